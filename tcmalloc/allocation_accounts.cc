@@ -0,0 +1,130 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/allocation_accounts.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+
+#include "absl/base/attributes.h"
+#include "absl/strings/str_cat.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/span.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+int AllocationAccounts::Index(uint64_t context) {
+  if (context == 0) {
+    return 0;
+  }
+  // Open addressing over the indices from 1, starting from a multiplicative
+  // hash of the context.
+  const uint64_t hash = context * 0x9e3779b97f4a7c15;
+  const int start = (hash >> 32) % kMaxAccounts;
+  for (int i = 0; i < kMaxAccounts; ++i) {
+    const int index = 1 + (start + i) % kMaxAccounts;
+    uint64_t current = contexts_[index].load(std::memory_order_acquire);
+    if (current == 0 &&
+        contexts_[index].compare_exchange_strong(current, context,
+                                                 std::memory_order_acq_rel)) {
+      return index;
+    }
+    if (current == context) {
+      return index;
+    }
+  }
+  unaccounted_charges_.fetch_add(1, std::memory_order_relaxed);
+  return 0;
+}
+
+void AllocationAccounts::ChargeLarge(uint64_t context, Span* span) {
+  const int index = Index(context);
+  if (index == 0) {
+    return;
+  }
+  large_bytes_[index].fetch_add(span->bytes_in_span(),
+                                std::memory_order_relaxed);
+  span->set_account(index);
+}
+
+void AllocationAccounts::CreditLarge(Span* span) {
+  const int index = span->account();
+  if (index == 0) {
+    return;
+  }
+  large_bytes_[index].fetch_sub(span->bytes_in_span(),
+                                std::memory_order_relaxed);
+  span->set_account(0);
+}
+
+size_t AllocationAccounts::ChargeSampled(const SampleInfo& sample) {
+  const int index = Index(sample.allocation_context);
+  if (index == 0) {
+    return 0;
+  }
+  // As for the heap profile: the sample stands for weight / requested_size
+  // allocations of allocated_size bytes.
+  const double allocation_estimate =
+      static_cast<double>(sample.weight) / (sample.requested_size + 1);
+  const size_t bytes = allocation_estimate * sample.allocated_size;
+  sampled_bytes_[index].fetch_add(bytes, std::memory_order_relaxed);
+  return bytes;
+}
+
+void AllocationAccounts::CreditSampled(uint64_t context, size_t bytes) {
+  // The account exists already, as it was charged.
+  const int index = Index(context);
+  if (index == 0) {
+    return;
+  }
+  sampled_bytes_[index].fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void AllocationAccounts::GetProperties(
+    std::map<std::string, MallocExtension::Property>* result) const {
+  for (int index = 1; index <= kMaxAccounts; ++index) {
+    const uint64_t context = contexts_[index].load(std::memory_order_acquire);
+    if (context == 0) {
+      continue;
+    }
+    // Charges and credits race, so an account may be briefly negative.
+    const int64_t large = large_bytes_[index].load(std::memory_order_relaxed);
+    const int64_t sampled =
+        sampled_bytes_[index].load(std::memory_order_relaxed);
+    const std::string prefix = absl::StrCat("tcmalloc.account.", context);
+    (*result)[absl::StrCat(prefix, ".large_bytes")].value =
+        large > 0 ? large : 0;
+    (*result)[absl::StrCat(prefix, ".sampled_bytes")].value =
+        sampled > 0 ? sampled : 0;
+  }
+  (*result)["tcmalloc.account.unaccounted_charges"].value =
+      unaccounted_charges();
+}
+
+AllocationAccounts& allocation_accounts() {
+  ABSL_CONST_INIT static AllocationAccounts accounts;
+  return accounts;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,96 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_ALLOCATION_ACCOUNTS_H_
+#define TCMALLOC_ALLOCATION_ACCOUNTS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/span.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Accounts the memory in use to the allocation context of the thread that
+// allocated it (see MallocExtension::SetAllocationContext), so that a process
+// serving many tenants can tell how much memory each holds, with
+// Parameters::allocation_accounting().
+//
+// Large allocations are charged exactly: the index of their account is kept
+// in their span (see Span::account), so that freeing them credits it.  Small
+// allocations are estimated from the sampled ones, which remember their
+// context anyway, in the same way as the heap profile.  Nothing is done on the
+// fast paths, so accounting costs next to nothing when disabled.
+//
+// Accounts are created on first use and never removed.  Once kMaxAccounts
+// contexts have been seen, the memory of any other is not accounted.
+class AllocationAccounts {
+ public:
+  static constexpr int kMaxAccounts = (1 << Span::kAccountBits) - 1;
+
+  constexpr AllocationAccounts() = default;
+
+  AllocationAccounts(const AllocationAccounts&) = delete;
+  AllocationAccounts& operator=(const AllocationAccounts&) = delete;
+
+  // Charges the large allocation of <span>, made by a thread with allocation
+  // context <context>, to its account.
+  void ChargeLarge(uint64_t context, Span* span);
+  // Credits the account charged for the large allocation of <span>, if any.
+  void CreditLarge(Span* span);
+
+  // Charges, or credits, the small sampled allocation of <sample> to the
+  // account of its allocation context, by the bytes it stands for.  Returns
+  // the bytes charged, to be passed to CreditSampled.
+  size_t ChargeSampled(const SampleInfo& sample);
+  void CreditSampled(uint64_t context, size_t bytes);
+
+  // Adds the accounts to <result> as tcmalloc.account.<context>.large_bytes
+  // and tcmalloc.account.<context>.sampled_bytes.
+  void GetProperties(
+      std::map<std::string, MallocExtension::Property>* result) const;
+
+  // The charges that no account could be created for.
+  int64_t unaccounted_charges() const {
+    return unaccounted_charges_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Returns the index of the account of <context>, creating it if needed, or
+  // 0 if there is none.
+  int Index(uint64_t context);
+
+  // Indexed by account; index 0 is unused, as it stands for no account.
+  std::atomic<uint64_t> contexts_[kMaxAccounts + 1] = {};
+  std::atomic<int64_t> large_bytes_[kMaxAccounts + 1] = {};
+  std::atomic<int64_t> sampled_bytes_[kMaxAccounts + 1] = {};
+  std::atomic<int64_t> unaccounted_charges_{0};
+};
+
+AllocationAccounts& allocation_accounts();
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_ALLOCATION_ACCOUNTS_H_
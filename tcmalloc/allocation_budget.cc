@@ -0,0 +1,82 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/allocation_budget.h"
+
+#include <stddef.h>
+
+#include <atomic>
+#include <utility>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/malloc_extension.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+struct ThreadBudget {
+  // 0 if the thread has no budget.
+  size_t budget;
+  size_t allocated;
+  // Whether the callback was called for the current budget.
+  bool exceeded;
+};
+
+ABSL_CONST_INIT thread_local ThreadBudget thread_budget
+    ABSL_ATTRIBUTE_INITIAL_EXEC = {0, 0, false};
+
+ABSL_CONST_INIT std::atomic<MallocExtension::AllocationBudgetCallback>
+    budget_callback{nullptr};
+
+}  // namespace
+
+void SetAllocationBudget(size_t bytes) { thread_budget = {bytes, 0, false}; }
+
+size_t AllocationBudgetUsage() { return thread_budget.allocated; }
+
+void SetAllocationBudgetCallback(
+    MallocExtension::AllocationBudgetCallback callback) {
+  budget_callback.store(callback, std::memory_order_release);
+}
+
+void SwapAllocationBudget(MallocExtension::AllocationTaskState& state) {
+  ThreadBudget& b = thread_budget;
+  std::swap(b.budget, state.budget);
+  std::swap(b.allocated, state.budget_usage);
+  std::swap(b.exceeded, state.budget_exceeded);
+}
+
+void ChargeAllocationBudget(size_t bytes) {
+  ThreadBudget& b = thread_budget;
+  if (ABSL_PREDICT_TRUE(b.budget == 0)) return;
+  b.allocated += bytes;
+  if (ABSL_PREDICT_TRUE(b.exceeded || b.allocated <= b.budget)) return;
+
+  // Mark the budget exceeded before calling out, so that the callback may
+  // allocate without being called again.
+  b.exceeded = true;
+  MallocExtension::AllocationBudgetCallback callback =
+      budget_callback.load(std::memory_order_acquire);
+  if (callback != nullptr) {
+    callback(b.allocated);
+  }
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
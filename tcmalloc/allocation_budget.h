@@ -0,0 +1,56 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_ALLOCATION_BUDGET_H_
+#define TCMALLOC_ALLOCATION_BUDGET_H_
+
+#include <stddef.h>
+
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/malloc_extension.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Per-thread allocation budgets, see MallocExtension::SetAllocationBudget.
+//
+// Allocations are not counted on the fast path: the sampler charges the bytes
+// allocated between two of its slow paths, as estimated from its byte
+// counter, when it takes one.  Budgets are therefore only as precise as the
+// sampling interval.
+
+// Sets the budget of the current thread to <bytes>, or disables it if 0, and
+// restarts counting its allocations.
+void SetAllocationBudget(size_t bytes);
+// Returns the bytes the current thread allocated since its budget was set.
+size_t AllocationBudgetUsage();
+
+void SetAllocationBudgetCallback(
+    MallocExtension::AllocationBudgetCallback callback);
+
+// Exchanges the budget of the current thread, and its usage, with those of
+// <state>.  See MallocExtension::SwapAllocationTaskState.
+void SwapAllocationBudget(MallocExtension::AllocationTaskState& state);
+
+// Charges <bytes> allocated by the current thread to its budget, and calls the
+// callback the first time the thread exceeds it.  Called by the sampler on its
+// slow path, without allocator locks held.
+void ChargeAllocationBudget(size_t bytes);
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_ALLOCATION_BUDGET_H_
@@ -54,5 +54,18 @@ Profile AllocationSample::Stop() && {
   return ProfileAccessor::MakeProfile(std::move(mallocs_));
 }
 
+HeapDeltaSample::HeapDeltaSample(HeapDeltaSampleList* list) : list_(list) {
+  changes_ = std::make_unique<StackTraceTable>(ProfileType::kHeap);
+  list->Add(this);
+}
+
+HeapDeltaSample::~HeapDeltaSample() { list_->Remove(this); }
+
+Profile HeapDeltaSample::Advance() {
+  // Allocate the next table outside of the list's lock.
+  return ProfileAccessor::MakeProfile(list_->Exchange(
+      this, std::make_unique<StackTraceTable>(ProfileType::kHeap)));
+}
+
 }  // namespace tcmalloc::tcmalloc_internal
 GOOGLE_MALLOC_SECTION_END
@@ -21,6 +21,7 @@
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/thread_annotations.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/malloc_extension.h"
@@ -86,6 +87,74 @@ class AllocationSampleList {
   AllocationSample* first_ ABSL_GUARDED_BY(lock_) = nullptr;
 };
 
+class HeapDeltaSampleList;
+
+// Records the samples allocated and freed between calls to Advance().
+class HeapDeltaSample final : public HeapProfileCursorBase {
+ public:
+  explicit HeapDeltaSample(HeapDeltaSampleList* list);
+  ~HeapDeltaSample() override;
+
+  Profile Advance() override;
+
+ private:
+  HeapDeltaSampleList* list_;
+  std::unique_ptr<StackTraceTable> changes_;
+  HeapDeltaSample* next_ = nullptr;
+  friend class HeapDeltaSampleList;
+};
+
+class HeapDeltaSampleList {
+ public:
+  constexpr HeapDeltaSampleList() = default;
+
+  void Add(HeapDeltaSample* hs) {
+    AllocationGuardSpinLockHolder h(&lock_);
+    hs->next_ = first_;
+    first_ = hs;
+  }
+
+  void Remove(HeapDeltaSample* hs) {
+    AllocationGuardSpinLockHolder h(&lock_);
+    HeapDeltaSample** link = &first_;
+    HeapDeltaSample* cur = first_;
+    while (cur != hs) {
+      TC_CHECK_NE(cur, nullptr);
+      link = &cur->next_;
+      cur = cur->next_;
+    }
+    *link = hs->next_;
+  }
+
+  // Replaces the changes recorded by <hs> with <changes>, returning them.
+  std::unique_ptr<StackTraceTable> Exchange(
+      HeapDeltaSample* hs, std::unique_ptr<StackTraceTable> changes) {
+    AllocationGuardSpinLockHolder h(&lock_);
+    hs->changes_.swap(changes);
+    return changes;
+  }
+
+  void ReportMalloc(const struct StackTrace& sample) {
+    AllocationGuardSpinLockHolder h(&lock_);
+    for (HeapDeltaSample* cur = first_; cur != nullptr; cur = cur->next_) {
+      cur->changes_->AddTrace(1.0, sample);
+    }
+  }
+
+  void ReportFree(const SampleInfo& sample, absl::Span<void* const> stack) {
+    AllocationGuardSpinLockHolder h(&lock_);
+    for (HeapDeltaSample* cur = first_; cur != nullptr; cur = cur->next_) {
+      cur->changes_->AddTrace(-1.0, sample, stack);
+    }
+  }
+
+ private:
+  // As AllocationSampleList::lock_.
+  absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  HeapDeltaSample* first_ ABSL_GUARDED_BY(lock_) = nullptr;
+};
+
 }  // namespace tcmalloc::tcmalloc_internal
 GOOGLE_MALLOC_SECTION_END
 
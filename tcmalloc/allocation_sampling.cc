@@ -14,31 +14,46 @@
 
 #include "tcmalloc/allocation_sampling.h"
 
+#include <sys/mman.h>
+
 #include <atomic>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <new>
 #include <optional>
-#include <utility>
+#include <type_traits>
 
 #include "absl/base/attributes.h"
+#include "absl/base/internal/cycleclock.h"
 #include "absl/base/optimization.h"
 #include "absl/debugging/stacktrace.h"
+#include "absl/functional/function_ref.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "absl/types/span.h"
+#include "tcmalloc/allocation_accounts.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/cpu_cache.h"
+#include "tcmalloc/dynamic_size_classes.h"
 #include "tcmalloc/guarded_allocations.h"
+#include "tcmalloc/huge_page_filler.h"
+#include "tcmalloc/huge_pages.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/exponential_biased.h"
+#include "tcmalloc/internal/fast_unwind.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/page_size.h"
 #include "tcmalloc/internal/sampled_allocation.h"
+#include "tcmalloc/large_density_predictor.h"
+#include "tcmalloc/locked_cpu_cache.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/pages.h"
 #include "tcmalloc/parameters.h"
+#include "tcmalloc/sampled_page_heap.h"
+#include "tcmalloc/sampler.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/stack_trace_table.h"
 #include "tcmalloc/tcmalloc_policy.h"
@@ -52,7 +67,7 @@ std::unique_ptr<const ProfileBase> DumpFragmentationProfile(Static& state) {
   state.sampled_allocation_recorder().Iterate(
       [&state, &profile](const SampledAllocation& sampled_allocation) {
         // Compute fragmentation to charge to this sample:
-        const StackTrace& t = sampled_allocation.sampled_stack;
+        const SampleInfo& t = sampled_allocation.sampled_stack;
         if (t.proxy == nullptr) {
           // There is just one object per-span, and neighboring spans
           // can be released back to the system, so we charge no
@@ -75,27 +90,179 @@ std::unique_ptr<const ProfileBase> DumpFragmentationProfile(Static& state) {
           // Associate the memory warmth with the actual object, not the proxy.
           // The residency information (t.span_start_address) is likely not very
           // useful, but we might as well pass it along.
-          profile->AddTrace(frag, t);
+          profile->AddTrace(frag, t, sampled_allocation.stack());
         }
       });
   return profile;
 }
 
+std::unique_ptr<const ProfileBase> DumpPinnedMemoryProfile(Static& state) {
+  auto profile = std::make_unique<StackTraceTable>(ProfileType::kPinnedMemory);
+  state.sampled_allocation_recorder().Iterate(
+      [&state, &profile](const SampledAllocation& sampled_allocation) {
+        const SampleInfo& t = sampled_allocation.sampled_stack;
+        if (t.proxy == nullptr) {
+          // As for DumpFragmentationProfile, the object lives on its own span
+          // in the sampled heap, so where its unsampled counterparts would
+          // have been placed is unknown.
+          return;
+        }
+
+        // As for DumpFragmentationProfile, the per-sample lock keeps the
+        // proxy, and thus its span, allocated.
+        const PageId p = PageIdContaining(t.proxy);
+        Span* span = state.pagemap().GetDescriptor(p);
+        if (span == nullptr) {
+          TC_ASSERT_NE(span, nullptr);
+          return;
+        }
+
+        const double frag = span->Fragmentation(t.allocated_size);
+        // Hugepages managed by a HugePageFiller map to their PageTracker; the
+        // pageheap_lock keeps it from being freed while we read it.
+        double hugepage_frag = 0;
+        {
+          PageHeapSpinLockHolder l;
+          const auto* tracker = static_cast<const PageTracker*>(
+              state.pagemap().GetHugepage(HugePageContaining(p).first_page()));
+          if (tracker != nullptr && tracker->used_pages() > Length(0)) {
+            const Length free_backed =
+                tracker->free_pages() - tracker->released_pages();
+            // The object, with its share of the span's free space, uses
+            // (1 + frag) objects worth of the hugepage's used pages.
+            hugepage_frag = (1 + frag) * free_backed.raw_num() /
+                            tracker->used_pages().raw_num();
+          }
+        }
+
+        if (frag + hugepage_frag > 0) {
+          profile->AddTrace(frag + hugepage_frag, t,
+                            sampled_allocation.stack());
+        }
+      });
+  return profile;
+}
+
+namespace {
+
+// A heap profile copied out of the sampled allocation recorder into memory
+// mapped directly from the OS.  Unlike adding a sample to a StackTraceTable,
+// copying it neither allocates nor takes the pageheap_lock, so the sample's
+// lock is only held for the copy and taking the snapshot leaves the heap it
+// measures alone.
+class HeapSnapshot final : public ProfileBase {
+ public:
+  HeapSnapshot() = default;
+  ~HeapSnapshot() override {
+    if (samples_ != nullptr) {
+      munmap(samples_, bytes_);
+    }
+  }
+
+  // Maps room for <capacity> samples.  Returns false if the mapping failed.
+  bool Reserve(size_t capacity) {
+    TC_ASSERT_EQ(samples_, nullptr);
+    const size_t page_size = GetPageSize();
+    bytes_ = (capacity * sizeof(Profile::Sample) + page_size - 1) &
+             ~(page_size - 1);
+    void* result = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (result == MAP_FAILED) {
+      bytes_ = 0;
+      return false;
+    }
+    samples_ = static_cast<Profile::Sample*>(result);
+    capacity_ = bytes_ / sizeof(Profile::Sample);
+    return true;
+  }
+
+  // Copies the sample, unless there is no room left for it.
+  void Add(const SampledAllocation& sampled_allocation) {
+    if (ABSL_PREDICT_FALSE(size_ == capacity_)) {
+      ++dropped_;
+      return;
+    }
+    StackTraceToSample(1.0, sampled_allocation.sampled_stack,
+                       sampled_allocation.stack(),
+                       *new (&samples_[size_++]) Profile::Sample());
+  }
+
+  void Iterate(
+      absl::FunctionRef<void(const Profile::Sample&)> f) const override {
+    for (size_t i = 0; i < size_; ++i) {
+      f(samples_[i]);
+    }
+  }
+
+  ProfileType Type() const override { return ProfileType::kHeap; }
+  absl::Duration Duration() const override { return absl::ZeroDuration(); }
+
+  size_t bytes() const { return bytes_; }
+  size_t dropped() const { return dropped_; }
+
+ private:
+  static_assert(std::is_trivially_destructible_v<Profile::Sample>);
+
+  Profile::Sample* samples_ = nullptr;
+  size_t capacity_ = 0;
+  size_t size_ = 0;
+  size_t dropped_ = 0;
+  size_t bytes_ = 0;
+};
+
+ABSL_CONST_INIT std::atomic<size_t> heap_snapshot_peak_bytes{0};
+ABSL_CONST_INIT std::atomic<size_t> heap_snapshot_dropped_samples{0};
+
+}  // namespace
+
 std::unique_ptr<const ProfileBase> DumpHeapProfile(Static& state) {
+  // Samples are only allocated when there are no dead ones to reuse, so a few
+  // more than there are now leaves room for those allocated while we copy.
+  const size_t num_samples = state.sampled_allocation_recorder().size();
+  auto snapshot = std::make_unique<HeapSnapshot>();
+  if (snapshot->Reserve(num_samples + num_samples / 8 + 16)) {
+    state.sampled_allocation_recorder().Iterate(
+        [&](const SampledAllocation& sampled_allocation) {
+          snapshot->Add(sampled_allocation);
+        });
+    size_t peak = heap_snapshot_peak_bytes.load(std::memory_order_relaxed);
+    while (peak < snapshot->bytes() &&
+           !heap_snapshot_peak_bytes.compare_exchange_weak(
+               peak, snapshot->bytes(), std::memory_order_relaxed)) {
+    }
+    heap_snapshot_dropped_samples.fetch_add(snapshot->dropped(),
+                                            std::memory_order_relaxed);
+    return snapshot;
+  }
+
   auto profile = std::make_unique<StackTraceTable>(ProfileType::kHeap);
   state.sampled_allocation_recorder().Iterate(
       [&](const SampledAllocation& sampled_allocation) {
-        profile->AddTrace(1.0, sampled_allocation.sampled_stack);
+        profile->AddTrace(1.0, sampled_allocation.sampled_stack,
+                          sampled_allocation.stack());
       });
   return profile;
 }
 
+ABSL_CONST_INIT thread_local uint64_t allocation_context
+    ABSL_ATTRIBUTE_INITIAL_EXEC = 0;
+
+size_t HeapSnapshotPeakBytes() {
+  return heap_snapshot_peak_bytes.load(std::memory_order_relaxed);
+}
+
+size_t HeapSnapshotDroppedSamples() {
+  return heap_snapshot_dropped_samples.load(std::memory_order_relaxed);
+}
+
 template <typename State>
 ABSL_ATTRIBUTE_NOINLINE static inline void FreeProxyObject(State& state,
                                                            void* ptr,
                                                            size_t size_class) {
   if (ABSL_PREDICT_TRUE(UsePerCpuCache(state))) {
     state.cpu_cache().Deallocate(ptr, size_class);
+  } else if (locked_cpu_cache().active()) {
+    locked_cpu_cache().Deallocate(ptr, size_class);
   } else if (ThreadCache* cache = ThreadCache::GetCacheIfPresent();
              ABSL_PREDICT_TRUE(cache)) {
     cache->Deallocate(ptr, size_class);
@@ -118,9 +285,10 @@ ABSL_ATTRIBUTE_NOINLINE static inline void FreeProxyObject(State& state,
 // For large objects (i.e. allocated with do_malloc_pages) they are
 // also fully reused and their span is marked as sampled.
 //
-// Note that do_free_with_size assumes sampled objects have
-// page-aligned addresses. Please change both functions if need to
-// invalidate the assumption.
+// With Parameters::compact_sampled_allocations(), small sampled objects
+// share pages of the sampled tag (see SampledPageHeap) rather than each
+// taking its own, so they are not page-aligned.  Their span is marked as
+// shared instead.
 //
 // Note that size_class might not match requested_size in case of
 // memalign. I.e. when larger than requested allocation is done to
@@ -136,11 +304,16 @@ sized_ptr_t SampleifyAllocation(Static& state, size_t requested_size,
   TC_CHECK((size_class != 0 && obj != nullptr && span == nullptr) ||
            (size_class == 0 && obj == nullptr && span != nullptr));
 
+  // Recording the sample counts against profile_sampling_cpu_budget.
+  const bool budgeted = Parameters::profile_sampling_cpu_budget() > 0;
+  const int64_t start_cycles =
+      budgeted ? absl::base_internal::CycleClock::Now() : 0;
+
   StackTrace stack_trace;
   stack_trace.proxy = nullptr;
   stack_trace.requested_size = requested_size;
   // Grab the stack trace outside the heap lock.
-  stack_trace.depth = absl::GetStackTrace(stack_trace.stack, kMaxStackDepth, 0);
+  stack_trace.depth = GetStackTrace(stack_trace.stack, kMaxStackDepth, 0);
 
   // requested_alignment = 1 means 'small size table alignment was used'
   // Historically this is reported as requested_alignment = 0
@@ -157,14 +330,27 @@ sized_ptr_t SampleifyAllocation(Static& state, size_t requested_size,
       nullptr, Profile::Sample::GuardedStatus::NotAttempted};
 
   size_t capacity = 0;
+  // The object, if it shares a page with other sampled objects.
+  void* shared = nullptr;
   if (size_class != 0) {
     TC_ASSERT_EQ(size_class,
                  state.pagemap().sizeclass(PageIdContainingTagged(obj)));
 
+    // Aligned allocations round up for their alignment, which a new size
+    // class would not help.
+    if (Parameters::dynamic_size_classes() &&
+        align <= static_cast<size_t>(kAlignment)) {
+      dynamic_size_classes().RecordSample(requested_size, weight);
+    }
+
     stack_trace.allocated_size = state.sizemap().class_to_size(size_class);
     stack_trace.cold_allocated = IsExpandedSizeClass(size_class);
 
     Length num_pages = BytesToLengthCeil(stack_trace.allocated_size);
+    const size_t slot_size =
+        Parameters::compact_sampled_allocations()
+            ? SampledPageHeap::SlotSize(stack_trace.allocated_size, align)
+            : 0;
     alloc_with_status = state.guardedpage_allocator().TrySample(
         requested_size, stack_trace.requested_alignment, num_pages,
         stack_trace);
@@ -184,6 +370,10 @@ sized_ptr_t SampleifyAllocation(Static& state, size_t requested_size,
         stack_trace.allocated_size = requested_size;
       }
       capacity = requested_size;
+    } else if (slot_size != 0 &&
+               (shared = sampled_page_heap().Alloc(slot_size, &span)) !=
+                   nullptr) {
+      capacity = stack_trace.allocated_size;
     } else if ((span = state.page_allocator().New(
                     num_pages, {1, AccessDensityPrediction::kSparse},
                     MemoryTag::kSampled)) == nullptr) {
@@ -223,6 +413,7 @@ sized_ptr_t SampleifyAllocation(Static& state, size_t requested_size,
       1;
   stack_trace.span_start_address = span->start_address();
   stack_trace.allocation_time = absl::Now();
+  stack_trace.allocation_context = allocation_context;
   stack_trace.guarded_status = static_cast<int>(alloc_with_status.status);
 
   // How many allocations does this sample represent, given the sampling
@@ -237,21 +428,43 @@ sized_ptr_t SampleifyAllocation(Static& state, size_t requested_size,
         allocation_estimate * (stack_trace.allocated_size - requested_size));
   }
 
+  // Large allocations are accounted exactly, by do_malloc_pages.
+  if (ABSL_PREDICT_FALSE(Parameters::allocation_accounting()) &&
+      size_class != 0) {
+    stack_trace.account_charged_bytes =
+        allocation_accounts().ChargeSampled(stack_trace);
+  }
+
   state.allocation_samples.ReportMalloc(stack_trace);
 
+  state.heap_delta_samples.ReportMalloc(stack_trace);
+
   state.deallocation_samples.ReportMalloc(stack_trace);
 
+  state.continuous_lifetimes.ReportMalloc(stack_trace);
+
   // The SampledAllocation object is visible to readers after this. Readers only
   // care about its various metadata (e.g. stack trace, weight) to generate the
   // heap profile, and won't need any information from Span::Sample() next.
   SampledAllocation* sampled_allocation =
-      state.sampled_allocation_recorder().Register(std::move(stack_trace));
-  // No pageheap_lock required. The span is freshly allocated and no one else
-  // can access it. It is visible after we return from this allocation path.
-  span->Sample(sampled_allocation);
+      state.sampled_allocation_recorder().Register(stack_trace,
+                                                   state.stack_depot());
+  // No pageheap_lock required. The span, or the slot of a shared page, is
+  // freshly allocated and no one else can access it. It is visible after we
+  // return from this allocation path.
+  if (shared != nullptr) {
+    SampledPageHeap::Sample(shared, span, sampled_allocation);
+  } else {
+    span->Sample(sampled_allocation);
+  }
 
   state.peak_heap_tracker().MaybeSaveSample();
 
+  if (budgeted) {
+    sampling_budget().RecordCost(absl::base_internal::CycleClock::Now() -
+                                 start_cycles);
+  }
+
   if (obj != nullptr) {
     // We are not maintaining precise statistics on malloc hit/miss rates at our
     // cache tiers.  We can deallocate into our ordinary cache.
@@ -259,9 +472,10 @@ sized_ptr_t SampleifyAllocation(Static& state, size_t requested_size,
     FreeProxyObject(state, obj, size_class);
   }
   TC_ASSERT_EQ(state.pagemap().sizeclass(span->first_page()), 0);
-  return {(alloc_with_status.alloc != nullptr) ? alloc_with_status.alloc
-                                               : span->start_address(),
-          capacity};
+  if (alloc_with_status.alloc != nullptr) {
+    return {alloc_with_status.alloc, capacity};
+  }
+  return {shared != nullptr ? shared : span->start_address(), capacity};
 }
 
 ABSL_ATTRIBUTE_NOINLINE
@@ -270,7 +484,7 @@ static void ReportMismatchedDelete(const SampledAllocation& alloc, size_t size,
                                    std::optional<size_t> allocated_size) {
   TC_LOG("*** GWP-ASan (https://google.github.io/tcmalloc/gwp-asan.html) has detected a memory error ***");
   TC_LOG("Error originates from memory allocated at:");
-  PrintStackTrace(alloc.sampled_stack.stack, alloc.sampled_stack.depth);
+  PrintStackTrace(alloc.stack().data(), alloc.stack().size());
 
   if (allocated_size.value_or(requested_size) != requested_size) {
     TC_LOG("Mismatched-size-delete of %v bytes (expected %v - %v bytes) at:",
@@ -292,7 +506,11 @@ void MaybeUnsampleAllocation(Static& state, void* ptr,
   // No pageheap_lock required. The sampled span should be unmarked and have its
   // state cleared only once. External synchronization when freeing is required;
   // otherwise, concurrent writes here would likely report a double-free.
-  if (SampledAllocation* sampled_allocation = span->Unsample()) {
+  SampledAllocation* sampled_allocation =
+      span->shared_sampled_page() != nullptr
+          ? SampledPageHeap::Unsample(ptr, span)
+          : span->Unsample();
+  if (sampled_allocation != nullptr) {
     TC_ASSERT_EQ(state.pagemap().sizeclass(PageIdContainingTagged(ptr)), 0);
 
     void* const proxy = sampled_allocation->sampled_stack.proxy;
@@ -325,6 +543,23 @@ void MaybeUnsampleAllocation(Static& state, void* ptr,
         static_cast<double>(weight) / (requested_size + 1);
     AllocHandle sampled_alloc_handle =
         sampled_allocation->sampled_stack.sampled_alloc_handle;
+    state.heap_delta_samples.ReportFree(sampled_allocation->sampled_stack,
+                                        sampled_allocation->stack());
+    if (sampled_allocation->sampled_stack.lifetime_profiled) {
+      state.continuous_lifetimes.ReportFree(sampled_allocation->sampled_stack,
+                                            sampled_allocation->depot_stack);
+    }
+    if (sampled_allocation->sampled_stack.account_charged_bytes != 0) {
+      allocation_accounts().CreditSampled(
+          sampled_allocation->sampled_stack.allocation_context,
+          sampled_allocation->sampled_stack.account_charged_bytes);
+    }
+    if (proxy == nullptr &&
+        Parameters::large_allocation_density_prediction()) {
+      large_density_predictor().Record(
+          BytesToLengthCeil(allocated_size),
+          absl::Now() - sampled_allocation->sampled_stack.allocation_time);
+    }
     state.sampled_allocation_recorder().Unregister(sampled_allocation);
 
     // Adjust our estimate of internal fragmentation.
@@ -42,11 +42,32 @@ class Static;
 // thus prevents the central free list to return the span to the page heap.
 std::unique_ptr<const ProfileBase> DumpFragmentationProfile(Static& state);
 
+// Like DumpFragmentationProfile, but also charges each span's share of the
+// free, backed pages of its hugepage to the objects on it: those pages cannot
+// be released as long as the span is in use.  Spans share the free pages of a
+// hugepage in proportion to their size.
+std::unique_ptr<const ProfileBase> DumpPinnedMemoryProfile(Static& state);
+
+// Returns a profile of the live sampled allocations.  The samples are copied
+// into memory mapped for the snapshot, holding each sample's lock only for the
+// copy and without allocating from TCMalloc.
 std::unique_ptr<const ProfileBase> DumpHeapProfile(Static& state);
 
+// The largest amount of memory mapped for a heap profile snapshot so far.
+size_t HeapSnapshotPeakBytes();
+
+// The number of samples left out of heap profile snapshots because they were
+// allocated while the snapshot was taken and did not fit.
+size_t HeapSnapshotDroppedSamples();
+
 extern "C" ABSL_CONST_INIT thread_local Sampler tcmalloc_sampler
     ABSL_ATTRIBUTE_INITIAL_EXEC;
 
+// The allocation context of the current thread, recorded with its sampled
+// allocations.  See MallocExtension::SetAllocationContext.
+extern ABSL_CONST_INIT thread_local uint64_t allocation_context
+    ABSL_ATTRIBUTE_INITIAL_EXEC;
+
 // Compiler needs to see definition of this variable to generate more
 // efficient code for -fPIE/PIC. If the compiler does not see the definition
 // it considers it may come from another dynamic library. So even for
@@ -0,0 +1,100 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/allocation_trace.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <new>
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/types/span.h"
+#include "tcmalloc/arena.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+ABSL_CONST_INIT std::atomic<uint32_t> AllocationTraceRecorder::next_thread_{1};
+ABSL_CONST_INIT thread_local uint32_t AllocationTraceRecorder::thread_id_
+    ABSL_ATTRIBUTE_INITIAL_EXEC = 0;
+
+AllocationTraceRecorder& allocation_trace() {
+  ABSL_CONST_INIT static AllocationTraceRecorder recorder;
+  return recorder;
+}
+
+void AllocationTraceRecorder::Init(Arena* arena, int num_rings) {
+  TC_CHECK_GT(num_rings, 0);
+  TC_CHECK_EQ(rings_.load(std::memory_order_relaxed), nullptr);
+  Ring* rings = static_cast<Ring*>(arena->Alloc(
+      sizeof(Ring) * num_rings, std::align_val_t{ABSL_CACHELINE_SIZE}));
+  for (int i = 0; i < num_rings; ++i) {
+    new (&rings[i]) Ring();
+  }
+  num_rings_ = num_rings;
+  rings_.store(rings, std::memory_order_release);
+}
+
+size_t AllocationTraceRecorder::Drain(absl::Span<Event> out,
+                                      uint64_t* dropped) {
+  Ring* rings = rings_.load(std::memory_order_acquire);
+  if (rings == nullptr) return 0;
+
+  absl::base_internal::SpinLockHolder h(&drain_lock_);
+  size_t n = 0;
+  for (int r = 0; r < num_rings_ && n < out.size(); ++r) {
+    Ring& ring = rings[r];
+    const uint64_t head = ring.head.load(std::memory_order_acquire);
+    if (head - ring.tail > kEventsPerRing) {
+      *dropped += head - kEventsPerRing - ring.tail;
+      ring.tail = head - kEventsPerRing;
+    }
+    for (; ring.tail < head && n < out.size(); ++ring.tail) {
+      const Slot& slot = ring.slots[ring.tail % kEventsPerRing];
+      const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+      if (seq < ring.tail + 1) {
+        // The event is still being written: pick it up on the next Drain.
+        break;
+      }
+      Event e;
+      e.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+      e.address_hash = slot.address_hash.load(std::memory_order_relaxed);
+      e.size = slot.size.load(std::memory_order_relaxed);
+      const uint64_t thread_and_kind =
+          slot.thread_and_kind.load(std::memory_order_relaxed);
+      e.thread = static_cast<uint32_t>(thread_and_kind >> 8);
+      e.kind = static_cast<Event::Kind>(thread_and_kind & 0xff);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq != ring.tail + 1 ||
+          slot.seq.load(std::memory_order_relaxed) != seq) {
+        // A later event has reused the slot.
+        ++*dropped;
+        continue;
+      }
+      out[n++] = e;
+    }
+  }
+  return n;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
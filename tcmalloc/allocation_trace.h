@@ -0,0 +1,157 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_ALLOCATION_TRACE_H_
+#define TCMALLOC_ALLOCATION_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/attributes.h"
+#include "absl/base/const_init.h"
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/types/span.h"
+#include "tcmalloc/arena.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/malloc_tracing_extension.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Building with TCMALLOC_INTERNAL_ALLOCATION_TRACE records every allocation
+// and deallocation into allocation_trace().
+#ifdef TCMALLOC_INTERNAL_ALLOCATION_TRACE
+inline constexpr bool kAllocationTrace = true;
+#else
+inline constexpr bool kAllocationTrace = false;
+#endif
+
+// Records allocation events into a ring buffer per CPU, for
+// MallocTracingExtension::DrainAllocationTrace.  Recording claims a slot with
+// a single atomic increment on the current CPU's ring and never blocks; when
+// the rings are not drained quickly enough, the oldest events are overwritten
+// and counted as dropped.
+class AllocationTraceRecorder {
+ public:
+  using Event = malloc_tracing_extension::AllocationTraceEvent;
+
+  static constexpr size_t kEventsPerRing = 1 << 14;
+
+  constexpr AllocationTraceRecorder() = default;
+
+  // Allocates <num_rings> rings.  Nothing is recorded before this has run.
+  void Init(Arena* arena, int num_rings)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // An invertible mix of the bits of <ptr>, so that distinct live objects
+  // never share a hash.
+  static uint64_t HashAddress(const void* ptr) {
+    uint64_t h = reinterpret_cast<uintptr_t>(ptr);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  void Record(Event::Kind kind, const void* ptr, size_t size);
+
+  // Copies up to out.size() of the events recorded since the last Drain into
+  // <out>, ring after ring, and returns how many were copied.  Events that
+  // were overwritten before being copied are added to <*dropped>.
+  size_t Drain(absl::Span<Event> out, uint64_t* dropped)
+      ABSL_LOCKS_EXCLUDED(drain_lock_);
+
+  // The most events that can be pending at once.
+  size_t capacity() const { return num_rings_ * kEventsPerRing; }
+
+ private:
+  // A seqlock per slot: <seq> is 0 while the slot is being written and the
+  // slot's index in the ring plus one once it holds that event.
+  struct Slot {
+    std::atomic<uint64_t> seq;
+    std::atomic<int64_t> timestamp;
+    std::atomic<uint64_t> address_hash;
+    std::atomic<uint64_t> size;
+    // The thread in the upper bits, the kind in the lowest byte.
+    std::atomic<uint64_t> thread_and_kind;
+  };
+
+  struct ABSL_CACHELINE_ALIGNED Ring {
+    // The number of slots ever claimed.
+    std::atomic<uint64_t> head{0};
+    // The number of slots drained or dropped.  Guarded by drain_lock_.
+    uint64_t tail = 0;
+    Slot slots[kEventsPerRing] = {};
+  };
+
+  static uint32_t ThreadId();
+
+  std::atomic<Ring*> rings_{nullptr};
+  int num_rings_ = 0;
+  absl::base_internal::SpinLock drain_lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+
+  // Threads are numbered process-wide, not per recorder.
+  ABSL_CONST_INIT static std::atomic<uint32_t> next_thread_;
+  ABSL_CONST_INIT static thread_local uint32_t thread_id_
+      ABSL_ATTRIBUTE_INITIAL_EXEC;
+};
+
+AllocationTraceRecorder& allocation_trace();
+
+inline uint32_t AllocationTraceRecorder::ThreadId() {
+  uint32_t id = thread_id_;
+  if (ABSL_PREDICT_FALSE(id == 0)) {
+    id = next_thread_.fetch_add(1, std::memory_order_relaxed);
+    thread_id_ = id;
+  }
+  return id;
+}
+
+inline void AllocationTraceRecorder::Record(Event::Kind kind, const void* ptr,
+                                            size_t size) {
+  Ring* rings = rings_.load(std::memory_order_acquire);
+  if (ABSL_PREDICT_FALSE(rings == nullptr)) return;
+  // Threads that have not registered with rseq report a negative CPU, and all
+  // share one ring.
+  const unsigned cpu =
+      static_cast<unsigned>(subtle::percpu::GetRealCpuUnsafe()) % num_rings_;
+  Ring& ring = rings[cpu];
+  const uint64_t index = ring.head.fetch_add(1, std::memory_order_relaxed);
+  Slot& slot = ring.slots[index % kEventsPerRing];
+  slot.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.timestamp.store(absl::base_internal::CycleClock::Now(),
+                       std::memory_order_relaxed);
+  slot.address_hash.store(HashAddress(ptr), std::memory_order_relaxed);
+  slot.size.store(size, std::memory_order_relaxed);
+  slot.thread_and_kind.store(
+      uint64_t{ThreadId()} << 8 | static_cast<uint8_t>(kind),
+      std::memory_order_relaxed);
+  slot.seq.store(index + 1, std::memory_order_release);
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_ALLOCATION_TRACE_H_
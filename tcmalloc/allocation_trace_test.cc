@@ -0,0 +1,188 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/allocation_trace.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/types/span.h"
+#include "tcmalloc/arena.h"
+#include "tcmalloc/common.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+using Event = AllocationTraceRecorder::Event;
+using Kind = Event::Kind;
+
+class AllocationTraceTest : public ::testing::Test {
+ protected:
+  void Init(int num_rings) {
+    PageHeapSpinLockHolder l;
+    recorder_.Init(&arena_, num_rings);
+  }
+
+  std::vector<Event> Drain(size_t max_events, uint64_t* dropped) {
+    std::vector<Event> events(max_events);
+    events.resize(recorder_.Drain(absl::MakeSpan(events), dropped));
+    return events;
+  }
+
+  Arena arena_;
+  AllocationTraceRecorder recorder_;
+};
+
+TEST_F(AllocationTraceTest, NothingBeforeInit) {
+  int object;
+  recorder_.Record(Kind::kAllocation, &object, sizeof(object));
+  uint64_t dropped = 0;
+  EXPECT_THAT(Drain(16, &dropped), testing::IsEmpty());
+  EXPECT_EQ(dropped, 0);
+}
+
+TEST_F(AllocationTraceTest, RecordsEvents) {
+  Init(1);
+  int a, b;
+  recorder_.Record(Kind::kAllocation, &a, 12);
+  recorder_.Record(Kind::kAllocation, &b, 34);
+  recorder_.Record(Kind::kDeallocation, &a, 0);
+
+  uint64_t dropped = 0;
+  std::vector<Event> events = Drain(16, &dropped);
+  EXPECT_EQ(dropped, 0);
+  ASSERT_EQ(events.size(), 3);
+  EXPECT_EQ(events[0].kind, Kind::kAllocation);
+  EXPECT_EQ(events[0].address_hash, AllocationTraceRecorder::HashAddress(&a));
+  EXPECT_EQ(events[0].size, 12);
+  EXPECT_EQ(events[1].kind, Kind::kAllocation);
+  EXPECT_EQ(events[1].address_hash, AllocationTraceRecorder::HashAddress(&b));
+  EXPECT_EQ(events[1].size, 34);
+  EXPECT_EQ(events[2].kind, Kind::kDeallocation);
+  EXPECT_EQ(events[2].address_hash, AllocationTraceRecorder::HashAddress(&a));
+  EXPECT_EQ(events[2].size, 0);
+  EXPECT_LE(events[0].timestamp, events[1].timestamp);
+  EXPECT_LE(events[1].timestamp, events[2].timestamp);
+  EXPECT_NE(events[0].thread, 0);
+  EXPECT_EQ(events[0].thread, events[2].thread);
+
+  // Drained events are not returned again.
+  EXPECT_THAT(Drain(16, &dropped), testing::IsEmpty());
+}
+
+TEST_F(AllocationTraceTest, DrainsInPieces) {
+  Init(1);
+  int object;
+  for (size_t i = 0; i < 10; ++i) {
+    recorder_.Record(Kind::kAllocation, &object, i);
+  }
+  uint64_t dropped = 0;
+  std::vector<Event> first = Drain(4, &dropped);
+  std::vector<Event> rest = Drain(16, &dropped);
+  EXPECT_EQ(dropped, 0);
+  ASSERT_EQ(first.size(), 4);
+  ASSERT_EQ(rest.size(), 6);
+  EXPECT_EQ(first[0].size, 0);
+  EXPECT_EQ(rest[0].size, 4);
+  EXPECT_EQ(rest[5].size, 9);
+}
+
+TEST_F(AllocationTraceTest, CountsOverwrittenEvents) {
+  Init(1);
+  constexpr size_t kOverflow = 100;
+  int object;
+  for (size_t i = 0; i < AllocationTraceRecorder::kEventsPerRing + kOverflow;
+       ++i) {
+    recorder_.Record(Kind::kAllocation, &object, i);
+  }
+  uint64_t dropped = 0;
+  std::vector<Event> events = Drain(recorder_.capacity(), &dropped);
+  EXPECT_EQ(dropped, kOverflow);
+  ASSERT_EQ(events.size(), AllocationTraceRecorder::kEventsPerRing);
+  EXPECT_EQ(events.front().size, kOverflow);
+}
+
+TEST_F(AllocationTraceTest, ThreadsAreNumbered) {
+  Init(4);
+  int object;
+  recorder_.Record(Kind::kAllocation, &object, 1);
+  std::thread t(
+      [&]() { recorder_.Record(Kind::kDeallocation, &object, 0); });
+  t.join();
+
+  uint64_t dropped = 0;
+  std::vector<Event> events = Drain(recorder_.capacity(), &dropped);
+  ASSERT_EQ(events.size(), 2);
+  EXPECT_NE(events[0].thread, events[1].thread);
+  EXPECT_NE(events[0].thread, 0);
+  EXPECT_NE(events[1].thread, 0);
+}
+
+// Every event is either drained or counted as dropped, even while threads
+// race the drain and each other for slots.
+TEST_F(AllocationTraceTest, ConcurrentRecordAndDrain) {
+  Init(2);
+  constexpr int kThreads = 4;
+  constexpr size_t kEventsPerThread = 200000;
+  std::atomic<int> running{kThreads};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&, i]() {
+      for (size_t j = 0; j < kEventsPerThread; ++j) {
+        recorder_.Record(Kind::kAllocation, &threads, i);
+      }
+      running.fetch_sub(1);
+    });
+  }
+
+  uint64_t drained = 0;
+  uint64_t dropped = 0;
+  bool done = false;
+  while (!done) {
+    done = running.load() == 0;
+    for (const Event& e : Drain(recorder_.capacity(), &dropped)) {
+      ASSERT_EQ(e.kind, Kind::kAllocation);
+      ASSERT_LT(e.size, kThreads);
+      ASSERT_EQ(e.address_hash, AllocationTraceRecorder::HashAddress(&threads));
+      ++drained;
+    }
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  drained += Drain(recorder_.capacity(), &dropped).size();
+  EXPECT_EQ(drained + dropped, kThreads * kEventsPerThread);
+}
+
+TEST(AllocationTraceHashTest, Distinct) {
+  absl::flat_hash_set<uint64_t> hashes;
+  constexpr uintptr_t kBase = uintptr_t{1} << 40;
+  for (uintptr_t i = 0; i < 100000; ++i) {
+    hashes.insert(AllocationTraceRecorder::HashAddress(
+        reinterpret_cast<void*>(kBase + i * 16)));
+  }
+  EXPECT_EQ(hashes.size(), 100000);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -14,6 +14,7 @@
 
 #include "tcmalloc/arena.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <new>
@@ -22,6 +23,7 @@
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/system-alloc.h"
 
@@ -32,17 +34,21 @@ namespace tcmalloc_internal {
 void* Arena::Alloc(size_t bytes, std::align_val_t alignment) {
   size_t align = static_cast<size_t>(alignment);
   TC_ASSERT_GT(align, 0);
-  {  // First we need to move up to the correct alignment.
-    const int misalignment = reinterpret_cast<uintptr_t>(free_area_) % align;
-    const int alignment_bytes = misalignment != 0 ? align - misalignment : 0;
-    free_area_ += alignment_bytes;
-    free_avail_ -= alignment_bytes;
-    bytes_allocated_ += alignment_bytes;
+  // First we need to move up to the correct alignment.
+  const size_t misalignment = reinterpret_cast<uintptr_t>(free_area_) % align;
+  size_t alignment_bytes = misalignment != 0 ? align - misalignment : 0;
+  if (free_avail_ < alignment_bytes + bytes && ReuseRange(bytes, align)) {
+    // Released ranges start on a page, which satisfies <align>.
+    alignment_bytes = 0;
   }
   char* result;
-  if (free_avail_ < bytes) {
+  if (free_avail_ < alignment_bytes + bytes) {
     size_t ask = bytes > kAllocIncrement ? bytes : kAllocIncrement;
-    auto [ptr, actual_size] = SystemAlloc(ask, kPageSize, MemoryTag::kMetadata);
+    // Alignments above the system page size (e.g. hugepage-aligned per-CPU
+    // slabs) have to come from the system allocator, since the fresh area
+    // replaces the current one rather than being padded into alignment.
+    auto [ptr, actual_size] = SystemAlloc(
+        ask, std::max<size_t>(kPageSize, align), MemoryTag::kMetadata);
     free_area_ = reinterpret_cast<char*>(ptr);
     if (ABSL_PREDICT_FALSE(free_area_ == nullptr)) {
       TC_BUG(
@@ -51,6 +57,13 @@ void* Arena::Alloc(size_t bytes, std::align_val_t alignment) {
           "succeeding (sandbox, VSS limitations)?",
           kAllocIncrement, bytes);
     }
+    if (numa_partition_ >= 0) {
+      SystemBindNumaPartition(free_area_, actual_size, numa_partition_);
+    }
+    if (Parameters::metadata_hugepages() &&
+        bytes_allocated_ >= kHugepageThreshold) {
+      bytes_hugepage_ += SystemAdviseHugepages(free_area_, actual_size);
+    }
     SystemBack(free_area_, actual_size);
 
     // We've discarded the previous free_area_, so any bytes that were
@@ -59,6 +72,10 @@ void* Arena::Alloc(size_t bytes, std::align_val_t alignment) {
     blocks_++;
 
     free_avail_ = actual_size;
+  } else {
+    free_area_ += alignment_bytes;
+    free_avail_ -= alignment_bytes;
+    bytes_allocated_ += alignment_bytes;
   }
 
   TC_ASSERT_EQ(reinterpret_cast<uintptr_t>(free_area_) % align, 0);
@@ -69,6 +86,64 @@ void* Arena::Alloc(size_t bytes, std::align_val_t alignment) {
   return reinterpret_cast<void*>(result);
 }
 
+bool Arena::ReleasePages(void* start, size_t bytes, size_t lost) {
+  TC_ASSERT_EQ(reinterpret_cast<uintptr_t>(start) % kPageSize, 0);
+  TC_ASSERT_EQ(bytes % kPageSize, 0);
+  TC_ASSERT_GT(bytes, 0);
+  char* const p = static_cast<char*>(start);
+  // Ranges given back together are often adjacent, e.g. runs of spans freed
+  // after a peak, so extend a tracked range when possible.
+  ReusableRange* range = nullptr;
+  for (int i = 0; i < num_reusable_; ++i) {
+    if (reusable_[i].start + reusable_[i].bytes == p ||
+        p + bytes == reusable_[i].start) {
+      range = &reusable_[i];
+      break;
+    }
+  }
+  if (range == nullptr && num_reusable_ == kMaxReusableRanges) {
+    return false;
+  }
+  if (!SystemRelease(start, bytes)) {
+    return false;
+  }
+  if (range == nullptr) {
+    range = &reusable_[num_reusable_++];
+    *range = {p, bytes};
+  } else {
+    range->start = std::min(range->start, p);
+    range->bytes += bytes;
+  }
+
+  TC_ASSERT_GE(bytes_allocated_, bytes + lost);
+  bytes_allocated_ -= bytes + lost;
+  bytes_unavailable_ += lost;
+  bytes_nonresident_ += bytes;
+  bytes_reusable_ += bytes;
+  return true;
+}
+
+bool Arena::ReuseRange(size_t bytes, size_t align) {
+  // Released ranges are only aligned to pages.
+  if (align > kPageSize) return false;
+  for (int i = 0; i < num_reusable_; ++i) {
+    const ReusableRange range = reusable_[i];
+    if (range.bytes < bytes) continue;
+    reusable_[i] = reusable_[--num_reusable_];
+    bytes_reusable_ -= range.bytes;
+    bytes_nonresident_ -= range.bytes;
+    SystemBack(range.start, range.bytes);
+
+    // As when growing the arena, the bytes left in the previous free area
+    // become unavailable.
+    bytes_unavailable_ += free_avail_;
+    free_area_ = range.start;
+    free_avail_ = range.bytes;
+    return true;
+  }
+  return false;
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
@@ -42,13 +42,20 @@ struct ArenaStats {
   // e.g. due to the slab being resized. Note that these bytes are disjoint from
   // the ones counted in `bytes_allocated`.
   size_t bytes_nonresident;
+  // The number of bytes of blocks advised to be backed by hugepages.
+  size_t bytes_hugepage;
+  // The non-resident bytes that were given back with ReleasePages and that
+  // Alloc() reuses before growing the arena.  These are a subset of
+  // `bytes_nonresident`.
+  size_t bytes_reusable;
 
   // The number of blocks allocated by the Arena.
   size_t blocks;
 };
 
 // Arena allocation; designed for use by tcmalloc internal data structures like
-// spans, profiles, etc.  Always expands.
+// spans, profiles, etc.  Expands as needed; pages of metadata that is no longer
+// used may be given back, and are then reused before the arena grows again.
 class Arena {
  public:
   constexpr Arena() {}
@@ -59,6 +66,14 @@ class Arena {
       size_t bytes, std::align_val_t alignment = kAlignment)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Returns the pages [start, start + bytes), which were allocated from this
+  // arena and are no longer in use, to the OS.  Later calls to Alloc() reuse
+  // them, for objects of any type.  <lost> more allocated bytes around them
+  // become unavailable.  Returns false, with nothing released, if the pages
+  // cannot be tracked for reuse or the OS refuses.
+  bool ReleasePages(void* start, size_t bytes, size_t lost)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   // Updates the stats for allocated and non-resident bytes.
   void UpdateAllocatedAndNonresident(int64_t allocated, int64_t nonresident)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
@@ -75,13 +90,37 @@ class Arena {
     s.bytes_unallocated = free_avail_;
     s.bytes_unavailable = bytes_unavailable_;
     s.bytes_nonresident = bytes_nonresident_;
+    s.bytes_hugepage = bytes_hugepage_;
+    s.bytes_reusable = bytes_reusable_;
     s.blocks = blocks_;
     return s;
   }
 
+  // Binds the blocks allocated from now on to the NUMA nodes of <partition>,
+  // so that metadata describing that partition's memory is local to it.
+  void BindToNumaPartition(size_t partition)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    numa_partition_ = partition;
+  }
+
  private:
   // How much to allocate from system at a time
   static constexpr int kAllocIncrement = 128 << 10;
+  // Blocks are only backed by hugepages once this many bytes are allocated,
+  // so that small heaps do not pay a hugepage of RSS per block.
+  static constexpr size_t kHugepageThreshold = 4 * kHugePageSize;
+  // How many ranges given back with ReleasePages are tracked for reuse.
+  static constexpr int kMaxReusableRanges = 1024;
+
+  struct ReusableRange {
+    char* start;
+    size_t bytes;
+  };
+
+  // Makes a reusable range of at least <bytes> the free area, if there is
+  // one.
+  bool ReuseRange(size_t bytes, size_t align)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   // Free area from which to carve new objects
   char* free_area_ ABSL_GUARDED_BY(pageheap_lock) = nullptr;
@@ -95,8 +134,18 @@ class Arena {
   // The number of bytes on the arena that have been MADV_DONTNEEDed away. Note
   // that these bytes are disjoint from the ones counted in `bytes_allocated`.
   size_t bytes_nonresident_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+  // The number of bytes of blocks advised to be backed by hugepages.
+  size_t bytes_hugepage_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+  // The ranges given back with ReleasePages that are not reused yet.
+  ReusableRange reusable_[kMaxReusableRanges] ABSL_GUARDED_BY(pageheap_lock) =
+      {};
+  int num_reusable_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+  size_t bytes_reusable_ ABSL_GUARDED_BY(pageheap_lock) = 0;
   // Total number of blocks/free areas managed by this Arena.
   size_t blocks_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+  // The NUMA partition new blocks are bound to, or -1 if they are left
+  // unbound.
+  int numa_partition_ ABSL_GUARDED_BY(pageheap_lock) = -1;
 
   Arena(const Arena&) = delete;
   Arena& operator=(const Arena&) = delete;
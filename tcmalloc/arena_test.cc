@@ -41,6 +41,11 @@ TEST(Arena, AlignedAlloc) {
                   alignment,
               0);
   }
+  // Alignments larger than the system page size force a fresh, suitably
+  // aligned block rather than padding the current one.
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(arena.Alloc(7, Align(kHugePageSize))) %
+                kHugePageSize,
+            0);
 }
 
 TEST(Arena, Stats) {
@@ -155,6 +160,45 @@ TEST(Arena, BytesImpending) {
   EXPECT_EQ(stats.bytes_allocated, 100);
 }
 
+TEST(Arena, HugepageBlocks) {
+  Arena arena;
+  PageHeapSpinLockHolder l;
+
+  // Blocks carved before the arena holds a few hugepages of metadata stay on
+  // small pages.
+  while (arena.stats().bytes_allocated < 4 * kHugePageSize) {
+    arena.Alloc(kHugePageSize);
+  }
+  EXPECT_EQ(arena.stats().bytes_hugepage, 0);
+
+  // Later ones may be backed by hugepages, if the kernel supports them.
+  arena.Alloc(kHugePageSize);
+  EXPECT_LE(arena.stats().bytes_hugepage, kHugePageSize);
+}
+
+TEST(Arena, ReusesReleasedPages) {
+  Arena arena;
+  PageHeapSpinLockHolder l;
+
+  char* ptr = static_cast<char*>(arena.Alloc(4 * kPageSize, Align(kPageSize)));
+  const ArenaStats before = arena.stats();
+  ASSERT_TRUE(arena.ReleasePages(ptr + kPageSize, 2 * kPageSize, 16));
+  ArenaStats stats = arena.stats();
+  EXPECT_EQ(stats.bytes_allocated, before.bytes_allocated - 2 * kPageSize - 16);
+  EXPECT_EQ(stats.bytes_unavailable, before.bytes_unavailable + 16);
+  EXPECT_EQ(stats.bytes_nonresident, before.bytes_nonresident + 2 * kPageSize);
+  EXPECT_EQ(stats.bytes_reusable, 2 * kPageSize);
+
+  // Once the free area is used up, the released pages come next.
+  arena.Alloc(stats.bytes_unallocated, Align(1));
+  EXPECT_EQ(arena.Alloc(kPageSize), ptr + kPageSize);
+  stats = arena.stats();
+  EXPECT_EQ(stats.bytes_reusable, 0);
+  EXPECT_EQ(stats.bytes_nonresident, before.bytes_nonresident);
+  EXPECT_EQ(stats.bytes_unallocated, kPageSize);
+  EXPECT_EQ(stats.blocks, before.blocks);
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
@@ -14,21 +14,145 @@
 
 
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
 
+#include "absl/base/attributes.h"
+#include "absl/base/internal/cycleclock.h"
+#include "absl/numeric/bits.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "tcmalloc/cpu_cache.h"
+#include "tcmalloc/dynamic_size_classes.h"
+#include "tcmalloc/global_stats.h"
+#include "tcmalloc/huge_pages.h"
+#include "tcmalloc/internal/background_wakeup.h"
+#include "tcmalloc/internal/cache_topology.h"
+#include "tcmalloc/internal/cpu_utils.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/internal/sysinfo.h"
 #include "tcmalloc/internal_malloc_extension.h"
+#include "tcmalloc/locked_cpu_cache.h"
 #include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/memory_pressure.h"
+#include "tcmalloc/parameter_control.h"
 #include "tcmalloc/parameters.h"
+#include "tcmalloc/pending_reservations.h"
+#include "tcmalloc/reclaim_notifier.h"
+#include "tcmalloc/release_requests.h"
+#include "tcmalloc/sampler.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/stats.h"
+#include "tcmalloc/thread_cache.h"
+#include "tcmalloc/transfer_cache.h"
 
-// Release memory to the system at a constant rate.
+namespace {
+
+// Returns the factor to scale the background release rate by under the
+// memory pressure reported by PSI.
+double PressureReleaseMultiplier() {
+  // Stall time, in percent of the last 10 seconds, at which memory is released
+  // at the configured rate.
+  constexpr double kNominalStallPercent = 1.0;
+  constexpr double kMaxMultiplier = 16.0;
+
+  std::optional<tcmalloc::tcmalloc_internal::MemoryPressure> pressure =
+      tcmalloc::tcmalloc_internal::ReadMemoryPressure();
+  if (!pressure.has_value()) {
+    return 1.0;
+  }
+  return std::min(pressure->some_avg10 / kNominalStallPercent, kMaxMultiplier);
+}
+
+// The NUMA partitions processed by ProcessNumaPartitionBackgroundActions, with
+// bit p set for partition p.
+ABSL_CONST_INIT std::atomic<uint64_t> numa_partition_workers{0};
+
+// Returns the number of bytes to release over [prev_time, now) at <share> of
+// the background release rate.
+size_t BytesToRelease(absl::Time prev_time, absl::Time now, double share) {
+  using ::tcmalloc::tcmalloc_internal::Parameters;
+
+  double release_rate =
+      static_cast<size_t>(Parameters::background_release_rate());
+  if (Parameters::pressure_based_release()) {
+    release_rate *= PressureReleaseMultiplier();
+  }
+  // If time goes backwards, we would like to cap the release rate at 0.
+  ssize_t bytes_to_release =
+      share * release_rate * absl::ToDoubleSeconds(now - prev_time);
+  return std::max<ssize_t>(bytes_to_release, 0);
+}
+
+#ifndef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
+// Returns how to plunder the transfer caches with
+// transfer_cache_plunder_interval set, or nullopt to plunder them once per
+// call, at the background thread's cadence.
+std::optional<tcmalloc::tcmalloc_internal::internal_transfer_cache::PlunderPolicy>
+TransferCachePlunderPolicy() {
+  // Batches a cache returns per call, so that a cache that was left full does
+  // not hold its lock, or the background thread, for long.
+  constexpr int kMaxBatchesPerPlunder = 8;
+
+  const absl::Duration interval =
+      tcmalloc::tcmalloc_internal::Parameters::transfer_cache_plunder_interval();
+  if (interval <= absl::ZeroDuration()) {
+    return std::nullopt;
+  }
+  return tcmalloc::tcmalloc_internal::internal_transfer_cache::PlunderPolicy{
+      .now = absl::base_internal::CycleClock::Now(),
+      .idle = static_cast<int64_t>(
+          absl::ToDoubleSeconds(interval) *
+          absl::base_internal::CycleClock::Frequency()),
+      .max_batches = kMaxBatchesPerPlunder,
+  };
+}
+#endif
+
+// Plunders the sharded transfer cache shards, i.e. the L3 cache domains, of the
+// CPUs in NUMA <partitions>.
+void PlunderShardedTransferCache(uint64_t partitions) {
+  using ::tcmalloc::tcmalloc_internal::CacheTopology;
+  using ::tcmalloc::tcmalloc_internal::NumCPUs;
+  using ::tcmalloc::tcmalloc_internal::tc_globals;
+
+  const CacheTopology& cache_topology = CacheTopology::Instance();
+  const int num_cpus = NumCPUs();
+  auto should_plunder = [&](int shard) {
+    // An L3 cache domain does not span NUMA nodes, so any of its CPUs
+    // determines its partition.
+    for (int cpu = 0; cpu < num_cpus; ++cpu) {
+      if (cache_topology.GetL3FromCpuId(cpu) == shard) {
+        return ((partitions >>
+                 tc_globals.numa_topology().GetCpuPartition(cpu)) &
+                1) != 0;
+      }
+    }
+    return false;
+  };
+#ifndef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
+  if (auto policy = TransferCachePlunderPolicy(); policy.has_value()) {
+    tc_globals.sharded_transfer_cache().Plunder(*policy, should_plunder);
+    return;
+  }
+#endif
+  tc_globals.sharded_transfer_cache().Plunder(should_plunder);
+}
+
+}  // namespace
+
+// Release memory to the system at a constant rate, or at a rate following
+// memory pressure if Parameters::pressure_based_release() is set.
 void MallocExtension_Internal_ProcessBackgroundActions() {
+  using ::tcmalloc::tcmalloc_internal::BackgroundWakeup;
+  using ::tcmalloc::tcmalloc_internal::HugeLength;
+  using ::tcmalloc::tcmalloc_internal::kNumClasses;
+  using ::tcmalloc::tcmalloc_internal::MemoryPressureNotifier;
+  using ::tcmalloc::tcmalloc_internal::NHugePages;
   using ::tcmalloc::tcmalloc_internal::Parameters;
   using ::tcmalloc::tcmalloc_internal::tc_globals;
 
@@ -36,10 +160,21 @@ void MallocExtension_Internal_ProcessBackgroundActions() {
 
   absl::Time prev_time = absl::Now();
   absl::Time last_reclaim = prev_time;
+  absl::Time last_thread_cache_idle_check = prev_time;
+  absl::Time last_decay = prev_time;
   absl::Time last_shuffle = prev_time;
+  // Apply the budget on the first iteration, i.e. at startup.
+  absl::Time last_cpu_cache_budget = absl::InfinitePast();
   absl::Time last_size_class_resize = prev_time;
   absl::Time last_size_class_max_capacity_resize = prev_time;
+  absl::Time last_cold_size_class_check = prev_time;
+  absl::Time last_span_cache_update = prev_time;
   absl::Time last_slab_resize_check = prev_time;
+  absl::Time last_hugepage_backing_sample = prev_time;
+  // Pick up the cgroup memory limit on the first iteration.
+  absl::Time last_cgroup_limit_check = absl::InfinitePast();
+  absl::Time last_parameter_control_check = prev_time;
+  absl::Time last_leak_detection = prev_time;
 
 #ifndef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
   absl::Time last_transfer_cache_plunder_check = prev_time;
@@ -52,31 +187,60 @@ void MallocExtension_Internal_ProcessBackgroundActions() {
   // want to separately account for pages released by ProcessBackgroundActions.
   tcmalloc::tcmalloc_internal::ConstantRatePageAllocatorReleaser releaser;
 
+  // Hugepages that we may collapse, accumulated at huge_page_collapse_rate()
+  // and capped at one second's worth.
+  double collapse_budget = 0;
+
+  // In event-driven mode, the number of sleep intervals to wait for the next
+  // event, doubling while none occur, and the events that ended the last wait.
+  constexpr int kMaxIdleBackoff = 64;
+  int idle_backoff = 1;
+  uint32_t events = 0;
+
   while (tcmalloc::MallocExtension::GetBackgroundProcessActionsEnabled()) {
     const absl::Duration sleep_time =
         tcmalloc::MallocExtension::GetBackgroundProcessSleepInterval();
 
-    // Reclaim inactive per-cpu caches once per cpu_cache_shuffle_period.
+    // Reclaim inactive per-cpu caches, and shrink the budget of inactive
+    // thread caches, once per idle_cache_reclaim_period.
     //
-    // We use a longer 30 sleep cycle reclaim period to make sure that caches
-    // are indeed idle. Reclaim drains entire cache, as opposed to cache shuffle
-    // for instance that only shrinks a cache by a few objects at a time. So, we
-    // might have larger performance degradation if we use a shorter reclaim
-    // interval and drain caches that weren't supposed to.
-    const absl::Duration cpu_cache_reclaim_period = 30 * sleep_time;
+    // We use a longer reclaim period (30 sleep cycles by default) to make sure
+    // that caches are indeed idle. Reclaim drains entire cache, as opposed to
+    // cache shuffle for instance that only shrinks a cache by a few objects at
+    // a time. So, we might have larger performance degradation if we use a
+    // shorter reclaim interval and drain caches that weren't supposed to.
+    const uint32_t idle_cache_reclaim_intervals =
+        Parameters::idle_cache_reclaim_intervals();
+    const absl::Duration idle_cache_reclaim_period =
+        idle_cache_reclaim_intervals * sleep_time;
 
     // Shuffle per-cpu caches once per cpu_cache_shuffle_period.
     const absl::Duration cpu_cache_shuffle_period = 5 * sleep_time;
 
+    // Check the usable CPUs and the CPU quota, and scale the per-cpu cache
+    // budget to them, once per cpu_cache_budget_period.
+    const absl::Duration cpu_cache_budget_period = 10 * sleep_time;
+
     const absl::Duration size_class_resize_period = 2 * sleep_time;
     const absl::Duration size_class_max_capacity_resize_period =
         29 * sleep_time;
 
+    // Look for rarely used size classes once per cold_size_class_period, so
+    // that a size class is judged by its use over about a minute.
+    const absl::Duration cold_size_class_period = 60 * sleep_time;
+
+    // Size the central freelists' caches of free spans once per
+    // span_cache_update_period.
+    const absl::Duration span_cache_update_period = 5 * sleep_time;
+
     // See if we should resize the slab once per cpu_cache_slab_resize_period.
     // This period is coprime to cpu_cache_shuffle_period and
     // cpu_cache_shuffle_period.
     const absl::Duration cpu_cache_slab_resize_period = 29 * sleep_time;
 
+    // Check the cgroup memory limit once per cgroup_limit_check_period.
+    const absl::Duration cgroup_limit_check_period = 10 * sleep_time;
+
 #ifndef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
     // We reclaim unused objects from the transfer caches once per
     // transfer_cache_plunder_period.
@@ -87,6 +251,45 @@ void MallocExtension_Internal_ProcessBackgroundActions() {
 
     absl::Time now = absl::Now();
 
+    // Apply changes to the parameter control file, right away if the reload
+    // signal was received.
+    tcmalloc::tcmalloc_internal::ParameterControl& parameter_control =
+        tcmalloc::tcmalloc_internal::parameter_control();
+    if (parameter_control.ConsumeReloadRequest()) {
+      parameter_control.Reload(/*force=*/true);
+      last_parameter_control_check = now;
+    } else if (now - last_parameter_control_check >=
+               tcmalloc::tcmalloc_internal::ParameterControl::kCheckIntervals *
+                   sleep_time) {
+      parameter_control.Reload(/*force=*/false);
+      last_parameter_control_check = now;
+    }
+
+    // Fault in the memory requested with PrepareForAllocation first, as its
+    // allocations are about to happen.
+    tcmalloc::tcmalloc_internal::pending_reservations().Process();
+
+    // Keep span metadata on hand, so that allocating threads that create
+    // spans under pageheap_lock do not also grow the metadata arenas, but give
+    // back what a past peak in the number of spans left over.
+    {
+      tcmalloc::tcmalloc_internal::PageHeapSpinLockHolder l;
+      tc_globals.ReleaseSpanMetadata();
+      tc_globals.ReserveSpanMetadata();
+    }
+
+    // Carry out the release requests of external memory agents, which shrink
+    // the caches before the regular passes below.
+    tcmalloc::tcmalloc_internal::ReleaseRequests& release_requests =
+        tcmalloc::tcmalloc_internal::release_requests();
+    release_requests.Process(sleep_time);
+
+    // Leave the caches and page heaps of the NUMA partitions that have their
+    // own thread to it.
+    const uint64_t workers =
+        numa_partition_workers.load(std::memory_order_relaxed);
+    const uint64_t partitions = ~workers;
+
     // We follow the cache hierarchy in TCMalloc from outermost (per-CPU) to
     // innermost (the page heap).  Freeing up objects at one layer can help aid
     // memory coalescing for inner caches.
@@ -98,30 +301,78 @@ void MallocExtension_Internal_ProcessBackgroundActions() {
       // threads unable to).
       TC_CHECK(tcmalloc::tcmalloc_internal::subtle::percpu::IsFast());
 
-      // Try to reclaim per-cpu caches once every cpu_cache_reclaim_period
+      tc_globals.cpu_cache().UpdateSizeClassRates();
+      tc_globals.cpu_cache().UpdateCacheHistograms();
+
+      // Try to reclaim per-cpu caches once every idle_cache_reclaim_period
       // when enabled.
-      if (now - last_reclaim >= cpu_cache_reclaim_period) {
-        tc_globals.cpu_cache().TryReclaimingCaches();
+      if (idle_cache_reclaim_intervals > 0 &&
+          now - last_reclaim >= idle_cache_reclaim_period) {
+        if (tc_globals.cpu_cache().TryReclaimingCaches(partitions) > 0) {
+          // Let caches kept outside of TCMalloc shrink with the per-CPU
+          // caches.
+          tcmalloc::tcmalloc_internal::reclaim_notifier().Notify();
+        }
         last_reclaim = now;
       }
 
-      if (now - last_shuffle >= cpu_cache_shuffle_period) {
-        tc_globals.cpu_cache().ShuffleCpuCaches();
+      // Sample the per-cpu cache lengths on every iteration, and return the
+      // objects that went unused once per per_cpu_caches_decay_intervals().
+      const uint32_t decay_intervals =
+          Parameters::per_cpu_caches_decay_intervals();
+      if (decay_intervals > 0) {
+        tc_globals.cpu_cache().UpdateDecayLowWaterMarks(partitions);
+        if (now - last_decay >= decay_intervals * sleep_time) {
+          tc_globals.cpu_cache().DecayCaches(partitions);
+          last_decay = now;
+        }
+      }
+
+      // Rebalance capacity right away if a cache overflows a lot.
+      if (now - last_shuffle >= cpu_cache_shuffle_period ||
+          (events & BackgroundWakeup::kCpuCacheOverflows) != 0) {
+        tc_globals.cpu_cache().ShuffleCpuCaches(partitions);
         last_shuffle = now;
       }
 
+      if (now - last_cpu_cache_budget >= cpu_cache_budget_period) {
+        // Drain the caches of CPUs that went offline or out of our cpuset
+        // first, so that the budget is shared by the remaining ones.
+        if (std::optional<tcmalloc::tcmalloc_internal::CpuSet> usable =
+                tcmalloc::tcmalloc_internal::UsableCPUs()) {
+          tc_globals.cpu_cache().DrainUnusableCpus(*usable);
+        }
+        if (std::optional<int> effective_cpus =
+                tcmalloc::tcmalloc_internal::NumEffectiveCPUs()) {
+          tc_globals.cpu_cache().UpdateCacheBudget(*effective_cpus);
+        }
+        last_cpu_cache_budget = now;
+      }
+
       if (now - last_size_class_resize >= size_class_resize_period) {
-        tc_globals.cpu_cache().ResizeSizeClasses();
+        tc_globals.cpu_cache().ResizeSizeClasses(partitions);
+        // Batch lengths are shared by all partitions, so they are only
+        // resized here.
+        tc_globals.cpu_cache().ResizeBatchLengths();
         last_size_class_resize = now;
       }
 
       if (Parameters::resize_size_class_max_capacity() &&
           now - last_size_class_max_capacity_resize >=
               size_class_max_capacity_resize_period) {
+        // A new size class starts without per-CPU capacity, which the resize
+        // grows out of the misses it records.
+        tcmalloc::tcmalloc_internal::dynamic_size_classes().Update();
         tc_globals.cpu_cache().ResizeSizeClassMaxCapacities();
         last_size_class_max_capacity_resize = now;
       }
 
+      if (now - last_cold_size_class_check >= cold_size_class_period) {
+        tc_globals.cpu_cache().UpdateColdSizeClasses(
+            Parameters::per_cpu_caches_bypass_cold_classes());
+        last_cold_size_class_check = now;
+      }
+
       // See if we need to grow the slab once every kCpuCacheSlabResizePeriod
       // when enabled.
       if (Parameters::per_cpu_caches_dynamic_slab_enabled() &&
@@ -129,14 +380,49 @@ void MallocExtension_Internal_ProcessBackgroundActions() {
         tc_globals.cpu_cache().ResizeSlabIfNeeded();
         last_slab_resize_check = now;
       }
+    } else if (idle_cache_reclaim_intervals > 0 &&
+               now - last_thread_cache_idle_check >=
+                   idle_cache_reclaim_period) {
+      // Threads that stopped allocating do not Scavenge() their caches, so
+      // hand their budget to the active threads instead.
+      {
+        tcmalloc::tcmalloc_internal::PageHeapSpinLockHolder l;
+        tcmalloc::tcmalloc_internal::ThreadCache::ShrinkIdleCaches();
+      }
+      // The locked per-CPU caches are drained from here, as they can be
+      // without synchronizing with their users.
+      tcmalloc::tcmalloc_internal::locked_cpu_cache().ReclaimIdle();
+      last_thread_cache_idle_check = now;
     }
 
-    tc_globals.sharded_transfer_cache().Plunder();
+#ifndef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
+    const auto plunder_policy = TransferCachePlunderPolicy();
+#endif
+    if (workers == 0) {
+#ifndef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
+      if (plunder_policy.has_value()) {
+        tc_globals.sharded_transfer_cache().Plunder(*plunder_policy);
+      } else {
+        tc_globals.sharded_transfer_cache().Plunder();
+      }
+#else
+      tc_globals.sharded_transfer_cache().Plunder();
+#endif
+    } else {
+      PlunderShardedTransferCache(partitions);
+    }
+    tc_globals.sharded_transfer_cache().UpdateActiveSizeClasses();
 
 #ifndef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
-    // Try to plunder and reclaim unused objects from transfer caches.
-    if (now - last_transfer_cache_plunder_check >=
-        transfer_cache_plunder_period) {
+    // Try to plunder and reclaim unused objects from transfer caches.  With a
+    // plunder policy, the caches keep track of how long their objects stayed
+    // unused themselves, and are visited on every iteration so that they
+    // return them in slices.
+    if (plunder_policy.has_value()) {
+      tc_globals.transfer_cache().TryPlunder(*plunder_policy);
+      last_transfer_cache_plunder_check = now;
+    } else if (now - last_transfer_cache_plunder_check >=
+               transfer_cache_plunder_period) {
       tc_globals.transfer_cache().TryPlunder();
       last_transfer_cache_plunder_check = now;
     }
@@ -148,17 +434,237 @@ void MallocExtension_Internal_ProcessBackgroundActions() {
     }
 #endif
 
-    // If time goes backwards, we would like to cap the release rate at 0.
-    ssize_t bytes_to_release =
-        static_cast<size_t>(Parameters::background_release_rate()) *
-        absl::ToDoubleSeconds(now - prev_time);
-    bytes_to_release = std::max<ssize_t>(bytes_to_release, 0);
+    // Free spans are not releasable, so they all go back to the page heap once
+    // memory runs short.
+    if (now - last_span_cache_update >= span_cache_update_period) {
+      const bool trim =
+          MemoryPressureNotifier::ComputeLevel(
+              tc_globals.page_allocator().SoftLimitUsagePercent(),
+              std::nullopt) != MemoryPressureNotifier::Level::kNone;
+      for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+        tc_globals.central_freelist(size_class).UpdateSpanCache(trim);
+      }
+      last_span_cache_update = now;
+    }
+
+    // Keep a soft limit some headroom below the cgroup memory limit, and
+    // release ahead of it as usage gets close.
+    if (now - last_cgroup_limit_check >= cgroup_limit_check_period) {
+      const uint32_t headroom =
+          std::min<uint32_t>(Parameters::cgroup_memory_limit_headroom_percent(),
+                             100);
+      size_t soft_limit = std::numeric_limits<size_t>::max();
+      if (headroom > 0) {
+        if (std::optional<size_t> cgroup_limit =
+                tcmalloc::tcmalloc_internal::CgroupMemoryLimit()) {
+          soft_limit = *cgroup_limit / 100 * (100 - headroom);
+        }
+      }
+      if (soft_limit != tc_globals.page_allocator().cgroup_soft_limit()) {
+        tc_globals.page_allocator().set_cgroup_soft_limit(soft_limit);
+      }
+      last_cgroup_limit_check = now;
+    }
+    tc_globals.page_allocator().ReleaseNearCgroupSoftLimit();
+
+    // Shrink ahead of the soft limit, so that allocations do not stall on
+    // shrinking the heap themselves once they hit it.
+    const uint32_t soft_limit_watermark =
+        Parameters::soft_limit_background_shrink_percent();
+    if (soft_limit_watermark > 0 &&
+        tc_globals.page_allocator().AboveSoftLimitWatermark(
+            soft_limit_watermark)) {
+      tcmalloc::tcmalloc_internal::ShrinkCaches(
+          tcmalloc::MallocExtension::CacheShrinkLevel::kIdle);
+      tc_globals.page_allocator().ShrinkAheadOfSoftLimit(soft_limit_watermark);
+    }
+
+    // Keep the cost of recording sampled allocations within its CPU budget.
+    tcmalloc::tcmalloc_internal::UpdateSamplingBudget();
+
+    // Look for stacks whose sampled bytes keep growing.
+    const absl::Duration leak_detection_interval =
+        Parameters::leak_detection_interval();
+    if (leak_detection_interval > absl::ZeroDuration() &&
+        now - last_leak_detection >= leak_detection_interval) {
+      tc_globals.leak_detector().Update(now);
+      last_leak_detection = now;
+    }
+
+    // The release rate is split evenly between the NUMA partitions.  This
+    // thread releases the share of the partitions without their own thread,
+    // and at least one share for the heaps that are not NUMA partitioned.
+    const int num_partitions = tc_globals.numa_topology().active_partitions();
+    const int num_worker_partitions = absl::popcount(
+        workers & ((uint64_t{1} << num_partitions) - 1));
+    const double release_share =
+        static_cast<double>(
+            std::max(num_partitions - num_worker_partitions, 1)) /
+        num_partitions;
+    const size_t bytes_to_release =
+        BytesToRelease(prev_time, now, release_share);
 
     // If release rate is set to 0, do not release memory to system. However, if
     // we want to release free and backed hugepages from HugeRegion,
     // ReleaseMemoryToSystem should be able to release those pages to the
     // system even with bytes_to_release = 0.
     if (bytes_to_release > 0 || Parameters::release_pages_from_huge_region()) {
+      releaser.Release(bytes_to_release,
+                       /*reason=*/tcmalloc::tcmalloc_internal::
+                           PageReleaseReason::kProcessBackgroundActions,
+                       /*skip_partitions=*/workers);
+    }
+
+    // Collapse subreleased hugepages that have filled up again, at no more
+    // than huge_page_collapse_rate() hugepages per second.
+    const uint32_t collapse_rate = Parameters::huge_page_collapse_rate();
+    if (collapse_rate > 0) {
+      const double elapsed =
+          std::max(absl::ToDoubleSeconds(now - prev_time), 0.);
+      collapse_budget = std::min(collapse_budget + collapse_rate * elapsed,
+                                 static_cast<double>(collapse_rate));
+      const size_t to_collapse = static_cast<size_t>(collapse_budget);
+      if (to_collapse > 0) {
+        const HugeLength attempted =
+            tc_globals.page_allocator().CollapseHugepages(
+                NHugePages(to_collapse));
+        collapse_budget -= attempted.raw_num();
+      }
+    } else {
+      collapse_budget = 0;
+    }
+
+    // Check how the kernel backs a sample of the intact hugepages once a
+    // minute.  Reading page flags is comparatively slow, so this runs rarely.
+    const uint32_t backing_samples = Parameters::huge_page_backing_samples();
+    if (backing_samples > 0 &&
+        now - last_hugepage_backing_sample >= absl::Minutes(1)) {
+      tc_globals.page_allocator().SampleHugepageBacking(
+          NHugePages(backing_samples));
+      last_hugepage_backing_sample = now;
+    }
+
+    // Tell the application's caches to shrink as memory runs short.
+    tcmalloc::tcmalloc_internal::memory_pressure_notifier().Update();
+
+    // Refresh the per-CPU cache bytes that summary stats report, so that
+    // those need not visit every CPU.
+    tcmalloc::tcmalloc_internal::UpdatePerCpuStatsSnapshot();
+
+    // Refresh the stats page for external scrapers, if it is published.
+    if (Parameters::publish_stats_page()) {
+      tcmalloc::tcmalloc_internal::PublishStatsPage();
+    }
+
+    prev_time = now;
+    if (Parameters::event_driven_background_actions()) {
+      events = tc_globals.background_wakeup().Wait(idle_backoff * sleep_time);
+      // A release in progress is paced by the sleep interval, so it must not
+      // back off.
+      idle_backoff = events != 0 || release_requests.pending_bytes() > 0
+                         ? 1
+                         : std::min(2 * idle_backoff, kMaxIdleBackoff);
+    } else {
+      absl::SleepFor(sleep_time);
+      events = 0;
+      idle_backoff = 1;
+    }
+  }
+}
+
+
+// Like ProcessBackgroundActions, for the per-CPU caches, transfer cache shards
+// and page heap of a single NUMA partition.
+void MallocExtension_Internal_ProcessNumaPartitionBackgroundActions(
+    int partition) {
+  using ::tcmalloc::tcmalloc_internal::CpuSet;
+  using ::tcmalloc::tcmalloc_internal::NumCPUs;
+  using ::tcmalloc::tcmalloc_internal::tc_globals;
+
+  const auto& topology = tc_globals.numa_topology();
+  const int num_partitions = topology.active_partitions();
+  if (partition < 0 || partition >= num_partitions) {
+    return;
+  }
+  const uint64_t partitions = uint64_t{1} << partition;
+  if ((numa_partition_workers.fetch_or(partitions, std::memory_order_relaxed) &
+       partitions) != 0) {
+    // Another thread already processes this partition.
+    return;
+  }
+
+  tcmalloc::MallocExtension::MarkThreadIdle();
+
+  // Run on the partition's CPUs, so that the memory we touch is local.
+  CpuSet cpus;
+  cpus.Zero();
+  for (int cpu = 0, n = NumCPUs(); cpu < n; ++cpu) {
+    if (topology.GetCpuPartition(cpu) == partition) {
+      cpus.Set(cpu);
+    }
+  }
+  if (cpus.Count() > 0 && !cpus.SetAffinity(0)) {
+    TC_LOG("Failed to bind the background thread of NUMA partition %v",
+           partition);
+  }
+
+  absl::Time prev_time = absl::Now();
+  absl::Time last_reclaim = prev_time;
+  absl::Time last_decay = prev_time;
+  absl::Time last_shuffle = prev_time;
+  absl::Time last_size_class_resize = prev_time;
+
+  tcmalloc::tcmalloc_internal::ConstantRatePageAllocatorReleaser releaser(
+      partition);
+
+  while (tcmalloc::MallocExtension::GetBackgroundProcessActionsEnabled()) {
+    const absl::Duration sleep_time =
+        tcmalloc::MallocExtension::GetBackgroundProcessSleepInterval();
+    // See ProcessBackgroundActions for the choice of periods.
+    const uint32_t idle_cache_reclaim_intervals =
+        tcmalloc::tcmalloc_internal::Parameters::idle_cache_reclaim_intervals();
+    const absl::Duration idle_cache_reclaim_period =
+        idle_cache_reclaim_intervals * sleep_time;
+    const absl::Duration cpu_cache_shuffle_period = 5 * sleep_time;
+    const absl::Duration size_class_resize_period = 2 * sleep_time;
+
+    absl::Time now = absl::Now();
+
+    if (tcmalloc::MallocExtension::PerCpuCachesActive()) {
+      TC_CHECK(tcmalloc::tcmalloc_internal::subtle::percpu::IsFast());
+
+      if (idle_cache_reclaim_intervals > 0 &&
+          now - last_reclaim >= idle_cache_reclaim_period) {
+        tc_globals.cpu_cache().TryReclaimingCaches(partitions);
+        last_reclaim = now;
+      }
+
+      const uint32_t decay_intervals = tcmalloc::tcmalloc_internal::
+          Parameters::per_cpu_caches_decay_intervals();
+      if (decay_intervals > 0) {
+        tc_globals.cpu_cache().UpdateDecayLowWaterMarks(partitions);
+        if (now - last_decay >= decay_intervals * sleep_time) {
+          tc_globals.cpu_cache().DecayCaches(partitions);
+          last_decay = now;
+        }
+      }
+
+      if (now - last_shuffle >= cpu_cache_shuffle_period) {
+        tc_globals.cpu_cache().ShuffleCpuCaches(partitions);
+        last_shuffle = now;
+      }
+
+      if (now - last_size_class_resize >= size_class_resize_period) {
+        tc_globals.cpu_cache().ResizeSizeClasses(partitions);
+        last_size_class_resize = now;
+      }
+    }
+
+    PlunderShardedTransferCache(partitions);
+
+    const size_t bytes_to_release =
+        BytesToRelease(prev_time, now, 1.0 / num_partitions);
+    if (bytes_to_release > 0) {
       releaser.Release(bytes_to_release,
                        /*reason=*/tcmalloc::tcmalloc_internal::
                            PageReleaseReason::kProcessBackgroundActions);
@@ -167,4 +673,6 @@ void MallocExtension_Internal_ProcessBackgroundActions() {
     prev_time = now;
     absl::SleepFor(sleep_time);
   }
+
+  numa_partition_workers.fetch_and(~partitions, std::memory_order_relaxed);
 }
@@ -0,0 +1,175 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Measures how background release affects the tail latency of allocations:
+// several threads allocate and free in a loop while ProcessBackgroundActions
+// releases memory at a given rate, and the percentiles of malloc latency are
+// reported, along with how long pageheap_lock was held against a probe that
+// takes it periodically.  This backs changes to how release holds the lock,
+// e.g. madvising outside of it.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "absl/base/internal/cycleclock.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/testing/testutil.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Allocations each thread keeps live, replacing one per operation.
+constexpr size_t kLiveAllocations = 512;
+// Operations each thread runs.
+constexpr size_t kOpsPerThread = size_t{1} << 21;
+constexpr absl::Duration kBackgroundInterval = absl::Milliseconds(10);
+constexpr absl::Duration kProbeInterval = absl::Microseconds(100);
+
+// Mostly small objects, served by the caches, and a few large ones, which come
+// from and return to the page heap, where background release takes them from.
+size_t RandomSize(absl::BitGen& rng) {
+  if (absl::Bernoulli(rng, 0.02)) {
+    return absl::Uniform<size_t>(rng, 256 << 10, 2 << 20);
+  }
+  return absl::Uniform<size_t>(rng, 8, 1024);
+}
+
+// Returns the cycles of malloc in each operation.
+std::vector<uint32_t> AllocationLoop() {
+  absl::BitGen rng;
+  std::vector<void*> live(kLiveAllocations, nullptr);
+  std::vector<uint32_t> cycles;
+  cycles.reserve(kOpsPerThread);
+
+  for (size_t i = 0; i < kOpsPerThread; ++i) {
+    void*& slot = live[absl::Uniform<size_t>(rng, 0, kLiveAllocations)];
+    free(slot);
+    const size_t size = RandomSize(rng);
+    const int64_t start = absl::base_internal::CycleClock::Now();
+    slot = malloc(size);
+    const int64_t elapsed = absl::base_internal::CycleClock::Now() - start;
+    // Touch the object, as an application would, so that released memory is
+    // faulted back in.
+    static_cast<char*>(slot)[0] = 1;
+    static_cast<char*>(slot)[size - 1] = 1;
+    cycles.push_back(static_cast<uint32_t>(
+        std::clamp<int64_t>(elapsed, 0, UINT32_MAX)));
+  }
+
+  for (void* ptr : live) free(ptr);
+  return cycles;
+}
+
+template <typename T>
+double PercentileNs(const std::vector<T>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  const size_t i = std::min(sorted.size() - 1,
+                            static_cast<size_t>(p * sorted.size()));
+  return sorted[i] * 1e9 / absl::base_internal::CycleClock::Frequency();
+}
+
+// Runs kOpsPerThread operations on each of state.range(1) threads while
+// background actions release state.range(0) MiB/s (0 disables release).
+// Reports the percentiles of malloc latency and of the wait of a probe taking
+// pageheap_lock every kProbeInterval, which approximates how long the lock is
+// held at a time.
+void BM_AllocateDuringRelease(benchmark::State& state) {
+  const size_t release_rate = state.range(0) << 20;
+  const int num_threads = state.range(1);
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    const MallocExtension::BytesPerSecond previous_rate =
+        MallocExtension::GetBackgroundReleaseRate();
+    MallocExtension::SetBackgroundReleaseRate(
+        static_cast<MallocExtension::BytesPerSecond>(release_rate));
+    std::thread background([] {
+      ScopedBackgroundProcessSleepInterval sleep_interval(kBackgroundInterval);
+      MallocExtension::ProcessBackgroundActions();
+    });
+
+    std::atomic<bool> done{false};
+    std::vector<int64_t> waits;
+    std::thread probe([&] {
+      while (!done.load(std::memory_order_relaxed)) {
+        const int64_t start = absl::base_internal::CycleClock::Now();
+        {
+          PageHeapSpinLockHolder l;
+          waits.push_back(absl::base_internal::CycleClock::Now() - start);
+        }
+        absl::SleepFor(kProbeInterval);
+      }
+    });
+    state.ResumeTiming();
+
+    std::vector<std::vector<uint32_t>> cycles(num_threads);
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (int t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&cycles, t] { cycles[t] = AllocationLoop(); });
+    }
+    for (std::thread& t : threads) t.join();
+
+    state.PauseTiming();
+    done.store(true, std::memory_order_relaxed);
+    probe.join();
+    {
+      ScopedBackgroundProcessActionsEnabled enabled(/*value=*/false);
+      background.join();
+    }
+    MallocExtension::SetBackgroundReleaseRate(previous_rate);
+
+    std::vector<uint32_t> all;
+    all.reserve(num_threads * kOpsPerThread);
+    for (const auto& c : cycles) all.insert(all.end(), c.begin(), c.end());
+    std::sort(all.begin(), all.end());
+    std::sort(waits.begin(), waits.end());
+
+    state.counters["malloc_p50_ns"] = PercentileNs(all, 0.5);
+    state.counters["malloc_p99_ns"] = PercentileNs(all, 0.99);
+    state.counters["malloc_p999_ns"] = PercentileNs(all, 0.999);
+    state.counters["lock_wait_p99_ns"] = PercentileNs(waits, 0.99);
+    state.counters["lock_wait_max_ns"] = PercentileNs(waits, 1.0);
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(state.iterations() * num_threads * kOpsPerThread);
+}
+
+BENCHMARK(BM_AllocateDuringRelease)
+    ->ArgNames({"release_mib_per_s", "threads"})
+    ->ArgsProduct({{0, 1, 16, 256}, {2, 8}})
+    ->Iterations(1)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
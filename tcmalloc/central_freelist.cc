@@ -16,18 +16,25 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <new>
 
+#include "absl/base/call_once.h"
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "absl/types/span.h"
 #include "tcmalloc/common.h"
+#include "tcmalloc/huge_page_filler.h"
 #include "tcmalloc/internal/allocation_guard.h"
+#include "tcmalloc/internal/cache_topology.h"
 #include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/internal/prefetch.h"
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/pages.h"
 #include "tcmalloc/selsan/selsan.h"
+#include "tcmalloc/slow_path_latency.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/static_vars.h"
 
@@ -40,7 +47,9 @@ static MemoryTag MemoryTagFromSizeClass(size_t size_class) {
   if (IsExpandedSizeClass(size_class)) {
     return MemoryTag::kCold;
   }
-  if (selsan::IsEnabled()) {
+  // Only a sampled fraction of the spans are tagged, so that the cost of
+  // tagging on every free of their objects stays proportional to it.
+  if (selsan::IsEnabled() && selsan::ShouldSample()) {
     return MemoryTag::kSelSan;
   }
   if (!tc_globals.numa_topology().numa_aware()) {
@@ -59,6 +68,49 @@ static AccessDensityPrediction AccessDensity(int objects_per_span) {
              : AccessDensityPrediction::kSparse;
 }
 
+// Returns the size of the largest size class whose central freelist is
+// sharded, per TCMALLOC_SHARDED_CENTRAL_FREELIST_MAX_SIZE, or 0.
+static size_t ShardedMaxSize() {
+  ABSL_CONST_INIT static absl::once_flag flag;
+  ABSL_CONST_INIT static size_t max_size = 0;
+  absl::base_internal::LowLevelCallOnce(&flag, [&]() {
+    const char* e =
+        thread_safe_getenv("TCMALLOC_SHARDED_CENTRAL_FREELIST_MAX_SIZE");
+    if (e == nullptr || *e == '\0') return;
+
+    size_t size = 0;
+    const char* p = e;
+    while (*p >= '0' && *p <= '9' && size <= kMaxSize) {
+      size = size * 10 + (*p++ - '0');
+    }
+    if (p == e || *p != '\0') {
+      TC_BUG("bad TCMALLOC_SHARDED_CENTRAL_FREELIST_MAX_SIZE env var '%s'", e);
+    }
+    max_size = size;
+  });
+  return max_size;
+}
+
+size_t StaticForwarder::num_shards(int size_class) {
+  const size_t max_size = ShardedMaxSize();
+  if (max_size == 0 || class_to_size(size_class) > max_size) {
+    return 1;
+  }
+  return CacheTopology::Instance().l3_count();
+}
+
+size_t StaticForwarder::CurrentShard(size_t num_shards) {
+  const int cpu = subtle::percpu::GetRealCpuUnsafe();
+  if (cpu < 0) {
+    return 0;
+  }
+  return CacheTopology::Instance().GetL3FromCpuId(cpu) % num_shards;
+}
+
+void* StaticForwarder::Alloc(size_t size, std::align_val_t alignment) {
+  return tc_globals.arena().Alloc(size, alignment);
+}
+
 size_t StaticForwarder::class_to_size(int size_class) {
   return tc_globals.sizemap().class_to_size(size_class);
 }
@@ -88,14 +140,25 @@ Span* StaticForwarder::AllocateSpan(int size_class, size_t objects_per_span,
   TC_ASSERT(density == AccessDensityPrediction::kSparse ||
             (density == AccessDensityPrediction::kDense &&
              pages_per_span == Length(1)));
-  Span* span =
-      tc_globals.page_allocator().New(pages_per_span, span_alloc_info, tag);
+  Span* span;
+  {
+    SlowPathLatencyTimer timer(SlowPathTier::kPageHeap, size_class);
+    span =
+        tc_globals.page_allocator().New(pages_per_span, span_alloc_info, tag);
+  }
   if (ABSL_PREDICT_FALSE(span == nullptr)) {
     return nullptr;
   }
   TC_ASSERT_EQ(tag, GetMemoryTag(span->start_address()));
   TC_ASSERT_EQ(span->num_pages(), pages_per_span);
 
+  if (nonintrusive_spans() &&
+      !Span::UseBitmapForSize(class_to_size(size_class))) {
+    PageHeapSpinLockHolder l;
+    span->set_freelist_bitmap(
+        tc_globals.freelist_bitmap_allocator(span->first_page()).New());
+  }
+
   tc_globals.pagemap().RegisterSizeClass(span, size_class);
   return span;
 }
@@ -106,6 +169,10 @@ static void ReturnSpansToPageHeap(MemoryTag tag, absl::Span<Span*> free_spans,
   PageHeapSpinLockHolder l;
   for (Span* const free_span : free_spans) {
     TC_ASSERT_EQ(tag, GetMemoryTag(free_span->start_address()));
+    if (Span::FreelistBitmap* bitmap = free_span->TakeFreelistBitmap()) {
+      tc_globals.freelist_bitmap_allocator(free_span->first_page())
+          .Delete(bitmap);
+    }
     tc_globals.page_allocator().Delete(free_span, objects_per_span, tag);
   }
 }
@@ -137,6 +204,16 @@ void StaticForwarder::DeallocateSpans(size_t objects_per_span,
   ReturnSpansToPageHeap(tag, free_spans, objects_per_span);
 }
 
+Length StaticForwarder::HugePageUsedPages(const Span* span) {
+  // Hugepages that are not on the HugePageFiller, like those backing large
+  // spans, have no PageTracker.
+  const void* pt = tc_globals.pagemap().GetHugepage(span->first_page());
+  if (pt == nullptr) {
+    return Length(0);
+  }
+  return static_cast<const PageTracker*>(pt)->used_pages_hint();
+}
+
 }  // namespace central_freelist_internal
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
@@ -18,8 +18,11 @@
 #include <stddef.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <new>
 
 #include "absl/base/attributes.h"
 #include "absl/base/const_init.h"
@@ -28,6 +31,7 @@
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "absl/numeric/bits.h"
+#include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/hinted_tracker_lists.h"
@@ -35,9 +39,11 @@
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
+#include "tcmalloc/internal/usdt.h"
 #include "tcmalloc/pages.h"
 #include "tcmalloc/parameters.h"
 #include "tcmalloc/selsan/selsan.h"
+#include "tcmalloc/slow_path_latency.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/span_stats.h"
 
@@ -59,6 +65,19 @@ class StaticForwarder {
   static uint32_t max_span_cache_array_size() {
     return Parameters::max_span_cache_array_size();
   }
+  static bool hugepage_aware_spans() {
+    return Parameters::central_freelist_hugepage_aware_spans();
+  }
+  static bool span_cache() { return Parameters::central_freelist_span_cache(); }
+  static absl::Duration span_cache_expiry() {
+    return Parameters::central_freelist_span_cache_expiry();
+  }
+  static bool address_ordered() {
+    return Parameters::central_freelist_address_ordered();
+  }
+  static bool nonintrusive_spans() {
+    return Parameters::central_freelist_nonintrusive_spans();
+  }
   static uint64_t clock_now() { return absl::base_internal::CycleClock::Now(); }
   static double clock_frequency() {
     return absl::base_internal::CycleClock::Frequency();
@@ -73,15 +92,51 @@ class StaticForwarder {
   static void DeallocateSpans(size_t objects_per_span,
                               absl::Span<Span*> free_spans)
       ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Returns the number of shards the central freelist of <size_class> is split
+  // into: one per L3 cache for size classes of at most
+  // TCMALLOC_SHARDED_CENTRAL_FREELIST_MAX_SIZE bytes, and one otherwise.
+  static size_t num_shards(int size_class);
+  // Returns the shard in [0, num_shards) that serves the current cpu.
+  static size_t CurrentShard(size_t num_shards);
+  static void* Alloc(size_t size, std::align_val_t alignment)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Returns the number of used pages of the hugepage <span> is on, or zero if
+  // the hugepage is not tracked by the HugePageFiller.  The result is a hint,
+  // as it is read without holding pageheap_lock.
+  static Length HugePageUsedPages(const Span* span)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
 };
 
 // Specifies number of nonempty_ lists that keep track of non-empty spans.
 static constexpr size_t kNumLists = 8;
 
+// Specifies the maximum number of shards of a central freelist.
+static constexpr size_t kMaxShards = size_t{1} << Span::kCentralShardBits;
+
 // Specifies the threshold for number of objects per span. The threshold is
 // used to consider a span sparsely- vs. densely-accessed.
 static constexpr size_t kFewObjectsAllocMaxLimit = 16;
 
+// Specifies the number of spans at the head of a nonempty_ list that are
+// compared when choosing spans on densely used hugepages.
+static constexpr size_t kHugePageAwareSpanCandidates = 4;
+
+// Specifies the maximum number of completely free spans each shard of a
+// central freelist keeps for reuse.
+static constexpr size_t kMaxCachedSpans = 8;
+
+// Statistics on the completely free spans a central freelist keeps.
+struct SpanCacheStats {
+  // Spans each shard may keep, as of the last UpdateSpanCache().
+  size_t limit = 0;
+  // Spans currently kept.
+  size_t cached = 0;
+  // Spans populated from the cache rather than the page heap.
+  size_t hits = 0;
+};
+
 // Data kept per size-class in central cache.
 template <typename ForwarderT>
 class CentralFreeList {
@@ -89,31 +144,34 @@ class CentralFreeList {
   using Forwarder = ForwarderT;
 
   constexpr CentralFreeList()
-      : lock_(absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY),
+      : local_shard_(),
+        shards_(&local_shard_),
+        num_shards_(1),
         size_class_(0),
         object_size_(0),
         objects_per_span_(0),
         first_nonempty_index_(0),
         pages_per_span_(0),
-        nonempty_(),
         use_all_buckets_for_few_object_spans_(false),
         lifetime_bucket_bounds_() {}
 
   CentralFreeList(const CentralFreeList&) = delete;
   CentralFreeList& operator=(const CentralFreeList&) = delete;
 
-  void Init(size_t size_class) ABSL_LOCKS_EXCLUDED(lock_);
+  void Init(size_t size_class);
 
   // These methods all do internal locking.
 
   // Insert batch into the central freelist.
   // REQUIRES: batch.size() > 0 && batch.size() <= kMaxObjectsToMove.
-  void InsertRange(absl::Span<void*> batch) ABSL_LOCKS_EXCLUDED(lock_);
+  void InsertRange(absl::Span<void*> batch);
 
   // Fill a prefix of batch[0..N-1] with up to N elements removed from central
   // freelist.  Return the number of elements removed.
-  ABSL_MUST_USE_RESULT int RemoveRange(absl::Span<void*> batch)
-      ABSL_LOCKS_EXCLUDED(lock_);
+  //
+  // Objects come from the shard of the current cpu, then from the other
+  // shards, and only then from a new span.
+  ABSL_MUST_USE_RESULT int RemoveRange(absl::Span<void*> batch);
 
   // Returns the number of free objects in cache.
   size_t length() const { return static_cast<size_t>(counter_.value()); }
@@ -124,16 +182,47 @@ class CentralFreeList {
   // page full of 5-byte objects would have 2 bytes memory overhead).
   size_t OverheadBytes() const;
 
-  // Returns number of live spans currently in the nonempty_[n] list.
+  // Returns number of live spans currently in the nonempty_[n] lists of all
+  // shards.
   // REQUIRES: n >= 0 && n < kNumLists.
-  size_t NumSpansInList(int n) ABSL_LOCKS_EXCLUDED(lock_);
+  size_t NumSpansInList(int n);
   SpanStats GetSpanStats() const;
 
+  // Returns the number of shards this freelist is split into.
+  size_t num_shards() const { return num_shards_; }
+
+  // Sizes the cache of completely free spans, which lets size classes that
+  // keep freeing and refilling whole spans skip pageheap_lock.  Each shard may
+  // keep as many spans as were both freed and populated per shard since the
+  // previous call, up to kMaxCachedSpans; without such churn, the limit
+  // halves.  Spans beyond the new limit, spans cached for longer than
+  // span_cache_expiry, or all of them if <trim> is set or the cache is
+  // disabled, are returned to the page heap.  Called by the background
+  // thread.
+  void UpdateSpanCache(bool trim) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  SpanCacheStats GetSpanCacheStats() const;
+
+  // Acquires and releases the locks of all shards around fork(), so that a
+  // child does not inherit them held by threads that only exist in the parent.
+  void AcquireInternalLocks() ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    for (size_t i = 0; i < num_shards_; ++i) {
+      shards_[i].lock.Lock();
+    }
+  }
+  void ReleaseInternalLocks() ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    for (size_t i = num_shards_; i > 0; --i) {
+      shards_[i - 1].lock.Unlock();
+    }
+  }
+
   // Reports span utilization and lifetime histogram stats.
   void PrintSpanUtilStats(Printer* out);
   void PrintSpanLifetimeStats(Printer* out);
   void PrintSpanUtilStatsInPbtxt(PbtxtRegion* region);
   void PrintSpanLifetimeStatsInPbtxt(PbtxtRegion* region);
+  void PrintSpanCacheStats(Printer* out) const;
+  void PrintSpanCacheStatsInPbtxt(PbtxtRegion* region) const;
 
   // Get number of spans in the histogram bucket. We record spans in the
   // histogram indexed by absl::bit_width(allocated). So, instead of using the
@@ -145,17 +234,54 @@ class CentralFreeList {
   Forwarder& forwarder() { return forwarder_; }
 
  private:
+  // The spans of a central freelist, with the lock that protects them.  A span
+  // belongs to the shard that populated it (see Span::central_shard) until it
+  // is returned to the page heap.
+  struct Shard {
+    constexpr Shard()
+        : lock(absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY),
+          nonempty(),
+          cached_spans(),
+          cached_at() {}
+
+    absl::base_internal::SpinLock lock;
+    // Non-empty lists that distinguish spans based on the number of objects
+    // allocated from them. As we prioritize spans, spans may be added to any
+    // of the kNumLists nonempty lists based on their allocated objects. If
+    // span prioritization is disabled, we add spans to the
+    // nonempty[kNumlists-1] list, leaving other lists unused.
+    HintedTrackerLists<Span, kNumLists> nonempty ABSL_GUARDED_BY(lock);
+    // Completely free spans kept for reuse by Populate, oldest first.  They
+    // still count as allocated from the page heap, and their objects as free
+    // objects of the freelist.
+    Span* cached_spans[kMaxCachedSpans] ABSL_GUARDED_BY(lock);
+    // When each of cached_spans was cached, in clock_now() ticks.
+    uint64_t cached_at[kMaxCachedSpans] ABSL_GUARDED_BY(lock);
+    size_t num_cached_spans ABSL_GUARDED_BY(lock) = 0;
+  };
+
   // Release an object to spans.
   // Returns object's span if it become completely free.
-  Span* ReleaseToSpans(void* object, Span* span, size_t object_size,
-                       uint32_t size_reciprocal, uint32_t max_span_cache_size)
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
-
-  // Populate cache by fetching from the page heap.
-  // May temporarily release lock_.
+  Span* ReleaseToSpans(Shard& shard, void* object, Span* span,
+                       size_t object_size, uint32_t size_reciprocal,
+                       uint32_t max_span_cache_size)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(shard.lock);
+
+  // Releases the objects of <batch> whose spans, <spans>, belong to shard
+  // <index>.  Stores the spans that became completely free in <free_spans>
+  // and returns their number.  <free_spans> may alias <spans> if all of the
+  // spans belong to the shard.
+  int ReleaseToShard(size_t index, absl::Span<void*> batch, Span** spans,
+                     Span** free_spans);
+
+  // Fill a prefix of batch[0..N-1] with up to N elements removed from the
+  // spans of shard <index>. Returns the number of elements removed.
+  int RemoveFromShard(size_t index, absl::Span<void*> batch);
+
+  // Populate shard <index> by fetching a span from the page heap.
   // Fill a prefix of batch[0..N-1] with up to N elements removed from central
   // freelist. Returns the number of elements removed.
-  int Populate(absl::Span<void*> batch) ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  int Populate(size_t index, absl::Span<void*> batch);
 
   // Allocate a span from the forwarder.
   Span* AllocateSpan();
@@ -164,10 +290,13 @@ class CentralFreeList {
   void DeallocateSpans(absl::Span<Span*> spans);
 
   // Parses nonempty_ lists and returns span from the list with the lowest
-  // possible index.
+  // possible index.  If <hugepage_aware> is set, prefers the span on the most
+  // densely used hugepage among the first kHugePageAwareSpanCandidates spans of
+  // that list.
   // Returns the span if one exists in the nonempty_ lists. Else, returns
   // nullptr.
-  Span* FirstNonEmptySpan() ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  Span* FirstNonEmptySpan(Shard& shard, bool hugepage_aware)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(shard.lock);
 
   // Returns first index to the nonempty_ lists that may record spans.
   uint8_t GetFirstNonEmptyIndex() const;
@@ -185,16 +314,34 @@ class CentralFreeList {
   // If increase is set to true, includes the span by incrementing the count
   // in the map. Otherwise, removes the span by decrementing the count in
   // the map.
-  void RecordSpanUtil(uint8_t bitwidth, bool increase)
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_) {
+  void RecordSpanUtil(uint8_t bitwidth, bool increase) {
     ASSUME(bitwidth > 0);
-    // Updates to objects_to_span_ are guarded by lock_, so writes may be
-    // performed using LossyAdd.
-    objects_to_spans_[bitwidth - 1].LossyAdd(increase ? 1 : -1);
+    UpdateCounter(objects_to_spans_[bitwidth - 1], increase ? 1 : -1);
   }
 
-  // This lock protects all the mutable data members.
-  absl::base_internal::SpinLock lock_;
+  // Adds <delta> to <counter> while holding the lock of a shard.  With a
+  // single shard, that lock serializes all updates, so writes may be
+  // performed using LossyAdd.
+  void UpdateCounter(StatsCounter& counter, StatsCounter::Value delta) {
+    if (ABSL_PREDICT_TRUE(num_shards_ == 1)) {
+      counter.LossyAdd(delta);
+    } else {
+      counter.Add(delta);
+    }
+  }
+
+  // Returns the shard the current cpu allocates from.
+  size_t HomeShard() const {
+    return ABSL_PREDICT_TRUE(num_shards_ == 1)
+               ? 0
+               : forwarder_.CurrentShard(num_shards_);
+  }
+
+  // The only shard, unless Init() splits the freelist into several shards.
+  Shard local_shard_;
+  // The num_shards_ shards of this freelist.
+  Shard* shards_;
+  size_t num_shards_;
 
   size_t size_class_;  // My size class (immutable after Init())
   size_t object_size_;
@@ -215,20 +362,20 @@ class CentralFreeList {
     return (requested - returned);
   }
 
-  void RecordSpanAllocated() ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_) {
-    counter_.LossyAdd(objects_per_span_);
-    num_spans_requested_.LossyAdd(1);
+  void RecordSpanAllocated() {
+    UpdateCounter(counter_, objects_per_span_);
+    UpdateCounter(num_spans_requested_, 1);
   }
 
-  void RecordMultiSpansDeallocated(size_t num_spans_returned)
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_) {
-    counter_.LossyAdd(-num_spans_returned * objects_per_span_);
-    num_spans_returned_.LossyAdd(num_spans_returned);
+  void RecordMultiSpansDeallocated(size_t num_spans_returned) {
+    UpdateCounter(counter_, -num_spans_returned * objects_per_span_);
+    UpdateCounter(num_spans_returned_, num_spans_returned);
   }
 
-  void UpdateObjectCounts(int num) ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_) {
-    counter_.LossyAdd(num);
-  }
+  void UpdateObjectCounts(int num) { UpdateCounter(counter_, num); }
+
+  // Removes the most recently cached span of <shard>, or returns nullptr.
+  Span* TakeCachedSpan(Shard& shard) ABSL_LOCKS_EXCLUDED(shard.lock);
 
   static constexpr size_t kLifetimeBuckets = 8;
   using LifetimeHistogram = size_t[kLifetimeBuckets];
@@ -243,9 +390,8 @@ class CentralFreeList {
   }
 
   // The followings are kept as a StatsCounter so that they can read without
-  // acquiring a lock. Updates to these variables are guarded by lock_
-  // so writes are performed using LossyAdd for speed, the lock still
-  // guarantees accuracy.
+  // acquiring a lock. Updates to these variables are made while holding a
+  // shard lock; see UpdateCounter().
 
   // Num free objects in cache entry
   StatsCounter counter_;
@@ -253,6 +399,16 @@ class CentralFreeList {
   StatsCounter num_spans_requested_;
   StatsCounter num_spans_returned_;
 
+  // Spans that became completely free, whether cached or returned, and spans
+  // populated from the cache of free spans.
+  StatsCounter num_spans_emptied_;
+  StatsCounter span_cache_hits_;
+  // The number of spans each shard may cache, and the span counts as of the
+  // last UpdateSpanCache(), which only the background thread reads.
+  std::atomic<size_t> span_cache_limit_{0};
+  size_t last_spans_populated_ = 0;
+  size_t last_spans_emptied_ = 0;
+
   // Records histogram of span utilization.
   //
   // Each bucket in the histogram records number of live spans with
@@ -278,12 +434,6 @@ class CentralFreeList {
   static constexpr size_t kSpanUtilBucketCapacity = 16;
   StatsCounter objects_to_spans_[kSpanUtilBucketCapacity];
 
-  // Non-empty lists that distinguish spans based on the number of objects
-  // allocated from them. As we prioritize spans, spans may be added to any of
-  // the kNumLists nonempty_ lists based on their allocated objects. If span
-  // prioritization is disabled, we add spans to the nonempty_[kNumlists-1]
-  // list, leaving other lists unused.
-  HintedTrackerLists<Span, kNumLists> nonempty_ ABSL_GUARDED_BY(lock_);
   bool use_all_buckets_for_few_object_spans_;
 
   size_t lifetime_bucket_bounds_[kLifetimeBuckets];
@@ -328,15 +478,30 @@ inline void CentralFreeList<Forwarder>::Init(size_t size_class)
   for (int i = 2; i < kLifetimeBuckets; ++i) {
     lifetime_bucket_bounds_[i] = lifetime_bucket_bounds_[i - 1] * 10;
   }
+
+  // Spans of a single object bypass the lists, so there is nothing to shard.
+  const size_t num_shards =
+      objects_per_span_ > 1
+          ? std::min(forwarder_.num_shards(size_class), kMaxShards)
+          : 1;
+  if (num_shards > 1) {
+    shards_ = static_cast<Shard*>(forwarder_.Alloc(
+        sizeof(Shard) * num_shards, std::align_val_t{ABSL_CACHELINE_SIZE}));
+    for (size_t i = 0; i < num_shards; ++i) {
+      new (&shards_[i]) Shard();
+    }
+    num_shards_ = num_shards;
+  }
 }
 
 template <class Forwarder>
 inline Span* CentralFreeList<Forwarder>::ReleaseToSpans(
-    void* object, Span* span, size_t object_size, uint32_t size_reciprocal,
-    uint32_t max_span_cache_size) {
+    Shard& shard, void* object, Span* span, size_t object_size,
+    uint32_t size_reciprocal, uint32_t max_span_cache_size) {
+  TC_ASSERT_EQ(&shards_[span->central_shard()], &shard);
   if (ABSL_PREDICT_FALSE(span->FreelistEmpty(object_size))) {
     const uint8_t index = GetFirstNonEmptyIndex();
-    nonempty_.Add(span, index);
+    shard.nonempty.Add(span, index);
     span->set_nonempty_index(index);
   }
 
@@ -348,7 +513,7 @@ inline Span* CentralFreeList<Forwarder>::ReleaseToSpans(
     // Update the histogram as the span is full and will be removed from the
     // nonempty_ list.
     RecordSpanUtil(prev_bitwidth, /*increase=*/false);
-    nonempty_.Remove(span, prev_index);
+    shard.nonempty.Remove(span, prev_index);
     return span;
   }
   // As the objects are being added to the span, its utilization might change.
@@ -366,19 +531,42 @@ inline Span* CentralFreeList<Forwarder>::ReleaseToSpans(
   // by cur_index.
   const uint8_t cur_index = IndexFor(cur_allocated, cur_bitwidth);
   if (cur_index != prev_index) {
-    nonempty_.Remove(span, prev_index);
-    nonempty_.Add(span, cur_index);
+    shard.nonempty.Remove(span, prev_index);
+    shard.nonempty.Add(span, cur_index);
     span->set_nonempty_index(cur_index);
   }
   return nullptr;
 }
 
 template <class Forwarder>
-inline Span* CentralFreeList<Forwarder>::FirstNonEmptySpan() {
+inline Span* CentralFreeList<Forwarder>::FirstNonEmptySpan(
+    Shard& shard, bool hugepage_aware) {
   // Scan nonempty_ lists in the range [first_nonempty_index_, kNumLists) and
   // return the span from a non-empty list if one exists. If all the lists are
   // empty, return nullptr.
-  return nonempty_.PeekLeast(GetFirstNonEmptyIndex());
+  if (ABSL_PREDICT_TRUE(!hugepage_aware)) {
+    return shard.nonempty.PeekLeast(GetFirstNonEmptyIndex());
+  }
+  const size_t index = shard.nonempty.FindNonEmpty(GetFirstNonEmptyIndex());
+  if (index == kNumLists) {
+    return nullptr;
+  }
+
+  // Spans in a list have similar occupancy.  Among them, allocate from the one
+  // whose hugepage is the busiest, so that objects concentrate on already
+  // dense hugepages while sparse hugepages drain and become releasable.
+  Span* best = nullptr;
+  Length best_used;
+  size_t candidates = 0;
+  for (Span* span : shard.nonempty[index]) {
+    const Length used = forwarder_.HugePageUsedPages(span);
+    if (best == nullptr || used > best_used) {
+      best = span;
+      best_used = used;
+    }
+    if (++candidates == kHugePageAwareSpanCandidates) break;
+  }
+  return best;
 }
 
 template <class Forwarder>
@@ -428,8 +616,12 @@ template <class Forwarder>
 inline size_t CentralFreeList<Forwarder>::NumSpansInList(int n) {
   ASSUME(n >= 0);
   ASSUME(n < kNumLists);
-  absl::base_internal::SpinLockHolder h(&lock_);
-  return nonempty_.SizeOfList(n);
+  size_t spans = 0;
+  for (size_t i = 0; i < num_shards_; ++i) {
+    absl::base_internal::SpinLockHolder h(&shards_[i].lock);
+    spans += shards_[i].nonempty.SizeOfList(n);
+  }
+  return spans;
 }
 
 template <class Forwarder>
@@ -439,7 +631,9 @@ inline void CentralFreeList<Forwarder>::InsertRange(absl::Span<void*> batch) {
 
   if (selsan::IsEnabled()) {
     for (auto& ptr : batch) {
-      ptr = selsan::ResetTag(ptr, object_size_);
+      if (IsSelSanMemory(ptr)) {
+        ptr = selsan::ResetTag(ptr, object_size_);
+      }
     }
   }
 
@@ -454,29 +648,28 @@ inline void CentralFreeList<Forwarder>::InsertRange(absl::Span<void*> batch) {
     return;
   }
 
-  // Safe to store free spans into freed up space in span array.
-  const uint32_t max_span_cache_size = forwarder_.max_span_cache_size();
-  Span** free_spans = spans;
-  int free_count = 0;
-
-  // Then, release all individual objects into spans under our mutex
+  // Then, release all individual objects into spans under the shard locks
   // and collect spans that become completely free.
-  {
-    // Use local copy of variables to ensure that they are not reloaded.
-    size_t object_size = object_size_;
-    uint32_t size_reciprocal = size_reciprocal_;
-    absl::base_internal::SpinLockHolder h(&lock_);
+  int free_count;
+  Span* sharded_free_spans[kMaxObjectsToMove];
+  Span** free_spans;
+  if (ABSL_PREDICT_TRUE(num_shards_ == 1)) {
+    // Safe to store free spans into freed up space in span array.
+    free_spans = spans;
+    free_count = ReleaseToShard(0, batch, spans, free_spans);
+  } else {
+    // Each shard rescans the span array, so free spans are collected
+    // separately.
+    uint32_t pending = 0;
     for (int i = 0; i < batch.size(); ++i) {
-      Span* span = ReleaseToSpans(batch[i], spans[i], object_size,
-                                  size_reciprocal, max_span_cache_size);
-      if (ABSL_PREDICT_FALSE(span)) {
-        free_spans[free_count] = span;
-        free_count++;
-      }
+      pending |= uint32_t{1} << spans[i]->central_shard();
+    }
+    free_spans = sharded_free_spans;
+    free_count = 0;
+    for (; pending != 0; pending &= pending - 1) {
+      free_count += ReleaseToShard(absl::countr_zero(pending), batch, spans,
+                                   free_spans + free_count);
     }
-
-    RecordMultiSpansDeallocated(free_count);
-    UpdateObjectCounts(batch.size());
   }
 
   // Then, release all free spans into page heap under its mutex.
@@ -485,6 +678,50 @@ inline void CentralFreeList<Forwarder>::InsertRange(absl::Span<void*> batch) {
   }
 }
 
+template <class Forwarder>
+inline int CentralFreeList<Forwarder>::ReleaseToShard(size_t index,
+                                                      absl::Span<void*> batch,
+                                                      Span** spans,
+                                                      Span** free_spans) {
+  // Use local copy of variables to ensure that they are not reloaded.
+  const uint32_t max_span_cache_size = forwarder_.max_span_cache_size();
+  size_t object_size = object_size_;
+  uint32_t size_reciprocal = size_reciprocal_;
+  Shard& shard = shards_[index];
+  int free_count = 0;
+  int cached_count = 0;
+  int released = 0;
+
+  absl::base_internal::SpinLockHolder h(&shard.lock);
+  // Read under the lock, so that no span is cached once UpdateSpanCache has
+  // trimmed the cache to a limit of zero.
+  const size_t span_cache_limit =
+      span_cache_limit_.load(std::memory_order_relaxed);
+  for (int i = 0; i < batch.size(); ++i) {
+    if (spans[i]->central_shard() != index) continue;
+    Span* span = ReleaseToSpans(shard, batch[i], spans[i], object_size,
+                                size_reciprocal, max_span_cache_size);
+    if (ABSL_PREDICT_FALSE(span)) {
+      if (shard.num_cached_spans < span_cache_limit) {
+        shard.cached_at[shard.num_cached_spans] = forwarder_.clock_now();
+        shard.cached_spans[shard.num_cached_spans++] = span;
+        cached_count++;
+      } else {
+        free_spans[free_count] = span;
+        free_count++;
+      }
+    }
+    released++;
+  }
+
+  if (ABSL_PREDICT_FALSE(free_count + cached_count != 0)) {
+    UpdateCounter(num_spans_emptied_, free_count + cached_count);
+  }
+  RecordMultiSpansDeallocated(free_count);
+  UpdateObjectCounts(released);
+  return free_count;
+}
+
 template <class Forwarder>
 void CentralFreeList<Forwarder>::DeallocateSpans(absl::Span<Span*> spans) {
   if (ABSL_PREDICT_TRUE(!selsan::IsEnabled())) {
@@ -512,6 +749,7 @@ void CentralFreeList<Forwarder>::DeallocateSpans(absl::Span<Span*> spans) {
 template <class Forwarder>
 inline int CentralFreeList<Forwarder>::RemoveRange(absl::Span<void*> batch) {
   TC_ASSERT(!batch.empty());
+  SlowPathLatencyTimer timer(SlowPathTier::kTransferCacheMiss, size_class_);
 
   if (objects_per_span_ == 1) {
     // If there is only 1 object per span, skip CentralFreeList entirely.
@@ -523,15 +761,40 @@ inline int CentralFreeList<Forwarder>::RemoveRange(absl::Span<void*> batch) {
     return 1;
   }
 
+  const size_t home = HomeShard();
+  int result = RemoveFromShard(home, batch);
+  // Steal from the other shards before fetching a new span.
+  for (size_t i = 1; i < num_shards_ && result < batch.size(); ++i) {
+    result += RemoveFromShard((home + i) % num_shards_, batch.subspan(result));
+  }
+  if (result < batch.size()) {
+    result += Populate(home, batch.subspan(result));
+  }
+  // The transfer and per-CPU caches hand out the last object of a batch
+  // first, so decreasing addresses are handed out in increasing order, which
+  // keeps consecutive allocations on nearby cache lines and pages rather than
+  // in the order their spans' freelists were last freed to.  Sorted outside
+  // of the shard locks.
+  if (forwarder_.address_ordered()) {
+    std::sort(batch.begin(), batch.begin() + result, std::greater<void*>());
+  }
+  TC_USDT_PROBE(transfer_cache_miss, size_class_, batch.size(), result);
+  return result;
+}
+
+template <class Forwarder>
+inline int CentralFreeList<Forwarder>::RemoveFromShard(
+    size_t index, absl::Span<void*> batch) {
   // Use local copy of variable to ensure that it is not reloaded.
   size_t object_size = object_size_;
+  Shard& shard = shards_[index];
   int result = 0;
-  absl::base_internal::SpinLockHolder h(&lock_);
+  const bool hugepage_aware = forwarder_.hugepage_aware_spans();
+  absl::base_internal::SpinLockHolder h(&shard.lock);
 
-  do {
-    Span* span = FirstNonEmptySpan();
+  while (result < batch.size()) {
+    Span* span = FirstNonEmptySpan(shard, hugepage_aware);
     if (ABSL_PREDICT_FALSE(!span)) {
-      result += Populate(batch.subspan(result));
       break;
     }
 
@@ -551,36 +814,41 @@ inline int CentralFreeList<Forwarder>::RemoveRange(absl::Span<void*> batch) {
       RecordSpanUtil(cur_bitwidth, /*increase=*/true);
     }
     if (span->FreelistEmpty(object_size)) {
-      nonempty_.Remove(span, prev_index);
+      shard.nonempty.Remove(span, prev_index);
     } else {
       // If span allocation changes so that it must be moved to a different
       // nonempty_ list, we remove it from the previous list and add it to the
       // desired list indexed by cur_index.
       const uint8_t cur_index = IndexFor(cur_allocated, cur_bitwidth);
       if (cur_index != prev_index) {
-        nonempty_.Remove(span, prev_index);
-        nonempty_.Add(span, cur_index);
+        shard.nonempty.Remove(span, prev_index);
+        shard.nonempty.Add(span, cur_index);
         span->set_nonempty_index(cur_index);
       }
     }
     result += here;
-  } while (result < batch.size());
+  }
   UpdateObjectCounts(-result);
   return result;
 }
 
 // Fetch memory from the system and add to the central cache freelist.
 template <class Forwarder>
-inline int CentralFreeList<Forwarder>::Populate(absl::Span<void*> batch)
-    ABSL_NO_THREAD_SAFETY_ANALYSIS {
-  // Release central list lock while operating on pageheap
+inline int CentralFreeList<Forwarder>::Populate(size_t index,
+                                                absl::Span<void*> batch) {
+  // The shard lock is not held while operating on pageheap.
   // Note, this could result in multiple calls to populate each allocating
   // a new span and the pushing those partially full spans onto nonempty.
-  lock_.Unlock();
-
-  Span* span = AllocateSpan();
-  if (ABSL_PREDICT_FALSE(span == nullptr)) {
-    return 0;
+  SlowPathLatencyTimer timer(SlowPathTier::kSpanAllocation, size_class_);
+  Shard& shard = shards_[index];
+  Span* span = TakeCachedSpan(shard);
+  const bool cached = span != nullptr;
+  if (!cached) {
+    span = AllocateSpan();
+    if (ABSL_PREDICT_FALSE(span == nullptr)) {
+      return 0;
+    }
+    span->set_central_shard(index);
   }
 
   const uint64_t alloc_time = forwarder_.clock_now();
@@ -588,10 +856,11 @@ inline int CentralFreeList<Forwarder>::Populate(absl::Span<void*> batch)
       span->BuildFreelist(object_size_, objects_per_span_, batch,
                           forwarder_.max_span_cache_size(), alloc_time);
   TC_ASSERT_GT(result, 0);
+  TC_USDT_PROBE(span_populate, size_class_, objects_per_span_, result);
   // This is a cheaper check than using FreelistEmpty().
   bool span_empty = result == objects_per_span_;
 
-  lock_.Lock();
+  absl::base_internal::SpinLockHolder h(&shard.lock);
 
   // Update the histogram once we populate the span.
   const uint16_t allocated = result;
@@ -599,14 +868,97 @@ inline int CentralFreeList<Forwarder>::Populate(absl::Span<void*> batch)
   const uint8_t bitwidth = absl::bit_width(allocated);
   RecordSpanUtil(bitwidth, /*increase=*/true);
   if (!span_empty) {
-    const uint8_t index = IndexFor(allocated, bitwidth);
-    nonempty_.Add(span, index);
-    span->set_nonempty_index(index);
+    const uint8_t list = IndexFor(allocated, bitwidth);
+    shard.nonempty.Add(span, list);
+    span->set_nonempty_index(list);
+  }
+  if (cached) {
+    // The span and its objects are still accounted for.
+    UpdateCounter(span_cache_hits_, 1);
+  } else {
+    RecordSpanAllocated();
   }
-  RecordSpanAllocated();
+  UpdateObjectCounts(-result);
   return result;
 }
 
+template <class Forwarder>
+inline Span* CentralFreeList<Forwarder>::TakeCachedSpan(Shard& shard) {
+  if (ABSL_PREDICT_TRUE(span_cache_limit_.load(std::memory_order_relaxed) ==
+                        0)) {
+    // Spans left over from a higher limit are returned by UpdateSpanCache.
+    return nullptr;
+  }
+  absl::base_internal::SpinLockHolder h(&shard.lock);
+  if (shard.num_cached_spans == 0) {
+    return nullptr;
+  }
+  return shard.cached_spans[--shard.num_cached_spans];
+}
+
+template <class Forwarder>
+inline void CentralFreeList<Forwarder>::UpdateSpanCache(bool trim) {
+  if (objects_per_span_ <= 1) {
+    // Such spans bypass the lists, see InsertRange.
+    return;
+  }
+  const bool enabled = forwarder_.span_cache() && !selsan::IsEnabled();
+  const size_t old_limit = span_cache_limit_.load(std::memory_order_relaxed);
+  if (!enabled && old_limit == 0) {
+    // The cache was emptied when its limit dropped to zero.
+    return;
+  }
+
+  const size_t populated = num_spans_requested_.value() +
+                           span_cache_hits_.value();
+  const size_t emptied = num_spans_emptied_.value();
+  const size_t churn = std::min(populated - last_spans_populated_,
+                                emptied - last_spans_emptied_);
+  last_spans_populated_ = populated;
+  last_spans_emptied_ = emptied;
+
+  size_t limit = 0;
+  if (enabled && !trim) {
+    const size_t per_shard = (churn + num_shards_ - 1) / num_shards_;
+    limit = std::max(std::min(per_shard, kMaxCachedSpans), old_limit / 2);
+  }
+  span_cache_limit_.store(limit, std::memory_order_relaxed);
+
+  const absl::Duration expiry = forwarder_.span_cache_expiry();
+  const uint64_t now = forwarder_.clock_now();
+  const double expiry_ticks =
+      absl::ToDoubleSeconds(expiry) * forwarder_.clock_frequency();
+  for (size_t i = 0; i < num_shards_; ++i) {
+    Shard& shard = shards_[i];
+    Span* trimmed[kMaxCachedSpans];
+    size_t num_trimmed = 0;
+    {
+      absl::base_internal::SpinLockHolder h(&shard.lock);
+      const size_t cached = shard.num_cached_spans;
+      num_trimmed = cached > limit ? cached - limit : 0;
+      // Spans are cached oldest first, so the expired ones are a prefix.
+      if (expiry > absl::ZeroDuration()) {
+        while (num_trimmed < cached &&
+               now - shard.cached_at[num_trimmed] >= expiry_ticks) {
+          ++num_trimmed;
+        }
+      }
+      if (num_trimmed == 0) {
+        continue;
+      }
+      // Return the spans that were cached the longest ago.
+      std::copy_n(shard.cached_spans, num_trimmed, trimmed);
+      std::copy(shard.cached_spans + num_trimmed,
+                shard.cached_spans + cached, shard.cached_spans);
+      std::copy(shard.cached_at + num_trimmed, shard.cached_at + cached,
+                shard.cached_at);
+      shard.num_cached_spans = cached - num_trimmed;
+      RecordMultiSpansDeallocated(num_trimmed);
+    }
+    DeallocateSpans(absl::MakeSpan(trimmed, num_trimmed));
+  }
+}
+
 template <class Forwarder>
 Span* CentralFreeList<Forwarder>::AllocateSpan() {
   Span* span =
@@ -646,6 +998,40 @@ inline size_t CentralFreeList<Forwarder>::NumSpansWith(
   return objects_to_spans_[bucket].value();
 }
 
+template <class Forwarder>
+inline SpanCacheStats CentralFreeList<Forwarder>::GetSpanCacheStats() const {
+  SpanCacheStats stats;
+  stats.limit = span_cache_limit_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < num_shards_; ++i) {
+    absl::base_internal::SpinLockHolder h(&shards_[i].lock);
+    stats.cached += shards_[i].num_cached_spans;
+  }
+  stats.hits = span_cache_hits_.value();
+  return stats;
+}
+
+template <class Forwarder>
+inline void CentralFreeList<Forwarder>::PrintSpanCacheStats(
+    Printer* out) const {
+  const SpanCacheStats stats = GetSpanCacheStats();
+  if (stats.hits == 0 && stats.cached == 0) {
+    return;
+  }
+  out->printf(
+      "class %3d [ %8zu bytes ] : %3zu spans cached (limit %zu per shard), "
+      "%12zu hits\n",
+      size_class_, object_size_, stats.cached, stats.limit, stats.hits);
+}
+
+template <class Forwarder>
+inline void CentralFreeList<Forwarder>::PrintSpanCacheStatsInPbtxt(
+    PbtxtRegion* region) const {
+  const SpanCacheStats stats = GetSpanCacheStats();
+  region->PrintI64("span_cache_limit", stats.limit);
+  region->PrintI64("span_cache_spans", stats.cached);
+  region->PrintI64("span_cache_hits", stats.hits);
+}
+
 template <class Forwarder>
 inline void CentralFreeList<Forwarder>::PrintSpanUtilStats(Printer* out) {
   out->printf("class %3d [ %8zu bytes ] : ", size_class_, object_size_);
@@ -675,9 +1061,9 @@ inline void CentralFreeList<Forwarder>::PrintSpanLifetimeStats(Printer* out) {
   double frequency = forwarder_.clock_frequency();
   LifetimeHistogram lifetime_histo{};
 
-  {
-    absl::base_internal::SpinLockHolder h(&lock_);
-    nonempty_.Iter(
+  for (size_t i = 0; i < num_shards_; ++i) {
+    absl::base_internal::SpinLockHolder h(&shards_[i].lock);
+    shards_[i].nonempty.Iter(
         [&](const Span* s) {
           const double elapsed = std::max<double>(
               now - s->AllocTime(size_class_, forwarder_.max_span_cache_size()),
@@ -728,9 +1114,9 @@ inline void CentralFreeList<Forwarder>::PrintSpanLifetimeStatsInPbtxt(
   double frequency = forwarder_.clock_frequency();
   LifetimeHistogram lifetime_histo{};
 
-  {
-    absl::base_internal::SpinLockHolder h(&lock_);
-    nonempty_.Iter(
+  for (size_t i = 0; i < num_shards_; ++i) {
+    absl::base_internal::SpinLockHolder h(&shards_[i].lock);
+    shards_[i].nonempty.Iter(
         [&](const Span* s) {
           const double elapsed = std::max<double>(
               now - s->AllocTime(size_class_, forwarder_.max_span_cache_size()),
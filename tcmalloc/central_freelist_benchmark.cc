@@ -15,6 +15,7 @@
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <new>
 #include <vector>
 
 #include "absl/algorithm/container.h"
@@ -22,6 +23,8 @@
 #include "absl/types/span.h"
 #include "benchmark/benchmark.h"
 #include "tcmalloc/central_freelist.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/tcmalloc_policy.h"
 
@@ -197,6 +200,158 @@ BENCHMARK(BM_SpanReuse)
     ->DenseRange(64, 1024, 64)
     ->DenseRange(1024, 4096, 512);
 
+// This benchmark fetches objects from spans whose freelists were shuffled by
+// random frees, links them into a list in the order the caches would hand them
+// out (from the end of each batch), and walks the list, as a workload building
+// and traversing a linked structure would.  The second argument sets
+// Parameters::central_freelist_address_ordered(), whose sorting cost is
+// included.
+void BM_PointerChase(benchmark::State& state) {
+  const size_t object_size = state.range(0);
+  const bool address_ordered = state.range(1);
+  const bool previous = Parameters::central_freelist_address_ordered();
+  Parameters::set_central_freelist_address_ordered(address_ordered);
+  size_t size_class = tc_globals.sizemap().SizeClass(CppPolicy(), object_size);
+  int batch_size = tc_globals.sizemap().num_objects_to_move(size_class);
+  int num_objects = 16 * 1024 * 1024 / object_size;
+  CentralFreeList cfl;
+  cfl.Init(size_class);
+
+  std::vector<void*> buffer(num_objects);
+  for (int index = 0; index < num_objects;) {
+    int count = std::min(batch_size, num_objects - index);
+    index += cfl.RemoveRange(absl::MakeSpan(buffer).subspan(index, count));
+  }
+  absl::BitGen rnd;
+  int64_t items_processed = 0;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    absl::c_shuffle(buffer, rnd);
+    for (int index = 0; index < num_objects; index += batch_size) {
+      unsigned int count = std::min(batch_size, num_objects - index);
+      cfl.InsertRange({&buffer[index], count});
+    }
+    state.ResumeTiming();
+
+    void* head = nullptr;
+    for (int index = 0; index < num_objects;) {
+      int count = std::min(batch_size, num_objects - index);
+      int got = cfl.RemoveRange(absl::MakeSpan(buffer).subspan(index, count));
+      for (int i = index + got; i > index; --i) {
+        *static_cast<void**>(buffer[i - 1]) = head;
+        head = buffer[i - 1];
+      }
+      index += got;
+    }
+    for (void* p = head; p != nullptr; p = *static_cast<void**>(p)) {
+      benchmark::DoNotOptimize(p);
+    }
+    items_processed += num_objects;
+  }
+  state.SetItemsProcessed(items_processed);
+
+  for (int index = 0; index < num_objects; index += batch_size) {
+    unsigned int count = std::min(batch_size, num_objects - index);
+    cfl.InsertRange({&buffer[index], count});
+  }
+  Parameters::set_central_freelist_address_ordered(previous);
+}
+BENCHMARK(BM_PointerChase)
+    ->ArgsProduct({{16, 64, 256, 1024}, {false, true}});
+
+// Shards central freelists by benchmark thread, the way StaticForwarder does
+// by L3 cache.
+class ThreadShardedForwarder
+    : public central_freelist_internal::StaticForwarder {
+ public:
+  ~ThreadShardedForwarder() {
+    if (shards_ != nullptr) {
+      ::operator delete(shards_, alignment_);
+    }
+  }
+
+  size_t num_shards(int size_class) const { return num_shards_; }
+  size_t CurrentShard(size_t num_shards) const {
+    return thread_shard % num_shards;
+  }
+  void* Alloc(size_t size, std::align_val_t alignment) {
+    shards_ = ::operator new(size, alignment);
+    alignment_ = alignment;
+    return shards_;
+  }
+
+  static thread_local size_t thread_shard;
+  size_t num_shards_ = 1;
+
+ private:
+  void* shards_ = nullptr;
+  std::align_val_t alignment_{};
+};
+
+thread_local size_t ThreadShardedForwarder::thread_shard = 0;
+
+// This benchmark measures how moving batches in and out of a central freelist
+// scales with the number of threads doing so concurrently, as happens when
+// transfer caches miss on many cpus at once.  The freelist is split into
+// state.range(1) shards that threads are assigned to round-robin.  Half of
+// the objects of every span stay allocated, so that spans are never returned
+// to the pageheap during the benchmark run.
+void BM_Contention(benchmark::State& state) {
+  using ShardedCentralFreeList =
+      central_freelist_internal::CentralFreeList<ThreadShardedForwarder>;
+  size_t object_size = state.range(0);
+  size_t size_class = tc_globals.sizemap().SizeClass(CppPolicy(), object_size);
+  int batch_size = tc_globals.sizemap().num_objects_to_move(size_class);
+
+  static ShardedCentralFreeList* cfl = nullptr;
+  static std::vector<void*>* held_objects = nullptr;
+  if (state.thread_index() == 0) {
+    cfl = new ShardedCentralFreeList();
+    cfl->forwarder().num_shards_ = state.range(1);
+    cfl->Init(size_class);
+
+    // Leave enough free objects behind for every thread to hold one batch.
+    held_objects = new std::vector<void*>(2 * state.threads() * batch_size);
+    for (int index = 0; index < held_objects->size();) {
+      int count = std::min<int>(batch_size, held_objects->size() - index);
+      index += cfl->RemoveRange(
+          absl::MakeSpan(*held_objects).subspan(index, count));
+    }
+    for (int index = 0; index < held_objects->size(); index += 2) {
+      cfl->InsertRange({&(*held_objects)[index], 1});
+    }
+  }
+  ThreadShardedForwarder::thread_shard = state.thread_index();
+
+  void* batch[kMaxObjectsToMove];
+  int64_t items_processed = 0;
+  for (auto _ : state) {
+    int got = cfl->RemoveRange(absl::MakeSpan(batch, batch_size));
+    benchmark::DoNotOptimize(batch);
+    if (got > 0) {
+      cfl->InsertRange(absl::MakeSpan(batch, got));
+    }
+    items_processed += got;
+  }
+  state.SetItemsProcessed(items_processed);
+
+  if (state.thread_index() == 0) {
+    for (int index = 1; index < held_objects->size(); index += 2) {
+      cfl->InsertRange({&(*held_objects)[index], 1});
+    }
+    delete held_objects;
+    held_objects = nullptr;
+    delete cfl;
+    cfl = nullptr;
+  }
+}
+BENCHMARK(BM_Contention)
+    ->RangeMultiplier(8)
+    ->Ranges({{16, 1024}, {1, 8}})
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <cstring>
+#include <functional>
 #include <memory>
 #include <string>
 #include <tuple>
@@ -34,6 +35,7 @@
 #include "absl/base/thread_annotations.h"
 #include "absl/container/fixed_array.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/memory/memory.h"
 #include "absl/numeric/bits.h"
 #include "absl/random/random.h"
@@ -325,6 +327,7 @@ INSTANTIATE_TEST_SUITE_P(All, StaticForwarderTest,
 namespace {
 
 using central_freelist_internal::kNumLists;
+using central_freelist_internal::SpanCacheStats;
 using TypeParam = FakeCentralFreeListEnvironment<
     central_freelist_internal::CentralFreeList<MockStaticForwarder>>;
 using CentralFreeListTest =
@@ -881,6 +884,259 @@ TEST_P(CentralFreeListTest, PassSpanDensityToPageheap) {
   test_function(e.objects_per_span(), AccessDensityPrediction::kDense);
 }
 
+TEST_P(CentralFreeListTest, Shards) {
+  TypeParam e(std::get<0>(GetParam()).size, std::get<0>(GetParam()).pages,
+              std::get<0>(GetParam()).num_to_move, std::get<1>(GetParam()),
+              /*num_shards=*/2);
+  if (e.objects_per_span() == 1) {
+    // Such spans skip the lists, so they are never sharded.
+    EXPECT_EQ(e.central_freelist().num_shards(), 1);
+    return;
+  }
+  ASSERT_EQ(e.central_freelist().num_shards(), 2);
+  EXPECT_CALL(e.forwarder(), AllocateSpan).Times(1);
+
+  // Shard 0 populates a span and keeps its remaining objects.
+  void* objects[2];
+  e.forwarder().set_current_shard(0);
+  ASSERT_EQ(e.central_freelist().RemoveRange(absl::MakeSpan(&objects[0], 1)),
+            1);
+
+  // Shard 1 has no spans, so it steals from shard 0 rather than populating.
+  e.forwarder().set_current_shard(1);
+  ASSERT_EQ(e.central_freelist().RemoveRange(absl::MakeSpan(&objects[1], 1)),
+            1);
+  EXPECT_EQ(e.central_freelist().length(), e.objects_per_span() - 2);
+
+  // The objects go back to the shard of their span, which becomes free.
+  EXPECT_CALL(e.forwarder(), DeallocateSpans).Times(1);
+  e.central_freelist().InsertRange(absl::MakeSpan(objects));
+  SpanStats stats = e.central_freelist().GetSpanStats();
+  EXPECT_EQ(stats.num_spans_requested, 1);
+  EXPECT_EQ(stats.num_spans_returned, 1);
+  EXPECT_EQ(e.central_freelist().length(), 0);
+}
+
+TEST_P(CentralFreeListTest, HugePageAwareSpans) {
+  TypeParam e(std::get<0>(GetParam()).size, std::get<0>(GetParam()).pages,
+              std::get<0>(GetParam()).num_to_move, std::get<1>(GetParam()));
+  const size_t objects_per_span = e.objects_per_span();
+  // Spans with a single object are never on the nonempty_ lists.
+  if (objects_per_span < 2) return;
+  e.forwarder().set_hugepage_aware_spans(true);
+
+  // Allocate all objects from two spans.
+  constexpr int kNumSpans = 2;
+  std::vector<void*> objects;
+  void* batch[kMaxObjectsToMove];
+  while (objects.size() < kNumSpans * objects_per_span) {
+    const size_t n = kNumSpans * objects_per_span - objects.size();
+    int got = e.central_freelist().RemoveRange(
+        absl::MakeSpan(batch, std::min(n, e.batch_size())));
+    ASSERT_GT(got, 0);
+    objects.insert(objects.end(), batch, batch + got);
+  }
+  Span* const dense = e.forwarder().MapObjectToSpan(objects.front());
+  Span* const sparse = e.forwarder().MapObjectToSpan(objects.back());
+  ASSERT_NE(dense, sparse);
+  e.forwarder().set_hugepage_used_pages(dense, Length(200));
+  e.forwarder().set_hugepage_used_pages(sparse, Length(10));
+
+  // Return one object to each span, so that both have the same occupancy.  The
+  // span on the sparse hugepage is returned to last, so it heads the list.
+  e.central_freelist().InsertRange({&objects.front(), 1});
+  e.central_freelist().InsertRange({&objects.back(), 1});
+
+  // Allocation prefers the span on the densely used hugepage.
+  int got = e.central_freelist().RemoveRange(absl::MakeSpan(batch, 1));
+  ASSERT_EQ(got, 1);
+  EXPECT_EQ(e.forwarder().MapObjectToSpan(batch[0]), dense);
+  objects.front() = batch[0];
+
+  // Without the policy, the span at the head of the list is used.
+  e.forwarder().set_hugepage_aware_spans(false);
+  got = e.central_freelist().RemoveRange(absl::MakeSpan(batch, 1));
+  ASSERT_EQ(got, 1);
+  EXPECT_EQ(e.forwarder().MapObjectToSpan(batch[0]), sparse);
+  objects.back() = batch[0];
+
+  for (void* object : objects) {
+    e.central_freelist().InsertRange({&object, 1});
+  }
+}
+
+TEST_P(CentralFreeListTest, SpanCache) {
+  TypeParam e(std::get<0>(GetParam()).size, std::get<0>(GetParam()).pages,
+              std::get<0>(GetParam()).num_to_move, std::get<1>(GetParam()));
+  // Spans with a single object bypass the lists and the cache.
+  if (e.objects_per_span() < 2) return;
+  e.forwarder().set_span_cache(true);
+  EXPECT_CALL(e.forwarder(), AllocateSpan).Times(2);
+  EXPECT_CALL(e.forwarder(), DeallocateSpans).Times(2);
+
+  // Populates a span for one object and frees it again.
+  auto churn = [&]() {
+    void* object;
+    ASSERT_EQ(e.central_freelist().RemoveRange(absl::MakeSpan(&object, 1)), 1);
+    e.central_freelist().InsertRange({&object, 1});
+  };
+
+  // Without churn, no spans are cached.
+  e.central_freelist().UpdateSpanCache(/*trim=*/false);
+  EXPECT_EQ(e.central_freelist().GetSpanCacheStats().limit, 0);
+  churn();
+  EXPECT_EQ(e.central_freelist().GetSpanCacheStats().cached, 0);
+
+  // A span was both freed and populated, so one may be kept.
+  e.central_freelist().UpdateSpanCache(/*trim=*/false);
+  EXPECT_EQ(e.central_freelist().GetSpanCacheStats().limit, 1);
+  churn();
+  SpanCacheStats stats = e.central_freelist().GetSpanCacheStats();
+  EXPECT_EQ(stats.cached, 1);
+  EXPECT_EQ(stats.hits, 0);
+  EXPECT_EQ(e.central_freelist().GetSpanStats().num_spans_returned, 1);
+
+  // The next span comes from the cache rather than the page heap.
+  churn();
+  stats = e.central_freelist().GetSpanCacheStats();
+  EXPECT_EQ(stats.cached, 1);
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(e.central_freelist().GetSpanStats().num_spans_requested, 2);
+
+  // Trimming returns the cached span to the page heap.
+  e.central_freelist().UpdateSpanCache(/*trim=*/true);
+  stats = e.central_freelist().GetSpanCacheStats();
+  EXPECT_EQ(stats.limit, 0);
+  EXPECT_EQ(stats.cached, 0);
+  EXPECT_EQ(e.central_freelist().GetSpanStats().num_spans_returned, 2);
+}
+
+TEST_P(CentralFreeListTest, SpanCacheExpiry) {
+  TypeParam e(std::get<0>(GetParam()).size, std::get<0>(GetParam()).pages,
+              std::get<0>(GetParam()).num_to_move, std::get<1>(GetParam()));
+  // Spans with a single object bypass the lists and the cache.
+  if (e.objects_per_span() < 2) return;
+  e.forwarder().set_span_cache(true);
+  e.forwarder().set_span_cache_expiry(absl::Seconds(10));
+  EXPECT_CALL(e.forwarder(), AllocateSpan).Times(2);
+  EXPECT_CALL(e.forwarder(), DeallocateSpans).Times(2);
+
+  auto churn = [&]() {
+    void* object;
+    ASSERT_EQ(e.central_freelist().RemoveRange(absl::MakeSpan(&object, 1)), 1);
+    e.central_freelist().InsertRange({&object, 1});
+  };
+
+  churn();
+  e.central_freelist().UpdateSpanCache(/*trim=*/false);
+  churn();
+  ASSERT_EQ(e.central_freelist().GetSpanCacheStats().cached, 1);
+
+  // A freshly cached span is kept.
+  churn();
+  e.central_freelist().UpdateSpanCache(/*trim=*/false);
+  EXPECT_EQ(e.central_freelist().GetSpanCacheStats().cached, 1);
+
+  // Churn keeps the limit at one span, but the cached span has expired.
+  churn();
+  e.forwarder().AdvanceClock(absl::Seconds(10));
+  e.central_freelist().UpdateSpanCache(/*trim=*/false);
+  SpanCacheStats stats = e.central_freelist().GetSpanCacheStats();
+  EXPECT_EQ(stats.limit, 1);
+  EXPECT_EQ(stats.cached, 0);
+  EXPECT_EQ(e.central_freelist().GetSpanStats().num_spans_returned, 2);
+}
+
+TEST_P(CentralFreeListTest, AddressOrdered) {
+  TypeParam e(std::get<0>(GetParam()).size, std::get<0>(GetParam()).pages,
+              std::get<0>(GetParam()).num_to_move, std::get<1>(GetParam()));
+  if (e.objects_per_span() < 2) return;
+  e.forwarder().set_address_ordered(true);
+
+  // Allocate a span's worth of objects, and free them in a random order, so
+  // that the span's freelist no longer follows addresses.
+  std::vector<void*> objects;
+  void* batch[kMaxObjectsToMove];
+  while (objects.size() < e.objects_per_span()) {
+    const size_t n = e.objects_per_span() - objects.size();
+    int got = e.central_freelist().RemoveRange(
+        absl::MakeSpan(batch, std::min(n, e.batch_size())));
+    ASSERT_GT(got, 0);
+    EXPECT_TRUE(std::is_sorted(batch, batch + got, std::greater<void*>()));
+    objects.insert(objects.end(), batch, batch + got);
+  }
+  absl::BitGen rng;
+  absl::c_shuffle(objects, rng);
+  // Keep one object, so that the span is not returned.
+  for (size_t i = 1; i < objects.size(); ++i) {
+    e.central_freelist().InsertRange({&objects[i], 1});
+  }
+  objects.resize(1);
+
+  const size_t n = std::min(e.objects_per_span() - 1, e.batch_size());
+  int got = e.central_freelist().RemoveRange(absl::MakeSpan(batch, n));
+  ASSERT_EQ(got, static_cast<int>(n));
+  EXPECT_TRUE(std::is_sorted(batch, batch + got, std::greater<void*>()));
+  objects.insert(objects.end(), batch, batch + got);
+
+  for (void* object : objects) {
+    e.central_freelist().InsertRange({&object, 1});
+  }
+}
+
+TEST_P(CentralFreeListTest, NonintrusiveSpans) {
+  TypeParam e(std::get<0>(GetParam()).size, std::get<0>(GetParam()).pages,
+              std::get<0>(GetParam()).num_to_move, std::get<1>(GetParam()));
+  if (e.objects_per_span() < 2) return;
+  e.forwarder().set_nonintrusive_spans(true);
+  const size_t size = std::get<0>(GetParam()).size;
+
+  // Allocate a span's worth of objects and fill them.
+  std::vector<void*> objects;
+  void* batch[kMaxObjectsToMove];
+  while (objects.size() < e.objects_per_span()) {
+    const size_t n = e.objects_per_span() - objects.size();
+    int got = e.central_freelist().RemoveRange(
+        absl::MakeSpan(batch, std::min(n, e.batch_size())));
+    ASSERT_GT(got, 0);
+    objects.insert(objects.end(), batch, batch + got);
+  }
+  for (void* object : objects) {
+    memset(object, 0xab, size);
+  }
+
+  // Free all objects but one, so that the span is not returned.  The span
+  // records them without writing to them.
+  absl::BitGen rng;
+  absl::c_shuffle(objects, rng);
+  for (size_t i = 1; i < objects.size(); ++i) {
+    e.central_freelist().InsertRange({&objects[i], 1});
+  }
+  for (size_t i = 1; i < objects.size(); ++i) {
+    const unsigned char* bytes = static_cast<unsigned char*>(objects[i]);
+    ASSERT_EQ(std::count(bytes, bytes + size, 0xab),
+              static_cast<ptrdiff_t>(size))
+        << i;
+  }
+
+  // Each freed object is handed out again exactly once.
+  absl::flat_hash_set<void*> freed(objects.begin() + 1, objects.end());
+  objects.resize(1);
+  while (!freed.empty()) {
+    int got = e.central_freelist().RemoveRange(
+        absl::MakeSpan(batch, std::min(freed.size(), e.batch_size())));
+    ASSERT_GT(got, 0);
+    for (int i = 0; i < got; ++i) {
+      EXPECT_EQ(freed.erase(batch[i]), 1);
+    }
+    objects.insert(objects.end(), batch, batch + got);
+  }
+
+  for (void* object : objects) {
+    e.central_freelist().InsertRange({&object, 1});
+  }
+}
+
 TEST_P(CentralFreeListTest, SpanFragmentation) {
   // This test is primarily exercising Span itself to model how tcmalloc.cc uses
   // it, but this gives us a self-contained (and sanitizable) implementation of
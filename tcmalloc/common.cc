@@ -23,11 +23,15 @@ namespace tcmalloc {
 namespace tcmalloc_internal {
 
 absl::string_view MemoryTagToLabel(MemoryTag tag) {
+  if (IsNormalTag(tag)) {
+    static constexpr absl::string_view kNormalLabels[kMaxNumaPartitions] = {
+        "NORMAL",    "NORMAL_P1", "NORMAL_P2", "NORMAL_P3",
+        "NORMAL_P4", "NORMAL_P5", "NORMAL_P6", "NORMAL_P7",
+    };
+    return kNormalLabels[NumaPartitionFromTag(tag)];
+  }
+
   switch (tag) {
-    case MemoryTag::kNormal:
-      return "NORMAL";
-    case MemoryTag::kNormalP1:
-      return "NORMAL_P1";
     case MemoryTag::kSampled:
       return "SAMPLED";
     case MemoryTag::kSelSan:
@@ -36,6 +40,10 @@ absl::string_view MemoryTagToLabel(MemoryTag tag) {
       return "COLD";
     case MemoryTag::kMetadata:
       return "METADATA";
+    case MemoryTag::kNormal:
+    case MemoryTag::kNormalP1:
+      // Handled above.
+      break;
   }
 
   ASSUME(false);
@@ -182,12 +182,27 @@ inline constexpr bool kSanitizerAddressSpace = true;
 inline constexpr bool kSanitizerAddressSpace = false;
 #endif
 
+// The largest number of NUMA partitions we can represent in a pointer's
+// MemoryTag (see below).
+inline constexpr size_t kMaxNumaPartitions = 8;
+
 // Disable NUMA awareness under Sanitizers to avoid failing to mmap memory.
+//
+// The number of partitions defaults to 2 and may be raised (up to
+// kMaxNumaPartitions) with -DTCMALLOC_INTERNAL_NUMA_PARTITIONS=N for hosts with
+// more NUMA nodes.  Each partition gets its own size classes, and therefore its
+// own transfer caches, central freelists and page heap.
 #if defined(TCMALLOC_INTERNAL_NUMA_AWARE)
-inline constexpr size_t kNumaPartitions = kSanitizerAddressSpace ? 1 : 2;
+#ifndef TCMALLOC_INTERNAL_NUMA_PARTITIONS
+#define TCMALLOC_INTERNAL_NUMA_PARTITIONS 2
+#endif
+inline constexpr size_t kNumaPartitions =
+    kSanitizerAddressSpace ? 1 : TCMALLOC_INTERNAL_NUMA_PARTITIONS;
 #else
 inline constexpr size_t kNumaPartitions = 1;
 #endif
+static_assert(kNumaPartitions >= 1 && kNumaPartitions <= kMaxNumaPartitions,
+              "Unsupported number of NUMA partitions");
 
 // We have copies of kNumBaseClasses size classes for each NUMA node, followed
 // by any expanded classes.
@@ -233,13 +248,20 @@ inline constexpr int kMaxOverages = 3;
 // scavenging code will shrink it down when its contents are not in use.
 inline constexpr size_t kMaxDynamicFreeListLength = 8192;
 
+// Number of address bits used to store a MemoryTag.  Normal memory is marked
+// by the most significant tag bit, and the NUMA partition is stored in the bits
+// below it, so we need an extra bit once we have more than 4 partitions.
+inline constexpr int kTagBits =
+    kSanitizerAddressSpace ? 2 : (kNumaPartitions <= 4 ? 3 : 4);
+
 enum class MemoryTag : uint8_t {
   // Sampled, infrequently allocated
   kSampled = 0x0,
-  // Normal memory, NUMA partition 0
-  kNormalP0 = kSanitizerAddressSpace ? 0x1 : 0x4,
+  // Normal memory, NUMA partition 0.  Partition N uses kNormalP0 + N, see
+  // NumaNormalTag.
+  kNormalP0 = kSanitizerAddressSpace ? 0x1 : (1 << (kTagBits - 1)),
   // Normal memory, NUMA partition 1
-  kNormalP1 = kSanitizerAddressSpace ? 0xff : 0x6,
+  kNormalP1 = kSanitizerAddressSpace ? 0xff : (1 << (kTagBits - 1)) + 1,
   // Normal memory
   kNormal = kNormalP0,
   // Cold
@@ -252,9 +274,18 @@ enum class MemoryTag : uint8_t {
   kSelSan = kSelSanPresent ? 0x1 : 0xfe,
 };
 
-inline constexpr uintptr_t kTagShift = std::min(kAddressBits - 4, 42);
-inline constexpr uintptr_t kTagMask =
-    uintptr_t{kSanitizerAddressSpace ? 0x3 : 0x7} << kTagShift;
+inline constexpr uintptr_t kTagShift =
+    std::min(kAddressBits - 1 - std::max(kTagBits, 3), 42);
+inline constexpr uintptr_t kTagMask = ((uintptr_t{1} << kTagBits) - 1)
+                                      << kTagShift;
+
+inline constexpr bool IsNormalTag(MemoryTag tag) {
+  if (kSanitizerAddressSpace) {
+    return tag == MemoryTag::kNormal;
+  }
+  return (static_cast<uint8_t>(tag) & static_cast<uint8_t>(MemoryTag::kNormal)) !=
+         0;
+}
 
 inline MemoryTag GetMemoryTag(const void* ptr) {
   return static_cast<MemoryTag>((reinterpret_cast<uintptr_t>(ptr) & kTagMask) >>
@@ -262,14 +293,17 @@ inline MemoryTag GetMemoryTag(const void* ptr) {
 }
 
 inline bool IsNormalMemory(const void* ptr) {
-  // This is slightly faster than checking kNormalP0/P1 separetly.
+  // This is slightly faster than checking each kNormalP* tag separately.
   static_assert((static_cast<uint8_t>(MemoryTag::kNormalP0) &
                  (static_cast<uint8_t>(MemoryTag::kSampled) |
                   static_cast<uint8_t>(MemoryTag::kCold))) == 0);
   bool res = (static_cast<uintptr_t>(GetMemoryTag(ptr)) &
               static_cast<uintptr_t>(MemoryTag::kNormal)) != 0;
-  TC_ASSERT(res == (GetMemoryTag(ptr) == MemoryTag::kNormalP0 ||
-                    GetMemoryTag(ptr) == MemoryTag::kNormalP1),
+  TC_ASSERT(res == (static_cast<uint8_t>(GetMemoryTag(ptr)) >=
+                        static_cast<uint8_t>(MemoryTag::kNormalP0) &&
+                    static_cast<uint8_t>(GetMemoryTag(ptr)) <
+                        static_cast<uint8_t>(MemoryTag::kNormalP0) +
+                            kNumaPartitions),
             "ptr=%p res=%d tag=%d", ptr, res,
             static_cast<int>(GetMemoryTag(ptr)));
   return res;
@@ -331,15 +365,22 @@ inline AllocationAccess AccessFromPointer(void* ptr) {
 }
 
 inline MemoryTag NumaNormalTag(size_t numa_partition) {
-  switch (numa_partition) {
-    case 0:
-      return MemoryTag::kNormalP0;
-    case 1:
-      return MemoryTag::kNormalP1;
-    default:
-      ASSUME(false);
-      __builtin_unreachable();
+  TC_ASSERT_LT(numa_partition, kNumaPartitions);
+  return static_cast<MemoryTag>(static_cast<uint8_t>(MemoryTag::kNormalP0) +
+                                numa_partition);
+}
+
+// Returns the NUMA partition of a normal memory tag.
+inline size_t NumaPartitionFromTag(MemoryTag tag) {
+  TC_ASSERT(IsNormalTag(tag), "tag=%d", static_cast<int>(tag));
+  if constexpr (kNumaPartitions == 1) {
+    return 0;
   }
+
+  const size_t partition = static_cast<uint8_t>(tag) -
+                           static_cast<uint8_t>(MemoryTag::kNormalP0);
+  TC_ASSERT_LT(partition, kNumaPartitions);
+  return partition;
 }
 
 inline size_t NumaPartitionFromPointer(void* ptr) {
@@ -347,12 +388,11 @@ inline size_t NumaPartitionFromPointer(void* ptr) {
     return 0;
   }
 
-  switch (GetMemoryTag(ptr)) {
-    case MemoryTag::kNormalP1:
-      return 1;
-    default:
-      return 0;
+  const MemoryTag tag = GetMemoryTag(ptr);
+  if (!IsNormalTag(tag)) {
+    return 0;
   }
+  return NumaPartitionFromTag(tag);
 }
 
 // Linker initialized, so this lock can be accessed at any time.
@@ -19,17 +19,22 @@
 #include <cstdint>
 #include <new>
 
+#include "absl/base/attributes.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/internal_malloc_extension.h"
+#include "tcmalloc/locked_cpu_cache.h"
 #include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
+#include "tcmalloc/thread_cache.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
+int ABSL_ATTRIBUTE_WEAK default_want_locked_cpu_caches();
+
 static void ActivatePerCpuCaches() {
   if (tcmalloc::tcmalloc_internal::tc_globals.CpuCacheActive()) {
     // Already active.
@@ -44,12 +49,31 @@ static void ActivatePerCpuCaches() {
     ThreadCache::BecomeIdle();
     // If there's a problem with this code, let's notice it right away:
     ::operator delete(::operator new(1));
+  } else if (Parameters::per_cpu_caches() &&
+             default_want_locked_cpu_caches != nullptr &&
+             default_want_locked_cpu_caches() > 0) {
+    tc_globals.InitIfNecessary();
+    locked_cpu_cache().Activate();
+    ThreadCache::BecomeIdle();
   }
 }
 
+int ABSL_ATTRIBUTE_WEAK default_want_lazy_per_cpu_caches();
+
+// The transfer cache refills of the thread caches after which lazily
+// activated per-CPU caches are activated.  Each refill moves a batch of
+// objects, so this is on the order of a hundred thousand allocations.
+constexpr int32_t kLazyPerCpuCacheActivationRefills = 4096;
+
 class PerCPUInitializer {
  public:
   PerCPUInitializer() {
+    if (default_want_lazy_per_cpu_caches != nullptr &&
+        default_want_lazy_per_cpu_caches() > 0) {
+      ThreadCache::DeferPerCpuCacheActivation(
+          kLazyPerCpuCacheActivationRefills);
+      return;
+    }
    ActivatePerCpuCaches();
   }
 };
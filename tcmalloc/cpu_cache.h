@@ -36,12 +36,15 @@
 #include "absl/base/thread_annotations.h"
 #include "absl/container/fixed_array.h"
 #include "absl/functional/function_ref.h"
+#include "absl/numeric/bits.h"
 #include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/experiment.h"
 #include "tcmalloc/experiment_config.h"
 #include "tcmalloc/internal/allocation_guard.h"
+#include "tcmalloc/internal/background_wakeup.h"
+#include "tcmalloc/internal/cache_topology.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/cpu_utils.h"
 #include "tcmalloc/internal/environment.h"
@@ -51,8 +54,11 @@
 #include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/internal/percpu_tcmalloc.h"
 #include "tcmalloc/internal/sysinfo.h"
+#include "tcmalloc/internal/usdt.h"
 #include "tcmalloc/pages.h"
 #include "tcmalloc/parameters.h"
+#include "tcmalloc/size_class_rates.h"
+#include "tcmalloc/slow_path_latency.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/thread_cache.h"
 #include "tcmalloc/transfer_cache.h"
@@ -124,6 +130,11 @@ class StaticForwarder {
     tc_globals.page_allocator().ShrinkToUsageLimit(Length(0));
   }
 
+  static void NotifyCpuCacheOverflows() {
+    tc_globals.background_wakeup().Notify(
+        BackgroundWakeup::kCpuCacheOverflows);
+  }
+
   static bool per_cpu_caches_dynamic_slab_enabled() {
     return Parameters::per_cpu_caches_dynamic_slab_enabled();
   }
@@ -136,6 +147,38 @@ class StaticForwarder {
     return Parameters::per_cpu_caches_dynamic_slab_shrink_threshold();
   }
 
+  static bool per_cpu_caches_steal_objects_enabled() {
+    return Parameters::per_cpu_caches_steal_objects_enabled();
+  }
+
+  static bool per_cpu_caches_asymmetric_batches() {
+    return Parameters::per_cpu_caches_asymmetric_batches();
+  }
+
+  static bool per_cpu_caches_adaptive_batches() {
+    return Parameters::per_cpu_caches_adaptive_batches();
+  }
+
+  static bool per_cpu_caches_ping_pong_hysteresis() {
+    return Parameters::per_cpu_caches_ping_pong_hysteresis();
+  }
+
+  static unsigned GetL3FromCpuId(int cpu) {
+    return CacheTopology::Instance().GetL3FromCpuId(cpu);
+  }
+
+  static bool per_cpu_caches_remote_free_enabled() {
+    return Parameters::per_cpu_caches_remote_free_enabled();
+  }
+
+  static bool per_cpu_caches_hugepage_slabs_enabled() {
+    return Parameters::per_cpu_caches_hugepage_slabs_enabled();
+  }
+
+  static bool per_cpu_caches_incremental_slab_resize() {
+    return Parameters::per_cpu_caches_incremental_slab_resize();
+  }
+
   static size_t class_to_size(int size_class) {
     return tc_globals.sizemap().class_to_size(size_class);
   }
@@ -218,6 +261,65 @@ struct GetShiftMaxCapacity {
   SlabShiftBounds shift_bounds;
 };
 
+// RemoteFreeList holds objects of a single size class that were freed on other
+// cpus on behalf of the cpu owning the list.  Objects are linked through their
+// first word.  Any cpu may push a batch, and the owner takes the whole list at
+// once, so the list is not subject to ABA problems.
+class RemoteFreeList {
+ public:
+  constexpr RemoteFreeList() = default;
+
+  // Pushes <batch> onto the list.  Returns false, without taking ownership of
+  // any object, if the list would grow beyond kMaxObjectsToMove objects.
+  bool Push(absl::Span<void* const> batch) {
+    TC_ASSERT(!batch.empty());
+    const size_t n = batch.size();
+    if (length_.fetch_add(n, std::memory_order_relaxed) + n >
+        kMaxObjectsToMove) {
+      length_.fetch_sub(n, std::memory_order_relaxed);
+      return false;
+    }
+
+    for (size_t i = 0; i + 1 < n; ++i) {
+      *reinterpret_cast<void**>(batch[i]) = batch[i + 1];
+    }
+    void** last = reinterpret_cast<void**>(batch[n - 1]);
+    void* head = head_.load(std::memory_order_relaxed);
+    do {
+      *last = head;
+    } while (!head_.compare_exchange_weak(head, batch[0],
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+    return true;
+  }
+
+  // Removes all objects from the list and stores them in <batch>.  Returns the
+  // number of objects removed.
+  // REQUIRES: batch.size() >= kMaxObjectsToMove.
+  size_t PopAll(absl::Span<void*> batch) {
+    TC_ASSERT_GE(batch.size(), kMaxObjectsToMove);
+    if (head_.load(std::memory_order_relaxed) == nullptr) return 0;
+
+    void* object = head_.exchange(nullptr, std::memory_order_acquire);
+    size_t n = 0;
+    while (object != nullptr) {
+      TC_ASSERT_LT(n, batch.size());
+      batch[n++] = object;
+      object = *reinterpret_cast<void**>(object);
+    }
+    length_.fetch_sub(n, std::memory_order_relaxed);
+    return n;
+  }
+
+  // Returns the number of objects on the list, including objects that are
+  // still being pushed.
+  size_t length() const { return length_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<void*> head_{nullptr};
+  std::atomic<size_t> length_{0};
+};
+
 template <typename Forwarder>
 class CpuCache {
  public:
@@ -249,6 +351,22 @@ class CpuCache {
     // Tracks number of misses recorded as of the end of the last per-class
     // max capacity resize interval.
     kMaxCapacityResize,
+    // Tracks total number of refills.
+    kRefillTotal,
+    // Tracks number of refills recorded as of the end of the last batch length
+    // resize interval.
+    kRefillResize,
+    // Tracks total number of underflows and overflows.
+    kSlowPathTotal,
+    // Tracks number of underflows and overflows recorded as of the end of the
+    // last UpdateColdSizeClasses() interval.
+    kSlowPathColdCheck,
+    // Tracks total number of times a cpu was found to alternate between
+    // underflows and overflows.
+    kPingPongTotal,
+    // Tracks number of underflows and overflows recorded as of the end of the
+    // last UpdateCacheHistograms() interval.
+    kSlowPathHistogram,
     kNumTypes,
   };
 
@@ -289,9 +407,34 @@ class CpuCache {
     std::atomic<size_t> madvise_failed_bytes;
   };
 
+  // Distributions over the caches of each populated cpu and size class with
+  // capacity on it.
+  struct CacheHistograms {
+    static constexpr int kOccupancyBuckets = 10;
+    static constexpr int kMissBuckets = 12;
+
+    // Bucket b counts the caches holding at least b / kOccupancyBuckets of
+    // their capacity, and less than (b + 1) / kOccupancyBuckets of it, except
+    // for the last bucket, which includes full caches.
+    uint64_t occupancy[kOccupancyBuckets] = {};
+    // Bucket 0 counts the caches without underflows or overflows during an
+    // UpdateCacheHistograms() interval, and bucket b > 0 those with
+    // [2^(b-1), 2^b) of them.  The last bucket is unbounded.
+    uint64_t misses[kMissBuckets] = {};
+
+    static constexpr int MissBucketFor(size_t misses) {
+      const int bucket = absl::bit_width(misses);
+      return bucket < kMissBuckets ? bucket : kMissBuckets - 1;
+    }
+  };
+
   // Sets the lower limit on the capacity that can be stolen from the cpu cache.
   static constexpr double kCacheCapacityThreshold = 0.20;
 
+  // Number of overflows on a CPU since the last shuffle at which the
+  // background thread is woken to rebalance cache capacity.
+  static constexpr size_t kOverflowWakeupThreshold = 1024;
+
   constexpr CpuCache() = default;
 
   // tcmalloc explicitly initializes its global state (to be safe for
@@ -325,6 +468,22 @@ class CpuCache {
   // when it's known that no hooks are installed.
   void DeallocateSlowNoHooks(void* ptr, size_t size_class);
 
+  // Allocates up to batch.size() objects of <size_class> into <batch>.  Objects
+  // are popped from the current cpu's slab in a single restartable sequence
+  // and any shortfall is fetched from the backing transfer cache.  Returns the
+  // number of objects allocated, which is less than batch.size() only when
+  // allocation fails.
+  //
+  // REQUIRES: no hooks are installed.
+  size_t AllocateBatch(size_t size_class, absl::Span<void*> batch);
+
+  // Frees all objects in <batch>, which must belong to <size_class>.  Objects
+  // are pushed onto the current cpu's slab in a single restartable sequence
+  // and whatever does not fit is released to the backing transfer cache.
+  //
+  // REQUIRES: no hooks are installed.
+  void DeallocateBatch(size_t size_class, absl::Span<void*> batch);
+
   // Force all Allocate/DeallocateFast to fail in the current thread
   // if malloc hooks are installed.
   void MaybeForceSlowPath();
@@ -340,6 +499,9 @@ class CpuCache {
 
   PerCPUMetadataState MetadataMemoryUsage() const;
 
+  // Reports how much of the current slabs can be mapped by hugepages.
+  PerCPUSlabTlbCoverage SlabTlbCoverage() const;
+
   // Give the number of bytes used in all cpu caches.
   uint64_t TotalUsedBytes() const;
 
@@ -359,6 +521,13 @@ class CpuCache {
   uint64_t CacheLimit() const;
   void SetCacheLimit(uint64_t v);
 
+  // Set of NUMA partitions, with bit p set for partition p.  ShuffleCpuCaches,
+  // TryReclaimingCaches and ResizeSizeClasses only touch the caches of the
+  // CPUs in the given partitions, so that threads processing disjoint sets of
+  // partitions may run them concurrently.
+  using PartitionMask = uint64_t;
+  static constexpr PartitionMask kAllPartitions = ~PartitionMask{0};
+
   // Shuffles per-cpu caches using the number of underflows and overflows that
   // occurred in the prior interval. It selects the top per-cpu caches
   // with highest misses as candidates, iterates through the other per-cpu
@@ -367,13 +536,75 @@ class CpuCache {
   //
   // TODO(vgogte): There are quite a few knobs that we can play around with in
   // ShuffleCpuCaches.
-  void ShuffleCpuCaches();
+  void ShuffleCpuCaches(PartitionMask partitions = kAllPartitions);
+
+  // Keeps the total capacity of the populated per-cpu caches within
+  // <effective_cpus> times the per-cpu limit, so that a process that can keep
+  // only a few CPUs busy (e.g. because of a CPU quota) does not hold a full
+  // cache on every CPU it has run on.  Caches are shrunk towards an even share
+  // of the budget, but not below kCacheCapacityThreshold of the limit, and
+  // regrown if the budget increases.  May be called from any processor.
+  void UpdateCacheBudget(int effective_cpus);
+
+  // Drains the caches of the populated cpus that are not in <usable>, because
+  // they went offline or were taken out of the process's cpuset, to the
+  // backing caches.  Such cpus are left out of UpdateCacheBudget(), so that
+  // their share of the budget goes to the remaining cpus, until they are
+  // usable again.  Returns the number of bytes drained.
+  uint64_t DrainUnusableCpus(const CpuSet& usable);
 
   // Tries to reclaim inactive per-CPU caches. It iterates through the set of
   // populated cpu caches and reclaims the caches that:
   // (1) had same number of used bytes since the last interval,
   // (2) had no change in the number of misses since the last interval.
-  void TryReclaimingCaches();
+  // Returns the number of caches reclaimed.
+  int TryReclaimingCaches(PartitionMask partitions = kAllPartitions);
+
+  // Records the number of objects in each size class of the populated per-cpu
+  // caches, keeping the lowest count seen since the last DecayCaches() as an
+  // estimate of the objects that were not used since.  Meant to be called
+  // several times per DecayCaches() period.
+  void UpdateDecayLowWaterMarks(PartitionMask partitions = kAllPartitions);
+
+  // Returns half of the objects of each cpu/size class that were not used
+  // since the last call, per UpdateDecayLowWaterMarks(), to the backing cache,
+  // like ThreadCache::Scavenge does with its low-water marks.  Objects left
+  // over by a burst of frees thus decay away over a few periods, while the
+  // objects the cpu keeps using stay cached.  Returns the number of bytes
+  // released.
+  size_t DecayCaches(PartitionMask partitions = kAllPartitions);
+
+  // A size class that missed at most this many times across all cpus during
+  // an UpdateColdSizeClasses() interval, and whose cached objects were not
+  // otherwise touched, bypasses the per-cpu caches.
+  static constexpr size_t kColdSizeClassMaxMisses = 8;
+  // A bypassed size class is cached again once this many of its objects are
+  // allocated or freed within an interval.
+  static constexpr uint64_t kColdSizeClassMaxOps = 256;
+
+  // When <enabled>, makes the size classes that have seen almost no use since
+  // the last call bypass the per-cpu caches: their objects are returned to
+  // the backing cache, their capacity to the cpus' slack for other size
+  // classes to grow into, and they are then allocated from and freed to the
+  // backing cache directly.  Bypassed size classes that became busy are
+  // cached again right away (see kColdSizeClassMaxOps), and all of them are
+  // when <enabled> is false.  Meant to be called about once a minute.
+  void UpdateColdSizeClasses(bool enabled);
+
+  // Reports whether <size_class> currently bypasses the per-cpu caches because
+  // it is rarely used.
+  bool IsColdSizeClass(size_t size_class) const {
+    TC_ASSERT_LT(size_class, kNumClasses);
+    return cold_size_class_[size_class].load(std::memory_order_relaxed);
+  }
+
+  // Reports the number of times <size_class> started bypassing the per-cpu
+  // caches because it was rarely used.
+  uint64_t GetColdSizeClassBypasses(size_t size_class) const {
+    TC_ASSERT_LT(size_class, kNumClasses);
+    return cold_size_class_bypasses_[size_class].load(
+        std::memory_order_relaxed);
+  }
 
   // Resize size classes for up to kNumCpuCachesToResize cpu caches per
   // interval.
@@ -383,7 +614,35 @@ class CpuCache {
   // size classes and attempts to grow up to kMaxSizeClassesToResize number of
   // classes by stealing capacity from rest of them. Per iteration, it resizes
   // size classes for up to kNumCpuCachesToResize number of per-cpu caches.
-  void ResizeSizeClasses();
+  void ResizeSizeClasses(PartitionMask partitions = kAllPartitions);
+
+  // A size class grows its batch length when at least kMinCpusToGrowBatch
+  // cpus refilled it kMinRefillsToGrowBatch times or more in an interval.
+  static constexpr int kMinCpusToGrowBatch = 4;
+  static constexpr size_t kMinRefillsToGrowBatch = 16;
+  // Adaptive batch lengths stay within a factor of kBatchLengthRange of
+  // SizeMap::num_objects_to_move.
+  static constexpr size_t kBatchLengthRange = 4;
+  // When per_cpu_caches_adaptive_batches is enabled, doubles the batch length
+  // of size classes that kept missing on many cpus since the last call, to
+  // amortize transfer cache lock acquisitions, and halves it for size classes
+  // that did not miss at all, to strand less memory in idle caches.
+  // Otherwise, resets all size classes to their default batch lengths.
+  void ResizeBatchLengths();
+
+  // Returns the number of objects <size_class> currently moves to and from the
+  // backing cache at a time.
+  size_t BatchLength(size_t size_class) const;
+
+  // Sets the batch length of <size_class>, such as one an earlier process
+  // learned, clamped to the range ResizeBatchLengths() keeps it in.  Has no
+  // effect unless per_cpu_caches_adaptive_batches is enabled.
+  void SetBatchLength(size_t size_class, size_t length);
+
+  // Sets the capacity <size_class> starts with in the caches of cpus that are
+  // populated from now on, as far as their available capacity allows.  Zero
+  // leaves it to grow from zero on demand.
+  void SetWarmCapacity(size_t size_class, uint16_t capacity);
 
   // Gets the max capacity for the size class using the current per-cpu shift.
   uint16_t GetMaxCapacity(int size_class, uint8_t shift) const;
@@ -420,6 +679,25 @@ class CpuCache {
   // of bytes we sent back.  This function is thread safe.
   uint64_t Reclaim(int cpu);
 
+  // Acquires and releases the cross-cpu locks of all cpus around fork(), so
+  // that a child does not inherit them held by threads that only exist in the
+  // parent.  No-ops if the caches have not been activated.
+  void AcquireInternalLocks() ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    locked_for_fork_ = resize_ != nullptr;
+    if (!locked_for_fork_) return;
+    const int num_cpus = NumCPUs();
+    for (int cpu = 0; cpu < num_cpus; ++cpu) {
+      resize_[cpu].lock.Lock();
+    }
+  }
+  void ReleaseInternalLocks() ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    if (!locked_for_fork_) return;
+    for (int cpu = NumCPUs() - 1; cpu >= 0; --cpu) {
+      resize_[cpu].lock.Unlock();
+    }
+    locked_for_fork_ = false;
+  }
+
   // Reports number of times the size classes were resized for <cpu>.
   uint64_t GetNumResizes(int cpu) const;
 
@@ -480,6 +758,34 @@ class CpuCache {
 
   size_t GetDynamicSlabFailedBytes() const;
 
+  // Moves the refills and overflows counted since the last call into the
+  // per-size-class rate time series.  Called by the background thread.
+  void UpdateSizeClassRates() { size_class_rates_.Update(); }
+
+  SizeClassRates::Rates GetSizeClassRates(size_t size_class) const {
+    return size_class_rates_.GetRates(size_class);
+  }
+
+  // Reports the number of <size_class> objects freed on a cpu outside of the
+  // NUMA partition the size class belongs to.
+  uint64_t GetNumaRemoteFrees(size_t size_class) const {
+    TC_ASSERT_LT(size_class, kNumClasses);
+    return numa_remote_frees_[size_class].load(std::memory_order_relaxed);
+  }
+
+  // Reports the number of times a cpu was found to alternate between
+  // underflows and overflows of <size_class>.
+  uint64_t GetPingPongs(size_t size_class) const;
+
+  // Computes the occupancy and miss histograms of the caches as of now and
+  // over the interval since the last call, and adds them to the running
+  // totals.  Called by the background thread.
+  void UpdateCacheHistograms();
+
+  // Reports the histograms computed by the last UpdateCacheHistograms(), or
+  // their sums over all calls when <total>.
+  CacheHistograms GetCacheHistograms(bool total) const;
+
   // Report statistics
   void Print(Printer* out) const;
   void PrintInPbtxt(PbtxtRegion* region) const;
@@ -511,8 +817,11 @@ class CpuCache {
     // <overflow> says if it's overflow or underflow.
     // <grow> is caller approximation of whether we want to grow capacity.
     // <successive> will contain number of successive overflows/underflows.
+    // <alternations> will contain number of successive misses that each
+    // went the other way than the one before, saturating at 15.
     // Returns if capacity needs to be grown aggressively (i.e. by batch size).
-    bool Update(bool overflow, bool grow, uint32_t* successive);
+    bool Update(bool overflow, bool grow, uint32_t* successive,
+                uint32_t* alternations);
     uint32_t Tick();
 
     // Records a miss for a provided <type>. A miss occurs when size class
@@ -544,7 +853,9 @@ class CpuCache {
       // last overflow/underflow?
       uint32_t overflow : 1;
       // number of times Steal checked this class since the last grow
-      uint32_t quiescent_ticks : 15;
+      uint32_t quiescent_ticks : 11;
+      // number of successive changes between overflows and underflows
+      uint32_t alternations : 4;
       // number of successive overflows/underflows
       uint32_t successive : 16;
     };
@@ -568,8 +879,12 @@ class CpuCache {
     std::atomic<size_t> available;
     // Size class to steal from for the clock-wise algorithm.
     size_t next_steal = 1;
+    // CPU to start from when stealing objects for this CPU on a refill miss.
+    std::atomic<int> next_object_steal;
     // Track whether we have ever populated this CPU.
     std::atomic<bool> populated;
+    // Whether the CPU was not usable as of the last DrainUnusableCpus().
+    std::atomic<bool> unusable;
     // For cross-cpu operations. We can't allocate while holding one of these so
     // please use AllocationGuardSpinLockHolder to hold it.
     absl::base_internal::SpinLock lock ABSL_ACQUIRED_BEFORE(pageheap_lock){
@@ -591,6 +906,11 @@ class CpuCache {
     // Tracks last time this CPU was reclaimed.  If last underflow/overflow data
     // appears before this point in time, we ignore the CPU.
     std::atomic<int64_t> last_reclaim;
+    // Lowest length of each size class seen by UpdateDecayLowWaterMarks()
+    // since the last DecayCaches().
+    std::atomic<uint16_t> decay_low_water[kNumClasses];
+    // Length of each size class as of the last UpdateColdSizeClasses().
+    uint16_t cold_check_length[kNumClasses];
   };
 
   // Determines how we distribute memory in the per-cpu cache to the various
@@ -609,14 +929,76 @@ class CpuCache {
   void ReleaseToBackingCache(size_t size_class, absl::Span<void*> batch);
 
   void* Refill(int cpu, size_t size_class);
+
+  // Tries to take up to batch.size() objects of <size_class> from the cache of
+  // an idle cpu that shares an L3 cache with <cpu>.  A cpu is considered idle
+  // for <size_class> if its last miss for the size class was an overflow, i.e.
+  // it has recently been freeing rather than allocating objects.  Returns the
+  // number of objects stored in <batch>.
+  size_t StealObjectsFromSiblingCache(int cpu, size_t size_class,
+                                      absl::Span<void*> batch);
+
+  // Returns the list of <size_class> objects freed on behalf of <cpu>.
+  RemoteFreeList& remote_free(int cpu, size_t size_class) const {
+    TC_ASSERT_NE(remote_free_, nullptr);
+    return remote_free_[cpu * kNumClasses + size_class];
+  }
+
+  // Hands <batch> to the remote free list of the cpu that last refilled
+  // <size_class>, if that is not <cpu>.  Returns false if the objects should
+  // be released to the backing cache instead.
+  bool ReleaseToRemoteFreeList(int cpu, size_t size_class,
+                               absl::Span<void*> batch);
+
+  // Releases all objects on <cpu>'s remote free lists to the backing cache.
+  // Returns the number of bytes released.
+  uint64_t DrainRemoteFreeLists(int cpu);
+
+  // Returns the list of <size_class> objects freed on <cpu> that belong to
+  // another NUMA partition.
+  RemoteFreeList& numa_remote_free(int cpu, size_t size_class) const {
+    TC_ASSERT_NE(numa_remote_free_, nullptr);
+    return numa_remote_free_[cpu * kNumClasses + size_class];
+  }
+
+  // Returns true if <size_class> belongs to a NUMA partition other than that
+  // of <cpu>, so that objects freed on <cpu> should go back to their home
+  // partition rather than into <cpu>'s cache.
+  bool IsNumaRemote(int cpu, size_t size_class) const {
+    return numa_remote_free_ != nullptr &&
+           size_class < kExpandedClassesStart &&
+           !forwarder_.numa_topology().IsLocalToCpuPartition(size_class, cpu);
+  }
+
+  // Frees <ptr>, of a <size_class> that IsNumaRemote() on <cpu>.  Objects are
+  // gathered on <cpu>'s list for the size class and released to the transfer
+  // cache of their home partition a batch at a time.
+  void DeallocateNumaRemote(int cpu, size_t size_class, void* ptr);
+
+  // Releases all objects on <cpu>'s NUMA remote free lists to the transfer
+  // caches of their home partitions.  Returns the number of bytes released.
+  uint64_t DrainNumaRemoteFreeLists(int cpu);
   std::pair<int, bool> CacheCpuSlab();
   void Populate(int cpu);
 
   // Returns true if we bypass cpu cache for a <size_class>. We may bypass
   // per-cpu cache when we enable certain configurations of sharded transfer
-  // cache.
+  // cache, or when the size class is rarely used (see UpdateColdSizeClasses).
   bool BypassCpuCache(size_t size_class) const;
 
+  // Returns true if the sharded transfer cache replaces the per-cpu cache for
+  // <size_class>.
+  bool BypassToShardedTransferCache(size_t size_class) const;
+
+  // Allocates or frees an object of rarely used <size_class> through the
+  // backing cache, and caches <size_class> again if it turns out busy.
+  void* AllocateColdSizeClass(size_t size_class);
+  void DeallocateColdSizeClass(void* ptr, size_t size_class);
+  void RecordColdSizeClassOp(size_t size_class);
+
+  // Returns the objects and capacity of <size_class> on all cpus.
+  void DrainColdSizeClass(size_t size_class);
+
   // Returns true if we use sharded transfer cache as a backing cache for
   // per-cpu caches. If a sharded transfer cache is used, we fetch/release
   // from/to a sharded transfer cache. Else, we use a legacy transfer cache.
@@ -672,11 +1054,29 @@ class CpuCache {
   // them. Currently, we use a clock-like algorithm to identify the size_class
   // to steal from.
   void StealFromOtherCache(int cpu, int max_populated_cpu,
-                           absl::Span<CpuMissStat> skip_cpus, size_t bytes);
+                           absl::Span<CpuMissStat> skip_cpus, size_t bytes,
+                           PartitionMask partitions);
+
+  // Returns whether <cpu> belongs to one of <partitions>.
+  bool InPartitions(int cpu, PartitionMask partitions) const {
+    return (partitions >> forwarder_.numa_topology().GetCpuPartition(cpu)) & 1;
+  }
+
+  // Returns the index of the round-robin hints used when processing
+  // <partitions>.
+  static size_t HintIndex(PartitionMask partitions) {
+    return std::min<size_t>(absl::countr_zero(partitions),
+                            kNumaPartitions - 1);
+  }
 
   // Try to steal one object from cpu/size_class. Return bytes stolen.
   size_t ShrinkOtherCache(int cpu, size_t size_class);
 
+  // Reduces the capacity of <cpu>'s cache by up to <bytes>, first from its
+  // unallocated capacity, then by shrinking its size classes.  Returns the
+  // number of bytes the capacity was reduced by.
+  size_t ShrinkCapacity(int cpu, size_t bytes);
+
   // Resizes capacities of up to kMaxSizeClassesToResize size classes for a
   // single <cpu>.
   void ResizeCpuSizeClasses(int cpu);
@@ -696,6 +1096,8 @@ class CpuCache {
 
   // Tracking data for each CPU's cache resizing efforts.
   ResizeInfo* resize_ = nullptr;
+  // Whether AcquireInternalLocks locked the resize_ locks.
+  bool locked_for_fork_ = false;
 
   // Tracks initial and maximum slab shift bounds.
   SlabShiftBounds shift_bounds_{};
@@ -704,13 +1106,44 @@ class CpuCache {
   std::atomic<uint16_t> max_capacity_[kNumClasses] = {0};
 
   // Provides a hint to StealFromOtherCache() so that we can steal from the
-  // caches in a round-robin fashion.
-  int next_cpu_cache_steal_ = 0;
+  // caches in a round-robin fashion, per HintIndex().
+  std::atomic<int> next_cpu_cache_steal_[kNumaPartitions] = {};
+
+  // NumCPUs() * kNumClasses remote free lists, indexed by the cpu that drains
+  // them.  nullptr unless remote frees were enabled on Activate().
+  RemoteFreeList* remote_free_ = nullptr;
+
+  // NumCPUs() * kNumClasses lists of objects freed on each cpu that belong to
+  // another NUMA partition.  nullptr unless NUMA awareness was enabled on
+  // Activate().
+  RemoteFreeList* numa_remote_free_ = nullptr;
+
+  // The number of objects of each size class freed outside of their NUMA
+  // partition.
+  std::atomic<uint64_t> numa_remote_frees_[kNumClasses] = {};
+
+  // Whether each size class bypasses the per-cpu caches because it is rarely
+  // used, the objects allocated and freed since it started or since the last
+  // UpdateColdSizeClasses(), and the number of times it started.
+  std::atomic<bool> cold_size_class_[kNumClasses] = {};
+  std::atomic<uint64_t> cold_size_class_ops_[kNumClasses] = {};
+  std::atomic<uint64_t> cold_size_class_bypasses_[kNumClasses] = {};
+
+  // The cpu that most recently refilled each size class, or -1.  Overflowing
+  // cpus hand their excess objects to this cpu.
+  std::atomic<int> last_refill_cpu_[kNumClasses] = {};
+
+  // The batch length set by ResizeBatchLengths() for each size class, or 0
+  // for its default SizeMap::num_objects_to_move.
+  std::atomic<uint16_t> batch_length_[kNumClasses] = {};
+
+  // The capacity set by SetWarmCapacity() for each size class.
+  std::atomic<uint16_t> warm_capacity_[kNumClasses] = {};
 
   // Provides a hint to ResizeSizeClasses() that records the last CPU for which
   // we resized size classes. We use this to resize size classes for CPUs in a
-  // round-robin fashion.
-  std::atomic<int> last_cpu_size_class_resize_ = 0;
+  // round-robin fashion, per HintIndex().
+  std::atomic<int> last_cpu_size_class_resize_[kNumaPartitions] = {};
 
   // Records the slab copy currently in use. We maintain kResizeSlabCopies
   // sets of kNumPossiblePerCpuShifts slabs. While resizing maximum size class
@@ -724,6 +1157,13 @@ class CpuCache {
   ABSL_ATTRIBUTE_NO_UNIQUE_ADDRESS Forwarder forwarder_;
 
   DynamicSlabInfo dynamic_slab_info_{};
+  SizeClassRates size_class_rates_;
+
+  // The histograms of the last UpdateCacheHistograms() ([0]) and their sums
+  // ([1]).
+  std::atomic<uint64_t>
+      occupancy_histogram_[2][CacheHistograms::kOccupancyBuckets] = {};
+  std::atomic<uint64_t> miss_histogram_[2][CacheHistograms::kMissBuckets] = {};
 
   // Pointers to allocations for slabs of each shift value for use in
   // ResizeSlabs. This memory is allocated on the arena, and it is nonresident
@@ -774,7 +1214,7 @@ static CpuSet FillActiveCpuMask() {
     allowed_cpus.Zero();
   }
 
-#ifdef PERCPU_USE_RSEQ
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
   const bool real_cpus = !subtle::percpu::UsingVirtualCpus();
 #else
   const bool real_cpus = true;
@@ -839,7 +1279,7 @@ inline size_t CpuCache<Forwarder>::MaxCapacity(size_t size_class) const {
     return 0;
   }
 
-  if (BypassCpuCache(size_class)) {
+  if (BypassToShardedTransferCache(size_class)) {
     return 0;
   }
 
@@ -1015,6 +1455,29 @@ inline void CpuCache<Forwarder>::Activate() {
     resize_[cpu].capacity.store(max_cache_size, std::memory_order_relaxed);
   }
 
+  if (forwarder_.per_cpu_caches_remote_free_enabled()) {
+    const size_t num_lists = num_cpus * kNumClasses;
+    remote_free_ = reinterpret_cast<RemoteFreeList*>(
+        forwarder_.Alloc(sizeof(RemoteFreeList) * num_lists,
+                         std::align_val_t{alignof(RemoteFreeList)}));
+    for (size_t i = 0; i < num_lists; ++i) {
+      new (&remote_free_[i]) RemoteFreeList();
+    }
+    for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+      last_refill_cpu_[size_class].store(-1, std::memory_order_relaxed);
+    }
+  }
+
+  if (topology.numa_aware()) {
+    const size_t num_lists = num_cpus * kNumClasses;
+    numa_remote_free_ = reinterpret_cast<RemoteFreeList*>(
+        forwarder_.Alloc(sizeof(RemoteFreeList) * num_lists,
+                         std::align_val_t{alignof(RemoteFreeList)}));
+    for (size_t i = 0; i < num_lists; ++i) {
+      new (&numa_remote_free_[i]) RemoteFreeList();
+    }
+  }
+
   void* slabs =
       AllocOrReuseSlabs(&forwarder_.Alloc,
                         subtle::percpu::ToShiftType(per_cpu_shift), num_cpus,
@@ -1039,6 +1502,20 @@ inline void CpuCache<Forwarder>::Deactivate() {
                 "ResizeInfo is expected to be trivially destructible");
   forwarder_.Dealloc(resize_, sizeof(*resize_) * num_cpus,
                      std::align_val_t{alignof(decltype(*resize_))});
+  if (remote_free_ != nullptr) {
+    static_assert(std::is_trivially_destructible_v<RemoteFreeList>,
+                  "RemoteFreeList is expected to be trivially destructible");
+    forwarder_.Dealloc(remote_free_,
+                       sizeof(RemoteFreeList) * num_cpus * kNumClasses,
+                       std::align_val_t{alignof(RemoteFreeList)});
+    remote_free_ = nullptr;
+  }
+  if (numa_remote_free_ != nullptr) {
+    forwarder_.Dealloc(numa_remote_free_,
+                       sizeof(RemoteFreeList) * num_cpus * kNumClasses,
+                       std::align_val_t{alignof(RemoteFreeList)});
+    numa_remote_free_ = nullptr;
+  }
 }
 
 template <class Forwarder>
@@ -1047,6 +1524,7 @@ inline int CpuCache<Forwarder>::FetchFromBackingCache(size_t size_class,
   if (UseBackingShardedTransferCache(size_class)) {
     return forwarder_.sharded_transfer_cache().RemoveRange(size_class, batch);
   }
+  forwarder_.sharded_transfer_cache().RecordUnshardedAccess(size_class);
   return forwarder_.transfer_cache().RemoveRange(size_class, batch);
 }
 
@@ -1058,6 +1536,7 @@ inline void CpuCache<Forwarder>::ReleaseToBackingCache(
     return;
   }
 
+  forwarder_.sharded_transfer_cache().RecordUnshardedAccess(size_class);
   forwarder_.transfer_cache().InsertRange(size_class, batch);
 }
 
@@ -1071,6 +1550,9 @@ void* CpuCache<Forwarder>::AllocateSlow(size_t size_class) {
 template <class Forwarder>
 void* CpuCache<Forwarder>::AllocateSlowNoHooks(size_t size_class) {
   if (BypassCpuCache(size_class)) {
+    if (ABSL_PREDICT_FALSE(!BypassToShardedTransferCache(size_class))) {
+      return AllocateColdSizeClass(size_class);
+    }
     return forwarder_.sharded_transfer_cache().Pop(size_class);
   }
   auto [cpu, cached] = CacheCpuSlab();
@@ -1101,7 +1583,13 @@ void* CpuCache<Forwarder>::AllocateSlowNoHooks(size_t size_class) {
 // return memory to the correct CPU.)
 template <class Forwarder>
 inline void* CpuCache<Forwarder>::Refill(int cpu, size_t size_class) {
+  SlowPathLatencyTimer timer(SlowPathTier::kCpuCacheRefill, size_class);
   const size_t target = UpdateCapacity(cpu, size_class, false);
+  resize_[cpu].per_class[size_class].RecordMiss(PerClassMissType::kRefillTotal);
+  if (remote_free_ != nullptr &&
+      last_refill_cpu_[size_class].load(std::memory_order_relaxed) != cpu) {
+    last_refill_cpu_[size_class].store(cpu, std::memory_order_relaxed);
+  }
 
   // Refill target objects in batch_length batches.
   size_t total = 0;
@@ -1112,7 +1600,20 @@ inline void* CpuCache<Forwarder>::Refill(int cpu, size_t size_class) {
 
   do {
     const size_t want = std::min(kMaxObjectsToMove, target - total);
-    got = FetchFromBackingCache(size_class, absl::MakeSpan(batch, want));
+    got = 0;
+    if (total == 0 && remote_free_ != nullptr) {
+      // Objects freed for us on other cpus may exceed <want>; whatever does
+      // not fit in the slab is released below.
+      got = remote_free(cpu, size_class).PopAll(absl::MakeSpan(batch));
+    }
+    if (got == 0 && total == 0 &&
+        forwarder_.per_cpu_caches_steal_objects_enabled()) {
+      got = StealObjectsFromSiblingCache(cpu, size_class,
+                                         absl::MakeSpan(batch, want));
+    }
+    if (got == 0) {
+      got = FetchFromBackingCache(size_class, absl::MakeSpan(batch, want));
+    }
     if (got == 0) {
       break;
     }
@@ -1129,11 +1630,133 @@ inline void* CpuCache<Forwarder>::Refill(int cpu, size_t size_class) {
       }
     }
   } while (got == kMaxObjectsToMove && i == 0 && total < target);
+  size_class_rates_.RecordRefill(size_class, total);
+  TC_USDT_PROBE(cpu_cache_refill, size_class, target, total);
   return result;
 }
 
+template <class Forwarder>
+inline size_t CpuCache<Forwarder>::StealObjectsFromSiblingCache(
+    int cpu, size_t size_class, absl::Span<void*> batch) {
+  // Stopping a remote cpu requires a fence, so only probe a few candidates and
+  // only steal when the sibling holds at least a full batch.
+  constexpr int kMaxCandidates = 4;
+  const size_t batch_length = forwarder_.num_objects_to_move(size_class);
+  const unsigned l3 = forwarder_.GetL3FromCpuId(cpu);
+  const int num_cpus = NumCPUs();
+
+  int src_cpu =
+      resize_[cpu].next_object_steal.load(std::memory_order_relaxed) %
+      num_cpus;
+  for (int i = 0, candidates = 0; i < num_cpus && candidates < kMaxCandidates;
+       ++i, src_cpu = (src_cpu + 1) % num_cpus) {
+    if (src_cpu == cpu || forwarder_.GetL3FromCpuId(src_cpu) != l3) continue;
+    if (!HasPopulated(src_cpu)) continue;
+    if (freelist_.Length(src_cpu, size_class) < batch_length) continue;
+    ++candidates;
+
+    const ResizeInfo& src = resize_[src_cpu];
+    if (src.last_miss_cycles[0][size_class].load(std::memory_order_relaxed) >=
+        src.last_miss_cycles[1][size_class].load(std::memory_order_relaxed)) {
+      continue;
+    }
+
+    // Don't wait for cross-cpu operations (e.g. StealFromOtherCache) that
+    // are already in progress on the source cpu.
+    if (!resize_[src_cpu].lock.TryLock()) continue;
+    size_t got;
+    {
+      subtle::percpu::ScopedSlabCpuStop<kNumClasses> cpu_stop(freelist_,
+                                                              src_cpu);
+      got = freelist_.PopOtherCache(src_cpu, size_class, batch.data(),
+                                    batch.size());
+    }
+    resize_[src_cpu].lock.Unlock();
+
+    if (got != 0) {
+      resize_[cpu].next_object_steal.store(src_cpu,
+                                           std::memory_order_relaxed);
+      return got;
+    }
+  }
+  resize_[cpu].next_object_steal.store(src_cpu, std::memory_order_relaxed);
+  return 0;
+}
+
+template <class Forwarder>
+inline bool CpuCache<Forwarder>::ReleaseToRemoteFreeList(
+    int cpu, size_t size_class, absl::Span<void*> batch) {
+  if (remote_free_ == nullptr) return false;
+  const int dest_cpu =
+      last_refill_cpu_[size_class].load(std::memory_order_relaxed);
+  if (dest_cpu < 0 || dest_cpu == cpu) return false;
+  return remote_free(dest_cpu, size_class).Push(batch);
+}
+
+template <class Forwarder>
+inline uint64_t CpuCache<Forwarder>::DrainRemoteFreeLists(int cpu) {
+  if (remote_free_ == nullptr) return 0;
+  uint64_t bytes = 0;
+  void* batch[kMaxObjectsToMove];
+  for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+    const size_t n =
+        remote_free(cpu, size_class).PopAll(absl::MakeSpan(batch));
+    if (n == 0) continue;
+    ReleaseToBackingCache(size_class, {batch, n});
+    bytes += n * forwarder_.class_to_size(size_class);
+  }
+  return bytes;
+}
+
+template <class Forwarder>
+void CpuCache<Forwarder>::DeallocateNumaRemote(int cpu, size_t size_class,
+                                               void* ptr) {
+  numa_remote_frees_[size_class].fetch_add(1, std::memory_order_relaxed);
+  RemoteFreeList& list = numa_remote_free(cpu, size_class);
+  // Several threads may run on (or have migrated off) <cpu>, so the length is
+  // only a hint: Push() bounds the list regardless.
+  if (list.length() + 1 < forwarder_.num_objects_to_move(size_class) &&
+      list.Push({&ptr, 1})) {
+    return;
+  }
+
+  void* batch[kMaxObjectsToMove];
+  size_t n = list.PopAll(absl::MakeSpan(batch));
+  if (n < kMaxObjectsToMove) {
+    batch[n++] = ptr;
+  } else {
+    ReleaseToBackingCache(size_class, {&ptr, 1});
+  }
+  // The size class encodes the partition, so this reaches the transfer cache
+  // of the objects' home partition.
+  ReleaseToBackingCache(size_class, {batch, n});
+}
+
+template <class Forwarder>
+inline uint64_t CpuCache<Forwarder>::DrainNumaRemoteFreeLists(int cpu) {
+  if (numa_remote_free_ == nullptr) return 0;
+  uint64_t bytes = 0;
+  void* batch[kMaxObjectsToMove];
+  for (size_t size_class = 1; size_class < kExpandedClassesStart;
+       ++size_class) {
+    const size_t n =
+        numa_remote_free(cpu, size_class).PopAll(absl::MakeSpan(batch));
+    if (n == 0) continue;
+    ReleaseToBackingCache(size_class, {batch, n});
+    bytes += n * forwarder_.class_to_size(size_class);
+  }
+  return bytes;
+}
+
 template <class Forwarder>
 inline bool CpuCache<Forwarder>::BypassCpuCache(size_t size_class) const {
+  return BypassToShardedTransferCache(size_class) ||
+         ABSL_PREDICT_FALSE(IsColdSizeClass(size_class));
+}
+
+template <class Forwarder>
+inline bool CpuCache<Forwarder>::BypassToShardedTransferCache(
+    size_t size_class) const {
   // We bypass per-cpu cache when sharded transfer cache is enabled for large
   // size classes (i.e. when we use the traditional configuration of the sharded
   // transfer cache).
@@ -1141,6 +1764,32 @@ inline bool CpuCache<Forwarder>::BypassCpuCache(size_t size_class) const {
          forwarder_.UseShardedCacheForLargeClassesOnly();
 }
 
+template <class Forwarder>
+inline void CpuCache<Forwarder>::RecordColdSizeClassOp(size_t size_class) {
+  const uint64_t ops = cold_size_class_ops_[size_class].fetch_add(
+                           1, std::memory_order_relaxed) +
+                       1;
+  if (ABSL_PREDICT_FALSE(ops == kColdSizeClassMaxOps)) {
+    // The per-cpu cache grows the size class back on its next misses.
+    cold_size_class_[size_class].store(false, std::memory_order_relaxed);
+  }
+}
+
+template <class Forwarder>
+void* CpuCache<Forwarder>::AllocateColdSizeClass(size_t size_class) {
+  RecordColdSizeClassOp(size_class);
+  void* ptr = nullptr;
+  FetchFromBackingCache(size_class, absl::MakeSpan(&ptr, 1));
+  return ptr;
+}
+
+template <class Forwarder>
+void CpuCache<Forwarder>::DeallocateColdSizeClass(void* ptr,
+                                                  size_t size_class) {
+  RecordColdSizeClassOp(size_class);
+  ReleaseToBackingCache(size_class, {&ptr, 1});
+}
+
 template <class Forwarder>
 inline bool CpuCache<Forwarder>::UseBackingShardedTransferCache(
     size_t size_class) const {
@@ -1187,6 +1836,41 @@ inline size_t TargetOverflowRefillCount(size_t capacity, size_t batch_length,
   return target;
 }
 
+// Number of successive misses in the same direction after which a cpu is
+// considered to only allocate, or only free, a size class.
+inline constexpr uint32_t kOneSidedMisses = 4;
+// Capacity, in batches, that a size class with one-sided misses may grow to.
+inline constexpr size_t kOneSidedCapacityBatches = 4;
+
+// Number of successive misses, each in the other direction than the one
+// before, after which a cpu is considered to ping-pong a size class between
+// refills and overflows.
+inline constexpr uint32_t kPingPongMisses = 4;
+// Capacity, in batches, that a size class that ping-pongs may grow to.
+inline constexpr size_t kPingPongCapacityBatches = 3;
+
+// As TargetOverflowRefillCount, for a size class that ping-pongs between
+// refills and overflows.  Only half a batch is moved, so that the list stays
+// partially filled and absorbs the next swing in the other direction.
+inline size_t TargetPingPongOverflowRefillCount(size_t capacity,
+                                                size_t batch_length) {
+  const size_t target = std::min((batch_length + 1) / 2 + 1, capacity + 1);
+  TC_ASSERT_NE(target, 0);
+  return target;
+}
+
+// As TargetOverflowRefillCount, for a size class that hits a long series of
+// overflows (or underflows) only. Objects kept in the list for the other
+// direction would never be used, so return (or refill) the whole list.
+inline size_t TargetOneSidedOverflowRefillCount(size_t capacity,
+                                                size_t batch_length,
+                                                size_t successive) {
+  const size_t max = (1 << std::min<uint32_t>(successive, 10)) * batch_length;
+  const size_t target = std::min(capacity + 1, max);
+  TC_ASSERT_NE(target, 0);
+  return target;
+}
+
 template <class Forwarder>
 inline size_t CpuCache<Forwarder>::UpdateCapacity(int cpu, size_t size_class,
                                                   bool overflow) {
@@ -1200,6 +1884,17 @@ inline size_t CpuCache<Forwarder>::UpdateCapacity(int cpu, size_t size_class,
   //  - We increase capacity beyond 2 * batch_length only when an overflow is
   //    followed by an underflow. That's the only case when we could benefit
   //    from larger capacity -- the overflow and the underflow would collapse.
+  //  - With per_cpu_caches_asymmetric_batches, a cpu that only frees (or only
+  //    allocates) a size class instead grows it up to
+  //    kOneSidedCapacityBatches batches and moves the whole list on each
+  //    miss, so that it exchanges fewer, larger batches with the transfer
+  //    cache.
+  //  - With per_cpu_caches_ping_pong_hysteresis, a cpu whose misses keep
+  //    alternating between overflows and underflows is moving about a batch
+  //    back and forth.  It grows the size class up to
+  //    kPingPongCapacityBatches batches and moves only half a batch on each
+  //    miss, so that the list has room and objects for the next swing.  Once
+  //    the pattern stops, Steal reclaims the extra capacity.
   //
   // Note: we can't understand when we have a perfectly-sized list, because for
   // a perfectly-sized list we don't hit any slow paths which looks the same as
@@ -1212,18 +1907,36 @@ inline size_t CpuCache<Forwarder>::UpdateCapacity(int cpu, size_t size_class,
   // We assert that the return value, target, is non-zero, so starting from an
   // initial capacity of zero means we may be populating this core for the
   // first time.
-  size_t batch_length = forwarder_.num_objects_to_move(size_class);
+  size_t batch_length = BatchLength(size_class);
   const size_t max_capacity = GetMaxCapacity(size_class, freelist_.GetShift());
   size_t capacity = freelist_.Capacity(cpu, size_class);
   const bool grow_by_one = capacity < 2 * batch_length;
   uint32_t successive = 0;
+  uint32_t alternations = 0;
   ResizeInfo& resize = resize_[cpu];
   const int64_t now = absl::base_internal::CycleClock::Now();
   // TODO(ckennelly): Use a strongly typed enum.
   resize.last_miss_cycles[overflow][size_class].store(
       now, std::memory_order_relaxed);
-  bool grow_by_batch =
-      resize.per_class[size_class].Update(overflow, grow_by_one, &successive);
+  bool grow_by_batch = resize.per_class[size_class].Update(
+      overflow, grow_by_one, &successive, &alternations);
+  resize.per_class[size_class].RecordMiss(PerClassMissType::kSlowPathTotal);
+  const bool one_sided = successive >= kOneSidedMisses &&
+                         forwarder_.per_cpu_caches_asymmetric_batches();
+  if (one_sided && capacity < kOneSidedCapacityBatches * batch_length) {
+    grow_by_batch = true;
+  }
+  const bool ping_pong = alternations >= kPingPongMisses &&
+                         forwarder_.per_cpu_caches_ping_pong_hysteresis();
+  if (ping_pong) {
+    if (alternations == kPingPongMisses) {
+      resize.per_class[size_class].RecordMiss(
+          PerClassMissType::kPingPongTotal);
+    }
+    if (capacity < kPingPongCapacityBatches * batch_length) {
+      grow_by_batch = true;
+    }
+  }
   if ((grow_by_one || grow_by_batch) && capacity != max_capacity) {
     size_t increase = 1;
     if (grow_by_batch) {
@@ -1243,6 +1956,13 @@ inline size_t CpuCache<Forwarder>::UpdateCapacity(int cpu, size_t size_class,
     resize_[cpu].per_class[size_class].RecordMiss(
         PerClassMissType::kMaxCapacityTotal);
   }
+  if (one_sided) {
+    return TargetOneSidedOverflowRefillCount(capacity, batch_length,
+                                             successive);
+  }
+  if (ping_pong) {
+    return TargetPingPongOverflowRefillCount(capacity, batch_length);
+  }
   return TargetOverflowRefillCount(capacity, batch_length, successive);
 }
 
@@ -1265,6 +1985,18 @@ ABSL_ATTRIBUTE_NOINLINE void CpuCache<Forwarder>::Populate(int cpu) {
   }
   freelist_.InitCpu(cpu, GetMaxCapacityFunctor(freelist_.GetShift()));
   resize_[cpu].populated.store(true, std::memory_order_release);
+
+  // Grow fails harmlessly if we were rescheduled since CacheCpuSlab.
+  for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+    const size_t capacity =
+        warm_capacity_[size_class].load(std::memory_order_relaxed);
+    const size_t size = forwarder_.class_to_size(size_class);
+    if (capacity == 0 || size == 0) continue;
+    const size_t available =
+        resize_[cpu].available.load(std::memory_order_relaxed) / size;
+    if (available == 0) continue;
+    Grow(cpu, size_class, std::min(capacity, available));
+  }
 }
 
 inline size_t subtract_at_least(std::atomic<size_t>* a, size_t min,
@@ -1309,12 +2041,14 @@ inline void CpuCache<Forwarder>::Grow(int cpu, size_t size_class,
 }
 
 template <class Forwarder>
-inline void CpuCache<Forwarder>::TryReclaimingCaches() {
+inline int CpuCache<Forwarder>::TryReclaimingCaches(
+    PartitionMask partitions) {
   const int num_cpus = NumCPUs();
+  int reclaimed = 0;
 
   for (int cpu = 0; cpu < num_cpus; ++cpu) {
     // Nothing to reclaim if the cpu is not populated.
-    if (!HasPopulated(cpu)) {
+    if (!HasPopulated(cpu) || !InPartitions(cpu, partitions)) {
       continue;
     }
 
@@ -1333,16 +2067,210 @@ inline void CpuCache<Forwarder>::TryReclaimingCaches() {
     // stayed constant since the last interval.
     if (used_bytes != 0 && used_bytes == prev_used_bytes && misses == 0) {
       Reclaim(cpu);
+      ++reclaimed;
     }
 
     // Takes a snapshot of used bytes in the cache at the end of this interval
     // so that we can calculate if cache usage changed in the next interval.
     //
-    // Reclaim occurs on a single thread. So, the relaxed store to used_bytes
-    // is safe.
+    // A cpu is only reclaimed by a single thread. So, the relaxed store to
+    // used_bytes is safe.
     resize_[cpu].reclaim_used_bytes.store(used_bytes,
                                           std::memory_order_relaxed);
   }
+  return reclaimed;
+}
+
+template <class Forwarder>
+inline void CpuCache<Forwarder>::UpdateDecayLowWaterMarks(
+    PartitionMask partitions) {
+  const int num_cpus = NumCPUs();
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    if (!HasPopulated(cpu) || !InPartitions(cpu, partitions)) continue;
+    for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+      std::atomic<uint16_t>& low_water =
+          resize_[cpu].decay_low_water[size_class];
+      const size_t length = freelist_.Length(cpu, size_class);
+      if (length < low_water.load(std::memory_order_relaxed)) {
+        low_water.store(length, std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+template <class Forwarder>
+inline size_t CpuCache<Forwarder>::DecayCaches(PartitionMask partitions) {
+  const int num_cpus = NumCPUs();
+  size_t released = 0;
+  void* batch[kMaxObjectsToMove];
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    if (!HasPopulated(cpu) || !InPartitions(cpu, partitions)) continue;
+    ResizeInfo& info = resize_[cpu];
+
+    // Only stop the cpu if it has unused objects.
+    bool has_unused = false;
+    for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+      if (info.decay_low_water[size_class].load(std::memory_order_relaxed) !=
+          0) {
+        has_unused = true;
+        break;
+      }
+    }
+
+    if (has_unused) {
+      AllocationGuardSpinLockHolder h(&info.lock);
+      subtle::percpu::ScopedSlabCpuStop<kNumClasses> cpu_stop(freelist_, cpu);
+      for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+        const size_t low_water =
+            info.decay_low_water[size_class].load(std::memory_order_relaxed);
+        if (low_water == 0) continue;
+        size_t to_release = low_water > 1 ? low_water / 2 : 1;
+        const size_t batch_length =
+            std::min<size_t>(forwarder_.num_objects_to_move(size_class),
+                             kMaxObjectsToMove);
+        while (to_release > 0) {
+          const size_t got = freelist_.PopOtherCache(
+              cpu, size_class, batch, std::min(to_release, batch_length));
+          if (got == 0) break;
+          ReleaseToBackingCache(size_class, {batch, got});
+          released += got * forwarder_.class_to_size(size_class);
+          to_release -= got;
+        }
+      }
+    }
+
+    // Start the next period from the current lengths.
+    for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+      info.decay_low_water[size_class].store(
+          freelist_.Length(cpu, size_class), std::memory_order_relaxed);
+    }
+  }
+  return released;
+}
+
+template <class Forwarder>
+inline void CpuCache<Forwarder>::UpdateColdSizeClasses(bool enabled) {
+  const int num_cpus = NumCPUs();
+  for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+    // Look at every cpu, even if the size class is not a candidate, so that
+    // the next interval starts from the current state.
+    size_t misses = 0;
+    size_t capacity = 0;
+    bool used_without_miss = false;
+    for (int cpu = 0; cpu < num_cpus; ++cpu) {
+      if (!HasPopulated(cpu)) continue;
+      ResizeInfo& info = resize_[cpu];
+      const size_t cpu_misses =
+          info.per_class[size_class].GetAndUpdateIntervalMisses(
+              PerClassMissType::kSlowPathTotal,
+              PerClassMissType::kSlowPathColdCheck);
+      const uint16_t length = freelist_.Length(cpu, size_class);
+      // Without a miss, a change in length means the fast path used the
+      // cached objects.
+      if (cpu_misses == 0 && length != info.cold_check_length[size_class]) {
+        used_without_miss = true;
+      }
+      info.cold_check_length[size_class] = length;
+      misses += cpu_misses;
+      capacity += freelist_.Capacity(cpu, size_class);
+    }
+
+    cold_size_class_ops_[size_class].store(0, std::memory_order_relaxed);
+    if (IsColdSizeClass(size_class)) {
+      if (!enabled) {
+        cold_size_class_[size_class].store(false, std::memory_order_relaxed);
+      } else if (capacity != 0) {
+        // A slow path that raced with the bypass may have grown the size
+        // class again.
+        DrainColdSizeClass(size_class);
+      }
+      continue;
+    }
+
+    // Size classes without capacity hold no memory to begin with.
+    if (!enabled || capacity == 0 || used_without_miss ||
+        misses > kColdSizeClassMaxMisses ||
+        forwarder_.class_to_size(size_class) == 0 ||
+        BypassToShardedTransferCache(size_class)) {
+      continue;
+    }
+    cold_size_class_[size_class].store(true, std::memory_order_relaxed);
+    cold_size_class_bypasses_[size_class].fetch_add(1,
+                                                    std::memory_order_relaxed);
+    DrainColdSizeClass(size_class);
+  }
+}
+
+template <class Forwarder>
+inline void CpuCache<Forwarder>::UpdateCacheHistograms() {
+  CacheHistograms h;
+  for (int cpu = 0, num_cpus = NumCPUs(); cpu < num_cpus; ++cpu) {
+    if (!HasPopulated(cpu)) continue;
+    ResizeInfo& info = resize_[cpu];
+    for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+      const size_t misses =
+          info.per_class[size_class].GetAndUpdateIntervalMisses(
+              PerClassMissType::kSlowPathTotal,
+              PerClassMissType::kSlowPathHistogram);
+      const size_t capacity = freelist_.Capacity(cpu, size_class);
+      if (capacity == 0) continue;
+      const size_t length =
+          std::min<size_t>(freelist_.Length(cpu, size_class), capacity);
+      ++h.occupancy[std::min(length * CacheHistograms::kOccupancyBuckets /
+                                 capacity,
+                             size_t{CacheHistograms::kOccupancyBuckets - 1})];
+      ++h.misses[CacheHistograms::MissBucketFor(misses)];
+    }
+  }
+
+  for (int b = 0; b < CacheHistograms::kOccupancyBuckets; ++b) {
+    occupancy_histogram_[0][b].store(h.occupancy[b], std::memory_order_relaxed);
+    occupancy_histogram_[1][b].fetch_add(h.occupancy[b],
+                                         std::memory_order_relaxed);
+  }
+  for (int b = 0; b < CacheHistograms::kMissBuckets; ++b) {
+    miss_histogram_[0][b].store(h.misses[b], std::memory_order_relaxed);
+    miss_histogram_[1][b].fetch_add(h.misses[b], std::memory_order_relaxed);
+  }
+}
+
+template <class Forwarder>
+inline typename CpuCache<Forwarder>::CacheHistograms
+CpuCache<Forwarder>::GetCacheHistograms(bool total) const {
+  CacheHistograms h;
+  for (int b = 0; b < CacheHistograms::kOccupancyBuckets; ++b) {
+    h.occupancy[b] =
+        occupancy_histogram_[total][b].load(std::memory_order_relaxed);
+  }
+  for (int b = 0; b < CacheHistograms::kMissBuckets; ++b) {
+    h.misses[b] = miss_histogram_[total][b].load(std::memory_order_relaxed);
+  }
+  return h;
+}
+
+template <class Forwarder>
+inline void CpuCache<Forwarder>::DrainColdSizeClass(size_t size_class) {
+  const size_t size = forwarder_.class_to_size(size_class);
+  const size_t batch_length = forwarder_.num_objects_to_move(size_class);
+  for (int cpu = 0, num_cpus = NumCPUs(); cpu < num_cpus; ++cpu) {
+    if (!HasPopulated(cpu) || freelist_.Capacity(cpu, size_class) == 0) {
+      continue;
+    }
+    ResizeInfo& info = resize_[cpu];
+    AllocationGuardSpinLockHolder h(&info.lock);
+    subtle::percpu::ScopedSlabCpuStop<kNumClasses> cpu_stop(freelist_, cpu);
+    const size_t capacity = freelist_.Capacity(cpu, size_class);
+    if (capacity == 0) continue;
+    const size_t shrunk = freelist_.ShrinkOtherCache(
+        cpu, size_class, capacity,
+        [&](size_t size_class, void** batch, size_t count) {
+          for (size_t i = 0; i < count; i += batch_length) {
+            ReleaseToBackingCache(
+                size_class, {batch + i, std::min(batch_length, count - i)});
+          }
+        });
+    info.available.fetch_add(shrunk * size, std::memory_order_relaxed);
+  }
 }
 
 template <class Forwarder>
@@ -1586,11 +2514,12 @@ void CpuCache<Forwarder>::ResizeSizeClassMaxCapacities()
 }
 
 template <class Forwarder>
-inline void CpuCache<Forwarder>::ResizeSizeClasses() {
+inline void CpuCache<Forwarder>::ResizeSizeClasses(PartitionMask partitions) {
   const int num_cpus = NumCPUs();
   // Start resizing from where we left off the last time, and resize size class
   // capacities for up to kNumCpuCachesToResize per-cpu caches.
-  int cpu = last_cpu_size_class_resize_.load(std::memory_order_relaxed);
+  std::atomic<int>& hint = last_cpu_size_class_resize_[HintIndex(partitions)];
+  int cpu = hint.load(std::memory_order_relaxed);
   int num_cpus_resized = 0;
 
   // Record the cumulative misses for the caches so that we can select the
@@ -1603,7 +2532,7 @@ inline void CpuCache<Forwarder>::ResizeSizeClasses() {
     TC_ASSERT_LT(cpu, num_cpus);
 
     // Nothing to resize if the cache is not populated.
-    if (!HasPopulated(cpu)) {
+    if (!HasPopulated(cpu) || !InPartitions(cpu, partitions)) {
       continue;
     }
 
@@ -1620,7 +2549,73 @@ inline void CpuCache<Forwarder>::ResizeSizeClasses() {
   }
   // Record the cpu hint for which the size classes were resized so that we
   // can start from the subsequent cpu in the next interval.
-  last_cpu_size_class_resize_.store(cpu, std::memory_order_relaxed);
+  hint.store(cpu, std::memory_order_relaxed);
+}
+
+template <class Forwarder>
+inline size_t CpuCache<Forwarder>::BatchLength(size_t size_class) const {
+  const size_t length =
+      batch_length_[size_class].load(std::memory_order_relaxed);
+  return length != 0 ? length : forwarder_.num_objects_to_move(size_class);
+}
+
+template <class Forwarder>
+inline void CpuCache<Forwarder>::SetBatchLength(size_t size_class,
+                                                size_t length) {
+  if (!forwarder_.per_cpu_caches_adaptive_batches()) return;
+  const size_t default_length = forwarder_.num_objects_to_move(size_class);
+  if (default_length == 0) return;
+  length = std::clamp(length,
+                      std::max<size_t>(default_length / kBatchLengthRange, 1),
+                      std::min(default_length * kBatchLengthRange,
+                               kMaxObjectsToMove));
+  batch_length_[size_class].store(length == default_length ? 0 : length,
+                                  std::memory_order_relaxed);
+}
+
+template <class Forwarder>
+inline void CpuCache<Forwarder>::SetWarmCapacity(size_t size_class,
+                                                 uint16_t capacity) {
+  warm_capacity_[size_class].store(capacity, std::memory_order_relaxed);
+}
+
+template <class Forwarder>
+void CpuCache<Forwarder>::ResizeBatchLengths() {
+  if (!forwarder_.per_cpu_caches_adaptive_batches()) {
+    for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+      batch_length_[size_class].store(0, std::memory_order_relaxed);
+    }
+    return;
+  }
+
+  const int num_cpus = NumCPUs();
+  for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+    int missing_cpus = 0;
+    size_t refills = 0;
+    for (int cpu = 0; cpu < num_cpus; ++cpu) {
+      if (!HasPopulated(cpu)) continue;
+      const size_t cpu_refills =
+          resize_[cpu].per_class[size_class].GetAndUpdateIntervalMisses(
+              PerClassMissType::kRefillTotal, PerClassMissType::kRefillResize);
+      refills += cpu_refills;
+      missing_cpus += cpu_refills >= kMinRefillsToGrowBatch;
+    }
+
+    const size_t default_length = forwarder_.num_objects_to_move(size_class);
+    if (default_length == 0) continue;
+    const size_t min_length =
+        std::max<size_t>(default_length / kBatchLengthRange, 1);
+    const size_t max_length =
+        std::min(default_length * kBatchLengthRange, kMaxObjectsToMove);
+    size_t length = BatchLength(size_class);
+    if (missing_cpus >= kMinCpusToGrowBatch) {
+      length = std::min(2 * length, max_length);
+    } else if (refills == 0) {
+      length = std::max(length / 2, min_length);
+    }
+    batch_length_[size_class].store(length == default_length ? 0 : length,
+                                    std::memory_order_relaxed);
+  }
 }
 
 template <class Forwarder>
@@ -1713,7 +2708,7 @@ void CpuCache<Forwarder>::ResizeCpuSizeClasses(int cpu) {
 }
 
 template <class Forwarder>
-inline void CpuCache<Forwarder>::ShuffleCpuCaches() {
+inline void CpuCache<Forwarder>::ShuffleCpuCaches(PartitionMask partitions) {
   // Knobs that we can potentially tune depending on the workloads.
   constexpr double kBytesToStealPercent = 5.0;
   constexpr int kMaxNumStealCpus = 5;
@@ -1726,7 +2721,7 @@ inline void CpuCache<Forwarder>::ShuffleCpuCaches() {
   int max_populated_cpu = -1;
   int num_populated_cpus = 0;
   for (int cpu = 0; cpu < num_cpus; ++cpu) {
-    if (!HasPopulated(cpu)) {
+    if (!HasPopulated(cpu) || !InPartitions(cpu, partitions)) {
       continue;
     }
     const CpuCacheMissStats miss_stats =
@@ -1770,12 +2765,14 @@ inline void CpuCache<Forwarder>::ShuffleCpuCaches() {
       break;
     }
     absl::Span<CpuMissStat> skip = {misses.begin(), static_cast<size_t>(i + 1)};
-    StealFromOtherCache(misses[i].cpu, max_populated_cpu, skip, to_steal);
+    StealFromOtherCache(misses[i].cpu, max_populated_cpu, skip, to_steal,
+                        partitions);
   }
 
   // Takes a snapshot of underflows and overflows at the end of this interval
   // so that we can calculate the misses that occurred in the next interval.
   for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    if (!InPartitions(cpu, partitions)) continue;
     UpdateIntervalCacheMissStats(cpu, MissCount::kShuffle);
   }
 }
@@ -1783,7 +2780,7 @@ inline void CpuCache<Forwarder>::ShuffleCpuCaches() {
 template <class Forwarder>
 inline void CpuCache<Forwarder>::StealFromOtherCache(
     int cpu, int max_populated_cpu, absl::Span<CpuMissStat> skip_cpus,
-    size_t bytes) {
+    size_t bytes, PartitionMask partitions) {
   constexpr double kCacheMissThreshold = 0.80;
 
   const CpuCacheMissStats dest_misses =
@@ -1800,7 +2797,8 @@ inline void CpuCache<Forwarder>::StealFromOtherCache(
   // We use next_cpu_cache_steal_ as a hint to start our search for cpu ids to
   // steal from so that we can iterate through the cpus in a nice round-robin
   // fashion.
-  int src_cpu = next_cpu_cache_steal_;
+  std::atomic<int>& hint = next_cpu_cache_steal_[HintIndex(partitions)];
+  int src_cpu = hint.load(std::memory_order_relaxed);
 
   // We iterate through max_populate_cpus number of cpus to steal from.
   // max_populate_cpus records the max cpu id that has been populated. Note
@@ -1830,8 +2828,9 @@ inline void CpuCache<Forwarder>::StealFromOtherCache(
     }
     if (skip) continue;
 
-    // We do not steal from the cache that hasn't been populated yet.
-    if (!HasPopulated(src_cpu)) continue;
+    // We do not steal from the cache that hasn't been populated yet, nor from
+    // other partitions' caches.
+    if (!HasPopulated(src_cpu) || !InPartitions(src_cpu, partitions)) continue;
 
     // We do not steal from cache that has capacity less than our lower
     // capacity threshold.
@@ -1878,7 +2877,7 @@ inline void CpuCache<Forwarder>::StealFromOtherCache(
   }
   // Record the last cpu id we stole from, which would provide a hint to the
   // next time we iterate through the cpus for stealing.
-  next_cpu_cache_steal_ = src_cpu;
+  hint.store(src_cpu, std::memory_order_relaxed);
 
   // Increment the capacity of the destination cpu cache by the amount of bytes
   // acquired from source caches.
@@ -1888,6 +2887,94 @@ inline void CpuCache<Forwarder>::StealFromOtherCache(
   }
 }
 
+template <class Forwarder>
+inline void CpuCache<Forwarder>::UpdateCacheBudget(int effective_cpus) {
+  const int num_cpus = NumCPUs();
+  const uint64_t limit = CacheLimit();
+
+  auto in_budget = [&](int cpu) {
+    return HasPopulated(cpu) &&
+           !resize_[cpu].unusable.load(std::memory_order_relaxed);
+  };
+
+  int num_populated_cpus = 0;
+  uint64_t total = 0;
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    if (!in_budget(cpu)) continue;
+    ++num_populated_cpus;
+    total += Capacity(cpu);
+  }
+  if (num_populated_cpus == 0) {
+    return;
+  }
+
+  const uint64_t budget =
+      limit * std::clamp(effective_cpus, 1, num_populated_cpus);
+  const uint64_t target =
+      std::max<uint64_t>(budget / num_populated_cpus,
+                         kCacheCapacityThreshold * limit);
+
+  for (int cpu = 0; cpu < num_cpus && total != budget; ++cpu) {
+    if (!in_budget(cpu)) continue;
+    const uint64_t capacity = Capacity(cpu);
+    if (total > budget && capacity > target) {
+      total -= ShrinkCapacity(cpu, std::min(capacity - target, total - budget));
+    } else if (total < budget && capacity < target) {
+      const uint64_t grow = std::min(target - capacity, budget - total);
+      resize_[cpu].available.fetch_add(grow, std::memory_order_relaxed);
+      resize_[cpu].capacity.fetch_add(grow, std::memory_order_relaxed);
+      total += grow;
+    }
+  }
+}
+
+template <class Forwarder>
+inline uint64_t CpuCache<Forwarder>::DrainUnusableCpus(
+    const CpuSet& usable) {
+  const int num_cpus = NumCPUs();
+  uint64_t bytes = 0;
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    const bool unusable = !usable.IsSet(cpu);
+    resize_[cpu].unusable.store(unusable, std::memory_order_relaxed);
+    // Threads that were running on the cpu as it became unusable may still
+    // have put objects in its cache, so it is drained until it stays empty.
+    if (unusable && HasPopulated(cpu) && UsedBytes(cpu) != 0) {
+      bytes += Reclaim(cpu);
+    }
+  }
+  return bytes;
+}
+
+template <class Forwarder>
+inline size_t CpuCache<Forwarder>::ShrinkCapacity(int cpu, size_t bytes) {
+  // Unallocated capacity can be taken without touching the slab.
+  size_t shrunk = subtract_at_least(&resize_[cpu].available, 0, bytes);
+  if (shrunk != 0) {
+    resize_[cpu].capacity.fetch_sub(shrunk, std::memory_order_relaxed);
+    if (shrunk >= bytes) {
+      return shrunk;
+    }
+  }
+
+  AllocationGuardSpinLockHolder h(&resize_[cpu].lock);
+  subtle::percpu::ScopedSlabCpuStop<kNumClasses> cpu_stop(freelist_, cpu);
+  size_t size_class = resize_[cpu].next_steal;
+  for (size_t i = 1; i < kNumClasses; ++i, ++size_class) {
+    if (size_class >= kNumClasses) {
+      size_class = 1;
+    }
+    if (size_t stolen = ShrinkOtherCache(cpu, size_class)) {
+      resize_[cpu].capacity.fetch_sub(stolen, std::memory_order_relaxed);
+      shrunk += stolen;
+      if (shrunk >= bytes) {
+        break;
+      }
+    }
+  }
+  resize_[cpu].next_steal = size_class;
+  return shrunk;
+}
+
 template <class Forwarder>
 size_t CpuCache<Forwarder>::ShrinkOtherCache(int cpu, size_t size_class) {
   TC_ASSERT(cpu >= 0 && cpu < NumCPUs(), "cpu=%d", cpu);
@@ -1992,6 +3079,9 @@ void CpuCache<Forwarder>::DeallocateSlow(void* ptr, size_t size_class) {
 template <class Forwarder>
 void CpuCache<Forwarder>::DeallocateSlowNoHooks(void* ptr, size_t size_class) {
   if (BypassCpuCache(size_class)) {
+    if (ABSL_PREDICT_FALSE(!BypassToShardedTransferCache(size_class))) {
+      return DeallocateColdSizeClass(ptr, size_class);
+    }
     return forwarder_.sharded_transfer_cache().Push(size_class, ptr);
   }
   auto [cpu, cached] = CacheCpuSlab();
@@ -2004,6 +3094,12 @@ void CpuCache<Forwarder>::DeallocateSlowNoHooks(void* ptr, size_t size_class) {
       return;
     }
   }
+  if (ABSL_PREDICT_FALSE(IsNumaRemote(cpu, size_class))) {
+    // Objects of another partition's size class are not cached here, so that
+    // they neither take capacity from local classes nor get reused far from
+    // their memory.
+    return DeallocateNumaRemote(cpu, size_class, ptr);
+  }
   RecordCacheMissStat(cpu, false);
   const size_t target = UpdateCapacity(cpu, size_class, true);
   size_t total = 0;
@@ -2018,10 +3114,99 @@ void CpuCache<Forwarder>::DeallocateSlowNoHooks(void* ptr, size_t size_class) {
     if (!count) break;
 
     total += count;
-    ReleaseToBackingCache(size_class, absl::Span<void*>(batch, count));
+    if (!ReleaseToRemoteFreeList(cpu, size_class,
+                                 absl::Span<void*>(batch, count))) {
+      ReleaseToBackingCache(size_class, absl::Span<void*>(batch, count));
+    }
     if (count != kMaxObjectsToMove) break;
     count = 0;
   } while (total < target);
+  size_class_rates_.RecordOverflow(size_class, total);
+  TC_USDT_PROBE(cpu_cache_overflow, size_class, target, total);
+}
+
+template <class Forwarder>
+inline size_t CpuCache<Forwarder>::AllocateBatch(size_t size_class,
+                                                 absl::Span<void*> batch) {
+  TC_ASSERT_GT(size_class, 0);
+  const size_t n = batch.size();
+  size_t got = 0;
+  if (ABSL_PREDICT_FALSE(BypassCpuCache(size_class))) {
+    for (; got < n; ++got) {
+      void* ptr = AllocateSlowNoHooks(size_class);
+      if (ptr == nullptr) break;
+      batch[got] = ptr;
+    }
+    return got;
+  }
+  if (ABSL_PREDICT_FALSE(n == 0)) {
+    return 0;
+  }
+
+  got = freelist_.PopBatch(size_class, batch.data(), n);
+  if (ABSL_PREDICT_TRUE(got == n)) {
+    return got;
+  }
+
+  // The slab is either empty or not cached.  Take the regular slow path for
+  // one object: it caches the slab, records the miss and grows and refills
+  // the cache, so that subsequent batches are likely to hit.
+  void* ptr = AllocateSlowNoHooks(size_class);
+  if (ABSL_PREDICT_FALSE(ptr == nullptr)) {
+    return got;
+  }
+  batch[got++] = ptr;
+  if (got < n) {
+    got += freelist_.PopBatch(size_class, batch.data() + got, n - got);
+  }
+
+  // Satisfy the remainder straight from the backing cache rather than
+  // bouncing objects through the slab.
+  while (got < n) {
+    const size_t want = std::min(kMaxObjectsToMove, n - got);
+    const size_t fetched =
+        FetchFromBackingCache(size_class, batch.subspan(got, want));
+    if (fetched == 0) {
+      break;
+    }
+    got += fetched;
+  }
+  return got;
+}
+
+template <class Forwarder>
+inline void CpuCache<Forwarder>::DeallocateBatch(size_t size_class,
+                                                 absl::Span<void*> batch) {
+  TC_ASSERT_GT(size_class, 0);
+  size_t n = batch.size();
+  if (ABSL_PREDICT_FALSE(BypassCpuCache(size_class))) {
+    for (void* ptr : batch) {
+      DeallocateSlowNoHooks(ptr, size_class);
+    }
+    return;
+  }
+  if (ABSL_PREDICT_FALSE(n == 0)) {
+    return;
+  }
+
+  // PushBatch consumes objects from the end of the batch and leaves the ones
+  // it could not push at the start.
+  n -= freelist_.PushBatch(size_class, batch.data(), n);
+  if (ABSL_PREDICT_TRUE(n == 0)) {
+    return;
+  }
+
+  // Overflow (or an uncached slab): free one object through the regular slow
+  // path so that the miss is recorded and the capacity updated, then retry.
+  DeallocateSlowNoHooks(batch[--n], size_class);
+  if (n != 0) {
+    n -= freelist_.PushBatch(size_class, batch.data(), n);
+  }
+
+  for (size_t i = 0; i < n; i += kMaxObjectsToMove) {
+    ReleaseToBackingCache(size_class,
+                          batch.subspan(i, std::min(kMaxObjectsToMove, n - i)));
+  }
 }
 
 template <class Forwarder>
@@ -2050,6 +3235,12 @@ inline uint64_t CpuCache<Forwarder>::UsedBytes(int target_cpu) const {
   for (int size_class = 1; size_class < kNumClasses; size_class++) {
     int size = forwarder_.class_to_size(size_class);
     total += size * freelist_.Length(target_cpu, size_class);
+    if (remote_free_ != nullptr) {
+      total += size * remote_free(target_cpu, size_class).length();
+    }
+    if (numa_remote_free_ != nullptr) {
+      total += size * numa_remote_free(target_cpu, size_class).length();
+    }
   }
   return total;
 }
@@ -2065,6 +3256,12 @@ inline PerCPUMetadataState CpuCache<Forwarder>::MetadataMemoryUsage() const {
   return freelist_.MetadataMemoryUsage();
 }
 
+template <class Forwarder>
+inline PerCPUSlabTlbCoverage
+CpuCache<Forwarder>::SlabTlbCoverage() const {
+  return freelist_.SlabTlbCoverage();
+}
+
 template <class Forwarder>
 inline uint64_t CpuCache<Forwarder>::TotalUsedBytes() const {
   uint64_t total = 0;
@@ -2085,6 +3282,12 @@ inline uint64_t CpuCache<Forwarder>::TotalObjectsOfClass(
         continue;
       }
       total_objects += freelist_.Length(cpu, size_class);
+      if (remote_free_ != nullptr) {
+        total_objects += remote_free(cpu, size_class).length();
+      }
+      if (numa_remote_free_ != nullptr) {
+        total_objects += numa_remote_free(cpu, size_class).length();
+      }
     }
   }
   return total_objects;
@@ -2146,6 +3349,8 @@ inline uint64_t CpuCache<Forwarder>::Reclaim(int cpu) {
 
   uint64_t bytes = 0;
   freelist_.Drain(cpu, DrainHandler<CpuCache>{*this, &bytes});
+  bytes += DrainRemoteFreeLists(cpu);
+  bytes += DrainNumaRemoteFreeLists(cpu);
 
   // Record that the reclaim occurred for this CPU.
   resize_[cpu].num_reclaims.store(
@@ -2204,7 +3409,21 @@ inline std::pair<void*, size_t> CpuCache<Forwarder>::AllocOrReuseSlabs(
     ErrnoRestorer errno_restorer;
     madvise(reused_slabs, size, MADV_HUGEPAGE);
   } else {
-    reused_slabs = alloc(size, subtle::percpu::kPhysicalPageAlign);
+    // With hugepage slabs, align new slabs to hugepage boundaries and ask for
+    // THP backing explicitly rather than relying on the system-wide THP mode,
+    // so that the slabs are covered by as few TLB entries as possible.  The
+    // advice is best effort: when THPs are unavailable we simply keep using
+    // native pages.
+    const bool hugepage_slabs =
+        forwarder_.per_cpu_caches_hugepage_slabs_enabled();
+    const std::align_val_t alignment =
+        hugepage_slabs ? static_cast<std::align_val_t>(kHugePageSize)
+                       : subtle::percpu::kPhysicalPageAlign;
+    reused_slabs = alloc(size, alignment);
+    if (hugepage_slabs) {
+      ErrnoRestorer errno_restorer;
+      madvise(reused_slabs, size, MADV_HUGEPAGE);
+    }
     // MSan does not see writes in assembly.
     ANNOTATE_MEMORY_IS_INITIALIZED(reused_slabs, size);
   }
@@ -2289,6 +3508,12 @@ void CpuCache<Forwarder>::ResizeSlabIfNeeded() ABSL_NO_THREAD_SAFETY_ANALYSIS {
   forwarder_.ArenaUpdateAllocatedAndNonresident(new_slabs_size, 0);
   forwarder_.ShrinkToUsageLimit();
 
+  // The locks keep remote operations off all cpus.  With incremental resizing,
+  // only the cpu being switched fails local operations at any time, so that
+  // threads on the other cpus keep using their caches.
+  const auto resize_slabs = forwarder_.per_cpu_caches_incremental_slab_resize()
+                                ? &Freelist::ResizeSlabsIncrementally
+                                : &Freelist::ResizeSlabs;
   for (int cpu = 0; cpu < num_cpus; ++cpu) resize_[cpu].lock.Lock();
   ResizeSlabsInfo info;
   const uint8_t resize_offset =
@@ -2305,7 +3530,7 @@ void CpuCache<Forwarder>::ResizeSlabIfNeeded() ABSL_NO_THREAD_SAFETY_ANALYSIS {
         },
         new_shift, num_cpus,
         ShiftOffset(per_cpu_shift, shift_bounds_.initial_shift), resize_offset);
-    info = freelist_.ResizeSlabs(
+    info = (freelist_.*resize_slabs)(
         new_shift, new_slabs,
         GetShiftMaxCapacity{max_capacity_, per_cpu_shift, shift_bounds_},
         [this](int cpu) { return HasPopulated(cpu); },
@@ -2325,7 +3550,15 @@ inline void CpuCache<Forwarder>::RecordCacheMissStat(const int cpu,
   MissCounts& misses =
       is_alloc ? resize_[cpu].underflows : resize_[cpu].overflows;
   auto& c = misses[MissCount::kTotal];
-  c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  const size_t total = c.load(std::memory_order_relaxed) + 1;
+  c.store(total, std::memory_order_relaxed);
+  // Notify once per shuffle interval, when the overflows reach the threshold.
+  if (!is_alloc &&
+      ABSL_PREDICT_FALSE(
+          total - misses[MissCount::kShuffle].load(std::memory_order_relaxed) ==
+          kOverflowWakeupThreshold)) {
+    forwarder_.NotifyCpuCacheOverflows();
+  }
 }
 
 template <class Forwarder>
@@ -2483,6 +3716,18 @@ CpuCache<Forwarder>::GetSizeClassCapacityStats(size_t size_class) const {
   return stats;
 }
 
+template <class Forwarder>
+inline uint64_t CpuCache<Forwarder>::GetPingPongs(size_t size_class) const {
+  TC_ASSERT_LT(size_class, kNumClasses);
+  uint64_t ping_pongs = 0;
+  const int num_cpus = NumCPUs();
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    ping_pongs += resize_[cpu].per_class[size_class].GetTotalMisses(
+        PerClassMissType::kPingPongTotal);
+  }
+  return ping_pongs;
+}
+
 template <class Forwarder>
 inline void CpuCache<Forwarder>::Print(Printer* out) const {
   out->printf("------------------------------------------------\n");
@@ -2535,6 +3780,18 @@ inline void CpuCache<Forwarder>::Print(Printer* out) const {
         stats.max_last_overflow_cpu_id);
   }
 
+  out->printf("------------------------------------------------\n");
+  out->printf("Size class batch lengths in per-cpu caches (adaptive: %s)\n",
+              forwarder_.per_cpu_caches_adaptive_batches() ? "on" : "off");
+  out->printf("------------------------------------------------\n");
+
+  for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+    out->printf("class %3d [ %8zu bytes ] : %3zu objects (default %3zu)\n",
+                size_class, forwarder_.class_to_size(size_class),
+                BatchLength(size_class),
+                forwarder_.num_objects_to_move(size_class));
+  }
+
   out->printf("------------------------------------------------\n");
   out->printf("Number of per-CPU cache underflows, overflows, and reclaims\n");
   out->printf("------------------------------------------------\n");
@@ -2573,6 +3830,99 @@ inline void CpuCache<Forwarder>::Print(Printer* out) const {
   out->printf(
       "%12u bytes for which MADVISE_DONTNEED failed\n",
       dynamic_slab_info_.madvise_failed_bytes.load(std::memory_order_relaxed));
+
+  const PerCPUSlabTlbCoverage coverage = SlabTlbCoverage();
+  const size_t small_page_size =
+      static_cast<size_t>(subtle::percpu::kPhysicalPageAlign);
+  out->printf(
+      "Slab TLB coverage: %12u of %12u bytes (%5.1f%%) hugepage-aligned, "
+      "%u hugepages + %u small pages (hugepage slabs: %s)\n",
+      coverage.hugepage_aligned_size, coverage.slabs_size,
+      100. * safe_div(coverage.hugepage_aligned_size, coverage.slabs_size),
+      coverage.hugepage_aligned_size / kHugePageSize,
+      (coverage.slabs_size - coverage.hugepage_aligned_size) / small_page_size,
+      forwarder_.per_cpu_caches_hugepage_slabs_enabled() ? "on" : "off");
+
+  out->printf("------------------------------------------------\n");
+  out->printf("Size class refill and overflow rates in per-cpu caches\n");
+  out->printf("(objects per second over the last %d s, and peak)\n",
+              static_cast<int>(absl::ToInt64Seconds(SizeClassRates::kWindow)));
+  out->printf("------------------------------------------------\n");
+  for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+    const SizeClassRates::Rates rates = GetSizeClassRates(size_class);
+    if (rates.peak_refills_per_second == 0 &&
+        rates.peak_overflows_per_second == 0) {
+      continue;
+    }
+    out->printf(
+        "class %3d [ %8zu bytes ] : refills %10.1f (peak %10.1f), "
+        "overflows %10.1f (peak %10.1f)\n",
+        size_class, forwarder_.class_to_size(size_class),
+        rates.refills_per_second, rates.peak_refills_per_second,
+        rates.overflows_per_second, rates.peak_overflows_per_second);
+  }
+
+  const CacheHistograms histograms = GetCacheHistograms(/*total=*/false);
+  out->printf("------------------------------------------------\n");
+  out->printf("Per-cpu cache occupancy and misses over the last interval\n");
+  out->printf("(number of cpu/size class caches with capacity)\n");
+  out->printf("------------------------------------------------\n");
+  for (int b = 0; b < CacheHistograms::kOccupancyBuckets; ++b) {
+    out->printf("occupancy >= %3d%% : %8u\n",
+                100 * b / CacheHistograms::kOccupancyBuckets,
+                histograms.occupancy[b]);
+  }
+  for (int b = 0; b < CacheHistograms::kMissBuckets; ++b) {
+    out->printf("misses    >= %4u : %8u\n", b == 0 ? 0 : 1u << (b - 1),
+                histograms.misses[b]);
+  }
+
+  if (numa_remote_free_ != nullptr) {
+    out->printf("------------------------------------------------\n");
+    out->printf("Objects freed outside of their NUMA partition\n");
+    out->printf("------------------------------------------------\n");
+    for (int size_class = 1; size_class < kExpandedClassesStart;
+         ++size_class) {
+      const uint64_t frees = GetNumaRemoteFrees(size_class);
+      if (frees == 0) continue;
+      out->printf("class %3d [ %8zu bytes ] : %12u remote frees\n",
+                  size_class, forwarder_.class_to_size(size_class), frees);
+    }
+  }
+
+  bool any_ping_pong = false;
+  for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+    any_ping_pong |= GetPingPongs(size_class) != 0;
+  }
+  if (any_ping_pong) {
+    out->printf("------------------------------------------------\n");
+    out->printf("Refill/overflow ping-pong detected in per-cpu caches\n");
+    out->printf("------------------------------------------------\n");
+    for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+      const uint64_t ping_pongs = GetPingPongs(size_class);
+      if (ping_pongs == 0) continue;
+      out->printf("class %3d [ %8zu bytes ] : %12u oscillations\n", size_class,
+                  forwarder_.class_to_size(size_class), ping_pongs);
+    }
+  }
+
+  bool any_cold = false;
+  for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+    any_cold |= GetColdSizeClassBypasses(size_class) != 0;
+  }
+  if (any_cold) {
+    out->printf("------------------------------------------------\n");
+    out->printf("Rarely used size classes bypassing the per-cpu caches\n");
+    out->printf("------------------------------------------------\n");
+    for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+      const uint64_t bypasses = GetColdSizeClassBypasses(size_class);
+      if (bypasses == 0) continue;
+      out->printf("class %3d [ %8zu bytes ] : %-8s (bypassed %u times)\n",
+                  size_class, forwarder_.class_to_size(size_class),
+                  IsColdSizeClass(size_class) ? "bypassed" : "cached",
+                  bypasses);
+    }
+  }
 }
 
 template <class Forwarder>
@@ -2618,6 +3968,36 @@ inline void CpuCache<Forwarder>::PrintInPbtxt(PbtxtRegion* region) const {
     entry.PrintI64("max_last_overflow_ns",
                    absl::ToInt64Nanoseconds(stats.max_last_overflow));
     entry.PrintI64("max_capacity_misses", stats.max_capacity_misses);
+    entry.PrintI64("batch_length", BatchLength(size_class));
+
+    const SizeClassRates::Rates rates = GetSizeClassRates(size_class);
+    entry.PrintDouble("refills_per_second", rates.refills_per_second);
+    entry.PrintDouble("peak_refills_per_second", rates.peak_refills_per_second);
+    entry.PrintDouble("overflows_per_second", rates.overflows_per_second);
+    entry.PrintDouble("peak_overflows_per_second",
+                      rates.peak_overflows_per_second);
+    entry.PrintI64("numa_remote_frees", GetNumaRemoteFrees(size_class));
+    entry.PrintI64("ping_pongs", GetPingPongs(size_class));
+    entry.PrintBool("cold_bypassed", IsColdSizeClass(size_class));
+    entry.PrintI64("cold_bypasses", GetColdSizeClassBypasses(size_class));
+  }
+
+  // Record the histograms of the last interval and their sums.
+  for (const bool total : {false, true}) {
+    const CacheHistograms h = GetCacheHistograms(total);
+    PbtxtRegion entry = region->CreateSubRegion("cpu_cache_histograms");
+    entry.PrintRaw("interval", total ? "TOTAL" : "LAST");
+    for (int b = 0; b < CacheHistograms::kOccupancyBuckets; ++b) {
+      PbtxtRegion bucket = entry.CreateSubRegion("occupancy");
+      bucket.PrintI64("lower_bound_percent",
+                      100 * b / CacheHistograms::kOccupancyBuckets);
+      bucket.PrintI64("count", h.occupancy[b]);
+    }
+    for (int b = 0; b < CacheHistograms::kMissBuckets; ++b) {
+      PbtxtRegion bucket = entry.CreateSubRegion("misses");
+      bucket.PrintI64("lower_bound", b == 0 ? 0 : int64_t{1} << (b - 1));
+      bucket.PrintI64("count", h.misses[b]);
+    }
   }
 
   // Record dynamic slab statistics.
@@ -2633,6 +4013,13 @@ inline void CpuCache<Forwarder>::PrintInPbtxt(PbtxtRegion* region) const {
   region->PrintI64(
       "dynamic_slab_madvise_failed_bytes",
       dynamic_slab_info_.madvise_failed_bytes.load(std::memory_order_relaxed));
+
+  const PerCPUSlabTlbCoverage coverage = SlabTlbCoverage();
+  region->PrintI64("slab_bytes", coverage.slabs_size);
+  region->PrintI64("slab_hugepage_aligned_bytes",
+                   coverage.hugepage_aligned_size);
+  region->PrintBool("hugepage_slabs",
+                    forwarder_.per_cpu_caches_hugepage_slabs_enabled());
 }
 
 template <class Forwarder>
@@ -2642,7 +4029,7 @@ inline void CpuCache<Forwarder>::PerClassResizeInfo::Init() {
 
 template <class Forwarder>
 inline bool CpuCache<Forwarder>::PerClassResizeInfo::Update(
-    bool overflow, bool grow, uint32_t* successive) {
+    bool overflow, bool grow, uint32_t* successive, uint32_t* alternations) {
   int32_t raw = state_.load(std::memory_order_relaxed);
   State state;
   memcpy(&state, &raw, sizeof(state));
@@ -2653,9 +4040,14 @@ inline bool CpuCache<Forwarder>::PerClassResizeInfo::Update(
   new_state.overflow = overflow;
   new_state.quiescent_ticks = grow ? 0 : state.quiescent_ticks;
   new_state.successive = overflow == state.overflow ? state.successive + 1 : 0;
+  new_state.alternations =
+      overflow == state.overflow
+          ? 0
+          : std::min<uint32_t>(state.alternations + 1, 15);
   memcpy(&raw, &new_state, sizeof(raw));
   state_.store(raw, std::memory_order_relaxed);
   *successive = new_state.successive;
+  *alternations = new_state.alternations;
   return overflow_then_underflow;
 }
 
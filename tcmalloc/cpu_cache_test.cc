@@ -40,6 +40,7 @@
 #include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/affinity.h"
+#include "tcmalloc/internal/cpu_utils.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
 #include "tcmalloc/internal/percpu.h"
@@ -146,8 +147,39 @@ class TestStaticForwarder {
     ++shrink_to_usage_limit_calls_;
   }
 
+  void NotifyCpuCacheOverflows() { ++overflow_notifications_; }
+
   bool per_cpu_caches_dynamic_slab_enabled() { return dynamic_slab_enabled_; }
 
+  bool per_cpu_caches_steal_objects_enabled() const {
+    return steal_objects_enabled_;
+  }
+
+  bool per_cpu_caches_asymmetric_batches() const {
+    return asymmetric_batches_;
+  }
+
+  bool per_cpu_caches_adaptive_batches() const { return adaptive_batches_; }
+
+  bool per_cpu_caches_ping_pong_hysteresis() const {
+    return ping_pong_hysteresis_;
+  }
+
+  // All cpus share a single L3 cache.
+  unsigned GetL3FromCpuId(int cpu) const { return 0; }
+
+  bool per_cpu_caches_remote_free_enabled() const {
+    return remote_free_enabled_;
+  }
+
+  bool per_cpu_caches_hugepage_slabs_enabled() const {
+    return hugepage_slabs_enabled_;
+  }
+
+  bool per_cpu_caches_incremental_slab_resize() const {
+    return incremental_slab_resize_;
+  }
+
   double per_cpu_caches_dynamic_slab_grow_threshold() {
     if (dynamic_slab_grow_threshold_ >= 0) return dynamic_slab_grow_threshold_;
     return dynamic_slab_ == DynamicSlab::kGrow
@@ -232,7 +264,15 @@ class TestStaticForwarder {
   size_t arena_reported_nonresident_bytes_ = 0;
   int64_t arena_reported_impending_bytes_ = 0;
   size_t shrink_to_usage_limit_calls_ = 0;
+  size_t overflow_notifications_ = 0;
   bool dynamic_slab_enabled_ = false;
+  bool steal_objects_enabled_ = false;
+  bool asymmetric_batches_ = false;
+  bool adaptive_batches_ = false;
+  bool ping_pong_hysteresis_ = false;
+  bool remote_free_enabled_ = false;
+  bool hugepage_slabs_enabled_ = false;
+  bool incremental_slab_resize_ = false;
   double dynamic_slab_grow_threshold_ = -1;
   double dynamic_slab_shrink_threshold_ = -1;
   bool configure_size_class_max_capacity_ = false;
@@ -506,6 +546,39 @@ TEST(CpuCacheTest, Metadata) {
   cache.Deactivate();
 }
 
+TEST(CpuCacheTest, AllocateDeallocateBatch) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CpuCache cache;
+  cache.Activate();
+
+  constexpr size_t kSizeClass = 1;
+  constexpr int kCpuId = 0;
+  // Larger than both the per-size class capacity and kMaxObjectsToMove, so
+  // both the slab and the backing cache paths are exercised.
+  constexpr size_t kBatchSize = 4 * kMaxObjectsToMove + 3;
+  std::vector<void*> batch(kBatchSize, nullptr);
+
+  {
+    ScopedFakeCpuId fake_cpu_id(kCpuId);
+    EXPECT_EQ(cache.AllocateBatch(kSizeClass, absl::MakeSpan(batch)),
+              kBatchSize);
+    std::vector<void*> sorted = batch;
+    std::sort(sorted.begin(), sorted.end());
+    EXPECT_EQ(std::adjacent_find(sorted.begin(), sorted.end()), sorted.end());
+    EXPECT_NE(sorted.front(), nullptr);
+
+    cache.DeallocateBatch(kSizeClass, absl::MakeSpan(batch));
+  }
+
+  EXPECT_LE(cache.TotalObjectsOfClass(kSizeClass), kBatchSize);
+
+  // Tear down.
+  cache.Deactivate();
+}
+
 TEST(CpuCacheTest, CacheMissStats) {
   if (!subtle::percpu::IsFast()) {
     return;
@@ -891,14 +964,503 @@ TEST(CpuCacheTest, StealCpuCache) {
   cache.Deactivate();
 }
 
+TEST(CpuCacheTest, StealObjectsFromSiblingCache) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+  if (NumCPUs() < 2) {
+    GTEST_SKIP() << "Need at least two cpus";
+  }
+
+  CpuCache cache;
+  TestStaticForwarder& forwarder = cache.forwarder();
+  forwarder.steal_objects_enabled_ = true;
+  cache.Activate();
+
+  constexpr size_t kSizeClass = 1;
+  constexpr int kConsumerCpu = 0;
+  constexpr int kProducerCpu = 1;
+  const size_t batch_length = forwarder.num_objects_to_move(kSizeClass);
+  const size_t size = forwarder.class_to_size(kSizeClass);
+
+  // Allocate on the consumer and free on the producer, so the producer's last
+  // miss for the size class is an overflow and its cache holds the objects.
+  std::vector<void*> objects;
+  {
+    ScopedFakeCpuId fake_cpu_id(kConsumerCpu);
+    for (size_t i = 0; i < 4 * batch_length; ++i) {
+      objects.push_back(cache.Allocate(kSizeClass));
+    }
+    cache.Reclaim(kConsumerCpu);
+  }
+  {
+    ScopedFakeCpuId fake_cpu_id(kProducerCpu);
+    for (void* ptr : objects) {
+      cache.Deallocate(ptr, kSizeClass);
+    }
+  }
+  const uint64_t producer_bytes = cache.UsedBytes(kProducerCpu);
+  ASSERT_GE(producer_bytes, batch_length * size);
+
+  // The consumer's refill should be served by the producer's cache rather than
+  // the transfer cache.
+  const TransferCacheStats before =
+      forwarder.transfer_cache().GetStats(kSizeClass);
+  {
+    ScopedFakeCpuId fake_cpu_id(kConsumerCpu);
+    void* ptr = cache.Allocate(kSizeClass);
+    ASSERT_NE(ptr, nullptr);
+    cache.Deallocate(ptr, kSizeClass);
+  }
+  const TransferCacheStats after =
+      forwarder.transfer_cache().GetStats(kSizeClass);
+  EXPECT_EQ(after.remove_hits, before.remove_hits);
+  EXPECT_EQ(after.remove_misses, before.remove_misses);
+  EXPECT_LT(cache.UsedBytes(kProducerCpu), producer_bytes);
+
+  cache.Deactivate();
+}
+
+TEST(CpuCacheTest, AsymmetricBatches) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  constexpr size_t kSizeClass = 1;
+  constexpr int kCpu = 0;
+  // Frees objects allocated earlier to an empty cache, and returns the
+  // capacity the cache settles at.
+  auto free_only_capacity = [](bool asymmetric_batches) {
+    CpuCache cache;
+    TestStaticForwarder& forwarder = cache.forwarder();
+    forwarder.asymmetric_batches_ = asymmetric_batches;
+    cache.Activate();
+
+    ScopedFakeCpuId fake_cpu_id(kCpu);
+    const size_t batch_length = forwarder.num_objects_to_move(kSizeClass);
+    std::vector<void*> objects;
+    for (size_t i = 0; i < 16 * batch_length; ++i) {
+      objects.push_back(cache.Allocate(kSizeClass));
+    }
+    cache.Reclaim(kCpu);
+    for (void* ptr : objects) {
+      cache.Deallocate(ptr, kSizeClass);
+    }
+    const size_t capacity = cache.GetCapacityOfSizeClass(kCpu, kSizeClass);
+    cache.Deactivate();
+    return capacity;
+  };
+
+  CpuCache cache;
+  const size_t batch_length = cache.forwarder().num_objects_to_move(kSizeClass);
+  EXPECT_LE(free_only_capacity(false), 2 * batch_length);
+  EXPECT_GT(free_only_capacity(true), 2 * batch_length);
+}
+
+TEST(CpuCacheTest, PingPongHysteresis) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  constexpr size_t kSizeClass = 1;
+  constexpr int kCpu = 0;
+  // Empties the cache before every operation, so that allocations underflow
+  // and deallocations overflow in turn, and returns the detected ping-pongs.
+  auto ping_pongs = [](bool hysteresis) {
+    CpuCache cache;
+    TestStaticForwarder& forwarder = cache.forwarder();
+    forwarder.ping_pong_hysteresis_ = hysteresis;
+    cache.Activate();
+
+    ScopedFakeCpuId fake_cpu_id(kCpu);
+    for (int i = 0; i < 8; ++i) {
+      cache.Reclaim(kCpu);
+      void* ptr = cache.Allocate(kSizeClass);
+      cache.Reclaim(kCpu);
+      cache.Deallocate(ptr, kSizeClass);
+    }
+    const uint64_t detected = cache.GetPingPongs(kSizeClass);
+    cache.Deactivate();
+    return detected;
+  };
+
+  EXPECT_EQ(ping_pongs(false), 0);
+  EXPECT_EQ(ping_pongs(true), 1);
+}
+
+TEST(CpuCacheTest, AdaptiveBatches) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+  if (NumCPUs() < CpuCache::kMinCpusToGrowBatch) {
+    GTEST_SKIP() << "Need at least " << CpuCache::kMinCpusToGrowBatch
+                 << " cpus";
+  }
+
+  CpuCache cache;
+  TestStaticForwarder& forwarder = cache.forwarder();
+  forwarder.adaptive_batches_ = true;
+  cache.Activate();
+
+  constexpr size_t kBusyClass = 1;
+  constexpr size_t kIdleClass = 2;
+  const size_t busy_length = forwarder.num_objects_to_move(kBusyClass);
+  const size_t idle_length = forwarder.num_objects_to_move(kIdleClass);
+  EXPECT_EQ(cache.BatchLength(kBusyClass), busy_length);
+
+  // Empty the cache before every allocation, so that each one refills.
+  std::vector<void*> objects;
+  for (int cpu = 0; cpu < CpuCache::kMinCpusToGrowBatch; ++cpu) {
+    ScopedFakeCpuId fake_cpu_id(cpu);
+    for (size_t i = 0; i < CpuCache::kMinRefillsToGrowBatch; ++i) {
+      objects.push_back(cache.Allocate(kBusyClass));
+      cache.Reclaim(cpu);
+    }
+  }
+
+  cache.ResizeBatchLengths();
+  const size_t grown_length = std::min(2 * busy_length, kMaxObjectsToMove);
+  EXPECT_EQ(cache.BatchLength(kBusyClass), grown_length);
+  EXPECT_EQ(cache.BatchLength(kIdleClass),
+            std::max<size_t>(idle_length / 2, 1));
+
+  // Refills now fetch the larger batch.
+  {
+    ScopedFakeCpuId fake_cpu_id(0);
+    objects.push_back(cache.Allocate(kBusyClass));
+    EXPECT_EQ(cache.GetCapacityOfSizeClass(0, kBusyClass), grown_length);
+  }
+
+  forwarder.adaptive_batches_ = false;
+  cache.ResizeBatchLengths();
+  EXPECT_EQ(cache.BatchLength(kBusyClass), busy_length);
+  EXPECT_EQ(cache.BatchLength(kIdleClass), idle_length);
+
+  for (void* ptr : objects) {
+    cache.Deallocate(ptr, kBusyClass);
+  }
+  cache.Deactivate();
+}
+
+TEST(CpuCacheTest, ImportedBatchLengths) {
+  CpuCache cache;
+  TestStaticForwarder& forwarder = cache.forwarder();
+  constexpr size_t kSizeClass = 1;
+  const size_t length = forwarder.num_objects_to_move(kSizeClass);
+
+  // Only adaptive batches take imported lengths.
+  cache.SetBatchLength(kSizeClass, length / 2);
+  EXPECT_EQ(cache.BatchLength(kSizeClass), length);
+
+  forwarder.adaptive_batches_ = true;
+  cache.SetBatchLength(kSizeClass, std::max<size_t>(length / 2, 1));
+  EXPECT_EQ(cache.BatchLength(kSizeClass), std::max<size_t>(length / 2, 1));
+  // Lengths stay within the range ResizeBatchLengths keeps them in.
+  cache.SetBatchLength(kSizeClass, 0);
+  EXPECT_EQ(cache.BatchLength(kSizeClass),
+            std::max<size_t>(length / CpuCache::kBatchLengthRange, 1));
+  cache.SetBatchLength(kSizeClass, 100 * length);
+  EXPECT_EQ(cache.BatchLength(kSizeClass),
+            std::min(length * CpuCache::kBatchLengthRange, kMaxObjectsToMove));
+}
+
+TEST(CpuCacheTest, WarmCapacity) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CpuCache cache;
+  cache.Activate();
+
+  constexpr size_t kWarmClass = 1;
+  constexpr size_t kColdClass = 2;
+  constexpr uint16_t kCapacity = 20;
+  cache.SetWarmCapacity(kWarmClass, kCapacity);
+
+  // The capacity is granted when the cpu's cache is populated, before any
+  // object of the size class was allocated on it.
+  ScopedFakeCpuId fake_cpu_id(0);
+  void* ptr = cache.Allocate(kColdClass);
+  ASSERT_TRUE(cache.HasPopulated(0));
+  EXPECT_EQ(cache.GetCapacityOfSizeClass(0, kWarmClass), kCapacity);
+
+  cache.Deallocate(ptr, kColdClass);
+  cache.Deactivate();
+}
+
+TEST(CpuCacheTest, RemoteFreeList) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+  if (NumCPUs() < 2) {
+    GTEST_SKIP() << "Need at least two cpus";
+  }
+
+  CpuCache cache;
+  TestStaticForwarder& forwarder = cache.forwarder();
+  forwarder.remote_free_enabled_ = true;
+  cache.Activate();
+
+  constexpr size_t kSizeClass = 1;
+  constexpr int kConsumerCpu = 0;
+  constexpr int kProducerCpu = 1;
+  const size_t batch_length = forwarder.num_objects_to_move(kSizeClass);
+
+  // Allocating on the consumer makes it the destination of overflows of this
+  // size class on other cpus.
+  std::vector<void*> objects;
+  {
+    ScopedFakeCpuId fake_cpu_id(kConsumerCpu);
+    for (size_t i = 0; i < 4 * batch_length; ++i) {
+      objects.push_back(cache.Allocate(kSizeClass));
+    }
+    cache.Reclaim(kConsumerCpu);
+  }
+  EXPECT_EQ(cache.UsedBytes(kConsumerCpu), 0);
+
+  {
+    ScopedFakeCpuId fake_cpu_id(kProducerCpu);
+    for (void* ptr : objects) {
+      cache.Deallocate(ptr, kSizeClass);
+    }
+  }
+  // Overflows on the producer are queued for the consumer and are accounted
+  // to it.
+  EXPECT_GT(cache.UsedBytes(kConsumerCpu), 0);
+
+  // The consumer's next refill is served from its remote free list.
+  const TransferCacheStats before =
+      forwarder.transfer_cache().GetStats(kSizeClass);
+  {
+    ScopedFakeCpuId fake_cpu_id(kConsumerCpu);
+    void* ptr = cache.Allocate(kSizeClass);
+    ASSERT_NE(ptr, nullptr);
+    cache.Deallocate(ptr, kSizeClass);
+  }
+  const TransferCacheStats after =
+      forwarder.transfer_cache().GetStats(kSizeClass);
+  EXPECT_EQ(after.remove_hits, before.remove_hits);
+  EXPECT_EQ(after.remove_misses, before.remove_misses);
+
+  // Reclaiming the consumer also drains its remote free lists.
+  cache.Reclaim(kConsumerCpu);
+  EXPECT_EQ(cache.UsedBytes(kConsumerCpu), 0);
+
+  cache.Deactivate();
+}
+
+TEST(CpuCacheTest, NumaRemoteFrees) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CpuCache cache;
+  TestStaticForwarder& forwarder = cache.forwarder();
+  const auto& topology = forwarder.numa_topology();
+  if (!topology.numa_aware()) {
+    GTEST_SKIP() << "NUMA awareness is disabled";
+  }
+  cache.Activate();
+
+  // Find a cpu in each of two partitions.
+  int home_cpu = -1, remote_cpu = -1;
+  for (int cpu = 0, num_cpus = NumCPUs(); cpu < num_cpus; ++cpu) {
+    if (home_cpu < 0) {
+      home_cpu = cpu;
+    } else if (topology.GetCpuPartition(cpu) !=
+               topology.GetCpuPartition(home_cpu)) {
+      remote_cpu = cpu;
+      break;
+    }
+  }
+  if (remote_cpu < 0) {
+    GTEST_SKIP() << "Need cpus in two NUMA partitions";
+  }
+
+  const size_t size_class =
+      1 + topology.GetCpuPartition(home_cpu) * kNumBaseClasses;
+  const size_t batch_length = forwarder.num_objects_to_move(size_class);
+  std::vector<void*> objects;
+  {
+    ScopedFakeCpuId fake_cpu_id(home_cpu);
+    for (size_t i = 0; i < 2 * batch_length + 1; ++i) {
+      objects.push_back(cache.Allocate(size_class));
+    }
+  }
+
+  const TransferCacheStats before =
+      forwarder.transfer_cache().GetStats(size_class);
+  {
+    ScopedFakeCpuId fake_cpu_id(remote_cpu);
+    for (void* ptr : objects) {
+      cache.Deallocate(ptr, size_class);
+    }
+  }
+  const TransferCacheStats after =
+      forwarder.transfer_cache().GetStats(size_class);
+
+  // The objects never enter the remote cpu's cache: they are handed to their
+  // home partition's transfer cache in batches, and the rest wait on the
+  // remote cpu's list.
+  EXPECT_EQ(cache.GetNumaRemoteFrees(size_class), objects.size());
+  EXPECT_EQ(cache.GetCapacityOfSizeClass(remote_cpu, size_class), 0);
+  EXPECT_EQ(after.insert_hits + after.insert_misses -
+                (before.insert_hits + before.insert_misses),
+            2);
+  EXPECT_EQ(cache.UsedBytes(remote_cpu), forwarder.class_to_size(size_class));
+
+  // Reclaiming the remote cpu drains its list.
+  cache.Reclaim(remote_cpu);
+  EXPECT_EQ(cache.UsedBytes(remote_cpu), 0);
+
+  cache.Deactivate();
+}
+
+TEST(CpuCacheTest, ColdSizeClasses) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CpuCache cache;
+  TestStaticForwarder& forwarder = cache.forwarder();
+  cache.Activate();
+  ScopedFakeCpuId fake_cpu_id(0);
+
+  // One class sees a single object, another one a lot of traffic.
+  constexpr size_t kColdClass = 2, kHotClass = 3;
+  cache.Deallocate(cache.Allocate(kColdClass), kColdClass);
+  for (int i = 0; i < 64; ++i) {
+    std::vector<void*> objects;
+    for (int j = 0; j < 64; ++j) {
+      objects.push_back(cache.Allocate(kHotClass));
+    }
+    for (void* ptr : objects) {
+      cache.Deallocate(ptr, kHotClass);
+    }
+  }
+  ASSERT_GT(cache.GetCapacityOfSizeClass(0, kColdClass), 0);
+
+  cache.UpdateColdSizeClasses(/*enabled=*/true);
+  EXPECT_TRUE(cache.IsColdSizeClass(kColdClass));
+  EXPECT_EQ(cache.GetColdSizeClassBypasses(kColdClass), 1);
+  EXPECT_EQ(cache.GetCapacityOfSizeClass(0, kColdClass), 0);
+  EXPECT_FALSE(cache.IsColdSizeClass(kHotClass));
+  EXPECT_GT(cache.GetCapacityOfSizeClass(0, kHotClass), 0);
+
+  // The cold class is served by the backing cache.
+  const TransferCacheStats before =
+      forwarder.transfer_cache().GetStats(kColdClass);
+  cache.Deallocate(cache.Allocate(kColdClass), kColdClass);
+  const TransferCacheStats after =
+      forwarder.transfer_cache().GetStats(kColdClass);
+  EXPECT_EQ(after.insert_hits + after.insert_misses -
+                (before.insert_hits + before.insert_misses),
+            1);
+  EXPECT_EQ(cache.GetCapacityOfSizeClass(0, kColdClass), 0);
+
+  // Enough traffic caches it per-cpu again.
+  for (int i = 0; i < CpuCache::kColdSizeClassMaxOps; ++i) {
+    cache.Deallocate(cache.Allocate(kColdClass), kColdClass);
+  }
+  EXPECT_FALSE(cache.IsColdSizeClass(kColdClass));
+  cache.Deallocate(cache.Allocate(kColdClass), kColdClass);
+  EXPECT_GT(cache.GetCapacityOfSizeClass(0, kColdClass), 0);
+
+  // Disabling the mode caches every size class again.
+  cache.UpdateColdSizeClasses(/*enabled=*/true);
+  EXPECT_TRUE(cache.IsColdSizeClass(kColdClass));
+  cache.UpdateColdSizeClasses(/*enabled=*/false);
+  EXPECT_FALSE(cache.IsColdSizeClass(kColdClass));
+  EXPECT_EQ(cache.GetColdSizeClassBypasses(kColdClass), 2);
+
+  cache.Deactivate();
+}
+
+TEST(CpuCacheTest, CacheHistograms) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CpuCache cache;
+  cache.Activate();
+  ScopedFakeCpuId fake_cpu_id(0);
+
+  constexpr size_t kSizeClass = 3;
+  cache.Deallocate(cache.Allocate(kSizeClass), kSizeClass);
+  uint64_t caches = 0;
+  for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+    caches += cache.GetCapacityOfSizeClass(0, size_class) > 0;
+  }
+  ASSERT_GT(caches, 0);
+
+  auto sum = [](absl::Span<const uint64_t> buckets) {
+    uint64_t n = 0;
+    for (uint64_t count : buckets) n += count;
+    return n;
+  };
+
+  cache.UpdateCacheHistograms();
+  CpuCache::CacheHistograms h = cache.GetCacheHistograms(/*total=*/false);
+  EXPECT_EQ(sum(h.occupancy), caches);
+  EXPECT_EQ(sum(h.misses), caches);
+  // The size class underflowed to get its capacity.
+  EXPECT_LT(h.misses[0], caches);
+
+  // Without operations since, no cache missed in the interval.
+  cache.UpdateCacheHistograms();
+  h = cache.GetCacheHistograms(/*total=*/false);
+  EXPECT_EQ(h.misses[0], caches);
+  EXPECT_EQ(sum(h.occupancy), caches);
+
+  const CpuCache::CacheHistograms total =
+      cache.GetCacheHistograms(/*total=*/true);
+  EXPECT_EQ(sum(total.occupancy), 2 * caches);
+  EXPECT_EQ(sum(total.misses), 2 * caches);
+
+  cache.Deactivate();
+}
+
+TEST(CpuCacheTest, HugepageSlabs) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CpuCache cache;
+  TestStaticForwarder& forwarder = cache.forwarder();
+  forwarder.hugepage_slabs_enabled_ = true;
+  cache.Activate();
+
+  // Hugepage-backed slabs behave like regular ones.
+  constexpr size_t kSizeClass = 1;
+  void* ptr = cache.Allocate(kSizeClass);
+  ASSERT_NE(ptr, nullptr);
+  cache.Deallocate(ptr, kSizeClass);
+
+  const PerCPUSlabTlbCoverage coverage =
+      cache.SlabTlbCoverage();
+  EXPECT_GT(coverage.slabs_size, 0);
+  EXPECT_LE(coverage.hugepage_aligned_size, coverage.slabs_size);
+  EXPECT_EQ(coverage.hugepage_aligned_size % kHugePageSize, 0);
+
+  std::string buf;
+  buf.resize(1 << 20);
+  Printer p(buf.data(), buf.size());
+  cache.Print(&p);
+  EXPECT_THAT(buf, testing::HasSubstr("Slab TLB coverage:"));
+  EXPECT_THAT(buf, testing::HasSubstr("(hugepage slabs: on)"));
+
+  cache.Deactivate();
+}
+
 // Test that when dynamic slab is enabled, nothing goes horribly wrong and that
 // arena non-resident bytes increases as expected.
-TEST(CpuCacheTest, DynamicSlab) {
+void TestDynamicSlab(bool incremental) {
   if (!subtle::percpu::IsFast()) {
     return;
   }
   CpuCache cache;
   TestStaticForwarder& forwarder = cache.forwarder();
+  forwarder.incremental_slab_resize_ = incremental;
 
   size_t prev_reported_nonresident_bytes =
       forwarder.arena_reported_nonresident_bytes_;
@@ -971,6 +1533,13 @@ TEST(CpuCacheTest, DynamicSlab) {
   cache.Deactivate();
 }
 
+TEST(CpuCacheTest, DynamicSlab) { TestDynamicSlab(/*incremental=*/false); }
+
+// Resizes the slabs one cpu at a time while the stress threads run.
+TEST(CpuCacheTest, DynamicSlabIncremental) {
+  TestDynamicSlab(/*incremental=*/true);
+}
+
 // In this test, we check if we can resize size classes based on the number of
 // misses they encounter. First, we exhaust cache capacity by filling up
 // larger size class as much as possible. Then, we try to allocate objects for
@@ -1115,6 +1684,43 @@ static void HotCacheOperations(CpuCache& cache, int cpu_id) {
   cache.Reclaim(cpu_id);
 }
 
+// Test that frequent overflows wake the background thread once per shuffle
+// interval.
+TEST(CpuCacheTest, OverflowsNotifyBackgroundThread) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CpuCache cache;
+  TestStaticForwarder& forwarder = cache.forwarder();
+  SizeMap size_map;
+  size_map.Init(kSizeClasses.classes);
+  forwarder.size_map_ = size_map;
+  cache.Activate();
+
+  constexpr int kCpuId = 0;
+  for (int i = 0; i < 16 && cache.GetIntervalCacheMissStats(
+                                        kCpuId, MissCount::kShuffle)
+                                        .overflows <
+                                CpuCache::kOverflowWakeupThreshold;
+       ++i) {
+    HotCacheOperations(cache, kCpuId);
+  }
+  ASSERT_GE(
+      cache.GetIntervalCacheMissStats(kCpuId, MissCount::kShuffle).overflows,
+      CpuCache::kOverflowWakeupThreshold);
+  EXPECT_EQ(forwarder.overflow_notifications_, 1);
+
+  // Shuffling starts a new interval.
+  cache.ShuffleCpuCaches();
+  for (int i = 0; i < 16 && forwarder.overflow_notifications_ < 2; ++i) {
+    HotCacheOperations(cache, kCpuId);
+  }
+  EXPECT_EQ(forwarder.overflow_notifications_, 2);
+
+  cache.Deactivate();
+}
+
 // Test that we are complying with the threshold when we grow the slab.
 // When wider slab is enabled, we check if overflow/underflow ratio is above the
 // threshold for individual cpu caches.
@@ -1411,6 +2017,116 @@ TEST(CpuCacheTest, ColdHotCacheShuffleTest) {
   cache.Deactivate();
 }
 
+TEST(CpuCacheTest, UpdateCacheBudget) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CpuCache cache;
+  const size_t max_cpu_cache_size = 1 << 16;
+  cache.SetCacheLimit(max_cpu_cache_size);
+  cache.Activate();
+
+  const int num_cpus = NumCPUs();
+  const size_t size_class = 2;
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    ColdCacheOperations(cache, cpu, size_class);
+    ASSERT_TRUE(cache.HasPopulated(cpu));
+  }
+
+  auto total_capacity = [&]() {
+    size_t total = 0;
+    for (int cpu = 0; cpu < num_cpus; ++cpu) {
+      EXPECT_EQ(cache.Allocated(cpu) + cache.Unallocated(cpu),
+                cache.Capacity(cpu));
+      total += cache.Capacity(cpu);
+    }
+    return total;
+  };
+  EXPECT_EQ(total_capacity(), num_cpus * max_cpu_cache_size);
+
+  // With a single effective CPU, the caches together get the capacity of one,
+  // but none shrinks below the capacity threshold.  Shrinking an allocated
+  // size class may take a few passes, and the cold caches hold a single
+  // object.
+  cache.UpdateCacheBudget(1);
+  const size_t floor =
+      CpuCache::kCacheCapacityThreshold * max_cpu_cache_size;
+  const size_t expected = std::max(max_cpu_cache_size, num_cpus * floor);
+  EXPECT_LE(total_capacity(),
+            expected + num_cpus * cache.forwarder().class_to_size(size_class));
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    EXPECT_GE(cache.Capacity(cpu), std::min(floor, max_cpu_cache_size));
+  }
+
+  // Raising the effective CPUs returns the capacity.
+  cache.UpdateCacheBudget(num_cpus);
+  EXPECT_EQ(total_capacity(), num_cpus * max_cpu_cache_size);
+
+  cache.Deactivate();
+}
+
+TEST(CpuCacheTest, DrainUnusableCpus) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+  const int num_cpus = NumCPUs();
+  if (num_cpus < 2) {
+    GTEST_SKIP() << "Needs at least two CPUs";
+  }
+
+  CpuCache cache;
+  const size_t max_cpu_cache_size = 1 << 16;
+  cache.SetCacheLimit(max_cpu_cache_size);
+  cache.Activate();
+
+  const size_t size_class = 2;
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    ColdCacheOperations(cache, cpu, size_class);
+    ASSERT_TRUE(cache.HasPopulated(cpu));
+  }
+  ASSERT_GT(cache.UsedBytes(0), 0);
+
+  // CPU 0 went offline.
+  CpuSet usable;
+  usable.Zero();
+  for (int cpu = 1; cpu < num_cpus; ++cpu) {
+    usable.Set(cpu);
+  }
+  EXPECT_GT(cache.DrainUnusableCpus(usable), 0);
+  EXPECT_EQ(cache.UsedBytes(0), 0);
+  for (int cpu = 1; cpu < num_cpus; ++cpu) {
+    EXPECT_GT(cache.UsedBytes(cpu), 0);
+  }
+  // Already drained.
+  EXPECT_EQ(cache.DrainUnusableCpus(usable), 0);
+
+  // The budget of a single CPU is shared by the remaining ones only.
+  cache.UpdateCacheBudget(1);
+  EXPECT_EQ(cache.Capacity(0), max_cpu_cache_size);
+  size_t total = 0;
+  for (int cpu = 1; cpu < num_cpus; ++cpu) {
+    total += cache.Capacity(cpu);
+  }
+  const size_t floor =
+      CpuCache::kCacheCapacityThreshold * max_cpu_cache_size;
+  EXPECT_LE(total,
+            std::max(max_cpu_cache_size, (num_cpus - 1) * floor) +
+                (num_cpus - 1) * cache.forwarder().class_to_size(size_class));
+
+  // Once usable again, CPU 0 counts towards the budget again.
+  usable.Set(0);
+  EXPECT_EQ(cache.DrainUnusableCpus(usable), 0);
+  cache.UpdateCacheBudget(num_cpus);
+  total = 0;
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    total += cache.Capacity(cpu);
+  }
+  EXPECT_EQ(total, num_cpus * max_cpu_cache_size);
+
+  cache.Deactivate();
+}
+
 TEST(CpuCacheTest, ReclaimCpuCache) {
   if (!subtle::percpu::IsFast()) {
     return;
@@ -1529,6 +2245,102 @@ TEST(CpuCacheTest, ReclaimCpuCache) {
   cache.Deactivate();
 }
 
+TEST(CpuCacheTest, ReclaimCpuCachesInPartitions) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CpuCache cache;
+  cache.Activate();
+
+  const int num_cpus = NumCPUs();
+  const size_t kSizeClass = 2;
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    ColdCacheOperations(cache, cpu, kSizeClass);
+  }
+
+  // No caches are touched without any partitions.
+  cache.TryReclaimingCaches(/*partitions=*/0);
+  cache.TryReclaimingCaches(/*partitions=*/0);
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    SCOPED_TRACE(absl::StrFormat("Failed CPU: %d", cpu));
+    EXPECT_GT(cache.UsedBytes(cpu), 0);
+    EXPECT_EQ(cache.GetNumReclaims(cpu), 0);
+  }
+
+  // Only the caches of the CPUs in the partition of CPU 0 are reclaimed.
+  const auto& topology = cache.forwarder().numa_topology();
+  const size_t partition = topology.GetCpuPartition(0);
+  cache.TryReclaimingCaches(uint64_t{1} << partition);
+  cache.TryReclaimingCaches(uint64_t{1} << partition);
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    SCOPED_TRACE(absl::StrFormat("Failed CPU: %d", cpu));
+    if (topology.GetCpuPartition(cpu) == partition) {
+      EXPECT_EQ(cache.UsedBytes(cpu), 0);
+      EXPECT_EQ(cache.GetNumReclaims(cpu), 1);
+    } else {
+      EXPECT_GT(cache.UsedBytes(cpu), 0);
+      EXPECT_EQ(cache.GetNumReclaims(cpu), 0);
+    }
+  }
+
+  cache.Deactivate();
+}
+
+TEST(CpuCacheTest, DecayCaches) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CpuCache cache;
+  cache.Activate();
+
+  // Leave a burst of objects of kSizeClass in the cache of CPU 0.
+  constexpr size_t kSizeClass = 1;
+  constexpr int kObjects = 64;
+  {
+    ScopedFakeCpuId fake_cpu_id(0);
+    std::vector<void*> ptrs(kObjects);
+    for (void*& ptr : ptrs) {
+      ptr = cache.Allocate(kSizeClass);
+    }
+    for (void* ptr : ptrs) {
+      cache.Deallocate(ptr, kSizeClass);
+    }
+  }
+  const uint64_t cached = cache.TotalObjectsOfClass(kSizeClass);
+  ASSERT_GT(cached, 1);
+
+  // Nothing has been observed unused before the first period.
+  cache.UpdateDecayLowWaterMarks();
+  EXPECT_EQ(cache.DecayCaches(), 0);
+  EXPECT_EQ(cache.TotalObjectsOfClass(kSizeClass), cached);
+
+  // The objects stayed unused for a whole period, so half of them decay.
+  cache.UpdateDecayLowWaterMarks();
+  EXPECT_EQ(cache.DecayCaches(),
+            cached / 2 * cache.forwarder().class_to_size(kSizeClass));
+  EXPECT_EQ(cache.TotalObjectsOfClass(kSizeClass), cached - cached / 2);
+
+  // Objects that are used during the period do not decay.
+  {
+    ScopedFakeCpuId fake_cpu_id(0);
+    std::vector<void*> ptrs(cache.TotalObjectsOfClass(kSizeClass));
+    for (void*& ptr : ptrs) {
+      ptr = cache.Allocate(kSizeClass);
+    }
+    cache.UpdateDecayLowWaterMarks();
+    for (void* ptr : ptrs) {
+      cache.Deallocate(ptr, kSizeClass);
+    }
+  }
+  const uint64_t reused = cache.TotalObjectsOfClass(kSizeClass);
+  EXPECT_EQ(cache.DecayCaches(), 0);
+  EXPECT_EQ(cache.TotalObjectsOfClass(kSizeClass), reused);
+
+  cache.Deactivate();
+}
+
 TEST(CpuCacheTest, SizeClassCapacityTest) {
   if (!subtle::percpu::IsFast()) {
     return;
@@ -1903,6 +2715,28 @@ TEST(CpuCacheTest, TargetOverflowRefillCount) {
   EXPECT_EQ(F(100, 8, 3), 51);
 }
 
+TEST(CpuCacheTest, TargetOneSidedOverflowRefillCount) {
+  auto F = cpu_cache_internal::TargetOneSidedOverflowRefillCount;
+  // Args are: capacity, batch_length, successive.
+  EXPECT_EQ(F(0, 8, 4), 1);
+  EXPECT_EQ(F(1, 8, 4), 2);
+  EXPECT_EQ(F(24, 8, 4), 25);
+  EXPECT_EQ(F(32, 8, 1), 16);
+  EXPECT_EQ(F(32, 8, 2), 32);
+  EXPECT_EQ(F(100, 8, 4), 101);
+  EXPECT_EQ(F(200, 8, 4), 128);
+}
+
+TEST(CpuCacheTest, TargetPingPongOverflowRefillCount) {
+  auto F = cpu_cache_internal::TargetPingPongOverflowRefillCount;
+  // Args are: capacity, batch_length.
+  EXPECT_EQ(F(0, 8), 1);
+  EXPECT_EQ(F(2, 8), 3);
+  EXPECT_EQ(F(16, 8), 5);
+  EXPECT_EQ(F(24, 32), 17);
+  EXPECT_EQ(F(96, 32), 17);
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
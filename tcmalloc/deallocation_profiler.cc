@@ -24,6 +24,7 @@
 #include <memory>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "absl/base/attributes.h"
 #include "absl/base/const_init.h"
@@ -31,20 +32,26 @@
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/internal/sysinfo.h"
 #include "absl/base/macros.h"
+#include "absl/base/optimization.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/debugging/stacktrace.h"  // for GetStackTrace
 #include "absl/functional/function_ref.h"
 #include "absl/hash/hash.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "tcmalloc/arena.h"
+#include "tcmalloc/common.h"
 #include "tcmalloc/internal/allocation_guard.h"
 #include "tcmalloc/internal/cache_topology.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/internal/sampled_allocation.h"
+#include "tcmalloc/internal/stack_depot.h"
 #include "tcmalloc/internal_malloc_extension.h"
 #include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
@@ -468,7 +475,8 @@ class DeallocationProfiler {
     return tcmalloc::Profile();
   }
 
-  void ReportMalloc(const tcmalloc_internal::StackTrace& stack_trace) {
+  void ReportMalloc(const tcmalloc_internal::SampleInfo& stack_trace,
+                    absl::Span<void* const> stack) {
     // store sampled alloc in the hashmap
     DeallocationSampleRecord& allocation =
         allocs_[stack_trace.sampled_alloc_handle];
@@ -476,9 +484,9 @@ class DeallocationProfiler {
     allocation.allocated_size = stack_trace.allocated_size;
     allocation.requested_size = stack_trace.requested_size;
     allocation.requested_alignment = stack_trace.requested_alignment;
-    allocation.depth = stack_trace.depth;
-    memcpy(allocation.stack, stack_trace.stack,
-           sizeof(void*) * std::min(static_cast<int64_t>(stack_trace.depth),
+    allocation.depth = stack.size();
+    memcpy(allocation.stack, stack.data(),
+           sizeof(void*) * std::min(static_cast<int64_t>(stack.size()),
                                     kMaxStackDepth));
     // TODO(mmaas): Do we need to worry about b/65384231 anymore?
     allocation.creation_time = stack_trace.allocation_time;
@@ -530,7 +538,8 @@ void DeallocationProfilerList::Add(DeallocationProfiler* profiler) {
   tcmalloc_internal::tc_globals.sampled_allocation_recorder().Iterate(
       [profiler](
           const tcmalloc_internal::SampledAllocation& sampled_allocation) {
-        profiler->ReportMalloc(sampled_allocation.sampled_stack);
+        profiler->ReportMalloc(sampled_allocation.sampled_stack,
+                               sampled_allocation.stack());
       });
 }
 
@@ -552,7 +561,8 @@ void DeallocationProfilerList::ReportMalloc(
   AllocationGuardSpinLockHolder h(&profilers_lock_);
   DeallocationProfiler* cur = first_;
   while (cur != nullptr) {
-    cur->ReportMalloc(stack_trace);
+    cur->ReportMalloc(stack_trace, absl::MakeConstSpan(stack_trace.stack,
+                                                       stack_trace.depth));
     cur = cur->next_;
   }
 }
@@ -725,6 +735,302 @@ tcmalloc::Profile DeallocationSample::Stop() && {
   return tcmalloc::Profile();
 }
 
+// A site of the continuous lifetime profile: the allocations of one size made
+// from one call stack and freed from another, with the same CPU and thread
+// matching.  Sites with a count of 0 are unused.  In a snapshot, the censored
+// samples of allocations that are still live have no dealloc stack.
+struct ContinuousLifetimeProfiler::Site {
+  const tcmalloc_internal::StackDepot::Entry* alloc;
+  const tcmalloc_internal::StackDepot::Entry* dealloc;
+  size_t requested_size;
+  size_t requested_alignment;
+  size_t allocated_size;
+  // The number of allocations each one recorded represents.
+  double weight;
+  // CpuThreadMatchingStatus::value.
+  int matching;
+
+  double count;
+  double mean_life_time_ns;
+  double variance_life_time_ns;
+  double min_life_time_ns;
+  double max_life_time_ns;
+
+  bool SameSite(const Site& other) const {
+    return alloc == other.alloc && dealloc == other.dealloc &&
+           requested_size == other.requested_size &&
+           requested_alignment == other.requested_alignment &&
+           allocated_size == other.allocated_size &&
+           matching == other.matching;
+  }
+
+  void Record(double life_time_ns) {
+    if (count == 0) {
+      min_life_time_ns = life_time_ns;
+      max_life_time_ns = life_time_ns;
+    } else {
+      min_life_time_ns = std::min(min_life_time_ns, life_time_ns);
+      max_life_time_ns = std::max(max_life_time_ns, life_time_ns);
+    }
+    // Update mean and variance using Welford’s online algorithm.
+    const double old_mean_ns = mean_life_time_ns;
+    mean_life_time_ns += (life_time_ns - old_mean_ns) / (count + 1);
+    variance_life_time_ns +=
+        (life_time_ns - mean_life_time_ns) * (mean_life_time_ns - old_mean_ns);
+    ++count;
+  }
+};
+
+class ContinuousLifetimeProfile final : public tcmalloc_internal::ProfileBase {
+ public:
+  using Site = ContinuousLifetimeProfiler::Site;
+
+  // Takes a reference to the stacks of each of <sites>.
+  ContinuousLifetimeProfile(std::vector<Site> sites, absl::Duration duration)
+      : sites_(std::move(sites)), duration_(duration) {}
+
+  ~ContinuousLifetimeProfile() override {
+    for (const Site& site : sites_) {
+      tcmalloc_internal::tc_globals.stack_depot().Unref(site.alloc);
+      if (site.dealloc != nullptr) {
+        tcmalloc_internal::tc_globals.stack_depot().Unref(site.dealloc);
+      }
+    }
+  }
+
+  void Iterate(
+      absl::FunctionRef<void(const Profile::Sample&)> func) const override;
+
+  ProfileType Type() const override {
+    return tcmalloc::ProfileType::kLifetimes;
+  }
+
+  absl::Duration Duration() const override { return duration_; }
+
+ private:
+  std::vector<Site> sites_;
+  absl::Duration duration_;
+};
+
+// Emits the same samples as DeallocationStackTraceTable::Iterate, so the two
+// profiles can be read alike.
+void ContinuousLifetimeProfile::Iterate(
+    absl::FunctionRef<void(const Profile::Sample&)> func) const {
+  uint64_t pair_id = 1;
+
+  for (const Site& site : sites_) {
+    const size_t allocated_size = site.allocated_size;
+    uintptr_t bytes = std::lround(site.count * site.weight * allocated_size);
+    int64_t count = (bytes + allocated_size - 1) / allocated_size;
+    int64_t sum = count * allocated_size;
+
+    double stddev_life_time_ns =
+        sqrt(std::max(0.0, site.variance_life_time_ns / site.count));
+
+    const auto bucketize = internal::LifetimeNsToBucketedDuration;
+    Profile::Sample sample{
+        .sum = sum,
+        .requested_size = site.requested_size,
+        .requested_alignment = site.requested_alignment,
+        .allocated_size = allocated_size,
+        .profile_id = pair_id++,
+        .is_censored = (site.dealloc == nullptr),
+        .avg_lifetime = bucketize(site.mean_life_time_ns),
+        .stddev_lifetime = bucketize(stddev_life_time_ns),
+        .min_lifetime = bucketize(site.min_life_time_ns),
+        .max_lifetime = bucketize(site.max_life_time_ns)};
+    if (!sample.is_censored) {
+      sample.allocator_deallocator_physical_cpu_matched =
+          (site.matching & (1 << 4)) != 0;
+      sample.allocator_deallocator_virtual_cpu_matched =
+          (site.matching & (1 << 3)) != 0;
+      sample.allocator_deallocator_l3_matched = (site.matching & (1 << 2)) != 0;
+      sample.allocator_deallocator_numa_matched =
+          (site.matching & (1 << 1)) != 0;
+      sample.allocator_deallocator_thread_matched = (site.matching & 1) != 0;
+    }
+
+    sample.count = count;
+    sample.depth = site.alloc->stack().size();
+    std::copy(site.alloc->stack().begin(), site.alloc->stack().end(),
+              sample.stack);
+    func(sample);
+
+    if (sample.is_censored) {
+      continue;
+    }
+
+    sample.count = -1 * count;
+    sample.depth = site.dealloc->stack().size();
+    std::copy(site.dealloc->stack().begin(), site.dealloc->stack().end(),
+              sample.stack);
+    func(sample);
+  }
+}
+
+void ContinuousLifetimeProfiler::ReportMalloc(
+    tcmalloc_internal::StackTrace& stack_trace) const {
+  const int64_t period =
+      tcmalloc_internal::Parameters::continuous_lifetime_profile_period();
+  if (ABSL_PREDICT_TRUE(period <= 0) ||
+      stack_trace.sampled_alloc_handle % period != 0) {
+    return;
+  }
+  stack_trace.lifetime_profiled = true;
+  stack_trace.cpu_id = tcmalloc_internal::subtle::percpu::GetRealCpu();
+  stack_trace.vcpu_id = tcmalloc_internal::subtle::percpu::VirtualCpu::get();
+  stack_trace.thread_id = absl::base_internal::GetTID();
+}
+
+void ContinuousLifetimeProfiler::ReportFree(
+    const tcmalloc_internal::SampleInfo& info,
+    const tcmalloc_internal::StackDepot::Entry* alloc_stack) {
+  TC_ASSERT(info.lifetime_profiled);
+  const absl::Time now = absl::Now();
+  const double life_time_ns =
+      absl::ToDoubleNanoseconds(now - info.allocation_time);
+  const int cpu_id = tcmalloc_internal::subtle::percpu::GetRealCpu();
+  const CpuThreadMatchingStatus status(
+      info.cpu_id == cpu_id,
+      info.vcpu_id == tcmalloc_internal::subtle::percpu::VirtualCpu::get(),
+      GetL3Id(info.cpu_id) == GetL3Id(cpu_id),
+      GetNumaId(info.cpu_id) == GetNumaId(cpu_id),
+      info.thread_id == absl::base_internal::GetTID());
+
+  tcmalloc_internal::StackDepot& depot =
+      tcmalloc_internal::tc_globals.stack_depot();
+  void* stack[tcmalloc_internal::kMaxStackDepth];
+  const int depth =
+      absl::GetStackTrace(stack, tcmalloc_internal::kMaxStackDepth, 1);
+  const tcmalloc_internal::StackDepot::Entry* dealloc_stack =
+      depot.Intern(absl::MakeConstSpan(stack, depth));
+
+  const Site key{
+      .alloc = alloc_stack,
+      .dealloc = dealloc_stack,
+      .requested_size = info.requested_size,
+      .requested_alignment = info.requested_alignment,
+      .allocated_size = info.allocated_size,
+      // We divide by the requested size to obtain the number of allocations.
+      .weight = static_cast<double>(info.weight) / (info.requested_size + 1),
+      .matching = status.value,
+  };
+  const size_t hash =
+      absl::HashOf(alloc_stack, dealloc_stack, key.requested_size,
+                   key.requested_alignment, key.allocated_size, key.matching);
+
+  bool found = false;
+  Site evicted{};
+  {
+    AllocationGuardSpinLockHolder h(&lock_);
+    if (ABSL_PREDICT_FALSE(sites_ == nullptr)) {
+      void* memory;
+      {
+        tcmalloc_internal::PageHeapSpinLockHolder l;
+        memory = tcmalloc_internal::tc_globals.arena().Alloc(
+            sizeof(Site) * kNumSites, std::align_val_t{alignof(Site)});
+      }
+      sites_ = static_cast<Site*>(memory);
+      std::uninitialized_value_construct_n(sites_, kNumSites);
+      start_time_ = now;
+    }
+
+    // Sites are only ever replaced, never removed, so the probe sequence of a
+    // site stops at the first unused one.
+    Site* site = nullptr;
+    Site* victim = &sites_[hash % kNumSites];
+    for (int i = 0; i < kProbes; ++i) {
+      Site& s = sites_[(hash + i) % kNumSites];
+      if (s.count == 0) {
+        victim = &s;
+        break;
+      }
+      if (s.SameSite(key)) {
+        site = &s;
+        found = true;
+        break;
+      }
+      if (s.count < victim->count) {
+        victim = &s;
+      }
+    }
+
+    if (site == nullptr) {
+      // The table's reference to dealloc_stack is the one Intern returned.
+      evicted = *victim;
+      *victim = key;
+      depot.Ref(alloc_stack);
+      site = victim;
+    }
+    site->Record(life_time_ns);
+  }
+
+  if (found) {
+    depot.Unref(dealloc_stack);
+  }
+  if (evicted.count != 0) {
+    depot.Unref(evicted.alloc);
+    depot.Unref(evicted.dealloc);
+  }
+}
+
+std::unique_ptr<tcmalloc_internal::ProfileBase>
+ContinuousLifetimeProfiler::Snapshot() {
+  tcmalloc_internal::StackDepot& depot =
+      tcmalloc_internal::tc_globals.stack_depot();
+  auto& recorder = tcmalloc_internal::tc_globals.sampled_allocation_recorder();
+  const absl::Time now = absl::Now();
+
+  // Neither lock may be held while allocating, so make room up front for
+  // every site and for the sampled allocations live now, plus some slack for
+  // those that are sampled meanwhile.  Any beyond that are left out.
+  std::vector<Site> sites;
+  const size_t live = recorder.size();
+  sites.reserve(kNumSites + live + live / 8 + 16);
+
+  absl::Duration duration;
+  {
+    AllocationGuardSpinLockHolder h(&lock_);
+    if (sites_ != nullptr) {
+      for (int i = 0; i < kNumSites; ++i) {
+        if (sites_[i].count == 0) continue;
+        depot.Ref(sites_[i].alloc);
+        depot.Ref(sites_[i].dealloc);
+        sites.push_back(sites_[i]);
+      }
+      duration = now - start_time_;
+    }
+  }
+
+  // As at the end of a DeallocationSample session, the profiled allocations
+  // that are still live are reported as censored.
+  recorder.Iterate(
+      [&](const tcmalloc_internal::SampledAllocation& sampled_allocation) {
+        const tcmalloc_internal::SampleInfo& info =
+            sampled_allocation.sampled_stack;
+        if (!info.lifetime_profiled || sites.size() == sites.capacity()) {
+          return;
+        }
+        depot.Ref(sampled_allocation.depot_stack);
+        Site censored{
+            .alloc = sampled_allocation.depot_stack,
+            .dealloc = nullptr,
+            .requested_size = info.requested_size,
+            .requested_alignment = info.requested_alignment,
+            .allocated_size = info.allocated_size,
+            .weight =
+                static_cast<double>(info.weight) / (info.requested_size + 1),
+            .matching = 0,
+        };
+        censored.Record(
+            absl::ToDoubleNanoseconds(now - info.allocation_time));
+        sites.push_back(censored);
+      });
+
+  return std::make_unique<ContinuousLifetimeProfile>(std::move(sites),
+                                                     duration);
+}
+
 namespace internal {
 
 // Lifetimes below 1ns are truncated to 1ns.  Lifetimes between 1ns and 1ms
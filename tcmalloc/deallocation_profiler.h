@@ -15,13 +15,17 @@
 #ifndef TCMALLOC_DEALLOCATION_PROFILER_H_
 #define TCMALLOC_DEALLOCATION_PROFILER_H_
 
+#include <stdint.h>
+
 #include <memory>
 
 #include "absl/base/const_init.h"
 #include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
 #include "absl/time/time.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/stack_depot.h"
 #include "tcmalloc/malloc_extension.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
@@ -58,6 +62,48 @@ class DeallocationSample final
   std::unique_ptr<DeallocationProfiler> profiler_;
 };
 
+class ContinuousLifetimeProfile;
+
+// Profiles the lifetimes of 1 in continuous_lifetime_profile_period() sampled
+// allocations for as long as the process runs, rather than for an explicit
+// session like DeallocationSample.  Sites are kept in a fixed-size
+// table: when a new site finds no room, the least often seen site near it is
+// evicted, so memory stays bounded while the common sites are kept.
+class ContinuousLifetimeProfiler {
+ public:
+  constexpr ContinuousLifetimeProfiler() = default;
+
+  // Marks <stack_trace> as profiled if it is one of the sampled allocations
+  // the profile tracks, recording where it was allocated.
+  void ReportMalloc(tcmalloc_internal::StackTrace& stack_trace) const;
+
+  // Records the deallocation of a profiled allocation, described by <info>,
+  // which was allocated from <alloc_stack>.
+  void ReportFree(const tcmalloc_internal::SampleInfo& info,
+                  const tcmalloc_internal::StackDepot::Entry* alloc_stack)
+      ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Returns a kLifetimes profile of the deallocations recorded so far, with the
+  // profiled allocations that are still live as censored samples.
+  std::unique_ptr<tcmalloc_internal::ProfileBase> Snapshot()
+      ABSL_LOCKS_EXCLUDED(lock_);
+
+ private:
+  friend class ContinuousLifetimeProfile;
+
+  struct Site;
+
+  static constexpr int kNumSites = 4096;
+  // How many slots following a site's hash are searched for it.
+  static constexpr int kProbes = 8;
+
+  absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  // Allocated from the arena on the first deallocation recorded.
+  Site* sites_ ABSL_GUARDED_BY(lock_) = nullptr;
+  absl::Time start_time_ ABSL_GUARDED_BY(lock_);
+};
+
 namespace internal {
 absl::Duration LifetimeNsToBucketedDuration(double lifetime_ns);
 }  // namespace internal
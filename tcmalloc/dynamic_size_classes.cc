@@ -0,0 +1,171 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/dynamic_size_classes.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "absl/base/attributes.h"
+#include "absl/functional/function_ref.h"
+#include "absl/types/span.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/parameters.h"
+#include "tcmalloc/sizemap.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/tcmalloc_policy.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+size_t ChooseDynamicClassSize(absl::Span<const uint64_t> weights,
+                              absl::FunctionRef<size_t(size_t)> class_size,
+                              absl::Span<const size_t> excluded) {
+  uint64_t total = 0;
+  for (uint64_t w : weights) {
+    total += w;
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  size_t best_size = 0;
+  double best_savings = 0;
+  // Buckets [begin, end) round up to the same size class.  A new class of
+  // size BucketSize(i) saves (class size - BucketSize(i)) bytes on each
+  // allocation in buckets [begin, i].
+  for (size_t begin = 1, end; begin < weights.size(); begin = end) {
+    const size_t cs = class_size(DynamicSizeClasses::BucketSize(begin));
+    uint64_t group_weight = 0;
+    double group_count = 0;
+    for (end = begin; end < weights.size() &&
+                      class_size(DynamicSizeClasses::BucketSize(end)) == cs;
+         ++end) {
+      group_weight += weights[end];
+      group_count += static_cast<double>(weights[end]) /
+                     DynamicSizeClasses::BucketSize(end);
+    }
+    if (group_weight < kDynamicClassMinShare * total) {
+      continue;
+    }
+
+    const double min_savings = kDynamicClassMinSavings * group_count * cs;
+    double count = 0;
+    for (size_t i = begin; i < end; ++i) {
+      const size_t size = DynamicSizeClasses::BucketSize(i);
+      count += static_cast<double>(weights[i]) / size;
+      if (weights[i] == 0 || size >= cs ||
+          std::find(excluded.begin(), excluded.end(), size) != excluded.end()) {
+        continue;
+      }
+      const double savings = count * (cs - size);
+      if (savings >= min_savings && savings > best_savings) {
+        best_size = size;
+        best_savings = savings;
+      }
+    }
+  }
+  return best_size;
+}
+
+void DynamicSizeClasses::Update() {
+  uint64_t weights[kNumBuckets];
+  for (size_t b = 0; b < kNumBuckets; ++b) {
+    weights[b] = weights_[b].load(std::memory_order_relaxed);
+    weights_[b].fetch_sub(weights[b] / 2, std::memory_order_relaxed);
+  }
+
+  if (!Parameters::dynamic_size_classes()) {
+    return;
+  }
+  SizeMap& sizemap = tc_globals.sizemap();
+  if (sizemap.num_dynamic_classes() >= SizeMap::kMaxDynamicClasses) {
+    return;
+  }
+
+  const size_t size = ChooseDynamicClassSize(
+      weights,
+      [&](size_t s) {
+        return sizemap.class_to_size(sizemap.SizeClass(CppPolicy(), s));
+      },
+      absl::MakeConstSpan(rejected_, num_rejected_));
+  if (size == 0) {
+    return;
+  }
+  const size_t size_class = sizemap.AddDynamicSizeClass(size);
+  if (size_class == 0) {
+    if (num_rejected_ < kMaxRejected) {
+      rejected_[num_rejected_++] = size;
+    }
+    return;
+  }
+
+  {
+    PageHeapSpinLockHolder l;
+    for (size_t offset = 0; offset < kExpandedClassesStart;
+         offset += kNumBaseClasses) {
+      tc_globals.transfer_cache()
+          .central_freelist(size_class + offset)
+          .Init(size_class + offset);
+    }
+  }
+  sizemap.PublishDynamicSizeClass(size_class);
+}
+
+void DynamicSizeClasses::Print(Printer* out) const {
+  const SizeMap& sizemap = tc_globals.sizemap();
+  out->printf("------------------------------------------------\n");
+  out->printf("Dynamic size classes (%s): %u added, %u rejected\n",
+              Parameters::dynamic_size_classes() ? "enabled" : "disabled",
+              sizemap.num_dynamic_classes(), num_rejected_);
+  out->printf("------------------------------------------------\n");
+  for (size_t i = 0; i < sizemap.num_dynamic_classes(); ++i) {
+    const size_t size_class = sizemap.first_dynamic_class() + i;
+    out->printf("  class %3d [ %8zu bytes ] carved out of class %3d [ %8zu "
+                "bytes ]\n",
+                size_class, sizemap.class_to_size(size_class),
+                sizemap.dynamic_enclosing_class(size_class),
+                sizemap.class_to_size(
+                    sizemap.dynamic_enclosing_class(size_class)));
+  }
+}
+
+void DynamicSizeClasses::PrintInPbtxt(PbtxtRegion* region) const {
+  const SizeMap& sizemap = tc_globals.sizemap();
+  region->PrintBool("dynamic_size_classes_enabled",
+                    Parameters::dynamic_size_classes());
+  region->PrintI64("dynamic_size_classes_rejected", num_rejected_);
+  for (size_t i = 0; i < sizemap.num_dynamic_classes(); ++i) {
+    const size_t size_class = sizemap.first_dynamic_class() + i;
+    PbtxtRegion entry = region->CreateSubRegion("dynamic_size_class");
+    entry.PrintI64("sizeclass", sizemap.class_to_size(size_class));
+    entry.PrintI64("enclosing_sizeclass",
+                   sizemap.class_to_size(
+                       sizemap.dynamic_enclosing_class(size_class)));
+  }
+}
+
+DynamicSizeClasses& dynamic_size_classes() {
+  ABSL_CONST_INIT static DynamicSizeClasses classes;
+  return classes;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
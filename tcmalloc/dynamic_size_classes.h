@@ -0,0 +1,112 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_DYNAMIC_SIZE_CLASSES_H_
+#define TCMALLOC_DYNAMIC_SIZE_CLASSES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/functional/function_ref.h"
+#include "absl/types/span.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/sizemap.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// The smallest share of the allocated bytes of a size class that a new size
+// class carved out of it must save, and the smallest share of all sampled
+// bytes that the size class must have, for ChooseDynamicClassSize to pick it.
+inline constexpr double kDynamicClassMinSavings = 0.1;
+inline constexpr double kDynamicClassMinShare = 0.01;
+
+// Returns the size of the new size class that saves the most rounding loss, or
+// 0 if none saves enough.  <weights> holds the sampled bytes requested per
+// SizeMap::ClassIndex bucket, <class_size> returns the allocated size for a
+// requested size, and sizes in <excluded> are not picked.
+size_t ChooseDynamicClassSize(absl::Span<const uint64_t> weights,
+                              absl::FunctionRef<size_t(size_t)> class_size,
+                              absl::Span<const size_t> excluded);
+
+// Adds size classes at runtime for sizes that are allocated a lot but round up
+// to a much larger size class, e.g. a 400-byte object in a 448-byte class.
+//
+// Sampled allocations are recorded into a histogram of requested sizes, which
+// the background thread looks at periodically (see Update).  New classes take
+// the size class slots the configured size classes leave unused (see
+// SizeMap::AddDynamicSizeClass), so there are at most
+// SizeMap::kMaxDynamicClasses of them and they are never removed.  Their
+// per-CPU capacity comes from CpuCache::ResizeSizeClassMaxCapacities, which
+// grows it from the misses of the new class; their transfer caches have no
+// capacity, so objects pass through to the central freelist.
+class DynamicSizeClasses {
+ public:
+  // One bucket per SizeMap::ClassIndex value.
+  static constexpr size_t kNumBuckets =
+      SizeMap::ConstexprClassIndex(kMaxSize) + 1;
+
+  // The requested sizes rejected by SizeMap::AddDynamicSizeClass that are
+  // remembered, so they are not tried again.
+  static constexpr size_t kMaxRejected = 16;
+
+  constexpr DynamicSizeClasses() = default;
+
+  DynamicSizeClasses(const DynamicSizeClasses&) = delete;
+  DynamicSizeClasses& operator=(const DynamicSizeClasses&) = delete;
+
+  // The largest requested size that falls in <bucket>.
+  static constexpr size_t BucketSize(size_t bucket) {
+    return bucket <= SizeMap::ConstexprClassIndex(SizeMap::kLargeSize)
+               ? bucket << 3
+               : (bucket - 120) << 7;
+  }
+
+  // Records a sampled allocation of <requested_size> bytes that stands for
+  // <weight> bytes of allocations.
+  void RecordSample(size_t requested_size, size_t weight) {
+    if (requested_size > kMaxSize) return;
+    weights_[SizeMap::ConstexprClassIndex(requested_size)].fetch_add(
+        weight, std::memory_order_relaxed);
+  }
+
+  // Adds a size class if Parameters::dynamic_size_classes() is set and a size
+  // saves enough, then halves the histogram so that it follows changes in the
+  // allocation mix.  Called by the background thread.
+  void Update();
+
+  // The number of sizes SizeMap::AddDynamicSizeClass rejected.
+  size_t rejected() const { return num_rejected_; }
+
+  void Print(Printer* out) const;
+  void PrintInPbtxt(PbtxtRegion* region) const;
+
+ private:
+  std::atomic<uint64_t> weights_[kNumBuckets] = {};
+  size_t rejected_[kMaxRejected] = {};
+  size_t num_rejected_ = 0;
+};
+
+DynamicSizeClasses& dynamic_size_classes();
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_DYNAMIC_SIZE_CLASSES_H_
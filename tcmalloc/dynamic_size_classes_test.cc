@@ -0,0 +1,105 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/dynamic_size_classes.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/numeric/bits.h"
+#include "absl/types/span.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/sizemap.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+constexpr size_t kNumBuckets = DynamicSizeClasses::kNumBuckets;
+
+// Size classes of every power of two.
+size_t PowerOfTwoClassSize(size_t size) { return absl::bit_ceil(size); }
+
+class ChooseDynamicClassSizeTest : public testing::Test {
+ protected:
+  void Add(size_t size, uint64_t weight) {
+    weights_[SizeMap::ConstexprClassIndex(size)] += weight;
+  }
+
+  size_t Choose(absl::Span<const size_t> excluded = {}) {
+    return ChooseDynamicClassSize(weights_, PowerOfTwoClassSize, excluded);
+  }
+
+  std::vector<uint64_t> weights_ = std::vector<uint64_t>(kNumBuckets, 0);
+};
+
+TEST(DynamicSizeClassesTest, BucketSize) {
+  for (size_t bucket = 1; bucket < kNumBuckets; ++bucket) {
+    const size_t size = DynamicSizeClasses::BucketSize(bucket);
+    EXPECT_EQ(SizeMap::ConstexprClassIndex(size), bucket) << size;
+    if (bucket + 1 < kNumBuckets) {
+      EXPECT_EQ(SizeMap::ConstexprClassIndex(size + 1), bucket + 1) << size;
+    }
+  }
+  EXPECT_EQ(DynamicSizeClasses::BucketSize(kNumBuckets - 1), kMaxSize);
+}
+
+TEST_F(ChooseDynamicClassSizeTest, Empty) { EXPECT_EQ(Choose(), 0); }
+
+TEST_F(ChooseDynamicClassSizeTest, SavesRoundingLoss) {
+  // 72 bytes round up to 128.
+  Add(72, 1 << 20);
+  EXPECT_EQ(Choose(), 72);
+
+  const size_t excluded[] = {72};
+  EXPECT_EQ(Choose(excluded), 0);
+}
+
+TEST_F(ChooseDynamicClassSizeTest, SavingsTooSmall) {
+  // 120 bytes lose less than kDynamicClassMinSavings to rounding up to 128.
+  Add(120, 1 << 20);
+  EXPECT_EQ(Choose(), 0);
+}
+
+TEST_F(ChooseDynamicClassSizeTest, ShareTooSmall) {
+  Add(64, 1 << 20);
+  Add(72, (1 << 20) * kDynamicClassMinShare / 2);
+  EXPECT_EQ(Choose(), 0);
+
+  Add(72, (1 << 20) * kDynamicClassMinShare);
+  EXPECT_EQ(Choose(), 72);
+}
+
+TEST_F(ChooseDynamicClassSizeTest, PicksLargestSavings) {
+  // A 72-byte class saves 56 bytes on 72-byte objects, a 100-byte class saves
+  // 28 bytes on both.  There are more 72-byte objects for the same weight.
+  Add(72, 1 << 20);
+  Add(100, 1 << 20);
+  EXPECT_EQ(Choose(), 72);
+
+  // Sizes in another class do not count towards the savings.
+  Add(200, 1 << 24);
+  EXPECT_EQ(Choose(), 200);
+
+  weights_[SizeMap::ConstexprClassIndex(200)] = 0;
+  Add(100, 1 << 22);
+  EXPECT_EQ(Choose(), 104);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -15,6 +15,7 @@
 #include "tcmalloc/experiment.h"
 
 #include <string.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <cstdint>
@@ -30,6 +31,7 @@
 #include "absl/functional/function_ref.h"
 #include "absl/hash/hash.h"
 #include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
@@ -47,6 +49,7 @@ namespace {
 const char kDelimiter = ',';
 const char kExperiments[] = "BORG_EXPERIMENTS";
 const char kDisableExperiments[] = "BORG_DISABLE_EXPERIMENTS";
+const char kExperimentRollout[] = "BORG_EXPERIMENT_ROLLOUT";
 constexpr absl::string_view kEnableAll = "enable-all-known-experiments";
 constexpr absl::string_view kDisableAll = "all";
 
@@ -95,11 +98,23 @@ const bool* GetSelectedExperiments() {
     const char* test_target = thread_safe_getenv("TEST_TARGET");
     const char* active_experiments = thread_safe_getenv(kExperiments);
     const char* disabled_experiments = thread_safe_getenv(kDisableExperiments);
-    SelectExperiments(
-        by_id, test_target ? test_target : "",
-        active_experiments ? active_experiments : "",
-        disabled_experiments ? disabled_experiments : "",
-        active_experiments == nullptr && disabled_experiments == nullptr);
+    const char* rollout = thread_safe_getenv(kExperimentRollout);
+    SelectExperiments(by_id, test_target ? test_target : "",
+                      active_experiments ? active_experiments : "",
+                      disabled_experiments ? disabled_experiments : "",
+                      active_experiments == nullptr &&
+                          disabled_experiments == nullptr &&
+                          rollout == nullptr);
+    if (rollout != nullptr) {
+      // Mix in the pid, so that processes started at the same time do not
+      // make the same choices.
+      const uint64_t seed = absl::HashOf(
+          static_cast<uint64_t>(absl::base_internal::CycleClock::Now()),
+          getpid());
+      ApplyExperimentRollout(by_id, rollout,
+                             disabled_experiments ? disabled_experiments : "",
+                             seed);
+    }
   });
   return by_id;
 }
@@ -217,6 +232,46 @@ const bool* SelectExperiments(bool* buffer, absl::string_view test_target,
   return buffer;
 }
 
+void ApplyExperimentRollout(bool* buffer, absl::string_view rollout,
+                            absl::string_view disabled, uint64_t seed) {
+  if (disabled == kDisableAll) return;
+
+  ParseExperiments(rollout, [&](absl::string_view token) {
+    const absl::string_view::size_type colon = token.rfind(':');
+    if (colon == absl::string_view::npos) return;
+    const absl::string_view label = token.substr(0, colon);
+    double fraction;
+    Experiment id;
+    if (!absl::SimpleAtod(token.substr(colon + 1), &fraction) ||
+        !LookupExperimentID(label, &id) || IsCompilerExperiment(id)) {
+      return;
+    }
+
+    bool is_disabled = false;
+    ParseExperiments(disabled, [&](absl::string_view disabled_label) {
+      is_disabled |= disabled_label == label;
+    });
+    if (is_disabled) return;
+
+    // Map the top 53 bits of the hash to [0, 1).  Hashing the label keeps the
+    // choices for different experiments independent.
+    const uint64_t hash = absl::HashOf(seed, label);
+    if (static_cast<double>(hash >> 11) * 0x1.0p-53 < fraction) {
+      buffer[static_cast<int>(id)] = true;
+    }
+  });
+}
+
+uint64_t ActiveExperimentsMask() {
+  static_assert(kNumExperiments <= 64, "mask is also exported as a property");
+  const bool* active = GetSelectedExperiments();
+  uint64_t mask = 0;
+  for (size_t i = 0; i < kNumExperiments; ++i) {
+    if (active[i]) mask |= uint64_t{1} << i;
+  }
+  return mask;
+}
+
 }  // namespace tcmalloc_internal
 
 bool IsExperimentActive(Experiment exp) {
@@ -16,6 +16,7 @@
 #define TCMALLOC_EXPERIMENT_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <optional>
 
@@ -36,6 +37,11 @@
 // setting the environment variable:
 //     BORG_DISABLE_EXPERIMENTS=all *or*
 //     BORG_DISABLE_EXPERIMENTS=BAD_EXPERIMENT_LABEL
+//
+// Experiments can also be rolled out to a random fraction of processes, for
+// A/B comparisons across a fleet, with:
+//     BORG_EXPERIMENT_ROLLOUT=LABEL:FRACTION[,LABEL:FRACTION...]
+// Each process enables LABEL with probability FRACTION, unless disabled.
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
@@ -54,6 +60,17 @@ const bool* SelectExperiments(bool* buffer, absl::string_view test_target,
                               absl::string_view active,
                               absl::string_view disabled, bool unset);
 
+// ApplyExperimentRollout enables each experiment listed in rollout as
+// LABEL:FRACTION with probability FRACTION, decided by hashing its label with
+// seed, unless disabled lists it (or is "all").
+//
+// This is exposed for testing purposes only.
+void ApplyExperimentRollout(bool* buffer, absl::string_view rollout,
+                            absl::string_view disabled, uint64_t seed);
+
+// Returns the active experiments, with bit i set if Experiment i is active.
+uint64_t ActiveExperimentsMask();
+
 }  // namespace tcmalloc_internal
 
 bool IsExperimentActive(Experiment exp);
@@ -0,0 +1,101 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/experiment.h"
+
+#include <stdint.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "absl/strings/str_cat.h"
+#include "tcmalloc/experiment_config.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+class ExperimentRolloutTest : public ::testing::Test {
+ protected:
+  ExperimentRolloutTest()
+      : label_(experiments[0].name), id_(experiments[0].id) {
+    Clear();
+  }
+
+  void Clear() {
+    for (bool& active : buffer_) active = false;
+  }
+
+  bool active() const { return buffer_[static_cast<int>(id_)]; }
+
+  bool buffer_[kNumExperiments];
+  const std::string label_;
+  const Experiment id_;
+};
+
+TEST_F(ExperimentRolloutTest, Fractions) {
+  ApplyExperimentRollout(buffer_, absl::StrCat(label_, ":0"), "", 1);
+  EXPECT_FALSE(active());
+
+  ApplyExperimentRollout(buffer_, absl::StrCat(label_, ":1"), "", 1);
+  EXPECT_TRUE(active());
+}
+
+TEST_F(ExperimentRolloutTest, Disabled) {
+  ApplyExperimentRollout(buffer_, absl::StrCat(label_, ":1"), label_, 1);
+  EXPECT_FALSE(active());
+
+  ApplyExperimentRollout(buffer_, absl::StrCat(label_, ":1"), "all", 1);
+  EXPECT_FALSE(active());
+}
+
+TEST_F(ExperimentRolloutTest, Malformed) {
+  for (const std::string& rollout :
+       {label_, absl::StrCat(label_, ":"), absl::StrCat(label_, ":x"),
+        std::string("NOT_AN_EXPERIMENT:1")}) {
+    ApplyExperimentRollout(buffer_, rollout, "", 1);
+    EXPECT_FALSE(active()) << rollout;
+  }
+}
+
+TEST_F(ExperimentRolloutTest, Split) {
+  // The outcome depends on the seed alone, and roughly matches the fraction.
+  const std::string rollout = absl::StrCat(label_, ":0.5");
+  constexpr int kSeeds = 1000;
+  int enabled = 0;
+  for (uint64_t seed = 0; seed < kSeeds; ++seed) {
+    Clear();
+    ApplyExperimentRollout(buffer_, rollout, "", seed);
+    const bool first = active();
+    Clear();
+    ApplyExperimentRollout(buffer_, rollout, "", seed);
+    EXPECT_EQ(first, active());
+    enabled += first;
+  }
+  EXPECT_GT(enabled, kSeeds / 4);
+  EXPECT_LT(enabled, kSeeds * 3 / 4);
+}
+
+TEST(ActiveExperimentsMaskTest, MatchesIsExperimentActive) {
+  const uint64_t mask = ActiveExperimentsMask();
+  for (const auto& config : experiments) {
+    EXPECT_EQ(IsExperimentActive(config.id),
+              (mask >> static_cast<int>(config.id)) & 1)
+        << config.name;
+  }
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
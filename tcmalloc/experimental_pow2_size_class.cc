@@ -16,6 +16,7 @@
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/size_class_info.h"
+#include "tcmalloc/sizemap.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
@@ -288,6 +289,8 @@ static constexpr SizeClassInfo List[] = {
 
 static_assert(sizeof(List) / sizeof(List[0]) <= kNumBaseClasses);
 extern constexpr SizeClasses kExperimentalPow2SizeClasses{List, Assumptions};
+extern constexpr SizeMap::ClassArray kExperimentalPow2ClassArray =
+    SizeMap::BuildClassArray(List);
 
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
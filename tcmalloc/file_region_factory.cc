@@ -0,0 +1,121 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/file_region_factory.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "absl/types/span.h"
+#include "tcmalloc/internal/mapped_regions.h"
+#include "tcmalloc/malloc_extension.h"
+
+// MADV_COLD and MADV_PAGEOUT are available from Linux 5.4.
+#ifndef MADV_COLD
+#define MADV_COLD 20
+#endif
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+namespace tcmalloc {
+namespace {
+
+// Appends the stats of the underlying factory to the <written> bytes already
+// in <buffer>, and returns the space required by both.
+size_t Append(absl::Span<char> buffer, int written,
+              AddressRegionFactory* underlying, bool pbtxt) {
+  const size_t used = written < 0 ? 0 : static_cast<size_t>(written);
+  absl::Span<char> rest = buffer.subspan(std::min(used, buffer.size()));
+  return used + (pbtxt ? underlying->GetStatsInPbtxt(rest)
+                       : underlying->GetStats(rest));
+}
+
+}  // namespace
+
+FileRegionFactory::~FileRegionFactory() {
+  // The regions, and so the file, are never unmapped.
+}
+
+AddressRegion* FileRegionFactory::Create(void* start, size_t size,
+                                         UsageHint hint) {
+  if (hint != hint_) {
+    return underlying_->Create(start, size, hint);
+  }
+  if (regions_.full()) return nullptr;
+
+  const int saved_errno = errno;
+  // The file is sparse: only the pages that are written take space.
+  const size_t offset = regions_.file_size();
+  if (ftruncate(fd_, offset + size) != 0 ||
+      mmap(start, size, PROT_NONE, MAP_SHARED | MAP_FIXED, fd_, offset) ==
+          MAP_FAILED) {
+    errno = saved_errno;
+    return nullptr;
+  }
+  errno = saved_errno;
+
+  AddressRegion* region = underlying_->Create(start, size, hint);
+  if (region == nullptr) return nullptr;
+  regions_.Add(start, size);
+  return region;
+}
+
+size_t FileRegionFactory::PageOut() {
+  const int saved_errno = errno;
+  size_t bytes = 0;
+  regions_.ForEach([&](const tcmalloc_internal::MappedRegions::Region& r) {
+    void* start = reinterpret_cast<void*>(r.start);
+    // Ranges that were never allocated from are PROT_NONE, which madvise
+    // accepts.
+    if (madvise(start, r.size, MADV_PAGEOUT) == 0 ||
+        madvise(start, r.size, MADV_COLD) == 0) {
+      bytes += r.size;
+    }
+  });
+  errno = saved_errno;
+  paged_out_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+  return bytes;
+}
+
+size_t FileRegionFactory::GetStats(absl::Span<char> buffer) {
+  constexpr double MiB = 1048576.0;
+  const size_t bytes = regions_.bytes();
+  const size_t paged_out = paged_out_bytes_.load(std::memory_order_relaxed);
+  const int written = snprintf(
+      buffer.data(), buffer.size(),
+      "FileRegionFactory: %zu bytes (%.1f MiB) file-backed in %d regions, "
+      "%zu bytes (%.1f MiB) paged out\n",
+      bytes, bytes / MiB, regions_.regions(), paged_out, paged_out / MiB);
+  return Append(buffer, written, underlying_, /*pbtxt=*/false);
+}
+
+size_t FileRegionFactory::GetStatsInPbtxt(absl::Span<char> buffer) {
+  const int written = snprintf(
+      buffer.data(), buffer.size(),
+      " file_region_factory_bytes: %zu\n"
+      " file_region_factory_regions: %d\n"
+      " file_region_factory_paged_out_bytes: %zu\n",
+      regions_.bytes(), regions_.regions(),
+      paged_out_bytes_.load(std::memory_order_relaxed));
+  return Append(buffer, written, underlying_, /*pbtxt=*/true);
+}
+
+}  // namespace tcmalloc
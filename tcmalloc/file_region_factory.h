@@ -0,0 +1,87 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An AddressRegionFactory that backs the memory of one usage hint with a file,
+// such as one on local NVMe, so that the kernel can page it out to the file
+// instead of keeping it in DRAM.
+
+#ifndef TCMALLOC_FILE_REGION_FACTORY_H_
+#define TCMALLOC_FILE_REGION_FACTORY_H_
+
+#include <stddef.h>
+
+#include <atomic>
+
+#include "absl/types/span.h"
+#include "tcmalloc/internal/mapped_regions.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+
+// Maps the regions created for `hint` (by default, those of cold allocations,
+// made with a hot_cold_t hint below tcmalloc_min_hot_access_hint) from `fd`,
+// and creates every region with `underlying`.  TCMalloc hands out the memory
+// of these regions in hugepage-sized chunks, as it does for other regions.
+//
+//   int fd = open("/mnt/nvme", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+//   static auto* factory =
+//       new FileRegionFactory(MallocExtension::GetRegionFactory(), fd);
+//   MallocExtension::SetRegionFactory(factory);
+//   void* cold = ::operator new(size, static_cast<hot_cold_t>(0));
+//
+// The pages of live objects stay in the page cache until the kernel reclaims
+// them, or PageOut() asks it to, for example from a memory pressure callback
+// (see MallocExtension::RegisterMemoryPressureCallback).  Memory that TCMalloc
+// releases is punched out of the file (MADV_REMOVE), as it holds no data.
+//
+// `underlying` must not map over the range given to Create, as the default
+// factory does not, since the file is already mapped there.  The factory must
+// never be deleted.
+class FileRegionFactory final : public AddressRegionFactory {
+ public:
+  static constexpr int kMaxRegions =
+      tcmalloc_internal::MappedRegions::kMaxRegions;
+
+  // Takes ownership of `fd`, which must be open for reading and writing.  The
+  // file is grown as regions are created, from its start.
+  FileRegionFactory(AddressRegionFactory* underlying, int fd,
+                    UsageHint hint = UsageHint::kInfrequentAccess)
+      : underlying_(underlying), fd_(fd), hint_(hint) {}
+  ~FileRegionFactory() override;
+
+  AddressRegion* Create(void* start, size_t size, UsageHint hint) override;
+  // Reports the file-backed regions, followed by the stats of `underlying`.
+  size_t GetStats(absl::Span<char> buffer) override;
+  size_t GetStatsInPbtxt(absl::Span<char> buffer) override;
+
+  // Asks the kernel to write the resident pages of the file-backed regions
+  // back to the file and reclaim them (MADV_PAGEOUT), or, on kernels without
+  // it, to reclaim them first under pressure (MADV_COLD).  Returns the number
+  // of bytes advised.
+  size_t PageOut();
+
+  // The total size of the file-backed regions.
+  size_t file_bytes() const { return regions_.bytes(); }
+
+ private:
+  AddressRegionFactory* const underlying_;
+  const int fd_;
+  const UsageHint hint_;
+  tcmalloc_internal::MappedRegions regions_;
+  std::atomic<size_t> paged_out_bytes_{0};
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_FILE_REGION_FACTORY_H_
@@ -0,0 +1,109 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/file_region_factory.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <string>
+#include <utility>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/types/span.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace {
+
+using UsageHint = AddressRegionFactory::UsageHint;
+using ::testing::HasSubstr;
+
+constexpr size_t kRegionSize = size_t{64} << 20;
+
+class FileRegionFactoryTest : public testing::Test {
+ protected:
+  FileRegionFactoryTest() {
+    std::string path = testing::TempDir() + "/file_region_XXXXXX";
+    fd_ = mkstemp(path.data());
+    EXPECT_GE(fd_, 0);
+    unlink(path.c_str());
+  }
+
+  // Reserves address space for a region, as TCMalloc does before Create.
+  static void* Reserve(size_t size) {
+    void* p =
+        mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    EXPECT_NE(p, MAP_FAILED);
+    return p;
+  }
+
+  int fd_;
+};
+
+TEST_F(FileRegionFactoryTest, BacksRegionsWithFile) {
+  FileRegionFactory factory(MallocExtension::GetRegionFactory(), fd_);
+  AddressRegion* region = factory.Create(Reserve(kRegionSize), kRegionSize,
+                                         UsageHint::kInfrequentAccess);
+  ASSERT_NE(region, nullptr);
+  EXPECT_EQ(factory.file_bytes(), kRegionSize);
+
+  const size_t page = getpagesize();
+  auto [p, size] = region->Alloc(page, page);
+  ASSERT_NE(p, nullptr);
+  memcpy(p, "cold", 5);
+
+  // The region is allocated from its end, so find the object in the file
+  // relative to the region's.
+  char buffer[5];
+  const off_t offset = kRegionSize - size;
+  ASSERT_EQ(pread(fd_, buffer, sizeof(buffer), offset), sizeof(buffer));
+  EXPECT_STREQ(buffer, "cold");
+
+  EXPECT_EQ(factory.PageOut(), kRegionSize);
+  EXPECT_STREQ(static_cast<char*>(p), "cold");
+}
+
+TEST_F(FileRegionFactoryTest, OtherHintsAreNotFileBacked) {
+  FileRegionFactory factory(MallocExtension::GetRegionFactory(), fd_);
+  ASSERT_NE(factory.Create(Reserve(kRegionSize), kRegionSize,
+                           UsageHint::kNormal),
+            nullptr);
+  EXPECT_EQ(factory.file_bytes(), 0);
+  EXPECT_EQ(lseek(fd_, 0, SEEK_END), 0);
+}
+
+TEST_F(FileRegionFactoryTest, Stats) {
+  FileRegionFactory factory(MallocExtension::GetRegionFactory(), fd_);
+  ASSERT_NE(factory.Create(Reserve(kRegionSize), kRegionSize,
+                           UsageHint::kInfrequentAccess),
+            nullptr);
+
+  std::string stats(factory.GetStats({}), '\0');
+  stats.resize(factory.GetStats(absl::MakeSpan(stats)));
+  EXPECT_THAT(stats, HasSubstr("FileRegionFactory: 67108864 bytes"));
+  EXPECT_THAT(stats, HasSubstr("in 1 regions"));
+
+  std::string pbtxt(factory.GetStatsInPbtxt({}), '\0');
+  pbtxt.resize(factory.GetStatsInPbtxt(absl::MakeSpan(pbtxt)));
+  EXPECT_THAT(pbtxt, HasSubstr("file_region_factory_bytes: 67108864"));
+}
+
+}  // namespace
+}  // namespace tcmalloc
@@ -14,40 +14,64 @@
 
 #include "tcmalloc/global_stats.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <initializer_list>
+#include <limits>
+#include <new>
 #include <optional>
 #include <utility>
 
+#include "absl/base/const_init.h"
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/optimization.h"
 #include "absl/strings/match.h"
 #include "absl/strings/string_view.h"
 #include "absl/strings/strip.h"
 #include "absl/time/time.h"
 #include "absl/types/optional.h"
+#include "tcmalloc/allocation_sampling.h"
 #include "tcmalloc/central_freelist.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/cpu_cache.h"
+#include "tcmalloc/dynamic_size_classes.h"
 #include "tcmalloc/experiment.h"
 #include "tcmalloc/experiment_config.h"
 #include "tcmalloc/guarded_page_allocator.h"
+#include "tcmalloc/huge_page_aware_allocator.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/cpu_utils.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/memory_stats.h"
 #include "tcmalloc/internal/optimization.h"
 #include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/internal/transparent_hugepage.h"
+#include "tcmalloc/leak_detector.h"
+#include "tcmalloc/locked_cpu_cache.h"
 #include "tcmalloc/page_allocator.h"
 #include "tcmalloc/page_heap_allocator.h"
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/pages.h"
+#include "tcmalloc/parameter_control.h"
 #include "tcmalloc/parameters.h"
+#include "tcmalloc/release_requests.h"
+#include "tcmalloc/sampled_page_heap.h"
 #include "tcmalloc/selsan/selsan.h"
+#include "tcmalloc/slow_path_latency.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/span_stats.h"
 #include "tcmalloc/stack_trace_table.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/stats.h"
+#include "tcmalloc/stats_page.h"
 #include "tcmalloc/system-alloc.h"
 #include "tcmalloc/thread_cache.h"
 #include "tcmalloc/transfer_cache.h"
@@ -75,16 +99,83 @@ static absl::string_view MadviseString() {
   ABSL_UNREACHABLE();
 }
 
+static absl::string_view ThpEnabledString() {
+  switch (GetThpSettings().enabled) {
+    case ThpEnabled::kUnknown:
+      return "THP_ENABLED_UNKNOWN";
+    case ThpEnabled::kAlways:
+      return "THP_ENABLED_ALWAYS";
+    case ThpEnabled::kMadvise:
+      return "THP_ENABLED_MADVISE";
+    case ThpEnabled::kNever:
+      return "THP_ENABLED_NEVER";
+  }
+
+  ABSL_UNREACHABLE();
+}
+
+static absl::string_view ThpDefragString() {
+  switch (GetThpSettings().defrag) {
+    case ThpDefrag::kUnknown:
+      return "THP_DEFRAG_UNKNOWN";
+    case ThpDefrag::kAlways:
+      return "THP_DEFRAG_ALWAYS";
+    case ThpDefrag::kDefer:
+      return "THP_DEFRAG_DEFER";
+    case ThpDefrag::kDeferMadvise:
+      return "THP_DEFRAG_DEFER_MADVISE";
+    case ThpDefrag::kMadvise:
+      return "THP_DEFRAG_MADVISE";
+    case ThpDefrag::kNever:
+      return "THP_DEFRAG_NEVER";
+  }
+
+  ABSL_UNREACHABLE();
+}
+
+// Returns the bytes at the end of each span of <size_class> that no object
+// fits in.
+static size_t SpanWasteBytes(int size_class) {
+  const size_t size = tc_globals.sizemap().class_to_size(size_class);
+  if (size == 0) return 0;
+  return Length(tc_globals.sizemap().class_to_pages(size_class)).in_bytes() %
+         size;
+}
+
+// The bytes in the per-CPU caches as of the last UpdatePerCpuStatsSnapshot,
+// and whether there was one.
+ABSL_CONST_INIT static std::atomic<uint64_t> per_cpu_bytes_snapshot{0};
+ABSL_CONST_INIT static std::atomic<bool> per_cpu_snapshot_taken{false};
+
+// Returns the bytes in the per-CPU caches.  This visits every CPU.
+static uint64_t PerCpuUsedBytes() {
+  if (UsePerCpuCache(tc_globals)) {
+    return tc_globals.cpu_cache().TotalUsedBytes();
+  }
+  if (locked_cpu_cache().active()) {
+    return locked_cpu_cache().TotalUsedBytes();
+  }
+  return 0;
+}
+
+void UpdatePerCpuStatsSnapshot() {
+  per_cpu_bytes_snapshot.store(PerCpuUsedBytes(), std::memory_order_relaxed);
+  per_cpu_snapshot_taken.store(true, std::memory_order_release);
+}
+
 // Get stats into "r".  Also, if class_count != NULL, class_count[k]
 // will be set to the total number of objects of size class k in the
 // central cache, transfer cache, and per-thread and per-CPU caches.
 // If small_spans is non-NULL, it is filled.  Same for large_spans.
 // The boolean report_residence determines whether residence information
 // should be captured or not. Residence info requires a potentially
-// costly OS call, and is not necessary in all situations.
+// costly OS call, and is not necessary in all situations.  If
+// per_cpu_snapshot is set, the per-CPU cache bytes are taken from the last
+// UpdatePerCpuStatsSnapshot, if any, rather than from every CPU.
 void ExtractStats(TCMallocStats* r, uint64_t* class_count,
                   SpanStats* span_stats, SmallSpanStats* small_spans,
-                  LargeSpanStats* large_spans, bool report_residence) {
+                  LargeSpanStats* large_spans, bool report_residence,
+                  bool per_cpu_snapshot = false) {
   r->central_bytes = 0;
   r->transfer_bytes = 0;
   for (int size_class = 0; size_class < kNumClasses; ++size_class) {
@@ -117,12 +208,14 @@ void ExtractStats(TCMallocStats* r, uint64_t* class_count,
   {  // scope
     PageHeapSpinLockHolder l;
     r->tc_stats = ThreadCache::GetStats(&r->thread_bytes, class_count);
-    r->span_stats = tc_globals.span_allocator().stats();
+    r->span_stats = tc_globals.span_stats();
     r->stack_stats = tc_globals.sampledallocation_allocator().stats();
+    r->stack_depot_stats = tc_globals.stack_depot().stats();
     r->linked_sample_stats = tc_globals.linked_sample_allocator().stats();
     r->metadata_bytes = tc_globals.metadata_bytes();
     r->pagemap_bytes = tc_globals.pagemap().bytes();
     r->pageheap = tc_globals.page_allocator().stats();
+    r->cold_pageheap = tc_globals.page_allocator().cold_stats();
     r->peak_stats = tc_globals.page_allocator().peak_stats();
     if (small_spans != nullptr) {
       tc_globals.page_allocator().GetSmallSpanStats(small_spans);
@@ -131,7 +224,7 @@ void ExtractStats(TCMallocStats* r, uint64_t* class_count,
       tc_globals.page_allocator().GetLargeSpanStats(large_spans);
     }
 
-    r->arena = tc_globals.arena().stats();
+    r->arena = tc_globals.arena_stats();
     if (!report_residence) {
       r->metadata_bytes += r->arena.bytes_nonresident;
     }
@@ -163,8 +256,13 @@ void ExtractStats(TCMallocStats* r, uint64_t* class_count,
   r->sharded_transfer_bytes = 0;
   r->percpu_metadata_bytes_res = 0;
   r->percpu_metadata_bytes = 0;
+  if (per_cpu_snapshot &&
+      per_cpu_snapshot_taken.load(std::memory_order_acquire)) {
+    r->per_cpu_bytes = per_cpu_bytes_snapshot.load(std::memory_order_relaxed);
+  } else {
+    r->per_cpu_bytes = PerCpuUsedBytes();
+  }
   if (UsePerCpuCache(tc_globals)) {
-    r->per_cpu_bytes = tc_globals.cpu_cache().TotalUsedBytes();
     r->sharded_transfer_bytes =
         tc_globals.sharded_transfer_cache().TotalBytes();
 
@@ -187,6 +285,25 @@ void ExtractTCMallocStats(TCMallocStats* r, bool report_residence) {
 // Because different fields of stats are computed from state protected
 // by different locks, they may be inconsistent.  Prevent underflow
 // when subtracting to avoid gigantic results.
+// Calls <f> with the tag of each heap that may have limits of its own (see
+// PageAllocator::set_tag_limit) and has a soft limit set.
+template <typename F>
+static void ForEachTagWithLimit(F f) {
+  auto visit = [&](MemoryTag tag) {
+    if (tc_globals.page_allocator().tag_limit(tag, PageAllocator::kSoft) !=
+        std::numeric_limits<size_t>::max()) {
+      f(tag);
+    }
+  };
+  for (size_t partition = 0;
+       partition < tc_globals.numa_topology().active_partitions();
+       ++partition) {
+    visit(NumaNormalTag(partition));
+  }
+  visit(MemoryTag::kSampled);
+  visit(MemoryTag::kCold);
+}
+
 static uint64_t StatSub(uint64_t a, uint64_t b) {
   return (a >= b) ? (a - b) : 0;
 }
@@ -214,6 +331,16 @@ uint64_t PhysicalMemoryUsed(const TCMallocStats& stats) {
   return StatSub(VirtualMemoryUsed(stats), UnmappedBytes(stats));
 }
 
+uint64_t FarTierBytes(const TCMallocStats& stats) {
+  if (ColdNumaNodes() == 0) return 0;
+  return StatSub(stats.cold_pageheap.system_bytes,
+                 stats.cold_pageheap.unmapped_bytes);
+}
+
+uint64_t LocalTierBytes(const TCMallocStats& stats) {
+  return StatSub(PhysicalMemoryUsed(stats), FarTierBytes(stats));
+}
+
 // The number of bytes either in use by the app or fragmented so that
 // it cannot be (arbitrarily) reused.
 uint64_t RequiredBytes(const TCMallocStats& stats) {
@@ -261,6 +388,8 @@ static absl::string_view SizeClassConfigurationString(
       return "SIZE_CLASS_LEGACY";
     case SizeClassConfiguration::kReuse:
       return "SIZE_CLASS_REUSE";
+    case SizeClassConfiguration::kCustom:
+      return "SIZE_CLASS_CUSTOM";
   }
 
   ASSUME(false);
@@ -271,6 +400,8 @@ static absl::string_view PerCpuTypeString(RseqVcpuMode mode) {
   switch (mode) {
     case RseqVcpuMode::kNone:
       return "NONE";
+    case RseqVcpuMode::kMmCid:
+      return "MM_CID";
   }
 
   ASSUME(false);
@@ -283,8 +414,11 @@ void DumpStats(Printer* out, int level) {
   SpanStats span_stats[kNumClasses];
   if (level >= 2) {
     ExtractStats(&stats, class_count, span_stats, nullptr, nullptr, true);
-  } else {
+  } else if (level >= 1) {
     ExtractTCMallocStats(&stats, true);
+  } else {
+    ExtractStats(&stats, nullptr, nullptr, nullptr, nullptr,
+                 /*report_residence=*/false, /*per_cpu_snapshot=*/true);
   }
 
   static const double MiB = 1048576.0;
@@ -292,6 +426,11 @@ void DumpStats(Printer* out, int level) {
   out->printf(
       "See https://github.com/google/tcmalloc/tree/master/docs/stats.md for an explanation of "
       "this page\n");
+  if (level == 0) {
+    out->printf(
+        "Summary stats: per-CPU cache freelist bytes are as of the last "
+        "background refresh, and residence is not measured.\n");
+  }
 
   const uint64_t virtual_memory_used = VirtualMemoryUsed(stats);
   const uint64_t physical_memory_used = PhysicalMemoryUsed(stats);
@@ -324,10 +463,12 @@ void DumpStats(Printer* out, int level) {
       "MALLOC:\n"
       "MALLOC:   %12u               Spans in use\n"
       "MALLOC:   %12u (%7.1f MiB) Spans created\n"
+      "MALLOC:   %12u (%7.1f MiB) Spans free (reclaimable)\n"
       "MALLOC:   %12u               Thread heaps in use\n"
       "MALLOC:   %12u (%7.1f MiB) Thread heaps created\n"
       "MALLOC:   %12u               Stack traces in use\n"
       "MALLOC:   %12u (%7.1f MiB) Stack traces created\n"
+      "MALLOC:   %12u (%7.1f MiB) Distinct call stacks of sampled allocations\n"
       "MALLOC:   %12u               Table buckets in use\n"
       "MALLOC:   %12u (%7.1f MiB) Table buckets created\n"
       "MALLOC:   %12u (%7.1f MiB) Pagemap bytes used\n"
@@ -335,6 +476,8 @@ void DumpStats(Printer* out, int level) {
       "MALLOC:   %12u (%7.1f MiB) per-CPU slab bytes used\n"
       "MALLOC:   %12u (%7.1f MiB) per-CPU slab resident bytes\n"
       "MALLOC:   %12u (%7.1f MiB) malloc metadata Arena non-resident bytes\n"
+      "MALLOC:   %12u (%7.1f MiB) malloc metadata Arena hugepage bytes\n"
+      "MALLOC:   %12u (%7.1f MiB) malloc metadata Arena reusable bytes\n"
       "MALLOC:   %12u (%7.1f MiB) Actual memory used at peak\n"
       "MALLOC:   %12u (%7.1f MiB) Estimated in-use at peak\n"
       "MALLOC:   %12.4f               Realized fragmentation (%%)\n"
@@ -358,12 +501,16 @@ void DumpStats(Printer* out, int level) {
       uint64_t(stats.span_stats.in_use),
       uint64_t(stats.span_stats.total),
       (stats.span_stats.total * Span::CalcSizeOf(Parameters::max_span_cache_array_size())) / MiB,
+      uint64_t(stats.span_stats.total - stats.span_stats.in_use),
+      ((stats.span_stats.total - stats.span_stats.in_use) * Span::CalcSizeOf(Parameters::max_span_cache_array_size())) / MiB,
       uint64_t(stats.tc_stats.in_use),
       uint64_t(stats.tc_stats.total),
       (stats.tc_stats.total * sizeof(ThreadCache)) / MiB,
       uint64_t(stats.stack_stats.in_use),
       uint64_t(stats.stack_stats.total),
-      (stats.stack_stats.total * sizeof(StackTrace)) / MiB,
+      (stats.stack_stats.total * sizeof(SampledAllocation)) / MiB,
+      uint64_t(stats.stack_depot_stats.stacks),
+      stats.stack_depot_stats.bytes / MiB,
       uint64_t(stats.linked_sample_stats.in_use),
       uint64_t(stats.linked_sample_stats.total),
       (stats.linked_sample_stats.total * sizeof(StackTraceTable::LinkedSample)) / MiB,
@@ -374,6 +521,8 @@ void DumpStats(Printer* out, int level) {
       stats.percpu_metadata_bytes / MiB,
       stats.percpu_metadata_bytes_res, stats.percpu_metadata_bytes_res / MiB,
       stats.arena.bytes_nonresident, stats.arena.bytes_nonresident / MiB,
+      stats.arena.bytes_hugepage, stats.arena.bytes_hugepage / MiB,
+      stats.arena.bytes_reusable, stats.arena.bytes_reusable / MiB,
       uint64_t(stats.peak_stats.backed_bytes),
       stats.peak_stats.backed_bytes / MiB,
       uint64_t(stats.peak_stats.sampled_application_bytes),
@@ -400,6 +549,20 @@ void DumpStats(Printer* out, int level) {
       tc_globals.sampled_internal_fragmentation_.value(),
       tc_globals.peak_heap_tracker().CurrentPeakSize(),
       tc_globals.total_sampled_count_.value());
+  out->printf(
+      "MALLOC HEAP SNAPSHOTS: %zu bytes (peak), %zu samples (dropped)\n",
+      HeapSnapshotPeakBytes(), HeapSnapshotDroppedSamples());
+  const LeakDetector::Stats leaks = tc_globals.leak_detector().stats();
+  out->printf(
+      "MALLOC LEAK CANDIDATES: %zu stacks, %zu bytes (%zu stacks tracked, "
+      "%zu samples dropped)\n",
+      leaks.candidate_stacks, leaks.candidate_bytes, leaks.tracked_stacks,
+      leaks.dropped_samples);
+
+  out->printf(
+      "MALLOC TIERS: %zu bytes local, %zu bytes far (cold heap on NUMA nodes "
+      "%#x)\n",
+      LocalTierBytes(stats), FarTierBytes(stats), ColdNumaNodes());
 
   MemoryStats memstats;
   if (GetMemoryStats(&memstats)) {
@@ -434,18 +597,21 @@ void DumpStats(Printer* out, int level) {
                              tc_globals.sizemap().class_to_size(size_class);
 
       cumulative += class_bytes;
+      const size_t pages = tc_globals.sizemap().class_to_pages(size_class);
       out->printf(
           // clang-format off
           "class %3d [ %8zu bytes ] : %8u objs; %5.1f MiB; %6.1f cum MiB; "
-          "%8u live pages; spans: %10zu ret / %10zu req = %5.4f;\n",
+          "%8u live pages; spans: %10zu ret / %10zu req = %5.4f; "
+          "%2zu pages/span, %5.2f%% waste;\n",
           // clang-format on
           size_class, tc_globals.sizemap().class_to_size(size_class),
           class_count[size_class], class_bytes / MiB, cumulative / MiB,
-          span_stats[size_class].num_live_spans() *
-              tc_globals.sizemap().class_to_pages(size_class),
+          span_stats[size_class].num_live_spans() * pages,
           span_stats[size_class].num_spans_returned,
           span_stats[size_class].num_spans_requested,
-          span_stats[size_class].prob_returned());
+          span_stats[size_class].prob_returned(), pages,
+          100.0 * SpanWasteBytes(size_class) /
+              std::max<size_t>(Length(pages).in_bytes(), 1));
     }
 
 #ifndef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
@@ -465,6 +631,16 @@ void DumpStats(Printer* out, int level) {
     for (int size_class = 1; size_class < kNumClasses; ++size_class) {
       tc_globals.central_freelist(size_class).PrintSpanLifetimeStats(out);
     }
+
+    out->printf("\n");
+    out->printf("------------------------------------------------\n");
+    out->printf("Central cache freelist: Free span cache (%s)\n",
+                Parameters::central_freelist_span_cache() ? "enabled"
+                                                          : "disabled");
+    out->printf("------------------------------------------------\n");
+    for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+      tc_globals.central_freelist(size_class).PrintSpanCacheStats(out);
+    }
 #endif
 
     tc_globals.transfer_cache().Print(out);
@@ -474,9 +650,14 @@ void DumpStats(Printer* out, int level) {
       tc_globals.cpu_cache().Print(out);
     }
 
-    tc_globals.page_allocator().Print(out, MemoryTag::kNormal);
-    if (tc_globals.numa_topology().active_partitions() > 1) {
-      tc_globals.page_allocator().Print(out, MemoryTag::kNormalP1);
+    slow_path_latency().Print(out);
+    dynamic_size_classes().Print(out);
+    sampled_page_heap().Print(out);
+
+    for (size_t partition = 0;
+         partition < tc_globals.numa_topology().active_partitions();
+         ++partition) {
+      tc_globals.page_allocator().Print(out, NumaNormalTag(partition));
     }
     tc_globals.page_allocator().Print(out, MemoryTag::kSampled);
     tc_globals.page_allocator().Print(out, MemoryTag::kCold);
@@ -496,6 +677,8 @@ void DumpStats(Printer* out, int level) {
 
     out->printf("PARAMETER desired_usage_limit_bytes %u\n", soft_limit_bytes);
     out->printf("PARAMETER hard_usage_limit_bytes %u\n", hard_limit_bytes);
+    out->printf("PARAMETER cgroup_usage_limit_bytes %u\n",
+                tc_globals.page_allocator().cgroup_soft_limit());
     out->printf("Number of times soft limit was hit: %lld\n",
                 tc_globals.page_allocator().limit_hits(PageAllocator::kSoft));
     out->printf("Number of times hard limit was hit: %lld\n",
@@ -506,6 +689,26 @@ void DumpStats(Printer* out, int level) {
     out->printf("Number of times memory shrank below hard limit: %lld\n",
                 tc_globals.page_allocator().successful_shrinks_after_limit_hit(
                     PageAllocator::kHard));
+    const PageAllocator::LimitShrinkStats limit_shrinks =
+        tc_globals.page_allocator().limit_shrink_stats();
+    out->printf(
+        "Limit shrinks: %lld in the foreground (%7.1f MiB), %lld in the "
+        "background (%7.1f MiB)\n",
+        limit_shrinks.foreground_shrinks,
+        limit_shrinks.foreground_pages.in_mib(),
+        limit_shrinks.background_shrinks,
+        limit_shrinks.background_pages.in_mib());
+    ForEachTagWithLimit([&](MemoryTag tag) {
+      const PageAllocator& page_allocator = tc_globals.page_allocator();
+      out->printf(
+          "Limits of the %s heap: soft %u, hard %u bytes; hit %lld and %lld "
+          "times\n",
+          MemoryTagToLabel(tag),
+          page_allocator.tag_limit(tag, PageAllocator::kSoft),
+          page_allocator.tag_limit(tag, PageAllocator::kHard),
+          page_allocator.tag_limit_hits(tag, PageAllocator::kSoft),
+          page_allocator.tag_limit_hits(tag, PageAllocator::kHard));
+    });
 
     out->printf("Total number of pages released: %llu (%7.1f MiB)\n",
                 stats.num_released_total.in_pages().raw_num(),
@@ -580,8 +783,132 @@ void DumpStats(Printer* out, int level) {
     out->printf("PARAMETER max_span_cache_array_size %d\n",
                 Parameters::max_span_cache_array_size());
     out->printf("PARAMETER madvise %s\n", MadviseString());
+    out->printf("PARAMETER transparent_hugepage_enabled %s\n",
+                ThpEnabledName(GetThpSettings().enabled));
+    out->printf("PARAMETER transparent_hugepage_defrag %s\n",
+                ThpDefragName(GetThpSettings().defrag));
     out->printf("PARAMETER tcmalloc_resize_size_class_max_capacity %d\n",
                 Parameters::resize_size_class_max_capacity() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_sharded_transfer_cache_adaptive %d\n",
+                Parameters::sharded_transfer_cache_adaptive() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_transfer_cache_lock_free %d\n",
+                Parameters::transfer_cache_lock_free() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_per_cpu_caches_steal_objects %d\n",
+                Parameters::per_cpu_caches_steal_objects_enabled() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_per_cpu_caches_remote_free %d\n",
+                Parameters::per_cpu_caches_remote_free_enabled() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_per_cpu_caches_hugepage_slabs %d\n",
+                Parameters::per_cpu_caches_hugepage_slabs_enabled() ? 1 : 0);
+    out->printf(
+        "PARAMETER tcmalloc_per_cpu_caches_incremental_slab_resize %d\n",
+        Parameters::per_cpu_caches_incremental_slab_resize() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_slow_path_latency_histograms %d\n",
+                Parameters::slow_path_latency_histograms() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_dynamic_size_classes %d\n",
+                Parameters::dynamic_size_classes() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_compact_sampled_allocations %d\n",
+                Parameters::compact_sampled_allocations() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_allocation_accounting %d\n",
+                Parameters::allocation_accounting() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_per_cpu_caches_bypass_cold_classes %d\n",
+                Parameters::per_cpu_caches_bypass_cold_classes() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_per_cpu_caches_ping_pong_hysteresis %d\n",
+                Parameters::per_cpu_caches_ping_pong_hysteresis() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_huge_page_collapse_rate %u\n",
+                Parameters::huge_page_collapse_rate());
+    out->printf("PARAMETER tcmalloc_huge_page_backing_samples %u\n",
+                Parameters::huge_page_backing_samples());
+    out->printf("PARAMETER tcmalloc_lifetime_based_allocation %d\n",
+                Parameters::lifetime_based_allocation() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_cgroup_memory_limit_headroom_percent %u\n",
+                Parameters::cgroup_memory_limit_headroom_percent());
+    out->printf("PARAMETER tcmalloc_soft_limit_background_shrink_percent %u\n",
+                Parameters::soft_limit_background_shrink_percent());
+    out->printf("PARAMETER tcmalloc_pressure_based_release %d\n",
+                Parameters::pressure_based_release() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_event_driven_background_actions %d\n",
+                Parameters::event_driven_background_actions() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_idle_cache_reclaim_intervals %u\n",
+                Parameters::idle_cache_reclaim_intervals());
+    out->printf("PARAMETER tcmalloc_per_cpu_caches_decay_intervals %u\n",
+                Parameters::per_cpu_caches_decay_intervals());
+    out->printf("PARAMETER tcmalloc_per_cpu_caches_asymmetric_batches %d\n",
+                Parameters::per_cpu_caches_asymmetric_batches() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_transfer_cache_predictive_resize %d\n",
+                Parameters::transfer_cache_predictive_resize() ? 1 : 0);
+    out->printf(
+        "PARAMETER tcmalloc_transfer_cache_plunder_interval %s\n",
+        absl::FormatDuration(Parameters::transfer_cache_plunder_interval()));
+    out->printf("PARAMETER tcmalloc_per_cpu_caches_adaptive_batches %d\n",
+                Parameters::per_cpu_caches_adaptive_batches() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_central_freelist_hugepage_aware_spans %d\n",
+                Parameters::central_freelist_hugepage_aware_spans() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_central_freelist_span_cache %d\n",
+                Parameters::central_freelist_span_cache() ? 1 : 0);
+    out->printf(
+        "PARAMETER tcmalloc_central_freelist_span_cache_expiry %s\n",
+        absl::FormatDuration(Parameters::central_freelist_span_cache_expiry()));
+    out->printf("PARAMETER tcmalloc_central_freelist_address_ordered %d\n",
+                Parameters::central_freelist_address_ordered() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_central_freelist_nonintrusive_spans %d\n",
+                Parameters::central_freelist_nonintrusive_spans() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_large_span_cache %d\n",
+                Parameters::large_span_cache() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_large_size_classes %d\n",
+                Parameters::large_size_classes() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_large_allocation_density_prediction %d\n",
+                Parameters::large_allocation_density_prediction() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_realloc_mremap %d\n",
+                Parameters::realloc_mremap() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_realloc_growth_headroom %d\n",
+                Parameters::realloc_growth_headroom() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_gigantic_pages %d\n",
+                Parameters::gigantic_pages() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_huge_cache_forecast %d\n",
+                Parameters::huge_cache_forecast() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_huge_cache_lifo_reuse %d\n",
+                Parameters::huge_cache_lifo_reuse() ? 1 : 0);
+    out->printf(
+        "PARAMETER tcmalloc_huge_cache_cold_interval %s\n",
+        absl::FormatDuration(Parameters::huge_cache_cold_interval()));
+    out->printf("PARAMETER tcmalloc_hugepage_granular_release %d\n",
+                Parameters::hugepage_granular_release() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_residency_aware_release %d\n",
+                Parameters::residency_aware_release() ? 1 : 0);
+    out->printf(
+        "PARAMETER tcmalloc_skip_subrelease_target_refault_percent %u\n",
+        Parameters::skip_subrelease_target_refault_percent());
+    out->printf("PARAMETER tcmalloc_donated_tail_packing %d\n",
+                Parameters::donated_tail_packing() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_large_huge_regions %d\n",
+                Parameters::large_huge_regions() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_metadata_hugepages %d\n",
+                Parameters::metadata_hugepages() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_profile_sampling_cpu_budget %f\n",
+                Parameters::profile_sampling_cpu_budget());
+    out->printf("PARAMETER tcmalloc_profile_sampling_max_interval %u\n",
+                Parameters::profile_sampling_max_interval());
+    out->printf("PARAMETER tcmalloc_continuous_lifetime_profile_period %d\n",
+                Parameters::continuous_lifetime_profile_period());
+    out->printf("PARAMETER tcmalloc_leak_detection_interval %s\n",
+                absl::FormatDuration(Parameters::leak_detection_interval()));
+    out->printf("PARAMETER tcmalloc_guarded_deallocation_batch_size %d\n",
+                Parameters::guarded_deallocation_batch_size());
+    out->printf("PARAMETER tcmalloc_exclude_free_from_core_dumps %d\n",
+                Parameters::exclude_free_from_core_dumps() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_publish_stats_page %d\n",
+                Parameters::publish_stats_page() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_memory_pressure_moderate_percent %u\n",
+                Parameters::memory_pressure_moderate_percent());
+    out->printf("PARAMETER tcmalloc_memory_pressure_critical_percent %u\n",
+                Parameters::memory_pressure_critical_percent());
+    out->printf("PARAMETER tcmalloc_release_memory_after_fork %d\n",
+                Parameters::release_memory_after_fork() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_cold_page_size %d\n",
+                Parameters::cold_page_size());
+    out->printf(
+        "PARAMETER tcmalloc_numeric_property_staleness %s\n",
+        absl::FormatDuration(Parameters::numeric_property_staleness()));
     out->printf(
         "PARAMETER tcmalloc_dense_trackers_sorted_on_spans_allocated %d\n",
         Parameters::dense_trackers_sorted_on_spans_allocated() ? 1 : 0);
@@ -617,6 +944,14 @@ void DumpStatsInPbtxt(Printer* out, int level) {
                   stats.arena.bytes_unavailable);
   region.PrintI64("malloc_metadata_arena_unallocated",
                   stats.arena.bytes_unallocated);
+  region.PrintI64("malloc_metadata_arena_hugepage",
+                  stats.arena.bytes_hugepage);
+  region.PrintI64("malloc_metadata_arena_reusable",
+                  stats.arena.bytes_reusable);
+  region.PrintI64(
+      "span_metadata_free",
+      (stats.span_stats.total - stats.span_stats.in_use) *
+          Span::CalcSizeOf(Parameters::max_span_cache_array_size()));
   region.PrintI64("actual_mem_used", physical_memory_used);
   region.PrintI64("unmapped", unmapped_bytes);
   region.PrintI64("virtual_address_space_used", virtual_memory_used);
@@ -627,6 +962,10 @@ void DumpStatsInPbtxt(Printer* out, int level) {
   region.PrintI64("num_stack_traces", uint64_t(stats.stack_stats.in_use));
   region.PrintI64("num_stack_traces_created",
                   uint64_t(stats.stack_stats.total));
+  region.PrintI64("num_distinct_sampled_stacks",
+                  uint64_t(stats.stack_depot_stats.stacks));
+  region.PrintI64("distinct_sampled_stacks_bytes",
+                  uint64_t(stats.stack_depot_stats.bytes));
   region.PrintI64("num_table_buckets",
                   uint64_t(stats.linked_sample_stats.in_use));
   region.PrintI64("num_table_buckets_created",
@@ -652,6 +991,14 @@ void DumpStatsInPbtxt(Printer* out, int level) {
         tc_globals.sampled_internal_fragmentation_.value());
     sampled_profiles.PrintI64("peak_bytes",
                               tc_globals.peak_heap_tracker().CurrentPeakSize());
+    sampled_profiles.PrintI64("snapshot_peak_bytes", HeapSnapshotPeakBytes());
+    sampled_profiles.PrintI64("snapshot_dropped_samples",
+                              HeapSnapshotDroppedSamples());
+    const LeakDetector::Stats leaks = tc_globals.leak_detector().stats();
+    sampled_profiles.PrintI64("leak_candidate_stacks", leaks.candidate_stacks);
+    sampled_profiles.PrintI64("leak_candidate_bytes", leaks.candidate_bytes);
+    sampled_profiles.PrintI64("leak_tracked_stacks", leaks.tracked_stacks);
+    sampled_profiles.PrintI64("leak_dropped_samples", leaks.dropped_samples);
   }
 
   // Print total process stats (inclusive of non-malloc sources).
@@ -664,6 +1011,10 @@ void DumpStatsInPbtxt(Printer* out, int level) {
   region.PrintI64("total_sampled_count",
                   tc_globals.total_sampled_count_.value());
 
+  region.PrintI64("local_tier_bytes", LocalTierBytes(stats));
+  region.PrintI64("far_tier_bytes", FarTierBytes(stats));
+  region.PrintI64("far_tier_numa_nodes", ColdNumaNodes());
+
   if (level >= 2) {
     {
 #ifndef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
@@ -679,10 +1030,15 @@ void DumpStatsInPbtxt(Printer* out, int level) {
         entry.PrintI64("num_spans_returned",
                        span_stats[size_class].num_spans_returned);
         entry.PrintI64("obj_capacity", span_stats[size_class].obj_capacity);
+        entry.PrintI64("pages_per_span",
+                       tc_globals.sizemap().class_to_pages(size_class));
+        entry.PrintI64("span_waste_bytes", SpanWasteBytes(size_class));
         tc_globals.central_freelist(size_class)
             .PrintSpanUtilStatsInPbtxt(&entry);
         tc_globals.central_freelist(size_class)
             .PrintSpanLifetimeStatsInPbtxt(&entry);
+        tc_globals.central_freelist(size_class)
+            .PrintSpanCacheStatsInPbtxt(&entry);
       }
 #endif
     }
@@ -693,10 +1049,15 @@ void DumpStatsInPbtxt(Printer* out, int level) {
     if (UsePerCpuCache(tc_globals)) {
       tc_globals.cpu_cache().PrintInPbtxt(&region);
     }
+
+    slow_path_latency().PrintInPbtxt(&region);
+    dynamic_size_classes().PrintInPbtxt(&region);
+    sampled_page_heap().PrintInPbtxt(&region);
   }
-  tc_globals.page_allocator().PrintInPbtxt(&region, MemoryTag::kNormal);
-  if (tc_globals.numa_topology().active_partitions() > 1) {
-    tc_globals.page_allocator().PrintInPbtxt(&region, MemoryTag::kNormalP1);
+  for (size_t partition = 0;
+       partition < tc_globals.numa_topology().active_partitions();
+       ++partition) {
+    tc_globals.page_allocator().PrintInPbtxt(&region, NumaNormalTag(partition));
   }
   tc_globals.page_allocator().PrintInPbtxt(&region, MemoryTag::kSampled);
   tc_globals.page_allocator().PrintInPbtxt(&region, MemoryTag::kCold);
@@ -712,6 +1073,8 @@ void DumpStatsInPbtxt(Printer* out, int level) {
 
   region.PrintI64("desired_usage_limit_bytes", soft_limit_bytes);
   region.PrintI64("hard_usage_limit_bytes", hard_limit_bytes);
+  region.PrintI64("cgroup_usage_limit_bytes",
+                  tc_globals.page_allocator().cgroup_soft_limit());
   region.PrintI64("soft_limit_hits",
                   tc_globals.page_allocator().limit_hits(PageAllocator::kSoft));
   region.PrintI64("hard_limit_hits",
@@ -724,6 +1087,31 @@ void DumpStatsInPbtxt(Printer* out, int level) {
       "successful_shrinks_after_hard_limit_hit",
       tc_globals.page_allocator().successful_shrinks_after_limit_hit(
           PageAllocator::kHard));
+  const PageAllocator::LimitShrinkStats limit_shrinks =
+      tc_globals.page_allocator().limit_shrink_stats();
+  region.PrintI64("foreground_limit_shrinks",
+                  limit_shrinks.foreground_shrinks);
+  region.PrintI64("foreground_limit_shrink_pages",
+                  limit_shrinks.foreground_pages.raw_num());
+  region.PrintI64("background_limit_shrinks",
+                  limit_shrinks.background_shrinks);
+  region.PrintI64("background_limit_shrink_pages",
+                  limit_shrinks.background_pages.raw_num());
+  ForEachTagWithLimit([&](MemoryTag tag) {
+    const PageAllocator& page_allocator = tc_globals.page_allocator();
+    PbtxtRegion heap_limit = region.CreateSubRegion("heap_limit");
+    heap_limit.PrintRaw("heap", MemoryTagToLabel(tag));
+    heap_limit.PrintI64("soft_limit_bytes",
+                        page_allocator.tag_limit(tag, PageAllocator::kSoft));
+    heap_limit.PrintI64("hard_limit_bytes",
+                        page_allocator.tag_limit(tag, PageAllocator::kHard));
+    heap_limit.PrintI64(
+        "soft_limit_hits",
+        page_allocator.tag_limit_hits(tag, PageAllocator::kSoft));
+    heap_limit.PrintI64(
+        "hard_limit_hits",
+        page_allocator.tag_limit_hits(tag, PageAllocator::kHard));
+  });
 
   region.PrintI64("num_released_total_pages",
                   stats.num_released_total.in_pages().raw_num());
@@ -794,8 +1182,324 @@ void DumpStatsInPbtxt(Printer* out, int level) {
       "size_class_config",
       SizeClassConfigurationString(tc_globals.size_class_configuration()));
   region.PrintRaw("madvise", MadviseString());
+  region.PrintRaw("transparent_hugepage_enabled", ThpEnabledString());
+  region.PrintRaw("transparent_hugepage_defrag", ThpDefragString());
   region.PrintBool("tcmalloc_resize_size_class_max_capacity",
                    Parameters::resize_size_class_max_capacity());
+  region.PrintBool("tcmalloc_sharded_transfer_cache_adaptive",
+                   Parameters::sharded_transfer_cache_adaptive());
+  region.PrintBool("tcmalloc_transfer_cache_lock_free",
+                   Parameters::transfer_cache_lock_free());
+  region.PrintBool("tcmalloc_per_cpu_caches_steal_objects",
+                   Parameters::per_cpu_caches_steal_objects_enabled());
+  region.PrintBool("tcmalloc_per_cpu_caches_remote_free",
+                   Parameters::per_cpu_caches_remote_free_enabled());
+  region.PrintBool("tcmalloc_per_cpu_caches_hugepage_slabs",
+                   Parameters::per_cpu_caches_hugepage_slabs_enabled());
+  region.PrintBool("tcmalloc_per_cpu_caches_incremental_slab_resize",
+                   Parameters::per_cpu_caches_incremental_slab_resize());
+  region.PrintBool("tcmalloc_slow_path_latency_histograms",
+                   Parameters::slow_path_latency_histograms());
+  region.PrintBool("tcmalloc_dynamic_size_classes",
+                   Parameters::dynamic_size_classes());
+  region.PrintBool("tcmalloc_compact_sampled_allocations",
+                   Parameters::compact_sampled_allocations());
+  region.PrintBool("tcmalloc_allocation_accounting",
+                   Parameters::allocation_accounting());
+  region.PrintBool("tcmalloc_per_cpu_caches_bypass_cold_classes",
+                   Parameters::per_cpu_caches_bypass_cold_classes());
+  region.PrintBool("tcmalloc_per_cpu_caches_ping_pong_hysteresis",
+                   Parameters::per_cpu_caches_ping_pong_hysteresis());
+  region.PrintI64("tcmalloc_huge_page_collapse_rate",
+                  Parameters::huge_page_collapse_rate());
+  region.PrintI64("tcmalloc_huge_page_backing_samples",
+                  Parameters::huge_page_backing_samples());
+  region.PrintBool("tcmalloc_lifetime_based_allocation",
+                   Parameters::lifetime_based_allocation());
+  region.PrintI64("tcmalloc_cgroup_memory_limit_headroom_percent",
+                  Parameters::cgroup_memory_limit_headroom_percent());
+  region.PrintI64("tcmalloc_soft_limit_background_shrink_percent",
+                  Parameters::soft_limit_background_shrink_percent());
+  region.PrintBool("tcmalloc_pressure_based_release",
+                   Parameters::pressure_based_release());
+  region.PrintBool("tcmalloc_event_driven_background_actions",
+                   Parameters::event_driven_background_actions());
+  region.PrintI64("tcmalloc_idle_cache_reclaim_intervals",
+                  Parameters::idle_cache_reclaim_intervals());
+  region.PrintI64("tcmalloc_per_cpu_caches_decay_intervals",
+                  Parameters::per_cpu_caches_decay_intervals());
+  region.PrintBool("tcmalloc_per_cpu_caches_asymmetric_batches",
+                   Parameters::per_cpu_caches_asymmetric_batches());
+  region.PrintBool("tcmalloc_transfer_cache_predictive_resize",
+                   Parameters::transfer_cache_predictive_resize());
+  region.PrintI64(
+      "tcmalloc_transfer_cache_plunder_interval_ns",
+      absl::ToInt64Nanoseconds(Parameters::transfer_cache_plunder_interval()));
+  region.PrintBool("tcmalloc_per_cpu_caches_adaptive_batches",
+                   Parameters::per_cpu_caches_adaptive_batches());
+  region.PrintBool("tcmalloc_central_freelist_hugepage_aware_spans",
+                   Parameters::central_freelist_hugepage_aware_spans());
+  region.PrintBool("tcmalloc_central_freelist_span_cache",
+                   Parameters::central_freelist_span_cache());
+  region.PrintI64("tcmalloc_central_freelist_span_cache_expiry_ns",
+                  absl::ToInt64Nanoseconds(
+                      Parameters::central_freelist_span_cache_expiry()));
+  region.PrintBool("tcmalloc_central_freelist_address_ordered",
+                   Parameters::central_freelist_address_ordered());
+  region.PrintBool("tcmalloc_central_freelist_nonintrusive_spans",
+                   Parameters::central_freelist_nonintrusive_spans());
+  region.PrintBool("tcmalloc_large_span_cache",
+                   Parameters::large_span_cache());
+  region.PrintBool("tcmalloc_large_size_classes",
+                   Parameters::large_size_classes());
+  region.PrintBool("tcmalloc_large_allocation_density_prediction",
+                   Parameters::large_allocation_density_prediction());
+  region.PrintBool("tcmalloc_realloc_mremap",
+                   Parameters::realloc_mremap());
+  region.PrintBool("tcmalloc_realloc_growth_headroom",
+                   Parameters::realloc_growth_headroom());
+  region.PrintBool("tcmalloc_gigantic_pages",
+                   Parameters::gigantic_pages());
+  region.PrintBool("tcmalloc_huge_cache_forecast",
+                   Parameters::huge_cache_forecast());
+  region.PrintBool("tcmalloc_huge_cache_lifo_reuse",
+                   Parameters::huge_cache_lifo_reuse());
+  region.PrintI64(
+      "tcmalloc_huge_cache_cold_interval_ns",
+      absl::ToInt64Nanoseconds(Parameters::huge_cache_cold_interval()));
+  region.PrintBool("tcmalloc_hugepage_granular_release",
+                   Parameters::hugepage_granular_release());
+  region.PrintBool("tcmalloc_residency_aware_release",
+                   Parameters::residency_aware_release());
+  region.PrintI64("tcmalloc_skip_subrelease_target_refault_percent",
+                  Parameters::skip_subrelease_target_refault_percent());
+  region.PrintBool("tcmalloc_donated_tail_packing",
+                   Parameters::donated_tail_packing());
+  region.PrintBool("tcmalloc_large_huge_regions",
+                   Parameters::large_huge_regions());
+  region.PrintBool("tcmalloc_metadata_hugepages",
+                   Parameters::metadata_hugepages());
+  region.PrintDouble("tcmalloc_profile_sampling_cpu_budget",
+                     Parameters::profile_sampling_cpu_budget());
+  region.PrintI64("tcmalloc_profile_sampling_max_interval",
+                  Parameters::profile_sampling_max_interval());
+  region.PrintI64("tcmalloc_continuous_lifetime_profile_period",
+                  Parameters::continuous_lifetime_profile_period());
+  region.PrintI64(
+      "tcmalloc_leak_detection_interval_ns",
+      absl::ToInt64Nanoseconds(Parameters::leak_detection_interval()));
+  region.PrintI64("tcmalloc_guarded_deallocation_batch_size",
+                  Parameters::guarded_deallocation_batch_size());
+  region.PrintBool("tcmalloc_exclude_free_from_core_dumps",
+                   Parameters::exclude_free_from_core_dumps());
+  region.PrintBool("tcmalloc_publish_stats_page",
+                   Parameters::publish_stats_page());
+  region.PrintI64("tcmalloc_memory_pressure_moderate_percent",
+                  Parameters::memory_pressure_moderate_percent());
+  region.PrintI64("tcmalloc_memory_pressure_critical_percent",
+                  Parameters::memory_pressure_critical_percent());
+  region.PrintBool("tcmalloc_release_memory_after_fork",
+                   Parameters::release_memory_after_fork());
+  region.PrintI64("tcmalloc_cold_page_size",
+                  Parameters::cold_page_size());
+  region.PrintI64(
+      "tcmalloc_numeric_property_staleness_ns",
+      absl::ToInt64Nanoseconds(Parameters::numeric_property_staleness()));
+}
+
+namespace {
+
+// The values of the most frequently scraped numeric properties, as of the last
+// time they were gathered.  While Parameters::numeric_property_staleness() is
+// positive, GetNumericProperty serves them from here, so that monitoring which
+// polls them from many threads does not have each call take pageheap_lock and
+// walk every cache.
+//
+// A value is at most the staleness old when the snapshot is refreshed, plus the
+// time one refresh takes: a thread that finds the snapshot too old while
+// another thread refreshes it returns the old values rather than waiting.
+class PropertySnapshot {
+ public:
+  enum Property {
+    kVirtualMemoryUsed,
+    kPhysicalMemoryUsed,
+    kInUseByApp,
+    kHeapSize,
+    kPageHeapFree,
+    kPageHeapUnmapped,
+    kNumProperties,
+  };
+
+  // Returns the property named <name>, if it is served from the snapshot.
+  static std::optional<Property> Find(absl::string_view name) {
+    if (name == "generic.virtual_memory_used") return kVirtualMemoryUsed;
+    if (name == "generic.physical_memory_used") return kPhysicalMemoryUsed;
+    if (name == "generic.current_allocated_bytes" ||
+        name == "generic.bytes_in_use_by_app") {
+      return kInUseByApp;
+    }
+    if (name == "generic.heap_size") return kHeapSize;
+    if (name == "tcmalloc.pageheap_free_bytes" ||
+        name == "tcmalloc.page_heap_free") {
+      return kPageHeapFree;
+    }
+    if (name == "tcmalloc.pageheap_unmapped_bytes" ||
+        name == "tcmalloc.page_heap_unmapped") {
+      return kPageHeapUnmapped;
+    }
+    return std::nullopt;
+  }
+
+  constexpr PropertySnapshot() = default;
+
+  // Returns <property>, refreshing the snapshot first if it is older than
+  // <max_age> and no other thread is refreshing it.
+  uint64_t Get(Property property, absl::Duration max_age)
+      ABSL_LOCKS_EXCLUDED(refresh_lock_) {
+    const int64_t max_age_ticks = absl::ToDoubleSeconds(max_age) *
+                                  absl::base_internal::CycleClock::Frequency();
+    const int64_t taken_at = taken_at_.load(std::memory_order_acquire);
+    if (ABSL_PREDICT_FALSE(taken_at == 0)) {
+      // There is nothing to fall back on yet.
+      absl::base_internal::SpinLockHolder h(&refresh_lock_);
+      if (taken_at_.load(std::memory_order_relaxed) == 0) {
+        Refresh();
+      }
+    } else if (absl::base_internal::CycleClock::Now() - taken_at >
+                   max_age_ticks &&
+               refresh_lock_.TryLock()) {
+      if (absl::base_internal::CycleClock::Now() -
+              taken_at_.load(std::memory_order_relaxed) >
+          max_age_ticks) {
+        Refresh();
+      }
+      refresh_lock_.Unlock();
+    }
+    return values_[property].load(std::memory_order_relaxed);
+  }
+
+ private:
+  void Refresh() ABSL_EXCLUSIVE_LOCKS_REQUIRED(refresh_lock_) {
+    TCMallocStats stats;
+    ExtractTCMallocStats(&stats, false);
+    // In the order of Property.
+    const uint64_t values[kNumProperties] = {
+        VirtualMemoryUsed(stats),
+        PhysicalMemoryUsed(stats),
+        InUseByApp(stats),
+        HeapSizeBytes(stats.pageheap),
+        stats.pageheap.free_bytes,
+        UnmappedBytes(stats),
+    };
+    for (int i = 0; i < kNumProperties; ++i) {
+      values_[i].store(values[i], std::memory_order_relaxed);
+    }
+    taken_at_.store(absl::base_internal::CycleClock::Now(),
+                    std::memory_order_release);
+  }
+
+  absl::base_internal::SpinLock refresh_lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  // CycleClock::Now() when the snapshot was taken, or 0 before the first one.
+  std::atomic<int64_t> taken_at_{0};
+  std::atomic<uint64_t> values_[kNumProperties] = {};
+};
+
+ABSL_CONST_INIT PropertySnapshot property_snapshot;
+
+ABSL_CONST_INIT absl::base_internal::SpinLock stats_page_lock(
+    absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY);
+ABSL_CONST_INIT StatsPage* stats_page ABSL_GUARDED_BY(stats_page_lock) =
+    nullptr;
+ABSL_CONST_INIT bool stats_page_failed ABSL_GUARDED_BY(stats_page_lock) =
+    false;
+// The memfd of stats_page, or -1 until it is created.
+ABSL_CONST_INIT std::atomic<int> stats_page_fd{-1};
+
+// Creates the memfd holding the stats page and maps it.  Returns nullptr on
+// failure.
+StatsPage* CreateStatsPage() ABSL_EXCLUSIVE_LOCKS_REQUIRED(stats_page_lock) {
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifdef SYS_memfd_create
+  ErrnoRestorer errno_restorer;
+  const int fd = syscall(SYS_memfd_create, "tcmalloc_stats_page",
+                         MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) return nullptr;
+  if (ftruncate(fd, sizeof(StatsPage)) != 0) {
+    close(fd);
+    return nullptr;
+  }
+#ifdef F_ADD_SEALS
+  // Keep the size fixed, so that the readers' mappings stay valid.  This is
+  // best effort.
+  (void)fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+#endif
+  void* p = mmap(nullptr, sizeof(StatsPage), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    close(fd);
+    return nullptr;
+  }
+  // The memfd starts out zeroed.
+  StatsPage* page = new (p) StatsPage;
+  page->version = StatsPage::kVersion;
+  page->num_fields = StatsPage::kNumFields;
+  page->magic = StatsPage::kMagic;
+  stats_page_fd.store(fd, std::memory_order_release);
+  return page;
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace
+
+void PublishStatsPage() {
+  absl::base_internal::SpinLockHolder h(&stats_page_lock);
+  if (stats_page == nullptr) {
+    if (stats_page_failed) return;
+    stats_page = CreateStatsPage();
+    if (stats_page == nullptr) {
+      stats_page_failed = true;
+      return;
+    }
+  }
+
+  TCMallocStats stats;
+  ExtractTCMallocStats(&stats, false);
+  // In the order of StatsPage::Field.
+  const uint64_t values[StatsPage::kNumFields] = {
+      static_cast<uint64_t>(absl::ToUnixNanos(absl::Now())),
+      InUseByApp(stats),
+      PhysicalMemoryUsed(stats),
+      VirtualMemoryUsed(stats),
+      stats.per_cpu_bytes,
+      stats.sharded_transfer_bytes,
+      stats.transfer_bytes,
+      stats.central_bytes,
+      stats.thread_bytes,
+      stats.pageheap.free_bytes,
+      UnmappedBytes(stats),
+      stats.metadata_bytes,
+      ExternalBytes(stats),
+      FarTierBytes(stats),
+      stats.num_released_total.in_bytes(),
+      static_cast<uint64_t>(Parameters::background_release_rate()),
+  };
+
+  const uint64_t sequence =
+      stats_page->sequence.load(std::memory_order_relaxed);
+  stats_page->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (int i = 0; i < StatsPage::kNumFields; ++i) {
+    stats_page->fields[i].store(values[i], std::memory_order_relaxed);
+  }
+  stats_page->sequence.store(sequence + 2, std::memory_order_release);
 }
 
 bool GetNumericProperty(const char* name_data, size_t name_size,
@@ -811,6 +1515,15 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
     return true;
   }
 
+  if (const absl::Duration staleness = Parameters::numeric_property_staleness();
+      staleness > absl::ZeroDuration()) {
+    if (std::optional<PropertySnapshot::Property> property =
+            PropertySnapshot::Find(name)) {
+      *value = property_snapshot.Get(*property, staleness);
+      return true;
+    }
+  }
+
   if (name == "generic.virtual_memory_used") {
     TCMallocStats stats;
     ExtractTCMallocStats(&stats, false);
@@ -900,7 +1613,14 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
     PageHeapSpinLockHolder l;
     // Arena non-resident bytes aren't on the page heap, but they are unmapped.
     *value = tc_globals.page_allocator().stats().unmapped_bytes +
-             tc_globals.arena().stats().bytes_nonresident;
+             tc_globals.arena_stats().bytes_nonresident;
+    return true;
+  }
+
+  if (name == "tcmalloc.stats_page_fd") {
+    const int fd = stats_page_fd.load(std::memory_order_acquire);
+    if (fd < 0) return false;
+    *value = fd;
     return true;
   }
 
@@ -909,6 +1629,11 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
     return true;
   }
 
+  if (name == "tcmalloc.heap_profile_snapshot_peak_bytes") {
+    *value = HeapSnapshotPeakBytes();
+    return true;
+  }
+
   if (name == "tcmalloc.page_algorithm") {
     PageHeapSpinLockHolder l;
     *value = tc_globals.page_allocator().algorithm();
@@ -1011,6 +1736,30 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
     }
   }
 
+  if (name == "tcmalloc.hugepage_backing.intact_bytes") {
+    const PageHeapSpinLockHolder l;
+    *value =
+        tc_globals.page_allocator().GetHugepageBackingStats().intact.in_bytes();
+    return true;
+  }
+
+  if (name == "tcmalloc.hugepage_backing.small_page_backed_bytes") {
+    const PageHeapSpinLockHolder l;
+    *value = tc_globals.page_allocator()
+                 .GetHugepageBackingStats()
+                 .EstimatedSmallPageBackedBytes();
+    return true;
+  }
+
+  if (name == "tcmalloc.local_tier_bytes" ||
+      name == "tcmalloc.far_tier_bytes") {
+    TCMallocStats stats;
+    ExtractTCMallocStats(&stats, false);
+    *value = name == "tcmalloc.local_tier_bytes" ? LocalTierBytes(stats)
+                                                 : FarTierBytes(stats);
+    return true;
+  }
+
   if (name == "tcmalloc.required_bytes") {
     TCMallocStats stats;
     ExtractTCMallocStats(&stats, false);
@@ -1018,6 +1767,51 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
     return true;
   }
 
+  if (name == "tcmalloc.active_experiments") {
+    *value = ActiveExperimentsMask();
+    return true;
+  }
+
+  if (name == "tcmalloc.parameter_control_reloads") {
+    *value = parameter_control().reloads();
+    return true;
+  }
+
+  if (name == "tcmalloc.shared_sampled_pages") {
+    *value = sampled_page_heap().stats().pages;
+    return true;
+  }
+
+  if (name == "tcmalloc.shared_sampled_objects") {
+    *value = sampled_page_heap().stats().objects;
+    return true;
+  }
+
+  if (name == "tcmalloc.release_requests") {
+    *value = release_requests().requests();
+    return true;
+  }
+
+  if (name == "tcmalloc.release_requests_async") {
+    *value = release_requests().async_requests();
+    return true;
+  }
+
+  if (name == "tcmalloc.release_request_pending_bytes") {
+    *value = release_requests().pending_bytes();
+    return true;
+  }
+
+  if (name == "tcmalloc.release_request_released_bytes") {
+    *value = release_requests().released_bytes();
+    return true;
+  }
+
+  if (name == "tcmalloc.release_request_cache_shrinks") {
+    *value = release_requests().cache_shrinks();
+    return true;
+  }
+
   const absl::string_view kExperimentPrefix = "tcmalloc.experiment.";
   if (absl::StartsWith(name, kExperimentPrefix)) {
     std::optional<Experiment> exp =
@@ -1028,6 +1822,26 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
     }
   }
 
+  const absl::string_view kSlowPathLatencyPrefix =
+      "tcmalloc.slow_path_latency.";
+  if (absl::StartsWith(name, kSlowPathLatencyPrefix)) {
+    const absl::string_view suffix =
+        absl::StripPrefix(name, kSlowPathLatencyPrefix);
+    for (int t = 0; t < kNumSlowPathTiers; ++t) {
+      const SlowPathTier tier = static_cast<SlowPathTier>(t);
+      absl::string_view rest = suffix;
+      if (!absl::ConsumePrefix(&rest, SlowPathTierName(tier))) continue;
+      if (rest == ".count") {
+        *value = slow_path_latency().TotalCount(tier);
+        return true;
+      }
+      if (rest == ".cycles") {
+        *value = slow_path_latency().TotalCycles(tier);
+        return true;
+      }
+    }
+  }
+
   // LINT.ThenChange(//depot/google3/tcmalloc/testing/malloc_extension_test.cc)
   return false;
 }
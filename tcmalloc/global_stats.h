@@ -21,6 +21,7 @@
 #include "tcmalloc/arena.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/stack_depot.h"
 #include "tcmalloc/page_allocator.h"
 #include "tcmalloc/page_heap_allocator.h"
 #include "tcmalloc/pages.h"
@@ -42,11 +43,13 @@ struct TCMallocStats {
   uint64_t percpu_metadata_bytes_res;  // Resident bytes of the per-CPU metadata
   AllocatorStats tc_stats;             // ThreadCache objects
   AllocatorStats span_stats;           // Span objects
-  AllocatorStats stack_stats;          // StackTrace objects
+  AllocatorStats stack_stats;          // SampledAllocation objects
+  StackDepot::Stats stack_depot_stats;  // Their call stacks
   AllocatorStats linked_sample_stats;  // StackTraceTable::LinkedSample objects
   size_t pagemap_bytes;                // included in metadata bytes
   size_t percpu_metadata_bytes;        // included in metadata bytes
   BackingStats pageheap;               // Stats from page heap
+  BackingStats cold_pageheap;          // included in pageheap
   PageAllocator::PeakStats peak_stats;
 
   Length num_released_total;
@@ -68,17 +71,33 @@ uint64_t VirtualMemoryUsed(const TCMallocStats& stats);
 uint64_t UnmappedBytes(const TCMallocStats& stats);
 uint64_t PhysicalMemoryUsed(const TCMallocStats& stats);
 uint64_t RequiredBytes(const TCMallocStats& stats);
+// Bytes backed by the far memory tier, i.e. by the cold page heap when it is
+// placed on ColdNumaNodes(), and by the local tier.
+uint64_t FarTierBytes(const TCMallocStats& stats);
+uint64_t LocalTierBytes(const TCMallocStats& stats);
 size_t ExternalBytes(const TCMallocStats& stats);
 size_t HeapSizeBytes(const BackingStats& stats);
 size_t LocalBytes(const TCMallocStats& stats);
 size_t SlackBytes(const BackingStats& stats);
 
-// WRITE stats to "out"
+// WRITE stats to "out".  Level 2 adds the per-size-class, per-CPU and page
+// heap details to level 1.  Level 0, the summary, is level 1 without
+// residence, and with the per-CPU cache bytes of the last
+// UpdatePerCpuStatsSnapshot rather than visiting every CPU.
 void DumpStats(Printer* out, int level);
 void DumpStatsInPbtxt(Printer* out, int level);
 
 bool GetNumericProperty(const char* name_data, size_t name_size, size_t* value);
 
+// Updates the stats page (see stats_page.h) with the current stats, creating it
+// first if needed.  Does nothing if it could not be created.  Called by the
+// background thread while Parameters::publish_stats_page() is set.
+void PublishStatsPage();
+
+// Records the bytes in the per-CPU caches for summary stats (DumpStats level
+// 0).  Called by the background thread.
+void UpdatePerCpuStatsSnapshot();
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
@@ -37,6 +37,7 @@
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/page_size.h"
+#include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/pages.h"
@@ -69,12 +70,12 @@ void GuardedPageAllocator::Init(size_t max_allocated_pages,
 
 void GuardedPageAllocator::Destroy() {
   AllocationGuardSpinLockHolder h(&guarded_page_lock_);
-  if (initialized_) {
+  if (initialized_.load(std::memory_order_relaxed)) {
     size_t len = pages_end_addr_ - pages_base_addr_;
     int err = munmap(reinterpret_cast<void*>(pages_base_addr_), len);
     TC_ASSERT_NE(err, -1);
     (void)err;
-    initialized_ = false;
+    initialized_.store(false, std::memory_order_relaxed);
   }
 }
 
@@ -177,9 +178,8 @@ GuardedAllocWithStatus GuardedPageAllocator::Allocate(
   void* result = reinterpret_cast<void*>(SlotToAddr(free_slot));
   if (mprotect(result, page_size_, PROT_READ | PROT_WRITE) == -1) {
     TC_ASSERT(false, "mprotect(.., PROT_READ|PROT_WRITE) failed");
-    AllocationGuardSpinLockHolder h(&guarded_page_lock_);
-    failed_allocations_.LossyAdd(1);
-    successful_allocations_.LossyAdd(-1);
+    failed_allocations_.Add(1);
+    successful_allocations_.Add(-1);
     FreeSlot(free_slot);
     return {nullptr, Profile::Sample::GuardedStatus::MProtectFailed};
   }
@@ -228,11 +228,13 @@ void GuardedPageAllocator::Deallocate(void* ptr) {
   // On double-free, do not overwrite the original deallocation metadata, so
   // that the report produced shows the original deallocation stack trace.
   if (d.dealloc_count.fetch_add(1, std::memory_order_relaxed) != 0) {
+    // The page is still accessible if its protection was deferred.
+    mprotect(reinterpret_cast<void*>(page_addr), page_size_, PROT_NONE);
     ForceTouchPage(ptr);
   }
 
-  // Record stack trace. Unwinding the stack is expensive, and holding the
-  // guarded_page_lock_ should be avoided here.
+  // Record stack trace.  Unwinding the stack is expensive, so it is done before
+  // the slot is released for reuse.
   d.dealloc_trace.depth =
       absl::GetStackTrace(d.dealloc_trace.stack, kMaxStackDepth,
                           /*skip_count=*/2);
@@ -247,17 +249,76 @@ void GuardedPageAllocator::Deallocate(void* ptr) {
     d.write_overflow_detected = true;
   }
 
-  // Calling mprotect() should also be done outside the guarded_page_lock_
-  // critical section, since mprotect() can have relatively large latency.
-  TC_CHECK_EQ(
-      0, mprotect(reinterpret_cast<void*>(page_addr), page_size_, PROT_NONE));
+  const size_t batch_size = std::clamp<int64_t>(
+      Parameters::guarded_deallocation_batch_size(), 1,
+      kMaxDeferredDeallocations);
+  if (batch_size == 1 || d.write_overflow_detected) {
+    TC_CHECK_EQ(0, mprotect(reinterpret_cast<void*>(page_addr), page_size_,
+                            PROT_NONE));
+    deallocation_protect_calls_.Add(1);
 
-  if (d.write_overflow_detected) {
-    ForceTouchPage(ptr);
+    if (d.write_overflow_detected) {
+      ForceTouchPage(ptr);
+    }
+
+    FreeSlot(slot);
+    if (ABSL_PREDICT_FALSE(num_deferred_.load(std::memory_order_relaxed) !=
+                           0)) {
+      // Batching was turned off with deallocations still pending.
+      FlushDeferredDeallocations();
+    }
+    return;
   }
 
-  AllocationGuardSpinLockHolder h(&guarded_page_lock_);
-  FreeSlot(slot);
+  // Changing any page's protection takes mmap_sem and shoots down the TLBs of
+  // every thread of the process, so collect freed slots and protect them
+  // together.  They are not handed out again until they are protected.
+  size_t batch[kMaxDeferredDeallocations];
+  size_t n;
+  {
+    AllocationGuardSpinLockHolder h(&deferred_lock_);
+    size_t deferred = num_deferred_.load(std::memory_order_relaxed);
+    deferred_slots_[deferred++] = slot;
+    if (deferred < batch_size) {
+      num_deferred_.store(deferred, std::memory_order_relaxed);
+      return;
+    }
+    n = deferred;
+    std::copy(deferred_slots_, deferred_slots_ + n, batch);
+    num_deferred_.store(0, std::memory_order_relaxed);
+  }
+  ProtectAndFreeSlots(batch, n);
+}
+
+void GuardedPageAllocator::ProtectAndFreeSlots(size_t* slots, size_t n) {
+  std::sort(slots, slots + n);
+  for (size_t begin = 0; begin < n;) {
+    size_t end = begin + 1;
+    while (end < n && slots[end] == slots[end - 1] + 1) {
+      ++end;
+    }
+    // The guard pages between consecutive slots are already PROT_NONE.
+    const size_t len = (2 * (slots[end - 1] - slots[begin]) + 1) * page_size_;
+    TC_CHECK_EQ(0, mprotect(reinterpret_cast<void*>(SlotToAddr(slots[begin])),
+                            len, PROT_NONE));
+    deallocation_protect_calls_.Add(1);
+    begin = end;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    FreeSlot(slots[i]);
+  }
+}
+
+void GuardedPageAllocator::FlushDeferredDeallocations() {
+  size_t batch[kMaxDeferredDeallocations];
+  size_t n;
+  {
+    AllocationGuardSpinLockHolder h(&deferred_lock_);
+    n = num_deferred_.load(std::memory_order_relaxed);
+    std::copy(deferred_slots_, deferred_slots_ + n, batch);
+    num_deferred_.store(0, std::memory_order_relaxed);
+  }
+  ProtectAndFreeSlots(batch, n);
 }
 
 size_t GuardedPageAllocator::GetRequestedSize(const void* ptr) const {
@@ -313,6 +374,8 @@ void GuardedPageAllocator::Print(Printer* out) {
       "Allocated High-Watermark: %zu / %zu\n"
       "Object Pages Touched: %zu / %zu\n"
       "Currently Quarantined: %zu\n"
+      "Deferred Deallocations: %zu\n"
+      "Deallocation mprotect Calls: %zu\n"
       "PARAMETER tcmalloc_guarded_sample_parameter %d\n",
       // Successful Allocations
       successful_allocations_.value(),
@@ -333,6 +396,10 @@ void GuardedPageAllocator::Print(Printer* out) {
       pages_touched_.value(), total_pages_,
       // Currently Quarantined
       total_pages_ - allocated_pages(),
+      // Deferred Deallocations
+      num_deferred_.load(std::memory_order_relaxed),
+      // Deallocation mprotect Calls
+      deallocation_protect_calls_.value(),
       // PARAMETER
       GetChainedInterval());
 }
@@ -352,6 +419,10 @@ void GuardedPageAllocator::PrintInPbtxt(PbtxtRegion* gwp_asan) {
                      high_allocated_pages_.load(std::memory_order_relaxed));
   gwp_asan->PrintI64("max_allocated_pages", max_allocated_pages_);
   gwp_asan->PrintI64("pages_touched", pages_touched_.value());
+  gwp_asan->PrintI64("deferred_deallocations",
+                     num_deferred_.load(std::memory_order_relaxed));
+  gwp_asan->PrintI64("deallocation_protect_calls",
+                     deallocation_protect_calls_.value());
   gwp_asan->PrintI64("total_pages", total_pages_);
   gwp_asan->PrintI64("tcmalloc_guarded_sample_parameter", GetChainedInterval());
 }
@@ -389,53 +460,82 @@ void GuardedPageAllocator::MapPages() {
   // Align first page to page_size_.
   first_page_addr_ = GetPageAddr(pages_base_addr_ + page_size_);
 
-  initialized_ = true;
+  // Slots past total_pages_ can never be reserved.
+  for (size_t slot = total_pages_; slot < kGpaMaxPages; ++slot) {
+    used_slots_[slot / kSlotsPerPool].fetch_or(
+        uint64_t{1} << (slot % kSlotsPerPool), std::memory_order_relaxed);
+  }
+
+  initialized_.store(true, std::memory_order_release);
 }
 
-// Selects a random slot in O(1) time.
 ssize_t GuardedPageAllocator::ReserveFreeSlot() {
-  AllocationGuardSpinLockHolder h(&guarded_page_lock_);
-  if (!initialized_ || !allow_allocations_) return -1;
-  if (GetNumAvailablePages() == 0) {
+  if (!initialized_.load(std::memory_order_acquire) ||
+      !allow_allocations_.load(std::memory_order_relaxed)) {
+    return -1;
+  }
+  // Count the page before taking a slot, so that concurrent reservations can
+  // not exceed max_allocated_pages_ between them.
+  const size_t nalloced =
+      allocated_pages_.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (nalloced > max_allocated_pages_) {
+    allocated_pages_.fetch_sub(1, std::memory_order_relaxed);
+    if (num_deferred_.load(std::memory_order_relaxed) != 0) {
+      // Deferred deallocations hold on to their slots; release them for the
+      // next allocation rather than wait for a full batch.
+      FlushDeferredDeallocations();
+    }
     skipped_allocations_noslots_.Add(1);
     return -1;
   }
-  successful_allocations_.LossyAdd(1);
-
-  const size_t slot = GetFreeSlot();
-  TC_ASSERT(!used_pages_.GetBit(slot));
-  used_pages_.SetBit(slot);
-
-  // Both writes to allocated_pages_ happen under the guarded_page_lock_, so
-  // we do not have to use an atomic fetch_add(), which is more expensive due to
-  // typically imposing a full memory barrier when lowered on e.g. x86. Recent
-  // compiler optimizations will also turn the store(load(relaxed) + N, relaxed)
-  // into a simple add instruction.
-  const size_t nalloced = allocated_pages_.load(std::memory_order_relaxed) + 1;
-  allocated_pages_.store(nalloced, std::memory_order_relaxed);
-  if (nalloced > high_allocated_pages_.load(std::memory_order_relaxed)) {
-    high_allocated_pages_.store(nalloced, std::memory_order_relaxed);
+  successful_allocations_.Add(1);
+
+  size_t high = high_allocated_pages_.load(std::memory_order_relaxed);
+  while (nalloced > high && !high_allocated_pages_.compare_exchange_weak(
+                                high, nalloced, std::memory_order_relaxed)) {
   }
-  return slot;
+  return GetFreeSlot();
 }
 
 size_t GuardedPageAllocator::GetFreeSlot() {
-  const size_t idx = rand_.Next() % total_pages_;
-  // Find the closest adjacent free slot to the random index.
-  ssize_t slot = used_pages_.FindClearBackwards(idx);
-  if (slot >= 0) return slot;
-  slot = used_pages_.FindClear(idx);
-  TC_ASSERT_LT(slot, total_pages_);
-  return slot;
+  const size_t num_pools = (total_pages_ + kSlotsPerPool - 1) / kSlotsPerPool;
+  const int cpu = subtle::percpu::GetRealCpu();
+  const size_t home = cpu >= 0 ? cpu % num_pools : 0;
+  // Take the closest free slot at or after a random one, so that which slot an
+  // allocation gets stays hard to predict.
+  const size_t start = rand_.Next() % kSlotsPerPool;
+
+  // allocated_pages_ counts this slot already and is only decremented after a
+  // slot is freed, so some pool has a free slot, although a concurrent
+  // reservation may take it first; keep scanning until one is ours.
+  for (;;) {
+    for (size_t i = 0; i < num_pools; ++i) {
+      const size_t pool = (home + i) % num_pools;
+      std::atomic<uint64_t>& word = used_slots_[pool];
+      uint64_t used = word.load(std::memory_order_relaxed);
+      while (used != ~uint64_t{0}) {
+        const size_t bit =
+            (start + absl::countr_zero(absl::rotr(~used, start))) %
+            kSlotsPerPool;
+        // Acquire the slot's metadata from the thread that freed it.
+        if (word.compare_exchange_weak(used, used | (uint64_t{1} << bit),
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed)) {
+          return pool * kSlotsPerPool + bit;
+        }
+      }
+    }
+  }
 }
 
 void GuardedPageAllocator::FreeSlot(size_t slot) {
   TC_ASSERT_LT(slot, total_pages_);
-  TC_ASSERT(used_pages_.GetBit(slot));
-  used_pages_.ClearBit(slot);
-  // Cheaper decrement - see above.
-  allocated_pages_.store(allocated_pages_.load(std::memory_order_relaxed) - 1,
-                         std::memory_order_relaxed);
+  const uint64_t bit = uint64_t{1} << (slot % kSlotsPerPool);
+  const uint64_t used = used_slots_[slot / kSlotsPerPool].fetch_and(
+      ~bit, std::memory_order_release);
+  TC_ASSERT(used & bit);
+  (void)used;
+  allocated_pages_.fetch_sub(1, std::memory_order_relaxed);
 }
 
 uintptr_t GuardedPageAllocator::GetPageAddr(uintptr_t addr) const {
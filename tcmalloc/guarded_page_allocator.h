@@ -30,7 +30,6 @@
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/exponential_biased.h"
 #include "tcmalloc/internal/logging.h"
-#include "tcmalloc/internal/range_tracker.h"
 #include "tcmalloc/internal/stacktrace_filter.h"
 #include "tcmalloc/pages.h"
 
@@ -47,7 +46,9 @@ namespace tcmalloc_internal {
 //
 // Is safe to use with static storage duration and is thread safe with the
 // exception of calls to Init() and Destroy() (see corresponding function
-// comments).
+// comments).  Allocate() and Deallocate() take no lock: the slots are split
+// into pools of 64, one bitmap word each, and a thread reserves a slot from its
+// CPU's pool with a compare-and-swap, moving on to the next pool if it is full.
 //
 // Example:
 //   ABSL_CONST_INIT GuardedPageAllocator gpa;
@@ -135,12 +136,11 @@ class GuardedPageAllocator {
   // Precondition:  size and alignment <= page_size_
   // Precondition:  alignment is 0 or a power of 2
   GuardedAllocWithStatus Allocate(size_t size, size_t alignment,
-                                  const StackTrace& stack_trace)
-      ABSL_LOCKS_EXCLUDED(guarded_page_lock_);
+                                  const StackTrace& stack_trace);
 
   // Deallocates memory pointed to by ptr.  ptr must have been previously
   // returned by a call to Allocate.
-  void Deallocate(void* ptr) ABSL_LOCKS_EXCLUDED(guarded_page_lock_);
+  void Deallocate(void* ptr);
 
   // Returns the size requested when ptr was allocated.  ptr must have been
   // previously returned by a call to Allocate.
@@ -165,9 +165,8 @@ class GuardedPageAllocator {
 
   // Writes a human-readable summary of GuardedPageAllocator's internal state to
   // *out.
-  void Print(Printer* out) ABSL_LOCKS_EXCLUDED(guarded_page_lock_);
-  void PrintInPbtxt(PbtxtRegion* gwp_asan)
-      ABSL_LOCKS_EXCLUDED(guarded_page_lock_);
+  void Print(Printer* out);
+  void PrintInPbtxt(PbtxtRegion* gwp_asan);
 
   // Returns true if ptr points to memory managed by this class.
   inline bool ABSL_ATTRIBUTE_ALWAYS_INLINE
@@ -177,9 +176,8 @@ class GuardedPageAllocator {
   }
 
   // Allows Allocate() to start returning allocations.
-  void AllowAllocations() ABSL_LOCKS_EXCLUDED(guarded_page_lock_) {
-    AllocationGuardSpinLockHolder h(&guarded_page_lock_);
-    allow_allocations_ = true;
+  void AllowAllocations() {
+    allow_allocations_.store(true, std::memory_order_relaxed);
   }
 
   // Returns the number of pages available for allocation, based on how many are
@@ -215,15 +213,24 @@ class GuardedPageAllocator {
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   // Reserves and returns a slot randomly selected from the free slots in
-  // used_pages_.  Returns -1 if no slots available, or if AllowAllocations()
+  // used_slots_.  Returns -1 if no slots available, or if AllowAllocations()
   // hasn't been called yet.
-  ssize_t ReserveFreeSlot() ABSL_LOCKS_EXCLUDED(guarded_page_lock_);
+  ssize_t ReserveFreeSlot();
 
-  // Returns a random free slot in used_pages_.
-  size_t GetFreeSlot() ABSL_EXCLUSIVE_LOCKS_REQUIRED(guarded_page_lock_);
+  // Reserves a random free slot in used_slots_, preferring the pool of the
+  // current CPU.  There must be one: the caller has already counted the slot in
+  // allocated_pages_.
+  size_t GetFreeSlot();
 
   // Marks the specified slot as unreserved.
-  void FreeSlot(size_t slot) ABSL_EXCLUSIVE_LOCKS_REQUIRED(guarded_page_lock_);
+  void FreeSlot(size_t slot);
+
+  // Protects the pages of <slots>, with one mprotect() call for each run of
+  // consecutive slots, and then frees them.  Sorts <slots>.
+  void ProtectAndFreeSlots(size_t* slots, size_t n);
+
+  // Protects and frees the slots whose deallocation was deferred.
+  void FlushDeferredDeallocations() ABSL_LOCKS_EXCLUDED(deferred_lock_);
 
   // Returns the address of the page that addr resides on.
   uintptr_t GetPageAddr(uintptr_t addr) const;
@@ -272,14 +279,30 @@ class GuardedPageAllocator {
   // 80% or below, the probability of false positives will be below 10%.
   DecayingStackTraceFilter<kGpaMaxPages * 3, 2, 32> stacktrace_filter_;
 
+  // Serializes MapPages() and Destroy().
   absl::base_internal::SpinLock guarded_page_lock_;
 
-  // Maps each bool to one page.
-  // true: reserved. false: freed.
-  Bitmap<kGpaMaxPages> used_pages_ ABSL_GUARDED_BY(guarded_page_lock_);
-
-  // Number of currently allocated pages. Atomic so it may be accessed outside
-  // the guarded_page_lock_ to calculate heuristics based on pool utilization.
+  static constexpr size_t kSlotsPerPool = 64;
+  static constexpr size_t kNumPools = kGpaMaxPages / kSlotsPerPool;
+  static_assert(kGpaMaxPages % kSlotsPerPool == 0);
+
+  // Maps each bit to one slot, in pools of kSlotsPerPool.
+  // 1: reserved. 0: freed.  The slots past total_pages_ are always reserved.
+  std::atomic<uint64_t> used_slots_[kNumPools] = {};
+
+  // Freed slots whose pages are not protected yet, while
+  // Parameters::guarded_deallocation_batch_size() > 1.  They stay reserved
+  // in used_slots_ until they are.
+  static constexpr size_t kMaxDeferredDeallocations = 64;
+  absl::base_internal::SpinLock deferred_lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  size_t deferred_slots_[kMaxDeferredDeallocations] ABSL_GUARDED_BY(
+      deferred_lock_) = {};
+  // Written under deferred_lock_, but read without it to skip taking it.
+  std::atomic<size_t> num_deferred_ = 0;
+
+  // Number of currently allocated pages, reserved before a slot is taken so
+  // that at most max_allocated_pages_ are ever used.
   std::atomic<size_t> allocated_pages_;
   // The high-water mark for allocated_pages_.
   std::atomic<size_t> high_allocated_pages_;
@@ -296,6 +319,8 @@ class GuardedPageAllocator {
   tcmalloc_internal::StatsCounter skipped_allocations_toolarge_;
   // Number of pages allocated at least once from page pool.
   tcmalloc_internal::StatsCounter pages_touched_;
+  // Number of mprotect() calls made to protect freed pages.
+  tcmalloc_internal::StatsCounter deallocation_protect_calls_;
 
   // A dynamically-allocated array of stack trace data captured when each page
   // is allocated/deallocated.  Printed by the SEGV handler when a memory error
@@ -311,10 +336,10 @@ class GuardedPageAllocator {
   Random rand_;
 
   // True if this object has been fully initialized.
-  bool initialized_ ABSL_GUARDED_BY(guarded_page_lock_);
+  std::atomic<bool> initialized_;
 
   // Flag to control whether we can return allocations or not.
-  bool allow_allocations_ ABSL_GUARDED_BY(guarded_page_lock_);
+  std::atomic<bool> allow_allocations_;
 };
 
 }  // namespace tcmalloc_internal
@@ -27,6 +27,7 @@
 #include "tcmalloc/internal/page_size.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/pages.h"
+#include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
@@ -90,6 +91,50 @@ void BM_AllocDealloc(benchmark::State& state) {
 BENCHMARK(BM_AllocDealloc)->Range(1, GetGpaPageSize());
 BENCHMARK(BM_AllocDealloc)->Arg(1)->ThreadRange(1, kMaxGpaPages);
 
+void SetDeallocationBatchSize(const benchmark::State& state) {
+  Parameters::set_guarded_deallocation_batch_size(state.range(0));
+}
+
+void ResetDeallocationBatchSize(const benchmark::State&) {
+  Parameters::set_guarded_deallocation_batch_size(0);
+}
+
+// Benchmark for the cost of protecting freed pages while every thread keeps
+// touching memory of its own: each mprotect(PROT_NONE) shoots down the TLBs of
+// all the threads, so its cost grows with their number.  The argument is the
+// guarded_deallocation_batch_size.
+void BM_AllocDeallocShootdown(benchmark::State& state) {
+  constexpr size_t kAllocsPerIteration = 8;
+  constexpr size_t kOwnPages = 64;
+  auto gpa = GetGuardedPageAllocator();
+  std::vector<char> own(kOwnPages * GetGpaPageSize());
+  for (auto _ : state) {
+    char* ptrs[kAllocsPerIteration];
+    for (size_t i = 0; i < kAllocsPerIteration; ++i) {
+      // Slots whose deallocation is deferred are not available, so the pool
+      // may run out when there are many threads.
+      ptrs[i] = reinterpret_cast<char*>(
+          gpa->Allocate(1, 0, GetStackTrace(0)).alloc);
+      if (ptrs[i] != nullptr) ptrs[i][0] = 'X';
+    }
+    for (size_t offset = 0; offset < own.size(); offset += GetGpaPageSize()) {
+      own[offset]++;
+    }
+    benchmark::DoNotOptimize(own.data());
+    for (char* ptr : ptrs) {
+      if (ptr != nullptr) gpa->Deallocate(ptr);
+    }
+  }
+}
+
+BENCHMARK(BM_AllocDeallocShootdown)
+    ->Arg(0)
+    ->Arg(8)
+    ->Arg(64)
+    ->ThreadRange(1, kMaxGpaPages / 8)
+    ->Setup(SetDeallocationBatchSize)
+    ->Teardown(ResetDeallocationBatchSize);
+
 auto& GetReserved() {
   static auto* ret =
       new std::vector<std::unique_ptr<void, std::function<void(void*)>>>;
@@ -32,6 +32,7 @@
 #include "tcmalloc/internal/page_size.h"
 #include "tcmalloc/internal/sysinfo.h"
 #include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/testing/testutil.h"
 
@@ -179,6 +180,63 @@ TEST_P(GuardedPageAllocatorParamTest, AllocDeallocAllPages) {
 INSTANTIATE_TEST_SUITE_P(VaryNumPages, GuardedPageAllocatorParamTest,
                          testing::Values(1, kMaxGpaPages / 2, kMaxGpaPages));
 
+// A pool that is not a whole number of bitmap words never hands out the slots
+// past its end.
+TEST(GuardedPageAllocatorPartialPoolTest, AllocDeallocAllPages) {
+  constexpr size_t kNumPages = 100;
+  GuardedPageAllocator gpa;
+  {
+    PageHeapSpinLockHolder l;
+    gpa.Init(kNumPages, kNumPages);
+  }
+  gpa.AllowAllocations();
+
+  absl::flat_hash_set<void*> bufs;
+  for (size_t i = 0; i < kNumPages; i++) {
+    auto alloc_with_status = gpa.Allocate(1, 0, GetStackTrace());
+    ASSERT_EQ(alloc_with_status.status,
+              Profile::Sample::GuardedStatus::Guarded);
+    EXPECT_TRUE(gpa.PointerIsMine(alloc_with_status.alloc));
+    EXPECT_TRUE(bufs.insert(alloc_with_status.alloc).second);
+  }
+  EXPECT_EQ(gpa.GetNumAvailablePages(), 0);
+  EXPECT_EQ(gpa.Allocate(1, 0, GetStackTrace()).status,
+            Profile::Sample::GuardedStatus::NoAvailableSlots);
+  for (void* buf : bufs) {
+    gpa.Deallocate(buf);
+  }
+  EXPECT_EQ(gpa.GetNumAvailablePages(), kNumPages);
+  gpa.Destroy();
+}
+
+// Freed slots whose protection is deferred are not handed out again until the
+// batch is protected.
+TEST_F(GuardedPageAllocatorTest, BatchedDeallocation) {
+  constexpr size_t kBatchSize = 4;
+  Parameters::set_guarded_deallocation_batch_size(kBatchSize);
+
+  char* bufs[kBatchSize];
+  for (size_t i = 0; i < kBatchSize; i++) {
+    auto alloc_with_status = gpa_.Allocate(1, 0, GetStackTrace());
+    ASSERT_EQ(alloc_with_status.status,
+              Profile::Sample::GuardedStatus::Guarded);
+    bufs[i] = reinterpret_cast<char*>(alloc_with_status.alloc);
+  }
+  for (size_t i = 0; i < kBatchSize - 1; i++) {
+    gpa_.Deallocate(bufs[i]);
+    EXPECT_EQ(gpa_.GetNumAvailablePages(), kMaxGpaPages - kBatchSize);
+  }
+  gpa_.Deallocate(bufs[kBatchSize - 1]);
+  EXPECT_EQ(gpa_.GetNumAvailablePages(), kMaxGpaPages);
+
+  char buf[2048] = {};
+  Printer out(buf, sizeof(buf));
+  gpa_.Print(&out);
+  EXPECT_THAT(buf, testing::ContainsRegex("Deferred Deallocations: 0"));
+
+  Parameters::set_guarded_deallocation_batch_size(0);
+}
+
 TEST_F(GuardedPageAllocatorTest, PointerIsMine) {
   auto alloc_with_status = gpa_.Allocate(1, 0, GetStackTrace());
   EXPECT_EQ(alloc_with_status.status, Profile::Sample::GuardedStatus::Guarded);
@@ -26,8 +26,9 @@ GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
-// This class wraps an array of N TrackerLists and a Bitmap storing which
-// elements are non-empty.
+// This class wraps an array of N TrackerLists and a SummarizedBitmap storing
+// which elements are non-empty, so that finding the first non-empty list at or
+// after an index takes two bit scans however many lists there are.
 template <class TrackerType, size_t N>
 class HintedTrackerLists {
  public:
@@ -67,6 +68,13 @@ class HintedTrackerLists {
     return lists_[i].first();
   }
 
+  // Returns the index of the first non-empty list with index at least n, or N
+  // if there is none.
+  size_t FindNonEmpty(const size_t n) const {
+    TC_ASSERT_LT(n, N);
+    return nonempty_.FindSet(n);
+  }
+
   // Adds pointer <pt> to the nonempty_[i] list.
   // REQUIRES: i < N && pt != nullptr.
   void Add(TrackerType* pt, const size_t i) {
@@ -120,7 +128,7 @@ class HintedTrackerLists {
  private:
   TrackerList lists_[N];
   size_t size_;
-  Bitmap<N> nonempty_;
+  SummarizedBitmap<N> nonempty_;
 };
 
 }  // namespace tcmalloc_internal
@@ -0,0 +1,126 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Emits hot/cold hints for allocation call sites from heap profiles with
+// residency data and lifetime profiles of a binary.
+//
+// Usage:
+//   hot_cold_hint_tool --heap_profiles=heap1.pb.gz,heap2.pb.gz \
+//       [--lifetime_profiles=lifetime.pb.gz] [--format=cc]
+//
+// Prints one line per hot or cold call site, as "binary offset hint
+// stale_fraction resident_bytes avg_lifetime", or with --format=cc,
+// initializers of a C++ array of {binary, offset, hint} for a lookup table
+// keyed by the return address of operator new, relative to the binary.  The
+// heap profiles should be collected with stale memory scanning enabled; see
+// hot_cold_hints.h for how hints are chosen.
+
+#include <stdio.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+#include "tcmalloc/hot_cold_hints.h"
+#include "tcmalloc/internal/profile.pb.h"
+
+ABSL_FLAG(std::vector<std::string>, heap_profiles, {},
+          "Heap profiles with residency data");
+ABSL_FLAG(std::vector<std::string>, lifetime_profiles, {},
+          "Lifetime profiles");
+ABSL_FLAG(std::string, format, "text", "Output format: text or cc");
+ABSL_FLAG(int, callsite_frame, 0,
+          "Frame of the sampled stacks to use as the call site");
+ABSL_FLAG(double, min_resident_bytes, 1 << 20,
+          "Resident bytes below which call sites are left out");
+ABSL_FLAG(double, cold_stale_fraction, 0.9,
+          "Fraction of stale bytes from which a call site is cold");
+ABSL_FLAG(double, hot_stale_fraction, 0.1,
+          "Fraction of stale bytes up to which a call site is hot");
+ABSL_FLAG(absl::Duration, min_cold_lifetime, absl::Seconds(1),
+          "Average lifetime below which a call site is never cold");
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+absl::StatusOr<perftools::profiles::Profile> ReadProfile(
+    const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return absl::NotFoundError(absl::StrFormat("Failed to open %s", path));
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return ParseProfile(contents.str());
+}
+
+int Run() {
+  const std::vector<std::string> heap_profiles =
+      absl::GetFlag(FLAGS_heap_profiles);
+  const std::string format = absl::GetFlag(FLAGS_format);
+  if (heap_profiles.empty() || (format != "text" && format != "cc")) {
+    absl::FPrintF(stderr,
+                  "Usage: hot_cold_hint_tool --heap_profiles=a,b "
+                  "[--lifetime_profiles=c,d] [--format=text|cc]\n");
+    return 2;
+  }
+
+  HotColdHintBuilder::Options options;
+  options.callsite_frame = absl::GetFlag(FLAGS_callsite_frame);
+  options.min_resident_bytes = absl::GetFlag(FLAGS_min_resident_bytes);
+  options.cold_stale_fraction = absl::GetFlag(FLAGS_cold_stale_fraction);
+  options.hot_stale_fraction = absl::GetFlag(FLAGS_hot_stale_fraction);
+  options.min_cold_lifetime = absl::GetFlag(FLAGS_min_cold_lifetime);
+  HotColdHintBuilder builder(options);
+
+  for (const auto& [paths, heap] :
+       {std::pair{heap_profiles, true},
+        std::pair{absl::GetFlag(FLAGS_lifetime_profiles), false}}) {
+    for (const std::string& path : paths) {
+      absl::StatusOr<perftools::profiles::Profile> profile = ReadProfile(path);
+      absl::Status status = profile.status();
+      if (status.ok()) {
+        status = heap ? builder.AddHeapProfile(*profile)
+                      : builder.AddLifetimeProfile(*profile);
+      }
+      if (!status.ok()) {
+        absl::FPrintF(stderr, "%s: %s\n", path, status.ToString());
+        return 1;
+      }
+    }
+  }
+
+  absl::PrintF("%s", FormatHints(builder.Hints(), format == "cc"
+                                                      ? HintFormat::kCc
+                                                      : HintFormat::kText));
+  return 0;
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  return tcmalloc::tcmalloc_internal::Run();
+}
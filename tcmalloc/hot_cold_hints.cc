@@ -0,0 +1,244 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/hot_cold_hints.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/io/gzip_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "tcmalloc/internal/profile.pb.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Returns the index of the sample type named <type>, or std::nullopt.
+std::optional<int> SampleTypeIndex(const perftools::profiles::Profile& profile,
+                                   absl::string_view type) {
+  for (int i = 0; i < profile.sample_type_size(); ++i) {
+    const int64_t id = profile.sample_type(i).type();
+    if (id >= 0 && id < profile.string_table_size() &&
+        profile.string_table(id) == type) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+// Finds the call sites of the samples of a profile.
+class CallsiteFinder {
+ public:
+  CallsiteFinder(const perftools::profiles::Profile& profile, int frame)
+      : profile_(profile), frame_(frame) {
+    for (const auto& location : profile.location()) {
+      locations_[location.id()] = &location;
+    }
+    for (const auto& mapping : profile.mapping()) {
+      mappings_[mapping.id()] = &mapping;
+    }
+  }
+
+  // Returns the call site of <sample>, or std::nullopt if its stack is too
+  // short or the frame is not in a mapped file.
+  std::optional<Callsite> Find(
+      const perftools::profiles::Sample& sample) const {
+    if (frame_ < 0 || frame_ >= sample.location_id_size()) return std::nullopt;
+    auto location = locations_.find(sample.location_id(frame_));
+    if (location == locations_.end()) return std::nullopt;
+    auto mapping = mappings_.find(location->second->mapping_id());
+    if (mapping == mappings_.end()) return std::nullopt;
+    const perftools::profiles::Mapping& m = *mapping->second;
+
+    // Profile addresses are one byte into the call instruction; the return
+    // address follows it.
+    const uint64_t address = location->second->address() + 1;
+    if (address < m.memory_start() || address >= m.memory_limit()) {
+      return std::nullopt;
+    }
+    std::string binary = String(m.build_id());
+    if (binary.empty()) binary = String(m.filename());
+    if (binary.empty()) return std::nullopt;
+    return Callsite{std::move(binary),
+                    address - m.memory_start() + m.file_offset()};
+  }
+
+ private:
+  std::string String(int64_t id) const {
+    if (id < 0 || id >= profile_.string_table_size()) return "";
+    return profile_.string_table(id);
+  }
+
+  const perftools::profiles::Profile& profile_;
+  const int frame_;
+  absl::flat_hash_map<uint64_t, const perftools::profiles::Location*>
+      locations_;
+  absl::flat_hash_map<uint64_t, const perftools::profiles::Mapping*> mappings_;
+};
+
+}  // namespace
+
+absl::Status HotColdHintBuilder::AddHeapProfile(
+    const perftools::profiles::Profile& profile) {
+  const std::optional<int> resident =
+      SampleTypeIndex(profile, "resident_space");
+  const std::optional<int> stale = SampleTypeIndex(profile, "stale_space");
+  if (!resident.has_value() || !stale.has_value()) {
+    return absl::InvalidArgumentError(
+        "Not a heap profile with residency data");
+  }
+
+  const CallsiteFinder finder(profile, options_.callsite_frame);
+  for (const auto& sample : profile.sample()) {
+    if (sample.value_size() <= std::max(*resident, *stale)) continue;
+    std::optional<Callsite> callsite = finder.Find(sample);
+    if (!callsite.has_value()) continue;
+    Stats& stats = stats_[*std::move(callsite)];
+    stats.resident_bytes += sample.value(*resident);
+    stats.stale_bytes += sample.value(*stale);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status HotColdHintBuilder::AddLifetimeProfile(
+    const perftools::profiles::Profile& profile) {
+  const std::optional<int> allocated =
+      SampleTypeIndex(profile, "allocated_objects");
+  const std::optional<int> censored =
+      SampleTypeIndex(profile, "censored_allocated_objects");
+  if (!allocated.has_value() || !censored.has_value()) {
+    return absl::InvalidArgumentError("Not a lifetime profile");
+  }
+  int64_t avg_lifetime_id = -1;
+  for (int i = 0; i < profile.string_table_size(); ++i) {
+    if (profile.string_table(i) == "avg_lifetime") avg_lifetime_id = i;
+  }
+
+  const CallsiteFinder finder(profile, options_.callsite_frame);
+  for (const auto& sample : profile.sample()) {
+    if (sample.value_size() <= std::max(*allocated, *censored)) continue;
+    const int64_t objects = sample.value(*allocated);
+    const int64_t censored_objects = sample.value(*censored);
+    // Deallocation samples have neither.
+    if (objects <= 0 && censored_objects <= 0) continue;
+    std::optional<Callsite> callsite = finder.Find(sample);
+    if (!callsite.has_value()) continue;
+
+    int64_t avg_lifetime_ns = 0;
+    for (const auto& label : sample.label()) {
+      if (label.key() == avg_lifetime_id) avg_lifetime_ns = label.num();
+    }
+    Stats& stats = stats_[*std::move(callsite)];
+    if (objects > 0) {
+      stats.lifetime_objects += objects;
+      stats.lifetime_ns += static_cast<double>(objects) * avg_lifetime_ns;
+    }
+    if (censored_objects > 0) {
+      stats.lifetime_objects += censored_objects;
+      stats.lifetime_ns +=
+          static_cast<double>(censored_objects) * profile.duration_nanos();
+    }
+  }
+  return absl::OkStatus();
+}
+
+std::vector<CallsiteHint> HotColdHintBuilder::Hints() const {
+  std::vector<CallsiteHint> hints;
+  for (const auto& [callsite, stats] : stats_) {
+    if (stats.resident_bytes <= 0 ||
+        stats.resident_bytes < options_.min_resident_bytes) {
+      continue;
+    }
+    const double stale_fraction =
+        std::min(1.0, stats.stale_bytes / stats.resident_bytes);
+    const absl::Duration avg_lifetime =
+        stats.lifetime_objects > 0
+            ? absl::Nanoseconds(stats.lifetime_ns / stats.lifetime_objects)
+            : absl::InfiniteDuration();
+
+    uint8_t hint;
+    if (stale_fraction >= options_.cold_stale_fraction &&
+        avg_lifetime >= options_.min_cold_lifetime) {
+      hint = 0;
+    } else if (stale_fraction <= options_.hot_stale_fraction) {
+      hint = 255;
+    } else {
+      continue;
+    }
+    hints.push_back({callsite, hint, stale_fraction, stats.resident_bytes,
+                     avg_lifetime});
+  }
+  std::stable_sort(hints.begin(), hints.end(),
+                   [](const CallsiteHint& a, const CallsiteHint& b) {
+                     return a.stale_fraction > b.stale_fraction;
+                   });
+  return hints;
+}
+
+absl::StatusOr<perftools::profiles::Profile> ParseProfile(
+    absl::string_view contents) {
+  perftools::profiles::Profile profile;
+  bool parsed;
+  if (contents.size() >= 2 && contents[0] == '\x1f' && contents[1] == '\x8b') {
+    google::protobuf::io::ArrayInputStream input(contents.data(),
+                                                 contents.size());
+    google::protobuf::io::GzipInputStream gzip(
+        &input, google::protobuf::io::GzipInputStream::GZIP);
+    // Corrupt input ends the stream early rather than failing the parse.
+    parsed = profile.ParseFromZeroCopyStream(&gzip) &&
+             gzip.ZlibErrorCode() >= 0;
+  } else {
+    parsed = profile.ParseFromArray(contents.data(), contents.size());
+  }
+  if (!parsed) {
+    return absl::InvalidArgumentError("Failed to parse profile");
+  }
+  return profile;
+}
+
+std::string FormatHints(absl::Span<const CallsiteHint> hints,
+                        HintFormat format) {
+  std::string out;
+  for (const CallsiteHint& h : hints) {
+    switch (format) {
+      case HintFormat::kText:
+        absl::StrAppendFormat(&out, "%s %#x %d %.3f %.0f %s\n",
+                              h.callsite.binary, h.callsite.offset, h.hint,
+                              h.stale_fraction, h.resident_bytes,
+                              absl::FormatDuration(h.avg_lifetime));
+        break;
+      case HintFormat::kCc:
+        absl::StrAppendFormat(&out, "{\"%s\", %#x, %d},\n", h.callsite.binary,
+                              h.callsite.offset, h.hint);
+        break;
+    }
+  }
+  return out;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
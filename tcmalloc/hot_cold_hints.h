@@ -0,0 +1,133 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Derives hot/cold hints for allocation call sites from profiles, for
+// __size_returning_new_hot_cold and the operator new overloads taking a
+// hot_cold_t.  See hot_cold_hint_tool.cc for the command line tool.
+//
+// Access data comes from heap profiles, whose samples carry the bytes of the
+// sampled objects that were resident and the bytes that were stale, i.e. not
+// accessed for a stale scan period (see MallocExtension::SnapshotCurrent).
+// Lifetimes come from lifetime profiles.  A call site is identified by the
+// return address into the code that called the allocator, as an offset into
+// the mapped file that contains it, so that hints apply across runs.
+
+#ifndef TCMALLOC_HOT_COLD_HINTS_H_
+#define TCMALLOC_HOT_COLD_HINTS_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "absl/container/btree_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "tcmalloc/internal/profile.pb.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+struct Callsite {
+  // The build ID of the mapped file, or its name if it has none.
+  std::string binary;
+  // The return address, as an offset into the file.
+  uint64_t offset;
+
+  bool operator<(const Callsite& other) const {
+    return std::tie(binary, offset) < std::tie(other.binary, other.offset);
+  }
+};
+
+struct CallsiteHint {
+  Callsite callsite;
+  // 0 for cold, which allocates from cold memory, and 255 for hot.
+  uint8_t hint;
+  // The fraction of the resident bytes of the call site that were stale.
+  double stale_fraction;
+  double resident_bytes;
+  // The average lifetime of its objects, or absl::InfiniteDuration() if no
+  // lifetime profile had the call site.
+  absl::Duration avg_lifetime;
+};
+
+class HotColdHintBuilder {
+ public:
+  struct Options {
+    // The frame of the sampled stacks that is the call site.  Frame 0 is
+    // the return address into the caller of the allocator.
+    int callsite_frame = 0;
+    // Call sites with less resident memory than this are left out.
+    double min_resident_bytes = 1 << 20;
+    // Call sites with at least this fraction of their resident bytes stale
+    // are cold, and those with at most hot_stale_fraction are hot.
+    double cold_stale_fraction = 0.9;
+    double hot_stale_fraction = 0.1;
+    // Objects living shorter than this on average are used soon after their
+    // allocation, so their call sites are never cold.
+    absl::Duration min_cold_lifetime = absl::Seconds(1);
+  };
+
+  HotColdHintBuilder() : HotColdHintBuilder(Options()) {}
+  explicit HotColdHintBuilder(Options options) : options_(options) {}
+
+  // Adds the resident and stale bytes of a heap profile.  Returns
+  // InvalidArgument if the profile has no residency data.
+  absl::Status AddHeapProfile(const perftools::profiles::Profile& profile);
+
+  // Adds the lifetimes of the allocations of a lifetime profile.  Objects
+  // still live when it was collected count as living for its duration.
+  // Returns InvalidArgument if the profile is not a lifetime profile.
+  absl::Status AddLifetimeProfile(const perftools::profiles::Profile& profile);
+
+  // Returns the call sites with enough resident memory that are hot or cold,
+  // the coldest first.
+  std::vector<CallsiteHint> Hints() const;
+
+ private:
+  struct Stats {
+    double resident_bytes = 0;
+    double stale_bytes = 0;
+    double lifetime_objects = 0;
+    double lifetime_ns = 0;
+  };
+
+  const Options options_;
+  absl::btree_map<Callsite, Stats> stats_;
+};
+
+// Parses a profile as written by Marshal, gzip-compressed or not.
+absl::StatusOr<perftools::profiles::Profile> ParseProfile(
+    absl::string_view contents);
+
+enum class HintFormat {
+  // One "binary offset hint stale_fraction resident_bytes avg_lifetime" line
+  // per call site.
+  kText,
+  // Initializers of a C++ array of {binary, offset, hint}, for a lookup table
+  // in an interposed operator new.
+  kCc,
+};
+
+std::string FormatHints(absl::Span<const CallsiteHint> hints,
+                        HintFormat format);
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_HOT_COLD_HINTS_H_
@@ -0,0 +1,172 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/hot_cold_hints.h"
+
+#include <stdint.h>
+
+#include <initializer_list>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "tcmalloc/internal/profile.pb.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+constexpr uint64_t kStart = 0x400000;
+constexpr uint64_t kFileOffset = 0x1000;
+
+// Builds profiles of one binary mapped at kStart, as ProfileBuilder does.
+class TestProfile {
+ public:
+  explicit TestProfile(std::initializer_list<absl::string_view> sample_types) {
+    profile_.add_string_table("");
+    for (absl::string_view type : sample_types) {
+      auto& t = *profile_.add_sample_type();
+      t.set_type(String(type));
+      t.set_unit(String("bytes"));
+    }
+    auto& mapping = *profile_.add_mapping();
+    mapping.set_id(1);
+    mapping.set_memory_start(kStart);
+    mapping.set_memory_limit(kStart + 0x100000);
+    mapping.set_file_offset(kFileOffset);
+    mapping.set_filename(String("/bin/server"));
+    mapping.set_build_id(String("abcdef"));
+  }
+
+  int64_t String(absl::string_view s) {
+    for (int i = 0; i < profile_.string_table_size(); ++i) {
+      if (profile_.string_table(i) == s) return i;
+    }
+    profile_.add_string_table(std::string(s));
+    return profile_.string_table_size() - 1;
+  }
+
+  // Adds a sample allocated from the call returning to <return_address>.
+  perftools::profiles::Sample& AddSample(uint64_t return_address,
+                                         std::vector<int64_t> values) {
+    auto& location = *profile_.add_location();
+    location.set_id(profile_.location_size());
+    location.set_address(return_address - 1);
+    location.set_mapping_id(1);
+    auto& sample = *profile_.add_sample();
+    sample.add_location_id(location.id());
+    for (int64_t v : values) sample.add_value(v);
+    return sample;
+  }
+
+  void AddLifetimeSample(uint64_t return_address, int64_t objects,
+                         int64_t censored, absl::Duration avg_lifetime) {
+    auto& sample = AddSample(return_address, {objects, 0, 0, 0, censored, 0});
+    auto& label = *sample.add_label();
+    label.set_key(String("avg_lifetime"));
+    label.set_num(absl::ToInt64Nanoseconds(avg_lifetime));
+    label.set_num_unit(String("nanoseconds"));
+  }
+
+  perftools::profiles::Profile& profile() { return profile_; }
+
+ private:
+  perftools::profiles::Profile profile_;
+};
+
+TestProfile HeapProfile() {
+  return TestProfile({"objects", "space", "resident_space", "swapped_space",
+                      "stale_space", "locked_space"});
+}
+
+TestProfile LifetimeProfile() {
+  TestProfile p({"allocated_objects", "allocated_space", "deallocated_objects",
+                 "deallocated_space", "censored_allocated_objects",
+                 "censored_allocated_space"});
+  p.profile().set_duration_nanos(absl::ToInt64Nanoseconds(absl::Minutes(1)));
+  return p;
+}
+
+constexpr uint64_t kColdSite = kStart + 0x10;
+constexpr uint64_t kHotSite = kStart + 0x20;
+constexpr uint64_t kLukewarmSite = kStart + 0x30;
+constexpr uint64_t kSmallSite = kStart + 0x40;
+constexpr uint64_t kShortLivedSite = kStart + 0x50;
+
+TEST(HotColdHintsTest, Hints) {
+  constexpr int64_t kMiB = 1 << 20;
+  TestProfile heap = HeapProfile();
+  heap.AddSample(kColdSite, {1, 0, 4 * kMiB, 0, 4 * kMiB, 0});
+  heap.AddSample(kHotSite, {1, 0, 8 * kMiB, 0, 0, 0});
+  heap.AddSample(kLukewarmSite, {1, 0, 2 * kMiB, 0, kMiB, 0});
+  heap.AddSample(kSmallSite, {1, 0, 1024, 0, 1024, 0});
+  heap.AddSample(kShortLivedSite, {1, 0, 2 * kMiB, 0, 2 * kMiB, 0});
+
+  TestProfile lifetime = LifetimeProfile();
+  lifetime.AddLifetimeSample(kColdSite, 10, 0, absl::Seconds(30));
+  lifetime.AddLifetimeSample(kColdSite, 0, 10, absl::ZeroDuration());
+  lifetime.AddLifetimeSample(kShortLivedSite, 100, 0, absl::Milliseconds(5));
+
+  HotColdHintBuilder builder;
+  ASSERT_TRUE(builder.AddHeapProfile(heap.profile()).ok());
+  ASSERT_TRUE(builder.AddLifetimeProfile(lifetime.profile()).ok());
+  const std::vector<CallsiteHint> hints = builder.Hints();
+
+  ASSERT_EQ(hints.size(), 2);
+  EXPECT_EQ(hints[0].callsite.binary, "abcdef");
+  EXPECT_EQ(hints[0].callsite.offset, kColdSite - kStart + kFileOffset);
+  EXPECT_EQ(hints[0].hint, 0);
+  EXPECT_EQ(hints[0].stale_fraction, 1.0);
+  // Half of the objects were censored, and live for the minute of the
+  // profile.
+  EXPECT_EQ(hints[0].avg_lifetime, absl::Seconds(45));
+
+  EXPECT_EQ(hints[1].callsite.offset, kHotSite - kStart + kFileOffset);
+  EXPECT_EQ(hints[1].hint, 255);
+  EXPECT_EQ(hints[1].avg_lifetime, absl::InfiniteDuration());
+
+  EXPECT_EQ(FormatHints(hints, HintFormat::kCc),
+            "{\"abcdef\", 0x1010, 0},\n{\"abcdef\", 0x1020, 255},\n");
+}
+
+TEST(HotColdHintsTest, WrongProfiles) {
+  HotColdHintBuilder builder;
+  EXPECT_EQ(builder.AddHeapProfile(LifetimeProfile().profile()).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(builder.AddLifetimeProfile(HeapProfile().profile()).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(HotColdHintsTest, ParseProfile) {
+  TestProfile heap = HeapProfile();
+  heap.AddSample(kColdSite, {1, 0, 4096, 0, 4096, 0});
+  const std::string serialized = heap.profile().SerializeAsString();
+
+  absl::StatusOr<perftools::profiles::Profile> parsed =
+      ParseProfile(serialized);
+  ASSERT_TRUE(parsed.ok()) << parsed.status();
+  EXPECT_EQ(parsed->sample_size(), 1);
+
+  EXPECT_FALSE(ParseProfile("\x1f\x8bnot a profile").ok());
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -0,0 +1,430 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/huge_address_btree.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "absl/base/internal/cycleclock.h"
+#include "tcmalloc/huge_pages.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Returns the length-weighted average of the times at which x and y were
+// added.
+int64_t MergeWhen(HugeRange x, int64_t x_when, HugeRange y, int64_t y_when) {
+  // avoid overflow with floating-point
+  const size_t x_len = x.len().raw_num();
+  const size_t y_len = y.len().raw_num();
+  const double x_weight = static_cast<double>(x_len) * x_when;
+  const double y_weight = static_cast<double>(y_len) * y_when;
+  return static_cast<int64_t>((x_weight + y_weight) / (x_len + y_len));
+}
+
+}  // namespace
+
+HugeAddressBTree::Node* HugeAddressBTree::BestFit(HugeLength n) {
+  const size_t len = n.raw_num();
+  Block* b = root_;
+  if (b == nullptr || Longest(b) < len) return nullptr;
+
+  // Invariant: some slot of b has longest >= len.  We favor the slot whose
+  // longest range is the smallest that fits, and lower addresses among equal
+  // ones.
+  while (true) {
+    size_t best = kFanout;
+    for (size_t i = 0; i < b->size; ++i) {
+      if (b->longest[i] >= len &&
+          (best == kFanout || b->longest[i] < b->longest[best])) {
+        best = i;
+      }
+    }
+    TC_ASSERT_LT(best, kFanout);
+    if (b->leaf) return &b->entries[best];
+    b = b->children[best];
+  }
+}
+
+HugeAddressBTree::Node* HugeAddressBTree::MostRecentFit(HugeLength n) {
+  Node* best = nullptr;
+  if (root_ != nullptr) {
+    MostRecentFit(root_, n.raw_num(), &best);
+  }
+  return best;
+}
+
+void HugeAddressBTree::MostRecentFit(Block* b, size_t len, Node** best) {
+  for (size_t i = 0; i < b->size; ++i) {
+    if (b->longest[i] < len) continue;
+    if (!b->leaf) {
+      MostRecentFit(b->children[i], len, best);
+    } else if (*best == nullptr || b->entries[i].when_ > (*best)->when_) {
+      *best = &b->entries[i];
+    }
+  }
+}
+
+size_t HugeAddressBTree::ChildIndex(const Block* parent, const Block* child) {
+  for (size_t i = 0; i < parent->size; ++i) {
+    if (parent->children[i] == child) return i;
+  }
+  TC_BUG("block %p is not a child of %p", child, parent);
+}
+
+HugeAddressBTree::Slot HugeAddressBTree::GetSlot(const Block* b,
+                                                 size_t i) const {
+  Slot s = {};
+  s.key = b->keys[i];
+  s.longest = b->longest[i];
+  if (b->leaf) {
+    s.child = nullptr;
+    s.entry = b->entries[i];
+  } else {
+    s.child = b->children[i];
+  }
+  return s;
+}
+
+void HugeAddressBTree::SetSlot(Block* b, size_t i, const Slot& s) {
+  b->keys[i] = s.key;
+  b->longest[i] = s.longest;
+  if (b->leaf) {
+    b->entries[i] = s.entry;
+  } else {
+    b->children[i] = s.child;
+    s.child->parent = b;
+  }
+}
+
+void HugeAddressBTree::ClearSlot(Block* b, size_t i) {
+  b->keys[i] = kNoKey;
+  b->longest[i] = 0;
+  b->children[i] = nullptr;
+}
+
+void HugeAddressBTree::InsertSlot(Block* b, size_t i, const Slot& s) {
+  if (b->size == kFanout) {
+    Block* sibling = Split(b);
+    if (i > b->size) {
+      i -= b->size;
+      b = sibling;
+    }
+  }
+  for (size_t j = b->size; j > i; --j) {
+    SetSlot(b, j, GetSlot(b, j - 1));
+  }
+  SetSlot(b, i, s);
+  ++b->size;
+  FixUp(b);
+}
+
+void HugeAddressBTree::EraseSlot(Block* b, size_t i) {
+  TC_ASSERT_LT(i, b->size);
+  for (size_t j = i; j + 1 < b->size; ++j) {
+    SetSlot(b, j, GetSlot(b, j + 1));
+  }
+  --b->size;
+  ClearSlot(b, b->size);
+  Rebalance(b);
+}
+
+HugeAddressBTree::Block* HugeAddressBTree::Split(Block* b) {
+  TC_ASSERT_EQ(b->size, kFanout);
+  Block* sibling = NewBlock(b->leaf);
+  constexpr size_t kHalf = kFanout / 2;
+  for (size_t j = kHalf; j < kFanout; ++j) {
+    SetSlot(sibling, j - kHalf, GetSlot(b, j));
+    ClearSlot(b, j);
+  }
+  sibling->size = kFanout - kHalf;
+  b->size = kHalf;
+
+  if (b->parent == nullptr) {
+    Block* root = NewBlock(/*leaf=*/false);
+    SetSlot(root, 0, Slot{b->keys[0], Longest(b), b, {}});
+    root->size = 1;
+    root_ = root;
+  }
+  Block* parent = b->parent;
+  const size_t j = ChildIndex(parent, b);
+  parent->longest[j] = Longest(b);
+  InsertSlot(parent, j + 1,
+             Slot{sibling->keys[0], Longest(sibling), sibling, {}});
+  return sibling;
+}
+
+void HugeAddressBTree::Rebalance(Block* b) {
+  if (b == root_) {
+    if (b->size == 0) {
+      root_ = nullptr;
+      DeleteBlock(b);
+    } else if (!b->leaf && b->size == 1) {
+      root_ = b->children[0];
+      root_->parent = nullptr;
+      DeleteBlock(b);
+    }
+    return;
+  }
+
+  Block* parent = b->parent;
+  const size_t j = ChildIndex(parent, b);
+  if (b->size == 0) {
+    DeleteBlock(b);
+    EraseSlot(parent, j);
+    return;
+  }
+
+  // Fold sparse blocks into a neighbor, so that the tree stays shallow as
+  // ranges are removed.
+  if (b->size < kFanout / 4) {
+    const size_t left_index = j > 0 ? j - 1 : j;
+    const size_t right_index = left_index + 1;
+    if (right_index < parent->size) {
+      Block* left = parent->children[left_index];
+      Block* right = parent->children[right_index];
+      if (left->size + right->size <= kFanout) {
+        for (size_t k = 0; k < right->size; ++k) {
+          SetSlot(left, left->size + k, GetSlot(right, k));
+        }
+        left->size += right->size;
+        DeleteBlock(right);
+        parent->keys[left_index] = left->keys[0];
+        parent->longest[left_index] = Longest(left);
+        EraseSlot(parent, right_index);
+        return;
+      }
+    }
+  }
+  FixUp(b);
+}
+
+void HugeAddressBTree::FixUp(Block* b) {
+  while (Block* parent = b->parent) {
+    const size_t j = ChildIndex(parent, b);
+    parent->keys[j] = b->keys[0];
+    parent->longest[j] = Longest(b);
+    b = parent;
+  }
+}
+
+void HugeAddressBTree::Update(Block* b, size_t i, HugeRange r, int64_t when) {
+  TC_ASSERT(b->leaf);
+  b->keys[i] = r.start().index();
+  b->longest[i] = r.len().raw_num();
+  b->entries[i].range_ = r;
+  b->entries[i].when_ = when;
+  FixUp(b);
+}
+
+HugeAddressBTree::Block* HugeAddressBTree::FindLeaf(size_t key) const {
+  Block* b = root_;
+  while (!b->leaf) {
+    const size_t rank = Rank(b, key);
+    b = b->children[rank > 0 ? rank - 1 : 0];
+  }
+  return b;
+}
+
+HugeAddressBTree::Block* HugeAddressBTree::NextLeaf(const Block* b) const {
+  // Climb until there is a block to our right, then take its leftmost leaf.
+  size_t depth = 0;
+  while (true) {
+    Block* parent = b->parent;
+    if (parent == nullptr) return nullptr;
+    const size_t j = ChildIndex(parent, b);
+    if (j + 1 < parent->size) {
+      b = parent->children[j + 1];
+      break;
+    }
+    b = parent;
+    ++depth;
+  }
+  while (depth-- > 0) {
+    b = b->children[0];
+  }
+  return const_cast<Block*>(b);
+}
+
+void HugeAddressBTree::Insert(HugeRange r) {
+  total_size_ += r.len();
+  const int64_t now = absl::base_internal::CycleClock::Now();
+  const size_t key = r.start().index();
+  if (root_ == nullptr) {
+    root_ = NewBlock(/*leaf=*/true);
+  }
+
+  // First, try to merge if necessary. Note there are three possibilities:
+  // we might need to merge before with r, r with after, or all three together.
+  Block* leaf = FindLeaf(key);
+  const size_t i = Rank(leaf, key);
+  Node* before = i > 0 ? &leaf->entries[i - 1] : nullptr;
+  Block* after_leaf = leaf;
+  size_t after_i = i;
+  if (after_i == leaf->size) {
+    after_leaf = NextLeaf(leaf);
+    after_i = 0;
+  }
+  Node* after = after_leaf != nullptr ? &after_leaf->entries[after_i] : nullptr;
+  TC_CHECK(!before || !before->range_.intersects(r));
+  TC_CHECK(!after || !after->range_.intersects(r));
+
+  const bool merge_before = before && before->range_.precedes(r);
+  const bool merge_after = after && r.precedes(after->range_);
+  if (merge_before && merge_after) {
+    // Three way merge: we drop after and grow before over both.
+    const HugeRange full = Join(before->range_, Join(r, after->range_));
+    const int64_t when =
+        MergeWhen(before->range_, before->when_, Join(r, after->range_),
+                  MergeWhen(r, now, after->range_, after->when_));
+    const size_t before_key = before->range_.start().index();
+    --nranges_;
+    EraseSlot(after_leaf, after_i);
+    // Erasing may have moved before to another leaf.
+    leaf = FindLeaf(before_key);
+    Update(leaf, Rank(leaf, before_key) - 1, full, when);
+  } else if (merge_before) {
+    Update(leaf, i - 1, Join(before->range_, r),
+           MergeWhen(before->range_, before->when_, r, now));
+  } else if (merge_after) {
+    Update(after_leaf, after_i, Join(r, after->range_),
+           MergeWhen(r, now, after->range_, after->when_));
+  } else {
+    // No merging possible; just add a new range.
+    Node entry;
+    entry.range_ = r;
+    entry.when_ = now;
+    ++nranges_;
+    InsertSlot(leaf, i, Slot{key, r.len().raw_num(), nullptr, entry});
+  }
+}
+
+void HugeAddressBTree::Remove(Node* n) {
+  const size_t key = n->range_.start().index();
+  Block* leaf = FindLeaf(key);
+  const size_t i = Rank(leaf, key) - 1;
+  TC_ASSERT_EQ(&leaf->entries[i], n);
+  total_size_ -= n->range_.len();
+  --nranges_;
+  EraseSlot(leaf, i);
+}
+
+void HugeAddressBTree::Check(const Block* b, size_t depth, size_t* leaf_depth,
+                             size_t* num_ranges, HugePage* end,
+                             HugeLength* size) const {
+  TC_CHECK_GT(b->size, 0);
+  TC_CHECK_LE(b->size, kFanout);
+  for (size_t i = b->size; i < kFanout; ++i) {
+    TC_CHECK_EQ(b->keys[i], kNoKey);
+    TC_CHECK_EQ(b->longest[i], 0);
+  }
+  for (size_t i = 0; i < b->size; ++i) {
+    if (i > 0) {
+      // tree
+      TC_CHECK_LT(b->keys[i - 1], b->keys[i]);
+    }
+    if (b->leaf) {
+      const HugeRange r = b->entries[i].range_;
+      TC_CHECK_EQ(b->keys[i], r.start().index());
+      TC_CHECK_EQ(b->longest[i], r.len().raw_num());
+      TC_CHECK_GT(r.len(), NHugePages(0));
+      // disjoint, and merged with any adjacent range
+      if (*num_ranges > 0) {
+        TC_CHECK_LT(end->index(), r.start().index());
+      }
+      *end = r.start() + r.len();
+      *num_ranges += 1;
+      *size += r.len();
+      continue;
+    }
+    const Block* child = b->children[i];
+    // well-formed
+    TC_CHECK_EQ(child->parent, b);
+    TC_CHECK_EQ(b->keys[i], child->keys[0]);
+    TC_CHECK_EQ(b->longest[i], Longest(child));
+    Check(child, depth + 1, leaf_depth, num_ranges, end, size);
+  }
+  if (b->leaf) {
+    // balanced
+    if (*leaf_depth == 0) *leaf_depth = depth;
+    TC_CHECK_EQ(*leaf_depth, depth);
+  }
+}
+
+void HugeAddressBTree::Check() {
+  size_t leaf_depth = 0;
+  size_t ranges = 0;
+  HugePage end = {0};
+  HugeLength size = NHugePages(0);
+  if (root_) {
+    TC_CHECK_EQ(root_->parent, nullptr);
+    Check(root_, 1, &leaf_depth, &ranges, &end, &size);
+  }
+  TC_CHECK_EQ(ranges, nranges());
+  TC_CHECK_EQ(size, total_mapped());
+  size_t free_blocks = 0;
+  for (const Block* b = freelist_; b != nullptr; b = b->parent) {
+    ++free_blocks;
+  }
+  TC_CHECK_EQ(total_blocks_, used_blocks_ + free_blocks);
+}
+
+void HugeAddressBTree::Print(Printer* out) const {
+  out->printf("HugeAddressMap: B-tree %zu / %zu blocks used / created\n",
+              used_blocks_, total_blocks_);
+  const size_t longest = root_ ? Longest(root_) : 0;
+  out->printf("HugeAddressMap: %zu contiguous hugepages available\n", longest);
+}
+
+void HugeAddressBTree::PrintInPbtxt(PbtxtRegion* hpaa) const {
+  hpaa->PrintI64("num_huge_address_map_btree_blocks_used", used_blocks_);
+  hpaa->PrintI64("num_huge_address_map_btree_blocks_created", total_blocks_);
+  const size_t longest = root_ ? NHugePages(Longest(root_)).in_bytes() : 0;
+  hpaa->PrintI64("contiguous_free_bytes", longest);
+}
+
+HugeAddressBTree::Block* HugeAddressBTree::NewBlock(bool leaf) {
+  used_blocks_++;
+  Block* b = freelist_;
+  if (b != nullptr) {
+    freelist_ = b->parent;
+  } else {
+    total_blocks_++;
+    b = reinterpret_cast<Block*>(meta_(sizeof(Block)));
+  }
+  new (b) Block;
+  b->leaf = leaf;
+  b->size = 0;
+  b->parent = nullptr;
+  for (size_t i = 0; i < kFanout; ++i) {
+    ClearSlot(b, i);
+  }
+  return b;
+}
+
+void HugeAddressBTree::DeleteBlock(Block* b) {
+  used_blocks_--;
+  b->parent = freelist_;
+  freelist_ = b;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,217 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_HUGE_ADDRESS_BTREE_H_
+#define TCMALLOC_HUGE_ADDRESS_BTREE_H_
+#include <stddef.h>
+#include <stdint.h>
+
+#include <limits>
+
+#include "absl/base/attributes.h"
+#include "tcmalloc/huge_address_map.h"
+#include "tcmalloc/huge_pages.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/metadata_allocator.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Maintains a set of disjoint HugeRanges, merging adjacent ranges into one,
+// like HugeAddressMap.  Ranges are kept in a B-tree of wide blocks ordered by
+// address, augmented with the longest range under each child.  Keys and
+// lengths are stored in their own fixed-size arrays, so that searching a block
+// touches a couple of cache lines and compiles to vectorized comparisons,
+// instead of chasing one pointer per range.
+//
+// Node pointers returned by BestFit are invalidated by Insert and Remove.
+class HugeAddressBTree {
+ public:
+  static constexpr size_t kFanout = 16;
+
+  explicit constexpr HugeAddressBTree(
+      MetadataAllocator& meta ABSL_ATTRIBUTE_LIFETIME_BOUND);
+
+  // IMPORTANT: DESTROYING A HUGE ADDRESS MAP DOES NOT MAKE ANY ATTEMPT
+  // AT FREEING ALLOCATED METADATA.
+  ~HugeAddressBTree() = default;
+
+  class Node {
+   public:
+    // the range stored at this point
+    HugeRange range() const { return range_; }
+    // when were this node's content added (in
+    // absl::base_internal::CycleClock::Now units)?
+    int64_t when() const { return when_; }
+
+   private:
+    friend class HugeAddressBTree;
+    HugeRange range_;
+    int64_t when_;
+  };
+
+  // Returns a range of at least <n> hugepages, or nullptr if there is none.
+  // Like HugeAddressMap::BestFit, this descends into the child whose longest
+  // range fits <n> most tightly, which is close to, but not exactly, best-fit.
+  Node* BestFit(HugeLength n);
+
+  // Returns the most recently added range of at least <n> hugepages, or
+  // nullptr if there is none.  Visits every range that fits.
+  Node* MostRecentFit(HugeLength n);
+
+  // Calls f(HugeRange) for each range, in address order.
+  template <typename F>
+  void ForEachRange(F f) const;
+
+  // Expensive consistency check.
+  void Check();
+
+  // Statistics
+  size_t nranges() const { return nranges_; }
+  HugeLength total_mapped() const { return total_size_; }
+  void Print(Printer* out) const;
+  void PrintInPbtxt(PbtxtRegion* hpaa) const;
+
+  // Add <r> to the map, merging with adjacent ranges as needed.
+  void Insert(HugeRange r);
+
+  // Delete n from the map.
+  void Remove(Node* n);
+
+ private:
+  static constexpr size_t kNoKey = std::numeric_limits<size_t>::max();
+
+  struct Block {
+    bool leaf;
+    uint16_t size;
+    Block* parent;
+    // Index of the first hugepage under each child, or of each range in a
+    // leaf.  Unused slots hold kNoKey.
+    size_t keys[kFanout];
+    // Length of the longest range under each child, or of each range in a
+    // leaf.  Unused slots hold 0.
+    size_t longest[kFanout];
+    Block* children[kFanout];
+    Node entries[kFanout];
+  };
+
+  // The contents of one slot of a block.
+  struct Slot {
+    size_t key;
+    size_t longest;
+    Block* child;
+    Node entry;
+  };
+
+  // Returns the number of keys in <b> that are no greater than <key>.
+  static size_t Rank(const Block* b, size_t key) {
+    size_t rank = 0;
+    for (size_t i = 0; i < kFanout; ++i) {
+      rank += b->keys[i] <= key;
+    }
+    return rank;
+  }
+
+  // Returns the longest range under <b>.
+  static size_t Longest(const Block* b) {
+    size_t longest = 0;
+    for (size_t i = 0; i < kFanout; ++i) {
+      longest = b->longest[i] > longest ? b->longest[i] : longest;
+    }
+    return longest;
+  }
+
+  static size_t ChildIndex(const Block* parent, const Block* child);
+
+  static void MostRecentFit(Block* b, size_t len, Node** best);
+
+  template <typename F>
+  static void ForEachRange(const Block* b, F& f);
+
+  Slot GetSlot(const Block* b, size_t i) const;
+  void SetSlot(Block* b, size_t i, const Slot& s);
+  void ClearSlot(Block* b, size_t i);
+
+  // Inserts <s> at index <i> of <b>, splitting <b> if it is full.
+  void InsertSlot(Block* b, size_t i, const Slot& s);
+  // Removes index <i> of <b>, merging or freeing <b> if it becomes sparse.
+  void EraseSlot(Block* b, size_t i);
+  // Moves the upper half of the full block <b> to a new sibling, which is
+  // returned.
+  Block* Split(Block* b);
+  void Rebalance(Block* b);
+  // Refreshes the keys and longest ranges of the ancestors of <b>.
+  void FixUp(Block* b);
+  // Replaces the range at index <i> of leaf <b>.
+  void Update(Block* b, size_t i, HugeRange r, int64_t when);
+
+  // Returns the leaf whose keys cover <key>.
+  Block* FindLeaf(size_t key) const;
+  // Returns the leaf that follows <b> in address order, if any.
+  Block* NextLeaf(const Block* b) const;
+
+  void Check(const Block* b, size_t depth, size_t* leaf_depth,
+             size_t* num_ranges, HugePage* end, HugeLength* size) const;
+
+  Block* NewBlock(bool leaf);
+  void DeleteBlock(Block* b);
+
+  Block* root_{nullptr};
+  size_t nranges_{0};
+  HugeLength total_size_{NHugePages(0)};
+
+  // cache of unused blocks, linked through their parent pointers
+  Block* freelist_{nullptr};
+  size_t used_blocks_{0};
+  size_t total_blocks_{0};
+  // How we get more
+  MetadataAllocator& meta_;
+};
+
+inline constexpr HugeAddressBTree::HugeAddressBTree(MetadataAllocator& meta)
+    : meta_(meta) {}
+
+template <typename F>
+inline void HugeAddressBTree::ForEachRange(F f) const {
+  if (root_ != nullptr) {
+    ForEachRange(root_, f);
+  }
+}
+
+template <typename F>
+inline void HugeAddressBTree::ForEachRange(const Block* b, F& f) {
+  for (size_t i = 0; i < b->size; ++i) {
+    if (b->leaf) {
+      f(b->entries[i].range_);
+    } else {
+      ForEachRange(b->children[i], f);
+    }
+  }
+}
+
+// The free range map used by HugeAllocator and HugeCache.  Building with
+// TCMALLOC_INTERNAL_HUGE_ADDRESS_BTREE selects the B-tree over the treap.
+#ifdef TCMALLOC_INTERNAL_HUGE_ADDRESS_BTREE
+using HugeRangeMap = HugeAddressBTree;
+#else
+using HugeRangeMap = HugeAddressMap;
+#endif
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_HUGE_ADDRESS_BTREE_H_
@@ -0,0 +1,179 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/huge_address_btree.h"
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/random.h"
+#include "tcmalloc/huge_pages.h"
+#include "tcmalloc/mock_metadata_allocator.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+class HugeAddressBTreeTest : public ::testing::Test {
+ protected:
+  HugeAddressBTreeTest() : map_(malloc_metadata_) {}
+
+  std::vector<HugeRange> Contents() {
+    std::vector<HugeRange> ret;
+    map_.ForEachRange([&](HugeRange r) { ret.push_back(r); });
+    return ret;
+  }
+
+  HugePage hp(size_t i) { return {i}; }
+  HugeLength hl(size_t i) { return NHugePages(i); }
+
+  HugeAddressBTree map_;
+
+ private:
+  FakeMetadataAllocator malloc_metadata_;
+};
+
+TEST_F(HugeAddressBTreeTest, Merging) {
+  const HugeRange r1 = HugeRange::Make(hp(0), hl(1));
+  const HugeRange r2 = HugeRange::Make(hp(1), hl(1));
+  const HugeRange r3 = HugeRange::Make(hp(2), hl(1));
+  const HugeRange all = Join(r1, Join(r2, r3));
+  map_.Insert(r1);
+  map_.Check();
+  EXPECT_THAT(Contents(), testing::ElementsAre(r1));
+  map_.Insert(r3);
+  map_.Check();
+  EXPECT_THAT(Contents(), testing::ElementsAre(r1, r3));
+  map_.Insert(r2);
+  map_.Check();
+  EXPECT_THAT(Contents(), testing::ElementsAre(all));
+}
+
+TEST_F(HugeAddressBTreeTest, BestFit) {
+  EXPECT_EQ(map_.BestFit(hl(1)), nullptr);
+  map_.Insert(HugeRange::Make(hp(10), hl(4)));
+  map_.Insert(HugeRange::Make(hp(20), hl(2)));
+  map_.Insert(HugeRange::Make(hp(30), hl(8)));
+  map_.Check();
+
+  HugeAddressBTree::Node* node = map_.BestFit(hl(3));
+  ASSERT_NE(node, nullptr);
+  EXPECT_EQ(node->range(), HugeRange::Make(hp(10), hl(4)));
+  EXPECT_EQ(map_.BestFit(hl(9)), nullptr);
+
+  map_.Remove(node);
+  map_.Check();
+  EXPECT_EQ(map_.nranges(), 2);
+  EXPECT_EQ(map_.total_mapped(), hl(10));
+}
+
+// Compares the map against a reference through enough ranges to build a tree
+// of several levels, and then to shrink it again.
+TEST_F(HugeAddressBTreeTest, MostRecentFit) {
+  EXPECT_EQ(map_.MostRecentFit(hl(1)), nullptr);
+  // Enough ranges to need more than one level of blocks, inserted in
+  // decreasing address order, with every fourth one long.
+  for (size_t i = 64; i > 0; --i) {
+    map_.Insert(HugeRange::Make(hp(10 * i), i % 4 == 0 ? hl(4) : hl(1)));
+  }
+  map_.Check();
+
+  HugeAddressBTree::Node* node = map_.MostRecentFit(hl(1));
+  ASSERT_NE(node, nullptr);
+  EXPECT_EQ(node->range(), HugeRange::Make(hp(10), hl(1)));
+  node = map_.MostRecentFit(hl(3));
+  ASSERT_NE(node, nullptr);
+  EXPECT_EQ(node->range(), HugeRange::Make(hp(40), hl(4)));
+  EXPECT_EQ(map_.MostRecentFit(hl(5)), nullptr);
+
+  map_.Remove(node);
+  map_.Check();
+  node = map_.MostRecentFit(hl(3));
+  ASSERT_NE(node, nullptr);
+  EXPECT_EQ(node->range(), HugeRange::Make(hp(80), hl(4)));
+}
+
+TEST_F(HugeAddressBTreeTest, MatchesReference) {
+  absl::BitGen rng;
+  // The free hugepages.
+  std::set<size_t> reference;
+  constexpr size_t kHugePages = 20000;
+
+  auto ReferenceRanges = [&]() {
+    std::vector<HugeRange> ranges;
+    for (size_t p : reference) {
+      if (!ranges.empty() && ranges.back().start() + ranges.back().len() ==
+                                 hp(p)) {
+        ranges.back() = Join(ranges.back(), HugeRange::Make(hp(p), hl(1)));
+      } else {
+        ranges.push_back(HugeRange::Make(hp(p), hl(1)));
+      }
+    }
+    return ranges;
+  };
+
+  // Release single hugepages in random order: first every other one, which
+  // grows the tree, and then the rest, which merges them all back together.
+  for (size_t parity : {0, 1}) {
+    std::vector<size_t> pages;
+    for (size_t i = 1 + parity; i <= kHugePages; i += 2) pages.push_back(i);
+    std::shuffle(pages.begin(), pages.end(), rng);
+    for (size_t i = 0; i < pages.size(); ++i) {
+      map_.Insert(HugeRange::Make(hp(pages[i]), hl(1)));
+      reference.insert(pages[i]);
+      if (i % 500 == 0) {
+        map_.Check();
+        ASSERT_EQ(Contents(), ReferenceRanges());
+      }
+    }
+  }
+  map_.Check();
+  EXPECT_THAT(Contents(),
+              testing::ElementsAre(HugeRange::Make(hp(1), hl(kHugePages))));
+
+  // Then take random fits back out, returning the remainder.
+  while (map_.nranges() > 0) {
+    const HugeLength want = hl(absl::Uniform<size_t>(rng, 1, 64));
+    HugeAddressBTree::Node* node = map_.BestFit(want);
+    if (node == nullptr) {
+      node = map_.BestFit(hl(1));
+      ASSERT_NE(node, nullptr);
+    }
+    const HugeRange r = node->range();
+    map_.Remove(node);
+    const HugeLength taken = std::min(want, r.len());
+    for (size_t i = 0; i < taken.raw_num(); ++i) {
+      reference.erase(r.start().index() + i);
+    }
+    if (r.len() > taken) {
+      map_.Insert(HugeRange::Make(r.start() + taken, r.len() - taken));
+    }
+    if (map_.nranges() % 64 == 0) {
+      map_.Check();
+      ASSERT_EQ(Contents(), ReferenceRanges());
+    }
+  }
+  map_.Check();
+  EXPECT_TRUE(reference.empty());
+  EXPECT_EQ(map_.total_mapped(), hl(0));
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
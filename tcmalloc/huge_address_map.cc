@@ -153,6 +153,69 @@ HugeAddressMap::Node* HugeAddressMap::Predecessor(HugePage p) {
   return best;
 }
 
+HugeAddressMap::Node* HugeAddressMap::BestFit(HugeLength n) {
+  Node* curr = root();
+  // invariant: curr != nullptr && curr->longest >= n
+  // we favor smaller gaps and lower nodes and lower addresses, in that
+  // order. The net effect is that we are neither a best-fit nor a
+  // lowest-address allocator but vaguely close to both.
+  Node* best = nullptr;
+  while (curr && curr->longest() >= n) {
+    if (curr->range().len() >= n) {
+      if (!best || best->range().len() > curr->range().len()) {
+        best = curr;
+      }
+    }
+
+    // Either subtree could contain a better fit and we don't want to
+    // search the whole tree. Pick a reasonable child to look at.
+    auto left = curr->left();
+    auto right = curr->right();
+    if (!left || left->longest() < n) {
+      curr = right;
+      continue;
+    }
+
+    if (!right || right->longest() < n) {
+      curr = left;
+      continue;
+    }
+
+    // Here, we have a nontrivial choice.
+    if (left->range().len() == right->range().len()) {
+      if (left->longest() <= right->longest()) {
+        curr = left;
+      } else {
+        curr = right;
+      }
+    } else if (left->range().len() < right->range().len()) {
+      // Here, the longest range in both children is the same...look
+      // in the subtree with the smaller root, as that's slightly
+      // more likely to be our best.
+      curr = left;
+    } else {
+      curr = right;
+    }
+  }
+  return best;
+}
+
+HugeAddressMap::Node* HugeAddressMap::MostRecentFit(HugeLength n) {
+  Node* best = nullptr;
+  MostRecentFit(root(), n, &best);
+  return best;
+}
+
+void HugeAddressMap::MostRecentFit(Node* n, HugeLength len, Node** best) {
+  if (n == nullptr || n->longest() < len) return;
+  if (n->range().len() >= len &&
+      (*best == nullptr || n->when() > (*best)->when())) {
+    *best = n;
+  }
+  MostRecentFit(n->left(), len, best);
+  MostRecentFit(n->right(), len, best);
+}
+
 void HugeAddressMap::Merge(Node* b, HugeRange r, Node* a) {
   auto merge_when = [](HugeRange x, int64_t x_when, HugeRange y,
                        int64_t y_when) {
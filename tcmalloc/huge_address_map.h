@@ -89,6 +89,21 @@ class HugeAddressMap {
   // after p (if any).
   Node* Predecessor(HugePage p);
 
+  // Returns a range of at least <n> hugepages, or nullptr if there is none.
+  Node* BestFit(HugeLength n);
+
+  // Returns the most recently added range of at least <n> hugepages, or
+  // nullptr if there is none.  Visits every range that fits.
+  Node* MostRecentFit(HugeLength n);
+
+  // Calls f(HugeRange) for each range, in address order.
+  template <typename F>
+  void ForEachRange(F f) const {
+    for (const Node* n = first(); n != nullptr; n = n->next()) {
+      f(n->range());
+    }
+  }
+
   // Expensive consistency check.
   void Check();
 
@@ -120,6 +135,8 @@ class HugeAddressMap {
 
   size_t total_nodes_{0};
 
+  static void MostRecentFit(Node* n, HugeLength len, Node** best);
+
   void Merge(Node* b, HugeRange r, Node* a);
   void FixLongest(Node* n);
   // Note that we always use the same seed, currently; this isn't very random.
@@ -0,0 +1,74 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "absl/random/random.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/huge_address_btree.h"
+#include "tcmalloc/huge_address_map.h"
+#include "tcmalloc/huge_pages.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/mock_metadata_allocator.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Fills a map with state.range(0) free ranges of 1 to 16 hugepages separated
+// by gaps, then repeatedly takes a fitting range out and returns it, as
+// HugeAllocator::Get and HugeAllocator::Release do.
+template <typename Map>
+void BM_BestFit(benchmark::State& state) {
+  const size_t num_ranges = state.range(0);
+  FakeMetadataAllocator meta;
+  Map map(meta);
+  absl::BitGen rng;
+  size_t p = 1;
+  for (size_t i = 0; i < num_ranges; ++i) {
+    const size_t len = absl::Uniform<size_t>(rng, 1, 17);
+    map.Insert(HugeRange::Make(HugePage{p}, NHugePages(len)));
+    p += len + 1;
+  }
+
+  std::vector<HugeLength> requests(1024);
+  for (HugeLength& n : requests) {
+    n = NHugePages(absl::Uniform<size_t>(rng, 1, 17));
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    const HugeLength n = requests[i++ % requests.size()];
+    auto* node = map.BestFit(n);
+    TC_CHECK_NE(node, nullptr);
+    const HugeRange r = node->range();
+    map.Remove(node);
+    benchmark::DoNotOptimize(r);
+    map.Insert(r);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_BestFit, HugeAddressMap)->Range(64, 1 << 20);
+BENCHMARK_TEMPLATE(BM_BestFit, HugeAddressBTree)->Range(64, 1 << 20);
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -68,6 +68,22 @@ TEST_F(HugeAddressMapTest, Merging) {
   EXPECT_THAT(Contents(), testing::ElementsAre(all));
 }
 
+TEST_F(HugeAddressMapTest, MostRecentFit) {
+  EXPECT_EQ(map_.MostRecentFit(hl(1)), nullptr);
+  map_.Insert(HugeRange::Make(hp(30), hl(4)));
+  map_.Insert(HugeRange::Make(hp(20), hl(4)));
+  map_.Insert(HugeRange::Make(hp(10), hl(1)));
+  map_.Check();
+
+  HugeAddressMap::Node* node = map_.MostRecentFit(hl(1));
+  ASSERT_NE(node, nullptr);
+  EXPECT_EQ(node->range(), HugeRange::Make(hp(10), hl(1)));
+  node = map_.MostRecentFit(hl(2));
+  ASSERT_NE(node, nullptr);
+  EXPECT_EQ(node->range(), HugeRange::Make(hp(20), hl(4)));
+  EXPECT_EQ(map_.MostRecentFit(hl(5)), nullptr);
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
@@ -16,7 +16,7 @@
 
 #include <string.h>
 
-#include "tcmalloc/huge_address_map.h"
+#include "tcmalloc/huge_address_btree.h"
 #include "tcmalloc/huge_pages.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
@@ -41,51 +41,8 @@ void HugeAllocator::PrintInPbtxt(PbtxtRegion* hpaa) const {
   hpaa->PrintI64("num_in_use_huge_pages", in_use_.raw_num());
 }
 
-HugeAddressMap::Node* HugeAllocator::Find(HugeLength n) {
-  HugeAddressMap::Node* curr = free_.root();
-  // invariant: curr != nullptr && curr->longest >= n
-  // we favor smaller gaps and lower nodes and lower addresses, in that
-  // order. The net effect is that we are neither a best-fit nor a
-  // lowest-address allocator but vaguely close to both.
-  HugeAddressMap::Node* best = nullptr;
-  while (curr && curr->longest() >= n) {
-    if (curr->range().len() >= n) {
-      if (!best || best->range().len() > curr->range().len()) {
-        best = curr;
-      }
-    }
-
-    // Either subtree could contain a better fit and we don't want to
-    // search the whole tree. Pick a reasonable child to look at.
-    auto left = curr->left();
-    auto right = curr->right();
-    if (!left || left->longest() < n) {
-      curr = right;
-      continue;
-    }
-
-    if (!right || right->longest() < n) {
-      curr = left;
-      continue;
-    }
-
-    // Here, we have a nontrivial choice.
-    if (left->range().len() == right->range().len()) {
-      if (left->longest() <= right->longest()) {
-        curr = left;
-      } else {
-        curr = right;
-      }
-    } else if (left->range().len() < right->range().len()) {
-      // Here, the longest range in both children is the same...look
-      // in the subtree with the smaller root, as that's slightly
-      // more likely to be our best.
-      curr = left;
-    } else {
-      curr = right;
-    }
-  }
-  return best;
+HugeRangeMap::Node* HugeAllocator::Find(HugeLength n) {
+  return free_.BestFit(n);
 }
 
 void HugeAllocator::CheckFreelist() {
@@ -158,14 +115,12 @@ void HugeAllocator::Release(HugeRange r) {
 
 void HugeAllocator::AddSpanStats(SmallSpanStats* small,
                                  LargeSpanStats* large) const {
-  for (const HugeAddressMap::Node* node = free_.first(); node != nullptr;
-       node = node->next()) {
-    HugeLength n = node->range().len();
+  free_.ForEachRange([&](HugeRange r) {
     if (large != nullptr) {
       large->spans++;
-      large->returned_pages += n.in_pages();
+      large->returned_pages += r.len().in_pages();
     }
-  }
+  });
 }
 
 }  // namespace tcmalloc_internal
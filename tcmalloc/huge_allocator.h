@@ -20,7 +20,7 @@
 #include <stddef.h>
 
 #include "absl/base/attributes.h"
-#include "tcmalloc/huge_address_map.h"
+#include "tcmalloc/huge_address_btree.h"
 #include "tcmalloc/huge_pages.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
@@ -99,8 +99,8 @@ class HugeAllocator {
   // backing costs if we've gotten this far; the last few bits of performance
   // don't matter, and most of the simple ideas can't hit all of the above
   // requirements.
-  HugeAddressMap free_;
-  HugeAddressMap::Node* Find(HugeLength n);
+  HugeRangeMap free_;
+  HugeRangeMap::Node* Find(HugeLength n);
 
   void CheckFreelist();
   void DebugCheckFreelist() {
@@ -18,11 +18,13 @@
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <initializer_list>
 #include <tuple>
 
 #include "absl/base/optimization.h"
 #include "absl/time/time.h"
-#include "tcmalloc/huge_address_map.h"
+#include "absl/types/span.h"
+#include "tcmalloc/huge_address_btree.h"
 #include "tcmalloc/huge_page_subrelease.h"
 #include "tcmalloc/huge_pages.h"
 #include "tcmalloc/internal/config.h"
@@ -108,8 +110,47 @@ template class MinMaxTracker<600>;
 HugeRange HugeCache::DoGet(HugeLength n, bool* from_released) {
   auto* node = Find(n);
   if (!node) {
+    // Demoted memory is still backed, so reusing it faults nothing in unless
+    // the kernel reclaimed it under memory pressure meanwhile.
+    if (cold_size_ >= n) {
+      for (HugeRangeMap* cold : {&young_cold(), &old_cold()}) {
+        auto* cold_node = cold->BestFit(n);
+        if (cold_node == nullptr) continue;
+        HugeRange result, leftover;
+        std::tie(result, leftover) = Split(cold_node->range(), n);
+        cold->Remove(cold_node);
+        if (leftover.valid()) {
+          cold->Insert(leftover);
+        }
+        hits_++;
+        weighted_hits_ += n.raw_num();
+        cold_size_ -= n;
+        total_cold_reused_ += n;
+        *from_released = false;
+        return result;
+      }
+    }
     misses_++;
     weighted_misses_ += n.raw_num();
+    // Prefer lazily freed memory: unless the kernel has reclaimed it since,
+    // backing it again faults nothing in.
+    if (lazy_size_ >= n) {
+      auto* lazy_node =
+          lifo_reuse_ ? lazy().MostRecentFit(n) : lazy().BestFit(n);
+      if (lazy_node != nullptr) {
+        HugeRange result, leftover;
+        std::tie(result, leftover) = Split(lazy_node->range(), n);
+        lazy().Remove(lazy_node);
+        if (leftover.valid()) {
+          lazy().Insert(leftover);
+        }
+        lazy_size_ -= n;
+        total_lazy_reused_ += n;
+        cold_hits_++;
+        *from_released = true;
+        return result;
+      }
+    }
     HugeRange res = allocator_->Get(n);
     if (res.valid()) {
       *from_released = true;
@@ -132,6 +173,96 @@ HugeRange HugeCache::DoGet(HugeLength n, bool* from_released) {
   return result;
 }
 
+DemandForecaster::DemandForecaster(Clock clock, absl::Duration period)
+    : clock_(clock),
+      slot_ticks_(std::max<int64_t>(
+          clock.freq() * absl::ToDoubleSeconds(period) / kSlots, 1)) {}
+
+void DemandForecaster::Report(HugeLength demand) {
+  const int64_t now = clock_.now();
+  if (ABSL_PREDICT_FALSE(start_ < 0)) {
+    start_ = now;
+  }
+  const int64_t slot = (now - start_) / slot_ticks_;
+  if (ABSL_PREDICT_FALSE(slot > slot_)) {
+    // Slots without reports saw the last reported demand throughout.  Past a
+    // full period, those slots would only overwrite each other.
+    const int64_t skipped =
+        std::min<int64_t>(slot - slot_ - 1, 2 * kSlots - 1);
+    CompleteSlot(peak_);
+    for (int64_t i = 0; i < skipped; ++i) {
+      CompleteSlot(last_);
+    }
+    slot_ = slot;
+    peak_ = last_;
+    predicted_ = Predict(slot_);
+  }
+  peak_ = std::max(peak_, demand);
+  last_ = demand;
+}
+
+void DemandForecaster::CompleteSlot(HugeLength realized) {
+  last_predicted_ = predicted_;
+  last_realized_ = realized;
+  total_error_ += std::abs(static_cast<double>(predicted_.raw_num()) -
+                           static_cast<double>(realized.raw_num()));
+  total_realized_ += realized.raw_num();
+  if (realized > predicted_) {
+    ++underpredicted_slots_;
+  }
+
+  const double peak = realized.raw_num();
+  recent_ = kRecentWeight * peak + (1 - kRecentWeight) * recent_;
+  double& seasonal = seasonal_[slot_ % kSlots];
+  if (slot_ < static_cast<int64_t>(kSlots)) {
+    seasonal = peak;
+  } else {
+    seasonal = kSeasonalWeight * peak + (1 - kSeasonalWeight) * seasonal;
+  }
+  ++slot_;
+  predicted_ = Predict(slot_);
+}
+
+HugeLength DemandForecaster::Predict(int64_t slot) const {
+  double prediction;
+  if (slot < static_cast<int64_t>(kSlots)) {
+    prediction = recent_;
+  } else {
+    // Look one slot ahead, to keep hugepages for a peak that is about to
+    // start.
+    prediction = std::max(seasonal_[slot % kSlots],
+                          seasonal_[(slot + 1) % kSlots]);
+  }
+  return NHugePages(std::ceil(prediction));
+}
+
+HugeLength DemandForecaster::Forecast() const {
+  return std::max(predicted_, peak_);
+}
+
+void DemandForecaster::Print(Printer* out) const {
+  const double error =
+      total_realized_ > 0 ? total_error_ / total_realized_ : 0.0;
+  out->printf(
+      "HugeCache: demand forecast %zu MiB (last slot %zu MiB predicted, "
+      "%zu MiB realized; %.1f%% mean absolute error, %zu of %lld slots "
+      "underpredicted)\n",
+      Forecast().in_mib(), last_predicted_.in_mib(), last_realized_.in_mib(),
+      100 * error, underpredicted_slots_, static_cast<long long>(slot_));
+}
+
+void DemandForecaster::PrintInPbtxt(PbtxtRegion* hpaa) const {
+  auto forecast = hpaa->CreateSubRegion("huge_cache_demand_forecast");
+  forecast.PrintI64("forecast_bytes", Forecast().in_bytes());
+  forecast.PrintI64("last_predicted_bytes", last_predicted_.in_bytes());
+  forecast.PrintI64("last_realized_bytes", last_realized_.in_bytes());
+  forecast.PrintDouble(
+      "mean_absolute_error",
+      total_realized_ > 0 ? total_error_ / total_realized_ : 0.0);
+  forecast.PrintI64("slots", slot_);
+  forecast.PrintI64("underpredicted_slots", underpredicted_slots_);
+}
+
 void HugeCache::MaybeGrowCacheLimit(HugeLength missed) {
   // Our goal is to make the cache size = the largest "brief dip."
   //
@@ -199,6 +330,7 @@ void HugeCache::UpdateSize(HugeLength size) { size_tracker_.Report(size); }
 
 void HugeCache::UpdateStatsTracker() {
   cachestats_tracker_.Report(GetSubreleaseStats());
+  forecaster_.Report(usage_);
   hugepage_release_stats_.reset();
 }
 
@@ -231,9 +363,20 @@ void HugeCache::Release(HugeRange r, bool demand_based_unback) {
     // the max size.  (This could reduce the number of regions we break
     // in half to avoid overshrinking.)
     if ((clock_.now() - last_limit_change_) > (cache_time_ticks_ * 2)) {
-      total_fast_unbacked_ += MaybeShrinkCacheLimit();
+      total_fast_unbacked_ += MaybeShrinkCacheLimit(/*demote=*/false);
     }
-    total_fast_unbacked_ += ShrinkCache(limit());
+    total_fast_unbacked_ += ShrinkCache(limit(), /*demote=*/false);
+  }
+  UpdateSize(size());
+  UpdateStatsTracker();
+}
+
+void HugeCache::AddReserved(HugeRange r) {
+  cache_.Insert(r);
+  size_ += r.len();
+  if (limit_ < size_) {
+    limit_ = size_;
+    last_limit_change_ = clock_.now();
   }
   UpdateSize(size());
   UpdateStatsTracker();
@@ -246,7 +389,7 @@ void HugeCache::ReleaseUnbacked(HugeRange r) {
   UpdateStatsTracker();
 }
 
-HugeLength HugeCache::MaybeShrinkCacheLimit() {
+HugeLength HugeCache::MaybeShrinkCacheLimit(bool demote) {
   last_limit_change_ = clock_.now();
 
   const HugeLength min = size_tracker_.MinOverTime(cache_time_ * 2);
@@ -259,14 +402,14 @@ HugeLength HugeCache::MaybeShrinkCacheLimit() {
   HugeLength drop = std::max(min / 2, NHugePages(1));
   limit_ = std::max(limit() <= drop ? NHugePages(0) : limit() - drop,
                     MinCacheLimit());
-  return ShrinkCache(limit());
+  return ShrinkCache(limit(), demote);
 }
 
-HugeLength HugeCache::ShrinkCache(HugeLength target) {
+HugeLength HugeCache::ShrinkCache(HugeLength target, bool demote) {
   HugeLength removed = NHugePages(0);
   while (size_ > target) {
     // Remove smallest-ish nodes, to avoid fragmentation where possible.
-    auto* node = Find(NHugePages(1));
+    auto* node = cache_.BestFit(NHugePages(1));
     TC_CHECK_NE(node, nullptr);
     HugeRange r = node->range();
     cache_.Remove(node);
@@ -285,31 +428,140 @@ HugeLength HugeCache::ShrinkCache(HugeLength target) {
     }
 
     size_ -= r.len();
+    // Ranges that cannot be demoted, e.g. on kernels without MADV_COLD, are
+    // unbacked right away.
+    if (demote && (*demote_)(r.start().first_page(), r.len().in_pages())) {
+      young_cold().Insert(r);
+      cold_size_ += r.len();
+      total_demoted_ += r.len();
+      continue;
+    }
     // Note, actual unback implementation is temporarily dropping and
     // re-acquiring the page heap lock here.
-    if (ABSL_PREDICT_FALSE(
-            !unback_(r.start().first_page(), r.len().in_pages()))) {
+    HugeLength resident;
+    if (ABSL_PREDICT_FALSE(!Unback(r, &resident))) {
       // We failed to release r.  Retain it in the cache instead of returning it
       // to the HugeAllocator.
       size_ += r.len();
       cache_.Insert(r);
       break;
     }
-    allocator_->Release(r);
-    removed += r.len();
+    ReleaseUnbackedRange(r);
+    removed += resident;
   }
 
   return removed;
 }
 
+bool HugeCache::Unback(HugeRange r, HugeLength* resident) {
+  MemoryModifyRange range = {r.start().first_page(), r.len().in_pages(),
+                             /*success=*/false,
+                             /*resident=*/r.len().in_pages()};
+  unback_.Batch(absl::MakeSpan(&range, 1));
+  *resident = std::min(HLFromPages(range.resident), r.len());
+  return range.success;
+}
+
+void HugeCache::ReleaseUnbackedRange(HugeRange r) {
+  if (!lazy_unback_ || lazy_size_ + r.len() > kMaxLazilyFreed) {
+    allocator_->Release(r);
+    return;
+  }
+  lazy().Insert(r);
+  lazy_size_ += r.len();
+  total_lazily_freed_ += r.len();
+}
+
+HugeLength HugeCache::ReclaimLazilyFreed(
+    absl::FunctionRef<Length(HugeRange)> resident) {
+  HugeRangeMap& from = lazy();
+  lazy_in_b_ = !lazy_in_b_;
+  HugeRangeMap& to = lazy();
+
+  HugeLength reclaimed = NHugePages(0);
+  lazy_resident_ = Length(0);
+  // Probe hugepage by hugepage, keeping those still (partly) resident for
+  // reuse and returning runs of reclaimed ones.
+  while (auto* node = from.BestFit(NHugePages(1))) {
+    const HugeRange r = node->range();
+    from.Remove(node);
+    HugePage run_start = r.start();
+    for (HugePage p = r.start(); p < r.start() + r.len(); ++p) {
+      const Length pages = resident(HugeRange{p, NHugePages(1)});
+      if (pages == Length(0)) {
+        continue;
+      }
+      lazy_resident_ += pages;
+      if (run_start < p) {
+        allocator_->Release(HugeRange{run_start, p - run_start});
+        reclaimed += p - run_start;
+      }
+      to.Insert(HugeRange{p, NHugePages(1)});
+      run_start = p + NHugePages(1);
+    }
+    const HugePage end = r.start() + r.len();
+    if (run_start < end) {
+      allocator_->Release(HugeRange{run_start, end - run_start});
+      reclaimed += end - run_start;
+    }
+  }
+
+  lazy_size_ -= reclaimed;
+  total_lazy_reclaimed_ += reclaimed;
+  return reclaimed;
+}
+
+HugeLength HugeCache::ReleaseColdPages() {
+  if (cold_size_ == NHugePages(0)) {
+    return NHugePages(0);
+  }
+  const int64_t now = clock_.now();
+  const bool all = !demoting();
+  if (!all && now - last_cold_flip_ < cold_interval_ticks_) {
+    return NHugePages(0);
+  }
+
+  HugeLength released = NHugePages(0);
+  for (HugeRangeMap* cold : {&old_cold(), &young_cold()}) {
+    while (auto* node = cold->BestFit(NHugePages(1))) {
+      const HugeRange r = node->range();
+      cold->Remove(node);
+      HugeLength resident;
+      if (ABSL_PREDICT_FALSE(!Unback(r, &resident))) {
+        cold->Insert(r);
+        break;
+      }
+      cold_size_ -= r.len();
+      ReleaseUnbackedRange(r);
+      released += resident;
+    }
+    // Unless demotion was turned off, the younger generation stays cold until
+    // the next interval.
+    if (!all) break;
+  }
+  if (!all) {
+    cold_in_b_ = !cold_in_b_;
+    last_cold_flip_ = now;
+  }
+  total_cold_unbacked_ += released;
+  return released;
+}
+
 HugeLength HugeCache::ReleaseCachedPages(HugeLength n) {
+  // Cold pages that are due were already chosen for release.
+  HugeLength released = ReleaseColdPages();
   // This is a good time to check: is our cache going persistently unused?
-  HugeLength released = MaybeShrinkCacheLimit();
-
-  if (released < n) {
-    n -= released;
-    const HugeLength target = n > size() ? NHugePages(0) : size() - n;
-    released += ShrinkCache(target);
+  released += MaybeShrinkCacheLimit(demoting());
+
+  // Hugepages with nothing resident free no memory, so keep shrinking until
+  // enough resident ones are released or the cache is empty.  Demoted ones
+  // are not released at all, so a demoting release makes a single pass.
+  while (released < n && size() > NHugePages(0)) {
+    const HugeLength left = n - released;
+    const HugeLength before = size();
+    const HugeLength target = left > size() ? NHugePages(0) : size() - left;
+    released += ShrinkCache(target, demoting());
+    if (demoting() || size() == before) break;
   }
   UpdateSize(size());
   UpdateStatsTracker();
@@ -356,6 +608,8 @@ HugeLength HugeCache::GetDesiredReleaseablePages(
 
 HugeLength HugeCache::ReleaseCachedPagesByDemand(
     HugeLength n, SkipSubreleaseIntervals intervals, bool hit_limit) {
+  const HugeLength cold_released = ReleaseColdPages();
+  total_periodic_unbacked_ += cold_released;
   // We cannot release more than what exists in the cache.
   HugeLength release_target = std::min(n, size());
 
@@ -369,13 +623,40 @@ HugeLength HugeCache::ReleaseCachedPagesByDemand(
         size() > MinCacheLimit() ? size() - MinCacheLimit() : NHugePages(0);
   }
   if (release_target == NHugePages(0)) {
-    return NHugePages(0);
+    return cold_released;
   }
   if (intervals.SkipSubreleaseEnabled() && !hit_limit) {
     // Updates the target based on the recent demand history.
     release_target = GetDesiredReleaseablePages(release_target, intervals);
   }
-  HugeLength released = ShrinkCache(size() - release_target);
+  return cold_released +
+         ReleaseCachedPagesForDemand(release_target, hit_limit);
+}
+
+HugeLength HugeCache::ReleaseCachedPagesByForecast() {
+  forecast_used_ = true;
+  const HugeLength cold_released = ReleaseColdPages();
+  total_periodic_unbacked_ += cold_released;
+  UpdateStatsTracker();
+  // As in ReleaseCachedPagesByDemand, protect the minimum cache size.
+  if (size() <= MinCacheLimit()) {
+    return cold_released;
+  }
+  const HugeLength current = usage() + size();
+  const HugeLength forecast = forecaster_.Forecast();
+  if (current <= forecast) {
+    return cold_released;
+  }
+  const HugeLength release_target =
+      std::min(current - forecast, size() - MinCacheLimit());
+  return cold_released +
+         ReleaseCachedPagesForDemand(release_target, /*hit_limit=*/false);
+}
+
+HugeLength HugeCache::ReleaseCachedPagesForDemand(HugeLength release_target,
+                                                  bool hit_limit) {
+  HugeLength released =
+      ShrinkCache(size() - release_target, demoting() && !hit_limit);
   hugepage_release_stats_.num_pages_subreleased += released.in_pages();
   hugepage_release_stats_.set_limit_hit(hit_limit);
   if (hugepage_release_stats_.limit_hit()) {
@@ -391,61 +672,30 @@ HugeLength HugeCache::ReleaseCachedPagesByDemand(
 void HugeCache::AddSpanStats(SmallSpanStats* small,
                              LargeSpanStats* large) const {
   static_assert(kPagesPerHugePage >= kMaxPages);
-  for (const HugeAddressMap::Node* node = cache_.first(); node != nullptr;
-       node = node->next()) {
-    HugeLength n = node->range().len();
+  cache_.ForEachRange([&](HugeRange r) {
     if (large != nullptr) {
       large->spans++;
-      large->normal_pages += n.in_pages();
+      large->normal_pages += r.len().in_pages();
     }
-  }
-}
-
-HugeAddressMap::Node* HugeCache::Find(HugeLength n) {
-  HugeAddressMap::Node* curr = cache_.root();
-  // invariant: curr != nullptr && curr->longest >= n
-  // we favor smaller gaps and lower nodes and lower addresses, in that
-  // order. The net effect is that we are neither a best-fit nor a
-  // lowest-address allocator but vaguely close to both.
-  HugeAddressMap::Node* best = nullptr;
-  while (curr && curr->longest() >= n) {
-    if (curr->range().len() >= n) {
-      if (!best || best->range().len() > curr->range().len()) {
-        best = curr;
+  });
+  for (const HugeRangeMap* cold : {&cold_a_, &cold_b_}) {
+    cold->ForEachRange([&](HugeRange r) {
+      if (large != nullptr) {
+        large->spans++;
+        large->normal_pages += r.len().in_pages();
       }
+    });
+  }
+  lazy().ForEachRange([&](HugeRange r) {
+    if (large != nullptr) {
+      large->spans++;
+      large->returned_pages += r.len().in_pages();
     }
+  });
+}
 
-    // Either subtree could contain a better fit and we don't want to
-    // search the whole tree. Pick a reasonable child to look at.
-    auto left = curr->left();
-    auto right = curr->right();
-    if (!left || left->longest() < n) {
-      curr = right;
-      continue;
-    }
-
-    if (!right || right->longest() < n) {
-      curr = left;
-      continue;
-    }
-
-    // Here, we have a nontrivial choice.
-    if (left->range().len() == right->range().len()) {
-      if (left->longest() <= right->longest()) {
-        curr = left;
-      } else {
-        curr = right;
-      }
-    } else if (left->range().len() < right->range().len()) {
-      // Here, the longest range in both children is the same...look
-      // in the subtree with the smaller root, as that's slightly
-      // more likely to be our best.
-      curr = left;
-    } else {
-      curr = right;
-    }
-  }
-  return best;
+HugeRangeMap::Node* HugeCache::Find(HugeLength n) {
+  return lifo_reuse_ ? cache_.MostRecentFit(n) : cache_.BestFit(n);
 }
 
 void HugeCache::Print(Printer* out) {
@@ -468,6 +718,11 @@ void HugeCache::Print(Printer* out) {
       "HugeCache: %zu / %zu hugepages cached / cache limit "
       "(%.3f hit rate, %.3f overflow rate)\n",
       size_.raw_num(), limit().raw_num(), hit_rate, overflow_rate);
+  out->printf(
+      "HugeCache: %zu warm hits (backed), %zu cold hits (lazily unbacked), "
+      "%zu misses (%.3f warm ratio, %s reuse)\n",
+      hits_, cold_hits_, misses_ - cold_hits_, safe_ratio(hits_, cold_hits_),
+      lifo_reuse_ ? "LIFO" : "best-fit");
   out->printf("HugeCache: %zu MiB fast unbacked, %zu MiB periodic\n",
               total_fast_unbacked_.in_bytes() / 1024 / 1024,
               total_periodic_unbacked_.in_bytes() / 1024 / 1024);
@@ -506,6 +761,25 @@ void HugeCache::Print(Printer* out) {
           .raw_num());
 
   cachestats_tracker_.Print(out, "HugeCache");
+  if (forecast_used_) {
+    forecaster_.Print(out);
+  }
+  if (total_lazily_freed_ > NHugePages(0)) {
+    out->printf(
+        "HugeCache: %zu MiB lazily freed (%zu MiB resident when last "
+        "checked); since startup, %zu MiB lazily freed, %zu MiB reused, "
+        "%zu MiB reclaimed by the kernel\n",
+        lazy_size_.in_mib(), lazy_resident_.in_bytes() / 1024 / 1024,
+        total_lazily_freed_.in_mib(), total_lazy_reused_.in_mib(),
+        total_lazy_reclaimed_.in_mib());
+  }
+  if (total_demoted_ > NHugePages(0)) {
+    out->printf(
+        "HugeCache: %zu MiB demoted to cold; since startup, %zu MiB demoted, "
+        "%zu MiB reused, %zu MiB released after staying cold\n",
+        cold_size_.in_mib(), total_demoted_.in_mib(),
+        total_cold_reused_.in_mib(), total_cold_unbacked_.in_mib());
+  }
 }
 
 void HugeCache::PrintInPbtxt(PbtxtRegion* hpaa) {
@@ -530,6 +804,11 @@ void HugeCache::PrintInPbtxt(PbtxtRegion* hpaa) {
   hpaa->PrintDouble("huge_cache_hit_rate", hit_rate);
   // lifetime cache overflow rate
   hpaa->PrintDouble("huge_cache_overflow_rate", overflow_rate);
+  // reuses of backed and of lazily unbacked memory
+  hpaa->PrintI64("huge_cache_warm_hits", hits_);
+  hpaa->PrintI64("huge_cache_cold_hits", cold_hits_);
+  hpaa->PrintDouble("huge_cache_warm_ratio", safe_ratio(hits_, cold_hits_));
+  hpaa->PrintBool("huge_cache_lifo_reuse", lifo_reuse_);
   // bytes eagerly unbacked by HugeCache
   hpaa->PrintI64("fast_unbacked_bytes", total_fast_unbacked_.in_bytes());
   // bytes unbacked by periodic releaser thread
@@ -578,6 +857,24 @@ void HugeCache::PrintInPbtxt(PbtxtRegion* hpaa) {
                                                   "cache_stats_timeseries");
   cachestats_tracker_.PrintSubreleaseStatsInPbtxt(hpaa,
                                                   "cache_skipped_subrelease");
+  if (forecast_used_) {
+    forecaster_.PrintInPbtxt(hpaa);
+  }
+  if (total_lazily_freed_ > NHugePages(0)) {
+    auto lazy_stats = hpaa->CreateSubRegion("huge_cache_lazily_freed");
+    lazy_stats.PrintI64("current_bytes", lazy_size_.in_bytes());
+    lazy_stats.PrintI64("resident_bytes", lazy_resident_.in_bytes());
+    lazy_stats.PrintI64("total_bytes", total_lazily_freed_.in_bytes());
+    lazy_stats.PrintI64("reused_bytes", total_lazy_reused_.in_bytes());
+    lazy_stats.PrintI64("reclaimed_bytes", total_lazy_reclaimed_.in_bytes());
+  }
+  if (total_demoted_ > NHugePages(0)) {
+    auto cold_stats = hpaa->CreateSubRegion("huge_cache_cold");
+    cold_stats.PrintI64("current_bytes", cold_size_.in_bytes());
+    cold_stats.PrintI64("total_bytes", total_demoted_.in_bytes());
+    cold_stats.PrintI64("reused_bytes", total_cold_reused_.in_bytes());
+    cold_stats.PrintI64("released_bytes", total_cold_unbacked_.in_bytes());
+  }
 }
 
 }  // namespace tcmalloc_internal
@@ -24,8 +24,10 @@
 
 #include "absl/base/attributes.h"
 #include "absl/base/internal/cycleclock.h"
+#include "absl/functional/function_ref.h"
 #include "absl/time/time.h"
-#include "tcmalloc/huge_address_map.h"
+#include "absl/types/span.h"
+#include "tcmalloc/huge_address_btree.h"
 #include "tcmalloc/huge_allocator.h"
 #include "tcmalloc/huge_page_subrelease.h"
 #include "tcmalloc/huge_pages.h"
@@ -40,11 +42,33 @@ GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
+// A range of pages passed to MemoryModifyFunction::Batch, along with the
+// outcome of modifying it.
+struct MemoryModifyRange {
+  PageId start;
+  Length len;
+  bool success;
+  // How many pages of the range were resident before it was modified, as set
+  // by Batch.  Implementations that cannot tell report all of them.
+  Length resident;
+};
+
 class MemoryModifyFunction {
  public:
   virtual ~MemoryModifyFunction() = default;
 
   ABSL_MUST_USE_RESULT virtual bool operator()(PageId start, Length len) = 0;
+
+  // Modifies each of ranges, recording the result in its success and resident
+  // fields.  Implementations may override this to amortize per-call costs,
+  // such as dropping pageheap_lock, over the whole batch, or to skip ranges
+  // that have nothing resident.
+  virtual void Batch(absl::Span<MemoryModifyRange> ranges) {
+    for (MemoryModifyRange& r : ranges) {
+      r.success = (*this)(r.start, r.len);
+      r.resident = r.len;
+    }
+  }
 };
 
 // Track the extreme values of a HugeLength value over the past
@@ -96,6 +120,60 @@ class MinMaxTracker {
 extern template class MinMaxTracker<>;
 extern template class MinMaxTracker<600>;
 
+// Predicts the peak of a HugeLength value (the demand for hugepages) over the
+// near future.  Time is divided into kSlots slots per period, typically a day.
+// Within the first period, the forecast is an exponentially weighted average
+// of the peaks of recent slots.  Afterwards, it is the peak seen in the same
+// and the following slot of previous periods, so that daily peaks are
+// anticipated and daily troughs are recognized as such.  The forecast never
+// drops below the peak of the current slot so far.
+class DemandForecaster {
+ public:
+  static constexpr size_t kSlots = 96;
+
+  DemandForecaster(Clock clock, absl::Duration period);
+
+  void Report(HugeLength demand);
+
+  // Returns the predicted peak demand for the rest of the current slot and
+  // the next one.
+  HugeLength Forecast() const;
+
+  void Print(Printer* out) const;
+  void PrintInPbtxt(PbtxtRegion* hpaa) const;
+
+ private:
+  // Weight of the latest slot in the average used within the first period,
+  // and in the per-slot averages across periods.
+  static constexpr double kRecentWeight = 0.5;
+  static constexpr double kSeasonalWeight = 0.5;
+
+  // Ends the current slot with the peak <realized>.
+  void CompleteSlot(HugeLength realized);
+  HugeLength Predict(int64_t slot) const;
+
+  Clock clock_;
+  const int64_t slot_ticks_;
+  // Time of the first report, or -1 before it.
+  int64_t start_ = -1;
+
+  // The current slot, counted from start_, and the demand seen in it.
+  int64_t slot_ = 0;
+  HugeLength peak_;
+  HugeLength last_;
+
+  double recent_ = 0;
+  double seasonal_[kSlots] = {};
+  HugeLength predicted_;
+
+  // Accuracy of the predictions made for completed slots.
+  HugeLength last_predicted_;
+  HugeLength last_realized_;
+  double total_error_ = 0;
+  double total_realized_ = 0;
+  size_t underpredicted_slots_ = 0;
+};
+
 class HugeCache {
  public:
   // For use in production
@@ -140,6 +218,10 @@ class HugeCache {
             absl::Duration cache_time, Clock clock)
       : allocator_(allocator),
         cache_(meta_allocate),
+        lazy_a_(meta_allocate),
+        lazy_b_(meta_allocate),
+        cold_a_(meta_allocate),
+        cold_b_(meta_allocate),
         clock_(clock),
         cache_time_ticks_(clock_.freq() * absl::ToDoubleSeconds(cache_time)),
         nanoseconds_per_tick_(absl::ToInt64Nanoseconds(absl::Seconds(1)) /
@@ -149,6 +231,7 @@ class HugeCache {
         usage_tracker_(clock, cache_time * 2),
         off_peak_tracker_(clock, cache_time * 2),
         size_tracker_(clock, cache_time * 2),
+        forecaster_(clock, absl::Hours(24)),
         unback_(unback),
         cache_time_(cache_time),
         cachestats_tracker_(clock, absl::Minutes(10), absl::Minutes(5)) {}
@@ -168,9 +251,16 @@ class HugeCache {
   // As Release, but the range is assumed to _not_ be backed.
   void ReleaseUnbacked(HugeRange r);
 
+  // Adds <r>, a backed range obtained directly from the HugeAllocator rather
+  // than through Get(), to the cache.  The cache limit grows to retain it, so
+  // subsequent Gets are served from it until demand-based shrinking decides
+  // the reservation is not needed.
+  void AddReserved(HugeRange r);
+
   // Release to the system up to <n> hugepages of cache contents; returns
   // the number of hugepages released. It also triggers cache shrinking if
-  // the cache becomes too big.
+  // the cache becomes too big.  Only resident memory counts toward <n>, so
+  // more than <n> hugepages may leave the cache if some had nothing resident.
   HugeLength ReleaseCachedPages(HugeLength n);
 
   // Release to the system up to <n> hugepages of cache contents if recent
@@ -182,10 +272,66 @@ class HugeCache {
                                         SkipSubreleaseIntervals intervals,
                                         bool hit_limit);
 
+  // Releases cache contents in excess of the demand forecast for the near
+  // future, while keeping at least MinCacheLimit() hugepages cached; returns
+  // the number of hugepages released.  Used for background release in place
+  // of ReleaseCachedPagesByDemand.
+  HugeLength ReleaseCachedPagesByForecast();
+
+  // Demand predicted for the near future.
+  HugeLength forecast() const { return forecaster_.Forecast(); }
+
+  // Whether unbacking is lazy, i.e. releases with MADV_FREE alone, so the
+  // kernel reclaims unbacked memory only under memory pressure.  While set,
+  // ranges unbacked by the cache are kept aside, up to kMaxLazilyFreed, rather
+  // than returned to the HugeAllocator, and cache misses reuse them before
+  // fresh ones: those the kernel has not reclaimed yet refault nothing.
+  void set_lazy_unback(bool lazy) { lazy_unback_ = lazy; }
+
+  // Whether Get reuses the most recently released range that fits, rather
+  // than the best fit, both among backed ranges and, on a miss, among lazily
+  // unbacked ones.  Memory released last is the most likely to still be in
+  // the TLB and CPU caches and, if lazily unbacked, not reclaimed yet.
+  void set_lifo_reuse(bool lifo) { lifo_reuse_ = lifo; }
+
+  // Whether periodic release demotes cached hugepages rather than unbacking
+  // them.  While <demote> is set and <cold_interval> is nonzero, the
+  // ReleaseCachedPages* functions mark the ranges they would unback cold with
+  // <demote>, e.g. MADV_COLD, and keep them backed: cache misses reuse them
+  // before unbacked memory, and they are unbacked once they have been cold
+  // for <cold_interval> to twice that.  When <demote> is null, the next
+  // release unbacks all cold ranges.
+  void set_demotion(MemoryModifyFunction* demote,
+                    absl::Duration cold_interval) {
+    demote_ = demote;
+    cold_interval_ticks_ = clock_.freq() * absl::ToDoubleSeconds(cold_interval);
+  }
+
+  // Backed memory marked cold, not counted in size().
+  HugeLength cold() const { return cold_size_; }
+
+  // Returns the lazily unbacked hugepages the kernel has reclaimed to the
+  // HugeAllocator; returns how many were returned.  <resident> returns how
+  // many pages of a range are still resident, e.g. from mincore.
+  HugeLength ReclaimLazilyFreed(
+      absl::FunctionRef<Length(HugeRange)> resident);
+
+  // Lazily unbacked memory kept aside for reuse.  As far as accounting goes,
+  // it is unmapped, although part of it may still be resident.
+  HugeLength lazily_freed() const { return lazy_size_; }
+
   // Backed memory available.
   HugeLength size() const { return size_; }
   // Current limit for how much backed memory we'll cache.
   HugeLength limit() const { return limit_; }
+  // Raises limit() to at least <limit>, such as the limit an earlier process
+  // of the same workload learned.  Like a limit learned from cache misses, it
+  // shrinks again once the cache is consistently too big.
+  void RaiseLimit(HugeLength limit) {
+    if (limit <= limit_) return;
+    limit_ = limit;
+    last_limit_change_ = clock_.now();
+  }
   // Sum total of unreleased requests.
   HugeLength usage() const { return usage_; }
 
@@ -193,9 +339,10 @@ class HugeCache {
 
   BackingStats stats() const {
     BackingStats s;
-    s.system_bytes = (usage() + size()).in_bytes();
-    s.free_bytes = size().in_bytes();
-    s.unmapped_bytes = 0;
+    s.system_bytes =
+        (usage() + size() + cold() + lazily_freed()).in_bytes();
+    s.free_bytes = (size() + cold()).in_bytes();
+    s.unmapped_bytes = lazily_freed().in_bytes();
     return s;
   }
 
@@ -210,11 +357,26 @@ class HugeCache {
   void MaybeGrowCacheLimit(HugeLength missed);
   // Check if the cache seems consistently too big.  Returns the
   // number of pages *evicted* (not the change in limit).
-  HugeLength MaybeShrinkCacheLimit();
+  HugeLength MaybeShrinkCacheLimit(bool demote);
 
   // Ensure the cache contains at most <target> hugepages,
-  // returning the number removed.
-  HugeLength ShrinkCache(HugeLength target);
+  // returning the number removed.  With <demote>, ranges are demoted if
+  // possible, and only those that are unbacked count as removed.  Hugepages
+  // that had nothing resident are removed but not counted.
+  HugeLength ShrinkCache(HugeLength target, bool demote);
+
+  // Unbacks <r> with unback_; returns whether it succeeded.  Sets *resident to
+  // how many hugepages' worth of its pages were resident, rounded up.
+  bool Unback(HugeRange r, HugeLength* resident);
+
+  // Whether periodic release currently demotes rather than unbacks.
+  bool demoting() const {
+    return demote_ != nullptr && cold_interval_ticks_ > 0;
+  }
+
+  // Unbacks the cold ranges that are due, or all of them if demotion is off;
+  // returns the number of resident hugepages unbacked.
+  HugeLength ReleaseColdPages();
 
   // Calculates the desired releasing target according to the recent demand
   // history, returns the updated (reduced) target if releasing the desired
@@ -224,14 +386,63 @@ class HugeCache {
 
   HugeRange DoGet(HugeLength n, bool* from_released);
 
-  HugeAddressMap::Node* Find(HugeLength n);
+  // Releases <release_target> hugepages as part of demand-based release.
+  HugeLength ReleaseCachedPagesForDemand(HugeLength release_target,
+                                         bool hit_limit);
 
-  HugeAddressMap cache_;
+  HugeRangeMap::Node* Find(HugeLength n);
+
+  // Hands <r>, which was just unbacked, to the lazily freed set or the
+  // HugeAllocator.
+  void ReleaseUnbackedRange(HugeRange r);
+
+  HugeRangeMap cache_;
   HugeLength size_{NHugePages(0)};
 
+  // At most 1 GiB of lazily unbacked memory is kept aside.
+  static constexpr HugeLength kMaxLazilyFreed =
+      NHugePages((size_t{1} << 30) / kHugePageSize);
+
+  // The lazily freed set alternates between two maps, so that
+  // ReclaimLazilyFreed can drain one and keep what is still resident in the
+  // other.
+  HugeRangeMap lazy_a_;
+  HugeRangeMap lazy_b_;
+  bool lazy_in_b_{false};
+  HugeRangeMap& lazy() { return lazy_in_b_ ? lazy_b_ : lazy_a_; }
+  const HugeRangeMap& lazy() const { return lazy_in_b_ ? lazy_b_ : lazy_a_; }
+  bool lazy_unback_{false};
+  bool lifo_reuse_{false};
+
+  // Demoted ranges alternate between two generations like the lazily freed
+  // set: ReleaseColdPages unbacks the older one every cold interval, and the
+  // younger one becomes the older one.
+  HugeRangeMap cold_a_;
+  HugeRangeMap cold_b_;
+  bool cold_in_b_{false};
+  HugeRangeMap& young_cold() { return cold_in_b_ ? cold_b_ : cold_a_; }
+  HugeRangeMap& old_cold() { return cold_in_b_ ? cold_a_ : cold_b_; }
+  MemoryModifyFunction* demote_{nullptr};
+  int64_t cold_interval_ticks_{0};
+  int64_t last_cold_flip_{0};
+  HugeLength cold_size_{NHugePages(0)};
+  HugeLength total_demoted_{NHugePages(0)};
+  HugeLength total_cold_reused_{NHugePages(0)};
+  HugeLength total_cold_unbacked_{NHugePages(0)};
+  HugeLength lazy_size_{NHugePages(0)};
+  // Pages of the lazily freed set found resident when last checked.
+  Length lazy_resident_;
+  HugeLength total_lazily_freed_{NHugePages(0)};
+  HugeLength total_lazy_reused_{NHugePages(0)};
+  HugeLength total_lazy_reclaimed_{NHugePages(0)};
+
   HugeLength limit_{NHugePages(10)};
 
+  // Hits reuse backed memory.  Cold hits are misses that reuse lazily
+  // unbacked memory, which faults in again unless the kernel has not
+  // reclaimed it yet.
   size_t hits_{0};
+  size_t cold_hits_{0};
   size_t misses_{0};
   size_t fills_{0};
   size_t overflows_{0};
@@ -263,6 +474,10 @@ class HugeCache {
   MinMaxTracker<> usage_tracker_;
   MinMaxTracker<> off_peak_tracker_;
   MinMaxTracker<> size_tracker_;
+  DemandForecaster forecaster_;
+  // Set once ReleaseCachedPagesByForecast is used, to only report forecasts
+  // then.
+  bool forecast_used_ = false;
 
   HugeLength total_fast_unbacked_{NHugePages(0)};
   HugeLength total_periodic_unbacked_{NHugePages(0)};
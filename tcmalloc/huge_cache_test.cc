@@ -33,6 +33,7 @@
 #include "absl/random/random.h"
 #include "absl/strings/str_cat.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "tcmalloc/huge_page_subrelease.h"
 #include "tcmalloc/huge_pages.h"
 #include "tcmalloc/internal/clock.h"
@@ -68,6 +69,16 @@ class HugeCacheTest
     MOCK_METHOD(bool, Unback, (PageId p, Length len), ());
 
     bool operator()(PageId p, Length len) override { return Unback(p, len); }
+
+    void Batch(absl::Span<MemoryModifyRange> ranges) override {
+      MemoryModifyFunction::Batch(ranges);
+      for (MemoryModifyRange& r : ranges) {
+        r.resident = resident_ ? r.len : Length(0);
+      }
+    }
+
+    // Whether unbacked ranges had their pages resident.
+    bool resident_ = true;
   };
 
  protected:
@@ -209,6 +220,23 @@ TEST_P(HugeCacheTest, ReleaseFailure) {
   EXPECT_EQ(NHugePages(0), cache_.ReleaseCachedPages(NHugePages(200)));
 }
 
+TEST_P(HugeCacheTest, ReleaseCountsResidentPages) {
+  EXPECT_CALL(mock_unback_, Unback(testing::_, testing::_))
+      .WillRepeatedly(Return(true));
+  bool from;
+  HugeRange r1 = cache_.Get(NHugePages(2), &from);
+  HugeRange r2 = cache_.Get(NHugePages(2), &from);
+  Release(r1);
+  Release(r2);
+  ASSERT_EQ(cache_.size(), NHugePages(4));
+
+  // Hugepages with nothing resident free no memory, so the cache keeps
+  // releasing past them.
+  mock_unback_.resident_ = false;
+  EXPECT_EQ(cache_.ReleaseCachedPages(NHugePages(1)), NHugePages(0));
+  EXPECT_EQ(cache_.size(), NHugePages(0));
+}
+
 TEST_P(HugeCacheTest, Stats) {
   bool from;
   HugeRange r = cache_.Get(NHugePages(1 + 1 + 2 + 1 + 3), &from);
@@ -1004,6 +1032,265 @@ TEST_F(MinMaxTrackerTest, Works) {
   EXPECT_EQ(NHugePages(1), tracker.MinOverTime(kDuration));
 }
 
+class DemandForecasterTest : public testing::Test {
+ protected:
+  static constexpr absl::Duration kPeriod = absl::Hours(24);
+  const absl::Duration kSlot = kPeriod / DemandForecaster::kSlots;
+
+  void Advance(absl::Duration d) {
+    clock_ += absl::ToDoubleSeconds(d) * GetFakeClockFrequency();
+  }
+
+  static int64_t FakeClock() { return clock_; }
+
+  static double GetFakeClockFrequency() {
+    return absl::ToDoubleNanoseconds(absl::Seconds(2));
+  }
+
+  DemandForecaster forecaster_{
+      Clock{.now = FakeClock, .freq = GetFakeClockFrequency}, kPeriod};
+
+ private:
+  static int64_t clock_;
+};
+
+int64_t DemandForecasterTest::clock_{0};
+
+TEST_F(DemandForecasterTest, FollowsRecentPeaks) {
+  forecaster_.Report(NHugePages(100));
+  EXPECT_EQ(forecaster_.Forecast(), NHugePages(100));
+  forecaster_.Report(NHugePages(0));
+  EXPECT_EQ(forecaster_.Forecast(), NHugePages(100));
+
+  // Without a full period of history, the forecast decays from past peaks.
+  Advance(kSlot);
+  forecaster_.Report(NHugePages(0));
+  EXPECT_EQ(forecaster_.Forecast(), NHugePages(50));
+  Advance(kSlot);
+  forecaster_.Report(NHugePages(0));
+  EXPECT_EQ(forecaster_.Forecast(), NHugePages(25));
+  // Slots without reports count as idle.
+  Advance(2 * kSlot);
+  forecaster_.Report(NHugePages(1));
+  EXPECT_EQ(forecaster_.Forecast(), NHugePages(7));
+}
+
+TEST_F(DemandForecasterTest, AnticipatesDailyPeaks) {
+  constexpr size_t kPeakSlot = 40;
+  for (size_t i = 0; i < DemandForecaster::kSlots; ++i) {
+    forecaster_.Report(NHugePages(i == kPeakSlot ? 100 : 10));
+    Advance(kSlot);
+  }
+
+  for (size_t i = 0; i < DemandForecaster::kSlots; ++i) {
+    forecaster_.Report(NHugePages(10));
+    if (i == kPeakSlot - 1 || i == kPeakSlot) {
+      // The peak is about to start, or has started.
+      EXPECT_EQ(forecaster_.Forecast(), NHugePages(100)) << i;
+    } else {
+      EXPECT_EQ(forecaster_.Forecast(), NHugePages(10)) << i;
+    }
+    Advance(kSlot);
+  }
+}
+
+TEST_P(HugeCacheTest, ReleaseByForecast) {
+  if (!GetDemandBasedRelease()) {
+    GTEST_SKIP();
+  }
+  EXPECT_CALL(mock_unback_, Unback(testing::_, testing::_))
+      .WillRepeatedly(Return(true));
+  const absl::Duration kSlot = absl::Hours(24) / DemandForecaster::kSlots;
+  bool released;
+  HugeRange r = cache_.Get(NHugePages(100), &released);
+  Release(r);
+  EXPECT_EQ(cache_.size(), NHugePages(100));
+
+  // The demand has just peaked, so the cache is kept.
+  EXPECT_EQ(cache_.ReleaseCachedPagesByForecast(), NHugePages(0));
+
+  // The forecast decays, and the cache follows it.
+  Advance(kSlot);
+  EXPECT_EQ(cache_.ReleaseCachedPagesByForecast(), NHugePages(50));
+  EXPECT_EQ(cache_.forecast(), NHugePages(50));
+  Advance(kSlot);
+  EXPECT_EQ(cache_.ReleaseCachedPagesByForecast(), NHugePages(25));
+
+  // The minimum cache size is kept regardless.
+  Advance(10 * kSlot);
+  EXPECT_EQ(cache_.ReleaseCachedPagesByForecast(), NHugePages(15));
+  EXPECT_EQ(cache_.size(), NHugePages(10));
+
+  std::string buffer(1024 * 1024, '\0');
+  {
+    Printer printer(&*buffer.begin(), buffer.size());
+    cache_.Print(&printer);
+  }
+  buffer.resize(strlen(buffer.c_str()));
+  EXPECT_THAT(buffer, testing::HasSubstr("HugeCache: demand forecast"));
+}
+
+TEST_P(HugeCacheTest, LazyUnbackReuse) {
+  EXPECT_CALL(mock_unback_, Unback(testing::_, testing::_))
+      .WillRepeatedly(Return(true));
+  cache_.set_lazy_unback(true);
+  bool from;
+  HugeRange r = cache_.Get(NHugePages(4), &from);
+  EXPECT_TRUE(from);
+  Release(r);
+  EXPECT_EQ(cache_.ReleaseCachedPages(NHugePages(4)), NHugePages(4));
+  EXPECT_EQ(cache_.size(), NHugePages(0));
+  EXPECT_EQ(cache_.lazily_freed(), NHugePages(4));
+  EXPECT_EQ(cache_.stats().unmapped_bytes, NHugePages(4).in_bytes());
+
+  // Misses are served from lazily freed memory before fresh memory.
+  HugeRange r1 = cache_.Get(NHugePages(1), &from);
+  EXPECT_TRUE(from);
+  EXPECT_TRUE(r.contains(r1));
+  EXPECT_EQ(cache_.lazily_freed(), NHugePages(3));
+  Release(r1);
+  EXPECT_EQ(cache_.ReleaseCachedPages(NHugePages(1)), NHugePages(1));
+  EXPECT_EQ(cache_.lazily_freed(), NHugePages(4));
+
+  // The kernel reclaimed all but the first hugepage, so only it is kept.
+  EXPECT_EQ(cache_.ReclaimLazilyFreed([&](HugeRange q) {
+    return q.start() == r.start() ? Length(7) : Length(0);
+  }),
+            NHugePages(3));
+  EXPECT_EQ(cache_.lazily_freed(), NHugePages(1));
+  r1 = cache_.Get(NHugePages(1), &from);
+  EXPECT_TRUE(from);
+  EXPECT_EQ(r1.start(), r.start());
+  EXPECT_EQ(cache_.lazily_freed(), NHugePages(0));
+
+  std::string buffer(1024 * 1024, '\0');
+  {
+    Printer printer(&*buffer.begin(), buffer.size());
+    cache_.Print(&printer);
+  }
+  buffer.resize(strlen(buffer.c_str()));
+  EXPECT_THAT(buffer,
+              testing::HasSubstr(absl::StrCat(
+                  "since startup, ", NHugePages(5).in_mib(),
+                  " MiB lazily freed, ", NHugePages(2).in_mib(),
+                  " MiB reused, ", NHugePages(3).in_mib(),
+                  " MiB reclaimed by the kernel")));
+  Release(r1);
+}
+
+TEST_P(HugeCacheTest, LifoReuse) {
+  bool from;
+  // Hold a hugepage after each range, so that they are not merged.
+  HugeRange a = cache_.Get(NHugePages(2), &from);
+  HugeRange spacer_a = cache_.Get(NHugePages(1), &from);
+  HugeRange b = cache_.Get(NHugePages(1), &from);
+  HugeRange spacer_b = cache_.Get(NHugePages(1), &from);
+  Release(b);
+  Release(a);
+
+  // LIFO reuses a, released after b, until it runs out.
+  cache_.set_lifo_reuse(true);
+  HugeRange r = cache_.Get(NHugePages(1), &from);
+  EXPECT_FALSE(from);
+  EXPECT_TRUE(a.contains(r));
+  Release(r);
+  r = cache_.Get(NHugePages(2), &from);
+  EXPECT_FALSE(from);
+  EXPECT_EQ(r, a);
+  HugeRange r2 = cache_.Get(NHugePages(1), &from);
+  EXPECT_FALSE(from);
+  EXPECT_EQ(r2, b);
+
+  // Best fit reuses b, although a was released after it.
+  cache_.set_lifo_reuse(false);
+  Release(r2);
+  Release(r);
+  r2 = cache_.Get(NHugePages(1), &from);
+  EXPECT_FALSE(from);
+  EXPECT_EQ(r2, b);
+  r = cache_.Get(NHugePages(2), &from);
+  EXPECT_FALSE(from);
+
+  std::string buffer(1024 * 1024, '\0');
+  {
+    Printer printer(&*buffer.begin(), buffer.size());
+    cache_.Print(&printer);
+  }
+  buffer.resize(strlen(buffer.c_str()));
+  EXPECT_THAT(buffer,
+              testing::HasSubstr("HugeCache: 5 warm hits (backed), 0 cold hits "
+                                 "(lazily unbacked), 4 misses (1.000 warm "
+                                 "ratio, best-fit reuse)"));
+  Release(r);
+  Release(r2);
+  Release(spacer_a);
+  Release(spacer_b);
+}
+
+TEST_P(HugeCacheTest, DemoteCold) {
+  class CountingDemote : public MemoryModifyFunction {
+   public:
+    bool operator()(PageId p, Length len) override {
+      demoted += len;
+      return true;
+    }
+
+    Length demoted;
+  };
+
+  EXPECT_CALL(mock_unback_, Unback(testing::_, testing::_))
+      .WillRepeatedly(Return(true));
+  CountingDemote demote;
+  cache_.set_demotion(&demote, absl::Seconds(10));
+  bool from;
+  HugeRange r = cache_.Get(NHugePages(4), &from);
+  EXPECT_TRUE(from);
+  Release(r);
+
+  // Release demotes the cached hugepages instead of unbacking them.
+  EXPECT_EQ(cache_.ReleaseCachedPages(NHugePages(4)), NHugePages(0));
+  EXPECT_EQ(demote.demoted, NHugePages(4).in_pages());
+  EXPECT_EQ(cache_.size(), NHugePages(0));
+  EXPECT_EQ(cache_.cold(), NHugePages(4));
+  EXPECT_EQ(cache_.stats().free_bytes, NHugePages(4).in_bytes());
+  EXPECT_EQ(cache_.stats().unmapped_bytes, 0);
+
+  // Misses reuse them while they are still backed.
+  HugeRange r1 = cache_.Get(NHugePages(1), &from);
+  EXPECT_FALSE(from);
+  EXPECT_TRUE(r.contains(r1));
+  EXPECT_EQ(cache_.cold(), NHugePages(3));
+
+  // They are unbacked once they have been cold for a full interval.
+  Advance(absl::Seconds(10));
+  EXPECT_EQ(cache_.ReleaseCachedPages(NHugePages(0)), NHugePages(0));
+  EXPECT_EQ(cache_.cold(), NHugePages(3));
+  Advance(absl::Seconds(10));
+  EXPECT_EQ(cache_.ReleaseCachedPages(NHugePages(0)), NHugePages(3));
+  EXPECT_EQ(cache_.cold(), NHugePages(0));
+
+  // Without demotion, release unbacks cold hugepages right away.
+  Release(r1);
+  EXPECT_EQ(cache_.ReleaseCachedPages(NHugePages(1)), NHugePages(0));
+  EXPECT_EQ(cache_.cold(), NHugePages(1));
+  cache_.set_demotion(nullptr, absl::Seconds(10));
+  EXPECT_EQ(cache_.ReleaseCachedPages(NHugePages(0)), NHugePages(1));
+  EXPECT_EQ(cache_.cold(), NHugePages(0));
+
+  std::string buffer(1024 * 1024, '\0');
+  {
+    Printer printer(&*buffer.begin(), buffer.size());
+    cache_.Print(&printer);
+  }
+  buffer.resize(strlen(buffer.c_str()));
+  EXPECT_THAT(buffer, testing::HasSubstr(absl::StrCat(
+                          "HugeCache: 0 MiB demoted to cold; since startup, ",
+                          NHugePages(5).in_mib(), " MiB demoted, ",
+                          NHugePages(1).in_mib(), " MiB reused, ",
+                          NHugePages(4).in_mib(),
+                          " MiB released after staying cold")));
+}
+
 INSTANTIATE_TEST_SUITE_P(
     All, HugeCacheTest,
     testing::Combine(testing::Values(absl::Seconds(1), absl::Seconds(30)),
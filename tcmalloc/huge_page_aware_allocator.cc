@@ -14,7 +14,12 @@
 
 #include "tcmalloc/huge_page_aware_allocator.h"
 
+#include <algorithm>
+#include <optional>
+
 #include "absl/base/attributes.h"
+#include "absl/status/status.h"
+#include "absl/types/span.h"
 #include "tcmalloc/arena.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/huge_pages.h"
@@ -22,6 +27,9 @@
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/mincore.h"
+#include "tcmalloc/internal/pageflags.h"
+#include "tcmalloc/internal/residency.h"
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/pages.h"
 #include "tcmalloc/span.h"
@@ -125,7 +133,9 @@ HugeRegionUsageOption huge_region_option() {
              : HugeRegionUsageOption::kDefault;
 }
 
-Arena& StaticForwarder::arena() { return tc_globals.arena(); }
+Arena& StaticForwarder::arena(MemoryTag tag) {
+  return tc_globals.metadata_arena(tag);
+}
 
 void* StaticForwarder::GetHugepage(HugePage p) {
   return tc_globals.pagemap().GetHugepage(p.first_page());
@@ -154,6 +164,55 @@ Span* StaticForwarder::NewSpan(PageId page, Length length) {
 
 void StaticForwarder::DeleteSpan(Span* span) { Span::Delete(span); }
 
+HugeLength StaticForwarder::CountSmallPageBacked(
+    absl::Span<const HugePage> hugepages, HugeLength* unknown) {
+  HugeLength small_page_backed;
+  *unknown = NHugePages(0);
+  PageFlags pageflags;
+  for (size_t i = 0; i < hugepages.size(); ++i) {
+    const PageFlags::HoleInfo info =
+        pageflags.CountHolesInSinglePage(hugepages[i].start_addr());
+    if (info.status != absl::StatusCode::kOk) {
+      // Page flags are most likely unavailable altogether, so do not keep
+      // trying (and logging) for the rest of the sample.
+      *unknown += NHugePages(hugepages.size() - i);
+      break;
+    }
+    if (!info.already_hugepage) {
+      ++small_page_backed;
+    }
+  }
+  return small_page_backed;
+}
+
+Length StaticForwarder::ResidentPages(PageId start, Length size) {
+  return BytesToLengthFloor(
+      MInCore::residence(start.start_addr(), size.in_bytes()));
+}
+
+void StaticForwarder::ReleaseResidentPages(
+    absl::Span<MemoryModifyRange> ranges) {
+  // Unlike mincore, pagemap tells swapped out pages apart from those that were
+  // never faulted in or were reclaimed.  Swapped out pages must still be
+  // released, so that they read as zero and free their swap space.
+  Residency residency;
+  for (MemoryModifyRange& r : ranges) {
+    std::optional<Residency::Info> info =
+        residency.Get(r.start.start_addr(), r.len.in_bytes());
+    if (!info.has_value()) {
+      r.resident = r.len;
+      r.success = ReleasePages(r.start, r.len);
+      continue;
+    }
+    r.resident = std::min(BytesToLengthCeil(info->bytes_resident), r.len);
+    if (info->bytes_resident == 0 && info->bytes_swapped == 0) {
+      r.success = true;
+      continue;
+    }
+    r.success = ReleasePages(r.start, r.len);
+  }
+}
+
 }  // namespace huge_page_allocator_internal
 
 }  // namespace tcmalloc_internal
@@ -17,11 +17,15 @@
 
 #include <stddef.h>
 
+#include <algorithm>
+#include <optional>
+
 #include "absl/base/attributes.h"
 #include "absl/base/internal/cycleclock.h"
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "tcmalloc/arena.h"
 #include "tcmalloc/central_freelist.h"
 #include "tcmalloc/common.h"
@@ -32,9 +36,12 @@
 #include "tcmalloc/huge_pages.h"
 #include "tcmalloc/huge_region.h"
 #include "tcmalloc/internal/allocation_guard.h"
+#include "tcmalloc/internal/clock.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/prefetch.h"
+#include "tcmalloc/internal/transparent_hugepage.h"
+#include "tcmalloc/lifetime_predictions.h"
 #include "tcmalloc/metadata_allocator.h"
 #include "tcmalloc/page_allocator_interface.h"
 #include "tcmalloc/page_heap_allocator.h"
@@ -47,6 +54,72 @@
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
+
+// How the kernel actually backs the hugepages that the hugepage-aware
+// allocator believes to be intact, i.e. backed and not subreleased since.
+// Only a sample of the intact hugepages is checked.
+struct HugePageBackingStats {
+  // Intact hugepages, when last sampled.
+  HugeLength intact;
+  // Intact hugepages whose backing was checked.
+  HugeLength sampled;
+  // Sampled hugepages that are mapped with small pages rather than a THP.
+  HugeLength small_page_backed;
+  // Sampled hugepages whose backing could not be determined, for example
+  // because /proc/self/pageflags is not available.
+  HugeLength unknown;
+
+  // Estimates the intact bytes that are mapped with small pages, from the
+  // sampled hugepages whose backing is known.
+  size_t EstimatedSmallPageBackedBytes() const {
+    const size_t known = (sampled - unknown).raw_num();
+    if (known == 0) return 0;
+    return static_cast<size_t>(static_cast<double>(intact.in_bytes()) *
+                               small_page_backed.raw_num() / known);
+  }
+
+  HugePageBackingStats& operator+=(const HugePageBackingStats& other) {
+    intact += other.intact;
+    sampled += other.sampled;
+    small_page_backed += other.small_page_backed;
+    unknown += other.unknown;
+    return *this;
+  }
+};
+
+// How the filler hugepages donated from the tails of large allocations are
+// used.
+struct DonatedTailStats {
+  // Donated hugepages still in the filler.
+  HugeLength tails;
+  // Tails that hold nothing but their owner.
+  HugeLength untouched;
+  // Tails whose owner has been freed, but that are kept by other spans.
+  HugeLength abandoned;
+  // Pages in use on the tails, by their owners and by other spans.
+  Length used_pages;
+  // Pages in use on the tails by spans other than their owners.
+  Length other_pages;
+
+  // Returns the fraction of the tails' pages that are in use.
+  double utilization() const {
+    if (tails == NHugePages(0)) return 0;
+    return static_cast<double>(used_pages.raw_num()) /
+           tails.in_pages().raw_num();
+  }
+};
+
+// How allocations aligned to more than a page were placed.
+struct AlignedAllocStats {
+  // Allocations with an alignment above a page.
+  size_t allocs = 0;
+  // Those placed at an aligned free range of a region.
+  size_t region_allocs = 0;
+  // Hugepages taken beyond allocations aligned to more than a hugepage to
+  // align them, all of which were returned to the cache.
+  HugeLength slop;
+};
+
 namespace huge_page_allocator_internal {
 
 // TODO(b/137017688):  Constant propagate.
@@ -87,11 +160,50 @@ class StaticForwarder {
   static bool huge_cache_demand_based_release() {
     return Parameters::huge_cache_demand_based_release();
   }
+  static bool huge_cache_forecast() {
+    return Parameters::huge_cache_forecast();
+  }
+  static bool huge_cache_lifo_reuse() {
+    return Parameters::huge_cache_lifo_reuse();
+  }
+  static absl::Duration huge_cache_cold_interval() {
+    return Parameters::huge_cache_cold_interval();
+  }
+  static bool hugepage_granular_release() {
+    return Parameters::hugepage_granular_release();
+  }
+  static bool residency_aware_release() {
+    return Parameters::residency_aware_release();
+  }
+
+  static uint32_t skip_subrelease_target_refault_percent() {
+    return Parameters::skip_subrelease_target_refault_percent();
+  }
+
+  static bool donated_tail_packing() {
+    return Parameters::donated_tail_packing();
+  }
+
+  static bool large_huge_regions() { return Parameters::large_huge_regions(); }
 
   static bool hpaa_subrelease() { return Parameters::hpaa_subrelease(); }
 
-  // Arena state.
-  static Arena& arena();
+  // Whether the kernel may back memory with hugepages at all.
+  static bool hugepages_available() { return GetThpSettings().available(); }
+
+  static bool lifetime_based_allocation() {
+    return Parameters::lifetime_based_allocation();
+  }
+
+  static bool gigantic_pages() { return Parameters::gigantic_pages(); }
+
+  static bool exclude_free_from_core_dumps() {
+    return Parameters::exclude_free_from_core_dumps();
+  }
+
+  // Arena state.  Metadata for memory with <tag> comes from the arena of its
+  // NUMA partition.
+  static Arena& arena(MemoryTag tag);
 
   // PageAllocator state.
 
@@ -122,6 +234,36 @@ class StaticForwarder {
   static bool ReleasePages(PageId start, Length size) {
     return SystemRelease(start.start_addr(), size.in_bytes());
   }
+  static void PopulatePages(PageId start, Length size) {
+    SystemPopulate(start.start_addr(), size.in_bytes());
+  }
+  static bool ReleasedPagesAreZero() { return SystemReleaseZeroes(); }
+  static bool ReleasedPagesAreLazy() { return SystemReleaseIsLazy(); }
+  // Returns how many pages of [start, start + size) are resident.
+  static Length ResidentPages(PageId start, Length size);
+  // Releases each of ranges like ReleasePages, except for those with no pages
+  // resident or swapped out, which releasing would not change; these succeed
+  // without a syscall.  Sets the resident field of each range.
+  static void ReleaseResidentPages(absl::Span<MemoryModifyRange> ranges);
+  static void BackGiganticPages(PageId start, Length size) {
+    (void)SystemBackGigantic(start.start_addr(), size.in_bytes());
+  }
+  static size_t GiganticPageBytes() { return SystemGiganticBytes(); }
+  static bool CollapsePages(PageId start, Length size) {
+    return SystemCollapse(start.start_addr(), size.in_bytes());
+  }
+  static void SetPagesDumpable(PageId start, Length size, bool dumpable) {
+    (void)SystemSetDumpable(start.start_addr(), size.in_bytes(), dumpable);
+  }
+  static bool DemotePages(PageId start, Length size) {
+    return SystemAdviseCold(start.start_addr(), size.in_bytes());
+  }
+
+  // Checks the kernel page flags of <hugepages>.  Returns how many of them are
+  // mapped with small pages, and sets *unknown to how many could not be
+  // checked.
+  static HugeLength CountSmallPageBacked(absl::Span<const HugePage> hugepages,
+                                         HugeLength* unknown);
 };
 
 struct HugePageAwareAllocatorOptions {
@@ -132,6 +274,10 @@ struct HugePageAwareAllocatorOptions {
           ? HugePageFillerDenseTrackerType::kSpansAllocated
           : HugePageFillerDenseTrackerType::kLongestFreeRangeAndChunks;
   absl::Duration huge_cache_time = Parameters::huge_cache_release_time();
+  // The time base of the allocator's trackers.  Simulations substitute a fake
+  // clock to replay hours of activity in seconds.
+  Clock clock = {.now = absl::base_internal::CycleClock::Now,
+                 .freq = absl::base_internal::CycleClock::Frequency};
 };
 
 // An implementation of the PageAllocator interface that is hugepage-efficient.
@@ -194,6 +340,32 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
   PageReleaseStats GetReleaseStats() const
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override;
 
+  // Takes whole, hugepage-aligned ranges straight from the HugeAllocator and
+  // seeds the HugeCache with them, optionally faulting them in first.  The
+  // range is populated without holding pageheap_lock.
+  Length Reserve(Length n, bool populate)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock) override;
+
+  // Collapses up to <max> filler hugepages that were subreleased and have
+  // since been fully backed again back to hugepage mappings, rather than
+  // waiting for khugepaged.  Returns the number of hugepages attempted.
+  HugeLength CollapseHugepages(HugeLength max)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Checks how up to <max> of the hugepages that the filler and regions
+  // believe to be intact are actually backed by the kernel.  The sample is
+  // spread across all intact hugepages and rotates between calls.  Page flags
+  // are read without holding pageheap_lock.  Returns the number of hugepages
+  // checked.
+  HugeLength SampleHugepageBacking(HugeLength max)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Result of the last SampleHugepageBacking.
+  HugePageBackingStats GetHugepageBackingStats() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return backing_stats_;
+  }
+
   // Prints stats about the page heap to *out.
   void Print(Printer* out) ABSL_LOCKS_EXCLUDED(pageheap_lock) override;
 
@@ -206,7 +378,15 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
 
   BackingStats FillerStats() const
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
-    return filler_.stats();
+    return filler_.stats() + short_lived_filler_.stats();
+  }
+
+  // Pages in use on filler hugepages that have been subreleased, and so are
+  // no longer backed by a hugepage.
+  Length FillerUsedPagesInSubreleased() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return filler_.used_pages_in_any_subreleased() +
+           short_lived_filler_.used_pages_in_any_subreleased();
   }
 
   BackingStats RegionsStats() const
@@ -230,13 +410,43 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
     return abandoned_pages_;
   }
 
+  DonatedTailStats GetDonatedTailStats()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  AlignedAllocStats GetAlignedAllocStats() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return aligned_stats_;
+  }
+
   const HugeCache* cache() const { return &cache_; }
 
+  void RaiseHugeCacheLimit(HugeLength limit)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    cache_.RaiseLimit(limit);
+  }
+
   const HugeRegionSet<HugeRegion>& region() const
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
     return regions_;
   };
 
+  // The regions that hold large allocations predicted to be short-lived.
+  const HugeRegionSet<HugeRegion>& lifetime_region() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return lifetime_regions_;
+  }
+
+  // The regions that hold multi-MiB allocations with large_huge_regions.
+  const HugeRegionSet<LargeHugeRegion>& large_region() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return large_regions_;
+  }
+
+  const LifetimePredictor& lifetime_predictor() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return lifetime_;
+  }
+
   // IsValidSizeClass verifies size class parameters from the HPAA perspective.
   static bool IsValidSizeClass(size_t size, size_t pages);
 
@@ -279,15 +489,87 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
       return ret;
     }
 
+    void Batch(absl::Span<MemoryModifyRange> ranges) override
+        ABSL_NO_THREAD_SAFETY_ANALYSIS {
+#ifndef NDEBUG
+      pageheap_lock.AssertHeld();
+#endif  // NDEBUG
+      pageheap_lock.Unlock();
+      if (hpaa_.forwarder_.residency_aware_release()) {
+        hpaa_.forwarder_.ReleaseResidentPages(ranges);
+      } else {
+        for (MemoryModifyRange& r : ranges) {
+          r.success = hpaa_.forwarder_.ReleasePages(r.start, r.len);
+          r.resident = r.len;
+        }
+      }
+      pageheap_lock.Lock();
+    }
+
+   public:
+    HugePageAwareAllocator& hpaa_;
+  };
+
+  // Marks cached hugepages cold, dropping pageheap_lock like
+  // UnbackWithoutLock.
+  class DemoteWithoutLock final : public MemoryModifyFunction {
+   public:
+    explicit DemoteWithoutLock(
+        HugePageAwareAllocator& hpaa ABSL_ATTRIBUTE_LIFETIME_BOUND)
+        : hpaa_(hpaa) {}
+
+    ABSL_MUST_USE_RESULT bool operator()(PageId start, Length length) override
+        ABSL_NO_THREAD_SAFETY_ANALYSIS {
+#ifndef NDEBUG
+      pageheap_lock.AssertHeld();
+#endif  // NDEBUG
+      pageheap_lock.Unlock();
+      bool ret = hpaa_.forwarder_.DemotePages(start, length);
+      pageheap_lock.Lock();
+      return ret;
+    }
+
    public:
     HugePageAwareAllocator& hpaa_;
   };
 
   Unback unback_ ABSL_GUARDED_BY(pageheap_lock);
   UnbackWithoutLock unback_without_lock_ ABSL_GUARDED_BY(pageheap_lock);
+  DemoteWithoutLock demote_without_lock_ ABSL_GUARDED_BY(pageheap_lock);
 
   typedef HugePageFiller<PageTracker> FillerType;
   FillerType filler_ ABSL_GUARDED_BY(pageheap_lock);
+  // Hugepages holding spans with a SpanLifetime::kShortLived hint.  Keeping
+  // them apart from filler_ lets them empty out, and be released whole,
+  // instead of being pinned by the long-lived spans sharing them.
+  FillerType short_lived_filler_ ABSL_GUARDED_BY(pageheap_lock);
+
+  FillerType& FillerFor(SpanAllocInfo span_alloc_info)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return span_alloc_info.lifetime == SpanLifetime::kShortLived
+               ? short_lived_filler_
+               : filler_;
+  }
+
+  FillerType& FillerFor(const FillerType::Tracker* pt)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return pt->short_lived() ? short_lived_filler_ : filler_;
+  }
+
+  // Tries to place a span on an existing filler hugepage.  With
+  // donated_tail_packing, short-lived spans go onto donated tails first; they
+  // are likely to be freed around the time of the owner of the tail.
+  FillerType::TryGetResult TryGetFromFiller(Length n,
+                                            SpanAllocInfo span_alloc_info)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    if (span_alloc_info.lifetime == SpanLifetime::kShortLived &&
+        span_alloc_info.density == AccessDensityPrediction::kSparse &&
+        forwarder_.donated_tail_packing()) {
+      auto result = filler_.TryGetDonated(n);
+      if (result.pt != nullptr) return result;
+    }
+    return FillerFor(span_alloc_info).TryGet(n, span_alloc_info);
+  }
 
   class VirtualMemoryAllocator final : public VirtualAllocator {
    public:
@@ -313,7 +595,7 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
 
     ABSL_MUST_USE_RESULT void* operator()(size_t bytes) override
         ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
-      return hpaa_.forwarder_.arena().Alloc(bytes);
+      return hpaa_.forwarder_.arena(hpaa_.tag_).Alloc(bytes);
     }
 
    public:
@@ -322,10 +604,27 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
 
   HugeRegionSet<HugeRegion> regions_ ABSL_GUARDED_BY(pageheap_lock);
 
+  // With lifetime-based allocation, large allocations from stacks whose
+  // allocations tend to be freed quickly are kept out of the filler, so that
+  // the long-lived small allocations packed onto their donated slack do not
+  // pin otherwise free hugepages.  They get their own regions, so that they do
+  // not share hugepages with regular large allocations either.
+  HugeRegionSet<HugeRegion> lifetime_regions_ ABSL_GUARDED_BY(pageheap_lock);
+  LifetimePredictor lifetime_ ABSL_GUARDED_BY(pageheap_lock);
+
+  // With large_huge_regions, multi-MiB allocations are best-fit into larger
+  // regions of their own.  Otherwise, each takes a run of hugepages from the
+  // cache and donates its tail to the filler, or shares regions_ with the
+  // allocations of a few MiB that fill most of their space.
+  HugeRegionSet<LargeHugeRegion> large_regions_
+      ABSL_GUARDED_BY(pageheap_lock);
+
   PageHeapAllocator<FillerType::Tracker> tracker_allocator_
       ABSL_GUARDED_BY(pageheap_lock);
   PageHeapAllocator<HugeRegion> region_allocator_
       ABSL_GUARDED_BY(pageheap_lock);
+  PageHeapAllocator<LargeHugeRegion> large_region_allocator_
+      ABSL_GUARDED_BY(pageheap_lock);
 
   FillerType::Tracker* GetTracker(HugePage p);
 
@@ -350,6 +649,26 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
   // reassembled.
   Length abandoned_pages_ ABSL_GUARDED_BY(pageheap_lock);
 
+  AlignedAllocStats aligned_stats_ ABSL_GUARDED_BY(pageheap_lock);
+
+  // Result of the last SampleHugepageBacking, and the offset into the intact
+  // hugepages at which the next sample starts.
+  HugePageBackingStats backing_stats_ ABSL_GUARDED_BY(pageheap_lock);
+  size_t backing_sample_offset_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+
+  // Set once a range has been excluded from core dumps.  From then on, every
+  // range taken from cache_ is included in them again, as it may have been
+  // excluded before the parameter was turned off, or before it was unbacked
+  // and handed back to alloc_.
+  bool dumps_excluded_ ABSL_GUARDED_BY(pageheap_lock) = false;
+
+  // Caches <r>, which is backed, in cache_, excluding it from core dumps first
+  // if that is enabled.
+  void ReleaseToCache(HugeRange r) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // Takes <n> hugepages from cache_, as HugeCache::Get.
+  HugeRange GetFromCache(HugeLength n, bool* from_released)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   void GetSpanStats(SmallSpanStats* small, LargeSpanStats* large)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
@@ -366,12 +685,40 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
   // Helpers for New().
 
   Span* LockAndAlloc(Length n, SpanAllocInfo span_alloc_info,
-                     bool* from_released);
+                     std::optional<uint64_t> stack_hash, bool* from_released);
+
+  // Whether the lifetime of an allocation of <n> pages is predicted and
+  // tracked: these are the large allocations that would donate their slack to
+  // the filler.
+  static bool TracksLifetime(Length n) {
+    return n > kSmallAllocPages && n <= HugeRegion::size().in_pages() &&
+           HLFromPages(n).in_pages() != n;
+  }
+
+  // How many allocations of the largest size for large_regions_ fit in one of
+  // them.
+  static constexpr size_t kLargeRegionAllocs = 64;
+
+  // Whether a large allocation of <n> pages, not a multiple of the hugepage
+  // size, goes to large_regions_ when they are enabled.
+  static bool UsesLargeRegions(Length n) {
+    return n > kPagesPerHugePage &&
+           n <= LargeHugeRegion::size().in_pages() / kLargeRegionAllocs;
+  }
 
   Span* AllocSmall(Length n, SpanAllocInfo span_alloc_info, bool* from_released)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
   Span* AllocLarge(Length n, SpanAllocInfo span_alloc_info, bool* from_released)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // As AllocLarge, but allocations from <stack_hash> that are predicted to be
+  // short-lived are placed in lifetime_regions_.
+  Span* AllocLargeWithLifetime(Length n, SpanAllocInfo span_alloc_info,
+                               uint64_t stack_hash, bool* from_released)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // Places a short-lived allocation of <n> pages in lifetime_regions_, or
+  // returns nullptr if they have no room and none can be added.
+  Span* AllocShortLived(Length n, bool* from_released)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
   Span* AllocEnormous(Length n, SpanAllocInfo span_alloc_info,
                       bool* from_released)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
@@ -379,8 +726,24 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
   Span* AllocRawHugepages(Length n, SpanAllocInfo span_alloc_info,
                           bool* from_released)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // Allocates <n> pages from the start of <r>, which covers them, donating
+  // the slack of its last hugepage to the filler.
+  Span* AllocFromHugepages(HugeRange r, Length n, SpanAllocInfo span_alloc_info,
+                           bool from_released)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // Allocates <n> pages aligned to <align> pages, for NewAligned.
+  Span* AllocAligned(Length n, Length align, SpanAllocInfo span_alloc_info,
+                     bool* from_released)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
-  bool AddRegion() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  bool AddRegion(HugeRegionSet<HugeRegion>& regions)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return AddRegion(regions, region_allocator_);
+  }
+  template <typename Region>
+  bool AddRegion(HugeRegionSet<Region>& regions,
+                 PageHeapAllocator<Region>& allocator)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   void ReleaseHugepage(FillerType::Tracker* pt)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
@@ -388,15 +751,34 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
   void DeleteFromHugepage(FillerType::Tracker* pt, PageId p, Length n,
                           bool might_abandon)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // Returns a hugepage that the filler reported as empty.
+  void ReleaseEmptyFillerHugepage(FillerType::Tracker* pt)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // Releases the hugepages that became empty while filler_ was releasing
+  // memory without pageheap_lock.
+  void ReleaseFillerHugepagesEmptiedByRelease()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   // Finish an allocation request - give it a span and mark it in the pagemap.
   Span* Finalize(Length n, PageId page);
 
+  // Backs a span made of released memory, ahead of its first use.
+  void BackFreshSpan(Span* span) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
   // Whether this HPAA should use subrelease. This delegates to the appropriate
   // parameter depending whether this is for the cold heap or another heap.
   bool hpaa_subrelease() const;
 
+  // The skip-subrelease intervals, and whether to subrelease partially
+  // allocated hugepages, for filler releases.  Cold memory is rarely accessed,
+  // so its TLB coverage matters little: the cold heap releases its free
+  // filler pages eagerly, regardless of recent demand, which keeps cold data
+  // packed on fewer backed hugepages.
+  SkipSubreleaseIntervals filler_skip_subrelease_intervals();
+  bool release_partial_alloc_pages() const;
+
   ABSL_ATTRIBUTE_NO_UNIQUE_ADDRESS Forwarder forwarder_;
+  Clock clock_;
 };
 
 template <class Forwarder>
@@ -405,15 +787,25 @@ inline HugePageAwareAllocator<Forwarder>::HugePageAwareAllocator(
     : PageAllocatorInterface("HugePageAware", options.tag),
       unback_(*this),
       unback_without_lock_(*this),
-      filler_(options.dense_tracker_type, unback_, unback_without_lock_),
-      regions_(options.use_huge_region_more_often),
+      demote_without_lock_(*this),
+      filler_(options.clock, options.dense_tracker_type, unback_,
+              unback_without_lock_),
+      short_lived_filler_(options.clock, options.dense_tracker_type, unback_,
+                          unback_without_lock_),
+      regions_(options.use_huge_region_more_often, options.clock),
+      lifetime_regions_(options.use_huge_region_more_often, options.clock),
+      lifetime_(options.clock),
+      large_regions_(options.use_huge_region_more_often, options.clock),
       vm_allocator_(*this),
       metadata_allocator_(*this),
       alloc_(vm_allocator_, metadata_allocator_),
       cache_(HugeCache{&alloc_, metadata_allocator_, unback_without_lock_,
-                       options.huge_cache_time}) {
-  tracker_allocator_.Init(&forwarder_.arena());
-  region_allocator_.Init(&forwarder_.arena());
+                       options.huge_cache_time, options.clock}),
+      clock_(options.clock) {
+  tracker_allocator_.Init(&forwarder_.arena(tag_));
+  region_allocator_.Init(&forwarder_.arena(tag_));
+  large_region_allocator_.Init(&forwarder_.arena(tag_));
+  lifetime_.Init(&forwarder_.arena(tag_));
 }
 
 template <class Forwarder>
@@ -437,7 +829,7 @@ inline PageId HugePageAwareAllocator<Forwarder>::AllocAndContribute(
   TC_CHECK_NE(p.start_addr(), nullptr);
   FillerType::Tracker* pt = tracker_allocator_.New();
   new (pt)
-      FillerType::Tracker(p, donated, absl::base_internal::CycleClock::Now());
+      FillerType::Tracker(p, donated, clock_.now());
   TC_ASSERT_GE(pt->longest_free_range(), n);
   TC_ASSERT_EQ(pt->was_donated(), donated);
   // if the page was donated, we track its size so that we can potentially
@@ -448,7 +840,12 @@ inline PageId HugePageAwareAllocator<Forwarder>::AllocAndContribute(
   PageId page = pt->Get(n).page;
   TC_ASSERT_EQ(page, p.first_page());
   SetTracker(p, pt);
-  filler_.Contribute(pt, donated, span_alloc_info);
+  // The slack of a donated hugepage is filled by whatever comes next, so only
+  // hugepages started by a short-lived span are set aside for them.
+  if (!donated && span_alloc_info.lifetime == SpanLifetime::kShortLived) {
+    pt->set_short_lived(true);
+  }
+  FillerFor(pt).Contribute(pt, donated, span_alloc_info);
   TC_ASSERT_EQ(pt->was_donated(), donated);
   return page;
 }
@@ -456,7 +853,7 @@ inline PageId HugePageAwareAllocator<Forwarder>::AllocAndContribute(
 template <class Forwarder>
 inline PageId HugePageAwareAllocator<Forwarder>::RefillFiller(
     Length n, SpanAllocInfo span_alloc_info, bool* from_released) {
-  HugeRange r = cache_.Get(NHugePages(1), from_released);
+  HugeRange r = GetFromCache(NHugePages(1), from_released);
   if (!r.valid()) return PageId{0};
   // This is duplicate to Finalize, but if we need to break up
   // hugepages to get to our usage limit it would be very bad to break
@@ -487,7 +884,7 @@ inline Span* HugePageAwareAllocator<Forwarder>::Finalize(Length n, PageId page)
 template <class Forwarder>
 inline Span* HugePageAwareAllocator<Forwarder>::AllocSmall(
     Length n, SpanAllocInfo span_alloc_info, bool* from_released) {
-  auto [pt, page, released] = filler_.TryGet(n, span_alloc_info);
+  auto [pt, page, released] = TryGetFromFiller(n, span_alloc_info);
   *from_released = released;
   if (ABSL_PREDICT_TRUE(pt != nullptr)) {
     return Finalize(n, page);
@@ -510,9 +907,18 @@ inline Span* HugePageAwareAllocator<Forwarder>::AllocLarge(
   }
 
   PageId page;
+  if (ABSL_PREDICT_FALSE(forwarder_.large_huge_regions()) &&
+      UsesLargeRegions(n)) {
+    if (large_regions_.MaybeGet(n, &page, from_released) ||
+        (AddRegion(large_regions_, large_region_allocator_) &&
+         large_regions_.MaybeGet(n, &page, from_released))) {
+      return Finalize(n, page);
+    }
+  }
+
   // If we fit in a single hugepage, try the Filler first.
   if (n < kPagesPerHugePage) {
-    auto [pt, page, released] = filler_.TryGet(n, span_alloc_info);
+    auto [pt, page, released] = TryGetFromFiller(n, span_alloc_info);
     *from_released = released;
     if (ABSL_PREDICT_TRUE(pt != nullptr)) {
       return Finalize(n, page);
@@ -556,7 +962,7 @@ inline Span* HugePageAwareAllocator<Forwarder>::AllocLarge(
 
   // We couldn't allocate a new region. They're oversized, so maybe we'd get
   // lucky with a smaller request?
-  if (!AddRegion()) {
+  if (!AddRegion(regions_)) {
     return AllocRawHugepages(n, span_alloc_info, from_released);
   }
 
@@ -564,6 +970,40 @@ inline Span* HugePageAwareAllocator<Forwarder>::AllocLarge(
   return Finalize(n, page);
 }
 
+template <class Forwarder>
+inline Span* HugePageAwareAllocator<Forwarder>::AllocLargeWithLifetime(
+    Length n, SpanAllocInfo span_alloc_info, uint64_t stack_hash,
+    bool* from_released) {
+  const LifetimePredictor::Prediction prediction = lifetime_.Predict(stack_hash);
+  Span* span = nullptr;
+  if (prediction == LifetimePredictor::Prediction::kShortLived) {
+    span = AllocShortLived(n, from_released);
+  }
+  if (span == nullptr) {
+    if (prediction == LifetimePredictor::Prediction::kShortLived) {
+      span_alloc_info.lifetime = SpanLifetime::kShortLived;
+    }
+    span = AllocLarge(n, span_alloc_info, from_released);
+    if (span == nullptr) return nullptr;
+  }
+  // Keep learning from predicted short-lived allocations too, so that a stack
+  // whose allocations become long-lived goes back to the regular allocator.
+  lifetime_.Track(span->first_page(), stack_hash, prediction);
+  return span;
+}
+
+template <class Forwarder>
+inline Span* HugePageAwareAllocator<Forwarder>::AllocShortLived(
+    Length n, bool* from_released) {
+  PageId page;
+  if (lifetime_regions_.MaybeGet(n, &page, from_released) ||
+      (AddRegion(lifetime_regions_) &&
+       lifetime_regions_.MaybeGet(n, &page, from_released))) {
+    return Finalize(n, page);
+  }
+  return nullptr;
+}
+
 template <class Forwarder>
 inline Span* HugePageAwareAllocator<Forwarder>::AllocEnormous(
     Length n, SpanAllocInfo span_alloc_info, bool* from_released) {
@@ -575,21 +1015,32 @@ inline Span* HugePageAwareAllocator<Forwarder>::AllocRawHugepages(
     Length n, SpanAllocInfo span_alloc_info, bool* from_released) {
   HugeLength hl = HLFromPages(n);
 
-  HugeRange r = cache_.Get(hl, from_released);
+  HugeRange r = GetFromCache(hl, from_released);
   if (!r.valid()) return nullptr;
+  return AllocFromHugepages(r, n, span_alloc_info, *from_released);
+}
 
+template <class Forwarder>
+inline Span* HugePageAwareAllocator<Forwarder>::AllocFromHugepages(
+    HugeRange r, Length n, SpanAllocInfo span_alloc_info, bool from_released) {
+  TC_ASSERT_EQ(r.len(), HLFromPages(n));
   // We now have a huge page range that covers our request.  There
   // might be some slack in it if n isn't a multiple of
   // kPagesPerHugePage. Add the hugepage with slack to the filler,
   // pretending the non-slack portion is a smaller allocation.
-  Length total = hl.in_pages();
+  Length total = r.len().in_pages();
   Length slack = total - n;
   HugePage first = r.start();
   SetTracker(first, nullptr);
   HugePage last = first + r.len() - NHugePages(1);
+  // Hugepages that come from the HugeAllocator have never been used, or have
+  // been released since.
+  const bool zeroed = from_released && forwarder_.ReleasedPagesAreZero();
   if (slack == Length(0)) {
     SetTracker(last, nullptr);
-    return Finalize(total, r.start().first_page());
+    Span* span = Finalize(total, r.start().first_page());
+    span->set_zeroed(zeroed);
+    return span;
   }
 
   ++donated_huge_pages_;
@@ -599,24 +1050,85 @@ inline Span* HugePageAwareAllocator<Forwarder>::AllocRawHugepages(
   AllocAndContribute(last, here, span_alloc_info, /*donated=*/true);
   Span* span = Finalize(n, r.start().first_page());
   span->set_donated(/*value=*/true);
+  span->set_zeroed(zeroed);
   return span;
 }
 
+template <class Forwarder>
+inline Span* HugePageAwareAllocator<Forwarder>::AllocAligned(
+    Length n, Length align, SpanAllocInfo span_alloc_info,
+    bool* from_released) {
+  ++aligned_stats_.allocs;
+  if (align <= kPagesPerHugePage) {
+    // Runs of hugepages start aligned, but one ending partway into a
+    // hugepage leaves a donated tail behind.  Prefer an aligned gap in a
+    // region, as AllocLarge would for an unaligned allocation.
+    PageId page;
+    if (HLFromPages(n).in_pages() != n &&
+        regions_.MaybeGetAligned(n, align, &page, from_released)) {
+      ++aligned_stats_.region_allocs;
+      return Finalize(n, page);
+    }
+    return AllocRawHugepages(n, span_alloc_info, from_released);
+  }
+
+  // Take enough extra hugepages to contain an aligned run, and return those
+  // before and after it to the cache, where they serve later allocations.
+  const HugeLength hl = HLFromPages(n);
+  const HugeLength align_hl = HLFromPages(align);
+  HugeRange r = GetFromCache(hl + align_hl - NHugePages(1), from_released);
+  if (!r.valid()) return nullptr;
+  const size_t mask = align_hl.raw_num() - 1;
+  const HugePage start{(r.start().index() + mask) & ~mask};
+  const HugeRange before = {r.start(), start - r.start()};
+  const HugeRange after = {start + hl, r.len() - hl - before.len()};
+  for (const HugeRange slop : {before, after}) {
+    if (slop.len() == NHugePages(0)) continue;
+    aligned_stats_.slop += slop.len();
+    if (*from_released) {
+      cache_.ReleaseUnbacked(slop);
+    } else {
+      ReleaseToCache(slop);
+    }
+  }
+  return AllocFromHugepages({start, hl}, n, span_alloc_info, *from_released);
+}
+
 inline static void BackSpan(Span* span) {
   SystemBack(span->start_address(), span->bytes_in_span());
 }
 
+template <class Forwarder>
+inline void HugePageAwareAllocator<Forwarder>::BackFreshSpan(Span* span) {
+  // Very large allocations are usually long-lived flat arrays, where 1 GiB
+  // pages remove most of the TLB misses that scanning them would take.  Only
+  // memory that has never been touched since it was released can be remapped.
+  if (ABSL_PREDICT_FALSE(forwarder_.gigantic_pages()) &&
+      IsNormalMemory(span->start_address()) &&
+      span->bytes_in_span() >= kGiganticPageSize) {
+    forwarder_.BackGiganticPages(span->first_page(), span->num_pages());
+  }
+  BackSpan(span);
+}
+
 // public
 template <class Forwarder>
 inline Span* HugePageAwareAllocator<Forwarder>::New(
     Length n, SpanAllocInfo span_alloc_info) {
   TC_CHECK_GT(n, Length(0));
+  // Stacks are collected before taking pageheap_lock.
+  std::optional<uint64_t> stack_hash;
+  if (ABSL_PREDICT_FALSE(forwarder_.lifetime_based_allocation()) &&
+      span_alloc_info.lifetime != SpanLifetime::kShortLived &&
+      TracksLifetime(n)) {
+    stack_hash = LifetimeStackHash();
+  }
   bool from_released;
-  Span* s = LockAndAlloc(n, span_alloc_info, &from_released);
+  Span* s = LockAndAlloc(n, span_alloc_info, stack_hash, &from_released);
   if (s) {
+    if (from_released) BackFreshSpan(s);
     // Prefetch for writing, as we anticipate using the memory soon.
     PrefetchW(s->start_address());
-    if (from_released) BackSpan(s);
   }
   TC_ASSERT(!s || GetMemoryTag(s->start_address()) == tag_);
   return s;
@@ -624,7 +1136,8 @@ inline Span* HugePageAwareAllocator<Forwarder>::New(
 
 template <class Forwarder>
 inline Span* HugePageAwareAllocator<Forwarder>::LockAndAlloc(
-    Length n, SpanAllocInfo span_alloc_info, bool* from_released) {
+    Length n, SpanAllocInfo span_alloc_info, std::optional<uint64_t> stack_hash,
+    bool* from_released) {
   PageHeapSpinLockHolder l;
   // Our policy depends on size.  For small things, we will pack them
   // into single hugepages.
@@ -635,6 +1148,16 @@ inline Span* HugePageAwareAllocator<Forwarder>::LockAndAlloc(
   // For anything too big for the filler, we use either a direct hugepage
   // allocation, or possibly the regions if we are worried about slack.
   if (n <= HugeRegion::size().in_pages()) {
+    // Allocations that the caller says are short-lived need no prediction.
+    if (span_alloc_info.lifetime == SpanLifetime::kShortLived &&
+        TracksLifetime(n)) {
+      if (Span* span = AllocShortLived(n, from_released)) return span;
+      return AllocLarge(n, span_alloc_info, from_released);
+    }
+    if (stack_hash.has_value()) {
+      return AllocLargeWithLifetime(n, span_alloc_info, *stack_hash,
+                                    from_released);
+    }
     return AllocLarge(n, span_alloc_info, from_released);
   }
 
@@ -651,24 +1174,138 @@ inline Span* HugePageAwareAllocator<Forwarder>::NewAligned(
     return New(n, span_alloc_info);
   }
 
-  // we can do better than this, but...
-  // TODO(b/134690769): support higher align.
-  TC_CHECK_LE(align, kPagesPerHugePage);
   bool from_released;
   Span* s;
   {
     PageHeapSpinLockHolder l;
-    s = AllocRawHugepages(n, span_alloc_info, &from_released);
+    s = AllocAligned(n, align, span_alloc_info, &from_released);
   }
-  if (s && from_released) BackSpan(s);
+  if (s && from_released) BackFreshSpan(s);
   TC_ASSERT(!s || GetMemoryTag(s->start_address()) == tag_);
   return s;
 }
 
+template <class Forwarder>
+inline Length HugePageAwareAllocator<Forwarder>::Reserve(Length n,
+                                                         bool populate) {
+  const HugeLength hl = HLFromPages(n);
+  if (hl == NHugePages(0)) return Length(0);
+
+  HugeRange r;
+  {
+    PageHeapSpinLockHolder l;
+    r = alloc_.Get(hl);
+  }
+  if (!r.valid()) return Length(0);
+
+  // Nobody else can see <r> until it is in the cache, so we are free to fault
+  // it in without the lock.
+  if (populate) {
+    forwarder_.PopulatePages(r.start().first_page(), r.len().in_pages());
+  }
+
+  PageHeapSpinLockHolder l;
+  if (forwarder_.exclude_free_from_core_dumps()) {
+    forwarder_.SetPagesDumpable(r.start().first_page(), r.len().in_pages(),
+                                /*dumpable=*/false);
+    dumps_excluded_ = true;
+  }
+  cache_.AddReserved(r);
+  return r.len().in_pages();
+}
+
+template <class Forwarder>
+inline HugeLength HugePageAwareAllocator<Forwarder>::CollapseHugepages(
+    HugeLength max) {
+  HugeLength attempted;
+  while (attempted < max) {
+    HugePage p;
+    FillerType* filler;
+    {
+      PageHeapSpinLockHolder l;
+      filler = &filler_;
+      if (!filler->TakeCollapseCandidate(&p)) {
+        filler = &short_lived_filler_;
+        if (!filler->TakeCollapseCandidate(&p)) break;
+      }
+      FillerType::Tracker* pt = GetTracker(p);
+      if (pt == nullptr || pt->released()) continue;
+    }
+
+    // Collapsing copies the hugepage, so we do not hold pageheap_lock.  The
+    // kernel preserves its contents against concurrent accesses, so the
+    // hugepage remains usable meanwhile.  If it is concurrently subreleased,
+    // the collapse may back released pages again, until the next release.
+    ++attempted;
+    const bool success =
+        forwarder_.CollapsePages(p.first_page(), kPagesPerHugePage);
+
+    PageHeapSpinLockHolder l;
+    filler->RecordCollapse(success);
+  }
+  return attempted;
+}
+
+template <class Forwarder>
+inline HugeLength HugePageAwareAllocator<Forwarder>::SampleHugepageBacking(
+    HugeLength max) {
+  constexpr size_t kMaxSamples = 512;
+  HugePage sample[kMaxSamples];
+  const size_t limit = std::min(max.raw_num(), kMaxSamples);
+  if (limit == 0) return NHugePages(0);
+
+  size_t n = 0;
+  HugeLength intact;
+  {
+    PageHeapSpinLockHolder l;
+    for (FillerType* filler : {&filler_, &short_lived_filler_}) {
+      filler->ForEachHugePage([&](const FillerType::Tracker* pt) {
+        if (!pt->released()) ++intact;
+      });
+    }
+    regions_.ForEachBackedHugePage([&](HugePage) { ++intact; });
+    lifetime_regions_.ForEachBackedHugePage([&](HugePage) { ++intact; });
+    large_regions_.ForEachBackedHugePage([&](HugePage) { ++intact; });
+
+    // Take every stride-th intact hugepage, starting at a different one each
+    // time so that consecutive samples cover different hugepages.
+    const size_t stride = std::max<size_t>(
+        1, (intact.raw_num() + limit - 1) / limit);
+    const size_t offset = backing_sample_offset_++ % stride;
+    size_t index = 0;
+    auto maybe_sample = [&](HugePage p) {
+      if (n < limit && index++ % stride == offset) {
+        sample[n++] = p;
+      }
+    };
+    for (FillerType* filler : {&filler_, &short_lived_filler_}) {
+      filler->ForEachHugePage([&](const FillerType::Tracker* pt) {
+        if (!pt->released()) maybe_sample(pt->location());
+      });
+    }
+    regions_.ForEachBackedHugePage(maybe_sample);
+    lifetime_regions_.ForEachBackedHugePage(maybe_sample);
+    large_regions_.ForEachBackedHugePage(maybe_sample);
+  }
+
+  // The sampled hugepages may be subreleased or freed while we read their
+  // page flags.  This only skews the result of this sample.
+  HugeLength unknown;
+  const HugeLength small_page_backed = forwarder_.CountSmallPageBacked(
+      absl::MakeConstSpan(sample, n), &unknown);
+
+  PageHeapSpinLockHolder l;
+  backing_stats_ = {.intact = intact,
+                    .sampled = NHugePages(n),
+                    .small_page_backed = small_page_backed,
+                    .unknown = unknown};
+  return NHugePages(n);
+}
+
 template <class Forwarder>
 inline void HugePageAwareAllocator<Forwarder>::DeleteFromHugepage(
     FillerType::Tracker* pt, PageId p, Length n, bool might_abandon) {
-  if (ABSL_PREDICT_TRUE(filler_.Put(pt, p, n) == nullptr)) {
+  if (ABSL_PREDICT_TRUE(FillerFor(pt).Put(pt, p, n) == nullptr)) {
     // If this allocation had resulted in a donation to the filler, we record
     // these pages as abandoned.
     if (ABSL_PREDICT_FALSE(might_abandon)) {
@@ -678,6 +1315,29 @@ inline void HugePageAwareAllocator<Forwarder>::DeleteFromHugepage(
     }
     return;
   }
+  ReleaseEmptyFillerHugepage(pt);
+}
+
+template <class Forwarder>
+inline DonatedTailStats
+HugePageAwareAllocator<Forwarder>::GetDonatedTailStats() {
+  DonatedTailStats stats;
+  // Donated hugepages are never short-lived, so they are all in filler_.
+  filler_.ForEachHugePage([&](FillerType::Tracker* pt) {
+    if (!pt->was_donated()) return;
+    ++stats.tails;
+    if (pt->donated()) ++stats.untouched;
+    if (pt->abandoned()) ++stats.abandoned;
+    const Length owner = pt->abandoned() ? Length(0) : pt->abandoned_count();
+    stats.used_pages += pt->used_pages();
+    stats.other_pages += pt->used_pages() - owner;
+  });
+  return stats;
+}
+
+template <class Forwarder>
+inline void HugePageAwareAllocator<Forwarder>::ReleaseEmptyFillerHugepage(
+    FillerType::Tracker* pt) {
   if (pt->was_donated()) {
     --donated_huge_pages_;
     if (pt->abandoned()) {
@@ -691,12 +1351,24 @@ inline void HugePageAwareAllocator<Forwarder>::DeleteFromHugepage(
 }
 
 template <class Forwarder>
-inline bool HugePageAwareAllocator<Forwarder>::AddRegion() {
-  HugeRange r = alloc_.Get(HugeRegion::size());
+inline void
+HugePageAwareAllocator<Forwarder>::ReleaseFillerHugepagesEmptiedByRelease() {
+  for (FillerType* filler : {&filler_, &short_lived_filler_}) {
+    while (FillerType::Tracker* pt = filler->TakeEmptiedByRelease()) {
+      ReleaseEmptyFillerHugepage(pt);
+    }
+  }
+}
+
+template <class Forwarder>
+template <typename Region>
+inline bool HugePageAwareAllocator<Forwarder>::AddRegion(
+    HugeRegionSet<Region>& regions, PageHeapAllocator<Region>& allocator) {
+  HugeRange r = alloc_.Get(Region::size());
   if (!r.valid()) return false;
-  HugeRegion* region = region_allocator_.New();
-  new (region) HugeRegion(r, unback_);
-  regions_.Contribute(region);
+  Region* region = allocator.New();
+  new (region) Region(r, unback_);
+  regions.Contribute(region);
   return true;
 }
 
@@ -708,6 +1380,9 @@ inline void HugePageAwareAllocator<Forwarder>::Delete(Span* span,
   HugePage hp = HugePageContaining(p);
   Length n = span->num_pages();
   info_.RecordFree(p, n);
+  if (TracksLifetime(n)) {
+    lifetime_.Untrack(p);
+  }
 
   bool might_abandon = span->donated();
   forwarder_.DeleteSpan(span);
@@ -727,8 +1402,16 @@ inline void HugePageAwareAllocator<Forwarder>::Delete(Span* span,
   }
 
   // b) We got put into a region, possibly crossing hugepages -
-  //    return our allocation to the region.
-  if (regions_.MaybePut(p, n)) return;
+  //    return our allocation to the region.  With demand-based release, empty
+  //    hugepages stay backed until ReleaseAtLeastNPages decides, from recent
+  //    demand, that they will not be needed again soon.
+  if (regions_.MaybePut(p, n,
+                        /*release=*/!regions_.UseHugeRegionMoreOften() &&
+                            !forwarder_.huge_region_demand_based_release())) {
+    return;
+  }
+  if (lifetime_regions_.MaybePut(p, n)) return;
+  if (large_regions_.MaybePut(p, n)) return;
 
   // c) we came straight from the HugeCache - return straight there.  (We
   //    might have had slack put into the filler - if so, return that virtual
@@ -750,7 +1433,7 @@ inline void HugePageAwareAllocator<Forwarder>::Delete(Span* span,
     Length virt_len = kPagesPerHugePage - slack;
     // We may have used the slack, which would prevent us from returning
     // the entire range now.  If filler returned a Tracker, we are fully empty.
-    if (filler_.Put(pt, virt, virt_len) == nullptr) {
+    if (FillerFor(pt).Put(pt, virt, virt_len) == nullptr) {
       // Last page isn't empty -- pretend the range was shorter.
       --hl;
 
@@ -778,11 +1461,32 @@ inline void HugePageAwareAllocator<Forwarder>::Delete(Span* span,
       }
     }
   }
+  ReleaseToCache({hp, hl});
+}
+
+template <class Forwarder>
+inline void HugePageAwareAllocator<Forwarder>::ReleaseToCache(HugeRange r) {
+  if (forwarder_.exclude_free_from_core_dumps()) {
+    forwarder_.SetPagesDumpable(r.start().first_page(), r.len().in_pages(),
+                                /*dumpable=*/false);
+    dumps_excluded_ = true;
+  }
   // We release in the background task instead (i.e., ReleaseAtLeastNPages()) if
   // the demand-based release is enabled.
   cache_.Release(
-      {hp, hl},
-      /*demand_based_unback=*/forwarder_.huge_cache_demand_based_release());
+      r, /*demand_based_unback=*/forwarder_.huge_cache_demand_based_release());
+}
+
+template <class Forwarder>
+inline HugeRange HugePageAwareAllocator<Forwarder>::GetFromCache(
+    HugeLength n, bool* from_released) {
+  cache_.set_lifo_reuse(forwarder_.huge_cache_lifo_reuse());
+  HugeRange r = cache_.Get(n, from_released);
+  if (r.valid() && dumps_excluded_) {
+    forwarder_.SetPagesDumpable(r.start().first_page(), r.len().in_pages(),
+                                /*dumpable=*/true);
+  }
+  return r;
 }
 
 template <class Forwarder>
@@ -795,11 +1499,7 @@ inline void HugePageAwareAllocator<Forwarder>::ReleaseHugepage(
   if (pt->released()) {
     cache_.ReleaseUnbacked(r);
   } else {
-    // We release in the background task instead (i.e., ReleaseAtLeastNPages())
-    // if the demand-based release is enabled.
-    cache_.Release(
-        r,
-        /*demand_based_unback=*/forwarder_.huge_cache_demand_based_release());
+    ReleaseToCache(r);
   }
 
   tracker_allocator_.Delete(pt);
@@ -812,7 +1512,10 @@ inline BackingStats HugePageAwareAllocator<Forwarder>::stats() const {
   const auto actual_system = stats.system_bytes;
   stats += cache_.stats();
   stats += filler_.stats();
+  stats += short_lived_filler_.stats();
   stats += regions_.stats();
+  stats += lifetime_regions_.stats();
+  stats += large_regions_.stats();
   // the "system" (total managed) byte count is wildly double counted,
   // since it all comes from HugeAllocator but is then managed by
   // cache/regions/filler. Adjust for that.
@@ -846,7 +1549,10 @@ inline void HugePageAwareAllocator<Forwarder>::GetSpanStats(
 
   alloc_.AddSpanStats(small, large);
   filler_.AddSpanStats(small, large);
+  short_lived_filler_.AddSpanStats(small, large);
   regions_.AddSpanStats(small, large);
+  lifetime_regions_.AddSpanStats(small, large);
+  large_regions_.AddSpanStats(small, large);
   cache_.AddSpanStats(small, large);
 }
 
@@ -866,8 +1572,32 @@ inline Length HugePageAwareAllocator<Forwarder>::ReleaseAtLeastNPages(
   }
   bool hit_limit = (reason == PageReleaseReason::kSoftLimitExceeded ||
                     reason == PageReleaseReason::kHardLimitExceeded);
+  // With lazy (MADV_FREE only) release, the cache keeps what it unbacks aside
+  // for reuse.  Periodically return what the kernel reclaimed meanwhile, and
+  // all of it once release is no longer lazy.
+  const bool lazy_release = forwarder_.ReleasedPagesAreLazy();
+  cache_.set_lazy_unback(lazy_release);
+  if (cache_.lazily_freed() > NHugePages(0) &&
+      (!lazy_release ||
+       reason == PageReleaseReason::kProcessBackgroundActions)) {
+    cache_.ReclaimLazilyFreed([&](HugeRange r) {
+      return lazy_release ? forwarder_.ResidentPages(r.start().first_page(),
+                                                     r.len().in_pages())
+                          : Length(0);
+    });
+  }
+  // Background release demotes cached hugepages before it unbacks them, if a
+  // cold interval is set.  Any other release unbacks the demoted ones too.
+  cache_.set_demotion(reason == PageReleaseReason::kProcessBackgroundActions
+                          ? &demote_without_lock_
+                          : nullptr,
+                      forwarder_.huge_cache_cold_interval());
   Length released;
-  if (forwarder_.huge_cache_demand_based_release()) {
+  if (forwarder_.huge_cache_demand_based_release() &&
+      forwarder_.huge_cache_forecast() &&
+      reason == PageReleaseReason::kProcessBackgroundActions) {
+    released += cache_.ReleaseCachedPagesByForecast().in_pages();
+  } else if (forwarder_.huge_cache_demand_based_release()) {
     released +=
         cache_
             .ReleaseCachedPagesByDemand(HLFromPages(num_pages),
@@ -877,11 +1607,12 @@ inline Length HugePageAwareAllocator<Forwarder>::ReleaseAtLeastNPages(
     released += cache_.ReleaseCachedPages(HLFromPages(num_pages)).in_pages();
   }
 
-  // Release all backed-but-free hugepages from HugeRegion.
-  // TODO(b/199203282): We release all the free hugepages from HugeRegions when
-  // the experiment is enabled. We can also explore releasing only a desired
-  // number of pages.
-  if (regions_.UseHugeRegionMoreOften()) {
+  // Release backed-but-free hugepages from HugeRegion.  These are only left
+  // behind by deallocations when regions are used more often, or when their
+  // release is demand-based, in which case we release no more than the
+  // filler's skip-subrelease demand history allows.
+  if (regions_.UseHugeRegionMoreOften() ||
+      forwarder_.huge_region_demand_based_release()) {
     if (forwarder_.huge_region_demand_based_release()) {
       Length desired = released > num_pages ? Length(0) : num_pages - released;
       released += regions_.ReleasePagesByPeakDemand(
@@ -897,6 +1628,10 @@ inline Length HugePageAwareAllocator<Forwarder>::ReleaseAtLeastNPages(
       released += regions_.ReleasePages(kFractionToReleaseFromRegion);
     }
   }
+  // Short-lived allocations come and go, so the free hugepages of their
+  // regions are likely to be reused soon: only release a fraction of them.
+  released += lifetime_regions_.ReleasePages(kFractionToReleaseFromRegion);
+  released += large_regions_.ReleasePages(kFractionToReleaseFromRegion);
 
   // This is our long term plan but in current state will lead to insufficient
   // THP coverage. It is however very useful to have the ability to turn this on
@@ -904,16 +1639,21 @@ inline Length HugePageAwareAllocator<Forwarder>::ReleaseAtLeastNPages(
   // TODO(b/134690769): make this work, remove the flag guard.
   if (hpaa_subrelease()) {
     if (released < num_pages) {
-      released += filler_.ReleasePages(
-          num_pages - released,
-          SkipSubreleaseIntervals{
-              .peak_interval = forwarder_.filler_skip_subrelease_interval(),
-              .short_interval =
-                  forwarder_.filler_skip_subrelease_short_interval(),
-              .long_interval =
-                  forwarder_.filler_skip_subrelease_long_interval()},
-          forwarder_.release_partial_alloc_pages(),
-          /*hit_limit*/ false);
+      const SkipSubreleaseIntervals intervals =
+          filler_skip_subrelease_intervals();
+      // In hugepage granular mode, only hugepages that are already broken
+      // are subreleased from, unless there are no hugepages to keep intact.
+      const bool break_hugepages = !forwarder_.hugepage_granular_release() ||
+                                   !forwarder_.hugepages_available();
+      released += filler_.ReleasePages(num_pages - released, intervals,
+                                       release_partial_alloc_pages(),
+                                       /*hit_limit*/ false, break_hugepages);
+      if (released < num_pages) {
+        released += short_lived_filler_.ReleasePages(
+            num_pages - released, intervals, release_partial_alloc_pages(),
+            /*hit_limit*/ false, break_hugepages);
+      }
+      ReleaseFillerHugepagesEmptiedByRelease();
     }
   }
 
@@ -963,12 +1703,18 @@ inline void HugePageAwareAllocator<Forwarder>::Print(Printer* out,
       "------------------------------------------------\n");
   out->printf("HugePageAware: breakdown of used / free / unmapped space:\n");
 
-  auto fstats = filler_.stats();
+  auto fstats = filler_.stats() + short_lived_filler_.stats();
   BreakdownStats(out, fstats, "HugePageAware: filler  ");
 
   auto rstats = regions_.stats();
   BreakdownStats(out, rstats, "HugePageAware: region  ");
 
+  auto lstats = lifetime_regions_.stats();
+  BreakdownStats(out, lstats, "HugePageAware: lifetime");
+
+  auto gstats = large_regions_.stats();
+  BreakdownStats(out, gstats, "HugePageAware: large   ");
+
   auto cstats = cache_.stats();
   // Everything in the filler came from the cache -
   // adjust the totals so we see the amount used by the mutator.
@@ -978,7 +1724,8 @@ inline void HugePageAwareAllocator<Forwarder>::Print(Printer* out,
   auto astats = alloc_.stats();
   // Everything in *all* components came from here -
   // so again adjust the totals.
-  astats.system_bytes -= (fstats + rstats + cstats).system_bytes;
+  astats.system_bytes -=
+      (fstats + rstats + lstats + gstats + cstats).system_bytes;
   BreakdownStats(out, astats, "HugePageAware: alloc   ");
   out->printf("\n");
 
@@ -986,15 +1733,46 @@ inline void HugePageAwareAllocator<Forwarder>::Print(Printer* out,
       "HugePageAware: filler donations %zu (%zu pages from abandoned "
       "donations)\n",
       donated_huge_pages_.raw_num(), abandoned_pages_.raw_num());
+  const DonatedTailStats tail_stats = GetDonatedTailStats();
+  out->printf(
+      "HugePageAware: donated tails %zu (%zu untouched, %zu abandoned), "
+      "%zu pages used (%zu by other spans), %.1f%% utilization\n",
+      tail_stats.tails.raw_num(), tail_stats.untouched.raw_num(),
+      tail_stats.abandoned.raw_num(), tail_stats.used_pages.raw_num(),
+      tail_stats.other_pages.raw_num(), 100 * tail_stats.utilization());
+  out->printf(
+      "HugePageAware: aligned allocations %zu (%zu in regions), "
+      "%zu hugepages of alignment slop returned to the cache\n",
+      aligned_stats_.allocs, aligned_stats_.region_allocs,
+      aligned_stats_.slop.raw_num());
+  out->printf(
+      "HugePageAware: %zu of %zu intact hugepages sampled, %zu backed by small "
+      "pages, %zu unknown (%.1f MiB estimated to be backed by small pages)\n",
+      backing_stats_.sampled.raw_num(), backing_stats_.intact.raw_num(),
+      backing_stats_.small_page_backed.raw_num(),
+      backing_stats_.unknown.raw_num(),
+      BytesToMiB(backing_stats_.EstimatedSmallPageBackedBytes()));
+  out->printf("HugePageAware: %.1f MiB backed by 1 GiB pages process-wide\n",
+              BytesToMiB(forwarder_.GiganticPageBytes()));
+  lifetime_.Print(out);
 
   // Component debug output
   // Filler is by far the most important; print (some) of it
   // unconditionally.
   filler_.Print(out, everything);
   out->printf("\n");
+  if (short_lived_filler_.size() > NHugePages(0)) {
+    out->printf("HugePageAware: filler for short-lived spans\n");
+    short_lived_filler_.Print(out, everything);
+    out->printf("\n");
+  }
   if (everything) {
     regions_.Print(out);
     out->printf("\n");
+    if (large_regions_.ActiveRegions() > 0) {
+      large_regions_.Print(out);
+      out->printf("\n");
+    }
     cache_.Print(out);
     alloc_.Print(out);
     out->printf("\n");
@@ -1013,7 +1791,10 @@ inline void HugePageAwareAllocator<Forwarder>::PrintInPbtxt(
     PbtxtRegion* region) {
   SmallSpanStats small;
   LargeSpanStats large;
-  PageHeapSpinLockHolder l;
+  // The filler's fullness histograms are recorded under pageheap_lock, but
+  // printed after releasing it.
+  huge_page_filler_internal::UsageInfo filler_usage;
+  pageheap_lock.Lock();
   GetSpanStats(&small, &large);
   PrintStatsInPbtxt(region, small, large);
   {
@@ -1024,12 +1805,18 @@ inline void HugePageAwareAllocator<Forwarder>::PrintInPbtxt(
                    regions_.UseHugeRegionMoreOften());
 
     // Fill HPAA Usage
-    auto fstats = filler_.stats();
+    auto fstats = filler_.stats() + short_lived_filler_.stats();
     BreakdownStatsInPbtxt(&hpaa, fstats, "filler_usage");
 
     auto rstats = regions_.stats();
     BreakdownStatsInPbtxt(&hpaa, rstats, "region_usage");
 
+    auto lstats = lifetime_regions_.stats();
+    BreakdownStatsInPbtxt(&hpaa, lstats, "lifetime_region_usage");
+
+    auto gstats = large_regions_.stats();
+    BreakdownStatsInPbtxt(&hpaa, gstats, "large_region_usage");
+
     auto cstats = cache_.stats();
     // Everything in the filler came from the cache -
     // adjust the totals so we see the amount used by the mutator.
@@ -1039,12 +1826,21 @@ inline void HugePageAwareAllocator<Forwarder>::PrintInPbtxt(
     auto astats = alloc_.stats();
     // Everything in *all* components came from here -
     // so again adjust the totals.
-    astats.system_bytes -= (fstats + rstats + cstats).system_bytes;
+    astats.system_bytes -=
+        (fstats + rstats + lstats + gstats + cstats).system_bytes;
 
     BreakdownStatsInPbtxt(&hpaa, astats, "alloc_usage");
 
-    filler_.PrintInPbtxt(&hpaa);
+    filler_.PrintInPbtxt(&hpaa, &filler_usage);
+    if (short_lived_filler_.size() > NHugePages(0)) {
+      auto short_lived = hpaa.CreateSubRegion("short_lived_filler");
+      short_lived_filler_.PrintInPbtxt(&short_lived);
+    }
     regions_.PrintInPbtxt(&hpaa);
+    if (large_regions_.ActiveRegions() > 0) {
+      auto large = hpaa.CreateSubRegion("large_huge_regions");
+      large_regions_.PrintInPbtxt(&large);
+    }
     cache_.PrintInPbtxt(&hpaa);
     alloc_.PrintInPbtxt(&hpaa);
 
@@ -1053,6 +1849,37 @@ inline void HugePageAwareAllocator<Forwarder>::PrintInPbtxt(
 
     hpaa.PrintI64("filler_donated_huge_pages", donated_huge_pages_.raw_num());
     hpaa.PrintI64("filler_abandoned_pages", abandoned_pages_.raw_num());
+    {
+      const DonatedTailStats tail_stats = GetDonatedTailStats();
+      auto tails = hpaa.CreateSubRegion("donated_tails");
+      tails.PrintI64("tails", tail_stats.tails.raw_num());
+      tails.PrintI64("untouched", tail_stats.untouched.raw_num());
+      tails.PrintI64("abandoned", tail_stats.abandoned.raw_num());
+      tails.PrintI64("used_pages", tail_stats.used_pages.raw_num());
+      tails.PrintI64("other_pages", tail_stats.other_pages.raw_num());
+    }
+    {
+      auto aligned = hpaa.CreateSubRegion("aligned_allocs");
+      aligned.PrintI64("allocs", aligned_stats_.allocs);
+      aligned.PrintI64("region_allocs", aligned_stats_.region_allocs);
+      aligned.PrintI64("slop_huge_pages", aligned_stats_.slop.raw_num());
+    }
+    lifetime_.PrintInPbtxt(&hpaa);
+    {
+      auto backing = hpaa.CreateSubRegion("hugepage_backing");
+      backing.PrintI64("intact", backing_stats_.intact.raw_num());
+      backing.PrintI64("sampled", backing_stats_.sampled.raw_num());
+      backing.PrintI64("small_page_backed",
+                       backing_stats_.small_page_backed.raw_num());
+      backing.PrintI64("unknown", backing_stats_.unknown.raw_num());
+      backing.PrintI64("estimated_small_page_backed_bytes",
+                       backing_stats_.EstimatedSmallPageBackedBytes());
+      backing.PrintI64("gigantic_page_backed_bytes",
+                       forwarder_.GiganticPageBytes());
+    }
+    pageheap_lock.Unlock();
+
+    filler_usage.Print(&hpaa);
   }
 }
 
@@ -1083,15 +1910,21 @@ HugePageAwareAllocator<Forwarder>::ReleaseAtLeastNPagesBreakingHugepages(
   } else {
     released += regions_.ReleasePages(/*release_fraction=*/1.0);
   }
+  released += lifetime_regions_.ReleasePages(/*release_fraction=*/1.0);
+  released += large_regions_.ReleasePages(/*release_fraction=*/1.0);
 
   if (released >= n) {
     info_.RecordRelease(n, released, reason);
     return released;
   }
 
-  released += filler_.ReleasePages(n - released, SkipSubreleaseIntervals{},
-                                   /*release_partial_alloc_pages=*/false,
-                                   /*hit_limit=*/true);
+  for (FillerType* filler : {&filler_, &short_lived_filler_}) {
+    if (released >= n) break;
+    released += filler->ReleasePages(n - released, SkipSubreleaseIntervals{},
+                                     /*release_partial_alloc_pages=*/false,
+                                     /*hit_limit=*/true);
+  }
+  ReleaseFillerHugepagesEmptiedByRelease();
 
   info_.RecordRelease(n, released, reason);
   return released;
@@ -1117,13 +1950,41 @@ bool HugePageAwareAllocator<Forwarder>::IsValidSizeClass(size_t size,
 
 template <class Forwarder>
 inline bool HugePageAwareAllocator<Forwarder>::hpaa_subrelease() const {
-  if (tag_ == MemoryTag::kCold) {
+  if (tag_ == MemoryTag::kCold || !forwarder_.hugepages_available()) {
     return true;
   } else {
     return forwarder_.hpaa_subrelease();
   }
 }
 
+template <class Forwarder>
+inline SkipSubreleaseIntervals
+HugePageAwareAllocator<Forwarder>::filler_skip_subrelease_intervals() {
+  if (tag_ == MemoryTag::kCold || !forwarder_.hugepages_available()) {
+    return SkipSubreleaseIntervals{};
+  }
+  SkipSubreleaseIntervals intervals{
+      .peak_interval = forwarder_.filler_skip_subrelease_interval(),
+      .short_interval = forwarder_.filler_skip_subrelease_short_interval(),
+      .long_interval = forwarder_.filler_skip_subrelease_long_interval()};
+  const uint32_t target_percent =
+      forwarder_.skip_subrelease_target_refault_percent();
+  if (target_percent > 0) {
+    intervals =
+        filler_.TuneSkipSubreleaseIntervals(intervals, target_percent / 100.0);
+  }
+  return intervals;
+}
+
+template <class Forwarder>
+inline bool HugePageAwareAllocator<Forwarder>::release_partial_alloc_pages()
+    const {
+  if (tag_ == MemoryTag::kCold || !forwarder_.hugepages_available()) {
+    return true;
+  }
+  return forwarder_.release_partial_alloc_pages();
+}
+
 }  // namespace huge_page_allocator_internal
 
 using HugePageAwareAllocator =
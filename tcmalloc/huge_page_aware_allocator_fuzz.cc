@@ -321,7 +321,10 @@ void FuzzHPAA(const std::string& s) {
             actual_stats = allocator->GetReleaseStats();
           }
 
-          if (forwarder.release_succeeds()) {
+          // Nonresident pages are released without counting.
+          if (forwarder.release_succeeds() &&
+              (!forwarder.residency_aware_release() ||
+               forwarder.pages_resident())) {
             const size_t min_released =
                 std::min(desired.in_bytes(), releasable_bytes);
             TC_CHECK_GE(released.in_bytes(), min_released);
@@ -434,7 +437,15 @@ void FuzzHPAA(const std::string& s) {
               // actual_value[0] - release enabled
               // actual_value[1:16] - interval_1
               // actual_value[17:32] - interval_2
+              // actual_value[33] - forecasting enabled
+              // actual_value[34] - LIFO reuse enabled
+              // actual_value[35] - demotion to cold enabled
               forwarder.set_huge_cache_demand_based_release(actual_value & 0x1);
+              forwarder.set_huge_cache_forecast((actual_value >> 33) & 0x1);
+              forwarder.set_huge_cache_lifo_reuse((actual_value >> 34) & 0x1);
+              forwarder.set_huge_cache_cold_interval(
+                  (actual_value >> 35) & 0x1 ? absl::Seconds(1)
+                                             : absl::ZeroDuration());
               if (forwarder.huge_cache_demand_based_release()) {
                 const uint64_t interval_1 = (actual_value >> 1) & 0xffff;
                 const uint64_t interval_2 = (actual_value >> 17) & 0xffff;
@@ -447,6 +458,26 @@ void FuzzHPAA(const std::string& s) {
               }
               break;
             }
+            case 9:
+              forwarder.set_lifetime_based_allocation(actual_value & 0x1);
+              break;
+            case 10:
+              forwarder.set_skip_subrelease_target_refault_percent(
+                  actual_value % 101);
+              break;
+            case 11:
+              forwarder.set_donated_tail_packing(actual_value & 0x1);
+              break;
+            case 12:
+              forwarder.set_exclude_free_from_core_dumps(actual_value & 0x1);
+              break;
+            case 13:
+              forwarder.set_hugepages_available(actual_value & 0x1);
+              break;
+            case 14:
+              forwarder.set_residency_aware_release(actual_value & 0x1);
+              forwarder.set_pages_resident((actual_value >> 1) & 0x1);
+              break;
           }
           break;
         }
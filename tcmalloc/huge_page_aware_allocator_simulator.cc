@@ -0,0 +1,450 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Replays a trace of page heap allocations against a HugePageAwareAllocator
+// backed by fake memory and a fake clock, so that the subrelease and filler
+// policies can be evaluated offline, hours of activity in seconds.
+//
+// Usage:
+//   huge_page_aware_allocator_simulator [--release_rate=B] \
+//       [--filler_skip_subrelease_short_interval=D] ... trace
+//
+// A trace is a text file with one PageAllocator::New or Delete per line, in
+// time order:
+//
+//   <time_ns> new <id> <pages> <objects_per_span> <sparse|dense> [short_lived]
+//       [align=<pages>] [stack=<hex hash>]
+//   <time_ns> delete <id>
+//
+// <id> names the span between its New and its Delete; <pages> and <align> are
+// in TCMalloc pages of the build the trace was recorded with, which must match
+// this binary's.  <stack> is the hash of the allocation stack.  Lines starting
+// with '#' are ignored.
+//
+// By default, spans are placed by the short_lived hints of the trace.  With
+// --predictor=none, oracle or stack, the hints are replaced by the predictions
+// of a PlacementPredictor (see placement_predictors.h), which learns from the
+// lifetimes of the spans as they become known, and the simulator also reports
+// how accurate it was.  Comparing the RSS and coverage of the predictors
+// shows how much lifetime-aware placement gains, and how much of the gain of
+// the oracle a realistic predictor keeps.
+//
+// Time only passes between events.  Every --background_interval of trace
+// time, the simulator releases memory as the background thread would, at
+// --release_rate.  Every --report_interval it prints the memory in use, the
+// RSS it would take, the share of used memory on intact hugepages and the
+// pages released so far.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/huge_page_aware_allocator.h"
+#include "tcmalloc/internal/clock.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/mock_huge_page_static_forwarder.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/lifetime_predictions.h"
+#include "tcmalloc/parameters.h"
+#include "tcmalloc/placement_predictors.h"
+#include "tcmalloc/span.h"
+#include "tcmalloc/stats.h"
+
+ABSL_FLAG(size_t, release_rate,
+          static_cast<size_t>(tcmalloc::tcmalloc_internal::Parameters::
+                                  background_release_rate()),
+          "Bytes per second released by the simulated background thread");
+ABSL_FLAG(absl::Duration, background_interval, absl::Seconds(1),
+          "Trace time between simulated background releases");
+ABSL_FLAG(absl::Duration, report_interval, absl::Minutes(1),
+          "Trace time between reports");
+ABSL_FLAG(absl::Duration, filler_skip_subrelease_short_interval,
+          tcmalloc::tcmalloc_internal::Parameters::
+              filler_skip_subrelease_short_interval(),
+          "Short interval of the filler's demand-based subrelease");
+ABSL_FLAG(absl::Duration, filler_skip_subrelease_long_interval,
+          tcmalloc::tcmalloc_internal::Parameters::
+              filler_skip_subrelease_long_interval(),
+          "Long interval of the filler's demand-based subrelease");
+ABSL_FLAG(bool, release_partial_alloc_pages,
+          tcmalloc::tcmalloc_internal::Parameters::
+              release_partial_alloc_pages(),
+          "Whether the filler subreleases partially allocated hugepages");
+ABSL_FLAG(bool, hpaa_subrelease,
+          tcmalloc::tcmalloc_internal::Parameters::hpaa_subrelease(),
+          "Whether the filler subreleases at all");
+ABSL_FLAG(bool, huge_region_demand_based_release,
+          tcmalloc::tcmalloc_internal::Parameters::
+              huge_region_demand_based_release(),
+          "Whether HugeRegions release based on recent demand");
+ABSL_FLAG(bool, huge_cache_demand_based_release,
+          tcmalloc::tcmalloc_internal::Parameters::
+              huge_cache_demand_based_release(),
+          "Whether the HugeCache releases based on recent demand");
+ABSL_FLAG(absl::Duration, huge_cache_time,
+          tcmalloc::tcmalloc_internal::Parameters::huge_cache_release_time(),
+          "How long the HugeCache keeps free hugepages backed");
+ABSL_FLAG(std::string, predictor, "trace",
+          "How spans are predicted short-lived: trace, none, oracle or stack");
+ABSL_FLAG(absl::Duration, lifetime_threshold,
+          tcmalloc::tcmalloc_internal::LifetimePredictor::kDefaultThreshold,
+          "Lifetime below which a span is short-lived, for --predictor");
+ABSL_FLAG(bool, print_stats, false,
+          "Print the allocator's stats at the end of the trace");
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+using huge_page_allocator_internal::FakeStaticForwarder;
+using huge_page_allocator_internal::HugePageAwareAllocator;
+using huge_page_allocator_internal::HugePageAwareAllocatorOptions;
+
+// Trace time, in nanoseconds.
+int64_t simulated_now = 0;
+
+int64_t SimulatedNow() { return simulated_now; }
+double SimulatedFrequency() { return 1e9; }
+
+// Counts the releases that reach the (fake) system.
+class SimulatorForwarder : public FakeStaticForwarder {
+ public:
+  bool ReleasePages(PageId begin, Length size) {
+    ++release_calls_;
+    return FakeStaticForwarder::ReleasePages(begin, size);
+  }
+
+  uint64_t release_calls_ = 0;
+};
+
+using Allocator = HugePageAwareAllocator<SimulatorForwarder>;
+
+struct Event {
+  int64_t time;
+  bool is_new;
+  uint64_t id;
+  Length pages;
+  Length align;
+  SpanAllocInfo info;
+  uint64_t stack_hash;
+  // The time of the matching delete, filled in once the trace is read.
+  int64_t free_time;
+};
+
+bool ParseEvent(absl::string_view line, Event& e) {
+  std::vector<absl::string_view> fields =
+      absl::StrSplit(line, ' ', absl::SkipWhitespace());
+  if (fields.size() < 3 || !absl::SimpleAtoi(fields[0], &e.time) ||
+      !absl::SimpleAtoi(fields[2], &e.id)) {
+    return false;
+  }
+  if (fields[1] == "delete") {
+    e.is_new = false;
+    return fields.size() == 3;
+  }
+  size_t pages;
+  if (fields[1] != "new" || fields.size() < 6 ||
+      !absl::SimpleAtoi(fields[3], &pages) || pages == 0 ||
+      !absl::SimpleAtoi(fields[4], &e.info.objects_per_span) ||
+      e.info.objects_per_span == 0) {
+    return false;
+  }
+  e.is_new = true;
+  e.pages = Length(pages);
+  e.align = Length(1);
+  if (fields[5] == "sparse") {
+    e.info.density = AccessDensityPrediction::kSparse;
+  } else if (fields[5] == "dense") {
+    e.info.density = AccessDensityPrediction::kDense;
+  } else {
+    return false;
+  }
+  e.info.lifetime = SpanLifetime::kLongLived;
+  e.stack_hash = 0;
+  e.free_time = std::numeric_limits<int64_t>::max();
+  for (size_t i = 6; i < fields.size(); ++i) {
+    size_t align;
+    if (fields[i] == "short_lived") {
+      e.info.lifetime = SpanLifetime::kShortLived;
+    } else if (absl::ConsumePrefix(&fields[i], "stack=")) {
+      if (!absl::SimpleHexAtoi(fields[i], &e.stack_hash)) return false;
+    } else if (absl::ConsumePrefix(&fields[i], "align=") &&
+               absl::SimpleAtoi(fields[i], &align) && align > 0 &&
+               (align & (align - 1)) == 0) {
+      e.align = Length(align);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ReadTrace(const char* path, std::vector<Event>& events) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    absl::FPrintF(stderr, "Failed to open %s\n", path);
+    return false;
+  }
+  std::string line;
+  for (size_t n = 1; std::getline(file, line); ++n) {
+    if (line.empty() || line[0] == '#') continue;
+    Event e;
+    if (!ParseEvent(line, e)) {
+      absl::FPrintF(stderr, "%s:%u: malformed event: %s\n", path, n, line);
+      return false;
+    }
+    if (!events.empty() && e.time < events.back().time) {
+      absl::FPrintF(stderr, "%s:%u: event out of time order\n", path, n);
+      return false;
+    }
+    events.push_back(e);
+  }
+
+  // Pairs each new with its delete, for the oracle.
+  absl::flat_hash_map<uint64_t, size_t> allocated;
+  for (size_t i = 0; i < events.size(); ++i) {
+    if (events[i].is_new) {
+      allocated[events[i].id] = i;
+    } else if (auto it = allocated.find(events[i].id); it != allocated.end()) {
+      events[it->second].free_time = events[i].time;
+      allocated.erase(it);
+    }
+  }
+  return true;
+}
+
+struct Sample {
+  Length used;
+  Length rss;
+  // The fraction of the used pages that are on intact hugepages.
+  double coverage;
+  PageReleaseStats released;
+};
+
+Sample TakeSample(Allocator& allocator) {
+  PageHeapSpinLockHolder l;
+  const BackingStats stats = allocator.stats();
+  Sample s;
+  s.used = BytesToLengthFloor(stats.system_bytes - stats.free_bytes -
+                              stats.unmapped_bytes);
+  s.rss = BytesToLengthFloor(stats.system_bytes - stats.unmapped_bytes);
+  const Length subreleased = allocator.FillerUsedPagesInSubreleased();
+  s.coverage = s.used == Length(0)
+                   ? 1
+                   : 1 - std::min(1.0, static_cast<double>(
+                                           subreleased.raw_num()) /
+                                           s.used.raw_num());
+  s.released = allocator.GetReleaseStats();
+  return s;
+}
+
+int Run(const std::vector<char*>& args) {
+  if (args.size() != 1) {
+    absl::FPrintF(stderr,
+                  "Usage: huge_page_aware_allocator_simulator [flags] trace\n");
+    return 2;
+  }
+  const std::string predictor_name = absl::GetFlag(FLAGS_predictor);
+  const absl::Duration lifetime_threshold =
+      absl::GetFlag(FLAGS_lifetime_threshold);
+  std::unique_ptr<PlacementPredictor> predictor;
+  if (predictor_name != "trace") {
+    predictor = MakePlacementPredictor(predictor_name, lifetime_threshold);
+    if (predictor == nullptr) {
+      absl::FPrintF(stderr, "Unknown predictor %s\n", predictor_name);
+      return 2;
+    }
+  }
+  std::vector<Event> events;
+  if (!ReadTrace(args[0], events)) return 1;
+
+  HugePageAwareAllocatorOptions options;
+  options.tag = MemoryTag::kNormal;
+  options.huge_cache_time = absl::GetFlag(FLAGS_huge_cache_time);
+  options.clock = Clock{.now = SimulatedNow, .freq = SimulatedFrequency};
+  // HugePageAwareAllocator can't be destroyed cleanly, so we construct it in
+  // place and leak it.
+  Allocator* allocator = new (malloc(sizeof(Allocator))) Allocator(options);
+  SimulatorForwarder& forwarder = allocator->forwarder();
+  forwarder.set_filler_skip_subrelease_short_interval(
+      absl::GetFlag(FLAGS_filler_skip_subrelease_short_interval));
+  forwarder.set_filler_skip_subrelease_long_interval(
+      absl::GetFlag(FLAGS_filler_skip_subrelease_long_interval));
+  forwarder.set_release_partial_alloc_pages(
+      absl::GetFlag(FLAGS_release_partial_alloc_pages));
+  forwarder.set_hpaa_subrelease(absl::GetFlag(FLAGS_hpaa_subrelease));
+  forwarder.set_huge_region_demand_based_release(
+      absl::GetFlag(FLAGS_huge_region_demand_based_release));
+  forwarder.set_huge_cache_demand_based_release(
+      absl::GetFlag(FLAGS_huge_cache_demand_based_release));
+
+  const int64_t background_interval =
+      absl::ToInt64Nanoseconds(absl::GetFlag(FLAGS_background_interval));
+  const int64_t report_interval =
+      absl::ToInt64Nanoseconds(absl::GetFlag(FLAGS_report_interval));
+  if (background_interval <= 0 || report_interval <= 0) {
+    absl::FPrintF(stderr, "Intervals must be positive\n");
+    return 2;
+  }
+  const Length release_per_interval = BytesToLengthFloor(static_cast<size_t>(
+      absl::GetFlag(FLAGS_release_rate) *
+      absl::ToDoubleSeconds(absl::GetFlag(FLAGS_background_interval))));
+
+  constexpr double kMiB = 1 << 20;
+  absl::PrintF("%10s %10s %10s %9s %12s %12s\n", "minutes", "used_MiB",
+               "rss_MiB", "coverage", "released_MiB", "release_calls");
+  auto report = [&](const Sample& s) {
+    absl::PrintF("%10.2f %10.1f %10.1f %8.2f%% %12.1f %12u\n",
+                 simulated_now / 60e9, s.used.in_bytes() / kMiB,
+                 s.rss.in_bytes() / kMiB, 100 * s.coverage,
+                 s.released.total.in_bytes() / kMiB, forwarder.release_calls_);
+  };
+
+  struct Live {
+    Span* span;
+    size_t objects_per_span;
+  };
+  absl::flat_hash_map<uint64_t, Live> live;
+  Length peak_rss;
+  double coverage_sum = 0;
+  size_t coverage_samples = 0;
+  simulated_now = events.empty() ? 0 : events.front().time;
+  int64_t next_background = simulated_now + background_interval;
+  int64_t next_report = simulated_now + report_interval;
+  std::optional<LifetimeObserver> observer;
+  if (predictor != nullptr) observer.emplace(*predictor, lifetime_threshold);
+
+  // Runs the background releases and reports due by <time>.
+  auto advance_to = [&](int64_t time) {
+    while (std::min(next_background, next_report) <= time) {
+      if (next_background <= next_report) {
+        simulated_now = next_background;
+        next_background += background_interval;
+        {
+          PageHeapSpinLockHolder l;
+          allocator->ReleaseAtLeastNPages(
+              release_per_interval,
+              PageReleaseReason::kProcessBackgroundActions);
+        }
+        // Sampling every background interval weighs the average by time.
+        const Sample s = TakeSample(*allocator);
+        peak_rss = std::max(peak_rss, s.rss);
+        coverage_sum += s.coverage;
+        ++coverage_samples;
+      } else {
+        simulated_now = next_report;
+        next_report += report_interval;
+        report(TakeSample(*allocator));
+      }
+    }
+    simulated_now = time;
+    if (observer.has_value()) observer->AdvanceTo(time);
+  };
+
+  size_t skipped = 0;
+  for (const Event& e : events) {
+    advance_to(e.time);
+    if (e.is_new) {
+      SpanAllocInfo info = e.info;
+      if (observer.has_value()) {
+        const TracedSpan traced = {.stack_hash = e.stack_hash,
+                                   .alloc_time = e.time,
+                                   .free_time = e.free_time};
+        info.lifetime = predictor->Predict(traced);
+        observer->Allocated(e.id, traced, info.lifetime);
+      }
+      Span* span = e.align > Length(1)
+                       ? allocator->NewAligned(e.pages, e.align, info)
+                       : allocator->New(e.pages, info);
+      TC_CHECK_NE(span, nullptr);
+      if (!live.try_emplace(e.id, Live{span, e.info.objects_per_span})
+               .second) {
+        absl::FPrintF(stderr, "span %u allocated twice\n", e.id);
+        return 1;
+      }
+    } else {
+      auto it = live.find(e.id);
+      if (it == live.end()) {
+        // The span was allocated before the trace started.
+        ++skipped;
+        continue;
+      }
+      if (observer.has_value()) observer->Freed(e.id, e.time);
+      PageHeapSpinLockHolder l;
+      allocator->Delete(it->second.span, it->second.objects_per_span);
+      live.erase(it);
+    }
+  }
+  const Sample last = TakeSample(*allocator);
+  report(last);
+  peak_rss = std::max(peak_rss, last.rss);
+
+  absl::PrintF(
+      "\nsimulated %s with %u events (%u deletes skipped): peak RSS %.1f MiB, "
+      "average hugepage coverage %.2f%%, %.1f MiB released in %u calls\n",
+      absl::FormatDuration(absl::Nanoseconds(
+          events.empty() ? 0 : events.back().time - events.front().time)),
+      events.size(), skipped, peak_rss.in_bytes() / kMiB,
+      100 * (coverage_samples > 0 ? coverage_sum / coverage_samples
+                                  : last.coverage),
+      last.released.total.in_bytes() / kMiB, forwarder.release_calls_);
+  if (observer.has_value()) {
+    // Spans still live at the end of the trace are not counted.
+    const LifetimeObserver::Stats& stats = observer->stats();
+    absl::PrintF(
+        "predictor %s: %u short-lived and %u long-lived spans, %u predicted "
+        "short-lived, %u of them mispredicted, %u short-lived spans missed\n",
+        predictor_name, stats.short_lived, stats.long_lived,
+        stats.predicted_short_lived, stats.mispredicted_short_lived,
+        stats.missed_short_lived);
+  }
+  if (absl::GetFlag(FLAGS_print_stats)) {
+    std::string output(1 << 20, '\0');
+    Printer printer(&output[0], output.size());
+    allocator->Print(&printer, /*everything=*/true);
+    output.resize(std::min(printer.SpaceRequired(), output.size()));
+    absl::PrintF("\n%s", output);
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+
+int main(int argc, char** argv) {
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  args.erase(args.begin());
+  return tcmalloc::tcmalloc_internal::Run(args);
+}
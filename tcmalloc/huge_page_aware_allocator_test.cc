@@ -16,6 +16,7 @@
 
 #include <errno.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -25,6 +26,7 @@
 #include <cstdint>
 #include <limits>
 #include <memory>
+#include <optional>
 #include <string>
 #include <thread>  // NOLINT(build/c++11)
 #include <utility>
@@ -56,6 +58,7 @@
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/page_size.h"
 #include "tcmalloc/internal/parameter_accessors.h"
+#include "tcmalloc/lifetime_predictions.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/page_allocator_test_util.h"
 #include "tcmalloc/pages.h"
@@ -87,11 +90,22 @@ class HugePageAwareAllocatorTest
     // HugePageAwareAllocator can't be destroyed cleanly, so we store a pointer
     // to one and construct in place.
     void* p = malloc(sizeof(HugePageAwareAllocator));
+    allocator_ = new (p) HugePageAwareAllocator(Options(MemoryTag::kNormal));
+  }
+
+  HugePageAwareAllocatorOptions Options(MemoryTag tag) {
     HugePageAwareAllocatorOptions options;
-    options.tag = MemoryTag::kNormal;
+    options.tag = tag;
     // TODO(b/242550501): Parameterize other parts of the options.
     options.use_huge_region_more_often = GetParam();
-    allocator_ = new (p) HugePageAwareAllocator(options);
+    return options;
+  }
+
+  // Replaces the allocator, which must be empty, with one for <tag>.  As in
+  // the destructor, the old allocator's memory is leaked.
+  void ResetAllocator(MemoryTag tag) {
+    TC_CHECK(ids_.empty());
+    allocator_ = new (allocator_) HugePageAwareAllocator(Options(tag));
   }
 
   ~HugePageAwareAllocatorTest() override {
@@ -305,6 +319,59 @@ TEST_P(HugePageAwareAllocatorTest, JustUnderMultipleOfHugepages) {
   }
 }
 
+TEST_P(HugePageAwareAllocatorTest, Reserve) {
+  const SpanAllocInfo kSpanInfo = {1, AccessDensityPrediction::kDense};
+  const Length n = 4 * kPagesPerHugePage - Length(1);
+  const size_t free_before = GetFreeBytes();
+
+  const Length reserved = allocator_->Reserve(n, /*populate=*/true);
+  ASSERT_GE(reserved, n);
+  EXPECT_EQ(reserved % kPagesPerHugePage, Length(0));
+  EXPECT_EQ(GetFreeBytes(), free_before + reserved.in_bytes());
+
+  // The reserved hugepages satisfy a subsequent allocation without growing
+  // the heap.
+  BackingStats before;
+  {
+    PageHeapSpinLockHolder l;
+    before = allocator_->stats();
+  }
+  Span* span = New(n, kSpanInfo);
+  BackingStats after;
+  {
+    PageHeapSpinLockHolder l;
+    after = allocator_->stats();
+  }
+  EXPECT_EQ(after.system_bytes, before.system_bytes);
+  Delete(span, kSpanInfo.objects_per_span);
+}
+
+TEST_P(HugePageAwareAllocatorTest, SampleHugepageBacking) {
+  const SpanAllocInfo kSpanInfo = {1, AccessDensityPrediction::kDense};
+  std::vector<Span*> spans;
+  for (int i = 0; i < 4; ++i) {
+    spans.push_back(New(kPagesPerHugePage - Length(1), kSpanInfo));
+  }
+
+  EXPECT_EQ(allocator_->SampleHugepageBacking(NHugePages(2)), NHugePages(2));
+  HugePageBackingStats stats;
+  {
+    PageHeapSpinLockHolder l;
+    stats = allocator_->GetHugepageBackingStats();
+  }
+  EXPECT_GE(stats.intact, NHugePages(4));
+  EXPECT_EQ(stats.sampled, NHugePages(2));
+  // Whether the hugepages are THPs, and whether we can tell at all, depends on
+  // the kernel.
+  EXPECT_LE(stats.small_page_backed + stats.unknown, stats.sampled);
+  EXPECT_LE(stats.EstimatedSmallPageBackedBytes(), stats.intact.in_bytes());
+  EXPECT_THAT(PrintInPbtxt(), HasSubstr("hugepage_backing"));
+
+  for (Span* span : spans) {
+    Delete(span, kSpanInfo.objects_per_span);
+  }
+}
+
 TEST_P(HugePageAwareAllocatorTest, Multithreaded) {
   static const size_t kThreads = 16;
   std::vector<std::thread> threads;
@@ -414,6 +481,59 @@ TEST_P(HugePageAwareAllocatorTest, SettingDemandBasedReleaseFlags) {
   EXPECT_EQ(Parameters::huge_cache_demand_based_release(), false);
 }
 
+// Returns whether the mapping containing <p> is included in core dumps, from
+// its VmFlags in /proc/self/smaps, or nullopt if they could not be read.
+std::optional<bool> IsDumpable(const void* p) {
+  FILE* f = fopen("/proc/self/smaps", "r");
+  if (f == nullptr) return std::nullopt;
+  const uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+  std::optional<bool> result;
+  bool in_mapping = false;
+  char line[1024];
+  while (!result.has_value() && fgets(line, sizeof(line), f) != nullptr) {
+    uintptr_t start, end;
+    if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+      in_mapping = start <= addr && addr < end;
+    } else if (in_mapping && strncmp(line, "VmFlags:", 8) == 0) {
+      result = strstr(line, " dd") == nullptr;
+    }
+  }
+  fclose(f);
+  return result;
+}
+
+TEST_P(HugePageAwareAllocatorTest, ExcludeFreeFromCoreDumps) {
+  const bool old_exclude = Parameters::exclude_free_from_core_dumps();
+  const bool old_demand_based = Parameters::huge_cache_demand_based_release();
+  Parameters::set_exclude_free_from_core_dumps(true);
+  // Keep the freed hugepage cached until it is reused.
+  Parameters::set_huge_cache_demand_based_release(true);
+
+  const SpanAllocInfo kSpanInfo = {1, AccessDensityPrediction::kSparse};
+  Span* span = New(kPagesPerHugePage, kSpanInfo);
+  void* const p = span->start_address();
+  if (!IsDumpable(p).has_value()) {
+    Delete(span, kSpanInfo.objects_per_span);
+    Parameters::set_exclude_free_from_core_dumps(old_exclude);
+    Parameters::set_huge_cache_demand_based_release(old_demand_based);
+    GTEST_SKIP() << "Cannot read /proc/self/smaps";
+  }
+  EXPECT_THAT(IsDumpable(p), testing::Optional(true));
+  Delete(span, kSpanInfo.objects_per_span);
+  EXPECT_THAT(IsDumpable(p), testing::Optional(false));
+
+  // Turning the parameter off must not leave reused memory out of dumps.
+  Parameters::set_exclude_free_from_core_dumps(false);
+  span = New(kPagesPerHugePage, kSpanInfo);
+  EXPECT_EQ(span->start_address(), p);
+  EXPECT_THAT(IsDumpable(p), testing::Optional(true));
+  Delete(span, kSpanInfo.objects_per_span);
+  EXPECT_THAT(IsDumpable(p), testing::Optional(true));
+
+  Parameters::set_exclude_free_from_core_dumps(old_exclude);
+  Parameters::set_huge_cache_demand_based_release(old_demand_based);
+}
+
 TEST_P(HugePageAwareAllocatorTest, ReleasingSmall) {
   const bool old_subrelease = Parameters::hpaa_subrelease();
   Parameters::set_hpaa_subrelease(true);
@@ -458,6 +578,42 @@ TEST_P(HugePageAwareAllocatorTest, ReleasingSmall) {
       old_skip_subrelease_long_interval);
 }
 
+TEST_P(HugePageAwareAllocatorTest, ColdReleasingSmall) {
+  // The cold heap subreleases free filler pages regardless of the recent
+  // demand and of whether hugepages are partially allocated.
+  const bool old_release_partial = Parameters::release_partial_alloc_pages();
+  Parameters::set_release_partial_alloc_pages(false);
+  const absl::Duration old_skip_subrelease_interval =
+      Parameters::filler_skip_subrelease_interval();
+  Parameters::set_filler_skip_subrelease_interval(absl::Minutes(10));
+
+  ResetAllocator(MemoryTag::kCold);
+
+  std::vector<Span*> live, dead;
+  static const size_t N = kPagesPerHugePage.raw_num() * 128;
+  const SpanAllocInfo kSpanInfo = {1, AccessDensityPrediction::kSparse};
+  for (int i = 0; i < N; ++i) {
+    Span* span = New(Length(1), kSpanInfo);
+    ((i % 2 == 0) ? live : dead).push_back(span);
+  }
+
+  for (auto d : dead) {
+    Delete(d, kSpanInfo.objects_per_span);
+  }
+
+  EXPECT_GE(
+      ReleasePages(Length(1),
+                   /*reason=*/PageReleaseReason::kProcessBackgroundActions),
+      kPagesPerHugePage / 2);
+
+  for (auto l : live) {
+    Delete(l, kSpanInfo.objects_per_span);
+  }
+
+  Parameters::set_release_partial_alloc_pages(old_release_partial);
+  Parameters::set_filler_skip_subrelease_interval(old_skip_subrelease_interval);
+}
+
 TEST_P(HugePageAwareAllocatorTest, HardReleaseSmall) {
   std::vector<Span*> live, dead;
   static const size_t N = kPagesPerHugePage.raw_num() * 128;
@@ -739,6 +895,113 @@ TEST_P(HugePageAwareAllocatorTest, DonatedHugePages) {
   EXPECT_THAT(PrintInPbtxt(), HasSubstr("filler_abandoned_pages: 0"));
 }
 
+TEST_P(HugePageAwareAllocatorTest, LifetimeBasedAllocation) {
+  // Once a stack's large allocations have been short-lived often enough, its
+  // next allocation goes to the lifetime regions instead of donating slack to
+  // the filler.
+  const bool old_lifetime_based_allocation =
+      Parameters::lifetime_based_allocation();
+  Parameters::set_lifetime_based_allocation(true);
+
+  static constexpr Length kLargeSize = 2 * kPagesPerHugePage - Length(2);
+  const SpanAllocInfo kSpanInfo = {1, AccessDensityPrediction::kSparse};
+  // All allocations need to come from the same stack.
+  for (int i = 0; i <= LifetimeDatabase::kMinSamples; ++i) {
+    Span* large = New(kLargeSize, kSpanInfo);
+    BackingStats lifetime_stats;
+    HugeLength donated_huge_pages;
+    {
+      PageHeapSpinLockHolder l;
+      lifetime_stats = allocator_->lifetime_region().stats();
+      donated_huge_pages = allocator_->DonatedHugePages();
+    }
+    const size_t lifetime_used = lifetime_stats.system_bytes -
+                                 lifetime_stats.free_bytes -
+                                 lifetime_stats.unmapped_bytes;
+    if (i < LifetimeDatabase::kMinSamples) {
+      EXPECT_EQ(lifetime_used, 0);
+      EXPECT_EQ(donated_huge_pages, NHugePages(1));
+    } else {
+      EXPECT_EQ(lifetime_used, kLargeSize.in_bytes());
+      EXPECT_EQ(donated_huge_pages, NHugePages(0));
+    }
+    Delete(large, kSpanInfo.objects_per_span);
+  }
+
+  {
+    PageHeapSpinLockHolder l;
+    const LifetimePredictor::Stats stats =
+        allocator_->lifetime_predictor().stats();
+    EXPECT_EQ(stats.tracked, LifetimeDatabase::kMinSamples + 1);
+    EXPECT_EQ(stats.predicted_short_lived, 1);
+    EXPECT_EQ(stats.short_lived, LifetimeDatabase::kMinSamples + 1);
+  }
+  EXPECT_THAT(Print(), HasSubstr("HugePageAware: lifetime"));
+  EXPECT_THAT(PrintInPbtxt(), HasSubstr("lifetime_predictor"));
+
+  Parameters::set_lifetime_based_allocation(old_lifetime_based_allocation);
+}
+
+TEST_P(HugePageAwareAllocatorTest, ShortLivedLargeSpansUseLifetimeRegions) {
+  // Large allocations hinted to be short-lived go to the lifetime regions
+  // without waiting for a prediction, and do not donate slack to the filler.
+  static constexpr Length kLargeSize = 2 * kPagesPerHugePage - Length(2);
+  const SpanAllocInfo kShortLived = {1, AccessDensityPrediction::kSparse,
+                                     SpanLifetime::kShortLived};
+
+  auto LifetimeUsedBytes = [&]() {
+    PageHeapSpinLockHolder l;
+    const BackingStats stats = allocator_->lifetime_region().stats();
+    return stats.system_bytes - stats.free_bytes - stats.unmapped_bytes;
+  };
+
+  Span* large = New(kLargeSize, kShortLived);
+  EXPECT_EQ(LifetimeUsedBytes(), kLargeSize.in_bytes());
+  {
+    PageHeapSpinLockHolder l;
+    EXPECT_EQ(allocator_->DonatedHugePages(), NHugePages(0));
+  }
+
+  Delete(large, kShortLived.objects_per_span);
+  EXPECT_EQ(LifetimeUsedBytes(), 0);
+}
+
+TEST_P(HugePageAwareAllocatorTest, LargeHugeRegions) {
+  const bool old_large_huge_regions = Parameters::large_huge_regions();
+  Parameters::set_large_huge_regions(true);
+  const SpanAllocInfo kSpanInfo = {1, AccessDensityPrediction::kSparse};
+
+  auto LargeUsedBytes = [&]() {
+    PageHeapSpinLockHolder l;
+    const BackingStats stats = allocator_->large_region().stats();
+    return stats.system_bytes - stats.free_bytes - stats.unmapped_bytes;
+  };
+
+  // Multi-MiB allocations go to the large regions, without donating their
+  // tails to the filler; exact multiples of hugepages and smaller allocations
+  // do not.
+  const Length kMultiMiB = 5 * kPagesPerHugePage + Length(3);
+  std::vector<Span*> spans;
+  for (int i = 0; i < 3; ++i) {
+    spans.push_back(New(kMultiMiB, kSpanInfo));
+  }
+  EXPECT_EQ(LargeUsedBytes(), 3 * kMultiMiB.in_bytes());
+  {
+    PageHeapSpinLockHolder l;
+    EXPECT_EQ(allocator_->DonatedHugePages(), NHugePages(0));
+    EXPECT_EQ(allocator_->large_region().ActiveRegions(), 1);
+  }
+  spans.push_back(New(4 * kPagesPerHugePage, kSpanInfo));
+  spans.push_back(New(kPagesPerHugePage - Length(1), kSpanInfo));
+  EXPECT_EQ(LargeUsedBytes(), 3 * kMultiMiB.in_bytes());
+
+  for (Span* s : spans) {
+    Delete(s, kSpanInfo.objects_per_span);
+  }
+  EXPECT_EQ(LargeUsedBytes(), 0);
+  Parameters::set_large_huge_regions(old_large_huge_regions);
+}
+
 TEST_P(HugePageAwareAllocatorTest, SmallDonations) {
   // This test works with small donations (kHugePageSize/2,kHugePageSize]-bytes
   // in size to check statistics.
@@ -1028,6 +1291,131 @@ TEST_P(HugePageAwareAllocatorTest, NotDonated) {
   EXPECT_EQ(abandoned_pages, Length(0));
 }
 
+TEST_P(HugePageAwareAllocatorTest, AlignedAboveHugepage) {
+  const SpanAllocInfo kSpanInfo = {1, AccessDensityPrediction::kSparse};
+  const Length align = 4 * kPagesPerHugePage;
+  std::vector<Span*> spans;
+  for (Length n :
+       {Length(1), kPagesPerHugePage + Length(1), 3 * kPagesPerHugePage}) {
+    Span* s = allocator_->NewAligned(n, align, kSpanInfo);
+    ASSERT_NE(s, nullptr);
+    EXPECT_EQ(s->first_page().index() % align.raw_num(), 0);
+    EXPECT_EQ(s->num_pages(), n);
+    spans.push_back(s);
+  }
+
+  AlignedAllocStats stats;
+  {
+    PageHeapSpinLockHolder l;
+    stats = allocator_->GetAlignedAllocStats();
+  }
+  EXPECT_EQ(stats.allocs, 3);
+  EXPECT_EQ(stats.region_allocs, 0);
+  // Each allocation takes at most three hugepages beyond its own.
+  EXPECT_LE(stats.slop, NHugePages(9));
+
+  for (Span* s : spans) {
+    AllocatorDelete(s, kSpanInfo.objects_per_span);
+  }
+}
+
+TEST_P(HugePageAwareAllocatorTest, ShortLivedSpansUseSeparateHugepages) {
+  const SpanAllocInfo kLongLived = {1, AccessDensityPrediction::kSparse};
+  const SpanAllocInfo kShortLived = {1, AccessDensityPrediction::kSparse,
+                                     SpanLifetime::kShortLived};
+
+  auto FillerSystemBytes = [&]() {
+    PageHeapSpinLockHolder l;
+    return allocator_->FillerStats().system_bytes;
+  };
+
+  Span* long_lived = New(Length(1), kLongLived);
+  Span* short_lived1 = New(Length(1), kShortLived);
+  Span* short_lived2 = New(Length(1), kShortLived);
+  EXPECT_NE(HugePageContaining(long_lived->first_page()),
+            HugePageContaining(short_lived1->first_page()));
+  EXPECT_EQ(HugePageContaining(short_lived1->first_page()),
+            HugePageContaining(short_lived2->first_page()));
+  EXPECT_EQ(FillerSystemBytes(), 2 * kHugePageSize);
+
+  // Freeing the short-lived spans empties their hugepage, even though the
+  // long-lived span is still allocated.
+  Delete(short_lived1, kShortLived.objects_per_span);
+  Delete(short_lived2, kShortLived.objects_per_span);
+  EXPECT_EQ(FillerSystemBytes(), kHugePageSize);
+
+  Delete(long_lived, kLongLived.objects_per_span);
+  EXPECT_EQ(FillerSystemBytes(), 0);
+}
+
+TEST_P(HugePageAwareAllocatorTest, ShortLivedSpansPackDonatedTails) {
+  const bool old_donated_tail_packing = Parameters::donated_tail_packing();
+  Parameters::set_donated_tail_packing(true);
+  const SpanAllocInfo kLongLived = {1, AccessDensityPrediction::kSparse};
+  const SpanAllocInfo kShortLived = {1, AccessDensityPrediction::kSparse,
+                                     SpanLifetime::kShortLived};
+
+  auto TailStats = [&]() {
+    PageHeapSpinLockHolder l;
+    return allocator_->GetDonatedTailStats();
+  };
+
+  Span* large = New(kPagesPerHugePage + Length(1), kLongLived);
+  DonatedTailStats stats = TailStats();
+  EXPECT_EQ(stats.tails, NHugePages(1));
+  EXPECT_EQ(stats.untouched, NHugePages(1));
+  EXPECT_EQ(stats.used_pages, Length(1));
+  EXPECT_EQ(stats.other_pages, Length(0));
+
+  Span* short_lived = New(Length(1), kShortLived);
+  EXPECT_EQ(HugePageContaining(short_lived->first_page()),
+            HugePageContaining(large->last_page()));
+  stats = TailStats();
+  EXPECT_EQ(stats.tails, NHugePages(1));
+  EXPECT_EQ(stats.untouched, NHugePages(0));
+  EXPECT_EQ(stats.used_pages, Length(2));
+  EXPECT_EQ(stats.other_pages, Length(1));
+  EXPECT_THAT(Print(), HasSubstr("HugePageAware: donated tails 1"));
+  EXPECT_THAT(PrintInPbtxt(), HasSubstr("other_pages: 1"));
+
+  // Once the short-lived span is gone, the whole range is returned with its
+  // owner, rather than leaving an abandoned tail behind.
+  Delete(short_lived, kShortLived.objects_per_span);
+  Delete(large, kLongLived.objects_per_span);
+  stats = TailStats();
+  EXPECT_EQ(stats.tails, NHugePages(0));
+  {
+    PageHeapSpinLockHolder l;
+    EXPECT_EQ(allocator_->AbandonedPages(), Length(0));
+    EXPECT_EQ(allocator_->FillerStats().system_bytes, 0);
+  }
+
+  Parameters::set_donated_tail_packing(old_donated_tail_packing);
+}
+
+TEST_P(HugePageAwareAllocatorTest, ZeroedHugePages) {
+  const SpanAllocInfo kSpanInfo = {1, AccessDensityPrediction::kSparse};
+  const Length kSize = NHugePages(2).in_pages();
+
+  // Fresh hugepages come from the system, and are zero unless releasing ever
+  // left pages intact.
+  Span* fresh = New(kSize, kSpanInfo);
+  EXPECT_EQ(fresh->zeroed(), SystemReleaseZeroes());
+  if (fresh->zeroed()) {
+    const char* p = static_cast<const char*>(fresh->start_address());
+    for (size_t i = 0; i < fresh->bytes_in_span(); i += kPageSize) {
+      ASSERT_EQ(p[i], 0);
+    }
+  }
+  memset(fresh->start_address(), 1, fresh->bytes_in_span());
+  Delete(fresh, kSpanInfo.objects_per_span);
+
+  // Hugepages reused from the cache are still backed, and hold stale data.
+  Span* reused = New(kSize, kSpanInfo);
+  EXPECT_FALSE(reused->zeroed());
+  Delete(reused, kSpanInfo.objects_per_span);
+}
+
 TEST_P(HugePageAwareAllocatorTest, PageMapInterference) {
   // This test manipulates the test HugePageAwareAllocator while making
   // allocations/deallocations that interact with the real PageAllocator. The
@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <limits>
 
 #include "absl/algorithm/container.h"
@@ -156,6 +157,12 @@ class PageTracker : public TList<PageTracker>::Elem {
   Length longest_free_range() const { return Length(free_.longest_free()); }
   size_t nallocs() const { return free_.allocs(); }
   Length used_pages() const { return Length(free_.used()); }
+  // Returns used_pages() as of the last Get or Put.  Unlike used_pages(), this
+  // may be read without holding pageheap_lock, for instance by the
+  // CentralFreeList to prefer spans on densely used hugepages.
+  Length used_pages_hint() const {
+    return Length(used_pages_hint_.load(std::memory_order_relaxed));
+  }
   Length released_pages() const { return Length(released_count_); }
   double alloctime() const { return alloctime_; }
   Length free_pages() const;
@@ -171,9 +178,25 @@ class PageTracker : public TList<PageTracker>::Elem {
   Length ReleaseFree(MemoryModifyFunction& unback)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Claims the next free, still backed, range of pages at or after index
+  // *from for release and advances *from past it.  The claimed pages are
+  // marked as in use, so that they cannot be allocated while they are being
+  // released without pageheap_lock.  Returns false if there is no such range.
+  // The claim is returned with Put(), followed by MarkReleased() if the pages
+  // were released.
+  bool ClaimForRelease(size_t* from, PageId* p, Length* n)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Records that the free pages [p, p + n) have been returned to the system.
+  void MarkReleased(PageId p, Length n)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   void AddSpanStats(SmallSpanStats* small, LargeSpanStats* large) const;
   bool HasDenseSpans() const { return has_dense_spans_; }
   void SetHasDenseSpans() { has_dense_spans_ = true; }
+  // Whether this hugepage only holds spans expected to be short-lived.
+  bool short_lived() const { return short_lived_; }
+  void set_short_lived(bool v) { short_lived_ = v; }
 
  private:
   HugePage location_;
@@ -214,6 +237,13 @@ class PageTracker : public TList<PageTracker>::Elem {
                 "nallocs must be able to support kPagesPerHugePage!");
 
   bool has_dense_spans_ = false;
+  bool short_lived_ = false;
+
+  std::atomic<uint16_t> used_pages_hint_ = 0;
+
+  void UpdateUsedPagesHint() {
+    used_pages_hint_.store(free_.used(), std::memory_order_relaxed);
+  }
 
   ABSL_MUST_USE_RESULT bool ReleasePages(PageId p, Length n,
                                          MemoryModifyFunction& unback) {
@@ -254,6 +284,10 @@ enum class HugePageFillerDenseTrackerType : bool {
   kSpansAllocated,
 };
 
+namespace huge_page_filler_internal {
+class UsageInfo;
+}  // namespace huge_page_filler_internal
+
 // This tracks a set of unfilled hugepages, and fulfills allocations
 // with a goal of filling some hugepages as tightly as possible and emptying
 // out the remainder.
@@ -289,6 +323,12 @@ class HugePageFiller {
   TryGetResult TryGet(Length n, SpanAllocInfo span_alloc_info)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Like TryGet for a sparse span, but only places it on the unused tail of a
+  // freshly donated hugepage.  Spans that are freed soon, like their owner,
+  // leave the tail empty again so that it can be returned with the owner.
+  TryGetResult TryGetDonated(Length n)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   // Marks [p, p + n) as usable by new allocations into *pt; returns pt
   // if that hugepage is now empty (nullptr otherwise.)
   // REQUIRES: pt is owned by this object (has been Contribute()), and
@@ -296,6 +336,19 @@ class HugePageFiller {
   TrackerType* Put(TrackerType* pt, PageId p, Length n)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // ReleasePages releases memory without holding pageheap_lock, during which
+  // a concurrent Put may free the last allocation on a hugepage that is being
+  // released.  Such a hugepage becomes empty once its release completes.
+  // Returns one of these hugepages, as Put would have, or nullptr if there
+  // are none.
+  TrackerType* TakeEmptiedByRelease()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    if (emptied_by_release_.empty()) return nullptr;
+    TrackerType* pt = emptied_by_release_.first();
+    emptied_by_release_.remove(pt);
+    return pt;
+  }
+
   // Contributes a tracker to the filler. If "donated," then the tracker is
   // marked as having come from the tail of a multi-hugepage allocation, which
   // causes it to be treated slightly differently.
@@ -352,6 +405,28 @@ class HugePageFiller {
 
   Length FreePagesInPartialAllocs() const;
 
+  // Returns the oldest hugepage that was subreleased and has since been fully
+  // backed again by allocations, which we may collapse back to a hugepage
+  // mapping.  Returns false if there are none.  The hugepage may have been
+  // released again, or have left the filler, since it was queued.
+  bool TakeCollapseCandidate(HugePage* p)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Records the outcome of collapsing a candidate.
+  void RecordCollapse(bool success)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    if (success) {
+      ++collapsed_huge_pages_;
+    } else {
+      ++failed_collapse_huge_pages_;
+    }
+  }
+
+  HugeLength collapsed_huge_pages() const { return collapsed_huge_pages_; }
+  HugeLength failed_collapse_huge_pages() const {
+    return failed_collapse_huge_pages_;
+  }
+
   // Fraction of used pages that are on non-released hugepages and
   // thus could be backed by kernel hugepages. (Of course, we can't
   // guarantee that the kernel had available 2-mib regions of physical
@@ -373,10 +448,25 @@ class HugePageFiller {
   // be greater than the desired number of pages.
   // Returns the number of pages actually released. The releasing target can be
   // reduced by skip subrelease which is disabled if all intervals are zero.
+  // Pages that unback_without_lock_ reports were not resident are released
+  // but not counted, as releasing them did not lower RSS.
+  //
+  // Unless break_hugepages or hit_limit is set, only hugepages that are
+  // already subreleased are released from, so that intact hugepages stay
+  // intact until they are freed and released whole.
   static constexpr double kPartialAllocPagesRelease = 0.1;
   Length ReleasePages(Length desired, SkipSubreleaseIntervals intervals,
-                      bool release_partial_alloc_pages, bool hit_limit)
+                      bool release_partial_alloc_pages, bool hit_limit,
+                      bool break_hugepages = true)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Returns <intervals> scaled to keep the share of subreleased pages that are
+  // refaulted shortly afterwards near <target_refault_rate>.  See
+  // SkipSubreleaseIntervalTuner.
+  SkipSubreleaseIntervals TuneSkipSubreleaseIntervals(
+      SkipSubreleaseIntervals intervals, double target_refault_rate) {
+    return interval_tuner_.Tune(intervals, target_refault_rate);
+  }
   // Number of candidate hugepages selected in each iteration for releasing
   // their free memory.
   static constexpr size_t kCandidatesForReleasingMemory =
@@ -390,6 +480,11 @@ class HugePageFiller {
   HugePageFillerStats GetStats() const;
   void Print(Printer* out, bool everything) const;
   void PrintInPbtxt(PbtxtRegion* hpaa) const;
+  // As PrintInPbtxt, but records the fullness histograms in <usage> instead of
+  // printing them.  They are built from every hugepage, and are most of the
+  // output, so this lets the caller print them after releasing pageheap_lock.
+  void PrintInPbtxt(PbtxtRegion* hpaa,
+                    huge_page_filler_internal::UsageInfo* usage) const;
 
   template <typename F>
   void ForEachHugePage(const F& func)
@@ -408,6 +503,16 @@ class HugePageFiller {
 
   SubreleaseStats subrelease_stats_;
 
+  // Ring buffer of collapse candidates.  When it is full, the oldest
+  // candidate is dropped; it has had the longest to be collapsed by
+  // khugepaged already.
+  static constexpr size_t kMaxCollapseCandidates = 256;
+  HugePage collapse_candidates_[kMaxCollapseCandidates];
+  size_t collapse_candidates_begin_ = 0;
+  size_t collapse_candidates_size_ = 0;
+  HugeLength collapsed_huge_pages_;
+  HugeLength failed_collapse_huge_pages_;
+
   // We group hugepages first by longest-free (as a measure of fragmentation),
   // then into kChunks chunks inside there by desirability of
   // allocation.
@@ -459,6 +564,8 @@ class HugePageFiller {
   void PrintAllocStatsInPbtxt(absl::string_view field, PbtxtRegion* hpaa,
                               const HugePageFillerStats& stats,
                               AccessDensityPrediction count) const;
+  // Records every hugepage in the fullness histograms of <usage>.
+  void RecordUsage(huge_page_filler_internal::UsageInfo* usage) const;
   // CompareForSubrelease identifies the worse candidate for subrelease, between
   // the choice of huge pages a and b.
   static bool CompareForSubrelease(TrackerType* a, TrackerType* b) {
@@ -487,8 +594,24 @@ class HugePageFiller {
                               size_t tracker_start);
 
   // Release desired pages from the page trackers in candidates.  Returns the
-  // number of pages released.
-  Length ReleaseCandidates(absl::Span<TrackerType*> candidates, Length target)
+  // number of resident pages released, which count toward target, and sets
+  // *released to the number of pages released.
+  //
+  // Free pages are claimed under pageheap_lock and released in a single
+  // batch with unback_without_lock_.  A candidate is only claimed if all of
+  // its free ranges fit in the batch, so at most kMaxReleaseBatch ranges are
+  // released per call.
+  Length ReleaseCandidates(absl::Span<TrackerType*> candidates, Length target,
+                           Length* released)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // A hugepage has at most kPagesPerHugePage / 2 free ranges, so this fits at
+  // least one candidate.
+  static constexpr size_t kMaxReleaseBatch = kPagesPerHugePage.raw_num();
+
+  // Implements Put.  If unbacked, [p, p + n) was a claim from
+  // ClaimForRelease and has been returned to the system.
+  TrackerType* PutInternal(TrackerType* pt, PageId p, Length n, bool unbacked)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   HugeLength size_;
@@ -504,14 +627,20 @@ class HugePageFiller {
   void UpdateFillerStatsTracker();
   using StatsTrackerType = SubreleaseStatsTracker<600>;
   StatsTrackerType fillerstats_tracker_;
+  SkipSubreleaseIntervalTuner interval_tuner_;
   Clock clock_;
   // TODO(b/73749855):  Remove remaining uses of unback_.
   MemoryModifyFunction& unback_;
   MemoryModifyFunction& unback_without_lock_;
+
+  // Hugepages that became empty while being released.  See
+  // TakeEmptiedByRelease.
+  TList<TrackerType> emptied_by_release_;
 };
 
 inline typename PageTracker::PageAllocation PageTracker::Get(Length n) {
   size_t index = free_.FindAndMark(n.raw_num());
+  UpdateUsedPagesHint();
 
   TC_ASSERT_EQ(released_by_page_.CountBits(0, kPagesPerHugePage.raw_num()),
                released_count_);
@@ -538,6 +667,7 @@ inline typename PageTracker::PageAllocation PageTracker::Get(Length n) {
 inline void PageTracker::Put(PageId p, Length n) {
   Length index = p - location_.first_page();
   free_.Unmark(index.raw_num(), n.raw_num());
+  UpdateUsedPagesHint();
 }
 
 inline Length PageTracker::ReleaseFree(MemoryModifyFunction& unback) {
@@ -589,6 +719,41 @@ inline Length PageTracker::ReleaseFree(MemoryModifyFunction& unback) {
   return Length(count);
 }
 
+inline bool PageTracker::ClaimForRelease(size_t* from, PageId* p, Length* n) {
+  size_t index = *from;
+  size_t backed_n;
+  // As in ReleaseFree, find the next range of still backed pages and claim
+  // the first free range that overlaps with it.
+  while (released_by_page_.NextFreeRange(index, &index, &backed_n)) {
+    size_t free_index;
+    size_t free_n;
+    if (free_.NextFreeRange(index, &free_index, &free_n) &&
+        free_index < index + backed_n) {
+      size_t end = std::min(free_index + free_n, index + backed_n);
+      size_t length = end - free_index;
+      TC_ASSERT_EQ(released_by_page_.CountBits(free_index, length), 0);
+      free_.Mark(free_index, length);
+
+      *p = location_.first_page() + Length(free_index);
+      *n = Length(length);
+      *from = end;
+      return true;
+    }
+    index += backed_n;
+  }
+  *from = index;
+  return false;
+}
+
+inline void PageTracker::MarkReleased(PageId p, Length n) {
+  size_t index = (p - location_.first_page()).raw_num();
+  TC_ASSERT_EQ(released_by_page_.CountBits(index, n.raw_num()), 0);
+  released_by_page_.SetRange(index, n.raw_num());
+  released_count_ += n.raw_num();
+  TC_ASSERT_LE(Length(released_count_), kPagesPerHugePage);
+  unbroken_ = false;
+}
+
 inline void PageTracker::AddSpanStats(SmallSpanStats* small,
                                       LargeSpanStats* large) const {
   size_t index = 0, n;
@@ -652,6 +817,7 @@ inline HugePageFiller<TrackerType>::HugePageFiller(
     : dense_tracker_type_(dense_tracker_type),
       size_(NHugePages(0)),
       fillerstats_tracker_(clock, absl::Minutes(10), absl::Minutes(5)),
+      interval_tuner_(clock),
       clock_(clock),
       unback_(unback),
       unback_without_lock_(unback_without_lock) {}
@@ -779,13 +945,29 @@ HugePageFiller<TrackerType>::TryGet(Length n, SpanAllocInfo span_alloc_info) {
 
   // If it was in a released state earlier, and is about to be full again,
   // record that the state has been toggled back and update the stat counter.
-  if (was_released && !pt->released() && !pt->was_released()) {
-    pt->set_was_released(/*status=*/true);
-    ++n_was_released_[type];
+  if (was_released && !pt->released()) {
+    if (!pt->was_released()) {
+      pt->set_was_released(/*status=*/true);
+      ++n_was_released_[type];
+    }
+
+    // The hugepage is fully backed again, but likely mapped with small pages.
+    size_t end = (collapse_candidates_begin_ + collapse_candidates_size_) %
+                 kMaxCollapseCandidates;
+    collapse_candidates_[end] = pt->location();
+    if (collapse_candidates_size_ < kMaxCollapseCandidates) {
+      ++collapse_candidates_size_;
+    } else {
+      collapse_candidates_begin_ =
+          (collapse_candidates_begin_ + 1) % kMaxCollapseCandidates;
+    }
   }
   TC_ASSERT(was_released || page_allocation.previously_unbacked == Length(0));
   TC_ASSERT_GE(unmapped_, page_allocation.previously_unbacked);
   unmapped_ -= page_allocation.previously_unbacked;
+  if (page_allocation.previously_unbacked > Length(0)) {
+    interval_tuner_.ReportRefaulted(page_allocation.previously_unbacked);
+  }
   // We're being used for an allocation, so we are no longer considered
   // donated by this point.
   TC_ASSERT(!pt->donated());
@@ -793,6 +975,23 @@ HugePageFiller<TrackerType>::TryGet(Length n, SpanAllocInfo span_alloc_info) {
   return {pt, page_allocation.page, was_released};
 }
 
+template <class TrackerType>
+inline typename HugePageFiller<TrackerType>::TryGetResult
+HugePageFiller<TrackerType>::TryGetDonated(Length n) {
+  TC_ASSERT_GT(n, Length(0));
+  ASSUME(n < kPagesPerHugePage);
+  TrackerType* pt = donated_alloc_.GetLeast(n.raw_num());
+  if (pt == nullptr) return {nullptr, PageId{0}, false};
+  TC_ASSERT_GE(pt->longest_free_range(), n);
+  const auto page_allocation = pt->Get(n);
+  // Donated hugepages are never released while they are donated.
+  TC_ASSERT_EQ(page_allocation.previously_unbacked, Length(0));
+  AddToFillerList(pt);
+  pages_allocated_[AccessDensityPrediction::kSparse] += n;
+  UpdateFillerStatsTracker();
+  return {pt, page_allocation.page, false};
+}
+
 // Marks [p, p + n) as usable by new allocations into *pt; returns pt
 // if that hugepage is now empty (nullptr otherwise.)
 // REQUIRES: pt is owned by this object (has been Contribute()), and
@@ -800,8 +999,19 @@ HugePageFiller<TrackerType>::TryGet(Length n, SpanAllocInfo span_alloc_info) {
 template <class TrackerType>
 inline TrackerType* HugePageFiller<TrackerType>::Put(TrackerType* pt, PageId p,
                                                      Length n) {
+  return PutInternal(pt, p, n, /*unbacked=*/false);
+}
+
+template <class TrackerType>
+inline TrackerType* HugePageFiller<TrackerType>::PutInternal(TrackerType* pt,
+                                                             PageId p, Length n,
+                                                             bool unbacked) {
   RemoveFromFillerList(pt);
   pt->Put(p, n);
+  if (unbacked) {
+    pt->MarkReleased(p, n);
+    unmapped_ += n;
+  }
   if (pt->HasDenseSpans()) {
     TC_ASSERT_GE(pages_allocated_[AccessDensityPrediction::kDense], n);
     pages_allocated_[AccessDensityPrediction::kDense] -= n;
@@ -848,7 +1058,12 @@ inline TrackerType* HugePageFiller<TrackerType>::Put(TrackerType* pt, PageId p,
     return pt;
   }
   AddToFillerList(pt);
-  UpdateFillerStatsTracker();
+  // Returning a claim does not change demand on the filler, so the filler
+  // stats are left to be reported by the next allocation or deallocation, as
+  // they were when releasing with the lock held.
+  if (!unbacked) {
+    UpdateFillerStatsTracker();
+  }
   return nullptr;
 }
 
@@ -921,25 +1136,36 @@ inline int HugePageFiller<TrackerType>::SelectCandidates(
 
 template <class TrackerType>
 inline Length HugePageFiller<TrackerType>::ReleaseCandidates(
-    absl::Span<TrackerType*> candidates, Length target) {
+    absl::Span<TrackerType*> candidates, Length target, Length* released) {
   absl::c_sort(candidates, CompareForSubrelease);
 
-  Length total_released;
+  // Claim the free, still backed, pages of the best candidates.  Claimed
+  // pages are accounted for as allocated until they are returned with
+  // PutInternal, so that neither they nor their hugepage can be reused while
+  // we have dropped pageheap_lock to release them.
+  std::array<MemoryModifyRange, kMaxReleaseBatch> batch;
+  std::array<TrackerType*, kMaxReleaseBatch> owners;
+  size_t batch_size = 0;
+  Length total_claimed;
   HugeLength total_broken = NHugePages(0);
 #ifndef NDEBUG
   Length last;
 #endif
-  for (int i = 0; i < candidates.size() && total_released < target; i++) {
+  for (int i = 0; i < candidates.size() && total_claimed < target; i++) {
     TrackerType* best = candidates[i];
     TC_ASSERT_NE(best, nullptr);
 
     // Verify that we have pages that we can release.
     TC_ASSERT_NE(best->free_pages(), Length(0));
-    // TODO(b/73749855):  This assertion may need to be relaxed if we release
-    // the pageheap_lock here.  A candidate could change state with another
-    // thread while we have the lock released for another candidate.
     TC_ASSERT_GT(best->free_pages(), best->released_pages());
 
+    // Each free range holds at least one page, so this bounds the number of
+    // ranges that we are about to claim.
+    if ((best->free_pages() - best->released_pages()).raw_num() >
+        batch.size() - batch_size) {
+      break;
+    }
+
 #ifndef NDEBUG
     // Double check that our sorting criteria were applied correctly.
     TC_ASSERT_LE(last, best->used_pages());
@@ -949,16 +1175,45 @@ inline Length HugePageFiller<TrackerType>::ReleaseCandidates(
     if (best->unbroken()) {
       ++total_broken;
     }
+    const AccessDensityPrediction type = best->HasDenseSpans()
+                                             ? AccessDensityPrediction::kDense
+                                             : AccessDensityPrediction::kSparse;
     RemoveFromFillerList(best);
-    Length ret = best->ReleaseFree(unback_);
-    unmapped_ += ret;
-    TC_ASSERT_GE(unmapped_, best->released_pages());
-    total_released += ret;
+    size_t index = 0;
+    PageId p;
+    Length n;
+    while (best->ClaimForRelease(&index, &p, &n)) {
+      TC_ASSERT_LT(batch_size, batch.size());
+      batch[batch_size] = {p, n, /*success=*/false, /*resident=*/n};
+      owners[batch_size] = best;
+      ++batch_size;
+      pages_allocated_[type] += n;
+      total_claimed += n;
+    }
     AddToFillerList(best);
   }
 
+  // This drops pageheap_lock for the duration of the batch.
+  unback_without_lock_.Batch(absl::MakeSpan(batch.data(), batch_size));
+
+  Length total_released, total_resident;
+  for (size_t i = 0; i < batch_size; ++i) {
+    const MemoryModifyRange& r = batch[i];
+    TrackerType* emptied = PutInternal(owners[i], r.start, r.len, r.success);
+    if (ABSL_PREDICT_TRUE(r.success)) {
+      total_released += r.len;
+      total_resident += r.resident;
+    }
+    if (ABSL_PREDICT_FALSE(emptied != nullptr)) {
+      emptied_by_release_.append(emptied);
+    }
+  }
+
   subrelease_stats_.num_pages_subreleased += total_released;
   subrelease_stats_.num_hugepages_broken += total_broken;
+  subrelease_stats_.total_pages_subreleased_nonresident +=
+      total_released - total_resident;
+  interval_tuner_.ReportSubreleased(total_released);
 
   // Keep separate stats if the on going release is triggered by reaching
   // tcmalloc limit
@@ -966,7 +1221,20 @@ inline Length HugePageFiller<TrackerType>::ReleaseCandidates(
     subrelease_stats_.total_pages_subreleased_due_to_limit += total_released;
     subrelease_stats_.total_hugepages_broken_due_to_limit += total_broken;
   }
-  return total_released;
+  *released = total_released;
+  return total_resident;
+}
+
+template <class TrackerType>
+inline bool HugePageFiller<TrackerType>::TakeCollapseCandidate(HugePage* p) {
+  if (collapse_candidates_size_ == 0) {
+    return false;
+  }
+  *p = collapse_candidates_[collapse_candidates_begin_];
+  collapse_candidates_begin_ =
+      (collapse_candidates_begin_ + 1) % kMaxCollapseCandidates;
+  --collapse_candidates_size_;
+  return true;
 }
 
 template <class TrackerType>
@@ -1053,7 +1321,7 @@ inline Length HugePageFiller<TrackerType>::GetDesiredSubreleasePages(
 template <class TrackerType>
 inline Length HugePageFiller<TrackerType>::ReleasePages(
     Length desired, SkipSubreleaseIntervals intervals,
-    bool release_partial_alloc_pages, bool hit_limit) {
+    bool release_partial_alloc_pages, bool hit_limit, bool break_hugepages) {
   Length total_released;
 
   // If the feature to release all free pages in partially-released allocs is
@@ -1081,6 +1349,7 @@ inline Length HugePageFiller<TrackerType>::ReleasePages(
     Length n = unmapping_unaccounted_;
     unmapping_unaccounted_ = Length(0);
     subrelease_stats_.num_pages_subreleased += n;
+    interval_tuner_.ReportSubreleased(n);
     total_released += n;
   }
 
@@ -1123,18 +1392,27 @@ inline Length HugePageFiller<TrackerType>::ReleasePages(
         regular_alloc_partial_released_[AccessDensityPrediction::kDense],
         kChunks);
 
-    Length released =
+    Length released;
+    const Length resident =
         ReleaseCandidates(absl::MakeSpan(candidates.data(), n_candidates),
-                          desired - total_released);
+                          desired - total_released, &released);
     subrelease_stats_.num_partial_alloc_pages_subreleased += released;
     if (released == Length(0)) {
       break;
     }
-    total_released += released;
+    total_released += resident;
   }
 
   // Only consider breaking up a hugepage if there are no partially released
   // pages.
+  if (!break_hugepages && !hit_limit && total_released < desired) {
+    // Leave the free pages of intact hugepages backed.  The hugepages are
+    // released whole once they are empty.
+    const Length intact_free = free_pages() - FreePagesInPartialAllocs();
+    subrelease_stats_.total_pages_kept_intact +=
+        std::min(desired - total_released, intact_free);
+    return total_released;
+  }
   while (total_released < desired) {
     CandidateArray candidates;
     // TODO(b/199203282): revisit the order in which allocs are searched for
@@ -1154,13 +1432,14 @@ inline Length HugePageFiller<TrackerType>::ReleasePages(
     n_candidates = SelectCandidates(absl::MakeSpan(candidates), n_candidates,
                                     donated_alloc_, 0);
 
-    Length released =
+    Length released;
+    const Length resident =
         ReleaseCandidates(absl::MakeSpan(candidates.data(), n_candidates),
-                          desired - total_released);
+                          desired - total_released, &released);
     if (released == Length(0)) {
       break;
     }
-    total_released += released;
+    total_released += resident;
   }
 
   return total_released;
@@ -1673,74 +1952,107 @@ inline void HugePageFiller<TrackerType>::Print(Printer* out,
       subrelease_stats_.total_hugepages_broken.raw_num(),
       subrelease_stats_.total_pages_subreleased_due_to_limit.raw_num(),
       subrelease_stats_.total_hugepages_broken_due_to_limit.raw_num());
+  out->printf(
+      "HugePageFiller: %zu hugepages intact, %zu broken; since startup, %zu "
+      "free pages kept backed to keep hugepages intact\n",
+      (stats.n_total[AccessDensityPrediction::kPredictionCounts] -
+       stats.n_released[AccessDensityPrediction::kPredictionCounts])
+          .raw_num(),
+      stats.n_released[AccessDensityPrediction::kPredictionCounts].raw_num(),
+      subrelease_stats_.total_pages_kept_intact.raw_num());
+  out->printf(
+      "HugePageFiller: Since startup, %zu subreleased pages were not "
+      "resident\n",
+      subrelease_stats_.total_pages_subreleased_nonresident.raw_num());
+  out->printf(
+      "HugePageFiller: Since startup, %zu hugepages collapsed, %zu collapses "
+      "failed\n",
+      collapsed_huge_pages_.raw_num(), failed_collapse_huge_pages_.raw_num());
 
   if (!everything) return;
 
   // Compute some histograms of fullness.
+  huge_page_filler_internal::UsageInfo usage;
+  RecordUsage(&usage);
+
+  out->printf("\n");
+  out->printf("HugePageFiller: fullness histograms\n");
+  usage.Print(out);
+
+  out->printf("\n");
+  fillerstats_tracker_.Print(out, "HugePageFiller");
+  if (interval_tuner_.active()) {
+    interval_tuner_.Print(out, "HugePageFiller");
+  }
+}
+
+template <class TrackerType>
+inline void HugePageFiller<TrackerType>::PrintAllocStatsInPbtxt(
+    absl::string_view field, PbtxtRegion* hpaa,
+    const HugePageFillerStats& stats, AccessDensityPrediction count) const {
+  TC_ASSERT_LT(count, AccessDensityPrediction::kPredictionCounts);
+  PbtxtRegion alloc_region = hpaa->CreateSubRegion(field);
+  alloc_region.PrintI64("full_huge_pages", stats.n_full[count].raw_num());
+  alloc_region.PrintI64("partial_huge_pages", stats.n_partial[count].raw_num());
+  alloc_region.PrintI64("released_huge_pages",
+                        stats.n_released[count].raw_num());
+  alloc_region.PrintI64("partially_released_huge_pages",
+                        stats.n_partial_released[count].raw_num());
+}
+
+template <class TrackerType>
+inline void HugePageFiller<TrackerType>::RecordUsage(
+    huge_page_filler_internal::UsageInfo* usage) const {
   using huge_page_filler_internal::UsageInfo;
-  UsageInfo usage;
   const double now = clock_.now();
   const double frequency = clock_.freq();
   donated_alloc_.Iter(
       [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kDonated, now, frequency);
+        usage->Record(pt, UsageInfo::kDonated, now, frequency);
       },
       0);
   regular_alloc_[AccessDensityPrediction::kSparse].Iter(
       [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kSparseRegular, now, frequency);
+        usage->Record(pt, UsageInfo::kSparseRegular, now, frequency);
       },
       0);
   regular_alloc_[AccessDensityPrediction::kDense].Iter(
       [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kDenseRegular, now, frequency);
+        usage->Record(pt, UsageInfo::kDenseRegular, now, frequency);
       },
       0);
   regular_alloc_partial_released_[AccessDensityPrediction::kSparse].Iter(
       [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kSparsePartialReleased, now, frequency);
+        usage->Record(pt, UsageInfo::kSparsePartialReleased, now, frequency);
       },
       0);
   regular_alloc_partial_released_[AccessDensityPrediction::kDense].Iter(
       [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kDensePartialReleased, now, frequency);
+        usage->Record(pt, UsageInfo::kDensePartialReleased, now, frequency);
       },
       0);
   regular_alloc_released_[AccessDensityPrediction::kSparse].Iter(
       [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kSparseReleased, now, frequency);
+        usage->Record(pt, UsageInfo::kSparseReleased, now, frequency);
       },
       0);
   regular_alloc_released_[AccessDensityPrediction::kDense].Iter(
       [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kDenseReleased, now, frequency);
+        usage->Record(pt, UsageInfo::kDenseReleased, now, frequency);
       },
       0);
-
-  out->printf("\n");
-  out->printf("HugePageFiller: fullness histograms\n");
-  usage.Print(out);
-
-  out->printf("\n");
-  fillerstats_tracker_.Print(out, "HugePageFiller");
 }
 
 template <class TrackerType>
-inline void HugePageFiller<TrackerType>::PrintAllocStatsInPbtxt(
-    absl::string_view field, PbtxtRegion* hpaa,
-    const HugePageFillerStats& stats, AccessDensityPrediction count) const {
-  TC_ASSERT_LT(count, AccessDensityPrediction::kPredictionCounts);
-  PbtxtRegion alloc_region = hpaa->CreateSubRegion(field);
-  alloc_region.PrintI64("full_huge_pages", stats.n_full[count].raw_num());
-  alloc_region.PrintI64("partial_huge_pages", stats.n_partial[count].raw_num());
-  alloc_region.PrintI64("released_huge_pages",
-                        stats.n_released[count].raw_num());
-  alloc_region.PrintI64("partially_released_huge_pages",
-                        stats.n_partial_released[count].raw_num());
+inline void HugePageFiller<TrackerType>::PrintInPbtxt(PbtxtRegion* hpaa) const {
+  huge_page_filler_internal::UsageInfo usage;
+  PrintInPbtxt(hpaa, &usage);
+  usage.Print(hpaa);
 }
 
 template <class TrackerType>
-inline void HugePageFiller<TrackerType>::PrintInPbtxt(PbtxtRegion* hpaa) const {
+inline void HugePageFiller<TrackerType>::PrintInPbtxt(
+    PbtxtRegion* hpaa, huge_page_filler_internal::UsageInfo* usage) const {
   const HugePageFillerStats stats = GetStats();
 
   // A donated alloc full list is impossible because it would have never been
@@ -1804,52 +2116,29 @@ inline void HugePageFiller<TrackerType>::PrintInPbtxt(PbtxtRegion* hpaa) const {
   hpaa->PrintI64(
       "filler_num_hugepages_broken_due_to_limit",
       subrelease_stats_.total_hugepages_broken_due_to_limit.raw_num());
+  hpaa->PrintI64(
+      "filler_num_hugepages_intact",
+      (stats.n_total[AccessDensityPrediction::kPredictionCounts] -
+       stats.n_released[AccessDensityPrediction::kPredictionCounts])
+          .raw_num());
+  hpaa->PrintI64("filler_num_pages_kept_intact",
+                 subrelease_stats_.total_pages_kept_intact.raw_num());
+  hpaa->PrintI64(
+      "filler_num_pages_subreleased_nonresident",
+      subrelease_stats_.total_pages_subreleased_nonresident.raw_num());
+  hpaa->PrintI64("filler_num_hugepages_collapsed",
+                 collapsed_huge_pages_.raw_num());
+  hpaa->PrintI64("filler_num_hugepages_collapse_failed",
+                 failed_collapse_huge_pages_.raw_num());
   // Compute some histograms of fullness.
-  using huge_page_filler_internal::UsageInfo;
-  UsageInfo usage;
-  const double now = clock_.now();
-  const double frequency = clock_.freq();
-  donated_alloc_.Iter(
-      [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kDonated, now, frequency);
-      },
-      0);
-  regular_alloc_[AccessDensityPrediction::kSparse].Iter(
-      [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kSparseRegular, now, frequency);
-      },
-      0);
-  regular_alloc_[AccessDensityPrediction::kDense].Iter(
-      [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kDenseRegular, now, frequency);
-      },
-      0);
-  regular_alloc_partial_released_[AccessDensityPrediction::kSparse].Iter(
-      [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kSparsePartialReleased, now, frequency);
-      },
-      0);
-  regular_alloc_partial_released_[AccessDensityPrediction::kDense].Iter(
-      [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kDensePartialReleased, now, frequency);
-      },
-      0);
-  regular_alloc_released_[AccessDensityPrediction::kSparse].Iter(
-      [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kSparseReleased, now, frequency);
-      },
-      0);
-  regular_alloc_released_[AccessDensityPrediction::kDense].Iter(
-      [&](const TrackerType* pt) {
-        usage.Record(pt, UsageInfo::kDenseReleased, now, frequency);
-      },
-      0);
-
-  usage.Print(hpaa);
+  RecordUsage(usage);
   fillerstats_tracker_.PrintSubreleaseStatsInPbtxt(hpaa,
                                                    "filler_skipped_subrelease");
   fillerstats_tracker_.PrintTimeseriesStatsInPbtxt(hpaa,
                                                    "filler_stats_timeseries");
+  if (interval_tuner_.active()) {
+    interval_tuner_.PrintInPbtxt(hpaa, "filler_skip_subrelease_tuning");
+  }
 }
 
 template <class TrackerType>
@@ -46,6 +46,7 @@
 #include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/huge_cache.h"
 #include "tcmalloc/huge_page_subrelease.h"
@@ -847,6 +848,14 @@ class FillerTest : public testing::TestWithParam<
                                 /*hit_limit=*/false);
   }
 
+  Length ReleasePagesKeepingHugepagesIntact(Length desired) {
+    PageHeapSpinLockHolder l;
+    return filler_.ReleasePages(desired, SkipSubreleaseIntervals{},
+                                /*release_partial_alloc_pages=*/false,
+                                /*hit_limit=*/false,
+                                /*break_hugepages=*/false);
+  }
+
   Length HardReleasePages(Length desired) {
     PageHeapSpinLockHolder l;
     return filler_.ReleasePages(desired, SkipSubreleaseIntervals{},
@@ -1245,6 +1254,36 @@ TEST_P(FillerTest, Release) {
   EXPECT_EQ(filler_.previously_released_huge_pages(), NHugePages(0));
 }
 
+TEST_P(FillerTest, ReleaseKeepingHugepagesIntact) {
+  static const Length kAlloc = kPagesPerHugePage / 2;
+  std::vector<PAlloc> p1 = AllocateVector(kAlloc - Length(1));
+  ASSERT_TRUE(!p1.empty());
+  std::vector<PAlloc> p2 = AllocateVectorWithSpanAllocInfo(
+      kAlloc + Length(1), p1.front().span_alloc_info);
+
+  std::vector<PAlloc> p3 = AllocateVector(kAlloc - Length(2));
+  ASSERT_TRUE(!p3.empty());
+  std::vector<PAlloc> p4 = AllocateVectorWithSpanAllocInfo(
+      kAlloc + Length(2), p3.front().span_alloc_info);
+  DeleteVector(p1);
+  DeleteVector(p3);
+
+  // Both hugepages are intact, so nothing is released and their free pages
+  // are reported as kept.
+  EXPECT_EQ(ReleasePagesKeepingHugepagesIntact(kMaxValidPages), Length(0));
+  EXPECT_EQ(filler_.unmapped_pages(), Length(0));
+  EXPECT_EQ(filler_.subrelease_stats().total_pages_kept_intact,
+            2 * kAlloc - Length(3));
+  EXPECT_EQ(filler_.subrelease_stats().num_hugepages_broken, NHugePages(0));
+
+  // Hitting the limit still breaks hugepages.
+  EXPECT_EQ(HardReleasePages(kAlloc - Length(1)), kAlloc - Length(1));
+  EXPECT_EQ(filler_.unmapped_pages(), kAlloc - Length(1));
+
+  DeleteVector(p2);
+  DeleteVector(p4);
+}
+
 TEST_P(FillerTest, ReleaseZero) {
   // Trying to release no pages should not crash.
   EXPECT_EQ(
@@ -1253,6 +1292,39 @@ TEST_P(FillerTest, ReleaseZero) {
       Length(0));
 }
 
+TEST_P(FillerTest, CollapseCandidates) {
+  const SpanAllocInfo kInfo = {1, AccessDensityPrediction::kSparse};
+  const Length kHalf = kPagesPerHugePage / 2;
+  PAlloc a = AllocateWithSpanAllocInfo(kHalf, kInfo);
+  PAlloc b = AllocateWithSpanAllocInfo(kHalf, kInfo);
+  ASSERT_EQ(a.pt, b.pt);
+  Delete(b);
+  ASSERT_EQ(ReleasePages(kHalf), kHalf);
+
+  HugePage p;
+  {
+    PageHeapSpinLockHolder l;
+    EXPECT_FALSE(filler_.TakeCollapseCandidate(&p));
+  }
+
+  // Reusing the released pages backs the hugepage fully again.
+  b = AllocateWithSpanAllocInfo(kHalf, kInfo);
+  ASSERT_EQ(a.pt, b.pt);
+  EXPECT_TRUE(b.from_released);
+  {
+    PageHeapSpinLockHolder l;
+    ASSERT_TRUE(filler_.TakeCollapseCandidate(&p));
+    EXPECT_EQ(p, a.pt->location());
+    EXPECT_FALSE(filler_.TakeCollapseCandidate(&p));
+    filler_.RecordCollapse(/*success=*/true);
+  }
+  EXPECT_EQ(filler_.collapsed_huge_pages(), NHugePages(1));
+  EXPECT_EQ(filler_.failed_collapse_huge_pages(), NHugePages(0));
+
+  Delete(a);
+  Delete(b);
+}
+
 void FillerTest::FragmentationTest() {
   constexpr Length kRequestLimit = Length(32);
   constexpr Length kSizeLimit = Length(512 * 1024);
@@ -3405,6 +3477,39 @@ TEST_P(FillerTest, CheckBufferSize) {
   EXPECT_LE(buffer_size, 1024 * 1024);
 }
 
+// Checks that the fullness histograms can be recorded separately from the rest
+// of the pbtxt output, and are printed the same way either way.
+TEST_P(FillerTest, PrintUsageSeparately) {
+  std::vector<PAlloc> allocs = AllocateVector(kPagesPerHugePage / 2);
+
+  std::string buffer(1024 * 1024, '\0');
+  Printer printer(&*buffer.begin(), buffer.size());
+  {
+    PbtxtRegion region(&printer, kTop);
+    filler_.PrintInPbtxt(&region);
+  }
+  const std::string together = buffer.substr(0, printer.SpaceRequired());
+
+  std::string separate_buffer(1024 * 1024, '\0');
+  Printer separate_printer(&*separate_buffer.begin(), separate_buffer.size());
+  {
+    PbtxtRegion region(&separate_printer, kTop);
+    huge_page_filler_internal::UsageInfo usage;
+    filler_.PrintInPbtxt(&region, &usage);
+    EXPECT_THAT(
+        separate_buffer.substr(0, separate_printer.SpaceRequired()),
+        testing::Not(testing::HasSubstr("filler_tracker")));
+    usage.Print(&region);
+  }
+  const std::string separate =
+      separate_buffer.substr(0, separate_printer.SpaceRequired());
+
+  EXPECT_THAT(together, testing::HasSubstr("filler_tracker"));
+  EXPECT_EQ(together, separate);
+
+  DeleteVector(allocs);
+}
+
 TEST_P(FillerTest, ReleasePriority) {
   // Fill up many huge pages (>> kPagesPerHugePage).  This relies on an
   // implementation detail of ReleasePages buffering up at most
@@ -3701,6 +3806,9 @@ HugePageFiller: 4 hugepages partially released, 0.0254 released
 HugePageFiller: 0.7186 of used pages hugepageable
 HugePageFiller: 0 hugepages were previously released, but later became full.
 HugePageFiller: Since startup, 282 pages subreleased, 5 hugepages broken, (0 pages, 0 hugepages due to reaching tcmalloc limit)
+HugePageFiller: 11 hugepages intact, 4 broken; since startup, 0 free pages kept backed to keep hugepages intact
+HugePageFiller: Since startup, 0 subreleased pages were not resident
+HugePageFiller: Since startup, 0 hugepages collapsed, 0 collapses failed
 
 HugePageFiller: fullness histograms
 
@@ -4368,6 +4476,104 @@ INSTANTIATE_TEST_SUITE_P(
         HugePageFillerDenseTrackerType::kLongestFreeRangeAndChunks,
         HugePageFillerDenseTrackerType::kSpansAllocated)));
 
+// Frees a one page allocation from within a release batch, as a concurrent
+// deallocation could while the pageheap_lock is dropped.
+class PutDuringReleaseUnback final : public MemoryModifyFunction {
+ public:
+  ABSL_MUST_USE_RESULT bool operator()(PageId p, Length len) override {
+    return true;
+  }
+
+  void Batch(absl::Span<MemoryModifyRange> ranges) override
+      ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    if (pt_ != nullptr) {
+      EXPECT_EQ(filler_->Put(pt_, p_, Length(1)), nullptr);
+      pt_ = nullptr;
+    }
+    MemoryModifyFunction::Batch(ranges);
+  }
+
+  HugePageFiller<PageTracker>* filler_ = nullptr;
+  PageTracker* pt_ = nullptr;
+  PageId p_;
+};
+
+TEST(HugePageFillerReleaseTest, PutDuringRelease) {
+  PutDuringReleaseUnback unback;
+  HugePageFiller<PageTracker> filler(
+      HugePageFillerDenseTrackerType::kLongestFreeRangeAndChunks, unback,
+      unback);
+  PageTracker pt(HugePageContaining(reinterpret_cast<void*>(kHugePageSize)),
+                 /*was_donated=*/false, /*now=*/0);
+  PageId p;
+  {
+    PageHeapSpinLockHolder l;
+    p = pt.Get(Length(1)).page;
+  }
+  filler.Contribute(&pt, /*donated=*/false,
+                    {1, AccessDensityPrediction::kSparse});
+
+  unback.filler_ = &filler;
+  unback.pt_ = &pt;
+  unback.p_ = p;
+
+  PageHeapSpinLockHolder l;
+  // The free pages are claimed before the only allocation is freed, so they
+  // are still released, after which the hugepage is empty.
+  EXPECT_EQ(filler.ReleasePages(kPagesPerHugePage, SkipSubreleaseIntervals{},
+                                /*release_partial_alloc_pages=*/false,
+                                /*hit_limit=*/false),
+            kPagesPerHugePage - Length(1));
+  EXPECT_EQ(filler.size(), NHugePages(0));
+  EXPECT_EQ(filler.used_pages(), Length(0));
+  EXPECT_EQ(filler.unmapped_pages(), Length(0));
+  EXPECT_EQ(filler.TakeEmptiedByRelease(), &pt);
+  EXPECT_EQ(filler.TakeEmptiedByRelease(), nullptr);
+}
+
+// Reports that the ranges it releases had nothing resident.
+class NonresidentUnback final : public MemoryModifyFunction {
+ public:
+  ABSL_MUST_USE_RESULT bool operator()(PageId p, Length len) override {
+    return true;
+  }
+
+  void Batch(absl::Span<MemoryModifyRange> ranges) override {
+    for (MemoryModifyRange& r : ranges) {
+      r.success = true;
+      r.resident = Length(0);
+    }
+  }
+};
+
+TEST(HugePageFillerReleaseTest, NonresidentPagesDoNotCount) {
+  NonresidentUnback unback;
+  HugePageFiller<PageTracker> filler(
+      HugePageFillerDenseTrackerType::kLongestFreeRangeAndChunks, unback,
+      unback);
+  PageTracker pt(HugePageContaining(reinterpret_cast<void*>(kHugePageSize)),
+                 /*was_donated=*/false, /*now=*/0);
+  PageId p;
+  {
+    PageHeapSpinLockHolder l;
+    p = pt.Get(Length(1)).page;
+  }
+  filler.Contribute(&pt, /*donated=*/false,
+                    {1, AccessDensityPrediction::kSparse});
+
+  PageHeapSpinLockHolder l;
+  // The free pages are released, but as that lowered RSS by nothing, none of
+  // them count toward the target.
+  EXPECT_EQ(filler.ReleasePages(kPagesPerHugePage, SkipSubreleaseIntervals{},
+                                /*release_partial_alloc_pages=*/false,
+                                /*hit_limit=*/false),
+            Length(0));
+  EXPECT_EQ(filler.unmapped_pages(), kPagesPerHugePage - Length(1));
+  EXPECT_EQ(filler.subrelease_stats().total_pages_subreleased_nonresident,
+            kPagesPerHugePage - Length(1));
+  EXPECT_EQ(filler.Put(&pt, p, Length(1)), &pt);
+}
+
 TEST(SkipSubreleaseIntervalsTest, EmptyIsNotEnabled) {
   // When we have a limit hit, we pass SkipSubreleaseIntervals{} to the
   // filler. Make sure it doesn't signal that we should skip the limit.
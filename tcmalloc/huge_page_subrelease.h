@@ -235,6 +235,13 @@ struct SubreleaseStats {
   // Keep these limit-related stats cumulative since startup only
   Length total_pages_subreleased_due_to_limit;
   HugeLength total_hugepages_broken_due_to_limit{NHugePages(0)};
+  // Free pages left backed, since startup, as releasing them would have broken
+  // intact hugepages.  See HugePageFiller::ReleasePages.
+  Length total_pages_kept_intact;
+  // Subreleased pages, since startup, that were not resident, so that
+  // releasing them did not lower RSS.  These do not count toward release
+  // targets.
+  Length total_pages_subreleased_nonresident;
 
   void reset() {
     total_pages_subreleased += num_pages_subreleased;
@@ -254,6 +261,162 @@ struct SubreleaseStats {
   bool limit_hit() { return is_limit_hit; }
 };
 
+// Evaluates a/b, avoiding division by zero.
+inline double safe_div(Length a, Length b) {
+  return safe_div(a.raw_num(), b.raw_num());
+}
+
+// Adjusts skip-subrelease intervals to keep the share of subreleased pages
+// that are faulted back in soon after their release near a target.  Longer
+// intervals skip more subreleases, and so trade memory for fewer refaults.
+//
+// Time is divided into periods of refault_window.  At the end of each period,
+// the intervals are doubled if more than the target share of the pages
+// subreleased within it were refaulted within refault_window, and halved if
+// fewer than half the target share were, within [1/kMaxScale, kMaxScale]
+// times the configured intervals.
+class SkipSubreleaseIntervalTuner {
+ public:
+  static constexpr int kMaxScaleShift = 3;
+  static constexpr int kMaxScale = 1 << kMaxScaleShift;
+  // Number of recent subreleases that refaults are matched against.
+  static constexpr size_t kMaxReleases = 64;
+
+  explicit SkipSubreleaseIntervalTuner(
+      Clock clock, absl::Duration refault_window = absl::Seconds(30))
+      : clock_(clock),
+        refault_window_(refault_window),
+        refault_window_ticks_(static_cast<int64_t>(
+            absl::ToDoubleSeconds(refault_window) * clock.freq())) {}
+
+  SkipSubreleaseIntervalTuner(const SkipSubreleaseIntervalTuner&) = delete;
+  SkipSubreleaseIntervalTuner& operator=(const SkipSubreleaseIntervalTuner&) =
+      delete;
+
+  // Records that <pages> were subreleased.
+  void ReportSubreleased(Length pages) {
+    if (pages == Length(0)) return;
+    releases_[next_release_] = {clock_.now(), pages};
+    next_release_ = (next_release_ + 1) % kMaxReleases;
+    period_released_ += pages;
+    total_released_ += pages;
+  }
+
+  // Records that <pages> that had been subreleased were backed again.  Only
+  // those matching subreleases within the last refault_window count as
+  // refaults.
+  void ReportRefaulted(Length pages) {
+    const int64_t now = clock_.now();
+    Length refaulted;
+    for (size_t i = 0; i < kMaxReleases && pages > Length(0); ++i) {
+      Release& r =
+          releases_[(next_release_ + kMaxReleases - 1 - i) % kMaxReleases];
+      if (r.pages == Length(0)) continue;
+      if (now - r.time > refault_window_ticks_) break;
+      const Length matched = std::min(pages, r.pages);
+      r.pages -= matched;
+      pages -= matched;
+      refaulted += matched;
+    }
+    period_refaulted_ += refaulted;
+    total_refaulted_ += refaulted;
+  }
+
+  // Returns <configured> intervals, scaled to aim for <target_refault_rate>.
+  SkipSubreleaseIntervals Tune(SkipSubreleaseIntervals configured,
+                               double target_refault_rate) {
+    const int64_t now = clock_.now();
+    if (period_start_ < 0) {
+      period_start_ = now;
+    } else if (now - period_start_ >= refault_window_ticks_) {
+      last_refault_rate_ = safe_div(period_refaulted_, period_released_);
+      if (last_refault_rate_ > target_refault_rate) {
+        scale_shift_ = std::min(scale_shift_ + 1, kMaxScaleShift);
+      } else if (last_refault_rate_ < target_refault_rate / 2) {
+        scale_shift_ = std::max(scale_shift_ - 1, -kMaxScaleShift);
+      }
+      period_start_ = now;
+      period_released_ = Length(0);
+      period_refaulted_ = Length(0);
+    }
+
+    target_refault_rate_ = target_refault_rate;
+    intervals_ = {.peak_interval = Scale(configured.peak_interval),
+                  .short_interval = Scale(configured.short_interval),
+                  .long_interval = Scale(configured.long_interval)};
+    return intervals_;
+  }
+
+  // Whether Tune has been called at all.
+  bool active() const { return period_start_ >= 0; }
+  // The factor by which the intervals last returned by Tune were scaled.
+  double scale() const {
+    return scale_shift_ >= 0 ? 1 << scale_shift_
+                             : 1.0 / (1 << -scale_shift_);
+  }
+  SkipSubreleaseIntervals intervals() const { return intervals_; }
+
+  void Print(Printer* out, absl::string_view field) const {
+    out->printf(
+        "%s: skip-subrelease intervals scaled by %.3f (peak %ds, short %ds, "
+        "long %ds) for a target of %.1f%% of pages refaulted within %ds, "
+        "last %.1f%%; %zu of %zu pages subreleased since startup refaulted\n",
+        field, scale(), absl::ToInt64Seconds(intervals_.peak_interval),
+        absl::ToInt64Seconds(intervals_.short_interval),
+        absl::ToInt64Seconds(intervals_.long_interval),
+        100 * target_refault_rate_, absl::ToInt64Seconds(refault_window_),
+        100 * last_refault_rate_, total_refaulted_.raw_num(),
+        total_released_.raw_num());
+  }
+
+  void PrintInPbtxt(PbtxtRegion* hpaa, absl::string_view field) const {
+    PbtxtRegion region = hpaa->CreateSubRegion(field);
+    region.PrintDouble("interval_scale", scale());
+    region.PrintI64("skip_subrelease_interval_ms",
+                    absl::ToInt64Milliseconds(intervals_.peak_interval));
+    region.PrintI64("skip_subrelease_short_interval_ms",
+                    absl::ToInt64Milliseconds(intervals_.short_interval));
+    region.PrintI64("skip_subrelease_long_interval_ms",
+                    absl::ToInt64Milliseconds(intervals_.long_interval));
+    region.PrintDouble("target_refault_rate", target_refault_rate_);
+    region.PrintDouble("last_refault_rate", last_refault_rate_);
+    region.PrintI64("refault_window_ms",
+                    absl::ToInt64Milliseconds(refault_window_));
+    region.PrintI64("subreleased_pages", total_released_.raw_num());
+    region.PrintI64("refaulted_pages", total_refaulted_.raw_num());
+  }
+
+ private:
+  struct Release {
+    int64_t time;
+    // Pages of this subrelease that have not been matched to a refault yet.
+    Length pages;
+  };
+
+  absl::Duration Scale(absl::Duration d) const {
+    return scale_shift_ >= 0 ? d * (1 << scale_shift_)
+                             : d / (1 << -scale_shift_);
+  }
+
+  Clock clock_;
+  const absl::Duration refault_window_;
+  const int64_t refault_window_ticks_;
+
+  Release releases_[kMaxReleases] = {};
+  size_t next_release_ = 0;
+
+  int64_t period_start_ = -1;
+  Length period_released_;
+  Length period_refaulted_;
+  Length total_released_;
+  Length total_refaulted_;
+
+  int scale_shift_ = 0;
+  double target_refault_rate_ = 0;
+  double last_refault_rate_ = 0;
+  SkipSubreleaseIntervals intervals_;
+};
+
 // Track subrelease statistics over a time window.
 template <size_t kEpochs = 16>
 class SubreleaseStatsTracker {
@@ -573,11 +736,6 @@ class SubreleaseStatsTracker {
   absl::Duration last_next_peak_interval_;
 };
 
-// Evaluates a/b, avoiding division by zero.
-inline double safe_div(Length a, Length b) {
-  return safe_div(a.raw_num(), b.raw_num());
-}
-
 template <size_t kEpochs>
 void SubreleaseStatsTracker<kEpochs>::Print(Printer* out,
                                             absl::string_view field) const {
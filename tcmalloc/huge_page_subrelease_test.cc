@@ -336,6 +336,93 @@ TEST_F(StatsTrackerTest, SubreleaseCorrectnessWithChangingIntervals) {
   EXPECT_EQ(tracker_.pending_skipped().count, 0);
 }
 
+class SkipSubreleaseIntervalTunerTest : public testing::Test {
+ protected:
+  static constexpr absl::Duration kRefaultWindow = absl::Seconds(30);
+  static constexpr SkipSubreleaseIntervals kConfigured = {
+      .short_interval = absl::Seconds(60), .long_interval = absl::Seconds(300)};
+
+  static int64_t FakeClock() { return clock_; }
+  static double GetFakeClockFrequency() {
+    return absl::ToDoubleNanoseconds(absl::Seconds(2));
+  }
+  static void Advance(absl::Duration d) {
+    clock_ += static_cast<int64_t>(absl::ToDoubleSeconds(d) *
+                                   GetFakeClockFrequency());
+  }
+
+  // Runs one period in which <released> pages are subreleased and <refaulted>
+  // of them are faulted back in, and returns the intervals chosen afterwards.
+  SkipSubreleaseIntervals RunPeriod(Length released, Length refaulted) {
+    tuner_.ReportSubreleased(released);
+    Advance(kRefaultWindow / 2);
+    tuner_.ReportRefaulted(refaulted);
+    Advance(kRefaultWindow / 2);
+    return tuner_.Tune(kConfigured, /*target_refault_rate=*/0.1);
+  }
+
+  static int64_t clock_;
+  SkipSubreleaseIntervalTuner tuner_{
+      Clock{.now = FakeClock, .freq = GetFakeClockFrequency}, kRefaultWindow};
+};
+
+int64_t SkipSubreleaseIntervalTunerTest::clock_{0};
+
+TEST_F(SkipSubreleaseIntervalTunerTest, TracksTargetRefaultRate) {
+  EXPECT_FALSE(tuner_.active());
+  SkipSubreleaseIntervals intervals =
+      tuner_.Tune(kConfigured, /*target_refault_rate=*/0.1);
+  EXPECT_TRUE(tuner_.active());
+  EXPECT_EQ(intervals.short_interval, kConfigured.short_interval);
+  EXPECT_EQ(intervals.long_interval, kConfigured.long_interval);
+
+  // Refaulting half of what was released lengthens the intervals, up to
+  // kMaxScale times their configured values.
+  intervals = RunPeriod(Length(100), Length(50));
+  EXPECT_EQ(tuner_.scale(), 2);
+  EXPECT_EQ(intervals.short_interval, absl::Seconds(120));
+  EXPECT_EQ(intervals.long_interval, absl::Seconds(600));
+  for (int i = 0; i < 10; ++i) {
+    intervals = RunPeriod(Length(100), Length(50));
+  }
+  EXPECT_EQ(tuner_.scale(), SkipSubreleaseIntervalTuner::kMaxScale);
+  EXPECT_EQ(intervals.peak_interval, absl::ZeroDuration());
+
+  // Near the target, the intervals stay put.
+  intervals = RunPeriod(Length(100), Length(8));
+  EXPECT_EQ(tuner_.scale(), SkipSubreleaseIntervalTuner::kMaxScale);
+
+  // Without refaults, they shorten again.
+  intervals = RunPeriod(Length(100), Length(0));
+  EXPECT_EQ(tuner_.scale(), SkipSubreleaseIntervalTuner::kMaxScale / 2);
+  for (int i = 0; i < 10; ++i) {
+    intervals = RunPeriod(Length(100), Length(0));
+  }
+  EXPECT_EQ(tuner_.scale(), 1.0 / SkipSubreleaseIntervalTuner::kMaxScale);
+  EXPECT_EQ(intervals.short_interval, absl::Seconds(60) / 8);
+}
+
+TEST_F(SkipSubreleaseIntervalTunerTest, OnlyCountsRecentRefaults) {
+  tuner_.Tune(kConfigured, /*target_refault_rate=*/0.1);
+  tuner_.ReportSubreleased(Length(100));
+  Advance(2 * kRefaultWindow);
+  // These pages were released too long ago to count as refaults.
+  tuner_.ReportRefaulted(Length(100));
+  tuner_.ReportSubreleased(Length(10));
+  // Only as many pages as were released recently can be refaulted.
+  tuner_.ReportRefaulted(Length(100));
+
+  std::string buffer(1024, '\0');
+  {
+    Printer printer(&*buffer.begin(), buffer.size());
+    tuner_.Print(&printer, "HugePageFiller");
+  }
+  buffer.resize(strlen(buffer.c_str()));
+  EXPECT_THAT(buffer, testing::HasSubstr(
+                          "10 of 110 pages subreleased since startup "
+                          "refaulted"));
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
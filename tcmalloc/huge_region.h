@@ -18,10 +18,12 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <limits>
 
 #include "absl/base/attributes.h"
 #include "absl/base/internal/cycleclock.h"
 #include "absl/base/optimization.h"
+#include "absl/numeric/bits.h"
 #include "absl/time/time.h"
 #include "tcmalloc/huge_cache.h"
 #include "tcmalloc/huge_page_subrelease.h"
@@ -64,23 +66,31 @@ enum class HugeRegionUsageOption : bool {
 // available gaps (1.75 MiB), and lengths that don't fit, but would
 // introduce unacceptable fragmentation (2.1 MiB).
 //
-class HugeRegion : public TList<HugeRegion>::Elem {
+// Regions span kRegionBytes, a multiple of the hugepage size: HugeRegion for
+// general use, and LargeHugeRegion for multi-MiB allocations.
+template <size_t kRegionBytes>
+class SizedHugeRegion : public TList<SizedHugeRegion<kRegionBytes>>::Elem {
  public:
-  // We could template this if there was any need.
-  static constexpr HugeLength kRegionSize = HLFromBytes(1024 * 1024 * 1024);
+  static_assert(kRegionBytes % kHugePageSize == 0);
+  static constexpr HugeLength kRegionSize = HLFromBytes(kRegionBytes);
   static constexpr size_t kNumHugePages = kRegionSize.raw_num();
   static constexpr HugeLength size() { return kRegionSize; }
 
   // REQUIRES: r.len() == size(); r unbacked.
-  HugeRegion(HugeRange r,
-             MemoryModifyFunction& unback ABSL_ATTRIBUTE_LIFETIME_BOUND);
-  HugeRegion() = delete;
+  SizedHugeRegion(HugeRange r,
+                  MemoryModifyFunction& unback ABSL_ATTRIBUTE_LIFETIME_BOUND);
+  SizedHugeRegion() = delete;
 
   // If available, return a range of n free pages, setting *from_released =
   // true iff the returned range is currently unbacked.
   // Returns false if no range available.
   bool MaybeGet(Length n, PageId* p, bool* from_released);
 
+  // As MaybeGet, but the returned range starts at a multiple of <align>
+  // pages.  Picks the shortest free range with room for an aligned run; the
+  // pages before it stay free.  <align> must be a power of two.
+  bool MaybeGetAligned(Length n, Length align, PageId* p, bool* from_released);
+
   // Return [p, p + n) for new allocations.
   // If release=true, release any hugepages made empty as a result.
   // REQUIRES: [p, p + n) was the result of a previous MaybeGet.
@@ -104,6 +114,20 @@ class HugeRegion : public TList<HugeRegion>::Elem {
 
   HugeLength backed() const;
 
+  // Lifetime count of hugepages unbacked by this region.
+  HugeLength total_unbacked() const { return total_unbacked_; }
+  // Lifetime count of hugepages backed again after this region had unbacked
+  // them, each of which is a page fault that an earlier release caused.
+  HugeLength total_refaulted() const { return total_refaulted_; }
+
+  // Calls func(HugePage) for each backed hugepage in this region.
+  template <typename F>
+  void ForEachBackedHugePage(const F& func) const {
+    for (size_t i = 0; i < kNumHugePages; ++i) {
+      if (backed_[i]) func(location_.start() + NHugePages(i));
+    }
+  }
+
   // Returns the number of hugepages that have been fully free (i.e. no
   // allocated pages on them), but are backed. We release hugepages lazily when
   // huge-regions-more-often feature is enabled.
@@ -115,13 +139,13 @@ class HugeRegion : public TList<HugeRegion>::Elem {
   BackingStats stats() const;
 
   // We don't define this as operator< because it's a rather specialized order.
-  bool BetterToAllocThan(const HugeRegion* rhs) const {
+  bool BetterToAllocThan(const SizedHugeRegion* rhs) const {
     return longest_free() < rhs->longest_free();
   }
 
-  void prepend_it(HugeRegion* other) { this->prepend(other); }
+  void prepend_it(SizedHugeRegion* other) { this->prepend(other); }
 
-  void append_it(HugeRegion* other) { this->append(other); }
+  void append_it(SizedHugeRegion* other) { this->append(other); }
 
  private:
   RangeTracker<kRegionSize.in_pages().raw_num()> tracker_;
@@ -143,12 +167,18 @@ class HugeRegion : public TList<HugeRegion>::Elem {
   Length pages_used_[kNumHugePages];
   // Is this hugepage backed?
   bool backed_[kNumHugePages];
+  // Has this hugepage been unbacked since it was last backed?
+  bool released_[kNumHugePages];
   HugeLength nbacked_;
   HugeLength total_unbacked_{NHugePages(0)};
+  HugeLength total_refaulted_{NHugePages(0)};
 
   MemoryModifyFunction& unback_;
 };
 
+using HugeRegion = SizedHugeRegion<size_t{1} << 30>;
+using LargeHugeRegion = SizedHugeRegion<size_t{4} << 30>;
+
 // Manage a set of regions from which we allocate.
 // Strategy: Allocate from the most fragmented region that fits.
 template <typename Region>
@@ -170,9 +200,18 @@ class HugeRegionSet {
   // true iff the returned range is currently unbacked.
   // Returns false if no range available.
   bool MaybeGet(Length n, PageId* page, bool* from_released);
+  // As MaybeGet, but the range starts at a multiple of <align> pages.
+  bool MaybeGetAligned(Length n, Length align, PageId* page,
+                       bool* from_released);
 
-  // Return an allocation to a region (if one matches!)
-  bool MaybePut(PageId p, Length n);
+  // Return an allocation to a region (if one matches!)  Hugepages made empty
+  // as a result are released immediately unless regions are used for all
+  // large allocations, in which case they are left to ReleasePages.
+  bool MaybePut(PageId p, Length n) {
+    return MaybePut(p, n, /*release=*/!UseHugeRegionMoreOften());
+  }
+  // As above, but release hugepages made empty iff <release> is true.
+  bool MaybePut(PageId p, Length n, bool release);
 
   // Add region to the set.
   void Contribute(Region* region);
@@ -201,7 +240,17 @@ class HugeRegionSet {
   void AddSpanStats(SmallSpanStats* small, LargeSpanStats* large) const;
   BackingStats stats() const;
   HugeLength free_backed() const;
+  // Lifetime counts of hugepages released and refaulted, across all regions.
+  HugeLength total_unbacked() const;
+  HugeLength total_refaulted() const;
   size_t ActiveRegions() const;
+  // Calls func(HugePage) for each backed hugepage in every region.
+  template <typename F>
+  void ForEachBackedHugePage(const F& func) const {
+    for (Region* region : list_) {
+      region->ForEachBackedHugePage(func);
+    }
+  }
   bool UseHugeRegionMoreOften() const {
     return use_huge_region_more_often_ ==
            HugeRegionUsageOption::kUseForAllLargeAllocs;
@@ -316,21 +365,27 @@ class HugeRegionSet {
 };
 
 // REQUIRES: r.len() == size(); r unbacked.
-inline HugeRegion::HugeRegion(HugeRange r, MemoryModifyFunction& unback)
+template <size_t kRegionBytes>
+inline SizedHugeRegion<kRegionBytes>::SizedHugeRegion(
+    HugeRange r, MemoryModifyFunction& unback)
     : tracker_{},
       location_(r),
       pages_used_{},
       backed_{},
+      released_{},
       nbacked_(NHugePages(0)),
       unback_(unback) {
   for (int i = 0; i < kNumHugePages; ++i) {
     // These are already 0 but for clarity...
     pages_used_[i] = Length(0);
     backed_[i] = false;
+    released_[i] = false;
   }
 }
 
-inline bool HugeRegion::MaybeGet(Length n, PageId* p, bool* from_released) {
+template <size_t kRegionBytes>
+inline bool SizedHugeRegion<kRegionBytes>::MaybeGet(Length n, PageId* p,
+                                                    bool* from_released) {
   if (n > longest_free()) return false;
   TC_ASSERT_GT(n, Length(0));
   auto index = Length(tracker_.FindAndMark(n.raw_num()));
@@ -343,8 +398,42 @@ inline bool HugeRegion::MaybeGet(Length n, PageId* p, bool* from_released) {
   return true;
 }
 
+template <size_t kRegionBytes>
+inline bool SizedHugeRegion<kRegionBytes>::MaybeGetAligned(
+    Length n, Length align, PageId* p, bool* from_released) {
+  if (n > longest_free()) return false;
+  TC_ASSERT_GT(n, Length(0));
+  TC_ASSERT(absl::has_single_bit(align.raw_num()));
+  const PageId first = location_.start().first_page();
+  const size_t mask = align.raw_num() - 1;
+
+  constexpr size_t kNone = kRegionSize.in_pages().raw_num();
+  size_t best_index = kNone;
+  size_t best_len = std::numeric_limits<size_t>::max();
+  size_t index = 0, len;
+  while (tracker_.NextFreeRange(index, &index, &len)) {
+    // Alignment is of the page's address, not its index in the region.
+    const size_t aligned =
+        ((first.index() + index + mask) & ~mask) - first.index();
+    if (aligned + n.raw_num() <= index + len && len < best_len) {
+      best_index = aligned;
+      best_len = len;
+    }
+    index += len;
+  }
+  if (best_index == kNone) return false;
+
+  tracker_.Mark(best_index, n.raw_num());
+  PageId page = first + Length(best_index);
+  *p = page;
+  Inc(page, n, from_released);
+  return true;
+}
+
 // If release=true, release any hugepages made empty as a result.
-inline void HugeRegion::Put(PageId p, Length n, bool release) {
+template <size_t kRegionBytes>
+inline void SizedHugeRegion<kRegionBytes>::Put(PageId p, Length n,
+                                               bool release) {
   Length index = p - location_.start().first_page();
   tracker_.Unmark(index.raw_num(), n.raw_num());
 
@@ -356,7 +445,8 @@ inline void HugeRegion::Put(PageId p, Length n, bool release) {
 // free but backed hugepages from the region. We can explore a more
 // sophisticated mechanism similar to Filler/Cache, that accounts for a recent
 // peak while releasing pages.
-inline HugeLength HugeRegion::Release(Length desired) {
+template <size_t kRegionBytes>
+inline HugeLength SizedHugeRegion<kRegionBytes>::Release(Length desired) {
   if (desired == Length(0)) return NHugePages(0);
 
   const Length free_yet_backed = free_backed().in_pages();
@@ -375,8 +465,9 @@ inline HugeLength HugeRegion::Release(Length desired) {
   return UnbackHugepages(should_unback);
 }
 
-inline void HugeRegion::AddSpanStats(SmallSpanStats* small,
-                                     LargeSpanStats* large) const {
+template <size_t kRegionBytes>
+inline void SizedHugeRegion<kRegionBytes>::AddSpanStats(
+    SmallSpanStats* small, LargeSpanStats* large) const {
   size_t index = 0, n;
   Length f, u;
   // This is complicated a bit by the backed/unbacked status of pages.
@@ -431,7 +522,8 @@ inline void HugeRegion::AddSpanStats(SmallSpanStats* small,
   TC_CHECK_EQ(u, unmapped_pages());
 }
 
-inline HugeLength HugeRegion::free_backed() const {
+template <size_t kRegionBytes>
+inline HugeLength SizedHugeRegion<kRegionBytes>::free_backed() const {
   HugeLength r = NHugePages(0);
   for (size_t i = 0; i < kNumHugePages; ++i) {
     if (backed_[i] && pages_used_[i] == Length(0)) {
@@ -441,7 +533,8 @@ inline HugeLength HugeRegion::free_backed() const {
   return r;
 }
 
-inline HugeLength HugeRegion::backed() const {
+template <size_t kRegionBytes>
+inline HugeLength SizedHugeRegion<kRegionBytes>::backed() const {
   HugeLength b;
   for (int i = 0; i < kNumHugePages; ++i) {
     if (backed_[i]) {
@@ -452,7 +545,8 @@ inline HugeLength HugeRegion::backed() const {
   return b;
 }
 
-inline void HugeRegion::Print(Printer* out) const {
+template <size_t kRegionBytes>
+inline void SizedHugeRegion<kRegionBytes>::Print(Printer* out) const {
   const size_t kib_used = used_pages().in_bytes() / 1024;
   const size_t kib_free = free_pages().in_bytes() / 1024;
   const size_t kib_longest_free = longest_free().in_bytes() / 1024;
@@ -461,22 +555,26 @@ inline void HugeRegion::Print(Printer* out) const {
   out->printf(
       "HugeRegion: %zu KiB used, %zu KiB free, "
       "%zu KiB contiguous space, %zu MiB unbacked, "
-      "%zu MiB unbacked lifetime\n",
+      "%zu MiB unbacked lifetime, %zu MiB refaulted lifetime\n",
       kib_used, kib_free, kib_longest_free, mib_unbacked,
-      total_unbacked_.in_bytes() / 1024 / 1024);
+      total_unbacked_.in_mib(), total_refaulted_.in_mib());
 }
 
-inline void HugeRegion::PrintInPbtxt(PbtxtRegion* detail) const {
+template <size_t kRegionBytes>
+inline void SizedHugeRegion<kRegionBytes>::PrintInPbtxt(
+    PbtxtRegion* detail) const {
   detail->PrintI64("used_bytes", used_pages().in_bytes());
   detail->PrintI64("free_bytes", free_pages().in_bytes());
   detail->PrintI64("longest_free_range_bytes", longest_free().in_bytes());
   const HugeLength unbacked = size() - backed();
   detail->PrintI64("unbacked_bytes", unbacked.in_bytes());
   detail->PrintI64("total_unbacked_bytes", total_unbacked_.in_bytes());
+  detail->PrintI64("total_refaulted_bytes", total_refaulted_.in_bytes());
   detail->PrintI64("backed_fully_free_bytes", free_backed().in_bytes());
 }
 
-inline BackingStats HugeRegion::stats() const {
+template <size_t kRegionBytes>
+inline BackingStats SizedHugeRegion<kRegionBytes>::stats() const {
   BackingStats s;
   s.system_bytes = location_.len().in_bytes();
   s.free_bytes = free_pages().in_bytes();
@@ -484,7 +582,9 @@ inline BackingStats HugeRegion::stats() const {
   return s;
 }
 
-inline void HugeRegion::Inc(PageId p, Length n, bool* from_released) {
+template <size_t kRegionBytes>
+inline void SizedHugeRegion<kRegionBytes>::Inc(PageId p, Length n,
+                                               bool* from_released) {
   bool should_back = false;
   while (n > Length(0)) {
     const HugePage hp = HugePageContaining(p);
@@ -495,6 +595,10 @@ inline void HugeRegion::Inc(PageId p, Length n, bool* from_released) {
       backed_[i] = true;
       should_back = true;
       ++nbacked_;
+      if (released_[i]) {
+        released_[i] = false;
+        ++total_refaulted_;
+      }
     }
     pages_used_[i] += here;
     TC_ASSERT_LE(pages_used_[i], kPagesPerHugePage);
@@ -504,7 +608,9 @@ inline void HugeRegion::Inc(PageId p, Length n, bool* from_released) {
   *from_released = should_back;
 }
 
-inline void HugeRegion::Dec(PageId p, Length n, bool release) {
+template <size_t kRegionBytes>
+inline void SizedHugeRegion<kRegionBytes>::Dec(PageId p, Length n,
+                                               bool release) {
   bool should_unback[kNumHugePages] = {};
   while (n > Length(0)) {
     const HugePage hp = HugePageContaining(p);
@@ -526,7 +632,8 @@ inline void HugeRegion::Dec(PageId p, Length n, bool release) {
   }
 }
 
-inline HugeLength HugeRegion::UnbackHugepages(
+template <size_t kRegionBytes>
+inline HugeLength SizedHugeRegion<kRegionBytes>::UnbackHugepages(
     bool should_unback[kNumHugePages]) {
   HugeLength released = NHugePages(0);
   size_t i = 0;
@@ -549,6 +656,7 @@ inline HugeLength HugeRegion::UnbackHugepages(
       for (size_t k = i; k < j; k++) {
         TC_ASSERT(should_unback[k]);
         backed_[k] = false;
+        released_[k] = true;
       }
 
       released += hl;
@@ -647,13 +755,23 @@ inline bool HugeRegionSet<Region>::MaybeGet(Length n, PageId* page,
   return false;
 }
 
+template <typename Region>
+inline bool HugeRegionSet<Region>::MaybeGetAligned(Length n, Length align,
+                                                   PageId* page,
+                                                   bool* from_released) {
+  for (Region* region : list_) {
+    if (region->MaybeGetAligned(n, align, page, from_released)) {
+      Fix(region);
+      UpdateStatsTracker();
+      return true;
+    }
+  }
+  return false;
+}
+
 // Return an allocation to a region (if one matches!)
 template <typename Region>
-inline bool HugeRegionSet<Region>::MaybePut(PageId p, Length n) {
-  // When HugeRegionMoreOften experiment is enabled, we do not release
-  // free-but-backed hugepages when we deallocate pages, but we do that
-  // periodically on the background thread.
-  const bool release = !UseHugeRegionMoreOften();
+inline bool HugeRegionSet<Region>::MaybePut(PageId p, Length n, bool release) {
   for (Region* region : list_) {
     if (region->contains(p)) {
       region->Put(p, n, release);
@@ -747,11 +865,23 @@ inline void HugeRegionSet<Region>::Print(Printer* out) const {
     total_free_backed += region->free_backed();
   }
 
+  const BackingStats usage = stats();
+  out->printf(
+      "HugeRegionSet: %zu MiB regions: %zu MiB used, %zu MiB free, "
+      "%zu MiB unmapped\n",
+      Region::size().in_mib(),
+      (usage.system_bytes - usage.free_bytes - usage.unmapped_bytes) >> 20,
+      usage.free_bytes >> 20, usage.unmapped_bytes >> 20);
+
   out->printf(
       "HugeRegionSet: %zu hugepages backed, %zu backed and free, "
       "out of %zu total\n",
       total_backed.raw_num(), total_free_backed.raw_num(),
       Region::size().raw_num() * n_);
+  out->printf(
+      "HugeRegionSet: Since startup, %zu hugepages released, "
+      "%zu hugepages refaulted\n",
+      total_unbacked().raw_num(), total_refaulted().raw_num());
 
   const Length in_pages = total_backed.in_pages();
   out->printf("HugeRegionSet: %zu pages free in backed region, %.4f free\n",
@@ -786,6 +916,8 @@ inline void HugeRegionSet<Region>::PrintInPbtxt(PbtxtRegion* hpaa) const {
   hpaa->PrintI64(
       "region_num_pages_subreleased_due_to_limit",
       subrelease_stats_.total_pages_subreleased_due_to_limit.raw_num());
+  hpaa->PrintI64("region_released_bytes", total_unbacked().in_bytes());
+  hpaa->PrintI64("region_refaulted_bytes", total_refaulted().in_bytes());
 
   regionstats_tracker_.PrintSubreleaseStatsInPbtxt(hpaa,
                                                    "region_skipped_subrelease");
@@ -826,6 +958,24 @@ inline HugeLength HugeRegionSet<Region>::free_backed() const {
   return pages;
 }
 
+template <typename Region>
+inline HugeLength HugeRegionSet<Region>::total_unbacked() const {
+  HugeLength unbacked;
+  for (Region* region : list_) {
+    unbacked += region->total_unbacked();
+  }
+  return unbacked;
+}
+
+template <typename Region>
+inline HugeLength HugeRegionSet<Region>::total_refaulted() const {
+  HugeLength refaulted;
+  for (Region* region : list_) {
+    refaulted += region->total_refaulted();
+  }
+  return refaulted;
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
@@ -178,6 +178,35 @@ TEST_F(HugeRegionTest, Basic) {
   }
 }
 
+TEST_F(HugeRegionTest, Aligned) {
+  Alloc a = Allocate(Length(1));
+  const Length align = kPagesPerHugePage / 2;
+  bool from_released;
+  PageId p;
+  ASSERT_TRUE(region_.MaybeGetAligned(Length(3), align, &p, &from_released));
+  EXPECT_EQ(p, p_.first_page() + align);
+  // The pages skipped for alignment stay free.
+  Alloc b = Allocate(align - Length(1));
+  EXPECT_EQ(b.p, p_.first_page() + Length(1));
+
+  // Alignment is of addresses, which for more than a hugepage may not
+  // coincide with offsets into the region.
+  const Length big_align = 4 * kPagesPerHugePage;
+  PageId q;
+  ASSERT_TRUE(
+      region_.MaybeGetAligned(Length(1), big_align, &q, &from_released));
+  EXPECT_EQ(q.index() % big_align.raw_num(), 0);
+
+  EXPECT_FALSE(region_.MaybeGetAligned(region_.size().in_pages(), align, &p,
+                                       &from_released));
+
+  region_.Put(q, Length(1), false);
+  region_.Put(p, Length(3), false);
+  Delete(b);
+  Delete(a);
+  EXPECT_EQ(region_.used_pages(), Length(0));
+}
+
 TEST_F(HugeRegionTest, ReqsBacking) {
   const Length n = kPagesPerHugePage;
   std::vector<Alloc> allocs;
@@ -1046,6 +1075,42 @@ HugeRegion: 0.0000% of decisions confirmed correct, 0 pending (0.0000% of pages,
 )"));
 }
 
+// Tests that hugepages kept backed on deallocation are reused without a fault,
+// and that those backed again after a release are counted as refaults.
+TEST_P(HugeRegionSetTest, Refault) {
+  auto r1 = GetRegion();
+  set_.Contribute(r1.get());
+  const Length N = kPagesPerHugePage;
+
+  bool from_released;
+  Alloc a = Allocate(N, &from_released);
+  EXPECT_TRUE(from_released);
+  ASSERT_TRUE(set_.MaybePut(a.p, a.n, /*release=*/false));
+  EXPECT_EQ(set_.free_backed(), NHugePages(1));
+  EXPECT_EQ(set_.total_unbacked(), NHugePages(0));
+
+  a = Allocate(N, &from_released);
+  EXPECT_FALSE(from_released);
+  ASSERT_TRUE(set_.MaybePut(a.p, a.n, /*release=*/true));
+  EXPECT_EQ(set_.free_backed(), NHugePages(0));
+  EXPECT_EQ(set_.total_unbacked(), NHugePages(1));
+  EXPECT_EQ(set_.total_refaulted(), NHugePages(0));
+
+  a = Allocate(N, &from_released);
+  EXPECT_TRUE(from_released);
+  EXPECT_EQ(set_.total_refaulted(), NHugePages(1));
+  Delete(a);
+
+  std::string buffer(1024 * 1024, '\0');
+  {
+    Printer printer(&*buffer.begin(), buffer.size());
+    set_.Print(&printer);
+  }
+  buffer.resize(strlen(buffer.c_str()));
+  EXPECT_THAT(buffer,
+              testing::HasSubstr("hugepages released, 1 hugepages refaulted"));
+}
+
 // Tests that HugeRegion releases all free hugepages when hit_limit is set to
 // true.
 TEST_P(HugeRegionSetTest, HardRelease) {
@@ -0,0 +1,79 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/background_wakeup.h"
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "tcmalloc/internal/config.h"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+void BackgroundWakeup::Notify(Event event) {
+  // Avoid contending on the cache line while the event is already pending.
+  if ((pending_.load(std::memory_order_relaxed) & event) != 0) {
+    return;
+  }
+  // Pairs with Wait: either the waiter observes the event before sleeping, or
+  // we observe the waiter and wake it.
+  pending_.fetch_or(event, std::memory_order_seq_cst);
+  if (!waiting_.load(std::memory_order_seq_cst)) {
+    return;
+  }
+#if defined(__linux__)
+  syscall(SYS_futex, &pending_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+}
+
+uint32_t BackgroundWakeup::Wait(absl::Duration timeout) {
+  waiting_.store(true, std::memory_order_seq_cst);
+  uint32_t events = pending_.exchange(0, std::memory_order_seq_cst);
+  if (events == 0 && timeout > absl::ZeroDuration()) {
+#if defined(__linux__)
+    const absl::Time deadline = absl::Now() + timeout;
+    while (true) {
+      const absl::Duration remaining = deadline - absl::Now();
+      if (remaining <= absl::ZeroDuration()) break;
+      struct timespec ts = absl::ToTimespec(remaining);
+      // Sleeps only while no event is pending.
+      const long rc = syscall(SYS_futex, &pending_, FUTEX_WAIT_PRIVATE, 0, &ts,
+                              nullptr, 0);
+      if (rc != 0 && errno == EINTR) continue;
+      break;
+    }
+#else
+    absl::SleepFor(timeout);
+#endif
+  }
+  waiting_.store(false, std::memory_order_relaxed);
+  return events | Consume();
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,80 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_BACKGROUND_WAKEUP_H_
+#define TCMALLOC_INTERNAL_BACKGROUND_WAKEUP_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/time/time.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Lets slow paths wake the background thread (see
+// MallocExtension::ProcessBackgroundActions) ahead of its sleep interval.
+//
+// Notify neither allocates nor takes locks, and it only makes a syscall if the
+// event is not already pending and a thread is waiting, so it may be called
+// from allocation slow paths.
+class BackgroundWakeup {
+ public:
+  enum Event : uint32_t {
+    // A per-CPU cache overflowed unusually often since the last shuffle.
+    kCpuCacheOverflows = 1 << 0,
+    // Backed memory exceeded a soft limit, or the watermark below it above
+    // which background actions shrink (see
+    // Parameters::soft_limit_background_shrink_percent).
+    kSoftLimitHit = 1 << 1,
+    // A large allocation was returned to the page heap.
+    kLargeFree = 1 << 2,
+    // MallocExtension::PrepareForAllocation requested a reservation.
+    kPrepareForAllocation = 1 << 3,
+    // The parameter reload signal was received, see ParameterControl.
+    kParameterReload = 1 << 4,
+    // A release was requested, see ReleaseRequests.
+    kReleaseRequest = 1 << 5,
+  };
+
+  constexpr BackgroundWakeup() = default;
+
+  BackgroundWakeup(const BackgroundWakeup&) = delete;
+  BackgroundWakeup& operator=(const BackgroundWakeup&) = delete;
+
+  void Notify(Event event);
+
+  // Waits until an event is notified or <timeout> passes, whichever comes
+  // first.  Returns the events notified since the previous Wait or Consume,
+  // which may be none.  Only one thread may wait at a time.
+  uint32_t Wait(absl::Duration timeout);
+
+  // Returns the events notified since the previous Wait or Consume, without
+  // waiting.
+  uint32_t Consume() { return pending_.exchange(0, std::memory_order_acquire); }
+
+ private:
+  // Bitmask of pending events.  Also the futex word that Wait sleeps on.
+  std::atomic<uint32_t> pending_{0};
+  std::atomic<bool> waiting_{false};
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_BACKGROUND_WAKEUP_H_
@@ -0,0 +1,70 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/background_wakeup.h"
+
+#include <stdint.h>
+
+#include <thread>  // NOLINT(build/c++11)
+
+#include "gtest/gtest.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+TEST(BackgroundWakeupTest, PendingEvents) {
+  BackgroundWakeup wakeup;
+  EXPECT_EQ(wakeup.Consume(), 0);
+
+  wakeup.Notify(BackgroundWakeup::kSoftLimitHit);
+  wakeup.Notify(BackgroundWakeup::kLargeFree);
+  wakeup.Notify(BackgroundWakeup::kLargeFree);
+  const absl::Time start = absl::Now();
+  EXPECT_EQ(wakeup.Wait(absl::Hours(1)),
+            BackgroundWakeup::kSoftLimitHit | BackgroundWakeup::kLargeFree);
+  EXPECT_LT(absl::Now() - start, absl::Minutes(1));
+  EXPECT_EQ(wakeup.Consume(), 0);
+}
+
+TEST(BackgroundWakeupTest, Timeout) {
+  BackgroundWakeup wakeup;
+  const absl::Time start = absl::Now();
+  EXPECT_EQ(wakeup.Wait(absl::Milliseconds(10)), 0);
+  EXPECT_GE(absl::Now() - start, absl::Milliseconds(10));
+}
+
+TEST(BackgroundWakeupTest, NotifyWakesWaiter) {
+  BackgroundWakeup wakeup;
+  std::thread notifier([&]() {
+    absl::SleepFor(absl::Milliseconds(10));
+    wakeup.Notify(BackgroundWakeup::kCpuCacheOverflows);
+  });
+
+  const absl::Time start = absl::Now();
+  uint32_t events = 0;
+  // Waits may end spuriously, so retry until the event arrives.
+  while (events == 0) {
+    events = wakeup.Wait(absl::Hours(1));
+  }
+  EXPECT_EQ(events, BackgroundWakeup::kCpuCacheOverflows);
+  EXPECT_LT(absl::Now() - start, absl::Minutes(1));
+  notifier.join();
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
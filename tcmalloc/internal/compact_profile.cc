@@ -0,0 +1,464 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/compact_profile.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tcmalloc/internal/profile.pb.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+constexpr uint64_t kResetTables = 1;
+
+void PutVarint(uint64_t v, std::string* out) {
+  while (v >= 0x80) {
+    out->push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  out->push_back(static_cast<char>(v));
+}
+
+// Zigzag encodes <v>, so that small negative numbers take few bytes too.
+void PutSigned(int64_t v, std::string* out) {
+  PutVarint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63),
+            out);
+}
+
+class RecordReader {
+ public:
+  explicit RecordReader(absl::string_view data) : data_(data) {}
+
+  bool Varint(uint64_t* v) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (data_.empty()) return false;
+      const uint8_t byte = data_[0];
+      data_.remove_prefix(1);
+      result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        *v = result;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool Signed(int64_t* v) {
+    uint64_t u;
+    if (!Varint(&u)) return false;
+    *v = static_cast<int64_t>((u >> 1) ^ (~(u & 1) + 1));
+    return true;
+  }
+
+  // Reads a count of entries, each of at least one byte.
+  bool Count(uint64_t* v) { return Varint(v) && *v <= data_.size(); }
+
+  bool Bytes(uint64_t n, absl::string_view* v) {
+    if (n > data_.size()) return false;
+    *v = data_.substr(0, n);
+    data_.remove_prefix(n);
+    return true;
+  }
+
+  bool done() const { return data_.empty(); }
+
+ private:
+  absl::string_view data_;
+};
+
+absl::Status Corrupt() {
+  return absl::InvalidArgumentError("Corrupt compact profile record");
+}
+
+}  // namespace
+
+bool CompactMapping::operator==(const CompactMapping& other) const {
+  return memory_start == other.memory_start &&
+         memory_limit == other.memory_limit &&
+         file_offset == other.file_offset && filename == other.filename &&
+         build_id == other.build_id;
+}
+
+absl::Status CompactProfileEncoder::Encode(
+    const perftools::profiles::Profile& profile, std::string* out) {
+  const int num_strings = profile.string_table_size();
+  auto valid_string = [&](int64_t index) {
+    return index >= 0 && index < num_strings;
+  };
+  if (profile.function_size() != 0) {
+    return absl::InvalidArgumentError("Functions are not supported");
+  }
+  absl::flat_hash_map<uint64_t, int> mapping_index;
+  for (int i = 0; i < profile.mapping_size(); ++i) {
+    const perftools::profiles::Mapping& m = profile.mapping(i);
+    if (!valid_string(m.filename()) || !valid_string(m.build_id()) ||
+        !mapping_index.emplace(m.id(), i).second) {
+      return absl::InvalidArgumentError("Invalid mapping");
+    }
+  }
+  absl::flat_hash_map<uint64_t, const perftools::profiles::Location*>
+      locations;
+  for (const perftools::profiles::Location& l : profile.location()) {
+    if (l.line_size() != 0 || l.is_folded()) {
+      return absl::InvalidArgumentError("Lines are not supported");
+    }
+    if ((l.mapping_id() != 0 && !mapping_index.contains(l.mapping_id())) ||
+        !locations.emplace(l.id(), &l).second) {
+      return absl::InvalidArgumentError("Invalid location");
+    }
+  }
+  for (const perftools::profiles::Sample& s : profile.sample()) {
+    if (s.value_size() != profile.sample_type_size()) {
+      return absl::InvalidArgumentError("Invalid sample values");
+    }
+    for (uint64_t id : s.location_id()) {
+      if (!locations.contains(id)) {
+        return absl::InvalidArgumentError("Invalid sample location");
+      }
+    }
+    for (const perftools::profiles::Label& label : s.label()) {
+      if (!valid_string(label.key()) || !valid_string(label.str()) ||
+          !valid_string(label.num_unit())) {
+        return absl::InvalidArgumentError("Invalid label");
+      }
+    }
+  }
+  for (const perftools::profiles::ValueType& t : profile.sample_type()) {
+    if (!valid_string(t.type()) || !valid_string(t.unit())) {
+      return absl::InvalidArgumentError("Invalid sample type");
+    }
+  }
+  for (int64_t comment : profile.comment()) {
+    if (!valid_string(comment)) {
+      return absl::InvalidArgumentError("Invalid comment");
+    }
+  }
+  if (!valid_string(profile.period_type().type()) ||
+      !valid_string(profile.period_type().unit()) ||
+      !valid_string(profile.drop_frames()) ||
+      !valid_string(profile.keep_frames()) ||
+      !valid_string(profile.default_sample_type()) ||
+      !valid_string(profile.doc_url())) {
+    return absl::InvalidArgumentError("Invalid string");
+  }
+
+  if (strings_.size() >= kMaxTableSize || locations_.size() >= kMaxTableSize) {
+    reset_ = true;
+  }
+  const bool reset = reset_;
+  reset_ = false;
+  if (reset) {
+    strings_.clear();
+    mappings_.clear();
+    locations_.clear();
+  }
+
+  // The sections that refer to strings and locations are encoded first, to
+  // find the new ones, which precede them in the record.
+  std::string new_strings;
+  uint64_t num_new_strings = 0;
+  auto sid = [&](int64_t index) -> uint64_t {
+    const std::string& s = profile.string_table(index);
+    if (s.empty()) return 0;
+    auto [it, inserted] = strings_.try_emplace(s, strings_.size() + 1);
+    if (inserted) {
+      ++num_new_strings;
+      PutVarint(s.size(), &new_strings);
+      new_strings.append(s);
+    }
+    return it->second;
+  };
+
+  std::vector<CompactMapping> mappings;
+  mappings.reserve(profile.mapping_size());
+  for (const perftools::profiles::Mapping& m : profile.mapping()) {
+    mappings.push_back({.memory_start = m.memory_start(),
+                        .memory_limit = m.memory_limit(),
+                        .file_offset = m.file_offset(),
+                        .filename = sid(m.filename()),
+                        .build_id = sid(m.build_id())});
+  }
+  std::string mapping_section;
+  if (reset || mappings != mappings_) {
+    PutVarint(1, &mapping_section);
+    PutVarint(mappings.size(), &mapping_section);
+    uint64_t previous = 0;
+    for (const CompactMapping& m : mappings) {
+      PutSigned(m.memory_start - previous, &mapping_section);
+      PutVarint(m.memory_limit - m.memory_start, &mapping_section);
+      PutVarint(m.file_offset, &mapping_section);
+      PutVarint(m.filename, &mapping_section);
+      PutVarint(m.build_id, &mapping_section);
+      previous = m.memory_start;
+    }
+    mappings_ = std::move(mappings);
+    locations_.clear();
+  } else {
+    PutVarint(0, &mapping_section);
+  }
+
+  std::string header;
+  PutVarint(profile.sample_type_size(), &header);
+  for (const perftools::profiles::ValueType& t : profile.sample_type()) {
+    PutVarint(sid(t.type()), &header);
+    PutVarint(sid(t.unit()), &header);
+  }
+  PutVarint(sid(profile.period_type().type()), &header);
+  PutVarint(sid(profile.period_type().unit()), &header);
+  PutSigned(profile.period(), &header);
+  PutSigned(profile.time_nanos(), &header);
+  PutSigned(profile.duration_nanos(), &header);
+  PutVarint(sid(profile.drop_frames()), &header);
+  PutVarint(sid(profile.keep_frames()), &header);
+  PutVarint(sid(profile.default_sample_type()), &header);
+  PutVarint(sid(profile.doc_url()), &header);
+  PutVarint(profile.comment_size(), &header);
+  for (int64_t comment : profile.comment()) {
+    PutVarint(sid(comment), &header);
+  }
+
+  std::string new_locations;
+  uint64_t num_new_locations = 0;
+  uint64_t previous_address = 0;
+  std::string samples;
+  PutVarint(profile.sample_size(), &samples);
+  for (const perftools::profiles::Sample& s : profile.sample()) {
+    PutVarint(s.location_id_size(), &samples);
+    uint64_t previous_id = 0;
+    for (uint64_t id : s.location_id()) {
+      const perftools::profiles::Location& l = *locations[id];
+      const uint64_t mapping =
+          l.mapping_id() != 0 ? mapping_index[l.mapping_id()] + 1 : 0;
+      auto [it, inserted] = locations_.try_emplace(
+          std::make_pair(l.address(), mapping), locations_.size() + 1);
+      if (inserted) {
+        ++num_new_locations;
+        PutSigned(l.address() - previous_address, &new_locations);
+        PutVarint(mapping, &new_locations);
+        previous_address = l.address();
+      }
+      PutSigned(it->second - previous_id, &samples);
+      previous_id = it->second;
+    }
+    for (int64_t value : s.value()) {
+      PutSigned(value, &samples);
+    }
+    PutVarint(s.label_size(), &samples);
+    for (const perftools::profiles::Label& label : s.label()) {
+      PutVarint(sid(label.key()), &samples);
+      PutVarint(sid(label.str()), &samples);
+      PutSigned(label.num(), &samples);
+      PutVarint(sid(label.num_unit()), &samples);
+    }
+  }
+
+  PutVarint(reset ? kResetTables : 0, out);
+  PutVarint(num_new_strings, out);
+  out->append(new_strings);
+  out->append(mapping_section);
+  PutVarint(num_new_locations, out);
+  out->append(new_locations);
+  out->append(header);
+  out->append(samples);
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>>
+CompactProfileDecoder::Decode(absl::string_view record) {
+  RecordReader in(record);
+  uint64_t flags;
+  if (!in.Varint(&flags)) return Corrupt();
+  if (flags & kResetTables) {
+    strings_.resize(1);
+    mappings_.clear();
+    locations_.clear();
+  }
+
+  uint64_t count;
+  if (!in.Count(&count)) return Corrupt();
+  for (uint64_t i = 0; i < count; ++i) {
+    uint64_t length;
+    absl::string_view s;
+    if (!in.Varint(&length) || !in.Bytes(length, &s)) return Corrupt();
+    strings_.emplace_back(s);
+  }
+
+  auto profile = std::make_unique<perftools::profiles::Profile>();
+  // The strings of the profile, by their index in the shared table.
+  absl::flat_hash_map<uint64_t, int64_t> local_strings;
+  profile->add_string_table("");
+  auto local_string = [&](uint64_t sid) -> int64_t {
+    if (sid == 0) return 0;
+    auto [it, inserted] =
+        local_strings.try_emplace(sid, profile->string_table_size());
+    if (inserted) profile->add_string_table(strings_[sid]);
+    return it->second;
+  };
+  auto string = [&](uint64_t* index) {
+    uint64_t sid;
+    if (!in.Varint(&sid) || sid >= strings_.size()) return false;
+    *index = local_string(sid);
+    return true;
+  };
+  // Mappings keep the index of their strings in the shared table, to be
+  // compared across records.
+  auto shared_string = [&](uint64_t* sid) {
+    return in.Varint(sid) && *sid < strings_.size();
+  };
+
+  uint64_t changed;
+  if (!in.Varint(&changed)) return Corrupt();
+  if (changed) {
+    if (!in.Count(&count)) return Corrupt();
+    mappings_.clear();
+    locations_.clear();
+    uint64_t previous = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+      int64_t start_delta;
+      uint64_t size;
+      CompactMapping m;
+      if (!in.Signed(&start_delta) || !in.Varint(&size) ||
+          !in.Varint(&m.file_offset) || !shared_string(&m.filename) ||
+          !shared_string(&m.build_id)) {
+        return Corrupt();
+      }
+      m.memory_start = previous + start_delta;
+      m.memory_limit = m.memory_start + size;
+      previous = m.memory_start;
+      mappings_.push_back(m);
+    }
+  }
+  for (size_t i = 0; i < mappings_.size(); ++i) {
+    const CompactMapping& m = mappings_[i];
+    perftools::profiles::Mapping& mapping = *profile->add_mapping();
+    mapping.set_id(i + 1);
+    mapping.set_memory_start(m.memory_start);
+    mapping.set_memory_limit(m.memory_limit);
+    mapping.set_file_offset(m.file_offset);
+    mapping.set_filename(local_string(m.filename));
+    mapping.set_build_id(local_string(m.build_id));
+  }
+
+  if (!in.Count(&count)) return Corrupt();
+  uint64_t previous_address = 0;
+  for (uint64_t i = 0; i < count; ++i) {
+    int64_t delta;
+    uint64_t mapping;
+    if (!in.Signed(&delta) || !in.Varint(&mapping) ||
+        mapping > mappings_.size()) {
+      return Corrupt();
+    }
+    previous_address += delta;
+    locations_.push_back({.address = previous_address, .mapping = mapping});
+  }
+
+  uint64_t index, unit;
+  if (!in.Count(&count)) return Corrupt();
+  const uint64_t num_values = count;
+  for (uint64_t i = 0; i < num_values; ++i) {
+    if (!string(&index) || !string(&unit)) return Corrupt();
+    perftools::profiles::ValueType& t = *profile->add_sample_type();
+    t.set_type(index);
+    t.set_unit(unit);
+  }
+  if (!string(&index) || !string(&unit)) return Corrupt();
+  profile->mutable_period_type()->set_type(index);
+  profile->mutable_period_type()->set_unit(unit);
+  int64_t period, time_nanos, duration_nanos;
+  if (!in.Signed(&period) || !in.Signed(&time_nanos) ||
+      !in.Signed(&duration_nanos)) {
+    return Corrupt();
+  }
+  profile->set_period(period);
+  profile->set_time_nanos(time_nanos);
+  profile->set_duration_nanos(duration_nanos);
+  uint64_t drop_frames, keep_frames, default_sample_type, doc_url;
+  if (!string(&drop_frames) || !string(&keep_frames) ||
+      !string(&default_sample_type) || !string(&doc_url)) {
+    return Corrupt();
+  }
+  profile->set_drop_frames(drop_frames);
+  profile->set_keep_frames(keep_frames);
+  profile->set_default_sample_type(default_sample_type);
+  profile->set_doc_url(doc_url);
+  if (!in.Count(&count)) return Corrupt();
+  for (uint64_t i = 0; i < count; ++i) {
+    if (!string(&index)) return Corrupt();
+    profile->add_comment(index);
+  }
+
+  // The locations of the profile, by their index in the shared table.
+  absl::flat_hash_map<uint64_t, uint64_t> local_locations;
+  if (!in.Count(&count)) return Corrupt();
+  for (uint64_t i = 0; i < count; ++i) {
+    perftools::profiles::Sample& sample = *profile->add_sample();
+    uint64_t depth;
+    if (!in.Count(&depth)) return Corrupt();
+    uint64_t id = 0;
+    for (uint64_t j = 0; j < depth; ++j) {
+      int64_t delta;
+      if (!in.Signed(&delta)) return Corrupt();
+      id += delta;
+      if (id == 0 || id > locations_.size()) return Corrupt();
+      auto [it, inserted] =
+          local_locations.try_emplace(id, profile->location_size() + 1);
+      if (inserted) {
+        const Location& l = locations_[id - 1];
+        perftools::profiles::Location& location = *profile->add_location();
+        location.set_id(it->second);
+        location.set_mapping_id(l.mapping);
+        location.set_address(l.address);
+      }
+      sample.add_location_id(it->second);
+    }
+    for (uint64_t j = 0; j < num_values; ++j) {
+      int64_t value;
+      if (!in.Signed(&value)) return Corrupt();
+      sample.add_value(value);
+    }
+    uint64_t num_labels;
+    if (!in.Count(&num_labels)) return Corrupt();
+    for (uint64_t j = 0; j < num_labels; ++j) {
+      uint64_t key, str;
+      int64_t num;
+      if (!string(&key) || !string(&str) || !in.Signed(&num) ||
+          !string(&unit)) {
+        return Corrupt();
+      }
+      perftools::profiles::Label& label = *sample.add_label();
+      label.set_key(key);
+      label.set_str(str);
+      label.set_num(num);
+      label.set_num_unit(unit);
+    }
+  }
+  if (!in.done()) return Corrupt();
+  return profile;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
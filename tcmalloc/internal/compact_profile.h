@@ -0,0 +1,116 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A compact encoding for a stream of profile.proto messages from one process.
+//
+// Successive profiles of a process repeat most of their strings, mappings and
+// locations, which profile.proto encodes anew in each.  Here, the encoder and
+// the decoder keep them in tables shared by the records of a stream: a record
+// only carries the strings and locations that are new to the stream, and the
+// mappings when they changed.  Every number is a varint, and the addresses of
+// new locations and the location ids of stacks are delta encoded.
+//
+// A record is:
+//   flags                                (kResetTables)
+//   new strings:   count, (length, bytes)*
+//   mappings:      changed, [count, (start delta, size, offset, filename,
+//                  build id)*]
+//   new locations: count, (address delta, mapping index + 1 or 0)*
+//   header:        sample types, period type, period, time, duration, drop
+//                  frames, keep frames, default sample type, doc URL, comments
+//   samples:       count, (locations, (location id delta)*, values, labels)*
+// Strings are referred to by their index in the shared table, where 0 is the
+// empty string, and locations by their index from 1.  A change of mappings
+// clears the locations, as their mappings are referred to by index.
+//
+// Functions and lines, which TCMalloc profiles do not have, are not encoded.
+
+#ifndef TCMALLOC_INTERNAL_COMPACT_PROFILE_H_
+#define TCMALLOC_INTERNAL_COMPACT_PROFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tcmalloc/internal/profile.pb.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+struct CompactMapping {
+  uint64_t memory_start;
+  uint64_t memory_limit;
+  uint64_t file_offset;
+  uint64_t filename;
+  uint64_t build_id;
+
+  bool operator==(const CompactMapping& other) const;
+  bool operator!=(const CompactMapping& other) const {
+    return !(*this == other);
+  }
+};
+
+class CompactProfileEncoder {
+ public:
+  // The tables are cleared when they reach this many entries, so that a
+  // long-lived stream does not grow them without bound.
+  static constexpr size_t kMaxTableSize = size_t{1} << 20;
+
+  // Appends the record of <profile> to <out>.  Returns InvalidArgument, and
+  // appends nothing, if <profile> has functions or lines, or refers to
+  // strings, mappings or locations it does not have.
+  absl::Status Encode(const perftools::profiles::Profile& profile,
+                      std::string* out);
+
+  // Makes the next record self-contained, e.g. for a new receiver.
+  void Reset() { reset_ = true; }
+
+ private:
+  absl::flat_hash_map<std::string, uint64_t> strings_;
+  std::vector<CompactMapping> mappings_;
+  // Keyed by address and mapping index + 1.
+  absl::flat_hash_map<std::pair<uint64_t, uint64_t>, uint64_t> locations_;
+  bool reset_ = true;
+};
+
+class CompactProfileDecoder {
+ public:
+  // Decodes the next record of a stream, which must follow the records
+  // decoded before it, unless it is self-contained.
+  absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> Decode(
+      absl::string_view record);
+
+ private:
+  struct Location {
+    uint64_t address;
+    uint64_t mapping;
+  };
+
+  std::vector<std::string> strings_ = {""};
+  std::vector<CompactMapping> mappings_;
+  std::vector<Location> locations_;
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_INTERNAL_COMPACT_PROFILE_H_
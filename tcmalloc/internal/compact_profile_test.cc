@@ -0,0 +1,259 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/compact_profile.h"
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "tcmalloc/internal/profile.pb.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Builds profiles as ProfileBuilder does.
+class TestProfile {
+ public:
+  TestProfile() {
+    profile_.add_string_table("");
+    auto& type = *profile_.add_sample_type();
+    type.set_type(String("space"));
+    type.set_unit(String("bytes"));
+    profile_.mutable_period_type()->set_type(String("space"));
+    profile_.mutable_period_type()->set_unit(String("bytes"));
+    profile_.set_default_sample_type(String("space"));
+    profile_.set_drop_frames(String("malloc|free"));
+    profile_.set_duration_nanos(1000);
+  }
+
+  int64_t String(absl::string_view s) {
+    for (int i = 0; i < profile_.string_table_size(); ++i) {
+      if (profile_.string_table(i) == s) return i;
+    }
+    profile_.add_string_table(std::string(s));
+    return profile_.string_table_size() - 1;
+  }
+
+  void AddMapping(uint64_t start, uint64_t limit, absl::string_view filename) {
+    auto& mapping = *profile_.add_mapping();
+    mapping.set_id(profile_.mapping_size());
+    mapping.set_memory_start(start);
+    mapping.set_memory_limit(limit);
+    mapping.set_filename(String(filename));
+    mapping.set_build_id(String("abcdef"));
+  }
+
+  void AddSample(std::vector<uint64_t> stack, int64_t bytes,
+                 absl::string_view label) {
+    auto& sample = *profile_.add_sample();
+    for (uint64_t address : stack) {
+      auto [it, inserted] =
+          locations_.try_emplace(address, profile_.location_size() + 1);
+      if (inserted) {
+        auto& location = *profile_.add_location();
+        location.set_id(it->second);
+        location.set_address(address);
+        for (const auto& mapping : profile_.mapping()) {
+          if (mapping.memory_start() <= address &&
+              address < mapping.memory_limit()) {
+            location.set_mapping_id(mapping.id());
+          }
+        }
+      }
+      sample.add_location_id(it->second);
+    }
+    sample.add_value(bytes);
+    auto& l = *sample.add_label();
+    l.set_key(String("context"));
+    l.set_str(String(label));
+    l.set_num(-bytes);
+    l.set_num_unit(String("bytes"));
+  }
+
+  const perftools::profiles::Profile& profile() const { return profile_; }
+  perftools::profiles::Profile& profile() { return profile_; }
+
+ private:
+  perftools::profiles::Profile profile_;
+  absl::flat_hash_map<uint64_t, uint64_t> locations_;
+};
+
+// A profile with its table references resolved, to compare profiles whose
+// tables are in a different order.
+struct Resolved {
+  using Mapping = std::tuple<uint64_t, uint64_t, uint64_t, std::string,
+                             std::string>;
+  using Label = std::tuple<std::string, std::string, int64_t, std::string>;
+  using Sample = std::tuple<std::vector<std::tuple<uint64_t, uint64_t>>,
+                            std::vector<int64_t>, std::vector<Label>>;
+
+  std::vector<Mapping> mappings;
+  std::vector<Sample> samples;
+  std::vector<std::string> header;
+  std::vector<int64_t> numbers;
+
+  bool operator==(const Resolved& other) const {
+    return std::tie(mappings, samples, header, numbers) ==
+           std::tie(other.mappings, other.samples, other.header,
+                    other.numbers);
+  }
+};
+
+Resolved Resolve(const perftools::profiles::Profile& p) {
+  auto s = [&](int64_t index) { return p.string_table(index); };
+  Resolved r;
+  for (const auto& m : p.mapping()) {
+    r.mappings.emplace_back(m.memory_start(), m.memory_limit(),
+                            m.file_offset(), s(m.filename()),
+                            s(m.build_id()));
+  }
+  absl::flat_hash_map<uint64_t, const perftools::profiles::Location*> locs;
+  for (const auto& l : p.location()) locs[l.id()] = &l;
+  for (const auto& sample : p.sample()) {
+    Resolved::Sample& out = r.samples.emplace_back();
+    for (uint64_t id : sample.location_id()) {
+      std::get<0>(out).emplace_back(locs[id]->address(),
+                                    locs[id]->mapping_id());
+    }
+    std::get<1>(out).assign(sample.value().begin(), sample.value().end());
+    for (const auto& l : sample.label()) {
+      std::get<2>(out).emplace_back(s(l.key()), s(l.str()), l.num(),
+                                    s(l.num_unit()));
+    }
+  }
+  for (const auto& t : p.sample_type()) {
+    r.header.push_back(s(t.type()));
+    r.header.push_back(s(t.unit()));
+  }
+  r.header.push_back(s(p.period_type().type()));
+  r.header.push_back(s(p.period_type().unit()));
+  r.header.push_back(s(p.drop_frames()));
+  r.header.push_back(s(p.keep_frames()));
+  r.header.push_back(s(p.default_sample_type()));
+  r.header.push_back(s(p.doc_url()));
+  for (int64_t c : p.comment()) r.header.push_back(s(c));
+  r.numbers = {p.period(), p.time_nanos(), p.duration_nanos()};
+  return r;
+}
+
+TestProfile MakeProfile(int variant) {
+  TestProfile p;
+  p.AddMapping(0x400000, 0x500000, "/bin/server");
+  p.AddMapping(0x7f0000000000, 0x7f0000100000, "/lib/libc.so");
+  for (int i = 0; i < 100; ++i) {
+    p.AddSample({0x400100 + 16 * (i % 10), 0x400200 + 16 * (i % 7),
+                 0x7f0000000400 + variant, 0x300},
+                1000 * i + variant, i % 2 ? "odd" : "even");
+  }
+  p.profile().add_comment(p.String("experiment"));
+  return p;
+}
+
+TEST(CompactProfileTest, RoundTrip) {
+  CompactProfileEncoder encoder;
+  CompactProfileDecoder decoder;
+  std::vector<size_t> sizes;
+  for (int variant = 0; variant < 3; ++variant) {
+    const TestProfile p = MakeProfile(variant);
+    std::string record;
+    ASSERT_TRUE(encoder.Encode(p.profile(), &record).ok());
+    sizes.push_back(record.size());
+    EXPECT_LT(record.size(), p.profile().ByteSizeLong());
+
+    absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> decoded =
+        decoder.Decode(record);
+    ASSERT_TRUE(decoded.ok()) << decoded.status();
+    EXPECT_TRUE(Resolve(**decoded) == Resolve(p.profile()));
+  }
+  // Later records share the tables of the first.
+  EXPECT_LT(sizes[1], sizes[0]);
+  EXPECT_LT(sizes[2], sizes[0]);
+}
+
+TEST(CompactProfileTest, MappingsChange) {
+  CompactProfileEncoder encoder;
+  CompactProfileDecoder decoder;
+  TestProfile p = MakeProfile(0);
+  std::string record;
+  ASSERT_TRUE(encoder.Encode(p.profile(), &record).ok());
+  ASSERT_TRUE(decoder.Decode(record).ok());
+
+  p.AddMapping(0x7f1000000000, 0x7f1000100000, "/lib/libdl.so");
+  p.AddSample({0x7f1000000010, 0x400100}, 5, "dlopen");
+  record.clear();
+  ASSERT_TRUE(encoder.Encode(p.profile(), &record).ok());
+  absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> decoded =
+      decoder.Decode(record);
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  EXPECT_TRUE(Resolve(**decoded) == Resolve(p.profile()));
+}
+
+TEST(CompactProfileTest, Reset) {
+  CompactProfileEncoder encoder;
+  std::string record;
+  ASSERT_TRUE(encoder.Encode(MakeProfile(0).profile(), &record).ok());
+
+  // A record that depends on the first cannot be decoded without it, unless
+  // the encoder was reset.
+  const TestProfile p = MakeProfile(1);
+  record.clear();
+  ASSERT_TRUE(encoder.Encode(p.profile(), &record).ok());
+  EXPECT_FALSE(CompactProfileDecoder().Decode(record).ok());
+
+  encoder.Reset();
+  record.clear();
+  ASSERT_TRUE(encoder.Encode(p.profile(), &record).ok());
+  absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> decoded =
+      CompactProfileDecoder().Decode(record);
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  EXPECT_TRUE(Resolve(**decoded) == Resolve(p.profile()));
+}
+
+TEST(CompactProfileTest, Errors) {
+  CompactProfileEncoder encoder;
+  std::string record;
+  TestProfile p = MakeProfile(0);
+  p.profile().add_function()->set_id(1);
+  EXPECT_EQ(encoder.Encode(p.profile(), &record).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_TRUE(record.empty());
+
+  p = MakeProfile(0);
+  p.profile().mutable_sample(0)->add_location_id(12345);
+  EXPECT_EQ(encoder.Encode(p.profile(), &record).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  ASSERT_TRUE(encoder.Encode(MakeProfile(0).profile(), &record).ok());
+  for (size_t n = 0; n < record.size(); n += 7) {
+    EXPECT_FALSE(CompactProfileDecoder()
+                     .Decode(absl::string_view(record).substr(0, n))
+                     .ok())
+        << n;
+  }
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -116,11 +116,17 @@ namespace tcmalloc_internal {
 #if defined __x86_64__
 // x86_64 processors use lower 48 bits in virtual to physical address
 // translation with 4-level page tables. The top 16 are thus unused.
-// We don't support 5-level page tables yet.
+// Building with TCMALLOC_INTERNAL_LA57 extends this to the 57 bits of 5-level
+// page tables, for kernels that hand out addresses above 47 bits to processes
+// that ask for them.
 // TODO(b/134686025): Under what operating systems can we increase it safely to
 // 17? This lets us use smaller page maps.  On first allocation, a 36-bit page
 // map uses only 96 KB instead of the 4.5 MB used by a 52-bit page map.
+#ifdef TCMALLOC_INTERNAL_LA57
+inline constexpr int kAddressBits = 57;
+#else
 inline constexpr int kAddressBits = 48;
+#endif
 #elif defined __powerpc64__ && defined __linux__
 // Linux(4.12 and above) on powerpc64 supports 128TB user virtual address space
 // by default, and up to 512TB if user space opts in by specifying hint in mmap.
@@ -137,6 +143,11 @@ inline constexpr int kAddressBits = 48;
 inline constexpr int kAddressBits = 8 * sizeof(void*);
 #endif
 
+// The address bits that cover the usual user address space, which even a
+// 5-level paging kernel limits mappings to unless asked for higher addresses.
+// We place mappings there first and keep the pagemap fastest for them.
+inline constexpr int kLowAddressBits = kAddressBits < 48 ? kAddressBits : 48;
+
 #if defined(__x86_64__)
 // x86 has 2 MiB huge pages
 static constexpr size_t kHugePageShift = 21;
@@ -48,7 +48,8 @@ class ExplicitlyConstructed {
 
  private:
   union AlignedUnion {
-    constexpr AlignedUnion() = default;
+    // Initializes a member so that this can be constant initialized.
+    constexpr AlignedUnion() : align_to_int64(0) {}
     alignas(T) char space[sizeof(T)];
     int64_t align_to_int64;
     void* align_to_ptr;
@@ -0,0 +1,64 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/fast_unwind.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/base/attributes.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Frames larger than this are taken to mean that the chain is broken.
+static constexpr uintptr_t kMaxFrameBytes = 1 << 20;
+
+ABSL_ATTRIBUTE_NOINLINE int GetStackTraceFromFramePointers(void** result,
+                                                           int max_depth,
+                                                           int skip_count) {
+  if constexpr (!kHaveFramePointerUnwinder) {
+    return 0;
+  }
+  // On x86-64 and AArch64, a frame pointer points at the saved frame pointer
+  // of the caller, followed by the return address into the caller.  The
+  // outermost frame has a null frame pointer.
+  void** fp = static_cast<void**>(__builtin_frame_address(0));
+  int depth = 0;
+  while (fp != nullptr && depth < max_depth) {
+    void* const pc = fp[1];
+    if (pc == nullptr) break;
+    if (skip_count > 0) {
+      --skip_count;
+    } else {
+      result[depth++] = pc;
+    }
+    void** const next = static_cast<void**>(fp[0]);
+    // The stack grows down, so callers' frames are at higher addresses.
+    const uintptr_t from = reinterpret_cast<uintptr_t>(fp);
+    const uintptr_t to = reinterpret_cast<uintptr_t>(next);
+    if (to <= from || to - from > kMaxFrameBytes ||
+        to % alignof(void*) != 0) {
+      break;
+    }
+    fp = next;
+  }
+  return depth;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,71 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_FAST_UNWIND_H_
+#define TCMALLOC_INTERNAL_FAST_UNWIND_H_
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/debugging/stacktrace.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+#if defined(__x86_64__) || defined(__aarch64__)
+inline constexpr bool kHaveFramePointerUnwinder = true;
+#else
+inline constexpr bool kHaveFramePointerUnwinder = false;
+#endif
+
+// Binaries built entirely with frame pointers (-fno-omit-frame-pointer) can
+// define TCMALLOC_INTERNAL_FRAME_POINTER_UNWIND to unwind sampled allocations
+// by walking the frame pointer chain, which is several times cheaper than the
+// general unwinder for deep stacks.
+#ifdef TCMALLOC_INTERNAL_FRAME_POINTER_UNWIND
+inline constexpr bool kUseFramePointerUnwinder = kHaveFramePointerUnwinder;
+#else
+inline constexpr bool kUseFramePointerUnwinder = false;
+#endif
+
+// Stores up to <max_depth> program counters of the current call stack in
+// <result>, innermost first and starting in the caller, after skipping
+// <skip_count> of them, by following the frame pointer chain.  Returns the
+// number of addresses stored.  The walk stops at the first frame that does not
+// look like part of a valid chain, so frames above a function built without
+// frame pointers are lost.
+//
+// Only available when kHaveFramePointerUnwinder is true; returns 0 otherwise.
+int GetStackTraceFromFramePointers(void** result, int max_depth,
+                                   int skip_count);
+
+// As absl::GetStackTrace: the frame pointer walk when it is enabled, falling
+// back to absl::GetStackTrace if it did not find any frames.
+ABSL_ATTRIBUTE_ALWAYS_INLINE inline int GetStackTrace(void** result,
+                                                      int max_depth,
+                                                      int skip_count) {
+  if constexpr (kUseFramePointerUnwinder) {
+    const int depth =
+        GetStackTraceFromFramePointers(result, max_depth, skip_count);
+    if (ABSL_PREDICT_TRUE(depth > 0)) return depth;
+  }
+  return absl::GetStackTrace(result, max_depth, skip_count);
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_FAST_UNWIND_H_
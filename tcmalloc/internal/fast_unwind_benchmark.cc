@@ -0,0 +1,62 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/debugging/stacktrace.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/fast_unwind.h"
+#include "tcmalloc/internal/logging.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+using Unwinder = int (*)(void** result, int max_depth, int skip_count);
+
+// Unwinds kMaxStackDepth frames, as SampleifyAllocation does, from
+// state.range(0) frames deep.
+ABSL_ATTRIBUTE_NOINLINE void Unwind(benchmark::State& state, Unwinder unwind,
+                                    int depth) {
+  if (depth > 0) {
+    Unwind(state, unwind, depth - 1);
+    ABSL_BLOCK_TAIL_CALL_OPTIMIZATION();
+    return;
+  }
+  void* stack[kMaxStackDepth];
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(unwind(stack, kMaxStackDepth, 0));
+  }
+}
+
+void BM_Absl(benchmark::State& state) {
+  Unwind(state, absl::GetStackTrace, state.range(0));
+}
+BENCHMARK(BM_Absl)->Arg(4)->Arg(16)->Arg(64);
+
+void BM_FramePointers(benchmark::State& state) {
+  if (!kHaveFramePointerUnwinder) {
+    state.SkipWithError("No frame pointer unwinder on this platform");
+    return;
+  }
+  Unwind(state, GetStackTraceFromFramePointers, state.range(0));
+}
+BENCHMARK(BM_FramePointers)->Arg(4)->Arg(16)->Arg(64);
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,102 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/fast_unwind.h"
+
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/debugging/stacktrace.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+constexpr int kMaxDepth = 64;
+constexpr int kRecursion = 10;
+
+struct Traces {
+  std::vector<void*> frame_pointers;
+  std::vector<void*> absl;
+};
+
+// Recurses <n> times, then unwinds with both unwinders from the same frame.
+ABSL_ATTRIBUTE_NOINLINE void Recurse(int n, int skip_count, Traces& traces) {
+  if (n > 0) {
+    Recurse(n - 1, skip_count, traces);
+    // Keeps the recursive call from being a tail call.
+    ABSL_BLOCK_TAIL_CALL_OPTIMIZATION();
+    return;
+  }
+  void* stack[kMaxDepth];
+  traces.frame_pointers.assign(
+      stack, stack + GetStackTraceFromFramePointers(stack, kMaxDepth,
+                                                    skip_count));
+  traces.absl.assign(
+      stack, stack + absl::GetStackTrace(stack, kMaxDepth, skip_count));
+}
+
+TEST(FastUnwindTest, MatchesAbsl) {
+  if (!kHaveFramePointerUnwinder) {
+    GTEST_SKIP() << "No frame pointer unwinder on this platform";
+  }
+  Traces traces;
+  Recurse(kRecursion, 0, traces);
+  // Frame 0 is the call to the unwinder; the next kRecursion frames all
+  // return to the recursive call, and the one after to this test.
+  ASSERT_GT(traces.frame_pointers.size(), kRecursion + 1);
+  for (int i = 1; i <= kRecursion; ++i) {
+    EXPECT_EQ(traces.frame_pointers[i], traces.frame_pointers[1]) << i;
+  }
+  EXPECT_NE(traces.frame_pointers[kRecursion + 1], traces.frame_pointers[1]);
+  // Beyond the test's own frames, the unwinders may stop at different places
+  // in code built without frame pointers.
+  EXPECT_THAT(traces.absl, testing::Contains(traces.frame_pointers[1]));
+  EXPECT_THAT(traces.absl,
+              testing::Contains(traces.frame_pointers[kRecursion + 1]));
+}
+
+TEST(FastUnwindTest, SkipsFrames) {
+  if (!kHaveFramePointerUnwinder) {
+    GTEST_SKIP() << "No frame pointer unwinder on this platform";
+  }
+  Traces all, skipped;
+  Recurse(kRecursion, 0, all);
+  Recurse(kRecursion, 3, skipped);
+  ASSERT_GT(skipped.frame_pointers.size(), kRecursion - 3);
+  for (int i = 0; i + 3 <= kRecursion; ++i) {
+    EXPECT_EQ(skipped.frame_pointers[i], all.frame_pointers[i + 3]) << i;
+  }
+}
+
+TEST(FastUnwindTest, StopsAtMaxDepth) {
+  if (!kHaveFramePointerUnwinder) {
+    GTEST_SKIP() << "No frame pointer unwinder on this platform";
+  }
+  void* stack[kMaxDepth];
+  EXPECT_EQ(GetStackTraceFromFramePointers(stack, 1, 0), 1);
+  EXPECT_EQ(GetStackTraceFromFramePointers(stack, 0, 0), 0);
+}
+
+TEST(FastUnwindTest, FallsBack) {
+  void* stack[kMaxDepth];
+  EXPECT_GT(GetStackTrace(stack, kMaxDepth, 0), 0);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -30,7 +30,12 @@ struct kernel_rseq {
   unsigned cpu_id;
   unsigned long long rseq_cs;
   unsigned flags;
-  unsigned padding[2];
+  unsigned node_id;
+  // Concurrency id (Linux 6.3+): a dense per-process id, unique among the
+  // process's concurrently running threads and smaller than the number of
+  // CPUs it may run on.  Available iff the kernel's AT_RSEQ_FEATURE_SIZE covers
+  // it.
+  unsigned mm_cid;
   // This is a prototype extension to the rseq() syscall.  Since a process may
   // run on only a few cores at a time, we can use a dense set of "v(irtual)
   // cpus."  This can reduce cache requirements, as we only need N caches for
@@ -58,13 +63,17 @@ static_assert(sizeof(kernel_rseq_cs) == (4 * sizeof(unsigned long long)),
 #if !defined(__NR_rseq)
 #if defined(__x86_64__)
 #define __NR_rseq 334
-#elif defined(__aarch64__)
+#elif defined(__aarch64__) || defined(__riscv)
 #define __NR_rseq 293
 #elif defined(__PPC__)
 #define __NR_rseq 387
 #endif
 #endif
 
+#ifndef AT_RSEQ_FEATURE_SIZE
+#define AT_RSEQ_FEATURE_SIZE 27
+#endif
+
 #ifndef KPF_ZERO_PAGE
 #define KPF_ZERO_PAGE 24
 #endif
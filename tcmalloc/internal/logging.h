@@ -55,9 +55,9 @@ static constexpr int kMaxStackDepth = 64;
 // An opaque handle type used to identify allocations.
 using AllocHandle = int64_t;
 
-// size/depth are made the same size as a pointer so that some generic
-// code below can conveniently cast them back and forth to void*.
-struct StackTrace {
+// Describes a sampled allocation, other than the call stack it was allocated
+// from.
+struct SampleInfo {
   // An opaque handle used by allocator to uniquely identify the sampled
   // memory block.
   AllocHandle sampled_alloc_handle;
@@ -79,9 +79,6 @@ struct StackTrace {
   uint8_t access_hint;
   bool cold_allocated;
 
-  uintptr_t depth;  // Number of PC values stored in array below
-  void* stack[kMaxStackDepth];
-
   // weight is the expected number of *bytes* that were requested
   // between the previous sample and this one
   size_t weight;
@@ -89,6 +86,12 @@ struct StackTrace {
   // Timestamp of allocation.
   absl::Time allocation_time;
 
+  // The allocation context of the allocating thread, or 0 if none.
+  uint64_t allocation_context = 0;
+  // The bytes charged to the account of allocation_context for this small
+  // allocation (see AllocationAccounts), or 0 if none.
+  size_t account_charged_bytes = 0;
+
   // If not nullptr, this is the start address of the span corresponding to this
   // sampled allocation. This may be nullptr for cases where it is not useful
   // for residency analysis such as for peakheapz.
@@ -97,6 +100,22 @@ struct StackTrace {
   // An integer representing the guarded status of the allocation.
   // The values are from the enum GuardedStatus in ../malloc_extension.h.
   int guarded_status;
+
+  // Whether the continuous lifetime profile tracks this allocation, and if so
+  // where it was allocated, to compare against where it is freed.
+  bool lifetime_profiled = false;
+  int cpu_id = -1;
+  int vcpu_id = -1;
+  pid_t thread_id = 0;
+};
+
+// A sampled allocation and its call stack.
+//
+// size/depth are made the same size as a pointer so that some generic
+// code below can conveniently cast them back and forth to void*.
+struct StackTrace : SampleInfo {
+  uintptr_t depth;  // Number of PC values stored in array below
+  void* stack[kMaxStackDepth];
 };
 
 #define TC_LOG(msg, ...)                                                \
@@ -0,0 +1,107 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_MAPPED_REGIONS_H_
+#define TCMALLOC_INTERNAL_MAPPED_REGIONS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <optional>
+
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// The address ranges that a region factory has mapped from a file, and their
+// offsets in it, for the factories that back TCMalloc's regions with files.
+// Regions are only added, by one thread at a time (TCMalloc serializes the
+// creation of regions), while lookups may run concurrently without locks.
+class MappedRegions {
+ public:
+  static constexpr int kMaxRegions = 256;
+
+  struct Region {
+    uintptr_t start;
+    size_t size;
+    size_t offset;
+  };
+
+  constexpr MappedRegions() = default;
+
+  MappedRegions(const MappedRegions&) = delete;
+  MappedRegions& operator=(const MappedRegions&) = delete;
+
+  bool full() const {
+    return num_regions_.load(std::memory_order_relaxed) == kMaxRegions;
+  }
+
+  // The offset in the file after the last region.
+  size_t file_size() const { return file_size_; }
+
+  // Records that [start, start + size) is mapped from the end of the file.
+  // REQUIRES: !full()
+  void Add(const void* start, size_t size) {
+    const int n = num_regions_.load(std::memory_order_relaxed);
+    regions_[n] = {reinterpret_cast<uintptr_t>(start), size, file_size_};
+    file_size_ += size;
+    num_regions_.store(n + 1, std::memory_order_release);
+  }
+
+  // Returns the offset of <p> in the file, or std::nullopt if it is not in
+  // any of the regions.
+  std::optional<size_t> Offset(const void* p) const {
+    const uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+    std::optional<size_t> offset;
+    ForEach([&](const Region& r) {
+      if (addr >= r.start && addr - r.start < r.size) {
+        offset = r.offset + (addr - r.start);
+      }
+    });
+    return offset;
+  }
+
+  // The total size of the regions.
+  size_t bytes() const {
+    size_t bytes = 0;
+    ForEach([&](const Region& r) { bytes += r.size; });
+    return bytes;
+  }
+
+  int regions() const { return num_regions_.load(std::memory_order_acquire); }
+
+  template <typename F>
+  void ForEach(F f) const {
+    const int n = num_regions_.load(std::memory_order_acquire);
+    for (int i = 0; i < n; ++i) {
+      f(regions_[i]);
+    }
+  }
+
+ private:
+  // Only accessed by the thread adding regions.
+  size_t file_size_ = 0;
+  // regions_[i] is immutable once num_regions_ exceeds i.
+  Region regions_[kMaxRegions] = {};
+  std::atomic<int> num_regions_{0};
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_MAPPED_REGIONS_H_
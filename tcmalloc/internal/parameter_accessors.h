@@ -48,6 +48,9 @@ TCMalloc_Internal_GetReleasePagesFromHugeRegionEnabled();
 ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetTagMetadataSeparatelyEnabled();
 ABSL_ATTRIBUTE_WEAK bool
 TCMalloc_Internal_GetResizeSizeClassMaxCapacityEnabled();
+ABSL_ATTRIBUTE_WEAK bool
+TCMalloc_Internal_GetShardedTransferCacheAdaptiveEnabled();
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetTransferCacheLockFreeEnabled();
 ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetPrioritizeSpansEnabled();
 ABSL_ATTRIBUTE_WEAK double
 TCMalloc_Internal_GetPeakSamplingHeapGrowthFraction();
@@ -72,12 +75,49 @@ ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetTagMetadataSeparatelyEnabled(
     bool v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetResizeSizeClassMaxCapacityEnabled(
     bool v);
+ABSL_ATTRIBUTE_WEAK void
+TCMalloc_Internal_SetShardedTransferCacheAdaptiveEnabled(bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetTransferCacheLockFreeEnabled(
+    bool v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPrioritizeSpansEnabled(bool v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetMaxPerCpuCacheSize(int32_t v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetMaxTotalThreadCacheBytes(
     int64_t v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPeakSamplingHeapGrowthFraction(
     double v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetWindowedPeakHeapProfiles();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetWindowedPeakHeapProfiles(bool v);
+ABSL_ATTRIBUTE_WEAK int64_t
+TCMalloc_Internal_GetContinuousLifetimeProfilePeriod();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetContinuousLifetimeProfilePeriod(
+    int64_t v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_GetLeakDetectionInterval(
+    absl::Duration* v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetLeakDetectionInterval(
+    absl::Duration v);
+ABSL_ATTRIBUTE_WEAK int64_t TCMalloc_Internal_GetGuardedDeallocationBatchSize();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetGuardedDeallocationBatchSize(
+    int64_t v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetExcludeFreeFromCoreDumps();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetExcludeFreeFromCoreDumps(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetPublishStatsPage();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPublishStatsPage(bool v);
+ABSL_ATTRIBUTE_WEAK uint32_t
+TCMalloc_Internal_GetMemoryPressureModeratePercent();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetMemoryPressureModeratePercent(
+    uint32_t v);
+ABSL_ATTRIBUTE_WEAK uint32_t
+TCMalloc_Internal_GetMemoryPressureCriticalPercent();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetMemoryPressureCriticalPercent(
+    uint32_t v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetReleaseMemoryAfterFork();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetReleaseMemoryAfterFork(bool v);
+ABSL_ATTRIBUTE_WEAK int64_t TCMalloc_Internal_GetColdPageSize();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetColdPageSize(int64_t v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_GetNumericPropertyStaleness(
+    absl::Duration* v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetNumericPropertyStaleness(
+    absl::Duration v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPerCpuCachesEnabled(bool v);
 ABSL_ATTRIBUTE_WEAK void
 TCMalloc_Internal_SetPerCpuCachesEnabledNoBuildRequirement(bool v);
@@ -108,6 +148,132 @@ ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetMinHotAccessHint(uint8_t v);
 ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetPerCpuCachesDynamicSlabEnabled();
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPerCpuCachesDynamicSlabEnabled(
     bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetPerCpuCachesStealObjectsEnabled();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPerCpuCachesStealObjectsEnabled(
+    bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetPerCpuCachesRemoteFreeEnabled();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPerCpuCachesRemoteFreeEnabled(
+    bool v);
+ABSL_ATTRIBUTE_WEAK bool
+TCMalloc_Internal_GetPerCpuCachesHugepageSlabsEnabled();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPerCpuCachesHugepageSlabsEnabled(
+    bool v);
+ABSL_ATTRIBUTE_WEAK bool
+TCMalloc_Internal_GetPerCpuCachesIncrementalSlabResize();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPerCpuCachesIncrementalSlabResize(
+    bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetSlowPathLatencyHistograms();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetSlowPathLatencyHistograms(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetDynamicSizeClasses();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetDynamicSizeClasses(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetCompactSampledAllocations();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetCompactSampledAllocations(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetAllocationAccounting();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetAllocationAccounting(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetPerCpuCachesBypassColdClasses();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPerCpuCachesBypassColdClasses(
+    bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetPerCpuCachesPingPongHysteresis();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPerCpuCachesPingPongHysteresis(
+    bool v);
+ABSL_ATTRIBUTE_WEAK uint32_t TCMalloc_Internal_GetHugePageCollapseRate();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHugePageCollapseRate(uint32_t v);
+ABSL_ATTRIBUTE_WEAK uint32_t TCMalloc_Internal_GetHugePageBackingSamples();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHugePageBackingSamples(
+    uint32_t v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetLifetimeBasedAllocation();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetLifetimeBasedAllocation(bool v);
+ABSL_ATTRIBUTE_WEAK uint32_t
+TCMalloc_Internal_GetCgroupMemoryLimitHeadroomPercent();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetCgroupMemoryLimitHeadroomPercent(
+    uint32_t v);
+ABSL_ATTRIBUTE_WEAK uint32_t
+TCMalloc_Internal_GetSoftLimitBackgroundShrinkPercent();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetSoftLimitBackgroundShrinkPercent(
+    uint32_t v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetPressureBasedRelease();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPressureBasedRelease(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetEventDrivenBackgroundActions();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetEventDrivenBackgroundActions(
+    bool v);
+ABSL_ATTRIBUTE_WEAK uint32_t TCMalloc_Internal_GetIdleCacheReclaimIntervals();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetIdleCacheReclaimIntervals(
+    uint32_t v);
+ABSL_ATTRIBUTE_WEAK uint32_t TCMalloc_Internal_GetPerCpuCachesDecayIntervals();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPerCpuCachesDecayIntervals(
+    uint32_t v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetPerCpuCachesAsymmetricBatches();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPerCpuCachesAsymmetricBatches(
+    bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetTransferCachePredictiveResize();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetTransferCachePredictiveResize(
+    bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_GetTransferCachePlunderInterval(
+    absl::Duration* v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetTransferCachePlunderInterval(
+    absl::Duration v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetPerCpuCachesAdaptiveBatches();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPerCpuCachesAdaptiveBatches(
+    bool v);
+ABSL_ATTRIBUTE_WEAK bool
+TCMalloc_Internal_GetCentralFreelistHugepageAwareSpans();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetCentralFreelistHugepageAwareSpans(
+    bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetCentralFreelistSpanCache();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetCentralFreelistSpanCache(bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_GetCentralFreelistSpanCacheExpiry(
+    absl::Duration* v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetCentralFreelistSpanCacheExpiry(
+    absl::Duration v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetCentralFreelistAddressOrdered();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetCentralFreelistAddressOrdered(
+    bool v);
+ABSL_ATTRIBUTE_WEAK bool
+TCMalloc_Internal_GetCentralFreelistNonintrusiveSpans();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetCentralFreelistNonintrusiveSpans(
+    bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetLargeSpanCache();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetLargeSpanCache(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetLargeSizeClasses();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetLargeSizeClasses(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetLargeAllocationDensityPrediction();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetLargeAllocationDensityPrediction(
+    bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetReallocMremap();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetReallocMremap(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetReallocGrowthHeadroom();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetReallocGrowthHeadroom(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetGiganticPages();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetGiganticPages(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetHugeCacheForecast();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHugeCacheForecast(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetHugeCacheLifoReuse();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHugeCacheLifoReuse(bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_GetHugeCacheColdInterval(
+    absl::Duration* v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHugeCacheColdInterval(
+    absl::Duration v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetHugepageGranularRelease();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHugepageGranularRelease(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetResidencyAwareRelease();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetResidencyAwareRelease(bool v);
+ABSL_ATTRIBUTE_WEAK uint32_t
+TCMalloc_Internal_GetSkipSubreleaseTargetRefaultPercent();
+ABSL_ATTRIBUTE_WEAK void
+TCMalloc_Internal_SetSkipSubreleaseTargetRefaultPercent(
+    uint32_t v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetDonatedTailPacking();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetDonatedTailPacking(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetLargeHugeRegions();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetLargeHugeRegions(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetMetadataHugepages();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetMetadataHugepages(bool v);
+ABSL_ATTRIBUTE_WEAK double TCMalloc_Internal_GetProfileSamplingCpuBudget();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetProfileSamplingCpuBudget(
+    double v);
+ABSL_ATTRIBUTE_WEAK int64_t TCMalloc_Internal_GetProfileSamplingMaxInterval();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetProfileSamplingMaxInterval(
+    int64_t v);
 ABSL_ATTRIBUTE_WEAK double
 TCMalloc_Internal_GetPerCpuCachesDynamicSlabGrowThreshold();
 ABSL_ATTRIBUTE_WEAK void
@@ -17,6 +17,7 @@
 #include <sched.h>
 #include <stdint.h>
 #include <sys/mman.h>
+#include <sys/auxv.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <syscall.h>
@@ -25,6 +26,7 @@
 #include <atomic>
 #include <cerrno>
 #include <cstddef>
+#include <cstring>
 #include <limits>
 #include <optional>
 
@@ -33,6 +35,7 @@
 #include "absl/base/optimization.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/cpu_utils.h"
+#include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/linux_syscall_support.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
@@ -57,6 +60,7 @@ enum PerCpuInitStatus {
 };
 
 ABSL_CONST_INIT static PerCpuInitStatus init_status = kSlowMode;
+ABSL_CONST_INIT static RseqVcpuMode rseq_vcpu_mode = RseqVcpuMode::kNone;
 ABSL_CONST_INIT static absl::once_flag init_per_cpu_once;
 #if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
 ABSL_CONST_INIT static std::atomic<bool> using_upstream_fence{false};
@@ -86,9 +90,29 @@ static bool InitThreadPerCpu() {
   return false;
 }
 
-bool UsingRseqVirtualCpus() {
-  return false;
+RseqVcpuMode GetRseqVcpuMode() { return rseq_vcpu_mode; }
+
+bool UsingRseqVirtualCpus() { return rseq_vcpu_mode == RseqVcpuMode::kMmCid; }
+
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
+static RseqVcpuMode ChooseRseqVcpuMode() {
+  const char* e = thread_safe_getenv("TCMALLOC_PERCPU_MM_CID");
+  if (e == nullptr || !strcmp(e, "0")) {
+    return RseqVcpuMode::kNone;
+  } else if (strcmp(e, "1")) {
+    TC_BUG("bad TCMALLOC_PERCPU_MM_CID env var '%s'", e);
+  }
+
+  // Older kernels leave mm_cid untouched; AT_RSEQ_FEATURE_SIZE was introduced
+  // together with it.
+  constexpr size_t kMmCidEnd =
+      offsetof(kernel_rseq, mm_cid) + sizeof(kernel_rseq::mm_cid);
+  if (getauxval(AT_RSEQ_FEATURE_SIZE) < kMmCidEnd) {
+    return RseqVcpuMode::kNone;
+  }
+  return RseqVcpuMode::kMmCid;
 }
+#endif  // TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
 
 static int UserVirtualCpuId() {
   TC_BUG("initialized unsupported vCPU mode");
@@ -100,7 +124,7 @@ int VirtualCpu::Synchronize() {
 
   if (UsingVirtualCpus()) {
     if (UsingRseqVirtualCpus())
-      vcpu = __rseq_abi.vcpu_id;
+      vcpu = __rseq_abi.mm_cid;
     else
       vcpu = UserVirtualCpuId();
   } else {
@@ -149,6 +173,11 @@ static void InitPerCpu() {
     // Ensure that tcmalloc_sampler is located before tcmalloc_slabs.
     TC_CHECK_LE(sampler_addr + TCMALLOC_SAMPLER_SIZE, slabs_addr);
 
+    // mm_cid only changes across a context switch, which also clobbers the
+    // cached slabs address (see percpu.h), so it is as safe a slab index as
+    // the CPU id.
+    rseq_vcpu_mode = ChooseRseqVcpuMode();
+
     constexpr int kMEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ = (1 << 8);
     // It is safe to make the syscall below multiple times.
     using_upstream_fence.store(
@@ -359,8 +388,6 @@ void FenceCpu(int vcpu) {
   }
 
   if (UsingRseqVirtualCpus()) {
-    ASSUME(false);
-
     // With virtual CPUs, we cannot identify the true physical core we need to
     // interrupt.
     FenceAllCpus();
@@ -31,7 +31,9 @@
 
 // TCMALLOC_PERCPU_RSEQ_SUPPORTED_PLATFORM defines whether or not we have an
 // implementation for the target OS and architecture.
-#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#if defined(__linux__) &&                            \
+    (defined(__x86_64__) || defined(__aarch64__) || \
+     (defined(__riscv) && __riscv_xlen == 64))
 #define TCMALLOC_PERCPU_RSEQ_SUPPORTED_PLATFORM 1
 #else
 #define TCMALLOC_PERCPU_RSEQ_SUPPORTED_PLATFORM 0
@@ -43,6 +45,9 @@
 #define TCMALLOC_PERCPU_RSEQ_SIGNATURE 0x53053053
 #elif defined(__aarch64__)
 #define TCMALLOC_PERCPU_RSEQ_SIGNATURE 0xd428bc00
+#elif defined(__riscv)
+// csrr mhartid, x0 (as used by the kernel's rseq selftests).
+#define TCMALLOC_PERCPU_RSEQ_SIGNATURE 0xf1401073
 #else
 // Rather than error, allow us to build, but with an invalid signature.
 #define TCMALLOC_PERCPU_RSEQ_SIGNATURE 0x0
@@ -68,7 +73,7 @@
 
 // TCMALLOC_INTERNAL_PERCPU_USE_RSEQ defines whether TCMalloc support for RSEQ
 // on the target architecture exists. We currently only provide RSEQ for 64-bit
-// x86, Arm binaries.
+// x86, Arm and RISC-V binaries.
 #if !defined(TCMALLOC_INTERNAL_PERCPU_USE_RSEQ)
 #if TCMALLOC_PERCPU_RSEQ_SUPPORTED_PLATFORM == 1
 #define TCMALLOC_INTERNAL_PERCPU_USE_RSEQ 1
@@ -174,8 +179,8 @@ ABSL_CONST_INIT thread_local volatile uintptr_t tcmalloc_slabs
     ABSL_ATTRIBUTE_WEAK = {};
 ABSL_CONST_INIT thread_local volatile kernel_rseq __rseq_abi
     ABSL_ATTRIBUTE_WEAK = {
-        0,      static_cast<unsigned>(kCpuIdUninitialized),   0, 0,
-        {0, 0}, {{kCpuIdUninitialized, kCpuIdUninitialized}},
+        0, static_cast<unsigned>(kCpuIdUninitialized),       0, 0, 0, 0,
+        {{kCpuIdUninitialized, kCpuIdUninitialized}},
 };
 ABSL_CONST_INIT thread_local volatile int tcmalloc_cached_vcpu
     ABSL_ATTRIBUTE_WEAK = kCpuIdUninitialized;
@@ -199,8 +204,18 @@ size_t TcmallocSlab_Internal_PopBatch(size_t size_class, void** batch,
 // increase the visibility of functions embedded into the root-namespace (by
 // virtue of C linkage) in the supported case.
 
-enum class RseqVcpuMode { kNone };
-inline RseqVcpuMode GetRseqVcpuMode() { return RseqVcpuMode::kNone; }
+enum class RseqVcpuMode {
+  // Per-CPU caches are indexed by physical CPU id.
+  kNone,
+  // Per-CPU caches are indexed by the kernel's rseq concurrency id (mm_cid),
+  // so only as many caches as the process has concurrently running threads
+  // are populated.  Enabled with TCMALLOC_PERCPU_MM_CID=1 on kernels that
+  // provide it.
+  kMmCid,
+};
+
+// Returns the mode chosen when per-CPU mode was initialized (see IsFast).
+RseqVcpuMode GetRseqVcpuMode();
 
 // Return whether we are using any kind of virtual CPUs.
 inline bool UsingVirtualCpus() {
@@ -349,6 +364,52 @@ inline void TSANReleaseBatch(void** batch, int n) {
 void FenceCpu(int vcpu);
 void FenceAllCpus();
 
+// A statistics counter for slow paths that many CPUs update concurrently, with
+// the interface of StatsCounter.  Updates go to a cache line picked by the CPU
+// the thread runs on, as tracked by rseq, so that CPUs do not bounce a single
+// line between them; reads sum the lines.
+//
+// The thread may migrate between picking the line and updating it, so updates
+// are still atomic, but they rarely contend.  Threads that have not
+// initialized rseq update the first line, and CPUs beyond kShards share lines.
+class PerCpuCounter {
+ public:
+  using Value = int64_t;
+
+  static constexpr int kShards = 64;
+
+  constexpr PerCpuCounter() = default;
+  PerCpuCounter(const PerCpuCounter&) = delete;
+  PerCpuCounter& operator=(const PerCpuCounter&) = delete;
+
+  void Add(Value increment) {
+    shards_[Shard()].value.fetch_add(increment, std::memory_order_relaxed);
+  }
+
+  // Returns the sum of the lines.  Concurrent updates may or may not be seen.
+  Value value() const {
+    Value sum = 0;
+    for (const Line& line : shards_) {
+      sum += line.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+ private:
+  struct alignas(ABSL_CACHELINE_SIZE) Line {
+    std::atomic<Value> value{0};
+  };
+
+  static size_t Shard() {
+    const int cpu = GetRealCpuUnsafe();
+    return ABSL_PREDICT_TRUE(cpu >= kCpuIdInitialized)
+               ? static_cast<size_t>(cpu) % kShards
+               : 0;
+  }
+
+  Line shards_[kShards];
+};
+
 }  // namespace percpu
 }  // namespace subtle
 }  // namespace tcmalloc_internal
@@ -0,0 +1,62 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Compares shared and per-CPU statistics counters updated by every thread, as
+// slow paths do.  Run with as many threads as the host has CPUs to see the
+// cost of bouncing a shared counter between them.
+
+#include "absl/base/attributes.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/internal/atomic_stats_counter.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/percpu.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+template <typename Counter>
+void BM_Add(benchmark::State& state) {
+  ABSL_CONST_INIT static Counter counter;
+  subtle::percpu::IsFast();
+  for (auto _ : state) {
+    counter.Add(1);
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    benchmark::DoNotOptimize(counter.value());
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_Add, StatsCounter)->ThreadRange(1, 256)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Add, subtle::percpu::PerCpuCounter)
+    ->ThreadRange(1, 256)
+    ->UseRealTime();
+
+template <typename Counter>
+void BM_Value(benchmark::State& state) {
+  Counter counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(counter.value());
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_Value, StatsCounter);
+BENCHMARK_TEMPLATE(BM_Value, subtle::percpu::PerCpuCounter);
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -36,6 +36,7 @@
 #include "absl/base/optimization.h"
 #include "absl/functional/function_ref.h"
 #include "absl/numeric/bits.h"
+#include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/mincore.h"
 #include "tcmalloc/internal/optimization.h"
@@ -61,6 +62,13 @@ struct PerCPUMetadataState {
   size_t resident_size;
 };
 
+struct PerCPUSlabTlbCoverage {
+  size_t slabs_size;
+  // Bytes of the slabs that lie within naturally aligned hugepages, i.e. that
+  // can each be mapped by a single TLB entry once backed by a THP.
+  size_t hugepage_aligned_size;
+};
+
 struct ResizeSlabsInfo {
   void* old_slabs;
   size_t old_slabs_size;
@@ -173,6 +181,20 @@ class TcmallocSlab {
       absl::FunctionRef<size_t(size_t)> capacity,
       absl::FunctionRef<bool(size_t)> populated, DrainHandler drain_handler);
 
+  // Like ResizeSlabs, but switches one cpu at a time to <new_slabs> rather than
+  // stopping all of them at once, so that local operations only fail on the
+  // cpu being switched.  The other cpus keep using the slabs they are on, and
+  // each cpu's part of the old slabs is drained as soon as it is switched.  The
+  // old slabs are no longer used once this returns, after every cpu has been
+  // fenced off them, so the caller may madvise them away.
+  //
+  // Caller must ensure that there are no concurrent calls to InitCpu,
+  // ShrinkOtherCache, Drain, UpdateMaxCapacities or ResizeSlabs.
+  ABSL_MUST_USE_RESULT ResizeSlabsInfo ResizeSlabsIncrementally(
+      Shift new_shift, void* new_slabs,
+      absl::FunctionRef<size_t(size_t)> capacity,
+      absl::FunctionRef<bool(size_t)> populated, DrainHandler drain_handler);
+
   // For tests. Returns the freed slabs pointer.
   void* Destroy(absl::FunctionRef<void(void*, size_t, std::align_val_t)> free);
 
@@ -271,6 +293,13 @@ class TcmallocSlab {
   size_t ShrinkOtherCache(int cpu, size_t size_class, size_t len,
                           ShrinkHandler shrink_handler);
 
+  // Pops up to <len> items from cpu/size_class slab into <batch> without
+  // changing its capacity.  Returns the number of items removed.
+  //
+  // May be called from another processor, not just the <cpu>.
+  // REQUIRES: len > 0.
+  size_t PopOtherCache(int cpu, size_t size_class, void** batch, size_t len);
+
   // Remove all items (of all classes) from <cpu>'s slab; reset capacity for all
   // classes to zero.  Then, for each sizeclass, invoke
   // DrainHandler(size_class, <items from slab>, <previous slab capacity>);
@@ -281,6 +310,10 @@ class TcmallocSlab {
 
   PerCPUMetadataState MetadataMemoryUsage() const;
 
+  // Reports how much of the current slabs are hugepage-aligned, as an upper
+  // bound on the TLB coverage those slabs can get from transparent hugepages.
+  PerCPUSlabTlbCoverage SlabTlbCoverage() const;
+
   // Gets the current shift of the slabs. Intended for use by the thread that
   // calls ResizeSlabs().
   uint8_t GetShift() const {
@@ -356,12 +389,27 @@ class TcmallocSlab {
     return slabs_and_shift_.load(order).Get();
   }
 
+  // The slabs, shift and size class begins in use by one cpu.
+  struct CpuLayout {
+    void* slabs;
+    Shift shift;
+    const std::atomic<uint16_t>* begins;
+  };
+
+  // Returns the layout of <cpu>: the one being resized to if
+  // ResizeSlabsIncrementally has switched <cpu> already, and the current one
+  // otherwise.
+  ABSL_MUST_USE_RESULT CpuLayout GetCpuLayout(int cpu) const;
+
   static void* CpuMemoryStart(void* slabs, Shift shift, int cpu);
   static AtomicHeader* GetHeader(void* slabs, Shift shift, int cpu,
                                  size_t size_class);
   static Header LoadHeader(AtomicHeader* hdrp);
   static void StoreHeader(AtomicHeader* hdrp, Header hdr);
-  void DrainCpu(void* slabs, Shift shift, int cpu, DrainHandler drain_handler);
+  void DrainCpu(const CpuLayout& layout, int cpu, DrainHandler drain_handler);
+  static void InitBegins(Shift shift,
+                         absl::FunctionRef<size_t(size_t)> capacity,
+                         std::atomic<uint16_t>* begins);
   void DrainOldSlabs(void* slabs, Shift shift, int cpu,
                      const std::array<uint16_t, NumClasses>& old_begins,
                      DrainHandler drain_handler);
@@ -380,6 +428,16 @@ class TcmallocSlab {
   std::atomic<bool>* stopped_ = nullptr;
   // begins_[size_class] is offset of the size_class region in the slabs area.
   std::atomic<uint16_t>* begins_ = nullptr;
+
+  // While ResizeSlabsIncrementally runs, the slabs being switched to and the
+  // begins of their size classes.  resized_[cpu] is set once <cpu> uses them.
+  std::atomic<SlabsAndShift> next_slabs_and_shift_{};
+  std::atomic<uint16_t>* next_begins_ = nullptr;
+  std::atomic<bool>* resized_ = nullptr;
+  // The begins that bound PopBatch, which cannot tell which slabs its cpu
+  // uses: the larger of begins_ and next_begins_ during an incremental resize,
+  // so that it never pops past the begin of either, and begins_ otherwise.
+  std::atomic<uint16_t>* pop_begins_ = nullptr;
 };
 
 // RAII for StopCpu/StartCpu.
@@ -404,9 +462,10 @@ class ScopedSlabCpuStop {
 template <size_t NumClasses>
 inline size_t TcmallocSlab<NumClasses>::Length(int cpu,
                                                size_t size_class) const {
-  const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
-  Header hdr = LoadHeader(GetHeader(slabs, shift, cpu, size_class));
-  uint16_t begin = begins_[size_class].load(std::memory_order_relaxed);
+  const CpuLayout layout = GetCpuLayout(cpu);
+  Header hdr =
+      LoadHeader(GetHeader(layout.slabs, layout.shift, cpu, size_class));
+  uint16_t begin = layout.begins[size_class].load(std::memory_order_relaxed);
   // We can read inconsistent hdr/begin during Resize, to avoid surprising
   // callers return 0 instead of overflows values.
   return std::max<ssize_t>(0, hdr.current - begin);
@@ -415,9 +474,10 @@ inline size_t TcmallocSlab<NumClasses>::Length(int cpu,
 template <size_t NumClasses>
 inline size_t TcmallocSlab<NumClasses>::Capacity(int cpu,
                                                  size_t size_class) const {
-  const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
-  Header hdr = LoadHeader(GetHeader(slabs, shift, cpu, size_class));
-  uint16_t begin = begins_[size_class].load(std::memory_order_relaxed);
+  const CpuLayout layout = GetCpuLayout(cpu);
+  Header hdr =
+      LoadHeader(GetHeader(layout.slabs, layout.shift, cpu, size_class));
+  uint16_t begin = layout.begins[size_class].load(std::memory_order_relaxed);
   return std::max<ssize_t>(0, hdr.end - begin);
 }
 
@@ -462,6 +522,19 @@ inline size_t TcmallocSlab<NumClasses>::Capacity(int cpu,
   "add %[scratch], %[scratch], :lo12:__rseq_cs_" #name \
   "_%=\n"                                              \
   "str %[scratch], %[rseq_cs_addr]\n"
+
+#elif defined(__riscv)
+// The trampoline is located in the .text.unlikely section, which may be
+// beyond the +-1MB reach of a JAL, so it jumps back with TAIL (AUIPC+JALR)
+// instead, which clobbers t1. RSEQ critical section asm blocks should use
+// TCMALLOC_RSEQ_CLOBBER in the clobber list to account for this.
+#define TCMALLOC_RSEQ_CLOBBER "t1"
+#define TCMALLOC_RSEQ_RELOC_TYPE "R_RISCV_NONE"
+#define TCMALLOC_RSEQ_JUMP "tail"
+#define TCMALLOC_RSEQ_SET_CS(name)       \
+  "lla %[scratch], __rseq_cs_" #name     \
+  "_%=\n"                                \
+  "sd %[scratch], %[rseq_cs_addr]\n"
 #endif
 
 #if !defined(__clang_major__) || __clang_major__ >= 9
@@ -587,6 +660,37 @@ inline ABSL_ATTRIBUTE_ALWAYS_INLINE bool StoreCurrentCpu(volatile void* p,
           [v] "r"(v)
         : TCMALLOC_RSEQ_CLOBBER, "cc", "memory");
   }
+#elif TCMALLOC_INTERNAL_PERCPU_USE_RSEQ && defined(__riscv)
+  uintptr_t tmp;
+  // As on Aarch64, the store width is part of the instruction (SD vs SW).
+  if constexpr (sizeof(T) == sizeof(uint64_t)) {
+    asm(TCMALLOC_RSEQ_PROLOGUE(TcmallocSlab_Internal_StoreCurrentCpu)
+            R"(
+        li %[scratch], 0
+        ld %[tmp], %[rseq_slabs_addr]
+        bgez %[tmp], 5f
+        li %[scratch], 1
+        sd %[v], %[p]
+        5 :)"
+        : [scratch] "=&r"(scratch), [tmp] "=&r"(tmp)
+        : TCMALLOC_RSEQ_INPUTS, [p] "m"(*static_cast<uint64_t* volatile*>(p)),
+          [v] "r"(v)
+        : TCMALLOC_RSEQ_CLOBBER, "memory");
+  } else {
+    static_assert(sizeof(T) == sizeof(uint32_t));
+    asm(TCMALLOC_RSEQ_PROLOGUE(TcmallocSlab_Internal_StoreCurrentCpu)
+            R"(
+        li %[scratch], 0
+        ld %[tmp], %[rseq_slabs_addr]
+        bgez %[tmp], 5f
+        li %[scratch], 1
+        sw %[v], %[p]
+        5 :)"
+        : [scratch] "=&r"(scratch), [tmp] "=&r"(tmp)
+        : TCMALLOC_RSEQ_INPUTS, [p] "m"(*static_cast<uint32_t* volatile*>(p)),
+          [v] "r"(v)
+        : TCMALLOC_RSEQ_CLOBBER, "memory");
+  }
 #endif
   return scratch;
 }
@@ -729,6 +833,79 @@ overflow_label:
 }
 #endif  // defined (__aarch64__)
 
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ && defined(__riscv)
+static inline ABSL_ATTRIBUTE_ALWAYS_INLINE bool TcmallocSlab_Internal_Push(
+    size_t size_class, void* item) {
+  uintptr_t region_start, scratch, hdr, end;
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+  asm goto(
+#else
+  // RISC-V has no condition flags, so the result is returned in a register.
+  uintptr_t overflow;
+  asm volatile(
+#endif
+      TCMALLOC_RSEQ_PROLOGUE(TcmallocSlab_Internal_Push)
+#if !TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+      "li %[overflow], 1\n"
+#endif
+      // region_start = tcmalloc_slabs;
+      "ld %[region_start], %[rseq_slabs_addr]\n"
+  // if (!(region_start & TCMALLOC_CACHED_SLABS_MASK)) goto overflow_label;
+  // TCMALLOC_CACHED_SLABS_MASK is the sign bit.
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+      "bgez %[region_start], %l[overflow_label]\n"
+#else
+      "bgez %[region_start], 5f\n"
+#endif
+      // region_start &= ~TCMALLOC_CACHED_SLABS_MASK;
+      "slli %[region_start], %[region_start], 1\n"
+      "srli %[region_start], %[region_start], 1\n"
+      // hdr = &slab_headers[size_class]
+      "add %[hdr], %[region_start], %[size_class_lsl2]\n"
+      // scratch = hdr->current (current index)
+      "lhu %[scratch], 0(%[hdr])\n"
+      // end = hdr->end (end index)
+      "lhu %[end], 2(%[hdr])\n"
+  // if (ABSL_PREDICT_FALSE(scratch >= end)) { goto overflow_label; }
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+      "bgeu %[scratch], %[end], %l[overflow_label]\n"
+#else
+      "bgeu %[scratch], %[end], 5f\n"
+#endif
+      // end = &region_start[scratch]
+      "slli %[end], %[scratch], 3\n"
+      "add %[end], %[region_start], %[end]\n"
+      "sd %[item], 0(%[end])\n"
+      "addi %[scratch], %[scratch], 1\n"
+#if !TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+      "li %[overflow], 0\n"
+#endif
+      "sh %[scratch], 0(%[hdr])\n"
+      // Commit
+      "5:\n"
+      : [region_start] "=&r"(region_start), [scratch] "=&r"(scratch),
+#if !TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+        [overflow] "=&r"(overflow),
+#endif
+        [hdr] "=&r"(hdr), [end] "=&r"(end)
+      : TCMALLOC_RSEQ_INPUTS, [size_class_lsl2] "r"(size_class << 2),
+        [item] "r"(item)
+      : TCMALLOC_RSEQ_CLOBBER, "memory"
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+      : overflow_label
+#endif
+  );
+#if !TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+  if (ABSL_PREDICT_FALSE(overflow)) {
+    goto overflow_label;
+  }
+#endif
+  return true;
+overflow_label:
+  return false;
+}
+#endif  // defined(__riscv)
+
 template <size_t NumClasses>
 inline ABSL_ATTRIBUTE_ALWAYS_INLINE bool TcmallocSlab<NumClasses>::Push(
     size_t size_class, void* item) {
@@ -933,6 +1110,88 @@ underflow_path:
 }
 #endif  // defined(__aarch64__)
 
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ && defined(__riscv)
+template <size_t NumClasses>
+inline ABSL_ATTRIBUTE_ALWAYS_INLINE void* TcmallocSlab<NumClasses>::Pop(
+    size_t size_class) {
+  TC_ASSERT_NE(size_class, 0);
+  void* result;
+  void* prefetch;
+  uintptr_t region_start, scratch, hdr, slot;
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+  asm goto(
+#else
+  uintptr_t underflow;
+  asm(
+#endif
+      TCMALLOC_RSEQ_PROLOGUE(TcmallocSlab_Internal_Pop)
+#if !TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+      "li %[underflow], 1\n"
+#endif
+      // region_start = tcmalloc_slabs;
+      "ld %[region_start], %[rseq_slabs_addr]\n"
+  // if (!(region_start & TCMALLOC_CACHED_SLABS_MASK)) goto underflow_path;
+  // TCMALLOC_CACHED_SLABS_MASK is the sign bit.
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+      "bgez %[region_start], %l[underflow_path]\n"
+#else
+      "bgez %[region_start], 5f\n"
+#endif
+      // region_start &= ~TCMALLOC_CACHED_SLABS_MASK;
+      "slli %[region_start], %[region_start], 1\n"
+      "srli %[region_start], %[region_start], 1\n"
+      // hdr = &slab_headers[size_class]
+      "add %[hdr], %[region_start], %[size_class_lsl2]\n"
+      // scratch = hdr->current - 1
+      "lhu %[scratch], 0(%[hdr])\n"
+      "addi %[scratch], %[scratch], -1\n"
+      // slot = &region_start[scratch]
+      "slli %[slot], %[scratch], 3\n"
+      "add %[slot], %[region_start], %[slot]\n"
+      "ld %[result], 0(%[slot])\n"
+      // Temporarily use %[prefetch] to test the begin mark of %[result].
+      "andi %[prefetch], %[result], %c[begin_mark_mask]\n"
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+      "bnez %[prefetch], %l[underflow_path]\n"
+#else
+      "bnez %[prefetch], 5f\n"
+#endif
+      "ld %[prefetch], -8(%[slot])\n"
+#if !TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+      "li %[underflow], 0\n"
+#endif
+      "sh %[scratch], 0(%[hdr])\n"
+      // Commit
+      "5:\n"
+      :
+#if !TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+      [underflow] "=&r"(underflow),
+#endif
+      [result] "=&r"(result), [prefetch] "=&r"(prefetch),
+      // Temps
+      [region_start] "=&r"(region_start), [hdr] "=&r"(hdr),
+      [slot] "=&r"(slot), [scratch] "=&r"(scratch)
+      // Real inputs
+      : TCMALLOC_RSEQ_INPUTS, [begin_mark_mask] "n"(kBeginMark),
+        [size_class_lsl2] "r"(size_class << 2)
+      : TCMALLOC_RSEQ_CLOBBER, "memory"
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+      : underflow_path
+#endif
+  );
+#if !TCMALLOC_INTERNAL_PERCPU_USE_RSEQ_ASM_GOTO_OUTPUT
+  if (ABSL_PREDICT_FALSE(underflow)) {
+    goto underflow_path;
+  }
+#endif
+  TSANAcquire(result);
+  PrefetchNextObject(prefetch);
+  return AssumeNotNull(result);
+underflow_path:
+  return nullptr;
+}
+#endif  // defined(__riscv)
+
 #if !TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
 template <size_t NumClasses>
 inline ABSL_ATTRIBUTE_ALWAYS_INLINE void* TcmallocSlab<NumClasses>::Pop(
@@ -945,11 +1204,11 @@ template <size_t NumClasses>
 inline size_t TcmallocSlab<NumClasses>::Grow(
     int cpu, size_t size_class, size_t len,
     absl::FunctionRef<size_t(uint8_t)> max_capacity) {
-  const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
-  const size_t max_cap = max_capacity(ToUint8(shift));
-  auto* hdrp = GetHeader(slabs, shift, cpu, size_class);
+  const CpuLayout layout = GetCpuLayout(cpu);
+  const size_t max_cap = max_capacity(ToUint8(layout.shift));
+  auto* hdrp = GetHeader(layout.slabs, layout.shift, cpu, size_class);
   Header hdr = LoadHeader(hdrp);
-  uint16_t begin = begins_[size_class].load(std::memory_order_relaxed);
+  uint16_t begin = layout.begins[size_class].load(std::memory_order_relaxed);
   ssize_t have = static_cast<ssize_t>(max_cap - (hdr.end - begin));
   if (have <= 0) {
     return 0;
@@ -998,7 +1257,7 @@ inline size_t TcmallocSlab<NumClasses>::PopBatch(size_t size_class,
   TC_ASSERT_NE(size_class, 0);
   TC_ASSERT_NE(len, 0);
   const size_t n = TcmallocSlab_Internal_PopBatch(size_class, batch, len,
-                                                  &begins_[size_class]);
+                                                  &pop_begins_[size_class]);
   TC_ASSERT_LE(n, len);
 
   // PopBatch is implemented in assembly, msan does not know that the returned
@@ -1037,14 +1296,20 @@ template <size_t NumClasses>
 void TcmallocSlab<NumClasses>::Init(
     absl::FunctionRef<void*(size_t, std::align_val_t)> alloc, void* slabs,
     absl::FunctionRef<size_t(size_t)> capacity, Shift shift) {
-  stopped_ = new (alloc(sizeof(stopped_[0]) * NumCPUs(),
+  // stopped_ and resized_ share an allocation, as do the begins.
+  stopped_ = new (alloc(sizeof(stopped_[0]) * 2 * NumCPUs(),
                         std::align_val_t{ABSL_CACHELINE_SIZE}))
-      std::atomic<bool>[NumCPUs()];
+      std::atomic<bool>[2 * NumCPUs()];
+  resized_ = stopped_ + NumCPUs();
   for (int cpu = NumCPUs() - 1; cpu >= 0; cpu--) {
     stopped_[cpu].store(false, std::memory_order_relaxed);
+    resized_[cpu].store(false, std::memory_order_relaxed);
   }
-  begins_ = static_cast<std::atomic<uint16_t>*>(alloc(
-      sizeof(begins_[0]) * NumClasses, std::align_val_t{ABSL_CACHELINE_SIZE}));
+  begins_ = static_cast<std::atomic<uint16_t>*>(
+      alloc(sizeof(begins_[0]) * 3 * NumClasses,
+            std::align_val_t{ABSL_CACHELINE_SIZE}));
+  next_begins_ = begins_ + NumClasses;
+  pop_begins_ = begins_ + 2 * NumClasses;
   InitSlabs(slabs, shift, capacity);
 
 #if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
@@ -1058,6 +1323,18 @@ template <size_t NumClasses>
 void TcmallocSlab<NumClasses>::InitSlabs(
     void* slabs, Shift shift, absl::FunctionRef<size_t(size_t)> capacity) {
   slabs_and_shift_.store({slabs, shift}, std::memory_order_relaxed);
+  InitBegins(shift, capacity, begins_);
+  for (size_t size_class = 1; size_class < NumClasses; ++size_class) {
+    pop_begins_[size_class].store(
+        begins_[size_class].load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+  }
+}
+
+template <size_t NumClasses>
+void TcmallocSlab<NumClasses>::InitBegins(
+    Shift shift, absl::FunctionRef<size_t(size_t)> capacity,
+    std::atomic<uint16_t>* begins) {
   size_t consumed_bytes =
       (NumClasses * sizeof(Header) + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
   bool prev_empty = false;
@@ -1069,8 +1346,8 @@ void TcmallocSlab<NumClasses>::InitSlabs(
       consumed_bytes += sizeof(void*);
     }
     prev_empty = cap == 0;
-    begins_[size_class].store(consumed_bytes / sizeof(void*),
-                              std::memory_order_relaxed);
+    begins[size_class].store(consumed_bytes / sizeof(void*),
+                             std::memory_order_relaxed);
     consumed_bytes += cap * sizeof(void*);
     if (consumed_bytes > (1 << ToUint8(shift))) {
       TC_BUG("per-CPU memory exceeded, have %v, need %v, size_class %v",
@@ -1083,8 +1360,8 @@ template <size_t NumClasses>
 void TcmallocSlab<NumClasses>::InitCpu(
     int cpu, absl::FunctionRef<size_t(size_t)> capacity) {
   ScopedSlabCpuStop<NumClasses> cpu_stop(*this, cpu);
-  const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
-  InitCpuImpl(slabs, shift, cpu, capacity);
+  const CpuLayout layout = GetCpuLayout(cpu);
+  InitCpuImpl(layout.slabs, layout.shift, cpu, capacity);
 }
 
 template <size_t NumClasses>
@@ -1141,9 +1418,8 @@ std::pair<int, bool> TcmallocSlab<NumClasses>::CacheCpuSlabSlow() {
     tcmalloc_slabs = TCMALLOC_CACHED_SLABS_MASK;
     CompilerBarrier();
     vcpu = VirtualCpu::Synchronize();
-    auto slabs_and_shift = slabs_and_shift_.load(std::memory_order_relaxed);
-    const auto [slabs, shift] = slabs_and_shift.Get();
-    void* start = CpuMemoryStart(slabs, shift, vcpu);
+    const CpuLayout layout = GetCpuLayout(vcpu);
+    void* start = CpuMemoryStart(layout.slabs, layout.shift, vcpu);
     uintptr_t new_val =
         reinterpret_cast<uintptr_t>(start) | TCMALLOC_CACHED_SLABS_MASK;
     if (!StoreCurrentCpu(&tcmalloc_slabs, new_val)) {
@@ -1172,8 +1448,10 @@ std::pair<int, bool> TcmallocSlab<NumClasses>::CacheCpuSlabSlow() {
     // between (to new slabs and then back to old slabs), the check below will
     // not lead to a retry, but changing slabs back also implies another Fence,
     // so this thread won't have old slabs cached already (Fence invalidates
-    // the cached pointer).
-    if (slabs_and_shift != slabs_and_shift_.load(std::memory_order_relaxed)) {
+    // the cached pointer).  ResizeSlabsIncrementally sets resized_[vcpu]
+    // before resetting stopped_[vcpu], so the same applies to it.
+    const CpuLayout current = GetCpuLayout(vcpu);
+    if (start != CpuMemoryStart(current.slabs, current.shift, vcpu)) {
       continue;
     }
     return {vcpu, true};
@@ -1182,11 +1460,12 @@ std::pair<int, bool> TcmallocSlab<NumClasses>::CacheCpuSlabSlow() {
 #endif
 
 template <size_t NumClasses>
-void TcmallocSlab<NumClasses>::DrainCpu(void* slabs, Shift shift, int cpu,
+void TcmallocSlab<NumClasses>::DrainCpu(const CpuLayout& layout, int cpu,
                                         DrainHandler drain_handler) {
   TC_ASSERT(stopped_[cpu].load(std::memory_order_relaxed));
+  const auto [slabs, shift, begins] = layout;
   for (size_t size_class = 1; size_class < NumClasses; ++size_class) {
-    uint16_t begin = begins_[size_class].load(std::memory_order_relaxed);
+    uint16_t begin = begins[size_class].load(std::memory_order_relaxed);
     auto* hdrp = GetHeader(slabs, shift, cpu, size_class);
     Header hdr = LoadHeader(hdrp);
     if (hdr.current == 0) {
@@ -1323,15 +1602,83 @@ auto TcmallocSlab<NumClasses>::ResizeSlabs(
   return {old_slabs, GetSlabsAllocSize(old_shift, num_cpus)};
 }
 
+template <size_t NumClasses>
+auto TcmallocSlab<NumClasses>::ResizeSlabsIncrementally(
+    Shift new_shift, void* new_slabs,
+    absl::FunctionRef<size_t(size_t)> capacity,
+    absl::FunctionRef<bool(size_t)> populated,
+    DrainHandler drain_handler) -> ResizeSlabsInfo {
+  // Phase 1: Lay out the new slabs, and bound PopBatch by the begins of both
+  // layouts.
+  const auto [old_slabs, old_shift] =
+      GetSlabsAndShift(std::memory_order_relaxed);
+  TC_ASSERT_NE(new_shift, old_shift);
+  std::array<uint16_t, NumClasses> old_begins;
+  InitBegins(new_shift, capacity, next_begins_);
+  for (int size_class = 1; size_class < NumClasses; ++size_class) {
+    old_begins[size_class] =
+        begins_[size_class].load(std::memory_order_relaxed);
+    pop_begins_[size_class].store(
+        std::max(old_begins[size_class],
+                 next_begins_[size_class].load(std::memory_order_relaxed)),
+        std::memory_order_relaxed);
+  }
+  next_slabs_and_shift_.store({new_slabs, new_shift},
+                              std::memory_order_relaxed);
+
+  // Phase 2: Switch the cpus one at a time, and return the pointers from the
+  // old slab of each to the TransferCache once it is off it.  StartCpu
+  // publishes the new layout of the cpu to the threads that cache its slab
+  // next.
+  const int num_cpus = NumCPUs();
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    StopCpu(cpu);
+    if (populated(cpu)) {
+      InitCpuImpl(new_slabs, new_shift, cpu, capacity);
+    }
+    resized_[cpu].store(true, std::memory_order_relaxed);
+    StartCpu(cpu);
+    if (populated(cpu)) {
+      DrainOldSlabs(old_slabs, old_shift, cpu, old_begins, drain_handler);
+    }
+  }
+
+  // Phase 3: Make the new slabs the current ones.  All cpus use them already,
+  // so none needs to be stopped.
+  InitSlabs(new_slabs, new_shift, capacity);
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    resized_[cpu].store(false, std::memory_order_release);
+  }
+
+  return {old_slabs, GetSlabsAllocSize(old_shift, num_cpus)};
+}
+
+template <size_t NumClasses>
+inline auto TcmallocSlab<NumClasses>::GetCpuLayout(int cpu) const
+    -> CpuLayout {
+  // Pairs with the release in ResizeSlabsIncrementally, so that once <cpu> is
+  // no longer marked, we see the new slabs as the current ones.
+  if (ABSL_PREDICT_FALSE(resized_[cpu].load(std::memory_order_acquire))) {
+    const auto [slabs, shift] =
+        next_slabs_and_shift_.load(std::memory_order_relaxed).Get();
+    return {slabs, shift, next_begins_};
+  }
+  const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
+  return {slabs, shift, begins_};
+}
+
 template <size_t NumClasses>
 void* TcmallocSlab<NumClasses>::Destroy(
     absl::FunctionRef<void(void*, size_t, std::align_val_t)> free) {
-  free(stopped_, sizeof(stopped_[0]) * NumCPUs(),
+  free(stopped_, sizeof(stopped_[0]) * 2 * NumCPUs(),
        std::align_val_t{ABSL_CACHELINE_SIZE});
   stopped_ = nullptr;
-  free(begins_, sizeof(begins_[0]) * NumClasses,
+  resized_ = nullptr;
+  free(begins_, sizeof(begins_[0]) * 3 * NumClasses,
        std::align_val_t{ABSL_CACHELINE_SIZE});
   begins_ = nullptr;
+  next_begins_ = nullptr;
+  pop_begins_ = nullptr;
   const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
   free(slabs, GetSlabsAllocSize(shift, NumCPUs()), kPhysicalPageAlign);
   slabs_and_shift_.store({nullptr, shift}, std::memory_order_relaxed);
@@ -1343,11 +1690,11 @@ size_t TcmallocSlab<NumClasses>::GrowOtherCache(
     int cpu, size_t size_class, size_t len,
     absl::FunctionRef<size_t(uint8_t)> max_capacity) {
   TC_ASSERT(stopped_[cpu].load(std::memory_order_relaxed));
-  const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
+  const auto [slabs, shift, begins] = GetCpuLayout(cpu);
   const size_t max_cap = max_capacity(ToUint8(shift));
   auto* hdrp = GetHeader(slabs, shift, cpu, size_class);
   Header hdr = LoadHeader(hdrp);
-  uint16_t begin = begins_[size_class].load(std::memory_order_relaxed);
+  uint16_t begin = begins[size_class].load(std::memory_order_relaxed);
   uint16_t to_grow = std::min<uint16_t>(len, max_cap - (hdr.end - begin));
   hdr.end += to_grow;
   StoreHeader(hdrp, hdr);
@@ -1358,7 +1705,7 @@ template <size_t NumClasses>
 size_t TcmallocSlab<NumClasses>::ShrinkOtherCache(
     int cpu, size_t size_class, size_t len, ShrinkHandler shrink_handler) {
   TC_ASSERT(stopped_[cpu].load(std::memory_order_relaxed));
-  const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
+  const auto [slabs, shift, begins] = GetCpuLayout(cpu);
 
   auto* hdrp = GetHeader(slabs, shift, cpu, size_class);
   Header hdr = LoadHeader(hdrp);
@@ -1367,7 +1714,7 @@ size_t TcmallocSlab<NumClasses>::ShrinkOtherCache(
   // the list first to create enough capacity that can be shrunk.
   // If we pop items, we also execute callbacks.
   const uint16_t unused = hdr.end - hdr.current;
-  uint16_t begin = begins_[size_class].load(std::memory_order_relaxed);
+  uint16_t begin = begins[size_class].load(std::memory_order_relaxed);
   if (unused < len && hdr.current != begin) {
     uint16_t pop = std::min<uint16_t>(len - unused, hdr.current - begin);
     void** batch = reinterpret_cast<void**>(CpuMemoryStart(slabs, shift, cpu)) +
@@ -1384,11 +1731,32 @@ size_t TcmallocSlab<NumClasses>::ShrinkOtherCache(
   return to_shrink;
 }
 
+template <size_t NumClasses>
+size_t TcmallocSlab<NumClasses>::PopOtherCache(int cpu, size_t size_class,
+                                               void** batch, size_t len) {
+  TC_ASSERT(stopped_[cpu].load(std::memory_order_relaxed));
+  TC_ASSERT_GT(len, 0);
+  const auto [slabs, shift, begins] = GetCpuLayout(cpu);
+
+  auto* hdrp = GetHeader(slabs, shift, cpu, size_class);
+  Header hdr = LoadHeader(hdrp);
+  const uint16_t begin = begins[size_class].load(std::memory_order_relaxed);
+  const uint16_t pop = std::min<size_t>(len, hdr.current - begin);
+  if (pop == 0) return 0;
+
+  void** items = reinterpret_cast<void**>(CpuMemoryStart(slabs, shift, cpu)) +
+                 hdr.current - pop;
+  TSANAcquireBatch(items, pop);
+  memcpy(batch, items, sizeof(void*) * pop);
+  hdr.current -= pop;
+  StoreHeader(hdrp, hdr);
+  return pop;
+}
+
 template <size_t NumClasses>
 void TcmallocSlab<NumClasses>::Drain(int cpu, DrainHandler drain_handler) {
   ScopedSlabCpuStop<NumClasses> cpu_stop(*this, cpu);
-  const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
-  DrainCpu(slabs, shift, cpu, drain_handler);
+  DrainCpu(GetCpuLayout(cpu), cpu, drain_handler);
 }
 
 template <size_t NumClasses>
@@ -1411,13 +1779,25 @@ PerCPUMetadataState TcmallocSlab<NumClasses>::MetadataMemoryUsage() const {
   PerCPUMetadataState result;
   const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
   size_t slabs_size = GetSlabsAllocSize(shift, NumCPUs());
-  size_t stopped_size = NumCPUs() * sizeof(stopped_[0]);
-  size_t begins_size = NumClasses * sizeof(begins_[0]);
+  size_t stopped_size = 2 * NumCPUs() * sizeof(stopped_[0]);
+  size_t begins_size = 3 * NumClasses * sizeof(begins_[0]);
   result.virtual_size = stopped_size + slabs_size + begins_size;
   result.resident_size = MInCore::residence(slabs, slabs_size);
   return result;
 }
 
+template <size_t NumClasses>
+PerCPUSlabTlbCoverage TcmallocSlab<NumClasses>::SlabTlbCoverage() const {
+  const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
+  const size_t slabs_size = GetSlabsAllocSize(shift, NumCPUs());
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(slabs);
+  const uintptr_t end = begin + slabs_size;
+  const uintptr_t huge_begin =
+      (begin + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  const uintptr_t huge_end = end & ~(kHugePageSize - 1);
+  return {slabs_size, huge_end > huge_begin ? huge_end - huge_begin : 0};
+}
+
 }  // namespace percpu
 }  // namespace subtle
 }  // namespace tcmalloc_internal
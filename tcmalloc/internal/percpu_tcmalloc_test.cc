@@ -76,6 +76,7 @@ namespace percpu {
 namespace {
 
 using testing::Each;
+using testing::UnorderedElementsAre;
 using testing::UnorderedElementsAreArray;
 
 constexpr size_t kStressSlabs = 5;
@@ -533,6 +534,71 @@ TEST_F(TcmallocSlabTest, ShrinkEmptyCache) {
   slab_.StartCpu(kCpu);
 }
 
+TEST_F(TcmallocSlabTest, ResizeSlabsIncrementally) {
+  if (MallocExtension::PerCpuCachesActive()) {
+    // This test unregisters rseq temporarily, as to decrease flakiness.
+    GTEST_SKIP() << "per-CPU TCMalloc is incompatible with unregistering rseq";
+  }
+
+  if (!IsFast()) {
+    GTEST_SKIP() << "Need fast percpu. Skipping.";
+    return;
+  }
+  constexpr int kCpu = 1;
+  constexpr int kSizeClass = 1;
+  const auto max_capacity = [](uint8_t shift) { return kCapacity; };
+
+  ScopedFakeCpuId fake_cpu_id(kCpu);
+  slab_.InitCpu(kCpu, [](size_t size_class) { return kCapacity; });
+  {
+    auto [got_cpu, cached] = slab_.CacheCpuSlab();
+    ASSERT_TRUE(cached);
+    ASSERT_EQ(got_cpu, kCpu);
+  }
+  void* objects[kCapacity];
+  ASSERT_EQ(slab_.Grow(kCpu, kSizeClass, kCapacity, max_capacity), kCapacity);
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(slab_.Push(kSizeClass, &objects[i]));
+  }
+
+  // The objects and capacity of the old slabs are handed back.
+  std::vector<void*> drained;
+  size_t drained_capacity = 0;
+  void* slabs = AllocSlabs(allocator, kShift - 1);
+  const auto [old_slabs, old_slabs_size] = slab_.ResizeSlabsIncrementally(
+      ToShiftType(kShift - 1), slabs, [](size_t) { return kCapacity; },
+      [](int cpu) { return cpu == kCpu; },
+      [&](int cpu, size_t size_class, void** batch, size_t size, size_t cap) {
+        EXPECT_EQ(cpu, kCpu);
+        drained.insert(drained.end(), batch, batch + size);
+        drained_capacity += cap;
+      });
+  ASSERT_NE(old_slabs, nullptr);
+  sized_aligned_delete(old_slabs, old_slabs_size,
+                       std::align_val_t{EXEC_PAGESIZE});
+  EXPECT_THAT(drained,
+              UnorderedElementsAre(&objects[0], &objects[1], &objects[2]));
+  EXPECT_EQ(drained_capacity, kCapacity);
+  EXPECT_EQ(slab_.GetShift(), kShift - 1);
+  EXPECT_EQ(slab_.Length(kCpu, kSizeClass), 0);
+  EXPECT_EQ(slab_.Capacity(kCpu, kSizeClass), 0);
+
+  // The cpu works on the new slabs once its slab is cached again.
+  slab_.UncacheCpuSlab();
+  {
+    auto [got_cpu, cached] = slab_.CacheCpuSlab();
+    ASSERT_TRUE(cached);
+    ASSERT_EQ(got_cpu, kCpu);
+  }
+  ASSERT_EQ(slab_.Grow(kCpu, kSizeClass, 2, max_capacity), 2);
+  ASSERT_TRUE(slab_.Push(kSizeClass, &objects[3]));
+  ASSERT_TRUE(slab_.Push(kSizeClass, &objects[4]));
+  EXPECT_EQ(slab_.Length(kCpu, kSizeClass), 2);
+  void* batch[kCapacity];
+  EXPECT_EQ(slab_.PopBatch(kSizeClass, batch, kCapacity), 2);
+  EXPECT_EQ(slab_.Pop(kSizeClass), nullptr);
+}
+
 TEST_F(TcmallocSlabTest, SimulatedMadviseFailure) {
   if (!IsFast()) {
     GTEST_SKIP() << "Need fast percpu. Skipping.";
@@ -900,9 +966,13 @@ void ResizeSlabsThread(Context& ctx, TcmallocSlab::DrainHandler drain_handler,
         --shift;
       }
     }
+    // Switch the cpus all at once or one at a time.
+    const auto resize_slabs = absl::Bernoulli(rnd, 0.5)
+                                  ? &TcmallocSlab::ResizeSlabsIncrementally
+                                  : &TcmallocSlab::ResizeSlabs;
     for (size_t cpu = 0; cpu < num_cpus; ++cpu) ctx.mutexes[cpu].Lock();
     void* slabs = AllocSlabs(allocator, shift);
-    const auto [old_slabs, old_slabs_size] = ctx.slab->ResizeSlabs(
+    const auto [old_slabs, old_slabs_size] = (ctx.slab->*resize_slabs)(
         ToShiftType(shift), slabs, ctx.GetMaxCapacityFunctor(),
         [&](size_t cpu) {
           return ctx.has_init[cpu].load(std::memory_order_relaxed);
@@ -18,11 +18,14 @@
 
 #include <atomic>
 #include <cstring>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "absl/base/attributes.h"
 #include "absl/log/absl_check.h"
 #include "absl/time/time.h"
+#include "tcmalloc/internal/cpu_utils.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/testing/testutil.h"
 
@@ -70,5 +73,42 @@ TEST(PerCpu, SignalHandling) {
   EXPECT_GT(alarms.load(std::memory_order_relaxed), 0);
 }
 
+TEST(PerCpu, VirtualCpuBound) {
+  if (!IsFast()) {
+    GTEST_SKIP() << "per-CPU unavailable";
+  }
+  if (GetRseqVcpuMode() != RseqVcpuMode::kMmCid) {
+    GTEST_SKIP() << "mm_cid unavailable or disabled";
+  }
+
+  // Concurrency ids are dense: a single-threaded test can only run on one of
+  // the first allowed-CPU-count ids, regardless of which physical CPU it is on.
+  CpuSet allowed;
+  ASSERT_TRUE(allowed.GetAffinity(0));
+  EXPECT_TRUE(UsingVirtualCpus());
+  EXPECT_LT(VirtualCpu::Synchronize(), allowed.Count());
+}
+
+TEST(PerCpu, Counter) {
+  // Threads that did not initialize rseq share the first line.
+  static PerCpuCounter counter;
+  constexpr int kThreads = 8;
+  constexpr int kAdds = 100000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([t] {
+      if (t % 2 == 0) IsFast();
+      for (int i = 0; i < kAdds; ++i) {
+        counter.Add(2);
+      }
+      counter.Add(-kAdds);
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(counter.value(), kThreads * kAdds);
+}
+
 }  // namespace
 }  // namespace tcmalloc::tcmalloc_internal::subtle::percpu
@@ -20,13 +20,16 @@
 
 #include "absl/base/casts.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/functional/function_ref.h"
 #include "absl/hash/hash.h"
+#include "absl/numeric/bits.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
 #include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "tcmalloc/internal/pageflags.h"
+#include "tcmalloc/internal_malloc_extension.h"
 #include "tcmalloc/malloc_extension.h"
 
 #if defined(__linux__)
@@ -37,18 +40,25 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <map>
 #include <memory>
 #include <optional>
 #include <string>
 #include <tuple>
 #include <utility>
+#include <vector>
 
 #include "tcmalloc/internal/profile.pb.h"
 #include "absl/base/attributes.h"
 #include "absl/base/macros.h"
+#include "absl/base/thread_annotations.h"
 #include "absl/status/status.h"
 #include "absl/strings/escaping.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream.h"
+#include "google/protobuf/wire_format_lite.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/residency.h"
 
@@ -118,7 +128,8 @@ struct SampleEqWithSubFields {
     auto fields = [](const Profile::Sample& s) {
       return std::tie(s.depth, s.requested_size, s.requested_alignment,
                       s.requested_size_returning, s.allocated_size,
-                      s.access_hint, s.access_allocated, s.guarded_status);
+                      s.access_hint, s.access_allocated, s.guarded_status,
+                      s.allocation_context);
     };
     return fields(a) == fields(b) &&
            std::equal(a.stack, a.stack + a.depth, b.stack, b.stack + b.depth);
@@ -130,7 +141,8 @@ struct SampleHashWithSubFields {
     return absl::HashOf(absl::MakeConstSpan(s.stack, s.depth), s.depth,
                         s.requested_size, s.requested_alignment,
                         s.requested_size_returning, s.allocated_size,
-                        s.access_hint, s.access_allocated, s.guarded_status);
+                        s.access_hint, s.access_allocated, s.guarded_status,
+                        s.allocation_context);
   }
 };
 
@@ -260,8 +272,151 @@ std::string GetBuildId(const dl_phdr_info* const info) {
 
   return result;
 }
+
+uint64_t LoadedObjectsGeneration() {
+  uint64_t generation = 0;
+  dl_iterate_phdr(
+      +[](dl_phdr_info* info, size_t size, void* data) {
+        if (size >=
+            offsetof(dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+          *static_cast<uint64_t*>(data) = info->dlpi_adds + info->dlpi_subs;
+        }
+        // The counts are the same for every object.
+        return 1;
+      },
+      &generation);
+  return generation;
+}
 #endif  // defined(__linux__)
 
+// The PT_LOAD segments of the loaded objects, in the order AddCurrentMappings
+// adds them, and the addresses already looked up in them.
+struct MappingSnapshot {
+  struct Mapping {
+    uintptr_t memory_start;
+    uintptr_t memory_limit;
+    uintptr_t file_offset;
+    std::string filename;
+    std::string build_id;
+  };
+
+  // Bounds the memory of resolved, as profiles see new addresses for as long
+  // as no object is loaded or unloaded.
+  static constexpr size_t kMaxResolved = 1 << 20;
+
+  uint64_t generation = 0;
+  std::vector<Mapping> mappings;
+
+  absl::Mutex mu;
+  // The index in mappings of the mapping containing each address, or -1.
+  absl::flat_hash_map<uintptr_t, int> resolved ABSL_GUARDED_BY(mu);
+};
+
+namespace {
+
+#if defined(__linux__)
+std::shared_ptr<MappingSnapshot> CollectMappings() {
+  auto snapshot = std::make_shared<MappingSnapshot>();
+  auto dl_iterate_callback = +[](dl_phdr_info* info, size_t size, void* data) {
+    auto& snapshot = *static_cast<MappingSnapshot*>(data);
+    // dl_iterate_phdr holds the loader lock throughout, so the counts match
+    // the objects collected.
+    if (size >= offsetof(dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+      snapshot.generation = info->dlpi_adds + info->dlpi_subs;
+    }
+
+    // Skip dummy entry introduced since glibc 2.18.
+    if (info->dlpi_phdr == nullptr && info->dlpi_phnum == 0) {
+      return 0;
+    }
+
+    const bool is_main_executable = snapshot.mappings.empty();
+
+    // Evaluate all the loadable segments.
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+      if (info->dlpi_phdr[i].p_type != PT_LOAD) {
+        continue;
+      }
+      const ElfW(Phdr)* pt_load = &info->dlpi_phdr[i];
+
+      TC_CHECK_NE(pt_load, nullptr);
+
+      // Extract data.
+      const size_t memory_start = info->dlpi_addr + pt_load->p_vaddr;
+      const size_t memory_limit = memory_start + pt_load->p_memsz;
+      const size_t file_offset = pt_load->p_offset;
+
+      // Storage for path to executable as dlpi_name isn't populated for the
+      // main executable.  +1 to allow for the null terminator that readlink
+      // does not add.
+      char self_filename[PATH_MAX + 1];
+      const char* filename = info->dlpi_name;
+      if (filename == nullptr || filename[0] == '\0') {
+        // This is either the main executable or the VDSO.  The main executable
+        // is always the first entry processed by callbacks.
+        if (is_main_executable) {
+          // This is the main executable.
+          ssize_t ret = readlink("/proc/self/exe", self_filename,
+                                 sizeof(self_filename) - 1);
+          if (ret >= 0 && ret < sizeof(self_filename)) {
+            self_filename[ret] = '\0';
+            filename = self_filename;
+          }
+        } else {
+          // This is the VDSO.
+          filename = GetSoName(info);
+        }
+      }
+
+      char resolved_path[PATH_MAX];
+      absl::string_view resolved_filename;
+      if (realpath(filename, resolved_path)) {
+        resolved_filename = resolved_path;
+      } else {
+        resolved_filename = filename;
+      }
+
+      snapshot.mappings.push_back({.memory_start = memory_start,
+                                   .memory_limit = memory_limit,
+                                   .file_offset = file_offset,
+                                   .filename = std::string(resolved_filename),
+                                   .build_id = GetBuildId(info)});
+    }
+    // Keep going.
+    return 0;
+  };
+
+  dl_iterate_phdr(dl_iterate_callback, snapshot.get());
+  return snapshot;
+}
+
+// Returns the mappings of the loaded objects.  Walking them resolves the path
+// and parses the build id of every object, which with hundreds of shared
+// objects is measurable, so they are only walked again once objects are
+// loaded or unloaded.
+std::shared_ptr<MappingSnapshot> CurrentMappings() {
+  ABSL_CONST_INIT static absl::Mutex mu(absl::kConstInit);
+  // Leaked, so that profiles may be built during exit.
+  ABSL_CONST_INIT static std::shared_ptr<MappingSnapshot>*
+      cached ABSL_GUARDED_BY(mu) = nullptr;
+
+  const uint64_t generation = LoadedObjectsGeneration();
+  absl::MutexLock l(&mu);
+  if (cached != nullptr && generation != 0 &&
+      (*cached)->generation == generation) {
+    return *cached;
+  }
+  std::shared_ptr<MappingSnapshot> snapshot = CollectMappings();
+  if (cached == nullptr) {
+    cached = new std::shared_ptr<MappingSnapshot>();
+  }
+  *cached = snapshot;
+  return snapshot;
+}
+#endif  // defined(__linux__)
+
+}  // namespace
+
 ABSL_CONST_INIT const absl::string_view kProfileDropFrames =
     // POSIX entry points.
     "calloc|"
@@ -331,6 +486,8 @@ ABSL_CONST_INIT const absl::string_view kProfileDropFrames =
     "__size_returning_new_hot_cold|"
     "__size_returning_new_aligned|"
     "__size_returning_new_aligned_hot_cold|"
+    "__size_returning_new_lifetime|"
+    "__size_returning_new_aligned_lifetime|"
     "slow_alloc|"
     "fast_alloc|"
     "AllocSmall|"
@@ -377,24 +534,53 @@ int ProfileBuilder::InternLocation(const void* ptr) {
     return index;
   }
 
-  // Find the mapping ID.
+  const int mapping_index = FindMapping(address);
+  if (mapping_index >= 0) {
+    location.set_mapping_id(profile_->mapping(mapping_index).id());
+  }
+
+  return index;
+}
+
+int ProfileBuilder::FindMapping(uintptr_t address) const {
+  // Addresses resolved against the current mappings are shared by the
+  // profiles built until objects are loaded or unloaded, as most frames recur
+  // from one profile to the next.
+  if (snapshot_ == nullptr ||
+      mappings_.size() != snapshot_->mappings.size()) {
+    return LookupMapping(address);
+  }
+  {
+    absl::ReaderMutexLock l(&snapshot_->mu);
+    auto it = snapshot_->resolved.find(address);
+    if (it != snapshot_->resolved.end()) {
+      return it->second;
+    }
+  }
+  const int mapping_index = LookupMapping(address);
+  absl::MutexLock l(&snapshot_->mu);
+  if (snapshot_->resolved.size() < MappingSnapshot::kMaxResolved) {
+    snapshot_->resolved.emplace(address, mapping_index);
+  }
+  return mapping_index;
+}
+
+int ProfileBuilder::LookupMapping(uintptr_t address) const {
   auto it = mappings_.upper_bound(address);
   if (it != mappings_.begin()) {
     --it;
   }
 
-  // If *it contains address, add mapping to location.
+  // If *it contains address, it is the mapping.
   const int mapping_index = it->second;
   const perftools::profiles::Mapping& mapping =
       profile_->mapping(mapping_index);
-  const int mapping_id = mapping.id();
   TC_ASSERT(it->first == mapping.memory_start());
 
   if (it->first <= address && address < mapping.memory_limit()) {
-    location.set_mapping_id(mapping_id);
+    return mapping_index;
   }
-
-  return index;
+  return -1;
 }
 
 void ProfileBuilder::InternCallstack(absl::Span<const void* const> stack,
@@ -412,70 +598,15 @@ void ProfileBuilder::InternCallstack(absl::Span<const void* const> stack,
 
 void ProfileBuilder::AddCurrentMappings() {
 #if defined(__linux__)
-  auto dl_iterate_callback = +[](dl_phdr_info* info, size_t size, void* data) {
-    // Skip dummy entry introduced since glibc 2.18.
-    if (info->dlpi_phdr == nullptr && info->dlpi_phnum == 0) {
-      return 0;
-    }
-
-    ProfileBuilder& builder = *static_cast<ProfileBuilder*>(data);
-    const bool is_main_executable = builder.profile_->mapping_size() == 0;
-
-    // Evaluate all the loadable segments.
-    for (int i = 0; i < info->dlpi_phnum; ++i) {
-      if (info->dlpi_phdr[i].p_type != PT_LOAD) {
-        continue;
-      }
-      const ElfW(Phdr)* pt_load = &info->dlpi_phdr[i];
-
-      TC_CHECK_NE(pt_load, nullptr);
-
-      // Extract data.
-      const size_t memory_start = info->dlpi_addr + pt_load->p_vaddr;
-      const size_t memory_limit = memory_start + pt_load->p_memsz;
-      const size_t file_offset = pt_load->p_offset;
-
-      // Storage for path to executable as dlpi_name isn't populated for the
-      // main executable.  +1 to allow for the null terminator that readlink
-      // does not add.
-      char self_filename[PATH_MAX + 1];
-      const char* filename = info->dlpi_name;
-      if (filename == nullptr || filename[0] == '\0') {
-        // This is either the main executable or the VDSO.  The main executable
-        // is always the first entry processed by callbacks.
-        if (is_main_executable) {
-          // This is the main executable.
-          ssize_t ret = readlink("/proc/self/exe", self_filename,
-                                 sizeof(self_filename) - 1);
-          if (ret >= 0 && ret < sizeof(self_filename)) {
-            self_filename[ret] = '\0';
-            filename = self_filename;
-          }
-        } else {
-          // This is the VDSO.
-          filename = GetSoName(info);
-        }
-      }
-
-      char resolved_path[PATH_MAX];
-      absl::string_view resolved_filename;
-      if (realpath(filename, resolved_path)) {
-        resolved_filename = resolved_path;
-      } else {
-        resolved_filename = filename;
-      }
-
-      const std::string build_id = GetBuildId(info);
-
-      // Add to profile.
-      builder.AddMapping(memory_start, memory_limit, file_offset,
-                         resolved_filename, build_id);
-    }
-    // Keep going.
-    return 0;
-  };
-
-  dl_iterate_phdr(dl_iterate_callback, this);
+  std::shared_ptr<MappingSnapshot> snapshot = CurrentMappings();
+  const bool first = profile_->mapping_size() == 0;
+  for (const MappingSnapshot::Mapping& m : snapshot->mappings) {
+    AddMapping(m.memory_start, m.memory_limit, m.file_offset, m.filename,
+               m.build_id);
+  }
+  if (first) {
+    snapshot_ = std::move(snapshot);
+  }
 #endif  // defined(__linux__)
 }
 
@@ -496,8 +627,12 @@ int ProfileBuilder::AddMapping(uintptr_t memory_start, uintptr_t memory_limit,
   return mapping_id;
 }
 
+// Receives each sample of a profile once it has been converted.
+using SampleSink = absl::FunctionRef<void(perftools::profiles::Sample&)>;
+
 static absl::Status MakeLifetimeProfileProto(const tcmalloc::Profile& profile,
-                                             ProfileBuilder* builder) {
+                                             ProfileBuilder* builder,
+                                             SampleSink add_sample) {
   TC_CHECK_NE(builder, nullptr);
   perftools::profiles::Profile& converted = builder->profile();
   perftools::profiles::ValueType* period_type = converted.mutable_period_type();
@@ -541,7 +676,7 @@ static absl::Status MakeLifetimeProfileProto(const tcmalloc::Profile& profile,
   const int none_id = builder->InternString("none");
 
   profile.Iterate([&](const tcmalloc::Profile::Sample& entry) {
-    perftools::profiles::Sample& sample = *converted.add_sample();
+    perftools::profiles::Sample sample;
 
     TC_CHECK_LE(entry.depth, ABSL_ARRAYSIZE(entry.stack));
     builder->InternCallstack(absl::MakeSpan(entry.stack, entry.depth), sample);
@@ -632,6 +767,7 @@ static absl::Status MakeLifetimeProfileProto(const tcmalloc::Profile& profile,
       sample.add_value(0);
       sample.add_value(0);
     }
+    add_sample(sample);
   });
   return absl::OkStatus();
 }
@@ -640,9 +776,29 @@ std::unique_ptr<perftools::profiles::Profile> ProfileBuilder::Finalize() && {
   return std::move(profile_);
 }
 
-absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
-    const ::tcmalloc::Profile& profile, PageFlagsBase* pageflags,
-    Residency* residency) {
+// Records the active experiments as comments, so that profiles collected
+// across a fleet can be split by experiment arm.
+static void AddExperimentComments(ProfileBuilder& builder) {
+#if ABSL_HAVE_ATTRIBUTE_WEAK
+  if (&MallocExtension_Internal_GetExperiments == nullptr) return;
+  std::map<std::string, MallocExtension::Property> experiments;
+  MallocExtension_Internal_GetExperiments(&experiments);
+  for (const auto& [name, property] : experiments) {
+    if (property.value == 0) continue;
+    builder.profile().add_comment(builder.InternString(name));
+  }
+#else
+  (void)builder;
+#endif
+}
+
+// Converts <profile> into <builder>, handing each sample to <add_sample>
+// rather than adding it to the builder's profile.
+static absl::Status ConvertProfile(const ::tcmalloc::Profile& profile,
+                                   PageFlagsBase* pageflags,
+                                   Residency* residency,
+                                   ProfileBuilder& builder,
+                                   SampleSink add_sample) {
   if (profile.Type() == ProfileType::kDoNotUse) {
 #if defined(ABSL_HAVE_ADDRESS_SANITIZER) || \
     defined(ABSL_HAVE_LEAK_SANITIZER) ||    \
@@ -657,15 +813,11 @@ absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
 #endif
   }
 
-  ProfileBuilder builder;
   builder.AddCurrentMappings();
+  AddExperimentComments(builder);
 
   if (profile.Type() == ProfileType::kLifetimes) {
-    absl::Status error = MakeLifetimeProfileProto(profile, &builder);
-    if (!error.ok()) {
-      return error;
-    }
-    return std::move(builder).Finalize();
+    return MakeLifetimeProfileProto(profile, &builder, add_sample);
   }
 
   const int alignment_id = builder.InternString("alignment");
@@ -673,6 +825,7 @@ absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
   const int count_id = builder.InternString("count");
   const int objects_id = builder.InternString("objects");
   const int request_id = builder.InternString("request");
+  const int request_bin_id = builder.InternString("request_bin");
   const int size_returning_id = builder.InternString("size_returning");
   const int stale_scan_period_id = builder.InternString("stale_scan_period");
   const int seconds_id = builder.InternString("seconds");
@@ -681,10 +834,13 @@ absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
   const int swapped_space_id = builder.InternString("swapped_space");
   const int stale_space_id = builder.InternString("stale_space");
   const int locked_space_id = builder.InternString("locked_space");
+  const int internal_fragmentation_space_id =
+      builder.InternString("internal_fragmentation_space");
   const int access_hint_id = builder.InternString("access_hint");
   const int access_allocated_id = builder.InternString("access_allocated");
   const int cold_id = builder.InternString("cold");
   const int hot_id = builder.InternString("hot");
+  const int allocation_context_id = builder.InternString("allocation_context");
 
   perftools::profiles::Profile& converted = builder.profile();
 
@@ -727,11 +883,26 @@ absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
     sample_type->set_unit(bytes_id);
   }
 
+  // Allocation profiles, which guide the choice of size classes, also bin the
+  // requested sizes of each stack and total the bytes its objects leave unused
+  // at the end of their size class.
+  const bool exporting_sizes =
+      (profile.Type() == tcmalloc::ProfileType::kAllocations);
+  if (exporting_sizes) {
+    perftools::profiles::ValueType& sample_type = *converted.add_sample_type();
+    sample_type.set_type(internal_fragmentation_space_id);
+    sample_type.set_unit(bytes_id);
+  }
+
   int default_sample_type_id;
   switch (profile.Type()) {
     case tcmalloc::ProfileType::kFragmentation:
+    case tcmalloc::ProfileType::kPinnedMemory:
     case tcmalloc::ProfileType::kHeap:
     case tcmalloc::ProfileType::kPeakHeap:
+    case tcmalloc::ProfileType::kPeakHeapLastMinute:
+    case tcmalloc::ProfileType::kPeakHeapLastHour:
+    case tcmalloc::ProfileType::kLeakCandidates:
       default_sample_type_id = space_id;
       break;
     case tcmalloc::ProfileType::kAllocations:
@@ -746,8 +917,7 @@ absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
   SampleMergedMap samples = MergeProfileSamplesAndMaybeGetResidencyInfo(
       profile, pageflags, residency);
   for (const auto& [entry, data] : samples) {
-    perftools::profiles::Profile& profile = builder.profile();
-    perftools::profiles::Sample& sample = *profile.add_sample();
+    perftools::profiles::Sample sample;
 
     TC_CHECK_LE(entry.depth, ABSL_ARRAYSIZE(entry.stack));
     builder.InternCallstack(absl::MakeSpan(entry.stack, entry.depth), sample);
@@ -760,6 +930,17 @@ absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
       sample.add_value(data.stale_size.value_or(0));
       sample.add_value(data.locked_size.value_or(0));
     }
+    if (exporting_sizes) {
+      // Size returning allocations leave nothing unused: the caller gets all
+      // of the object.
+      const bool unused_tail = !entry.requested_size_returning &&
+                               entry.allocated_size > entry.requested_size;
+      sample.add_value(
+          unused_tail
+              ? data.count * static_cast<int64_t>(entry.allocated_size -
+                                                  entry.requested_size)
+              : 0);
+    }
 
     // add fields that are common to all memory profiles
     auto add_label = [&](int key, int unit, size_t value) {
@@ -776,10 +957,17 @@ absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
 
     add_positive_label(bytes_id, bytes_id, entry.allocated_size);
     add_positive_label(request_id, bytes_id, entry.requested_size);
+    if (exporting_sizes) {
+      // Powers of two, so that pprof -tags shows a histogram of the requested
+      // sizes of each stack; the bytes label already bins by size class.
+      add_positive_label(request_bin_id, bytes_id,
+                         absl::bit_ceil(entry.requested_size));
+    }
     add_positive_label(alignment_id, bytes_id, entry.requested_alignment);
     add_positive_label(size_returning_id, 0, entry.requested_size_returning);
     add_positive_label(stale_scan_period_id, seconds_id,
                        data.stale_scan_period.value_or(0));
+    add_positive_label(allocation_context_id, 0, entry.allocation_context);
 
     auto add_access_label = [&](int key,
                                 tcmalloc::Profile::Sample::Access access) {
@@ -860,11 +1048,56 @@ absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
         guarded_status_label.set_str(guarded_id);
         break;
     }
+    add_sample(sample);
   }
 
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
+    const ::tcmalloc::Profile& profile, PageFlagsBase* pageflags,
+    Residency* residency) {
+  ProfileBuilder builder;
+  absl::Status status =
+      ConvertProfile(profile, pageflags, residency, builder,
+                     [&](perftools::profiles::Sample& sample) {
+                       builder.profile().add_sample()->Swap(&sample);
+                     });
+  if (!status.ok()) {
+    return status;
+  }
   return std::move(builder).Finalize();
 }
 
+absl::Status WriteProfileProto(
+    const ::tcmalloc::Profile& profile, PageFlagsBase* pageflags,
+    Residency* residency, google::protobuf::io::ZeroCopyOutputStream* output) {
+  using google::protobuf::internal::WireFormatLite;
+
+  ProfileBuilder builder;
+  google::protobuf::io::CodedOutputStream coded(output);
+  // The fields of a message may be written in any order, and repeated ones
+  // are concatenated, so each sample is written as a Profile.sample field as
+  // soon as it is converted and the rest of the profile once all are.
+  absl::Status status = ConvertProfile(
+      profile, pageflags, residency, builder,
+      [&](perftools::profiles::Sample& sample) {
+        coded.WriteTag(WireFormatLite::MakeTag(
+            perftools::profiles::Profile::kSampleFieldNumber,
+            WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+        coded.WriteVarint32(static_cast<uint32_t>(sample.ByteSizeLong()));
+        sample.SerializeWithCachedSizes(&coded);
+      });
+  if (!status.ok()) {
+    return status;
+  }
+  if (!std::move(builder).Finalize()->SerializeToCodedStream(&coded) ||
+      coded.HadError()) {
+    return absl::InternalError("Failed to write the profile");
+  }
+  return absl::OkStatus();
+}
+
 absl::Status ProfileBuilder::SetDocURL(absl::string_view url) {
   if (!url.empty() && !absl::StartsWith(url, "http://") &&
       !absl::StartsWith(url, "https://")) {
@@ -892,5 +1125,22 @@ absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
   return MakeProfileProto(profile, p, r);
 }
 
+absl::Status WriteProfileProto(
+    const ::tcmalloc::Profile& profile,
+    google::protobuf::io::ZeroCopyOutputStream* output) {
+  std::optional<PageFlags> pageflags;
+  std::optional<Residency> residency;
+
+  PageFlags* p = nullptr;
+  Residency* r = nullptr;
+
+  if (profile.Type() == ProfileType::kHeap) {
+    p = &pageflags.emplace();
+    r = &residency.emplace();
+  }
+
+  return WriteProfileProto(profile, p, r, output);
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
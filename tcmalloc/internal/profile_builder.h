@@ -31,6 +31,7 @@
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
+#include "google/protobuf/io/zero_copy_stream.h"
 #include "tcmalloc/malloc_extension.h"
 
 namespace tcmalloc {
@@ -38,8 +39,16 @@ namespace tcmalloc_internal {
 
 #if defined(__linux__)
 std::string GetBuildId(const dl_phdr_info* const info);
+
+// Returns the number of objects the dynamic linker has loaded and unloaded,
+// which changes with every dlopen or dlclose that maps or unmaps an object, or
+// 0 if the linker does not count them.
+uint64_t LoadedObjectsGeneration();
 #endif  // defined(__linux__)
 
+// The mappings of the loaded objects, see AddCurrentMappings.
+struct MappingSnapshot;
+
 // ProfileBuilder manages building up a profile.proto instance and populating
 // common parts using the string/pointer table conventions expected by pprof.
 class ProfileBuilder {
@@ -48,7 +57,9 @@ class ProfileBuilder {
 
   perftools::profiles::Profile& profile() { return *profile_; }
 
-  // Adds the current process mappings to the profile.
+  // Adds the current process mappings to the profile.  They are collected
+  // once for each LoadedObjectsGeneration and shared by the profiles built
+  // until objects are loaded or unloaded.
   void AddCurrentMappings();
 
   // Adds a single mapping to the profile and to lookup cache and returns the
@@ -73,7 +84,14 @@ class ProfileBuilder {
   std::unique_ptr<perftools::profiles::Profile> Finalize() &&;
 
  private:
+  // Returns the index in profile_->mapping() of the mapping containing
+  // <address>, or -1 if none does.
+  int FindMapping(uintptr_t address) const;
+  int LookupMapping(uintptr_t address) const;
+
   std::unique_ptr<perftools::profiles::Profile> profile_;
+  // The mappings added by AddCurrentMappings, if it added them first.
+  std::shared_ptr<MappingSnapshot> snapshot_;
   // mappings_ stores the start address of each mapping in profile_->mapping()
   // to its index.
   absl::btree_map<uintptr_t, int> mappings_;
@@ -86,6 +104,14 @@ extern const absl::string_view kProfileDropFrames;
 absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
     const ::tcmalloc::Profile& profile);
 
+// Writes <profile> to <output> in the profile.proto encoding, as
+// MakeProfileProto(profile)->SerializeToZeroCopyStream(output) would, but
+// without holding all of its samples in memory: each is written as soon as it
+// is converted.
+absl::Status WriteProfileProto(
+    const ::tcmalloc::Profile& profile,
+    google::protobuf::io::ZeroCopyOutputStream* output);
+
 class PageFlagsBase;
 class PageFlags;
 class Residency;
@@ -94,6 +120,9 @@ class Residency;
 absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
     const ::tcmalloc::Profile& profile, PageFlagsBase* pageflags,
     Residency* residency);
+absl::Status WriteProfileProto(
+    const ::tcmalloc::Profile& profile, PageFlagsBase* pageflags,
+    Residency* residency, google::protobuf::io::ZeroCopyOutputStream* output);
 
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
@@ -44,6 +44,7 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/time/time.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
 #include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/fake_profile.h"
 #include "tcmalloc/internal/page_size.h"
@@ -57,6 +58,7 @@ namespace tcmalloc_internal {
 namespace {
 
 using ::testing::AnyOf;
+using ::testing::Contains;
 using ::testing::Each;
 using ::testing::IsSupersetOf;
 using ::testing::Key;
@@ -136,6 +138,43 @@ TEST(ProfileBuilderTest, Mappings) {
   EXPECT_THAT(mapping_ids, Not(testing::Contains(0)));
 }
 
+TEST(ProfileBuilderTest, CachedMappings) {
+  const uint64_t generation = LoadedObjectsGeneration();
+  EXPECT_NE(generation, 0);
+  EXPECT_EQ(LoadedObjectsGeneration(), generation);
+
+  // Until objects are loaded or unloaded, profiles get the same mappings, and
+  // resolve the same addresses to the same mapping.
+  const void* const address = absl::bit_cast<const void*>(&RealPath);
+  std::vector<std::unique_ptr<perftools::profiles::Profile>> profiles;
+  for (int i = 0; i < 2; ++i) {
+    ProfileBuilder builder;
+    builder.AddCurrentMappings();
+    builder.InternLocation(address);
+    profiles.push_back(std::move(builder).Finalize());
+  }
+  ASSERT_EQ(LoadedObjectsGeneration(), generation);
+
+  ASSERT_EQ(profiles[0]->mapping_size(), profiles[1]->mapping_size());
+  for (int i = 0; i < profiles[0]->mapping_size(); ++i) {
+    const auto& a = profiles[0]->mapping(i);
+    const auto& b = profiles[1]->mapping(i);
+    EXPECT_EQ(a.memory_start(), b.memory_start());
+    EXPECT_EQ(a.memory_limit(), b.memory_limit());
+    EXPECT_EQ(profiles[0]->string_table(a.filename()),
+              profiles[1]->string_table(b.filename()));
+    EXPECT_EQ(profiles[0]->string_table(a.build_id()),
+              profiles[1]->string_table(b.build_id()));
+  }
+  for (const auto& profile : profiles) {
+    ASSERT_EQ(profile->location_size(), 1);
+    const int mapping_id = profile->location(0).mapping_id();
+    ASSERT_NE(mapping_id, 0);
+    const auto& mapping = profile->mapping(mapping_id - 1);
+    EXPECT_EQ(profile->string_table(mapping.filename()), RealPath());
+  }
+}
+
 TEST(ProfileBuilderTest, LocationTableNoMappings) {
   const uintptr_t kAddress = uintptr_t{0x150};
 
@@ -768,6 +807,102 @@ TEST(ProfileBuilderTest, PeakHeapProfile) {
             converted.sample(1).location_id(0));
 }
 
+// Samples that differ only in their allocation context are kept apart, and
+// the context is exported as a label.
+TEST(ProfileBuilderTest, AllocationContext) {
+  std::vector<Profile::Sample> samples;
+  for (uint64_t context : {uint64_t{0}, uint64_t{7}, uint64_t{7}}) {
+    auto& sample = samples.emplace_back();
+    sample.sum = 16;
+    sample.count = 1;
+    sample.requested_size = 16;
+    sample.allocated_size = 16;
+    sample.depth = 2;
+    sample.stack[0] = absl::bit_cast<void*>(uintptr_t{0x12345});
+    sample.stack[1] = reinterpret_cast<void*>(&RealPath);
+    sample.access_allocated = Profile::Sample::Access::Hot;
+    sample.allocation_context = context;
+  }
+  auto fake_profile = std::make_unique<FakeProfile>();
+  fake_profile->SetType(ProfileType::kAllocations);
+  fake_profile->SetDuration(absl::Seconds(1));
+  fake_profile->SetSamples(std::move(samples));
+  Profile profile = ProfileAccessor::MakeProfile(std::move(fake_profile));
+  auto converted_or = MakeProfileProto(profile);
+  ASSERT_TRUE(converted_or.ok());
+  const auto& converted = **converted_or;
+
+  SampleLabels extracted;
+  ASSERT_NO_FATAL_FAILURE(CheckAndExtractSampleLabels(converted, extracted));
+  EXPECT_THAT(extracted,
+              UnorderedElementsAre(Not(Contains(Key("allocation_context"))),
+                                   Contains(Pair("allocation_context", 7))));
+
+  ASSERT_EQ(converted.sample_size(), 2);
+  for (const auto& sample : converted.sample()) {
+    bool has_context = false;
+    for (const auto& label : sample.label()) {
+      has_context |=
+          converted.string_table(label.key()) == "allocation_context";
+    }
+    EXPECT_EQ(sample.value(0), has_context ? 2 : 1);
+  }
+}
+
+// Allocation profiles bin requested sizes and report the unused tails of
+// objects as internal fragmentation.
+TEST(ProfileBuilderTest, AllocationSizes) {
+  std::vector<Profile::Sample> samples;
+  for (bool size_returning : {false, true}) {
+    auto& sample = samples.emplace_back();
+    sample.sum = 48;
+    sample.count = 3;
+    sample.requested_size = 10;
+    sample.requested_size_returning = size_returning;
+    sample.allocated_size = 16;
+    sample.depth = 2;
+    sample.stack[0] = absl::bit_cast<void*>(uintptr_t{0x12345});
+    sample.stack[1] = reinterpret_cast<void*>(&RealPath);
+    sample.access_allocated = Profile::Sample::Access::Hot;
+  }
+  auto fake_profile = std::make_unique<FakeProfile>();
+  fake_profile->SetType(ProfileType::kAllocations);
+  fake_profile->SetDuration(absl::Seconds(1));
+  fake_profile->SetSamples(std::move(samples));
+  Profile profile = ProfileAccessor::MakeProfile(std::move(fake_profile));
+  auto converted_or = MakeProfileProto(profile);
+  ASSERT_TRUE(converted_or.ok());
+  const auto& converted = **converted_or;
+
+  int fragmentation_index = -1;
+  for (int i = 0; i < converted.sample_type_size(); ++i) {
+    if (converted.string_table(converted.sample_type(i).type()) ==
+        "internal_fragmentation_space") {
+      fragmentation_index = i;
+    }
+  }
+  ASSERT_NE(fragmentation_index, -1);
+
+  SampleLabels extracted;
+  ASSERT_NO_FATAL_FAILURE(CheckAndExtractSampleLabels(converted, extracted));
+  EXPECT_THAT(extracted, Each(Contains(Pair("request_bin", 16))));
+
+  ASSERT_EQ(converted.sample_size(), 2);
+  std::vector<int64_t> fragmentation;
+  for (const auto& sample : converted.sample()) {
+    fragmentation.push_back(sample.value(fragmentation_index));
+  }
+  // Size returning allocations use their whole object.
+  EXPECT_THAT(fragmentation, UnorderedElementsAre(3 * 6, 0));
+
+  // Other profiles are unchanged.
+  const auto& heap = MakeTestProfile(absl::Seconds(1), ProfileType::kHeap);
+  for (const auto& sample_type : heap.sample_type()) {
+    EXPECT_NE(heap.string_table(sample_type.type()),
+              "internal_fragmentation_space");
+  }
+}
+
 TEST(ProfileBuilderTest, LifetimeProfile) {
   constexpr absl::Duration kDuration = absl::Milliseconds(1500);
   auto fake_profile = std::make_unique<FakeProfile>();
@@ -927,6 +1062,53 @@ TEST(ProfileBuilderTest, LifetimeProfile) {
   EXPECT_EQ(converted.period(), 0);
 }
 
+TEST(ProfileBuilderTest, WriteProfileProto) {
+  for (ProfileType type : {ProfileType::kHeap, ProfileType::kAllocations,
+                           ProfileType::kLifetimes}) {
+    SCOPED_TRACE(static_cast<int>(type));
+
+    std::vector<Profile::Sample> samples;
+    for (int i = 1; i <= 3; ++i) {
+      auto& sample = samples.emplace_back();
+      sample.sum = 16 * i;
+      sample.count = (type == ProfileType::kLifetimes && i == 2) ? -i : i;
+      sample.requested_size = 16;
+      sample.allocated_size = 16;
+      sample.depth = 2;
+      sample.stack[0] = absl::bit_cast<void*>(uintptr_t{0x12345} * i);
+      sample.stack[1] = reinterpret_cast<void*>(&RealPath);
+    }
+    auto fake_profile = std::make_unique<FakeProfile>();
+    fake_profile->SetType(type);
+    fake_profile->SetDuration(absl::Seconds(1));
+    fake_profile->SetSamples(std::move(samples));
+    Profile profile = ProfileAccessor::MakeProfile(std::move(fake_profile));
+
+    auto converted_or = MakeProfileProto(profile, nullptr, nullptr);
+    ASSERT_TRUE(converted_or.ok()) << converted_or.status();
+
+    std::string written;
+    {
+      google::protobuf::io::StringOutputStream stream(&written);
+      ASSERT_TRUE(WriteProfileProto(profile, nullptr, nullptr, &stream).ok());
+    }
+    perftools::profiles::Profile parsed;
+    ASSERT_TRUE(parsed.ParseFromString(written));
+
+    // The samples come first in the written encoding, but parse into the same
+    // profile.
+    EXPECT_EQ(parsed.sample_size(), 3);
+    EXPECT_EQ(parsed.SerializeAsString(), (*converted_or)->SerializeAsString());
+  }
+}
+
+TEST(ProfileBuilderTest, WriteProfileProtoError) {
+  Profile profile;
+  std::string written;
+  google::protobuf::io::StringOutputStream stream(&written);
+  EXPECT_FALSE(WriteProfileProto(profile, nullptr, nullptr, &stream).ok());
+}
+
 TEST(BuildId, CorruptImage_b180635896) {
   std::string image_path;
   const char* srcdir = thread_safe_getenv("TEST_SRCDIR");
@@ -61,6 +61,12 @@ class Bitmap {
   // put it in *index, *length and return true; else return false.
   bool NextFreeRange(size_t start, size_t* index, size_t* length) const;
 
+  // Calls f(index, length) for every maximal free range, in increasing order
+  // of index.  Equivalent to iterating with NextFreeRange, but makes a single
+  // pass over the words, consuming fully free and fully used words at once.
+  template <typename F>
+  void ForEachFreeRange(F f) const;
+
   // Returns index of the first {true, false} bit >= index, or N if none.
   size_t FindSet(size_t index) const;
   size_t FindClear(size_t index) const;
@@ -91,6 +97,64 @@ class Bitmap {
   ssize_t FindValueBackwards(size_t index) const;
 };
 
+// A bitmap of N bits with a summary bitmap of its nonzero words, so that
+// FindSet takes two bit scans rather than a scan over all the words in between.
+// Only supports the operations of sparse "which lists are nonempty" sets.
+template <size_t N>
+class SummarizedBitmap {
+ public:
+  constexpr SummarizedBitmap() : bits_{} {}
+
+  size_t size() const { return N; }
+
+  bool GetBit(size_t i) const {
+    TC_ASSERT_LT(i, N);
+    return bits_[i / kWordSize] & (size_t{1} << (i % kWordSize));
+  }
+
+  void SetBit(size_t i) {
+    TC_ASSERT_LT(i, N);
+    const size_t word = i / kWordSize;
+    ASSUME(word < kWords);
+    if (bits_[word] == 0) summary_.SetBit(word);
+    bits_[word] |= size_t{1} << (i % kWordSize);
+  }
+
+  void ClearBit(size_t i) {
+    TC_ASSERT_LT(i, N);
+    const size_t word = i / kWordSize;
+    ASSUME(word < kWords);
+    bits_[word] &= ~(size_t{1} << (i % kWordSize));
+    if (bits_[word] == 0) summary_.ClearBit(word);
+  }
+
+  bool IsZero() const { return summary_.IsZero(); }
+
+  // Returns index of the first set bit >= index, or N if none.
+  size_t FindSet(size_t index) const {
+    TC_ASSERT_LT(index, N);
+    size_t word = index / kWordSize;
+    ASSUME(word < kWords);
+    size_t here = bits_[word] & (~size_t{0} << (index % kWordSize));
+    if (here == 0) {
+      if (word + 1 >= kWords) return N;
+      word = summary_.FindSet(word + 1);
+      if (word == kWords) return N;
+      here = bits_[word];
+    }
+    ASSUME(here != 0);
+    return word * kWordSize + absl::countr_zero(here);
+  }
+
+ private:
+  static constexpr size_t kWordSize = sizeof(size_t) * 8;
+  static constexpr size_t kWords = (N + kWordSize - 1) / kWordSize;
+
+  size_t bits_[kWords];
+  // Bit i is set iff bits_[i] is nonzero.
+  Bitmap<kWords> summary_;
+};
+
 // Tracks allocations in a range of items of fixed size.  Supports
 // finding an unset range of a given length, while keeping track of
 // the largest remaining unmarked length.
@@ -200,10 +264,7 @@ inline size_t RangeTracker<N>::FindAndMark(size_t n) {
   // TODO(b/134691947): shortest? lowest-addressed?
   size_t best_index = N;
   size_t best_len = 2 * N;
-  // Iterate over free ranges:
-  size_t index = 0, len;
-
-  while (bits_.NextFreeRange(index, &index, &len)) {
+  bits_.ForEachFreeRange([&](size_t index, size_t len) {
     if (len > longest_len) {
       second_len = longest_len;
       longest_len = len;
@@ -215,9 +276,7 @@ inline size_t RangeTracker<N>::FindAndMark(size_t n) {
       best_index = index;
       best_len = len;
     }
-
-    index += len;
-  }
+  });
 
   TC_CHECK_LT(best_index, N);
   bits_.SetRange(best_index, n);
@@ -243,17 +302,14 @@ inline void RangeTracker<N>::Mark(size_t index, size_t n) {
   nallocs_++;
 
   size_t longest_len = 0;
-  size_t scan_index = 0, scan_len;
 
   // We just marked a range as used. This might change the longest free range
   // recorded in longest_free_. Recompute.
-  while (bits_.NextFreeRange(scan_index, &scan_index, &scan_len)) {
-    if (scan_len > longest_len) {
-      longest_len = scan_len;
+  bits_.ForEachFreeRange([&](size_t, size_t len) {
+    if (len > longest_len) {
+      longest_len = len;
     }
-
-    scan_index += scan_len;
-  }
+  });
 
   longest_free_ = longest_len;
 }
@@ -437,6 +493,59 @@ inline bool Bitmap<N>::NextFreeRange(size_t start, size_t* index,
   return true;
 }
 
+template <size_t N>
+template <typename F>
+inline void Bitmap<N>::ForEachFreeRange(F f) const {
+  const size_t all_ones = ~static_cast<size_t>(0);
+  // The free range extending to the end of the words scanned so far, if any.
+  size_t run_start = 0;
+  size_t run_len = 0;
+  for (size_t word = 0; word < kWords; ++word) {
+    size_t free = ~bits_[word];
+    if (kDeadBits > 0 && word == kWords - 1) {
+      // Dead bits are never set; treat them as used so no range covers them.
+      free &= all_ones >> kDeadBits;
+    }
+    const size_t base = word * kWordSize;
+    if (free == all_ones) {
+      if (run_len == 0) run_start = base;
+      run_len += kWordSize;
+      continue;
+    }
+    if (free == 0) {
+      if (run_len > 0) {
+        f(run_start, run_len);
+        run_len = 0;
+      }
+      continue;
+    }
+
+    size_t offset = 0;
+    while (offset < kWordSize) {
+      const size_t here = free >> offset;
+      const size_t used =
+          here == 0 ? kWordSize - offset : absl::countr_zero(here);
+      if (used > 0) {
+        if (run_len > 0) {
+          f(run_start, run_len);
+          run_len = 0;
+        }
+        offset += used;
+        if (offset == kWordSize) break;
+      }
+      // Bits shifted in from the top are zero, so this stops at the end of
+      // the word.
+      const size_t clear = absl::countr_one(free >> offset);
+      if (run_len == 0) run_start = base + offset;
+      run_len += clear;
+      offset += clear;
+    }
+  }
+  if (run_len > 0) {
+    f(run_start, run_len);
+  }
+}
+
 template <size_t N>
 inline size_t Bitmap<N>::FindSet(size_t index) const {
   return FindValue<true>(index);
@@ -292,39 +292,55 @@ BENCHMARK_TEMPLATE(BM_FindRandom, 256 * 32, false, Backward);
 BENCHMARK_TEMPLATE(BM_FindRandom, 256 * 32, true, Forward);
 BENCHMARK_TEMPLATE(BM_FindRandom, 256 * 32, true, Backward);
 
-template <size_t N>
+enum ScanMethod {
+  NextFreeRange,
+  ForEachFreeRange,
+};
+
+template <size_t N, ScanMethod Method>
 ABSL_ATTRIBUTE_NOINLINE size_t DoScanBenchmark(Bitmap<N>* set,
                                                benchmark::State& state) {
   size_t total = 0;
   for (auto s : state) {
-    size_t index = 0, len;
-    while (set->NextFreeRange(index, &index, &len)) {
-      benchmark::DoNotOptimize(index);
-      benchmark::DoNotOptimize(len);
-      index += len;
-      total++;
+    if (Method == NextFreeRange) {
+      size_t index = 0, len;
+      while (set->NextFreeRange(index, &index, &len)) {
+        benchmark::DoNotOptimize(index);
+        benchmark::DoNotOptimize(len);
+        index += len;
+        total++;
+      }
+    } else {
+      set->ForEachFreeRange([&](size_t index, size_t len) {
+        benchmark::DoNotOptimize(index);
+        benchmark::DoNotOptimize(len);
+        total++;
+      });
     }
   }
 
   return total;
 }
 
-template <size_t N>
+template <size_t N, ScanMethod Method>
 static void BM_ScanEmpty(benchmark::State& state) {
   Bitmap<N> set;
   volatile size_t to_set = 0;
   volatile size_t to_clear = 0;
   set.SetBit(to_set);
   set.ClearBit(to_clear);
-  size_t total = DoScanBenchmark<N>(&set, state);
+  size_t total = DoScanBenchmark<N, Method>(&set, state);
   state.SetItemsProcessed(total);
 }
 
-BENCHMARK_TEMPLATE(BM_ScanEmpty, 64);
-BENCHMARK_TEMPLATE(BM_ScanEmpty, 256);
-BENCHMARK_TEMPLATE(BM_ScanEmpty, 256 * 32);
+BENCHMARK_TEMPLATE(BM_ScanEmpty, 64, NextFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanEmpty, 64, ForEachFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanEmpty, 256, NextFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanEmpty, 256, ForEachFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanEmpty, 256 * 32, NextFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanEmpty, 256 * 32, ForEachFreeRange);
 
-template <size_t N>
+template <size_t N, ScanMethod Method>
 static void BM_ScanFull(benchmark::State& state) {
   Bitmap<N> set;
   volatile size_t to_set = 0;
@@ -333,15 +349,18 @@ static void BM_ScanFull(benchmark::State& state) {
   set.ClearBit(to_clear);
   set.SetRange(0, N);
 
-  size_t total = DoScanBenchmark<N>(&set, state);
+  size_t total = DoScanBenchmark<N, Method>(&set, state);
   state.SetItemsProcessed(total);
 }
 
-BENCHMARK_TEMPLATE(BM_ScanFull, 64);
-BENCHMARK_TEMPLATE(BM_ScanFull, 256);
-BENCHMARK_TEMPLATE(BM_ScanFull, 256 * 32);
+BENCHMARK_TEMPLATE(BM_ScanFull, 64, NextFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanFull, 64, ForEachFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanFull, 256, NextFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanFull, 256, ForEachFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanFull, 256 * 32, NextFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanFull, 256 * 32, ForEachFreeRange);
 
-template <size_t N>
+template <size_t N, ScanMethod Method>
 static void BM_ScanRandom(benchmark::State& state) {
   Bitmap<N> set;
   volatile size_t to_set = 0;
@@ -352,15 +371,18 @@ static void BM_ScanRandom(benchmark::State& state) {
   for (int i = 0; i < N; ++i) {
     if (absl::Bernoulli(rng, 1.0 / 2)) set.SetBit(i);
   }
-  size_t total = DoScanBenchmark<N>(&set, state);
+  size_t total = DoScanBenchmark<N, Method>(&set, state);
   state.SetItemsProcessed(total);
 }
 
-BENCHMARK_TEMPLATE(BM_ScanRandom, 64);
-BENCHMARK_TEMPLATE(BM_ScanRandom, 256);
-BENCHMARK_TEMPLATE(BM_ScanRandom, 256 * 32);
+BENCHMARK_TEMPLATE(BM_ScanRandom, 64, NextFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanRandom, 64, ForEachFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanRandom, 256, NextFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanRandom, 256, ForEachFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanRandom, 256 * 32, NextFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanRandom, 256 * 32, ForEachFreeRange);
 
-template <size_t N>
+template <size_t N, ScanMethod Method>
 static void BM_ScanChunks(benchmark::State& state) {
   Bitmap<N> set;
   volatile size_t to_set = 0;
@@ -381,13 +403,56 @@ static void BM_ScanChunks(benchmark::State& state) {
     }
     index = limit;
   }
-  size_t total = DoScanBenchmark<N>(&set, state);
+  size_t total = DoScanBenchmark<N, Method>(&set, state);
   state.SetItemsProcessed(total);
 }
 
-BENCHMARK_TEMPLATE(BM_ScanChunks, 64);
-BENCHMARK_TEMPLATE(BM_ScanChunks, 256);
-BENCHMARK_TEMPLATE(BM_ScanChunks, 256 * 32);
+BENCHMARK_TEMPLATE(BM_ScanChunks, 64, NextFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanChunks, 64, ForEachFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanChunks, 256, NextFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanChunks, 256, ForEachFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanChunks, 256 * 32, NextFreeRange);
+BENCHMARK_TEMPLATE(BM_ScanChunks, 256 * 32, ForEachFreeRange);
+
+// Searches a sparse bitmap from random indices, as HintedTrackerLists does to
+// find the first non-empty list that fits a request.
+template <typename Map, size_t N>
+static void BM_FindSetSparse(benchmark::State& state) {
+  Map map;
+  absl::BitGen rng;
+  const size_t num_set = state.range(0);
+  for (size_t i = 0; i < num_set; ++i) {
+    map.SetBit(absl::Uniform<size_t>(rng, 0, N));
+  }
+  std::vector<size_t> starts(1024);
+  for (size_t& start : starts) {
+    start = absl::Uniform<size_t>(rng, 0, N);
+  }
+
+  size_t i = 0;
+  for (auto s : state) {
+    benchmark::DoNotOptimize(map.FindSet(starts[i++ % starts.size()]));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_FindSetSparse, Bitmap<256 * 8>, 256 * 8)
+    ->Arg(1)
+    ->Arg(8)
+    ->Arg(64);
+BENCHMARK_TEMPLATE(BM_FindSetSparse, SummarizedBitmap<256 * 8>, 256 * 8)
+    ->Arg(1)
+    ->Arg(8)
+    ->Arg(64);
+BENCHMARK_TEMPLATE(BM_FindSetSparse, Bitmap<256 * 64>, 256 * 64)
+    ->Arg(1)
+    ->Arg(8)
+    ->Arg(64);
+BENCHMARK_TEMPLATE(BM_FindSetSparse, SummarizedBitmap<256 * 64>, 256 * 64)
+    ->Arg(1)
+    ->Arg(8)
+    ->Arg(64);
 
 }  // namespace
 }  // namespace tcmalloc_internal
@@ -250,6 +250,90 @@ TEST_F(BitmapTest, CountBitsFuzz) {
   }
 }
 
+template <size_t N>
+void CheckForEachFreeRange(absl::BitGen& rng, double p) {
+  Bitmap<N> map;
+  for (size_t i = 0; i < N; ++i) {
+    if (absl::Bernoulli(rng, p)) {
+      map.SetBit(i);
+    }
+  }
+
+  std::vector<std::pair<size_t, size_t>> expected, actual;
+  size_t index = 0, len;
+  while (map.NextFreeRange(index, &index, &len)) {
+    expected.push_back({index, len});
+    index += len;
+  }
+  map.ForEachFreeRange(
+      [&](size_t index, size_t len) { actual.push_back({index, len}); });
+  EXPECT_EQ(expected, actual) << N << " " << p;
+}
+
+TEST_F(BitmapTest, ForEachFreeRange) {
+  absl::BitGen rng;
+  for (double p : {0.0, 0.01, 0.3, 0.5, 0.9, 1.0}) {
+    for (int i = 0; i < 100; ++i) {
+      CheckForEachFreeRange<1>(rng, p);
+      CheckForEachFreeRange<64>(rng, p);
+      CheckForEachFreeRange<253>(rng, p);
+      CheckForEachFreeRange<256>(rng, p);
+      CheckForEachFreeRange<512>(rng, p);
+    }
+  }
+}
+
+// Sets and clears random bits in a SummarizedBitmap and a Bitmap, and checks
+// that they agree.
+template <size_t N>
+void CheckSummarizedBitmap(absl::BitGen& rng) {
+  SummarizedBitmap<N> summarized;
+  Bitmap<N> plain;
+  for (int op = 0; op < 1000; ++op) {
+    const size_t i = absl::Uniform<size_t>(rng, 0, N);
+    if (absl::Bernoulli(rng, 0.5)) {
+      summarized.SetBit(i);
+      plain.SetBit(i);
+    } else {
+      summarized.ClearBit(i);
+      plain.ClearBit(i);
+    }
+    ASSERT_EQ(summarized.IsZero(), plain.IsZero());
+    const size_t j = absl::Uniform<size_t>(rng, 0, N);
+    ASSERT_EQ(summarized.GetBit(j), plain.GetBit(j)) << j;
+    ASSERT_EQ(summarized.FindSet(j), plain.FindSet(j)) << j;
+  }
+}
+
+TEST(SummarizedBitmapTest, MatchesBitmap) {
+  absl::BitGen rng;
+  for (int i = 0; i < 10; ++i) {
+    CheckSummarizedBitmap<1>(rng);
+    CheckSummarizedBitmap<64>(rng);
+    CheckSummarizedBitmap<253>(rng);
+    CheckSummarizedBitmap<2048>(rng);
+    CheckSummarizedBitmap<64 * 64 + 3>(rng);
+  }
+}
+
+TEST(SummarizedBitmapTest, FindSetAcrossWords) {
+  SummarizedBitmap<64 * 100> map;
+  EXPECT_TRUE(map.IsZero());
+  EXPECT_EQ(map.FindSet(0), 64 * 100);
+  map.SetBit(64 * 90 + 5);
+  EXPECT_FALSE(map.IsZero());
+  EXPECT_EQ(map.FindSet(0), 64 * 90 + 5);
+  EXPECT_EQ(map.FindSet(64 * 90 + 5), 64 * 90 + 5);
+  EXPECT_EQ(map.FindSet(64 * 90 + 6), 64 * 100);
+  map.SetBit(3);
+  EXPECT_EQ(map.FindSet(0), 3);
+  EXPECT_EQ(map.FindSet(4), 64 * 90 + 5);
+  map.ClearBit(64 * 90 + 5);
+  EXPECT_EQ(map.FindSet(4), 64 * 100);
+  map.ClearBit(3);
+  EXPECT_TRUE(map.IsZero());
+}
+
 class RangeTrackerTest : public ::testing::Test {
  protected:
   std::vector<std::pair<size_t, size_t>> FreeRanges() {
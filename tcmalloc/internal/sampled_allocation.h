@@ -15,16 +15,21 @@
 #ifndef TCMALLOC_INTERNAL_SAMPLED_ALLOCATION_H_
 #define TCMALLOC_INTERNAL_SAMPLED_ALLOCATION_H_
 
-#include <utility>
-
+#include "absl/base/thread_annotations.h"
+#include "absl/types/span.h"
+#include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/sampled_allocation_recorder.h"
+#include "tcmalloc/internal/stack_depot.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
 // Stores information about the sampled allocation.
+//
+// The call stack is kept in a StackDepot shared by the samples, which is
+// passed to PrepareForSampling().
 struct SampledAllocation : public tcmalloc_internal::Sample<SampledAllocation> {
   // We use this constructor to initialize `graveyard_`, which is used to
   // maintain the freelist of SampledAllocations. When we revive objects from
@@ -35,8 +40,11 @@ struct SampledAllocation : public tcmalloc_internal::Sample<SampledAllocation> {
   // When no object is available on the freelist, we allocate for a new
   // SampledAllocation object and invoke this constructor with
   // `PrepareForSampling()`.
-  explicit SampledAllocation(StackTrace&& stack_trace) {
-    PrepareForSampling(std::move(stack_trace));
+  SampledAllocation(const StackTrace& stack_trace, StackDepot& depot) {
+    PrepareForSampling(stack_trace, depot);
+  }
+  SampledAllocation(const SampledAllocation& other, StackDepot& depot) {
+    PrepareForSampling(other, depot);
   }
 
   SampledAllocation(const SampledAllocation&) = delete;
@@ -47,13 +55,41 @@ struct SampledAllocation : public tcmalloc_internal::Sample<SampledAllocation> {
 
   // Prepares the state of the object. It is invoked when either a new sampled
   // allocation is constructed or when an object is revived from the freelist.
-  void PrepareForSampling(StackTrace&& stack_trace)
+  void PrepareForSampling(const StackTrace& stack_trace, StackDepot& depot)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock) {
+    const StackDepot::Entry* previous = depot_stack;
+    sampled_stack = stack_trace;
+    depot_stack =
+        depot.Intern(absl::MakeConstSpan(stack_trace.stack, stack_trace.depth));
+    if (previous != nullptr) {
+      depot.Unref(previous);
+    }
+  }
+
+  // As above, but copies the sample <other>, sharing its call stack.  The
+  // caller must hold <other>'s lock too.
+  void PrepareForSampling(const SampledAllocation& other, StackDepot& depot)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock) {
-    sampled_stack = std::move(stack_trace);
+    const StackDepot::Entry* previous = depot_stack;
+    sampled_stack = other.sampled_stack;
+    depot_stack = other.depot_stack;
+    if (depot_stack != nullptr) {
+      depot.Ref(depot_stack);
+    }
+    if (previous != nullptr) {
+      depot.Unref(previous);
+    }
+  }
+
+  // The call stack of the sampled allocation.
+  absl::Span<void* const> stack() const {
+    if (depot_stack == nullptr) return {};
+    return depot_stack->stack();
   }
 
-  // The stack trace of the sampled allocation.
-  StackTrace sampled_stack = {};
+  // Everything but the call stack of the sampled allocation.
+  SampleInfo sampled_stack = {};
+  const StackDepot::Entry* depot_stack = nullptr;
 };
 
 }  // namespace tcmalloc_internal
@@ -23,9 +23,14 @@
 #define TCMALLOC_INTERNAL_SAMPLED_ALLOCATION_RECORDER_H_
 
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
 
+#include "absl/base/attributes.h"
+#include "absl/base/config.h"
 #include "absl/base/const_init.h"
 #include "absl/base/internal/spinlock.h"
+#include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "absl/functional/function_ref.h"
 #include "tcmalloc/internal/allocation_guard.h"
@@ -44,17 +49,25 @@ struct Sample {
   absl::base_internal::SpinLock lock{absl::kConstInit,
                                      absl::base_internal::SCHEDULE_KERNEL_ONLY};
   T* next = nullptr;
-  T* dead ABSL_GUARDED_BY(lock) = nullptr;
+  Sample* dead ABSL_GUARDED_BY(lock) = nullptr;
 };
 
 // Holds samples and their associated stack traces.
 //
+// Dead samples are kept for reuse on kNumGraveyards lists, each with its own
+// lock.  A thread registers and unregisters samples on the list its thread
+// hashes to, and only looks at the others when its own is empty, so threads
+// sampling concurrently rarely contend.  With kNumGraveyards == 1 every
+// Register and Unregister serializes on a single lock.
+//
 // Thread safe.
-template <typename T, typename AllocatorT>
+template <typename T, typename AllocatorT, size_t kNumGraveyards = 8>
 class SampleRecorder {
  public:
   using Allocator = AllocatorT;
 
+  static_assert(kNumGraveyards > 0);
+
   constexpr explicit SampleRecorder(Allocator* allocator);
   ~SampleRecorder();
 
@@ -64,7 +77,8 @@ class SampleRecorder {
   SampleRecorder(SampleRecorder&&) = delete;
   SampleRecorder& operator=(SampleRecorder&&) = delete;
 
-  // Sets up the dead pointer of `graveyard_` to make it a circular linked list.
+  // Sets up the dead pointers of `graveyards_` to make them circular linked
+  // lists.
   void Init();
 
   // Registers for sampling.  Returns an opaque registration info.
@@ -93,25 +107,34 @@ class SampleRecorder {
   // Iterates over all the registered samples.
   void Iterate(const absl::FunctionRef<void(const T& sample)>& f);
 
+  // Returns the number of samples allocated so far, live or dead.  Iterate
+  // visits no more samples than this unless new ones are allocated meanwhile.
+  size_t size() const { return size_.load(std::memory_order_relaxed); }
+
  private:
+  struct alignas(ABSL_CACHELINE_SIZE) Graveyard : Sample<T> {};
+
+  // Returns the graveyard of the current thread.
+  Graveyard& LocalGraveyard();
+
   void PushNew(T* sample);
   void PushDead(T* sample);
   template <typename... Targs>
-  T* PopDead(Targs&&... args);
+  T* PopDead(Graveyard& graveyard, Targs&&... args);
 
   // Intrusive lock free linked lists for tracking samples.
   //
   // `all_` records all samples (they are never removed from this list) and is
   // terminated with a `nullptr`.
   //
-  // `graveyard_.dead` is a circular linked list.  When it is empty,
-  // `graveyard_.dead == &graveyard`.  The list is circular so that
+  // Each `graveyards_[i].dead` is a circular linked list.  When it is empty,
+  // `graveyards_[i].dead == &graveyards_[i]`.  The list is circular so that
   // every item on it (even the last) has a non-null dead pointer.  This allows
   // `Iterate` to determine if a given sample is live or dead using only
   // information on the sample itself.
   //
   // For example, nodes [A, B, C, D, E] with [A, C, E] alive and [B, D] dead
-  // looks like this (G is the Graveyard):
+  // on the same graveyard looks like this (G is the Graveyard):
   //
   //           +---+    +---+    +---+    +---+    +---+
   //    all -->| A |--->| B |--->| C |--->| D |--->| E |
@@ -125,24 +148,27 @@ class SampleRecorder {
   //     +--------------------------------------+
   //
   std::atomic<T*> all_;
-  T graveyard_;
+  std::atomic<size_t> size_;
+  Graveyard graveyards_[kNumGraveyards];
 
   std::atomic<DisposeCallback> dispose_;
   Allocator* const allocator_;
 };
 
-template <typename T, typename Allocator>
-typename SampleRecorder<T, Allocator>::DisposeCallback
-SampleRecorder<T, Allocator>::SetDisposeCallback(DisposeCallback f) {
+template <typename T, typename Allocator, size_t kNumGraveyards>
+typename SampleRecorder<T, Allocator, kNumGraveyards>::DisposeCallback
+SampleRecorder<T, Allocator, kNumGraveyards>::SetDisposeCallback(
+    DisposeCallback f) {
   return dispose_.exchange(f, std::memory_order_relaxed);
 }
 
-template <typename T, typename Allocator>
-constexpr SampleRecorder<T, Allocator>::SampleRecorder(Allocator* allocator)
-    : all_(nullptr), dispose_(nullptr), allocator_(allocator) {}
+template <typename T, typename Allocator, size_t kNumGraveyards>
+constexpr SampleRecorder<T, Allocator, kNumGraveyards>::SampleRecorder(
+    Allocator* allocator)
+    : all_(nullptr), size_(0), dispose_(nullptr), allocator_(allocator) {}
 
-template <typename T, typename Allocator>
-SampleRecorder<T, Allocator>::~SampleRecorder() {
+template <typename T, typename Allocator, size_t kNumGraveyards>
+SampleRecorder<T, Allocator, kNumGraveyards>::~SampleRecorder() {
   T* s = all_.load(std::memory_order_acquire);
   while (s != nullptr) {
     T* next = s->next;
@@ -151,14 +177,32 @@ SampleRecorder<T, Allocator>::~SampleRecorder() {
   }
 }
 
-template <typename T, typename Allocator>
-void SampleRecorder<T, Allocator>::Init() {
-  AllocationGuardSpinLockHolder l(&graveyard_.lock);
-  graveyard_.dead = &graveyard_;
+template <typename T, typename Allocator, size_t kNumGraveyards>
+void SampleRecorder<T, Allocator, kNumGraveyards>::Init() {
+  for (Graveyard& graveyard : graveyards_) {
+    AllocationGuardSpinLockHolder l(&graveyard.lock);
+    graveyard.dead = &graveyard;
+  }
 }
 
-template <typename T, typename Allocator>
-void SampleRecorder<T, Allocator>::PushNew(T* sample) {
+template <typename T, typename Allocator, size_t kNumGraveyards>
+typename SampleRecorder<T, Allocator, kNumGraveyards>::Graveyard&
+SampleRecorder<T, Allocator, kNumGraveyards>::LocalGraveyard() {
+  if constexpr (kNumGraveyards == 1) {
+    return graveyards_[0];
+  } else {
+    // Thread-local storage of different threads is at different addresses.
+    ABSL_CONST_INIT static thread_local char anchor
+        ABSL_ATTRIBUTE_INITIAL_EXEC = 0;
+    const uintptr_t hash = (reinterpret_cast<uintptr_t>(&anchor) >> 6) *
+                           uintptr_t{0x9e3779b97f4a7c15};
+    return graveyards_[(hash >> 32) % kNumGraveyards];
+  }
+}
+
+template <typename T, typename Allocator, size_t kNumGraveyards>
+void SampleRecorder<T, Allocator, kNumGraveyards>::PushNew(T* sample) {
+  size_.fetch_add(1, std::memory_order_relaxed);
   sample->next = all_.load(std::memory_order_relaxed);
   while (!all_.compare_exchange_weak(sample->next, sample,
                                      std::memory_order_release,
@@ -166,40 +210,51 @@ void SampleRecorder<T, Allocator>::PushNew(T* sample) {
   }
 }
 
-template <typename T, typename Allocator>
-void SampleRecorder<T, Allocator>::PushDead(T* sample) {
+template <typename T, typename Allocator, size_t kNumGraveyards>
+void SampleRecorder<T, Allocator, kNumGraveyards>::PushDead(T* sample) {
   if (auto* dispose = dispose_.load(std::memory_order_relaxed)) {
     dispose(*sample);
   }
 
-  AllocationGuardSpinLockHolder graveyard_lock(&graveyard_.lock);
+  Graveyard& graveyard = LocalGraveyard();
+  AllocationGuardSpinLockHolder graveyard_lock(&graveyard.lock);
   AllocationGuardSpinLockHolder sample_lock(&sample->lock);
-  sample->dead = graveyard_.dead;
-  graveyard_.dead = sample;
+  sample->dead = graveyard.dead;
+  graveyard.dead = sample;
 }
 
-template <typename T, typename Allocator>
+template <typename T, typename Allocator, size_t kNumGraveyards>
 template <typename... Targs>
-T* SampleRecorder<T, Allocator>::PopDead(Targs&&... args) {
-  AllocationGuardSpinLockHolder graveyard_lock(&graveyard_.lock);
+T* SampleRecorder<T, Allocator, kNumGraveyards>::PopDead(Graveyard& graveyard,
+                                                         Targs&&... args) {
+  AllocationGuardSpinLockHolder graveyard_lock(&graveyard.lock);
 
   // The list is circular, so eventually it collapses down to
-  //   graveyard_.dead == &graveyard_
+  //   graveyard.dead == &graveyard
   // when it is empty.
-  T* sample = graveyard_.dead;
-  if (sample == &graveyard_) return nullptr;
+  if (graveyard.dead == &graveyard) return nullptr;
+  T* sample = static_cast<T*>(graveyard.dead);
 
   AllocationGuardSpinLockHolder sample_lock(&sample->lock);
-  graveyard_.dead = sample->dead;
+  graveyard.dead = sample->dead;
   sample->dead = nullptr;
   sample->PrepareForSampling(std::forward<Targs>(args)...);
   return sample;
 }
 
-template <typename T, typename Allocator>
+template <typename T, typename Allocator, size_t kNumGraveyards>
 template <typename... Targs>
-T* SampleRecorder<T, Allocator>::Register(Targs&&... args) {
-  T* sample = PopDead(std::forward<Targs>(args)...);
+T* SampleRecorder<T, Allocator, kNumGraveyards>::Register(Targs&&... args) {
+  Graveyard& local = LocalGraveyard();
+  T* sample = PopDead(local, std::forward<Targs>(args)...);
+  // Before allocating, look for a dead sample to reuse in the other
+  // graveyards, so that the number of samples stays bounded by the peak number
+  // live however threads register and unregister them.
+  for (size_t i = 0; sample == nullptr && i < kNumGraveyards; ++i) {
+    if (&graveyards_[i] != &local) {
+      sample = PopDead(graveyards_[i], std::forward<Targs>(args)...);
+    }
+  }
   if (sample == nullptr) {
     // Resurrection failed.  Hire a new warlock.
     sample = allocator_->New(std::forward<Targs>(args)...);
@@ -209,14 +264,15 @@ T* SampleRecorder<T, Allocator>::Register(Targs&&... args) {
   return sample;
 }
 
-template <typename T, typename Allocator>
-void SampleRecorder<T, Allocator>::Unregister(T* sample) {
+template <typename T, typename Allocator, size_t kNumGraveyards>
+void SampleRecorder<T, Allocator, kNumGraveyards>::Unregister(T* sample) {
   PushDead(sample);
 }
 
-template <typename T, typename Allocator>
-void SampleRecorder<T, Allocator>::UnregisterAll() {
-  AllocationGuardSpinLockHolder graveyard_lock(&graveyard_.lock);
+template <typename T, typename Allocator, size_t kNumGraveyards>
+void SampleRecorder<T, Allocator, kNumGraveyards>::UnregisterAll() {
+  Graveyard& graveyard = LocalGraveyard();
+  AllocationGuardSpinLockHolder graveyard_lock(&graveyard.lock);
   T* sample = all_.load(std::memory_order_acquire);
   auto* dispose = dispose_.load(std::memory_order_relaxed);
   while (sample != nullptr) {
@@ -224,16 +280,16 @@ void SampleRecorder<T, Allocator>::UnregisterAll() {
       AllocationGuardSpinLockHolder sample_lock(&sample->lock);
       if (sample->dead == nullptr) {
         if (dispose) dispose(*sample);
-        sample->dead = graveyard_.dead;
-        graveyard_.dead = sample;
+        sample->dead = graveyard.dead;
+        graveyard.dead = sample;
       }
     }
     sample = sample->next;
   }
 }
 
-template <typename T, typename Allocator>
-void SampleRecorder<T, Allocator>::Iterate(
+template <typename T, typename Allocator, size_t kNumGraveyards>
+void SampleRecorder<T, Allocator, kNumGraveyards>::Iterate(
     const absl::FunctionRef<void(const T& sample)>& f) {
   T* s = all_.load(std::memory_order_acquire);
   while (s != nullptr) {
@@ -0,0 +1,98 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <thread>  // NOLINT(build/c++11)
+
+#include "absl/base/thread_annotations.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/sampled_allocation_recorder.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+struct Info : public Sample<Info> {
+  void PrepareForSampling() ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock) {}
+  size_t value = 0;
+};
+
+struct InfoAllocator {
+  static Info* New() { return new Info; }
+  static void Delete(Info* info) { delete info; }
+};
+
+template <size_t kNumGraveyards>
+using Recorder = SampleRecorder<Info, InfoAllocator, kNumGraveyards>;
+
+// Returns a recorder shared by all the threads of a benchmark.
+template <size_t kNumGraveyards>
+Recorder<kNumGraveyards>& SharedRecorder() {
+  static InfoAllocator allocator;
+  static Recorder<kNumGraveyards>* recorder = [] {
+    auto* recorder = new Recorder<kNumGraveyards>(&allocator);
+    recorder->Init();
+    return recorder;
+  }();
+  return *recorder;
+}
+
+// Registers and then unregisters a batch of samples per iteration, as threads
+// sampling allocations and freeing them do.  With one graveyard this is the
+// recorder as it was before graveyards were sharded.
+template <size_t kNumGraveyards>
+void BM_RegisterUnregister(benchmark::State& state) {
+  Recorder<kNumGraveyards>& recorder = SharedRecorder<kNumGraveyards>();
+  constexpr int kBatch = 16;
+  Info* samples[kBatch];
+  for (auto s : state) {
+    for (Info*& sample : samples) {
+      sample = recorder.Register();
+    }
+    for (Info* sample : samples) {
+      recorder.Unregister(sample);
+    }
+  }
+  state.SetItemsProcessed(kBatch * state.iterations());
+}
+BENCHMARK(BM_RegisterUnregister<1>)
+    ->ThreadRange(1, std::max(1u, std::thread::hardware_concurrency()));
+BENCHMARK(BM_RegisterUnregister<8>)
+    ->ThreadRange(1, std::max(1u, std::thread::hardware_concurrency()));
+
+// Iterates over the samples while other threads register and unregister.
+template <size_t kNumGraveyards>
+void BM_IterateWhileRegistering(benchmark::State& state) {
+  Recorder<kNumGraveyards>& recorder = SharedRecorder<kNumGraveyards>();
+  if (state.thread_index() != 0) {
+    BM_RegisterUnregister<kNumGraveyards>(state);
+    return;
+  }
+  for (auto s : state) {
+    size_t sum = 0;
+    recorder.Iterate([&](const Info& info) { sum += info.value; });
+    benchmark::DoNotOptimize(sum);
+  }
+}
+BENCHMARK(BM_IterateWhileRegistering<1>)->ThreadRange(2, 8);
+BENCHMARK(BM_IterateWhileRegistering<8>)->ThreadRange(2, 8);
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -22,6 +22,7 @@
 #include <cstdint>
 #include <random>
 #include <string>
+#include <thread>  // NOLINT(build/c++11)
 #include <vector>
 
 #include "gmock/gmock.h"
@@ -174,6 +175,62 @@ TEST_F(SampleRecorderTest, Unregistration) {
   EXPECT_EQ(alloc_count1, alloc_count2);
 }
 
+TEST_F(SampleRecorderTest, Size) {
+  EXPECT_EQ(sample_recorder_.size(), 0);
+  Info* info1 = Register(1);
+  Info* info2 = Register(2);
+  EXPECT_EQ(sample_recorder_.size(), 2);
+
+  // Dead samples are still counted, and reused before allocating new ones.
+  sample_recorder_.Unregister(info1);
+  EXPECT_EQ(sample_recorder_.size(), 2);
+  info1 = Register(3);
+  EXPECT_EQ(sample_recorder_.size(), 2);
+  Info* info3 = Register(4);
+  EXPECT_EQ(sample_recorder_.size(), 3);
+
+  sample_recorder_.Unregister(info1);
+  sample_recorder_.Unregister(info2);
+  sample_recorder_.Unregister(info3);
+}
+
+// Samples unregistered by one thread are reused by another, whichever
+// graveyards the threads use.
+TEST_F(SampleRecorderTest, CrossThreadReuse) {
+  constexpr int kSamples = 10;
+  std::thread t([&]() {
+    std::vector<Info*> infos;
+    for (int i = 0; i < kSamples; ++i) {
+      infos.push_back(Register(i));
+    }
+    for (Info* info : infos) {
+      sample_recorder_.Unregister(info);
+    }
+  });
+  t.join();
+  EXPECT_EQ(sample_recorder_.size(), kSamples);
+
+  for (int i = 0; i < kSamples; ++i) {
+    Register(i);
+  }
+  EXPECT_EQ(sample_recorder_.size(), kSamples);
+  EXPECT_EQ(GetSizes().size(), kSamples);
+}
+
+// A single graveyard behaves the same.
+TEST(SampleRecorderSingleGraveyardTest, Reuse) {
+  TestAllocator allocator;
+  SampleRecorder<Info, TestAllocator, 1> sample_recorder{&allocator};
+  sample_recorder.Init();
+  Info* info1 = sample_recorder.Register();
+  Info* info2 = sample_recorder.Register();
+  sample_recorder.Unregister(info1);
+  EXPECT_EQ(sample_recorder.Register(), info1);
+  EXPECT_EQ(sample_recorder.size(), 2);
+  sample_recorder.Unregister(info1);
+  sample_recorder.Unregister(info2);
+}
+
 TEST_F(SampleRecorderTest, MultiThreaded) {
   absl::Notification stop;
   ThreadManager threads;
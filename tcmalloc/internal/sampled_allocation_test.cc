@@ -14,15 +14,34 @@
 
 #include "tcmalloc/internal/sampled_allocation.h"
 
+#include <stddef.h>
+
+#include <cstddef>
+#include <new>
+
 #include "gtest/gtest.h"
 #include "absl/base/internal/spinlock.h"
 #include "absl/debugging/stacktrace.h"
+#include "absl/types/span.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/stack_depot.h"
 
 namespace tcmalloc {
 namespace tcmalloc_internal {
 namespace {
 
+// The depot never frees, so allocate its entries from a buffer.
+void* AllocFromBuffer(size_t bytes, std::align_val_t alignment) {
+  alignas(std::max_align_t) static char buffer[1 << 16];
+  static size_t used = 0;
+  const size_t align = static_cast<size_t>(alignment);
+  used = (used + align - 1) & ~(align - 1);
+  TC_CHECK_LE(used + bytes, sizeof(buffer));
+  void* result = &buffer[used];
+  used += bytes;
+  return result;
+}
+
 StackTrace PrepareStackTrace() {
   StackTrace st;
   st.depth = absl::GetStackTrace(st.stack, kMaxStackDepth, /* skip_count= */ 0);
@@ -35,12 +54,16 @@ StackTrace PrepareStackTrace() {
 }
 
 TEST(SampledAllocationTest, PrepareForSampling) {
+  StackDepot depot(&AllocFromBuffer);
   // PrepareForSampling() invoked in the constructor.
-  SampledAllocation sampled_allocation(PrepareStackTrace());
+  const StackTrace st = PrepareStackTrace();
+  SampledAllocation sampled_allocation(st, depot);
   absl::base_internal::SpinLockHolder sample_lock(&sampled_allocation.lock);
 
   // Now verify some fields.
-  EXPECT_GT(sampled_allocation.sampled_stack.depth, 0);
+  EXPECT_GT(sampled_allocation.stack().size(), 0);
+  EXPECT_EQ(sampled_allocation.stack(),
+            absl::MakeConstSpan(st.stack, st.depth));
   EXPECT_EQ(sampled_allocation.sampled_stack.requested_size, 8);
   EXPECT_EQ(sampled_allocation.sampled_stack.requested_alignment, 4);
   EXPECT_EQ(sampled_allocation.sampled_stack.allocated_size, 8);
@@ -48,7 +71,6 @@ TEST(SampledAllocationTest, PrepareForSampling) {
   EXPECT_EQ(sampled_allocation.sampled_stack.weight, 4);
 
   // Set them to different values.
-  sampled_allocation.sampled_stack.depth = 0;
   sampled_allocation.sampled_stack.requested_size = 0;
   sampled_allocation.sampled_stack.requested_alignment = 0;
   sampled_allocation.sampled_stack.allocated_size = 0;
@@ -56,13 +78,29 @@ TEST(SampledAllocationTest, PrepareForSampling) {
   sampled_allocation.sampled_stack.weight = 0;
 
   // Call PrepareForSampling() again and check the fields.
-  sampled_allocation.PrepareForSampling(PrepareStackTrace());
-  EXPECT_GT(sampled_allocation.sampled_stack.depth, 0);
+  sampled_allocation.PrepareForSampling(PrepareStackTrace(), depot);
+  EXPECT_GT(sampled_allocation.stack().size(), 0);
   EXPECT_EQ(sampled_allocation.sampled_stack.requested_size, 8);
   EXPECT_EQ(sampled_allocation.sampled_stack.requested_alignment, 4);
   EXPECT_EQ(sampled_allocation.sampled_stack.allocated_size, 8);
   EXPECT_EQ(sampled_allocation.sampled_stack.access_hint, 1);
   EXPECT_EQ(sampled_allocation.sampled_stack.weight, 4);
+  // The first call stack was released.
+  EXPECT_EQ(depot.stats().stacks, 1);
+  EXPECT_EQ(depot.stats().references, 1);
+}
+
+TEST(SampledAllocationTest, CopySharesStack) {
+  StackDepot depot(&AllocFromBuffer);
+  SampledAllocation original(PrepareStackTrace(), depot);
+  absl::base_internal::SpinLockHolder original_lock(&original.lock);
+  SampledAllocation copy(original, depot);
+  absl::base_internal::SpinLockHolder copy_lock(&copy.lock);
+
+  EXPECT_EQ(copy.depot_stack, original.depot_stack);
+  EXPECT_EQ(copy.sampled_stack.requested_size, 8);
+  EXPECT_EQ(depot.stats().stacks, 1);
+  EXPECT_EQ(depot.stats().references, 2);
 }
 
 }  // namespace
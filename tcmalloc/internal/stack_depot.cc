@@ -0,0 +1,111 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/stack_depot.h"
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#include "absl/hash/hash.h"
+#include "absl/types/span.h"
+#include "tcmalloc/internal/allocation_guard.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+const StackDepot::Entry* StackDepot::Intern(absl::Span<void* const> stack) {
+  TC_ASSERT_LE(stack.size(), kMaxStackDepth);
+  const size_t hash = absl::HashOf(stack);
+
+  AllocationGuardSpinLockHolder h(&lock_);
+  Entry** bucket = &buckets_[hash % kNumBuckets];
+  for (Entry* e = *bucket; e != nullptr; e = e->next_) {
+    if (e->hash_ == hash && e->depth_ == stack.size() &&
+        std::equal(stack.begin(), stack.end(), e->frames())) {
+      ++e->refcount_;
+      references_.store(references_.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+      return e;
+    }
+  }
+
+  const size_t size_class =
+      (stack.size() + kFramesPerSizeClass - 1) / kFramesPerSizeClass;
+  Entry* e = free_[size_class];
+  if (e != nullptr) {
+    free_[size_class] = e->next_;
+  } else {
+    const size_t bytes =
+        sizeof(Entry) + size_class * kFramesPerSizeClass * sizeof(void*);
+    e = new (alloc_(bytes, std::align_val_t{alignof(Entry)})) Entry;
+    bytes_.store(bytes_.load(std::memory_order_relaxed) + bytes,
+                 std::memory_order_relaxed);
+  }
+  e->hash_ = hash;
+  e->refcount_ = 1;
+  e->depth_ = stack.size();
+  e->size_class_ = size_class;
+  std::copy(stack.begin(), stack.end(), e->frames());
+  e->next_ = *bucket;
+  *bucket = e;
+  stacks_.store(stacks_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+  references_.store(references_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+  return e;
+}
+
+void StackDepot::Ref(const Entry* entry) {
+  AllocationGuardSpinLockHolder h(&lock_);
+  TC_ASSERT_GT(entry->refcount_, 0);
+  ++const_cast<Entry*>(entry)->refcount_;
+  references_.store(references_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+}
+
+void StackDepot::Unref(const Entry* entry) {
+  Entry* e = const_cast<Entry*>(entry);
+  AllocationGuardSpinLockHolder h(&lock_);
+  TC_ASSERT_GT(e->refcount_, 0);
+  references_.store(references_.load(std::memory_order_relaxed) - 1,
+                    std::memory_order_relaxed);
+  if (--e->refcount_ > 0) return;
+
+  Entry** link = &buckets_[e->hash_ % kNumBuckets];
+  while (*link != e) {
+    TC_CHECK_NE(*link, nullptr);
+    link = &(*link)->next_;
+  }
+  *link = e->next_;
+  e->next_ = free_[e->size_class_];
+  free_[e->size_class_] = e;
+  stacks_.store(stacks_.load(std::memory_order_relaxed) - 1,
+                std::memory_order_relaxed);
+}
+
+StackDepot::Stats StackDepot::stats() const {
+  return {stacks_.load(std::memory_order_relaxed),
+          references_.load(std::memory_order_relaxed),
+          bytes_.load(std::memory_order_relaxed)};
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,123 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_STACK_DEPOT_H_
+#define TCMALLOC_INTERNAL_STACK_DEPOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <new>
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/types/span.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Stores each distinct call stack of the sampled allocations once, for all of
+// the samples taken from it, rather than kMaxStackDepth frames per sample.
+//
+// Entries are reference counted.  The depot's allocator has no way to free
+// memory, so an entry whose last reference is released is kept for a later
+// stack of a similar depth.
+//
+// Thread safe.
+class StackDepot {
+ public:
+  class Entry {
+   public:
+    absl::Span<void* const> stack() const {
+      return {reinterpret_cast<void* const*>(this + 1), depth_};
+    }
+    size_t hash() const { return hash_; }
+
+   private:
+    friend class StackDepot;
+
+    void** frames() { return reinterpret_cast<void**>(this + 1); }
+
+    // Guarded by the depot's lock.  hash_, depth_ and the frames do not
+    // change while the entry is referenced.
+    Entry* next_;
+    size_t hash_;
+    uint32_t refcount_;
+    uint16_t depth_;
+    // The index of the free list the entry returns to, which bounds depth_.
+    uint16_t size_class_;
+  };
+
+  struct Stats {
+    // Distinct stacks currently stored.
+    size_t stacks;
+    // References to them.
+    size_t references;
+    // Bytes allocated for entries, whether in use or free.
+    size_t bytes;
+  };
+
+  // Allocates memory for the depot.  Must not fail and must not allocate with
+  // malloc: the depot's lock may be held by a sampled allocation.
+  using Allocator = void* (*)(size_t bytes, std::align_val_t alignment);
+
+  constexpr explicit StackDepot(Allocator alloc) : alloc_(alloc) {}
+
+  StackDepot(const StackDepot&) = delete;
+  StackDepot& operator=(const StackDepot&) = delete;
+
+  // Returns the entry for <stack>, storing it if it is new, with a reference
+  // to it for the caller.
+  const Entry* Intern(absl::Span<void* const> stack) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Adds a reference to <entry>.
+  void Ref(const Entry* entry) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Drops a reference to <entry>, which must not be used again if it was the
+  // last one.
+  void Unref(const Entry* entry) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Does not take the depot's lock, so can be called under any other.
+  Stats stats() const;
+
+ private:
+  static constexpr size_t kFramesPerSizeClass = 8;
+  static constexpr size_t kNumSizeClasses =
+      kMaxStackDepth / kFramesPerSizeClass + 1;
+  static constexpr size_t kNumBuckets = 1024;
+  static_assert(kMaxStackDepth % kFramesPerSizeClass == 0);
+
+  mutable absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  const Allocator alloc_;
+  Entry* buckets_[kNumBuckets] ABSL_GUARDED_BY(lock_) = {};
+  // Released entries, by the number of frames they have room for.
+  Entry* free_[kNumSizeClasses] ABSL_GUARDED_BY(lock_) = {};
+
+  // Written under lock_, but read by stats() without it.
+  std::atomic<size_t> stacks_{0};
+  std::atomic<size_t> references_{0};
+  std::atomic<size_t> bytes_{0};
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_STACK_DEPOT_H_
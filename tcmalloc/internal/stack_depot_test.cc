@@ -0,0 +1,138 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/stack_depot.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/types/span.h"
+#include "tcmalloc/internal/logging.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// The depot never frees, so allocate its entries from a buffer.
+void* AllocFromBuffer(size_t bytes, std::align_val_t alignment) {
+  alignas(std::max_align_t) static char buffer[1 << 21];
+  static size_t used = 0;
+  const size_t align = static_cast<size_t>(alignment);
+  used = (used + align - 1) & ~(align - 1);
+  TC_CHECK_LE(used + bytes, sizeof(buffer));
+  void* result = &buffer[used];
+  used += bytes;
+  return result;
+}
+
+std::vector<void*> MakeStack(int depth, uintptr_t seed) {
+  std::vector<void*> stack;
+  for (int i = 0; i < depth; ++i) {
+    stack.push_back(reinterpret_cast<void*>(seed * 1000 + i));
+  }
+  return stack;
+}
+
+TEST(StackDepotTest, DeduplicatesStacks) {
+  StackDepot depot(&AllocFromBuffer);
+  const std::vector<void*> a = MakeStack(10, 1);
+  const std::vector<void*> b = MakeStack(10, 2);
+
+  const StackDepot::Entry* a1 = depot.Intern(a);
+  const StackDepot::Entry* a2 = depot.Intern(a);
+  const StackDepot::Entry* b1 = depot.Intern(b);
+  EXPECT_EQ(a1, a2);
+  EXPECT_NE(a1, b1);
+  EXPECT_EQ(a1->stack(), absl::MakeConstSpan(a));
+  EXPECT_EQ(b1->stack(), absl::MakeConstSpan(b));
+  EXPECT_EQ(depot.stats().stacks, 2);
+  EXPECT_EQ(depot.stats().references, 3);
+
+  depot.Unref(a1);
+  depot.Unref(a2);
+  depot.Unref(b1);
+  EXPECT_EQ(depot.stats().stacks, 0);
+  EXPECT_EQ(depot.stats().references, 0);
+}
+
+TEST(StackDepotTest, PrefixIsDistinct) {
+  StackDepot depot(&AllocFromBuffer);
+  const std::vector<void*> stack = MakeStack(kMaxStackDepth, 3);
+  const StackDepot::Entry* full = depot.Intern(stack);
+  const StackDepot::Entry* prefix =
+      depot.Intern(absl::MakeConstSpan(stack).first(5));
+  const StackDepot::Entry* empty = depot.Intern({});
+  EXPECT_NE(full, prefix);
+  EXPECT_EQ(full->stack().size(), kMaxStackDepth);
+  EXPECT_EQ(prefix->stack().size(), 5);
+  EXPECT_TRUE(empty->stack().empty());
+  depot.Unref(full);
+  depot.Unref(prefix);
+  depot.Unref(empty);
+}
+
+TEST(StackDepotTest, RefKeepsEntry) {
+  StackDepot depot(&AllocFromBuffer);
+  const std::vector<void*> stack = MakeStack(4, 4);
+  const StackDepot::Entry* e = depot.Intern(stack);
+  depot.Ref(e);
+  depot.Unref(e);
+  EXPECT_EQ(depot.stats().stacks, 1);
+  EXPECT_EQ(depot.Intern(stack), e);
+  depot.Unref(e);
+  depot.Unref(e);
+  EXPECT_EQ(depot.stats().stacks, 0);
+}
+
+TEST(StackDepotTest, ReusesReleasedEntries) {
+  StackDepot depot(&AllocFromBuffer);
+  const StackDepot::Entry* e = depot.Intern(MakeStack(20, 5));
+  const size_t bytes = depot.stats().bytes;
+  EXPECT_GT(bytes, 0);
+  depot.Unref(e);
+
+  // A stack of a similar depth takes the released entry's memory.
+  const StackDepot::Entry* f = depot.Intern(MakeStack(18, 6));
+  EXPECT_EQ(f, e);
+  EXPECT_EQ(depot.stats().bytes, bytes);
+  EXPECT_EQ(f->stack(), absl::MakeConstSpan(MakeStack(18, 6)));
+  depot.Unref(f);
+}
+
+TEST(StackDepotTest, ManyStacks) {
+  StackDepot depot(&AllocFromBuffer);
+  constexpr int kStacks = 2000;
+  std::vector<const StackDepot::Entry*> entries;
+  for (int i = 0; i < kStacks; ++i) {
+    entries.push_back(depot.Intern(MakeStack(1 + i % kMaxStackDepth, i)));
+  }
+  EXPECT_EQ(depot.stats().stacks, kStacks);
+  for (int i = 0; i < kStacks; ++i) {
+    EXPECT_EQ(depot.Intern(MakeStack(1 + i % kMaxStackDepth, i)), entries[i]);
+    depot.Unref(entries[i]);
+  }
+  for (const StackDepot::Entry* e : entries) {
+    depot.Unref(e);
+  }
+  EXPECT_EQ(depot.stats().stacks, 0);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -19,14 +19,19 @@
 
 #include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <optional>
+#include <utility>
 
 #include "absl/base/optimization.h"
 #include "absl/functional/function_ref.h"
+#include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/cpu_utils.h"
 #include "tcmalloc/internal/util.h"
@@ -38,6 +43,78 @@ namespace tcmalloc_internal {
 #if __linux__
 namespace {
 bool IsInBounds(int cpu) { return 0 <= cpu && cpu < kMaxCpus; }
+
+// Reads up to buf.size() bytes from <path>.  Returns std::nullopt if the file
+// cannot be read.
+std::optional<absl::string_view> ReadSmallFile(const char* path,
+                                               absl::Span<char> buf) {
+  int fd = signal_safe_open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+  size_t bytes_read;
+  const ssize_t rc = signal_safe_read(fd, buf.data(), buf.size(), &bytes_read);
+  signal_safe_close(fd);
+  if (rc < 0) {
+    return std::nullopt;
+  }
+  return absl::string_view(buf.data(), bytes_read);
+}
+
+// Calls <f> with the contents of <file> (starting with a slash) in the cgroup
+// v2 directory of this process and in each of its ancestors below the root,
+// innermost first.  Files that cannot be read are skipped.
+void ForEachCgroupFile(absl::string_view file,
+                       absl::FunctionRef<void(absl::string_view)> f) {
+  std::array<char, 4096> cgroup_buf;
+  const std::optional<absl::string_view> cgroup_contents =
+      ReadSmallFile("/proc/self/cgroup", absl::MakeSpan(cgroup_buf));
+  if (!cgroup_contents.has_value()) {
+    return;
+  }
+  std::optional<absl::string_view> cgroup =
+      sysinfo_internal::ParseCgroupV2Path(*cgroup_contents);
+  if (!cgroup.has_value()) {
+    return;
+  }
+
+  constexpr absl::string_view kRoot = "/sys/fs/cgroup";
+  std::array<char, 4096> path;
+  std::array<char, 256> contents_buf;
+  absl::string_view dir = *cgroup;
+  while (!dir.empty() && dir != "/") {
+    if (kRoot.size() + dir.size() + file.size() >= path.size()) {
+      break;
+    }
+    char* p = path.data();
+    p = std::copy(kRoot.begin(), kRoot.end(), p);
+    p = std::copy(dir.begin(), dir.end(), p);
+    p = std::copy(file.begin(), file.end(), p);
+    *p = '\0';
+
+    const std::optional<absl::string_view> contents =
+        ReadSmallFile(path.data(), absl::MakeSpan(contents_buf));
+    if (contents.has_value()) {
+      f(*contents);
+    }
+
+    const size_t slash = dir.rfind('/');
+    if (slash == absl::string_view::npos) {
+      break;
+    }
+    dir = dir.substr(0, slash);
+  }
+}
+
+// Parses the CPU list in <contents>.
+std::optional<CpuSet> ParseCpulistContents(absl::string_view contents) {
+  return ParseCpulist([&](char* const buf, const size_t count) {
+    const size_t n = std::min(count, contents.size());
+    memcpy(buf, contents.data(), n);
+    contents.remove_prefix(n);
+    return static_cast<ssize_t>(n);
+  });
+}
 }  // namespace
 
 std::optional<CpuSet> ParseCpulist(
@@ -138,8 +215,170 @@ std::optional<int> NumPossibleCPUsNoCache() {
   return *max_so_far + 1;
 }
 
+std::optional<double> ParseCgroupCpuMax(absl::string_view contents) {
+  const size_t space = contents.find(' ');
+  if (space == absl::string_view::npos) {
+    return std::nullopt;
+  }
+  const absl::string_view quota_str = contents.substr(0, space);
+  absl::string_view period_str = contents.substr(space + 1);
+  if (!period_str.empty() && period_str.back() == '\n') {
+    period_str.remove_suffix(1);
+  }
+
+  int64_t quota, period;
+  if (quota_str == "max" || !absl::SimpleAtoi(quota_str, &quota) ||
+      !absl::SimpleAtoi(period_str, &period) || quota <= 0 || period <= 0) {
+    return std::nullopt;
+  }
+  return static_cast<double>(quota) / period;
+}
+
+std::optional<size_t> ParseCgroupMemoryLimit(absl::string_view contents) {
+  if (!contents.empty() && contents.back() == '\n') {
+    contents.remove_suffix(1);
+  }
+  uint64_t bytes;
+  if (contents == "max" || !absl::SimpleAtoi(contents, &bytes)) {
+    return std::nullopt;
+  }
+  return bytes;
+}
+
+std::optional<MemoryPressure> ParseMemoryPressure(absl::string_view contents) {
+  std::optional<MemoryPressure> pressure;
+  while (!contents.empty()) {
+    const size_t newline = contents.find('\n');
+    const absl::string_view line = contents.substr(0, newline);
+    const bool some = line.substr(0, 5) == "some ";
+    const bool full = line.substr(0, 5) == "full ";
+    constexpr absl::string_view kAvg10 = "avg10=";
+    const size_t avg10 = line.find(kAvg10);
+    if ((some || full) && avg10 != absl::string_view::npos) {
+      absl::string_view value = line.substr(avg10 + kAvg10.size());
+      value = value.substr(0, value.find(' '));
+      double percent;
+      if (!absl::SimpleAtod(value, &percent) || percent < 0) {
+        return std::nullopt;
+      }
+      if (!pressure.has_value()) {
+        pressure.emplace();
+      }
+      (some ? pressure->some_avg10 : pressure->full_avg10) = percent;
+    }
+    if (newline == absl::string_view::npos) {
+      break;
+    }
+    contents.remove_prefix(newline + 1);
+  }
+  return pressure;
+}
+
+std::optional<absl::string_view> ParseCgroupV2Path(
+    absl::string_view contents) {
+  while (!contents.empty()) {
+    const size_t newline = contents.find('\n');
+    const absl::string_view line = contents.substr(0, newline);
+    if (line.substr(0, 3) == "0::") {
+      return line.substr(3);
+    }
+    if (newline == absl::string_view::npos) {
+      break;
+    }
+    contents.remove_prefix(newline + 1);
+  }
+  return std::nullopt;
+}
+
 }  // namespace sysinfo_internal
 
+std::optional<int> NumEffectiveCPUs() {
+  CpuSet allowed;
+  if (!allowed.GetAffinity(0)) {
+    return std::nullopt;
+  }
+  int cpus = allowed.Count();
+
+  // A quota on any ancestor also limits this cgroup.
+  ForEachCgroupFile("/cpu.max", [&](absl::string_view cpu_max) {
+    if (std::optional<double> quota =
+            sysinfo_internal::ParseCgroupCpuMax(cpu_max)) {
+      cpus = std::min(cpus, static_cast<int>(std::ceil(*quota)));
+    }
+  });
+  return std::max(cpus, 1);
+}
+
+std::optional<CpuSet> UsableCPUs() {
+  std::array<char, 1024> buf;
+  const std::optional<absl::string_view> online = ReadSmallFile(
+      "/sys/devices/system/cpu/online", absl::MakeSpan(buf));
+  if (!online.has_value()) {
+    return std::nullopt;
+  }
+  std::optional<CpuSet> usable = ParseCpulistContents(*online);
+  if (!usable.has_value()) {
+    return std::nullopt;
+  }
+
+  // The effective cpuset of the innermost cgroup already accounts for those
+  // of its ancestors.
+  bool seen = false;
+  ForEachCgroupFile("/cpuset.cpus.effective", [&](absl::string_view cpus) {
+    // The kernel ends the list with a newline, which a list too long for the
+    // buffer is missing.
+    if (std::exchange(seen, true) || !absl::EndsWith(cpus, "\n")) {
+      return;
+    }
+    std::optional<CpuSet> cpuset = ParseCpulistContents(cpus);
+    if (!cpuset.has_value()) {
+      return;
+    }
+    for (int cpu = 0; cpu < kMaxCpus; ++cpu) {
+      if (!cpuset->IsSet(cpu)) {
+        usable->CLR(cpu);
+      }
+    }
+  });
+  return usable;
+}
+
+std::optional<size_t> CgroupMemoryLimit() {
+  std::optional<size_t> limit;
+  auto update = [&](absl::string_view contents) {
+    if (std::optional<size_t> bytes =
+            sysinfo_internal::ParseCgroupMemoryLimit(contents)) {
+      limit = std::min(limit.value_or(*bytes), *bytes);
+    }
+  };
+  ForEachCgroupFile("/memory.high", update);
+  ForEachCgroupFile("/memory.max", update);
+  return limit;
+}
+
+std::optional<MemoryPressure> ReadMemoryPressure() {
+  std::optional<MemoryPressure> result;
+  auto update = [&](absl::string_view contents) {
+    if (std::optional<MemoryPressure> pressure =
+            sysinfo_internal::ParseMemoryPressure(contents)) {
+      if (!result.has_value()) {
+        result = *pressure;
+      } else {
+        result->some_avg10 = std::max(result->some_avg10, pressure->some_avg10);
+        result->full_avg10 = std::max(result->full_avg10, pressure->full_avg10);
+      }
+    }
+  };
+
+  std::array<char, 256> buf;
+  if (std::optional<absl::string_view> contents =
+          ReadSmallFile("/proc/pressure/memory", absl::MakeSpan(buf))) {
+    update(*contents);
+  }
+  ForEachCgroupFile("/memory.pressure", update);
+  return result;
+}
+
 #endif  // __linux__
 
 }  // namespace tcmalloc_internal
@@ -24,6 +24,7 @@
 #include "absl/base/attributes.h"
 #include "absl/base/call_once.h"
 #include "absl/functional/function_ref.h"
+#include "absl/strings/string_view.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/cpu_utils.h"
 #include "tcmalloc/internal/logging.h"
@@ -47,6 +48,43 @@ namespace tcmalloc_internal {
 std::optional<CpuSet> ParseCpulist(
     absl::FunctionRef<ssize_t(char* buf, size_t count)> read);
 
+// Returns the number of CPUs this process can keep busy at once: the CPUs in
+// its affinity mask (which reflects its cpuset), further limited by the cgroup
+// v2 CPU bandwidth quota (cpu.max) of its cgroup or any ancestor, rounded up.
+// Returns std::nullopt if the affinity mask cannot be retrieved.
+//
+// The result of this function is not cached internally, so that changes to
+// the quota are observed.
+std::optional<int> NumEffectiveCPUs();
+
+// Returns the CPUs that threads of this process can currently run on: the
+// online CPUs, further limited to the effective cpuset of its cgroup v2 if
+// there is one.  Returns std::nullopt if the online CPUs cannot be read.
+//
+// The result of this function is not cached internally, so that CPU hotplug
+// and cpuset changes are observed.
+std::optional<CpuSet> UsableCPUs();
+
+// Returns the tightest cgroup v2 memory limit (memory.high or memory.max) of
+// this process's cgroup and its ancestors, in bytes, or std::nullopt if there
+// is none.
+//
+// The result of this function is not cached internally, so that changes to
+// the limits are observed.
+std::optional<size_t> CgroupMemoryLimit();
+
+// Memory pressure stall information (PSI): the percentage of the last 10
+// seconds in which some or all non-idle tasks were stalled on memory.
+struct MemoryPressure {
+  double some_avg10 = 0;
+  double full_avg10 = 0;
+};
+
+// Returns the highest memory pressure reported by /proc/pressure/memory (the
+// whole system) and the memory.pressure files of this process's cgroup v2 and
+// its ancestors, or std::nullopt if PSI is unavailable.
+std::optional<MemoryPressure> ReadMemoryPressure();
+
 namespace sysinfo_internal {
 
 // Returns the number of possible CPUs on the machine, including currently
@@ -55,6 +93,25 @@ namespace sysinfo_internal {
 // The result of this function is not cached internally.
 std::optional<int> NumPossibleCPUsNoCache();
 
+// Parses the contents of a cgroup v2 cpu.max file, "<quota> <period>", into
+// the number of CPUs the quota amounts to.  Returns std::nullopt if the quota
+// is "max" (unlimited) or the contents are malformed.
+std::optional<double> ParseCgroupCpuMax(absl::string_view contents);
+
+// Parses the contents of a cgroup v2 memory.high or memory.max file into a
+// number of bytes.  Returns std::nullopt if the limit is "max" (unlimited) or
+// the contents are malformed.
+std::optional<size_t> ParseCgroupMemoryLimit(absl::string_view contents);
+
+// Parses the avg10 values of the contents of a PSI memory file, such as
+// /proc/pressure/memory.  Returns std::nullopt if the contents are malformed
+// or report no avg10 value.
+std::optional<MemoryPressure> ParseMemoryPressure(absl::string_view contents);
+
+// Returns the cgroup v2 path ("0::<path>") from the contents of
+// /proc/<pid>/cgroup, or std::nullopt if there is none.
+std::optional<absl::string_view> ParseCgroupV2Path(absl::string_view contents);
+
 }  // namespace sysinfo_internal
 #endif  // __linux__
 
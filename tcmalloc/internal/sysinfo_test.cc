@@ -161,6 +161,95 @@ TEST(ParseCpulistTest, Random) {
   }
 }
 
+TEST(ParseCgroupCpuMaxTest, Quota) {
+  EXPECT_THAT(sysinfo_internal::ParseCgroupCpuMax("200000 100000\n"),
+              testing::Optional(2.0));
+  EXPECT_THAT(sysinfo_internal::ParseCgroupCpuMax("50000 100000"),
+              testing::Optional(0.5));
+}
+
+TEST(ParseCgroupCpuMaxTest, Unlimited) {
+  EXPECT_EQ(sysinfo_internal::ParseCgroupCpuMax("max 100000\n"),
+            std::nullopt);
+}
+
+TEST(ParseCgroupCpuMaxTest, Malformed) {
+  EXPECT_EQ(sysinfo_internal::ParseCgroupCpuMax(""), std::nullopt);
+  EXPECT_EQ(sysinfo_internal::ParseCgroupCpuMax("100000"), std::nullopt);
+  EXPECT_EQ(sysinfo_internal::ParseCgroupCpuMax("100000 0"), std::nullopt);
+  EXPECT_EQ(sysinfo_internal::ParseCgroupCpuMax("x 100000"), std::nullopt);
+}
+
+TEST(ParseCgroupMemoryLimitTest, Basic) {
+  EXPECT_THAT(sysinfo_internal::ParseCgroupMemoryLimit("1073741824\n"),
+              testing::Optional(size_t{1073741824}));
+  EXPECT_THAT(sysinfo_internal::ParseCgroupMemoryLimit("0"),
+              testing::Optional(size_t{0}));
+  EXPECT_EQ(sysinfo_internal::ParseCgroupMemoryLimit("max\n"), std::nullopt);
+  EXPECT_EQ(sysinfo_internal::ParseCgroupMemoryLimit(""), std::nullopt);
+  EXPECT_EQ(sysinfo_internal::ParseCgroupMemoryLimit("-1"), std::nullopt);
+}
+
+TEST(ParseMemoryPressureTest, Basic) {
+  const std::optional<MemoryPressure> pressure =
+      sysinfo_internal::ParseMemoryPressure(
+          "some avg10=1.50 avg60=0.75 avg300=0.10 total=12345\n"
+          "full avg10=0.25 avg60=0.10 avg300=0.01 total=678\n");
+  ASSERT_TRUE(pressure.has_value());
+  EXPECT_EQ(pressure->some_avg10, 1.5);
+  EXPECT_EQ(pressure->full_avg10, 0.25);
+
+  // Older kernels only report "some" for the whole system.
+  EXPECT_THAT(sysinfo_internal::ParseMemoryPressure(
+                  "some avg10=3.00 avg60=0.00 avg300=0.00 total=0"),
+              testing::Optional(testing::Field(&MemoryPressure::some_avg10,
+                                               3.0)));
+}
+
+TEST(ParseMemoryPressureTest, Malformed) {
+  EXPECT_EQ(sysinfo_internal::ParseMemoryPressure(""), std::nullopt);
+  EXPECT_EQ(sysinfo_internal::ParseMemoryPressure("some total=0\n"),
+            std::nullopt);
+  EXPECT_EQ(sysinfo_internal::ParseMemoryPressure("some avg10=x avg60=0\n"),
+            std::nullopt);
+}
+
+TEST(ParseCgroupV2PathTest, Basic) {
+  EXPECT_THAT(sysinfo_internal::ParseCgroupV2Path("0::/foo/bar\n"),
+              testing::Optional(absl::string_view("/foo/bar")));
+  // Hybrid hierarchies list the v1 controllers first.
+  EXPECT_THAT(sysinfo_internal::ParseCgroupV2Path(
+                  "12:cpu,cpuacct:/foo\n1:name=systemd:/bar\n0::/baz\n"),
+              testing::Optional(absl::string_view("/baz")));
+  EXPECT_EQ(sysinfo_internal::ParseCgroupV2Path("12:cpu,cpuacct:/foo\n"),
+            std::nullopt);
+  EXPECT_EQ(sysinfo_internal::ParseCgroupV2Path(""), std::nullopt);
+}
+
+TEST(NumEffectiveCPUs, BoundedByAffinity) {
+  CpuSet allowed;
+  ASSERT_TRUE(allowed.GetAffinity(0));
+  const std::optional<int> effective = NumEffectiveCPUs();
+  ASSERT_THAT(effective, testing::Ne(std::nullopt));
+  EXPECT_GE(*effective, 1);
+  EXPECT_LE(*effective, allowed.Count());
+}
+
+TEST(UsableCPUs, IncludesAllowedCPUs) {
+  const std::optional<CpuSet> usable = UsableCPUs();
+  if (!usable.has_value()) {
+    GTEST_SKIP() << "Online CPUs not available";
+  }
+  // We can only run on usable CPUs.
+  CpuSet allowed;
+  ASSERT_TRUE(allowed.GetAffinity(0));
+  for (int cpu = 0; cpu < kMaxCpus; ++cpu) {
+    if (allowed.IsSet(cpu)) {
+      EXPECT_TRUE(usable->IsSet(cpu)) << cpu;
+    }
+  }
+}
+
 TEST(NumCPUs, NoCache) {
   const int result = []() {
     AllocationGuard guard;
@@ -0,0 +1,131 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/transparent_hugepage.h"
+
+#include <fcntl.h>
+
+#include <cstddef>
+
+#include "absl/base/attributes.h"
+#include "absl/base/call_once.h"
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/util.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Returns the bracketed value in <contents>, or an empty string_view.
+absl::string_view SelectedValue(absl::string_view contents) {
+  const size_t open = contents.find('[');
+  if (open == absl::string_view::npos) {
+    return absl::string_view();
+  }
+  const size_t close = contents.find(']', open);
+  if (close == absl::string_view::npos) {
+    return absl::string_view();
+  }
+  return contents.substr(open + 1, close - open - 1);
+}
+
+// Reads up to <size> bytes of <path> into <buf>.  Returns an empty string_view
+// on failure.
+absl::string_view ReadSysfs(const char* path, char* buf, size_t size) {
+  const int fd = signal_safe_open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return absl::string_view();
+  }
+  size_t bytes_read;
+  const ssize_t rc = signal_safe_read(fd, buf, size, &bytes_read);
+  signal_safe_close(fd);
+  if (rc < 0) {
+    return absl::string_view();
+  }
+  return absl::string_view(buf, bytes_read);
+}
+
+}  // namespace
+
+ThpEnabled ParseThpEnabled(absl::string_view contents) {
+  const absl::string_view value = SelectedValue(contents);
+  if (value == "always") return ThpEnabled::kAlways;
+  if (value == "madvise") return ThpEnabled::kMadvise;
+  if (value == "never") return ThpEnabled::kNever;
+  return ThpEnabled::kUnknown;
+}
+
+ThpDefrag ParseThpDefrag(absl::string_view contents) {
+  const absl::string_view value = SelectedValue(contents);
+  if (value == "always") return ThpDefrag::kAlways;
+  if (value == "defer") return ThpDefrag::kDefer;
+  if (value == "defer+madvise") return ThpDefrag::kDeferMadvise;
+  if (value == "madvise") return ThpDefrag::kMadvise;
+  if (value == "never") return ThpDefrag::kNever;
+  return ThpDefrag::kUnknown;
+}
+
+absl::string_view ThpEnabledName(ThpEnabled enabled) {
+  switch (enabled) {
+    case ThpEnabled::kUnknown:
+      return "unknown";
+    case ThpEnabled::kAlways:
+      return "always";
+    case ThpEnabled::kMadvise:
+      return "madvise";
+    case ThpEnabled::kNever:
+      return "never";
+  }
+
+  ABSL_UNREACHABLE();
+}
+
+absl::string_view ThpDefragName(ThpDefrag defrag) {
+  switch (defrag) {
+    case ThpDefrag::kUnknown:
+      return "unknown";
+    case ThpDefrag::kAlways:
+      return "always";
+    case ThpDefrag::kDefer:
+      return "defer";
+    case ThpDefrag::kDeferMadvise:
+      return "defer+madvise";
+    case ThpDefrag::kMadvise:
+      return "madvise";
+    case ThpDefrag::kNever:
+      return "never";
+  }
+
+  ABSL_UNREACHABLE();
+}
+
+const ThpSettings& GetThpSettings() {
+  ABSL_CONST_INIT static absl::once_flag flag;
+  ABSL_CONST_INIT static ThpSettings settings;
+  absl::base_internal::LowLevelCallOnce(&flag, [&]() {
+    char buf[128];
+    settings.enabled = ParseThpEnabled(ReadSysfs(
+        "/sys/kernel/mm/transparent_hugepage/enabled", buf, sizeof(buf)));
+    settings.defrag = ParseThpDefrag(ReadSysfs(
+        "/sys/kernel/mm/transparent_hugepage/defrag", buf, sizeof(buf)));
+  });
+  return settings;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
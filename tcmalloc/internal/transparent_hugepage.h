@@ -0,0 +1,78 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_TRANSPARENT_HUGEPAGE_H_
+#define TCMALLOC_INTERNAL_TRANSPARENT_HUGEPAGE_H_
+
+#include "absl/strings/string_view.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// /sys/kernel/mm/transparent_hugepage/enabled
+enum class ThpEnabled {
+  kUnknown,
+  kAlways,
+  kMadvise,
+  kNever,
+};
+
+// /sys/kernel/mm/transparent_hugepage/defrag
+enum class ThpDefrag {
+  kUnknown,
+  kAlways,
+  kDefer,
+  kDeferMadvise,
+  kMadvise,
+  kNever,
+};
+
+// The kernel's transparent hugepage (THP) settings.
+struct ThpSettings {
+  ThpEnabled enabled = ThpEnabled::kUnknown;
+  ThpDefrag defrag = ThpDefrag::kUnknown;
+
+  // Whether memory may be backed by hugepages at all.  When the settings are
+  // unknown, THP is assumed to be available, as it was before they were read.
+  bool available() const { return enabled != ThpEnabled::kNever; }
+
+  // Whether memory meant for hugepages should be marked MADV_HUGEPAGE: the
+  // kernel then backs it with hugepages where it otherwise would not, or
+  // compacts memory to do so at fault time.
+  bool advise() const {
+    return enabled == ThpEnabled::kMadvise ||
+           (enabled == ThpEnabled::kAlways &&
+            (defrag == ThpDefrag::kMadvise ||
+             defrag == ThpDefrag::kDeferMadvise));
+  }
+};
+
+// Parses the contents of the sysfs files, which list the possible values with
+// the current one in brackets, e.g. "always [madvise] never".
+ThpEnabled ParseThpEnabled(absl::string_view contents);
+ThpDefrag ParseThpDefrag(absl::string_view contents);
+
+absl::string_view ThpEnabledName(ThpEnabled enabled);
+absl::string_view ThpDefragName(ThpDefrag defrag);
+
+// Returns the THP settings, read from sysfs the first time this is called.
+const ThpSettings& GetThpSettings();
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_TRANSPARENT_HUGEPAGE_H_
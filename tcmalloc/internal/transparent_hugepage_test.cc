@@ -0,0 +1,72 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/transparent_hugepage.h"
+
+#include "gtest/gtest.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+TEST(TransparentHugepageTest, ParseEnabled) {
+  EXPECT_EQ(ParseThpEnabled("[always] madvise never\n"), ThpEnabled::kAlways);
+  EXPECT_EQ(ParseThpEnabled("always [madvise] never\n"), ThpEnabled::kMadvise);
+  EXPECT_EQ(ParseThpEnabled("always madvise [never]\n"), ThpEnabled::kNever);
+  EXPECT_EQ(ParseThpEnabled(""), ThpEnabled::kUnknown);
+  EXPECT_EQ(ParseThpEnabled("always madvise never"), ThpEnabled::kUnknown);
+  EXPECT_EQ(ParseThpEnabled("[bogus"), ThpEnabled::kUnknown);
+}
+
+TEST(TransparentHugepageTest, ParseDefrag) {
+  EXPECT_EQ(ParseThpDefrag("always defer [defer+madvise] madvise never\n"),
+            ThpDefrag::kDeferMadvise);
+  EXPECT_EQ(ParseThpDefrag("always [defer] defer+madvise madvise never\n"),
+            ThpDefrag::kDefer);
+  EXPECT_EQ(ParseThpDefrag("always defer defer+madvise [madvise] never\n"),
+            ThpDefrag::kMadvise);
+  EXPECT_EQ(ParseThpDefrag(""), ThpDefrag::kUnknown);
+}
+
+TEST(TransparentHugepageTest, Policy) {
+  ThpSettings settings;
+  EXPECT_TRUE(settings.available());
+  EXPECT_FALSE(settings.advise());
+
+  settings.enabled = ThpEnabled::kMadvise;
+  EXPECT_TRUE(settings.available());
+  EXPECT_TRUE(settings.advise());
+
+  settings.enabled = ThpEnabled::kAlways;
+  settings.defrag = ThpDefrag::kDefer;
+  EXPECT_FALSE(settings.advise());
+  settings.defrag = ThpDefrag::kDeferMadvise;
+  EXPECT_TRUE(settings.advise());
+
+  settings.enabled = ThpEnabled::kNever;
+  EXPECT_FALSE(settings.available());
+  EXPECT_FALSE(settings.advise());
+}
+
+TEST(TransparentHugepageTest, Names) {
+  EXPECT_EQ(ThpEnabledName(ThpEnabled::kMadvise), "madvise");
+  EXPECT_EQ(ThpDefragName(ThpDefrag::kDeferMadvise), "defer+madvise");
+  // Whatever the host's settings, reading them succeeds or reports unknown.
+  const ThpSettings& settings = GetThpSettings();
+  EXPECT_EQ(&settings, &GetThpSettings());
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -0,0 +1,107 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// USDT (user-level statically defined tracing) probes on the allocator's slow
+// paths, for tracing tools such as bpftrace and perf.
+//
+// Binaries built with TCMALLOC_INTERNAL_USDT defined, which requires
+// <sys/sdt.h>, contain the probes below under the provider "tcmalloc".  Each
+// probe compiles to a nop, and arguments that cost anything to compute, such as
+// latencies, are only computed while a tracer is attached to the probe.
+// Without TCMALLOC_INTERNAL_USDT, the probes compile to nothing.
+//
+//   slow_path(tier, size_class, cycles): a slow path of tier <tier> (see
+//       SlowPathTier) took <cycles> CycleClock cycles.
+//   cpu_cache_refill(size_class, target, objects): a per-CPU cache underflow
+//       fetched <objects> of the <target> objects it wanted.
+//   cpu_cache_overflow(size_class, target, objects): a per-CPU cache overflow
+//       returned <objects> objects, for up to <target>.
+//   transfer_cache_miss(size_class, requested, objects): the central free
+//       list returned <objects> of <requested> objects.
+//   span_populate(size_class, objects_per_span, objects): the central free
+//       list carved a new span.
+//   page_alloc_new(pages, align, tag) and page_alloc_delete(pages,
+//       objects_per_span, tag): a span was requested from, or returned to, the
+//       page allocator.
+//   system_alloc(bytes, alignment, address): memory was requested from the
+//       system; <address> is null on failure.
+//   system_release(address, bytes, released): memory was returned to the
+//       system.
+//   page_release(requested_bytes, released_bytes, reason, cycles): a rate
+//       limited release, e.g. by the background thread, for a
+//       PageReleaseReason.
+//
+// For example:
+//   bpftrace -e 'usdt:<binary>:tcmalloc:slow_path { @[arg0] = hist(arg2); }'
+
+#ifndef TCMALLOC_INTERNAL_USDT_H_
+#define TCMALLOC_INTERNAL_USDT_H_
+
+#include "absl/base/optimization.h"
+#include "tcmalloc/internal/config.h"
+
+#define TCMALLOC_INTERNAL_USDT_PROBES(X) \
+  X(slow_path)                           \
+  X(cpu_cache_refill)                    \
+  X(cpu_cache_overflow)                  \
+  X(transfer_cache_miss)                 \
+  X(span_populate)                       \
+  X(page_alloc_new)                      \
+  X(page_alloc_delete)                   \
+  X(system_alloc)                        \
+  X(system_release)                      \
+  X(page_release)
+
+#ifdef TCMALLOC_INTERNAL_USDT
+
+#if !__has_include(<sys/sdt.h>)
+#error "TCMALLOC_INTERNAL_USDT requires <sys/sdt.h>"
+#endif
+
+// Each probe has a semaphore, which tracers increment while attached.
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+// The semaphores are referenced by name from the probes' notes, so must not be
+// mangled.  They are defined in usdt.cc.
+#define TCMALLOC_INTERNAL_USDT_DECLARE_SEMAPHORE(name) \
+  extern "C" volatile unsigned short tcmalloc_##name##_semaphore;
+TCMALLOC_INTERNAL_USDT_PROBES(TCMALLOC_INTERNAL_USDT_DECLARE_SEMAPHORE)
+#undef TCMALLOC_INTERNAL_USDT_DECLARE_SEMAPHORE
+
+#define TC_USDT_PROBE(name, ...) STAP_PROBEV(tcmalloc, name, __VA_ARGS__)
+// True while a tracer is attached to probe <name>.
+#define TC_USDT_ENABLED(name) \
+  ABSL_PREDICT_FALSE(tcmalloc_##name##_semaphore != 0)
+
+#else  // TCMALLOC_INTERNAL_USDT
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+template <typename... Args>
+constexpr int UsdtProbeArgs(const Args&...) {
+  return 0;
+}
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+
+// The arguments are not evaluated, but still type checked and counted as used.
+#define TC_USDT_PROBE(name, ...) \
+  static_cast<void>(             \
+      sizeof(::tcmalloc::tcmalloc_internal::UsdtProbeArgs(__VA_ARGS__)))
+#define TC_USDT_ENABLED(name) false
+
+#endif  // TCMALLOC_INTERNAL_USDT
+
+#endif  // TCMALLOC_INTERNAL_USDT_H_
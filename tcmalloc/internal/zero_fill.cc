@@ -0,0 +1,102 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/zero_fill.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+#if defined(__x86_64__) && defined(__SSE2__)
+
+// SSE2 is part of the x86-64 baseline, so there is nothing to detect.
+size_t ZeroBlockSize() { return 64; }
+
+// REQUIRES: <p> and <n> are multiples of ZeroBlockSize().
+void ZeroBlocks(char* p, size_t n) {
+  const __m128i zero = _mm_setzero_si128();
+  for (char* end = p + n; p < end; p += 64) {
+    _mm_stream_si128(reinterpret_cast<__m128i*>(p), zero);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(p + 16), zero);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(p + 32), zero);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(p + 48), zero);
+  }
+  // Non-temporal stores are weakly ordered.  Make sure they are visible
+  // before anything that publishes the buffer to another thread.
+  _mm_sfence();
+}
+
+#elif defined(__aarch64__)
+
+// DCZID_EL0 is readable from userspace.  Its DZP bit is set when DC ZVA is
+// prohibited; otherwise its low bits are log2 of the block size in words.
+size_t ZeroBlockSize() {
+  uint64_t dczid;
+  __asm__("mrs %0, dczid_el0" : "=r"(dczid));
+  if (dczid & (1 << 4)) {
+    return 0;
+  }
+  return size_t{4} << (dczid & 0xf);
+}
+
+// REQUIRES: <p> and <n> are multiples of ZeroBlockSize().
+void ZeroBlocks(char* p, size_t n) {
+  const size_t block = ZeroBlockSize();
+  for (char* end = p + n; p < end; p += block) {
+    __asm__ volatile("dc zva, %0" : : "r"(p) : "memory");
+  }
+}
+
+#else
+
+size_t ZeroBlockSize() { return 0; }
+
+void ZeroBlocks(char* p, size_t n) { memset(p, 0, n); }
+
+#endif
+
+}  // namespace
+
+void ZeroFillNonTemporal(void* ptr, size_t size) {
+  const size_t block = ZeroBlockSize();
+  if (block == 0 || size < 2 * block) {
+    memset(ptr, 0, size);
+    return;
+  }
+
+  const uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+  const uintptr_t limit = start + size;
+  const uintptr_t aligned_start = (start + block - 1) & ~(block - 1);
+  const uintptr_t aligned_limit = limit & ~(block - 1);
+  // The unaligned head and tail are at most a block each.
+  memset(ptr, 0, aligned_start - start);
+  ZeroBlocks(reinterpret_cast<char*>(aligned_start),
+             aligned_limit - aligned_start);
+  memset(reinterpret_cast<void*>(aligned_limit), 0, limit - aligned_limit);
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,53 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_ZERO_FILL_H_
+#define TCMALLOC_INTERNAL_ZERO_FILL_H_
+
+#include <stddef.h>
+#include <string.h>
+
+#include "absl/base/optimization.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Buffers of at least this many bytes are zeroed without pulling them into the
+// processor's caches.  Zeroing them with memset would evict a comparable
+// amount of other, likely hotter, data from the last level cache, while the
+// caller rarely reads more than the start of such a buffer soon afterwards.
+inline constexpr size_t kNonTemporalZeroFillThreshold = size_t{1} << 20;
+
+// Zeroes <size> bytes at <ptr>, bypassing the caches where the processor
+// supports it: with non-temporal stores on x86, and with DC ZVA on AArch64
+// when it is permitted.  Falls back to memset otherwise.
+void ZeroFillNonTemporal(void* ptr, size_t size);
+
+// Zeroes <size> bytes at <ptr>, choosing between memset and
+// ZeroFillNonTemporal by size.
+inline void ZeroFill(void* ptr, size_t size) {
+  if (ABSL_PREDICT_TRUE(size < kNonTemporalZeroFillThreshold)) {
+    memset(ptr, 0, size);
+    return;
+  }
+  ZeroFillNonTemporal(ptr, size);
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_ZERO_FILL_H_
@@ -0,0 +1,62 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/zero_fill.h"
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Zeroes [offset, offset + size) of a buffer filled with a pattern, and
+// checks that exactly those bytes were zeroed.
+void CheckZeroFill(size_t offset, size_t size, bool non_temporal) {
+  constexpr char kPattern = 0x5a;
+  const size_t kGuard = 256;
+  std::vector<char> buf(offset + size + kGuard, kPattern);
+  if (non_temporal) {
+    ZeroFillNonTemporal(buf.data() + offset, size);
+  } else {
+    ZeroFill(buf.data() + offset, size);
+  }
+  for (size_t i = 0; i < buf.size(); ++i) {
+    const bool zeroed = i >= offset && i < offset + size;
+    ASSERT_EQ(buf[i], zeroed ? 0 : kPattern)
+        << "offset=" << offset << " size=" << size << " i=" << i;
+  }
+}
+
+TEST(ZeroFillTest, NonTemporal) {
+  for (size_t offset : {0, 1, 15, 64, 100}) {
+    for (size_t size : {0, 1, 63, 64, 65, 128, 4095, 4096, 12345, 65536}) {
+      CheckZeroFill(offset, size, /*non_temporal=*/true);
+    }
+  }
+}
+
+TEST(ZeroFillTest, AboveThreshold) {
+  for (size_t offset : {0, 8, 33}) {
+    CheckZeroFill(offset, kNonTemporalZeroFillThreshold + 100,
+                  /*non_temporal=*/false);
+  }
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -24,8 +24,10 @@
 #include <cstdint>
 #include <map>
 #include <memory>
+#include <new>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/base/attributes.h"
 #include "absl/time/time.h"
@@ -45,6 +47,14 @@ class AllocationProfilingTokenAccessor {
   }
 };
 
+class HeapProfileCursorAccessor {
+ public:
+  static MallocExtension::HeapProfileCursor MakeCursor(
+      std::unique_ptr<HeapProfileCursorBase> p) {
+    return MallocExtension::HeapProfileCursor(std::move(p));
+  }
+};
+
 class ProfileAccessor {
  public:
   static Profile MakeProfile(std::unique_ptr<const ProfileBase> p) {
@@ -68,17 +78,24 @@ ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetRegionFactory(
 
 ABSL_ATTRIBUTE_WEAK const tcmalloc::tcmalloc_internal::ProfileBase*
 MallocExtension_Internal_SnapshotCurrent(tcmalloc::ProfileType type);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SnapshotTopPeakHeaps(
+    std::vector<tcmalloc::MallocExtension::PeakHeapProfile>* result);
 
 ABSL_ATTRIBUTE_WEAK tcmalloc::tcmalloc_internal::AllocationProfilingTokenBase*
 MallocExtension_Internal_StartAllocationProfiling();
 ABSL_ATTRIBUTE_WEAK tcmalloc::tcmalloc_internal::AllocationProfilingTokenBase*
 MallocExtension_Internal_StartLifetimeProfiling();
+ABSL_ATTRIBUTE_WEAK tcmalloc::tcmalloc_internal::HeapProfileCursorBase*
+MallocExtension_Internal_StartHeapProfileCursor();
 
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ActivateGuardedSampling();
 ABSL_ATTRIBUTE_WEAK tcmalloc::MallocExtension::Ownership
 MallocExtension_Internal_GetOwnership(const void* ptr);
 ABSL_ATTRIBUTE_WEAK size_t MallocExtension_Internal_GetMemoryLimit(
     tcmalloc::MallocExtension::LimitKind limit_kind);
+ABSL_ATTRIBUTE_WEAK size_t MallocExtension_Internal_GetHeapMemoryLimit(
+    tcmalloc::MallocExtension::MemoryHeap heap, int numa_partition,
+    tcmalloc::MallocExtension::LimitKind limit_kind);
 ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_GetNumericProperty(
     const char* name_data, size_t name_size, size_t* value);
 ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_GetPerCpuCachesActive();
@@ -103,6 +120,15 @@ ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetProperties(
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetExperiments(
     std::map<std::string, tcmalloc::MallocExtension::Property>* ret);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetStats(std::string* ret);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetSummaryStats(
+    std::string* ret);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_WarmUp(
+    const tcmalloc::MallocExtension::WarmUpBucket* buckets, size_t num_buckets,
+    bool per_cpu_caches);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ExportTuningState(
+    std::string* ret);
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_ImportTuningState(
+    const char* data, size_t size);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetMaxPerCpuCacheSize(
     int32_t value);
 ABSL_ATTRIBUTE_WEAK void
@@ -125,11 +151,67 @@ MallocExtension_Internal_SetCacheDemandReleaseLongInterval(
 ABSL_ATTRIBUTE_WEAK size_t MallocExtension_Internal_ReleaseCpuMemory(int cpu);
 ABSL_ATTRIBUTE_WEAK size_t
 MallocExtension_Internal_ReleaseMemoryToSystem(size_t bytes);
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_ReleaseMemoryToSystemAsync(
+    size_t bytes, tcmalloc::MallocExtension::ReleaseCallback callback,
+    void* arg);
+ABSL_ATTRIBUTE_WEAK size_t MallocExtension_Internal_Reserve(size_t bytes,
+                                                            bool populate);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_PrepareForAllocation(
+    size_t bytes, tcmalloc::hot_cold_t hot_cold);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_RequestMemoryRelease(
+    size_t bytes, absl::Duration within,
+    tcmalloc::MallocExtension::CacheShrinkLevel level);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetMemoryLimit(
     size_t limit, tcmalloc::MallocExtension::LimitKind limit_kind);
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_SetHeapMemoryLimit(
+    tcmalloc::MallocExtension::MemoryHeap heap, int numa_partition,
+    size_t limit, tcmalloc::MallocExtension::LimitKind limit_kind);
+ABSL_ATTRIBUTE_WEAK bool
+MallocExtension_Internal_RegisterMemoryPressureCallback(
+    tcmalloc::MallocExtension::MemoryPressureCallback callback);
+ABSL_ATTRIBUTE_WEAK void
+MallocExtension_Internal_UnregisterMemoryPressureCallback(
+    tcmalloc::MallocExtension::MemoryPressureCallback callback);
+
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_RegisterReclaimCallback(
+    tcmalloc::MallocExtension::ReclaimCallback callback, void* arg);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_UnregisterReclaimCallback(
+    tcmalloc::MallocExtension::ReclaimCallback callback, void* arg);
 
 ABSL_ATTRIBUTE_WEAK size_t
 MallocExtension_Internal_GetAllocatedSize(const void* ptr);
+ABSL_ATTRIBUTE_WEAK size_t
+MallocExtension_Internal_TryResizeInPlace(void* ptr, size_t size);
+ABSL_ATTRIBUTE_WEAK size_t MallocExtension_Internal_AllocateBatch(size_t size,
+                                                                 void** batch,
+                                                                 size_t n);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_DeallocateBatch(void** batch,
+                                                                  size_t n);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_DeallocateSizedBatch(
+    void** batch, size_t n, size_t size);
+ABSL_ATTRIBUTE_WEAK uint32_t MallocExtension_Internal_GetSizeClassHandle(
+    size_t size, std::align_val_t alignment, tcmalloc::hot_cold_t hot_cold);
+ABSL_ATTRIBUTE_WEAK void* MallocExtension_Internal_AllocateWithHandle(
+    size_t size, std::align_val_t alignment, tcmalloc::hot_cold_t hot_cold,
+    uint32_t size_class);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_DeallocateWithHandle(
+    void* p, size_t size, std::align_val_t alignment, uint32_t size_class);
+ABSL_ATTRIBUTE_WEAK void* MallocExtension_Internal_AllocateInterleaved(
+    size_t size);
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_SetRegisteredMemoryFactory(
+    tcmalloc::AddressRegionFactory* factory,
+    tcmalloc::MallocExtension::RegisterMemoryCallback callback);
+ABSL_ATTRIBUTE_WEAK void* MallocExtension_Internal_AllocateRegistered(
+    size_t size);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_DeallocateRegistered(
+    void* ptr, size_t size);
+ABSL_ATTRIBUTE_WEAK tcmalloc::tcmalloc_internal::UserHeap*
+MallocExtension_Internal_CreateHeap();
+ABSL_ATTRIBUTE_WEAK void* MallocExtension_Internal_HeapAllocate(
+    tcmalloc::tcmalloc_internal::UserHeap* heap, size_t size,
+    std::align_val_t alignment);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_DestroyHeap(
+    tcmalloc::tcmalloc_internal::UserHeap* heap);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_MarkThreadBusy();
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_MarkThreadIdle();
 
@@ -137,8 +219,21 @@ ABSL_ATTRIBUTE_WEAK int64_t
 MallocExtension_Internal_GetProfileSamplingInterval();
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetProfileSamplingInterval(
     int64_t);
+ABSL_ATTRIBUTE_WEAK uint64_t MallocExtension_Internal_GetAllocationContext();
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetAllocationContext(
+    uint64_t context);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetAllocationBudget(
+    size_t bytes);
+ABSL_ATTRIBUTE_WEAK size_t MallocExtension_Internal_GetAllocationBudgetUsage();
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetAllocationBudgetCallback(
+    tcmalloc::MallocExtension::AllocationBudgetCallback callback);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SwapAllocationTaskState(
+    tcmalloc::MallocExtension::AllocationTaskState* state);
 
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ProcessBackgroundActions();
+ABSL_ATTRIBUTE_WEAK int MallocExtension_Internal_GetNumNumaPartitions();
+ABSL_ATTRIBUTE_WEAK void
+MallocExtension_Internal_ProcessNumaPartitionBackgroundActions(int partition);
 
 ABSL_ATTRIBUTE_WEAK tcmalloc::MallocExtension::BytesPerSecond
 MallocExtension_Internal_GetBackgroundReleaseRate();
@@ -30,6 +30,10 @@ ABSL_ATTRIBUTE_WEAK
 absl::StatusOr<tcmalloc::malloc_tracing_extension::AllocatedAddressRanges>
 MallocTracingExtension_Internal_GetAllocatedAddressRanges();
 
+ABSL_ATTRIBUTE_WEAK
+absl::StatusOr<tcmalloc::malloc_tracing_extension::AllocationTrace>
+MallocTracingExtension_Internal_DrainAllocationTrace();
+
 #endif
 
 #endif  // TCMALLOC_INTERNAL_MALLOC_TRACING_EXTENSION_H_
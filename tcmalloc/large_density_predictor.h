@@ -0,0 +1,120 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_LARGE_DENSITY_PREDICTOR_H_
+#define TCMALLOC_LARGE_DENSITY_PREDICTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/attributes.h"
+#include "absl/numeric/bits.h"
+#include "absl/time/time.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Predicts the access density of large allocations from the sampled lifetimes
+// of earlier large allocations of about the same size.
+//
+// Large allocations are bucketed by the bit width of their number of pages.
+// Each bucket counts the sampled allocations that were freed before
+// kLongLivedThreshold and those that outlived it; a bucket whose allocations
+// are mostly long-lived is predicted dense, so that its spans are placed on
+// the filler's dense hugepages, instead of fragmenting the sparse ones that
+// short-lived allocations come and go from.  Allocations that are still live
+// are not counted, which errs towards the sparse default.
+//
+// Thread-safe: it is updated as sampled allocations are freed, without
+// pageheap_lock.
+class LargeDensityPredictor {
+ public:
+  static constexpr int kNumBuckets = 64;
+  static constexpr absl::Duration kLongLivedThreshold = absl::Seconds(1);
+  // A bucket needs this many recorded lifetimes before it is predicted dense.
+  static constexpr uint32_t kMinSamples = 8;
+  // A bucket is dense when it has at least this many long-lived allocations
+  // for each short-lived one.
+  static constexpr uint32_t kDenseRatio = 4;
+  // Counts are halved when a bucket reaches this many samples, so that
+  // predictions follow changes in behavior.
+  static constexpr uint32_t kMaxSamples = 256;
+
+  constexpr LargeDensityPredictor() = default;
+
+  AccessDensityPrediction Predict(Length n) const {
+    const Counts counts =
+        Unpack(buckets_[Bucket(n)].load(std::memory_order_relaxed));
+    if (counts.short_lived + counts.long_lived < kMinSamples ||
+        counts.long_lived < kDenseRatio * counts.short_lived) {
+      return AccessDensityPrediction::kSparse;
+    }
+    return AccessDensityPrediction::kDense;
+  }
+
+  // Records that an allocation of <n> pages was freed after <lifetime>.
+  void Record(Length n, absl::Duration lifetime) {
+    const bool long_lived = lifetime >= kLongLivedThreshold;
+    std::atomic<uint32_t>& bucket = buckets_[Bucket(n)];
+    uint32_t packed = bucket.load(std::memory_order_relaxed);
+    Counts counts;
+    do {
+      counts = Unpack(packed);
+      if (long_lived) {
+        ++counts.long_lived;
+      } else {
+        ++counts.short_lived;
+      }
+      if (counts.short_lived + counts.long_lived >= kMaxSamples) {
+        counts.short_lived /= 2;
+        counts.long_lived /= 2;
+      }
+    } while (!bucket.compare_exchange_weak(packed, Pack(counts),
+                                           std::memory_order_relaxed));
+  }
+
+ private:
+  struct Counts {
+    uint32_t short_lived;
+    uint32_t long_lived;
+  };
+
+  static int Bucket(Length n) { return absl::bit_width(n.raw_num()) - 1; }
+
+  static Counts Unpack(uint32_t packed) {
+    return {.short_lived = packed & 0xffff, .long_lived = packed >> 16};
+  }
+  static uint32_t Pack(Counts counts) {
+    return counts.short_lived | (counts.long_lived << 16);
+  }
+
+  std::atomic<uint32_t> buckets_[kNumBuckets] = {};
+};
+
+inline LargeDensityPredictor& large_density_predictor() {
+  ABSL_CONST_INIT static LargeDensityPredictor predictor;
+  return predictor;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_LARGE_DENSITY_PREDICTOR_H_
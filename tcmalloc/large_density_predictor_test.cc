@@ -0,0 +1,71 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/large_density_predictor.h"
+
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+constexpr absl::Duration kLong = LargeDensityPredictor::kLongLivedThreshold;
+constexpr absl::Duration kShort = absl::Milliseconds(1);
+
+TEST(LargeDensityPredictorTest, PredictsLongLivedSizesDense) {
+  LargeDensityPredictor predictor;
+  EXPECT_EQ(predictor.Predict(Length(40)), AccessDensityPrediction::kSparse);
+
+  for (int i = 0; i < LargeDensityPredictor::kMinSamples - 1; ++i) {
+    predictor.Record(Length(40), kLong);
+  }
+  // Not enough samples yet.
+  EXPECT_EQ(predictor.Predict(Length(40)), AccessDensityPrediction::kSparse);
+  predictor.Record(Length(40), kLong);
+  EXPECT_EQ(predictor.Predict(Length(40)), AccessDensityPrediction::kDense);
+  // Sizes of the same bit width share the prediction, others do not.
+  EXPECT_EQ(predictor.Predict(Length(63)), AccessDensityPrediction::kDense);
+  EXPECT_EQ(predictor.Predict(Length(64)), AccessDensityPrediction::kSparse);
+  EXPECT_EQ(predictor.Predict(Length(31)), AccessDensityPrediction::kSparse);
+}
+
+TEST(LargeDensityPredictorTest, ShortLivedAllocationsStaySparse) {
+  LargeDensityPredictor predictor;
+  for (int i = 0; i < 100; ++i) {
+    predictor.Record(Length(100), kLong);
+    predictor.Record(Length(100), kShort);
+  }
+  EXPECT_EQ(predictor.Predict(Length(100)), AccessDensityPrediction::kSparse);
+}
+
+TEST(LargeDensityPredictorTest, FollowsChanges) {
+  LargeDensityPredictor predictor;
+  for (int i = 0; i < LargeDensityPredictor::kMaxSamples; ++i) {
+    predictor.Record(Length(200), kLong);
+  }
+  EXPECT_EQ(predictor.Predict(Length(200)), AccessDensityPrediction::kDense);
+  // The counts are halved as they saturate, so that short-lived allocations
+  // win the bucket back.
+  for (int i = 0; i < LargeDensityPredictor::kMaxSamples; ++i) {
+    predictor.Record(Length(200), kShort);
+  }
+  EXPECT_EQ(predictor.Predict(Length(200)), AccessDensityPrediction::kSparse);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
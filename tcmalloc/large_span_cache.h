@@ -0,0 +1,170 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A small cache of freed large spans in front of a page heap, guarded by its
+// own lock rather than pageheap_lock.
+#ifndef TCMALLOC_LARGE_SPAN_CACHE_H_
+#define TCMALLOC_LARGE_SPAN_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/attributes.h"
+#include "absl/base/const_init.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Services that repeatedly allocate and free buffers of the same large size
+// serialize on pageheap_lock for both operations.  LargeSpanCache keeps a few
+// such spans, still backed and still registered in the pagemap, so that a
+// subsequent allocation of exactly the same length is served without taking
+// pageheap_lock at all.
+//
+// Cached spans remain allocated as far as the underlying page heap is
+// concerned.  Drain hands them back to it; callers do so ahead of releasing
+// memory, so that a cache which is not being reused never pins memory for
+// long.
+class LargeSpanCache {
+ public:
+  // Lengths outside of [kMinLength, kMaxLength] are not cached: smaller
+  // lengths are mostly served by the central freelists, and larger ones are
+  // rare enough that pageheap_lock is not a bottleneck for them.
+  static constexpr Length kMinLength = BytesToLengthCeil(size_t{64} << 10);
+  static constexpr Length kMaxLength = BytesToLengthFloor(size_t{2} << 20);
+  static constexpr size_t kMaxSpans = 8;
+  static constexpr size_t kMaxBytes = size_t{16} << 20;
+
+  constexpr LargeSpanCache() = default;
+
+  LargeSpanCache(const LargeSpanCache&) = delete;
+  LargeSpanCache& operator=(const LargeSpanCache&) = delete;
+
+  // Limits the bytes in cached spans to <max_bytes> rather than kMaxBytes.
+  // REQUIRES: no spans are cached.
+  void Init(size_t max_bytes) { max_bytes_ = max_bytes; }
+
+  // Takes ownership of <span> if it fits.  Returns false, leaving <span> to
+  // the caller, otherwise.
+  bool Put(Span* span) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Returns a cached span of exactly <n> pages whose first page is aligned to
+  // <align> pages, or nullptr if there is none.
+  Span* Get(Length n, Length align) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Removes cached spans and passes each of them to <f>, after dropping the
+  // cache's lock.  If <all> is false, only spans that were cached before the
+  // previous call to Drain are removed.
+  template <typename F>
+  void Drain(bool all, F f) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Bytes in cached spans.
+  size_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Entry {
+    Span* span;
+    uint32_t generation;
+  };
+
+  absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  Entry entries_[kMaxSpans] ABSL_GUARDED_BY(lock_) = {};
+  size_t size_ ABSL_GUARDED_BY(lock_) = 0;
+  // Incremented by each Drain, to tell the spans cached since then apart.
+  uint32_t generation_ ABSL_GUARDED_BY(lock_) = 0;
+  std::atomic<size_t> bytes_{0};
+  size_t max_bytes_ = kMaxBytes;
+};
+
+inline bool LargeSpanCache::Put(Span* span) {
+  const Length n = span->num_pages();
+  if (n < kMinLength || n > kMaxLength) {
+    return false;
+  }
+  TC_ASSERT(!span->sampled());
+
+  absl::base_internal::SpinLockHolder h(&lock_);
+  if (size_ == kMaxSpans || bytes() + n.in_bytes() > max_bytes_) {
+    return false;
+  }
+  for (size_t i = 0; i < size_; ++i) {
+    TC_CHECK_NE(entries_[i].span, span, "Possible double free detected");
+  }
+  entries_[size_++] = {span, generation_};
+  bytes_.store(bytes() + n.in_bytes(), std::memory_order_relaxed);
+  return true;
+}
+
+inline Span* LargeSpanCache::Get(Length n, Length align) {
+  if (n < kMinLength || n > kMaxLength) {
+    return nullptr;
+  }
+
+  absl::base_internal::SpinLockHolder h(&lock_);
+  // Prefer the most recently cached spans, which are the most likely to still
+  // be in the processor's caches.
+  for (size_t i = size_; i-- > 0;) {
+    Span* span = entries_[i].span;
+    if (span->num_pages() != n ||
+        (align > Length(1) &&
+         span->first_page().index() % align.raw_num() != 0)) {
+      continue;
+    }
+    entries_[i] = entries_[--size_];
+    bytes_.store(bytes() - n.in_bytes(), std::memory_order_relaxed);
+    return span;
+  }
+  return nullptr;
+}
+
+template <typename F>
+inline void LargeSpanCache::Drain(bool all, F f) {
+  Span* drained[kMaxSpans];
+  size_t num_drained = 0;
+  {
+    absl::base_internal::SpinLockHolder h(&lock_);
+    size_t kept = 0;
+    for (size_t i = 0; i < size_; ++i) {
+      if (all || entries_[i].generation != generation_) {
+        drained[num_drained++] = entries_[i].span;
+        bytes_.store(bytes() - entries_[i].span->num_pages().in_bytes(),
+                     std::memory_order_relaxed);
+      } else {
+        entries_[kept++] = entries_[i];
+      }
+    }
+    size_ = kept;
+    ++generation_;
+  }
+  for (size_t i = 0; i < num_drained; ++i) {
+    f(drained[i]);
+  }
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_LARGE_SPAN_CACHE_H_
@@ -0,0 +1,130 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/large_span_cache.h"
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+using ::testing::UnorderedElementsAre;
+
+class LargeSpanCacheTest : public testing::Test {
+ protected:
+  // Returns a span of <n> pages, the first of which is page <p>.
+  Span* MakeSpan(size_t p, Length n) {
+    TC_CHECK_LT(num_spans_, kMaxSpans);
+    Span* span = &spans_[num_spans_++];
+    span->Init(PageId{p}, n);
+    return span;
+  }
+
+  std::vector<Span*> Drain(bool all) {
+    std::vector<Span*> drained;
+    cache_.Drain(all, [&](Span* span) { drained.push_back(span); });
+    return drained;
+  }
+
+  LargeSpanCache cache_;
+
+ private:
+  static constexpr size_t kMaxSpans = 16;
+  Span spans_[kMaxSpans];
+  size_t num_spans_ = 0;
+};
+
+TEST_F(LargeSpanCacheTest, ReusesExactLength) {
+  const Length n = LargeSpanCache::kMinLength;
+  Span* span = MakeSpan(1024, n);
+  ASSERT_TRUE(cache_.Put(span));
+  EXPECT_EQ(cache_.bytes(), n.in_bytes());
+
+  EXPECT_EQ(cache_.Get(n + Length(1), Length(1)), nullptr);
+  EXPECT_EQ(cache_.Get(n, Length(1)), span);
+  EXPECT_EQ(cache_.bytes(), 0);
+  EXPECT_EQ(cache_.Get(n, Length(1)), nullptr);
+}
+
+TEST_F(LargeSpanCacheTest, RespectsAlignment) {
+  const Length n = LargeSpanCache::kMinLength;
+  Span* span = MakeSpan(1025, n);
+  ASSERT_TRUE(cache_.Put(span));
+  EXPECT_EQ(cache_.Get(n, Length(2)), nullptr);
+  EXPECT_EQ(cache_.Get(n, Length(1)), span);
+}
+
+TEST_F(LargeSpanCacheTest, RejectsOtherLengths) {
+  if (LargeSpanCache::kMinLength > Length(1)) {
+    EXPECT_FALSE(
+        cache_.Put(MakeSpan(1024, LargeSpanCache::kMinLength - Length(1))));
+  }
+  EXPECT_FALSE(
+      cache_.Put(MakeSpan(2048, LargeSpanCache::kMaxLength + Length(1))));
+  EXPECT_EQ(cache_.bytes(), 0);
+}
+
+TEST_F(LargeSpanCacheTest, Bounded) {
+  const Length n = LargeSpanCache::kMaxLength;
+  size_t cached = 0;
+  while (cache_.Put(MakeSpan(1024 + cached * n.raw_num(), n))) {
+    ++cached;
+  }
+  EXPECT_GT(cached, 0);
+  EXPECT_LE(cached, LargeSpanCache::kMaxSpans);
+  EXPECT_LE(cache_.bytes(), LargeSpanCache::kMaxBytes);
+  EXPECT_EQ(Drain(/*all=*/true).size(), cached);
+  EXPECT_EQ(cache_.bytes(), 0);
+}
+
+TEST_F(LargeSpanCacheTest, LimitsBytes) {
+  const Length n = LargeSpanCache::kMaxLength;
+  cache_.Init(n.in_bytes());
+  EXPECT_TRUE(cache_.Put(MakeSpan(1024, n)));
+  EXPECT_FALSE(cache_.Put(MakeSpan(1024 + n.raw_num(), n)));
+  EXPECT_EQ(cache_.bytes(), n.in_bytes());
+}
+
+TEST_F(LargeSpanCacheTest, DrainsUnusedSpans) {
+  const Length n = LargeSpanCache::kMinLength;
+  Span* old_span = MakeSpan(1024, n);
+  ASSERT_TRUE(cache_.Put(old_span));
+  // Nothing was cached before the first drain.
+  EXPECT_THAT(Drain(/*all=*/false), UnorderedElementsAre());
+
+  Span* new_span = MakeSpan(2048, n);
+  ASSERT_TRUE(cache_.Put(new_span));
+  EXPECT_THAT(Drain(/*all=*/false), UnorderedElementsAre(old_span));
+  EXPECT_EQ(cache_.bytes(), n.in_bytes());
+
+  // Reusing a span keeps it in the cache for another drain.
+  ASSERT_EQ(cache_.Get(n, Length(1)), new_span);
+  ASSERT_TRUE(cache_.Put(new_span));
+  EXPECT_THAT(Drain(/*all=*/false), UnorderedElementsAre());
+  EXPECT_THAT(Drain(/*all=*/false), UnorderedElementsAre(new_span));
+  EXPECT_EQ(cache_.bytes(), 0);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -0,0 +1,128 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/leak_detector.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/time/time.h"
+#include "tcmalloc/internal/allocation_guard.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/sampled_allocation.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/sampler.h"
+#include "tcmalloc/stack_trace_table.h"
+#include "tcmalloc/static_vars.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// The key of the stack of <sample>, never 0.
+size_t StackKey(const SampledAllocation& sample) {
+  const size_t hash =
+      sample.depot_stack != nullptr ? sample.depot_stack->hash() : 0;
+  return hash != 0 ? hash : 1;
+}
+
+}  // namespace
+
+LeakDetector::Stack* LeakDetector::Find(Stack* table, size_t hash) {
+  static_assert((kMaxStacks & (kMaxStacks - 1)) == 0);
+  for (size_t i = 0; i < kMaxStacks; ++i) {
+    Stack& slot = table[(hash + i) & (kMaxStacks - 1)];
+    if (slot.hash == hash || slot.hash == 0) return &slot;
+  }
+  return nullptr;
+}
+
+void LeakDetector::Update(absl::Time now) {
+  AllocationGuardSpinLockHolder h(&lock_);
+  Stack* previous = tables_[current_];
+  current_ ^= 1;
+  Stack* table = tables_[current_];
+  for (size_t i = 0; i < kMaxStacks; ++i) {
+    table[i] = {};
+  }
+
+  Stats stats = {};
+  tc_globals.sampled_allocation_recorder().Iterate(
+      [&](const SampledAllocation& sample) {
+        Stack* stack = Find(table, StackKey(sample));
+        if (stack == nullptr) {
+          ++stats.dropped_samples;
+          return;
+        }
+        if (stack->hash == 0) {
+          stack->hash = StackKey(sample);
+          ++stats.tracked_stacks;
+        }
+        stack->bytes +=
+            static_cast<int64_t>(AllocatedBytes(sample.sampled_stack) + 0.5);
+      });
+
+  for (size_t i = 0; i < kMaxStacks; ++i) {
+    Stack& stack = table[i];
+    if (stack.hash == 0) continue;
+    // A stack that was not tracked before has nothing to grow from.
+    const Stack* before = Find(previous, stack.hash);
+    if (before == nullptr || before->hash == 0) continue;
+    if (stack.bytes > before->bytes) {
+      stack.growths = before->growths + 1;
+    } else if (stack.bytes == before->bytes) {
+      // Slow leaks are not sampled between every pair of updates.
+      stack.growths = before->growths;
+    }
+    if (stack.growths >= kMinGrowths) {
+      ++stats.candidate_stacks;
+      stats.candidate_bytes += stack.bytes;
+    }
+  }
+  stats_ = stats;
+  last_update_ = now;
+}
+
+std::unique_ptr<ProfileBase> LeakDetector::DumpCandidates() {
+  auto profile =
+      std::make_unique<StackTraceTable>(ProfileType::kLeakCandidates);
+
+  AllocationGuardSpinLockHolder h(&lock_);
+  if (stats_.candidate_stacks == 0) return profile;
+  Stack* table = tables_[current_];
+  tc_globals.sampled_allocation_recorder().Iterate(
+      [&](const SampledAllocation& sample) {
+        if (sample.sampled_stack.allocation_time > last_update_) return;
+        const Stack* stack = Find(table, StackKey(sample));
+        if (stack == nullptr || stack->hash == 0 ||
+            stack->growths < kMinGrowths) {
+          return;
+        }
+        profile->AddTrace(1.0, sample.sampled_stack, sample.stack());
+      });
+  return profile;
+}
+
+LeakDetector::Stats LeakDetector::stats() const {
+  AllocationGuardSpinLockHolder h(&lock_);
+  return stats_;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,98 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_LEAK_DETECTOR_H_
+#define TCMALLOC_LEAK_DETECTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+#include "absl/base/const_init.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/time/time.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/malloc_extension.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Finds slow leaks in the sampled heap.  Each Update takes the live sampled
+// bytes of each allocating stack; a stack whose bytes grew in kMinGrowths
+// updates, without shrinking in any update in between, is a leak candidate.
+// Updates are driven by the background thread every
+// Parameters::leak_detection_interval().
+class LeakDetector {
+ public:
+  static constexpr uint32_t kMinGrowths = 3;
+  // The number of stacks tracked.  Samples of further stacks are dropped.
+  static constexpr size_t kMaxStacks = 2048;
+
+  struct Stats {
+    // Stacks that are leak candidates, and their estimated live bytes.
+    size_t candidate_stacks;
+    size_t candidate_bytes;
+    // Stacks tracked by the last update, and the samples of further stacks
+    // that it dropped.
+    size_t tracked_stacks;
+    size_t dropped_samples;
+  };
+
+  constexpr LeakDetector() = default;
+
+  LeakDetector(const LeakDetector&) = delete;
+  LeakDetector& operator=(const LeakDetector&) = delete;
+
+  // Takes the live sampled bytes of each stack at <now>.
+  void Update(absl::Time now) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Returns the live samples of the leak candidates that were allocated
+  // before the last update, as ProfileType::kLeakCandidates.  The younger
+  // samples of a candidate may still be in flight rather than leaked.
+  std::unique_ptr<ProfileBase> DumpCandidates() ABSL_LOCKS_EXCLUDED(lock_);
+
+  Stats stats() const ABSL_LOCKS_EXCLUDED(lock_);
+
+ private:
+  struct Stack {
+    // The hash of the stack in the StackDepot, or 0 for an empty slot.
+    size_t hash;
+    // Estimated live bytes at the last update.
+    int64_t bytes;
+    // Updates in which bytes grew since it last shrank.
+    uint32_t growths;
+  };
+
+  // Returns the slot of <hash> in <table>, an open addressed table of
+  // kMaxStacks slots, or the empty slot it would take.  Returns nullptr if
+  // <hash> is absent and the table is full.
+  static Stack* Find(Stack* table, size_t hash);
+
+  mutable absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  // Updates fill the table that the previous one did not.
+  Stack tables_[2][kMaxStacks] ABSL_GUARDED_BY(lock_) = {};
+  int current_ ABSL_GUARDED_BY(lock_) = 0;
+  absl::Time last_update_ ABSL_GUARDED_BY(lock_) = absl::InfinitePast();
+  Stats stats_ ABSL_GUARDED_BY(lock_) = {};
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_LEAK_DETECTOR_H_
@@ -0,0 +1,104 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/leak_detector.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/base/attributes.h"
+#include "absl/time/clock.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/testing/testutil.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+constexpr size_t kLeakedSize = 12345;
+constexpr size_t kSteadySize = 23456;
+
+ABSL_ATTRIBUTE_NOINLINE void Allocate(size_t size, int n,
+                                      std::vector<void*>& ptrs) {
+  for (int i = 0; i < n; ++i) {
+    void* ptr = ::operator new(size);
+    benchmark::DoNotOptimize(ptr);
+    ptrs.push_back(ptr);
+  }
+}
+
+// Counts the samples of <profile> of each size.
+void CountSamples(const Profile& profile, int& leaked, int& steady) {
+  leaked = steady = 0;
+  profile.Iterate([&](const Profile::Sample& sample) {
+    if (sample.requested_size == kLeakedSize) ++leaked;
+    if (sample.requested_size == kSteadySize) ++steady;
+  });
+}
+
+TEST(LeakDetectorTest, ReportsGrowingStacks) {
+  ScopedProfileSamplingInterval s(1);
+  LeakDetector& detector = tc_globals.leak_detector();
+
+  std::vector<void*> leaked, steady;
+  leaked.reserve(1000);
+  steady.reserve(1000);
+  Allocate(kSteadySize, 8, steady);
+  // A new stack has nothing to grow from in its first update.
+  for (uint32_t i = 0; i <= LeakDetector::kMinGrowths; ++i) {
+    Allocate(kLeakedSize, 8, leaked);
+    detector.Update(absl::Now());
+  }
+  EXPECT_GE(detector.stats().candidate_stacks, 1);
+  EXPECT_GT(detector.stats().candidate_bytes, 0);
+
+  int num_leaked, num_steady;
+  CountSamples(MallocExtension::SnapshotCurrent(ProfileType::kLeakCandidates),
+               num_leaked, num_steady);
+  EXPECT_GT(num_leaked, 0);
+  EXPECT_EQ(num_steady, 0);
+
+  // Objects allocated since the last update are left out.
+  const size_t before = leaked.size();
+  Allocate(kLeakedSize, 8, leaked);
+  int num_leaked_after;
+  CountSamples(MallocExtension::SnapshotCurrent(ProfileType::kLeakCandidates),
+               num_leaked_after, num_steady);
+  EXPECT_EQ(num_leaked_after, num_leaked);
+
+  // Shrinking clears the candidate.
+  for (size_t i = before; i < leaked.size(); ++i) {
+    ::operator delete(leaked[i]);
+  }
+  leaked.resize(before);
+  ::operator delete(leaked.back());
+  leaked.pop_back();
+  detector.Update(absl::Now());
+  CountSamples(MallocExtension::SnapshotCurrent(ProfileType::kLeakCandidates),
+               num_leaked, num_steady);
+  EXPECT_EQ(num_leaked, 0);
+
+  for (void* ptr : leaked) ::operator delete(ptr);
+  for (void* ptr : steady) ::operator delete(ptr);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -0,0 +1,325 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_LIFETIME_PREDICTIONS_H_
+#define TCMALLOC_LIFETIME_PREDICTIONS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/base/attributes.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/debugging/stacktrace.h"
+#include "absl/hash/hash.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "tcmalloc/arena.h"
+#include "tcmalloc/internal/clock.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/linked_list.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/page_heap_allocator.h"
+#include "tcmalloc/pages.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Returns a hash of the calling stack, which identifies the allocation site of
+// a large allocation.  The frames inside TCMalloc are part of the hash, but
+// they are the same for every allocation of a given kind.
+ABSL_ATTRIBUTE_NOINLINE inline uint64_t LifetimeStackHash() {
+  constexpr int kMaxDepth = 32;
+  void* stack[kMaxDepth];
+  const int depth = absl::GetStackTrace(stack, kMaxDepth, 1);
+  return absl::HashOf(absl::MakeConstSpan(stack, depth));
+}
+
+// Counts of short- and long-lived allocations, keyed by the hash of their
+// allocation stack (see docs/lifetime-based-allocator.md).  The database has a
+// fixed number of entries: a new site evicts the site with the fewest samples
+// among the entries it may occupy.
+class LifetimeDatabase {
+ public:
+  enum class Prediction { kLongLived, kShortLived };
+
+  static constexpr size_t kNumEntries = 1024;
+  static constexpr size_t kMaxProbes = 4;
+  // A site needs this many recorded lifetimes before it is predicted to be
+  // short-lived.
+  static constexpr uint32_t kMinSamples = 8;
+  // A site is short-lived when it has at least this many short-lived
+  // allocations for each long-lived one.
+  static constexpr uint32_t kShortLivedRatio = 8;
+  // Counts are halved when a site reaches this many samples, so that
+  // predictions follow changes in behavior.
+  static constexpr uint32_t kMaxSamples = 1024;
+
+  constexpr LifetimeDatabase() = default;
+
+  // Sites that have not been seen often enough are predicted long-lived, which
+  // leaves their allocations in the regular allocator.
+  Prediction Predict(uint64_t stack_hash) const {
+    const Entry* e = Find(stack_hash);
+    if (e == nullptr || e->samples() < kMinSamples) {
+      return Prediction::kLongLived;
+    }
+    return e->short_count >= kShortLivedRatio * e->long_count
+               ? Prediction::kShortLived
+               : Prediction::kLongLived;
+  }
+
+  void Record(uint64_t stack_hash, Prediction lifetime) {
+    Entry* e = FindOrInsert(stack_hash);
+    if (lifetime == Prediction::kShortLived) {
+      ++e->short_count;
+    } else {
+      ++e->long_count;
+    }
+    if (e->samples() >= kMaxSamples) {
+      // Keep at least one sample so that the entry stays occupied.
+      e->short_count = (e->short_count + 1) / 2;
+      e->long_count = (e->long_count + 1) / 2;
+    }
+  }
+
+  // Number of sites in the database.
+  size_t size() const { return size_; }
+  // Number of sites that were evicted to make room for another one.
+  uint64_t evictions() const { return evictions_; }
+
+ private:
+  struct Entry {
+    uint64_t stack_hash;
+    uint32_t short_count;
+    uint32_t long_count;
+
+    uint32_t samples() const { return short_count + long_count; }
+  };
+
+  const Entry* Find(uint64_t stack_hash) const {
+    for (size_t i = 0; i < kMaxProbes; ++i) {
+      const Entry& e = entries_[(stack_hash + i) % kNumEntries];
+      if (e.samples() != 0 && e.stack_hash == stack_hash) return &e;
+    }
+    return nullptr;
+  }
+
+  Entry* FindOrInsert(uint64_t stack_hash) {
+    Entry* victim = nullptr;
+    for (size_t i = 0; i < kMaxProbes; ++i) {
+      Entry& e = entries_[(stack_hash + i) % kNumEntries];
+      if (e.samples() == 0) {
+        if (victim == nullptr || victim->samples() != 0) victim = &e;
+        continue;
+      }
+      if (e.stack_hash == stack_hash) return &e;
+      if (victim == nullptr ||
+          (victim->samples() != 0 && e.samples() < victim->samples())) {
+        victim = &e;
+      }
+    }
+    TC_ASSERT_NE(victim, nullptr);
+    if (victim->samples() == 0) {
+      ++size_;
+    } else {
+      ++evictions_;
+    }
+    *victim = {.stack_hash = stack_hash, .short_count = 0, .long_count = 0};
+    return victim;
+  }
+
+  Entry entries_[kNumEntries] = {};
+  size_t size_ = 0;
+  uint64_t evictions_ = 0;
+};
+
+// Predicts whether large allocations are short-lived, from the lifetimes of
+// earlier allocations from the same stack.
+//
+// Every large allocation with a stack hash is tracked until it is freed, or
+// until it outlives the threshold, whichever happens first.  Trackers are kept
+// in allocation order, so that the ones that outlived the threshold are always
+// at the front.  Tracker metadata is bounded: allocations are not tracked when
+// kMaxTrackers are already live.
+//
+// All methods require pageheap_lock.
+class LifetimePredictor {
+ public:
+  using Prediction = LifetimeDatabase::Prediction;
+
+  static constexpr size_t kNumBuckets = 1024;
+  static constexpr size_t kMaxTrackers = 64 * 1024;
+  static constexpr absl::Duration kDefaultThreshold = absl::Milliseconds(500);
+
+  struct Stats {
+    // Allocations that were tracked, and that were predicted short-lived.
+    uint64_t tracked;
+    uint64_t predicted_short_lived;
+    // Tracked allocations that were freed before the threshold, and that
+    // outlived it.
+    uint64_t short_lived;
+    uint64_t long_lived;
+    // Allocations predicted short-lived that outlived the threshold.
+    uint64_t mispredicted;
+    // Allocations not tracked because kMaxTrackers were live.
+    uint64_t untracked;
+  };
+
+  explicit LifetimePredictor(Clock clock,
+                             absl::Duration threshold = kDefaultThreshold)
+      : clock_(clock), threshold_(threshold) {}
+
+  void Init(Arena* arena) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    tracker_allocator_.Init(arena);
+  }
+
+  Prediction Predict(uint64_t stack_hash) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return database_.Predict(stack_hash);
+  }
+
+  // Starts tracking the allocation starting at <p> from the stack with
+  // <stack_hash>.  <prediction> is the prediction that the allocation was
+  // placed with.
+  void Track(PageId p, uint64_t stack_hash, Prediction prediction)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    const int64_t now = clock_.now();
+    RecordLongLived(now);
+    if (live_ >= kMaxTrackers) {
+      ++stats_.untracked;
+      return;
+    }
+    Tracker* t = tracker_allocator_.New();
+    new (t) Tracker(p, stack_hash, now, prediction);
+    Tracker*& bucket = buckets_[BucketFor(p)];
+    t->next_in_bucket = bucket;
+    bucket = t;
+    trackers_.append(t);
+    ++live_;
+    ++stats_.tracked;
+    if (prediction == Prediction::kShortLived) ++stats_.predicted_short_lived;
+  }
+
+  // Stops tracking the allocation starting at <p>, if it is tracked, and
+  // records it as short-lived.
+  void Untrack(PageId p) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    if (live_ == 0) return;
+    RecordLongLived(clock_.now());
+    Tracker** link = &buckets_[BucketFor(p)];
+    for (Tracker* t = *link; t != nullptr; link = &t->next_in_bucket, t = *link) {
+      if (t->page != p) continue;
+      database_.Record(t->stack_hash, Prediction::kShortLived);
+      ++stats_.short_lived;
+      *link = t->next_in_bucket;
+      Remove(t);
+      return;
+    }
+  }
+
+  Stats stats() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return stats_;
+  }
+  size_t live_trackers() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return live_;
+  }
+  const LifetimeDatabase& database() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return database_;
+  }
+
+  void Print(Printer* out) const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    out->printf(
+        "HugePageAware: lifetime predictor: %zu sites (%u evicted), %zu live "
+        "trackers, %u tracked, %u predicted short-lived (%u mispredicted), "
+        "%u short-lived, %u long-lived, %u untracked\n",
+        database_.size(), database_.evictions(), live_, stats_.tracked,
+        stats_.predicted_short_lived, stats_.mispredicted, stats_.short_lived,
+        stats_.long_lived, stats_.untracked);
+  }
+
+  void PrintInPbtxt(PbtxtRegion* hpaa) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    auto region = hpaa->CreateSubRegion("lifetime_predictor");
+    region.PrintI64("threshold_ms", absl::ToInt64Milliseconds(threshold_));
+    region.PrintI64("sites", database_.size());
+    region.PrintI64("evicted_sites", database_.evictions());
+    region.PrintI64("live_trackers", live_);
+    region.PrintI64("tracked", stats_.tracked);
+    region.PrintI64("predicted_short_lived", stats_.predicted_short_lived);
+    region.PrintI64("mispredicted", stats_.mispredicted);
+    region.PrintI64("short_lived", stats_.short_lived);
+    region.PrintI64("long_lived", stats_.long_lived);
+    region.PrintI64("untracked", stats_.untracked);
+  }
+
+ private:
+  struct Tracker : public TList<Tracker>::Elem {
+    Tracker(PageId page, uint64_t stack_hash, int64_t allocation_time,
+            Prediction prediction)
+        : page(page),
+          stack_hash(stack_hash),
+          allocation_time(allocation_time),
+          prediction(prediction) {}
+
+    PageId page;
+    uint64_t stack_hash;
+    int64_t allocation_time;
+    Prediction prediction;
+    Tracker* next_in_bucket = nullptr;
+  };
+
+  static size_t BucketFor(PageId p) { return p.index() % kNumBuckets; }
+
+  // Records the allocations that outlived the threshold as long-lived and
+  // stops tracking them.
+  void RecordLongLived(int64_t now) {
+    if (trackers_.empty()) return;
+    const int64_t threshold_ticks =
+        static_cast<int64_t>(absl::ToDoubleSeconds(threshold_) * clock_.freq());
+    while (!trackers_.empty()) {
+      Tracker* t = trackers_.first();
+      if (now - t->allocation_time < threshold_ticks) break;
+      database_.Record(t->stack_hash, Prediction::kLongLived);
+      ++stats_.long_lived;
+      if (t->prediction == Prediction::kShortLived) ++stats_.mispredicted;
+      Tracker** link = &buckets_[BucketFor(t->page)];
+      while (*link != t) link = &(*link)->next_in_bucket;
+      *link = t->next_in_bucket;
+      Remove(t);
+    }
+  }
+
+  void Remove(Tracker* t) {
+    trackers_.remove(t);
+    tracker_allocator_.Delete(t);
+    --live_;
+  }
+
+  Clock clock_;
+  absl::Duration threshold_;
+  LifetimeDatabase database_;
+  // Live trackers in allocation order, and hashed by their first page.
+  TList<Tracker> trackers_;
+  Tracker* buckets_[kNumBuckets] = {};
+  size_t live_ = 0;
+  Stats stats_ = {};
+  PageHeapAllocator<Tracker> tracker_allocator_;
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_LIFETIME_PREDICTIONS_H_
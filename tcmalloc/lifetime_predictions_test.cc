@@ -0,0 +1,197 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/lifetime_predictions.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "tcmalloc/arena.h"
+#include "tcmalloc/internal/clock.h"
+#include "tcmalloc/pages.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+using Prediction = LifetimeDatabase::Prediction;
+
+TEST(LifetimeDatabaseTest, PredictsShortLivedSites) {
+  LifetimeDatabase db;
+  constexpr uint64_t kShort = 1, kLong = 2, kMixed = 3;
+  EXPECT_EQ(db.Predict(kShort), Prediction::kLongLived);
+
+  for (int i = 0; i < LifetimeDatabase::kMinSamples - 1; ++i) {
+    db.Record(kShort, Prediction::kShortLived);
+  }
+  // Not enough samples yet.
+  EXPECT_EQ(db.Predict(kShort), Prediction::kLongLived);
+  db.Record(kShort, Prediction::kShortLived);
+  EXPECT_EQ(db.Predict(kShort), Prediction::kShortLived);
+
+  for (int i = 0; i < 2 * LifetimeDatabase::kMinSamples; ++i) {
+    db.Record(kLong, Prediction::kLongLived);
+    db.Record(kMixed, i % 2 == 0 ? Prediction::kShortLived
+                                 : Prediction::kLongLived);
+  }
+  EXPECT_EQ(db.Predict(kLong), Prediction::kLongLived);
+  EXPECT_EQ(db.Predict(kMixed), Prediction::kLongLived);
+  EXPECT_EQ(db.size(), 3);
+  EXPECT_EQ(db.evictions(), 0);
+}
+
+TEST(LifetimeDatabaseTest, FollowsChangesInBehavior) {
+  LifetimeDatabase db;
+  constexpr uint64_t kSite = 42;
+  for (int i = 0; i < LifetimeDatabase::kMaxSamples; ++i) {
+    db.Record(kSite, Prediction::kShortLived);
+  }
+  EXPECT_EQ(db.Predict(kSite), Prediction::kShortLived);
+
+  // Halving the counts lets long-lived allocations win within a bounded number
+  // of samples.
+  for (int i = 0; i < LifetimeDatabase::kMaxSamples; ++i) {
+    db.Record(kSite, Prediction::kLongLived);
+  }
+  EXPECT_EQ(db.Predict(kSite), Prediction::kLongLived);
+}
+
+TEST(LifetimeDatabaseTest, EvictsSitesWithFewestSamples) {
+  LifetimeDatabase db;
+  // All of these sites compete for the same entries.
+  constexpr uint64_t kBusy = 0;
+  for (int i = 0; i < LifetimeDatabase::kMinSamples; ++i) {
+    db.Record(kBusy, Prediction::kShortLived);
+  }
+  for (uint64_t i = 1; i <= 2 * LifetimeDatabase::kMaxProbes; ++i) {
+    db.Record(i * LifetimeDatabase::kNumEntries, Prediction::kShortLived);
+  }
+  // kBusy and the first kMaxProbes - 1 sites fill the entries, and every
+  // later site evicts the previous one.
+  EXPECT_EQ(db.size(), LifetimeDatabase::kMaxProbes);
+  EXPECT_EQ(db.evictions(), LifetimeDatabase::kMaxProbes + 1);
+  EXPECT_EQ(db.Predict(kBusy), Prediction::kShortLived);
+}
+
+class LifetimePredictorTest : public testing::Test {
+ protected:
+  static int64_t FakeClock() { return clock_; }
+  static double GetFakeClockFrequency() {
+    return absl::ToDoubleNanoseconds(absl::Seconds(2));
+  }
+  static void Advance(absl::Duration d) {
+    clock_ += absl::ToDoubleSeconds(d) * GetFakeClockFrequency();
+  }
+
+  LifetimePredictorTest()
+      : predictor_(Clock{.now = FakeClock, .freq = GetFakeClockFrequency}) {
+    PageHeapSpinLockHolder l;
+    predictor_.Init(&arena_);
+  }
+
+  // Allocates and frees an allocation from <stack_hash> that lives for
+  // <lifetime>.
+  void AllocateAndFree(uint64_t stack_hash, absl::Duration lifetime) {
+    PageHeapSpinLockHolder l;
+    const PageId p = next_;
+    next_ += Length(1);
+    predictor_.Track(p, stack_hash, predictor_.Predict(stack_hash));
+    Advance(lifetime);
+    predictor_.Untrack(p);
+  }
+
+  Prediction Predict(uint64_t stack_hash) {
+    PageHeapSpinLockHolder l;
+    return predictor_.Predict(stack_hash);
+  }
+
+  LifetimePredictor::Stats stats() {
+    PageHeapSpinLockHolder l;
+    return predictor_.stats();
+  }
+
+  Arena arena_;
+  LifetimePredictor predictor_;
+  PageId next_{1};
+
+  static int64_t clock_;
+};
+
+int64_t LifetimePredictorTest::clock_{1234};
+
+TEST_F(LifetimePredictorTest, LearnsLifetimes) {
+  constexpr uint64_t kShort = 1, kLong = 2;
+  const absl::Duration threshold = LifetimePredictor::kDefaultThreshold;
+  for (int i = 0; i < LifetimeDatabase::kMinSamples; ++i) {
+    AllocateAndFree(kShort, threshold / 10);
+    AllocateAndFree(kLong, threshold * 2);
+  }
+  EXPECT_EQ(Predict(kShort), Prediction::kShortLived);
+  EXPECT_EQ(Predict(kLong), Prediction::kLongLived);
+
+  LifetimePredictor::Stats s = stats();
+  EXPECT_EQ(s.tracked, 2 * LifetimeDatabase::kMinSamples);
+  EXPECT_EQ(s.short_lived, LifetimeDatabase::kMinSamples);
+  EXPECT_EQ(s.long_lived, LifetimeDatabase::kMinSamples);
+  EXPECT_EQ(s.predicted_short_lived, 0);
+  EXPECT_EQ(s.mispredicted, 0);
+
+  // The site changes behavior: the predicted short-lived allocation is
+  // counted as mispredicted.
+  AllocateAndFree(kShort, threshold * 2);
+  s = stats();
+  EXPECT_EQ(s.predicted_short_lived, 1);
+  EXPECT_EQ(s.mispredicted, 1);
+}
+
+TEST_F(LifetimePredictorTest, RecordsLiveAllocationsAsLongLived) {
+  constexpr uint64_t kSite = 7;
+  {
+    PageHeapSpinLockHolder l;
+    for (int i = 0; i < LifetimeDatabase::kMinSamples; ++i) {
+      predictor_.Track(next_, kSite, Prediction::kLongLived);
+      next_ += Length(1);
+    }
+    EXPECT_EQ(predictor_.live_trackers(), LifetimeDatabase::kMinSamples);
+  }
+
+  // The allocations are never freed, but the next allocation finds that they
+  // outlived the threshold.
+  Advance(LifetimePredictor::kDefaultThreshold * 2);
+  AllocateAndFree(kSite, absl::ZeroDuration());
+
+  PageHeapSpinLockHolder l;
+  EXPECT_EQ(predictor_.live_trackers(), 0);
+  EXPECT_EQ(predictor_.stats().long_lived, LifetimeDatabase::kMinSamples);
+  EXPECT_EQ(predictor_.stats().short_lived, 1);
+  EXPECT_EQ(predictor_.Predict(kSite), Prediction::kLongLived);
+}
+
+TEST_F(LifetimePredictorTest, IgnoresUntrackedPages) {
+  PageHeapSpinLockHolder l;
+  predictor_.Track(PageId{1}, 1, Prediction::kLongLived);
+  // Same bucket, different page.
+  predictor_.Untrack(PageId{1 + LifetimePredictor::kNumBuckets});
+  EXPECT_EQ(predictor_.live_trackers(), 1);
+  EXPECT_EQ(predictor_.stats().short_lived, 0);
+  predictor_.Untrack(PageId{1});
+  EXPECT_EQ(predictor_.live_trackers(), 0);
+  EXPECT_EQ(predictor_.stats().short_lived, 1);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -0,0 +1,189 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/locked_cpu_cache.h"
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/types/span.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/linked_list.h"
+#include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/internal/sysinfo.h"
+#include "tcmalloc/parameters.h"
+#include "tcmalloc/static_vars.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+void LockedCpuCache::Activate() {
+  PageHeapSpinLockHolder l;
+  if (active()) return;
+
+  const int num_shards = NumCPUs();
+  void* storage = tc_globals.arena().Alloc(
+      sizeof(Shard) * num_shards, std::align_val_t{alignof(Shard)});
+  shards_ = static_cast<Shard*>(storage);
+  for (int i = 0; i < num_shards; ++i) {
+    new (&shards_[i]) Shard();
+  }
+  num_shards_ = num_shards;
+  active_.store(true, std::memory_order_release);
+}
+
+LockedCpuCache::Shard& LockedCpuCache::CurrentShard() {
+  // The result is only a hint, as the thread may migrate right after, which
+  // costs contention on the lock but not correctness.
+  const int cpu = subtle::percpu::GetRealCpu();
+  return shards_[cpu >= 0 ? cpu % num_shards_ : 0];
+}
+
+void* LockedCpuCache::Allocate(size_t size_class) {
+  TC_ASSERT(active());
+  void* result;
+  Shard& shard = CurrentShard();
+  if (ABSL_PREDICT_FALSE(!shard.lock.TryLock())) {
+    return tc_globals.transfer_cache().RemoveRange(
+               size_class, absl::MakeSpan(&result, 1)) == 0
+               ? nullptr
+               : result;
+  }
+
+  shard.used = true;
+  LinkedList& list = shard.lists[size_class];
+  const size_t size = tc_globals.sizemap().class_to_size(size_class);
+  if (ABSL_PREDICT_TRUE(list.TryPop(&result))) {
+    shard.used_bytes.store(shard.used_bytes.load(std::memory_order_relaxed) -
+                               size,
+                           std::memory_order_relaxed);
+    shard.lock.Unlock();
+    return result;
+  }
+
+  // Refill with a batch, so that the next allocations of this size class on
+  // this CPU hit.
+  void* batch[kMaxObjectsToMove];
+  const int batch_size = tc_globals.sizemap().num_objects_to_move(size_class);
+  const int n = tc_globals.transfer_cache().RemoveRange(
+      size_class, absl::MakeSpan(batch, batch_size));
+  if (n > 1) {
+    list.PushBatch(n - 1, batch + 1);
+    shard.used_bytes.store(shard.used_bytes.load(std::memory_order_relaxed) +
+                               (n - 1) * size,
+                           std::memory_order_relaxed);
+  }
+  shard.lock.Unlock();
+  return n == 0 ? nullptr : batch[0];
+}
+
+void LockedCpuCache::Deallocate(void* ptr, size_t size_class) {
+  TC_ASSERT(active());
+  Shard& shard = CurrentShard();
+  if (ABSL_PREDICT_FALSE(!shard.lock.TryLock())) {
+    tc_globals.transfer_cache().InsertRange(size_class,
+                                            absl::Span<void*>(&ptr, 1));
+    return;
+  }
+
+  shard.used = true;
+  LinkedList& list = shard.lists[size_class];
+  const size_t size = tc_globals.sizemap().class_to_size(size_class);
+  const size_t batch_size =
+      tc_globals.sizemap().num_objects_to_move(size_class);
+  size_t used_bytes = shard.used_bytes.load(std::memory_order_relaxed);
+  // Hold up to two batches per size class, and no more than
+  // max_per_cpu_cache_size bytes overall (other than the objects of the
+  // size class being freed).
+  if (list.length() >= 2 * batch_size ||
+      used_bytes + size > Parameters::max_per_cpu_cache_size()) {
+    used_bytes -= ReleaseBatch(list, size_class) * size;
+  }
+  list.Push(ptr);
+  shard.used_bytes.store(used_bytes + size, std::memory_order_relaxed);
+  shard.lock.Unlock();
+}
+
+size_t LockedCpuCache::ReleaseBatch(LinkedList& list, size_t size_class) {
+  void* batch[kMaxObjectsToMove];
+  const size_t n =
+      std::min<size_t>(list.length(),
+                       tc_globals.sizemap().num_objects_to_move(size_class));
+  if (n == 0) return 0;
+  list.PopBatch(n, batch);
+  tc_globals.transfer_cache().InsertRange(size_class,
+                                          absl::Span<void*>(batch, n));
+  return n;
+}
+
+size_t LockedCpuCache::Drain(Shard& shard) {
+  size_t bytes = 0;
+  for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+    LinkedList& list = shard.lists[size_class];
+    const size_t size = tc_globals.sizemap().class_to_size(size_class);
+    while (!list.empty()) {
+      bytes += ReleaseBatch(list, size_class) * size;
+    }
+  }
+  shard.used_bytes.store(0, std::memory_order_relaxed);
+  return bytes;
+}
+
+size_t LockedCpuCache::ReclaimIdle() {
+  if (!active()) return 0;
+  size_t bytes = 0;
+  for (int cpu = 0; cpu < num_shards_; ++cpu) {
+    Shard& shard = shards_[cpu];
+    // A shard that is locked is in use, so it is not idle.
+    if (!shard.lock.TryLock()) continue;
+    if (!shard.used) {
+      bytes += Drain(shard);
+    }
+    shard.used = false;
+    shard.lock.Unlock();
+  }
+  return bytes;
+}
+
+size_t LockedCpuCache::Reclaim(int cpu) {
+  if (!active() || cpu < 0 || cpu >= num_shards_) return 0;
+  Shard& shard = shards_[cpu];
+  absl::base_internal::SpinLockHolder h(&shard.lock);
+  return Drain(shard);
+}
+
+size_t LockedCpuCache::TotalUsedBytes() const {
+  if (!active()) return 0;
+  size_t bytes = 0;
+  for (int cpu = 0; cpu < num_shards_; ++cpu) {
+    bytes += shards_[cpu].used_bytes.load(std::memory_order_relaxed);
+  }
+  return bytes;
+}
+
+LockedCpuCache& locked_cpu_cache() {
+  ABSL_CONST_INIT static LockedCpuCache cache;
+  return cache;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,104 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_LOCKED_CPU_CACHE_H_
+#define TCMALLOC_LOCKED_CPU_CACHE_H_
+
+#include <stddef.h>
+
+#include <atomic>
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/linked_list.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Per-CPU caches for when rseq is unavailable, e.g. when a seccomp policy
+// blocks it, so that the thread caches are not the only option.  The caches
+// are indexed by sched_getcpu().  Since a thread may be preempted or migrated
+// at any point, each cache is guarded by a spinlock, which is only ever tried:
+// a thread that finds the lock of its CPU's cache held, typically by the
+// thread it preempted, goes to the transfer cache rather than wait.
+//
+// This is slower than CpuCache, which needs no atomic operations on its fast
+// path, but as with it the number of caches is bounded by the number of CPUs
+// rather than of threads.  Enabled by linking in want_locked_cpu_caches.
+class LockedCpuCache {
+ public:
+  constexpr LockedCpuCache() = default;
+
+  LockedCpuCache(const LockedCpuCache&) = delete;
+  LockedCpuCache& operator=(const LockedCpuCache&) = delete;
+
+  // Allocates the caches of all CPUs and starts using them.
+  void Activate() ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  bool active() const { return active_.load(std::memory_order_acquire); }
+
+  // Allocates an object of <size_class>, or returns nullptr if out of memory.
+  // REQUIRES: active()
+  void* Allocate(size_t size_class);
+
+  // REQUIRES: active()
+  void Deallocate(void* ptr, size_t size_class);
+
+  // Returns the objects of the caches that were not used since the previous
+  // call to the transfer cache.  Called by the background thread.  Returns the
+  // bytes returned.
+  size_t ReclaimIdle();
+
+  // Returns the objects of <cpu>'s cache to the transfer cache.  Returns the
+  // bytes returned.
+  size_t Reclaim(int cpu);
+
+  // The bytes cached by all CPUs.
+  size_t TotalUsedBytes() const;
+
+ private:
+  struct alignas(ABSL_CACHELINE_SIZE) Shard {
+    absl::base_internal::SpinLock lock{
+        absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+    // Written under lock, read without it for stats.
+    std::atomic<size_t> used_bytes{0};
+    bool used ABSL_GUARDED_BY(lock) = false;
+    LinkedList lists[kNumClasses] ABSL_GUARDED_BY(lock);
+  };
+
+  Shard& CurrentShard();
+
+  // Returns all of the objects of <shard> to the transfer cache.
+  size_t Drain(Shard& shard) ABSL_EXCLUSIVE_LOCKS_REQUIRED(shard.lock);
+
+  // Returns up to a batch of the objects in <list> to the transfer cache.
+  // Returns the number of objects returned.
+  static size_t ReleaseBatch(LinkedList& list, size_t size_class);
+
+  std::atomic<bool> active_{false};
+  Shard* shards_ = nullptr;
+  int num_shards_ = 0;
+};
+
+LockedCpuCache& locked_cpu_cache();
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_LOCKED_CPU_CACHE_H_
@@ -0,0 +1,110 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/locked_cpu_cache.h"
+
+#include <stddef.h>
+
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/sysinfo.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/tcmalloc_policy.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+class LockedCpuCacheTest : public testing::Test {
+ protected:
+  LockedCpuCacheTest() {
+    tc_globals.InitIfNecessary();
+    cache_.Activate();
+  }
+
+  ~LockedCpuCacheTest() override {
+    for (int cpu = 0; cpu < NumCPUs(); ++cpu) {
+      cache_.Reclaim(cpu);
+    }
+  }
+
+  static size_t SizeClass(size_t size) {
+    size_t size_class;
+    EXPECT_TRUE(tc_globals.sizemap().GetSizeClass(CppPolicy(), size,
+                                                  &size_class));
+    return size_class;
+  }
+
+  LockedCpuCache cache_;
+};
+
+TEST_F(LockedCpuCacheTest, CachesFreedObjects) {
+  ASSERT_TRUE(cache_.active());
+  const size_t size_class = SizeClass(64);
+  const size_t size = tc_globals.sizemap().class_to_size(size_class);
+
+  void* ptr = cache_.Allocate(size_class);
+  ASSERT_NE(ptr, nullptr);
+  cache_.Deallocate(ptr, size_class);
+  EXPECT_GE(cache_.TotalUsedBytes(), size);
+
+  size_t reclaimed = 0;
+  for (int cpu = 0; cpu < NumCPUs(); ++cpu) {
+    reclaimed += cache_.Reclaim(cpu);
+  }
+  EXPECT_GE(reclaimed, size);
+  EXPECT_EQ(cache_.TotalUsedBytes(), 0);
+}
+
+TEST_F(LockedCpuCacheTest, ReclaimIdle) {
+  const size_t size_class = SizeClass(128);
+  cache_.Deallocate(cache_.Allocate(size_class), size_class);
+  ASSERT_GT(cache_.TotalUsedBytes(), 0);
+
+  // The first call only marks the caches as unused.
+  EXPECT_EQ(cache_.ReclaimIdle(), 0);
+  EXPECT_GT(cache_.ReclaimIdle(), 0);
+  EXPECT_EQ(cache_.TotalUsedBytes(), 0);
+}
+
+TEST_F(LockedCpuCacheTest, Threads) {
+  const size_t size_class = SizeClass(32);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&]() {
+      std::vector<void*> ptrs;
+      for (int round = 0; round < 100; ++round) {
+        for (int i = 0; i < 1000; ++i) {
+          void* ptr = cache_.Allocate(size_class);
+          ASSERT_NE(ptr, nullptr);
+          ptrs.push_back(ptr);
+        }
+        for (void* ptr : ptrs) {
+          cache_.Deallocate(ptr, size_class);
+        }
+        ptrs.clear();
+      }
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
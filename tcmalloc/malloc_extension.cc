@@ -17,6 +17,7 @@
 #include <assert.h>
 #include <string.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
 #include <cstdlib>
@@ -26,7 +27,9 @@
 #include <new>
 #include <optional>
 #include <string>
+#include <thread>  // NOLINT(build/c++11)
 #include <utility>
+#include <vector>
 
 #include "absl/base/attributes.h"
 #include "absl/base/call_once.h"
@@ -137,6 +140,19 @@ Profile MallocExtension::AllocationProfilingToken::Stop() && {
   return std::move(*p).Stop();
 }
 
+MallocExtension::HeapProfileCursor::HeapProfileCursor(
+    std::unique_ptr<tcmalloc_internal::HeapProfileCursorBase> impl)
+    : impl_(std::move(impl)) {}
+
+MallocExtension::HeapProfileCursor::~HeapProfileCursor() {}
+
+Profile MallocExtension::HeapProfileCursor::Advance() {
+  if (!impl_) {
+    return Profile();
+  }
+  return impl_->Advance();
+}
+
 Profile::Profile(std::unique_ptr<const tcmalloc_internal::ProfileBase> impl)
     : impl_(std::move(impl)) {}
 
@@ -224,6 +240,51 @@ std::string MallocExtension::GetStats() {
   return "";
 }
 
+std::string MallocExtension::GetSummaryStats() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetSummaryStats != nullptr) {
+    std::string ret;
+    MallocExtension_Internal_GetSummaryStats(&ret);
+    return ret;
+  }
+#endif
+#if defined(ABSL_HAVE_THREAD_SANITIZER)
+  return "NOT IMPLEMENTED";
+#endif
+  return "";
+}
+
+void MallocExtension::WarmUp(absl::Span<const WarmUpBucket> histogram,
+                             bool per_cpu_caches) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_WarmUp != nullptr) {
+    MallocExtension_Internal_WarmUp(histogram.data(), histogram.size(),
+                                    per_cpu_caches);
+  }
+#endif
+}
+
+std::string MallocExtension::ExportTuningState() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_ExportTuningState != nullptr) {
+    std::string ret;
+    MallocExtension_Internal_ExportTuningState(&ret);
+    return ret;
+  }
+#endif
+  return "";
+}
+
+bool MallocExtension::ImportTuningState(absl::string_view blob) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_ImportTuningState != nullptr) {
+    return MallocExtension_Internal_ImportTuningState(blob.data(),
+                                                      blob.size());
+  }
+#endif
+  return false;
+}
+
 void MallocExtension::ReleaseMemoryToSystem(size_t num_bytes) {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (&MallocExtension_Internal_ReleaseMemoryToSystem != nullptr) {
@@ -232,6 +293,81 @@ void MallocExtension::ReleaseMemoryToSystem(size_t num_bytes) {
 #endif
 }
 
+bool MallocExtension::ReleaseMemoryToSystemAsync(size_t num_bytes,
+                                                 ReleaseCallback callback,
+                                                 void* arg) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_ReleaseMemoryToSystemAsync != nullptr) {
+    return MallocExtension_Internal_ReleaseMemoryToSystemAsync(num_bytes,
+                                                               callback, arg);
+  }
+#endif
+  return false;
+}
+
+size_t MallocExtension::Reserve(size_t num_bytes, bool populate) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_Reserve == nullptr) {
+    return 0;
+  }
+
+  // Populating a reservation is dominated by page faults, which scale with
+  // the number of threads taking them.  Split large requests into chunks of
+  // at least kMinChunkBytes and reserve them concurrently.
+  static constexpr size_t kMinChunkBytes = size_t{1} << 30;
+  static constexpr size_t kMaxWorkers = 16;
+  size_t num_chunks = 1;
+  if (populate) {
+    const size_t max_chunks = std::clamp<size_t>(
+        std::thread::hardware_concurrency(), 1, kMaxWorkers);
+    num_chunks = std::clamp<size_t>(num_bytes / kMinChunkBytes, 1, max_chunks);
+  }
+  if (num_chunks == 1) {
+    return MallocExtension_Internal_Reserve(num_bytes, populate);
+  }
+
+  const size_t chunk_bytes = num_bytes / num_chunks;
+  std::atomic<size_t> reserved{0};
+  std::vector<std::thread> workers;
+  workers.reserve(num_chunks - 1);
+  for (size_t i = 1; i < num_chunks; ++i) {
+    workers.emplace_back([&]() {
+      reserved.fetch_add(MallocExtension_Internal_Reserve(chunk_bytes, true),
+                         std::memory_order_relaxed);
+    });
+  }
+  reserved.fetch_add(
+      MallocExtension_Internal_Reserve(
+          num_bytes - chunk_bytes * (num_chunks - 1), true),
+      std::memory_order_relaxed);
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  return reserved.load(std::memory_order_relaxed);
+#else
+  return 0;
+#endif
+}
+
+void MallocExtension::PrepareForAllocation(size_t num_bytes,
+                                           hot_cold_t hot_cold) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_PrepareForAllocation != nullptr) {
+    MallocExtension_Internal_PrepareForAllocation(num_bytes, hot_cold);
+  }
+#endif
+}
+
+void MallocExtension::RequestMemoryRelease(size_t num_bytes,
+                                           absl::Duration within,
+                                           CacheShrinkLevel level) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_RequestMemoryRelease != nullptr) {
+    MallocExtension_Internal_RequestMemoryRelease(num_bytes, within, level);
+  }
+#endif
+}
+
 AddressRegionFactory* MallocExtension::GetRegionFactory() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (&MallocExtension_Internal_GetRegionFactory == nullptr) {
@@ -269,6 +405,17 @@ Profile MallocExtension::SnapshotCurrent(tcmalloc::ProfileType type) {
 #endif
 }
 
+std::vector<MallocExtension::PeakHeapProfile>
+MallocExtension::SnapshotTopPeakHeaps() {
+  std::vector<PeakHeapProfile> result;
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_SnapshotTopPeakHeaps != nullptr) {
+    MallocExtension_Internal_SnapshotTopPeakHeaps(&result);
+  }
+#endif
+  return result;
+}
+
 MallocExtension::AllocationProfilingToken
 MallocExtension::StartAllocationProfiling() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
@@ -299,6 +446,20 @@ MallocExtension::StartLifetimeProfiling() {
 #endif
 }
 
+MallocExtension::HeapProfileCursor MallocExtension::StartHeapProfileCursor() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_StartHeapProfileCursor == nullptr) {
+    return {};
+  }
+
+  return tcmalloc_internal::HeapProfileCursorAccessor::MakeCursor(
+      std::unique_ptr<tcmalloc_internal::HeapProfileCursorBase>(
+          MallocExtension_Internal_StartHeapProfileCursor()));
+#else
+  return {};
+#endif
+}
+
 void MallocExtension::MarkThreadIdle() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (&MallocExtension_Internal_MarkThreadIdle == nullptr) {
@@ -342,6 +503,70 @@ void MallocExtension::SetMemoryLimit(const size_t limit, LimitKind limit_kind) {
 #endif
 }
 
+size_t MallocExtension::GetHeapMemoryLimit(MemoryHeap heap, int numa_partition,
+                                           LimitKind limit_kind) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetHeapMemoryLimit != nullptr) {
+    return MallocExtension_Internal_GetHeapMemoryLimit(heap, numa_partition,
+                                                       limit_kind);
+  }
+#endif
+  return 0;
+}
+
+bool MallocExtension::SetHeapMemoryLimit(MemoryHeap heap, int numa_partition,
+                                         const size_t limit,
+                                         LimitKind limit_kind) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_SetHeapMemoryLimit != nullptr) {
+    // limit == 0 implies no limit.
+    const size_t new_limit =
+        (limit > 0) ? limit : std::numeric_limits<size_t>::max();
+    return MallocExtension_Internal_SetHeapMemoryLimit(heap, numa_partition,
+                                                       new_limit, limit_kind);
+  }
+#endif
+  return false;
+}
+
+bool MallocExtension::RegisterMemoryPressureCallback(
+    MemoryPressureCallback callback) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_RegisterMemoryPressureCallback != nullptr) {
+    return MallocExtension_Internal_RegisterMemoryPressureCallback(callback);
+  }
+#endif
+  return false;
+}
+
+void MallocExtension::UnregisterMemoryPressureCallback(
+    MemoryPressureCallback callback) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_UnregisterMemoryPressureCallback != nullptr) {
+    MallocExtension_Internal_UnregisterMemoryPressureCallback(callback);
+  }
+#endif
+}
+
+bool MallocExtension::RegisterReclaimCallback(ReclaimCallback callback,
+                                              void* arg) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_RegisterReclaimCallback != nullptr) {
+    return MallocExtension_Internal_RegisterReclaimCallback(callback, arg);
+  }
+#endif
+  return false;
+}
+
+void MallocExtension::UnregisterReclaimCallback(ReclaimCallback callback,
+                                                void* arg) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_UnregisterReclaimCallback != nullptr) {
+    MallocExtension_Internal_UnregisterReclaimCallback(callback, arg);
+  }
+#endif
+}
+
 int64_t MallocExtension::GetProfileSamplingInterval() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (&MallocExtension_Internal_GetProfileSamplingInterval != nullptr) {
@@ -360,6 +585,61 @@ void MallocExtension::SetProfileSamplingInterval(int64_t interval) {
   (void)interval;
 }
 
+uint64_t MallocExtension::GetAllocationContext() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetAllocationContext != nullptr) {
+    return MallocExtension_Internal_GetAllocationContext();
+  }
+#endif
+  return 0;
+}
+
+void MallocExtension::SetAllocationContext(uint64_t context) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_SetAllocationContext != nullptr) {
+    MallocExtension_Internal_SetAllocationContext(context);
+  }
+#endif
+  (void)context;
+}
+
+void MallocExtension::SetAllocationBudget(size_t bytes) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_SetAllocationBudget != nullptr) {
+    MallocExtension_Internal_SetAllocationBudget(bytes);
+  }
+#endif
+  (void)bytes;
+}
+
+size_t MallocExtension::GetAllocationBudgetUsage() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetAllocationBudgetUsage != nullptr) {
+    return MallocExtension_Internal_GetAllocationBudgetUsage();
+  }
+#endif
+  return 0;
+}
+
+void MallocExtension::SetAllocationBudgetCallback(
+    AllocationBudgetCallback callback) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_SetAllocationBudgetCallback != nullptr) {
+    MallocExtension_Internal_SetAllocationBudgetCallback(callback);
+  }
+#endif
+  (void)callback;
+}
+
+void MallocExtension::SwapAllocationTaskState(AllocationTaskState& state) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_SwapAllocationTaskState != nullptr) {
+    MallocExtension_Internal_SwapAllocationTaskState(&state);
+  }
+#endif
+  (void)state;
+}
+
 int64_t MallocExtension::GetGuardedSamplingInterval() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (MallocExtension_Internal_GetGuardedSamplingInterval == nullptr) {
@@ -698,6 +978,168 @@ std::optional<size_t> MallocExtension::GetAllocatedSize(const void* p) {
   return std::nullopt;
 }
 
+std::optional<size_t> MallocExtension::TryResizeInPlace(void* p,
+                                                        size_t size) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_TryResizeInPlace != nullptr) {
+    return MallocExtension_Internal_TryResizeInPlace(p, size);
+  }
+#endif
+#if TCMALLOC_UNDER_SANITIZERS
+  return __sanitizer_get_allocated_size(p);
+#endif
+  return std::nullopt;
+}
+
+size_t MallocExtension::AllocateBatch(size_t size, absl::Span<void*> ptrs) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_AllocateBatch != nullptr) {
+    return MallocExtension_Internal_AllocateBatch(size, ptrs.data(),
+                                                  ptrs.size());
+  }
+#endif
+  size_t n = 0;
+  for (; n < ptrs.size(); ++n) {
+    void* p = malloc(size);
+    if (p == nullptr) break;
+    ptrs[n] = p;
+  }
+  return n;
+}
+
+void MallocExtension::DeallocateBatch(absl::Span<void* const> ptrs) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_DeallocateBatch != nullptr) {
+    // The batch is only read, never written, by the implementation.
+    MallocExtension_Internal_DeallocateBatch(const_cast<void**>(ptrs.data()),
+                                             ptrs.size());
+    return;
+  }
+#endif
+  for (void* p : ptrs) {
+    free(p);
+  }
+}
+
+void MallocExtension::DeallocateSizedBatch(absl::Span<void* const> ptrs,
+                                           size_t size) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_DeallocateSizedBatch != nullptr) {
+    // The batch is only read, never written, by the implementation.
+    MallocExtension_Internal_DeallocateSizedBatch(
+        const_cast<void**>(ptrs.data()), ptrs.size(), size);
+    return;
+  }
+#endif
+  for (void* p : ptrs) {
+    free(p);
+  }
+}
+
+MallocExtension::SizeClassHandle MallocExtension::GetSizeClassHandle(
+    size_t size, std::align_val_t alignment, hot_cold_t hot_cold) {
+  uint32_t size_class = 0;
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_GetSizeClassHandle != nullptr) {
+    size_class =
+        MallocExtension_Internal_GetSizeClassHandle(size, alignment, hot_cold);
+  }
+#endif
+  return SizeClassHandle(size, alignment, hot_cold, size_class);
+}
+
+void* MallocExtension::AllocateWithHandle(const SizeClassHandle& handle) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_AllocateWithHandle != nullptr) {
+    return MallocExtension_Internal_AllocateWithHandle(
+        handle.size_, handle.alignment_, handle.hot_cold_, handle.size_class_);
+  }
+#endif
+  return ::operator new(handle.size_, handle.alignment_);
+}
+
+void MallocExtension::DeallocateWithHandle(void* p,
+                                           const SizeClassHandle& handle) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_DeallocateWithHandle != nullptr) {
+    MallocExtension_Internal_DeallocateWithHandle(
+        p, handle.size_, handle.alignment_, handle.size_class_);
+    return;
+  }
+#endif
+  ::operator delete(p, handle.size_, handle.alignment_);
+}
+
+void* MallocExtension::AllocateInterleaved(size_t size) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_AllocateInterleaved != nullptr) {
+    return MallocExtension_Internal_AllocateInterleaved(size);
+  }
+#endif
+  // Placed like any other memory.
+  return malloc(size);
+}
+
+bool MallocExtension::SetRegisteredMemoryFactory(
+    AddressRegionFactory* factory, RegisterMemoryCallback callback) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_SetRegisteredMemoryFactory != nullptr) {
+    return MallocExtension_Internal_SetRegisteredMemoryFactory(factory,
+                                                               callback);
+  }
+#endif
+  return false;
+}
+
+void* MallocExtension::AllocateRegistered(size_t size) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_AllocateRegistered != nullptr) {
+    return MallocExtension_Internal_AllocateRegistered(size);
+  }
+#endif
+  return nullptr;
+}
+
+void MallocExtension::DeallocateRegistered(void* ptr, size_t size) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_DeallocateRegistered != nullptr) {
+    MallocExtension_Internal_DeallocateRegistered(ptr, size);
+  }
+#endif
+}
+
+MallocExtension::Heap* MallocExtension::CreateHeap() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_CreateHeap != nullptr) {
+    return MallocExtension_Internal_CreateHeap();
+  }
+#endif
+  return nullptr;
+}
+
+void* MallocExtension::HeapAllocate(Heap* heap, size_t size,
+                                    std::align_val_t alignment) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_HeapAllocate != nullptr) {
+    return MallocExtension_Internal_HeapAllocate(heap, size, alignment);
+  }
+#endif
+  // Heaps cannot be created without TCMalloc.
+  static_cast<void>(heap);
+  static_cast<void>(size);
+  static_cast<void>(alignment);
+  return nullptr;
+}
+
+void MallocExtension::DestroyHeap(Heap* heap) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_DestroyHeap != nullptr) {
+    MallocExtension_Internal_DestroyHeap(heap);
+  }
+#endif
+  static_cast<void>(heap);
+}
+
 MallocExtension::Ownership MallocExtension::GetOwnership(const void* p) {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (MallocExtension_Internal_GetOwnership != nullptr) {
@@ -765,6 +1207,24 @@ void MallocExtension::ProcessBackgroundActions() {
 #endif
 }
 
+int MallocExtension::GetNumNumaPartitions() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetNumNumaPartitions != nullptr) {
+    return MallocExtension_Internal_GetNumNumaPartitions();
+  }
+#endif
+  return 1;
+}
+
+void MallocExtension::ProcessNumaPartitionBackgroundActions(int partition) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_ProcessNumaPartitionBackgroundActions !=
+      nullptr) {
+    MallocExtension_Internal_ProcessNumaPartitionBackgroundActions(partition);
+  }
+#endif
+}
+
 bool MallocExtension::NeedsProcessBackgroundActions() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   return &MallocExtension_Internal_ProcessBackgroundActions != nullptr;
@@ -821,6 +1281,11 @@ __size_returning_new_hot_cold(size_t size, __hot_cold_t) {
   return {::operator new(size), size};
 }
 
+ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE tcmalloc::sized_ptr_t
+__size_returning_new_lifetime(size_t size, __lifetime_t) {
+  return {::operator new(size), size};
+}
+
 ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE tcmalloc::sized_ptr_t
 tcmalloc_size_returning_operator_new_nothrow(size_t size) noexcept {
   void* p = ::operator new(size, std::nothrow);
@@ -854,6 +1319,12 @@ __size_returning_new_aligned_hot_cold(size_t size, std::align_val_t alignment,
   return {::operator new(size, alignment), size};
 }
 
+ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE tcmalloc::sized_ptr_t
+__size_returning_new_aligned_lifetime(size_t size, std::align_val_t alignment,
+                                      __lifetime_t) {
+  return {::operator new(size, alignment), size};
+}
+
 ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE tcmalloc::sized_ptr_t
 tcmalloc_size_returning_operator_new_aligned_hot_cold_nothrow(
     size_t size, std::align_val_t alignment, __hot_cold_t) noexcept {
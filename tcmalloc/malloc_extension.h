@@ -32,6 +32,7 @@
 #include <optional>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/base/attributes.h"
 #include "absl/base/macros.h"
@@ -55,17 +56,35 @@
 // 255 - The allocation is accessed very frequently.
 enum class __hot_cold_t : uint8_t;
 
-// TODO(ckennelly): Lifetimes
+// Indicates how long the allocation is expected to live.
+// 0   - The allocation is freed soon, e.g. a temporary buffer.
+// ...
+// 255 - The allocation lives for as long as the program.
+enum class __lifetime_t : uint8_t;
 
 namespace tcmalloc {
 
 // Alias to the newer type in the global namespace, so that existing code works
 // as is.
 using hot_cold_t = __hot_cold_t;
+using lifetime_t = __lifetime_t;
 
 constexpr hot_cold_t kDefaultMinHotAccessHint =
     static_cast<tcmalloc::hot_cold_t>(1);
 
+// Selects the operator new overloads (see new_extension.h) that return memory
+// sharing no cache line with any other live allocation, so that objects
+// written by different threads do not falsely share cache lines.
+struct isolate_t {
+  explicit isolate_t() = default;
+};
+inline constexpr isolate_t isolate{};
+
+// Allocations hinted below kMediumLifetime are treated as short-lived.
+constexpr lifetime_t kShortLifetime = static_cast<lifetime_t>(0);
+constexpr lifetime_t kMediumLifetime = static_cast<lifetime_t>(128);
+constexpr lifetime_t kLongLifetime = static_cast<lifetime_t>(255);
+
 }  // namespace tcmalloc
 
 inline bool AbslParseFlag(absl::string_view text, tcmalloc::hot_cold_t* hotness,
@@ -91,8 +110,11 @@ namespace tcmalloc {
 namespace tcmalloc_internal {
 class AllocationProfilingTokenAccessor;
 class AllocationProfilingTokenBase;
+class HeapProfileCursorAccessor;
+class HeapProfileCursorBase;
 class ProfileAccessor;
 class ProfileBase;
+class UserHeap;
 }  // namespace tcmalloc_internal
 
 enum class ProfileType {
@@ -111,8 +133,27 @@ enum class ProfileType {
   kAllocations,
 
   // Lifetimes of sampled objects that are live during the profiling session.
+  // SnapshotCurrent returns the continuous lifetime profile, kept while
+  // tcmalloc_continuous_lifetime_profile_period is nonzero.
   kLifetimes,
 
+  // Free memory that sampled objects keep from being returned to the OS: like
+  // kFragmentation, the free space on their spans, plus their share of the
+  // free but backed pages of the hugepages those spans are on.
+  kPinnedMemory,
+
+  // Like kPeakHeap, but for the largest sampled heap within the last one to
+  // two minutes, or hours.  Only collected with the
+  // windowed_peak_heap_profiles parameter; empty otherwise.
+  kPeakHeapLastMinute,
+  kPeakHeapLastHour,
+
+  // Live sampled objects allocated at stacks whose sampled bytes kept growing
+  // over the last updates of the leak detector, which only runs with the
+  // leak_detection_interval parameter; empty otherwise.  Objects younger than
+  // the last update are left out.
+  kLeakCandidates,
+
   // Only present to prevent switch statements without a default clause so that
   // we can extend this enumeration without breaking code.
   kDoNotUse,
@@ -163,6 +204,10 @@ class Profile final {
     // Timestamp of allocation.
     absl::Time allocation_time;
 
+    // The allocation context of the allocating thread, see
+    // MallocExtension::SetAllocationContext.  0 if it had none.
+    uint64_t allocation_context = 0;
+
     // The following vars are used by the lifetime (deallocation) profiler.
     uint64_t profile_id;
 
@@ -275,6 +320,7 @@ class AddressRegionFactory {
     // mbind is not sufficient (e.g. when dealing with pre-faulted memory).
     kNormalNumaAwareS0,  // Normal usage intended for NUMA S0 under numa_aware.
     kNormalNumaAwareS1,  // Normal usage intended for NUMA S1 under numa_aware.
+    kRegistered,  // Memory for MallocExtension::AllocateRegistered.
   };
 
   AddressRegionFactory() {}
@@ -326,6 +372,29 @@ class MallocExtension final {
   // statistics.
   static std::string GetStats();
 
+  // Gets the summary part of GetStats(): the totals of the "MALLOC:" lines
+  // and the sampled profile counters, without the per-size-class, per-CPU and
+  // page heap details.  Its cost does not grow with the number of CPUs: the
+  // per-CPU cache freelist bytes are as of the background thread's last
+  // refresh, and residence is not measured.
+  static std::string GetSummaryStats();
+
+  // Returns what the caches have learned about this process's workload, as a
+  // compact blob: per-CPU cache capacities and batch lengths, transfer cache
+  // capacities and HugeCache limits.  A later process of the same service can
+  // pass it to ImportTuningState() at startup to begin with the cache shapes
+  // this one reached, rather than re-learning them with elevated slow-path
+  // rates.  Returns an empty string if TCMalloc is not linked in.
+  static std::string ExportTuningState();
+
+  // Starts the caches from a blob returned by ExportTuningState(), ideally
+  // before the process starts serving.  Size classes are matched by object
+  // size, so a blob from another build applies to the size classes they
+  // share.  Per-CPU capacities apply to cpus whose caches are populated
+  // afterwards.  The caches go on adapting from there.  Returns false if
+  // `blob` is not a tuning state or if TCMalloc is not linked in.
+  static bool ImportTuningState(absl::string_view blob);
+
   // -------------------------------------------------------------------
   // Control operations for getting malloc implementation specific parameters.
   // Some currently useful properties:
@@ -368,6 +437,12 @@ class MallocExtension final {
   //
   //  "tcmalloc.per_cpu_caches_active"
   //      Whether tcmalloc is using per-CPU caches (1 or 0 respectively).
+  //
+  // With the tcmalloc_numeric_property_staleness parameter set, the generic
+  // properties other than the peak and fragmentation ones, and the page heap
+  // free and unmapped bytes, come from a snapshot of the stats shared by all
+  // callers.  They may then be as old as the staleness plus the time it takes
+  // to gather the stats once, but do not take any of tcmalloc's locks.
   // -------------------------------------------------------------------
 
   // Gets the named property's value or a nullopt if the property is not valid.
@@ -429,6 +504,98 @@ class MallocExtension final {
   //   back in.
   static void ReleaseMemoryToSystem(size_t num_bytes);
 
+  // Called with the bytes released by a ReleaseMemoryToSystemAsync request,
+  // and the argument it was made with.
+  using ReleaseCallback = void (*)(size_t bytes_released, void* arg);
+
+  // Like ReleaseMemoryToSystem, but returns immediately, so that large
+  // releases may be requested from latency-sensitive threads.  The background
+  // thread (see ProcessBackgroundActions) releases the memory a few hugepages
+  // at a time, holding the page heap lock for one chunk at most, and then
+  // calls callback, if not null, with the bytes released and arg.  The
+  // callback runs on the background thread and must not block.
+  //
+  // Returns false if the request was not accepted, because the underlying
+  // malloc implementation does not support it or too many requests are
+  // pending; the callback is not called then.  Accepted requests do not
+  // complete while the background thread is not running.
+  static bool ReleaseMemoryToSystemAsync(size_t num_bytes,
+                                         ReleaseCallback callback = nullptr,
+                                         void* arg = nullptr);
+
+  // Reserves at least num_bytes of memory ahead of demand, so that subsequent
+  // allocations (in particular large ones) are served without growing the
+  // heap.  Memory is reserved in hugepage-aligned chunks.  If populate is
+  // true, the reservation is also faulted in, using several threads for large
+  // requests, so that warming up a large heap does not pay for page faults on
+  // the allocation path.
+  //
+  // Reserved memory is free memory: it is subject to the memory limits and is
+  // returned to the OS like any other cached memory once it is not needed.
+  //
+  // Returns the number of bytes reserved, which is 0 if the underlying malloc
+  // implementation does not support reservations.
+  static size_t Reserve(size_t num_bytes, bool populate = false);
+
+  // `count` allocations of `size` bytes that WarmUp() should prepare for.
+  struct WarmUpBucket {
+    size_t size;
+    size_t count;
+  };
+
+  // Prepares for the allocations in `histogram`, such as those of the first
+  // requests a server handles, so that they do not stall populating spans
+  // and allocating pages.  For each size with a size class, `count` objects
+  // are carved out of spans in the central freelist, and put in the transfer
+  // cache as far as its capacity allows, which WarmUp() raises to up to
+  // `count`.  With `per_cpu_caches`, they go to the per-CPU cache of the
+  // calling thread's CPU first.  Larger sizes are Reserve()d and populated.
+  //
+  // Objects that no cache takes go back to the central freelist, whose spans
+  // are then free, but remain backed in the page heap until it releases
+  // memory.  Has no effect if the malloc implementation does not support it.
+  static void WarmUp(absl::Span<const WarmUpBucket> histogram,
+                     bool per_cpu_caches = false);
+
+  // Asks for num_bytes of memory to be reserved and faulted in, as by
+  // Reserve(num_bytes, /*populate=*/true), on the background thread (see
+  // ProcessBackgroundActions), ahead of a large allocation with the access
+  // hint hot_cold by this thread.  Returns immediately, so that the page
+  // faults are taken off the critical path as long as the allocation comes
+  // late enough; the reservation is made within one background interval, or
+  // right away if background actions are event driven.
+  //
+  // This is a hint: it has no effect if the underlying malloc implementation
+  // does not support it, or if the background thread is not running.
+  static void PrepareForAllocation(size_t num_bytes,
+                                   hot_cold_t hot_cold = hot_cold_t{255});
+
+  enum class CacheShrinkLevel {
+    // Leave the caches as they are.
+    kNone,
+    // Drain the per-CPU caches that went idle, and the objects in the
+    // transfer caches and the free spans in the central freelists that went
+    // unused.
+    kIdle,
+    // Drain all of the per-CPU and transfer caches.
+    kAll,
+  };
+
+  // Asks for num_bytes of free memory to be returned to the OS within
+  // <within>, and for the caches to be shrunk to <level> first, on the
+  // background thread (see ProcessBackgroundActions).  Returns immediately.
+  // The release is spread over the sleep intervals up to the deadline, so
+  // that it does not stall the application; requests made before the last
+  // is done add up.  This is meant for node-level memory agents, which may
+  // also make requests by signal (see TCMALLOC_RELEASE_SIGNAL in
+  // docs/tuning.md).
+  //
+  // This is a hint: it has no effect if the underlying malloc implementation
+  // does not support it, or if the background thread is not running.
+  static void RequestMemoryRelease(
+      size_t num_bytes, absl::Duration within,
+      CacheShrinkLevel level = CacheShrinkLevel::kNone);
+
   enum class LimitKind { kSoft, kHard };
 
   // Make a best effort attempt to prevent more than limit bytes of memory
@@ -441,12 +608,162 @@ class MallocExtension final {
   static size_t GetMemoryLimit(LimitKind limit_kind);
   static void SetMemoryLimit(size_t limit, LimitKind limit_kind);
 
+  // The heaps that may be limited on their own, see SetHeapMemoryLimit.
+  enum class MemoryHeap {
+    // The normal heap of a NUMA partition.
+    kNormal,
+    // The heap of sampled allocations.
+    kSampled,
+    // The heap of cold allocations (see __hot_cold_t), if they do not share
+    // the normal heap.
+    kCold,
+  };
+
+  // Limits the backed memory of one heap, regardless of the others and of
+  // SetMemoryLimit, e.g. to keep the normal heap within a local DRAM budget
+  // while the cold heap grows.  <numa_partition> selects the partition of
+  // kNormal (see GetNumNumaPartitions()) and is otherwise ignored.  When
+  // the heap grows past its soft limit, its free memory is released, breaking
+  // up hugepages if need be; if it stays above its hard limit, the process
+  // crashes.  Metadata does not count towards these limits.  A limit of 0
+  // means none.  Returns false if the heap does not exist on its own in this
+  // process, or the malloc implementation does not support per-heap limits.
+  static size_t GetHeapMemoryLimit(MemoryHeap heap, int numa_partition,
+                                   LimitKind limit_kind);
+  static bool SetHeapMemoryLimit(MemoryHeap heap, int numa_partition,
+                                 size_t limit, LimitKind limit_kind);
+
+  enum class MemoryPressureLevel {
+    // Usage is below the thresholds below and no pressure is reported.
+    kNone,
+    // Usage has reached tcmalloc_memory_pressure_moderate_percent of the soft
+    // limit, or tasks are stalling on memory (PSI).  Caches should shrink.
+    kModerate,
+    // Usage has reached tcmalloc_memory_pressure_critical_percent of the soft
+    // limit, or tasks are fully stalled on memory.  Allocations may soon fail
+    // or the kernel reclaim memory; free whatever can be freed.
+    kCritical,
+  };
+
+  using MemoryPressureCallback = void (*)(MemoryPressureLevel level);
+
+  // Registers <callback> to be called by the background thread (see
+  // ProcessBackgroundActions) whenever the memory pressure level changes, and
+  // on each of its iterations while the level is kCritical.  Callbacks are
+  // called without any allocator locks held, so they may allocate and free
+  // memory, but they delay the background thread's other work.
+  //
+  // Returns false if the underlying malloc implementation does not support
+  // callbacks, or if too many are registered already.
+  static bool RegisterMemoryPressureCallback(MemoryPressureCallback callback);
+  // Unregisters <callback>.  A notification in progress may still call it.
+  static void UnregisterMemoryPressureCallback(
+      MemoryPressureCallback callback);
+
+  using ReclaimCallback = void (*)(void* arg);
+
+  // Registers <callback> to be called with <arg> by the background thread
+  // whenever it reclaims idle per-CPU caches (see
+  // tcmalloc_idle_cache_reclaim_intervals), so that caches of objects kept
+  // outside of TCMalloc, such as ObjectCache, can shrink with them.  Callbacks
+  // are called without any allocator locks held, but must not register or
+  // unregister callbacks.
+  //
+  // Returns false if the underlying malloc implementation does not support
+  // callbacks, or if too many are registered already.
+  static bool RegisterReclaimCallback(ReclaimCallback callback, void* arg);
+  // Unregisters <callback> with <arg>.  Once this returns, <callback> is no
+  // longer running with <arg> and will not be called with it again.
+  static void UnregisterReclaimCallback(ReclaimCallback callback, void* arg);
+
   // Gets the sampling interval.  Returns a value < 0 if unknown.
   static int64_t GetProfileSamplingInterval();
   // Sets the sampling interval for heap profiles.  TCMalloc samples
   // approximately every interval bytes allocated.
   static void SetProfileSamplingInterval(int64_t interval);
 
+  // Gets the allocation context of the current thread.  Returns 0 if it has
+  // none or if unknown.
+  static uint64_t GetAllocationContext();
+  // Sets the allocation context of the current thread.  The context is
+  // recorded with every sampled allocation the thread makes and reported as
+  // Profile::Sample::allocation_context, so that heap and allocation profiles
+  // can be attributed to e.g. tenants or RPC methods.  Contexts are opaque
+  // integers to TCMalloc; callers that want names intern them themselves.  0
+  // means no context.
+  //
+  // Setting the context only stores it in a thread-local: allocations that are
+  // not sampled do not look at it.
+  static void SetAllocationContext(uint64_t context);
+
+  // Sets the allocation context of the current thread for the lifetime of the
+  // object, restoring the previous one when it is destroyed.
+  class ScopedAllocationContext {
+   public:
+    explicit ScopedAllocationContext(uint64_t context)
+        : previous_(GetAllocationContext()) {
+      SetAllocationContext(context);
+    }
+    ~ScopedAllocationContext() { SetAllocationContext(previous_); }
+
+    ScopedAllocationContext(const ScopedAllocationContext&) = delete;
+    ScopedAllocationContext& operator=(const ScopedAllocationContext&) = delete;
+
+   private:
+    uint64_t previous_;
+  };
+
+  using AllocationBudgetCallback = void (*)(size_t allocated_bytes);
+
+  // Sets the allocation budget of the current thread to <bytes> and starts
+  // counting its allocations anew.  The first time the thread has allocated
+  // more than <bytes> since, the callback set with
+  // SetAllocationBudgetCallback is called on the thread, from within the
+  // allocation that exceeded the budget, with the bytes it allocated.  This
+  // lets servers cancel runaway requests before they exhaust memory, e.g. by
+  // setting a budget when they start serving a request, like its allocation
+  // context.  0 disables the budget.
+  //
+  // Allocations are counted without slowing the fast path down, by charging
+  // the bytes estimated by the sampler whenever it takes its slow path, so
+  // the budget is only as precise as the profile sampling interval (or
+  // 128 MiB with sampling disabled).  Frees are not credited.
+  static void SetAllocationBudget(size_t bytes);
+  // Returns the bytes the current thread allocated since its budget was set,
+  // as counted for the budget.  Returns 0 if it has none or if unknown.
+  static size_t GetAllocationBudgetUsage();
+  // Sets the callback called when a thread exceeds its allocation budget, or
+  // nullptr for none.  The callback is called without allocator locks held,
+  // so it may allocate.
+  static void SetAllocationBudgetCallback(AllocationBudgetCallback callback);
+
+  // The allocator state of the current thread that belongs to the work it runs
+  // rather than to the thread itself: its allocation context, its allocation
+  // budget, and the sampler's count of the bytes left until the next sample.
+  // A value-initialized state is that of work that has not allocated yet.
+  // Apart from allocation_context, the fields are opaque to callers.
+  struct AllocationTaskState {
+    uint64_t allocation_context = 0;
+    size_t budget = 0;
+    size_t budget_usage = 0;
+    bool budget_exceeded = false;
+    int64_t sample_interval = 0;
+    int64_t bytes_until_sample = 0;
+  };
+
+  // Exchanges the allocation task state of the current thread with <state>.
+  // Runtimes that run many tasks (e.g. fibers or coroutines) on each thread
+  // keep a state per task and call this when a task starts running on a
+  // thread and again when it stops, so that allocation contexts, budgets and
+  // sampling weights follow the task rather than the thread:
+  //
+  //   MallocExtension::SwapAllocationTaskState(task->alloc_state);
+  //   task->Run();  // Until it suspends.
+  //   MallocExtension::SwapAllocationTaskState(task->alloc_state);
+  //
+  // This only touches thread-locals, so it costs a few nanoseconds.
+  static void SwapAllocationTaskState(AllocationTaskState& state);
+
   // Gets the guarded sampling rate.  Returns a value < 0 if unknown.
   static int64_t GetGuardedSamplingInterval();
   // Sets the guarded sampling interval for sampled allocations.  TCMalloc
@@ -546,6 +863,157 @@ class MallocExtension final {
   // null.
   static std::optional<size_t> GetAllocatedSize(const void* p);
 
+  // Attempts to resize the allocation p to at least `size` bytes without
+  // moving it, in the manner of xallocx().  Returns the number of bytes
+  // reserved for p afterwards, all of which the client may use; the resize
+  // succeeded if that is at least `size`.
+  //
+  // The reservation of p never changes at present, so this grows p within
+  // the capacity of its size class or pages, and leaves its capacity
+  // untouched when shrinking.  Callers can thus grow containers up to that
+  // capacity without copying, then fall back to realloc().
+  //
+  // p must satisfy the same requirements as for GetAllocatedSize(), and must
+  // not be null.  After growing p in place, it may be freed with a sized
+  // deallocation of any size up to the returned size.
+  static std::optional<size_t> TryResizeInPlace(void* p, size_t size);
+
+  // Allocates ptrs.size() objects of at least `size` bytes each and stores
+  // them in `ptrs`.  Each object behaves as if it was returned by malloc(size)
+  // and may be freed individually with free()/sdallocx() or together with
+  // DeallocateBatch().  Returns the number of objects allocated, which is
+  // smaller than ptrs.size() only when allocation fails.
+  //
+  // This amortizes the per-object fast path cost (cpu lookup, sampling check,
+  // slab header loads) when many objects of the same size are needed at once.
+  static size_t AllocateBatch(size_t size, absl::Span<void*> ptrs);
+
+  // Frees all of the (possibly null) pointers in `ptrs`, as if by calling
+  // free() on each one.  Objects of the same size class that are adjacent in
+  // `ptrs` are freed together.
+  static void DeallocateBatch(absl::Span<void* const> ptrs);
+
+  // Like DeallocateBatch(), but every non-null pointer in `ptrs` must have been
+  // allocated with a requested size of `size` (e.g. via AllocateBatch(size) or
+  // malloc(size)).  The size class is derived from `size` instead of being
+  // looked up for each object, which avoids a pagemap access per object.
+  static void DeallocateSizedBatch(absl::Span<void* const> ptrs, size_t size);
+
+  // A size, alignment and hot/cold hint whose size class has been looked up
+  // once, for code that allocates many objects of the same size, such as
+  // node-based containers.  See GetSizeClassHandle().
+  class SizeClassHandle {
+   public:
+    constexpr SizeClassHandle() = default;
+
+    size_t size() const { return size_; }
+    std::align_val_t alignment() const { return alignment_; }
+    hot_cold_t hot_cold() const { return hot_cold_; }
+
+   private:
+    friend class MallocExtension;
+
+    constexpr SizeClassHandle(size_t size, std::align_val_t alignment,
+                              hot_cold_t hot_cold, uint32_t size_class)
+        : size_(size),
+          alignment_(alignment),
+          hot_cold_(hot_cold),
+          size_class_(size_class) {}
+
+    size_t size_ = 0;
+    std::align_val_t alignment_ =
+        static_cast<std::align_val_t>(alignof(std::max_align_t));
+    hot_cold_t hot_cold_ = static_cast<hot_cold_t>(255);
+    // Opaque to clients.  0 if allocations of the handle take the generic
+    // path, e.g. because they are too large for a size class.
+    uint32_t size_class_ = 0;
+  };
+
+  // Returns a handle for allocations of `size` bytes aligned to `alignment`
+  // with the access hint `hot_cold`.  Handles may be shared between threads
+  // and stay valid for the lifetime of the process, but reflect the
+  // tcmalloc_min_hot_access_hint parameter at the time they were created.
+  static SizeClassHandle GetSizeClassHandle(
+      size_t size,
+      std::align_val_t alignment =
+          static_cast<std::align_val_t>(alignof(std::max_align_t)),
+      hot_cold_t hot_cold = static_cast<hot_cold_t>(255));
+
+  // Allocates an object as ::operator new(handle.size(), handle.alignment(),
+  // handle.hot_cold()) does, including throwing std::bad_alloc on failure,
+  // but without looking up its size class again.
+  static void* AllocateWithHandle(const SizeClassHandle& handle);
+
+  // Frees `p`, which must have been allocated with a handle for the same
+  // size, alignment and hint (or by ::operator new with those), as sized
+  // ::operator delete does.  `p` may be null.
+  static void DeallocateWithHandle(void* p, const SizeClassHandle& handle);
+
+  // Allocates `size` bytes for a large, read-mostly buffer that threads on all
+  // NUMA nodes access alike, such as a table shared by all sockets.  Its pages
+  // are interleaved across the nodes of all NUMA partitions a hugepage at a
+  // time, so that the accesses spread across the memory bandwidth of all of
+  // them, rather than crossing to the one node that TCMalloc would otherwise
+  // bind it to.  Returns nullptr if out of memory.
+  //
+  // The allocation is rounded up to and aligned on whole hugepages, so this is
+  // only worthwhile for buffers of several hugepages.  Without NUMA awareness
+  // (see GetNumNumaPartitions()) or a single node, the memory is placed like
+  // any other.  The result is freed with free() or ::operator delete as usual,
+  // which places its pages like those of other allocations again.  realloc()
+  // returns memory that is only interleaved if it kept the allocation in place.
+  static void* AllocateInterleaved(size_t size);
+
+  // Called with each range of registered memory before buffers are allocated
+  // from it, see SetRegisteredMemoryFactory.
+  using RegisterMemoryCallback = void (*)(void* start, size_t size);
+
+  // Sets the factory of the memory of AllocateRegistered(), such as memory
+  // that is registered with RDMA NICs or GPUs, where registering each buffer
+  // is expensive.  TCMalloc reserves address space and creates regions of it
+  // with `factory` and UsageHint::kRegistered, and allocates memory from them
+  // a hugepage at a time.  `callback` is called once with every range the
+  // regions return, before any buffer is carved out of it, so that memory is
+  // registered at hugepage granularity rather than per buffer.  The callback
+  // runs with a lock held that AllocateRegistered() takes, so it must not call
+  // it.  Returns false if a factory was set already, or if TCMalloc is not
+  // linked in.
+  static bool SetRegisteredMemoryFactory(AddressRegionFactory* factory,
+                                         RegisterMemoryCallback callback);
+
+  // Returns `size` bytes of registered memory, aligned to `size` rounded up to
+  // a power of two, for buffers of up to a hugepage.  Returns nullptr if no
+  // factory is set, if `size` is larger than a hugepage or if the factory is
+  // out of memory.  The memory must be freed with DeallocateRegistered(), not
+  // free() or ::operator delete.  Registered memory is never returned to the
+  // factory: freed buffers are reused for buffers of about the same size.
+  static void* AllocateRegistered(size_t size);
+
+  // Frees `ptr`, which AllocateRegistered(size) returned.  `ptr` may be null.
+  static void DeallocateRegistered(void* ptr, size_t size);
+
+  // A heap partition for objects that are freed all at once, such as the
+  // objects of one request.  Its objects are carved out of spans of its own,
+  // so they do not fragment the spans of other objects, and DestroyHeap()
+  // returns those spans to the page allocator without visiting each object.
+  using Heap = tcmalloc_internal::UserHeap;
+
+  // Returns a new, empty heap, or nullptr if TCMalloc is not linked in.
+  // Heaps may be used from any thread.
+  static Heap* CreateHeap();
+
+  // Returns `size` bytes aligned to `alignment` from `heap`, or nullptr if out
+  // of memory.  The memory must not be passed to free(), ::operator delete or
+  // realloc(): it is only freed by DestroyHeap().  Allocations from heaps are
+  // not sampled for heap profiles.
+  static void* HeapAllocate(
+      Heap* heap, size_t size,
+      std::align_val_t alignment =
+          static_cast<std::align_val_t>(alignof(std::max_align_t)));
+
+  // Frees `heap` and every object allocated from it.  `heap` may be null.
+  static void DestroyHeap(Heap* heap);
+
   // Returns
   // * kOwned if TCMalloc allocated the memory pointed to by p, or
   // * kNotOwned if allocated elsewhere or p is null.
@@ -585,6 +1053,20 @@ class MallocExtension final {
 
   static Profile SnapshotCurrent(tcmalloc::ProfileType type);
 
+  // The sampled heap at one of its largest peaks.
+  struct PeakHeapProfile {
+    // When the peak was reached.
+    absl::Time time;
+    // A profile of type kPeakHeap.
+    Profile profile;
+  };
+
+  // Returns the largest peaks of the sampled heap, largest first, at most one
+  // for each minute.  These are only collected with the
+  // windowed_peak_heap_profiles parameter, so that peaks can be related to
+  // the events that caused them; the result is empty otherwise.
+  static std::vector<PeakHeapProfile> SnapshotTopPeakHeaps();
+
   // AllocationProfilingToken tracks an active profiling session started with
   // StartAllocationProfiling.  Profiling continues until Stop() is called.
   class AllocationProfilingToken {
@@ -620,6 +1102,40 @@ class MallocExtension final {
   // session. Returns null if the implementation does not support profiling.
   static AllocationProfilingToken StartLifetimeProfiling();
 
+  // HeapProfileCursor tracks the changes to the heap profile between calls to
+  // Advance().  It is meant for profilers that poll the heap profile: the cost
+  // of a call is proportional to the number of samples allocated and freed
+  // since the previous one, rather than to the number of live samples.
+  class HeapProfileCursor {
+   public:
+    HeapProfileCursor() = default;
+    HeapProfileCursor(HeapProfileCursor&&) = default;
+    HeapProfileCursor(const HeapProfileCursor&) = delete;
+    ~HeapProfileCursor();
+
+    HeapProfileCursor& operator=(HeapProfileCursor&&) = default;
+    HeapProfileCursor& operator=(const HeapProfileCursor&) = delete;
+
+    // Returns a kHeap profile of the samples allocated since the previous
+    // call, or since StartHeapProfileCursor for the first one, with positive
+    // counts, and of the samples freed meanwhile, with negative counts.
+    // Adding the deltas in order to a SnapshotCurrent(kHeap) taken after the
+    // cursor was created gives the current heap profile.  Samples allocated
+    // or freed while that snapshot is taken may be counted twice.  Returns an
+    // empty profile if the implementation does not support profiling.
+    Profile Advance();
+
+   private:
+    explicit HeapProfileCursor(
+        std::unique_ptr<tcmalloc_internal::HeapProfileCursorBase>);
+
+    std::unique_ptr<tcmalloc_internal::HeapProfileCursorBase> impl_;
+    friend class tcmalloc_internal::HeapProfileCursorAccessor;
+  };
+
+  // Starts tracking changes to the heap profile.
+  static HeapProfileCursor StartHeapProfileCursor();
+
   // Runs housekeeping actions for the allocator off of the main allocation path
   // of new/delete.  As of 2020, this includes:
   // * Inspecting the current CPU mask and releasing memory from inaccessible
@@ -630,6 +1146,26 @@ class MallocExtension final {
   // When linked against TCMalloc, this method does not return.
   static void ProcessBackgroundActions();
 
+  // Returns the number of NUMA partitions TCMalloc keeps separate caches and
+  // page heaps for, i.e. one more than the largest valid argument of
+  // ProcessNumaPartitionBackgroundActions.  This is 1 unless TCMalloc is NUMA
+  // aware.
+  static int GetNumNumaPartitions();
+
+  // Runs the background actions that only concern NUMA <partition> on the
+  // calling thread, after binding it to the CPUs of that partition, so that the
+  // work stays local to the node and runs in parallel with that of other
+  // partitions:
+  // * Reclaiming, shuffling and resizing the per-CPU caches of its CPUs.
+  // * Plundering the transfer cache shards of its CPUs.
+  // * Releasing its share of GetBackgroundReleaseRate() from its page heap.
+  //
+  // ProcessBackgroundActions skips these actions for partitions that are
+  // processed by such a thread, but still needs to run for the rest.  Returns
+  // immediately if <partition> is invalid or already processed by another
+  // thread, and otherwise once background actions are disabled.
+  static void ProcessNumaPartitionBackgroundActions(int partition);
+
   // Return true if ProcessBackgroundActions should be called on this platform.
   // Not all platforms need/support background actions. As of 2021 this
   // includes Apple and Emscripten.
@@ -648,6 +1184,99 @@ class MallocExtension final {
   static void SetBackgroundReleaseRate(BytesPerSecond rate);
 };
 
+// An allocator for standard containers that allocates single objects, such as
+// the nodes of std::map or std::list, through a MallocExtension handle, and
+// arrays through std::allocator.  Rebinding looks up the handle of the
+// new type, so containers do so once, when they are constructed.
+template <typename T>
+class SizeClassHandleAllocator {
+ public:
+  using value_type = T;
+
+  explicit SizeClassHandleAllocator(
+      hot_cold_t hot_cold = static_cast<hot_cold_t>(255))
+      : handle_(MallocExtension::GetSizeClassHandle(
+            sizeof(T), static_cast<std::align_val_t>(alignof(T)), hot_cold)) {}
+
+  template <typename U>
+  SizeClassHandleAllocator(  // NOLINT(google-explicit-constructor)
+      const SizeClassHandleAllocator<U>& other)
+      : SizeClassHandleAllocator(other.handle().hot_cold()) {}
+
+  T* allocate(size_t n) {
+    if (n == 1) {
+      return static_cast<T*>(MallocExtension::AllocateWithHandle(handle_));
+    }
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* p, size_t n) {
+    if (n == 1) {
+      MallocExtension::DeallocateWithHandle(p, handle_);
+      return;
+    }
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  const MallocExtension::SizeClassHandle& handle() const { return handle_; }
+
+  // Allocators for the same hint can free each other's memory.
+  template <typename U>
+  bool operator==(const SizeClassHandleAllocator<U>& other) const {
+    return handle_.hot_cold() == other.handle().hot_cold();
+  }
+  template <typename U>
+  bool operator!=(const SizeClassHandleAllocator<U>& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  MallocExtension::SizeClassHandle handle_;
+};
+
+namespace malloc_extension_internal {
+
+// The handle for objects of kSize bytes aligned to kAlignment, looked up on
+// first use and shared by all types of that size and alignment.
+template <size_t kSize, size_t kAlignment>
+const MallocExtension::SizeClassHandle& HandleFor() {
+  static const MallocExtension::SizeClassHandle handle =
+      MallocExtension::GetSizeClassHandle(
+          kSize, static_cast<std::align_val_t>(kAlignment));
+  return handle;
+}
+
+}  // namespace malloc_extension_internal
+
+// Like `new T(args...)` and `delete p`, but the size class of T is looked up
+// once per size and alignment, rather than on every allocation and
+// deallocation.  An object created by New<T> must be destroyed by Delete<T>
+// with the same T, not a base class of it.
+template <typename T, typename... Args>
+T* New(Args&&... args) {
+  const MallocExtension::SizeClassHandle& handle =
+      malloc_extension_internal::HandleFor<sizeof(T), alignof(T)>();
+  // Frees the memory if the constructor throws.
+  struct Guard {
+    ~Guard() {
+      if (p != nullptr) MallocExtension::DeallocateWithHandle(p, handle);
+    }
+    void* p;
+    const MallocExtension::SizeClassHandle& handle;
+  } guard{MallocExtension::AllocateWithHandle(handle), handle};
+  T* t = ::new (guard.p) T(std::forward<Args>(args)...);
+  guard.p = nullptr;
+  return t;
+}
+
+template <typename T>
+void Delete(T* p) {
+  if (p == nullptr) return;
+  p->~T();
+  MallocExtension::DeallocateWithHandle(
+      p, malloc_extension_internal::HandleFor<sizeof(T), alignof(T)>());
+}
+
 }  // namespace tcmalloc
 
 // The nallocx function allocates no memory, but it performs the same size
@@ -718,6 +1347,14 @@ __sized_ptr_t __size_returning_new_hot_cold(size_t, __hot_cold_t);
 __sized_ptr_t __size_returning_new_aligned(size_t, std::align_val_t);
 __sized_ptr_t __size_returning_new_aligned_hot_cold(size_t, std::align_val_t,
                                                     __hot_cold_t);
+// As above, with a hint of how long the allocation lives instead of how hot it
+// is.  Allocations that are large enough to be placed on their own pages are
+// kept apart from long-lived ones, so that they do not fragment the hugepages
+// that long-lived memory stays on; smaller ones share spans with the rest of
+// their size class, so the hint has no effect on them.
+__sized_ptr_t __size_returning_new_lifetime(size_t, __lifetime_t);
+__sized_ptr_t __size_returning_new_aligned_lifetime(size_t, std::align_val_t,
+                                                    __lifetime_t);
 
 ABSL_DEPRECATE_AND_INLINE()
 inline __sized_ptr_t tcmalloc_size_returning_operator_new(size_t size) {
@@ -783,6 +1420,22 @@ class AllocationProfilingTokenBase {
   virtual Profile Stop() && = 0;
 };
 
+// HeapProfileCursorBase tracks the changes to the heap profile between calls
+// to Advance().
+//
+// As AllocationProfilingTokenBase, this decouples the implementation details
+// (of TCMalloc) from the interface.
+class HeapProfileCursorBase {
+ public:
+  HeapProfileCursorBase() = default;
+
+  virtual ~HeapProfileCursorBase() = default;
+
+  // Returns the samples allocated, with positive counts, and freed, with
+  // negative counts, since the previous call.
+  virtual Profile Advance() = 0;
+};
+
 // ProfileBase contains a profile of allocations.
 //
 // This decouples the implementation details (of TCMalloc) from the interface,
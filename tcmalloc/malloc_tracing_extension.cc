@@ -37,5 +37,15 @@ absl::StatusOr<AllocatedAddressRanges> GetAllocatedAddressRanges() {
       "malloc_tracing_extension routines not exported by the current malloc.");
 }
 
+absl::StatusOr<AllocationTrace> DrainAllocationTrace() {
+#if ABSL_HAVE_ATTRIBUTE_WEAK && !defined(__APPLE__) && !defined(__EMSCRIPTEN__)
+  if (&MallocTracingExtension_Internal_DrainAllocationTrace != nullptr) {
+    return MallocTracingExtension_Internal_DrainAllocationTrace();
+  }
+#endif
+  return absl::UnimplementedError(
+      "malloc_tracing_extension routines not exported by the current malloc.");
+}
+
 }  // namespace malloc_tracing_extension
 }  // namespace tcmalloc
@@ -48,6 +48,43 @@ struct AllocatedAddressRanges {
 // Returns the address ranges currently allocated by TCMalloc.
 absl::StatusOr<AllocatedAddressRanges> GetAllocatedAddressRanges();
 
+// One allocation or deallocation recorded by the allocation trace.
+struct AllocationTraceEvent {
+  enum class Kind : uint8_t { kAllocation, kDeallocation };
+
+  // When the event happened, in absl::base_internal::CycleClock ticks.
+  int64_t timestamp;
+  // A bijective hash of the object's address.  It identifies the object from
+  // its allocation to its deallocation without recording the address itself.
+  uint64_t address_hash;
+  // The requested size of an allocation.  For a deallocation, the size passed
+  // to sized delete, or 0 if none was.
+  uint64_t size;
+  // Identifies the calling thread.  Threads are numbered from 1 in the order
+  // of their first traced event.
+  uint32_t thread;
+  Kind kind;
+};
+
+// Type used by DrainAllocationTrace.
+struct AllocationTrace {
+  // The events recorded since the previous drain.  Events are recorded into a
+  // ring buffer per CPU and are returned one ring after the other: sort them
+  // by timestamp to recover the order of the whole process.
+  std::vector<AllocationTraceEvent> events;
+  // The number of events overwritten before they could be drained.
+  uint64_t dropped;
+};
+// Returns the events recorded by TCMalloc's allocation trace since the last
+// call.  Tracing requires TCMalloc to be built with
+// -DTCMALLOC_INTERNAL_ALLOCATION_TRACE; other builds return
+// FailedPreconditionError.  The rings hold a limited number of events, so a
+// process being traced should drain them every few milliseconds, for example
+// from a dedicated thread.  Allocations made by the drain itself are traced.
+//
+// See tcmalloc/testing/allocation_trace_replay.cc for replaying a trace.
+absl::StatusOr<AllocationTrace> DrainAllocationTrace();
+
 }  // namespace malloc_tracing_extension
 }  // namespace tcmalloc
 
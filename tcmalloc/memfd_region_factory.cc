@@ -0,0 +1,92 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/memfd_region_factory.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <optional>
+
+#include "absl/types/span.h"
+#include "tcmalloc/malloc_extension.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+namespace tcmalloc {
+
+MemfdRegionFactory::~MemfdRegionFactory() {
+  // The regions, and so the memfd, are never unmapped.
+}
+
+AddressRegion* MemfdRegionFactory::Create(void* start, size_t size,
+                                          UsageHint hint) {
+  if (hint != shared_hint_) {
+    return underlying_->Create(start, size, hint);
+  }
+#ifdef SYS_memfd_create
+  const int saved_errno = errno;
+  if (regions_.full()) return nullptr;
+
+  int fd = fd_.load(std::memory_order_relaxed);
+  if (fd < 0) {
+    fd = syscall(SYS_memfd_create, "tcmalloc_shared", MFD_CLOEXEC);
+    if (fd < 0) {
+      errno = saved_errno;
+      return nullptr;
+    }
+    fd_.store(fd, std::memory_order_release);
+  }
+
+  // The memfd is sparse: only the pages that are touched take memory.
+  const size_t offset = regions_.file_size();
+  if (ftruncate(fd, offset + size) != 0 ||
+      mmap(start, size, PROT_NONE, MAP_SHARED | MAP_FIXED, fd, offset) ==
+          MAP_FAILED) {
+    errno = saved_errno;
+    return nullptr;
+  }
+  errno = saved_errno;
+
+  AddressRegion* region = underlying_->Create(start, size, hint);
+  if (region == nullptr) return nullptr;
+  regions_.Add(start, size);
+  return region;
+#else
+  return nullptr;
+#endif
+}
+
+size_t MemfdRegionFactory::GetStats(absl::Span<char> buffer) {
+  return underlying_->GetStats(buffer);
+}
+
+size_t MemfdRegionFactory::GetStatsInPbtxt(absl::Span<char> buffer) {
+  return underlying_->GetStatsInPbtxt(buffer);
+}
+
+std::optional<MemfdRegionFactory::Location> MemfdRegionFactory::Lookup(
+    const void* p) const {
+  std::optional<size_t> offset = regions_.Offset(p);
+  if (!offset.has_value()) return std::nullopt;
+  return Location{fd_.load(std::memory_order_relaxed), *offset};
+}
+
+}  // namespace tcmalloc
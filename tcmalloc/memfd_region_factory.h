@@ -0,0 +1,95 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An AddressRegionFactory that backs the memory of one usage hint with a
+// memfd, so that allocations from it can be shared with another process
+// without copying.
+
+#ifndef TCMALLOC_MEMFD_REGION_FACTORY_H_
+#define TCMALLOC_MEMFD_REGION_FACTORY_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <optional>
+
+#include "absl/types/span.h"
+#include "tcmalloc/internal/mapped_regions.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+
+// Maps the regions created for `shared_hint` from a single memfd, and creates
+// every region with `underlying`.  Another process that receives fd() (over a
+// Unix socket, or via /proc/<pid>/fd) can map an allocation from such a region
+// at the offset that Lookup() returns.
+//
+// For example, to share cold allocations (those made with a hot_cold_t hint
+// below tcmalloc_min_hot_access_hint):
+//
+//   static auto* factory = new MemfdRegionFactory(
+//       MallocExtension::GetRegionFactory(),
+//       AddressRegionFactory::UsageHint::kInfrequentAccess);
+//   MallocExtension::SetRegionFactory(factory);
+//   char* buffer = static_cast<char*>(
+//       ::operator new(size, static_cast<hot_cold_t>(0)));
+//   std::optional<MemfdRegionFactory::Location> location =
+//       factory->Lookup(buffer);
+//
+// Everything TCMalloc places in those regions is visible to processes that
+// map the memfd, not only the buffers meant to be shared.  Memory that
+// TCMalloc releases is removed from the memfd (MADV_REMOVE), so that it reads
+// as zeroes in every mapping.
+//
+// `underlying` must not map over the range given to Create, as the default
+// factory does not, since the memfd is already mapped there.  The factory
+// must outlive all allocations from its regions, that is, never be deleted.
+class MemfdRegionFactory final : public AddressRegionFactory {
+ public:
+  static constexpr int kMaxRegions =
+      tcmalloc_internal::MappedRegions::kMaxRegions;
+
+  struct Location {
+    int fd;
+    size_t offset;
+  };
+
+  MemfdRegionFactory(AddressRegionFactory* underlying, UsageHint shared_hint)
+      : underlying_(underlying), shared_hint_(shared_hint) {}
+  ~MemfdRegionFactory() override;
+
+  AddressRegion* Create(void* start, size_t size, UsageHint hint) override;
+  size_t GetStats(absl::Span<char> buffer) override;
+  size_t GetStatsInPbtxt(absl::Span<char> buffer) override;
+
+  // The memfd, or -1 until the first region for the shared hint is created.
+  int fd() const { return fd_.load(std::memory_order_acquire); }
+
+  // The total size of the regions mapped from the memfd.
+  size_t shared_bytes() const { return regions_.bytes(); }
+
+  // Returns the location of `p` in fd(), or std::nullopt if `p` is not in a
+  // region mapped from it.  Lock free.
+  std::optional<Location> Lookup(const void* p) const;
+
+ private:
+  AddressRegionFactory* const underlying_;
+  const UsageHint shared_hint_;
+  std::atomic<int> fd_{-1};
+  tcmalloc_internal::MappedRegions regions_;
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_MEMFD_REGION_FACTORY_H_
@@ -0,0 +1,108 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/memfd_region_factory.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <optional>
+#include <utility>
+
+#include "gtest/gtest.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace {
+
+using UsageHint = AddressRegionFactory::UsageHint;
+
+constexpr size_t kRegionSize = size_t{64} << 20;
+
+// Reserves address space for a region, as TCMalloc does before Create.
+void* Reserve(size_t size) {
+  void* p = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  EXPECT_NE(p, MAP_FAILED);
+  return p;
+}
+
+TEST(MemfdRegionFactoryTest, SharesAllocations) {
+  MemfdRegionFactory factory(MallocExtension::GetRegionFactory(),
+                             UsageHint::kInfrequentAccess);
+  EXPECT_EQ(factory.fd(), -1);
+
+  void* start = Reserve(kRegionSize);
+  AddressRegion* region =
+      factory.Create(start, kRegionSize, UsageHint::kInfrequentAccess);
+  ASSERT_NE(region, nullptr);
+  ASSERT_GE(factory.fd(), 0);
+  EXPECT_EQ(factory.shared_bytes(), kRegionSize);
+
+  const size_t page = getpagesize();
+  auto [p, size] = region->Alloc(page, page);
+  ASSERT_NE(p, nullptr);
+  memcpy(p, "shared", 7);
+
+  std::optional<MemfdRegionFactory::Location> location = factory.Lookup(p);
+  ASSERT_TRUE(location.has_value());
+  EXPECT_EQ(location->fd, factory.fd());
+  EXPECT_EQ(location->offset % page, 0);
+
+  // A second mapping of the memfd, as another process would make, sees the
+  // same memory.
+  void* view = mmap(nullptr, page, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    location->fd, location->offset);
+  ASSERT_NE(view, MAP_FAILED);
+  EXPECT_STREQ(static_cast<char*>(view), "shared");
+  memcpy(view, "reply", 6);
+  EXPECT_STREQ(static_cast<char*>(p), "reply");
+  EXPECT_EQ(munmap(view, page), 0);
+
+  EXPECT_FALSE(factory.Lookup(&factory).has_value());
+}
+
+TEST(MemfdRegionFactoryTest, OtherHintsAreNotShared) {
+  MemfdRegionFactory factory(MallocExtension::GetRegionFactory(),
+                             UsageHint::kInfrequentAccess);
+  void* start = Reserve(kRegionSize);
+  AddressRegion* region =
+      factory.Create(start, kRegionSize, UsageHint::kNormal);
+  ASSERT_NE(region, nullptr);
+  EXPECT_EQ(factory.fd(), -1);
+  EXPECT_EQ(factory.shared_bytes(), 0);
+
+  auto [p, size] = region->Alloc(getpagesize(), getpagesize());
+  ASSERT_NE(p, nullptr);
+  EXPECT_FALSE(factory.Lookup(p).has_value());
+}
+
+TEST(MemfdRegionFactoryTest, RegionsHaveDistinctOffsets) {
+  MemfdRegionFactory factory(MallocExtension::GetRegionFactory(),
+                             UsageHint::kInfrequentAccess);
+  void* a = Reserve(kRegionSize);
+  void* b = Reserve(kRegionSize);
+  ASSERT_NE(factory.Create(a, kRegionSize, UsageHint::kInfrequentAccess),
+            nullptr);
+  ASSERT_NE(factory.Create(b, kRegionSize, UsageHint::kInfrequentAccess),
+            nullptr);
+  EXPECT_EQ(factory.Lookup(a)->offset, 0);
+  EXPECT_EQ(factory.Lookup(b)->offset, kRegionSize);
+  EXPECT_EQ(factory.Lookup(static_cast<char*>(b) + 100)->offset,
+            kRegionSize + 100);
+}
+
+}  // namespace
+}  // namespace tcmalloc
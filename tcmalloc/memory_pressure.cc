@@ -0,0 +1,112 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/memory_pressure.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <optional>
+
+#include "absl/base/attributes.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/sysinfo.h"
+#include "tcmalloc/page_allocator.h"
+#include "tcmalloc/parameters.h"
+#include "tcmalloc/static_vars.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+bool MemoryPressureNotifier::Register(Callback callback) {
+  for (std::atomic<Callback>& slot : callbacks_) {
+    Callback expected = nullptr;
+    if (slot.compare_exchange_strong(expected, callback,
+                                     std::memory_order_acq_rel)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void MemoryPressureNotifier::Unregister(Callback callback) {
+  for (std::atomic<Callback>& slot : callbacks_) {
+    Callback expected = callback;
+    if (slot.compare_exchange_strong(expected, nullptr,
+                                     std::memory_order_acq_rel)) {
+      return;
+    }
+  }
+}
+
+bool MemoryPressureNotifier::has_callbacks() const {
+  return std::any_of(std::begin(callbacks_), std::end(callbacks_),
+                     [](const std::atomic<Callback>& slot) {
+                       return slot.load(std::memory_order_relaxed) != nullptr;
+                     });
+}
+
+void MemoryPressureNotifier::Update() {
+  if (!has_callbacks()) {
+    // Callbacks registered later are first told the current level, even if it
+    // is kNone.
+    last_level_ = Level::kNone;
+    return;
+  }
+  Notify(ComputeLevel(tc_globals.page_allocator().SoftLimitUsagePercent(),
+                      ReadMemoryPressure()));
+}
+
+void MemoryPressureNotifier::Notify(Level level) {
+  const bool changed = level != last_level_;
+  last_level_ = level;
+  if (!changed && level != Level::kCritical) return;
+
+  for (std::atomic<Callback>& slot : callbacks_) {
+    Callback callback = slot.load(std::memory_order_acquire);
+    if (callback != nullptr) {
+      callback(level);
+    }
+  }
+}
+
+MemoryPressureNotifier::Level MemoryPressureNotifier::ComputeLevel(
+    double soft_limit_usage_percent, std::optional<MemoryPressure> pressure) {
+  // A threshold of 0 disables it.
+  auto reached = [&](uint32_t threshold) {
+    return threshold > 0 && soft_limit_usage_percent >= threshold;
+  };
+
+  if (reached(Parameters::memory_pressure_critical_percent()) ||
+      (pressure.has_value() && pressure->full_avg10 >= kStallPercent)) {
+    return Level::kCritical;
+  }
+  if (reached(Parameters::memory_pressure_moderate_percent()) ||
+      (pressure.has_value() && pressure->some_avg10 >= kStallPercent)) {
+    return Level::kModerate;
+  }
+  return Level::kNone;
+}
+
+MemoryPressureNotifier& memory_pressure_notifier() {
+  ABSL_CONST_INIT static MemoryPressureNotifier notifier;
+  return notifier;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,81 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_MEMORY_PRESSURE_H_
+#define TCMALLOC_MEMORY_PRESSURE_H_
+
+#include <atomic>
+#include <optional>
+
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/sysinfo.h"
+#include "tcmalloc/malloc_extension.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Calls the callbacks registered with
+// MallocExtension::RegisterMemoryPressureCallback as the memory pressure level
+// changes.  The level follows the backed memory relative to the soft limit
+// (see Parameters::memory_pressure_moderate_percent and
+// Parameters::memory_pressure_critical_percent) and the memory stall time
+// reported by PSI, whichever is higher.
+class MemoryPressureNotifier {
+ public:
+  using Level = MallocExtension::MemoryPressureLevel;
+  using Callback = MallocExtension::MemoryPressureCallback;
+
+  static constexpr int kMaxCallbacks = 16;
+  // PSI stall time, in percent of the last 10 seconds, at which some tasks
+  // stalling is kModerate and all tasks stalling is kCritical.
+  static constexpr double kStallPercent = 10.0;
+
+  constexpr MemoryPressureNotifier() = default;
+
+  MemoryPressureNotifier(const MemoryPressureNotifier&) = delete;
+  MemoryPressureNotifier& operator=(const MemoryPressureNotifier&) = delete;
+
+  // Returns false if kMaxCallbacks are registered already.
+  bool Register(Callback callback);
+  void Unregister(Callback callback);
+
+  // Reads the current level and notifies the callbacks.  Does nothing, not
+  // even reading PSI, while none are registered.  Called by the background
+  // thread, which must not hold any allocator locks.
+  void Update();
+
+  // Calls the callbacks with <level> if it differs from the previous one or
+  // is kCritical.  Not thread safe: only Update, or tests, call this.
+  void Notify(Level level);
+
+  // Returns the level for backed memory at <soft_limit_usage_percent> of the
+  // soft limit (0 if there is none) and PSI <pressure>.
+  static Level ComputeLevel(double soft_limit_usage_percent,
+                            std::optional<MemoryPressure> pressure);
+
+ private:
+  bool has_callbacks() const;
+
+  std::atomic<Callback> callbacks_[kMaxCallbacks]{};
+  Level last_level_ = Level::kNone;
+};
+
+MemoryPressureNotifier& memory_pressure_notifier();
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_MEMORY_PRESSURE_H_
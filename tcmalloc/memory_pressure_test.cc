@@ -0,0 +1,123 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/memory_pressure.h"
+
+#include <optional>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "tcmalloc/internal/sysinfo.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/parameters.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+using Level = MemoryPressureNotifier::Level;
+using testing::ElementsAre;
+
+std::vector<Level>& Received() {
+  static std::vector<Level> received;
+  return received;
+}
+
+void RecordLevel(Level level) { Received().push_back(level); }
+void OtherCallback(Level) {}
+
+TEST(MemoryPressureTest, ComputeLevelFromLimit) {
+  Parameters::set_memory_pressure_moderate_percent(90);
+  Parameters::set_memory_pressure_critical_percent(98);
+
+  EXPECT_EQ(MemoryPressureNotifier::ComputeLevel(0, std::nullopt),
+            Level::kNone);
+  EXPECT_EQ(MemoryPressureNotifier::ComputeLevel(89.9, std::nullopt),
+            Level::kNone);
+  EXPECT_EQ(MemoryPressureNotifier::ComputeLevel(90, std::nullopt),
+            Level::kModerate);
+  EXPECT_EQ(MemoryPressureNotifier::ComputeLevel(98, std::nullopt),
+            Level::kCritical);
+  EXPECT_EQ(MemoryPressureNotifier::ComputeLevel(150, std::nullopt),
+            Level::kCritical);
+
+  // A threshold of 0 is disabled.
+  Parameters::set_memory_pressure_critical_percent(0);
+  EXPECT_EQ(MemoryPressureNotifier::ComputeLevel(150, std::nullopt),
+            Level::kModerate);
+  Parameters::set_memory_pressure_moderate_percent(0);
+  EXPECT_EQ(MemoryPressureNotifier::ComputeLevel(150, std::nullopt),
+            Level::kNone);
+
+  Parameters::set_memory_pressure_moderate_percent(90);
+  Parameters::set_memory_pressure_critical_percent(98);
+}
+
+TEST(MemoryPressureTest, ComputeLevelFromPsi) {
+  const double kStall = MemoryPressureNotifier::kStallPercent;
+  EXPECT_EQ(MemoryPressureNotifier::ComputeLevel(
+                0, MemoryPressure{.some_avg10 = kStall / 2}),
+            Level::kNone);
+  EXPECT_EQ(MemoryPressureNotifier::ComputeLevel(
+                0, MemoryPressure{.some_avg10 = kStall}),
+            Level::kModerate);
+  EXPECT_EQ(MemoryPressureNotifier::ComputeLevel(
+                0, MemoryPressure{.some_avg10 = kStall, .full_avg10 = kStall}),
+            Level::kCritical);
+  // The higher of the two is reported.
+  EXPECT_EQ(MemoryPressureNotifier::ComputeLevel(
+                99, MemoryPressure{.some_avg10 = kStall}),
+            Level::kCritical);
+}
+
+TEST(MemoryPressureTest, NotifiesOnChanges) {
+  MemoryPressureNotifier notifier;
+  Received().clear();
+  ASSERT_TRUE(notifier.Register(&RecordLevel));
+
+  notifier.Notify(Level::kNone);
+  notifier.Notify(Level::kModerate);
+  notifier.Notify(Level::kModerate);
+  // kCritical is repeated while it lasts.
+  notifier.Notify(Level::kCritical);
+  notifier.Notify(Level::kCritical);
+  notifier.Notify(Level::kNone);
+  notifier.Notify(Level::kNone);
+  EXPECT_THAT(Received(),
+              ElementsAre(Level::kModerate, Level::kCritical, Level::kCritical,
+                          Level::kNone));
+
+  notifier.Unregister(&RecordLevel);
+  Received().clear();
+  notifier.Notify(Level::kCritical);
+  EXPECT_THAT(Received(), ElementsAre());
+}
+
+TEST(MemoryPressureTest, RegistrationLimit) {
+  MemoryPressureNotifier notifier;
+  for (int i = 0; i < MemoryPressureNotifier::kMaxCallbacks; ++i) {
+    EXPECT_TRUE(notifier.Register(&OtherCallback));
+  }
+  EXPECT_FALSE(notifier.Register(&RecordLevel));
+
+  // Unregistering frees one slot, even for a callback registered repeatedly.
+  notifier.Unregister(&OtherCallback);
+  EXPECT_TRUE(notifier.Register(&RecordLevel));
+  EXPECT_FALSE(notifier.Register(&RecordLevel));
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
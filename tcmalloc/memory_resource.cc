@@ -0,0 +1,135 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/memory_resource.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/new_extension.h"
+
+namespace tcmalloc {
+
+MemoryResource* MemoryResource::Hot() {
+  static MemoryResource* resource =
+      new MemoryResource(static_cast<hot_cold_t>(255));
+  return resource;
+}
+
+MemoryResource* MemoryResource::Cold() {
+  static MemoryResource* resource =
+      new MemoryResource(static_cast<hot_cold_t>(0));
+  return resource;
+}
+
+void* MemoryResource::do_allocate(size_t bytes, size_t alignment) {
+  if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    return ::operator new(bytes, hot_cold_);
+  }
+  return ::operator new(bytes, static_cast<std::align_val_t>(alignment),
+                        hot_cold_);
+}
+
+void MemoryResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+  if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    ::operator delete(p, bytes);
+    return;
+  }
+  ::operator delete(p, bytes, static_cast<std::align_val_t>(alignment));
+}
+
+bool MemoryResource::do_is_equal(
+    const std::pmr::memory_resource& other) const noexcept {
+  return dynamic_cast<const MemoryResource*>(&other) != nullptr;
+}
+
+void HugePageArenaResource::release() {
+  while (blocks_ != nullptr) {
+    Block* block = blocks_;
+    blocks_ = block->next;
+    ::operator delete(block, block->size,
+                      static_cast<std::align_val_t>(block->alignment));
+  }
+  block_bytes_ = 0;
+  current_ = nullptr;
+  end_ = nullptr;
+}
+
+HugePageArenaResource::Block* HugePageArenaResource::NewBlock(
+    size_t bytes, size_t alignment) {
+  const size_t block_alignment = std::max(kBlockSize, alignment);
+  // The header takes up to <alignment> bytes ahead of the first allocation.
+  const size_t header = std::max(sizeof(Block), alignment);
+  // On overflow, ask for more than can be allocated, so that ::operator new
+  // reports the failure.
+  size_t size = std::numeric_limits<size_t>::max();
+  if (bytes <= size - header - kBlockSize) {
+    size = (header + bytes + kBlockSize - 1) / kBlockSize * kBlockSize;
+  }
+
+  Block* block = static_cast<Block*>(
+      ::operator new(size, static_cast<std::align_val_t>(block_alignment)));
+  block->next = blocks_;
+  block->size = size;
+  block->alignment = block_alignment;
+  blocks_ = block;
+  block_bytes_ += size;
+  return block;
+}
+
+void* HugePageArenaResource::do_allocate(size_t bytes, size_t alignment) {
+  auto align_up = [alignment](uintptr_t p) {
+    return (p + alignment - 1) & ~(alignment - 1);
+  };
+
+  const uintptr_t p = align_up(reinterpret_cast<uintptr_t>(current_));
+  if (current_ != nullptr && p <= reinterpret_cast<uintptr_t>(end_) &&
+      bytes <= reinterpret_cast<uintptr_t>(end_) - p) {
+    current_ = reinterpret_cast<char*>(p + bytes);
+    return reinterpret_cast<void*>(p);
+  }
+
+  Block* block = NewBlock(bytes, alignment);
+  char* start = reinterpret_cast<char*>(
+      align_up(reinterpret_cast<uintptr_t>(block + 1)));
+  char* end = reinterpret_cast<char*>(block) + block->size;
+  // Keep carving from whichever block has more room left, so that a large
+  // allocation does not waste the rest of the current block.
+  if (current_ == nullptr || end - (start + bytes) > end_ - current_) {
+    current_ = start + bytes;
+    end_ = end;
+  }
+  return start;
+}
+
+void HugePageArenaResource::do_deallocate(void* p, size_t bytes,
+                                          size_t alignment) {
+  // Memory is released with the blocks.
+  static_cast<void>(p);
+  static_cast<void>(bytes);
+  static_cast<void>(alignment);
+}
+
+bool HugePageArenaResource::do_is_equal(
+    const std::pmr::memory_resource& other) const noexcept {
+  return this == &other;
+}
+
+}  // namespace tcmalloc
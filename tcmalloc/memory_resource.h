@@ -0,0 +1,103 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// std::pmr::memory_resource implementations for TCMalloc.
+
+#ifndef TCMALLOC_MEMORY_RESOURCE_H_
+#define TCMALLOC_MEMORY_RESOURCE_H_
+
+#include <cstddef>
+#include <memory_resource>
+
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+
+// Allocates with the hot/cold ::operator new of TCMalloc and frees with sized
+// ::operator delete, so that, unlike std::pmr::new_delete_resource(), the
+// size and the access hint of every allocation reach the allocator.
+//
+// All MemoryResources compare equal: memory allocated by one can be freed by
+// any other, whatever their hints.
+class MemoryResource final : public std::pmr::memory_resource {
+ public:
+  explicit MemoryResource(hot_cold_t hot_cold = static_cast<hot_cold_t>(255))
+      : hot_cold_(hot_cold) {}
+
+  hot_cold_t hot_cold() const { return hot_cold_; }
+
+  // Returns a resource for memory that is accessed frequently (hint 255) or
+  // rarely (hint 0), which lives for the lifetime of the process.
+  static MemoryResource* Hot();
+  static MemoryResource* Cold();
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override;
+
+  hot_cold_t hot_cold_;
+};
+
+// A monotonic resource, like std::pmr::monotonic_buffer_resource, that carves
+// allocations out of hugepage-sized and -aligned blocks, which TCMalloc backs
+// with whole hugepages.  Deallocation does nothing: memory is only returned,
+// a block at a time, by release() or the destructor.  Allocations too large
+// to share a block get blocks of their own.
+//
+// Not thread safe.
+class HugePageArenaResource final : public std::pmr::memory_resource {
+ public:
+  static constexpr size_t kBlockSize = size_t{2} << 20;
+
+  HugePageArenaResource() = default;
+  ~HugePageArenaResource() override { release(); }
+
+  HugePageArenaResource(const HugePageArenaResource&) = delete;
+  HugePageArenaResource& operator=(const HugePageArenaResource&) = delete;
+
+  // Frees all of the blocks, and with them every allocation made from this.
+  void release();
+
+  // The total size of the blocks currently held.
+  size_t block_bytes() const { return block_bytes_; }
+
+ private:
+  // Stored at the start of each block.
+  struct Block {
+    Block* next;
+    size_t size;
+    size_t alignment;
+  };
+
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override;
+
+  // Returns a new block with room for <bytes> aligned to <alignment> after
+  // its header, and adds it to blocks_.
+  Block* NewBlock(size_t bytes, size_t alignment);
+
+  Block* blocks_ = nullptr;
+  size_t block_bytes_ = 0;
+  // The unused part of the current block.
+  char* current_ = nullptr;
+  char* end_ = nullptr;
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_MEMORY_RESOURCE_H_
@@ -0,0 +1,139 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/memory_resource.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace {
+
+TEST(MemoryResourceTest, AllocatesWithAlignment) {
+  for (MemoryResource* resource :
+       {MemoryResource::Hot(), MemoryResource::Cold()}) {
+    for (size_t size : {1, 8, 100, 4096, 300000}) {
+      for (size_t alignment : {1, 8, 16, 64, 4096}) {
+        void* p = resource->allocate(size, alignment);
+        ASSERT_NE(p, nullptr);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % alignment, 0);
+        EXPECT_GE(MallocExtension::GetAllocatedSize(p), size);
+        memset(p, 0xcd, size);
+        resource->deallocate(p, size, alignment);
+      }
+    }
+  }
+}
+
+TEST(MemoryResourceTest, Equality) {
+  MemoryResource hot;
+  MemoryResource cold(static_cast<hot_cold_t>(0));
+  EXPECT_TRUE(hot.is_equal(cold));
+  EXPECT_TRUE(hot.is_equal(*MemoryResource::Cold()));
+  EXPECT_FALSE(hot.is_equal(*std::pmr::new_delete_resource()));
+
+  // Memory can be freed through any of them.
+  void* p = hot.allocate(64);
+  cold.deallocate(p, 64);
+}
+
+TEST(MemoryResourceTest, Containers) {
+  std::pmr::map<int, std::pmr::string> m(MemoryResource::Cold());
+  for (int i = 0; i < 1000; ++i) {
+    m[i] = std::pmr::string(100, 'a' + i % 26);
+  }
+  std::pmr::vector<int> v(MemoryResource::Hot());
+  for (int i = 0; i < 100000; ++i) {
+    v.push_back(i);
+  }
+  EXPECT_EQ(m[5].size(), 100);
+  EXPECT_EQ(v[99999], 99999);
+}
+
+TEST(HugePageArenaResourceTest, CarvesFromBlocks) {
+  HugePageArenaResource arena;
+  EXPECT_EQ(arena.block_bytes(), 0);
+
+  std::vector<char*> ptrs;
+  for (int i = 0; i < 10000; ++i) {
+    const size_t alignment = size_t{1} << (i % 7);
+    char* p = static_cast<char*>(arena.allocate(100, alignment));
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % alignment, 0);
+    memset(p, i, 100);
+    ptrs.push_back(p);
+  }
+  // 10000 objects of 100 bytes with some padding fit in one block.
+  EXPECT_EQ(arena.block_bytes(), HugePageArenaResource::kBlockSize);
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_EQ(ptrs[i][99], static_cast<char>(i));
+  }
+
+  // Blocks are hugepage aligned.
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ptrs[0]) &
+                ~(HugePageArenaResource::kBlockSize - 1),
+            reinterpret_cast<uintptr_t>(ptrs[9999]) &
+                ~(HugePageArenaResource::kBlockSize - 1));
+
+  arena.release();
+  EXPECT_EQ(arena.block_bytes(), 0);
+}
+
+TEST(HugePageArenaResourceTest, LargeAllocations) {
+  HugePageArenaResource arena;
+  char* small = static_cast<char*>(arena.allocate(64));
+
+  // A block of its own, which does not take over from the current block.
+  const size_t kLarge = 3 * HugePageArenaResource::kBlockSize;
+  char* large = static_cast<char*>(arena.allocate(kLarge, 4096));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(large) % 4096, 0);
+  memset(large, 0xcd, kLarge);
+  EXPECT_EQ(arena.block_bytes(), 5 * HugePageArenaResource::kBlockSize);
+
+  char* next = static_cast<char*>(arena.allocate(64));
+  EXPECT_EQ(next, small + 64);
+
+  // Over-aligned allocations.
+  void* aligned = arena.allocate(8, 2 * HugePageArenaResource::kBlockSize);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) %
+                (2 * HugePageArenaResource::kBlockSize),
+            0);
+}
+
+TEST(HugePageArenaResourceTest, Containers) {
+  HugePageArenaResource arena;
+  {
+    std::pmr::map<int, std::pmr::string> m(&arena);
+    for (int i = 0; i < 10000; ++i) {
+      m[i] = std::pmr::string(50, 'a' + i % 26);
+    }
+    EXPECT_EQ(m[7][0], 'h');
+  }
+  EXPECT_GT(arena.block_bytes(), 0);
+  EXPECT_TRUE(arena.is_equal(arena));
+  HugePageArenaResource other;
+  EXPECT_FALSE(arena.is_equal(other));
+}
+
+}  // namespace
+}  // namespace tcmalloc
@@ -28,8 +28,10 @@
 #include "absl/hash/hash.h"
 #include "absl/numeric/bits.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "tcmalloc/arena.h"
 #include "tcmalloc/common.h"
+#include "tcmalloc/huge_cache.h"
 #include "tcmalloc/huge_pages.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
@@ -45,13 +47,13 @@ namespace huge_page_allocator_internal {
 class FakeStaticForwarder {
  public:
   // Runtime parameters.  This can change between calls.
-  absl::Duration filler_skip_subrelease_interval() {
+  absl::Duration filler_skip_subrelease_interval() const {
     return subrelease_interval_;
   }
-  absl::Duration filler_skip_subrelease_short_interval() {
+  absl::Duration filler_skip_subrelease_short_interval() const {
     return short_interval_;
   }
-  absl::Duration filler_skip_subrelease_long_interval() {
+  absl::Duration filler_skip_subrelease_long_interval() const {
     return long_interval_;
   }
   absl::Duration cache_demand_release_short_interval() {
@@ -60,7 +62,9 @@ class FakeStaticForwarder {
   absl::Duration cache_demand_release_long_interval() {
     return cache_demand_release_long_interval_;
   }
-  bool release_partial_alloc_pages() { return release_partial_alloc_pages_; }
+  bool release_partial_alloc_pages() const {
+    return release_partial_alloc_pages_;
+  }
   bool hpaa_subrelease() const { return hpaa_subrelease_; }
 
   void set_filler_skip_subrelease_interval(absl::Duration v) {
@@ -82,8 +86,34 @@ class FakeStaticForwarder {
     release_partial_alloc_pages_ = v;
   }
   void set_hpaa_subrelease(bool v) { hpaa_subrelease_ = v; }
+  bool hugepages_available() const { return hugepages_available_; }
+  void set_hugepages_available(bool v) { hugepages_available_ = v; }
+  bool gigantic_pages() const { return false; }
+  bool lifetime_based_allocation() const { return lifetime_based_allocation_; }
+  void set_lifetime_based_allocation(bool v) {
+    lifetime_based_allocation_ = v;
+  }
   bool release_succeeds() const { return release_succeeds_; }
   void set_release_succeeds(bool v) { release_succeeds_ = v; }
+  // Fake allocations hold no memory, so they only read as zero if a test says
+  // so.
+  bool ReleasedPagesAreZero() const { return released_pages_are_zero_; }
+  void set_released_pages_are_zero(bool v) { released_pages_are_zero_ = v; }
+
+  bool ReleasedPagesAreLazy() const { return released_pages_are_lazy_; }
+  void set_released_pages_are_lazy(bool v) { released_pages_are_lazy_ = v; }
+  // The fake memory is never reclaimed.
+  Length ResidentPages(PageId start, Length size) { return size; }
+  // Fake memory is resident unless a test says otherwise, in which case
+  // releasing it succeeds without calling ReleasePages.
+  void ReleaseResidentPages(absl::Span<MemoryModifyRange> ranges) {
+    for (MemoryModifyRange& r : ranges) {
+      r.resident = pages_resident_ ? r.len : Length(0);
+      r.success = pages_resident_ ? ReleasePages(r.start, r.len) : true;
+    }
+  }
+  bool pages_resident() const { return pages_resident_; }
+  void set_pages_resident(bool v) { pages_resident_ = v; }
 
   bool huge_region_demand_based_release() const {
     return huge_region_demand_based_release_;
@@ -98,9 +128,47 @@ class FakeStaticForwarder {
   void set_huge_cache_demand_based_release(bool v) {
     huge_cache_demand_based_release_ = v;
   }
+  bool huge_cache_forecast() const { return huge_cache_forecast_; }
+  void set_huge_cache_forecast(bool v) { huge_cache_forecast_ = v; }
+  bool huge_cache_lifo_reuse() const { return huge_cache_lifo_reuse_; }
+  void set_huge_cache_lifo_reuse(bool v) { huge_cache_lifo_reuse_ = v; }
+  absl::Duration huge_cache_cold_interval() const {
+    return huge_cache_cold_interval_;
+  }
+  void set_huge_cache_cold_interval(absl::Duration v) {
+    huge_cache_cold_interval_ = v;
+  }
+  bool hugepage_granular_release() const { return hugepage_granular_release_; }
+  void set_hugepage_granular_release(bool v) {
+    hugepage_granular_release_ = v;
+  }
+  bool residency_aware_release() const { return residency_aware_release_; }
+  void set_residency_aware_release(bool v) { residency_aware_release_ = v; }
+
+  uint32_t skip_subrelease_target_refault_percent() const {
+    return skip_subrelease_target_refault_percent_;
+  }
+  void set_skip_subrelease_target_refault_percent(uint32_t v) {
+    skip_subrelease_target_refault_percent_ = v;
+  }
+
+  bool donated_tail_packing() const { return donated_tail_packing_; }
+  void set_donated_tail_packing(bool v) { donated_tail_packing_ = v; }
+
+  bool large_huge_regions() const { return large_huge_regions_; }
+  void set_large_huge_regions(bool v) { large_huge_regions_ = v; }
+
+  bool exclude_free_from_core_dumps() const {
+    return exclude_free_from_core_dumps_;
+  }
+  void set_exclude_free_from_core_dumps(bool v) {
+    exclude_free_from_core_dumps_ = v;
+  }
 
   // Arena state.
-  Arena& arena() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) { return arena_; }
+  Arena& arena(MemoryTag tag) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return arena_;
+  }
 
   // PageAllocator state.
 
@@ -165,6 +233,52 @@ class FakeStaticForwarder {
 
     return release_succeeds_;
   }
+  void PopulatePages(PageId begin, Length size) {
+    const uintptr_t start =
+        reinterpret_cast<uintptr_t>(begin.start_addr()) & ~kTagMask;
+    TC_CHECK_LE(start + size.in_bytes(), fake_allocation_);
+    populated_ += size;
+  }
+
+  Length populated() const { return populated_; }
+
+  // Fake allocations are never backed by 1 GiB pages.
+  void BackGiganticPages(PageId begin, Length size) {}
+  size_t GiganticPageBytes() const { return 0; }
+
+  bool CollapsePages(PageId begin, Length size) {
+    const uintptr_t start =
+        reinterpret_cast<uintptr_t>(begin.start_addr()) & ~kTagMask;
+    TC_CHECK_LE(start + size.in_bytes(), fake_allocation_);
+    collapsed_ += size;
+    return true;
+  }
+
+  Length collapsed() const { return collapsed_; }
+
+  bool DemotePages(PageId begin, Length size) {
+    const uintptr_t start =
+        reinterpret_cast<uintptr_t>(begin.start_addr()) & ~kTagMask;
+    TC_CHECK_LE(start + size.in_bytes(), fake_allocation_);
+    demoted_ += size;
+    return true;
+  }
+
+  Length demoted() const { return demoted_; }
+
+  void SetPagesDumpable(PageId begin, Length size, bool dumpable) {
+    const uintptr_t start =
+        reinterpret_cast<uintptr_t>(begin.start_addr()) & ~kTagMask;
+    TC_CHECK_LE(start + size.in_bytes(), fake_allocation_);
+  }
+
+  // Fake allocations are not backed by the kernel, so their backing is
+  // unknown.
+  HugeLength CountSmallPageBacked(absl::Span<const HugePage> hugepages,
+                                  HugeLength* unknown) {
+    *unknown = NHugePages(hugepages.size());
+    return NHugePages(0);
+  }
 
  private:
   static absl::base_internal::LowLevelAlloc::Arena* ll_arena() {
@@ -182,12 +296,29 @@ class FakeStaticForwarder {
   absl::Duration cache_demand_release_long_interval_;
   bool release_partial_alloc_pages_ = false;
   bool hpaa_subrelease_ = true;
+  bool hugepages_available_ = true;
+  bool lifetime_based_allocation_ = false;
   bool release_succeeds_ = true;
+  bool released_pages_are_zero_ = false;
+  bool released_pages_are_lazy_ = false;
+  bool pages_resident_ = true;
   bool huge_region_demand_based_release_ = false;
   bool huge_cache_demand_based_release_ = false;
+  bool huge_cache_forecast_ = false;
+  bool huge_cache_lifo_reuse_ = false;
+  absl::Duration huge_cache_cold_interval_ = absl::ZeroDuration();
+  bool hugepage_granular_release_ = false;
+  bool residency_aware_release_ = false;
+  uint32_t skip_subrelease_target_refault_percent_ = 0;
+  bool donated_tail_packing_ = false;
+  bool large_huge_regions_ = false;
+  bool exclude_free_from_core_dumps_ = false;
   Arena arena_;
 
   uintptr_t fake_allocation_ = 0x1000;
+  Length populated_;
+  Length collapsed_;
+  Length demoted_;
 
   template <typename T>
   class AllocAdaptor final {
@@ -19,6 +19,8 @@
 #include <cstdint>
 #include <map>
 #include <new>
+#include <utility>
+#include <vector>
 
 #include "gmock/gmock.h"
 #include "absl/synchronization/mutex.h"
@@ -33,6 +35,12 @@ namespace tcmalloc_internal {
 class FakeStaticForwarder {
  public:
   FakeStaticForwarder() : class_size_(0), pages_() {}
+  ~FakeStaticForwarder() {
+    for (auto [ptr, alignment] : allocations_) {
+      ::operator delete(ptr, alignment);
+    }
+  }
+
   void Init(size_t class_size, size_t pages, size_t num_objects_to_move,
             bool use_large_spans) {
     class_size_ = class_size;
@@ -42,6 +50,19 @@ class FakeStaticForwarder {
     TC_ASSERT_LE(max_span_cache_size(), max_span_cache_array_size());
     clock_ = 1234;
   }
+  bool hugepage_aware_spans() const { return hugepage_aware_spans_; }
+  void set_hugepage_aware_spans(bool value) { hugepage_aware_spans_ = value; }
+  bool span_cache() const { return span_cache_; }
+  void set_span_cache(bool value) { span_cache_ = value; }
+  absl::Duration span_cache_expiry() const { return span_cache_expiry_; }
+  void set_span_cache_expiry(absl::Duration value) {
+    span_cache_expiry_ = value;
+  }
+  bool address_ordered() const { return address_ordered_; }
+  void set_address_ordered(bool value) { address_ordered_ = value; }
+  bool nonintrusive_spans() const { return nonintrusive_spans_; }
+  void set_nonintrusive_spans(bool value) { nonintrusive_spans_ = value; }
+
   uint64_t clock_now() const { return clock_; }
   double clock_frequency() const {
     return absl::ToDoubleNanoseconds(absl::Seconds(2));
@@ -83,6 +104,33 @@ class FakeStaticForwarder {
     return nullptr;
   }
 
+  size_t num_shards(int size_class) const { return num_shards_; }
+  size_t CurrentShard(size_t num_shards) const {
+    return current_shard_ % num_shards;
+  }
+  // Sets the number of shards of central freelists initialized afterwards.
+  void set_num_shards(size_t num_shards) { num_shards_ = num_shards; }
+  void set_current_shard(size_t shard) { current_shard_ = shard; }
+
+  Length HugePageUsedPages(const Span* span) {
+    absl::MutexLock l(&mu_);
+    auto it = map_.find(span->first_page());
+    return it == map_.end() ? Length(0) : it->second.hugepage_used_pages;
+  }
+  // Sets the number of used pages reported for the hugepage of <span>.
+  void set_hugepage_used_pages(const Span* span, Length used) {
+    absl::MutexLock l(&mu_);
+    auto it = map_.find(span->first_page());
+    ASSERT_NE(it, map_.end());
+    it->second.hugepage_used_pages = used;
+  }
+
+  void* Alloc(size_t size, std::align_val_t alignment) {
+    void* ptr = ::operator new(size, alignment);
+    allocations_.emplace_back(ptr, alignment);
+    return ptr;
+  }
+
   Span* AllocateSpan(int, size_t objects_per_span, Length pages_per_span) {
     void* backing =
         ::operator new(pages_per_span.in_bytes(), std::align_val_t(kPageSize));
@@ -95,6 +143,9 @@ class FakeStaticForwarder {
 
     auto* span = new (span_buf) Span();
     span->Init(page, pages_per_span);
+    if (nonintrusive_spans_ && !Span::UseBitmapForSize(class_size_)) {
+      span->set_freelist_bitmap(new Span::FreelistBitmap);
+    }
 
     absl::MutexLock l(&mu_);
     SpanInfo info;
@@ -122,6 +173,7 @@ class FakeStaticForwarder {
 
     for (Span* span : free_spans) {
       ::operator delete(span->start_address(), std::align_val_t(kPageSize));
+      delete span->TakeFreelistBitmap();
 
       span->~Span();
       ::operator delete(span, span_alignment);
@@ -132,6 +184,7 @@ class FakeStaticForwarder {
   struct SpanInfo {
     Span* span;
     SpanAllocInfo span_alloc_info;
+    Length hugepage_used_pages;
   };
 
   absl::Mutex mu_;
@@ -141,6 +194,14 @@ class FakeStaticForwarder {
   size_t num_objects_to_move_;
   bool use_large_spans_;
   uint64_t clock_;
+  bool hugepage_aware_spans_ = false;
+  bool span_cache_ = false;
+  absl::Duration span_cache_expiry_ = absl::ZeroDuration();
+  bool address_ordered_ = false;
+  bool nonintrusive_spans_ = false;
+  size_t num_shards_ = 1;
+  size_t current_shard_ = 0;
+  std::vector<std::pair<void*, std::align_val_t>> allocations_;
 };
 
 class RawMockStaticForwarder : public FakeStaticForwarder {
@@ -217,8 +278,10 @@ class FakeCentralFreeListEnvironment {
 
   explicit FakeCentralFreeListEnvironment(size_t class_size, size_t pages,
                                           size_t num_objects_to_move,
-                                          bool use_large_spans) {
+                                          bool use_large_spans,
+                                          size_t num_shards = 1) {
     forwarder().Init(class_size, pages, num_objects_to_move, use_large_spans);
+    forwarder().set_num_shards(num_shards);
     cache_.Init(kSizeClass);
   }
 
@@ -125,10 +125,13 @@ class FakeShardedTransferCacheManager
   static void SetCacheForLargeClassesOnly(bool value) {
     enable_cache_for_large_classes_only_ = value;
   }
+  static bool UseAdaptiveCache() { return enable_adaptive_cache_; }
+  static void SetAdaptiveCache(bool value) { enable_adaptive_cache_ = value; }
 
  private:
   static bool enable_generic_cache_;
   static bool enable_cache_for_large_classes_only_;
+  static bool enable_adaptive_cache_;
 };
 
 // Wires up a largely functional TransferCache + TransferCacheManager +
@@ -314,7 +317,15 @@ class FakeCpuLayout {
 class FakeMultiClassTransferCacheManager : public TransferCacheManager {
  public:
   void Init() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
-    InitCaches();
+    InitCaches(TransferCacheImplementation::kLegacy);
+  }
+};
+
+// Defines transfer cache manager for testing lock-free transfer cache.
+class FakeMultiClassLockFreeTransferCacheManager : public TransferCacheManager {
+ public:
+  void Init() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    InitCaches(TransferCacheImplementation::kLockFree);
   }
 };
 
@@ -14,12 +14,29 @@
 
 #include "tcmalloc/new_extension.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <new>
 
 #include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
 #include "tcmalloc/malloc_extension.h"
 
+namespace {
+
+// Rounds <size> up to whole cache lines, so that an allocation aligned to a
+// cache line fills the ones it is on.
+size_t IsolatedSize(size_t size) {
+  return (std::max<size_t>(size, 1) + ABSL_CACHELINE_SIZE - 1) &
+         ~size_t{ABSL_CACHELINE_SIZE - 1};
+}
+
+std::align_val_t IsolatedAlignment(std::align_val_t alignment) {
+  return std::max(alignment, std::align_val_t{ABSL_CACHELINE_SIZE});
+}
+
+}  // namespace
+
 ABSL_ATTRIBUTE_WEAK void* operator new(
     size_t size, tcmalloc::hot_cold_t hot_cold) noexcept(false) {
   return ::operator new(size);
@@ -66,3 +83,55 @@ ABSL_ATTRIBUTE_WEAK void* operator new[](
   return ::operator new[](size, alignment, std::nothrow);
 }
 #endif  // __cpp_aligned_new
+
+ABSL_ATTRIBUTE_WEAK void* operator new(size_t size,
+                                       tcmalloc::isolate_t) noexcept(false) {
+  return ::operator new(IsolatedSize(size),
+                        std::align_val_t{ABSL_CACHELINE_SIZE});
+}
+
+ABSL_ATTRIBUTE_WEAK void* operator new(size_t size, const std::nothrow_t&,
+                                       tcmalloc::isolate_t) noexcept {
+  return ::operator new(IsolatedSize(size),
+                        std::align_val_t{ABSL_CACHELINE_SIZE}, std::nothrow);
+}
+
+ABSL_ATTRIBUTE_WEAK void* operator new[](size_t size,
+                                         tcmalloc::isolate_t) noexcept(false) {
+  return ::operator new[](IsolatedSize(size),
+                          std::align_val_t{ABSL_CACHELINE_SIZE});
+}
+
+ABSL_ATTRIBUTE_WEAK void* operator new[](size_t size, const std::nothrow_t&,
+                                         tcmalloc::isolate_t) noexcept {
+  return ::operator new[](IsolatedSize(size),
+                          std::align_val_t{ABSL_CACHELINE_SIZE}, std::nothrow);
+}
+
+#ifdef __cpp_aligned_new
+ABSL_ATTRIBUTE_WEAK void* operator new(size_t size, std::align_val_t alignment,
+                                       tcmalloc::isolate_t) noexcept(false) {
+  return ::operator new(IsolatedSize(size), IsolatedAlignment(alignment));
+}
+
+ABSL_ATTRIBUTE_WEAK void* operator new(size_t size, std::align_val_t alignment,
+                                       const std::nothrow_t&,
+                                       tcmalloc::isolate_t) noexcept {
+  return ::operator new(IsolatedSize(size), IsolatedAlignment(alignment),
+                        std::nothrow);
+}
+
+ABSL_ATTRIBUTE_WEAK void* operator new[](size_t size,
+                                         std::align_val_t alignment,
+                                         tcmalloc::isolate_t) noexcept(false) {
+  return ::operator new[](IsolatedSize(size), IsolatedAlignment(alignment));
+}
+
+ABSL_ATTRIBUTE_WEAK void* operator new[](size_t size,
+                                         std::align_val_t alignment,
+                                         const std::nothrow_t&,
+                                         tcmalloc::isolate_t) noexcept {
+  return ::operator new[](IsolatedSize(size), IsolatedAlignment(alignment),
+                          std::nothrow);
+}
+#endif  // __cpp_aligned_new
@@ -41,4 +41,32 @@ void* operator new[](size_t size, std::align_val_t alignment,
                      tcmalloc::hot_cold_t hot_cold) noexcept;
 #endif  // __cpp_aligned_new
 
+// Allocates memory that shares no cache line with any other live allocation,
+// e.g. `new (tcmalloc::isolate) Counter`.  Small allocations are rounded up to
+// whole cache lines.
+//
+// The memory is allocated with at least cache line alignment: it must be freed
+// without a size, or with a size and an alignment of at least
+// ABSL_CACHELINE_SIZE, e.g.
+// `::operator delete(p, size, std::align_val_t{ABSL_CACHELINE_SIZE})`.
+void* operator new(size_t size, tcmalloc::isolate_t) noexcept(false);
+void* operator new(size_t size, const std::nothrow_t&,
+                   tcmalloc::isolate_t) noexcept;
+void* operator new[](size_t size, tcmalloc::isolate_t) noexcept(false);
+void* operator new[](size_t size, const std::nothrow_t&,
+                     tcmalloc::isolate_t) noexcept;
+
+#ifdef __cpp_aligned_new
+// As above, with at least <alignment>: sized deallocation must pass the larger
+// of <alignment> and ABSL_CACHELINE_SIZE.
+void* operator new(size_t size, std::align_val_t alignment,
+                   tcmalloc::isolate_t) noexcept(false);
+void* operator new(size_t size, std::align_val_t alignment,
+                   const std::nothrow_t&, tcmalloc::isolate_t) noexcept;
+void* operator new[](size_t size, std::align_val_t alignment,
+                     tcmalloc::isolate_t) noexcept(false);
+void* operator new[](size_t size, std::align_val_t alignment,
+                     const std::nothrow_t&, tcmalloc::isolate_t) noexcept;
+#endif  // __cpp_aligned_new
+
 #endif  // TCMALLOC_NEW_EXTENSION_H_
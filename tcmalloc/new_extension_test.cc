@@ -483,5 +483,44 @@ TEST(HotColdNew, OperatorNewArrayAlignedNothrow) {
 }
 #endif  // __cpp_aligned_new
 
+TEST(IsolatedNew, DoesNotShareCacheLines) {
+  // Sampled objects are alone on their pages, but report their exact size.
+  ScopedNeverSample never_sample;
+  constexpr size_t kLine = ABSL_CACHELINE_SIZE;
+  for (size_t size : {size_t{1}, size_t{8}, size_t{24}, kLine - 1, kLine,
+                      kLine + 1, size_t{1000}, size_t{300} << 10}) {
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 100; ++i) {
+      void* ptr = (i % 2 == 0) ? ::operator new(size, isolate)
+                               : ::operator new(size, std::nothrow, isolate);
+      ASSERT_NE(ptr, nullptr);
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % kLine, 0) << size;
+      // The object, with its slack, fills whole cache lines.
+      const size_t allocated = MallocExtension::GetAllocatedSize(ptr).value_or(
+          (size + kLine - 1) & ~(kLine - 1));
+      EXPECT_EQ(allocated % kLine, 0) << size;
+      ptrs.push_back(ptr);
+    }
+    // Every object is on cache lines of its own.
+    std::sort(ptrs.begin(), ptrs.end());
+    for (size_t i = 1; i < ptrs.size(); ++i) {
+      EXPECT_GE(reinterpret_cast<uintptr_t>(ptrs[i]) / kLine,
+                (reinterpret_cast<uintptr_t>(ptrs[i - 1]) + size - 1) / kLine +
+                    1);
+    }
+    for (void* ptr : ptrs) {
+      ::operator delete(ptr, size, std::align_val_t{kLine});
+    }
+  }
+
+  void* array = ::operator new[](8, isolate);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(array) % kLine, 0);
+  ::operator delete[](array, 8, std::align_val_t{kLine});
+
+  void* aligned = ::operator new(8, std::align_val_t{256}, isolate);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % 256, 0);
+  ::operator delete(aligned, 8, std::align_val_t{256});
+}
+
 }  // namespace
 }  // namespace tcmalloc
@@ -0,0 +1,180 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A cache of constructed objects, in the manner of the slab caches of
+// kernels: objects returned to the cache keep their state, such as
+// initialized mutexes or reserved buffers, and are handed out again without
+// running their constructors.
+
+#ifndef TCMALLOC_OBJECT_CACHE_H_
+#define TCMALLOC_OBJECT_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "tcmalloc/malloc_extension.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace tcmalloc {
+
+// Hands out default constructed objects of type T, and keeps the objects
+// given back to it constructed for reuse.  The cache is split into kShards
+// shards, chosen by the current CPU, each holding up to kShardCapacity
+// objects.  A shard in use by another thread is skipped rather than waited
+// for, so a miss, or a contended shard, falls back to constructing (or
+// destroying) an object with tcmalloc::New (or tcmalloc::Delete).
+//
+// Objects cached in shards that went unused between two reclaims of the
+// per-CPU caches by the background thread are destroyed (see
+// MallocExtension::RegisterReclaimCallback), so that idle caches do not pin
+// memory.
+//
+// Thread safe.
+template <typename T>
+class ObjectCache {
+ public:
+  static constexpr size_t kShards = 16;
+  static constexpr size_t kShardCapacity = 32;
+
+  ObjectCache() {
+    registered_ = MallocExtension::RegisterReclaimCallback(&ReclaimCallback,
+                                                           this);
+  }
+
+  ~ObjectCache() {
+    if (registered_) {
+      MallocExtension::UnregisterReclaimCallback(&ReclaimCallback, this);
+    }
+    Drain();
+  }
+
+  ObjectCache(const ObjectCache&) = delete;
+  ObjectCache& operator=(const ObjectCache&) = delete;
+
+  // Returns a cached object, or a new, default constructed, one.
+  T* Get() {
+    Shard& shard = CurrentShard();
+    if (shard.TryLock()) {
+      shard.used = true;
+      T* result = shard.count > 0 ? shard.objects[--shard.count] : nullptr;
+      shard.Unlock();
+      if (result != nullptr) return result;
+    }
+    return New<T>();
+  }
+
+  // Returns <object>, which must have come from Get(), to the cache as it is.
+  // Callers are responsible for clearing any state that should not be seen by
+  // the next user of the object.  <object> may be null.
+  void Put(T* object) {
+    if (object == nullptr) return;
+    Shard& shard = CurrentShard();
+    if (shard.TryLock()) {
+      shard.used = true;
+      const bool cached = shard.count < kShardCapacity;
+      if (cached) {
+        shard.objects[shard.count++] = object;
+      }
+      shard.Unlock();
+      if (cached) return;
+    }
+    Delete(object);
+  }
+
+  // Destroys the objects of the shards that were not used since the previous
+  // call.  Called by the background thread.
+  void Reclaim() { Release(/*idle_only=*/true); }
+
+  // Destroys all of the cached objects.
+  void Drain() { Release(/*idle_only=*/false); }
+
+  // The number of objects cached.  Only a snapshot while the cache is in use.
+  size_t cached() const {
+    size_t n = 0;
+    for (const Shard& shard : shards_) {
+      n += shard.count_snapshot.load(std::memory_order_relaxed);
+    }
+    return n;
+  }
+
+ private:
+  struct alignas(64) Shard {
+    bool TryLock() { return !locked.exchange(true, std::memory_order_acquire); }
+    void Unlock() {
+      count_snapshot.store(count, std::memory_order_relaxed);
+      locked.store(false, std::memory_order_release);
+    }
+
+    std::atomic<bool> locked{false};
+    std::atomic<size_t> count_snapshot{0};
+    // Guarded by locked.
+    bool used = false;
+    size_t count = 0;
+    T* objects[kShardCapacity];
+  };
+
+  static void ReclaimCallback(void* arg) {
+    static_cast<ObjectCache*>(arg)->Reclaim();
+  }
+
+  Shard& CurrentShard() {
+#ifdef __linux__
+    const int cpu = sched_getcpu();
+    if (cpu >= 0) return shards_[cpu % kShards];
+#endif
+    // Spread threads over the shards by the address of a thread local.
+    static thread_local char tls;
+    return shards_[(reinterpret_cast<uintptr_t>(&tls) >> 6) % kShards];
+  }
+
+  void Release(bool idle_only) {
+    for (Shard& shard : shards_) {
+      if (idle_only) {
+        // A shard that is locked is in use, so it is not idle.
+        if (!shard.TryLock()) continue;
+      } else {
+        while (!shard.TryLock()) {
+        }
+      }
+      T* objects[kShardCapacity];
+      size_t n = 0;
+      if (!idle_only || !shard.used) {
+        n = shard.count;
+        for (size_t i = 0; i < n; ++i) {
+          objects[i] = shard.objects[i];
+        }
+        shard.count = 0;
+      }
+      shard.used = false;
+      shard.Unlock();
+      // Destroy the objects outside of the lock, as their destructors may be
+      // slow.
+      for (size_t i = 0; i < n; ++i) {
+        Delete(objects[i]);
+      }
+    }
+  }
+
+  Shard shards_[kShards];
+  bool registered_ = false;
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_OBJECT_CACHE_H_
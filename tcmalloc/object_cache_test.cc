@@ -0,0 +1,148 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/object_cache.h"
+
+#include <stddef.h>
+
+#include <atomic>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace tcmalloc {
+namespace {
+
+struct Object {
+  Object() { constructed.fetch_add(1, std::memory_order_relaxed); }
+  ~Object() { destroyed.fetch_add(1, std::memory_order_relaxed); }
+
+  static std::atomic<int> constructed;
+  static std::atomic<int> destroyed;
+
+  int state = 0;
+  std::vector<int> buffer = std::vector<int>(128);
+};
+
+std::atomic<int> Object::constructed{0};
+std::atomic<int> Object::destroyed{0};
+
+class ObjectCacheTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    Object::constructed = 0;
+    Object::destroyed = 0;
+  }
+};
+
+TEST_F(ObjectCacheTest, RetainsState) {
+  ObjectCache<Object> cache;
+  Object* object = cache.Get();
+  ASSERT_NE(object, nullptr);
+  object->state = 7;
+  cache.Put(object);
+  EXPECT_EQ(cache.cached(), 1);
+  EXPECT_EQ(Object::destroyed, 0);
+
+  // The thread may have moved to another CPU, and so shard, in between.
+  std::vector<Object*> objects;
+  bool found = false;
+  for (int i = 0; i < 100 && !found; ++i) {
+    Object* o = cache.Get();
+    found = o == object;
+    objects.push_back(o);
+  }
+  EXPECT_TRUE(found);
+  EXPECT_EQ(object->state, 7);
+  for (Object* o : objects) {
+    cache.Put(o);
+  }
+  cache.Put(nullptr);
+
+  cache.Drain();
+  EXPECT_EQ(cache.cached(), 0);
+  EXPECT_EQ(Object::constructed, Object::destroyed);
+}
+
+TEST_F(ObjectCacheTest, Capacity) {
+  ObjectCache<Object> cache;
+  constexpr int kObjects = 1000;
+  std::vector<Object*> objects;
+  for (int i = 0; i < kObjects; ++i) {
+    objects.push_back(cache.Get());
+  }
+  for (Object* o : objects) {
+    cache.Put(o);
+  }
+  EXPECT_LE(cache.cached(),
+            ObjectCache<Object>::kShards * ObjectCache<Object>::kShardCapacity);
+  EXPECT_EQ(Object::destroyed, kObjects - static_cast<int>(cache.cached()));
+}
+
+TEST_F(ObjectCacheTest, ReclaimIdleShards) {
+  ObjectCache<Object> cache;
+  cache.Put(cache.Get());
+  EXPECT_EQ(cache.cached(), 1);
+
+  // The shard was used since the last reclaim.
+  cache.Reclaim();
+  EXPECT_EQ(cache.cached(), 1);
+
+  cache.Reclaim();
+  EXPECT_EQ(cache.cached(), 0);
+  EXPECT_EQ(Object::destroyed, 1);
+}
+
+TEST_F(ObjectCacheTest, Threads) {
+  ObjectCache<Object> cache;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&]() {
+      std::vector<Object*> objects;
+      for (int i = 0; i < 10000; ++i) {
+        objects.push_back(cache.Get());
+        if (objects.size() > 10) {
+          for (Object* o : objects) {
+            cache.Put(o);
+          }
+          objects.clear();
+        }
+        if (i % 1000 == 0) {
+          cache.Reclaim();
+        }
+      }
+      for (Object* o : objects) {
+        cache.Put(o);
+      }
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  cache.Drain();
+  EXPECT_EQ(Object::constructed, Object::destroyed);
+}
+
+TEST_F(ObjectCacheTest, DestructorDrains) {
+  {
+    ObjectCache<Object> cache;
+    cache.Put(cache.Get());
+  }
+  EXPECT_EQ(Object::constructed, 1);
+  EXPECT_EQ(Object::destroyed, 1);
+}
+
+}  // namespace
+}  // namespace tcmalloc
@@ -14,7 +14,10 @@
 
 #include "tcmalloc/page_allocator.h"
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <limits>
 
 #include "absl/base/attributes.h"
@@ -23,15 +26,21 @@
 #include "absl/base/optimization.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/huge_page_aware_allocator.h"
+#include "tcmalloc/internal/background_wakeup.h"
+#include "tcmalloc/internal/cache_topology.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/large_span_cache.h"
 #include "tcmalloc/page_heap.h"
 #include "tcmalloc/pages.h"
 #include "tcmalloc/parameters.h"
 #include "tcmalloc/selsan/selsan.h"
+#include "tcmalloc/span.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/stats.h"
+#include "tcmalloc/system-alloc.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
@@ -103,8 +112,11 @@ PageAllocator::PageAllocator() {
     normal_impl_[0] = new (&choices_[part++].hpaa) HugePageAwareAllocator(
         HugePageAwareAllocatorOptions{MemoryTag::kNormal});
     if (tc_globals.numa_topology().numa_aware()) {
-      normal_impl_[1] = new (&choices_[part++].hpaa) HugePageAwareAllocator(
-          HugePageAwareAllocatorOptions{MemoryTag::kNormalP1});
+      for (size_t partition = 1; partition < kNumaPartitions; ++partition) {
+        normal_impl_[partition] =
+            new (&choices_[part++].hpaa) HugePageAwareAllocator(
+                HugePageAwareAllocatorOptions{NumaNormalTag(partition)});
+      }
     }
     sampled_impl_ = new (&choices_[part++].hpaa) HugePageAwareAllocator(
         HugePageAwareAllocatorOptions{MemoryTag::kSampled});
@@ -124,8 +136,10 @@ PageAllocator::PageAllocator() {
 #if 0
     normal_impl_[0] = new (&choices_[part++].ph) PageHeap(MemoryTag::kNormal);
     if (tc_globals.numa_topology().numa_aware()) {
-      normal_impl_[1] =
-          new (&choices_[part++].ph) PageHeap(MemoryTag::kNormalP1);
+      for (size_t partition = 1; partition < kNumaPartitions; ++partition) {
+        normal_impl_[partition] =
+            new (&choices_[part++].ph) PageHeap(NumaNormalTag(partition));
+      }
     }
     sampled_impl_ = new (&choices_[part++].ph) PageHeap(MemoryTag::kSampled);
     if (selsan::IsEnabled()) {
@@ -143,12 +157,34 @@ PageAllocator::PageAllocator() {
 #endif
     TC_CHECK_LE(part, ABSL_ARRAYSIZE(choices_));
   }
+
+  for (auto& limits : tag_limits_) {
+    std::fill(std::begin(limits), std::end(limits),
+              std::numeric_limits<size_t>::max());
+  }
+
+  // Split the byte budget of each heap's large span cache among its shards,
+  // though each shard can hold at least one span of the largest length.
+  num_large_span_cache_shards_ =
+      std::clamp<size_t>(CacheTopology::Instance().l3_count(), 1,
+                         kMaxLargeSpanCacheShards);
+  const size_t shard_bytes =
+      std::max(LargeSpanCache::kMaxBytes / num_large_span_cache_shards_,
+               LargeSpanCache::kMaxLength.in_bytes());
+  for (auto& shards : large_span_caches_) {
+    for (LargeSpanCache& cache : shards) {
+      cache.Init(shard_bytes);
+    }
+  }
 }
 
-void PageAllocator::ShrinkToUsageLimit(Length n) {
+size_t PageAllocator::BackedBytes() const {
   BackingStats s = stats();
-  const size_t backed =
-      s.system_bytes - s.unmapped_bytes + tc_globals.metadata_bytes();
+  return s.system_bytes - s.unmapped_bytes + tc_globals.metadata_bytes();
+}
+
+void PageAllocator::ShrinkToUsageLimit(Length n) {
+  const size_t backed = BackedBytes();
   // New high water marks should be rare.
   if (ABSL_PREDICT_FALSE(backed > peak_backed_bytes_)) {
     peak_backed_bytes_ = backed;
@@ -167,21 +203,36 @@ void PageAllocator::ShrinkToUsageLimit(Length n) {
   // occur if we allocate space for many objects preemptively and only later
   // sample them (incrementing sampled_objects_size_).
 
-  if (limits_[kSoft] == std::numeric_limits<size_t>::max()) {
+  if (ABSL_PREDICT_FALSE(has_tag_limits_)) {
+    ShrinkTagsToLimits();
+  }
+
+  const size_t soft = soft_limit();
+  if (soft == std::numeric_limits<size_t>::max()) {
     // Limits are not set.
     return;
   }
-  if (backed <= limits_[kSoft]) {
-    // We're already fine.
+  if (backed <= soft) {
+    // We're already fine, but let background actions shrink ahead of the
+    // limit once past their watermark.
+    const uint32_t percent =
+        Parameters::soft_limit_background_shrink_percent();
+    if (percent > 0 && percent < 100 && backed > soft / 100 * percent) {
+      tc_globals.background_wakeup().Notify(BackgroundWakeup::kSoftLimitHit);
+    }
     return;
   }
 
   ++limit_hits_[kSoft];
+  tc_globals.background_wakeup().Notify(BackgroundWakeup::kSoftLimitHit);
   if (limits_[kHard] < backed) ++limit_hits_[kHard];
 
-  const size_t overage = backed - limits_[kSoft];
+  const size_t overage = backed - soft;
   const Length pages = LengthFromBytes(overage + kPageSize - 1);
-  if (ShrinkHardBy(pages, kSoft)) {
+  ++limit_shrink_stats_.foreground_shrinks;
+  const Length released = ShrinkHardBy(pages, kSoft);
+  limit_shrink_stats_.foreground_pages += released;
+  if (released >= pages) {
     ++successful_shrinks_after_limit_hit_[kSoft];
     return;
   }
@@ -189,16 +240,16 @@ void PageAllocator::ShrinkToUsageLimit(Length n) {
   // We're still not below limit.
   if (limits_[kHard] < std::numeric_limits<size_t>::max()) {
     // Recompute how many pages we still need to release.
-    BackingStats s = stats();
-    const size_t backed =
-        s.system_bytes - s.unmapped_bytes + tc_globals.metadata_bytes();
+    const size_t backed = BackedBytes();
     if (backed <= limits_[kHard]) {
       // We're already fine in terms of hard limit.
       return;
     }
     const size_t overage = backed - limits_[kHard];
     const Length pages = LengthFromBytes(overage + kPageSize - 1);
-    if (ShrinkHardBy(pages, kHard)) {
+    const Length released = ShrinkHardBy(pages, kHard);
+    limit_shrink_stats_.foreground_pages += released;
+    if (released >= pages) {
       ++successful_shrinks_after_limit_hit_[kHard];
       TC_ASSERT_EQ(successful_shrinks_after_limit_hit_[kHard],
                    limit_hits_[kHard]);
@@ -220,10 +271,167 @@ void PageAllocator::ShrinkToUsageLimit(Length n) {
   if (warned) return;
   warned = true;
   TC_LOG("Couldn't respect usage limit of %v and OOM is likely to follow.",
-         limits_[kSoft]);
+         soft);
 }
 
-bool PageAllocator::ShrinkHardBy(Length pages, LimitKind limit_kind) {
+int PageAllocator::TagLimitIndex(MemoryTag tag) const {
+  if (IsNormalTag(tag)) {
+    const size_t partition = NumaPartitionFromTag(tag);
+    return partition < active_numa_partitions() ? partition : -1;
+  }
+  switch (tag) {
+    case MemoryTag::kSampled:
+      return kNumaPartitions;
+    case MemoryTag::kCold:
+      // Without a cold heap, cold allocations share the normal heap.
+      return has_cold_impl_ ? kNumaPartitions + 1 : -1;
+    default:
+      return -1;
+  }
+}
+
+MemoryTag PageAllocator::TagOfLimitIndex(int index) {
+  const size_t i = index;
+  if (i < kNumaPartitions) return NumaNormalTag(i);
+  return i == kNumaPartitions ? MemoryTag::kSampled : MemoryTag::kCold;
+}
+
+bool PageAllocator::set_tag_limit(MemoryTag tag, size_t limit,
+                                  LimitKind limit_kind) {
+  PageHeapSpinLockHolder l;
+  const int index = TagLimitIndex(tag);
+  if (index < 0) return false;
+  size_t* limits = tag_limits_[index];
+  limits[limit_kind] = limit;
+  if (limits[kHard] < limits[kSoft]) {
+    limits[kSoft] = limits[kHard];
+  }
+  has_tag_limits_ = false;
+  for (const auto& tag_limits : tag_limits_) {
+    if (tag_limits[kSoft] != std::numeric_limits<size_t>::max()) {
+      has_tag_limits_ = true;
+    }
+  }
+  ShrinkToUsageLimit(Length(0));
+  return true;
+}
+
+size_t PageAllocator::tag_limit(MemoryTag tag, LimitKind limit_kind) const {
+  PageHeapSpinLockHolder l;
+  const int index = TagLimitIndex(tag);
+  if (index < 0) return std::numeric_limits<size_t>::max();
+  return tag_limits_[index][limit_kind];
+}
+
+int64_t PageAllocator::tag_limit_hits(MemoryTag tag,
+                                      LimitKind limit_kind) const {
+  PageHeapSpinLockHolder l;
+  const int index = TagLimitIndex(tag);
+  if (index < 0) return 0;
+  return tag_limit_hits_[index][limit_kind];
+}
+
+void PageAllocator::ShrinkTagsToLimits() {
+  constexpr PageReleaseReason kReason = PageReleaseReason::kSoftLimitExceeded;
+  for (int index = 0; index < static_cast<int>(kNumTagLimits); ++index) {
+    // The soft limit never exceeds the hard one, so it tells whether either
+    // is set.
+    const size_t soft = tag_limits_[index][kSoft];
+    const size_t hard = tag_limits_[index][kHard];
+    if (soft == std::numeric_limits<size_t>::max()) continue;
+    const MemoryTag tag = TagOfLimitIndex(index);
+    Interface* heap = impl(tag);
+    auto backed = [heap]() ABSL_NO_THREAD_SAFETY_ANALYSIS {
+      const BackingStats s = heap->stats();
+      return s.system_bytes - s.unmapped_bytes;
+    };
+    const size_t before = backed();
+    if (before <= soft) continue;
+
+    ++tag_limit_hits_[index][kSoft];
+    if (before > hard) ++tag_limit_hits_[index][kHard];
+    if (LargeSpanCacheHeap(tag) >= 0) {
+      DrainLargeSpanCache(tag, /*all=*/true);
+    }
+    const Length pages = LengthFromBytes(before - soft + kPageSize - 1);
+    Length released = heap->ReleaseAtLeastNPages(pages, kReason);
+    if (released < pages && alg_ == HPAA) {
+      released += static_cast<HugePageAwareAllocator*>(heap)
+                      ->ReleaseAtLeastNPagesBreakingHugepages(pages - released,
+                                                              kReason);
+    }
+    if (released >= pages || backed() <= hard) continue;
+
+    tag_limits_[index][kHard] = std::numeric_limits<size_t>::max();
+    TC_BUG("Hit hard tcmalloc limit of %v for the %v heap. Aborting.", hard,
+           MemoryTagToLabel(tag));
+  }
+}
+
+Length PageAllocator::ReleaseNearCgroupSoftLimit() {
+  PageHeapSpinLockHolder l;
+  if (cgroup_soft_limit_ == std::numeric_limits<size_t>::max()) {
+    return Length(0);
+  }
+  const size_t threshold =
+      cgroup_soft_limit_ / 100 * kCgroupReleaseThresholdPercent;
+  const size_t band = cgroup_soft_limit_ - threshold;
+  const size_t backed = BackedBytes();
+  if (backed <= threshold || band == 0) {
+    return Length(0);
+  }
+  // Anything above the limit itself is released by ShrinkToUsageLimit.
+  const size_t excess = std::min(backed - threshold, band);
+  const double share = static_cast<double>(excess) / band;
+  const size_t bytes = static_cast<size_t>(excess * share);
+  if (bytes == 0) {
+    return Length(0);
+  }
+  return ReleaseAtLeastNPages(LengthFromBytes(bytes + kPageSize - 1),
+                              PageReleaseReason::kSoftLimitExceeded);
+}
+
+bool PageAllocator::AboveSoftLimitWatermark(uint32_t percent) {
+  PageHeapSpinLockHolder l;
+  const size_t soft = soft_limit();
+  if (soft == std::numeric_limits<size_t>::max() || percent == 0 ||
+      percent >= 100) {
+    return false;
+  }
+  return BackedBytes() > soft / 100 * percent;
+}
+
+Length PageAllocator::ShrinkAheadOfSoftLimit(uint32_t percent) {
+  PageHeapSpinLockHolder l;
+  const size_t soft = soft_limit();
+  if (soft == std::numeric_limits<size_t>::max() || percent == 0 ||
+      percent >= 100) {
+    return Length(0);
+  }
+  const size_t watermark = soft / 100 * percent;
+  const size_t backed = BackedBytes();
+  if (backed <= watermark) {
+    return Length(0);
+  }
+  // Hugepages are only broken up once the limit itself is hit.
+  ++limit_shrink_stats_.background_shrinks;
+  const Length released =
+      ReleaseAtLeastNPages(LengthFromBytes(backed - watermark + kPageSize - 1),
+                           PageReleaseReason::kSoftLimitExceeded);
+  limit_shrink_stats_.background_pages += released;
+  return released;
+}
+
+double PageAllocator::SoftLimitUsagePercent() {
+  PageHeapSpinLockHolder l;
+  const size_t soft = soft_limit();
+  if (soft == std::numeric_limits<size_t>::max() || soft == 0) {
+    return 0;
+  }
+  return 100.0 * BackedBytes() / soft;
+}
+
+Length PageAllocator::ShrinkHardBy(Length pages, LimitKind limit_kind) {
   const PageReleaseReason release_reason =
       limit_kind == kHard ? PageReleaseReason::kHardLimitExceeded
                           : PageReleaseReason::kSoftLimitExceeded;
@@ -231,17 +439,18 @@ bool PageAllocator::ShrinkHardBy(Length pages, LimitKind limit_kind) {
   if (alg_ == HPAA) {
     if (pages <= ret) {
       // We released target amount.
-      return true;
+      return ret;
     }
 
     // At this point, we have no choice but to break up hugepages.
     // However, if the client has turned off subrelease, and is using hard
     // limits, then respect desire to do no subrelease ever.
-    if (limit_kind == kHard && !Parameters::hpaa_subrelease()) return false;
+    if (limit_kind == kHard && !Parameters::hpaa_subrelease()) return ret;
 
     static bool warned_hugepages = false;
     if (!warned_hugepages) {
-      const size_t limit = limits_[limit_kind];
+      const size_t limit =
+          limit_kind == kSoft ? soft_limit() : limits_[limit_kind];
       TC_LOG(
           "Couldn't respect usage limit of %v without breaking hugepages - "
           "performance will drop",
@@ -253,7 +462,7 @@ bool PageAllocator::ShrinkHardBy(Length pages, LimitKind limit_kind) {
                  ->ReleaseAtLeastNPagesBreakingHugepages(pages - ret,
                                                          release_reason);
       if (ret >= pages) {
-        return true;
+        return ret;
       }
     }
     if (selsan_impl_) {
@@ -261,7 +470,7 @@ bool PageAllocator::ShrinkHardBy(Length pages, LimitKind limit_kind) {
                  ->ReleaseAtLeastNPagesBreakingHugepages(pages - ret,
                                                          release_reason);
       if (ret >= pages) {
-        return true;
+        return ret;
       }
     }
     for (int partition = 0; partition < active_numa_partitions(); partition++) {
@@ -269,7 +478,7 @@ bool PageAllocator::ShrinkHardBy(Length pages, LimitKind limit_kind) {
                  ->ReleaseAtLeastNPagesBreakingHugepages(pages - ret,
                                                          release_reason);
       if (ret >= pages) {
-        return true;
+        return ret;
       }
     }
 
@@ -277,8 +486,34 @@ bool PageAllocator::ShrinkHardBy(Length pages, LimitKind limit_kind) {
                ->ReleaseAtLeastNPagesBreakingHugepages(pages - ret,
                                                        release_reason);
   }
-  // Return "true", if we got back under the limit.
-  return (pages <= ret);
+  return ret;
+}
+
+size_t PageAllocator::LargeSpanCacheShard() const {
+  if (num_large_span_cache_shards_ == 1) {
+    return 0;
+  }
+  const int cpu = subtle::percpu::GetRealCpuUnsafe();
+  if (cpu < 0) {
+    return 0;
+  }
+  return CacheTopology::Instance().GetL3FromCpuId(cpu) %
+         num_large_span_cache_shards_;
+}
+
+bool PageAllocator::Interleave(Span* span) {
+  if (!SystemInterleaveNuma(span->start_address(), span->bytes_in_span())) {
+    return false;
+  }
+  span->set_numa_interleaved(true);
+  return true;
+}
+
+void PageAllocator::Uninterleave(Span* span, MemoryTag tag) {
+  TC_ASSERT(span->numa_interleaved());
+  SystemUninterleaveNuma(span->start_address(), span->bytes_in_span(),
+                         IsNormalTag(tag) ? NumaPartitionFromTag(tag) : 0);
+  span->set_numa_interleaved(false);
 }
 
 size_t PageAllocator::active_numa_partitions() const {
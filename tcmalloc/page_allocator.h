@@ -17,13 +17,16 @@
 
 #include <stddef.h>
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <limits>
 #include <utility>
 
 #include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
+#include "absl/numeric/bits.h"
 #include "absl/strings/string_view.h"
 #include "absl/time/time.h"
 #include "tcmalloc/common.h"
@@ -32,6 +35,8 @@
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
+#include "tcmalloc/internal/usdt.h"
+#include "tcmalloc/large_span_cache.h"
 #include "tcmalloc/page_allocator_interface.h"
 #include "tcmalloc/page_heap.h"
 #include "tcmalloc/pages.h"
@@ -61,14 +66,49 @@ class PageAllocator {
   Span* NewAligned(Length n, Length align, SpanAllocInfo span_alloc_info,
                    MemoryTag tag) ABSL_LOCKS_EXCLUDED(pageheap_lock);
 
+  // Returns <n> rounded up to whole logical pages of <tag>, the unit that
+  // large allocations with <tag> are made in.  Only the cold heap has a
+  // logical page size of its own (see Parameters::cold_page_size); the other
+  // heaps use kPageSize.
+  static Length RoundUpToLogicalPages(Length n, MemoryTag tag);
+
+  // Returns <n> rounded up to the large size class that holds it (see
+  // Parameters::large_size_classes).  Lengths the large span cache holds are
+  // rounded to four significant bits, at most 12.5% more; other lengths are
+  // returned as is.
+  static Length RoundUpToLargeSizeClass(Length n);
+
   // Delete the span "[p, p+n-1]".
   // REQUIRES: span was returned by earlier call to New() with the same value of
   //           "tag" and has not yet been deleted.
   void Delete(Span* span, size_t objects_per_span, MemoryTag tag)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Offers the span of a freed large allocation to the cache of large spans
+  // for "tag" (see Parameters::large_span_cache), without taking
+  // pageheap_lock.  Returns false if the caller needs to Delete the span.
+  // REQUIRES: as for Delete, with objects_per_span == 1.
+  bool CacheLargeSpan(Span* span, MemoryTag tag)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Interleaves the pages of the large allocation <span> across the NUMA nodes
+  // of all partitions and marks it as such (see
+  // MallocExtension::AllocateInterleaved).  Returns false if its pages are
+  // placed as before.
+  static bool Interleave(Span* span) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Places the pages of an interleaved <span> as those of other spans of <tag>
+  // again.  The span needs to be placed as its heap expects before it is cached
+  // or deleted.
+  static void Uninterleave(Span* span, MemoryTag tag)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
   BackingStats stats() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Returns the stats of the cold heap, which are included in stats(), or
+  // empty stats if cold allocations share the normal heap.
+  BackingStats cold_stats() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   void GetSmallSpanStats(SmallSpanStats* result)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
@@ -81,7 +121,50 @@ class PageAllocator {
   // may also be larger than num_pages since page_heap might decide to
   // release one large range instead of fragmenting it into two
   // smaller released and unreleased ranges.
-  Length ReleaseAtLeastNPages(Length num_pages, PageReleaseReason reason)
+  //
+  // The normal heaps of the NUMA partitions set in <skip_partitions> (bit p
+  // for partition p) are left alone, for the threads that release them with
+  // ReleasePartitionAtLeastNPages.
+  Length ReleaseAtLeastNPages(Length num_pages, PageReleaseReason reason,
+                              uint64_t skip_partitions = 0)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // As ReleaseAtLeastNPages, but only releases from the normal heap of NUMA
+  // <partition>.
+  Length ReleasePartitionAtLeastNPages(int partition, Length num_pages,
+                                       PageReleaseReason reason)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Reserves at least <n> pages of memory with <tag> ahead of demand.  See
+  // PageAllocatorInterface::Reserve.
+  Length Reserve(Length n, bool populate, MemoryTag tag)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Collapses up to <max> subreleased, and since refilled, hugepages back to
+  // hugepage mappings.  See HugePageAwareAllocator::CollapseHugepages.
+  // Returns the number of hugepages attempted.
+  HugeLength CollapseHugepages(HugeLength max)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Checks how up to <max> intact hugepages of each hugepage-aware allocator
+  // are backed by the kernel.  See
+  // HugePageAwareAllocator::SampleHugepageBacking.
+  void SampleHugepageBacking(HugeLength max)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Returns the result of the last SampleHugepageBacking, combined across all
+  // hugepage-aware allocators.
+  HugePageBackingStats GetHugepageBackingStats() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Returns the HugeCache limit of the normal heap of NUMA partition
+  // <partition>, or zero if hugepage-aware allocation is off.
+  HugeLength HugeCacheLimit(int partition) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Raises the HugeCache limit of the normal heap of NUMA partition
+  // <partition> to at least <limit>.  See HugeCache::RaiseLimit.
+  void RaiseHugeCacheLimit(int partition, HugeLength limit)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   // Returns the number of pages that have been released, combined across all
@@ -103,6 +186,64 @@ class PageAllocator {
     return limits_[limit_kind];
   }
 
+  // Limits on the backed memory of the heap of <tag> alone, e.g. to bound the
+  // normal heap of a NUMA partition while the cold heap grows.  Metadata is
+  // not counted.  ShrinkToUsageLimit releases the heap's free memory down to
+  // its soft limit, breaking up hugepages if need be, and crashes if the heap
+  // stays above its hard limit.  A soft limit above the hard limit is lowered
+  // to it.  Returns false, setting nothing, if <tag> has no heap of its own.
+  bool set_tag_limit(MemoryTag tag, size_t limit, LimitKind limit_kind)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  // std::numeric_limits<size_t>::max() means none.
+  size_t tag_limit(MemoryTag tag, LimitKind limit_kind) const
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  int64_t tag_limit_hits(MemoryTag tag, LimitKind limit_kind) const
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Soft limit derived from the cgroup memory limit by background actions
+  // (see Parameters::cgroup_memory_limit_headroom_percent).  It is maintained
+  // alongside limit(kSoft), whichever is lower, and counts towards the kSoft
+  // limit hits.  std::numeric_limits<size_t>::max() means none.
+  void set_cgroup_soft_limit(size_t limit) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  size_t cgroup_soft_limit() const ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    PageHeapSpinLockHolder h;
+    return cgroup_soft_limit_;
+  }
+
+  // Releases memory ahead of the cgroup soft limit.  Once backed memory exceeds
+  // kCgroupReleaseThresholdPercent of the limit, releases a share of the excess
+  // that grows from nothing at the threshold to all of it at the limit.  The
+  // release is made as for a soft limit hit, that is without regard to recent
+  // demand.  Returns the number of pages released.
+  Length ReleaseNearCgroupSoftLimit() ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Whether backed memory exceeds <percent> of the soft limit in effect, the
+  // watermark above which background actions shrink ahead of the limit (see
+  // Parameters::soft_limit_background_shrink_percent).
+  bool AboveSoftLimitWatermark(uint32_t percent)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Releases the backed memory above that watermark, as for a soft limit hit
+  // but without breaking up hugepages.  Returns the number of pages released.
+  Length ShrinkAheadOfSoftLimit(uint32_t percent)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Soft and hard limit enforcement, split between the allocations that had
+  // to shrink the heap themselves (foreground) and background actions
+  // shrinking ahead of the soft limit.
+  struct LimitShrinkStats {
+    int64_t foreground_shrinks;
+    Length foreground_pages;
+    int64_t background_shrinks;
+    Length background_pages;
+  };
+  LimitShrinkStats limit_shrink_stats() const
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Returns the backed memory (as counted against the limits) as a percentage
+  // of the soft limit in effect, or 0 if no limit is set.
+  double SoftLimitUsagePercent() ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
   int64_t limit_hits(LimitKind limit_kind) const
       ABSL_LOCKS_EXCLUDED(pageheap_lock);
 
@@ -134,15 +275,63 @@ class PageAllocator {
   }
 
  private:
-  bool ShrinkHardBy(Length page, LimitKind limit_kind)
+  static constexpr size_t kCgroupReleaseThresholdPercent = 90;
+
+  // Returns the number of pages released, which is at least <pages> if the
+  // shrink succeeded.
+  Length ShrinkHardBy(Length pages, LimitKind limit_kind)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Bytes backed by the page heaps and metadata, as compared to the limits.
+  size_t BackedBytes() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // The soft limit in effect: the lower of limits_[kSoft] and
+  // cgroup_soft_limit_.
+  size_t soft_limit() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return std::min(limits_[kSoft], cgroup_soft_limit_);
+  }
+
+  // The normal heaps of the NUMA partitions, then the sampled and cold heaps.
+  static constexpr size_t kNumTagLimits = kNumaPartitions + 2;
+
+  // Returns the index into tag_limits_ for <tag>, or -1 if the heap of <tag>
+  // cannot be limited on its own.
+  int TagLimitIndex(MemoryTag tag) const;
+  static MemoryTag TagOfLimitIndex(int index);
+
+  // Releases memory from the heaps above their own limits.
+  void ShrinkTagsToLimits() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   using Interface =
       std::conditional<huge_page_allocator_internal::kUnconditionalHPAA,
                        HugePageAwareAllocator, PageAllocatorInterface>::type;
 
   ABSL_ATTRIBUTE_RETURNS_NONNULL Interface* impl(MemoryTag tag) const;
 
+  // Returns the index into large_span_caches_ of the heap for "tag", or -1 if
+  // spans of "tag" are not cached.
+  static int LargeSpanCacheHeap(MemoryTag tag);
+
+  // Returns the shard of the large span caches that serves the current cpu.
+  size_t LargeSpanCacheShard() const;
+
+  // Returns the cache of large spans for "tag" that serves the current cpu,
+  // or nullptr if spans of "tag" are not cached.
+  LargeSpanCache* large_span_cache(MemoryTag tag);
+
+  // Returns a cached span for New or NewAligned, or nullptr if none fits.
+  Span* GetCachedLargeSpan(Length n, Length align,
+                           SpanAllocInfo span_alloc_info, MemoryTag tag)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Returns the spans of the large span caches to their heaps: all of them if
+  // "all", otherwise those that went unused since the previous drain.  The
+  // caches of the NUMA partitions set in "skip_partitions" are left alone.
+  void DrainLargeSpanCaches(bool all, uint64_t skip_partitions)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  void DrainLargeSpanCache(MemoryTag tag, bool all)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   size_t active_numa_partitions() const;
 
   static constexpr size_t kNumHeaps =
@@ -162,17 +351,36 @@ class PageAllocator {
   Algorithm alg_;
   bool has_cold_impl_;
 
+  // The large span caches of each heap are sharded by L3 cache, so that
+  // frees and reuses of large spans by different cpus neither contend on the
+  // same lock nor hand each other cold memory.
+  static constexpr size_t kMaxLargeSpanCacheShards = 16;
+  // Indexed by NUMA partition for the normal heaps, followed by the cold heap,
+  // and then by shard.
+  LargeSpanCache large_span_caches_[kNumaPartitions + 1]
+                                   [kMaxLargeSpanCacheShards];
+  size_t num_large_span_cache_shards_ = 1;
+
   // Max size of backed spans we will attempt to maintain.
   // Crash if we can't maintain below limits_[kHard], which is guaranteed to be
   // higher than limits_[kSoft].
   size_t limits_[kNumLimits] = {std::numeric_limits<size_t>::max(),
                                 std::numeric_limits<size_t>::max()};
+  size_t cgroup_soft_limit_ = std::numeric_limits<size_t>::max();
+
+  // See set_tag_limit.  Filled with std::numeric_limits<size_t>::max() by the
+  // constructor.
+  size_t tag_limits_[kNumTagLimits][kNumLimits];
+  int64_t tag_limit_hits_[kNumTagLimits][kNumLimits]{};
+  // Whether any of tag_limits_ is set.
+  bool has_tag_limits_ = false;
 
   // The number of times the limit has been hit.
   int64_t limit_hits_[kNumLimits]{0};
   // Number of times we succeeded in shrinking the memory usage to be less than
   // or at the limit.
   int64_t successful_shrinks_after_limit_hit_[kNumLimits]{0};
+  LimitShrinkStats limit_shrink_stats_{};
 
   // peak_backed_bytes_ tracks the maximum number of pages backed (with physical
   // memory) in the page heap and metadata.
@@ -191,11 +399,11 @@ inline PageAllocator::Interface* PageAllocator::impl(MemoryTag tag) const {
     TC_ASSERT_EQ(alg_, HPAA);
   }
 
+  if (IsNormalTag(tag)) {
+    return normal_impl_[NumaPartitionFromTag(tag)];
+  }
+
   switch (tag) {
-    case MemoryTag::kNormalP0:
-      return normal_impl_[0];
-    case MemoryTag::kNormalP1:
-      return normal_impl_[1];
     case MemoryTag::kSampled:
       return sampled_impl_;
     case MemoryTag::kSelSan:
@@ -208,22 +416,202 @@ inline PageAllocator::Interface* PageAllocator::impl(MemoryTag tag) const {
   }
 }
 
+inline int PageAllocator::LargeSpanCacheHeap(MemoryTag tag) {
+  if (IsNormalTag(tag)) {
+    return NumaPartitionFromTag(tag);
+  }
+  if (tag == MemoryTag::kCold) {
+    return kNumaPartitions;
+  }
+  return -1;
+}
+
+inline LargeSpanCache* PageAllocator::large_span_cache(MemoryTag tag) {
+  const int heap = LargeSpanCacheHeap(tag);
+  if (heap < 0) {
+    return nullptr;
+  }
+  return &large_span_caches_[heap][LargeSpanCacheShard()];
+}
+
+inline void PageAllocator::DrainLargeSpanCache(MemoryTag tag, bool all) {
+  const int heap = LargeSpanCacheHeap(tag);
+  TC_ASSERT_GE(heap, 0);
+  Interface* impl_for_tag = impl(tag);
+  for (size_t shard = 0; shard < num_large_span_cache_shards_; ++shard) {
+    large_span_caches_[heap][shard].Drain(
+        all, [impl_for_tag](Span* span) ABSL_NO_THREAD_SAFETY_ANALYSIS {
+          impl_for_tag->Delete(span, /*objects_per_span=*/1);
+        });
+  }
+}
+
+inline void PageAllocator::DrainLargeSpanCaches(bool all,
+                                                uint64_t skip_partitions) {
+  DrainLargeSpanCache(MemoryTag::kCold, all);
+  for (int partition = 0; partition < active_numa_partitions(); partition++) {
+    if ((skip_partitions >> partition) & 1) continue;
+    DrainLargeSpanCache(NumaNormalTag(partition), all);
+  }
+}
+
+inline Length PageAllocator::Reserve(Length n, bool populate,
+                                    MemoryTag tag) {
+  const Length reserved = impl(tag)->Reserve(n, populate);
+  if (reserved > Length(0)) {
+    // The reservation counts towards the memory limits like any other free
+    // backed memory.
+    PageHeapSpinLockHolder l;
+    ShrinkToUsageLimit(Length(0));
+  }
+  return reserved;
+}
+
+inline HugeLength PageAllocator::CollapseHugepages(HugeLength max) {
+  HugeLength attempted;
+  if (alg_ != HPAA) return attempted;
+
+  // Cold memory gains little from TLB coverage, so we leave it to khugepaged.
+  for (int partition = 0; partition < active_numa_partitions(); partition++) {
+    if (attempted >= max) return attempted;
+    attempted += static_cast<HugePageAwareAllocator*>(normal_impl_[partition])
+                     ->CollapseHugepages(max - attempted);
+  }
+  if (attempted < max) {
+    attempted += static_cast<HugePageAwareAllocator*>(sampled_impl_)
+                     ->CollapseHugepages(max - attempted);
+  }
+  return attempted;
+}
+
+inline void PageAllocator::SampleHugepageBacking(HugeLength max) {
+  if (alg_ != HPAA) return;
+
+  for (int partition = 0; partition < active_numa_partitions(); partition++) {
+    static_cast<HugePageAwareAllocator*>(normal_impl_[partition])
+        ->SampleHugepageBacking(max);
+  }
+  static_cast<HugePageAwareAllocator*>(sampled_impl_)
+      ->SampleHugepageBacking(max);
+  if (has_cold_impl_) {
+    static_cast<HugePageAwareAllocator*>(cold_impl_)
+        ->SampleHugepageBacking(max);
+  }
+}
+
+inline HugePageBackingStats PageAllocator::GetHugepageBackingStats() const {
+  HugePageBackingStats stats;
+  if (alg_ != HPAA) return stats;
+
+  for (int partition = 0; partition < active_numa_partitions(); partition++) {
+    stats += static_cast<const HugePageAwareAllocator*>(normal_impl_[partition])
+                 ->GetHugepageBackingStats();
+  }
+  stats += static_cast<const HugePageAwareAllocator*>(sampled_impl_)
+               ->GetHugepageBackingStats();
+  if (has_cold_impl_) {
+    stats += static_cast<const HugePageAwareAllocator*>(cold_impl_)
+                 ->GetHugepageBackingStats();
+  }
+  return stats;
+}
+
+inline HugeLength PageAllocator::HugeCacheLimit(int partition) const {
+  if (alg_ != HPAA) return NHugePages(0);
+  return static_cast<const HugePageAwareAllocator*>(normal_impl_[partition])
+      ->cache()
+      ->limit();
+}
+
+inline void PageAllocator::RaiseHugeCacheLimit(int partition,
+                                               HugeLength limit) {
+  if (alg_ != HPAA) return;
+  static_cast<HugePageAwareAllocator*>(normal_impl_[partition])
+      ->RaiseHugeCacheLimit(limit);
+}
+
+inline Span* PageAllocator::GetCachedLargeSpan(Length n, Length align,
+                                               SpanAllocInfo span_alloc_info,
+                                               MemoryTag tag) {
+  // Only large allocations are cached, so that a cached span is handed back
+  // to the heap as the same kind of allocation it was taken out as.
+  if (span_alloc_info.objects_per_span != 1 ||
+      span_alloc_info.density != AccessDensityPrediction::kSparse ||
+      !Parameters::large_span_cache()) {
+    return nullptr;
+  }
+  LargeSpanCache* cache = large_span_cache(tag);
+  return cache != nullptr ? cache->Get(n, align) : nullptr;
+}
+
+inline Length PageAllocator::RoundUpToLogicalPages(Length n, MemoryTag tag) {
+  if (ABSL_PREDICT_TRUE(tag != MemoryTag::kCold)) return n;
+  const int64_t page_size = Parameters::cold_page_size();
+  if (page_size <= static_cast<int64_t>(kPageSize)) return n;
+  // Bound the logical pages to hugepages, beyond which rounding only wastes
+  // memory.
+  const Length pages = std::min(
+      Length(absl::bit_floor(static_cast<uint64_t>(page_size)) / kPageSize),
+      kPagesPerHugePage);
+  return Length((n.raw_num() + pages.raw_num() - 1) / pages.raw_num() *
+                pages.raw_num());
+}
+
+inline Length PageAllocator::RoundUpToLargeSizeClass(Length n) {
+  if (n <= LargeSpanCache::kMinLength || n > LargeSpanCache::kMaxLength) {
+    return n;
+  }
+  const int width = absl::bit_width(n.raw_num());
+  if (width <= 4) return n;
+  const size_t step = size_t{1} << (width - 4);
+  const Length rounded((n.raw_num() + step - 1) & ~(step - 1));
+  return rounded <= LargeSpanCache::kMaxLength ? rounded : n;
+}
+
 inline Span* PageAllocator::New(Length n, SpanAllocInfo span_alloc_info,
                                 MemoryTag tag) {
+  TC_USDT_PROBE(page_alloc_new, n.raw_num(), 1, static_cast<int>(tag));
+  if (Span* span = GetCachedLargeSpan(n, Length(1), span_alloc_info, tag);
+      span != nullptr) {
+    return span;
+  }
   return impl(tag)->New(n, span_alloc_info);
 }
 
 inline Span* PageAllocator::NewAligned(Length n, Length align,
                                        SpanAllocInfo span_alloc_info,
                                        MemoryTag tag) {
+  TC_USDT_PROBE(page_alloc_new, n.raw_num(), align.raw_num(),
+                static_cast<int>(tag));
+  if (Span* span = GetCachedLargeSpan(n, align, span_alloc_info, tag);
+      span != nullptr) {
+    return span;
+  }
   return impl(tag)->NewAligned(n, align, span_alloc_info);
 }
 
 inline void PageAllocator::Delete(Span* span, size_t objects_per_span,
                                   MemoryTag tag) {
+  TC_USDT_PROBE(page_alloc_delete, span->num_pages().raw_num(),
+                objects_per_span, static_cast<int>(tag));
   impl(tag)->Delete(span, objects_per_span);
 }
 
+inline bool PageAllocator::CacheLargeSpan(Span* span, MemoryTag tag) {
+  if (!Parameters::large_span_cache()) {
+    return false;
+  }
+  LargeSpanCache* cache = large_span_cache(tag);
+  if (cache == nullptr) {
+    return false;
+  }
+  // The memory of a freed span is no longer known to be zero, nor grown by
+  // realloc.
+  span->set_zeroed(false);
+  span->set_realloc_grown(false);
+  return cache->Put(span);
+}
+
 inline BackingStats PageAllocator::stats() const {
   BackingStats ret = normal_impl_[0]->stats();
   for (int partition = 1; partition < active_numa_partitions(); partition++) {
@@ -236,6 +624,23 @@ inline BackingStats PageAllocator::stats() const {
   if (has_cold_impl_) {
     ret += cold_impl_->stats();
   }
+  // Cached large spans are free as far as the application is concerned.
+  for (const auto& shards : large_span_caches_) {
+    for (size_t shard = 0; shard < num_large_span_cache_shards_; ++shard) {
+      ret.free_bytes += shards[shard].bytes();
+    }
+  }
+  return ret;
+}
+
+inline BackingStats PageAllocator::cold_stats() const {
+  if (!has_cold_impl_) {
+    return BackingStats();
+  }
+  BackingStats ret = cold_impl_->stats();
+  for (size_t shard = 0; shard < num_large_span_cache_shards_; ++shard) {
+    ret.free_bytes += large_span_caches_[kNumaPartitions][shard].bytes();
+  }
   return ret;
 }
 
@@ -282,7 +687,13 @@ inline void PageAllocator::GetLargeSpanStats(LargeSpanStats* result) {
 }
 
 inline Length PageAllocator::ReleaseAtLeastNPages(Length num_pages,
-                                                  PageReleaseReason reason) {
+                                                  PageReleaseReason reason,
+                                                  uint64_t skip_partitions) {
+  // Cached large spans are not releasable.  Background release returns those
+  // that have since gone unused, while any other reason returns them all.
+  DrainLargeSpanCaches(reason != PageReleaseReason::kProcessBackgroundActions,
+                       skip_partitions);
+
   Length released;
   // TODO(ckennelly): Refine this policy.  Cold data should be the most
   // resilient to not being on huge pages.
@@ -294,6 +705,7 @@ inline Length PageAllocator::ReleaseAtLeastNPages(Length num_pages,
         num_pages > released ? num_pages - released : Length(0), reason);
   }
   for (int partition = 0; partition < active_numa_partitions(); partition++) {
+    if ((skip_partitions >> partition) & 1) continue;
     released += normal_impl_[partition]->ReleaseAtLeastNPages(
         num_pages > released ? num_pages - released : Length(0), reason);
   }
@@ -303,6 +715,15 @@ inline Length PageAllocator::ReleaseAtLeastNPages(Length num_pages,
   return released;
 }
 
+inline Length PageAllocator::ReleasePartitionAtLeastNPages(
+    int partition, Length num_pages, PageReleaseReason reason) {
+  TC_ASSERT_GE(partition, 0);
+  TC_ASSERT_LT(partition, active_numa_partitions());
+  DrainLargeSpanCache(NumaNormalTag(partition),
+                      reason != PageReleaseReason::kProcessBackgroundActions);
+  return normal_impl_[partition]->ReleaseAtLeastNPages(num_pages, reason);
+}
+
 inline PageReleaseStats PageAllocator::GetReleaseStats() const {
   PageReleaseStats stats;
 
@@ -363,6 +784,12 @@ inline void PageAllocator::set_limit(size_t limit, LimitKind limit_kind) {
   ShrinkToUsageLimit(Length(0));
 }
 
+inline void PageAllocator::set_cgroup_soft_limit(size_t limit) {
+  PageHeapSpinLockHolder h;
+  cgroup_soft_limit_ = limit;
+  ShrinkToUsageLimit(Length(0));
+}
+
 inline int64_t PageAllocator::limit_hits(LimitKind limit_kind) const {
   TC_ASSERT_LT(limit_kind, kNumLimits);
   PageHeapSpinLockHolder l;
@@ -376,6 +803,12 @@ inline int64_t PageAllocator::successful_shrinks_after_limit_hit(
   return successful_shrinks_after_limit_hit_[limit_kind];
 }
 
+inline PageAllocator::LimitShrinkStats PageAllocator::limit_shrink_stats()
+    const {
+  PageHeapSpinLockHolder l;
+  return limit_shrink_stats_;
+}
+
 inline const PageAllocInfo& PageAllocator::info(MemoryTag tag) const {
   return impl(tag)->info();
 }
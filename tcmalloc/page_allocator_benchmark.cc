@@ -0,0 +1,148 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Measures the throughput of PageAllocator::New/Delete when several threads
+// allocate and free spans at once, and how long they wait for pageheap_lock,
+// so that changes to its locking (e.g. sharding it) can be evaluated.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/cycleclock.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/huge_pages.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/page_allocator.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/stats.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Spans each thread keeps allocated, replacing one per iteration.
+constexpr size_t kLiveSpans = 64;
+
+// Returns a span length: mostly small spans, as for size classes, some medium
+// ones, up to a hugepage, and a few of several hugepages.
+Length RandomLength(absl::BitGen& rng) {
+  const double p = absl::Uniform(rng, 0.0, 1.0);
+  if (p < 0.8) {
+    return Length(absl::Uniform<size_t>(rng, 1, 8));
+  }
+  if (p < 0.98) {
+    return Length(absl::Uniform<size_t>(rng, 8, kPagesPerHugePage.raw_num()));
+  }
+  return kPagesPerHugePage * absl::Uniform<size_t>(rng, 2, 5) +
+         Length(absl::Uniform<size_t>(rng, 0, 8));
+}
+
+constexpr SpanAllocInfo kSpanAllocInfo = {1, AccessDensityPrediction::kSparse};
+
+// Background release, releasing memory as ProcessBackgroundActions would while
+// the benchmark runs.
+ABSL_CONST_INIT std::atomic<bool> stop_release{false};
+ABSL_CONST_INIT std::thread* release_thread = nullptr;
+
+void StartRelease(const benchmark::State& state) {
+  tc_globals.InitIfNecessary();
+  if (state.range(0) == 0) return;
+  stop_release.store(false, std::memory_order_relaxed);
+  release_thread = new std::thread([] {
+    while (!stop_release.load(std::memory_order_relaxed)) {
+      {
+        PageHeapSpinLockHolder l;
+        tc_globals.page_allocator().ReleaseAtLeastNPages(
+            kPagesPerHugePage, PageReleaseReason::kProcessBackgroundActions);
+      }
+      absl::SleepFor(absl::Milliseconds(1));
+    }
+  });
+}
+
+void StopRelease(const benchmark::State&) {
+  if (release_thread == nullptr) return;
+  stop_release.store(true, std::memory_order_relaxed);
+  release_thread->join();
+  delete release_thread;
+  release_thread = nullptr;
+}
+
+// Allocates and frees spans of mixed lengths from every thread.  The argument
+// is whether memory is released in the background at the same time.  Reports
+// the operations (a New and a Delete) per second and the average time an
+// operation waited for pageheap_lock around Delete.
+void BM_NewDelete(benchmark::State& state) {
+  PageAllocator& allocator = tc_globals.page_allocator();
+  absl::BitGen rng;
+  std::vector<Span*> spans(kLiveSpans, nullptr);
+  int64_t wait_cycles = 0;
+
+  auto release = [&](Span* span) {
+    const int64_t start = absl::base_internal::CycleClock::Now();
+    PageHeapSpinLockHolder l;
+    wait_cycles += absl::base_internal::CycleClock::Now() - start;
+    allocator.Delete(span, kSpanAllocInfo.objects_per_span, MemoryTag::kNormal);
+  };
+
+  for (auto _ : state) {
+    Span*& span = spans[absl::Uniform<size_t>(rng, 0, kLiveSpans)];
+    if (span != nullptr) {
+      release(span);
+    }
+    span = allocator.New(RandomLength(rng), kSpanAllocInfo, MemoryTag::kNormal);
+    TC_CHECK_NE(span, nullptr);
+    benchmark::DoNotOptimize(span);
+  }
+
+  for (Span* span : spans) {
+    if (span != nullptr) {
+      release(span);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["lock_wait_ns"] = benchmark::Counter(
+      wait_cycles * 1e9 / absl::base_internal::CycleClock::Frequency() /
+          std::max<int64_t>(state.iterations(), 1),
+      benchmark::Counter::kAvgThreads);
+}
+
+BENCHMARK(BM_NewDelete)
+    ->Arg(0)
+    ->Arg(1)
+    ->ThreadRange(1, 64)
+    ->UseRealTime()
+    ->Setup(StartRelease)
+    ->Teardown(StopRelease);
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -79,6 +79,15 @@ class PageAllocatorInterface {
   virtual PageReleaseStats GetReleaseStats() const
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) = 0;
 
+  // Reserves at least <n> pages of free memory ahead of demand, so that
+  // subsequent allocations are served without growing the heap.  If
+  // <populate> is set, the memory is also faulted in.  Returns the number of
+  // pages reserved, which is zero if reservations are not supported.
+  virtual Length Reserve(Length n, bool populate)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    return Length(0);
+  }
+
   // Prints stats about the page heap to *out.
   virtual void Print(Printer* out) ABSL_LOCKS_EXCLUDED(pageheap_lock) = 0;
 
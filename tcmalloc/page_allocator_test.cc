@@ -20,7 +20,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <limits>
 #include <new>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -30,6 +32,7 @@
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/large_span_cache.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/page_allocator_test_util.h"
 #include "tcmalloc/span.h"
@@ -220,6 +223,177 @@ TEST_F(PageAllocatorTest, b270916852) {
   Parameters::set_hpaa_subrelease(old_subrelease);
 }
 
+TEST_F(PageAllocatorTest, TagLimits) {
+  constexpr SpanAllocInfo kSpanInfo = {/*objects_per_span=*/1,
+                                       AccessDensityPrediction::kSparse};
+  Span* normal = New(kPagesPerHugePage / 2, kSpanInfo, MemoryTag::kNormal);
+  Span* sampled = New(kPagesPerHugePage / 2, kSpanInfo, MemoryTag::kSampled);
+  Delete(New(kPagesPerHugePage / 2, kSpanInfo, MemoryTag::kSampled),
+         kSpanInfo.objects_per_span, MemoryTag::kSampled);
+
+  EXPECT_FALSE(allocator_->set_tag_limit(MemoryTag::kSelSan, kHugePageSize,
+                                         PageAllocator::kSoft));
+  EXPECT_EQ(allocator_->tag_limit(MemoryTag::kSampled, PageAllocator::kSoft),
+            std::numeric_limits<size_t>::max());
+
+  // The sampled heap releases its free half hugepage to get within its limit,
+  // while the normal heap keeps its own.
+  ASSERT_TRUE(allocator_->set_tag_limit(
+      MemoryTag::kSampled, kHugePageSize / 2, PageAllocator::kSoft));
+  EXPECT_EQ(allocator_->tag_limit(MemoryTag::kSampled, PageAllocator::kSoft),
+            kHugePageSize / 2);
+  EXPECT_EQ(
+      allocator_->tag_limit_hits(MemoryTag::kSampled, PageAllocator::kSoft), 1);
+  EXPECT_EQ(
+      allocator_->tag_limit_hits(MemoryTag::kSampled, PageAllocator::kHard), 0);
+  EXPECT_EQ(
+      allocator_->tag_limit_hits(MemoryTag::kNormal, PageAllocator::kSoft), 0);
+  BackingStats stats;
+  {
+    PageHeapSpinLockHolder l;
+    stats = allocator_->stats();
+  }
+  EXPECT_GE(stats.unmapped_bytes, kHugePageSize / 2);
+  EXPECT_LT(stats.unmapped_bytes, kHugePageSize);
+
+  // A hard limit lowers the soft limit.
+  ASSERT_TRUE(allocator_->set_tag_limit(
+      MemoryTag::kSampled, kHugePageSize / 4 * 3, PageAllocator::kHard));
+  ASSERT_TRUE(allocator_->set_tag_limit(MemoryTag::kSampled, kHugePageSize,
+                                        PageAllocator::kSoft));
+  EXPECT_EQ(allocator_->tag_limit(MemoryTag::kSampled, PageAllocator::kSoft),
+            kHugePageSize / 4 * 3);
+
+  Delete(normal, kSpanInfo.objects_per_span, MemoryTag::kNormal);
+  Delete(sampled, kSpanInfo.objects_per_span, MemoryTag::kSampled);
+}
+
+TEST_F(PageAllocatorTest, CgroupSoftLimit) {
+  constexpr SpanAllocInfo kSpanInfo = {/*objects_per_span=*/1,
+                                       AccessDensityPrediction::kSparse};
+  Span* span = New(kPagesPerHugePage, kSpanInfo);
+  ASSERT_NE(span, nullptr);
+  const size_t backed = [&]() {
+    PageHeapSpinLockHolder l;
+    BackingStats stats = allocator_->stats();
+    return stats.system_bytes - stats.unmapped_bytes +
+           tc_globals.metadata_bytes();
+  }();
+
+  // A cgroup soft limit below usage counts as a soft limit hit, without
+  // changing the configured soft limit.
+  EXPECT_EQ(allocator_->cgroup_soft_limit(),
+            std::numeric_limits<size_t>::max());
+  allocator_->set_cgroup_soft_limit(backed / 2);
+  EXPECT_EQ(allocator_->cgroup_soft_limit(), backed / 2);
+  EXPECT_EQ(allocator_->limit(PageAllocator::kSoft),
+            std::numeric_limits<size_t>::max());
+  EXPECT_LE(1, allocator_->limit_hits(PageAllocator::kSoft));
+
+  allocator_->set_cgroup_soft_limit(std::numeric_limits<size_t>::max());
+  EXPECT_EQ(allocator_->ReleaseNearCgroupSoftLimit(), Length(0));
+
+  // Free memory is released once usage gets close to the limit, but not
+  // while it is well below it.
+  Delete(span, kSpanInfo.objects_per_span);
+  allocator_->set_cgroup_soft_limit(backed * 2);
+  EXPECT_EQ(allocator_->ReleaseNearCgroupSoftLimit(), Length(0));
+  allocator_->set_cgroup_soft_limit(backed / 95 * 100);
+  EXPECT_GT(allocator_->ReleaseNearCgroupSoftLimit(), Length(0));
+  allocator_->set_cgroup_soft_limit(std::numeric_limits<size_t>::max());
+}
+
+TEST_F(PageAllocatorTest, ShrinkAheadOfSoftLimit) {
+  constexpr SpanAllocInfo kSpanInfo = {/*objects_per_span=*/1,
+                                       AccessDensityPrediction::kSparse};
+  Span* span = New(kPagesPerHugePage, kSpanInfo);
+  ASSERT_NE(span, nullptr);
+  Delete(span, kSpanInfo.objects_per_span);
+  const size_t backed = [&]() {
+    PageHeapSpinLockHolder l;
+    BackingStats stats = allocator_->stats();
+    return stats.system_bytes - stats.unmapped_bytes +
+           tc_globals.metadata_bytes();
+  }();
+
+  // Without a soft limit, there is no watermark.
+  EXPECT_FALSE(allocator_->AboveSoftLimitWatermark(90));
+  EXPECT_EQ(allocator_->ShrinkAheadOfSoftLimit(90), Length(0));
+
+  // Usage is below the limit, but above the watermark: the free hugepage is
+  // released in the background, not as a soft limit hit.
+  allocator_->set_limit(backed / 95 * 100, PageAllocator::kSoft);
+  const int64_t limit_hits = allocator_->limit_hits(PageAllocator::kSoft);
+  EXPECT_FALSE(allocator_->AboveSoftLimitWatermark(0));
+  EXPECT_FALSE(allocator_->AboveSoftLimitWatermark(99));
+  EXPECT_TRUE(allocator_->AboveSoftLimitWatermark(90));
+  EXPECT_GT(allocator_->ShrinkAheadOfSoftLimit(90), Length(0));
+  EXPECT_FALSE(allocator_->AboveSoftLimitWatermark(90));
+  EXPECT_EQ(allocator_->limit_hits(PageAllocator::kSoft), limit_hits);
+
+  const PageAllocator::LimitShrinkStats shrinks =
+      allocator_->limit_shrink_stats();
+  EXPECT_EQ(shrinks.background_shrinks, 1);
+  EXPECT_GT(shrinks.background_pages, Length(0));
+  EXPECT_EQ(shrinks.foreground_shrinks, 0);
+
+  allocator_->set_limit(std::numeric_limits<size_t>::max(),
+                        PageAllocator::kSoft);
+}
+
+TEST(PageAllocatorLogicalPagesTest, RoundUpToLogicalPages) {
+  const int64_t old_page_size = Parameters::cold_page_size();
+  const Length kPages = Length(3);
+
+  Parameters::set_cold_page_size(0);
+  EXPECT_EQ(PageAllocator::RoundUpToLogicalPages(kPages, MemoryTag::kCold),
+            kPages);
+
+  Parameters::set_cold_page_size(4 * kPageSize);
+  EXPECT_EQ(PageAllocator::RoundUpToLogicalPages(kPages, MemoryTag::kCold),
+            Length(4));
+  EXPECT_EQ(PageAllocator::RoundUpToLogicalPages(Length(4), MemoryTag::kCold),
+            Length(4));
+  EXPECT_EQ(PageAllocator::RoundUpToLogicalPages(Length(5), MemoryTag::kCold),
+            Length(8));
+  // Other heaps keep TCMalloc's page size.
+  EXPECT_EQ(PageAllocator::RoundUpToLogicalPages(kPages, MemoryTag::kNormal),
+            kPages);
+
+  // Sizes are rounded down to a power of two.
+  Parameters::set_cold_page_size(3 * kPageSize);
+  EXPECT_EQ(PageAllocator::RoundUpToLogicalPages(kPages, MemoryTag::kCold),
+            Length(4));
+
+  // Logical pages are at most a hugepage.
+  Parameters::set_cold_page_size(kHugePageSize * 4);
+  EXPECT_EQ(PageAllocator::RoundUpToLogicalPages(Length(1), MemoryTag::kCold),
+            kPagesPerHugePage);
+
+  Parameters::set_cold_page_size(old_page_size);
+}
+
+TEST(PageAllocatorLogicalPagesTest, RoundUpToLargeSizeClass) {
+  // Lengths the large span cache does not hold are left alone.
+  EXPECT_EQ(PageAllocator::RoundUpToLargeSizeClass(Length(1)), Length(1));
+  const Length kTooLong = LargeSpanCache::kMaxLength + Length(1);
+  EXPECT_EQ(PageAllocator::RoundUpToLargeSizeClass(kTooLong), kTooLong);
+
+  std::set<Length> classes;
+  for (Length n = LargeSpanCache::kMinLength + Length(1);
+       n <= LargeSpanCache::kMaxLength; ++n) {
+    const Length rounded = PageAllocator::RoundUpToLargeSizeClass(n);
+    EXPECT_GE(rounded, n);
+    EXPECT_LE(rounded, LargeSpanCache::kMaxLength);
+    EXPECT_LE((rounded - n).raw_num(), n.raw_num() / 8);
+    // Rounding is idempotent.
+    EXPECT_EQ(PageAllocator::RoundUpToLargeSizeClass(rounded), rounded);
+    classes.insert(rounded);
+  }
+  // Eight classes per doubling at most, from 64 KiB to 2 MiB.
+  EXPECT_LE(classes.size(), 8 * 5);
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
@@ -16,6 +16,7 @@
 #define TCMALLOC_PAGE_HEAP_ALLOCATOR_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <new>
 
@@ -48,7 +49,10 @@ template <class T>
 class PageHeapAllocator {
  public:
   constexpr PageHeapAllocator()
-      : arena_(nullptr), free_list_(nullptr), stats_{0, 0} {}
+      : arena_(nullptr),
+        free_list_(nullptr),
+        stats_{0, 0},
+        free_after_release_(0) {}
 
   // We use an explicit Init function because these variables are statically
   // allocated and their constructors might not have run by the time some
@@ -99,11 +103,144 @@ class PageHeapAllocator {
     stats_.in_use--;
   }
 
+  // Carves objects of <size> bytes out of the arena until at least <n> are
+  // on the free list, so that New does not have to grow the arena while the
+  // caller holds pageheap_lock for other work.
+  void Reserve(size_t n, size_t size, std::align_val_t align)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    TC_ASSERT_GE(static_cast<size_t>(align), alignof(T));
+    while (stats_.total - stats_.in_use < n) {
+      T* p = reinterpret_cast<T*>(arena_->Alloc(size, align));
+      stats_.total++;
+      stats_.in_use++;
+      Delete(p);
+    }
+  }
+
+  // Gives the pages that lie entirely within free objects of <size> bytes
+  // back to the arena, which returns them to the OS and reuses them for any
+  // metadata, keeping at least <keep> objects on the free list.  The free list
+  // is left sorted by address, so that New hands out neighboring objects.
+  // Returns the number of bytes released.
+  //
+  // This sorts the free list under pageheap_lock, so it only does anything
+  // once the free list holds kMinReleaseBytes beyond <keep> and has doubled
+  // since the previous call did.
+  size_t ReleaseFree(size_t keep, size_t size)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    TC_ASSERT_GE(size, sizeof(T));
+    const size_t free = stats_.total - stats_.in_use;
+    if (free <= keep || (free - keep) * size < kMinReleaseBytes ||
+        free < 2 * free_after_release_) {
+      return 0;
+    }
+
+#ifdef ABSL_HAVE_ADDRESS_SANITIZER
+    for (T* p = free_list_; p != nullptr; p = Next(p)) {
+      ASAN_UNPOISON_MEMORY_REGION(p, size);
+    }
+#endif
+    T* p = SortByAddress(free_list_);
+    free_list_ = nullptr;
+    T** tail = &free_list_;
+    size_t released = 0;
+    size_t dropped = 0;
+    while (p != nullptr) {
+      // Find the run of adjacent free objects that starts at p.
+      char* const start = reinterpret_cast<char*>(p);
+      size_t n = 1;
+      while (Next(p) ==
+             reinterpret_cast<T*>(reinterpret_cast<char*>(p) + size)) {
+        p = Next(p);
+        ++n;
+      }
+      char* const end = start + n * size;
+      T* const next_run = Next(p);
+
+      // The objects [first, last) overlap the whole pages of the run.  Those
+      // leave the free list; the parts of them outside the pages are lost.
+      constexpr uintptr_t kPageMask = kPageSize - 1;
+      char* const lo = reinterpret_cast<char*>(
+          (reinterpret_cast<uintptr_t>(start) + kPageMask) & ~kPageMask);
+      char* const hi = reinterpret_cast<char*>(
+          reinterpret_cast<uintptr_t>(end) & ~kPageMask);
+      size_t first = n;
+      size_t last = n;
+      if (lo < hi) {
+        first = (lo - start) / size;
+        last = (hi - 1 - start) / size + 1;
+        const size_t lost = (lo - start - first * size) +
+                            (start + last * size - hi);
+        if (free - dropped - (last - first) < keep ||
+            !arena_->ReleasePages(lo, hi - lo, lost)) {
+          first = last = n;
+        } else {
+          released += hi - lo;
+          dropped += last - first;
+        }
+      }
+
+      for (size_t i = 0; i < n; ++i) {
+        if (i == first) i = last;
+        if (i == n) break;
+        T* object = reinterpret_cast<T*>(start + i * size);
+        *tail = object;
+        tail = reinterpret_cast<T**>(object);
+      }
+      p = next_run;
+    }
+    *tail = nullptr;
+
+#ifdef ABSL_HAVE_ADDRESS_SANITIZER
+    for (T* q = free_list_; q != nullptr;) {
+      T* next = Next(q);
+      ASAN_POISON_MEMORY_REGION(q, size);
+      q = next;
+    }
+#endif
+    stats_.total -= dropped;
+    free_after_release_ = free - dropped;
+    return released;
+  }
+
   AllocatorStats stats() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
     return stats_;
   }
 
  private:
+  // The least that ReleaseFree must be able to give back before it sorts the
+  // free list.
+  static constexpr size_t kMinReleaseBytes = 1 << 20;
+
+  static T* Next(T* p) { return *reinterpret_cast<T**>(p); }
+
+  // Sorts the list at <head> by address.  A merge sort, which needs no memory
+  // beyond the list itself.
+  static T* SortByAddress(T* head) {
+    if (head == nullptr || Next(head) == nullptr) return head;
+    // Split the list in half.
+    T* slow = head;
+    for (T* fast = Next(head); fast != nullptr && Next(fast) != nullptr;
+         fast = Next(Next(fast))) {
+      slow = Next(slow);
+    }
+    T* second = Next(slow);
+    *reinterpret_cast<T**>(slow) = nullptr;
+
+    T* a = SortByAddress(head);
+    T* b = SortByAddress(second);
+    T* merged = nullptr;
+    T** tail = &merged;
+    while (a != nullptr && b != nullptr) {
+      T*& smaller = a < b ? a : b;
+      *tail = smaller;
+      tail = reinterpret_cast<T**>(smaller);
+      smaller = Next(smaller);
+    }
+    *tail = a != nullptr ? a : b;
+    return merged;
+  }
+
   // Arena from which to allocate memory
   Arena* arena_;
 
@@ -111,6 +248,9 @@ class PageHeapAllocator {
   T* free_list_ ABSL_GUARDED_BY(pageheap_lock);
 
   AllocatorStats stats_ ABSL_GUARDED_BY(pageheap_lock);
+
+  // The free objects that the last call to ReleaseFree left.
+  size_t free_after_release_ ABSL_GUARDED_BY(pageheap_lock);
 };
 
 }  // namespace tcmalloc_internal
@@ -0,0 +1,99 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/page_heap_allocator.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "gtest/gtest.h"
+#include "tcmalloc/arena.h"
+#include "tcmalloc/common.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Not a divisor of the page size, so that objects straddle pages.
+struct Object {
+  char data[96];
+};
+
+constexpr size_t kObjects =
+    std::max<size_t>(4 << 20, 32 * kPageSize) / sizeof(Object);
+// Objects kept in use, far enough apart that whole pages between them are
+// free.
+constexpr size_t kStride = 4 * kPageSize / sizeof(Object) + 1;
+
+// The test holds pageheap_lock, so it must not allocate.
+Object* objects[kObjects];
+
+TEST(PageHeapAllocator, ReleaseFree) {
+  Arena arena;
+  PageHeapAllocator<Object> allocator;
+  PageHeapSpinLockHolder l;
+  allocator.Init(&arena);
+
+  for (size_t i = 0; i < kObjects; ++i) {
+    objects[i] = allocator.New();
+  }
+  // Free in reverse, so that the free list is out of address order.
+  for (size_t i = kObjects; i-- > 0;) {
+    if (i % kStride == 0) {
+      memset(objects[i]->data, i % 256, sizeof(Object));
+    } else {
+      allocator.Delete(objects[i]);
+    }
+  }
+  const size_t in_use = allocator.stats().in_use;
+
+  constexpr size_t kKeep = 10;
+  const size_t released = allocator.ReleaseFree(kKeep, sizeof(Object));
+  EXPECT_GT(released, kObjects * sizeof(Object) / 2);
+  EXPECT_EQ(arena.stats().bytes_reusable, released);
+  AllocatorStats stats = allocator.stats();
+  EXPECT_EQ(stats.in_use, in_use);
+  EXPECT_GE(stats.total - stats.in_use, kKeep);
+
+  // Objects in use kept their contents.
+  for (size_t i = 0; i < kObjects; i += kStride) {
+    for (char c : objects[i]->data) {
+      ASSERT_EQ(c, static_cast<char>(i % 256));
+    }
+  }
+
+  // The free list is sorted by address.
+  Object* a = allocator.New();
+  Object* b = allocator.New();
+  EXPECT_LT(a, b);
+  allocator.Delete(b);
+  allocator.Delete(a);
+
+  // Until the free list grows again, there is nothing more to release.
+  EXPECT_EQ(allocator.ReleaseFree(kKeep, sizeof(Object)), 0);
+
+  // Allocating again reuses the released pages before the arena grows.
+  const size_t blocks = arena.stats().blocks;
+  for (size_t i = 0; i < released / sizeof(Object) / 2; ++i) {
+    allocator.New();
+  }
+  EXPECT_EQ(arena.stats().blocks, blocks);
+  EXPECT_LT(arena.stats().bytes_reusable, released);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
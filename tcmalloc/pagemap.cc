@@ -39,6 +39,7 @@ void PageMap::RegisterSizeClass(Span* span, size_t sc) {
   for (PageId p = first; p <= last; ++p) {
     map_.set_with_sizeclass(p.index(), span, sc);
   }
+  map_.update_sizeclass_summary(first.index(), span->num_pages().raw_num(), sc);
 }
 
 void PageMap::UnregisterSizeClass(Span* span) {
@@ -46,6 +47,8 @@ void PageMap::UnregisterSizeClass(Span* span) {
   const PageId first = span->first_page();
   const PageId last = span->last_page();
   TC_ASSERT_EQ(GetDescriptor(first), span);
+  // Clear the summary first, so that it is never more recent than the pages.
+  map_.update_sizeclass_summary(first.index(), span->num_pages().raw_num(), 0);
   for (PageId p = first; p <= last; ++p) {
     map_.clear_sizeclass(p.index());
   }
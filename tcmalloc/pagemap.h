@@ -30,10 +30,14 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
 #include <optional>
+#include <type_traits>
 #include <vector>
 
 #include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/allocation_guard.h"
@@ -52,7 +56,12 @@ namespace tcmalloc_internal {
 typedef void* (*PagemapAllocator)(size_t);
 void* MetaDataAlloc(size_t bytes);
 
-template <int BITS, PagemapAllocator Allocator>
+// With kChunkedSpans, span pointers are kept in per-hugepage chunks that are
+// only allocated for the hugepages passed to Ensure(), rather than for the
+// whole leaf at once.  This costs a dependent load on span lookups, but on
+// sparse heaps, where a leaf covers few hugepages actually in use, it saves
+// most of the leaf: the span pointers take 8 of its 9 bytes per page.
+template <int BITS, PagemapAllocator Allocator, bool kChunkedSpans = false>
 class PageMap2 {
  private:
   // The leaf node (regardless of pointer size) always maps 2^15 entries;
@@ -70,6 +79,44 @@ class PageMap2 {
       (kLeafBits + kPageShift - kHugePageShift);
   static constexpr size_t kLeafHugepages = kLeafCoveredBytes / kHugePageSize;
   static_assert(kLeafHugepages == 1 << kLeafHugeBits, "sanity");
+  static constexpr int kHugepagePageBits = kLeafBits - kLeafHugeBits;
+  static constexpr int kHugepagePages = 1 << kHugepagePageBits;
+
+  struct FlatSpans {
+    Span* get(size_t i) const { return span[i]; }
+    Span*& at(size_t i) { return span[i]; }
+    bool Ensure(size_t begin, size_t end, size_t* bytes_used) { return true; }
+
+    Span* span[kLeafLength];
+  };
+
+  struct ChunkedSpans {
+    Span* get(size_t i) const {
+      Span* const* c = chunk[i >> kHugepagePageBits];
+      return c != nullptr ? c[i & (kHugepagePages - 1)] : nullptr;
+    }
+    Span*& at(size_t i) {
+      TC_ASSERT_NE(chunk[i >> kHugepagePageBits], nullptr);
+      return chunk[i >> kHugepagePageBits][i & (kHugepagePages - 1)];
+    }
+    // Allocates the chunks covering pages [begin, end) of the leaf.
+    bool Ensure(size_t begin, size_t end, size_t* bytes_used) {
+      for (size_t i = begin >> kHugepagePageBits;
+           i <= (end - 1) >> kHugepagePageBits; ++i) {
+        if (chunk[i] != nullptr) continue;
+        constexpr size_t kChunkBytes = sizeof(Span*) * kHugepagePages;
+        Span** c = reinterpret_cast<Span**>(Allocator(kChunkBytes));
+        if (c == nullptr) return false;
+        *bytes_used += kChunkBytes;
+        memset(c, 0, kChunkBytes);
+        chunk[i] = c;
+      }
+      return true;
+    }
+
+    Span** chunk[kLeafHugepages];
+  };
+
   struct Leaf {
     // We keep parallel arrays indexed by page number.  One keeps the
     // size class; another span pointers; the last hugepage-related
@@ -77,10 +124,55 @@ class PageMap2 {
     // since small object deallocations are so frequent and do not
     // need the other information kept in a Span.
     CompactSizeClass sizeclass[kLeafLength];
-    Span* span[kLeafLength];
+    std::conditional_t<kChunkedSpans, ChunkedSpans, FlatSpans> spans;
     void* hugepage[kLeafHugepages];
+#ifdef TCMALLOC_INTERNAL_HUGEPAGE_SIZECLASS
+    // A summary of the size classes on each hugepage, much smaller than
+    // sizeclass and so more likely to be cached: the number of pages with a
+    // size class above kSummaryCountShift, and their size class below it, or
+    // kMixedSizeClass if they do not all have the same.
+    std::atomic<uint32_t> hugepage_sizeclass[kLeafHugepages];
+#endif
   };
 
+#ifdef TCMALLOC_INTERNAL_HUGEPAGE_SIZECLASS
+  static constexpr int kSummaryCountShift = 16;
+  static constexpr uint32_t kMixedSizeClass = (1 << kSummaryCountShift) - 1;
+  static_assert(kMaxClass < kMixedSizeClass);
+  // The summary of a hugepage whose pages all have the same size class, less
+  // that size class.
+  static constexpr uint32_t kUniformSummary = uint32_t{1}
+                                              << (kHugepagePageBits +
+                                                  kSummaryCountShift);
+
+  // Adds <delta_pages> pages of size class <sc> (or removes them when
+  // negative) to the summary of the hugepage containing page <k>.
+  void update_hugepage_sizeclass(uintptr_t k, int delta_pages,
+                                 CompactSizeClass sc) {
+    const uintptr_t i1 = k >> kLeafBits;
+    const uintptr_t i2 = k & (kLeafLength - 1);
+    std::atomic<uint32_t>& summary =
+        root_[i1]->hugepage_sizeclass[i2 >> kHugepagePageBits];
+    uint32_t old = summary.load(std::memory_order_relaxed);
+    uint32_t next;
+    do {
+      const uint32_t count = (old >> kSummaryCountShift) + delta_pages;
+      TC_ASSERT_LE(count, uint32_t{1} << kHugepagePageBits);
+      uint32_t cls = old & kMixedSizeClass;
+      if (count == 0) {
+        cls = 0;
+      } else if (old == 0) {
+        cls = sc;
+      } else if (delta_pages > 0 && cls != sc) {
+        // Stays mixed until the hugepage holds no small objects.
+        cls = kMixedSizeClass;
+      }
+      next = (count << kSummaryCountShift) | cls;
+    } while (!summary.compare_exchange_weak(old, next,
+                                            std::memory_order_relaxed));
+  }
+#endif
+
   Leaf* root_[kRootLength];  // Top-level node
   size_t bytes_used_;
 
@@ -96,7 +188,7 @@ class PageMap2 {
     if ((k >> BITS) > 0 || root_[i1] == nullptr) {
       return nullptr;
     }
-    return root_[i1]->span[i2];
+    return root_[i1]->spans.get(i2);
   }
 
   // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
@@ -107,7 +199,7 @@ class PageMap2 {
     for (; i1 < kRootLength; ++i1, i2 = 0) {
       if (root_[i1] == nullptr) continue;
       for (; i2 < kLeafLength; ++i2) {
-        if (root_[i1]->span[i2] != nullptr) return (i1 << kLeafBits) | i2;
+        if (root_[i1]->spans.get(i2) != nullptr) return (i1 << kLeafBits) | i2;
       }
     }
     return std::nullopt;
@@ -120,7 +212,7 @@ class PageMap2 {
     const Number i2 = k & (kLeafLength - 1);
     TC_ASSERT_EQ(k >> BITS, 0);
     TC_ASSERT_NE(root_[i1], nullptr);
-    return root_[i1]->span[i2];
+    return root_[i1]->spans.get(i2);
   }
 
   // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
@@ -131,6 +223,18 @@ class PageMap2 {
     const Number i2 = k & (kLeafLength - 1);
     TC_ASSERT_EQ(k >> BITS, 0);
     TC_ASSERT_NE(root_[i1], nullptr);
+#ifdef TCMALLOC_INTERNAL_HUGEPAGE_SIZECLASS
+    // Most small-object hugepages hold spans of a single size class, which the
+    // summary resolves without touching the much larger sizeclass array.
+    const uint32_t summary =
+        root_[i1]->hugepage_sizeclass[i2 >> kHugepagePageBits].load(
+            std::memory_order_relaxed);
+    const uint32_t cls = summary - kUniformSummary;
+    if (ABSL_PREDICT_TRUE(cls < kMixedSizeClass)) {
+      TC_ASSERT_EQ(cls, root_[i1]->sizeclass[i2]);
+      return cls;
+    }
+#endif
     return root_[i1]->sizeclass[i2];
   }
 
@@ -138,7 +242,30 @@ class PageMap2 {
     TC_ASSERT_EQ(k >> BITS, 0);
     const Number i1 = k >> kLeafBits;
     const Number i2 = k & (kLeafLength - 1);
-    root_[i1]->span[i2] = s;
+    root_[i1]->spans.at(i2) = s;
+  }
+
+  // Records that [k, k + n) were given size class <sc>, after setting it with
+  // set_with_sizeclass, or had it cleared, with <sc> == 0, after
+  // clear_sizeclass.  This keeps the per-hugepage summaries used by
+  // sizeclass() up to date when they are enabled.
+  //
+  // Concurrent calls are safe.
+  void update_sizeclass_summary(Number k, size_t n, CompactSizeClass sc) {
+#ifdef TCMALLOC_INTERNAL_HUGEPAGE_SIZECLASS
+    const Number end = k + n;
+    while (k < end) {
+      const Number hugepage_end =
+          ((k >> kHugepagePageBits) + 1) << kHugepagePageBits;
+      const int pages = std::min(end, hugepage_end) - k;
+      update_hugepage_sizeclass(k, sc != 0 ? pages : -pages, sc);
+      k += pages;
+    }
+#else
+    (void)k;
+    (void)n;
+    (void)sc;
+#endif
   }
 
   void set_with_sizeclass(Number k, Span* s, CompactSizeClass sc) {
@@ -146,7 +273,7 @@ class PageMap2 {
     const Number i1 = k >> kLeafBits;
     const Number i2 = k & (kLeafLength - 1);
     Leaf* leaf = root_[i1];
-    leaf->span[i2] = s;
+    leaf->spans.at(i2) = s;
     leaf->sizeclass[i2] = sc;
   }
 
@@ -186,12 +313,18 @@ class PageMap2 {
         Leaf* leaf = reinterpret_cast<Leaf*>(Allocator(sizeof(Leaf)));
         if (leaf == nullptr) return false;
         bytes_used_ += sizeof(Leaf);
-        memset(leaf, 0, sizeof(*leaf));
+        memset(static_cast<void*>(leaf), 0, sizeof(*leaf));
         root_[i1] = leaf;
       }
 
       // Advance key past whatever is covered by this leaf node
-      key = ((key >> kLeafBits) + 1) << kLeafBits;
+      const Number next = ((key >> kLeafBits) + 1) << kLeafBits;
+      const Number end = std::min<Number>(next, start + n);
+      if (!root_[i1]->spans.Ensure(key & (kLeafLength - 1),
+                                   end - (i1 << kLeafBits), &bytes_used_)) {
+        return false;
+      }
+      key = next;
     }
     return true;
   }
@@ -357,6 +490,9 @@ class PageMap3 {
     root_[i1]->leafs[i2]->hugepage[i3 >> (kLeafBits - kLeafHugeBits)] = v;
   }
 
+  // PageMap3 keeps no per-hugepage size class summaries.
+  void update_sizeclass_summary(Number k, size_t n, CompactSizeClass sc) {}
+
   bool Ensure(Number start, size_t n) {
     for (Number key = start; key <= start + n - 1;) {
       const Number i1 = key >> (kLeafBits + kMidBits);
@@ -395,6 +531,127 @@ class PageMap3 {
   const void* RootAddress() { return root_; }
 };
 
+// Maps BITS-bit page numbers with a PageMap2 for those below 2^kLowBits, the
+// common case, and a PageMap3 for the rest.  Lookups of low pages pay a single
+// extra compare over PageMap2, while the root nodes stay small no matter how
+// large BITS is.  This lets the pagemap cover 57-bit (5-level paging) address
+// spaces.
+template <int kLowBits, int BITS, PagemapAllocator Allocator>
+class PageMapSplit {
+  static_assert(kLowBits < BITS);
+
+ public:
+  typedef uintptr_t Number;
+
+  constexpr PageMapSplit() : low_(), high_() {}
+
+  // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
+  void* get(Number k) const ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    if (ABSL_PREDICT_TRUE(IsLow(k))) return low_.get(k);
+    return high_.get(k);
+  }
+
+  // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
+  std::optional<Number> get_next_set_page(Number k) const {
+    if (IsLow(k)) {
+      std::optional<Number> next = low_.get_next_set_page(k);
+      if (next.has_value()) return next;
+      k = kLowLimit - 1;
+    }
+    return high_.get_next_set_page(k);
+  }
+
+  // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
+  // Requires that the span is known to already exist.
+  Span* get_existing(Number k) const ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    if (ABSL_PREDICT_TRUE(IsLow(k))) return low_.get_existing(k);
+    return high_.get_existing(k);
+  }
+
+  // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
+  // REQUIRES: Must be a valid page number previously Ensure()d.
+  CompactSizeClass ABSL_ATTRIBUTE_ALWAYS_INLINE
+  sizeclass(Number k) const ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    if (ABSL_PREDICT_TRUE(IsLow(k))) return low_.sizeclass(k);
+    return high_.sizeclass(k);
+  }
+
+  void set(Number k, Span* s) {
+    if (IsLow(k)) {
+      low_.set(k, s);
+    } else {
+      high_.set(k, s);
+    }
+  }
+
+  void set_with_sizeclass(Number k, Span* s, CompactSizeClass sc) {
+    if (IsLow(k)) {
+      low_.set_with_sizeclass(k, s, sc);
+    } else {
+      high_.set_with_sizeclass(k, s, sc);
+    }
+  }
+
+  void clear_sizeclass(Number k) {
+    if (IsLow(k)) {
+      low_.clear_sizeclass(k);
+    } else {
+      high_.clear_sizeclass(k);
+    }
+  }
+
+  void update_sizeclass_summary(Number k, size_t n, CompactSizeClass sc) {
+    // Spans never cross kLowLimit, as no mapping does.
+    if (IsLow(k)) {
+      low_.update_sizeclass_summary(k, n, sc);
+    } else {
+      high_.update_sizeclass_summary(k, n, sc);
+    }
+  }
+
+  void* get_hugepage(Number k) {
+    if (IsLow(k)) return low_.get_hugepage(k);
+    return high_.get_hugepage(k);
+  }
+
+  void set_hugepage(Number k, void* v) {
+    if (IsLow(k)) {
+      low_.set_hugepage(k, v);
+    } else {
+      high_.set_hugepage(k, v);
+    }
+  }
+
+  bool Ensure(Number start, size_t n) {
+    TC_ASSERT_GT(n, 0);
+    if (IsLow(start)) {
+      const size_t low_n = std::min<Number>(n, kLowLimit - start);
+      if (!low_.Ensure(start, low_n)) return false;
+      if (low_n == n) return true;
+      start += low_n;
+      n -= low_n;
+    }
+    return high_.Ensure(start, n);
+  }
+
+  size_t bytes_used() const {
+    return low_.bytes_used() + high_.bytes_used() - sizeof(low_) -
+           sizeof(high_) + sizeof(*this);
+  }
+
+  // The root of the low map, by far the larger of the two.
+  constexpr size_t RootSize() const { return low_.RootSize(); }
+  const void* RootAddress() { return low_.RootAddress(); }
+
+ private:
+  static constexpr Number kLowLimit = Number{1} << kLowBits;
+
+  static bool IsLow(Number k) { return k < kLowLimit; }
+
+  PageMap2<kLowBits, Allocator> low_;
+  PageMap3<BITS, Allocator> high_;
+};
+
 class PageMap {
  public:
   constexpr PageMap() : map_{} {}
@@ -499,6 +756,13 @@ class PageMap {
  private:
 #ifdef TCMALLOC_USE_PAGEMAP3
   PageMap3<kAddressBits - kPageShift, MetaDataAlloc> map_;
+#elif defined(TCMALLOC_INTERNAL_LA57)
+  PageMapSplit<kLowAddressBits - kPageShift, kAddressBits - kPageShift,
+               MetaDataAlloc>
+      map_;
+#elif defined(TCMALLOC_INTERNAL_CHUNKED_PAGEMAP)
+  PageMap2<kAddressBits - kPageShift, MetaDataAlloc, /*kChunkedSpans=*/true>
+      map_;
 #else
   PageMap2<kAddressBits - kPageShift, MetaDataAlloc> map_;
 #endif
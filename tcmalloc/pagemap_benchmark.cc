@@ -0,0 +1,106 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <new>
+#include <vector>
+
+#include "absl/random/random.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/pagemap.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+std::vector<void*>& Allocations() {
+  static std::vector<void*>* allocations = new std::vector<void*>();
+  return *allocations;
+}
+
+void* Alloc(size_t bytes) {
+  void* ptr = ::operator new(bytes);
+  Allocations().push_back(ptr);
+  return ptr;
+}
+
+void FreeAll() {
+  for (void* ptr : Allocations()) {
+    ::operator delete(ptr);
+  }
+  Allocations().clear();
+}
+
+constexpr int kBits = kAddressBits - kPageShift;
+
+// Maps state.range(0) hugepages, one out of every state.range(1), with a span
+// per page, and then looks up random pages among them.  The metadata_bytes
+// counter reports the size of the map, which is all resident for a flat one.
+template <bool kChunkedSpans>
+void BM_GetExisting(benchmark::State& state) {
+  using Map = PageMap2<kBits, Alloc, kChunkedSpans>;
+  const size_t hugepages = state.range(0);
+  const size_t stride = state.range(1);
+  constexpr size_t kHugepagePages = kPagesPerHugePage.raw_num();
+
+  // The root node is too large for the stack.
+  void* storage = calloc(1, sizeof(Map));
+  TC_CHECK_NE(storage, nullptr);
+  Map* map = new (storage) Map();
+  for (size_t i = 0; i < hugepages; ++i) {
+    const uintptr_t first = i * stride * kHugepagePages;
+    TC_CHECK(map->Ensure(first, kHugepagePages));
+    for (uintptr_t p = first; p < first + kHugepagePages; ++p) {
+      map->set(p, reinterpret_cast<Span*>(p + 1));
+    }
+  }
+
+  absl::BitGen rng;
+  std::vector<uintptr_t> pages(4096);
+  for (uintptr_t& p : pages) {
+    p = absl::Uniform<size_t>(rng, 0, hugepages) * stride * kHugepagePages +
+        absl::Uniform<size_t>(rng, 0, kHugepagePages);
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map->get_existing(pages[i++ % pages.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["metadata_bytes"] =
+      benchmark::Counter(map->bytes_used() - map->RootSize(),
+                         benchmark::Counter::kDefaults,
+                         benchmark::Counter::kIs1024);
+
+  map->~Map();
+  free(storage);
+  FreeAll();
+}
+
+BENCHMARK_TEMPLATE(BM_GetExisting, false)
+    ->ArgsProduct({{64, 4096}, {1, 16, 128}});
+BENCHMARK_TEMPLATE(BM_GetExisting, true)
+    ->ArgsProduct({{64, 4096}, {1, 16, 128}});
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
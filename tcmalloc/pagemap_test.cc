@@ -133,8 +133,154 @@ TEST_P(PageMapTest, RandomAccess) {
   }
 }
 
+#ifdef TCMALLOC_INTERNAL_HUGEPAGE_SIZECLASS
+TEST_P(PageMapTest, HugepageSizeClassSummary) {
+  constexpr intptr_t kHugepagePages = kPagesPerHugePage.raw_num();
+  const intptr_t limit = std::max<intptr_t>(GetParam(), 2 * kHugepagePages);
+  map->Ensure(0, limit);
+
+  auto Register = [&](intptr_t first, intptr_t n, uint8_t cls) {
+    for (intptr_t i = first; i < first + n; ++i) {
+      map->set_with_sizeclass(i, span(first), cls);
+    }
+    map->update_sizeclass_summary(first, n, cls);
+  };
+  auto Unregister = [&](intptr_t first, intptr_t n) {
+    map->update_sizeclass_summary(first, n, 0);
+    for (intptr_t i = first; i < first + n; ++i) {
+      map->clear_sizeclass(i);
+    }
+  };
+
+  // A span crossing into the second hugepage, and spans of another size class
+  // on it, leave it mixed.
+  const intptr_t half = kHugepagePages / 2;
+  Register(0, kHugepagePages + half, 3);
+  Register(kHugepagePages + half, kHugepagePages - half, 5);
+  for (intptr_t i = 0; i < kHugepagePages + half; ++i) {
+    ASSERT_EQ(map->sizeclass(i), 3);
+  }
+  for (intptr_t i = kHugepagePages + half; i < 2 * kHugepagePages; ++i) {
+    ASSERT_EQ(map->sizeclass(i), 5);
+  }
+
+  // Mixed hugepages stay mixed until they are emptied.
+  Unregister(kHugepagePages + half, kHugepagePages - half);
+  Register(kHugepagePages + half, kHugepagePages - half, 3);
+  for (intptr_t i = 0; i < 2 * kHugepagePages; ++i) {
+    ASSERT_EQ(map->sizeclass(i), 3);
+  }
+
+  Unregister(0, kHugepagePages + half);
+  Unregister(kHugepagePages + half, kHugepagePages - half);
+  for (intptr_t i = 0; i < 2 * kHugepagePages; ++i) {
+    ASSERT_EQ(map->sizeclass(i), 0);
+  }
+  Register(kHugepagePages, kHugepagePages, 7);
+  for (intptr_t i = kHugepagePages; i < 2 * kHugepagePages; ++i) {
+    ASSERT_EQ(map->sizeclass(i), 7);
+  }
+}
+#endif
+
 INSTANTIATE_TEST_SUITE_P(Limits, PageMapTest, ::testing::Values(100, 1 << 20));
 
+class ChunkedPageMapTest : public ::testing::Test {
+ public:
+  ~ChunkedPageMapTest() override {
+    for (void* ptr : *ptrs()) {
+      ::operator delete(ptr);
+    }
+    ptrs()->clear();
+  }
+
+  static void* alloc(size_t n) {
+    void* ptr = ::operator new(n);
+    ptrs()->push_back(ptr);
+    return ptr;
+  }
+
+ private:
+  static std::vector<void*>* ptrs() {
+    static std::vector<void*>* ret = new std::vector<void*>();
+    return ret;
+  }
+};
+
+TEST_F(ChunkedPageMapTest, EnsuresHugepages) {
+  constexpr intptr_t kHugepagePages = kPagesPerHugePage.raw_num();
+  PageMap2<20, ChunkedPageMapTest::alloc, /*kChunkedSpans=*/true> chunked;
+  PageMap2<20, ChunkedPageMapTest::alloc> flat;
+
+  // Ensuring a single page makes its whole hugepage usable.
+  const intptr_t first = 3 * kHugepagePages;
+  ASSERT_TRUE(chunked.Ensure(first + 1, 1));
+  ASSERT_TRUE(flat.Ensure(first + 1, 1));
+  for (intptr_t i = first; i < first + kHugepagePages; ++i) {
+    chunked.set_with_sizeclass(i, span(i), sc(i));
+    ASSERT_EQ(chunked.get(i), span(i));
+    ASSERT_EQ(chunked.sizeclass(i), sc(i));
+  }
+  // Other hugepages on the same leaf hold no spans.
+  EXPECT_EQ(chunked.get(0), nullptr);
+  EXPECT_EQ(chunked.get(first + kHugepagePages), nullptr);
+  EXPECT_LT(chunked.bytes_used(), flat.bytes_used());
+
+  // Ranges spanning several hugepages and leaves.
+  const intptr_t start = 5 * kHugepagePages - 1;
+  const intptr_t n = 1 << 16;
+  ASSERT_TRUE(chunked.Ensure(start, n));
+  for (intptr_t i = start; i < start + n; ++i) {
+    chunked.set(i, span(i));
+  }
+  for (intptr_t i = start; i < start + n; ++i) {
+    ASSERT_EQ(chunked.get_existing(i), span(i));
+  }
+  EXPECT_EQ(chunked.get_next_set_page(first + kHugepagePages - 1), start);
+  EXPECT_EQ(chunked.get(start - 1), nullptr);
+}
+
+using SplitPageMapTest = ChunkedPageMapTest;
+
+TEST_F(SplitPageMapTest, MixedRanges) {
+  constexpr intptr_t kLowLimit = intptr_t{1} << 20;
+  PageMapSplit<20, 30, SplitPageMapTest::alloc> map;
+
+  // A range crossing from the low map into the high one.
+  const intptr_t start = kLowLimit - 100;
+  const intptr_t n = 300;
+  ASSERT_TRUE(map.Ensure(start, n));
+  for (intptr_t i = start; i < start + n; ++i) {
+    map.set_with_sizeclass(i, span(i), sc(i));
+  }
+  for (intptr_t i = start; i < start + n; ++i) {
+    ASSERT_EQ(map.get(i), span(i));
+    ASSERT_EQ(map.get_existing(i), span(i));
+    ASSERT_EQ(map.sizeclass(i), sc(i));
+  }
+
+  // Pages far above the low map.
+  const intptr_t high = (intptr_t{1} << 29) + 12345;
+  ASSERT_TRUE(map.Ensure(high, 1));
+  map.set(high, span(high));
+  EXPECT_EQ(map.get(high), span(high));
+  EXPECT_EQ(map.get(high + 1), nullptr);
+  EXPECT_EQ(map.get(intptr_t{1} << 30), nullptr);
+
+  // Searching for set pages continues from the low map into the high one.
+  map.clear_sizeclass(start);
+  map.set(start, nullptr);
+  EXPECT_EQ(map.get_next_set_page(0), start + 1);
+  for (intptr_t i = start + 1; i < start + n; ++i) {
+    map.set(i, nullptr);
+  }
+  EXPECT_EQ(map.get_next_set_page(0), high);
+  EXPECT_EQ(map.get_next_set_page(high), std::nullopt);
+
+  PageMap2<20, SplitPageMapTest::alloc> low;
+  EXPECT_EQ(map.RootSize(), low.RootSize());
+}
+
 // Surround pagemap with unused memory. This isolates it so that it does not
 // share pages with any other structures. This avoids the risk that adjacent
 // objects might cause it to be mapped in. The padding is of sufficient size
@@ -0,0 +1,288 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/parameter_control.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+
+#include "absl/base/attributes.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "tcmalloc/internal/background_wakeup.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/environment.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/parameter_accessors.h"
+#include "tcmalloc/internal/util.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/parameters.h"
+#include "tcmalloc/static_vars.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+bool ParseValue(absl::string_view s, bool* v) { return absl::SimpleAtob(s, v); }
+bool ParseValue(absl::string_view s, int32_t* v) {
+  return absl::SimpleAtoi(s, v);
+}
+bool ParseValue(absl::string_view s, uint32_t* v) {
+  return absl::SimpleAtoi(s, v);
+}
+bool ParseValue(absl::string_view s, int64_t* v) {
+  return absl::SimpleAtoi(s, v);
+}
+bool ParseValue(absl::string_view s, uint64_t* v) {
+  return absl::SimpleAtoi(s, v);
+}
+bool ParseValue(absl::string_view s, double* v) {
+  return absl::SimpleAtod(s, v);
+}
+bool ParseValue(absl::string_view s, absl::Duration* v) {
+  return absl::ParseDuration(s, v);
+}
+
+template <typename T, void (*Setter)(T)>
+bool ParseAndSet(absl::string_view value) {
+  T v;
+  if (!ParseValue(value, &v)) {
+    return false;
+  }
+  Setter(v);
+  return true;
+}
+
+void SetBackgroundReleaseRate(uint64_t v) {
+  Parameters::set_background_release_rate(
+      static_cast<MallocExtension::BytesPerSecond>(v));
+}
+
+struct Tunable {
+  absl::string_view name;
+  bool (*set)(absl::string_view value);
+};
+
+#define TCMALLOC_TUNABLE(name, type) \
+  { #name, &ParseAndSet<type, &Parameters::set_##name> }
+
+// The parameters that may be set by name.  Those that are only read when
+// TCMalloc initializes, like per_cpu_caches, are left out, as are the ones
+// that are chosen by experiments.
+constexpr Tunable kTunables[] = {
+    {"background_release_rate",
+     &ParseAndSet<uint64_t, &SetBackgroundReleaseRate>},
+    {"background_process_sleep_interval",
+     &ParseAndSet<absl::Duration,
+                  &TCMalloc_Internal_SetBackgroundProcessSleepInterval>},
+    TCMALLOC_TUNABLE(heap_size_hard_limit, uint64_t),
+    TCMALLOC_TUNABLE(hpaa_subrelease, bool),
+    TCMALLOC_TUNABLE(guarded_sampling_interval, int64_t),
+    TCMALLOC_TUNABLE(profile_sampling_interval, int64_t),
+    TCMALLOC_TUNABLE(profile_sampling_cpu_budget, double),
+    TCMALLOC_TUNABLE(profile_sampling_max_interval, int64_t),
+    TCMALLOC_TUNABLE(max_per_cpu_cache_size, int32_t),
+    TCMALLOC_TUNABLE(max_total_thread_cache_bytes, int64_t),
+    TCMALLOC_TUNABLE(peak_sampling_heap_growth_fraction, double),
+    TCMALLOC_TUNABLE(filler_skip_subrelease_interval, absl::Duration),
+    TCMALLOC_TUNABLE(filler_skip_subrelease_short_interval, absl::Duration),
+    TCMALLOC_TUNABLE(filler_skip_subrelease_long_interval, absl::Duration),
+    TCMALLOC_TUNABLE(skip_subrelease_target_refault_percent, uint32_t),
+    TCMALLOC_TUNABLE(cache_demand_release_short_interval, absl::Duration),
+    TCMALLOC_TUNABLE(cache_demand_release_long_interval, absl::Duration),
+    TCMALLOC_TUNABLE(huge_region_demand_based_release, bool),
+    TCMALLOC_TUNABLE(large_huge_regions, bool),
+    TCMALLOC_TUNABLE(huge_cache_demand_based_release, bool),
+    TCMALLOC_TUNABLE(hugepage_granular_release, bool),
+    TCMALLOC_TUNABLE(residency_aware_release, bool),
+    TCMALLOC_TUNABLE(huge_page_collapse_rate, uint32_t),
+    TCMALLOC_TUNABLE(huge_page_backing_samples, uint32_t),
+    TCMALLOC_TUNABLE(per_cpu_caches_dynamic_slab_enabled, bool),
+    TCMALLOC_TUNABLE(per_cpu_caches_dynamic_slab_grow_threshold, double),
+    TCMALLOC_TUNABLE(per_cpu_caches_dynamic_slab_shrink_threshold, double),
+    TCMALLOC_TUNABLE(per_cpu_caches_incremental_slab_resize, bool),
+    TCMALLOC_TUNABLE(per_cpu_caches_decay_intervals, uint32_t),
+    TCMALLOC_TUNABLE(idle_cache_reclaim_intervals, uint32_t),
+    TCMALLOC_TUNABLE(cgroup_memory_limit_headroom_percent, uint32_t),
+    TCMALLOC_TUNABLE(soft_limit_background_shrink_percent, uint32_t),
+    TCMALLOC_TUNABLE(pressure_based_release, bool),
+    TCMALLOC_TUNABLE(event_driven_background_actions, bool),
+    TCMALLOC_TUNABLE(memory_pressure_moderate_percent, uint32_t),
+    TCMALLOC_TUNABLE(memory_pressure_critical_percent, uint32_t),
+    TCMALLOC_TUNABLE(release_memory_after_fork, bool),
+    TCMALLOC_TUNABLE(exclude_free_from_core_dumps, bool),
+    TCMALLOC_TUNABLE(publish_stats_page, bool),
+    TCMALLOC_TUNABLE(numeric_property_staleness, absl::Duration),
+    TCMALLOC_TUNABLE(slow_path_latency_histograms, bool),
+    TCMALLOC_TUNABLE(dynamic_size_classes, bool),
+    TCMALLOC_TUNABLE(compact_sampled_allocations, bool),
+    TCMALLOC_TUNABLE(allocation_accounting, bool),
+    TCMALLOC_TUNABLE(per_cpu_caches_bypass_cold_classes, bool),
+    TCMALLOC_TUNABLE(per_cpu_caches_ping_pong_hysteresis, bool),
+    TCMALLOC_TUNABLE(central_freelist_span_cache, bool),
+    TCMALLOC_TUNABLE(central_freelist_span_cache_expiry, absl::Duration),
+    TCMALLOC_TUNABLE(central_freelist_address_ordered, bool),
+    TCMALLOC_TUNABLE(central_freelist_nonintrusive_spans, bool),
+    TCMALLOC_TUNABLE(large_size_classes, bool),
+    TCMALLOC_TUNABLE(large_allocation_density_prediction, bool),
+    TCMALLOC_TUNABLE(huge_cache_lifo_reuse, bool),
+    TCMALLOC_TUNABLE(huge_cache_cold_interval, absl::Duration),
+    TCMALLOC_TUNABLE(leak_detection_interval, absl::Duration),
+    TCMALLOC_TUNABLE(transfer_cache_plunder_interval, absl::Duration),
+};
+
+#undef TCMALLOC_TUNABLE
+
+// FNV-1a, which is enough to tell whether the control file changed.
+uint64_t HashContents(absl::string_view contents) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (char c : contents) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+  }
+  return hash;
+}
+
+}  // namespace
+
+bool ParameterControl::Set(absl::string_view name, absl::string_view value) {
+  for (const Tunable& tunable : kTunables) {
+    if (tunable.name == name) {
+      return tunable.set(value);
+    }
+  }
+  return false;
+}
+
+int ParameterControl::Apply(absl::string_view settings) {
+  int applied = 0;
+  auto apply = [&](absl::string_view setting) {
+    setting = absl::StripAsciiWhitespace(setting);
+    if (setting.empty()) {
+      return;
+    }
+    const size_t eq = setting.find('=');
+    if (eq == absl::string_view::npos) {
+      TC_LOG("Ignoring TCMalloc parameter setting without a value: %s",
+             setting);
+      return;
+    }
+    const absl::string_view name =
+        absl::StripAsciiWhitespace(setting.substr(0, eq));
+    const absl::string_view value =
+        absl::StripAsciiWhitespace(setting.substr(eq + 1));
+    if (!Set(name, value)) {
+      TC_LOG("Ignoring invalid TCMalloc parameter setting: %s", setting);
+      return;
+    }
+    ++applied;
+  };
+
+  while (!settings.empty()) {
+    const size_t eol = std::min(settings.find('\n'), settings.size());
+    absl::string_view line = settings.substr(0, eol);
+    settings.remove_prefix(std::min(eol + 1, settings.size()));
+    line = line.substr(0, line.find('#'));
+
+    while (!line.empty()) {
+      const size_t end = std::min(line.find_first_of(",;"), line.size());
+      apply(line.substr(0, end));
+      line.remove_prefix(std::min(end + 1, line.size()));
+    }
+  }
+  return applied;
+}
+
+void ParameterControl::HandleReloadSignal(int) {
+  // Only async-signal-safe operations: an atomic store and a futex wake.
+  parameter_control().reload_requested_.store(true, std::memory_order_relaxed);
+  tc_globals.background_wakeup().Notify(BackgroundWakeup::kParameterReload);
+}
+
+void ParameterControl::Init() {
+  if (const char* e = thread_safe_getenv("TCMALLOC_PARAMETERS");
+      e != nullptr) {
+    Apply(e);
+  }
+
+  path_ = thread_safe_getenv("TCMALLOC_PARAMETERS_FILE");
+  if (path_ != nullptr && path_[0] == '\0') {
+    path_ = nullptr;
+  }
+  Reload(/*force=*/false);
+
+  if (const char* e = thread_safe_getenv("TCMALLOC_PARAMETERS_RELOAD_SIGNAL");
+      e != nullptr) {
+    int signo;
+    if (!absl::SimpleAtoi(e, &signo) || signo <= 0 || signo >= NSIG) {
+      TC_LOG("Ignoring invalid TCMALLOC_PARAMETERS_RELOAD_SIGNAL: %s", e);
+      return;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &ParameterControl::HandleReloadSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if (sigaction(signo, &action, nullptr) != 0) {
+      TC_LOG("Failed to install the parameter reload handler for signal %v",
+             signo);
+    }
+  }
+}
+
+void ParameterControl::Reload(bool force) {
+  if (path_ == nullptr) {
+    return;
+  }
+
+  int fd = signal_safe_open(path_, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  std::array<char, kMaxFileSize> buf;
+  size_t bytes_read;
+  const ssize_t rc = signal_safe_read(fd, buf.data(), buf.size(), &bytes_read);
+  signal_safe_close(fd);
+  if (rc < 0) {
+    return;
+  }
+
+  const absl::string_view contents(buf.data(), bytes_read);
+  const uint64_t hash = HashContents(contents);
+  if (!force && hash == applied_hash_) {
+    return;
+  }
+  applied_hash_ = hash;
+  const int applied = Apply(contents);
+  reloads_.fetch_add(1, std::memory_order_relaxed);
+  TC_LOG("Applied %v TCMalloc parameter settings from %s", applied, path_);
+}
+
+ParameterControl& parameter_control() {
+  ABSL_CONST_INIT static ParameterControl control;
+  return control;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
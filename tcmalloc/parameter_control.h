@@ -0,0 +1,101 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_PARAMETER_CONTROL_H_
+#define TCMALLOC_PARAMETER_CONTROL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/strings/string_view.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Sets runtime tunables in Parameters by name, without code changes:
+//
+// * At startup, from the TCMALLOC_PARAMETERS environment variable, and
+// * at startup and whenever its contents change, from the control file named by
+//   TCMALLOC_PARAMETERS_FILE.  The background thread (see
+//   MallocExtension::ProcessBackgroundActions) checks the file once per
+//   kCheckIntervals sleep intervals, or right away when the process receives
+//   the signal numbered TCMALLOC_PARAMETERS_RELOAD_SIGNAL, if that is set.
+//
+// Settings are "name=value" pairs, separated by commas, semicolons or newlines,
+// where name is that of the Parameters accessor, e.g.
+//
+//   background_release_rate=33554432,filler_skip_subrelease_interval=5s
+//
+// Booleans take true/false/1/0, durations take absl::ParseDuration syntax, and
+// a '#' starts a comment that runs to the end of the line.  Settings with an
+// unknown name or an invalid value are logged and skipped.  The file settings
+// apply after the environment ones, so they win.
+class ParameterControl {
+ public:
+  // The background thread rereads the control file once per this many sleep
+  // intervals.
+  static constexpr int kCheckIntervals = 10;
+
+  // The largest control file that is read.  Anything beyond it is ignored.
+  static constexpr size_t kMaxFileSize = 4096;
+
+  constexpr ParameterControl() = default;
+
+  ParameterControl(const ParameterControl&) = delete;
+  ParameterControl& operator=(const ParameterControl&) = delete;
+
+  // Applies the environment variable and the control file, and installs the
+  // reload signal handler.  Called once, when TCMalloc initializes.
+  void Init();
+
+  // Rereads the control file and applies it if it changed since it was last
+  // applied, or if <force>.  Called by the background thread.
+  void Reload(bool force);
+
+  // Whether the reload signal was received since the last call.
+  bool ConsumeReloadRequest() {
+    return reload_requested_.exchange(false, std::memory_order_relaxed);
+  }
+
+  // The number of times the control file was applied.
+  int64_t reloads() const { return reloads_.load(std::memory_order_relaxed); }
+
+  // Sets the parameter <name> to <value>.  Returns false if there is no such
+  // parameter or <value> does not parse.
+  static bool Set(absl::string_view name, absl::string_view value);
+
+  // Applies <settings>, see above.  Returns the number of settings applied.
+  static int Apply(absl::string_view settings);
+
+ private:
+  static void HandleReloadSignal(int signo);
+
+  const char* path_ = nullptr;
+  // A hash of the control file contents last applied, or 0 if none were.
+  uint64_t applied_hash_ = 0;
+  std::atomic<bool> reload_requested_{false};
+  std::atomic<int64_t> reloads_{0};
+};
+
+ParameterControl& parameter_control();
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_PARAMETER_CONTROL_H_
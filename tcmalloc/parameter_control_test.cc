@@ -0,0 +1,71 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/parameter_control.h"
+
+#include <cstdint>
+
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/parameters.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+TEST(ParameterControlTest, SetByName) {
+  const uint32_t decay_intervals = Parameters::per_cpu_caches_decay_intervals();
+
+  EXPECT_TRUE(ParameterControl::Set("per_cpu_caches_decay_intervals", "17"));
+  EXPECT_EQ(Parameters::per_cpu_caches_decay_intervals(), 17);
+
+  EXPECT_FALSE(ParameterControl::Set("per_cpu_caches_decay_intervals", "-1"));
+  EXPECT_FALSE(ParameterControl::Set("per_cpu_caches_decay_intervals", "x"));
+  EXPECT_FALSE(ParameterControl::Set("no_such_parameter", "1"));
+  EXPECT_EQ(Parameters::per_cpu_caches_decay_intervals(), 17);
+
+  Parameters::set_per_cpu_caches_decay_intervals(decay_intervals);
+}
+
+TEST(ParameterControlTest, Apply) {
+  const MallocExtension::BytesPerSecond release_rate =
+      Parameters::background_release_rate();
+  const absl::Duration skip_subrelease =
+      Parameters::filler_skip_subrelease_interval();
+  const bool pressure_based_release = Parameters::pressure_based_release();
+
+  EXPECT_EQ(ParameterControl::Apply(
+                " background_release_rate = 12345, "
+                "filler_skip_subrelease_interval=7s;bogus\n"
+                "# pressure_based_release=true\n"
+                "pressure_based_release=true  # a comment, with a separator\n"
+                "unknown=1\n"),
+            3);
+  EXPECT_EQ(static_cast<size_t>(Parameters::background_release_rate()),
+            size_t{12345});
+  EXPECT_EQ(Parameters::filler_skip_subrelease_interval(), absl::Seconds(7));
+  EXPECT_TRUE(Parameters::pressure_based_release());
+
+  EXPECT_EQ(ParameterControl::Apply(""), 0);
+  EXPECT_EQ(ParameterControl::Apply(",,;\n#\n"), 0);
+
+  Parameters::set_background_release_rate(release_rate);
+  Parameters::set_filler_skip_subrelease_interval(skip_subrelease);
+  Parameters::set_pressure_based_release(pressure_based_release);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -251,6 +251,9 @@ ABSL_CONST_INIT std::atomic<bool> Parameters::release_partial_alloc_pages_(
 // TODO(b/123345734): Remove the flag when experimentation is done.
 ABSL_CONST_INIT std::atomic<bool> Parameters::resize_size_class_max_capacity_(
     true);
+ABSL_CONST_INIT std::atomic<bool> Parameters::sharded_transfer_cache_adaptive_(
+    true);
+ABSL_CONST_INIT std::atomic<bool> Parameters::transfer_cache_lock_free_(false);
 ABSL_CONST_INIT std::atomic<bool> Parameters::huge_cache_demand_based_release_(
     false);
 // TODO(b/199203282):  Remove this opt-out.
@@ -260,6 +263,24 @@ ABSL_CONST_INIT std::atomic<int64_t> Parameters::max_total_thread_cache_bytes_(
     kDefaultOverallThreadCacheSize);
 ABSL_CONST_INIT std::atomic<double>
     Parameters::peak_sampling_heap_growth_fraction_(1.1);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::windowed_peak_heap_profiles_(false);
+ABSL_CONST_INIT std::atomic<int64_t>
+    Parameters::continuous_lifetime_profile_period_(0);
+ABSL_CONST_INIT std::atomic<int64_t> Parameters::leak_detection_interval_ns_(0);
+ABSL_CONST_INIT std::atomic<int64_t>
+    Parameters::guarded_deallocation_batch_size_(0);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::exclude_free_from_core_dumps_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::publish_stats_page_(false);
+ABSL_CONST_INIT std::atomic<uint32_t>
+    Parameters::memory_pressure_moderate_percent_(90);
+ABSL_CONST_INIT std::atomic<uint32_t>
+    Parameters::memory_pressure_critical_percent_(98);
+ABSL_CONST_INIT std::atomic<bool> Parameters::release_memory_after_fork_(false);
+ABSL_CONST_INIT std::atomic<int64_t> Parameters::cold_page_size_(0);
+ABSL_CONST_INIT std::atomic<int64_t>
+    Parameters::numeric_property_staleness_ns_(0);
 ABSL_CONST_INIT std::atomic<bool> Parameters::per_cpu_caches_enabled_(
 #if defined(TCMALLOC_DEPRECATED_PERTHREAD)
     false
@@ -269,6 +290,78 @@ ABSL_CONST_INIT std::atomic<bool> Parameters::per_cpu_caches_enabled_(
 );
 ABSL_CONST_INIT std::atomic<bool> Parameters::per_cpu_caches_dynamic_slab_(
     true);
+ABSL_CONST_INIT std::atomic<bool> Parameters::per_cpu_caches_steal_objects_(
+    false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::per_cpu_caches_remote_free_(
+    false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::per_cpu_caches_hugepage_slabs_(
+    false);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::per_cpu_caches_incremental_slab_resize_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::slow_path_latency_histograms_(
+    false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::dynamic_size_classes_(false);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::compact_sampled_allocations_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::allocation_accounting_(false);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::per_cpu_caches_bypass_cold_classes_(false);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::per_cpu_caches_ping_pong_hysteresis_(false);
+ABSL_CONST_INIT std::atomic<uint32_t> Parameters::huge_page_collapse_rate_(0);
+ABSL_CONST_INIT std::atomic<uint32_t> Parameters::huge_page_backing_samples_(0);
+ABSL_CONST_INIT std::atomic<bool> Parameters::lifetime_based_allocation_(false);
+ABSL_CONST_INIT std::atomic<uint32_t>
+    Parameters::cgroup_memory_limit_headroom_percent_(0);
+ABSL_CONST_INIT std::atomic<uint32_t>
+    Parameters::soft_limit_background_shrink_percent_(0);
+ABSL_CONST_INIT std::atomic<bool> Parameters::pressure_based_release_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::event_driven_background_actions_(
+    false);
+ABSL_CONST_INIT std::atomic<uint32_t>
+    Parameters::idle_cache_reclaim_intervals_(30);
+ABSL_CONST_INIT std::atomic<uint32_t>
+    Parameters::per_cpu_caches_decay_intervals_(0);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::per_cpu_caches_asymmetric_batches_(false);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::transfer_cache_predictive_resize_(false);
+ABSL_CONST_INIT std::atomic<int64_t>
+    Parameters::transfer_cache_plunder_interval_ns_(0);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::per_cpu_caches_adaptive_batches_(false);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::central_freelist_hugepage_aware_spans_(false);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::central_freelist_span_cache_(false);
+ABSL_CONST_INIT std::atomic<int64_t>
+    Parameters::central_freelist_span_cache_expiry_ns_(0);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::central_freelist_address_ordered_(false);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::central_freelist_nonintrusive_spans_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::large_span_cache_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::large_size_classes_(false);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::large_allocation_density_prediction_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::realloc_mremap_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::realloc_growth_headroom_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::gigantic_pages_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::huge_cache_forecast_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::huge_cache_lifo_reuse_(false);
+ABSL_CONST_INIT std::atomic<int64_t>
+    Parameters::huge_cache_cold_interval_ns_(0);
+ABSL_CONST_INIT std::atomic<bool> Parameters::hugepage_granular_release_(
+    false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::residency_aware_release_(false);
+ABSL_CONST_INIT std::atomic<uint32_t>
+    Parameters::skip_subrelease_target_refault_percent_(0);
+ABSL_CONST_INIT std::atomic<bool> Parameters::donated_tail_packing_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::large_huge_regions_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::metadata_hugepages_(true);
+ABSL_CONST_INIT std::atomic<double> Parameters::profile_sampling_cpu_budget_(0);
+ABSL_CONST_INIT std::atomic<int64_t>
+    Parameters::profile_sampling_max_interval_(64 << 20);
 ABSL_CONST_INIT std::atomic<MadvisePreference> Parameters::madvise_(
     MadvisePreference::kDontNeed);
 ABSL_CONST_INIT std::atomic<tcmalloc::hot_cold_t>
@@ -496,6 +589,14 @@ bool TCMalloc_Internal_GetResizeSizeClassMaxCapacityEnabled() {
   return Parameters::resize_size_class_max_capacity();
 }
 
+bool TCMalloc_Internal_GetShardedTransferCacheAdaptiveEnabled() {
+  return Parameters::sharded_transfer_cache_adaptive();
+}
+
+bool TCMalloc_Internal_GetTransferCacheLockFreeEnabled() {
+  return Parameters::transfer_cache_lock_free();
+}
+
 double TCMalloc_Internal_GetPeakSamplingHeapGrowthFraction() {
   return Parameters::peak_sampling_heap_growth_fraction();
 }
@@ -566,6 +667,15 @@ void TCMalloc_Internal_SetResizeSizeClassMaxCapacityEnabled(bool v) {
                                                     std::memory_order_relaxed);
 }
 
+void TCMalloc_Internal_SetShardedTransferCacheAdaptiveEnabled(bool v) {
+  Parameters::sharded_transfer_cache_adaptive_.store(v,
+                                                     std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_SetTransferCacheLockFreeEnabled(bool v) {
+  Parameters::transfer_cache_lock_free_.store(v, std::memory_order_relaxed);
+}
+
 void TCMalloc_Internal_SetMaxPerCpuCacheSize(int32_t v) {
   tcmalloc::tcmalloc_internal::tc_globals.cpu_cache().SetCacheLimit(v);
 }
@@ -583,6 +693,100 @@ void TCMalloc_Internal_SetPeakSamplingHeapGrowthFraction(double v) {
       v, std::memory_order_relaxed);
 }
 
+bool TCMalloc_Internal_GetWindowedPeakHeapProfiles() {
+  return Parameters::windowed_peak_heap_profiles();
+}
+
+void TCMalloc_Internal_SetWindowedPeakHeapProfiles(bool v) {
+  Parameters::windowed_peak_heap_profiles_.store(v, std::memory_order_relaxed);
+}
+
+int64_t TCMalloc_Internal_GetContinuousLifetimeProfilePeriod() {
+  return Parameters::continuous_lifetime_profile_period();
+}
+
+void TCMalloc_Internal_SetContinuousLifetimeProfilePeriod(int64_t v) {
+  Parameters::continuous_lifetime_profile_period_.store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_GetLeakDetectionInterval(absl::Duration* v) {
+  *v = Parameters::leak_detection_interval();
+}
+
+void TCMalloc_Internal_SetLeakDetectionInterval(absl::Duration v) {
+  Parameters::leak_detection_interval_ns_.store(absl::ToInt64Nanoseconds(v),
+                                                std::memory_order_relaxed);
+}
+
+int64_t TCMalloc_Internal_GetGuardedDeallocationBatchSize() {
+  return Parameters::guarded_deallocation_batch_size();
+}
+
+void TCMalloc_Internal_SetGuardedDeallocationBatchSize(int64_t v) {
+  Parameters::guarded_deallocation_batch_size_.store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetExcludeFreeFromCoreDumps() {
+  return Parameters::exclude_free_from_core_dumps();
+}
+
+void TCMalloc_Internal_SetExcludeFreeFromCoreDumps(bool v) {
+  Parameters::exclude_free_from_core_dumps_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetPublishStatsPage() {
+  return Parameters::publish_stats_page();
+}
+
+void TCMalloc_Internal_SetPublishStatsPage(bool v) {
+  Parameters::publish_stats_page_.store(v, std::memory_order_relaxed);
+}
+
+uint32_t TCMalloc_Internal_GetMemoryPressureModeratePercent() {
+  return Parameters::memory_pressure_moderate_percent();
+}
+
+void TCMalloc_Internal_SetMemoryPressureModeratePercent(uint32_t v) {
+  Parameters::memory_pressure_moderate_percent_.store(
+      v, std::memory_order_relaxed);
+}
+
+uint32_t TCMalloc_Internal_GetMemoryPressureCriticalPercent() {
+  return Parameters::memory_pressure_critical_percent();
+}
+
+void TCMalloc_Internal_SetMemoryPressureCriticalPercent(uint32_t v) {
+  Parameters::memory_pressure_critical_percent_.store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetReleaseMemoryAfterFork() {
+  return Parameters::release_memory_after_fork();
+}
+
+void TCMalloc_Internal_SetReleaseMemoryAfterFork(bool v) {
+  Parameters::release_memory_after_fork_.store(v, std::memory_order_relaxed);
+}
+
+int64_t TCMalloc_Internal_GetColdPageSize() {
+  return Parameters::cold_page_size();
+}
+
+void TCMalloc_Internal_SetColdPageSize(int64_t v) {
+  Parameters::cold_page_size_.store(v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_GetNumericPropertyStaleness(absl::Duration* v) {
+  *v = Parameters::numeric_property_staleness();
+}
+
+void TCMalloc_Internal_SetNumericPropertyStaleness(absl::Duration v) {
+  Parameters::numeric_property_staleness_ns_.store(absl::ToInt64Nanoseconds(v),
+                                                   std::memory_order_relaxed);
+}
+
 void TCMalloc_Internal_SetPerCpuCachesEnabled(bool v) {
 #if !defined(TCMALLOC_DEPRECATED_PERTHREAD)
   if (!v) {
@@ -679,6 +883,386 @@ void TCMalloc_Internal_SetPerCpuCachesDynamicSlabEnabled(bool v) {
   Parameters::per_cpu_caches_dynamic_slab_.store(v, std::memory_order_relaxed);
 }
 
+bool TCMalloc_Internal_GetPerCpuCachesStealObjectsEnabled() {
+  return Parameters::per_cpu_caches_steal_objects_enabled();
+}
+
+void TCMalloc_Internal_SetPerCpuCachesStealObjectsEnabled(bool v) {
+  Parameters::per_cpu_caches_steal_objects_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetPerCpuCachesRemoteFreeEnabled() {
+  return Parameters::per_cpu_caches_remote_free_enabled();
+}
+
+void TCMalloc_Internal_SetPerCpuCachesRemoteFreeEnabled(bool v) {
+  Parameters::per_cpu_caches_remote_free_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetPerCpuCachesHugepageSlabsEnabled() {
+  return Parameters::per_cpu_caches_hugepage_slabs_enabled();
+}
+
+void TCMalloc_Internal_SetPerCpuCachesHugepageSlabsEnabled(bool v) {
+  Parameters::per_cpu_caches_hugepage_slabs_.store(v,
+                                                   std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetPerCpuCachesIncrementalSlabResize() {
+  return Parameters::per_cpu_caches_incremental_slab_resize();
+}
+
+void TCMalloc_Internal_SetPerCpuCachesIncrementalSlabResize(bool v) {
+  Parameters::per_cpu_caches_incremental_slab_resize_.store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetSlowPathLatencyHistograms() {
+  return Parameters::slow_path_latency_histograms();
+}
+
+void TCMalloc_Internal_SetSlowPathLatencyHistograms(bool v) {
+  Parameters::slow_path_latency_histograms_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetDynamicSizeClasses() {
+  return Parameters::dynamic_size_classes();
+}
+
+void TCMalloc_Internal_SetDynamicSizeClasses(bool v) {
+  Parameters::dynamic_size_classes_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetCompactSampledAllocations() {
+  return Parameters::compact_sampled_allocations();
+}
+
+void TCMalloc_Internal_SetCompactSampledAllocations(bool v) {
+  Parameters::compact_sampled_allocations_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetAllocationAccounting() {
+  return Parameters::allocation_accounting();
+}
+
+void TCMalloc_Internal_SetAllocationAccounting(bool v) {
+  Parameters::allocation_accounting_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetPerCpuCachesBypassColdClasses() {
+  return Parameters::per_cpu_caches_bypass_cold_classes();
+}
+
+void TCMalloc_Internal_SetPerCpuCachesBypassColdClasses(bool v) {
+  Parameters::per_cpu_caches_bypass_cold_classes_.store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetPerCpuCachesPingPongHysteresis() {
+  return Parameters::per_cpu_caches_ping_pong_hysteresis();
+}
+
+void TCMalloc_Internal_SetPerCpuCachesPingPongHysteresis(bool v) {
+  Parameters::per_cpu_caches_ping_pong_hysteresis_.store(
+      v, std::memory_order_relaxed);
+}
+
+uint32_t TCMalloc_Internal_GetHugePageCollapseRate() {
+  return Parameters::huge_page_collapse_rate();
+}
+
+void TCMalloc_Internal_SetHugePageCollapseRate(uint32_t v) {
+  Parameters::huge_page_collapse_rate_.store(v, std::memory_order_relaxed);
+}
+
+uint32_t TCMalloc_Internal_GetHugePageBackingSamples() {
+  return Parameters::huge_page_backing_samples();
+}
+
+void TCMalloc_Internal_SetHugePageBackingSamples(uint32_t v) {
+  Parameters::huge_page_backing_samples_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetLifetimeBasedAllocation() {
+  return Parameters::lifetime_based_allocation();
+}
+
+void TCMalloc_Internal_SetLifetimeBasedAllocation(bool v) {
+  Parameters::lifetime_based_allocation_.store(v, std::memory_order_relaxed);
+}
+
+uint32_t TCMalloc_Internal_GetCgroupMemoryLimitHeadroomPercent() {
+  return Parameters::cgroup_memory_limit_headroom_percent();
+}
+
+void TCMalloc_Internal_SetCgroupMemoryLimitHeadroomPercent(uint32_t v) {
+  Parameters::cgroup_memory_limit_headroom_percent_.store(
+      v, std::memory_order_relaxed);
+}
+
+uint32_t TCMalloc_Internal_GetSoftLimitBackgroundShrinkPercent() {
+  return Parameters::soft_limit_background_shrink_percent();
+}
+
+void TCMalloc_Internal_SetSoftLimitBackgroundShrinkPercent(uint32_t v) {
+  Parameters::soft_limit_background_shrink_percent_.store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetPressureBasedRelease() {
+  return Parameters::pressure_based_release();
+}
+
+void TCMalloc_Internal_SetPressureBasedRelease(bool v) {
+  Parameters::pressure_based_release_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetEventDrivenBackgroundActions() {
+  return Parameters::event_driven_background_actions();
+}
+
+void TCMalloc_Internal_SetEventDrivenBackgroundActions(bool v) {
+  Parameters::event_driven_background_actions_.store(
+      v, std::memory_order_relaxed);
+}
+
+uint32_t TCMalloc_Internal_GetIdleCacheReclaimIntervals() {
+  return Parameters::idle_cache_reclaim_intervals();
+}
+
+void TCMalloc_Internal_SetIdleCacheReclaimIntervals(uint32_t v) {
+  Parameters::idle_cache_reclaim_intervals_.store(v, std::memory_order_relaxed);
+}
+
+uint32_t TCMalloc_Internal_GetPerCpuCachesDecayIntervals() {
+  return Parameters::per_cpu_caches_decay_intervals();
+}
+
+void TCMalloc_Internal_SetPerCpuCachesDecayIntervals(uint32_t v) {
+  Parameters::per_cpu_caches_decay_intervals_.store(v,
+                                                    std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetPerCpuCachesAsymmetricBatches() {
+  return Parameters::per_cpu_caches_asymmetric_batches();
+}
+
+void TCMalloc_Internal_SetPerCpuCachesAsymmetricBatches(bool v) {
+  Parameters::per_cpu_caches_asymmetric_batches_.store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetTransferCachePredictiveResize() {
+  return Parameters::transfer_cache_predictive_resize();
+}
+
+void TCMalloc_Internal_SetTransferCachePredictiveResize(bool v) {
+  Parameters::transfer_cache_predictive_resize_.store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_GetTransferCachePlunderInterval(absl::Duration* v) {
+  *v = Parameters::transfer_cache_plunder_interval();
+}
+
+void TCMalloc_Internal_SetTransferCachePlunderInterval(absl::Duration v) {
+  Parameters::transfer_cache_plunder_interval_ns_.store(
+      absl::ToInt64Nanoseconds(v), std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetPerCpuCachesAdaptiveBatches() {
+  return Parameters::per_cpu_caches_adaptive_batches();
+}
+
+void TCMalloc_Internal_SetPerCpuCachesAdaptiveBatches(bool v) {
+  Parameters::per_cpu_caches_adaptive_batches_.store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetCentralFreelistHugepageAwareSpans() {
+  return Parameters::central_freelist_hugepage_aware_spans();
+}
+
+void TCMalloc_Internal_SetCentralFreelistHugepageAwareSpans(bool v) {
+  Parameters::central_freelist_hugepage_aware_spans_.store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetCentralFreelistSpanCache() {
+  return Parameters::central_freelist_span_cache();
+}
+
+void TCMalloc_Internal_SetCentralFreelistSpanCache(bool v) {
+  Parameters::central_freelist_span_cache_.store(v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_GetCentralFreelistSpanCacheExpiry(absl::Duration* v) {
+  *v = Parameters::central_freelist_span_cache_expiry();
+}
+
+void TCMalloc_Internal_SetCentralFreelistSpanCacheExpiry(absl::Duration v) {
+  Parameters::central_freelist_span_cache_expiry_ns_.store(
+      absl::ToInt64Nanoseconds(v), std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetCentralFreelistAddressOrdered() {
+  return Parameters::central_freelist_address_ordered();
+}
+
+void TCMalloc_Internal_SetCentralFreelistAddressOrdered(bool v) {
+  Parameters::central_freelist_address_ordered_.store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetCentralFreelistNonintrusiveSpans() {
+  return Parameters::central_freelist_nonintrusive_spans();
+}
+
+void TCMalloc_Internal_SetCentralFreelistNonintrusiveSpans(bool v) {
+  Parameters::central_freelist_nonintrusive_spans_.store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetLargeSpanCache() {
+  return Parameters::large_span_cache();
+}
+
+void TCMalloc_Internal_SetLargeSpanCache(bool v) {
+  Parameters::large_span_cache_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetLargeSizeClasses() {
+  return Parameters::large_size_classes();
+}
+
+void TCMalloc_Internal_SetLargeSizeClasses(bool v) {
+  Parameters::large_size_classes_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetLargeAllocationDensityPrediction() {
+  return Parameters::large_allocation_density_prediction();
+}
+
+void TCMalloc_Internal_SetLargeAllocationDensityPrediction(bool v) {
+  Parameters::large_allocation_density_prediction_.store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetReallocMremap() {
+  return Parameters::realloc_mremap();
+}
+
+void TCMalloc_Internal_SetReallocMremap(bool v) {
+  Parameters::realloc_mremap_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetReallocGrowthHeadroom() {
+  return Parameters::realloc_growth_headroom();
+}
+
+void TCMalloc_Internal_SetReallocGrowthHeadroom(bool v) {
+  Parameters::realloc_growth_headroom_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetGiganticPages() {
+  return Parameters::gigantic_pages();
+}
+
+void TCMalloc_Internal_SetGiganticPages(bool v) {
+  Parameters::gigantic_pages_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetHugeCacheForecast() {
+  return Parameters::huge_cache_forecast();
+}
+
+void TCMalloc_Internal_SetHugeCacheForecast(bool v) {
+  Parameters::huge_cache_forecast_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetHugeCacheLifoReuse() {
+  return Parameters::huge_cache_lifo_reuse();
+}
+
+void TCMalloc_Internal_SetHugeCacheLifoReuse(bool v) {
+  Parameters::huge_cache_lifo_reuse_.store(v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_GetHugeCacheColdInterval(absl::Duration* v) {
+  *v = Parameters::huge_cache_cold_interval();
+}
+
+void TCMalloc_Internal_SetHugeCacheColdInterval(absl::Duration v) {
+  Parameters::huge_cache_cold_interval_ns_.store(absl::ToInt64Nanoseconds(v),
+                                                 std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetHugepageGranularRelease() {
+  return Parameters::hugepage_granular_release();
+}
+
+void TCMalloc_Internal_SetHugepageGranularRelease(bool v) {
+  Parameters::hugepage_granular_release_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetResidencyAwareRelease() {
+  return Parameters::residency_aware_release();
+}
+
+void TCMalloc_Internal_SetResidencyAwareRelease(bool v) {
+  Parameters::residency_aware_release_.store(v, std::memory_order_relaxed);
+}
+
+uint32_t TCMalloc_Internal_GetSkipSubreleaseTargetRefaultPercent() {
+  return Parameters::skip_subrelease_target_refault_percent();
+}
+
+void TCMalloc_Internal_SetSkipSubreleaseTargetRefaultPercent(uint32_t v) {
+  Parameters::skip_subrelease_target_refault_percent_.store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetDonatedTailPacking() {
+  return Parameters::donated_tail_packing();
+}
+
+void TCMalloc_Internal_SetDonatedTailPacking(bool v) {
+  Parameters::donated_tail_packing_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetLargeHugeRegions() {
+  return Parameters::large_huge_regions();
+}
+
+void TCMalloc_Internal_SetLargeHugeRegions(bool v) {
+  Parameters::large_huge_regions_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetMetadataHugepages() {
+  return Parameters::metadata_hugepages();
+}
+
+void TCMalloc_Internal_SetMetadataHugepages(bool v) {
+  Parameters::metadata_hugepages_.store(v, std::memory_order_relaxed);
+}
+
+double TCMalloc_Internal_GetProfileSamplingCpuBudget() {
+  return Parameters::profile_sampling_cpu_budget();
+}
+
+void TCMalloc_Internal_SetProfileSamplingCpuBudget(double v) {
+  Parameters::profile_sampling_cpu_budget_.store(v, std::memory_order_relaxed);
+}
+
+int64_t TCMalloc_Internal_GetProfileSamplingMaxInterval() {
+  return Parameters::profile_sampling_max_interval();
+}
+
+void TCMalloc_Internal_SetProfileSamplingMaxInterval(int64_t v) {
+  Parameters::profile_sampling_max_interval_.store(
+      v, std::memory_order_relaxed);
+}
+
 double TCMalloc_Internal_GetPerCpuCachesDynamicSlabGrowThreshold() {
   return Parameters::per_cpu_caches_dynamic_slab_grow_threshold();
 }
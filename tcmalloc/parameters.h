@@ -96,12 +96,132 @@ class Parameters {
     TCMalloc_Internal_SetPeakSamplingHeapGrowthFraction(value);
   }
 
+  // Whether to keep the peak heap profiles of the last minute and hour and of
+  // the largest one minute peaks, in addition to the all-time peak.  Each of
+  // these is a copy of the sampled heap, so this costs up to seven times its
+  // sample metadata.
+  static bool windowed_peak_heap_profiles() {
+    return windowed_peak_heap_profiles_.load(std::memory_order_relaxed);
+  }
+  static void set_windowed_peak_heap_profiles(bool value) {
+    TCMalloc_Internal_SetWindowedPeakHeapProfiles(value);
+  }
+
+  // Profile the lifetimes of 1 in this many sampled allocations for as long as
+  // the process runs, for SnapshotCurrent(ProfileType::kLifetimes).  0 disables
+  // it.  The profile is kept in a fixed-size table, so the deallocation sites
+  // least often seen are evicted to make room for new ones.
+  static int64_t continuous_lifetime_profile_period() {
+    return continuous_lifetime_profile_period_.load(std::memory_order_relaxed);
+  }
+  static void set_continuous_lifetime_profile_period(int64_t value) {
+    TCMalloc_Internal_SetContinuousLifetimeProfilePeriod(value);
+  }
+
+  // If nonzero, the background thread takes the live sampled bytes of each
+  // allocating stack this often, to find the stacks whose bytes keep growing
+  // for SnapshotCurrent(ProfileType::kLeakCandidates).
+  static absl::Duration leak_detection_interval() {
+    return absl::Nanoseconds(
+        leak_detection_interval_ns_.load(std::memory_order_relaxed));
+  }
+  static void set_leak_detection_interval(absl::Duration value) {
+    TCMalloc_Internal_SetLeakDetectionInterval(value);
+  }
+
+  // The number of freed guarded allocations whose pages are protected together,
+  // so that one mprotect call can cover neighbouring slots and fewer TLB
+  // shootdowns are needed. A use after free of a page that is still waiting
+  // goes undetected. 0 or 1 protects each page as soon as it is freed.
+  static int64_t guarded_deallocation_batch_size() {
+    return guarded_deallocation_batch_size_.load(std::memory_order_relaxed);
+  }
+  static void set_guarded_deallocation_batch_size(int64_t value) {
+    TCMalloc_Internal_SetGuardedDeallocationBatchSize(value);
+  }
+
+  // Whether backed hugepages held free in the page heap's hugepage cache are
+  // excluded from core dumps with MADV_DONTDUMP, until they are reused.
+  static bool exclude_free_from_core_dumps() {
+    return exclude_free_from_core_dumps_.load(std::memory_order_relaxed);
+  }
+  static void set_exclude_free_from_core_dumps(bool value) {
+    TCMalloc_Internal_SetExcludeFreeFromCoreDumps(value);
+  }
+
+  // Whether the background thread publishes the key allocator gauges in a
+  // shared memory stats page, see tcmalloc/stats_page.h.
+  static bool publish_stats_page() {
+    return publish_stats_page_.load(std::memory_order_relaxed);
+  }
+  static void set_publish_stats_page(bool value) {
+    TCMalloc_Internal_SetPublishStatsPage(value);
+  }
+
+  // Percentage of the soft memory limit (see MallocExtension::SetMemoryLimit)
+  // at which the background thread reports MemoryPressureLevel::kModerate to
+  // the callbacks registered with
+  // MallocExtension::RegisterMemoryPressureCallback.
+  static uint32_t memory_pressure_moderate_percent() {
+    return memory_pressure_moderate_percent_.load(std::memory_order_relaxed);
+  }
+  static void set_memory_pressure_moderate_percent(uint32_t value) {
+    TCMalloc_Internal_SetMemoryPressureModeratePercent(value);
+  }
+
+  // Percentage of the soft memory limit at which the background thread reports
+  // MemoryPressureLevel::kCritical to the memory pressure callbacks.
+  static uint32_t memory_pressure_critical_percent() {
+    return memory_pressure_critical_percent_.load(std::memory_order_relaxed);
+  }
+  static void set_memory_pressure_critical_percent(uint32_t value) {
+    TCMalloc_Internal_SetMemoryPressureCriticalPercent(value);
+  }
+
+  // Whether a child process drops the per-CPU caches and releases the free
+  // memory it inherited, including the HugeCache, right after fork(). This
+  // keeps pre-forked workers from holding, and copying on write, caches of
+  // their parent that they never use, at the cost of a slower first allocation
+  // burst in the child.
+  static bool release_memory_after_fork() {
+    return release_memory_after_fork_.load(std::memory_order_relaxed);
+  }
+  static void set_release_memory_after_fork(bool value) {
+    TCMalloc_Internal_SetReleaseMemoryAfterFork(value);
+  }
+
+  // The size, in bytes, of the logical pages of the cold heap.  Large cold
+  // allocations are rounded up to whole logical pages, which makes for fewer
+  // distinct span sizes, and so fewer, more reusable, spans.  The size is
+  // rounded down to a power of two, and sizes of at most kPageSize leave the
+  // cold heap on TCMalloc's page size.
+  static int64_t cold_page_size() {
+    return cold_page_size_.load(std::memory_order_relaxed);
+  }
+  static void set_cold_page_size(int64_t value) {
+    TCMalloc_Internal_SetColdPageSize(value);
+  }
+
+  // How old the stats behind the most frequently scraped numeric properties
+  // may be.  Zero, the default, gathers them on every call.
+  static absl::Duration numeric_property_staleness() {
+    return absl::Nanoseconds(
+        numeric_property_staleness_ns_.load(std::memory_order_relaxed));
+  }
+  static void set_numeric_property_staleness(absl::Duration value) {
+    TCMalloc_Internal_SetNumericPropertyStaleness(value);
+  }
+
   static bool release_partial_alloc_pages() {
     return release_partial_alloc_pages_.load(std::memory_order_relaxed);
   }
 
   static bool huge_region_demand_based_release();
 
+  static void set_huge_region_demand_based_release(bool value) {
+    TCMalloc_Internal_SetHugeRegionDemandBasedRelease(value);
+  }
+
   static bool huge_cache_demand_based_release() {
     return huge_cache_demand_based_release_.load(std::memory_order_relaxed);
   }
@@ -118,6 +238,22 @@ class Parameters {
     return resize_size_class_max_capacity_.load(std::memory_order_relaxed);
   }
 
+  static bool sharded_transfer_cache_adaptive() {
+    return sharded_transfer_cache_adaptive_.load(std::memory_order_relaxed);
+  }
+
+  static void set_sharded_transfer_cache_adaptive(bool value) {
+    TCMalloc_Internal_SetShardedTransferCacheAdaptiveEnabled(value);
+  }
+
+  static bool transfer_cache_lock_free() {
+    return transfer_cache_lock_free_.load(std::memory_order_relaxed);
+  }
+
+  static void set_transfer_cache_lock_free(bool value) {
+    TCMalloc_Internal_SetTransferCacheLockFreeEnabled(value);
+  }
+
   static bool per_cpu_caches() {
     return per_cpu_caches_enabled_.load(std::memory_order_relaxed);
   }
@@ -199,6 +335,451 @@ class Parameters {
     TCMalloc_Internal_SetPerCpuCachesDynamicSlabEnabled(value);
   }
 
+  static bool per_cpu_caches_steal_objects_enabled() {
+    return per_cpu_caches_steal_objects_.load(std::memory_order_relaxed);
+  }
+  static void set_per_cpu_caches_steal_objects_enabled(bool value) {
+    TCMalloc_Internal_SetPerCpuCachesStealObjectsEnabled(value);
+  }
+
+  static bool per_cpu_caches_remote_free_enabled() {
+    return per_cpu_caches_remote_free_.load(std::memory_order_relaxed);
+  }
+  static void set_per_cpu_caches_remote_free_enabled(bool value) {
+    TCMalloc_Internal_SetPerCpuCachesRemoteFreeEnabled(value);
+  }
+
+  static bool per_cpu_caches_hugepage_slabs_enabled() {
+    return per_cpu_caches_hugepage_slabs_.load(std::memory_order_relaxed);
+  }
+  static void set_per_cpu_caches_hugepage_slabs_enabled(bool value) {
+    TCMalloc_Internal_SetPerCpuCachesHugepageSlabsEnabled(value);
+  }
+
+  static bool per_cpu_caches_incremental_slab_resize() {
+    return per_cpu_caches_incremental_slab_resize_.load(
+        std::memory_order_relaxed);
+  }
+  static void set_per_cpu_caches_incremental_slab_resize(bool value) {
+    TCMalloc_Internal_SetPerCpuCachesIncrementalSlabResize(value);
+  }
+
+  static bool slow_path_latency_histograms() {
+    return slow_path_latency_histograms_.load(std::memory_order_relaxed);
+  }
+  static void set_slow_path_latency_histograms(bool value) {
+    TCMalloc_Internal_SetSlowPathLatencyHistograms(value);
+  }
+
+  // Whether the background thread adds size classes for sampled allocation
+  // sizes that lose much memory to rounding up (see dynamic_size_classes.h).
+  static bool dynamic_size_classes() {
+    return dynamic_size_classes_.load(std::memory_order_relaxed);
+  }
+  static void set_dynamic_size_classes(bool value) {
+    TCMalloc_Internal_SetDynamicSizeClasses(value);
+  }
+
+  // Whether sampled objects of at most SampledPageHeap::kMaxSlotSize bytes
+  // share pages of the sampled tag rather than each taking its own.
+  static bool compact_sampled_allocations() {
+    return compact_sampled_allocations_.load(std::memory_order_relaxed);
+  }
+  static void set_compact_sampled_allocations(bool value) {
+    TCMalloc_Internal_SetCompactSampledAllocations(value);
+  }
+
+  // Whether the memory allocated is accounted to the allocation context of the
+  // allocating thread (see AllocationAccounts).
+  static bool allocation_accounting() {
+    return allocation_accounting_.load(std::memory_order_relaxed);
+  }
+  static void set_allocation_accounting(bool value) {
+    TCMalloc_Internal_SetAllocationAccounting(value);
+  }
+
+  // Whether rarely used size classes bypass the per-CPU caches (see
+  // CpuCache::UpdateColdSizeClasses).
+  static bool per_cpu_caches_bypass_cold_classes() {
+    return per_cpu_caches_bypass_cold_classes_.load(std::memory_order_relaxed);
+  }
+  static void set_per_cpu_caches_bypass_cold_classes(bool value) {
+    TCMalloc_Internal_SetPerCpuCachesBypassColdClasses(value);
+  }
+
+  // Whether per-CPU caches that alternate between refilling and overflowing a
+  // size class keep a partial batch and grow (see CpuCache::UpdateCapacity).
+  static bool per_cpu_caches_ping_pong_hysteresis() {
+    return per_cpu_caches_ping_pong_hysteresis_.load(std::memory_order_relaxed);
+  }
+  static void set_per_cpu_caches_ping_pong_hysteresis(bool value) {
+    TCMalloc_Internal_SetPerCpuCachesPingPongHysteresis(value);
+  }
+
+  // Maximum number of hugepages per second that background actions collapse
+  // back to hugepage mappings after they were subreleased and filled again.
+  // 0 disables collapsing.
+  static uint32_t huge_page_collapse_rate() {
+    return huge_page_collapse_rate_.load(std::memory_order_relaxed);
+  }
+  static void set_huge_page_collapse_rate(uint32_t value) {
+    TCMalloc_Internal_SetHugePageCollapseRate(value);
+  }
+
+  // Number of intact hugepages per hugepage-aware allocator whose kernel
+  // backing background actions check each minute.  0 disables sampling.
+  static uint32_t huge_page_backing_samples() {
+    return huge_page_backing_samples_.load(std::memory_order_relaxed);
+  }
+  static void set_huge_page_backing_samples(uint32_t value) {
+    TCMalloc_Internal_SetHugePageBackingSamples(value);
+  }
+
+  // Whether the hugepage-aware allocator places large allocations from stacks
+  // whose earlier allocations were short-lived into a separate set of
+  // HugeRegions (see docs/lifetime-based-allocator.md).
+  static bool lifetime_based_allocation() {
+    return lifetime_based_allocation_.load(std::memory_order_relaxed);
+  }
+  static void set_lifetime_based_allocation(bool value) {
+    TCMalloc_Internal_SetLifetimeBasedAllocation(value);
+  }
+
+  // Percentage of the cgroup v2 memory limit (the lower of memory.high and
+  // memory.max) kept free of TCMalloc's backed memory.  When positive,
+  // background actions maintain a soft limit this far below the cgroup limit
+  // and release more aggressively as usage approaches it.  0 disables this.
+  static uint32_t cgroup_memory_limit_headroom_percent() {
+    return cgroup_memory_limit_headroom_percent_.load(
+        std::memory_order_relaxed);
+  }
+  static void set_cgroup_memory_limit_headroom_percent(uint32_t value) {
+    TCMalloc_Internal_SetCgroupMemoryLimitHeadroomPercent(value);
+  }
+
+  // Percentage of the soft limit in effect above which background actions
+  // shrink the caches and release free memory, so that allocations rarely
+  // reach the limit and have to shrink the heap themselves.  Allocations that
+  // cross it wake the background thread.  0 disables this.
+  static uint32_t soft_limit_background_shrink_percent() {
+    return soft_limit_background_shrink_percent_.load(
+        std::memory_order_relaxed);
+  }
+  static void set_soft_limit_background_shrink_percent(uint32_t value) {
+    TCMalloc_Internal_SetSoftLimitBackgroundShrinkPercent(value);
+  }
+
+  // Whether background actions scale background_release_rate() by memory
+  // pressure (PSI): nothing is released while no task stalls on memory, the
+  // configured rate is used at 1% stall time, and up to 16 times the rate
+  // under heavier pressure.  Without PSI, the configured rate is used.
+  static bool pressure_based_release() {
+    return pressure_based_release_.load(std::memory_order_relaxed);
+  }
+  static void set_pressure_based_release(bool value) {
+    TCMalloc_Internal_SetPressureBasedRelease(value);
+  }
+
+  // Whether background actions sleep until slow paths report an event (see
+  // BackgroundWakeup), backing off to up to 64 times
+  // background_process_sleep_interval() while none occur, instead of waking
+  // at every interval.
+  static bool event_driven_background_actions() {
+    return event_driven_background_actions_.load(std::memory_order_relaxed);
+  }
+  static void set_event_driven_background_actions(bool value) {
+    TCMalloc_Internal_SetEventDrivenBackgroundActions(value);
+  }
+
+  // Number of background_process_sleep_interval()s without activity after
+  // which background actions drain a per-CPU cache, and give the budget of a
+  // thread cache back to the other threads.  Zero disables both.
+  static uint32_t idle_cache_reclaim_intervals() {
+    return idle_cache_reclaim_intervals_.load(std::memory_order_relaxed);
+  }
+  static void set_idle_cache_reclaim_intervals(uint32_t value) {
+    TCMalloc_Internal_SetIdleCacheReclaimIntervals(value);
+  }
+
+  // Number of background_process_sleep_interval()s after which background
+  // actions return half of the objects that a per-CPU cache did not use over
+  // that period to the transfer cache (see CpuCache::DecayCaches).  Zero
+  // disables decay.
+  static uint32_t per_cpu_caches_decay_intervals() {
+    return per_cpu_caches_decay_intervals_.load(std::memory_order_relaxed);
+  }
+  static void set_per_cpu_caches_decay_intervals(uint32_t value) {
+    TCMalloc_Internal_SetPerCpuCachesDecayIntervals(value);
+  }
+
+  // Whether per-CPU caches that only allocate, or only free, a size class move
+  // whole lists to and from the transfer cache and grow beyond two batches.
+  static bool per_cpu_caches_asymmetric_batches() {
+    return per_cpu_caches_asymmetric_batches_.load(std::memory_order_relaxed);
+  }
+  static void set_per_cpu_caches_asymmetric_batches(bool value) {
+    TCMalloc_Internal_SetPerCpuCachesAsymmetricBatches(value);
+  }
+
+  // Whether transfer cache resizing also grows size classes whose misses are
+  // forecast to recur periodically (see MissForecaster), ahead of their next
+  // burst.
+  static bool transfer_cache_predictive_resize() {
+    return transfer_cache_predictive_resize_.load(std::memory_order_relaxed);
+  }
+  static void set_transfer_cache_predictive_resize(bool value) {
+    TCMalloc_Internal_SetTransferCachePredictiveResize(value);
+  }
+
+  // If nonzero, transfer caches return the objects they did not hand out for
+  // this long, measured per cache rather than in background intervals, and a
+  // bounded number of batches at a time.
+  static absl::Duration transfer_cache_plunder_interval() {
+    return absl::Nanoseconds(
+        transfer_cache_plunder_interval_ns_.load(std::memory_order_relaxed));
+  }
+  static void set_transfer_cache_plunder_interval(absl::Duration value) {
+    TCMalloc_Internal_SetTransferCachePlunderInterval(value);
+  }
+
+  // Whether per-cpu caches move objects to and from the transfer cache in
+  // batches sized at runtime (see CpuCache::ResizeBatchLengths) rather than
+  // in the fixed SizeMap::num_objects_to_move batches.
+  static bool per_cpu_caches_adaptive_batches() {
+    return per_cpu_caches_adaptive_batches_.load(std::memory_order_relaxed);
+  }
+  static void set_per_cpu_caches_adaptive_batches(bool value) {
+    TCMalloc_Internal_SetPerCpuCachesAdaptiveBatches(value);
+  }
+
+  // Whether the CentralFreeList prefers, among spans with similar occupancy,
+  // the ones on the most densely used hugepages, so that sparse hugepages
+  // drain and can be released.
+  static bool central_freelist_hugepage_aware_spans() {
+    return central_freelist_hugepage_aware_spans_.load(
+        std::memory_order_relaxed);
+  }
+  static void set_central_freelist_hugepage_aware_spans(bool value) {
+    TCMalloc_Internal_SetCentralFreelistHugepageAwareSpans(value);
+  }
+
+  // Whether central freelists keep completely free spans for reuse, up to a
+  // limit that follows how often each size class frees and refills spans (see
+  // CentralFreeList::UpdateSpanCache).
+  static bool central_freelist_span_cache() {
+    return central_freelist_span_cache_.load(std::memory_order_relaxed);
+  }
+  static void set_central_freelist_span_cache(bool value) {
+    TCMalloc_Internal_SetCentralFreelistSpanCache(value);
+  }
+
+  // If nonzero, free spans the central freelists kept for this long go back
+  // to the page heap even if the limit of the span cache would keep them.
+  static absl::Duration central_freelist_span_cache_expiry() {
+    return absl::Nanoseconds(central_freelist_span_cache_expiry_ns_.load(
+        std::memory_order_relaxed));
+  }
+  static void set_central_freelist_span_cache_expiry(absl::Duration value) {
+    TCMalloc_Internal_SetCentralFreelistSpanCacheExpiry(value);
+  }
+
+  // Whether the central freelist orders the objects of each batch it hands out
+  // by address, so that the caches hand them out in increasing address order.
+  static bool central_freelist_address_ordered() {
+    return central_freelist_address_ordered_.load(std::memory_order_relaxed);
+  }
+  static void set_central_freelist_address_ordered(bool value) {
+    TCMalloc_Internal_SetCentralFreelistAddressOrdered(value);
+  }
+
+  // Whether spans of size classes that keep their free objects in a list
+  // threaded through the objects keep them in a bitmap outside of the span
+  // instead, so that the central freelist never touches free objects.  Applies
+  // to spans fetched from the page heap afterwards.
+  static bool central_freelist_nonintrusive_spans() {
+    return central_freelist_nonintrusive_spans_.load(
+        std::memory_order_relaxed);
+  }
+  static void set_central_freelist_nonintrusive_spans(bool value) {
+    TCMalloc_Internal_SetCentralFreelistNonintrusiveSpans(value);
+  }
+
+  // Whether the page allocator keeps a few recently freed spans of 64 KiB to
+  // 2 MiB per heap in a cache with its own lock, so that allocating the same
+  // length again does not take pageheap_lock.
+  static bool large_span_cache() {
+    return large_span_cache_.load(std::memory_order_relaxed);
+  }
+  static void set_large_span_cache(bool value) {
+    TCMalloc_Internal_SetLargeSpanCache(value);
+  }
+
+  // Whether allocations of kMaxSize to 2 MiB are rounded up to coarse size
+  // classes of whole pages, so that nearby sizes can reuse each other's spans
+  // from the large span cache.
+  static bool large_size_classes() {
+    return large_size_classes_.load(std::memory_order_relaxed);
+  }
+  static void set_large_size_classes(bool value) {
+    TCMalloc_Internal_SetLargeSizeClasses(value);
+  }
+
+  // Whether large allocations are placed as densely or sparsely accessed
+  // according to the sampled lifetimes of earlier allocations of their size.
+  static bool large_allocation_density_prediction() {
+    return large_allocation_density_prediction_.load(
+        std::memory_order_relaxed);
+  }
+  static void set_large_allocation_density_prediction(bool value) {
+    TCMalloc_Internal_SetLargeAllocationDensityPrediction(value);
+  }
+
+  // Whether realloc moves the pages of a growing allocation of at least a
+  // hugepage to the new allocation with mremap, rather than copying them.
+  static bool realloc_mremap() {
+    return realloc_mremap_.load(std::memory_order_relaxed);
+  }
+  static void set_realloc_mremap(bool value) {
+    TCMalloc_Internal_SetReallocMremap(value);
+  }
+
+  // Whether realloc gives a large allocation that it grows for the second time
+  // in a row headroom of as much again, so that the next growth is in place.
+  static bool realloc_growth_headroom() {
+    return realloc_growth_headroom_.load(std::memory_order_relaxed);
+  }
+  static void set_realloc_growth_headroom(bool value) {
+    TCMalloc_Internal_SetReallocGrowthHeadroom(value);
+  }
+
+  // Whether allocations of at least 1 GiB are backed with 1 GiB hugetlb pages
+  // where the kernel has them available, rather than with transparent
+  // hugepages.
+  static bool gigantic_pages() {
+    return gigantic_pages_.load(std::memory_order_relaxed);
+  }
+  static void set_gigantic_pages(bool value) {
+    TCMalloc_Internal_SetGiganticPages(value);
+  }
+
+  // Whether background release sizes the HugeCache from a forecast of demand,
+  // which anticipates daily peaks and troughs, rather than from recent demand
+  // alone.  Requires huge_cache_demand_based_release.
+  static bool huge_cache_forecast() {
+    return huge_cache_forecast_.load(std::memory_order_relaxed);
+  }
+  static void set_huge_cache_forecast(bool value) {
+    TCMalloc_Internal_SetHugeCacheForecast(value);
+  }
+
+  // If true, HugeCache reuses the most recently released range that fits a
+  // request, rather than the best fit, so that recently touched memory is
+  // reused first.
+  static bool huge_cache_lifo_reuse() {
+    return huge_cache_lifo_reuse_.load(std::memory_order_relaxed);
+  }
+  static void set_huge_cache_lifo_reuse(bool value) {
+    TCMalloc_Internal_SetHugeCacheLifoReuse(value);
+  }
+
+  // If nonzero, background release marks hugepages in the HugeCache cold
+  // rather than releasing them, and only releases them once they have stayed
+  // cold for this long.
+  static absl::Duration huge_cache_cold_interval() {
+    return absl::Nanoseconds(
+        huge_cache_cold_interval_ns_.load(std::memory_order_relaxed));
+  }
+  static void set_huge_cache_cold_interval(absl::Duration value) {
+    TCMalloc_Internal_SetHugeCacheColdInterval(value);
+  }
+
+  // Whether background release only returns whole hugepages.  The
+  // HugePageFiller then releases no pages of hugepages that are still intact,
+  // which stay backed until they are empty and released by the HugeCache,
+  // trading higher RSS for fewer broken hugepages.  Releases on hitting a
+  // memory limit may still break hugepages.
+  static bool hugepage_granular_release() {
+    return hugepage_granular_release_.load(std::memory_order_relaxed);
+  }
+  static void set_hugepage_granular_release(bool value) {
+    TCMalloc_Internal_SetHugepageGranularRelease(value);
+  }
+
+  // Whether the HugePageFiller and HugeCache check which pages are resident
+  // before releasing them.  Pages that are neither resident nor swapped out
+  // are then marked released without a syscall, and only resident pages count
+  // toward release targets, so that these reflect the RSS actually returned.
+  static bool residency_aware_release() {
+    return residency_aware_release_.load(std::memory_order_relaxed);
+  }
+  static void set_residency_aware_release(bool value) {
+    TCMalloc_Internal_SetResidencyAwareRelease(value);
+  }
+
+  // If nonzero, the skip-subrelease intervals of the HugePageFiller are scaled
+  // at runtime, from 1/8 to 8 times their configured values, so that about this
+  // percentage of subreleased pages is faulted back in shortly after being
+  // released.
+  static uint32_t skip_subrelease_target_refault_percent() {
+    return skip_subrelease_target_refault_percent_.load(
+        std::memory_order_relaxed);
+  }
+  static void set_skip_subrelease_target_refault_percent(uint32_t value) {
+    TCMalloc_Internal_SetSkipSubreleaseTargetRefaultPercent(value);
+  }
+
+  // Whether spans with a short-lived hint are placed on the unused tails of
+  // hugepages donated by large allocations, ahead of the hugepages reserved for
+  // short-lived spans, so that these tails empty out before their owner is
+  // freed.
+  static bool donated_tail_packing() {
+    return donated_tail_packing_.load(std::memory_order_relaxed);
+  }
+  static void set_donated_tail_packing(bool value) {
+    TCMalloc_Internal_SetDonatedTailPacking(value);
+  }
+
+  // Whether multi-MiB allocations that are not a multiple of the hugepage size
+  // are placed in their own tier of larger huge regions, instead of starting
+  // runs of hugepages that donate their tails to the filler.
+  static bool large_huge_regions() {
+    return large_huge_regions_.load(std::memory_order_relaxed);
+  }
+  static void set_large_huge_regions(bool value) {
+    TCMalloc_Internal_SetLargeHugeRegions(value);
+  }
+
+  // Whether new metadata Arena blocks are advised to be backed by hugepages
+  // once the arena holds a few hugepages worth of metadata, giving walks over
+  // spans and trackers TLB coverage.
+  static bool metadata_hugepages() {
+    return metadata_hugepages_.load(std::memory_order_relaxed);
+  }
+  static void set_metadata_hugepages(bool value) {
+    TCMalloc_Internal_SetMetadataHugepages(value);
+  }
+
+  // The fraction of CPU time that recording sampled allocations (unwinding and
+  // inserting them into the sampled allocation tables) may take.  When non-
+  // zero, the sampling interval is raised above profile_sampling_interval, up
+  // to profile_sampling_max_interval, while sampling costs more than this.
+  // Sample weights account for the interval each sample was taken at.
+  static double profile_sampling_cpu_budget() {
+    return profile_sampling_cpu_budget_.load(std::memory_order_relaxed);
+  }
+  static void set_profile_sampling_cpu_budget(double value) {
+    TCMalloc_Internal_SetProfileSamplingCpuBudget(value);
+  }
+
+  // The largest sampling interval profile_sampling_cpu_budget may raise the
+  // interval to.
+  static int64_t profile_sampling_max_interval() {
+    return profile_sampling_max_interval_.load(std::memory_order_relaxed);
+  }
+  static void set_profile_sampling_max_interval(int64_t value) {
+    TCMalloc_Internal_SetProfileSamplingMaxInterval(value);
+  }
+
   static double per_cpu_caches_dynamic_slab_grow_threshold() {
     return per_cpu_caches_dynamic_slab_grow_threshold_.load(
         std::memory_order_relaxed);
@@ -225,9 +806,23 @@ class Parameters {
   friend void ::TCMalloc_Internal_SetHugeRegionDemandBasedRelease(bool v);
   friend void ::TCMalloc_Internal_SetReleasePagesFromHugeRegionEnabled(bool v);
   friend void ::TCMalloc_Internal_SetResizeSizeClassMaxCapacityEnabled(bool v);
+  friend void ::TCMalloc_Internal_SetShardedTransferCacheAdaptiveEnabled(
+      bool v);
+  friend void ::TCMalloc_Internal_SetTransferCacheLockFreeEnabled(bool v);
   friend void ::TCMalloc_Internal_SetMaxPerCpuCacheSize(int32_t v);
   friend void ::TCMalloc_Internal_SetMaxTotalThreadCacheBytes(int64_t v);
   friend void ::TCMalloc_Internal_SetPeakSamplingHeapGrowthFraction(double v);
+  friend void ::TCMalloc_Internal_SetWindowedPeakHeapProfiles(bool v);
+  friend void ::TCMalloc_Internal_SetContinuousLifetimeProfilePeriod(int64_t v);
+  friend void ::TCMalloc_Internal_SetLeakDetectionInterval(absl::Duration v);
+  friend void ::TCMalloc_Internal_SetGuardedDeallocationBatchSize(int64_t v);
+  friend void ::TCMalloc_Internal_SetExcludeFreeFromCoreDumps(bool v);
+  friend void ::TCMalloc_Internal_SetPublishStatsPage(bool v);
+  friend void ::TCMalloc_Internal_SetMemoryPressureModeratePercent(uint32_t v);
+  friend void ::TCMalloc_Internal_SetMemoryPressureCriticalPercent(uint32_t v);
+  friend void ::TCMalloc_Internal_SetReleaseMemoryAfterFork(bool v);
+  friend void ::TCMalloc_Internal_SetColdPageSize(int64_t v);
+  friend void ::TCMalloc_Internal_SetNumericPropertyStaleness(absl::Duration v);
   friend void ::TCMalloc_Internal_SetPerCpuCachesEnabledNoBuildRequirement(
       bool v);
   friend void ::TCMalloc_Internal_SetProfileSamplingInterval(int64_t v);
@@ -243,6 +838,56 @@ class Parameters {
   friend void ::TCMalloc_Internal_SetHugeCacheDemandReleaseLongInterval(
       absl::Duration v);
   friend void ::TCMalloc_Internal_SetPerCpuCachesDynamicSlabEnabled(bool v);
+  friend void ::TCMalloc_Internal_SetPerCpuCachesStealObjectsEnabled(bool v);
+  friend void ::TCMalloc_Internal_SetPerCpuCachesRemoteFreeEnabled(bool v);
+  friend void ::TCMalloc_Internal_SetPerCpuCachesHugepageSlabsEnabled(bool v);
+  friend void ::TCMalloc_Internal_SetPerCpuCachesIncrementalSlabResize(bool v);
+  friend void ::TCMalloc_Internal_SetSlowPathLatencyHistograms(bool v);
+  friend void ::TCMalloc_Internal_SetDynamicSizeClasses(bool v);
+  friend void ::TCMalloc_Internal_SetCompactSampledAllocations(bool v);
+  friend void ::TCMalloc_Internal_SetAllocationAccounting(bool v);
+  friend void ::TCMalloc_Internal_SetPerCpuCachesBypassColdClasses(bool v);
+  friend void ::TCMalloc_Internal_SetPerCpuCachesPingPongHysteresis(bool v);
+  friend void ::TCMalloc_Internal_SetHugePageCollapseRate(uint32_t v);
+  friend void ::TCMalloc_Internal_SetHugePageBackingSamples(uint32_t v);
+  friend void ::TCMalloc_Internal_SetLifetimeBasedAllocation(bool v);
+  friend void ::TCMalloc_Internal_SetCgroupMemoryLimitHeadroomPercent(
+      uint32_t v);
+  friend void ::TCMalloc_Internal_SetSoftLimitBackgroundShrinkPercent(
+      uint32_t v);
+  friend void ::TCMalloc_Internal_SetPressureBasedRelease(bool v);
+  friend void ::TCMalloc_Internal_SetEventDrivenBackgroundActions(bool v);
+  friend void ::TCMalloc_Internal_SetIdleCacheReclaimIntervals(uint32_t v);
+  friend void ::TCMalloc_Internal_SetPerCpuCachesDecayIntervals(uint32_t v);
+  friend void ::TCMalloc_Internal_SetPerCpuCachesAsymmetricBatches(bool v);
+  friend void ::TCMalloc_Internal_SetTransferCachePredictiveResize(bool v);
+  friend void ::TCMalloc_Internal_SetTransferCachePlunderInterval(
+      absl::Duration v);
+  friend void ::TCMalloc_Internal_SetPerCpuCachesAdaptiveBatches(bool v);
+  friend void ::TCMalloc_Internal_SetCentralFreelistHugepageAwareSpans(bool v);
+  friend void ::TCMalloc_Internal_SetCentralFreelistSpanCache(bool v);
+  friend void ::TCMalloc_Internal_SetCentralFreelistSpanCacheExpiry(
+      absl::Duration v);
+  friend void ::TCMalloc_Internal_SetCentralFreelistAddressOrdered(bool v);
+  friend void ::TCMalloc_Internal_SetCentralFreelistNonintrusiveSpans(bool v);
+  friend void ::TCMalloc_Internal_SetLargeSpanCache(bool v);
+  friend void ::TCMalloc_Internal_SetLargeSizeClasses(bool v);
+  friend void ::TCMalloc_Internal_SetLargeAllocationDensityPrediction(bool v);
+  friend void ::TCMalloc_Internal_SetReallocMremap(bool v);
+  friend void ::TCMalloc_Internal_SetReallocGrowthHeadroom(bool v);
+  friend void ::TCMalloc_Internal_SetGiganticPages(bool v);
+  friend void ::TCMalloc_Internal_SetHugeCacheForecast(bool v);
+  friend void ::TCMalloc_Internal_SetHugeCacheLifoReuse(bool v);
+  friend void ::TCMalloc_Internal_SetHugeCacheColdInterval(absl::Duration v);
+  friend void ::TCMalloc_Internal_SetHugepageGranularRelease(bool v);
+  friend void ::TCMalloc_Internal_SetResidencyAwareRelease(bool v);
+  friend void ::TCMalloc_Internal_SetSkipSubreleaseTargetRefaultPercent(
+      uint32_t v);
+  friend void ::TCMalloc_Internal_SetDonatedTailPacking(bool v);
+  friend void ::TCMalloc_Internal_SetLargeHugeRegions(bool v);
+  friend void ::TCMalloc_Internal_SetMetadataHugepages(bool v);
+  friend void ::TCMalloc_Internal_SetProfileSamplingCpuBudget(double v);
+  friend void ::TCMalloc_Internal_SetProfileSamplingMaxInterval(int64_t v);
   friend void ::TCMalloc_Internal_SetPerCpuCachesDynamicSlabGrowThreshold(
       double v);
   friend void ::TCMalloc_Internal_SetPerCpuCachesDynamicSlabShrinkThreshold(
@@ -260,13 +905,71 @@ class Parameters {
   static std::atomic<int32_t> max_per_cpu_cache_size_;
   static std::atomic<int64_t> max_total_thread_cache_bytes_;
   static std::atomic<double> peak_sampling_heap_growth_fraction_;
+  static std::atomic<bool> windowed_peak_heap_profiles_;
+  static std::atomic<int64_t> continuous_lifetime_profile_period_;
+  static std::atomic<int64_t> leak_detection_interval_ns_;
+  static std::atomic<int64_t> guarded_deallocation_batch_size_;
+  static std::atomic<bool> exclude_free_from_core_dumps_;
+  static std::atomic<bool> publish_stats_page_;
+  static std::atomic<uint32_t> memory_pressure_moderate_percent_;
+  static std::atomic<uint32_t> memory_pressure_critical_percent_;
+  static std::atomic<bool> release_memory_after_fork_;
+  static std::atomic<int64_t> cold_page_size_;
+  static std::atomic<int64_t> numeric_property_staleness_ns_;
   static std::atomic<bool> per_cpu_caches_enabled_;
   static std::atomic<bool> release_partial_alloc_pages_;
   static std::atomic<bool> huge_cache_demand_based_release_;
   static std::atomic<bool> release_pages_from_huge_region_;
   static std::atomic<bool> resize_size_class_max_capacity_;
+  static std::atomic<bool> sharded_transfer_cache_adaptive_;
+  static std::atomic<bool> transfer_cache_lock_free_;
   static std::atomic<int64_t> profile_sampling_interval_;
   static std::atomic<bool> per_cpu_caches_dynamic_slab_;
+  static std::atomic<bool> per_cpu_caches_steal_objects_;
+  static std::atomic<bool> per_cpu_caches_remote_free_;
+  static std::atomic<bool> per_cpu_caches_hugepage_slabs_;
+  static std::atomic<bool> per_cpu_caches_incremental_slab_resize_;
+  static std::atomic<bool> slow_path_latency_histograms_;
+  static std::atomic<bool> dynamic_size_classes_;
+  static std::atomic<bool> compact_sampled_allocations_;
+  static std::atomic<bool> allocation_accounting_;
+  static std::atomic<bool> per_cpu_caches_bypass_cold_classes_;
+  static std::atomic<bool> per_cpu_caches_ping_pong_hysteresis_;
+  static std::atomic<uint32_t> huge_page_collapse_rate_;
+  static std::atomic<uint32_t> huge_page_backing_samples_;
+  static std::atomic<bool> lifetime_based_allocation_;
+  static std::atomic<uint32_t> cgroup_memory_limit_headroom_percent_;
+  static std::atomic<uint32_t> soft_limit_background_shrink_percent_;
+  static std::atomic<bool> pressure_based_release_;
+  static std::atomic<bool> event_driven_background_actions_;
+  static std::atomic<uint32_t> idle_cache_reclaim_intervals_;
+  static std::atomic<uint32_t> per_cpu_caches_decay_intervals_;
+  static std::atomic<bool> per_cpu_caches_asymmetric_batches_;
+  static std::atomic<bool> transfer_cache_predictive_resize_;
+  static std::atomic<int64_t> transfer_cache_plunder_interval_ns_;
+  static std::atomic<bool> per_cpu_caches_adaptive_batches_;
+  static std::atomic<bool> central_freelist_hugepage_aware_spans_;
+  static std::atomic<bool> central_freelist_span_cache_;
+  static std::atomic<int64_t> central_freelist_span_cache_expiry_ns_;
+  static std::atomic<bool> central_freelist_address_ordered_;
+  static std::atomic<bool> central_freelist_nonintrusive_spans_;
+  static std::atomic<bool> large_span_cache_;
+  static std::atomic<bool> large_size_classes_;
+  static std::atomic<bool> large_allocation_density_prediction_;
+  static std::atomic<bool> realloc_mremap_;
+  static std::atomic<bool> realloc_growth_headroom_;
+  static std::atomic<bool> gigantic_pages_;
+  static std::atomic<bool> huge_cache_forecast_;
+  static std::atomic<bool> huge_cache_lifo_reuse_;
+  static std::atomic<int64_t> huge_cache_cold_interval_ns_;
+  static std::atomic<bool> hugepage_granular_release_;
+  static std::atomic<bool> residency_aware_release_;
+  static std::atomic<uint32_t> skip_subrelease_target_refault_percent_;
+  static std::atomic<bool> donated_tail_packing_;
+  static std::atomic<bool> large_huge_regions_;
+  static std::atomic<bool> metadata_hugepages_;
+  static std::atomic<double> profile_sampling_cpu_budget_;
+  static std::atomic<int64_t> profile_sampling_max_interval_;
   static std::atomic<MadvisePreference> madvise_;
   static std::atomic<tcmalloc::hot_cold_t> min_hot_access_hint_;
   static std::atomic<double> per_cpu_caches_dynamic_slab_grow_threshold_;
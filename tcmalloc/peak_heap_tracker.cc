@@ -16,11 +16,17 @@
 
 #include <stdio.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <utility>
 
 #include "absl/base/internal/spinlock.h"
+#include "absl/functional/function_ref.h"
 #include "absl/memory/memory.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "tcmalloc/internal/allocation_guard.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
@@ -40,8 +46,28 @@ bool PeakHeapTracker::IsNewPeak() {
           current_peak_size * Parameters::peak_sampling_heap_growth_fraction());
 }
 
+bool PeakHeapTracker::IsNewWindowedPeak(absl::Time now) {
+  if (absl::ToUnixNanos(now) >=
+      next_epoch_end_ns_.load(std::memory_order_relaxed)) {
+    return true;
+  }
+  const double size = tc_globals.sampled_objects_size_.value();
+  const double fraction = Parameters::peak_sampling_heap_growth_fraction();
+  for (const auto& peak_size : window_peak_sizes_) {
+    if (size > peak_size.load(std::memory_order_relaxed) * fraction) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void PeakHeapTracker::MaybeSaveSample() {
-  if (Parameters::peak_sampling_heap_growth_fraction() <= 0 || !IsNewPeak()) {
+  if (Parameters::peak_sampling_heap_growth_fraction() <= 0) {
+    return;
+  }
+  const bool windowed = Parameters::windowed_peak_heap_profiles();
+  const absl::Time now = windowed ? absl::Now() : absl::InfinitePast();
+  if (!IsNewPeak() && !(windowed && IsNewWindowedPeak(now))) {
     return;
   }
 
@@ -49,33 +75,154 @@ void PeakHeapTracker::MaybeSaveSample() {
 
   // double-check in case another allocation was sampled (or a sampled
   // allocation freed) while we were waiting for the lock
-  if (!IsNewPeak()) {
-    return;
+  if (IsNewPeak()) {
+    SetCurrentPeakSize(tc_globals.sampled_objects_size_.value());
+    Save(peak_heap_recorder_.get_mutable());
   }
-  SetCurrentPeakSize(tc_globals.sampled_objects_size_.value());
+  if (windowed) {
+    SaveWindowedSamples(now, tc_globals.sampled_objects_size_.value());
+  }
+}
 
+void PeakHeapTracker::Save(PeakHeapRecorder& recorder) {
   // Guaranteed to have no live sample after this call since we are doing this
   // under `recorder_lock_`.
-  peak_heap_recorder_.get_mutable().UnregisterAll();
+  recorder.UnregisterAll();
   tc_globals.sampled_allocation_recorder().Iterate(
-      [this](const SampledAllocation& sampled_allocation) {
+      [this, &recorder](const SampledAllocation& sampled_allocation) {
         recorder_lock_.AssertHeld();
-        StackTrace st = sampled_allocation.sampled_stack;
-        peak_heap_recorder_.get_mutable().Register(std::move(st));
+        recorder.Register(sampled_allocation, tc_globals.stack_depot());
       });
 }
 
+void PeakHeapTracker::SaveWindowedSamples(absl::Time now, int64_t size) {
+  const double fraction = Parameters::peak_sampling_heap_growth_fraction();
+  absl::Time next_epoch_end = absl::InfiniteFuture();
+  for (int w = 0; w < kNumWindows; ++w) {
+    Window& window = windows_[w];
+    if (now >= window.epoch_end) {
+      Rotate(w);
+      if (now - window.epoch_end >= kWindowLengths[w]) {
+        // Nothing was sampled during the whole epoch that just ended, so its
+        // peak is stale too.
+        Rotate(w);
+        window.epoch_end = now + kWindowLengths[w];
+      } else {
+        window.epoch_end += kWindowLengths[w];
+      }
+      window_peak_sizes_[w].store(0, std::memory_order_relaxed);
+    }
+    next_epoch_end = std::min(next_epoch_end, window.epoch_end);
+
+    Snapshot& current = snapshots_[window.current];
+    if (size > current.size * fraction) {
+      Save(current.recorder.get_mutable());
+      current.size = size;
+      current.time = now;
+      window_peak_sizes_[w].store(size, std::memory_order_relaxed);
+    }
+  }
+  next_epoch_end_ns_.store(absl::ToUnixNanos(next_epoch_end),
+                           std::memory_order_relaxed);
+}
+
+void PeakHeapTracker::Rotate(int w) {
+  Window& window = windows_[w];
+  // The previous epoch falls out of the window.  One minute epochs get a
+  // chance to be kept as one of the top peaks instead.
+  int index = window.previous;
+  if (w == 0) {
+    index = MaybeKeepTopPeak(index);
+  }
+  window.previous = window.current;
+  window.current = index;
+
+  Snapshot& snapshot = snapshots_[index];
+  snapshot.recorder.get_mutable().UnregisterAll();
+  snapshot.size = 0;
+  snapshot.time = absl::InfinitePast();
+}
+
+int PeakHeapTracker::MaybeKeepTopPeak(int index) {
+  int& smallest = top_peaks_[kNumTopPeaks - 1];
+  if (snapshots_[index].size <= snapshots_[smallest].size) {
+    return index;
+  }
+  std::swap(index, smallest);
+  for (int i = kNumTopPeaks - 1;
+       i > 0 && snapshots_[top_peaks_[i]].size >
+                    snapshots_[top_peaks_[i - 1]].size;
+       --i) {
+    std::swap(top_peaks_[i], top_peaks_[i - 1]);
+  }
+  return index;
+}
+
+void PeakHeapTracker::Dump(PeakHeapRecorder& recorder,
+                           StackTraceTable& profile) {
+  recorder.Iterate([&profile](const SampledAllocation& peak_heap_record) {
+    profile.AddTrace(1.0, peak_heap_record.sampled_stack,
+                     peak_heap_record.stack());
+  });
+}
+
 std::unique_ptr<ProfileBase> PeakHeapTracker::DumpSample() {
   auto profile = std::make_unique<StackTraceTable>(ProfileType::kPeakHeap);
 
   AllocationGuardSpinLockHolder h(&recorder_lock_);
-  peak_heap_recorder_.get_mutable().Iterate(
-      [&profile](const SampledAllocation& peak_heap_record) {
-        profile->AddTrace(1.0, peak_heap_record.sampled_stack);
-      });
+  Dump(peak_heap_recorder_.get_mutable(), *profile);
+  return profile;
+}
+
+std::unique_ptr<ProfileBase> PeakHeapTracker::DumpWindowedSample(
+    int window, ProfileType type) {
+  TC_ASSERT_GE(window, 0);
+  TC_ASSERT_LT(window, kNumWindows);
+  auto profile = std::make_unique<StackTraceTable>(type);
+  const absl::Time now = absl::Now();
+
+  AllocationGuardSpinLockHolder h(&recorder_lock_);
+  // Epochs are only rotated when an allocation is sampled, so skip those that
+  // ended more than a window ago.
+  const Window& w = windows_[window];
+  Snapshot* peak = nullptr;
+  for (int index : {w.current, w.previous}) {
+    Snapshot& snapshot = snapshots_[index];
+    if (snapshot.size > 0 && now - snapshot.time < 2 * kWindowLengths[window] &&
+        (peak == nullptr || snapshot.size > peak->size)) {
+      peak = &snapshot;
+    }
+  }
+  if (peak != nullptr) {
+    Dump(peak->recorder.get_mutable(), *profile);
+  }
   return profile;
 }
 
+void PeakHeapTracker::DumpTopSamples(
+    absl::FunctionRef<void(absl::Time, std::unique_ptr<ProfileBase>)> f) {
+  // The profiles are allocated up front: nothing may be allocated under
+  // `recorder_lock_`.
+  std::unique_ptr<StackTraceTable> profiles[kNumTopPeaks];
+  for (auto& profile : profiles) {
+    profile = std::make_unique<StackTraceTable>(ProfileType::kPeakHeap);
+  }
+  absl::Time times[kNumTopPeaks];
+  int num_peaks = 0;
+  {
+    AllocationGuardSpinLockHolder h(&recorder_lock_);
+    for (; num_peaks < kNumTopPeaks; ++num_peaks) {
+      Snapshot& snapshot = snapshots_[top_peaks_[num_peaks]];
+      if (snapshot.size == 0) break;
+      times[num_peaks] = snapshot.time;
+      Dump(snapshot.recorder.get_mutable(), *profiles[num_peaks]);
+    }
+  }
+  for (int i = 0; i < num_peaks; ++i) {
+    f(times[i], std::move(profiles[i]));
+  }
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
@@ -23,6 +23,8 @@
 #include "absl/base/const_init.h"
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/thread_annotations.h"
+#include "absl/functional/function_ref.h"
+#include "absl/time/time.h"
 #include "tcmalloc/arena.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/config.h"
@@ -31,6 +33,7 @@
 #include "tcmalloc/internal/sampled_allocation_recorder.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/sampled_allocation_allocator.h"
+#include "tcmalloc/stack_trace_table.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
@@ -38,6 +41,18 @@ namespace tcmalloc_internal {
 
 class PeakHeapTracker {
  public:
+  // With Parameters::windowed_peak_heap_profiles(), peaks are also tracked
+  // within windows of these lengths, for the kPeakHeapLastMinute and
+  // kPeakHeapLastHour profiles.  Time is divided into epochs of the window
+  // length and the peaks of the current and the previous epoch are kept, so
+  // the reported peak is the largest within the last one to two windows.
+  static constexpr int kNumWindows = 2;
+  static constexpr absl::Duration kWindowLengths[kNumWindows] = {
+      absl::Minutes(1), absl::Hours(1)};
+
+  // The number of largest one minute epoch peaks kept.
+  static constexpr int kNumTopPeaks = 3;
+
   constexpr PeakHeapTracker()
       : recorder_lock_(absl::kConstInit,
                        absl::base_internal::SCHEDULE_KERNEL_ONLY),
@@ -49,17 +64,35 @@ class PeakHeapTracker {
     AllocationGuardSpinLockHolder h(&recorder_lock_);
     peak_heap_recorder_.Construct(&peak_heap_record_allocator_);
     peak_heap_recorder_.get_mutable().Init();
+    for (Snapshot& snapshot : snapshots_) {
+      snapshot.recorder.Construct(&peak_heap_record_allocator_);
+      snapshot.recorder.get_mutable().Init();
+    }
   }
 
   // Possibly save high-water-mark allocation stack traces for peak-heap
   // profile. Should be called immediately after sampling an allocation. If
   // the heap has grown by a sufficient amount since the last high-water-mark,
-  // it will save a copy of the sample profile.
+  // it will save a copy of the sample profile.  The same goes for the
+  // windowed peaks, if enabled.
   void MaybeSaveSample() ABSL_LOCKS_EXCLUDED(recorder_lock_);
 
   // Return the saved high-water-mark heap profile, if any.
   std::unique_ptr<ProfileBase> DumpSample() ABSL_LOCKS_EXCLUDED(recorder_lock_);
 
+  // Returns the peak heap profile of window <window>, an index into
+  // kWindowLengths, with type <type>.  It is empty unless windowed peaks are
+  // enabled.
+  std::unique_ptr<ProfileBase> DumpWindowedSample(int window, ProfileType type)
+      ABSL_LOCKS_EXCLUDED(recorder_lock_);
+
+  // Calls <f> with the time and the heap profile of each of the kNumTopPeaks
+  // largest one minute epoch peaks saved so far, largest first.  Only epochs
+  // that have ended are considered.
+  void DumpTopSamples(
+      absl::FunctionRef<void(absl::Time, std::unique_ptr<ProfileBase>)> f)
+      ABSL_LOCKS_EXCLUDED(recorder_lock_);
+
   size_t CurrentPeakSize() const {
     return do_not_access_directly_peak_sampled_heap_size_.load(
         std::memory_order_relaxed);
@@ -75,6 +108,24 @@ class PeakHeapTracker {
   using PeakHeapRecorder =
       SampleRecorder<SampledAllocation, SampledAllocationAllocator>;
 
+  // A copy of the sampled heap taken at its largest during some epoch.
+  struct Snapshot {
+    ExplicitlyConstructed<PeakHeapRecorder> recorder;
+    // The sampled heap size when the copy was taken, or 0 if there is none.
+    int64_t size = 0;
+    absl::Time time;
+  };
+
+  // The epochs of a window: indices into snapshots_ of the peaks of the
+  // current and the previous epoch, and when the current epoch ends.
+  struct Window {
+    int current;
+    int previous;
+    absl::Time epoch_end = absl::InfinitePast();
+  };
+
+  static constexpr int kNumSnapshots = 2 * kNumWindows + kNumTopPeaks;
+
   SampledAllocationAllocator peak_heap_record_allocator_;
 
   // Guards the peak heap samples stored in `peak_heap_recorder_`.
@@ -94,7 +145,34 @@ class PeakHeapTracker {
   // under `recorder_lock_`; may be read without it.
   std::atomic<int64_t> do_not_access_directly_peak_sampled_heap_size_{0};
 
+  // Snapshots are handed between windows_ and top_peaks_ by index rather than
+  // copied.
+  Snapshot snapshots_[kNumSnapshots] ABSL_GUARDED_BY(recorder_lock_) = {};
+  Window windows_[kNumWindows] ABSL_GUARDED_BY(recorder_lock_) = {{0, 1},
+                                                                  {2, 3}};
+  // Indices into snapshots_ of the largest one minute peaks, largest first.
+  int top_peaks_[kNumTopPeaks] ABSL_GUARDED_BY(recorder_lock_) = {4, 5, 6};
+
+  // The size of the current epoch's peak of each window, and the end of the
+  // earliest epoch, in nanoseconds since the epoch.  Only written under
+  // `recorder_lock_`; may be read without it.
+  std::atomic<int64_t> window_peak_sizes_[kNumWindows] = {};
+  std::atomic<int64_t> next_epoch_end_ns_{0};
+
   bool IsNewPeak();
+  bool IsNewWindowedPeak(absl::Time now);
+
+  void Save(PeakHeapRecorder& recorder)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(recorder_lock_);
+  void Dump(PeakHeapRecorder& recorder, StackTraceTable& profile)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(recorder_lock_);
+  void SaveWindowedSamples(absl::Time now, int64_t size)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(recorder_lock_);
+  // Starts a new epoch of window <window>.
+  void Rotate(int window) ABSL_EXCLUSIVE_LOCKS_REQUIRED(recorder_lock_);
+  // Offers the snapshot at <index> to top_peaks_.  Returns the index of the
+  // snapshot that is no longer needed: <index> itself or the one it replaced.
+  int MaybeKeepTopPeak(int index) ABSL_EXCLUSIVE_LOCKS_REQUIRED(recorder_lock_);
 };
 
 }  // namespace tcmalloc_internal
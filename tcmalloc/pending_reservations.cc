@@ -0,0 +1,81 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/pending_reservations.h"
+
+#include <stddef.h>
+
+#include <atomic>
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/spinlock.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/page_allocator.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/static_vars.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+bool PendingReservations::Add(size_t bytes, MemoryTag tag) {
+  if (bytes == 0) return true;
+  absl::base_internal::SpinLockHolder h(&lock_);
+  int i = 0;
+  while (i < num_requests_ && requests_[i].tag != tag) ++i;
+  if (i == num_requests_) {
+    if (num_requests_ == kMaxPending) return false;
+    requests_[num_requests_++] = {0, tag};
+  }
+  requests_[i].bytes += bytes;
+  pending_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+  return true;
+}
+
+size_t PendingReservations::Process() {
+  if (pending_bytes() == 0) return 0;
+
+  Request requests[kMaxPending];
+  int n;
+  {
+    absl::base_internal::SpinLockHolder h(&lock_);
+    n = num_requests_;
+    for (int i = 0; i < n; ++i) {
+      requests[i] = requests_[i];
+    }
+    num_requests_ = 0;
+  }
+
+  // Faulting in the reservations takes a while, so it is done without lock_,
+  // letting new requests queue up meanwhile.
+  size_t reserved = 0;
+  for (int i = 0; i < n; ++i) {
+    reserved += tc_globals.page_allocator()
+                    .Reserve(BytesToLengthCeil(requests[i].bytes),
+                             /*populate=*/true, requests[i].tag)
+                    .in_bytes();
+    pending_bytes_.fetch_sub(requests[i].bytes, std::memory_order_relaxed);
+  }
+  return reserved;
+}
+
+PendingReservations& pending_reservations() {
+  ABSL_CONST_INIT static PendingReservations reservations;
+  return reservations;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
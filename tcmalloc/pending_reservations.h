@@ -0,0 +1,79 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_PENDING_RESERVATIONS_H_
+#define TCMALLOC_PENDING_RESERVATIONS_H_
+
+#include <stddef.h>
+
+#include <atomic>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Reservations requested with MallocExtension::PrepareForAllocation, which the
+// background thread makes and faults in ahead of the allocations they are for,
+// so that the allocating thread does not take the page faults.
+//
+// Requests for the same heap are merged, so that they are reserved as one
+// range.
+class PendingReservations {
+ public:
+  static constexpr int kMaxPending = 16;
+
+  constexpr PendingReservations() = default;
+
+  PendingReservations(const PendingReservations&) = delete;
+  PendingReservations& operator=(const PendingReservations&) = delete;
+
+  // Records a request for <bytes> from the heap for <tag>.  Returns false, and
+  // drops the request, if kMaxPending heaps have requests pending already.
+  bool Add(size_t bytes, MemoryTag tag) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Reserves and populates the pending requests.  Returns the bytes reserved.
+  // The caller must not hold pageheap_lock.
+  size_t Process() ABSL_LOCKS_EXCLUDED(lock_);
+
+  // The bytes requested and not yet reserved.
+  size_t pending_bytes() const {
+    return pending_bytes_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Request {
+    size_t bytes;
+    MemoryTag tag;
+  };
+
+  absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  Request requests_[kMaxPending] ABSL_GUARDED_BY(lock_) = {};
+  int num_requests_ ABSL_GUARDED_BY(lock_) = 0;
+  // Lets Process skip taking lock_ when nothing is pending.
+  std::atomic<size_t> pending_bytes_{0};
+};
+
+PendingReservations& pending_reservations();
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_PENDING_RESERVATIONS_H_
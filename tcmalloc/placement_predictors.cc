@@ -0,0 +1,85 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/placement_predictors.h"
+
+#include <stdint.h>
+
+#include <memory>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "tcmalloc/span.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+std::unique_ptr<PlacementPredictor> MakePlacementPredictor(
+    absl::string_view name, absl::Duration threshold) {
+  if (name == "none") return std::make_unique<NoPlacementPredictor>();
+  if (name == "oracle") {
+    return std::make_unique<OraclePlacementPredictor>(threshold);
+  }
+  if (name == "stack") return std::make_unique<StackHashPlacementPredictor>();
+  return nullptr;
+}
+
+void LifetimeObserver::Allocated(uint64_t id, const TracedSpan& span,
+                                 SpanLifetime prediction) {
+  AdvanceTo(span.alloc_time);
+  pending_[id] = {span, prediction};
+  by_alloc_time_.emplace_back(span.alloc_time, id);
+  if (prediction == SpanLifetime::kShortLived) ++stats_.predicted_short_lived;
+}
+
+void LifetimeObserver::Freed(uint64_t id, int64_t now) {
+  AdvanceTo(now);
+  auto it = pending_.find(id);
+  if (it == pending_.end()) return;
+  Report(it->second, SpanLifetime::kShortLived);
+  pending_.erase(it);
+}
+
+void LifetimeObserver::AdvanceTo(int64_t now) {
+  while (!by_alloc_time_.empty() &&
+         by_alloc_time_.front().first <= now - threshold_) {
+    const auto [alloc_time, id] = by_alloc_time_.front();
+    by_alloc_time_.pop_front();
+    auto it = pending_.find(id);
+    // Skip spans that were freed, including those whose id was reused since.
+    if (it == pending_.end() || it->second.span.alloc_time != alloc_time) {
+      continue;
+    }
+    Report(it->second, SpanLifetime::kLongLived);
+    pending_.erase(it);
+  }
+}
+
+void LifetimeObserver::Report(const Pending& pending, SpanLifetime lifetime) {
+  if (lifetime == SpanLifetime::kShortLived) {
+    ++stats_.short_lived;
+    if (pending.prediction != SpanLifetime::kShortLived) {
+      ++stats_.missed_short_lived;
+    }
+  } else {
+    ++stats_.long_lived;
+    if (pending.prediction == SpanLifetime::kShortLived) {
+      ++stats_.mispredicted_short_lived;
+    }
+  }
+  predictor_.Observe(pending.span, lifetime);
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
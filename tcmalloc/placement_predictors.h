@@ -0,0 +1,164 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Lifetime predictors for replaying span traces offline (see
+// huge_page_aware_allocator_simulator.cc), so that lifetime-aware placement
+// (docs/lifetime-based-allocator.md) can be judged against the placement it
+// would get from a perfect predictor, and from none, before it is rolled out.
+
+#ifndef TCMALLOC_PLACEMENT_PREDICTORS_H_
+#define TCMALLOC_PLACEMENT_PREDICTORS_H_
+
+#include <stdint.h>
+
+#include <deque>
+#include <limits>
+#include <memory>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "tcmalloc/lifetime_predictions.h"
+#include "tcmalloc/span.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// A span of a trace, as known when it is allocated.  Only the oracle may look
+// at free_time.
+struct TracedSpan {
+  // The hash of the allocation stack, or 0 if the trace has none.
+  uint64_t stack_hash = 0;
+  // Trace times, in nanoseconds.  free_time is
+  // std::numeric_limits<int64_t>::max() for spans that are never freed.
+  int64_t alloc_time = 0;
+  int64_t free_time = std::numeric_limits<int64_t>::max();
+};
+
+class PlacementPredictor {
+ public:
+  virtual ~PlacementPredictor() = default;
+
+  // Predicts the lifetime of <span> as it is allocated.
+  virtual SpanLifetime Predict(const TracedSpan& span) = 0;
+
+  // Learns the lifetime of <span> once it is known: when it is freed before
+  // the threshold, or once it outlives it.
+  virtual void Observe(const TracedSpan& span, SpanLifetime lifetime) {}
+};
+
+// Predicts every span to be long-lived, which is the placement without
+// lifetime awareness.
+class NoPlacementPredictor final : public PlacementPredictor {
+ public:
+  SpanLifetime Predict(const TracedSpan& span) override {
+    return SpanLifetime::kLongLived;
+  }
+};
+
+// Predicts from the recorded free time, which bounds what any predictor can
+// achieve.
+class OraclePlacementPredictor final : public PlacementPredictor {
+ public:
+  explicit OraclePlacementPredictor(absl::Duration threshold)
+      : threshold_(absl::ToInt64Nanoseconds(threshold)) {}
+
+  SpanLifetime Predict(const TracedSpan& span) override {
+    return span.free_time - span.alloc_time < threshold_
+               ? SpanLifetime::kShortLived
+               : SpanLifetime::kLongLived;
+  }
+
+ private:
+  const int64_t threshold_;
+};
+
+// Predicts from the lifetimes seen earlier for the same allocation stack,
+// with the LifetimeDatabase of the lifetime-based allocator.  Spans without a
+// stack hash are predicted long-lived.
+class StackHashPlacementPredictor final : public PlacementPredictor {
+ public:
+  SpanLifetime Predict(const TracedSpan& span) override {
+    if (span.stack_hash == 0) return SpanLifetime::kLongLived;
+    return database_.Predict(span.stack_hash) ==
+                   LifetimeDatabase::Prediction::kShortLived
+               ? SpanLifetime::kShortLived
+               : SpanLifetime::kLongLived;
+  }
+
+  void Observe(const TracedSpan& span, SpanLifetime lifetime) override {
+    if (span.stack_hash == 0) return;
+    database_.Record(span.stack_hash,
+                     lifetime == SpanLifetime::kShortLived
+                         ? LifetimeDatabase::Prediction::kShortLived
+                         : LifetimeDatabase::Prediction::kLongLived);
+  }
+
+ private:
+  LifetimeDatabase database_;
+};
+
+// Returns the predictor named "none", "oracle" or "stack", or nullptr.
+std::unique_ptr<PlacementPredictor> MakePlacementPredictor(
+    absl::string_view name, absl::Duration threshold);
+
+// Feeds the lifetimes of the spans of a trace to a predictor as they become
+// known, and counts how well it predicted them.  Spans are identified by the
+// trace's ids, and must be allocated in time order.
+class LifetimeObserver {
+ public:
+  struct Stats {
+    uint64_t short_lived = 0;
+    uint64_t long_lived = 0;
+    uint64_t predicted_short_lived = 0;
+    // Spans predicted short-lived that outlived the threshold.
+    uint64_t mispredicted_short_lived = 0;
+    // Short-lived spans that were predicted long-lived.
+    uint64_t missed_short_lived = 0;
+  };
+
+  LifetimeObserver(PlacementPredictor& predictor, absl::Duration threshold)
+      : predictor_(predictor),
+        threshold_(absl::ToInt64Nanoseconds(threshold)) {}
+
+  void Allocated(uint64_t id, const TracedSpan& span, SpanLifetime prediction);
+  void Freed(uint64_t id, int64_t now);
+  // Reports the spans that have outlived the threshold by <now>.
+  void AdvanceTo(int64_t now);
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct Pending {
+    TracedSpan span;
+    SpanLifetime prediction;
+  };
+
+  void Report(const Pending& pending, SpanLifetime lifetime);
+
+  PlacementPredictor& predictor_;
+  const int64_t threshold_;
+  // The spans whose lifetime is not known yet, and the ids of all spans
+  // allocated, in allocation order, for AdvanceTo.  Ids of spans reported
+  // already are skipped.
+  absl::flat_hash_map<uint64_t, Pending> pending_;
+  std::deque<std::pair<int64_t, uint64_t>> by_alloc_time_;
+  Stats stats_;
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_PLACEMENT_PREDICTORS_H_
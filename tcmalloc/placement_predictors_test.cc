@@ -0,0 +1,110 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/placement_predictors.h"
+
+#include <stdint.h>
+
+#include <memory>
+
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "tcmalloc/lifetime_predictions.h"
+#include "tcmalloc/span.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+constexpr absl::Duration kThreshold = absl::Milliseconds(500);
+constexpr int64_t kThresholdNs = 500'000'000;
+
+TEST(PlacementPredictorsTest, MakePlacementPredictor) {
+  EXPECT_NE(MakePlacementPredictor("none", kThreshold), nullptr);
+  EXPECT_NE(MakePlacementPredictor("oracle", kThreshold), nullptr);
+  EXPECT_NE(MakePlacementPredictor("stack", kThreshold), nullptr);
+  EXPECT_EQ(MakePlacementPredictor("trace", kThreshold), nullptr);
+}
+
+TEST(PlacementPredictorsTest, None) {
+  NoPlacementPredictor none;
+  EXPECT_EQ(none.Predict({.alloc_time = 0, .free_time = 1}),
+            SpanLifetime::kLongLived);
+}
+
+TEST(PlacementPredictorsTest, Oracle) {
+  OraclePlacementPredictor oracle(kThreshold);
+  EXPECT_EQ(oracle.Predict({.alloc_time = 10, .free_time = 10 + 1}),
+            SpanLifetime::kShortLived);
+  EXPECT_EQ(oracle.Predict({.alloc_time = 10, .free_time = 10 + kThresholdNs}),
+            SpanLifetime::kLongLived);
+  EXPECT_EQ(oracle.Predict({.alloc_time = 10}), SpanLifetime::kLongLived);
+}
+
+TEST(PlacementPredictorsTest, StackHashLearns) {
+  StackHashPlacementPredictor predictor;
+  LifetimeObserver observer(predictor, kThreshold);
+  constexpr uint64_t kHash = 0x1234;
+
+  int64_t now = 0;
+  for (uint64_t id = 0; id < LifetimeDatabase::kMinSamples; ++id) {
+    const TracedSpan span = {.stack_hash = kHash, .alloc_time = now};
+    const SpanLifetime prediction = predictor.Predict(span);
+    EXPECT_EQ(prediction, SpanLifetime::kLongLived);
+    observer.Allocated(id, span, prediction);
+    now += 1000;
+    observer.Freed(id, now);
+  }
+  EXPECT_EQ(predictor.Predict({.stack_hash = kHash, .alloc_time = now}),
+            SpanLifetime::kShortLived);
+  // Spans without a stack are never predicted short-lived.
+  EXPECT_EQ(predictor.Predict({.alloc_time = now}), SpanLifetime::kLongLived);
+
+  const LifetimeObserver::Stats& stats = observer.stats();
+  EXPECT_EQ(stats.short_lived, LifetimeDatabase::kMinSamples);
+  EXPECT_EQ(stats.long_lived, 0);
+  EXPECT_EQ(stats.missed_short_lived, LifetimeDatabase::kMinSamples);
+}
+
+TEST(PlacementPredictorsTest, ObserverReportsAtThreshold) {
+  NoPlacementPredictor none;
+  LifetimeObserver observer(none, kThreshold);
+
+  observer.Allocated(1, {.alloc_time = 0}, SpanLifetime::kShortLived);
+  observer.Allocated(2, {.alloc_time = 100}, SpanLifetime::kLongLived);
+  observer.AdvanceTo(kThresholdNs - 1);
+  EXPECT_EQ(observer.stats().long_lived, 0);
+  observer.AdvanceTo(kThresholdNs);
+  EXPECT_EQ(observer.stats().long_lived, 1);
+  EXPECT_EQ(observer.stats().mispredicted_short_lived, 1);
+
+  // Freeing a span once it was reported does not count it again.
+  observer.Freed(1, kThresholdNs + 1);
+  // Reusing the id of a freed span tracks the new span only.
+  observer.Freed(2, kThresholdNs + 1);
+  observer.Allocated(2, {.alloc_time = kThresholdNs + 2},
+                     SpanLifetime::kShortLived);
+  observer.Freed(2, kThresholdNs + 3);
+
+  const LifetimeObserver::Stats& stats = observer.stats();
+  EXPECT_EQ(stats.long_lived, 1);
+  EXPECT_EQ(stats.short_lived, 2);
+  EXPECT_EQ(stats.predicted_short_lived, 2);
+  EXPECT_EQ(stats.mispredicted_short_lived, 1);
+  EXPECT_EQ(stats.missed_short_lived, 1);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -14,32 +14,183 @@
 
 #include "tcmalloc/profile_marshaler.h"
 
+#include <stdint.h>
+
+#include <memory>
 #include <string>
 
+#include "tcmalloc/internal/profile.pb.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/io/gzip_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "tcmalloc/internal/compact_profile.h"
 #include "tcmalloc/internal/profile_builder.h"
 
 namespace tcmalloc {
+namespace {
+
+// A compact profile stream starts with kCompactMagic and a byte of flags,
+// uncompressed, followed by the records, each preceded by its length.
+constexpr absl::string_view kCompactMagic = "TCCP";
+constexpr uint8_t kCompactCompressed = 1;
+
+}  // namespace
 
 // Marshal converts a Profile instance into a gzip-encoded, serialized
 // representation suitable for viewing with PProf
 // (https://github.com/google/pprof).
 absl::StatusOr<std::string> Marshal(const tcmalloc::Profile& profile) {
-  auto converted_or = tcmalloc_internal::MakeProfileProto(profile);
-  if (!converted_or.ok()) {
-    return converted_or.status();
-  }
-
   std::string output;
   google::protobuf::io::StringOutputStream stream(&output);
-  google::protobuf::io::GzipOutputStream gzip_stream(&stream);
-  if (!(*converted_or)->SerializeToZeroCopyStream(&gzip_stream)) {
-    return absl::InternalError("Failed to serialize to gzip stream");
+  absl::Status status = MarshalTo(profile, &stream);
+  if (!status.ok()) {
+    return status;
+  }
+  return output;
+}
+
+absl::Status MarshalTo(const tcmalloc::Profile& profile,
+                       google::protobuf::io::ZeroCopyOutputStream* output) {
+  google::protobuf::io::GzipOutputStream gzip_stream(output);
+  absl::Status status =
+      tcmalloc_internal::WriteProfileProto(profile, &gzip_stream);
+  if (!status.ok()) {
+    return status;
   }
   if (!gzip_stream.Close()) {
     return absl::InternalError("Failed to serialize to gzip stream");
   }
+  return absl::OkStatus();
+}
+
+CompactProfileWriter::CompactProfileWriter(
+    google::protobuf::io::ZeroCopyOutputStream* output)
+    : CompactProfileWriter(output, Options()) {}
+
+CompactProfileWriter::CompactProfileWriter(
+    google::protobuf::io::ZeroCopyOutputStream* output, Options options)
+    : output_(output),
+      options_(options),
+      encoder_(std::make_unique<tcmalloc_internal::CompactProfileEncoder>()) {}
+
+CompactProfileWriter::~CompactProfileWriter() {
+  if (!closed_) {
+    Close().IgnoreError();
+  }
+}
+
+absl::Status CompactProfileWriter::Write(const tcmalloc::Profile& profile) {
+  if (closed_) {
+    return absl::FailedPreconditionError("The stream is closed");
+  }
+  absl::StatusOr<std::unique_ptr<tcmalloc_internal::perftools::profiles::Profile>>
+      converted = tcmalloc_internal::MakeProfileProto(profile);
+  if (!converted.ok()) {
+    return converted.status();
+  }
+  std::string record;
+  absl::Status status = encoder_->Encode(**converted, &record);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (records_ == nullptr) {
+    google::protobuf::io::CodedOutputStream coded(output_);
+    coded.WriteRaw(kCompactMagic.data(), kCompactMagic.size());
+    const uint8_t flags = options_.compress ? kCompactCompressed : 0;
+    coded.WriteRaw(&flags, sizeof(flags));
+    if (coded.HadError()) {
+      return absl::InternalError("Failed to write the stream header");
+    }
+    records_ = output_;
+    if (options_.compress) {
+      google::protobuf::io::GzipOutputStream::Options gzip_options;
+      gzip_options.format = google::protobuf::io::GzipOutputStream::ZLIB;
+      gzip_ =
+          std::make_unique<google::protobuf::io::GzipOutputStream>(
+              output_, gzip_options);
+      records_ = gzip_.get();
+    }
+  }
+
+  {
+    google::protobuf::io::CodedOutputStream coded(records_);
+    coded.WriteVarint64(record.size());
+    coded.WriteString(record);
+    if (coded.HadError()) {
+      return absl::InternalError("Failed to write the profile");
+    }
+  }
+  if (gzip_ != nullptr && !gzip_->Flush()) {
+    return absl::InternalError("Failed to flush the compressed stream");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status CompactProfileWriter::Close() {
+  closed_ = true;
+  if (gzip_ != nullptr && !gzip_->Close()) {
+    return absl::InternalError("Failed to close the compressed stream");
+  }
+  return absl::OkStatus();
+}
+
+CompactProfileReader::CompactProfileReader(
+    google::protobuf::io::ZeroCopyInputStream* input)
+    : input_(input),
+      decoder_(std::make_unique<tcmalloc_internal::CompactProfileDecoder>()) {}
+
+CompactProfileReader::~CompactProfileReader() = default;
+
+absl::StatusOr<std::string> CompactProfileReader::Next() {
+  if (records_ == nullptr) {
+    google::protobuf::io::CodedInputStream coded(input_);
+    std::string magic;
+    uint8_t flags;
+    if (!coded.ReadString(&magic, kCompactMagic.size()) ||
+        magic != kCompactMagic || !coded.ReadRaw(&flags, sizeof(flags))) {
+      return absl::InvalidArgumentError("Not a compact profile stream");
+    }
+    records_ = input_;
+    if (flags & kCompactCompressed) {
+      gzip_ = std::make_unique<google::protobuf::io::GzipInputStream>(
+          input_, google::protobuf::io::GzipInputStream::ZLIB);
+      records_ = gzip_.get();
+    }
+  }
+
+  std::string record;
+  {
+    google::protobuf::io::CodedInputStream coded(records_);
+    const void* data;
+    int size;
+    if (!coded.GetDirectBufferPointer(&data, &size)) {
+      return absl::OutOfRangeError("End of the stream");
+    }
+    uint64_t length;
+    if (!coded.ReadVarint64(&length) ||
+        !coded.ReadString(&record, static_cast<int>(length))) {
+      return absl::InvalidArgumentError("Truncated compact profile stream");
+    }
+  }
+  absl::StatusOr<std::unique_ptr<tcmalloc_internal::perftools::profiles::Profile>>
+      profile = decoder_->Decode(record);
+  if (!profile.ok()) {
+    return profile.status();
+  }
+
+  std::string output;
+  {
+    google::protobuf::io::StringOutputStream stream(&output);
+    google::protobuf::io::GzipOutputStream gzip_stream(&stream);
+    if (!(*profile)->SerializeToZeroCopyStream(&gzip_stream) ||
+        !gzip_stream.Close()) {
+      return absl::InternalError("Failed to serialize to gzip stream");
+    }
+  }
   return output;
 }
 
@@ -15,18 +15,96 @@
 #ifndef TCMALLOC_PROFILE_MARSHALER_H_
 #define TCMALLOC_PROFILE_MARSHALER_H_
 
+#include <memory>
 #include <string>
 
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "google/protobuf/io/gzip_stream.h"
+#include "google/protobuf/io/zero_copy_stream.h"
 #include "tcmalloc/malloc_extension.h"
 
 namespace tcmalloc {
+namespace tcmalloc_internal {
+class CompactProfileDecoder;
+class CompactProfileEncoder;
+}  // namespace tcmalloc_internal
 
 // Marshal converts a Profile instance into a gzip-encoded, serialized
 // representation suitable for viewing with PProf
 // (https://github.com/google/pprof).
 absl::StatusOr<std::string> Marshal(const tcmalloc::Profile& profile);
 
+// As Marshal, but writes the encoded profile to <output> as it is produced,
+// without holding all of it, or of its profile.proto representation, in
+// memory.
+absl::Status MarshalTo(const tcmalloc::Profile& profile,
+                       google::protobuf::io::ZeroCopyOutputStream* output);
+
+// Writes a stream of profiles of this process to <output> in a compact
+// encoding, for exporting profiles often.  Successive profiles share their
+// strings, mappings and locations, which each record only has when they are
+// new to the stream (see tcmalloc/internal/compact_profile.h), and the numbers
+// are varints, delta encoded where that makes them smaller.
+//
+// CompactProfileReader converts the stream back to the profiles Marshal
+// produces.  A reader must read the stream from its start.
+class CompactProfileWriter {
+ public:
+  struct Options {
+    // Whether to compress the stream with zlib.  The compressor is flushed
+    // after each profile, so that the reader can convert it as soon as it is
+    // received, but it keeps its window across profiles.
+    bool compress = true;
+  };
+
+  explicit CompactProfileWriter(
+      google::protobuf::io::ZeroCopyOutputStream* output);
+  CompactProfileWriter(google::protobuf::io::ZeroCopyOutputStream* output,
+                       Options options);
+  // Closes the stream if Close was not called.
+  ~CompactProfileWriter();
+
+  CompactProfileWriter(const CompactProfileWriter&) = delete;
+  CompactProfileWriter& operator=(const CompactProfileWriter&) = delete;
+
+  absl::Status Write(const tcmalloc::Profile& profile);
+
+  // Ends the stream.  No profile may be written after.
+  absl::Status Close();
+
+ private:
+  google::protobuf::io::ZeroCopyOutputStream* output_;
+  const Options options_;
+  std::unique_ptr<tcmalloc_internal::CompactProfileEncoder> encoder_;
+  // Set once the header is written.
+  google::protobuf::io::ZeroCopyOutputStream* records_ = nullptr;
+  std::unique_ptr<google::protobuf::io::GzipOutputStream> gzip_;
+  bool closed_ = false;
+};
+
+// Reads a stream written by CompactProfileWriter.
+class CompactProfileReader {
+ public:
+  explicit CompactProfileReader(
+      google::protobuf::io::ZeroCopyInputStream* input);
+  ~CompactProfileReader();
+
+  CompactProfileReader(const CompactProfileReader&) = delete;
+  CompactProfileReader& operator=(const CompactProfileReader&) = delete;
+
+  // Returns the next profile of the stream, encoded as Marshal encodes it, or
+  // OutOfRange at the end of the stream.
+  absl::StatusOr<std::string> Next();
+
+ private:
+  google::protobuf::io::ZeroCopyInputStream* input_;
+  std::unique_ptr<tcmalloc_internal::CompactProfileDecoder> decoder_;
+  // Set once the header is read.
+  google::protobuf::io::ZeroCopyInputStream* records_ = nullptr;
+  std::unique_ptr<google::protobuf::io::GzipInputStream> gzip_;
+};
+
 }  // namespace tcmalloc
 
 #endif  // TCMALLOC_PROFILE_MARSHALER_H_
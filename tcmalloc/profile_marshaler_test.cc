@@ -23,12 +23,14 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/memory/memory.h"
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
 #include "absl/time/time.h"
 #include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/io/gzip_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "tcmalloc/internal/fake_profile.h"
 #include "tcmalloc/internal_malloc_extension.h"
 #include "tcmalloc/malloc_extension.h"
@@ -81,6 +83,88 @@ TEST(ProfileMarshalTest, Smoke) {
   EXPECT_EQ(converted.string_table(converted.default_sample_type()), "objects");
 }
 
+Profile MakeFakeProfile(absl::Duration duration) {
+  auto fake_profile = std::make_unique<FakeProfile>();
+  fake_profile->SetType(ProfileType::kAllocations);
+  fake_profile->SetDuration(duration);
+
+  std::vector<Profile::Sample> samples;
+  for (int i = 0; i < 10; ++i) {
+    auto& sample = samples.emplace_back();
+
+    sample.sum = 1234 * (i + 1);
+    sample.count = 2;
+    sample.requested_size = 617 * (i + 1);
+    sample.allocated_size = 617 * (i + 1);
+  }
+  fake_profile->SetSamples(std::move(samples));
+
+  return tcmalloc_internal::ProfileAccessor::MakeProfile(
+      std::move(fake_profile));
+}
+
+perftools::profiles::Profile Parse(absl::string_view encoded) {
+  google::protobuf::io::ArrayInputStream stream(encoded.data(), encoded.size());
+  google::protobuf::io::GzipInputStream gzip_stream(&stream);
+  google::protobuf::io::CodedInputStream coded_stream(&gzip_stream);
+
+  perftools::profiles::Profile converted;
+  EXPECT_TRUE(converted.ParseFromCodedStream(&coded_stream));
+  return converted;
+}
+
+class CompactProfileStreamTest : public testing::TestWithParam<bool> {};
+
+TEST_P(CompactProfileStreamTest, RoundTrip) {
+  const absl::Duration kDurations[] = {absl::Milliseconds(1500),
+                                       absl::Seconds(2), absl::Seconds(3)};
+
+  std::string stream;
+  {
+    google::protobuf::io::StringOutputStream output(&stream);
+    CompactProfileWriter::Options options;
+    options.compress = GetParam();
+    CompactProfileWriter writer(&output, options);
+    for (absl::Duration duration : kDurations) {
+      ASSERT_TRUE(writer.Write(MakeFakeProfile(duration)).ok());
+    }
+    ASSERT_TRUE(writer.Close().ok());
+    EXPECT_FALSE(writer.Write(MakeFakeProfile(kDurations[0])).ok());
+  }
+
+  google::protobuf::io::ArrayInputStream input(stream.data(), stream.size());
+  CompactProfileReader reader(&input);
+  for (absl::Duration duration : kDurations) {
+    absl::StatusOr<std::string> encoded = reader.Next();
+    ASSERT_TRUE(encoded.ok()) << encoded.status();
+    absl::StatusOr<std::string> expected = Marshal(MakeFakeProfile(duration));
+    ASSERT_TRUE(expected.ok());
+
+    const perftools::profiles::Profile converted = Parse(*encoded);
+    const perftools::profiles::Profile reference = Parse(*expected);
+    EXPECT_EQ(converted.duration_nanos(), absl::ToInt64Nanoseconds(duration));
+    EXPECT_EQ(converted.string_table(converted.default_sample_type()),
+              reference.string_table(reference.default_sample_type()));
+    EXPECT_EQ(converted.string_table(converted.drop_frames()),
+              reference.string_table(reference.drop_frames()));
+    EXPECT_EQ(converted.sample_size(), reference.sample_size());
+    EXPECT_EQ(converted.sample_type_size(), reference.sample_type_size());
+  }
+  EXPECT_EQ(reader.Next().status().code(), absl::StatusCode::kOutOfRange);
+}
+
+INSTANTIATE_TEST_SUITE_P(Compression, CompactProfileStreamTest,
+                         testing::Bool());
+
+TEST(CompactProfileReaderTest, RejectsOtherStreams) {
+  absl::StatusOr<std::string> encoded =
+      Marshal(MakeFakeProfile(absl::Seconds(1)));
+  ASSERT_TRUE(encoded.ok());
+  google::protobuf::io::ArrayInputStream input(encoded->data(), encoded->size());
+  CompactProfileReader reader(&input);
+  EXPECT_EQ(reader.Next().status().code(), absl::StatusCode::kInvalidArgument);
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <atomic>
 #include <memory>
@@ -353,5 +354,40 @@ TEST(FragmentationzTest, Accuracy) {
       << " requested = " << requested_size << " count = " << count;
 }
 
+// The pinned memory profile charges each sample at least as much as the
+// fragmentation profile: the free space on its span, plus a share of the free
+// pages of its hugepage.
+TEST(PinnedMemoryzTest, IncludesFragmentation) {
+  ScopedProfileSamplingInterval ps(512 * 1024);
+  ScopedGuardedSamplingInterval gs(-1);
+
+  static const size_t kItemSize = 115;
+  static const size_t kNumItems = 1024 * 1024;
+
+  std::vector<std::unique_ptr<char[]>> keep;
+  std::vector<std::unique_ptr<char[]>> drop;
+  drop.reserve(kNumItems * 8 / 10);
+  keep.reserve(kNumItems * 2 / 10);
+  for (int i = 0; i < kNumItems; ++i) {
+    (i % 5 == 0 ? keep : drop)
+        .push_back(std::unique_ptr<char[]>(
+            static_cast<char*>(::operator new[](kItemSize))));
+  }
+  drop.resize(0);
+
+  auto sum_of = [](ProfileType type) {
+    int64_t sum = 0;
+    MallocExtension::SnapshotCurrent(type).Iterate(
+        [&](const Profile::Sample& e) {
+          if (e.requested_size == kItemSize) sum += e.sum;
+        });
+    return sum;
+  };
+  const int64_t frag_bytes = sum_of(ProfileType::kFragmentation);
+  const int64_t pinned_bytes = sum_of(ProfileType::kPinnedMemory);
+  EXPECT_GT(frag_bytes, 0);
+  EXPECT_GE(pinned_bytes, frag_bytes);
+}
+
 }  // namespace
 }  // namespace tcmalloc
@@ -0,0 +1,62 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/reclaim_notifier.h"
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/spinlock.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+bool ReclaimNotifier::Register(Callback callback, void* arg) {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  for (Entry& e : entries_) {
+    if (e.callback == nullptr) {
+      e = {callback, arg};
+      return true;
+    }
+  }
+  return false;
+}
+
+void ReclaimNotifier::Unregister(Callback callback, void* arg) {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  for (Entry& e : entries_) {
+    if (e.callback == callback && e.arg == arg) {
+      e = {nullptr, nullptr};
+      return;
+    }
+  }
+}
+
+void ReclaimNotifier::Notify() {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  for (const Entry& e : entries_) {
+    if (e.callback != nullptr) {
+      e.callback(e.arg);
+    }
+  }
+}
+
+ReclaimNotifier& reclaim_notifier() {
+  ABSL_CONST_INIT static ReclaimNotifier notifier;
+  return notifier;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
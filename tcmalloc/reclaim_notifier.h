@@ -0,0 +1,69 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_RECLAIM_NOTIFIER_H_
+#define TCMALLOC_RECLAIM_NOTIFIER_H_
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/malloc_extension.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Calls the callbacks registered with MallocExtension::RegisterReclaimCallback
+// when the background thread reclaims idle per-CPU caches, so that caches
+// kept outside of TCMalloc can shrink with them.
+class ReclaimNotifier {
+ public:
+  using Callback = MallocExtension::ReclaimCallback;
+
+  static constexpr int kMaxCallbacks = 64;
+
+  constexpr ReclaimNotifier() = default;
+
+  ReclaimNotifier(const ReclaimNotifier&) = delete;
+  ReclaimNotifier& operator=(const ReclaimNotifier&) = delete;
+
+  // Returns false if kMaxCallbacks are registered already.
+  bool Register(Callback callback, void* arg) ABSL_LOCKS_EXCLUDED(lock_);
+  // Unregisters <callback> with <arg>, waiting for a notification in progress
+  // to finish, so that <arg> may be destroyed as soon as this returns.
+  void Unregister(Callback callback, void* arg) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Calls each callback with its argument.  Callbacks run under lock_, so
+  // they must not register or unregister callbacks.  The caller must not hold
+  // any allocator locks.
+  void Notify() ABSL_LOCKS_EXCLUDED(lock_);
+
+ private:
+  struct Entry {
+    Callback callback;
+    void* arg;
+  };
+
+  absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  Entry entries_[kMaxCallbacks] ABSL_GUARDED_BY(lock_) = {};
+};
+
+ReclaimNotifier& reclaim_notifier();
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_RECLAIM_NOTIFIER_H_
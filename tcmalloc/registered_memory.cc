@@ -0,0 +1,127 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/registered_memory.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/spinlock.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/system-alloc.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+ABSL_CONST_INIT RegisteredHeap heap;
+
+}  // namespace
+
+RegisteredHeap& registered_heap() { return heap; }
+
+bool RegisteredHeap::Init(AddressRegionFactory* factory,
+                          MallocExtension::RegisterMemoryCallback callback) {
+  TC_CHECK_NE(factory, nullptr);
+  TC_CHECK_NE(callback, nullptr);
+  absl::base_internal::SpinLockHolder h(&lock_);
+  if (factory_ != nullptr) return false;
+  factory_ = factory;
+  callback_ = callback;
+  return true;
+}
+
+void* RegisteredHeap::Allocate(size_t size) {
+  if (size > kMaxSize) return nullptr;
+  const size_t size_class = SizeClass(size);
+  const size_t class_size = ClassToSize(size_class);
+
+  absl::base_internal::SpinLockHolder h(&lock_);
+  if (factory_ == nullptr) return nullptr;
+  void* result;
+  if (FreeBuffer* buffer = free_[size_class]; buffer != nullptr) {
+    free_[size_class] = buffer->next;
+    result = buffer;
+  } else {
+    if (carve_[size_class] % kHugePageSize == 0) {
+      const uintptr_t hugepage = NewHugePage();
+      if (hugepage == 0) return nullptr;
+      carve_[size_class] = hugepage;
+    }
+    result = reinterpret_cast<void*>(carve_[size_class]);
+    carve_[size_class] += class_size;
+  }
+  stats_.allocated_bytes += class_size;
+  return result;
+}
+
+void RegisteredHeap::Deallocate(void* ptr, size_t size) {
+  if (ptr == nullptr) return;
+  TC_ASSERT_LE(size, kMaxSize);
+  const size_t size_class = SizeClass(size);
+  TC_ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) % ClassToSize(size_class), 0);
+
+  absl::base_internal::SpinLockHolder h(&lock_);
+  FreeBuffer* buffer = static_cast<FreeBuffer*>(ptr);
+  buffer->next = free_[size_class];
+  free_[size_class] = buffer;
+  stats_.allocated_bytes -= ClassToSize(size_class);
+}
+
+RegisteredHeap::Stats RegisteredHeap::stats() const {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  return stats_;
+}
+
+uintptr_t RegisteredHeap::NewHugePage() {
+  if (spare_ < spare_end_) {
+    const uintptr_t hugepage = spare_;
+    spare_ += kHugePageSize;
+    return hugepage;
+  }
+
+  // A region that is out of memory is left behind: its remainder is smaller
+  // than a hugepage, so there is nothing worth tracking.
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    if (region_ == nullptr) {
+      region_ = SystemCreateRegion(
+          factory_, AddressRegionFactory::UsageHint::kRegistered);
+      if (region_ == nullptr) return 0;
+    }
+    auto [ptr, actual] =
+        SystemRegionAlloc(region_, kHugePageSize, kHugePageSize);
+    if (ptr == nullptr) {
+      region_ = nullptr;
+      continue;
+    }
+    TC_CHECK_GE(actual, kHugePageSize);
+    const uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+    TC_CHECK_EQ(start % kHugePageSize, 0);
+    callback_(ptr, actual);
+    stats_.registered_bytes += actual;
+    spare_ = start + kHugePageSize;
+    spare_end_ = start + actual / kHugePageSize * kHugePageSize;
+    return start;
+  }
+  return 0;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
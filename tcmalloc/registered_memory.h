@@ -0,0 +1,119 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_REGISTERED_MEMORY_H_
+#define TCMALLOC_REGISTERED_MEMORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/numeric/bits.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/malloc_extension.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// The heap of MallocExtension::AllocateRegistered.  Its memory comes from the
+// AddressRegionFactory given to Init, a hugepage at a time, and each range the
+// factory's regions hand out is passed to the registration callback once,
+// before any buffer is carved out of it.  Registering memory with devices is
+// expensive and pins it, so the heap never returns memory: freed buffers are
+// reused for buffers of the same size class.
+//
+// Buffers are rounded up to a power of two from kMinSize to kMaxSize bytes and
+// aligned to their size.  Each size class carves its buffers out of hugepages
+// of its own.
+class RegisteredHeap {
+ public:
+  static constexpr size_t kMinSize = 64;
+  static constexpr size_t kMaxSize = kHugePageSize;
+
+  struct Stats {
+    // The memory passed to the registration callback.
+    size_t registered_bytes = 0;
+    // The size of the buffers allocated and not yet freed, after rounding.
+    size_t allocated_bytes = 0;
+  };
+
+  constexpr RegisteredHeap() = default;
+
+  RegisteredHeap(const RegisteredHeap&) = delete;
+  RegisteredHeap& operator=(const RegisteredHeap&) = delete;
+
+  // Sets the factory of the regions backing the heap and the callback that
+  // registers their memory.  Returns false if the heap already has a factory.
+  bool Init(AddressRegionFactory* factory,
+            MallocExtension::RegisterMemoryCallback callback)
+      ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Returns <size> bytes of registered memory, or nullptr if the heap has no
+  // factory, <size> exceeds kMaxSize or the factory is out of memory.
+  void* Allocate(size_t size) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Frees <ptr>, which Allocate returned for <size> bytes.
+  void Deallocate(void* ptr, size_t size) ABSL_LOCKS_EXCLUDED(lock_);
+
+  Stats stats() const ABSL_LOCKS_EXCLUDED(lock_);
+
+ private:
+  static constexpr size_t kMinSizeShift = 6;
+  static_assert(kMinSize == size_t{1} << kMinSizeShift);
+  static constexpr size_t kNumClasses = kHugePageShift - kMinSizeShift + 1;
+
+  static size_t SizeClass(size_t size) {
+    return absl::bit_width(std::max(size, kMinSize) - 1) - kMinSizeShift;
+  }
+  static size_t ClassToSize(size_t size_class) {
+    return kMinSize << size_class;
+  }
+
+  // Returns a registered hugepage, or nullptr if the factory is out of memory.
+  uintptr_t NewHugePage() ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  struct FreeBuffer {
+    FreeBuffer* next;
+  };
+
+  mutable absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  AddressRegionFactory* factory_ ABSL_GUARDED_BY(lock_) = nullptr;
+  MallocExtension::RegisterMemoryCallback callback_ ABSL_GUARDED_BY(lock_) =
+      nullptr;
+  // The region hugepages are allocated from, once the heap needed one.
+  AddressRegion* region_ ABSL_GUARDED_BY(lock_) = nullptr;
+  // Registered hugepages that no size class has taken yet.
+  uintptr_t spare_ ABSL_GUARDED_BY(lock_) = 0;
+  uintptr_t spare_end_ ABSL_GUARDED_BY(lock_) = 0;
+  // The freed buffers of each size class.
+  FreeBuffer* free_[kNumClasses] ABSL_GUARDED_BY(lock_) = {};
+  // The next buffer to carve out of the current hugepage of each size class.
+  // Once it reaches the end of the hugepage, the class needs a new one.
+  uintptr_t carve_[kNumClasses] ABSL_GUARDED_BY(lock_) = {};
+  Stats stats_ ABSL_GUARDED_BY(lock_);
+};
+
+// The heap of MallocExtension::AllocateRegistered.
+RegisteredHeap& registered_heap();
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_REGISTERED_MEMORY_H_
@@ -0,0 +1,259 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/release_requests.h"
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/strings/numbers.h"
+#include "absl/time/time.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/cpu_cache.h"
+#include "tcmalloc/internal/background_wakeup.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/environment.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/sysinfo.h"
+#include "tcmalloc/internal_malloc_extension.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/page_allocator.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/static_vars.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+void ReleaseRequests::HandleReleaseSignal(int, siginfo_t* info, void*) {
+  // Only async-signal-safe operations: atomics and a futex wake.
+  if (info != nullptr && info->si_code == SI_QUEUE) {
+    const Request r =
+        DecodeSignalValue(static_cast<uint32_t>(info->si_value.sival_int));
+    release_requests().Add(r.bytes, r.within, r.level);
+  } else {
+    release_requests().Add(std::numeric_limits<size_t>::max(),
+                           absl::ZeroDuration(), CacheShrinkLevel::kIdle);
+  }
+}
+
+void ReleaseRequests::Init() {
+  const char* e = thread_safe_getenv("TCMALLOC_RELEASE_SIGNAL");
+  if (e == nullptr) {
+    return;
+  }
+  int signo;
+  if (!absl::SimpleAtoi(e, &signo) || signo <= 0 || signo >= NSIG) {
+    TC_LOG("Ignoring invalid TCMALLOC_RELEASE_SIGNAL: %s", e);
+    return;
+  }
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = &ReleaseRequests::HandleReleaseSignal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART | SA_SIGINFO;
+  if (sigaction(signo, &action, nullptr) != 0) {
+    TC_LOG("Failed to install the release request handler for signal %v",
+           signo);
+  }
+}
+
+ReleaseRequests::Request ReleaseRequests::DecodeSignalValue(uint32_t value) {
+  const uint32_t mib = value & ((uint32_t{1} << kSignalMiBBits) - 1);
+  value >>= kSignalMiBBits;
+  const uint32_t seconds = value & ((uint32_t{1} << kSignalSecondsBits) - 1);
+  value >>= kSignalSecondsBits;
+  const uint32_t level = value & ((uint32_t{1} << kSignalLevelBits) - 1);
+  return {size_t{mib} << 20, absl::Seconds(seconds),
+          static_cast<CacheShrinkLevel>(
+              std::min(level, static_cast<uint32_t>(CacheShrinkLevel::kAll)))};
+}
+
+void ReleaseRequests::Add(size_t bytes, absl::Duration within,
+                          CacheShrinkLevel level) {
+  if (bytes == 0 && level == CacheShrinkLevel::kNone) {
+    return;
+  }
+  requests_.fetch_add(1, std::memory_order_relaxed);
+
+  const int64_t ns =
+      absl::ToInt64Nanoseconds(std::max(within, absl::ZeroDuration()));
+  int64_t old_ns = within_ns_.load(std::memory_order_relaxed);
+  while (ns < old_ns && !within_ns_.compare_exchange_weak(
+                            old_ns, ns, std::memory_order_relaxed)) {
+  }
+  int old_level = shrink_level_.load(std::memory_order_relaxed);
+  while (static_cast<int>(level) > old_level &&
+         !shrink_level_.compare_exchange_weak(old_level,
+                                              static_cast<int>(level),
+                                              std::memory_order_relaxed)) {
+  }
+  // Saturate, so that a request for everything stays one.
+  size_t old_bytes = pending_bytes_.load(std::memory_order_relaxed);
+  size_t new_bytes;
+  do {
+    new_bytes = bytes > std::numeric_limits<size_t>::max() - old_bytes
+                    ? std::numeric_limits<size_t>::max()
+                    : old_bytes + bytes;
+  } while (!pending_bytes_.compare_exchange_weak(old_bytes, new_bytes,
+                                                 std::memory_order_relaxed));
+
+  new_request_.store(true, std::memory_order_release);
+  tc_globals.background_wakeup().Notify(BackgroundWakeup::kReleaseRequest);
+}
+
+bool ReleaseRequests::AddAsync(size_t bytes, ReleaseCallback callback,
+                               void* arg) {
+  {
+    absl::base_internal::SpinLockHolder h(&lock_);
+    if (num_async_ == kMaxAsync) return false;
+    async_[num_async_++] = {bytes, callback, arg};
+  }
+  async_requests_.fetch_add(1, std::memory_order_relaxed);
+  async_pending_.store(true, std::memory_order_release);
+  tc_globals.background_wakeup().Notify(BackgroundWakeup::kReleaseRequest);
+  return true;
+}
+
+size_t ReleaseRequests::ReleaseInChunks(size_t bytes) {
+  size_t released = 0;
+  while (released < bytes) {
+    const Length n =
+        std::min(kReleaseChunk, BytesToLengthCeil(bytes - released));
+    Length chunk;
+    {
+      PageHeapSpinLockHolder l;
+      chunk = tc_globals.page_allocator().ReleaseAtLeastNPages(
+          n, PageReleaseReason::kReleaseMemoryToSystem);
+    }
+    if (chunk == Length(0)) break;
+    released += chunk.in_bytes();
+  }
+  return released;
+}
+
+size_t ReleaseRequests::BytesDueNow(size_t pending, absl::Duration time_left,
+                                    absl::Duration sleep_time) {
+  if (time_left <= sleep_time || sleep_time <= absl::ZeroDuration()) {
+    return pending;
+  }
+  // Release evenly over the sleep intervals left, rounding up so that the
+  // last one is not left with more than its share.
+  const double share = absl::FDivDuration(sleep_time, time_left);
+  return std::min(pending,
+                  static_cast<size_t>(static_cast<double>(pending) * share) + 1);
+}
+
+void ShrinkCaches(MallocExtension::CacheShrinkLevel level) {
+  using CacheShrinkLevel = MallocExtension::CacheShrinkLevel;
+  if (level == CacheShrinkLevel::kNone) return;
+  // As in ForkChild, but only draining all the per-CPU caches for kAll; for
+  // kIdle, only those that went unused since the last reclaim are.
+  if (tc_globals.CpuCacheActive()) {
+    if (level == CacheShrinkLevel::kAll) {
+      const int num_cpus = NumCPUs();
+      for (int cpu = 0; cpu < num_cpus; ++cpu) {
+        MallocExtension_Internal_ReleaseCpuMemory(cpu);
+      }
+    } else {
+      tc_globals.cpu_cache().TryReclaimingCaches();
+    }
+  }
+  tc_globals.sharded_transfer_cache().Plunder();
+#ifndef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
+  // The first pass plunders the objects that went unused since the last one,
+  // and the second the rest.
+  tc_globals.transfer_cache().TryPlunder();
+  if (level == CacheShrinkLevel::kAll) {
+    tc_globals.transfer_cache().TryPlunder();
+  }
+#endif
+  for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+    tc_globals.central_freelist(size_class).UpdateSpanCache(/*trim=*/true);
+  }
+}
+
+size_t ReleaseRequests::Process(absl::Duration sleep_time) {
+  // The caches are shrunk first, so that the memory they free is released.
+  const int level = shrink_level_.exchange(0, std::memory_order_relaxed);
+  if (level != 0) {
+    cache_shrinks_.fetch_add(1, std::memory_order_relaxed);
+    ShrinkCaches(static_cast<CacheShrinkLevel>(level));
+  }
+
+  size_t released = 0;
+  if (async_pending_.exchange(false, std::memory_order_acquire)) {
+    AsyncRequest requests[kMaxAsync];
+    int n;
+    {
+      absl::base_internal::SpinLockHolder h(&lock_);
+      n = num_async_;
+      for (int i = 0; i < n; ++i) {
+        requests[i] = async_[i];
+      }
+      num_async_ = 0;
+    }
+    // The callbacks run without lock_, so that they may make new requests.
+    for (int i = 0; i < n; ++i) {
+      const size_t bytes = ReleaseInChunks(requests[i].bytes);
+      released_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+      released += bytes;
+      if (requests[i].callback != nullptr) {
+        requests[i].callback(bytes, requests[i].arg);
+      }
+    }
+  }
+
+  const absl::Time now = absl::Now();
+  if (new_request_.exchange(false, std::memory_order_acquire)) {
+    const int64_t ns =
+        within_ns_.exchange(INT64_MAX, std::memory_order_relaxed);
+    deadline_ = std::min(deadline_, now + absl::Nanoseconds(ns));
+  }
+  const size_t pending = pending_bytes();
+  if (pending == 0) {
+    deadline_ = absl::InfiniteFuture();
+    return released;
+  }
+
+  const size_t due = BytesDueNow(pending, deadline_ - now, sleep_time);
+  const size_t bytes = ReleaseInChunks(due);
+  released_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+  released += bytes;
+  // Requests are best effort: bytes that could not be released when they were
+  // due are dropped rather than retried.  Add only grows pending_bytes_, so it
+  // stays at least <due>.
+  pending_bytes_.fetch_sub(due, std::memory_order_relaxed);
+  if (due == pending) {
+    deadline_ = absl::InfiniteFuture();
+  }
+  return released;
+}
+
+ReleaseRequests& release_requests() {
+  ABSL_CONST_INIT static ReleaseRequests requests;
+  return requests;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,174 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_RELEASE_REQUESTS_H_
+#define TCMALLOC_RELEASE_REQUESTS_H_
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/time/time.h"
+#include "tcmalloc/huge_pages.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/pages.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Requests from outside the allocator, e.g. a node memory agent, to release
+// memory within a deadline and to shrink the caches, made with
+// MallocExtension::RequestMemoryRelease or by signal.  The background thread
+// (see MallocExtension::ProcessBackgroundActions) carries them out, spreading
+// the release over the time it is given, so that giving memory back does not
+// stall the application.
+//
+// If TCMALLOC_RELEASE_SIGNAL is set to a signal number, receiving that signal
+// requests a release.  A signal queued with sigqueue carries the request in
+// its value (see DecodeSignalValue); any other asks for all free memory right
+// away, and for the idle caches to be shrunk.
+//
+// Requests merge: the bytes add up, the earliest deadline and the highest
+// shrink level win.
+//
+// MallocExtension::ReleaseMemoryToSystemAsync requests are kept apart, as each
+// has its own completion callback, and are released as soon as the background
+// thread gets to them.
+//
+// Both kinds are released kReleaseChunk at a time, taking pageheap_lock once
+// per chunk, so that allocating threads wait for at most one chunk.
+class ReleaseRequests {
+ public:
+  using CacheShrinkLevel = MallocExtension::CacheShrinkLevel;
+  using ReleaseCallback = MallocExtension::ReleaseCallback;
+
+  static constexpr Length kReleaseChunk = NHugePages(4).in_pages();
+  static constexpr int kMaxAsync = 16;
+
+  // Layout of the value of a queued release signal: the MiB to release in the
+  // low bits, then the seconds to release them within, then the
+  // CacheShrinkLevel.
+  static constexpr int kSignalMiBBits = 20;
+  static constexpr int kSignalSecondsBits = 8;
+  static constexpr int kSignalLevelBits = 2;
+
+  struct Request {
+    size_t bytes;
+    absl::Duration within;
+    CacheShrinkLevel level;
+  };
+
+  constexpr ReleaseRequests() = default;
+
+  ReleaseRequests(const ReleaseRequests&) = delete;
+  ReleaseRequests& operator=(const ReleaseRequests&) = delete;
+
+  // Installs the release signal handler.  Called once, when TCMalloc
+  // initializes.
+  void Init();
+
+  // Records a request to release <bytes> within <within> and to shrink the
+  // caches to <level>.  Async-signal-safe: it only touches atomics, and wakes
+  // the background thread.
+  void Add(size_t bytes, absl::Duration within, CacheShrinkLevel level);
+
+  // Records a request to release <bytes> as soon as possible, after which
+  // <callback>, if not null, is called with the bytes released and <arg> on
+  // the background thread.  Returns false, and drops the request, if
+  // kMaxAsync requests are pending already.
+  bool AddAsync(size_t bytes, ReleaseCallback callback, void* arg)
+      ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Shrinks the caches and releases the share of the pending bytes due in
+  // this sleep interval of <sleep_time>.  Returns the bytes released.  Called
+  // by the background thread.
+  size_t Process(absl::Duration sleep_time) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Releases at least <bytes>, or as much as there is, kReleaseChunk at a
+  // time.  Returns the bytes released.  The caller must not hold
+  // pageheap_lock.
+  static size_t ReleaseInChunks(size_t bytes);
+
+  // The bytes to release now, out of <pending> due in <time_left>, when the
+  // next chance comes after <sleep_time>.
+  static size_t BytesDueNow(size_t pending, absl::Duration time_left,
+                            absl::Duration sleep_time);
+
+  // The request carried in the value of a queued release signal.
+  static Request DecodeSignalValue(uint32_t value);
+
+  // The bytes requested and not yet released.
+  size_t pending_bytes() const {
+    return pending_bytes_.load(std::memory_order_relaxed);
+  }
+
+  int64_t requests() const { return requests_.load(std::memory_order_relaxed); }
+  int64_t released_bytes() const {
+    return released_bytes_.load(std::memory_order_relaxed);
+  }
+  int64_t cache_shrinks() const {
+    return cache_shrinks_.load(std::memory_order_relaxed);
+  }
+  int64_t async_requests() const {
+    return async_requests_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct AsyncRequest {
+    size_t bytes;
+    ReleaseCallback callback;
+    void* arg;
+  };
+  static void HandleReleaseSignal(int signo, siginfo_t* info, void* context);
+
+  std::atomic<size_t> pending_bytes_{0};
+  // The time left for the pending bytes when the latest request came, and the
+  // level to shrink the caches to, which Process consumes.
+  std::atomic<int64_t> within_ns_{INT64_MAX};
+  std::atomic<int> shrink_level_{0};
+  std::atomic<bool> new_request_{false};
+  // Only touched by Process.
+  absl::Time deadline_ = absl::InfiniteFuture();
+
+  absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  AsyncRequest async_[kMaxAsync] ABSL_GUARDED_BY(lock_) = {};
+  int num_async_ ABSL_GUARDED_BY(lock_) = 0;
+  // Lets Process skip taking lock_ when no async request is pending.
+  std::atomic<bool> async_pending_{false};
+
+  std::atomic<int64_t> requests_{0};
+  std::atomic<int64_t> async_requests_{0};
+  std::atomic<int64_t> released_bytes_{0};
+  std::atomic<int64_t> cache_shrinks_{0};
+};
+
+ReleaseRequests& release_requests();
+
+// Shrinks the per-CPU caches, transfer caches and central freelist span
+// caches to <level>, so that the memory they free may be released.  Called by
+// the background thread.
+void ShrinkCaches(MallocExtension::CacheShrinkLevel level);
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_RELEASE_REQUESTS_H_
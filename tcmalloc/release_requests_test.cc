@@ -0,0 +1,107 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/release_requests.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <limits>
+
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+using CacheShrinkLevel = MallocExtension::CacheShrinkLevel;
+
+TEST(ReleaseRequestsTest, BytesDueNow) {
+  const absl::Duration sleep_time = absl::Seconds(1);
+  // Due within the next interval, or right away.
+  EXPECT_EQ(ReleaseRequests::BytesDueNow(1000, absl::Seconds(1), sleep_time),
+            1000);
+  EXPECT_EQ(ReleaseRequests::BytesDueNow(1000, absl::ZeroDuration(),
+                                         sleep_time),
+            1000);
+  EXPECT_EQ(ReleaseRequests::BytesDueNow(1000, -absl::Seconds(3), sleep_time),
+            1000);
+  // Spread evenly over the intervals left.
+  EXPECT_EQ(ReleaseRequests::BytesDueNow(1000, absl::Seconds(4), sleep_time),
+            251);
+  EXPECT_EQ(ReleaseRequests::BytesDueNow(1 << 20, absl::Seconds(10),
+                                         absl::Milliseconds(500)),
+            (1 << 20) / 20 + 1);
+  EXPECT_EQ(ReleaseRequests::BytesDueNow(0, absl::Seconds(4), sleep_time), 0);
+}
+
+TEST(ReleaseRequestsTest, DecodeSignalValue) {
+  ReleaseRequests::Request r = ReleaseRequests::DecodeSignalValue(0);
+  EXPECT_EQ(r.bytes, 0);
+  EXPECT_EQ(r.within, absl::ZeroDuration());
+  EXPECT_EQ(r.level, CacheShrinkLevel::kNone);
+
+  r = ReleaseRequests::DecodeSignalValue(512 | (30 << 20) | (1 << 28));
+  EXPECT_EQ(r.bytes, size_t{512} << 20);
+  EXPECT_EQ(r.within, absl::Seconds(30));
+  EXPECT_EQ(r.level, CacheShrinkLevel::kIdle);
+
+  r = ReleaseRequests::DecodeSignalValue(std::numeric_limits<uint32_t>::max());
+  EXPECT_EQ(r.bytes, ((size_t{1} << 20) - 1) << 20);
+  EXPECT_EQ(r.within, absl::Seconds(255));
+  EXPECT_EQ(r.level, CacheShrinkLevel::kAll);
+}
+
+TEST(ReleaseRequestsTest, Merge) {
+  ReleaseRequests requests;
+  requests.Add(0, absl::Seconds(1), CacheShrinkLevel::kNone);
+  EXPECT_EQ(requests.requests(), 0);
+  EXPECT_EQ(requests.pending_bytes(), 0);
+
+  requests.Add(1 << 20, absl::Seconds(10), CacheShrinkLevel::kNone);
+  requests.Add(1 << 20, absl::Seconds(5), CacheShrinkLevel::kIdle);
+  EXPECT_EQ(requests.requests(), 2);
+  EXPECT_EQ(requests.pending_bytes(), 2 << 20);
+
+  // A request for everything saturates.
+  requests.Add(std::numeric_limits<size_t>::max(), absl::ZeroDuration(),
+               CacheShrinkLevel::kNone);
+  EXPECT_EQ(requests.pending_bytes(), std::numeric_limits<size_t>::max());
+}
+
+TEST(ReleaseRequestsTest, Async) {
+  ReleaseRequests requests;
+  int calls = 0;
+  auto callback = [](size_t bytes_released, void* arg) {
+    EXPECT_EQ(bytes_released, 0);
+    ++*static_cast<int*>(arg);
+  };
+  for (int i = 0; i < ReleaseRequests::kMaxAsync; ++i) {
+    EXPECT_TRUE(requests.AddAsync(0, callback, &calls));
+  }
+  EXPECT_FALSE(requests.AddAsync(0, callback, &calls));
+  EXPECT_EQ(requests.async_requests(), ReleaseRequests::kMaxAsync);
+
+  EXPECT_EQ(requests.Process(absl::Seconds(1)), 0);
+  EXPECT_EQ(calls, ReleaseRequests::kMaxAsync);
+  EXPECT_TRUE(requests.AddAsync(0, nullptr, nullptr));
+  EXPECT_EQ(requests.Process(absl::Seconds(1)), 0);
+  EXPECT_EQ(calls, ReleaseRequests::kMaxAsync);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
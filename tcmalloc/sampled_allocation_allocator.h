@@ -45,14 +45,15 @@ class SampledAllocationAllocator {
     allocator_.Init(arena);
   }
 
-  SampledAllocation* New(StackTrace stack_trace)
-      ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+  // Constructs a SampledAllocation from <args>.
+  template <typename... Targs>
+  SampledAllocation* New(Targs&&... args) ABSL_LOCKS_EXCLUDED(pageheap_lock) {
     SampledAllocation* s;
     {
       PageHeapSpinLockHolder l;
       s = allocator_.New();
     }
-    return new (s) SampledAllocation(std::move(stack_trace));
+    return new (s) SampledAllocation(std::forward<Targs>(args)...);
   }
 
   void Delete(SampledAllocation* s) ABSL_LOCKS_EXCLUDED(pageheap_lock) {
@@ -14,17 +14,37 @@
 
 #include "tcmalloc/sampled_allocation_allocator.h"
 
+#include <stddef.h>
+
+#include <cstddef>
+#include <new>
+
 #include "gtest/gtest.h"
 #include "absl/debugging/stacktrace.h"
+#include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/stack_depot.h"
 
 namespace tcmalloc {
 namespace tcmalloc_internal {
 namespace {
 
+// The depot never frees, so allocate its entries from a buffer.
+void* AllocFromBuffer(size_t bytes, std::align_val_t alignment) {
+  alignas(std::max_align_t) static char buffer[1 << 12];
+  static size_t used = 0;
+  const size_t align = static_cast<size_t>(alignment);
+  used = (used + align - 1) & ~(align - 1);
+  TC_CHECK_LE(used + bytes, sizeof(buffer));
+  void* result = &buffer[used];
+  used += bytes;
+  return result;
+}
+
 TEST(SampledAllocationAllocatorTest, AllocAndDealloc) {
   Arena arena;
+  StackDepot depot(&AllocFromBuffer);
   SampledAllocationAllocator allocator;
   {
     PageHeapSpinLockHolder l;
@@ -34,8 +54,10 @@ TEST(SampledAllocationAllocatorTest, AllocAndDealloc) {
   st.depth = absl::GetStackTrace(st.stack, kMaxStackDepth, /* skip_count= */ 0);
   st.requested_size = 8;
   st.allocated_size = 8;
-  SampledAllocation* sampled_allocation = allocator.New(st);
-  EXPECT_GT(sampled_allocation->sampled_stack.depth, 0);
+  SampledAllocation* sampled_allocation =
+      allocator.New(st, depot);
+  EXPECT_EQ(sampled_allocation->stack(),
+            absl::MakeConstSpan(st.stack, st.depth));
   EXPECT_EQ(sampled_allocation->sampled_stack.requested_size, 8);
   EXPECT_EQ(sampled_allocation->sampled_stack.allocated_size, 8);
   allocator.Delete(sampled_allocation);
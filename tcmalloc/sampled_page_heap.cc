@@ -0,0 +1,210 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/sampled_page_heap.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <new>
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/numeric/bits.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/atomic_stats_counter.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/sampled_allocation.h"
+#include "tcmalloc/page_allocator.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/parameters.h"
+#include "tcmalloc/sampler.h"
+#include "tcmalloc/span.h"
+#include "tcmalloc/static_vars.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+size_t SampledPageHeap::SlotSize(size_t size, size_t align) {
+  const size_t slot_size =
+      std::max(absl::bit_ceil(std::max(size, align)), kMinSlotSize);
+  return slot_size <= kMaxSlotSize ? slot_size : 0;
+}
+
+int SampledPageHeap::SlotSizeIndex(size_t slot_size) {
+  TC_ASSERT(absl::has_single_bit(slot_size));
+  TC_ASSERT_GE(slot_size, kMinSlotSize);
+  TC_ASSERT_LE(slot_size, kMaxSlotSize);
+  return absl::countr_zero(slot_size) - absl::countr_zero(kMinSlotSize);
+}
+
+size_t SampledPageHeap::SlotIndex(const void* ptr,
+                                  const SharedSampledPage& page) {
+  const uintptr_t offset = reinterpret_cast<uintptr_t>(ptr) -
+                           reinterpret_cast<uintptr_t>(
+                               page.span->start_address());
+  TC_CHECK_EQ(offset % page.slot_size, 0);
+  TC_ASSERT_LT(offset / page.slot_size, kSharedSampledPageSlots);
+  return offset / page.slot_size;
+}
+
+void* SampledPageHeap::TakeSlot(SharedSampledPage* page, Span** span) {
+  const size_t slot = page->free.FindSet(0);
+  TC_ASSERT_LT(slot, kSharedSampledPageSlots);
+  page->free.ClearBit(slot);
+  ++page->used;
+  ++objects_;
+  if (page->free.IsZero()) {
+    partial_[SlotSizeIndex(page->slot_size)].remove(page);
+  }
+  *span = page->span;
+  return static_cast<char*>(page->span->start_address()) +
+         slot * page->slot_size;
+}
+
+void* SampledPageHeap::Alloc(size_t slot_size, Span** span) {
+  const int index = SlotSizeIndex(slot_size);
+  {
+    absl::base_internal::SpinLockHolder h(&lock_);
+    if (!partial_[index].empty()) {
+      return TakeSlot(partial_[index].first(), span);
+    }
+  }
+
+  // Set up a new page outside of lock_, which is not held with pageheap_lock.
+  Span* page_span = tc_globals.page_allocator().New(
+      Length(1), {1, AccessDensityPrediction::kSparse}, MemoryTag::kSampled);
+  if (page_span == nullptr) {
+    return nullptr;
+  }
+  SharedSampledPage* page;
+  {
+    PageHeapSpinLockHolder l;
+    if (!metadata_allocator_inited_) {
+      metadata_allocator_.Init(&tc_globals.arena());
+      metadata_allocator_inited_ = true;
+    }
+    page = metadata_allocator_.New();
+  }
+  new (page) SharedSampledPage();
+  page->span = page_span;
+  page->slot_size = slot_size;
+  page->used = 0;
+  page->free.SetRange(0, kPageSize / slot_size);
+  page_span->ShareSampled(page);
+
+  absl::base_internal::SpinLockHolder h(&lock_);
+  ++pages_;
+  partial_[index].prepend(page);
+  return TakeSlot(page, span);
+}
+
+void SampledPageHeap::Free(void* ptr, Span* span) {
+  SharedSampledPage* page = span->shared_sampled_page();
+  TC_CHECK_NE(page, nullptr);
+  const size_t slot = SlotIndex(ptr, *page);
+  {
+    absl::base_internal::SpinLockHolder h(&lock_);
+    TC_CHECK(!page->free.GetBit(slot), "Possible double free detected");
+    const bool was_full = page->free.IsZero();
+    page->free.SetBit(slot);
+    --page->used;
+    --objects_;
+    TList<SharedSampledPage>& list = partial_[SlotSizeIndex(page->slot_size)];
+    if (page->used != 0) {
+      if (was_full) {
+        list.prepend(page);
+      }
+      return;
+    }
+    if (!was_full) {
+      list.remove(page);
+    }
+    --pages_;
+  }
+
+  span->Unshare();
+  PageHeapSpinLockHolder l;
+  metadata_allocator_.Delete(page);
+  tc_globals.page_allocator().Delete(span, /*objects_per_span=*/1,
+                                     MemoryTag::kSampled);
+}
+
+void SampledPageHeap::Sample(void* ptr, Span* span,
+                             SampledAllocation* sampled_allocation) {
+  SharedSampledPage* page = span->shared_sampled_page();
+  TC_CHECK(page != nullptr && sampled_allocation != nullptr);
+  const size_t slot = SlotIndex(ptr, *page);
+  TC_ASSERT_EQ(page->samples[slot], nullptr);
+  page->samples[slot] = sampled_allocation;
+
+  // As in Span::Sample.
+  tc_globals.sampled_objects_size_.Add(static_cast<StatsCounter::Value>(
+      AllocatedBytes(sampled_allocation->sampled_stack)));
+  tc_globals.total_sampled_count_.Add(1);
+}
+
+SampledAllocation* SampledPageHeap::Unsample(void* ptr, Span* span) {
+  SharedSampledPage* page = span->shared_sampled_page();
+  TC_CHECK_NE(page, nullptr);
+  const size_t slot = SlotIndex(ptr, *page);
+  SampledAllocation* sampled_allocation = page->samples[slot];
+  TC_CHECK_NE(sampled_allocation, nullptr, "Possible double free detected");
+  page->samples[slot] = nullptr;
+
+  // As in Span::Unsample.
+  tc_globals.sampled_objects_size_.Add(-static_cast<StatsCounter::Value>(
+      AllocatedBytes(sampled_allocation->sampled_stack)));
+  return sampled_allocation;
+}
+
+SampledAllocation* SampledPageHeap::sampled_allocation(const void* ptr,
+                                                       const Span* span) {
+  const SharedSampledPage* page = span->shared_sampled_page();
+  TC_ASSERT_NE(page, nullptr);
+  return page->samples[SlotIndex(ptr, *page)];
+}
+
+SampledPageHeap::Stats SampledPageHeap::stats() const {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  return {pages_, objects_};
+}
+
+void SampledPageHeap::Print(Printer* out) const {
+  const Stats s = stats();
+  out->printf("------------------------------------------------\n");
+  out->printf("Shared sampled pages (%s): %zu pages holding %zu objects\n",
+              Parameters::compact_sampled_allocations() ? "enabled"
+                                                        : "disabled",
+              s.pages, s.objects);
+  out->printf("------------------------------------------------\n");
+}
+
+void SampledPageHeap::PrintInPbtxt(PbtxtRegion* region) const {
+  const Stats s = stats();
+  region->PrintI64("shared_sampled_pages", s.pages);
+  region->PrintI64("shared_sampled_objects", s.objects);
+}
+
+SampledPageHeap& sampled_page_heap() {
+  ABSL_CONST_INIT static SampledPageHeap heap;
+  return heap;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,125 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_SAMPLED_PAGE_HEAP_H_
+#define TCMALLOC_SAMPLED_PAGE_HEAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/linked_list.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/range_tracker.h"
+#include "tcmalloc/internal/sampled_allocation.h"
+#include "tcmalloc/page_heap_allocator.h"
+#include "tcmalloc/span.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// The slots a shared sampled page is split into, at most.
+inline constexpr size_t kSharedSampledPageSlots = 64;
+
+// The metadata of a page of the sampled tag shared by several sampled objects,
+// which its span points to (see Span::ShareSampled).
+struct SharedSampledPage : public TList<SharedSampledPage>::Elem {
+  Span* span;
+  size_t slot_size;
+  size_t used;
+  // Set for the slots that are free.
+  Bitmap<kSharedSampledPageSlots> free;
+  SampledAllocation* samples[kSharedSampledPageSlots];
+};
+
+// Places small sampled objects on pages of the sampled tag that they share,
+// rather than on a page each, so that sampling more often does not cost a page
+// of RSS per sampled object.  Each page holds slots of one power of two size,
+// like a size class; pages are returned to the page heap once empty.
+//
+// The sampled objects on a shared page are found from their span, as for the
+// sampled objects that have their own span, and then by their offset in the
+// page.
+class SampledPageHeap {
+ public:
+  static constexpr size_t kMinSlotSize = kPageSize / kSharedSampledPageSlots;
+  static constexpr size_t kMaxSlotSize = kPageSize / 4;
+  static constexpr int kNumSlotSizes = 5;
+  static_assert(kMinSlotSize << (kNumSlotSizes - 1) == kMaxSlotSize);
+
+  constexpr SampledPageHeap() = default;
+
+  SampledPageHeap(const SampledPageHeap&) = delete;
+  SampledPageHeap& operator=(const SampledPageHeap&) = delete;
+
+  // Returns the smallest slot size that holds an object of <size> bytes
+  // aligned to <align>, or 0 if the object is too large to share a page.
+  static size_t SlotSize(size_t size, size_t align);
+
+  // Returns a free slot of <slot_size>, a value returned by SlotSize, and sets
+  // *span to the span of its page.  Returns nullptr if no page is available.
+  void* Alloc(size_t slot_size, Span** span) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Frees the slot of <ptr> on <span>, and the page once it is empty.
+  void Free(void* ptr, Span* span) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Like Span::Sample and Span::Unsample, for the object at <ptr> on <span>.
+  // No lock is required, as each slot has a single owner.
+  static void Sample(void* ptr, Span* span,
+                     SampledAllocation* sampled_allocation);
+  static SampledAllocation* Unsample(void* ptr, Span* span);
+
+  // Returns the sampled allocation of the object at <ptr> on <span>.
+  static SampledAllocation* sampled_allocation(const void* ptr,
+                                               const Span* span);
+
+  struct Stats {
+    size_t pages;
+    size_t objects;
+  };
+  Stats stats() const ABSL_LOCKS_EXCLUDED(lock_);
+
+  void Print(Printer* out) const ABSL_LOCKS_EXCLUDED(lock_);
+  void PrintInPbtxt(PbtxtRegion* region) const ABSL_LOCKS_EXCLUDED(lock_);
+
+ private:
+  static int SlotSizeIndex(size_t slot_size);
+  static size_t SlotIndex(const void* ptr, const SharedSampledPage& page);
+
+  void* TakeSlot(SharedSampledPage* page, Span** span)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  mutable absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  // The pages of each slot size with free slots.
+  TList<SharedSampledPage> partial_[kNumSlotSizes] ABSL_GUARDED_BY(lock_);
+  size_t pages_ ABSL_GUARDED_BY(lock_) = 0;
+  size_t objects_ ABSL_GUARDED_BY(lock_) = 0;
+
+  PageHeapAllocator<SharedSampledPage> metadata_allocator_
+      ABSL_GUARDED_BY(pageheap_lock);
+  bool metadata_allocator_inited_ ABSL_GUARDED_BY(pageheap_lock) = false;
+};
+
+SampledPageHeap& sampled_page_heap();
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_SAMPLED_PAGE_HEAP_H_
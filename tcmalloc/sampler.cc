@@ -14,6 +14,8 @@
 
 #include "tcmalloc/sampler.h"
 
+#include <time.h>
+
 #include <algorithm>
 #include <atomic>
 #include <cmath>
@@ -24,6 +26,7 @@
 #include "absl/base/attributes.h"
 #include "absl/base/internal/cycleclock.h"
 #include "absl/base/optimization.h"
+#include "tcmalloc/allocation_budget.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/exponential_biased.h"
 #include "tcmalloc/internal/logging.h"
@@ -42,8 +45,15 @@ namespace tcmalloc_internal {
 // counter value and then add it back when we calculate the sample weight.
 constexpr ssize_t kIntervalOffset = 1;
 
+// The sampling point picked while sampling is disabled.
+constexpr ssize_t kUnsampledPoint = 128 << 20;
+
 ssize_t Sampler::GetSampleInterval() {
-  return Parameters::profile_sampling_interval();
+  const ssize_t interval = Parameters::profile_sampling_interval();
+  // Intervals of 0 and 1 disable sampling and sample everything: leave them
+  // be.
+  if (interval <= 1) return interval;
+  return std::max(interval, sampling_budget().interval());
 }
 
 // Run this before using your sampler
@@ -73,7 +83,7 @@ ssize_t Sampler::PickNextSamplingPoint() {
     // runtime, so pick something reasonably large (to keep overhead
     // low) but small enough that we'll eventually start to sample
     // again.
-    return 128 << 20;
+    return kUnsampledPoint;
   }
   if (ABSL_PREDICT_FALSE(sample_interval_ == 1)) {
     // A sample period of 1, generally used only in tests due to its exorbitant
@@ -120,6 +130,39 @@ ssize_t Sampler::GetGeometricVariable(ssize_t mean) {
     return static_cast<ssize_t>(interval);
 }
 
+void Sampler::Reseed() {
+  // An uninitialized sampler is seeded on its first slow path anyway.
+  if (!initialized_) return;
+  Init(static_cast<uint64_t>(absl::base_internal::CycleClock::Now()) +
+       reinterpret_cast<uintptr_t>(this));
+}
+
+void Sampler::SwapTaskState(MallocExtension::AllocationTaskState& state) {
+  if (ABSL_PREDICT_FALSE(!initialized_)) {
+    // Seed the generator now, rather than on the next slow path, which would
+    // discard the counters swapped in.  The thread's own counters are then
+    // those of a task that has not allocated yet.
+    initialized_ = true;
+    Init(static_cast<uint64_t>(absl::base_internal::CycleClock::Now()) +
+         reinterpret_cast<uintptr_t>(this));
+    sample_interval_ = 0;
+    bytes_until_sample_ = 0;
+  }
+  const int64_t interval = state.sample_interval;
+  const int64_t bytes = state.bytes_until_sample;
+  state.sample_interval = sample_interval_;
+  state.bytes_until_sample = bytes_until_sample_;
+  // Picked sampling points have a nonzero interval or a nonzero count, so both
+  // are 0 in value-initialized states (or, harmlessly, once a count runs out
+  // exactly while sampling is disabled).
+  if (interval == 0 && bytes == 0) {
+    bytes_until_sample_ = PickNextSamplingPoint();
+  } else {
+    sample_interval_ = interval;
+    bytes_until_sample_ = bytes;
+  }
+}
+
 size_t Sampler::RecordAllocationSlow(size_t k) {
   if (ABSL_PREDICT_FALSE(!initialized_)) {
     initialized_ = true;
@@ -144,15 +187,69 @@ size_t Sampler::RecordAllocationSlow(size_t k) {
   // gives us a weight of T + k - f.
   //
   size_t weight = sample_interval_ - bytes_until_sample_ - kIntervalOffset;
+  // The weight also estimates the bytes allocated since the previous sample.
+  // Without sampling, those are counted exactly from the point picked.
+  ChargeAllocationBudget(sample_interval_ > 0
+                             ? weight
+                             : kUnsampledPoint - bytes_until_sample_);
   bytes_until_sample_ = PickNextSamplingPoint();
   return GetSampleInterval() <= 0 ? 0 : weight;
 }
 
-double AllocatedBytes(const StackTrace& stack) {
+double AllocatedBytes(const SampleInfo& stack) {
   return static_cast<double>(stack.weight) * stack.allocated_size /
          (stack.requested_size + 1);
 }
 
+void SamplingBudget::Update(double budget, ssize_t min_interval,
+                            ssize_t max_interval, int64_t cpu_cycles) {
+  const int64_t cost = cost_cycles_.exchange(0, std::memory_order_relaxed);
+  if (budget <= 0 || min_interval <= 1) {
+    interval_.store(0, std::memory_order_relaxed);
+    return;
+  }
+  max_interval = std::max(max_interval, min_interval);
+  const ssize_t current =
+      std::clamp(interval_.load(std::memory_order_relaxed), min_interval,
+                 max_interval);
+  if (cpu_cycles <= 0) {
+    interval_.store(current, std::memory_order_relaxed);
+    return;
+  }
+  // The cost is inversely proportional to the interval, so scaling the
+  // interval by overhead / budget brings the overhead to the budget.  The
+  // ratio is bounded to smooth out bursts of sampling.
+  const double overhead = static_cast<double>(cost) / cpu_cycles;
+  const double ratio = std::clamp(overhead / budget, 0.5, 2.0);
+  const double next =
+      std::clamp(current * ratio, static_cast<double>(min_interval),
+                 static_cast<double>(max_interval));
+  interval_.store(static_cast<ssize_t>(next), std::memory_order_relaxed);
+}
+
+SamplingBudget& sampling_budget() {
+  ABSL_CONST_INIT static SamplingBudget budget;
+  return budget;
+}
+
+void UpdateSamplingBudget() {
+  // Only called by the background thread.
+  ABSL_CONST_INIT static double last_cpu_seconds = 0;
+
+  struct timespec ts;
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) return;
+  const double cpu_seconds = ts.tv_sec + ts.tv_nsec * 1e-9;
+  const double elapsed = cpu_seconds - last_cpu_seconds;
+  last_cpu_seconds = cpu_seconds;
+
+  sampling_budget().Update(
+      Parameters::profile_sampling_cpu_budget(),
+      Parameters::profile_sampling_interval(),
+      Parameters::profile_sampling_max_interval(),
+      static_cast<int64_t>(elapsed *
+                           absl::base_internal::CycleClock::Frequency()));
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
@@ -19,6 +19,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <atomic>
+
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "tcmalloc/internal/config.h"
@@ -111,6 +113,16 @@ class Sampler {
   // Returns the current sample interval.
   static ssize_t GetSampleInterval();
 
+  // Seeds the random number generator again, so that a child process does not
+  // pick the same sampling points as its parent after fork().
+  void Reseed();
+
+  // Exchanges the bytes until the next sample, and the interval they were
+  // picked with, with those of <state>, so that each task counts down to its
+  // own samples (see MallocExtension::SwapAllocationTaskState).  A state that
+  // has never been swapped in starts from a new sampling point.
+  void SwapTaskState(MallocExtension::AllocationTaskState& state);
+
   // The following are public for the purposes of testing
 
   // Used to ensure that the hot fields are collocated in the same cache line
@@ -186,7 +198,43 @@ inline bool Sampler::WillRecordAllocation(size_t k) {
 
 // Returns the approximate number of bytes that would have been allocated to
 // obtain this sample.
-double AllocatedBytes(const StackTrace& stack);
+double AllocatedBytes(const SampleInfo& stack);
+
+// Raises the sampling interval above profile_sampling_interval while recording
+// sampled allocations takes more than profile_sampling_cpu_budget of the
+// process' CPU time.  Thread safe.
+class SamplingBudget {
+ public:
+  constexpr SamplingBudget() = default;
+
+  // Adds <cycles> of CycleClock time spent recording a sampled allocation.
+  void RecordCost(int64_t cycles) {
+    cost_cycles_.fetch_add(cycles, std::memory_order_relaxed);
+  }
+
+  // Returns the sampling interval needed to stay within the budget, or 0 if
+  // there is no budget.
+  ssize_t interval() const {
+    return interval_.load(std::memory_order_relaxed);
+  }
+
+  // Scales the interval by the ratio of the cost recorded since the last
+  // Update to <budget> times the <cpu_cycles> the process ran for meanwhile.
+  // The interval changes by at most a factor of 2 per call, and stays within
+  // [min_interval, max_interval].  Must not be called concurrently.
+  void Update(double budget, ssize_t min_interval, ssize_t max_interval,
+              int64_t cpu_cycles);
+
+ private:
+  std::atomic<int64_t> cost_cycles_{0};
+  std::atomic<ssize_t> interval_{0};
+};
+
+SamplingBudget& sampling_budget();
+
+// Updates sampling_budget() from the parameters and the process' CPU time
+// since the last call.  Called periodically by the background thread.
+void UpdateSamplingBudget();
 
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
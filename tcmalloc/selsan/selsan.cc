@@ -56,6 +56,9 @@ namespace {
 
 ABSL_CONST_INIT std::atomic<int> sampling_percent = 100;
 ABSL_CONST_INIT Random rand{0};
+// Span allocations that ShouldSample chose to tag, and that it did not.
+ABSL_CONST_INIT std::atomic<int64_t> sampled_spans = 0;
+ABSL_CONST_INIT std::atomic<int64_t> unsampled_spans = 0;
 
 void MapShadow() {
   void* const kShadowStart =
@@ -149,13 +152,14 @@ void SetSamplingPercent(int v) {
 
 bool ShouldSample() {
   const int percent = SamplingPercent();
-  if (!enabled || percent <= 0) {
+  if (!enabled) {
     return false;
   }
-  if (percent >= 100) {
-    return true;
-  }
-  return (rand.Next() % 100) < percent;
+  const bool sample =
+      percent >= 100 || (percent > 0 && (rand.Next() % 100) < percent);
+  (sample ? sampled_spans : unsampled_spans)
+      .fetch_add(1, std::memory_order_relaxed);
+  return sample;
 }
 
 void PrintTextStats(Printer* out) {
@@ -165,14 +169,23 @@ SelSan Status
 ------------------------------------------------
 Enabled: %d
 Sampling percent: %d%%
+Sampled spans: %d
+Unsampled spans: %d
 
 )",
-              enabled, SamplingPercent());
+              enabled, SamplingPercent(),
+              sampled_spans.load(std::memory_order_relaxed),
+              unsampled_spans.load(std::memory_order_relaxed));
 }
 
 void PrintPbtxtStats(PbtxtRegion* out) {
   auto selsan = out->CreateSubRegion("selsan");
   selsan.PrintRaw("status", enabled ? "SELSAN_ENABLED" : "SELSAN_DISABLED");
+  selsan.PrintI64("sampling_percent", SamplingPercent());
+  selsan.PrintI64("sampled_spans",
+                  sampled_spans.load(std::memory_order_relaxed));
+  selsan.PrintI64("unsampled_spans",
+                  unsampled_spans.load(std::memory_order_relaxed));
 }
 
 #ifdef __x86_64__
@@ -82,6 +82,8 @@ inline ABSL_ATTRIBUTE_ALWAYS_INLINE bool IsEnabled() {
 }
 
 // Says if a given span allocation should be allocation from selsan page heap.
+// Only objects in such spans are tagged, and only the sampling percent of the
+// span allocations are.  Counts the decisions for the stats.
 bool ShouldSample();
 
 int SamplingPercent();
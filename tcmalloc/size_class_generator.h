@@ -0,0 +1,207 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Compile-time generation of size class tables.
+//
+// Rather than maintaining a table like the one in size_classes.cc by hand, a
+// size class set can be derived from a SizeClassSpec:
+//
+//   constexpr auto kMyClasses = GenerateSizeClasses(SizeClassSpec{
+//       .max_increment_percent = 20, .max_span_waste_percent = 5});
+//   constexpr SizeMap::ClassArray kMyClassArray =
+//       SizeMap::BuildClassArray(kMyClasses.span());
+//
+// Both the table and its class_array_ lookup are then computed by the
+// compiler, so using them costs nothing at startup.
+
+#ifndef TCMALLOC_SIZE_CLASS_GENERATOR_H_
+#define TCMALLOC_SIZE_CLASS_GENERATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "absl/types/span.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/size_class_info.h"
+#include "tcmalloc/sizemap.h"
+#include "tcmalloc/span.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Describes the size classes to generate.  The defaults approximate the
+// trade-offs of kSizeClasses.
+struct SizeClassSpec {
+  // Below this size, only powers of two are used.
+  size_t pow2_below = 64;
+  // Classes of at least this size are multiples of it, so that objects
+  // allocated with ::operator new are suitably aligned.
+#if defined(__cpp_aligned_new) && __STDCPP_DEFAULT_NEW_ALIGNMENT__ <= 8
+  size_t new_alignment = 8;
+#else
+  size_t new_alignment = 16;
+#endif
+  // Maximum growth from one size class to the next, so that internal
+  // fragmentation of an allocation is bounded by roughly this much.  Classes
+  // are never finer than their alignment (see AlignmentFor), and powers of two
+  // are never skipped.
+  size_t max_increment_percent = 15;
+  // Spans are grown (up to max_pages) until the tail left over after the last
+  // object is at most this fraction of the span.
+  size_t max_span_waste_percent = 3;
+  size_t max_pages = 32;
+  // Objects moved between the per-CPU and central caches are bounded by
+  // <batch_bytes> and clamped to [2, max_batch].
+  size_t batch_bytes = 64 << 10;
+  size_t max_batch = 32;
+  // Per-CPU cache capacity is <capacity_bytes> worth of objects clamped to
+  // [min_capacity, max_capacity].
+  size_t capacity_bytes = 256 << 10;
+  size_t min_capacity = 128;
+  size_t max_capacity = 2048;
+  // Size of the largest class.  Must be kMaxSize for use with SizeMap.
+  size_t max_size = kMaxSize;
+};
+
+// The result of GenerateSizeClasses: a size class list starting with the
+// sentinel class 0, like the tables in size_classes.cc.
+template <size_t N = kNumBaseClasses>
+struct GeneratedSizeClasses {
+  SizeClassInfo classes[N] = {};
+  size_t count = 0;
+
+  constexpr absl::Span<const SizeClassInfo> span() const {
+    return absl::Span<const SizeClassInfo>(classes, count);
+  }
+};
+
+namespace size_class_generator_internal {
+
+// Deliberately not constexpr: reaching a call in a constant expression turns
+// an unsatisfiable spec into a compile error.
+inline void SpecNeedsTooManySizeClasses() {
+  TC_BUG("size class spec produces too many size classes");
+}
+
+// Returns the alignment of a size class of <size> bytes.
+constexpr size_t AlignmentFor(size_t size, const SizeClassSpec& spec) {
+  if (size > SizeMap::kLargeSize) {
+    return SizeMap::kLargeSizeAlignment;
+  }
+  const size_t alignment = static_cast<size_t>(kAlignment);
+  return size >= spec.new_alignment ? std::max(alignment, spec.new_alignment)
+                                    : alignment;
+}
+
+constexpr size_t NextPowerOfTwo(size_t size) {
+  size_t p = 1;
+  while (p <= size) p <<= 1;
+  return p;
+}
+
+// Returns the next size class after <size>.
+constexpr size_t NextSize(size_t size, const SizeClassSpec& spec) {
+  size_t next = 0;
+  if (size < spec.pow2_below) {
+    next = NextPowerOfTwo(size);
+  } else {
+    next = size + size * spec.max_increment_percent / 100;
+    next -= next % AlignmentFor(next, spec);
+    if (next <= size) {
+      next = size + AlignmentFor(size + 1, spec);
+      next -= next % AlignmentFor(next, spec);
+    }
+    next = std::min(next, NextPowerOfTwo(size));
+  }
+  return std::min(next, spec.max_size);
+}
+
+// Returns the pages per span for objects of <size>.
+constexpr size_t PagesFor(size_t size, const SizeClassSpec& spec) {
+  // Spans of small objects keep an intrusive freelist and must be one page.
+  if (size < kPageSize / Span::MaxBitmapObjects()) {
+    return 1;
+  }
+  const size_t min_pages = (size + kPageSize - 1) / kPageSize;
+  const size_t max_pages = std::max(min_pages, std::min<size_t>(spec.max_pages,
+                                                                32));
+  size_t best_pages = min_pages;
+  size_t best_waste = SIZE_MAX;
+  for (size_t pages = min_pages; pages <= max_pages; ++pages) {
+    const size_t span_bytes = pages * kPageSize;
+    if (span_bytes / size > Span::MaxBitmapObjects()) break;
+    const size_t waste = span_bytes % size;
+    if (waste * 100 <= spec.max_span_waste_percent * span_bytes) {
+      return pages;
+    }
+    // Keep the smallest fraction of waste: waste / pages < best / best_pages.
+    if (best_waste == SIZE_MAX || waste * best_pages < best_waste * pages) {
+      best_pages = pages;
+      best_waste = waste;
+    }
+  }
+  return best_pages;
+}
+
+constexpr size_t Clamp(size_t v, size_t lo, size_t hi) {
+  return std::max(lo, std::min(v, hi));
+}
+
+}  // namespace size_class_generator_internal
+
+// Returns the parameters <spec> prescribes for a size class of <size> bytes.
+constexpr SizeClassInfo MakeSizeClass(size_t size, const SizeClassSpec& spec) {
+  namespace internal = size_class_generator_internal;
+
+  const size_t num_to_move = internal::Clamp(
+      spec.batch_bytes / size, 2, std::min(spec.max_batch, kMaxObjectsToMove));
+  const size_t capacity = internal::Clamp(
+      spec.capacity_bytes / size, spec.min_capacity, spec.max_capacity);
+  return {static_cast<uint32_t>(size),
+          static_cast<uint8_t>(internal::PagesFor(size, spec)),
+          static_cast<uint8_t>(num_to_move), static_cast<uint32_t>(capacity)};
+}
+
+// Generates the size classes described by <spec>.  Usable in constant
+// expressions; a spec needing more than N - 1 classes fails to compile there
+// (and crashes at runtime otherwise).
+template <size_t N = kNumBaseClasses>
+constexpr GeneratedSizeClasses<N> GenerateSizeClasses(
+    const SizeClassSpec& spec = SizeClassSpec()) {
+  namespace internal = size_class_generator_internal;
+
+  GeneratedSizeClasses<N> result;
+  result.classes[0] = {0, 0, 0, 0};
+  result.count = 1;
+  size_t size = static_cast<size_t>(kAlignment);
+  while (true) {
+    if (result.count >= N) {
+      internal::SpecNeedsTooManySizeClasses();
+    }
+    result.classes[result.count++] = MakeSizeClass(size, spec);
+    if (size >= spec.max_size) break;
+    size = internal::NextSize(size, spec);
+  }
+  return result;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_SIZE_CLASS_GENERATOR_H_
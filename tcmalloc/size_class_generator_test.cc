@@ -0,0 +1,117 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/size_class_generator.h"
+
+#include <stddef.h>
+
+#include "gtest/gtest.h"
+#include "absl/types/span.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/size_class_info.h"
+#include "tcmalloc/sizemap.h"
+#include "tcmalloc/tcmalloc_policy.h"
+
+namespace tcmalloc::tcmalloc_internal {
+namespace {
+
+struct TestingSizeMap : SizeMap {
+  // Re-export as public.
+  using SizeMap::ValidSizeClasses;
+};
+
+#ifdef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
+// Few size classes are available, so they need to be coarser.
+constexpr SizeClassSpec kSpec{.max_increment_percent = 25};
+#else
+constexpr SizeClassSpec kSpec;
+#endif
+
+constexpr auto kGenerated = GenerateSizeClasses(kSpec);
+constexpr SizeMap::ClassArray kGeneratedClassArray =
+    SizeMap::BuildClassArray(kGenerated.span());
+
+static_assert(kGenerated.classes[1].size == static_cast<size_t>(kAlignment));
+static_assert(kGenerated.classes[kGenerated.count - 1].size == kMaxSize);
+static_assert(kGeneratedClassArray[SizeMap::ConstexprClassIndex(kMaxSize)] ==
+              kGenerated.count - 1);
+
+// Checks class_array against a linear search of size_classes.
+void CheckClassArray(absl::Span<const SizeClassInfo> size_classes,
+                     const SizeMap::ClassArray& class_array) {
+  size_t c = 1;
+  for (size_t size = 0; size <= kMaxSize; ++size) {
+    while (size_classes[c].size < size) ++c;
+    ASSERT_EQ(class_array[SizeMap::ConstexprClassIndex(size)], c)
+        << "size=" << size;
+  }
+}
+
+TEST(SizeClassGeneratorTest, GeneratesValidSizeClasses) {
+  EXPECT_TRUE(TestingSizeMap::ValidSizeClasses(kGenerated.span()));
+}
+
+TEST(SizeClassGeneratorTest, BoundsFragmentation) {
+  for (size_t c = 2; c < kGenerated.count; ++c) {
+    const size_t prev = kGenerated.classes[c - 1].size;
+    const size_t size = kGenerated.classes[c].size;
+    const size_t alignment =
+        size_class_generator_internal::AlignmentFor(size, kSpec);
+    EXPECT_EQ(size % alignment, 0) << "class " << c << " size " << size;
+    if (prev < kSpec.pow2_below) {
+      EXPECT_EQ(size, 2 * prev);
+    } else if (size - prev > alignment) {
+      EXPECT_LE((size - prev) * 100, prev * kSpec.max_increment_percent)
+          << "class " << c << " size " << size;
+    }
+  }
+}
+
+TEST(SizeClassGeneratorTest, SpecIsHonored) {
+  constexpr SizeClassSpec kCoarse{.pow2_below = 256,
+                                  .max_increment_percent = 50,
+                                  .max_batch = 8,
+                                  .max_capacity = 512};
+  constexpr auto kClasses = GenerateSizeClasses(kCoarse);
+  ASSERT_TRUE(TestingSizeMap::ValidSizeClasses(kClasses.span()));
+  EXPECT_LT(kClasses.count, kGenerated.count);
+  EXPECT_EQ(kClasses.classes[6].size, 256);
+  for (size_t c = 1; c < kClasses.count; ++c) {
+    EXPECT_LE(kClasses.classes[c].num_to_move, 8);
+    EXPECT_LE(kClasses.classes[c].max_capacity, 512);
+  }
+}
+
+TEST(SizeClassGeneratorTest, BuildClassArray) {
+  CheckClassArray(kGenerated.span(), kGeneratedClassArray);
+  CheckClassArray(kSizeClasses.classes, kSizeClassArray);
+  CheckClassArray(kLegacySizeClasses.classes, kLegacyClassArray);
+  CheckClassArray(kReuseSizeClasses.classes, kReuseClassArray);
+  CheckClassArray(kExperimentalPow2SizeClasses.classes,
+                  kExperimentalPow2ClassArray);
+}
+
+TEST(SizeClassGeneratorTest, InitWithPrecomputedClassArray) {
+  SizeMap computed, precomputed;
+  ASSERT_TRUE(computed.Init(kGenerated.span()));
+  ASSERT_TRUE(precomputed.Init(kGenerated.span(), &kGeneratedClassArray));
+  for (size_t size = 0; size <= kMaxSize; ++size) {
+    ASSERT_EQ(precomputed.SizeClass(CppPolicy(), size),
+              computed.SizeClass(CppPolicy(), size))
+        << "size=" << size;
+  }
+}
+
+}  // namespace
+}  // namespace tcmalloc::tcmalloc_internal
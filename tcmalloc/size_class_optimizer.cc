@@ -0,0 +1,355 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/size_class_optimizer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "tcmalloc/internal/profile.pb.h"
+#include "absl/container/btree_map.h"
+#include "absl/numeric/bits.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/gzip_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/huge_page_aware_allocator.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/size_class_generator.h"
+#include "tcmalloc/size_class_info.h"
+#include "tcmalloc/sizemap.h"
+#include "tcmalloc/span.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Returns the smallest size class that <spec> allows for <size>.
+size_t RoundUpToClassSize(size_t size, const SizeClassSpec& spec) {
+  size = std::max(size, static_cast<size_t>(kAlignment));
+  if (size < spec.pow2_below) {
+    return absl::bit_ceil(size);
+  }
+  // The sizes at which the alignment grows are multiples of the alignment
+  // below them, so the rounded size needs no further rounding.
+  const size_t alignment =
+      size_class_generator_internal::AlignmentFor(size, spec);
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// Returns the bytes lost at the end of a span per byte of objects in it.
+double SpanWaste(size_t size, size_t pages) {
+  const size_t span_bytes = pages * kPageSize;
+  const size_t object_bytes = span_bytes / size * size;
+  return static_cast<double>(span_bytes - object_bytes) / object_bytes;
+}
+
+}  // namespace
+
+size_t ChooseSpanPages(size_t size, double objects, const SizeClassSpec& spec,
+                       double populate_cost_bytes) {
+  // Spans of small objects keep an intrusive freelist and must be one page.
+  if (!Span::UseBitmapForSize(size)) {
+    return 1;
+  }
+  const size_t min_pages = (size + kPageSize - 1) / kPageSize;
+  const size_t max_pages =
+      std::max(min_pages, std::min<size_t>(spec.max_pages, 32));
+  size_t best_pages = min_pages;
+  double best_cost = std::numeric_limits<double>::infinity();
+  for (size_t pages = min_pages; pages <= max_pages; ++pages) {
+    if (!Span::IsValidSizeClass(size, pages) ||
+        !HugePageAwareAllocator::IsValidSizeClass(size, pages)) {
+      break;
+    }
+    const size_t span_bytes = pages * kPageSize;
+    const size_t objects_per_span = span_bytes / size;
+    const double cost = objects * size * SpanWaste(size, pages) + span_bytes +
+                        populate_cost_bytes * objects / objects_per_span;
+    if (cost < best_cost) {
+      best_pages = pages;
+      best_cost = cost;
+    }
+  }
+  return best_pages;
+}
+
+void AddToHistogram(const Profile& profile, SizeHistogram& histogram) {
+  profile.Iterate([&](const Profile::Sample& sample) {
+    if (sample.requested_size <= kMaxSize) {
+      histogram[sample.requested_size] += sample.count;
+    }
+  });
+}
+
+absl::Status AddMarshaledToHistogram(absl::string_view marshaled,
+                                     SizeHistogram& histogram) {
+  google::protobuf::io::ArrayInputStream stream(marshaled.data(),
+                                                marshaled.size());
+  google::protobuf::io::GzipInputStream gzip_stream(&stream);
+  google::protobuf::io::CodedInputStream coded_stream(&gzip_stream);
+
+  perftools::profiles::Profile profile;
+  if (!profile.ParseFromCodedStream(&coded_stream)) {
+    return absl::InvalidArgumentError("Failed to parse profile");
+  }
+
+  int objects_index = -1;
+  for (int i = 0; i < profile.sample_type_size(); ++i) {
+    if (profile.string_table(profile.sample_type(i).type()) == "objects") {
+      objects_index = i;
+      break;
+    }
+  }
+  if (objects_index < 0) {
+    return absl::InvalidArgumentError("Profile has no object counts");
+  }
+
+  int64_t request_id = -1, bytes_id = -1;
+  for (int i = 0; i < profile.string_table_size(); ++i) {
+    if (profile.string_table(i) == "request") {
+      request_id = i;
+    } else if (profile.string_table(i) == "bytes") {
+      bytes_id = i;
+    }
+  }
+
+  for (const perftools::profiles::Sample& sample : profile.sample()) {
+    if (sample.value_size() <= objects_index) continue;
+    // Prefer the requested size, which is missing if it matches the
+    // allocated size.
+    int64_t size = -1;
+    for (const perftools::profiles::Label& label : sample.label()) {
+      if (label.key() == request_id) {
+        size = label.num();
+        break;
+      } else if (label.key() == bytes_id) {
+        size = label.num();
+      }
+    }
+    if (size < 0 || size > kMaxSize) continue;
+    histogram[size] += sample.value(objects_index);
+  }
+  return absl::OkStatus();
+}
+
+std::vector<SizeClassInfo> OptimizeSizeClasses(
+    const SizeHistogram& histogram, const SizeClassOptimizerOptions& options) {
+  TC_CHECK_GE(options.num_classes, 2);
+  TC_CHECK_LE(options.num_classes, kNumBaseClasses);
+  const SizeClassSpec& spec = options.spec;
+
+  // Every candidate size class, with the requests that round up to it.
+  struct Candidate {
+    double objects = 0;
+    double bytes = 0;
+    // Always a size class.
+    bool required = false;
+  };
+  absl::btree_map<size_t, Candidate> candidates;
+  for (const auto& [size, objects] : histogram) {
+    if (size > kMaxSize || objects <= 0) continue;
+    Candidate& candidate = candidates[RoundUpToClassSize(size, spec)];
+    candidate.objects += objects;
+    candidate.bytes += objects * size;
+  }
+  const auto coverage = GenerateSizeClasses(options.coverage);
+  for (size_t c = 1; c < coverage.count; ++c) {
+    const size_t size = std::min(
+        RoundUpToClassSize(coverage.classes[c].size, spec), kMaxSize);
+    candidates[size].required = true;
+  }
+  candidates[kMaxSize].required = true;
+
+  const size_t n = candidates.size();
+  std::vector<size_t> sizes;
+  std::vector<bool> required;
+  std::vector<double> waste;
+  // Prefix sums of the objects and bytes served by candidates [0, i).
+  std::vector<double> objects(1, 0), bytes(1, 0);
+  sizes.reserve(n);
+  for (const auto& [size, candidate] : candidates) {
+    sizes.push_back(size);
+    required.push_back(candidate.required);
+    waste.push_back(SpanWaste(size, MakeSizeClass(size, spec).pages));
+    objects.push_back(objects.back() + candidate.objects);
+    bytes.push_back(bytes.back() + candidate.bytes);
+  }
+
+  // Cost of making candidate i the size class following candidate j (or the
+  // first size class, for j == -1).
+  auto cost = [&](ptrdiff_t j, size_t i) {
+    const double served = objects[i + 1] - objects[j + 1];
+    const double allocated = served * sizes[i];
+    return allocated - (bytes[i + 1] - bytes[j + 1]) + allocated * waste[i];
+  };
+
+  // best[k][i] is the minimal cost of covering candidates [0, i] with k + 1
+  // size classes, the largest of which is candidate i.  Required candidates
+  // cannot be skipped, so the predecessor of candidate i is at or after the
+  // last required candidate before it.
+  const size_t max_classes = std::min(options.num_classes - 1, n);
+  constexpr double kInfinity = std::numeric_limits<double>::infinity();
+  std::vector<std::vector<double>> best(max_classes,
+                                        std::vector<double>(n, kInfinity));
+  std::vector<std::vector<ptrdiff_t>> prev(max_classes,
+                                           std::vector<ptrdiff_t>(n, -1));
+  std::vector<ptrdiff_t> last_required(n, -1);
+  for (size_t i = 1; i < n; ++i) {
+    last_required[i] = required[i - 1] ? i - 1 : last_required[i - 1];
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (last_required[i] < 0) {
+      best[0][i] = cost(-1, i);
+    }
+  }
+  for (size_t k = 1; k < max_classes; ++k) {
+    for (size_t i = k; i < n; ++i) {
+      for (ptrdiff_t j = std::max<ptrdiff_t>(last_required[i], k - 1);
+           j < static_cast<ptrdiff_t>(i); ++j) {
+        if (best[k - 1][j] == kInfinity) continue;
+        const double c = best[k - 1][j] + cost(j, i);
+        if (c < best[k][i]) {
+          best[k][i] = c;
+          prev[k][i] = j;
+        }
+      }
+    }
+  }
+
+  size_t num_classes = 0;
+  for (size_t k = 0; k < max_classes; ++k) {
+    if (best[k][n - 1] < kInfinity &&
+        (num_classes == 0 || best[k][n - 1] < best[num_classes - 1][n - 1])) {
+      num_classes = k + 1;
+    }
+  }
+  TC_CHECK_GT(num_classes, 0, "coverage needs more than %v size classes",
+              options.num_classes - 1);
+
+  std::vector<SizeClassInfo> result(num_classes + 1);
+  result[0] = {0, 0, 0, 0};
+  ptrdiff_t i = n - 1;
+  for (size_t k = num_classes; k > 0; --k) {
+    const ptrdiff_t j = prev[k - 1][i];
+    result[k] = MakeSizeClass(sizes[i], spec);
+    if (options.populate_cost_bytes > 0) {
+      result[k].pages = static_cast<uint8_t>(
+          ChooseSpanPages(sizes[i], objects[i + 1] - objects[j + 1], spec,
+                          options.populate_cost_bytes));
+    }
+    i = j;
+  }
+  return result;
+}
+
+FragmentationEstimate EstimateFragmentation(
+    const SizeHistogram& histogram, absl::Span<const SizeClassInfo> classes) {
+  FragmentationEstimate estimate;
+  size_t c = 1;
+  for (const auto& [size, objects] : histogram) {
+    if (size > kMaxSize) break;
+    while (c < classes.size() && classes[c].size < size) ++c;
+    if (c == classes.size()) break;
+
+    const double allocated = objects * classes[c].size;
+    estimate.requested_bytes += objects * size;
+    estimate.internal_bytes += allocated - objects * size;
+    estimate.span_waste_bytes +=
+        allocated * SpanWaste(classes[c].size, classes[c].pages);
+  }
+  return estimate;
+}
+
+std::string SizeClassTableSource(absl::Span<const SizeClassInfo> classes) {
+  std::string out = absl::StrFormat(
+      R"(// Size classes generated by size_class_tool.
+//
+// Linking this file into a binary (as an alwayslink library, like
+// want_legacy_size_classes) makes TCMalloc use these size classes instead of
+// its defaults.
+
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/size_class_info.h"
+#include "tcmalloc/sizemap.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+static_assert(kPageShift == %d, "generated for a different page size");
+static_assert(kMaxSize == %d, "kMaxSize mismatch");
+
+constexpr SizeClassAssumptions Assumptions{
+  .has_expanded_classes = %s,
+  .span_size = %d,
+  .sampling_interval = %d,
+  .large_size = %d,
+  .large_size_alignment = %d,
+};
+
+// clang-format off
+constexpr SizeClassInfo List[] = {
+//                                         |
+//  bytes pages batch   cap    class  objs |  waste     inc
+)",
+      kPageShift, kMaxSize, kHasExpandedClasses ? "true" : "false",
+      sizeof(Span), kDefaultProfileSamplingInterval, SizeMap::kLargeSize,
+      SizeMap::kLargeSizeAlignment);
+  for (size_t c = 0; c < classes.size(); ++c) {
+    const SizeClassInfo& info = classes[c];
+    const size_t objects =
+        info.size == 0 ? 0 : info.pages * kPageSize / info.size;
+    const double waste =
+        info.size == 0 ? 0 : 100 * SpanWaste(info.size, info.pages);
+    const double inc =
+        c < 2 ? 0 : 100.0 * (info.size - classes[c - 1].size) /
+                        classes[c - 1].size;
+    absl::StrAppendFormat(&out,
+                          "  {%6u, %4u, %4u, %5u},  // %2u %5u | %6.2f%% "
+                          "%6.2f%%\n",
+                          info.size, info.pages, info.num_to_move,
+                          info.max_capacity, c, objects, waste, inc);
+  }
+  absl::StrAppend(&out, R"(};
+// clang-format on
+
+static_assert(sizeof(List) / sizeof(List[0]) <= kNumBaseClasses);
+constexpr SizeClasses kCustomSizeClasses{List, Assumptions};
+
+}  // namespace
+
+const SizeClasses* default_custom_size_classes() { return &kCustomSizeClasses; }
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+)");
+  return out;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
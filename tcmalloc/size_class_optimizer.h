@@ -0,0 +1,104 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Profile-guided size class selection.
+//
+// Derives a size class table from the allocation sizes observed in a heap or
+// allocation profile, minimizing the internal fragmentation (rounding up to the
+// size class) and span waste (the tail of a span no object fits in) of those
+// allocations.  See size_class_tool.cc for how to link the result into a
+// binary.
+
+#ifndef TCMALLOC_SIZE_CLASS_OPTIMIZER_H_
+#define TCMALLOC_SIZE_CLASS_OPTIMIZER_H_
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "absl/container/btree_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/size_class_generator.h"
+#include "tcmalloc/size_class_info.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Number of objects observed per requested size.
+using SizeHistogram = absl::btree_map<size_t, double>;
+
+// Adds the samples of <profile> that are small enough for a size class to
+// <histogram>.
+void AddToHistogram(const Profile& profile, SizeHistogram& histogram);
+
+// As AddToHistogram, for a profile serialized by Marshal (profile_marshaler.h).
+absl::Status AddMarshaledToHistogram(absl::string_view marshaled,
+                                     SizeHistogram& histogram);
+
+struct SizeClassOptimizerOptions {
+  // Number of size classes, including the sentinel class 0.
+  size_t num_classes = kNumBaseClasses;
+  // The classes generated from <coverage> are always included, so that sizes
+  // missing from the profile are still served with bounded fragmentation.
+  SizeClassSpec coverage = {.max_increment_percent = 100};
+  // Determines the pages, batch sizes and capacities of the classes.  Sizes
+  // below spec.pow2_below are rounded up to powers of two.
+  SizeClassSpec spec;
+  // When positive, the pages per span of each class are chosen from the
+  // objects the profile allocates from it (see ChooseSpanPages) rather than
+  // from spec.  This is the memory, in bytes, that is worth spending to save
+  // one CentralFreeList::Populate per span's worth of profiled objects.
+  double populate_cost_bytes = 0;
+};
+
+// Returns the pages per span, between the fewest that fit an object and
+// spec.max_pages, for a class of <size> bytes serving <objects> objects.  The
+// choice minimizes the span waste of those objects, one span's worth of
+// memory stranded in a partially used span, and <populate_cost_bytes> per span
+// populated.  Hot classes thus get bigger spans, fetching fewer of them, and
+// cold classes smaller ones.
+size_t ChooseSpanPages(size_t size, double objects, const SizeClassSpec& spec,
+                       double populate_cost_bytes);
+
+// Returns the size classes, starting with the sentinel class 0, that minimize
+// the fragmentation estimated for <histogram>.  The result satisfies the
+// constraints of SizeMap::ValidSizeClasses.
+std::vector<SizeClassInfo> OptimizeSizeClasses(
+    const SizeHistogram& histogram,
+    const SizeClassOptimizerOptions& options = {});
+
+struct FragmentationEstimate {
+  double requested_bytes = 0;
+  // Bytes lost to rounding up requests to their size class.
+  double internal_bytes = 0;
+  // Bytes lost at the end of the spans holding the objects.
+  double span_waste_bytes = 0;
+};
+
+FragmentationEstimate EstimateFragmentation(
+    const SizeHistogram& histogram, absl::Span<const SizeClassInfo> classes);
+
+// Returns a C++ source file that, once linked into a binary, makes TCMalloc
+// use <classes> (see default_custom_size_classes in sizemap.h).
+std::string SizeClassTableSource(absl::Span<const SizeClassInfo> classes);
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_SIZE_CLASS_OPTIMIZER_H_
@@ -0,0 +1,171 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/size_class_optimizer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/numeric/bits.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/fake_profile.h"
+#include "tcmalloc/internal_malloc_extension.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/profile_marshaler.h"
+#include "tcmalloc/size_class_info.h"
+#include "tcmalloc/sizemap.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+using ::testing::Contains;
+using ::testing::Field;
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+struct TestingSizeMap : SizeMap {
+  // Re-export as public.
+  using SizeMap::ValidSizeClasses;
+};
+
+auto HasSize(size_t size) {
+  return Contains(Field(&SizeClassInfo::size, size));
+}
+
+TEST(SizeClassOptimizerTest, FitsObservedSizes) {
+  const SizeHistogram histogram = {
+      {24, 10}, {96, 5}, {1500, 3}, {50000, 1}};
+  const std::vector<SizeClassInfo> classes = OptimizeSizeClasses(histogram);
+  ASSERT_TRUE(TestingSizeMap::ValidSizeClasses(classes));
+  EXPECT_LE(classes.size(), kNumBaseClasses);
+
+  // Sizes are rounded up to powers of two below 64 and to the required
+  // alignment otherwise.
+  EXPECT_THAT(classes, HasSize(32));
+  EXPECT_THAT(classes, HasSize(96));
+  EXPECT_THAT(classes, HasSize(1536));
+  EXPECT_THAT(classes, HasSize(50048));
+  // Coverage classes are present regardless of the profile.
+  EXPECT_THAT(classes, HasSize(4096));
+  EXPECT_THAT(classes, HasSize(kMaxSize));
+
+  const FragmentationEstimate optimized =
+      EstimateFragmentation(histogram, classes);
+  const FragmentationEstimate current =
+      EstimateFragmentation(histogram, kSizeClasses.classes);
+  EXPECT_EQ(optimized.requested_bytes, current.requested_bytes);
+  EXPECT_LT(optimized.internal_bytes, current.internal_bytes);
+}
+
+TEST(SizeClassOptimizerTest, SpendsClassesOnCommonSizes) {
+  SizeClassOptimizerOptions options;
+  // Powers of two from kAlignment to kMaxSize are required; leave room for a
+  // single additional class.
+  const size_t num_required =
+      absl::bit_width(kMaxSize) - absl::bit_width(size_t{8}) + 1;
+  options.num_classes = num_required + 2;
+
+  const SizeHistogram histogram = {{80, 1000}, {3000, 1}};
+  const std::vector<SizeClassInfo> classes =
+      OptimizeSizeClasses(histogram, options);
+  ASSERT_TRUE(TestingSizeMap::ValidSizeClasses(classes));
+  EXPECT_EQ(classes.size(), options.num_classes);
+  EXPECT_THAT(classes, HasSize(80));
+  EXPECT_THAT(classes, Not(HasSize(3072)));
+}
+
+TEST(SizeClassOptimizerTest, SizesSpansByAllocationRate) {
+  const SizeClassSpec spec;
+  constexpr double kPopulateCost = kPageSize;
+  // Objects with an intrusive freelist need single page spans.
+  EXPECT_EQ(ChooseSpanPages(64, 1e9, spec, kPopulateCost), 1);
+
+  const size_t size = kPageSize * 3 / 8;
+  const size_t cold = ChooseSpanPages(size, 1, spec, kPopulateCost);
+  const size_t hot = ChooseSpanPages(size, 1e9, spec, kPopulateCost);
+  EXPECT_EQ(cold, 1);
+  EXPECT_GT(hot, cold);
+  EXPECT_TRUE(SizeMap::IsValidSizeClass(size, hot, 2));
+
+  SizeClassOptimizerOptions options;
+  options.populate_cost_bytes = kPopulateCost;
+  const std::vector<SizeClassInfo> classes =
+      OptimizeSizeClasses({{size, 1e9}, {size * 2, 1}}, options);
+  ASSERT_TRUE(TestingSizeMap::ValidSizeClasses(classes));
+  for (const SizeClassInfo& info : classes) {
+    if (info.size == size) {
+      EXPECT_EQ(info.pages, hot);
+    }
+  }
+}
+
+TEST(SizeClassOptimizerTest, ReadsMarshaledProfiles) {
+  auto fake_profile = std::make_unique<FakeProfile>();
+  fake_profile->SetType(ProfileType::kAllocations);
+
+  struct {
+    size_t requested, allocated;
+    int64_t count;
+  } const kAllocations[] = {{24, 32, 7},
+                            {1000, 1024, 3},
+                            {4096, 4096, 2},
+                            {kMaxSize + 1, kMaxSize + kPageSize, 1}};
+  std::vector<Profile::Sample> samples;
+  for (const auto& a : kAllocations) {
+    auto& sample = samples.emplace_back();
+    sample.requested_size = a.requested;
+    sample.allocated_size = a.allocated;
+    sample.count = a.count;
+    sample.sum = a.count * a.allocated;
+  }
+  fake_profile->SetSamples(std::move(samples));
+  Profile profile = ProfileAccessor::MakeProfile(std::move(fake_profile));
+
+  SizeHistogram expected;
+  AddToHistogram(profile, expected);
+  EXPECT_EQ(expected, (SizeHistogram{{24, 7}, {1000, 3}, {4096, 2}}));
+
+  absl::StatusOr<std::string> marshaled = Marshal(profile);
+  ASSERT_TRUE(marshaled.ok());
+  SizeHistogram histogram;
+  ASSERT_TRUE(AddMarshaledToHistogram(*marshaled, histogram).ok());
+  EXPECT_EQ(histogram, expected);
+
+  EXPECT_FALSE(AddMarshaledToHistogram("not a profile", histogram).ok());
+}
+
+TEST(SizeClassOptimizerTest, TableSource) {
+  const std::vector<SizeClassInfo> classes =
+      OptimizeSizeClasses({{96, 1}, {2000, 1}});
+  const std::string source = SizeClassTableSource(classes);
+  EXPECT_THAT(source, HasSubstr("default_custom_size_classes()"));
+  EXPECT_THAT(source,
+              HasSubstr(absl::StrCat("kPageShift == ", kPageShift, ",")));
+  EXPECT_THAT(source, HasSubstr("{    96,"));
+  EXPECT_THAT(source, HasSubstr("{  2048,"));
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -0,0 +1,171 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_SIZE_CLASS_RATES_H_
+#define TCMALLOC_SIZE_CLASS_RATES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/time/time.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/clock.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/explicitly_constructed.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/timeseries_tracker.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Tracks, per size class, the rate of objects that the per-CPU caches fetch on
+// underflows and return on overflows, over a sliding window.  The fast paths
+// are not counted, so these are the rates at which each size class's demand
+// reaches the backing caches, which is what cache sizes are tuned against.
+//
+// Recording costs one relaxed atomic add per slow path.  Update() moves the
+// counts into a TimeSeriesTracker, and must be called periodically, e.g. by
+// the background thread.
+class SizeClassRates {
+ public:
+  static constexpr size_t kEpochs = 12;
+  static constexpr absl::Duration kWindow = absl::Minutes(1);
+
+  struct Rates {
+    // Objects per second over the completed epochs of the window.
+    double refills_per_second = 0;
+    double overflows_per_second = 0;
+    // The highest rate of any completed epoch of the window.
+    double peak_refills_per_second = 0;
+    double peak_overflows_per_second = 0;
+  };
+
+  constexpr SizeClassRates() = default;
+  // For testing with a mock clock.
+  explicit constexpr SizeClassRates(Clock clock) : clock_(clock) {}
+
+  SizeClassRates(const SizeClassRates&) = delete;
+  SizeClassRates& operator=(const SizeClassRates&) = delete;
+
+  void RecordRefill(size_t size_class, size_t objects) {
+    TC_ASSERT_LT(size_class, kNumClasses);
+    counts_[size_class].refills.fetch_add(objects, std::memory_order_relaxed);
+  }
+
+  void RecordOverflow(size_t size_class, size_t objects) {
+    TC_ASSERT_LT(size_class, kNumClasses);
+    counts_[size_class].overflows.fetch_add(objects,
+                                            std::memory_order_relaxed);
+  }
+
+  // Reports the objects recorded since the last call to the current epoch.
+  void Update() ABSL_LOCKS_EXCLUDED(lock_) {
+    Entry delta;
+    for (size_t size_class = 0; size_class < kNumClasses; ++size_class) {
+      delta.refills[size_class] = counts_[size_class].refills.exchange(
+          0, std::memory_order_relaxed);
+      delta.overflows[size_class] = counts_[size_class].overflows.exchange(
+          0, std::memory_order_relaxed);
+    }
+
+    absl::base_internal::SpinLockHolder h(&lock_);
+    // TimeSeriesTracker reads the clock in its constructor, so it cannot be
+    // constant initialized with the CpuCache that owns this.
+    if (!tracker_constructed_) {
+      tracker_.Construct(clock_, kWindow);
+      tracker_constructed_ = true;
+    }
+    tracker_.get_mutable().Report(delta);
+  }
+
+  Rates GetRates(size_t size_class) const ABSL_LOCKS_EXCLUDED(lock_) {
+    TC_ASSERT_LT(size_class, kNumClasses);
+    Rates rates;
+    absl::base_internal::SpinLockHolder h(&lock_);
+    if (!tracker_constructed_) return rates;
+
+    Tracker& tracker = tracker_.get_mutable();
+    tracker.UpdateTimeBase();
+    const double epoch_seconds = absl::ToDoubleSeconds(kWindow / kEpochs);
+    uint64_t refills = 0, overflows = 0;
+    // Offset 0 is the current, incomplete, epoch.
+    tracker.IterBackwards(
+        [&](size_t offset, int64_t, const Entry& e) {
+          if (offset == 0) return;
+          refills += e.refills[size_class];
+          overflows += e.overflows[size_class];
+          rates.peak_refills_per_second =
+              std::max(rates.peak_refills_per_second,
+                       e.refills[size_class] / epoch_seconds);
+          rates.peak_overflows_per_second =
+              std::max(rates.peak_overflows_per_second,
+                       e.overflows[size_class] / epoch_seconds);
+        },
+        kEpochs);
+    rates.refills_per_second = refills / ((kEpochs - 1) * epoch_seconds);
+    rates.overflows_per_second = overflows / ((kEpochs - 1) * epoch_seconds);
+    return rates;
+  }
+
+ private:
+  struct Counts {
+    std::atomic<uint64_t> refills{0};
+    std::atomic<uint64_t> overflows{0};
+  };
+
+  struct Entry {
+    uint64_t refills[kNumClasses] = {};
+    uint64_t overflows[kNumClasses] = {};
+
+    static Entry Nil() { return Entry(); }
+    void Report(const Entry& delta) {
+      for (size_t i = 0; i < kNumClasses; ++i) {
+        refills[i] += delta.refills[i];
+        overflows[i] += delta.overflows[i];
+      }
+    }
+    bool empty() const {
+      for (size_t i = 0; i < kNumClasses; ++i) {
+        if (refills[i] != 0 || overflows[i] != 0) return false;
+      }
+      return true;
+    }
+  };
+
+  using Tracker = TimeSeriesTracker<Entry, Entry, kEpochs>;
+
+  Counts counts_[kNumClasses];
+
+  const Clock clock_ = {.now = absl::base_internal::CycleClock::Now,
+                        .freq = absl::base_internal::CycleClock::Frequency};
+  mutable absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  bool tracker_constructed_ ABSL_GUARDED_BY(lock_) = false;
+  // Mutable since reading the rates first moves the tracker to the current
+  // epoch.
+  mutable ExplicitlyConstructed<Tracker> tracker_ ABSL_GUARDED_BY(lock_);
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_SIZE_CLASS_RATES_H_
@@ -0,0 +1,117 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/size_class_rates.h"
+
+#include <stdint.h>
+
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "tcmalloc/internal/clock.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+const absl::Duration kEpoch =
+    SizeClassRates::kWindow / SizeClassRates::kEpochs;
+const double kEpochSeconds = absl::ToDoubleSeconds(kEpoch);
+// The rates are averaged over the completed epochs of the window.
+const double kWindowSeconds = (SizeClassRates::kEpochs - 1) * kEpochSeconds;
+
+class SizeClassRatesTest : public testing::Test {
+ protected:
+  static int64_t FakeClock() { return clock_; }
+
+  static double GetFakeClockFrequency() {
+    return absl::ToDoubleNanoseconds(absl::Seconds(2));
+  }
+
+  static void Advance(absl::Duration d) {
+    clock_ += absl::ToDoubleSeconds(d) * GetFakeClockFrequency();
+  }
+
+  static int64_t clock_;
+
+  SizeClassRates rates_{
+      Clock{.now = FakeClock, .freq = GetFakeClockFrequency}};
+};
+
+int64_t SizeClassRatesTest::clock_ = 1234;
+
+TEST_F(SizeClassRatesTest, EmptyBeforeUpdate) {
+  rates_.RecordRefill(1, 100);
+  const SizeClassRates::Rates r = rates_.GetRates(1);
+  EXPECT_EQ(r.refills_per_second, 0);
+  EXPECT_EQ(r.peak_refills_per_second, 0);
+}
+
+TEST_F(SizeClassRatesTest, CompletedEpochsOnly) {
+  rates_.RecordRefill(1, 100);
+  rates_.RecordOverflow(2, 50);
+  rates_.Update();
+
+  // Still in the current epoch.
+  SizeClassRates::Rates r = rates_.GetRates(1);
+  EXPECT_EQ(r.refills_per_second, 0);
+
+  Advance(kEpoch);
+  r = rates_.GetRates(1);
+  EXPECT_DOUBLE_EQ(r.refills_per_second, 100 / kWindowSeconds);
+  EXPECT_DOUBLE_EQ(r.peak_refills_per_second, 100 / kEpochSeconds);
+  EXPECT_EQ(r.overflows_per_second, 0);
+
+  r = rates_.GetRates(2);
+  EXPECT_EQ(r.refills_per_second, 0);
+  EXPECT_DOUBLE_EQ(r.overflows_per_second, 50 / kWindowSeconds);
+  EXPECT_DOUBLE_EQ(r.peak_overflows_per_second, 50 / kEpochSeconds);
+
+  EXPECT_EQ(rates_.GetRates(3).peak_refills_per_second, 0);
+}
+
+TEST_F(SizeClassRatesTest, Peak) {
+  for (int objects : {10, 40, 20}) {
+    rates_.RecordRefill(1, objects);
+    rates_.Update();
+    Advance(kEpoch);
+  }
+  const SizeClassRates::Rates r = rates_.GetRates(1);
+  EXPECT_DOUBLE_EQ(r.refills_per_second, 70 / kWindowSeconds);
+  EXPECT_DOUBLE_EQ(r.peak_refills_per_second, 40 / kEpochSeconds);
+}
+
+TEST_F(SizeClassRatesTest, Expires) {
+  rates_.RecordRefill(1, 100);
+  rates_.Update();
+  Advance(kEpoch);
+  EXPECT_GT(rates_.GetRates(1).refills_per_second, 0);
+
+  Advance(SizeClassRates::kWindow);
+  const SizeClassRates::Rates r = rates_.GetRates(1);
+  EXPECT_EQ(r.refills_per_second, 0);
+  EXPECT_EQ(r.peak_refills_per_second, 0);
+}
+
+TEST_F(SizeClassRatesTest, UpdateResetsCounts) {
+  rates_.RecordRefill(1, 100);
+  rates_.Update();
+  rates_.Update();
+  Advance(kEpoch);
+  EXPECT_DOUBLE_EQ(rates_.GetRates(1).refills_per_second,
+                   100 / kWindowSeconds);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
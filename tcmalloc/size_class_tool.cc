@@ -0,0 +1,150 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Generates size classes tuned to the allocation sizes of a binary.
+//
+// Usage:
+//   size_class_tool [--num_classes=N] [--output=my_size_classes.cc] \
+//       heap.pb.gz [allocations.pb.gz...]
+//
+// The inputs are profiles as produced by Marshal (profile_marshaler.h) from
+// MallocExtension::SnapshotCurrent or MallocExtension::StartAllocationProfiling.
+// The output is a C++ source file; to use it, link it into the binary like
+// want_legacy_size_classes:
+//
+//   cc_library(
+//       name = "my_size_classes",
+//       srcs = ["my_size_classes.cc"],
+//       deps = ["@com_google_tcmalloc//tcmalloc:common_8k_pages"],
+//       alwayslink = 1,
+//   )
+//
+// Size classes depend on the page size, so the tool must be built for the page
+// size of the binary (it emits a static_assert to that effect).
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/size_class_info.h"
+#include "tcmalloc/size_class_optimizer.h"
+#include "tcmalloc/sizemap.h"
+
+ABSL_FLAG(size_t, num_classes, tcmalloc::tcmalloc_internal::kNumBaseClasses,
+          "Number of size classes to generate, including class 0");
+ABSL_FLAG(size_t, max_increment_percent, 100,
+          "Maximum growth between consecutive size classes, regardless of the "
+          "profile");
+ABSL_FLAG(double, populate_cost_bytes, 16 << 10,
+          "Memory worth spending to save one span allocation per span's worth "
+          "of profiled objects; bigger values give hot size classes bigger "
+          "spans, 0 sizes spans by waste alone");
+ABSL_FLAG(std::string, output, "", "File to write the size classes to");
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+void PrintEstimate(absl::string_view name, const SizeHistogram& histogram,
+                   absl::Span<const SizeClassInfo> classes) {
+  const FragmentationEstimate estimate =
+      EstimateFragmentation(histogram, classes);
+  absl::FPrintF(stderr,
+                "%-9s %3u classes: internal fragmentation %6.2f%%, span waste "
+                "%6.2f%%\n",
+                name, classes.size() - 1,
+                100 * estimate.internal_bytes / estimate.requested_bytes,
+                100 * estimate.span_waste_bytes / estimate.requested_bytes);
+}
+
+int Run(const std::vector<char*>& profiles) {
+  if (profiles.empty()) {
+    absl::FPrintF(stderr, "Usage: size_class_tool [flags] profile...\n");
+    return 2;
+  }
+
+  SizeHistogram histogram;
+  for (const char* path : profiles) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+      absl::FPrintF(stderr, "Failed to open %s\n", path);
+      return 1;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    if (absl::Status status =
+            AddMarshaledToHistogram(contents.str(), histogram);
+        !status.ok()) {
+      absl::FPrintF(stderr, "%s: %s\n", path, status.ToString());
+      return 1;
+    }
+  }
+  if (histogram.empty()) {
+    absl::FPrintF(stderr, "No allocations of at most %u bytes found\n",
+                  kMaxSize);
+    return 1;
+  }
+
+  SizeClassOptimizerOptions options;
+  options.num_classes = absl::GetFlag(FLAGS_num_classes);
+  options.coverage.max_increment_percent =
+      absl::GetFlag(FLAGS_max_increment_percent);
+  options.populate_cost_bytes = absl::GetFlag(FLAGS_populate_cost_bytes);
+  if (options.num_classes < 2 || options.num_classes > kNumBaseClasses) {
+    absl::FPrintF(stderr, "--num_classes must be in [2, %u]\n",
+                  kNumBaseClasses);
+    return 2;
+  }
+  const std::vector<SizeClassInfo> classes =
+      OptimizeSizeClasses(histogram, options);
+
+  PrintEstimate("default", histogram, kSizeClasses.classes);
+  PrintEstimate("optimized", histogram, classes);
+
+  const std::string source = SizeClassTableSource(classes);
+  const std::string output = absl::GetFlag(FLAGS_output);
+  if (output.empty()) {
+    absl::PrintF("%s", source);
+    return 0;
+  }
+  std::ofstream out(output);
+  out << source;
+  out.close();
+  if (!out) {
+    absl::FPrintF(stderr, "Failed to write %s\n", output);
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+
+int main(int argc, char** argv) {
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  args.erase(args.begin());
+  return tcmalloc::tcmalloc_internal::Run(args);
+}
@@ -0,0 +1,44 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+
+#include "gtest/gtest.h"
+#include "absl/types/span.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/size_class_info.h"
+#include "tcmalloc/sizemap.h"
+#include "tcmalloc/static_vars.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Run with TCMALLOC_SIZE_CLASSES=reuse.
+TEST(SizeClassesFromEnvTest, SelectsReuseSizeClasses) {
+  // This test needs to validate against the actual SizeMap TCMalloc will use.
+  Static::InitIfNecessary();
+
+  ASSERT_EQ(Static::size_class_configuration(), SizeClassConfiguration::kReuse);
+
+  absl::Span<const SizeClassInfo> classes = kReuseSizeClasses.classes;
+  ASSERT_LE(classes.size(), kNumClasses);
+  for (int c = 0; c < classes.size(); ++c) {
+    EXPECT_EQ(Static::sizemap().class_to_size(c), classes[c].size) << c;
+  }
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
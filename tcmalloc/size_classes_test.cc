@@ -169,6 +169,7 @@ TEST_F(RunTimeSizeClassesTest, WastedSpan) {
     case SizeClassConfiguration::kLegacy:
     case SizeClassConfiguration::kPow2Below64:
     case SizeClassConfiguration::kReuse:
+    case SizeClassConfiguration::kCustom:
       // This test fails for other classes (was passing with a different span
       // size allocation algorithm used between cl/130150125 and cl/139955211).
       GTEST_SKIP();
@@ -47,6 +47,24 @@ const SizeClasses& SizeMap::CurrentClasses() {
     case SizeClassConfiguration::kLegacy:
       // TODO(b/242710633): remove this opt out.
       return kLegacySizeClasses;
+    case SizeClassConfiguration::kCustom:
+      return *default_custom_size_classes();
+  }
+  TC_BUG("unreachable");
+}
+
+const SizeMap::ClassArray* SizeMap::CurrentClassArray() {
+  switch (Static::size_class_configuration()) {
+    case SizeClassConfiguration::kPow2Below64:
+      return &kSizeClassArray;
+    case SizeClassConfiguration::kPow2Only:
+      return &kExperimentalPow2ClassArray;
+    case SizeClassConfiguration::kReuse:
+      return &kReuseClassArray;
+    case SizeClassConfiguration::kLegacy:
+      return &kLegacyClassArray;
+    case SizeClassConfiguration::kCustom:
+      return nullptr;
   }
   TC_BUG("unreachable");
 }
@@ -165,12 +183,16 @@ bool SizeMap::SetSizeClasses(absl::Span<const SizeClassInfo> size_classes) {
     ++curr;
   }
 
-  // Fill any unspecified size classes with 0.
+  // Fill any unspecified size classes with 0.  AddDynamicSizeClass may fill
+  // them later.
   for (int x = curr; x < kNumBaseClasses; x++) {
     class_to_size_[x] = 0;
     class_to_pages_[x] = 0;
     num_objects_to_move_[x] = 0;
+    max_capacity_[x] = 0;
   }
+  first_dynamic_class_ = std::min<size_t>(curr, kNumBaseClasses);
+  num_dynamic_classes_ = 0;
 
   // Copy selected size classes into the upper registers.
   for (int i = 1; i < (kNumClasses / kNumBaseClasses); i++) {
@@ -185,6 +207,53 @@ bool SizeMap::SetSizeClasses(absl::Span<const SizeClassInfo> size_classes) {
   return true;
 }
 
+size_t SizeMap::AddDynamicSizeClass(size_t size) {
+  size_t idx;
+  if (!ClassIndexMaybe(size, idx)) {
+    return 0;
+  }
+  const size_t size_class = first_dynamic_class_ + num_dynamic_classes_;
+  if (num_dynamic_classes_ >= kMaxDynamicClasses ||
+      size_class >= kNumBaseClasses) {
+    return 0;
+  }
+  const size_t enclosing = class_array_[idx];
+  if (enclosing == 0 || class_to_size_[enclosing] == size) {
+    return 0;
+  }
+  TC_ASSERT_GT(class_to_size_[enclosing], size);
+  if (!IsValidSizeClass(size, class_to_pages_[enclosing],
+                        num_objects_to_move_[enclosing])) {
+    return 0;
+  }
+
+  for (size_t offset = 0; offset < kExpandedClassesStart;
+       offset += kNumBaseClasses) {
+    class_to_size_[size_class + offset] = size;
+    class_to_pages_[size_class + offset] = class_to_pages_[enclosing];
+    num_objects_to_move_[size_class + offset] = num_objects_to_move_[enclosing];
+    max_capacity_[size_class + offset] = max_capacity_[enclosing];
+    dynamic_enclosing_class_[size_class + offset] = enclosing + offset;
+  }
+  ++num_dynamic_classes_;
+  return size_class;
+}
+
+void SizeMap::PublishDynamicSizeClass(size_t size_class) {
+  TC_ASSERT(IsDynamicSizeClass(size_class));
+  const size_t size = class_to_size_[size_class];
+  TC_ASSERT_NE(size, 0);
+  // Lookups race with these stores, and see either the new class or the one
+  // it was carved out of, which both fit <size>.  The release orders the
+  // stores after those of the new class's metadata.
+  for (size_t i = ClassIndex(size);
+       i > 0 && class_to_size_[class_array_[i]] > size; --i) {
+    __atomic_store_n(&class_array_[i],
+                     static_cast<CompactSizeClass>(size_class),
+                     __ATOMIC_RELEASE);
+  }
+}
+
 // Return true if all size classes meet the requirements for alignment
 // ordering and min and max values.
 bool SizeMap::ValidSizeClasses(absl::Span<const SizeClassInfo> size_classes) {
@@ -228,34 +297,31 @@ bool SizeMap::ValidSizeClasses(absl::Span<const SizeClassInfo> size_classes) {
 }
 
 // Initialize the mapping arrays
-bool SizeMap::Init(absl::Span<const SizeClassInfo> size_classes) {
+bool SizeMap::Init(absl::Span<const SizeClassInfo> size_classes,
+                   const ClassArray* class_array) {
   // Do some sanity checking on add_amount[]/shift_amount[]/class_array[]
   TC_CHECK_EQ(ClassIndex(0), 0);
   TC_CHECK_LT(ClassIndex(kMaxSize), sizeof(class_array_));
+  TC_CHECK_EQ(ClassIndex(kMaxSize), ConstexprClassIndex(kMaxSize));
   static_assert(kAlignment <= std::align_val_t{16}, "kAlignment is too large");
 
   if (!SetSizeClasses(size_classes)) {
     return false;
   }
 
-  int next_size = 0;
-  for (int c = 1; c < kNumClasses; c++) {
-    const int max_size_in_class = class_to_size_[c];
-
-    for (int s = next_size; s <= max_size_in_class;
-         s += static_cast<size_t>(kAlignment)) {
-      class_array_[ClassIndex(s)] = c;
-    }
-    next_size = max_size_in_class + static_cast<size_t>(kAlignment);
-    if (next_size > kMaxSize) {
-      break;
-    }
+  if (class_array != nullptr) {
+    std::copy(class_array->begin(), class_array->end(), &class_array_[0]);
+  } else {
+    const ClassArray computed = BuildClassArray(size_classes);
+    std::copy(computed.begin(), computed.end(), &class_array_[0]);
   }
 
   if (!ColdFeatureActive()) {
     return true;
   }
 
+  int next_size = 0;
+
   memset(cold_sizes_, 0, sizeof(cold_sizes_));
   cold_sizes_count_ = 0;
   // Point all lookups in the upper register of class_array_ (allocations
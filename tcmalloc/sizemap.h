@@ -18,6 +18,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <array>
+
 #include "absl/base/attributes.h"
 #include "absl/base/dynamic_annotations.h"
 #include "absl/base/optimization.h"
@@ -42,6 +45,10 @@ extern const SizeClasses kLegacySizeClasses;
 extern const SizeClasses kLowFragSizeClasses;
 extern const SizeClasses kReuseSizeClasses;
 
+// Size classes generated for a binary by size_class_tool.  If linked in and
+// non-null, these take precedence over the default and legacy size classes.
+const SizeClasses* ABSL_ATTRIBUTE_WEAK default_custom_size_classes();
+
 // Size-class information + mapping
 class SizeMap {
  public:
@@ -159,6 +166,16 @@ class SizeMap {
   // Mapping from size class to max size storable in that class
   uint32_t class_to_size_[kNumClasses] = {0};
 
+  // The size class slots from first_dynamic_class_ to kNumBaseClasses (in each
+  // NUMA partition) are left unused by the configured size classes, and are
+  // filled by AddDynamicSizeClass.
+  size_t first_dynamic_class_ = kNumBaseClasses;
+  size_t num_dynamic_classes_ = 0;
+
+  // For each dynamic size class, the size class its sizes were served from
+  // before it was added.
+  CompactSizeClass dynamic_enclosing_class_[kNumClasses] = {0};
+
  protected:
   // Set the give size classes to be used by TCMalloc.
   bool SetSizeClasses(absl::Span<const SizeClassInfo> size_classes);
@@ -170,9 +187,47 @@ class SizeMap {
   size_t cold_sizes_count_ = 0;
 
  public:
+  // The class_array_ lookup of the base size classes.
+  using ClassArray = std::array<CompactSizeClass, kClassArraySize>;
+
+  // As ClassIndex, for use in constant expressions.  REQUIRES: s <= kMaxSize.
+  static constexpr size_t ConstexprClassIndex(size_t s) {
+    return s <= kLargeSize ? (s + 7) >> 3 : (s + 127 + (120 << 7)) >> 7;
+  }
+
+  // Returns the class_array_ lookup that Init computes for <size_classes>.
+  // This is constexpr so that the lookup of a size class list known at compile
+  // time is built by the compiler rather than at startup (see
+  // CurrentClassArray).
+  static constexpr ClassArray BuildClassArray(
+      absl::Span<const SizeClassInfo> size_classes) {
+    ClassArray class_array = {};
+    const size_t num_classes = std::min(size_classes.size(), kNumBaseClasses);
+    size_t next_size = 0;
+    for (size_t c = 1; c < num_classes; c++) {
+      const size_t max_size_in_class = size_classes[c].size;
+      // ConstexprClassIndex is monotonic and maps consecutive multiples of
+      // kAlignment to consecutive (or equal) indices.
+      for (size_t i = ConstexprClassIndex(next_size),
+                  end = ConstexprClassIndex(max_size_in_class);
+           i <= end; i++) {
+        class_array[i] = c;
+      }
+      next_size = max_size_in_class + static_cast<size_t>(kAlignment);
+      if (next_size > kMaxSize) {
+        break;
+      }
+    }
+    return class_array;
+  }
+
   // Returns size classes to use in the current process.
   static const SizeClasses& CurrentClasses();
 
+  // Returns BuildClassArray(CurrentClasses().classes), as computed at compile
+  // time, or nullptr if it is not known at compile time.
+  static const ClassArray* CurrentClassArray();
+
   // Checks assumptions used to generate the current size classes.
   // Prints any wrong assumptions to stderr.
   static void CheckAssumptions();
@@ -181,8 +236,21 @@ class SizeMap {
   // rely on Init() to populate things.
   constexpr SizeMap() = default;
 
-  // Initialize the mapping arrays.  Returns true on success.
-  bool Init(absl::Span<const SizeClassInfo> size_classes);
+  // Initialize the mapping arrays.  Returns true on success.  <class_array>,
+  // if not null, must be BuildClassArray(size_classes): it is copied instead
+  // of being computed.
+  bool Init(absl::Span<const SizeClassInfo> size_classes,
+            const ClassArray* class_array = nullptr);
+
+  // Returns the alignment to allocate an object aligned to `align` with, so
+  // that it shares no cache line with any other allocation.  GetSizeClass only
+  // picks size classes whose size is a multiple of the alignment, and objects
+  // are carved from page aligned spans, so an object aligned to a cache line
+  // fills the cache lines it is on.  Allocations that do not fit a size class
+  // get pages of their own, which are aligned to a cache line too.
+  static constexpr size_t IsolatedAlignment(size_t align) {
+    return std::max<size_t>(align, ABSL_CACHELINE_SIZE);
+  }
 
   // Returns the size class for size `size` respecting the alignment
   // & access requirements of `policy`.
@@ -242,7 +310,11 @@ class SizeMap {
     // so avoid the loop overhead on the fast path.
     if (ABSL_PREDICT_FALSE(class_to_size(*size_class) & (align - 1))) {
       do {
-        ++*size_class;
+        // Dynamic size classes are numbered after the others, so the next
+        // larger class is the one they were carved out of.
+        *size_class = ABSL_PREDICT_FALSE(IsDynamicSizeClass(*size_class))
+                          ? dynamic_enclosing_class_[*size_class]
+                          : *size_class + 1;
       } while (ABSL_PREDICT_FALSE(class_to_size(*size_class) & (align - 1)));
     }
     return true;
@@ -298,8 +370,56 @@ class SizeMap {
 
   static bool IsValidSizeClass(size_t size, size_t num_pages,
                                size_t num_objects_to_move);
+
+  // The most size classes AddDynamicSizeClass adds.
+  static constexpr size_t kMaxDynamicClasses = 4;
+
+  // Returns true if <size_class> was, or may later be, added by
+  // AddDynamicSizeClass.
+  ABSL_ATTRIBUTE_ALWAYS_INLINE bool IsDynamicSizeClass(
+      size_t size_class) const {
+    if (size_class >= kExpandedClassesStart) return false;
+    return size_class % kNumBaseClasses >= first_dynamic_class_;
+  }
+
+  // Adds a size class for objects of <size> bytes, which currently round up to
+  // a larger size class, in one of the slots the configured size classes leave
+  // unused.  The new class takes its pages, batch size and capacity from that
+  // larger class, and GetSizeClass does not return it before
+  // PublishDynamicSizeClass.  Returns the new size class (of NUMA partition 0,
+  // the other partitions get theirs at the usual offsets), or 0 if <size> is
+  // not a valid size class, is one already, or no slot is left.
+  //
+  // Objects allocated before the class is published keep their larger class,
+  // so sized deallocations of sizes that map to a dynamic size class look up
+  // the size class of the object instead (see IsDynamicSizeClass).
+  //
+  // REQUIRES: only called by one thread at a time.
+  size_t AddDynamicSizeClass(size_t size);
+
+  // Makes GetSizeClass return <size_class>, added by AddDynamicSizeClass, for
+  // the sizes it serves.  The caller must first initialize whatever backs
+  // <size_class> in each NUMA partition, e.g. its central freelist.
+  void PublishDynamicSizeClass(size_t size_class);
+
+  size_t first_dynamic_class() const { return first_dynamic_class_; }
+  size_t num_dynamic_classes() const { return num_dynamic_classes_; }
+
+  // Returns the size class that served the sizes of dynamic <size_class>
+  // before it was added.
+  size_t dynamic_enclosing_class(size_t size_class) const {
+    TC_ASSERT(IsDynamicSizeClass(size_class));
+    return dynamic_enclosing_class_[size_class];
+  }
 };
 
+// class_array_ lookups of the size class tables above, built at compile time
+// next to each table.
+extern const SizeMap::ClassArray kSizeClassArray;
+extern const SizeMap::ClassArray kExperimentalPow2ClassArray;
+extern const SizeMap::ClassArray kLegacyClassArray;
+extern const SizeMap::ClassArray kReuseClassArray;
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
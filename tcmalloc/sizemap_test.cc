@@ -117,4 +117,56 @@ TEST(ColdSizeClassTest, VerifyAllocationFullRange) {
   }
 }
 
+TEST(DynamicSizeClassTest, AddAndPublish) {
+  SizeMap size_map;
+  const auto& classes = kSizeClasses.classes;
+  ASSERT_TRUE(size_map.Init(classes));
+  if (size_map.first_dynamic_class() >= kNumBaseClasses) {
+    GTEST_SKIP() << "no unused size class slots";
+  }
+  EXPECT_FALSE(size_map.IsDynamicSizeClass(0));
+  EXPECT_FALSE(size_map.IsDynamicSizeClass(size_map.first_dynamic_class() - 1));
+  EXPECT_TRUE(size_map.IsDynamicSizeClass(size_map.first_dynamic_class()));
+
+  // Find a size between two size classes that is not 16-byte aligned.
+  size_t size = 0;
+  for (int i = 1; i + 1 < classes.size(); ++i) {
+    if (classes[i].size % 16 == 0 &&
+        classes[i + 1].size >= classes[i].size + 16 &&
+        classes[i + 1].size <= SizeMap::kLargeSize) {
+      size = classes[i].size + 8;
+      break;
+    }
+  }
+  ASSERT_NE(size, 0);
+
+  const size_t enclosing = size_map.SizeClass(CppPolicy(), size);
+  const size_t larger = size_map.SizeClass(CppPolicy(), size + 8);
+  EXPECT_EQ(size_map.AddDynamicSizeClass(size_map.class_to_size(enclosing)),
+            0);
+  const size_t size_class = size_map.AddDynamicSizeClass(size);
+  ASSERT_NE(size_class, 0);
+  EXPECT_TRUE(size_map.IsDynamicSizeClass(size_class));
+  EXPECT_EQ(size_map.num_dynamic_classes(), 1);
+  EXPECT_EQ(size_map.class_to_size(size_class), size);
+  EXPECT_EQ(size_map.class_to_pages(size_class),
+            size_map.class_to_pages(enclosing));
+  // Not returned before it is published.
+  EXPECT_EQ(size_map.SizeClass(CppPolicy(), size), enclosing);
+
+  size_map.PublishDynamicSizeClass(size_class);
+  const size_t found = size_map.SizeClass(CppPolicy(), size);
+  EXPECT_EQ(size_map.class_to_size(found), size);
+  EXPECT_EQ(size_map.dynamic_enclosing_class(found), enclosing);
+  EXPECT_EQ(size_map.SizeClass(CppPolicy(), size - 7), found);
+  EXPECT_EQ(size_map.SizeClass(CppPolicy(), size + 8), larger);
+  EXPECT_EQ(size_map.AddDynamicSizeClass(size), 0);
+
+  // Aligned lookups skip the dynamic size class, which is not 16-byte aligned.
+  const size_t aligned = size_map.SizeClass(CppPolicy().AlignAs(16), size);
+  EXPECT_FALSE(size_map.IsDynamicSizeClass(aligned));
+  EXPECT_EQ(size_map.class_to_size(aligned) % 16, 0);
+  EXPECT_GE(size_map.class_to_size(aligned), size);
+}
+
 }  // namespace tcmalloc::tcmalloc_internal
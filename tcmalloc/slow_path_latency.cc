@@ -0,0 +1,135 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/slow_path_latency.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/base/attributes.h"
+#include "absl/strings/string_view.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/optimization.h"
+#include "tcmalloc/parameters.h"
+#include "tcmalloc/static_vars.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+absl::string_view SlowPathTierName(SlowPathTier tier) {
+  switch (tier) {
+    case SlowPathTier::kCpuCacheRefill:
+      return "cpu_cache_refill";
+    case SlowPathTier::kTransferCacheMiss:
+      return "transfer_cache_miss";
+    case SlowPathTier::kSpanAllocation:
+      return "span_allocation";
+    case SlowPathTier::kPageHeap:
+      return "page_heap";
+    case SlowPathTier::kSystemAlloc:
+      return "system_alloc";
+    case SlowPathTier::kNumTiers:
+      break;
+  }
+  ASSUME(false);
+  return "";
+}
+
+SlowPathLatencyHistograms& slow_path_latency() {
+  ABSL_CONST_INIT static SlowPathLatencyHistograms histograms;
+  return histograms;
+}
+
+uint64_t SlowPathLatencyHistograms::TotalCount(SlowPathTier tier) const {
+  uint64_t total = 0;
+  for (size_t size_class = 0; size_class < kNumClasses; ++size_class) {
+    for (int bucket = 0; bucket < kNumBuckets; ++bucket) {
+      total += count(tier, size_class, bucket);
+    }
+  }
+  return total;
+}
+
+void SlowPathLatencyHistograms::Print(Printer* out) const {
+  out->printf("------------------------------------------------\n");
+  out->printf("Slow path latency histograms (cycles, %s)\n",
+              Parameters::slow_path_latency_histograms() ? "enabled"
+                                                         : "disabled");
+  out->printf("------------------------------------------------\n");
+  for (int t = 0; t < kNumSlowPathTiers; ++t) {
+    const SlowPathTier tier = static_cast<SlowPathTier>(t);
+    const uint64_t events = TotalCount(tier);
+    const uint64_t cycles = TotalCycles(tier);
+    out->printf("%-20s: %12u events, %16u cycles, %10.1f cycles/event\n",
+                SlowPathTierName(tier), events, cycles,
+                safe_div(cycles, events));
+    if (events == 0) continue;
+
+    for (size_t size_class = 0; size_class < kNumClasses; ++size_class) {
+      uint64_t class_events = 0;
+      for (int bucket = 0; bucket < kNumBuckets; ++bucket) {
+        class_events += count(tier, size_class, bucket);
+      }
+      if (class_events == 0) continue;
+
+      out->printf("  class %3d [ %8zu bytes ] :", size_class,
+                  tc_globals.sizemap().class_to_size(size_class));
+      for (int bucket = 0; bucket < kNumBuckets; ++bucket) {
+        out->printf(" %u", count(tier, size_class, bucket));
+      }
+      out->printf("\n");
+    }
+  }
+}
+
+void SlowPathLatencyHistograms::PrintInPbtxt(PbtxtRegion* region) const {
+  region->PrintBool("slow_path_latency_enabled",
+                    Parameters::slow_path_latency_histograms());
+  for (int t = 0; t < kNumSlowPathTiers; ++t) {
+    const SlowPathTier tier = static_cast<SlowPathTier>(t);
+    const uint64_t events = TotalCount(tier);
+    PbtxtRegion entry = region->CreateSubRegion("slow_path_latency");
+    entry.PrintRaw("tier", SlowPathTierName(tier));
+    entry.PrintI64("count", events);
+    entry.PrintI64("total_cycles", TotalCycles(tier));
+    if (events == 0) continue;
+
+    for (size_t size_class = 0; size_class < kNumClasses; ++size_class) {
+      uint64_t class_events = 0;
+      for (int bucket = 0; bucket < kNumBuckets; ++bucket) {
+        class_events += count(tier, size_class, bucket);
+      }
+      if (class_events == 0) continue;
+
+      PbtxtRegion histogram = entry.CreateSubRegion("histogram");
+      histogram.PrintI64("sizeclass",
+                         tc_globals.sizemap().class_to_size(size_class));
+      histogram.PrintI64("count", class_events);
+      for (int bucket = 0; bucket < kNumBuckets; ++bucket) {
+        const uint64_t bucket_count = count(tier, size_class, bucket);
+        if (bucket_count == 0) continue;
+        PbtxtRegion b = histogram.CreateSubRegion("bucket");
+        b.PrintI64("upper_bound_cycles", BucketUpperBound(bucket));
+        b.PrintI64("count", bucket_count);
+      }
+    }
+  }
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,155 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_SLOW_PATH_LATENCY_H_
+#define TCMALLOC_SLOW_PATH_LATENCY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/optimization.h"
+#include "absl/numeric/bits.h"
+#include "absl/strings/string_view.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/internal/usdt.h"
+#include "tcmalloc/parameters.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// The tiers of the allocation slow path, from the closest to the fast path to
+// the furthest away.  Tiers nest, so the latency of a tier includes the
+// latency of every tier below it that it had to fall back to.
+enum class SlowPathTier {
+  // CpuCache::Refill, i.e. a per-CPU cache underflow.
+  kCpuCacheRefill,
+  // CentralFreeList::RemoveRange, i.e. a transfer cache miss.
+  kTransferCacheMiss,
+  // CentralFreeList::Populate, i.e. allocating and carving a new span.
+  kSpanAllocation,
+  // PageAllocator::New{,Aligned}.
+  kPageHeap,
+  // SystemAlloc, i.e. growing the heap with mmap.
+  kSystemAlloc,
+  kNumTiers,
+};
+
+inline constexpr int kNumSlowPathTiers =
+    static_cast<int>(SlowPathTier::kNumTiers);
+
+absl::string_view SlowPathTierName(SlowPathTier tier);
+
+// Cycle-count histograms of slow path latencies, per tier and size class.
+// Tiers without a size class (large allocations and the system allocator)
+// are recorded under size class 0.
+//
+// Bucket b counts latencies below 2^(kMinBucketShift + b) cycles that did not
+// fit in bucket b - 1; the last bucket is unbounded.
+class SlowPathLatencyHistograms {
+ public:
+  static constexpr int kNumBuckets = 16;
+  static constexpr int kMinBucketShift = 7;
+
+  constexpr SlowPathLatencyHistograms() = default;
+
+  static constexpr int BucketFor(uint64_t cycles) {
+    const int bucket = absl::bit_width(cycles >> kMinBucketShift);
+    return bucket < kNumBuckets ? bucket : kNumBuckets - 1;
+  }
+
+  // Upper bound (exclusive) of <bucket> in cycles, or 0 for the last,
+  // unbounded, bucket.
+  static constexpr uint64_t BucketUpperBound(int bucket) {
+    return bucket + 1 < kNumBuckets ? uint64_t{1} << (kMinBucketShift + bucket)
+                                    : 0;
+  }
+
+  void Record(SlowPathTier tier, size_t size_class, uint64_t cycles) {
+    TC_ASSERT_LT(size_class, kNumClasses);
+    const int t = static_cast<int>(tier);
+    buckets_[t][size_class][BucketFor(cycles)].fetch_add(
+        1, std::memory_order_relaxed);
+    total_cycles_[t].Add(cycles);
+  }
+
+  uint64_t count(SlowPathTier tier, size_t size_class, int bucket) const {
+    return buckets_[static_cast<int>(tier)][size_class][bucket].load(
+        std::memory_order_relaxed);
+  }
+
+  // Number of recorded events of <tier>, across all size classes.
+  uint64_t TotalCount(SlowPathTier tier) const;
+
+  // Sum of the latencies recorded for <tier>, in cycles.
+  uint64_t TotalCycles(SlowPathTier tier) const {
+    return total_cycles_[static_cast<int>(tier)].value();
+  }
+
+  void Print(Printer* out) const;
+  void PrintInPbtxt(PbtxtRegion* region) const;
+
+ private:
+  std::atomic<uint64_t> buckets_[kNumSlowPathTiers][kNumClasses][kNumBuckets] =
+      {};
+  // Every slow path updates these, from any CPU.
+  subtle::percpu::PerCpuCounter total_cycles_[kNumSlowPathTiers];
+};
+
+SlowPathLatencyHistograms& slow_path_latency();
+
+// Records the lifetime of the timer into slow_path_latency() when
+// Parameters::slow_path_latency_histograms() is set, and reports it to the
+// slow_path USDT probe while it is traced (see usdt.h).  When disabled this
+// costs a single relaxed load.
+class SlowPathLatencyTimer {
+ public:
+  SlowPathLatencyTimer(SlowPathTier tier, size_t size_class)
+      : tier_(tier),
+        size_class_(size_class),
+        start_(ABSL_PREDICT_FALSE(Parameters::slow_path_latency_histograms() ||
+                                  TC_USDT_ENABLED(slow_path))
+                   ? absl::base_internal::CycleClock::Now()
+                   : 0) {}
+
+  SlowPathLatencyTimer(const SlowPathLatencyTimer&) = delete;
+  SlowPathLatencyTimer& operator=(const SlowPathLatencyTimer&) = delete;
+
+  ~SlowPathLatencyTimer() {
+    if (ABSL_PREDICT_TRUE(start_ == 0)) return;
+    const int64_t elapsed = absl::base_internal::CycleClock::Now() - start_;
+    const uint64_t cycles = elapsed > 0 ? static_cast<uint64_t>(elapsed) : 0;
+    if (Parameters::slow_path_latency_histograms()) {
+      slow_path_latency().Record(tier_, size_class_, cycles);
+    }
+    TC_USDT_PROBE(slow_path, static_cast<int>(tier_), size_class_, cycles);
+  }
+
+ private:
+  const SlowPathTier tier_;
+  const size_t size_class_;
+  const int64_t start_;
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_SLOW_PATH_LATENCY_H_
@@ -0,0 +1,97 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/slow_path_latency.h"
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/parameters.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+using Histograms = SlowPathLatencyHistograms;
+
+TEST(SlowPathLatencyTest, Buckets) {
+  EXPECT_EQ(Histograms::BucketFor(0), 0);
+  EXPECT_EQ(Histograms::BucketFor((1 << Histograms::kMinBucketShift) - 1), 0);
+  EXPECT_EQ(Histograms::BucketFor(1 << Histograms::kMinBucketShift), 1);
+  EXPECT_EQ(Histograms::BucketFor(~uint64_t{0}), Histograms::kNumBuckets - 1);
+
+  for (int bucket = 0; bucket + 1 < Histograms::kNumBuckets; ++bucket) {
+    const uint64_t bound = Histograms::BucketUpperBound(bucket);
+    EXPECT_EQ(Histograms::BucketFor(bound - 1), bucket);
+    EXPECT_EQ(Histograms::BucketFor(bound), bucket + 1);
+  }
+  EXPECT_EQ(Histograms::BucketUpperBound(Histograms::kNumBuckets - 1), 0);
+}
+
+TEST(SlowPathLatencyTest, Record) {
+  // The histograms are large, so keep them off the stack.
+  auto histograms = std::make_unique<Histograms>();
+  constexpr size_t kSizeClass = 3;
+
+  histograms->Record(SlowPathTier::kPageHeap, kSizeClass, 10);
+  histograms->Record(SlowPathTier::kPageHeap, kSizeClass, 1000);
+  histograms->Record(SlowPathTier::kPageHeap, 0, 1000);
+
+  EXPECT_EQ(histograms->count(SlowPathTier::kPageHeap, kSizeClass,
+                              Histograms::BucketFor(10)),
+            1);
+  EXPECT_EQ(histograms->count(SlowPathTier::kPageHeap, kSizeClass,
+                              Histograms::BucketFor(1000)),
+            1);
+  EXPECT_EQ(histograms->TotalCount(SlowPathTier::kPageHeap), 3);
+  EXPECT_EQ(histograms->TotalCycles(SlowPathTier::kPageHeap), 2010);
+  EXPECT_EQ(histograms->TotalCount(SlowPathTier::kCpuCacheRefill), 0);
+
+  std::string buf(64 << 10, '\0');
+  {
+    Printer printer(buf.data(), buf.size());
+    PbtxtRegion region(&printer, kTop);
+    histograms->PrintInPbtxt(&region);
+  }
+  EXPECT_THAT(buf, testing::HasSubstr("tier: page_heap"));
+  EXPECT_THAT(buf, testing::HasSubstr("total_cycles: 2010"));
+}
+
+TEST(SlowPathLatencyTest, Timer) {
+  const bool was_enabled = Parameters::slow_path_latency_histograms();
+  constexpr size_t kSizeClass = 1;
+
+  Parameters::set_slow_path_latency_histograms(false);
+  const uint64_t before =
+      slow_path_latency().TotalCount(SlowPathTier::kSpanAllocation);
+  { SlowPathLatencyTimer timer(SlowPathTier::kSpanAllocation, kSizeClass); }
+  EXPECT_EQ(slow_path_latency().TotalCount(SlowPathTier::kSpanAllocation),
+            before);
+
+  Parameters::set_slow_path_latency_histograms(true);
+  { SlowPathLatencyTimer timer(SlowPathTier::kSpanAllocation, kSizeClass); }
+  EXPECT_EQ(slow_path_latency().TotalCount(SlowPathTier::kSpanAllocation),
+            before + 1);
+
+  Parameters::set_slow_path_latency_histograms(was_enabled);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -27,6 +27,7 @@
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
+#include "tcmalloc/internal/prefetch.h"
 #include "tcmalloc/internal/sampled_allocation.h"
 #include "tcmalloc/pages.h"
 #include "tcmalloc/sampler.h"
@@ -134,6 +135,16 @@ double Span::Fragmentation(size_t object_size) const {
 //              \/
 //              [---|idx|idx|idx|idx|idx|idx|idx]  16-byte object
 //
+// Objects that have never been allocated are on neither component.  A fresh
+// span records the index just past its last object in uncarved_ and objects
+// are carved off the top of [0, uncarved_) once the cache and the freelist are
+// empty.  Building the whole freelist up front would instead write to objects
+// all over the span, while populating it, before any of them are needed.
+//
+// Spans given a FreelistBitmap (see set_freelist_bitmap) record free objects
+// in it instead of in the cache and the freelist, so that pushing and popping
+// never touches the objects.  embed_count_ then holds the number of set bits.
+//
 
 void* Span::BitmapIdxToPtr(ObjIdx idx, size_t size) const {
   uintptr_t off = first_page().start_uintptr() + idx * size;
@@ -170,9 +181,34 @@ size_t Span::FreelistPopBatch(const absl::Span<void*> batch, size_t size) {
   if (ABSL_PREDICT_FALSE(UseBitmapForSize(size))) {
     return BitmapPopBatch(batch, size);
   }
+  if (ABSL_PREDICT_FALSE(has_freelist_bitmap_)) {
+    return FreelistBitmapPopBatch(batch.data(), batch.size(), size);
+  }
   return ListPopBatch(batch.data(), batch.size(), size);
 }
 
+size_t Span::FreelistBitmapPopBatch(void** __restrict batch, size_t N,
+                                    size_t size) {
+  FreelistBitmap& bitmap = *small_span_state_.freelist_bitmap;
+  const uintptr_t span_start = first_page().start_uintptr();
+  size_t result = 0;
+  // Popped bits are cleared, so each search resumes at the last one found.
+  for (size_t idx = 0; result < N && embed_count_ != 0; ++result) {
+    idx = bitmap.FindSet(idx);
+    TC_ASSERT_LT(idx, bitmap.size());
+    bitmap.ClearBit(idx);
+    embed_count_--;
+    batch[result] = IdxToPtr(idx, size, span_start);
+  }
+
+  if (result < N && uncarved_ != 0) {
+    result += CarvePopBatch(batch + result, N - result, size, span_start);
+  }
+  allocated_.store(allocated_.load(std::memory_order_relaxed) + result,
+                   std::memory_order_relaxed);
+  return result;
+}
+
 size_t Span::ListPopBatch(void** __restrict batch, size_t N, size_t size) {
   size_t result = 0;
 
@@ -201,6 +237,10 @@ size_t Span::ListPopBatch(void** __restrict batch, size_t N, size_t size) {
     size_t iter = embed_count;
     if (result + embed_count > N) {
       iter = N - result;
+    } else if (result + embed_count + 1 < N && host[0] != kListEnd) {
+      // We will move on to the next object on the freelist: start fetching
+      // it while this one is emptied.
+      PrefetchT0(IdxToPtr(host[0], size, span_start));
     }
     for (size_t i = 0; i < iter; i++) {
       // Pop from the first object on freelist.
@@ -223,11 +263,29 @@ size_t Span::ListPopBatch(void** __restrict batch, size_t N, size_t size) {
     freelist_ = host[0];
     embed_count_ = size / sizeof(ObjIdx) - 1;
   }
+
+  if (result < N && uncarved_ != 0) {
+    result += CarvePopBatch(batch + result, N - result, size, span_start);
+  }
   allocated_.store(allocated_.load(std::memory_order_relaxed) + result,
                    std::memory_order_relaxed);
   return result;
 }
 
+size_t Span::CarvePopBatch(void** __restrict batch, size_t N, size_t size,
+                           uintptr_t start) {
+  const ObjIdx idxStep = size / static_cast<size_t>(kAlignment);
+  ObjIdx idx = uncarved_;
+  TC_ASSERT_EQ(idx % idxStep, 0);
+  size_t result = 0;
+  for (; result < N && idx != 0; ++result) {
+    idx -= idxStep;
+    batch[result] = IdxToPtr(idx, size, start);
+  }
+  uncarved_ = idx;
+  return result;
+}
+
 uint32_t Span::CalcReciprocal(size_t size) {
   // Calculate scaling factor. We want to avoid dividing by the size of the
   // object. Instead we'll multiply by a scaled version of the reciprocal.
@@ -254,78 +312,44 @@ int Span::BuildFreelist(size_t size, size_t count, absl::Span<void*> batch,
   TC_ASSERT(!is_large_or_sampled());
   TC_ASSERT_GT(count, 0);
   freelist_ = kListEnd;
+  uncarved_ = 0;
 
   if (UseBitmapForSize(size)) {
     BuildBitmap(size, count);
     return BitmapPopBatch(batch, size);
   }
 
-  // First, push as much as we can into the batch.
-  const uintptr_t start = first_page().start_uintptr();
-  char* ptr = reinterpret_cast<char*>(start);
-  int result = batch.size() <= count ? batch.size() : count;
-  for (int i = 0; i < result; ++i) {
-    batch[i] = ptr;
-    ptr += size;
-  }
-  allocated_.store(result, std::memory_order_relaxed);
-
   const ObjIdx idxStep = size / static_cast<size_t>(kAlignment);
   // Valid objects are {0, idxStep, idxStep * 2, ..., idxStep * (count - 1)}.
-  ObjIdx idx = idxStep * result;
-
+  //
   // Verify that the end of the useful portion of the span (and the beginning of
   // the span waste) has an index that doesn't overflow or risk confusion with
   // kListEnd. This is slightly stronger than we actually need (see comment in
   // PtrToIdx for that) but rules out some bugs and weakening it wouldn't
   // actually help. One example of the potential bugs that are ruled out is the
-  // possibility of idxEnd (below) overflowing.
+  // possibility of uncarved_ (below) overflowing.
   TC_ASSERT_LT(count * idxStep, kListEnd);
+  static_assert(kListEnd < (uint32_t{1} << kUncarvedBits));
 
-  // The index of the end of the useful portion of the span.
-  ObjIdx idxEnd = count * idxStep;
-
-  // Then, push as much as we can into the cache.
   TC_ASSERT_GE(max_cache_size, kCacheSize);
   TC_ASSERT_LE(max_cache_size, kLargeCacheSize);
 
+  if (has_freelist_bitmap_) {
+    small_span_state_.freelist_bitmap->Clear();
+  }
   if (max_cache_size == Span::kLargeCacheSize) {
     memcpy(&small_span_state_.cache[Span::kLargeCacheSize], &alloc_time,
            sizeof(alloc_time));
   }
 
-  int cache_size = 0;
-  for (; idx < idxEnd && cache_size < max_cache_size; idx += idxStep) {
-    small_span_state_.cache[cache_size] = idx;
-    cache_size++;
-  }
-  cache_size_ = cache_size;
-
-  // Now, build freelist and stack other objects onto freelist objects.
-  // Note: we take freelist objects from the beginning and stacked objects
-  // from the end. This has a nice property of not paging in whole span at once
-  // and not draining whole cache.
-  ObjIdx* host = nullptr;  // cached first object on freelist
-  const size_t max_embed = size / sizeof(ObjIdx) - 1;
-  int embed_count = 0;
-  while (idx < idxEnd) {
-    // Check the no idx can be confused with kListEnd.
-    TC_ASSERT_NE(idx, kListEnd);
-    if (host && embed_count != max_embed) {
-      // Push onto first object on the freelist.
-      embed_count++;
-      idxEnd -= idxStep;
-      host[embed_count] = idxEnd;
-    } else {
-      // The first object is full, push new object onto freelist.
-      host = IdxToPtr(idx, size, start);
-      host[0] = freelist_;
-      freelist_ = idx;
-      embed_count = 0;
-      idx += idxStep;
-    }
-  }
-  embed_count_ = embed_count;
+  // All objects start out uncarved; hand out the batch from them and leave the
+  // rest untouched.
+  cache_size_ = 0;
+  embed_count_ = 0;
+  uncarved_ = count * idxStep;
+  const int result = CarvePopBatch(batch.data(), batch.size(), size,
+                                   first_page().start_uintptr());
+  allocated_.store(result, std::memory_order_relaxed);
   return result;
 }
 
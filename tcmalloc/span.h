@@ -56,9 +56,18 @@ enum AccessDensityPrediction {
   kPredictionCounts
 };
 
+// Expected lifetime of the objects in a span.  Allocations that are known, or
+// predicted from sampled lifetimes, to be freed soon are packed apart from
+// the others, so that they do not pin free hugepages when they are freed.
+enum class SpanLifetime {
+  kLongLived = 0,
+  kShortLived = 1,
+};
+
 struct SpanAllocInfo {
   size_t objects_per_span;
   AccessDensityPrediction density;
+  SpanLifetime lifetime = SpanLifetime::kLongLived;
 };
 
 // Information kept for a span (a contiguous run of pages).
@@ -79,6 +88,9 @@ struct SpanAllocInfo {
 //  - SAMPLED: the span holds a single sampled object.
 //    The span can be considered to be owner by user until the object is freed.
 //    location_ == IN_USE && sampled_ == 1.
+//  - SHARED_SAMPLED: the span is a page shared by several small sampled
+//    objects (see SampledPageHeap), whose metadata it points to.
+//    location_ == IN_USE && shared_sampled_ == 1.
 //  - ON_NORMAL_FREELIST: the span has no allocated objects, owned by PageHeap
 //    and is on normal PageHeap list.
 //    location_ == ON_NORMAL_FREELIST.
@@ -86,6 +98,7 @@ struct SpanAllocInfo {
 //    and is on returned PageHeap list.
 //    location_ == ON_RETURNED_FREELIST.
 class Span;
+struct SharedSampledPage;
 typedef TList<Span> SpanList;
 
 class Span final : public SpanList::Elem {
@@ -98,10 +111,17 @@ class Span final : public SpanList::Elem {
         nonempty_index_(0),
         location_(IN_USE),
         is_donated_(0),
+        central_shard_(0),
+        has_freelist_bitmap_(0),
         first_page_(0),
-        reserved_(0),
+        account_(0),
+        zeroed_(0),
+        uncarved_(0),
         is_large_span_(0),
         sampled_(0),
+        shared_sampled_(0),
+        realloc_grown_(0),
+        numa_interleaved_(0),
         large_or_sampled_state_{0, nullptr} {}
 
   Span(const Span&) = delete;
@@ -153,12 +173,50 @@ class Span final : public SpanList::Elem {
   // that sampling state can't be changed concurrently.
   bool sampled() const;
 
+  // Marks this span in the "SHARED_SAMPLED" state, with <page> holding the
+  // metadata of the sampled objects on it.
+  void ShareSampled(SharedSampledPage* page);
+
+  // Unmarks this span from its "SHARED_SAMPLED" state, before it goes back to
+  // the page heap.
+  void Unshare();
+
+  // Returns the metadata of the objects on a SHARED_SAMPLED span, or nullptr
+  // if the span is in another state.
+  SharedSampledPage* shared_sampled_page() const;
+
   bool donated() const { return is_donated_; }
   void set_donated(bool value) { is_donated_ = value; }
 
+  // Is the memory of this span known to be all zero?  The page heap sets this
+  // for spans carved out of released memory; it is only meaningful until the
+  // span's memory is first handed out.
+  bool zeroed() const { return zeroed_; }
+  void set_zeroed(bool value) { zeroed_ = value; }
+
+  // Did realloc grow the allocation of this span out of another?  Only set for
+  // large allocations (see Parameters::realloc_growth_headroom).
+  bool realloc_grown() const { return realloc_grown_; }
+  void set_realloc_grown(bool value) { realloc_grown_ = value; }
+
+  // Are the pages of this span interleaved across NUMA nodes?  Only set for
+  // allocations of MallocExtension::AllocateInterleaved.
+  bool numa_interleaved() const { return numa_interleaved_; }
+  void set_numa_interleaved(bool value) { numa_interleaved_ = value; }
+
+  // The index of the account charged for the large allocation of this span
+  // (see AllocationAccounts), or 0 if none.
+  uint32_t account() const { return account_; }
+  void set_account(uint32_t index) {
+    TC_ASSERT_LT(index, uint32_t{1} << kAccountBits);
+    account_ = index;
+  }
+
   // Returns if the span is large (i.e. consists of > kLargeSpanLength number of
-  // pages) or is sampled.
-  bool is_large_or_sampled() const { return is_large_span_ || sampled_; }
+  // pages) or is sampled, or shared by sampled objects.
+  bool is_large_or_sampled() const {
+    return is_large_span_ || sampled_ || shared_sampled_;
+  }
   // ---------------------------------------------------------------------------
   // Span memory range.
   // ---------------------------------------------------------------------------
@@ -198,12 +256,34 @@ class Span final : public SpanList::Elem {
   // Records an index of the non-empty list associated with this span.
   void set_nonempty_index(uint8_t index) { nonempty_index_ = index; }
 
+  // Returns the CentralFreeList shard whose lists hold this span.
+  uint8_t central_shard() const { return central_shard_; }
+  // Records the CentralFreeList shard that populated this span.
+  void set_central_shard(uint8_t shard) {
+    TC_ASSERT_LT(shard, 1 << kCentralShardBits);
+    central_shard_ = shard;
+  }
+
   // ---------------------------------------------------------------------------
   // Freelist management.
   // Used for spans in CentralFreelist to manage free objects.
   // These methods REQUIRE a SMALL_OBJECT span.
   // ---------------------------------------------------------------------------
 
+  // Out-of-line record of the free objects of a span that would otherwise keep
+  // them in a compressed linked list threaded through the objects.  Bit i is
+  // set when the object at offset i * kAlignment is free.
+  using FreelistBitmap = Bitmap<(kPageSize >> kAlignmentShift)>;
+
+  // Makes the span record its free objects in <bitmap> rather than in the
+  // objects themselves, so that pushing and popping objects does not touch
+  // them.  Must be called before BuildFreelist, and only for sizes that do not
+  // UseBitmapForSize.  The span does not own <bitmap>.
+  void set_freelist_bitmap(FreelistBitmap* bitmap);
+  // Returns the bitmap passed to set_freelist_bitmap, or nullptr if none, and
+  // makes the span forget it.
+  FreelistBitmap* TakeFreelistBitmap();
+
   // Indicate whether the Span is empty. Size is used to determine whether
   // the span is using a compressed linked list of objects, or a bitmap
   // to hold available objects.
@@ -226,6 +306,9 @@ class Span final : public SpanList::Elem {
   // Initialize freelist to contain all objects in the span.
   // Pops up to N objects from the freelist and returns them in the batch array.
   // Returns number of objects actually popped.
+  //
+  // Objects of spans that use a compressed linked list are carved lazily: the
+  // objects not popped here are not touched until they are handed out.
   int BuildFreelist(size_t size, size_t count, absl::Span<void*> batch,
                     uint32_t max_cache_size, uint64_t alloc_time);
 
@@ -235,6 +318,10 @@ class Span final : public SpanList::Elem {
   // IsValidSizeClass verifies size class parameters from the Span perspective.
   static bool IsValidSizeClass(size_t size, size_t pages);
 
+  // Returns the maximum number of objects in a span of a size class whose
+  // objects are tracked in a bitmap (see IsValidSizeClass).
+  static constexpr size_t MaxBitmapObjects() { return kBitmapSize; }
+
   // Returns true if Span does not touch objects and the <size> is suitable
   // for cold size classes.
   static bool IsNonIntrusive(size_t size);
@@ -248,7 +335,9 @@ class Span final : public SpanList::Elem {
   static constexpr size_t kLargeCacheArraySize = 12;
   static constexpr size_t kMaxCacheBits = 4;
   static constexpr size_t kMaxPageIdBits = kAddressBits - kPageShift;
-  static constexpr size_t kReservedBits = 26;
+  static constexpr size_t kAccountBits = 9;
+  static constexpr size_t kUncarvedBits = 16;
+  static constexpr size_t kCentralShardBits = 3;
 
   static_assert(kLargeCacheSize <= (1 << kMaxCacheBits) - 1);
 
@@ -270,6 +359,11 @@ class Span final : public SpanList::Elem {
   typedef uint16_t ObjIdx;
   static constexpr ObjIdx kListEnd = -1;
 
+  // The fields from here through small_span_state_ are the ones used by every
+  // FreelistPush and FreelistPopBatch.  They take up the 32 bytes following
+  // the list links, with only a few bits of state used elsewhere (location_,
+  // is_donated_, zeroed_, sampled_) packed into their spare bits.
+
   // Use uint16_t or uint8_t for 16 bit and 8 bit fields instead of bitfields.
   // LLVM will generate widen load/store and bit masking operations to access
   // bitfields and this hurts performance. Although compiler flag
@@ -290,20 +384,38 @@ class Span final : public SpanList::Elem {
   // Has this span allocation resulted in a donation to the filler in the page
   // heap? This is used by page heap to compute abandoned pages.
   uint8_t is_donated_ : 1;
+  // The CentralFreeList shard that owns this span.
+  uint8_t central_shard_ : kCentralShardBits;
+  // Are free objects recorded in small_span_state_.freelist_bitmap?
+  uint8_t has_freelist_bitmap_ : 1;
 
   static constexpr size_t kBitmapSize = 8 * sizeof(ObjIdx) * kCacheSize;
 
   uint64_t first_page_ : kMaxPageIdBits;  // Starting page number.
 
-  uint32_t reserved_ : kReservedBits;
+  // The AllocationAccounts index of the account charged for the large
+  // allocation of this span, or 0 if none.
+  uint32_t account_ : kAccountBits;
+  uint32_t zeroed_ : 1;
+  // For available objects stored as a compressed linked list, objects with
+  // indices below uncarved_ have never been handed out and are not on the
+  // freelist.  They are carved from the top, decrementing uncarved_.
+  uint32_t uncarved_ : kUncarvedBits;
   // Determines if the span consists of > kLargeSpanLength number of pages.
   uint8_t is_large_span_ : 1;
   uint8_t sampled_ : 1;  // Sampled object?
+  uint8_t shared_sampled_ : 1;  // Page shared by sampled objects?
+  uint8_t realloc_grown_ : 1;   // Grown by realloc?
+  uint8_t numa_interleaved_ : 1;  // Interleaved across NUMA nodes?
 
   struct LargeOrSampledState {
     uint64_t num_pages;
-    // Used only for sampled spans (SAMPLED state).
-    SampledAllocation* sampled_allocation;
+    union {
+      // Used only for sampled spans (SAMPLED state).
+      SampledAllocation* sampled_allocation;
+      // Used only for shared sampled pages (SHARED_SAMPLED state).
+      SharedSampledPage* shared_sampled_page;
+    };
   };
 
   struct SmallSpanState {
@@ -317,6 +429,11 @@ class Span final : public SpanList::Elem {
       // Each bit is set to one when the object is available, and zero
       // when the object is used.
       Bitmap<kBitmapSize> bitmap{};
+
+      // Used for spans with has_freelist_bitmap_ set, which otherwise use the
+      // compressed linked list.  It overlaps the first entries of the cache,
+      // which those spans do not use, but not the allocation time.
+      FreelistBitmap* freelist_bitmap;
     };
   };
 
@@ -349,8 +466,21 @@ class Span final : public SpanList::Elem {
 
   size_t ListPopBatch(void** __restrict batch, size_t N, size_t size);
 
+  // Pops up to N objects that were never handed out.  Returns number of objects
+  // actually popped.
+  size_t CarvePopBatch(void** __restrict batch, size_t N, size_t size,
+                       uintptr_t start);
+
   bool ListPush(void* ptr, size_t size, uint32_t max_cache_size);
 
+  // For spans with a FreelistBitmap, records that the object has been returned.
+  // Always returns true.
+  bool FreelistBitmapPush(void* ptr, size_t size);
+
+  // For spans with a FreelistBitmap, populates batch with up to N objects.
+  // Returns number of objects actually popped.
+  size_t FreelistBitmapPopBatch(void** __restrict batch, size_t N, size_t size);
+
   // For spans containing 64 or fewer objects, indicate that the object at the
   // index has been returned. Always returns true.
   bool BitmapPush(void* ptr, size_t size, uint32_t reciprocal);
@@ -418,9 +548,22 @@ inline bool Span::FreelistPush(void* ptr, size_t size, uint32_t reciprocal,
   if (ABSL_PREDICT_FALSE(UseBitmapForSize(size))) {
     return BitmapPush(ptr, size, reciprocal);
   }
+  if (ABSL_PREDICT_FALSE(has_freelist_bitmap_)) {
+    return FreelistBitmapPush(ptr, size);
+  }
   return ListPush(ptr, size, max_cache_size);
 }
 
+inline bool Span::FreelistBitmapPush(void* ptr, size_t size) {
+  ObjIdx idx = PtrToIdx(ptr, size);
+  // Check that the object is not already returned.
+  TC_ASSERT(!small_span_state_.freelist_bitmap->GetBit(idx));
+  small_span_state_.freelist_bitmap->SetBit(idx);
+  // embed_count_ holds the number of set bits.
+  embed_count_++;
+  return true;
+}
+
 inline bool Span::ListPush(void* ptr, size_t size, uint32_t max_cache_size) {
   ObjIdx idx = PtrToIdx(ptr, size);
   if (cache_size_ < max_cache_size) {
@@ -491,6 +634,26 @@ inline SampledAllocation* Span::sampled_allocation() const {
 
 inline bool Span::sampled() const { return sampled_; }
 
+inline void Span::ShareSampled(SharedSampledPage* page) {
+  TC_CHECK(!sampled_ && !shared_sampled_ && page != nullptr);
+  const Length pages_per_span = num_pages();
+  shared_sampled_ = 1;
+  large_or_sampled_state_.num_pages = pages_per_span.raw_num();
+  large_or_sampled_state_.shared_sampled_page = page;
+}
+
+inline void Span::Unshare() {
+  TC_CHECK(shared_sampled_);
+  const Length pages_per_span = num_pages();
+  shared_sampled_ = 0;
+  small_span_state_.num_pages = pages_per_span.raw_num();
+}
+
+inline SharedSampledPage* Span::shared_sampled_page() const {
+  if (!shared_sampled_) return nullptr;
+  return large_or_sampled_state_.shared_sampled_page;
+}
+
 inline PageId Span::first_page() const { return PageId(first_page_); }
 
 inline PageId Span::last_page() const {
@@ -540,19 +703,20 @@ inline bool Span::FreelistEmpty(size_t size) const {
   TC_ASSERT(!is_large_or_sampled());
   if (UseBitmapForSize(size)) {
     return small_span_state_.bitmap.IsZero();
+  } else if (has_freelist_bitmap_) {
+    return embed_count_ == 0 && uncarved_ == 0;
   } else {
-    return cache_size_ == 0 && freelist_ == kListEnd;
+    return cache_size_ == 0 && freelist_ == kListEnd && uncarved_ == 0;
   }
 }
 
 inline void Span::Prefetch() {
-  // TODO(b/304135905): Will revisit this.
-  // The first 16 bytes of a Span are the next and previous pointers
-  // for when it is stored in a linked list. Since the sizeof(Span) is
-  // 48 bytes, spans fit into 2 cache lines 50% of the time, with either
-  // the first 16-bytes or the last 16-bytes in a different cache line.
-  // Prefetch the cacheline that contains the most frequestly accessed
-  // data by offseting into the middle of the Span.
+  // The first 16 bytes of a Span are the next and previous pointers for when
+  // it is stored in a linked list, and the remaining 32 bytes hold the fields
+  // used to push and pop objects.  Spans are 16-byte aligned (see
+  // CalcAlignOf), so those 32 bytes share a cache line for 3 in 4 spans.
+  // Prefetch the cacheline that contains the most frequently accessed data by
+  // offsetting into the middle of the Span.
   static_assert(sizeof(Span) <= 64, "Update span prefetch offset");
   PrefetchT0(&this->allocated_);
 }
@@ -568,11 +732,31 @@ inline void Span::Init(PageId p, Length n) {
   first_page_ = p.index();
   location_ = IN_USE;
   sampled_ = 0;
+  shared_sampled_ = 0;
+  realloc_grown_ = 0;
+  numa_interleaved_ = 0;
+  account_ = 0;
   nonempty_index_ = 0;
   is_donated_ = 0;
+  central_shard_ = 0;
+  has_freelist_bitmap_ = 0;
+  zeroed_ = 0;
   set_num_pages(n);
 }
 
+inline void Span::set_freelist_bitmap(FreelistBitmap* bitmap) {
+  TC_ASSERT(!is_large_or_sampled());
+  TC_ASSERT_NE(bitmap, nullptr);
+  small_span_state_.freelist_bitmap = bitmap;
+  has_freelist_bitmap_ = 1;
+}
+
+inline Span::FreelistBitmap* Span::TakeFreelistBitmap() {
+  if (!has_freelist_bitmap_) return nullptr;
+  has_freelist_bitmap_ = 0;
+  return small_span_state_.freelist_bitmap;
+}
+
 inline bool Span::IsValidSizeClass(size_t size, size_t pages) {
   if (Length(pages) > kLargeSpanLength) return false;
   if (Span::UseBitmapForSize(size)) {
@@ -599,8 +783,10 @@ inline bool Span::IsNonIntrusive(size_t size) { return UseBitmapForSize(size); }
 inline std::align_val_t Span::CalcAlignOf(uint32_t max_cache_array_size) {
   TC_ASSERT_GE(max_cache_array_size, kCacheSize);
   TC_ASSERT_LE(max_cache_array_size, kLargeCacheArraySize);
+  // 48-byte spans are aligned to 16 bytes, which costs no space, so that the
+  // fields following their list links cross a cache line less often.
   return static_cast<std::align_val_t>(
-      max_cache_array_size == kCacheSize ? 8 : ABSL_CACHELINE_SIZE);
+      max_cache_array_size == kCacheSize ? 16 : ABSL_CACHELINE_SIZE);
 }
 
 inline size_t Span::CalcSizeOf(uint32_t max_cache_array_size) {
@@ -15,8 +15,10 @@
 #include <stdlib.h>
 
 #include <cstdint>
+#include <new>
 #include <vector>
 
+#include "absl/base/optimization.h"
 #include "absl/random/random.h"
 #include "absl/types/span.h"
 #include "benchmark/benchmark.h"
@@ -226,6 +228,60 @@ BENCHMARK(BM_multiple_spans)
     ->Arg(40)
     ->Arg(80);
 
+// BM_multiple_spans_placement is like BM_multiple_spans, but lays out the
+// spans back to back with the given alignment, as the span allocator does, and
+// prefetches each span before use, as CentralFreeList does.  With an 8-byte
+// alignment, the fields used to push and pop objects cross a cache line for
+// half of the spans, against 1 in 4 with the 16-byte alignment that
+// Span::CalcAlignOf asks for.
+void BM_multiple_spans_placement(benchmark::State& state) {
+  const int size_class = state.range(0);
+  const size_t alignment = state.range(1);
+
+  const int num_spans = 1 << 20;
+  size_t size = tc_globals.sizemap().class_to_size(size_class);
+  uint32_t reciprocal = Span::CalcReciprocal(size);
+  TC_CHECK_GT(size, 0);
+  size_t batch_size = tc_globals.sizemap().num_objects_to_move(size_class);
+
+  // Offset the first span so that its address is a multiple of alignment, but
+  // of no larger power of two.
+  const size_t stride = sizeof(RawSpan);
+  std::vector<char> buffer(num_spans * stride + 2 * ABSL_CACHELINE_SIZE);
+  char* base = reinterpret_cast<char*>(
+      (reinterpret_cast<uintptr_t>(buffer.data()) + ABSL_CACHELINE_SIZE - 1) &
+      ~uintptr_t{ABSL_CACHELINE_SIZE - 1});
+  base += alignment < ABSL_CACHELINE_SIZE ? alignment : 0;
+  std::vector<RawSpan*> spans(num_spans);
+  for (int i = 0; i < num_spans; i++) {
+    spans[i] = new (base + i * stride) RawSpan();
+    spans[i]->Init(size_class);
+  }
+  absl::BitGen rng;
+
+  void* batch[kMaxObjectsToMove];
+
+  int64_t processed = 0;
+  while (state.KeepRunningBatch(batch_size)) {
+    Span& span = spans[absl::Uniform(rng, 0, num_spans)]->span();
+    span.Prefetch();
+    int n = span.FreelistPopBatch(absl::MakeSpan(batch, batch_size), size);
+    processed += n;
+
+    for (int j = 0; j < n; j++) {
+      span.FreelistPush(batch[j], size, reciprocal, kMaxCacheSize);
+    }
+  }
+
+  state.SetItemsProcessed(processed);
+  for (RawSpan* span : spans) {
+    span->~RawSpan();
+  }
+}
+
+BENCHMARK(BM_multiple_spans_placement)
+    ->ArgsProduct({{1, 7, 20, 80}, {8, 16}});
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
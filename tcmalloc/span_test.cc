@@ -17,6 +17,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <new>
 #include <string>
@@ -242,6 +243,55 @@ TEST_P(SpanTest, FreelistRandomized) {
   }
 }
 
+TEST_P(SpanTest, CarvesLazily) {
+  if (Span::UseBitmapForSize(size_)) {
+    GTEST_SKIP() << "Bitmap spans never touch their objects.";
+  }
+
+  const size_t bytes = npages_ * kPageSize;
+  void* mem;
+  ASSERT_EQ(posix_memalign(&mem, kPageSize, bytes), 0);
+  constexpr unsigned char kPattern = 0x5a;
+  memset(mem, kPattern, bytes);
+
+  void* buf = ::operator new(Span::CalcSizeOf(max_cache_array_size_),
+                             std::align_val_t(alignof(Span)));
+  Span* span = new (buf) Span();
+  span->Init(PageIdContaining(mem), Length(npages_));
+  void* first;
+  ASSERT_EQ(span->BuildFreelist(size_, objects_per_span_,
+                                absl::MakeSpan(&first, 1), max_cache_size_,
+                                kSpanAllocTime),
+            1);
+
+  // Populating the span leaves the objects that were not handed out alone.
+  const unsigned char* const start = static_cast<unsigned char*>(mem);
+  const unsigned char* const first_byte = static_cast<unsigned char*>(first);
+  for (size_t i = 0; i < bytes; ++i) {
+    if (start + i >= first_byte && start + i < first_byte + size_) continue;
+    ASSERT_EQ(start[i], kPattern) << i;
+  }
+
+  // The remaining objects are still available.
+  absl::flat_hash_set<void*> objects = {first};
+  void* batch[kMaxObjectsToMove];
+  for (;;) {
+    size_t n =
+        span->FreelistPopBatch(absl::MakeSpan(batch, batch_size_), size_);
+    for (size_t i = 0; i < n; ++i) {
+      EXPECT_TRUE(objects.insert(batch[i]).second);
+    }
+    if (n < batch_size_) {
+      break;
+    }
+  }
+  EXPECT_EQ(objects.size(), objects_per_span_);
+  EXPECT_TRUE(span->FreelistEmpty(size_));
+
+  free(mem);
+  ::operator delete(buf, std::align_val_t(alignof(Span)));
+}
+
 INSTANTIATE_TEST_SUITE_P(
     All, SpanTest,
     testing::Combine(testing::Range(size_t(1), kNumClasses),
@@ -17,9 +17,11 @@
 #include <stddef.h>
 #include <string.h>
 
+#include <cmath>
 #include <cstdint>
 
 #include "absl/functional/function_ref.h"
+#include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/allocation_guard.h"
 #include "tcmalloc/internal/config.h"
@@ -50,8 +52,51 @@ StackTraceTable::~StackTraceTable() {
   all_ = nullptr;
 }
 
-void StackTraceTable::AddTrace(double sample_weight, const StackTrace& t) {
-  depth_total_ += t.depth;
+void StackTraceToSample(double sample_weight, const SampleInfo& t,
+                        absl::Span<void* const> stack,
+                        Profile::Sample& sample) {
+  // Report total bytes that are a multiple of the object size.
+  size_t allocated_size = t.allocated_size;
+  size_t requested_size = t.requested_size;
+
+  const bool freed = sample_weight < 0;
+  uintptr_t bytes = std::abs(sample_weight) * AllocatedBytes(t) + 0.5;
+  // We want sum to be a multiple of allocated_size; pick the nearest
+  // multiple rather than always rounding up or down.
+  //
+  // TODO(b/215362992): Revisit this assertion when GWP-ASan guards
+  // zero-byte allocations.
+  TC_ASSERT_GT(allocated_size, 0);
+  // The reported count of samples, with possible rounding up for unsample.
+  sample.count = (bytes + allocated_size / 2) / allocated_size;
+  if (freed) {
+    sample.count = -sample.count;
+  }
+  sample.sum = sample.count * static_cast<int64_t>(allocated_size);
+  sample.requested_size = requested_size;
+  sample.requested_alignment = t.requested_alignment;
+  sample.requested_size_returning = t.requested_size_returning;
+  sample.allocated_size = allocated_size;
+  sample.access_hint = static_cast<hot_cold_t>(t.access_hint);
+  sample.access_allocated = t.cold_allocated ? Profile::Sample::Access::Cold
+                                             : Profile::Sample::Access::Hot;
+  sample.depth = stack.size();
+  sample.allocation_time = t.allocation_time;
+  sample.allocation_context = t.allocation_context;
+
+  // The span of a freed sample may already have been reused.
+  sample.span_start_address = freed ? nullptr : t.span_start_address;
+  sample.guarded_status =
+      static_cast<Profile::Sample::GuardedStatus>(t.guarded_status);
+
+  static_assert(kMaxStackDepth <= Profile::Sample::kMaxStackDepth,
+                "Profile stack size smaller than internal stack sizes");
+  memcpy(sample.stack, stack.data(), sizeof(sample.stack[0]) * sample.depth);
+}
+
+void StackTraceTable::AddTrace(double sample_weight, const SampleInfo& info,
+                               absl::Span<void* const> stack) {
+  depth_total_ += stack.size();
   // Note this makes a copy of the information from the stack trace and users
   // would call TCMalloc public API and iterate over the copied data in the
   // `StackTraceTable`. Ideally, we would want to avoid the copy and let the API
@@ -70,38 +115,7 @@ void StackTraceTable::AddTrace(double sample_weight, const StackTrace& t) {
   }
   s = new (s) LinkedSample;
 
-  // Report total bytes that are a multiple of the object size.
-  size_t allocated_size = t.allocated_size;
-  size_t requested_size = t.requested_size;
-
-  uintptr_t bytes = sample_weight * AllocatedBytes(t) + 0.5;
-  // We want sum to be a multiple of allocated_size; pick the nearest
-  // multiple rather than always rounding up or down.
-  //
-  // TODO(b/215362992): Revisit this assertion when GWP-ASan guards
-  // zero-byte allocations.
-  TC_ASSERT_GT(allocated_size, 0);
-  // The reported count of samples, with possible rounding up for unsample.
-  s->sample.count = (bytes + allocated_size / 2) / allocated_size;
-  s->sample.sum = s->sample.count * allocated_size;
-  s->sample.requested_size = requested_size;
-  s->sample.requested_alignment = t.requested_alignment;
-  s->sample.requested_size_returning = t.requested_size_returning;
-  s->sample.allocated_size = allocated_size;
-  s->sample.access_hint = static_cast<hot_cold_t>(t.access_hint);
-  s->sample.access_allocated = t.cold_allocated ? Profile::Sample::Access::Cold
-                                                : Profile::Sample::Access::Hot;
-  s->sample.depth = t.depth;
-  s->sample.allocation_time = t.allocation_time;
-
-  s->sample.span_start_address = t.span_start_address;
-  s->sample.guarded_status =
-      static_cast<Profile::Sample::GuardedStatus>(t.guarded_status);
-
-  static_assert(kMaxStackDepth <= Profile::Sample::kMaxStackDepth,
-                "Profile stack size smaller than internal stack sizes");
-  memcpy(s->sample.stack, t.stack,
-         sizeof(s->sample.stack[0]) * s->sample.depth);
+  StackTraceToSample(sample_weight, info, stack, s->sample);
 
   s->next = all_;
   all_ = s;
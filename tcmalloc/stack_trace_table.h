@@ -21,6 +21,7 @@
 
 #include "absl/base/thread_annotations.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
@@ -48,8 +49,15 @@ class StackTraceTable final : public ProfileBase {
   // Adds stack trace "t" of the sample to table with the given weight of the
   // sample. `sample_weight` is a floating point value used to calculate the
   // the expected number of objects allocated (might be fractional considering
-  // fragmentation) corresponding to a given sample.
+  // fragmentation) corresponding to a given sample.  A negative weight records
+  // the sample as freed, with a negative count and sum and no span address.
   void AddTrace(double sample_weight, const StackTrace& t)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    AddTrace(sample_weight, t, absl::MakeConstSpan(t.stack, t.depth));
+  }
+  // As above, for a sample whose call stack is stored apart from it.
+  void AddTrace(double sample_weight, const SampleInfo& info,
+                absl::Span<void* const> stack)
       ABSL_LOCKS_EXCLUDED(pageheap_lock);
 
   // Exposed for PageHeapAllocator
@@ -68,6 +76,17 @@ class StackTraceTable final : public ProfileBase {
   LinkedSample* all_;
 };
 
+// Converts the stack trace <t> of a sample into <sample>, as
+// StackTraceTable::AddTrace(sample_weight, t) records it.
+void StackTraceToSample(double sample_weight, const SampleInfo& info,
+                        absl::Span<void* const> stack,
+                        Profile::Sample& sample);
+inline void StackTraceToSample(double sample_weight, const StackTrace& t,
+                               Profile::Sample& sample) {
+  StackTraceToSample(sample_weight, t, absl::MakeConstSpan(t.stack, t.depth),
+                     sample);
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
@@ -392,6 +392,22 @@ TEST(StackTraceTableTest, StackTraceTable) {
 
     CheckTraces(table, {k1, k5});
   }
+
+  // Table w/ t1 allocated and freed
+  {
+    SCOPED_TRACE("t1, freed t1");
+
+    AllocationEntry k1_freed = k1;
+    k1_freed.sum = -k1.sum;
+    k1_freed.count = -k1.count;
+
+    StackTraceTable table(ProfileType::kHeap);
+    AddTrace(&table, 1.0, t1);
+    AddTrace(&table, -1.0, t1);
+    EXPECT_EQ(4, table.depth_total());
+
+    CheckTraces(table, {k1, k1_freed});
+  }
 }
 
 }  // namespace
@@ -15,15 +15,21 @@
 #include "tcmalloc/static_vars.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <atomic>
+#include <new>
+#include <optional>
 
 #include "absl/base/attributes.h"
+#include "absl/base/call_once.h"
 #include "absl/base/const_init.h"
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
 #include "absl/types/span.h"
 #include "tcmalloc/allocation_sample.h"
+#include "tcmalloc/allocation_trace.h"
 #include "tcmalloc/arena.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/cpu_cache.h"
@@ -33,21 +39,27 @@
 #include "tcmalloc/guarded_page_allocator.h"
 #include "tcmalloc/internal/allocation_guard.h"
 #include "tcmalloc/internal/atomic_stats_counter.h"
+#include "tcmalloc/internal/background_wakeup.h"
 #include "tcmalloc/internal/cache_topology.h"
 #include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/explicitly_constructed.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/mincore.h"
 #include "tcmalloc/internal/numa.h"
 #include "tcmalloc/internal/parameter_accessors.h"
 #include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/internal/stack_depot.h"
 #include "tcmalloc/internal/sysinfo.h"
+#include "tcmalloc/leak_detector.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/page_allocator.h"
 #include "tcmalloc/page_heap_allocator.h"
 #include "tcmalloc/pagemap.h"
+#include "tcmalloc/parameter_control.h"
 #include "tcmalloc/parameters.h"
 #include "tcmalloc/peak_heap_tracker.h"
+#include "tcmalloc/release_requests.h"
 #include "tcmalloc/sampled_allocation_allocator.h"
 #include "tcmalloc/size_class_info.h"
 #include "tcmalloc/sizemap.h"
@@ -60,6 +72,15 @@ GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
+namespace {
+
+void* AllocStackDepot(size_t bytes, std::align_val_t alignment) {
+  PageHeapSpinLockHolder l;
+  return Static::arena().Alloc(bytes, alignment);
+}
+
+}  // namespace
+
 // Cacheline-align our SizeMap and CpuCache.  They both have very hot arrays as
 // their first member variables, and aligning them reduces the number of cache
 // lines these arrays use.
@@ -69,6 +90,7 @@ namespace tcmalloc_internal {
 ABSL_CONST_INIT absl::base_internal::SpinLock pageheap_lock(
     absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY);
 ABSL_CONST_INIT Arena Static::arena_;
+ABSL_CONST_INIT Arena Static::numa_arenas_[kNumaPartitions];
 ABSL_CONST_INIT SizeMap ABSL_CACHELINE_ALIGNED Static::sizemap_;
 TCMALLOC_ATTRIBUTE_NO_DESTROY ABSL_CONST_INIT TransferCacheManager
     Static::transfer_cache_;
@@ -77,19 +99,31 @@ ABSL_CONST_INIT ShardedTransferCacheManager
 ABSL_CONST_INIT CpuCache ABSL_CACHELINE_ALIGNED Static::cpu_cache_;
 ABSL_CONST_INIT SampledAllocationAllocator Static::sampledallocation_allocator_;
 ABSL_CONST_INIT PageHeapAllocator<Span> Static::span_allocator_;
+ABSL_CONST_INIT PageHeapAllocator<Span>
+    Static::numa_span_allocators_[kNumaPartitions];
+ABSL_CONST_INIT PageHeapAllocator<Span::FreelistBitmap>
+    Static::freelist_bitmap_allocator_;
+ABSL_CONST_INIT PageHeapAllocator<Span::FreelistBitmap>
+    Static::numa_freelist_bitmap_allocators_[kNumaPartitions];
 ABSL_CONST_INIT PageHeapAllocator<ThreadCache> Static::threadcache_allocator_;
 ABSL_CONST_INIT ExplicitlyConstructed<SampledAllocationRecorder>
     Static::sampled_allocation_recorder_;
-ABSL_CONST_INIT tcmalloc_internal::StatsCounter Static::sampled_objects_size_;
-ABSL_CONST_INIT tcmalloc_internal::StatsCounter
+ABSL_CONST_INIT subtle::percpu::PerCpuCounter Static::sampled_objects_size_;
+ABSL_CONST_INIT subtle::percpu::PerCpuCounter
     Static::sampled_internal_fragmentation_;
-ABSL_CONST_INIT tcmalloc_internal::StatsCounter Static::total_sampled_count_;
+ABSL_CONST_INIT subtle::percpu::PerCpuCounter Static::total_sampled_count_;
 ABSL_CONST_INIT AllocationSampleList Static::allocation_samples;
+ABSL_CONST_INIT HeapDeltaSampleList Static::heap_delta_samples;
 ABSL_CONST_INIT deallocationz::DeallocationProfilerList
     Static::deallocation_samples;
+ABSL_CONST_INIT deallocationz::ContinuousLifetimeProfiler
+    Static::continuous_lifetimes;
 ABSL_CONST_INIT std::atomic<AllocHandle> Static::sampled_alloc_handle_generator{
     0};
 ABSL_CONST_INIT PeakHeapTracker Static::peak_heap_tracker_;
+ABSL_CONST_INIT LeakDetector Static::leak_detector_;
+ABSL_CONST_INIT StackDepot Static::stack_depot_(&AllocStackDepot);
+ABSL_CONST_INIT BackgroundWakeup Static::background_wakeup_;
 ABSL_CONST_INIT PageHeapAllocator<StackTraceTable::LinkedSample>
     Static::linked_sample_allocator_;
 ABSL_CONST_INIT std::atomic<bool> Static::inited_{false};
@@ -113,21 +147,27 @@ size_t Static::metadata_bytes() {
   // collection of static variables.  Simplify this.
   // LINT.IfChange(static_vars_size)
   const size_t static_var_size =
-      sizeof(pageheap_lock) + sizeof(arena_) + sizeof(sizemap_) +
+      sizeof(pageheap_lock) + sizeof(arena_) + sizeof(numa_arenas_) +
+      sizeof(sizemap_) +
       sizeof(sharded_transfer_cache_) + sizeof(transfer_cache_) +
       sizeof(cpu_cache_) + sizeof(sampledallocation_allocator_) +
-      sizeof(span_allocator_) + +sizeof(threadcache_allocator_) +
+      sizeof(span_allocator_) + sizeof(numa_span_allocators_) +
+      sizeof(freelist_bitmap_allocator_) +
+      sizeof(numa_freelist_bitmap_allocators_) +
+      sizeof(threadcache_allocator_) +
       sizeof(sampled_allocation_recorder_) + sizeof(linked_sample_allocator_) +
       sizeof(inited_) + sizeof(cpu_cache_active_) + sizeof(page_allocator_) +
       sizeof(pagemap_) + sizeof(sampled_objects_size_) +
       sizeof(sampled_internal_fragmentation_) + sizeof(total_sampled_count_) +
-      sizeof(allocation_samples) + sizeof(deallocation_samples) +
+      sizeof(allocation_samples) + sizeof(heap_delta_samples) +
+      sizeof(deallocation_samples) + sizeof(continuous_lifetimes) +
       sizeof(sampled_alloc_handle_generator) + sizeof(peak_heap_tracker_) +
+      sizeof(leak_detector_) + sizeof(stack_depot_) +
       sizeof(guardedpage_allocator_) + sizeof(numa_topology_) +
       sizeof(CacheTopology::Instance());
   // LINT.ThenChange(:static_vars)
 
-  const size_t allocated = arena().stats().bytes_allocated +
+  const size_t allocated = arena_stats().bytes_allocated +
                            AddressRegionFactory::InternalBytesAllocated();
   return allocated + static_var_size;
 }
@@ -140,9 +180,51 @@ size_t Static::pagemap_residence() {
 
 int ABSL_ATTRIBUTE_WEAK default_want_legacy_size_classes();
 
+// Returns the size classes selected with the TCMALLOC_SIZE_CLASSES environment
+// variable, if any.  This allows comparing the size class tables built into a
+// binary without relinking it.
+static std::optional<SizeClassConfiguration> SizeClassConfigurationFromEnv() {
+  const char* e = thread_safe_getenv("TCMALLOC_SIZE_CLASSES");
+  if (e == nullptr || *e == '\0') {
+    return std::nullopt;
+  }
+
+  const absl::string_view name = e;
+  if (name == "pow2_below_64") {
+    return SizeClassConfiguration::kPow2Below64;
+  } else if (name == "pow2_only") {
+    return SizeClassConfiguration::kPow2Only;
+  } else if (name == "legacy") {
+    return SizeClassConfiguration::kLegacy;
+  } else if (name == "reuse") {
+    return SizeClassConfiguration::kReuse;
+  } else if (name == "custom") {
+    if (default_custom_size_classes == nullptr ||
+        default_custom_size_classes() == nullptr) {
+      TC_BUG("TCMALLOC_SIZE_CLASSES=custom requires linking in size classes "
+             "generated by size_class_tool");
+    }
+    return SizeClassConfiguration::kCustom;
+  }
+  TC_BUG("bad TCMALLOC_SIZE_CLASSES env var '%s'", e);
+}
+
 SizeClassConfiguration Static::size_class_configuration() {
+  // The environment takes precedence over the size classes linked in or
+  // selected by experiments.
+  ABSL_CONST_INIT static absl::once_flag flag;
+  ABSL_CONST_INIT static std::optional<SizeClassConfiguration> from_env;
+  absl::base_internal::LowLevelCallOnce(
+      &flag, [&]() { from_env = SizeClassConfigurationFromEnv(); });
+  if (from_env.has_value()) {
+    return *from_env;
+  }
+
   if (IsExperimentActive(Experiment::TEST_ONLY_TCMALLOC_POW2_SIZECLASS)) {
     return SizeClassConfiguration::kPow2Only;
+  } else if (default_custom_size_classes != nullptr &&
+             default_custom_size_classes() != nullptr) {
+    return SizeClassConfiguration::kCustom;
   } else if (default_want_legacy_size_classes != nullptr &&
              default_want_legacy_size_classes() > 0) {
     // TODO(b/242710633): remove this opt out.
@@ -155,49 +237,128 @@ SizeClassConfiguration Static::size_class_configuration() {
   }
 }
 
+ArenaStats Static::arena_stats() {
+  ArenaStats total = arena_.stats();
+  for (const Arena& arena : numa_arenas_) {
+    const ArenaStats s = arena.stats();
+    total.bytes_allocated += s.bytes_allocated;
+    total.bytes_unallocated += s.bytes_unallocated;
+    total.bytes_unavailable += s.bytes_unavailable;
+    total.bytes_nonresident += s.bytes_nonresident;
+    total.bytes_hugepage += s.bytes_hugepage;
+    total.bytes_reusable += s.bytes_reusable;
+    total.blocks += s.blocks;
+  }
+  return total;
+}
+
+void Static::ReserveSpanMetadata() {
+  if (!IsInited()) return;
+  const uint32_t max_span_cache_array_size =
+      Parameters::max_span_cache_array_size();
+  const size_t size = Span::CalcSizeOf(max_span_cache_array_size);
+  const std::align_val_t align = Span::CalcAlignOf(max_span_cache_array_size);
+  span_allocator_.Reserve(kSpanMetadataReserve, size, align);
+  if (kNumaPartitions > 1 && numa_topology_.numa_aware()) {
+    for (PageHeapAllocator<Span>& allocator : numa_span_allocators_) {
+      allocator.Reserve(kSpanMetadataReserve, size, align);
+    }
+  }
+}
+
+size_t Static::ReleaseSpanMetadata() {
+  if (!IsInited()) return 0;
+  const size_t size =
+      Span::CalcSizeOf(Parameters::max_span_cache_array_size());
+  size_t released = span_allocator_.ReleaseFree(kSpanMetadataReserve, size);
+  if (kNumaPartitions > 1 && numa_topology_.numa_aware()) {
+    for (PageHeapAllocator<Span>& allocator : numa_span_allocators_) {
+      released += allocator.ReleaseFree(kSpanMetadataReserve, size);
+    }
+  }
+  return released;
+}
+
+AllocatorStats Static::span_stats() {
+  AllocatorStats total = span_allocator_.stats();
+  for (const PageHeapAllocator<Span>& allocator : numa_span_allocators_) {
+    const AllocatorStats s = allocator.stats();
+    total.in_use += s.in_use;
+    total.total += s.total;
+  }
+  return total;
+}
+
 ABSL_ATTRIBUTE_COLD ABSL_ATTRIBUTE_NOINLINE void Static::SlowInitIfNecessary() {
-  PageHeapSpinLockHolder l;
+  bool initialized = false;
+  {
+    PageHeapSpinLockHolder l;
 
-  // double-checked locking
-  if (!inited_.load(std::memory_order_acquire)) {
-    TC_CHECK(sizemap_.Init(SizeMap::CurrentClasses().classes));
-    // Verify we can determine the number of CPUs now, since we will need it
-    // later for per-CPU caches and initializing the cache topology.
-    if (ABSL_PREDICT_FALSE(!NumCPUsMaybe().has_value())) {
-      TCMalloc_Internal_SetPerCpuCachesEnabledNoBuildRequirement(false);
+    // double-checked locking
+    if (!inited_.load(std::memory_order_acquire)) {
+      TC_CHECK(sizemap_.Init(SizeMap::CurrentClasses().classes,
+                             SizeMap::CurrentClassArray()));
+      // Verify we can determine the number of CPUs now, since we will need it
+      // later for per-CPU caches and initializing the cache topology.
+      if (ABSL_PREDICT_FALSE(!NumCPUsMaybe().has_value())) {
+        TCMalloc_Internal_SetPerCpuCachesEnabledNoBuildRequirement(false);
+      }
+      (void)subtle::percpu::IsFast();
+      numa_topology_.Init();
+      for (size_t partition = 0; partition < kNumaPartitions; ++partition) {
+        numa_arenas_[partition].BindToNumaPartition(partition);
+      }
+      CacheTopology::Instance().Init();
+      sampledallocation_allocator_.Init(&arena_);
+      sampled_allocation_recorder_.Construct(&sampledallocation_allocator_);
+      sampled_allocation_recorder().Init();
+      peak_heap_tracker_.Init(&arena_);
+
+      const bool large_span_experiment =
+          IsExperimentActive(Experiment::TEST_ONLY_TCMALLOC_BIG_SPAN) ||
+          IsExperimentActive(Experiment::TCMALLOC_BIG_SPAN);
+      Parameters::set_max_span_cache_size(
+          large_span_experiment ? Span::kLargeCacheSize : Span::kCacheSize);
+      Parameters::set_max_span_cache_array_size(large_span_experiment
+                                                    ? Span::kLargeCacheArraySize
+                                                    : Span::kCacheSize);
+
+      span_allocator_.Init(&arena_);
+      span_allocator_.New();  // Reduce cache conflicts
+      span_allocator_.New();  // Reduce cache conflicts
+      for (size_t partition = 0; partition < kNumaPartitions; ++partition) {
+        numa_span_allocators_[partition].Init(&numa_arenas_[partition]);
+      }
+      freelist_bitmap_allocator_.Init(&arena_);
+      for (size_t partition = 0; partition < kNumaPartitions; ++partition) {
+        numa_freelist_bitmap_allocators_[partition].Init(
+            &numa_arenas_[partition]);
+      }
+      linked_sample_allocator_.Init(&arena_);
+      // Do a bit of sanitizing: make sure central_cache is aligned properly
+      TC_CHECK_EQ((sizeof(transfer_cache_) % ABSL_CACHELINE_SIZE), 0);
+      transfer_cache_.Init();
+      // The constructor of the sharded transfer cache leaves it in a disabled
+      // state.
+      sharded_transfer_cache_.Init();
+      new (page_allocator_.memory) PageAllocator;
+      threadcache_allocator_.Init(&arena_);
+      pagemap_.MapRootWithSmallPages();
+      guardedpage_allocator_.Init(/*max_allocated_pages=*/64,
+                                  /*total_pages=*/128);
+      if constexpr (kAllocationTrace) {
+        allocation_trace().Init(&arena_, NumCPUsMaybe().value_or(1));
+      }
+      inited_.store(true, std::memory_order_release);
+      initialized = true;
     }
-    (void)subtle::percpu::IsFast();
-    numa_topology_.Init();
-    CacheTopology::Instance().Init();
-    sampledallocation_allocator_.Init(&arena_);
-    sampled_allocation_recorder_.Construct(&sampledallocation_allocator_);
-    sampled_allocation_recorder().Init();
-    peak_heap_tracker_.Init(&arena_);
-
-    const bool large_span_experiment =
-        IsExperimentActive(Experiment::TEST_ONLY_TCMALLOC_BIG_SPAN) ||
-        IsExperimentActive(Experiment::TCMALLOC_BIG_SPAN);
-    Parameters::set_max_span_cache_size(
-        large_span_experiment ? Span::kLargeCacheSize : Span::kCacheSize);
-    Parameters::set_max_span_cache_array_size(
-        large_span_experiment ? Span::kLargeCacheArraySize : Span::kCacheSize);
-
-    span_allocator_.Init(&arena_);
-    span_allocator_.New();  // Reduce cache conflicts
-    span_allocator_.New();  // Reduce cache conflicts
-    linked_sample_allocator_.Init(&arena_);
-    // Do a bit of sanitizing: make sure central_cache is aligned properly
-    TC_CHECK_EQ((sizeof(transfer_cache_) % ABSL_CACHELINE_SIZE), 0);
-    transfer_cache_.Init();
-    // The constructor of the sharded transfer cache leaves it in a disabled
-    // state.
-    sharded_transfer_cache_.Init();
-    new (page_allocator_.memory) PageAllocator;
-    threadcache_allocator_.Init(&arena_);
-    pagemap_.MapRootWithSmallPages();
-    guardedpage_allocator_.Init(/*max_allocated_pages=*/64,
-                                /*total_pages=*/128);
-    inited_.store(true, std::memory_order_release);
+  }
+
+  // Some parameters take the pageheap_lock when set, so the settings from the
+  // environment are applied once it is released.
+  if (initialized) {
+    parameter_control().Init();
+    release_requests().Init();
   }
 }
 
@@ -24,21 +24,28 @@
 #include <atomic>
 
 #include "absl/base/attributes.h"
+#include "absl/base/internal/cycleclock.h"
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "tcmalloc/allocation_sample.h"
+#include "tcmalloc/allocation_trace.h"
 #include "tcmalloc/arena.h"
 #include "tcmalloc/central_freelist.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/deallocation_profiler.h"
 #include "tcmalloc/guarded_page_allocator.h"
 #include "tcmalloc/internal/atomic_stats_counter.h"
+#include "tcmalloc/internal/background_wakeup.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/explicitly_constructed.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/numa.h"
+#include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/internal/sampled_allocation.h"
 #include "tcmalloc/internal/sampled_allocation_recorder.h"
+#include "tcmalloc/internal/stack_depot.h"
+#include "tcmalloc/internal/usdt.h"
+#include "tcmalloc/leak_detector.h"
 #include "tcmalloc/page_allocator.h"
 #include "tcmalloc/page_heap_allocator.h"
 #include "tcmalloc/pages.h"
@@ -68,6 +75,7 @@ enum class SizeClassConfiguration {
   kPow2Only = 2,
   kLegacy = 4,
   kReuse = 6,
+  kCustom = 8,
 };
 
 class Static final {
@@ -99,6 +107,12 @@ class Static final {
 
   static PeakHeapTracker& peak_heap_tracker() { return peak_heap_tracker_; }
 
+  static LeakDetector& leak_detector() { return leak_detector_; }
+
+  // Wakes the background thread in event-driven mode (see
+  // Parameters::event_driven_background_actions).
+  static BackgroundWakeup& background_wakeup() { return background_wakeup_; }
+
   static NumaTopology<kNumaPartitions, kNumBaseClasses>& numa_topology() {
     return numa_topology_;
   }
@@ -109,6 +123,24 @@ class Static final {
 
   static Arena& arena() { return arena_; }
 
+  // The arena for metadata describing the memory of NUMA <partition>.  When
+  // NUMA awareness is enabled, its blocks are bound to that partition's nodes.
+  static Arena& numa_arena(size_t partition) {
+    if (!numa_topology_.numa_aware()) return arena_;
+    TC_ASSERT_LT(partition, kNumaPartitions);
+    return numa_arenas_[partition];
+  }
+
+  // The arena for metadata describing memory with <tag>.
+  static Arena& metadata_arena(MemoryTag tag) {
+    if (!IsNormalTag(tag)) return arena_;
+    return numa_arena(NumaPartitionFromTag(tag));
+  }
+
+  // Returns the combined statistics of all arenas.
+  static ArenaStats arena_stats()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   // Page-level allocator.
   static PageAllocator& page_allocator() {
     return *reinterpret_cast<PageAllocator*>(page_allocator_.memory);
@@ -124,7 +156,54 @@ class Static final {
     return sampledallocation_allocator_;
   }
 
-  static PageHeapAllocator<Span>& span_allocator() { return span_allocator_; }
+  // Returns the allocator for the span starting at <p>, which lives on the
+  // NUMA partition of the memory it describes.
+  static PageHeapAllocator<Span>& span_allocator(PageId p) {
+    if constexpr (kNumaPartitions > 1) {
+      if (numa_topology_.numa_aware()) {
+        const MemoryTag tag = GetMemoryTag(p.start_addr());
+        if (IsNormalTag(tag)) {
+          return numa_span_allocators_[NumaPartitionFromTag(tag)];
+        }
+      }
+    }
+    return span_allocator_;
+  }
+
+  // The spans that ReserveSpanMetadata keeps on the free list of each span
+  // allocator.
+  static constexpr size_t kSpanMetadataReserve = 256;
+
+  // Refills the free lists of the span allocators to kSpanMetadataReserve
+  // spans.  Called periodically by the background thread, so that Span::New
+  // rarely grows an arena, and maps memory for it, in an allocating thread.
+  static void ReserveSpanMetadata()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Gives the pages of free spans beyond kSpanMetadataReserve per allocator
+  // back to the arenas, e.g. after a transient peak in the number of spans.
+  // Returns the number of bytes released.
+  static size_t ReleaseSpanMetadata()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Returns the combined statistics of all span allocators.
+  static AllocatorStats span_stats()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Returns the allocator for the FreelistBitmap of the span starting at <p>,
+  // which lives on the NUMA partition of the memory it describes.
+  static PageHeapAllocator<Span::FreelistBitmap>& freelist_bitmap_allocator(
+      PageId p) {
+    if constexpr (kNumaPartitions > 1) {
+      if (numa_topology_.numa_aware()) {
+        const MemoryTag tag = GetMemoryTag(p.start_addr());
+        if (IsNormalTag(tag)) {
+          return numa_freelist_bitmap_allocators_[NumaPartitionFromTag(tag)];
+        }
+      }
+    }
+    return freelist_bitmap_allocator_;
+  }
 
   static PageHeapAllocator<ThreadCache>& threadcache_allocator() {
     return threadcache_allocator_;
@@ -134,22 +213,32 @@ class Static final {
     return sampled_allocation_recorder_.get_mutable();
   }
 
+  // The call stacks of the sampled allocations.  It takes the pageheap_lock to
+  // grow, so must not be used with it held.
+  static StackDepot& stack_depot() { return stack_depot_; }
+
   // State kept for sampled allocations (/heapz support). No pageheap_lock
-  // required when reading/writing the counters.
-  ABSL_CONST_INIT static tcmalloc_internal::StatsCounter sampled_objects_size_;
+  // required when reading/writing the counters.  Every CPU updates them, so
+  // they are kept per CPU.
+  ABSL_CONST_INIT static subtle::percpu::PerCpuCounter sampled_objects_size_;
   // sampled_internal_fragmentation estimates the amount of memory overhead from
   // allocation sizes being rounded up to size class/page boundaries.
-  ABSL_CONST_INIT static tcmalloc_internal::StatsCounter
+  ABSL_CONST_INIT static subtle::percpu::PerCpuCounter
       sampled_internal_fragmentation_;
   // total_sampled_count_ tracks the total number of allocations that are
   // sampled.
-  ABSL_CONST_INIT static tcmalloc_internal::StatsCounter total_sampled_count_;
+  ABSL_CONST_INIT static subtle::percpu::PerCpuCounter total_sampled_count_;
 
   ABSL_CONST_INIT static AllocationSampleList allocation_samples;
 
+  ABSL_CONST_INIT static HeapDeltaSampleList heap_delta_samples;
+
   ABSL_CONST_INIT static deallocationz::DeallocationProfilerList
       deallocation_samples;
 
+  ABSL_CONST_INIT static deallocationz::ContinuousLifetimeProfiler
+      continuous_lifetimes;
+
   // MallocHook::AllocHandle is a simple 64-bit int, and is not dependent on
   // other data.
   ABSL_CONST_INIT static std::atomic<AllocHandle>
@@ -167,8 +256,10 @@ class Static final {
     cpu_cache_active_.store(true, std::memory_order_release);
   }
 
+  // Traced builds record every object, so the batch paths, which bypass the
+  // per-object hooks, must not be used.
   static bool ABSL_ATTRIBUTE_ALWAYS_INLINE HaveHooks() {
-    return false;
+    return kAllocationTrace;
   }
 
   static size_t metadata_bytes() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
@@ -192,6 +283,7 @@ class Static final {
   // can run their constructors.
 
   ABSL_CONST_INIT static Arena arena_;
+  ABSL_CONST_INIT static Arena numa_arenas_[kNumaPartitions];
   static SizeMap sizemap_;
   TCMALLOC_ATTRIBUTE_NO_DESTROY ABSL_CONST_INIT static TransferCacheManager
       transfer_cache_;
@@ -200,12 +292,19 @@ class Static final {
   ABSL_CONST_INIT static GuardedPageAllocator guardedpage_allocator_;
   static SampledAllocationAllocator sampledallocation_allocator_;
   static PageHeapAllocator<Span> span_allocator_;
+  static PageHeapAllocator<Span> numa_span_allocators_[kNumaPartitions];
+  static PageHeapAllocator<Span::FreelistBitmap> freelist_bitmap_allocator_;
+  static PageHeapAllocator<Span::FreelistBitmap>
+      numa_freelist_bitmap_allocators_[kNumaPartitions];
   static PageHeapAllocator<ThreadCache> threadcache_allocator_;
   static PageHeapAllocator<StackTraceTable::LinkedSample>
       linked_sample_allocator_;
   ABSL_CONST_INIT static std::atomic<bool> inited_;
   ABSL_CONST_INIT static std::atomic<bool> cpu_cache_active_;
   ABSL_CONST_INIT static PeakHeapTracker peak_heap_tracker_;
+  ABSL_CONST_INIT static LeakDetector leak_detector_;
+  ABSL_CONST_INIT static StackDepot stack_depot_;
+  ABSL_CONST_INIT static BackgroundWakeup background_wakeup_;
   ABSL_CONST_INIT static NumaTopology<kNumaPartitions, kNumBaseClasses>
       numa_topology_;
 
@@ -253,7 +352,7 @@ inline Span* Span::New(PageId p, Length len) {
              max_span_cache_array_size == Span::kCacheSize) ||
             (Parameters::max_span_cache_size() == kLargeCacheSize &&
              max_span_cache_array_size == Span::kLargeCacheArraySize));
-  Span* result = Static::span_allocator().NewWithSize(
+  Span* result = Static::span_allocator(p).NewWithSize(
       Span::CalcSizeOf(max_span_cache_array_size),
       Span::CalcAlignOf(max_span_cache_array_size));
   result->Init(p, len);
@@ -261,6 +360,8 @@ inline Span* Span::New(PageId p, Length len) {
 }
 
 inline void Span::Delete(Span* span) {
+  PageHeapAllocator<Span>& allocator =
+      Static::span_allocator(span->first_page());
 #ifndef NDEBUG
   const uint32_t max_span_cache_array_size =
       Parameters::max_span_cache_array_size();
@@ -273,7 +374,7 @@ inline void Span::Delete(Span* span) {
   // In debug mode, trash the contents of deleted Spans
   memset(static_cast<void*>(span), 0x3f, span_size);
 #endif
-  Static::span_allocator().Delete(span);
+  allocator.Delete(span);
 }
 
 // ConstantRatePageAllocatorReleaser() might release more than the requested
@@ -283,7 +384,20 @@ inline void Span::Delete(Span* span) {
 // constant rate.
 class ConstantRatePageAllocatorReleaser {
  public:
-  size_t Release(size_t num_bytes, PageReleaseReason reason) {
+  ConstantRatePageAllocatorReleaser() = default;
+  // Only releases from the normal heap of NUMA <partition>; see
+  // PageAllocator::ReleasePartitionAtLeastNPages.
+  explicit ConstantRatePageAllocatorReleaser(int partition)
+      : partition_(partition) {}
+
+  // Releases from all heaps except for the normal heaps of the NUMA partitions
+  // in <skip_partitions>, unless constructed for a single partition.
+  size_t Release(size_t num_bytes, PageReleaseReason reason,
+                 uint64_t skip_partitions = 0) {
+    const int64_t start = TC_USDT_ENABLED(page_release)
+                              ? absl::base_internal::CycleClock::Now()
+                              : 0;
+    const size_t requested_bytes = num_bytes;
     const PageHeapSpinLockHolder l;
 
     if (num_bytes <= extra_bytes_released_) {
@@ -308,9 +422,17 @@ class ConstantRatePageAllocatorReleaser {
       }
     }();
 
-    const size_t bytes_released = tc_globals.page_allocator()
-                                      .ReleaseAtLeastNPages(num_pages, reason)
-                                      .in_bytes();
+    PageAllocator& page_allocator = tc_globals.page_allocator();
+    const size_t bytes_released =
+        (partition_ >= 0 ? page_allocator.ReleasePartitionAtLeastNPages(
+                               partition_, num_pages, reason)
+                         : page_allocator.ReleaseAtLeastNPages(
+                               num_pages, reason, skip_partitions))
+            .in_bytes();
+    TC_USDT_PROBE(page_release, requested_bytes, bytes_released,
+                  static_cast<int>(reason),
+                  start != 0 ? absl::base_internal::CycleClock::Now() - start
+                             : 0);
     if (bytes_released > num_bytes) {
       extra_bytes_released_ = bytes_released - num_bytes;
 
@@ -325,6 +447,8 @@ class ConstantRatePageAllocatorReleaser {
   }
 
  private:
+  // The NUMA partition to release from, or -1 for all heaps.
+  int partition_ = -1;
   size_t extra_bytes_released_ = 0;
 };
 
@@ -0,0 +1,356 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/stats_analysis.h"
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Splits pbtxt into words, quoted strings and the punctuation '{', '}' and
+// ':'.  PbtxtRegion does not always separate a closing brace from the value
+// before it.
+class Tokenizer {
+ public:
+  explicit Tokenizer(absl::string_view text) : text_(text) {}
+
+  // Returns the next token, or an empty one at the end.
+  absl::string_view Next() {
+    while (pos_ < text_.size() && absl::ascii_isspace(text_[pos_])) {
+      ++pos_;
+    }
+    if (pos_ == text_.size()) {
+      return {};
+    }
+    const size_t start = pos_;
+    const char c = text_[pos_];
+    if (c == '{' || c == '}' || c == ':') {
+      ++pos_;
+    } else if (c == '"') {
+      const size_t end = text_.find('"', pos_ + 1);
+      pos_ = end == absl::string_view::npos ? text_.size() : end + 1;
+    } else {
+      while (pos_ < text_.size() && !absl::ascii_isspace(text_[pos_]) &&
+             text_[pos_] != '{' && text_[pos_] != '}' && text_[pos_] != ':') {
+        ++pos_;
+      }
+    }
+    return text_.substr(start, pos_ - start);
+  }
+
+ private:
+  absl::string_view text_;
+  size_t pos_ = 0;
+};
+
+constexpr absl::string_view kHpaa = "page_allocator.huge_page_allocator.";
+
+double Share(double bytes, double total) {
+  return total > 0 ? bytes / total : 0;
+}
+
+std::string Percent(double share) {
+  return absl::StrFormat("%.1f%%", 100 * share);
+}
+
+}  // namespace
+
+double StatsDump::Get(absl::string_view path) const {
+  auto it = values_.find(path);
+  return it == values_.end() ? 0 : it->second;
+}
+
+bool StatsDump::Has(absl::string_view path) const {
+  return values_.find(path) != values_.end();
+}
+
+absl::StatusOr<StatsDump> ParseStatsPbtxt(absl::string_view pbtxt) {
+  StatsDump dump;
+  Tokenizer tokens(pbtxt);
+  // The paths of the enclosing regions, the innermost last.
+  std::vector<std::string> prefixes = {""};
+  for (absl::string_view token = tokens.Next(); !token.empty();
+       token = tokens.Next()) {
+    if (token == "}") {
+      if (prefixes.size() == 1) {
+        return absl::InvalidArgumentError("Unbalanced '}'");
+      }
+      prefixes.pop_back();
+      continue;
+    }
+    if (token == "{" || token == ":" || token[0] == '"') {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Expected a field name, found '", token, "'"));
+    }
+    const std::string path = absl::StrCat(prefixes.back(), token);
+    const absl::string_view next = tokens.Next();
+    if (next == "{") {
+      prefixes.push_back(absl::StrCat(path, "."));
+      continue;
+    }
+    if (next != ":") {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Expected ':' or '{' after '", path, "'"));
+    }
+    const absl::string_view value = tokens.Next();
+    if (value.empty() || value == "{" || value == "}" || value == ":") {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Expected a value for '", path, "'"));
+    }
+    double number;
+    if (value == "true" || value == "false") {
+      number = value == "true" ? 1 : 0;
+    } else if (!absl::SimpleAtod(value, &number)) {
+      continue;
+    }
+    dump.values_[path] += number;
+  }
+  if (prefixes.size() != 1) {
+    return absl::InvalidArgumentError("Unbalanced '{'");
+  }
+  return dump;
+}
+
+double MemoryBreakdown::Get(absl::string_view name) const {
+  for (const Entry& entry : entries) {
+    if (entry.name == name) return entry.bytes;
+  }
+  return 0;
+}
+
+MemoryBreakdown ComputeBreakdown(const StatsDump& dump) {
+  auto hpaa = [&](absl::string_view field) {
+    return dump.Get(absl::StrCat(kHpaa, field));
+  };
+
+  const double filler_free = hpaa("filler_usage.free");
+  const double region_free =
+      hpaa("region_usage.free") + hpaa("lifetime_region_usage.free");
+  const double huge_cache_free = hpaa("cache_usage.free");
+  // The rest of the page heap's free memory: that of the page heap without
+  // hugepage awareness, the allocators' own and that of the span caches.
+  const double other_free =
+      std::max(0.0, dump.Get("page_heap_freelist") - filler_free -
+                        region_free - huge_cache_free);
+
+  MemoryBreakdown breakdown;
+  breakdown.entries = {
+      {std::string(kBreakdownInUse), dump.Get("in_use_by_app")},
+      {std::string(kBreakdownPerCpuCaches),
+       dump.Get("per_cpu_cache_freelist")},
+      {std::string(kBreakdownTransferCaches),
+       dump.Get("transfer_cache_freelist") +
+           dump.Get("sharded_transfer_cache_freelist")},
+      {std::string(kBreakdownCentralCaches),
+       dump.Get("central_cache_freelist")},
+      {std::string(kBreakdownThreadCaches),
+       dump.Get("thread_cache_freelists")},
+      {std::string(kBreakdownFillerFree), filler_free},
+      {std::string(kBreakdownRegionFree), region_free},
+      {std::string(kBreakdownHugeCacheFree), huge_cache_free},
+      {std::string(kBreakdownOtherPageHeapFree), other_free},
+      {std::string(kBreakdownMetadata), dump.Get("malloc_metadata")},
+      {std::string(kBreakdownFillerReleased), hpaa("filler_usage.unmapped")},
+      {std::string(kBreakdownRegionReleased),
+       hpaa("region_usage.unmapped") + hpaa("lifetime_region_usage.unmapped")},
+  };
+  breakdown.total_bytes = dump.Has("total_resident")
+                              ? dump.Get("total_resident")
+                              : dump.Get("actual_mem_used");
+  return breakdown;
+}
+
+std::string FormatBreakdown(const MemoryBreakdown& breakdown) {
+  std::string out = absl::StrFormat("%-22s %16.0f bytes\n", "total",
+                                    breakdown.total_bytes);
+  for (const MemoryBreakdown::Entry& entry : breakdown.entries) {
+    absl::StrAppendFormat(&out, "%-22s %16.0f bytes %7s\n", entry.name,
+                          entry.bytes,
+                          Percent(Share(entry.bytes, breakdown.total_bytes)));
+  }
+  return out;
+}
+
+std::string CompareBreakdowns(const MemoryBreakdown& before,
+                              const MemoryBreakdown& after) {
+  struct Row {
+    std::string name;
+    double before;
+    double after;
+  };
+  std::vector<Row> rows;
+  for (const MemoryBreakdown::Entry& entry : after.entries) {
+    rows.push_back({entry.name, before.Get(entry.name), entry.bytes});
+  }
+  std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+    return std::fabs(a.after - a.before) > std::fabs(b.after - b.before);
+  });
+
+  std::string out = absl::StrFormat("%-22s %16s %16s %16s\n", "", "before",
+                                    "after", "delta");
+  absl::StrAppendFormat(&out, "%-22s %16.0f %16.0f %+16.0f\n", "total",
+                        before.total_bytes, after.total_bytes,
+                        after.total_bytes - before.total_bytes);
+  for (const Row& row : rows) {
+    absl::StrAppendFormat(&out, "%-22s %16.0f %16.0f %+16.0f\n", row.name,
+                          row.before, row.after, row.after - row.before);
+  }
+  return out;
+}
+
+std::vector<Recommendation> RecommendTuning(
+    const StatsDump& dump, const RecommendationThresholds& thresholds) {
+  std::vector<Recommendation> recommendations;
+  const MemoryBreakdown breakdown = ComputeBreakdown(dump);
+  const double in_use = breakdown.Get(kBreakdownInUse);
+  if (in_use <= 0) {
+    return recommendations;
+  }
+  auto share = [&](absl::string_view name) {
+    return Share(breakdown.Get(name), in_use);
+  };
+  // Whether the dump has the boolean parameter <name>, and it is off.
+  auto off = [&](absl::string_view name) {
+    return dump.Has(name) && dump.Get(name) == 0;
+  };
+
+  if (const double s = share(kBreakdownPerCpuCaches);
+      s > thresholds.per_cpu_caches) {
+    const double size = dump.Get("tcmalloc_max_per_cpu_cache_size");
+    recommendations.push_back(
+        {"tcmalloc_max_per_cpu_cache_size",
+         absl::StrFormat("Per-CPU caches hold %s of the memory in use; lower "
+                         "the per-CPU cache size from %.0f bytes, e.g. to "
+                         "%.0f.",
+                         Percent(s), size, size / 2)});
+  }
+
+  if (const double s = share(kBreakdownTransferCaches);
+      s > thresholds.transfer_caches) {
+    if (off("tcmalloc_transfer_cache_predictive_resize")) {
+      recommendations.push_back(
+          {"tcmalloc_transfer_cache_predictive_resize",
+           absl::StrFormat("Transfer caches hold %s of the memory in use; let "
+                           "them shrink with demand.",
+                           Percent(s))});
+    } else {
+      recommendations.push_back(
+          {"", absl::StrFormat("Transfer caches hold %s of the memory in use; "
+                               "look for size classes that are freed on "
+                               "other CPUs than they are allocated on.",
+                               Percent(s))});
+    }
+  }
+
+  if (const double s = share(kBreakdownFillerFree);
+      s > thresholds.filler_free) {
+    const double short_ns =
+        dump.Get("tcmalloc_skip_subrelease_short_interval_ns");
+    const double long_ns = dump.Get("tcmalloc_skip_subrelease_long_interval_ns");
+    if (short_ns > 0 || long_ns > 0) {
+      recommendations.push_back(
+          {"tcmalloc_skip_subrelease_long_interval_ns",
+           absl::StrFormat("The filler holds %s of the memory in use free; "
+                           "shorten the skip-subrelease intervals (now %.0fs "
+                           "short, %.0fs long) to release it sooner.",
+                           Percent(s), short_ns / 1e9, long_ns / 1e9)});
+    } else if (off("tcmalloc_release_partial_alloc_pages")) {
+      recommendations.push_back(
+          {"tcmalloc_release_partial_alloc_pages",
+           absl::StrFormat("The filler holds %s of the memory in use free; "
+                           "release the free pages of partially allocated "
+                           "hugepages too.",
+                           Percent(s))});
+    }
+  }
+
+  // Releasing too eagerly breaks up hugepages, which shows as low hugepage
+  // coverage of the filler's used memory.
+  const double filler_used = dump.Get(absl::StrCat(kHpaa, "filler_usage.used"));
+  const double hugepageable =
+      dump.Get(absl::StrCat(kHpaa, "filler_hugepageable_used_bytes"));
+  if (const double s = Share(breakdown.Get(kBreakdownFillerReleased),
+                             filler_used);
+      s > thresholds.filler_released && filler_used > 0 &&
+      Share(hugepageable, filler_used) < 0.9) {
+    recommendations.push_back(
+        {"tcmalloc_skip_subrelease_long_interval_ns",
+         absl::StrFormat("The filler released %s of its used memory's worth "
+                         "and only %s of its used memory is on intact "
+                         "hugepages; lengthen the skip-subrelease intervals "
+                         "to break up fewer hugepages.",
+                         Percent(s), Percent(Share(hugepageable, filler_used)))});
+  }
+
+  if (const double s = share(kBreakdownRegionFree);
+      s > thresholds.region_free) {
+    if (off("tcmalloc_release_pages_from_huge_region")) {
+      recommendations.push_back(
+          {"tcmalloc_release_pages_from_huge_region",
+           absl::StrFormat("Huge regions hold %s of the memory in use free; "
+                           "release their free pages.",
+                           Percent(s))});
+    } else if (off("tcmalloc_huge_region_demand_based_release")) {
+      recommendations.push_back(
+          {"tcmalloc_huge_region_demand_based_release",
+           absl::StrFormat("Huge regions hold %s of the memory in use free; "
+                           "release it based on demand.",
+                           Percent(s))});
+    }
+  }
+
+  if (const double s = share(kBreakdownHugeCacheFree);
+      s > thresholds.huge_cache_free) {
+    if (off("tcmalloc_huge_cache_demand_based_release")) {
+      recommendations.push_back(
+          {"tcmalloc_huge_cache_demand_based_release",
+           absl::StrFormat("The huge cache holds %s of the memory in use; "
+                           "size it by demand.",
+                           Percent(s))});
+    } else {
+      recommendations.push_back(
+          {"tcmalloc_cache_demand_release_long_interval_ns",
+           absl::StrFormat("The huge cache holds %s of the memory in use; "
+                           "shorten the demand intervals it is sized by.",
+                           Percent(s))});
+    }
+  }
+
+  if (const double s = share(kBreakdownMetadata); s > thresholds.metadata) {
+    recommendations.push_back(
+        {"", absl::StrFormat("Metadata is %s of the memory in use; check "
+                             "num_spans and num_stack_traces for leaks of "
+                             "spans or sampled allocations.",
+                             Percent(s))});
+  }
+  return recommendations;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -0,0 +1,134 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Offline analysis of the stats of MallocExtension::GetStatsInPbtxt.
+//
+// Breaks the memory of a process down into what the application uses and
+// what TCMalloc holds on to, compares two dumps to find what an RSS regression
+// comes from, and recommends tuning for the overheads found.  See
+// stats_analysis_tool.cc for the command line tool.
+
+#ifndef TCMALLOC_STATS_ANALYSIS_H_
+#define TCMALLOC_STATS_ANALYSIS_H_
+
+#include <stddef.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "absl/container/btree_map.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// The numeric fields of a GetStatsInPbtxt dump, keyed by their path, e.g.
+// "page_allocator.huge_page_allocator.filler_usage.free".  Fields that repeat
+// under the same path, e.g. those of each page allocator or size class, are
+// summed.  Booleans are 1 or 0; fields that are not numbers are dropped.
+class StatsDump {
+ public:
+  // Returns the value of the field at <path>, or 0 if there is none.
+  double Get(absl::string_view path) const;
+  bool Has(absl::string_view path) const;
+
+  const absl::btree_map<std::string, double, std::less<>>& values() const {
+    return values_;
+  }
+
+ private:
+  friend absl::StatusOr<StatsDump> ParseStatsPbtxt(absl::string_view pbtxt);
+
+  absl::btree_map<std::string, double, std::less<>> values_;
+};
+
+// Parses the output of MallocExtension::GetStatsInPbtxt.
+absl::StatusOr<StatsDump> ParseStatsPbtxt(absl::string_view pbtxt);
+
+// Where the memory of a process goes, in bytes.
+struct MemoryBreakdown {
+  struct Entry {
+    std::string name;
+    double bytes;
+  };
+  // In a fixed order, starting with the application's use.
+  std::vector<Entry> entries;
+  // The resident memory of the process, if the dump has it, or else the
+  // memory TCMalloc has backed.
+  double total_bytes;
+
+  double Get(absl::string_view name) const;
+};
+
+// The names of the entries of a MemoryBreakdown.
+inline constexpr absl::string_view kBreakdownInUse = "in_use_by_app";
+inline constexpr absl::string_view kBreakdownPerCpuCaches = "per_cpu_caches";
+inline constexpr absl::string_view kBreakdownTransferCaches =
+    "transfer_caches";
+inline constexpr absl::string_view kBreakdownCentralCaches = "central_caches";
+inline constexpr absl::string_view kBreakdownThreadCaches = "thread_caches";
+inline constexpr absl::string_view kBreakdownFillerFree = "filler_free";
+inline constexpr absl::string_view kBreakdownRegionFree = "region_free";
+inline constexpr absl::string_view kBreakdownHugeCacheFree = "huge_cache_free";
+inline constexpr absl::string_view kBreakdownOtherPageHeapFree =
+    "other_page_heap_free";
+inline constexpr absl::string_view kBreakdownMetadata = "metadata";
+inline constexpr absl::string_view kBreakdownFillerReleased =
+    "filler_released";
+inline constexpr absl::string_view kBreakdownRegionReleased =
+    "region_released";
+
+// Breaks the memory of <dump> down.  The released entries are not backed, so
+// they do not count towards total_bytes; they are listed as they are what
+// subrelease gave back.
+MemoryBreakdown ComputeBreakdown(const StatsDump& dump);
+
+// Formats <breakdown> as a table, with each entry's share of the total.
+std::string FormatBreakdown(const MemoryBreakdown& breakdown);
+
+// Formats the entries of <before> and <after> side by side, the entries that
+// changed the most first.
+std::string CompareBreakdowns(const MemoryBreakdown& before,
+                              const MemoryBreakdown& after);
+
+// The shares of the application's use above which an overhead is worth
+// tuning.  That of the filler's released memory is relative to the filler's
+// used memory instead.
+struct RecommendationThresholds {
+  double per_cpu_caches = 0.10;
+  double transfer_caches = 0.05;
+  double filler_free = 0.10;
+  double filler_released = 0.20;
+  double region_free = 0.10;
+  double huge_cache_free = 0.10;
+  double metadata = 0.05;
+};
+
+struct Recommendation {
+  // The TCMalloc parameter to tune, as named in the dump, or empty if the
+  // overhead has no parameter to tune.
+  std::string parameter;
+  std::string advice;
+};
+
+// Returns tuning to reduce the overheads of <dump> above <thresholds>.
+std::vector<Recommendation> RecommendTuning(
+    const StatsDump& dump, const RecommendationThresholds& thresholds = {});
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_STATS_ANALYSIS_H_
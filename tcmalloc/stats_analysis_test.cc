@@ -0,0 +1,132 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/stats_analysis.h"
+
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Field;
+using ::testing::HasSubstr;
+using ::testing::IsEmpty;
+
+constexpr double kMiB = 1 << 20;
+
+// A dump as PbtxtRegion prints it, with the given bytes in MiB.
+std::string Dump(int in_use, int per_cpu, int filler_free, int metadata) {
+  return absl::StrFormat(
+      " in_use_by_app: %d page_heap_freelist: %d"
+      " per_cpu_cache_freelist: %d transfer_cache_freelist: 0"
+      " sharded_transfer_cache_freelist: 0 central_cache_freelist: 0"
+      " thread_cache_freelists: 0 malloc_metadata: %d"
+      " actual_mem_used: %d"
+      " page_allocator { tag: normal huge_page_allocator { using_hpaa: true"
+      " filler_usage { used: %d free: %d unmapped: 0}"
+      " region_usage { used: 0 free: 0 unmapped: 0}}}"
+      " page_allocator { tag: sampled huge_page_allocator { using_hpaa: true"
+      " filler_usage { used: 0 free: 0 unmapped: 0}}}"
+      " tcmalloc_max_per_cpu_cache_size: 3145728"
+      " tcmalloc_transfer_cache_predictive_resize: false",
+      in_use << 20, filler_free << 20, per_cpu << 20, metadata << 20,
+      (in_use + per_cpu + filler_free + metadata) << 20, in_use << 20,
+      filler_free << 20);
+}
+
+TEST(StatsAnalysisTest, Parse) {
+  absl::StatusOr<StatsDump> dump = ParseStatsPbtxt(Dump(100, 1, 2, 3));
+  ASSERT_TRUE(dump.ok()) << dump.status();
+  EXPECT_EQ(dump->Get("in_use_by_app"), 100 * kMiB);
+  EXPECT_EQ(dump->Get("tcmalloc_transfer_cache_predictive_resize"), 0);
+  EXPECT_TRUE(dump->Has("tcmalloc_transfer_cache_predictive_resize"));
+  EXPECT_FALSE(dump->Has("total_resident"));
+  // Repeated fields are summed, booleans are numbers, strings are dropped.
+  EXPECT_EQ(dump->Get("page_allocator.huge_page_allocator.using_hpaa"), 2);
+  EXPECT_EQ(dump->Get("page_allocator.huge_page_allocator.filler_usage.free"),
+            2 * kMiB);
+  EXPECT_FALSE(dump->Has("page_allocator.tag"));
+}
+
+TEST(StatsAnalysisTest, ParseErrors) {
+  EXPECT_EQ(ParseStatsPbtxt("a { b: 1").status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(ParseStatsPbtxt("a: 1 }").status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(ParseStatsPbtxt("a 1").status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(ParseStatsPbtxt("a:").status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_TRUE(ParseStatsPbtxt("").ok());
+}
+
+TEST(StatsAnalysisTest, Breakdown) {
+  absl::StatusOr<StatsDump> dump = ParseStatsPbtxt(Dump(100, 1, 2, 3));
+  ASSERT_TRUE(dump.ok()) << dump.status();
+  const MemoryBreakdown breakdown = ComputeBreakdown(*dump);
+  EXPECT_EQ(breakdown.total_bytes, 106 * kMiB);
+  EXPECT_EQ(breakdown.Get(kBreakdownInUse), 100 * kMiB);
+  EXPECT_EQ(breakdown.Get(kBreakdownPerCpuCaches), 1 * kMiB);
+  EXPECT_EQ(breakdown.Get(kBreakdownFillerFree), 2 * kMiB);
+  EXPECT_EQ(breakdown.Get(kBreakdownOtherPageHeapFree), 0);
+  EXPECT_EQ(breakdown.Get(kBreakdownMetadata), 3 * kMiB);
+  EXPECT_THAT(FormatBreakdown(breakdown), HasSubstr("filler_free"));
+}
+
+TEST(StatsAnalysisTest, Compare) {
+  absl::StatusOr<StatsDump> before = ParseStatsPbtxt(Dump(100, 1, 2, 3));
+  absl::StatusOr<StatsDump> after = ParseStatsPbtxt(Dump(100, 1, 50, 4));
+  ASSERT_TRUE(before.ok()) << before.status();
+  ASSERT_TRUE(after.ok()) << after.status();
+  const std::string comparison =
+      CompareBreakdowns(ComputeBreakdown(*before), ComputeBreakdown(*after));
+  // The largest change comes first, after the header and total.
+  const std::vector<std::string> lines = absl::StrSplit(comparison, '\n');
+  ASSERT_GE(lines.size(), 4);
+  EXPECT_THAT(lines[2], HasSubstr("filler_free"));
+  EXPECT_THAT(lines[3], HasSubstr("metadata"));
+}
+
+TEST(StatsAnalysisTest, Recommendations) {
+  absl::StatusOr<StatsDump> healthy = ParseStatsPbtxt(Dump(100, 1, 2, 3));
+  ASSERT_TRUE(healthy.ok()) << healthy.status();
+  EXPECT_THAT(RecommendTuning(*healthy), IsEmpty());
+
+  absl::StatusOr<StatsDump> overheads = ParseStatsPbtxt(Dump(100, 20, 2, 10));
+  ASSERT_TRUE(overheads.ok()) << overheads.status();
+  EXPECT_THAT(
+      RecommendTuning(*overheads),
+      ElementsAre(Field(&Recommendation::parameter,
+                        "tcmalloc_max_per_cpu_cache_size"),
+                  Field(&Recommendation::parameter, "")));
+
+  RecommendationThresholds thresholds;
+  thresholds.per_cpu_caches = 0.5;
+  thresholds.metadata = 0.5;
+  EXPECT_THAT(RecommendTuning(*overheads, thresholds), IsEmpty());
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -0,0 +1,126 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Analyzes the stats of MallocExtension::GetStatsInPbtxt.
+//
+// Usage:
+//   stats_analysis_tool stats.pbtxt
+//   stats_analysis_tool before.pbtxt after.pbtxt
+//
+// With one dump, prints where its memory goes and tuning for the overheads
+// above the thresholds (see RecommendationThresholds, and the flags below).
+// With two, prints how each part changed from the first to the second, the
+// largest changes first, and tuning for the second.
+
+#include <stdio.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "tcmalloc/stats_analysis.h"
+
+ABSL_FLAG(double, per_cpu_caches_threshold, 0.10,
+          "Share of the memory in use above which to tune per-CPU caches");
+ABSL_FLAG(double, transfer_caches_threshold, 0.05,
+          "Share of the memory in use above which to tune transfer caches");
+ABSL_FLAG(double, filler_free_threshold, 0.10,
+          "Share of the memory in use above which to tune filler release");
+ABSL_FLAG(double, filler_released_threshold, 0.20,
+          "Share of the filler's used memory released above which to tune "
+          "filler release");
+ABSL_FLAG(double, region_free_threshold, 0.10,
+          "Share of the memory in use above which to tune huge regions");
+ABSL_FLAG(double, huge_cache_free_threshold, 0.10,
+          "Share of the memory in use above which to tune the huge cache");
+ABSL_FLAG(double, metadata_threshold, 0.05,
+          "Share of the memory in use above which to look into metadata");
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+absl::StatusOr<StatsDump> ReadDump(const char* path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    return absl::NotFoundError(absl::StrFormat("Failed to open %s", path));
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return ParseStatsPbtxt(contents.str());
+}
+
+int Run(const std::vector<char*>& paths) {
+  if (paths.empty() || paths.size() > 2) {
+    absl::FPrintF(stderr,
+                  "Usage: stats_analysis_tool [flags] stats.pbtxt "
+                  "[after.pbtxt]\n");
+    return 2;
+  }
+  std::vector<StatsDump> dumps;
+  for (const char* path : paths) {
+    absl::StatusOr<StatsDump> dump = ReadDump(path);
+    if (!dump.ok()) {
+      absl::FPrintF(stderr, "%s: %s\n", path, dump.status().ToString());
+      return 1;
+    }
+    dumps.push_back(*std::move(dump));
+  }
+
+  if (dumps.size() == 1) {
+    absl::PrintF("%s", FormatBreakdown(ComputeBreakdown(dumps[0])));
+  } else {
+    absl::PrintF("%s", CompareBreakdowns(ComputeBreakdown(dumps[0]),
+                                         ComputeBreakdown(dumps[1])));
+  }
+
+  RecommendationThresholds thresholds;
+  thresholds.per_cpu_caches = absl::GetFlag(FLAGS_per_cpu_caches_threshold);
+  thresholds.transfer_caches = absl::GetFlag(FLAGS_transfer_caches_threshold);
+  thresholds.filler_free = absl::GetFlag(FLAGS_filler_free_threshold);
+  thresholds.filler_released = absl::GetFlag(FLAGS_filler_released_threshold);
+  thresholds.region_free = absl::GetFlag(FLAGS_region_free_threshold);
+  thresholds.huge_cache_free = absl::GetFlag(FLAGS_huge_cache_free_threshold);
+  thresholds.metadata = absl::GetFlag(FLAGS_metadata_threshold);
+  const std::vector<Recommendation> recommendations =
+      RecommendTuning(dumps.back(), thresholds);
+  if (recommendations.empty()) {
+    absl::PrintF("\nNo overheads above the thresholds.\n");
+    return 0;
+  }
+  absl::PrintF("\nRecommendations:\n");
+  for (const Recommendation& r : recommendations) {
+    if (r.parameter.empty()) {
+      absl::PrintF("  %s\n", r.advice);
+    } else {
+      absl::PrintF("  %s: %s\n", r.parameter, r.advice);
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+
+int main(int argc, char** argv) {
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  args.erase(args.begin());
+  return tcmalloc::tcmalloc_internal::Run(args);
+}
@@ -0,0 +1,109 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The layout of the stats page, which lets another process read TCMalloc's key
+// gauges without any work in, or locks taken by, the application.
+//
+// With the tcmalloc_publish_stats_page parameter set, the background thread
+// (see MallocExtension::ProcessBackgroundActions) creates a memfd holding a
+// StatsPage, and refreshes it on each of its iterations.  The file descriptor
+// is the "tcmalloc.stats_page_fd" numeric property.  A scraper with access to
+// the process can open /proc/<pid>/fd/<fd>, map sizeof(StatsPage) bytes of it
+// read-only, and read it with ReadStatsPage.
+//
+// This header has no dependencies on TCMalloc, so scrapers can include it
+// without linking against it.
+
+#ifndef TCMALLOC_STATS_PAGE_H_
+#define TCMALLOC_STATS_PAGE_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace tcmalloc {
+
+struct StatsPage {
+  // "TCMSTATS", little endian.
+  static constexpr uint64_t kMagic = 0x53544154534d4354;
+  static constexpr uint32_t kVersion = 1;
+
+  // Indices into fields.  Later versions only append to these.
+  enum Field : uint32_t {
+    // Unix time of the last update, in nanoseconds.
+    kUpdateTimeNanos,
+    // As the numeric properties of the same names.
+    kInUseByAppBytes,             // generic.bytes_in_use_by_app
+    kPhysicalMemoryUsedBytes,     // generic.physical_memory_used
+    kVirtualMemoryUsedBytes,      // generic.virtual_memory_used
+    kPerCpuCacheBytes,            // tcmalloc.cpu_free
+    kShardedTransferCacheBytes,   // tcmalloc.sharded_transfer_cache_free
+    kTransferCacheBytes,          // tcmalloc.transfer_cache_free
+    kCentralCacheBytes,           // tcmalloc.central_cache_free
+    kThreadCacheBytes,            // tcmalloc.thread_cache_free
+    kPageHeapFreeBytes,           // tcmalloc.pageheap_free_bytes
+    kPageHeapUnmappedBytes,       // tcmalloc.pageheap_unmapped_bytes
+    kMetadataBytes,               // tcmalloc.metadata_bytes, without residence
+    kExternalFragmentationBytes,  // tcmalloc.external_fragmentation_bytes
+    // Resident bytes of the page heap on the far memory tier.
+    kFarTierBytes,
+    // Bytes released to the system since startup, for any reason
+    // (tcmalloc.num_released_total_bytes).  Its rate of change over time is
+    // the release rate.
+    kReleasedBytes,
+    // The configured background release rate, in bytes per second.
+    kBackgroundReleaseRate,
+    kNumFields,
+  };
+
+  // Room for the fields of later versions.
+  static constexpr uint32_t kMaxFields = 64;
+
+  // Set before the page is published, and constant afterwards.
+  uint64_t magic;
+  uint32_t version;
+  // The number of valid entries in fields.
+  uint32_t num_fields;
+
+  // A seqlock: odd while an update is in progress, and incremented twice by
+  // each update.
+  std::atomic<uint64_t> sequence;
+  std::atomic<uint64_t> fields[kMaxFields];
+};
+
+static_assert(StatsPage::kNumFields <= StatsPage::kMaxFields);
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "The stats page is shared with other processes");
+
+// Copies the first <n> fields of <page> into <out>, retrying while the page is
+// being updated.  Returns the number of fields copied, which is less than <n>
+// if the page has fewer, or 0 if <page> is not a stats page.
+inline uint32_t ReadStatsPage(const StatsPage& page, uint64_t* out,
+                              uint32_t n) {
+  if (page.magic != StatsPage::kMagic) return 0;
+  if (n > page.num_fields) n = page.num_fields;
+  if (n > StatsPage::kMaxFields) n = StatsPage::kMaxFields;
+  while (true) {
+    const uint64_t before = page.sequence.load(std::memory_order_acquire);
+    if (before % 2 != 0) continue;
+    for (uint32_t i = 0; i < n; ++i) {
+      out[i] = page.fields[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (page.sequence.load(std::memory_order_relaxed) == before) return n;
+  }
+}
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_STATS_PAGE_H_
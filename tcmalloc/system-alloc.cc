@@ -45,13 +45,17 @@
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/allocation_guard.h"
 #include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/exponential_biased.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/numa.h"
 #include "tcmalloc/internal/optimization.h"
 #include "tcmalloc/internal/page_size.h"
+#include "tcmalloc/internal/transparent_hugepage.h"
+#include "tcmalloc/internal/usdt.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/parameters.h"
+#include "tcmalloc/slow_path_latency.h"
 #include "tcmalloc/static_vars.h"
 
 // On systems (like freebsd) that don't define MAP_ANONYMOUS, use the old
@@ -163,6 +167,7 @@ class MmapRegionFactory final : public AddressRegionFactory {
 
  private:
   std::atomic<size_t> bytes_reserved_{0};
+  std::atomic<size_t> regions_{0};
 };
 ABSL_CONST_INIT std::aligned_storage<sizeof(MmapRegionFactory),
                                      alignof(MmapRegionFactory)>::type
@@ -233,6 +238,12 @@ std::pair<void*, size_t> MmapRegion::Alloc(size_t request_size,
     // This is only advisory, so ignore the error.
     ErrnoRestorer errno_restorer;
     (void)madvise(result_ptr, actual_size, MADV_NOHUGEPAGE);
+  } else if (hint_ != AddressRegionFactory::UsageHint::kMetadata &&
+             GetThpSettings().advise()) {
+    // Where THP is only used for (or only compacts memory for) regions that
+    // ask for it, ask for it on those meant to be hugepage backed.
+    ErrnoRestorer errno_restorer;
+    (void)madvise(result_ptr, actual_size, MADV_HUGEPAGE);
   }
   free_size_ -= actual_size;
   return {result_ptr, actual_size};
@@ -243,6 +254,7 @@ AddressRegion* MmapRegionFactory::Create(void* start, size_t size,
   void* region_space = MallocInternal(sizeof(MmapRegion));
   if (!region_space) return nullptr;
   bytes_reserved_.fetch_add(size, std::memory_order_relaxed);
+  regions_.fetch_add(1, std::memory_order_relaxed);
   return new (region_space)
       MmapRegion(reinterpret_cast<uintptr_t>(start), size, hint);
 }
@@ -251,8 +263,10 @@ size_t MmapRegionFactory::GetStats(absl::Span<char> buffer) {
   Printer printer(buffer.data(), buffer.size());
   size_t allocated = bytes_reserved_.load(std::memory_order_relaxed);
   constexpr double MiB = 1048576.0;
-  printer.printf("MmapSysAllocator: %zu bytes (%.1f MiB) reserved\n", allocated,
-                 allocated / MiB);
+  size_t regions = regions_.load(std::memory_order_relaxed);
+  printer.printf(
+      "MmapSysAllocator: %zu bytes (%.1f MiB) reserved in %zu regions\n",
+      allocated, allocated / MiB, regions);
 
   return printer.SpaceRequired();
 }
@@ -261,23 +275,35 @@ size_t MmapRegionFactory::GetStatsInPbtxt(absl::Span<char> buffer) {
   Printer printer(buffer.data(), buffer.size());
   size_t allocated = bytes_reserved_.load(std::memory_order_relaxed);
   printer.printf(" mmap_sys_allocator: %lld\n", allocated);
+  printer.printf(" mmap_sys_allocator_regions: %lld\n",
+                 regions_.load(std::memory_order_relaxed));
 
   return printer.SpaceRequired();
 }
 
 static AddressRegionFactory::UsageHint TagToHint(MemoryTag tag) {
   using UsageHint = AddressRegionFactory::UsageHint;
+  if (IsNormalTag(tag)) {
+    if (tc_globals.numa_topology().numa_aware()) {
+      // Hints only exist for the first two partitions; memory for the
+      // remaining partitions is still bound to its nodes by MmapAligned.
+      switch (NumaPartitionFromTag(tag)) {
+        case 0:
+          return UsageHint::kNormalNumaAwareS0;
+        case 1:
+          return UsageHint::kNormalNumaAwareS1;
+        default:
+          break;
+      }
+    }
+    return UsageHint::kNormal;
+  }
+
   switch (tag) {
     case MemoryTag::kNormal:
-      if (tc_globals.numa_topology().numa_aware()) {
-        return UsageHint::kNormalNumaAwareS0;
-      }
-      return UsageHint::kNormal;
     case MemoryTag::kNormalP1:
-      if (tc_globals.numa_topology().numa_aware()) {
-        return UsageHint::kNormalNumaAwareS1;
-      }
-      return UsageHint::kNormal;
+      // Handled above.
+      break;
     case MemoryTag::kSelSan:
       if (tc_globals.numa_topology().numa_aware()) {
         return UsageHint::kNormalNumaAwareS0;
@@ -307,7 +333,8 @@ std::pair<void*, size_t> RegionManager::Alloc(size_t request_size,
   // If we are dealing with large sizes, or large alignments we do not
   // want to throw away the existing reserved region, so instead we
   // return a new region specifically targeted for the request.
-  if (request_size > kMinMmapAlloc || alignment > kMinMmapAlloc) {
+  const size_t reserve = RegionReserveBytes();
+  if (request_size > reserve || alignment > reserve) {
     // Align on kMinSystemAlloc boundaries to reduce external fragmentation for
     // future allocations.
     size_t size = RoundUp(request_size, kMinSystemAlloc);
@@ -337,11 +364,15 @@ std::pair<void*, size_t> RegionManager::Alloc(size_t request_size,
 std::pair<void*, size_t> RegionManager::Allocate(size_t size, size_t alignment,
                                                  const MemoryTag tag) {
   AddressRegion*& region = *[&]() {
+    if (IsNormalTag(tag)) {
+      return &normal_region_[NumaPartitionFromTag(tag)];
+    }
+
     switch (tag) {
       case MemoryTag::kNormal:
-        return &normal_region_[0];
       case MemoryTag::kNormalP1:
-        return &normal_region_[1];
+        // Handled above.
+        break;
       case MemoryTag::kSampled:
         return &sampled_region_;
       case MemoryTag::kSelSan:
@@ -364,13 +395,14 @@ std::pair<void*, size_t> RegionManager::Allocate(size_t size, size_t alignment,
 
   // Allocation failed so we need to reserve more memory.
   // Reserve new region and try allocation again.
-  void* ptr = MmapAligned(kMinMmapAlloc, kMinMmapAlloc, tag);
+  const size_t reserve = RegionReserveBytes();
+  void* ptr = MmapAligned(reserve, reserve, tag);
   if (!ptr) return {nullptr, 0};
 
   const auto region_type = TagToHint(tag);
-  region = region_factory->Create(ptr, kMinMmapAlloc, region_type);
+  region = region_factory->Create(ptr, reserve, region_type);
   if (!region) {
-    munmap(ptr, kMinMmapAlloc);
+    munmap(ptr, reserve);
     return {nullptr, 0};
   }
   return region->Alloc(size, alignment);
@@ -419,7 +451,96 @@ void BindMemory(void* const base, const size_t size, const size_t partition) {
          nodemask);
 }
 
+// Places the cold memory region spanning `size` bytes starting from `base` on
+// ColdNumaNodes(), if any.  The nodes are preferred rather than required, so
+// that allocations fall back to other nodes rather than fail once the cold
+// nodes are full.
+void BindColdMemory(void* const base, const size_t size) {
+  const uint64_t nodemask = ColdNumaNodes();
+  if (nodemask == 0) return;
+
+  // MPOL_PREFERRED_MANY is available from Linux 5.15.  Older kernels reject it
+  // with EINVAL, in which case we prefer the lowest cold node only.
+  constexpr int kMpolPreferredMany = 5;
+  int err = syscall(__NR_mbind, base, size, kMpolPreferredMany, &nodemask,
+                    sizeof(nodemask) * 8, 0);
+  if (err != 0 && errno == EINVAL) {
+    const uint64_t first_node = nodemask & (~nodemask + 1);
+    err = syscall(__NR_mbind, base, size, MPOL_PREFERRED, &first_node,
+                  sizeof(first_node) * 8, 0);
+  }
+  if (err != 0) {
+    TC_LOG(
+        "Warning: Unable to mbind cold memory (errno=%d, base=%p, "
+        "nodemask=%v)",
+        errno, base, nodemask);
+  }
+}
+
 ABSL_CONST_INIT std::atomic<int> system_release_errors(0);
+// Set once any released memory may still hold its contents, because it was
+// only released with MADV_FREE.
+ABSL_CONST_INIT std::atomic<bool> system_release_kept_data(false);
+
+// The addresses of the 1 GiB pages mapped by SystemBackGigantic.  There are
+// few enough of them that they are simply kept in an array.
+constexpr size_t kMaxGiganticPages = 1024;
+ABSL_CONST_INIT absl::base_internal::SpinLock gigantic_lock(
+    absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY);
+ABSL_CONST_INIT uintptr_t gigantic_pages[kMaxGiganticPages] ABSL_GUARDED_BY(
+    gigantic_lock) = {};
+ABSL_CONST_INIT std::atomic<size_t> num_gigantic_pages(0);
+
+// Returns true if any 1 GiB page overlaps [start, end).  If <partial> is
+// true, only counts pages which [start, end) does not cover entirely.
+bool OverlapsGiganticPages(uintptr_t start, uintptr_t end, bool partial)
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(gigantic_lock) {
+  const size_t n = num_gigantic_pages.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < n; ++i) {
+    const uintptr_t page = gigantic_pages[i];
+    if (page + kGiganticPageSize <= start || page >= end) continue;
+    if (!partial || page < start || page + kGiganticPageSize > end) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Replaces the 1 GiB pages within [start, end) with ordinary anonymous memory,
+// which hands them back to the kernel.  Returns false if [start, end) covers
+// only part of one of them, as those cannot be released piecemeal, or if
+// remapping failed.
+bool ReleaseGiganticPages(uintptr_t start, uintptr_t end) {
+  if (ABSL_PREDICT_TRUE(
+          num_gigantic_pages.load(std::memory_order_relaxed) == 0)) {
+    return true;
+  }
+  absl::base_internal::SpinLockHolder h(&gigantic_lock);
+  if (OverlapsGiganticPages(start, end, /*partial=*/true)) {
+    return false;
+  }
+  size_t n = num_gigantic_pages.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < n;) {
+    const uintptr_t page = gigantic_pages[i];
+    if (page < start || page >= end) {
+      ++i;
+      continue;
+    }
+    // Mapping over the page atomically replaces it, so the range never
+    // becomes available to other mmap callers.
+    void* result = mmap(reinterpret_cast<void*>(page), kGiganticPageSize,
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+                        -1, 0);
+    if (result == MAP_FAILED) {
+      system_release_errors.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    gigantic_pages[i] = gigantic_pages[--n];
+    num_gigantic_pages.store(n, std::memory_order_relaxed);
+  }
+  return true;
+}
 
 int MapFixedNoReplaceFlagAvailable() {
   ABSL_CONST_INIT static int noreplace_flag;
@@ -472,6 +593,7 @@ AddressRange SystemAlloc(size_t bytes, size_t alignment, const MemoryTag tag) {
   // Discard requests that overflow
   if (bytes + alignment < bytes) return {nullptr, 0};
 
+  SlowPathLatencyTimer timer(SlowPathTier::kSystemAlloc, /*size_class=*/0);
   AllocationGuardSpinLockHolder lock_holder(&spinlock);
 
   InitSystemAllocatorIfNecessary();
@@ -483,9 +605,29 @@ AddressRange SystemAlloc(size_t bytes, size_t alignment, const MemoryTag tag) {
                                    actual_bytes - 1);
     TC_ASSERT_EQ(GetMemoryTag(result), tag);
   }
+  TC_USDT_PROBE(system_alloc, bytes, alignment, result);
   return {result, actual_bytes};
 }
 
+AddressRegion* SystemCreateRegion(AddressRegionFactory* factory,
+                                  AddressRegionFactory::UsageHint hint) {
+  const size_t reserve = RegionReserveBytes();
+  AllocationGuardSpinLockHolder lock_holder(&spinlock);
+  void* ptr = MmapAligned(reserve, reserve, MemoryTag::kMetadata);
+  if (ptr == nullptr) return nullptr;
+  AddressRegion* region = factory->Create(ptr, reserve, hint);
+  if (region == nullptr) {
+    munmap(ptr, reserve);
+  }
+  return region;
+}
+
+std::pair<void*, size_t> SystemRegionAlloc(AddressRegion* region, size_t size,
+                                           size_t alignment) {
+  AllocationGuardSpinLockHolder lock_holder(&spinlock);
+  return region->Alloc(size, alignment);
+}
+
 static bool ReleasePages(void* start, size_t length) {
   ErrnoRestorer errno_restorer;
 
@@ -546,14 +688,125 @@ static bool ReleasePages(void* start, size_t length) {
       ret = madvise(start, length, MADV_DONTNEED);
     } while (ret == -1 && errno == EAGAIN);
   }
+#else
+  constexpr bool do_madvdontneed = false;
 #endif
   if (ret == 0) {
+    // MADV_FREE leaves the pages as they are until the kernel reclaims them.
+    if (!do_madvdontneed) {
+      system_release_kept_data.store(true, std::memory_order_relaxed);
+    }
     return true;
   }
 
   return false;
 }
 
+uint64_t ColdNumaNodes() {
+  ABSL_CONST_INIT static absl::once_flag flag;
+  ABSL_CONST_INIT static uint64_t nodemask = 0;
+  absl::base_internal::LowLevelCallOnce(&flag, [&]() {
+    const char* e = thread_safe_getenv("TCMALLOC_COLD_NUMA_NODES");
+    if (e == nullptr || *e == '\0') return;
+
+    uint64_t mask = 0;
+    for (const char* p = e; *p != '\0';) {
+      int node = 0;
+      const char* start = p;
+      while (*p >= '0' && *p <= '9' && node < 64) {
+        node = node * 10 + (*p++ - '0');
+      }
+      if (p == start || node >= 64 || (*p != ',' && *p != '\0')) {
+        TC_BUG("bad TCMALLOC_COLD_NUMA_NODES env var '%s'", e);
+      }
+      mask |= uint64_t{1} << node;
+      if (*p == ',') ++p;
+    }
+    nodemask = mask;
+  });
+  return nodemask;
+}
+
+void SystemBindNumaPartition(void* start, size_t length, size_t partition) {
+  BindMemory(start, length, partition);
+}
+
+bool SystemInterleaveNuma(void* start, size_t length) {
+  ErrnoRestorer errno_restorer;
+  const auto& topology = tc_globals.numa_topology();
+  if (!topology.numa_aware()) {
+    return false;
+  }
+  uint64_t nodemask = 0;
+  for (size_t partition = 0; partition < topology.active_partitions();
+       ++partition) {
+    nodemask |= topology.GetPartitionNodes(partition);
+  }
+  if (absl::popcount(nodemask) < 2) {
+    return false;
+  }
+  // The kernel interleaves transparent hugepages whole, so a hugepage-aligned
+  // range is spread across the nodes a hugepage at a time.
+  if (syscall(__NR_mbind, start, length, MPOL_INTERLEAVE, &nodemask,
+              sizeof(nodemask) * 8, MPOL_MF_MOVE) != 0) {
+    TC_LOG("Warning: Unable to interleave memory (errno=%d, base=%p, "
+           "nodemask=%v)",
+           errno, start, nodemask);
+    return false;
+  }
+  return true;
+}
+
+void SystemUninterleaveNuma(void* start, size_t length, size_t partition) {
+  ErrnoRestorer errno_restorer;
+  if (tc_globals.numa_topology().bind_mode() != NumaBindMode::kNone) {
+    BindMemory(start, length, partition);
+    return;
+  }
+  if (syscall(__NR_mbind, start, length, MPOL_DEFAULT, nullptr, 0, 0) != 0) {
+    TC_LOG("Warning: Unable to reset memory policy (errno=%d, base=%p)", errno,
+           start);
+  }
+}
+
+size_t SystemAdviseHugepages(void* start, size_t length) {
+  const uintptr_t begin =
+      RoundUp(reinterpret_cast<uintptr_t>(start), kHugePageSize);
+  const uintptr_t end =
+      (reinterpret_cast<uintptr_t>(start) + length) & ~(kHugePageSize - 1);
+  if (begin >= end) return 0;
+
+  ErrnoRestorer errno_restorer;
+  if (madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE) !=
+      0) {
+    return 0;
+  }
+  return end - begin;
+}
+
+size_t RegionReserveBytes() {
+  ABSL_CONST_INIT static absl::once_flag flag;
+  ABSL_CONST_INIT static size_t bytes = kMinMmapAlloc;
+  absl::base_internal::LowLevelCallOnce(&flag, [&]() {
+    const char* e = thread_safe_getenv("TCMALLOC_RESERVE_REGION_BYTES");
+    if (e == nullptr || *e == '\0') return;
+
+    // Regions must leave room for alignment within a single tag's range.
+    constexpr size_t kMaxReserve = uintptr_t{1} << (kTagShift - 1);
+    size_t value = 0;
+    const char* p = e;
+    while (*p >= '0' && *p <= '9') {
+      value = std::min(value * 10 + (*p++ - '0'), kMaxReserve);
+    }
+    if (p == e || *p != '\0') {
+      TC_BUG("bad TCMALLOC_RESERVE_REGION_BYTES env var '%s'", e);
+    }
+    bytes = std::max(RoundUp(value, kMinMmapAlloc), kMinMmapAlloc);
+    bytes = std::min(bytes, kMaxReserve);
+  });
+  return bytes;
+}
+
 int SystemReleaseErrors() {
   return system_release_errors.load(std::memory_order_relaxed);
 }
@@ -583,6 +836,9 @@ bool SystemRelease(void* start, size_t length) {
     void* new_ptr = reinterpret_cast<void*>(new_start);
     size_t new_length = new_end - new_start;
 
+    if (!ReleaseGiganticPages(new_start, new_end)) {
+      return false;
+    }
     if (!ReleasePages(new_ptr, new_length)) {
       // Try unlocking.
       int ret;
@@ -603,9 +859,189 @@ bool SystemRelease(void* start, size_t length) {
   }
 #endif
 
+  TC_USDT_PROBE(system_release, start, length, result);
   return result;
 }
 
+size_t SystemBackGigantic(void* start, size_t length) {
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+  ErrnoRestorer errno_restorer;
+  {
+    AllocationGuardSpinLockHolder lock_holder(&spinlock);
+    if (region_factory != reinterpret_cast<MmapRegionFactory*>(&mmap_space)) {
+      return 0;
+    }
+  }
+  // NUMA policies are only applied to the mappings made by the region
+  // factory.
+  if (tc_globals.numa_topology().numa_aware()) {
+    return 0;
+  }
+
+  const uintptr_t begin =
+      RoundUp(reinterpret_cast<uintptr_t>(start), kGiganticPageSize);
+  const uintptr_t end =
+      RoundDown(reinterpret_cast<uintptr_t>(start) + length, kGiganticPageSize);
+  size_t backed = 0;
+  absl::base_internal::SpinLockHolder h(&gigantic_lock);
+  for (uintptr_t page = begin; page < end; page += kGiganticPageSize) {
+    size_t n = num_gigantic_pages.load(std::memory_order_relaxed);
+    if (n == kMaxGiganticPages) break;
+    // The kernel places hugetlb mappings on their page size, so map the page
+    // anywhere and move it over the range afterwards.  Moving replaces the
+    // range's existing mapping atomically; had we mapped over it directly
+    // with MAP_FIXED, a failure would leave a hole in the heap.  Without
+    // MAP_NORESERVE, mmap fails up front when the pool is exhausted, rather
+    // than a later fault raising SIGBUS.
+    void* mapped =
+        mmap(nullptr, kGiganticPageSize, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (30 << MAP_HUGE_SHIFT),
+             -1, 0);
+    if (mapped == MAP_FAILED) break;
+    void* moved = mremap(mapped, kGiganticPageSize, kGiganticPageSize,
+                         MREMAP_MAYMOVE | MREMAP_FIXED,
+                         reinterpret_cast<void*>(page));
+    if (moved == MAP_FAILED) {
+      // Kernels before 5.16 cannot move hugetlb mappings.
+      munmap(mapped, kGiganticPageSize);
+      break;
+    }
+    TC_ASSERT_EQ(reinterpret_cast<uintptr_t>(moved), page);
+    gigantic_pages[n] = page;
+    num_gigantic_pages.store(n + 1, std::memory_order_relaxed);
+    backed += kGiganticPageSize;
+  }
+  return backed;
+#else
+  return 0;
+#endif
+}
+
+size_t SystemGiganticBytes() {
+  return num_gigantic_pages.load(std::memory_order_relaxed) *
+         kGiganticPageSize;
+}
+
+bool SystemReleaseZeroes() {
+  return !system_release_kept_data.load(std::memory_order_relaxed) &&
+         SystemReleaseErrors() == 0;
+}
+
+bool SystemReleaseIsLazy() {
+#ifdef MADV_FREE
+  return Parameters::madvise() == MadvisePreference::kFreeOnly;
+#else
+  return false;
+#endif
+}
+
+void SystemPopulate(void* start, size_t length) {
+  ErrnoRestorer errno_restorer;
+  // MADV_POPULATE_WRITE (Linux 5.14+) faults the range in without touching
+  // it from userspace.
+#ifndef MADV_POPULATE_WRITE
+  static constexpr int MADV_POPULATE_WRITE = 23;
+#endif
+  int ret;
+  do {
+    ret = madvise(start, length, MADV_POPULATE_WRITE);
+  } while (ret == -1 && (errno == EAGAIN || errno == EINTR));
+  if (ret == 0) {
+    return;
+  }
+
+  // Older kernels reject the advice with EINVAL: fault in one byte per page
+  // instead.  The range holds no live data, so overwriting it is harmless.
+  const size_t page_size = GetPageSize();
+  volatile char* p = static_cast<volatile char*>(start);
+  for (size_t offset = 0; offset < length; offset += page_size) {
+    p[offset] = 0;
+  }
+}
+
+bool SystemCollapse(void* start, size_t length) {
+  ErrnoRestorer errno_restorer;
+  // MADV_COLLAPSE is available from Linux 6.1.  Older kernels reject it with
+  // EINVAL, leaving the range to khugepaged.
+#ifndef MADV_COLLAPSE
+  static constexpr int MADV_COLLAPSE = 25;
+#endif
+  int ret;
+  do {
+    ret = madvise(start, length, MADV_COLLAPSE);
+  } while (ret == -1 && errno == EINTR);
+  return ret == 0;
+}
+
+bool SystemSetDumpable(void* start, size_t length, bool dumpable) {
+  ErrnoRestorer errno_restorer;
+  return madvise(start, length, dumpable ? MADV_DODUMP : MADV_DONTDUMP) == 0;
+}
+
+bool SystemAdviseCold(void* start, size_t length) {
+  ErrnoRestorer errno_restorer;
+#ifndef MADV_COLD
+  static constexpr int MADV_COLD = 20;
+#endif
+  int ret;
+  do {
+    ret = madvise(start, length, MADV_COLD);
+  } while (ret == -1 && errno == EAGAIN);
+  return ret == 0;
+}
+
+bool SystemMove(void* from, void* to, size_t length) {
+  ErrnoRestorer errno_restorer;
+  // Remapping only preserves the contents and placement of private anonymous
+  // mappings, which are what MmapRegionFactory creates.
+  {
+    AllocationGuardSpinLockHolder lock_holder(&spinlock);
+    if (region_factory != reinterpret_cast<MmapRegionFactory*>(&mmap_space)) {
+      return false;
+    }
+  }
+
+  const uintptr_t pagemask = GetPageSize() - 1;
+  if (((reinterpret_cast<uintptr_t>(from) | reinterpret_cast<uintptr_t>(to) |
+        length) &
+       pagemask) != 0) {
+    return false;
+  }
+  // hugetlb mappings cannot be moved with MREMAP_DONTUNMAP.
+  if (num_gigantic_pages.load(std::memory_order_relaxed) != 0) {
+    absl::base_internal::SpinLockHolder h(&gigantic_lock);
+    const uintptr_t src = reinterpret_cast<uintptr_t>(from);
+    const uintptr_t dst = reinterpret_cast<uintptr_t>(to);
+    if (OverlapsGiganticPages(src, src + length, /*partial=*/false) ||
+        OverlapsGiganticPages(dst, dst + length, /*partial=*/false)) {
+      return false;
+    }
+  }
+
+  // MREMAP_DONTUNMAP is available from Linux 5.7.  Older kernels reject it
+  // with EINVAL; remember that, rather than failing every call.
+#ifndef MREMAP_DONTUNMAP
+  static constexpr int MREMAP_DONTUNMAP = 4;
+#endif
+  ABSL_CONST_INIT static std::atomic<bool> unsupported(false);
+  if (unsupported.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  void* result =
+      mremap(from, length, length,
+             MREMAP_MAYMOVE | MREMAP_FIXED | MREMAP_DONTUNMAP, to);
+  if (result == MAP_FAILED) {
+    // EFAULT means the source spans several mappings, which is specific to
+    // this range.
+    if (errno == EINVAL) {
+      unsupported.store(true, std::memory_order_relaxed);
+    }
+    return false;
+  }
+  TC_ASSERT_EQ(result, to);
+  return true;
+}
+
 AddressRegionFactory* GetRegionFactory() {
   AllocationGuardSpinLockHolder lock_holder(&spinlock);
   InitSystemAllocatorIfNecessary();
@@ -619,8 +1055,10 @@ void SetRegionFactory(AddressRegionFactory* factory) {
   region_factory = factory;
 }
 
+// Returns a random hint for a mapping of <size> bytes with <tag>.  Hints fall
+// below kLowAddressBits unless <high> is set, which allows all kAddressBits.
 static uintptr_t RandomMmapHint(size_t size, size_t alignment,
-                                const MemoryTag tag) {
+                                const MemoryTag tag, bool high = false) {
   // Rely on kernel's mmap randomization to seed our RNG.
   ABSL_CONST_INIT static uintptr_t rnd;
   ABSL_CONST_INIT static absl::once_flag flag;
@@ -645,12 +1083,14 @@ static uintptr_t RandomMmapHint(size_t size, size_t alignment,
   //
   //  *  Below that, the top highest the hardware allows us to use, since it is
   //     reserved for kernel space addresses.
-  constexpr uintptr_t kAddrMask = (uintptr_t{1} << (kAddressBits - 1)) - 1;
+  const int address_bits = high ? kAddressBits : kLowAddressBits;
+  const uintptr_t addr_mask = (uintptr_t{1} << (address_bits - 1)) - 1;
 #else
   // MSan and TSan use up all of the lower address space, so we allow use of
   // mid-upper address space when they're active.  This only matters for
   // TCMalloc-internal tests, since sanitizers install their own malloc/free.
-  constexpr uintptr_t kAddrMask = (uintptr_t{0xF} << (kAddressBits - 5)) - 1;
+  const int address_bits = high ? kAddressBits : kLowAddressBits;
+  const uintptr_t addr_mask = (uintptr_t{0xF} << (address_bits - 5)) - 1;
 #endif
 
   // Ensure alignment >= size so we're guaranteed the full mapping has the same
@@ -658,7 +1098,7 @@ static uintptr_t RandomMmapHint(size_t size, size_t alignment,
   alignment = absl::bit_ceil(std::max(alignment, size));
 
   rnd = ExponentialBiased::NextRandom(rnd);
-  uintptr_t addr = rnd & kAddrMask & ~(alignment - 1) & ~kTagMask;
+  uintptr_t addr = rnd & addr_mask & ~(alignment - 1) & ~kTagMask;
   addr |= static_cast<uintptr_t>(tag) << kTagShift;
   TC_ASSERT_EQ(GetMemoryTag(reinterpret_cast<const void*>(addr)), tag);
   return addr;
@@ -676,17 +1116,20 @@ void* MmapAligned(size_t size, size_t alignment, const MemoryTag tag) {
 
   std::optional<int> numa_partition;
   uintptr_t& next_addr = *[&]() {
+    if (IsNormalTag(tag)) {
+      numa_partition = NumaPartitionFromTag(tag);
+      return &next_normal_addr[*numa_partition];
+    }
+
     switch (tag) {
       case MemoryTag::kSampled:
         return &next_sampled_addr;
       case MemoryTag::kSelSan:
         return &next_selsan_addr;
       case MemoryTag::kNormalP0:
-        numa_partition = 0;
-        return &next_normal_addr[0];
       case MemoryTag::kNormalP1:
-        numa_partition = 1;
-        return &next_normal_addr[1];
+        // Handled above.
+        break;
       case MemoryTag::kCold:
         return &next_cold_addr;
       case MemoryTag::kMetadata:
@@ -715,6 +1158,8 @@ void* MmapAligned(size_t size, size_t alignment, const MemoryTag tag) {
     if (result == hint) {
       if (numa_partition.has_value()) {
         BindMemory(result, size, *numa_partition);
+      } else if (tag == MemoryTag::kCold) {
+        BindColdMemory(result, size);
       }
       // Attempt to keep the next mmap contiguous in the common case.
       next_addr += size;
@@ -756,7 +1201,11 @@ void* MmapAligned(size_t size, size_t alignment, const MemoryTag tag) {
         TC_ASSERT_EQ(err, 0);
       }
     }
-    next_addr = RandomMmapHint(size, alignment, tag);
+    // Only move past the low address space once it looks full, so that the
+    // pagemap stays on its fast path.
+    next_addr = RandomMmapHint(size, alignment, tag,
+                               /*high=*/kAddressBits > kLowAddressBits &&
+                                   i >= 500);
   }
 
   // Override errno with the current value to ensure it is set by the
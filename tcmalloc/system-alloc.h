@@ -19,6 +19,9 @@
 #define TCMALLOC_SYSTEM_ALLOC_H_
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include <utility>
 
 #include "absl/base/attributes.h"
 #include "tcmalloc/common.h"
@@ -54,6 +57,39 @@ AddressRange SystemAlloc(size_t bytes, size_t alignment, MemoryTag tag);
 // call to SystemRelease.
 int SystemReleaseErrors();
 
+// Returns the NUMA nodes that cold memory is placed on, as a nodemask, or 0 if
+// cold memory is placed like any other memory.  The nodes are read from the
+// TCMALLOC_COLD_NUMA_NODES environment variable, a comma-separated list of node
+// ids, typically those of CXL or other far memory.
+uint64_t ColdNumaNodes();
+
+// Binds [start, start + length), which must not have been touched yet, to the
+// NUMA nodes of <partition>, as SystemAlloc does for normal memory of that
+// partition.  Does nothing unless NUMA awareness is enabled.
+void SystemBindNumaPartition(void* start, size_t length, size_t partition);
+
+// Interleaves [start, start + length) across the NUMA nodes of all partitions,
+// migrating any of its pages that are already resident.  Returns false, having
+// changed nothing, unless NUMA awareness is enabled and there are several nodes
+// to interleave across.
+bool SystemInterleaveNuma(void* start, size_t length);
+
+// Undoes SystemInterleaveNuma, placing [start, start + length) as SystemAlloc
+// places normal memory of <partition>.
+void SystemUninterleaveNuma(void* start, size_t length, size_t partition);
+
+// Advises that the hugepage-aligned part of [start, start + length), which must
+// not have been touched yet, be backed by hugepages when faulted in.  Returns
+// the number of bytes advised.
+size_t SystemAdviseHugepages(void* start, size_t length);
+
+// Returns the size of the PROT_NONE address range reserved at a time for each
+// memory tag, from which SystemAlloc carves its allocations.  It defaults to
+// kMinMmapAlloc and can be raised with the TCMALLOC_RESERVE_REGION_BYTES
+// environment variable, so that a large heap is backed by a few mappings
+// rather than one per kMinMmapAlloc.
+size_t RegionReserveBytes();
+
 // This call is a hint to the operating system that the pages
 // contained in the specified range of memory will not be used for a
 // while, and can be released for use by other processes or the OS.
@@ -67,6 +103,17 @@ int SystemReleaseErrors();
 // Returns true on success.
 ABSL_MUST_USE_RESULT bool SystemRelease(void* start, size_t length);
 
+// Returns true if all memory given back with SystemRelease so far reads as zero
+// when next touched.  This does not hold once memory has been released with
+// MADV_FREE alone, or once a release has failed, as its memory may then be
+// reused as if released regardless.
+bool SystemReleaseZeroes();
+
+// Returns true if SystemRelease is lazy: it releases with MADV_FREE alone, so
+// the kernel takes the memory back only under memory pressure, and until then
+// it stays resident and may be reused without faulting.
+bool SystemReleaseIsLazy();
+
 // This call is the inverse of SystemRelease: the pages in this range
 // are in use and should be faulted in.  (In principle this is a
 // best-effort hint, but in practice we will unconditionally fault the
@@ -80,12 +127,69 @@ inline void SystemBack(void* start, size_t length) {
   // that routinely make large mallocs they never touch (sigh).
 }
 
+// Faults in [start, start + length) ahead of use, so that later accesses do
+// not take page faults.  Unlike SystemBack, this populates the range
+// unconditionally.
+// REQUIRES: [start, start + length) is a range aligned to 4KiB boundaries.
+void SystemPopulate(void* start, size_t length);
+
+// Asks the kernel to synchronously back [start, start + length) with
+// hugepages, copying any data already present.  Returns true on success.
+// REQUIRES: [start, start + length) is a range aligned to hugepage boundaries.
+bool SystemCollapse(void* start, size_t length);
+
+// Sets whether [start, start + length) is included in core dumps, with
+// MADV_DODUMP or MADV_DONTDUMP.  Each change may split the kernel's mapping of
+// the range, so this is meant for large ranges.  Returns true on success.
+// REQUIRES: [start, start + length) is a range aligned to 4KiB boundaries.
+bool SystemSetDumpable(void* start, size_t length, bool dumpable);
+
+// Marks [start, start + length) cold with MADV_COLD, so the kernel reclaims it
+// before other memory, or demotes it to a slower memory tier, while it stays
+// mapped and keeps its contents.  Returns true on success, false e.g. on
+// kernels older than Linux 5.4.
+// REQUIRES: [start, start + length) is a range aligned to 4KiB boundaries.
+bool SystemAdviseCold(void* start, size_t length);
+
+// The size of the pages SystemBackGigantic maps.
+inline constexpr size_t kGiganticPageSize = size_t{1} << 30;
+
+// Backs the 1 GiB-aligned parts of [start, start + length) with 1 GiB hugetlb
+// pages, as far as the kernel's pool of them allows.  Returns the number of
+// bytes now backed this way.  SystemRelease hands such pages back to the
+// kernel only when releasing them in full, and fails otherwise.
+// REQUIRES: [start, start + length) is unused, and was not populated.
+size_t SystemBackGigantic(void* start, size_t length);
+
+// Returns the number of bytes currently backed by SystemBackGigantic.
+size_t SystemGiganticBytes();
+
+// Moves the pages of [from, from + length) to [to, to + length) by remapping
+// them, leaving the source range mapped but unbacked, as if released.  Returns
+// false, leaving both ranges untouched, if the pages could not be moved, for
+// instance because the kernel does not support it or the memory does not come
+// from the default region factory.
+// REQUIRES: the ranges do not overlap.
+ABSL_MUST_USE_RESULT bool SystemMove(void* from, void* to, size_t length);
+
 // Returns the current address region factory.
 AddressRegionFactory* GetRegionFactory();
 
 // Sets the current address region factory to factory.
 void SetRegionFactory(AddressRegionFactory* factory);
 
+// Reserves RegionReserveBytes() of address space and returns the region that
+// <factory> creates over it with <hint>, or nullptr on failure.  The address
+// space is taken from the range of MemoryTag::kMetadata, since the memory is
+// never passed to free().
+AddressRegion* SystemCreateRegion(AddressRegionFactory* factory,
+                                  AddressRegionFactory::UsageHint hint);
+
+// Returns region->Alloc(size, alignment), called under the lock that guards
+// the regions of the default factory.
+std::pair<void*, size_t> SystemRegionAlloc(AddressRegion* region, size_t size,
+                                           size_t alignment);
+
 // Reserves using mmap() a region of memory of the requested size and alignment,
 // with the bits specified by kTagMask set according to tag.
 //
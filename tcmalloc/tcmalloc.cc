@@ -49,6 +49,7 @@
 #include "tcmalloc/tcmalloc.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <sched.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -80,7 +81,10 @@
 #include "absl/strings/string_view.h"
 #include "absl/time/clock.h"
 #include "absl/types/span.h"
+#include "tcmalloc/allocation_accounts.h"
+#include "tcmalloc/allocation_budget.h"
 #include "tcmalloc/allocation_sample.h"
+#include "tcmalloc/allocation_trace.h"
 #include "tcmalloc/allocation_sampling.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/cpu_cache.h"
@@ -89,7 +93,9 @@
 #include "tcmalloc/global_stats.h"
 #include "tcmalloc/guarded_allocations.h"
 #include "tcmalloc/guarded_page_allocator.h"
+#include "tcmalloc/huge_page_aware_allocator.h"
 #include "tcmalloc/internal/allocation_guard.h"
+#include "tcmalloc/internal/background_wakeup.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
@@ -97,18 +103,29 @@
 #include "tcmalloc/internal/page_size.h"
 #include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/internal/sampled_allocation.h"
+#include "tcmalloc/internal/sysinfo.h"
+#include "tcmalloc/internal/zero_fill.h"
 #include "tcmalloc/internal_malloc_extension.h"
+#include "tcmalloc/large_density_predictor.h"
+#include "tcmalloc/locked_cpu_cache.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/malloc_tracing_extension.h"
+#include "tcmalloc/memory_pressure.h"
 #include "tcmalloc/new_extension.h"
 #include "tcmalloc/page_allocator.h"
 #include "tcmalloc/page_heap_allocator.h"
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/pages.h"
 #include "tcmalloc/parameters.h"
+#include "tcmalloc/pending_reservations.h"
+#include "tcmalloc/reclaim_notifier.h"
+#include "tcmalloc/registered_memory.h"
+#include "tcmalloc/release_requests.h"
+#include "tcmalloc/sampled_page_heap.h"
 #include "tcmalloc/sampler.h"
 #include "tcmalloc/segv_handler.h"
 #include "tcmalloc/selsan/selsan.h"
+#include "tcmalloc/slow_path_latency.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/stats.h"
@@ -116,6 +133,7 @@
 #include "tcmalloc/tcmalloc_policy.h"
 #include "tcmalloc/thread_cache.h"
 #include "tcmalloc/transfer_cache.h"
+#include "tcmalloc/user_heap.h"
 
 #if defined(TCMALLOC_HAVE_STRUCT_MALLINFO) || \
     defined(TCMALLOC_HAVE_STRUCT_MALLINFO2)
@@ -201,6 +219,40 @@ static void PrintStats(int level) {
   delete[] buffer;
 }
 
+// Writes the stats at <level> (see DumpStats) to [buffer, buffer+result],
+// followed by the low-level allocator stats.  Returns the size required.
+static size_t GetStatsAtLevel(char* buffer, size_t buffer_length, int level) {
+  Printer printer(buffer, buffer_length);
+  DumpStats(&printer, level);
+
+  printer.printf("\nLow-level allocator stats:\n");
+  printer.printf("Memory Release Failures: %d\n", SystemReleaseErrors());
+
+  size_t n = printer.SpaceRequired();
+
+  size_t bytes_remaining = buffer_length > n ? buffer_length - n : 0;
+  if (bytes_remaining > 0) {
+    n += GetRegionFactory()->GetStats(
+        absl::Span<char>(buffer + n, bytes_remaining));
+  }
+
+  return n;
+}
+
+extern "C" void MallocExtension_Internal_GetSummaryStats(std::string* ret) {
+  // The summary takes a few KiB, unless the region factory's stats are large.
+  for (size_t shift = 14; shift < 22; shift++) {
+    const size_t size = 1 << shift;
+    ret->resize(size - 1);
+
+    size_t written_size = GetStatsAtLevel(&*ret->begin(), size - 1, 0);
+    if (written_size < size - 1) {
+      ret->resize(written_size);
+      break;
+    }
+  }
+}
+
 extern "C" void MallocExtension_Internal_GetStats(std::string* ret) {
   size_t shift = std::max<size_t>(18, absl::bit_width(ret->capacity()) - 1);
   for (; shift < 22; shift++) {
@@ -223,25 +275,7 @@ extern "C" void MallocExtension_Internal_GetStats(std::string* ret) {
 
 extern "C" size_t TCMalloc_Internal_GetStats(char* buffer,
                                              size_t buffer_length) {
-  Printer printer(buffer, buffer_length);
-  if (buffer_length < 10000) {
-    DumpStats(&printer, 1);
-  } else {
-    DumpStats(&printer, 2);
-  }
-
-  printer.printf("\nLow-level allocator stats:\n");
-  printer.printf("Memory Release Failures: %d\n", SystemReleaseErrors());
-
-  size_t n = printer.SpaceRequired();
-
-  size_t bytes_remaining = buffer_length > n ? buffer_length - n : 0;
-  if (bytes_remaining > 0) {
-    n += GetRegionFactory()->GetStats(
-        absl::Span<char>(buffer + n, bytes_remaining));
-  }
-
-  return n;
+  return GetStatsAtLevel(buffer, buffer_length, buffer_length < 10000 ? 1 : 2);
 }
 
 extern "C" const ProfileBase* MallocExtension_Internal_SnapshotCurrent(
@@ -251,13 +285,36 @@ extern "C" const ProfileBase* MallocExtension_Internal_SnapshotCurrent(
       return DumpHeapProfile(tc_globals).release();
     case ProfileType::kFragmentation:
       return DumpFragmentationProfile(tc_globals).release();
+    case ProfileType::kPinnedMemory:
+      return DumpPinnedMemoryProfile(tc_globals).release();
     case ProfileType::kPeakHeap:
       return tc_globals.peak_heap_tracker().DumpSample().release();
+    case ProfileType::kLifetimes:
+      return tc_globals.continuous_lifetimes.Snapshot().release();
+    case ProfileType::kPeakHeapLastMinute:
+      return tc_globals.peak_heap_tracker()
+          .DumpWindowedSample(0, type)
+          .release();
+    case ProfileType::kPeakHeapLastHour:
+      return tc_globals.peak_heap_tracker()
+          .DumpWindowedSample(1, type)
+          .release();
+    case ProfileType::kLeakCandidates:
+      return tc_globals.leak_detector().DumpCandidates().release();
     default:
       return nullptr;
   }
 }
 
+extern "C" void MallocExtension_Internal_SnapshotTopPeakHeaps(
+    std::vector<MallocExtension::PeakHeapProfile>* result) {
+  tc_globals.peak_heap_tracker().DumpTopSamples(
+      [&](absl::Time time, std::unique_ptr<ProfileBase> profile) {
+        result->push_back(
+            {time, ProfileAccessor::MakeProfile(std::move(profile))});
+      });
+}
+
 extern "C" AllocationProfilingTokenBase*
 MallocExtension_Internal_StartAllocationProfiling() {
   return new AllocationSample(&tc_globals.allocation_samples, absl::Now());
@@ -269,6 +326,11 @@ MallocExtension_Internal_StartLifetimeProfiling() {
       &tc_globals.deallocation_samples);
 }
 
+extern "C" tcmalloc_internal::HeapProfileCursorBase*
+MallocExtension_Internal_StartHeapProfileCursor() {
+  return new HeapDeltaSample(&tc_globals.heap_delta_samples);
+}
+
 MallocExtension::Ownership GetOwnership(const void* ptr) {
   const PageId p = PageIdContainingTagged(ptr);
   return tc_globals.pagemap().GetDescriptor(p)
@@ -302,10 +364,102 @@ extern "C" void MallocExtension_Internal_SetMemoryLimit(
       limit, static_cast<PageAllocator::LimitKind>(limit_kind));
 }
 
+// Returns the tag of <heap>, or std::nullopt if there is no such heap.
+static std::optional<MemoryTag> MemoryHeapTag(
+    tcmalloc::MallocExtension::MemoryHeap heap, int numa_partition) {
+  switch (heap) {
+    case tcmalloc::MallocExtension::MemoryHeap::kNormal:
+      if (numa_partition < 0 ||
+          static_cast<size_t>(numa_partition) >=
+              tc_globals.numa_topology().active_partitions()) {
+        return std::nullopt;
+      }
+      return NumaNormalTag(numa_partition);
+    case tcmalloc::MallocExtension::MemoryHeap::kSampled:
+      return MemoryTag::kSampled;
+    case tcmalloc::MallocExtension::MemoryHeap::kCold:
+      return MemoryTag::kCold;
+  }
+  return std::nullopt;
+}
+
+extern "C" size_t MallocExtension_Internal_GetHeapMemoryLimit(
+    tcmalloc::MallocExtension::MemoryHeap heap, int numa_partition,
+    tcmalloc::MallocExtension::LimitKind limit_kind) {
+  tc_globals.InitIfNecessary();
+  const std::optional<MemoryTag> tag = MemoryHeapTag(heap, numa_partition);
+  if (!tag.has_value()) return std::numeric_limits<size_t>::max();
+  return tc_globals.page_allocator().tag_limit(
+      *tag, static_cast<PageAllocator::LimitKind>(limit_kind));
+}
+
+extern "C" bool MallocExtension_Internal_SetHeapMemoryLimit(
+    tcmalloc::MallocExtension::MemoryHeap heap, int numa_partition,
+    size_t limit, tcmalloc::MallocExtension::LimitKind limit_kind) {
+  tc_globals.InitIfNecessary();
+  const std::optional<MemoryTag> tag = MemoryHeapTag(heap, numa_partition);
+  if (!tag.has_value()) return false;
+  return tc_globals.page_allocator().set_tag_limit(
+      *tag, limit, static_cast<PageAllocator::LimitKind>(limit_kind));
+}
+
+extern "C" bool MallocExtension_Internal_RegisterMemoryPressureCallback(
+    tcmalloc::MallocExtension::MemoryPressureCallback callback) {
+  return memory_pressure_notifier().Register(callback);
+}
+
+extern "C" void MallocExtension_Internal_UnregisterMemoryPressureCallback(
+    tcmalloc::MallocExtension::MemoryPressureCallback callback) {
+  memory_pressure_notifier().Unregister(callback);
+}
+
+extern "C" bool MallocExtension_Internal_RegisterReclaimCallback(
+    tcmalloc::MallocExtension::ReclaimCallback callback, void* arg) {
+  return reclaim_notifier().Register(callback, arg);
+}
+
+extern "C" void MallocExtension_Internal_UnregisterReclaimCallback(
+    tcmalloc::MallocExtension::ReclaimCallback callback, void* arg) {
+  reclaim_notifier().Unregister(callback, arg);
+}
+
 extern "C" void MallocExtension_Internal_MarkThreadIdle() {
   ThreadCache::BecomeIdle();
 }
 
+extern "C" uint64_t MallocExtension_Internal_GetAllocationContext() {
+  return allocation_context;
+}
+
+extern "C" void MallocExtension_Internal_SetAllocationContext(
+    uint64_t context) {
+  allocation_context = context;
+}
+
+extern "C" void MallocExtension_Internal_SetAllocationBudget(size_t bytes) {
+  SetAllocationBudget(bytes);
+}
+
+extern "C" size_t MallocExtension_Internal_GetAllocationBudgetUsage() {
+  return AllocationBudgetUsage();
+}
+
+extern "C" void MallocExtension_Internal_SetAllocationBudgetCallback(
+    tcmalloc::MallocExtension::AllocationBudgetCallback callback) {
+  SetAllocationBudgetCallback(callback);
+}
+
+extern "C" void MallocExtension_Internal_SwapAllocationTaskState(
+    tcmalloc::MallocExtension::AllocationTaskState* state) {
+  std::swap(allocation_context, state->allocation_context);
+  SwapAllocationBudget(*state);
+  GetThreadSampler()->SwapTaskState(*state);
+}
+
+extern "C" int MallocExtension_Internal_GetNumNumaPartitions() {
+  return tc_globals.numa_topology().active_partitions();
+}
+
 extern "C" AddressRegionFactory* MallocExtension_Internal_GetRegionFactory() {
   PageHeapSpinLockHolder l;
   return GetRegionFactory();
@@ -334,6 +488,116 @@ extern "C" size_t MallocExtension_Internal_ReleaseMemoryToSystem(
                           /*reason=*/PageReleaseReason::kReleaseMemoryToSystem);
 }
 
+extern "C" bool MallocExtension_Internal_ReleaseMemoryToSystemAsync(
+    size_t num_bytes, MallocExtension::ReleaseCallback callback, void* arg) {
+  tc_globals.InitIfNecessary();
+  return release_requests().AddAsync(num_bytes, callback, arg);
+}
+
+extern "C" size_t MallocExtension_Internal_Reserve(size_t bytes,
+                                                   bool populate) {
+  tc_globals.InitIfNecessary();
+  // Spread the reservation evenly over the NUMA partitions in use.
+  const size_t partitions = tc_globals.numa_topology().active_partitions();
+  const Length per_partition =
+      BytesToLengthCeil((bytes + partitions - 1) / partitions);
+  Length reserved;
+  for (size_t partition = 0; partition < partitions; ++partition) {
+    reserved += tc_globals.page_allocator().Reserve(
+        per_partition, populate, NumaNormalTag(partition));
+  }
+  return reserved.in_bytes();
+}
+
+extern "C" void MallocExtension_Internal_WarmUp(
+    const MallocExtension::WarmUpBucket* buckets, size_t num_buckets,
+    bool per_cpu_caches) {
+  tc_globals.InitIfNecessary();
+  per_cpu_caches = per_cpu_caches && tc_globals.CpuCacheActive();
+  size_t large_bytes = 0;
+  std::vector<void*> objects;
+  for (size_t i = 0; i < num_buckets; ++i) {
+    const auto [size, count] = buckets[i];
+    size_t size_class;
+    if (!tc_globals.sizemap().GetSizeClass(CppPolicy(), size, &size_class)) {
+      size_t bytes;
+      if (ABSL_PREDICT_FALSE(MultiplyOverflow(size, count, &bytes))) {
+        bytes = std::numeric_limits<size_t>::max();
+      }
+      large_bytes += std::min(bytes, ~large_bytes);  // Saturates.
+      continue;
+    }
+
+    // Take all the objects before returning any, so that each comes from a
+    // span populated for it rather than being handed back and forth.
+    TransferCacheManager& transfer_cache = tc_globals.transfer_cache();
+    const size_t batch_length =
+        tc_globals.sizemap().num_objects_to_move(size_class);
+    objects.clear();
+    objects.reserve(count);
+    void* batch[kMaxObjectsToMove];
+    while (objects.size() < count) {
+      const size_t n = std::min(batch_length, count - objects.size());
+      const int got =
+          transfer_cache.RemoveRange(size_class, absl::MakeSpan(batch, n));
+      if (got == 0) break;
+      objects.insert(objects.end(), batch, batch + got);
+    }
+
+    if (transfer_cache.GetStats(size_class).capacity < objects.size()) {
+      transfer_cache.SetCapacity(size_class, objects.size());
+    }
+    if (per_cpu_caches) {
+      for (void* ptr : objects) {
+        tc_globals.cpu_cache().Deallocate(ptr, size_class);
+      }
+      continue;
+    }
+    for (size_t start = 0; start < objects.size(); start += batch_length) {
+      const size_t n = std::min(batch_length, objects.size() - start);
+      transfer_cache.InsertRange(size_class,
+                                 absl::MakeSpan(objects.data() + start, n));
+    }
+  }
+  if (large_bytes > 0) {
+    MallocExtension_Internal_Reserve(large_bytes, /*populate=*/true);
+  }
+}
+
+extern "C" void MallocExtension_Internal_PrepareForAllocation(
+    size_t bytes, hot_cold_t hot_cold) {
+  tc_globals.InitIfNecessary();
+  // Reserve from the heap that the allocation will come from, as in
+  // do_malloc_pages.
+  MemoryTag tag = MemoryTag::kNormal;
+  if (hot_cold < Parameters::min_hot_access_hint()) {
+    tag = MemoryTag::kCold;
+  } else if (tc_globals.numa_topology().numa_aware()) {
+    tag = NumaNormalTag(tc_globals.numa_topology().GetCurrentPartition());
+  }
+  if (pending_reservations().Add(bytes, tag)) {
+    tc_globals.background_wakeup().Notify(
+        BackgroundWakeup::kPrepareForAllocation);
+  }
+}
+
+extern "C" void MallocExtension_Internal_RequestMemoryRelease(
+    size_t bytes, absl::Duration within,
+    MallocExtension::CacheShrinkLevel level) {
+  tc_globals.InitIfNecessary();
+  release_requests().Add(bytes, within, level);
+}
+
+// Returns the pages that an allocation of <size> bytes without a size class
+// spans, before rounding to logical pages.
+inline Length LargeAllocationLength(size_t size) {
+  const Length n = BytesToLengthCeil(size);
+  if (ABSL_PREDICT_FALSE(Parameters::large_size_classes())) {
+    return PageAllocator::RoundUpToLargeSizeClass(n);
+  }
+  return n;
+}
+
 // nallocx slow path.
 // Moved to a separate function because size_class_with_alignment is not inlined
 // which would cause nallocx to become non-leaf function with stack frame and
@@ -349,7 +613,7 @@ static ABSL_ATTRIBUTE_NOINLINE size_t nallocx_slow(size_t size, int flags) {
     TC_ASSERT_NE(size_class, 0);
     return tc_globals.sizemap().class_to_size(size_class);
   } else {
-    return BytesToLengthCeil(size).in_bytes();
+    return LargeAllocationLength(size).in_bytes();
   }
 }
 
@@ -368,7 +632,7 @@ extern "C" size_t nallocx(size_t size, int flags) noexcept {
     TC_ASSERT_NE(size_class, 0);
     return tc_globals.sizemap().class_to_size(size_class);
   } else {
-    return BytesToLengthCeil(size).in_bytes();
+    return LargeAllocationLength(size).in_bytes();
   }
 }
 
@@ -442,6 +706,8 @@ extern "C" void MallocExtension_Internal_GetProperties(
       stats.pageheap.unmapped_bytes + stats.arena.bytes_nonresident;
   (*result)["tcmalloc.sampled_internal_fragmentation"].value =
       tc_globals.sampled_internal_fragmentation_.value();
+  (*result)["tcmalloc.heap_profile_snapshot_peak_bytes"].value =
+      HeapSnapshotPeakBytes();
 
   (*result)["tcmalloc.page_algorithm"].value =
       tc_globals.page_allocator().algorithm();
@@ -449,7 +715,11 @@ extern "C" void MallocExtension_Internal_GetProperties(
   (*result)["tcmalloc.external_fragmentation_bytes"].value =
       ExternalBytes(stats);
   (*result)["tcmalloc.required_bytes"].value = RequiredBytes(stats);
+  (*result)["tcmalloc.local_tier_bytes"].value = LocalTierBytes(stats);
+  (*result)["tcmalloc.far_tier_bytes"].value = FarTierBytes(stats);
   (*result)["tcmalloc.slack_bytes"].value = SlackBytes(stats.pageheap);
+  (*result)["tcmalloc.active_experiments"].value = ActiveExperimentsMask();
+  allocation_accounts().GetProperties(result);
 
   const uint64_t hard_limit =
       tc_globals.page_allocator().limit(PageAllocator::kHard);
@@ -468,6 +738,39 @@ extern "C" void MallocExtension_Internal_GetProperties(
   (*result)["tcmalloc.successful_shrinks_after_hard_limit_hit"].value =
       tc_globals.page_allocator().successful_shrinks_after_limit_hit(
           PageAllocator::kHard);
+  const PageAllocator::LimitShrinkStats limit_shrinks =
+      tc_globals.page_allocator().limit_shrink_stats();
+  (*result)["tcmalloc.foreground_limit_shrinks"].value =
+      limit_shrinks.foreground_shrinks;
+  (*result)["tcmalloc.background_limit_shrinks"].value =
+      limit_shrinks.background_shrinks;
+
+  for (int t = 0; t < kNumSlowPathTiers; ++t) {
+    const SlowPathTier tier = static_cast<SlowPathTier>(t);
+    const std::string prefix =
+        absl::StrCat("tcmalloc.slow_path_latency.", SlowPathTierName(tier));
+    (*result)[absl::StrCat(prefix, ".count")].value =
+        slow_path_latency().TotalCount(tier);
+    (*result)[absl::StrCat(prefix, ".cycles")].value =
+        slow_path_latency().TotalCycles(tier);
+  }
+
+  if (UsePerCpuCache(tc_globals)) {
+    for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+      const SizeClassRates::Rates rates =
+          tc_globals.cpu_cache().GetSizeClassRates(size_class);
+      if (rates.peak_refills_per_second == 0 &&
+          rates.peak_overflows_per_second == 0) {
+        continue;
+      }
+      const std::string prefix =
+          absl::StrCat("tcmalloc.size_class.", size_class);
+      (*result)[absl::StrCat(prefix, ".refills_per_second")].value =
+          rates.refills_per_second;
+      (*result)[absl::StrCat(prefix, ".overflows_per_second")].value =
+          rates.overflows_per_second;
+    }
+  }
 
   (*result)["tcmalloc.num_released_total_bytes"].value =
       stats.num_released_total.in_bytes();
@@ -479,9 +782,22 @@ extern "C" void MallocExtension_Internal_GetProperties(
       stats.num_released_soft_limit_exceeded.in_bytes();
   (*result)["tcmalloc.num_released_hard_limit_exceeded_bytes"].value =
       stats.num_released_hard_limit_exceeded.in_bytes();
+
+  HugePageBackingStats backing;
+  {
+    PageHeapSpinLockHolder l;
+    backing = tc_globals.page_allocator().GetHugepageBackingStats();
+  }
+  (*result)["tcmalloc.hugepage_backing.intact_bytes"].value =
+      backing.intact.in_bytes();
+  (*result)["tcmalloc.hugepage_backing.small_page_backed_bytes"].value =
+      backing.EstimatedSmallPageBackedBytes();
 }
 
 extern "C" size_t MallocExtension_Internal_ReleaseCpuMemory(int cpu) {
+  if (locked_cpu_cache().active()) {
+    return locked_cpu_cache().Reclaim(cpu);
+  }
   if (ABSL_PREDICT_FALSE(!subtle::percpu::IsFast())) return 0;
 
   size_t bytes = 0;
@@ -497,6 +813,10 @@ extern "C" size_t MallocExtension_Internal_ReleaseCpuMemory(int cpu) {
 
 inline size_t GetLargeSize(const void* ptr, const PageId p) {
   const Span* span = tc_globals.pagemap().GetExistingDescriptor(p);
+  if (span->shared_sampled_page() != nullptr) {
+    return SampledPageHeap::sampled_allocation(ptr, span)
+        ->sampled_stack.allocated_size;
+  }
   if (span->sampled()) {
     if (tc_globals.guardedpage_allocator().PointerIsMine(ptr)) {
       return tc_globals.guardedpage_allocator().GetRequestedSize(ptr);
@@ -523,6 +843,8 @@ ABSL_ATTRIBUTE_NOINLINE static void FreeWithHooksOrPerThread(
     void* ptr, size_t size_class) {
   if (ABSL_PREDICT_TRUE(UsePerCpuCache(tc_globals))) {
     tc_globals.cpu_cache().DeallocateSlow(ptr, size_class);
+  } else if (locked_cpu_cache().active()) {
+    locked_cpu_cache().Deallocate(ptr, size_class);
   } else if (ThreadCache* cache = ThreadCache::GetCacheIfPresent();
              ABSL_PREDICT_TRUE(cache)) {
     cache->Deallocate(ptr, size_class);
@@ -600,7 +922,7 @@ namespace {
 template <typename Policy>
 inline sized_ptr_t do_malloc_pages(size_t size, size_t weight, Policy policy) {
   // Page allocator does not deal well with num_pages = 0.
-  Length num_pages = std::max<Length>(BytesToLengthCeil(size), Length(1));
+  Length num_pages = std::max<Length>(LargeAllocationLength(size), Length(1));
 
   MemoryTag tag = MemoryTag::kNormal;
   if (policy.is_cold()) {
@@ -608,9 +930,20 @@ inline sized_ptr_t do_malloc_pages(size_t size, size_t weight, Policy policy) {
   } else if (tc_globals.numa_topology().numa_aware()) {
     tag = NumaNormalTag(policy.numa_partition());
   }
-  Span* span = tc_globals.page_allocator().NewAligned(
-      num_pages, BytesToLengthCeil(policy.align()),
-      {1, AccessDensityPrediction::kSparse}, tag);
+  num_pages = PageAllocator::RoundUpToLogicalPages(num_pages, tag);
+  // Dense hugepages sorted on spans allocated only hold single-page spans.
+  AccessDensityPrediction density = AccessDensityPrediction::kSparse;
+  if (ABSL_PREDICT_FALSE(Parameters::large_allocation_density_prediction()) &&
+      !Parameters::dense_trackers_sorted_on_spans_allocated()) {
+    density = large_density_predictor().Predict(num_pages);
+  }
+  Span* span;
+  {
+    SlowPathLatencyTimer timer(SlowPathTier::kPageHeap, /*size_class=*/0);
+    span = tc_globals.page_allocator().NewAligned(
+        num_pages, BytesToLengthCeil(policy.align()),
+        {1, density, policy.lifetime()}, tag);
+  }
   if (span == nullptr) return {nullptr, 0};
 
   // Set capacity to the exact size for a page allocation.  This needs to be
@@ -619,6 +952,11 @@ inline sized_ptr_t do_malloc_pages(size_t size, size_t weight, Policy policy) {
   sized_ptr_t res{span->start_address(), num_pages.in_bytes()};
   TC_ASSERT(!ColdFeatureActive() || tag == GetMemoryTag(span->start_address()));
 
+  if (ABSL_PREDICT_FALSE(Parameters::allocation_accounting()) &&
+      allocation_context != 0) {
+    allocation_accounts().ChargeLarge(allocation_context, span);
+  }
+
   if (weight != 0) {
     auto ptr = SampleLargeAllocation(tc_globals, policy, size, weight, span);
     TC_CHECK_EQ(res.p, ptr.p);
@@ -627,6 +965,9 @@ inline sized_ptr_t do_malloc_pages(size_t size, size_t weight, Policy policy) {
   return res;
 }
 
+// Frees of at least this many bytes wake the background thread.
+constexpr size_t kLargeFreeWakeupBytes = size_t{64} << 20;
+
 // Handles freeing object that doesn't have size class, i.e. which
 // is either large or sampled. We explicitly prevent inlining it to
 // keep it out of fast-path. This helps avoid expensive
@@ -645,12 +986,29 @@ static void InvokeHooksAndFreePages(void* ptr, std::optional<size_t> size) {
     tc_globals.guardedpage_allocator().Deallocate(ptr);
     PageHeapSpinLockHolder l;
     Span::Delete(span);
+  } else if (span->shared_sampled_page() != nullptr) {
+    sampled_page_heap().Free(ptr, span);
   } else {
     TC_ASSERT_EQ(span->first_page(), p);
     TC_ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) % kPageSize, 0);
-    PageHeapSpinLockHolder l;
-    tc_globals.page_allocator().Delete(span, /*objects_per_span=*/1,
-                                       GetMemoryTag(ptr));
+    const Length num_pages = span->num_pages();
+    const MemoryTag tag = GetMemoryTag(ptr);
+    // Credited even if accounting was disabled since, so accounts stay exact.
+    if (ABSL_PREDICT_FALSE(span->account() != 0)) {
+      allocation_accounts().CreditLarge(span);
+    }
+    if (ABSL_PREDICT_FALSE(span->numa_interleaved())) {
+      tc_globals.page_allocator().Uninterleave(span, tag);
+    }
+    if (!tc_globals.page_allocator().CacheLargeSpan(span, tag)) {
+      PageHeapSpinLockHolder l;
+      tc_globals.page_allocator().Delete(span, /*objects_per_span=*/1, tag);
+    }
+    // Let the background thread release the freed memory at its current
+    // rate, rather than after a long event-driven sleep.
+    if (ABSL_PREDICT_FALSE(num_pages.in_bytes() >= kLargeFreeWakeupBytes)) {
+      tc_globals.background_wakeup().Notify(BackgroundWakeup::kLargeFree);
+    }
   }
 }
 
@@ -659,6 +1017,78 @@ static size_t GetSizeClass(void* ptr) {
   return tc_globals.pagemap().sizeclass(p);
 }
 
+// Deallocations are traced before the object is freed, and allocations after
+// it is allocated, so that the trace never sees an address reused while live.
+inline void TraceAllocation(void* ptr, size_t size) {
+  if (ABSL_PREDICT_TRUE(ptr != nullptr)) {
+    allocation_trace().Record(
+        AllocationTraceRecorder::Event::Kind::kAllocation, ptr, size);
+  }
+}
+
+inline void TraceAllocation(sized_ptr_t ptr, size_t size) {
+  TraceAllocation(ptr.p, size);
+}
+
+inline void TraceDeallocation(void* ptr, size_t size) {
+  if (ABSL_PREDICT_TRUE(ptr != nullptr)) {
+    allocation_trace().Record(
+        AllocationTraceRecorder::Event::Kind::kDeallocation, ptr, size);
+  }
+}
+
+// Returns true if the <size> bytes allocated at <ptr> are known to be zero,
+// as they are the start of a fresh span carved out of released memory.
+static bool TakeKnownZero(void* ptr, size_t size) {
+  if (size <= kMaxSize) {
+    return false;
+  }
+  Span* span = tc_globals.pagemap().GetDescriptor(PageIdContaining(ptr));
+  if (span == nullptr || !span->zeroed() || span->start_address() != ptr) {
+    return false;
+  }
+  // Clear the hint, so that later users of the span do not rely on it.
+  span->set_zeroed(false);
+  return true;
+}
+
+// Copies <size> bytes of the large allocation <old_ptr> to that of <new_ptr>
+// by moving their pages (see Parameters::realloc_mremap).  Returns false if
+// the caller needs to copy them instead.
+static bool MoveLargeAllocation(void* old_ptr, void* new_ptr, size_t size) {
+  if (size < kHugePageSize || !Parameters::realloc_mremap()) {
+    return false;
+  }
+  // Both need to be page allocations of the same heap, as the moved pages keep
+  // the placement of the old allocation.
+  if (GetSizeClass(old_ptr) != 0 || GetSizeClass(new_ptr) != 0) {
+    return false;
+  }
+  const MemoryTag tag = GetMemoryTag(old_ptr);
+  if (GetMemoryTag(new_ptr) != tag ||
+      !(IsNormalTag(tag) || tag == MemoryTag::kCold) ||
+      tc_globals.guardedpage_allocator().PointerIsMine(old_ptr) ||
+      tc_globals.guardedpage_allocator().PointerIsMine(new_ptr)) {
+    return false;
+  }
+  // The moved pages would take the interleaving along, which only the old
+  // allocation is entitled to.
+  if (const Span* span =
+          tc_globals.pagemap().GetDescriptor(PageIdContaining(old_ptr));
+      span != nullptr && span->numa_interleaved()) {
+    return false;
+  }
+
+  // Only whole system pages can be moved: copy any tail.
+  const size_t moved = size & ~(GetPageSize() - 1);
+  if (!SystemMove(old_ptr, new_ptr, moved)) {
+    return false;
+  }
+  memcpy(static_cast<char*>(new_ptr) + moved,
+         static_cast<const char*>(old_ptr) + moved, size - moved);
+  return true;
+}
+
 // Helper for the object deletion (free, delete, etc.).  Inputs:
 //   ptr is object to be freed
 //   size_class is the size class of that object, or 0 if it's unknown
@@ -671,7 +1101,13 @@ static size_t GetSizeClass(void* ptr) {
 // "have_size_class-case" and others are "!have_size_class-case". But we
 // certainly don't have such compiler. See also do_free_with_size below.
 inline ABSL_ATTRIBUTE_ALWAYS_INLINE void do_free(void* ptr) {
-  if (!kSelSanPresent || ABSL_PREDICT_FALSE(!IsNormalMemory(ptr))) {
+  if constexpr (kAllocationTrace) {
+    TraceDeallocation(ptr, 0);
+  }
+  // Testing the tag bits rather than ptr == nullptr costs the same, and lets
+  // objects of the sampled tag skip the pagemap size class lookup, which would
+  // only miss.  nullptr is not normal memory either.
+  if (ABSL_PREDICT_FALSE(!IsNormalMemory(ptr))) {
     if (ABSL_PREDICT_FALSE(ptr == nullptr)) {
       return;
     }
@@ -683,6 +1119,10 @@ inline ABSL_ATTRIBUTE_ALWAYS_INLINE void do_free(void* ptr) {
       FreeSmall(ptr, size_class);
       return;
     }
+    if (GetMemoryTag(ptr) == MemoryTag::kSampled) {
+      SLOW_PATH_BARRIER();
+      return InvokeHooksAndFreePages(ptr, std::nullopt);
+    }
   }
   TC_ASSERT_NE(ptr, nullptr);
 
@@ -731,6 +1171,9 @@ template <typename AlignPolicy>
 inline ABSL_ATTRIBUTE_ALWAYS_INLINE void do_free_with_size(void* ptr,
                                                            size_t size,
                                                            AlignPolicy align) {
+  if constexpr (kAllocationTrace) {
+    TraceDeallocation(ptr, size);
+  }
   TC_ASSERT(
       CorrectAlignment(ptr, static_cast<std::align_val_t>(align.align())));
 
@@ -749,6 +1192,11 @@ inline ABSL_ATTRIBUTE_ALWAYS_INLINE void do_free_with_size(void* ptr,
       TC_ASSERT(CorrectSize(ptr, size, align));
       size_t size_class = tc_globals.sizemap().SizeClass(
           CppPolicy().AlignAs(align.align()).InSameNumaPartitionAs(ptr), size);
+      if (ABSL_PREDICT_FALSE(
+              tc_globals.sizemap().IsDynamicSizeClass(size_class))) {
+        size_class =
+            tc_globals.pagemap().sizeclass(PageIdContainingTagged(ptr));
+      }
       size = tc_globals.sizemap().class_to_size(size_class);
       ptr = selsan::UpdateTag(ptr, size);
       FreeSmall(ptr, size_class);
@@ -777,6 +1225,11 @@ inline ABSL_ATTRIBUTE_ALWAYS_INLINE void do_free_with_size(void* ptr,
     SLOW_PATH_BARRIER();
     return InvokeHooksAndFreePages(ptr, size);
   }
+  // The object may have been allocated before the dynamic size class was
+  // added, from the size class it was carved out of.
+  if (ABSL_PREDICT_FALSE(tc_globals.sizemap().IsDynamicSizeClass(size_class))) {
+    size_class = tc_globals.pagemap().sizeclass(PageIdContaining(ptr));
+  }
 
   FreeSmall(ptr, size_class);
 }
@@ -796,10 +1249,26 @@ bool CorrectSize(void* ptr, size_t size, AlignPolicy align) {
                  CppPolicy().AlignAs(align.align()), size, &size_class)) {
     size = tc_globals.sizemap().class_to_size(size_class);
   } else {
-    size = BytesToLengthCeil(size).in_bytes();
+    const Length n = BytesToLengthCeil(size);
+    size = LargeAllocationLength(size).in_bytes();
+    // Large size classes may have been turned on or off since the object was
+    // allocated, so it may span either length.
+    if (GetSize(ptr) ==
+        (size == n.in_bytes() ? PageAllocator::RoundUpToLargeSizeClass(n)
+                              : n).in_bytes()) {
+      return true;
+    }
   }
   size_t actual = GetSize(ptr);
   if (ABSL_PREDICT_TRUE(actual == size)) return true;
+  // Objects allocated before a dynamic size class was added have the size of
+  // the class it was carved out of.
+  while (actual > size &&
+         tc_globals.sizemap().IsDynamicSizeClass(size_class)) {
+    size_class = tc_globals.sizemap().dynamic_enclosing_class(size_class);
+    size = tc_globals.sizemap().class_to_size(size_class);
+    if (actual == size) return true;
+  }
   // We might have had a cold size class, so actual > size.  If we did not use
   // size returning new, the caller may not know this occurred.
   //
@@ -923,8 +1392,16 @@ alloc_small_sampled_hooks_or_perthread(size_t size, size_t size_class,
       (res = tc_globals.cpu_cache().AllocateFast(size_class)) == nullptr) {
     if (UsePerCpuCache(tc_globals)) {
       res = tc_globals.cpu_cache().AllocateSlow(size_class);
+    } else if (locked_cpu_cache().active()) {
+      res = locked_cpu_cache().Allocate(size_class);
     } else {
       res = ThreadCache::GetCache()->Allocate(size_class);
+      // The per-CPU caches may have been deferred until now (see
+      // want_lazy_per_cpu_caches).  Activate them outside of the thread
+      // cache, which activation retires.
+      if (ThreadCache::TakePerCpuCacheActivation()) {
+        TCMalloc_Internal_ForceCpuCacheActivation();
+      }
     }
     if (ABSL_PREDICT_FALSE(res == nullptr)) return policy.handle_oom(size);
   }
@@ -977,8 +1454,8 @@ ABSL_ATTRIBUTE_NOINLINE static typename Policy::pointer_type slow_alloc_large(
 }
 
 template <typename Policy, typename Pointer = typename Policy::pointer_type>
-static inline Pointer ABSL_ATTRIBUTE_ALWAYS_INLINE fast_alloc(size_t size,
-                                                              Policy policy) {
+static inline Pointer ABSL_ATTRIBUTE_ALWAYS_INLINE
+untraced_fast_alloc(size_t size, Policy policy) {
   // If size is larger than kMaxSize, it's not fast-path anymore. In
   // such case, GetSizeClass will return false, and we'll delegate to the slow
   // path. If malloc is not yet initialized, we may end up with size_class == 0
@@ -1017,6 +1494,261 @@ static inline Pointer ABSL_ATTRIBUTE_ALWAYS_INLINE fast_alloc(size_t size,
   return Policy::to_pointer(ret, size_class);
 }
 
+template <typename Policy, typename Pointer = typename Policy::pointer_type>
+static inline Pointer ABSL_ATTRIBUTE_ALWAYS_INLINE fast_alloc(size_t size,
+                                                              Policy policy) {
+  if constexpr (kAllocationTrace && Policy::invoke_hooks()) {
+    Pointer ptr = untraced_fast_alloc(size, policy);
+    TraceAllocation(ptr, size);
+    return ptr;
+  } else {
+    return untraced_fast_alloc(size, policy);
+  }
+}
+
+// The most headroom realloc gives an allocation it grows (see
+// Parameters::realloc_growth_headroom).
+constexpr size_t kMaxReallocHeadroom = size_t{1} << 30;
+
+// Returns the span of the large allocation <ptr>, or nullptr if it is not one.
+static Span* LargeAllocationSpan(void* ptr) {
+  if (GetSizeClass(ptr) != 0 ||
+      tc_globals.guardedpage_allocator().PointerIsMine(ptr)) {
+    return nullptr;
+  }
+  Span* span = tc_globals.pagemap().GetDescriptor(PageIdContainingTagged(ptr));
+  if (span == nullptr || span->start_address() != ptr) {
+    return nullptr;
+  }
+  return span;
+}
+
+// Allocates at least <new_size> bytes to grow the large allocation <old_ptr>
+// into, if realloc grew <old_ptr> out of another allocation too.  Such an
+// allocation is likely a buffer grown geometrically, like a std::vector, so it
+// gets headroom of as much again, up to kMaxReallocHeadroom, which its next
+// growth fits into in place.  Returns nullptr if <old_ptr> gets no headroom or
+// the allocation failed.
+static void* AllocateWithReallocHeadroom(void* old_ptr, size_t new_size) {
+  const Span* old_span = LargeAllocationSpan(old_ptr);
+  if (old_span == nullptr || !old_span->realloc_grown()) {
+    return nullptr;
+  }
+  const size_t headroom = std::min(
+      {new_size, kMaxReallocHeadroom,
+       std::numeric_limits<size_t>::max() - new_size});  // Avoid overflow.
+  // As for the lower bound to grow in do_realloc, the hooks are not invoked
+  // with the size including the headroom.
+  auto res = fast_alloc(new_size + headroom,
+                        MallocPolicy().Nothrow().WithoutHooks().SizeReturning());
+  if (res.p != nullptr) {
+    if constexpr (kAllocationTrace) {
+      TraceAllocation(res.p, new_size);
+    }
+  }
+  return res.p;
+}
+
+// Records that realloc grew the allocation at <ptr> out of another, so that
+// the next growth gives it headroom.
+static void MarkReallocGrown(void* ptr) {
+  if (Span* span = LargeAllocationSpan(ptr); span != nullptr) {
+    span->set_realloc_grown(true);
+  }
+}
+
+// Allocates <size> bytes for MallocExtension::AllocateInterleaved.  They are
+// rounded up to whole hugepages, so that the pages whose NUMA policy changes
+// belong to the allocation alone.
+static void* alloc_interleaved(size_t size) {
+  if (ABSL_PREDICT_FALSE(size > std::numeric_limits<size_t>::max() -
+                                    (kHugePageSize - 1))) {
+    return MallocPolicy().handle_oom(size);
+  }
+  const size_t rounded =
+      std::max(size + kHugePageSize - 1, kHugePageSize) & ~(kHugePageSize - 1);
+  void* ptr = fast_alloc(rounded, MallocPolicy().AlignAs(kHugePageSize));
+  if (ptr == nullptr) {
+    return nullptr;
+  }
+  if (Span* span = LargeAllocationSpan(ptr); span != nullptr) {
+    tc_globals.page_allocator().Interleave(span);
+  }
+  return ptr;
+}
+
+// Batch allocation for MallocExtension::AllocateBatch.  When none of the
+// objects need per-object work (sampling, hooks, per-thread caches), the whole
+// batch is served by the per-cpu cache at once.  Otherwise we fall back to
+// allocating the objects one at a time.
+template <typename Policy>
+static size_t alloc_batch(size_t size, absl::Span<void*> batch, Policy policy) {
+  const size_t n = batch.size();
+  if (ABSL_PREDICT_FALSE(n == 0)) {
+    return 0;
+  }
+
+  // The sampler charges size + 1 bytes per object, see
+  // Sampler::TryRecordAllocationFast.
+  size_t size_class;
+  size_t bytes;
+  if (ABSL_PREDICT_TRUE(tc_globals.IsInited()) &&
+      tc_globals.sizemap().GetSizeClass(policy, size, &size_class) &&
+      !MultiplyOverflow(size + 1, n, &bytes) && !Static::HaveHooks() &&
+      UsePerCpuCache(tc_globals) &&
+      !GetThreadSampler()->WillRecordAllocation(bytes - 1)) {
+    const bool recorded = GetThreadSampler()->TryRecordAllocationFast(bytes - 1);
+    TC_ASSERT(recorded);
+    (void)recorded;
+    return tc_globals.cpu_cache().AllocateBatch(size_class, batch);
+  }
+
+  size_t got = 0;
+  for (; got < n; ++got) {
+    void* ptr = fast_alloc(size, policy);
+    if (ABSL_PREDICT_FALSE(ptr == nullptr)) break;
+    batch[got] = ptr;
+  }
+  return got;
+}
+
+// Batch deallocation for MallocExtension::DeallocateBatch.  Consecutive runs of
+// objects from the same size class are handed to the per-cpu cache at once;
+// everything else (nullptr, sampled, cold, large objects) goes through
+// do_free.
+static void free_batch(absl::Span<void*> batch) {
+  if (ABSL_PREDICT_FALSE(Static::HaveHooks()) ||
+      ABSL_PREDICT_FALSE(!UsePerCpuCache(tc_globals))) {
+    for (void* ptr : batch) {
+      do_free(ptr);
+    }
+    return;
+  }
+
+  auto size_class_of = [](void* ptr) -> size_t {
+    if (ptr == nullptr || !IsNormalMemory(ptr)) return 0;
+    return tc_globals.pagemap().sizeclass(PageIdContaining(ptr));
+  };
+
+  const size_t n = batch.size();
+  size_t i = 0;
+  size_t size_class = n > 0 ? size_class_of(batch[0]) : 0;
+  while (i < n) {
+    if (size_class == 0) {
+      do_free(batch[i]);
+      ++i;
+      if (i < n) size_class = size_class_of(batch[i]);
+      continue;
+    }
+
+    size_t j = i + 1;
+    size_t next_size_class = 0;
+    for (; j < n; ++j) {
+      next_size_class = size_class_of(batch[j]);
+      if (next_size_class != size_class) break;
+    }
+    tc_globals.cpu_cache().DeallocateBatch(size_class,
+                                           batch.subspan(i, j - i));
+    i = j;
+    size_class = next_size_class;
+  }
+}
+
+// Sized batch deallocation for MallocExtension::DeallocateSizedBatch.  Every
+// object in `batch` was allocated with `size`, so the size class is computed
+// from the size rather than looked up in the pagemap for each object.  Only
+// the NUMA partition can differ between objects, so runs of objects from the
+// same partition are handed to the per-cpu cache (and from there to the
+// transfer cache) at once.  Non-normal objects still take do_free_with_size.
+static void free_sized_batch(void** batch, size_t n, size_t size) {
+  if (ABSL_PREDICT_FALSE(Static::HaveHooks()) ||
+      ABSL_PREDICT_FALSE(!UsePerCpuCache(tc_globals))) {
+    for (size_t i = 0; i < n; ++i) {
+      do_free_with_size(batch[i], size, MallocAlignPolicy());
+    }
+    return;
+  }
+
+  // Returns 0 for objects that need the per-object slow path.
+  auto size_class_of = [size](void* ptr) -> size_t {
+    if (ABSL_PREDICT_FALSE(!IsNormalMemory(ptr))) return 0;
+    TC_ASSERT(CorrectSize(ptr, size, MallocAlignPolicy()));
+    size_t size_class;
+    if (ABSL_PREDICT_FALSE(!tc_globals.sizemap().GetSizeClass(
+            CppPolicy().InSameNumaPartitionAs(ptr), size, &size_class))) {
+      return 0;
+    }
+    return size_class;
+  };
+
+  size_t i = 0;
+  size_t size_class = n > 0 ? size_class_of(batch[0]) : 0;
+  while (i < n) {
+    if (size_class == 0) {
+      do_free_with_size(batch[i], size, MallocAlignPolicy());
+      ++i;
+      if (i < n) size_class = size_class_of(batch[i]);
+      continue;
+    }
+
+    size_t j = i + 1;
+    size_t next_size_class = 0;
+    for (; j < n; ++j) {
+      next_size_class = size_class_of(batch[j]);
+      if (next_size_class != size_class) break;
+    }
+    tc_globals.cpu_cache().DeallocateBatch(size_class,
+                                           absl::MakeSpan(batch + i, j - i));
+    i = j;
+    size_class = next_size_class;
+  }
+}
+
+// Allocation for MallocExtension::AllocateWithHandle.  Handles hold the size
+// class of NUMA partition 0 (or a cold size class), so only the partition of
+// the current CPU is added to it.  Otherwise this is the small object path of
+// fast_alloc.
+static void* alloc_with_handle(size_t size, std::align_val_t alignment,
+                               hot_cold_t hot_cold, size_t size_class) {
+  const auto policy = CppPolicy().AlignAs(alignment).AccessAs(hot_cold);
+  if (ABSL_PREDICT_FALSE(size_class == 0)) {
+    return fast_alloc(size, policy);
+  }
+  if (size_class < kNumBaseClasses) {
+    size_class += policy.scaled_numa_partition();
+  }
+
+  void* ret = nullptr;
+  if (ABSL_PREDICT_TRUE(GetThreadSampler()->TryRecordAllocationFast(size))) {
+    ret = tc_globals.cpu_cache().AllocateFast(size_class);
+  }
+  if (ABSL_PREDICT_FALSE(ret == nullptr)) {
+    SLOW_PATH_BARRIER();
+    ret = slow_alloc_small(size, size_class, policy);
+  }
+  if constexpr (kAllocationTrace) {
+    TraceAllocation(ret, size);
+  }
+  return ret;
+}
+
+// Deallocation for MallocExtension::DeallocateWithHandle.  Objects that are
+// not normal memory (nullptr, sampled, cold) take do_free_with_size.
+static void free_with_handle(void* ptr, size_t size, std::align_val_t alignment,
+                             size_t size_class) {
+  if (ABSL_PREDICT_FALSE(size_class == 0) ||
+      ABSL_PREDICT_FALSE(!IsNormalMemory(ptr))) {
+    return do_free_with_size(ptr, size, AlignAsPolicy(alignment));
+  }
+  if constexpr (kAllocationTrace) {
+    TraceDeallocation(ptr, size);
+  }
+  TC_ASSERT(CorrectSize(ptr, size, AlignAsPolicy(alignment)));
+  TC_ASSERT_LT(size_class, kNumBaseClasses);
+  size_class += NumaPartitionFromPointer(ptr) * kNumBaseClasses;
+  FreeSmall(ptr, size_class);
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
@@ -1030,6 +1762,99 @@ extern "C" size_t MallocExtension_Internal_GetAllocatedSize(const void* ptr) {
   return GetSize(ptr);
 }
 
+extern "C" size_t MallocExtension_Internal_TryResizeInPlace(void* ptr,
+                                                           size_t size) {
+  TC_ASSERT_NE(ptr, nullptr);
+  TC_ASSERT(GetOwnership(ptr) !=
+            tcmalloc::MallocExtension::Ownership::kNotOwned);
+  // Neither size classes nor page heaps can change an allocation's capacity
+  // in place, so the resize succeeds exactly when it fits that capacity.
+  static_cast<void>(size);
+  return GetSize(ptr);
+}
+
+extern "C" size_t MallocExtension_Internal_AllocateBatch(size_t size,
+                                                        void** batch,
+                                                        size_t n) {
+  return tcmalloc::tcmalloc_internal::alloc_batch(
+      size, absl::MakeSpan(batch, n), MallocPolicy());
+}
+
+extern "C" void MallocExtension_Internal_DeallocateBatch(void** batch,
+                                                         size_t n) {
+  tcmalloc::tcmalloc_internal::free_batch(absl::MakeSpan(batch, n));
+}
+
+extern "C" void MallocExtension_Internal_DeallocateSizedBatch(void** batch,
+                                                              size_t n,
+                                                              size_t size) {
+  tcmalloc::tcmalloc_internal::free_sized_batch(batch, n, size);
+}
+
+extern "C" uint32_t MallocExtension_Internal_GetSizeClassHandle(
+    size_t size, std::align_val_t alignment, tcmalloc::hot_cold_t hot_cold) {
+  TC_ASSERT(absl::has_single_bit(static_cast<size_t>(alignment)));
+  tc_globals.InitIfNecessary();
+  size_t size_class;
+  if (!tc_globals.sizemap().GetSizeClass(
+          CppPolicy().AlignAs(alignment).AccessAs(hot_cold).InNumaPartition(0),
+          size, &size_class)) {
+    return 0;
+  }
+  return size_class;
+}
+
+extern "C" void* MallocExtension_Internal_AllocateWithHandle(
+    size_t size, std::align_val_t alignment, tcmalloc::hot_cold_t hot_cold,
+    uint32_t size_class) {
+  return tcmalloc::tcmalloc_internal::alloc_with_handle(size, alignment,
+                                                        hot_cold, size_class);
+}
+
+extern "C" void MallocExtension_Internal_DeallocateWithHandle(
+    void* p, size_t size, std::align_val_t alignment, uint32_t size_class) {
+  tcmalloc::tcmalloc_internal::free_with_handle(p, size, alignment,
+                                                size_class);
+}
+
+extern "C" void* MallocExtension_Internal_AllocateInterleaved(size_t size) {
+  return tcmalloc::tcmalloc_internal::alloc_interleaved(size);
+}
+
+extern "C" bool MallocExtension_Internal_SetRegisteredMemoryFactory(
+    tcmalloc::AddressRegionFactory* factory,
+    tcmalloc::MallocExtension::RegisterMemoryCallback callback) {
+  return tcmalloc::tcmalloc_internal::registered_heap().Init(factory,
+                                                             callback);
+}
+
+extern "C" void* MallocExtension_Internal_AllocateRegistered(size_t size) {
+  return tcmalloc::tcmalloc_internal::registered_heap().Allocate(size);
+}
+
+extern "C" void MallocExtension_Internal_DeallocateRegistered(void* ptr,
+                                                              size_t size) {
+  tcmalloc::tcmalloc_internal::registered_heap().Deallocate(ptr, size);
+}
+
+extern "C" tcmalloc::tcmalloc_internal::UserHeap*
+MallocExtension_Internal_CreateHeap() {
+  return tcmalloc::tcmalloc_internal::UserHeap::Create();
+}
+
+extern "C" void* MallocExtension_Internal_HeapAllocate(
+    tcmalloc::tcmalloc_internal::UserHeap* heap, size_t size,
+    std::align_val_t alignment) {
+  TC_ASSERT_NE(heap, nullptr);
+  return heap->Allocate(size, static_cast<size_t>(alignment));
+}
+
+extern "C" void MallocExtension_Internal_DestroyHeap(
+    tcmalloc::tcmalloc_internal::UserHeap* heap) {
+  if (heap == nullptr) return;
+  tcmalloc::tcmalloc_internal::UserHeap::Destroy(heap);
+}
+
 extern "C" void MallocExtension_Internal_MarkThreadBusy() {
   tc_globals.InitIfNecessary();
 
@@ -1052,7 +1877,7 @@ MallocTracingExtension_Internal_GetAllocatedAddressRanges() {
     {
       AllocationGuardSpinLockHolder l(
           &tcmalloc::tcmalloc_internal::pageheap_lock);
-      estimated_span_count = tc_globals.span_allocator().stats().total;
+      estimated_span_count = tc_globals.span_stats().total;
     }
     // We need to avoid allocation events during GetAllocatedSpans, as that may
     // cause a deadlock on pageheap_lock. To this end, we ensure that the result
@@ -1071,18 +1896,42 @@ MallocTracingExtension_Internal_GetAllocatedAddressRanges() {
       "output vector.");
 }
 
+absl::StatusOr<tcmalloc::malloc_tracing_extension::AllocationTrace>
+MallocTracingExtension_Internal_DrainAllocationTrace() {
+  using tcmalloc::tcmalloc_internal::allocation_trace;
+  if constexpr (!tcmalloc::tcmalloc_internal::kAllocationTrace) {
+    return absl::FailedPreconditionError(
+        "TCMalloc was built without TCMALLOC_INTERNAL_ALLOCATION_TRACE.");
+  }
+  tc_globals.InitIfNecessary();
+  tcmalloc::malloc_tracing_extension::AllocationTrace trace;
+  trace.dropped = 0;
+  // Size the result before draining, so that growing it does not record
+  // events into the rings while they are drained.
+  trace.events.resize(allocation_trace().capacity());
+  trace.events.resize(allocation_trace().Drain(absl::MakeSpan(trace.events),
+                                               &trace.dropped));
+  return trace;
+}
+
 //-------------------------------------------------------------------
 // Exported routines
 //-------------------------------------------------------------------
 
 using tcmalloc::tcmalloc_internal::AlignAsPolicy;
+using tcmalloc::tcmalloc_internal::AllocateWithReallocHeadroom;
 using tcmalloc::tcmalloc_internal::CorrectAlignment;
 using tcmalloc::tcmalloc_internal::DefaultAlignPolicy;
 using tcmalloc::tcmalloc_internal::do_free;
 using tcmalloc::tcmalloc_internal::do_free_with_size;
 using tcmalloc::tcmalloc_internal::GetPageSize;
 using tcmalloc::tcmalloc_internal::MallocAlignPolicy;
+using tcmalloc::tcmalloc_internal::MarkReallocGrown;
+using tcmalloc::tcmalloc_internal::MoveLargeAllocation;
 using tcmalloc::tcmalloc_internal::MultiplyOverflow;
+using tcmalloc::tcmalloc_internal::SizeMap;
+using tcmalloc::tcmalloc_internal::TakeKnownZero;
+using tcmalloc::tcmalloc_internal::ZeroFill;
 
 // depends on TCMALLOC_HAVE_STRUCT_MALLINFO, so needs to come after that.
 #ifndef TCMALLOC_INTERNAL_METHODS_ONLY
@@ -1141,6 +1990,23 @@ __sized_ptr_t __size_returning_new_aligned_hot_cold(size_t size,
   return fast_alloc(
       size, CppPolicy().AlignAs(alignment).AccessAs(hot_cold).SizeReturning());
 }
+
+extern "C" ABSL_CACHELINE_ALIGNED ABSL_ATTRIBUTE_SECTION(google_malloc)
+__sized_ptr_t __size_returning_new_lifetime(size_t size,
+                                            __lifetime_t lifetime) {
+  return fast_alloc(size, CppPolicy().LifetimeAs(lifetime).SizeReturning());
+}
+
+extern "C" ABSL_CACHELINE_ALIGNED ABSL_ATTRIBUTE_SECTION(google_malloc)
+__sized_ptr_t __size_returning_new_aligned_lifetime(size_t size,
+                                                    std::align_val_t alignment,
+                                                    __lifetime_t lifetime) {
+  TC_ASSERT(absl::has_single_bit(static_cast<size_t>(alignment)));
+  return fast_alloc(size, CppPolicy()
+                              .AlignAs(alignment)
+                              .LifetimeAs(lifetime)
+                              .SizeReturning());
+}
 #endif  // !TCMALLOC_INTERNAL_METHODS_ONLY
 
 extern "C" ABSL_CACHELINE_ALIGNED void* TCMallocInternalMemalign(
@@ -1168,8 +2034,10 @@ extern "C" ABSL_CACHELINE_ALIGNED void* TCMallocInternalCalloc(
     return MallocPolicy::handle_oom(std::numeric_limits<size_t>::max());
   }
   void* result = fast_alloc(size, MallocPolicy());
-  if (ABSL_PREDICT_TRUE(result != nullptr)) {
-    memset(result, 0, size);
+  // Memory freshly obtained from the system does not need zeroing again, which
+  // would fault in every page.
+  if (ABSL_PREDICT_TRUE(result != nullptr) && !TakeKnownZero(result, size)) {
+    ZeroFill(result, size);
   }
   return result;
 }
@@ -1213,11 +2081,20 @@ static inline ABSL_ATTRIBUTE_ALWAYS_INLINE void* do_realloc(void* old_ptr,
       tc_globals.guardedpage_allocator().PointerIsMine(old_ptr)) {
     // Need to reallocate.
     void* new_ptr = nullptr;
+    // Growing large allocations are tracked to predict geometric growth.
+    const bool track_growth =
+        new_size > old_size &&
+        new_size > tcmalloc::tcmalloc_internal::kMaxSize &&
+        tcmalloc::tcmalloc_internal::Parameters::realloc_growth_headroom();
+    if (track_growth) {
+      new_ptr = AllocateWithReallocHeadroom(old_ptr, new_size);
+    }
 
     // Note: we shouldn't use larger size if the allocation will be sampled
     // b/c we will record wrong size and guarded page allocator won't be able
     // to properly enforce size limit.
-    if (new_size > old_size && new_size < lower_bound_to_grow && !will_sample) {
+    if (new_ptr == nullptr && new_size > old_size &&
+        new_size < lower_bound_to_grow && !will_sample) {
       // Avoid fast_alloc() reporting a hook with the lower bound size
       // as the expectation for pointer returning allocation functions
       // is that malloc hooks are invoked with the requested_size.
@@ -1225,6 +2102,9 @@ static inline ABSL_ATTRIBUTE_ALWAYS_INLINE void* do_realloc(void* old_ptr,
           fast_alloc(lower_bound_to_grow,
                      MallocPolicy().Nothrow().WithoutHooks().SizeReturning());
       if (res.p != nullptr) {
+        if constexpr (tcmalloc::tcmalloc_internal::kAllocationTrace) {
+          tcmalloc::tcmalloc_internal::TraceAllocation(res.p, new_size);
+        }
       }
       new_ptr = res.p;
     }
@@ -1235,7 +2115,15 @@ static inline ABSL_ATTRIBUTE_ALWAYS_INLINE void* do_realloc(void* old_ptr,
     if (new_ptr == nullptr) {
       return nullptr;
     }
-    memcpy(new_ptr, old_ptr, ((old_size < new_size) ? old_size : new_size));
+    if (track_growth) {
+      MarkReallocGrown(new_ptr);
+    }
+    const size_t copy_size = std::min(old_size, new_size);
+    // Growing large allocations can move their pages rather than copy them.
+    if (new_size <= old_size ||
+        !MoveLargeAllocation(old_ptr, new_ptr, copy_size)) {
+      memcpy(new_ptr, old_ptr, copy_size);
+    }
     // We could use a variant of do_free() that leverages the fact
     // that we already know the sizeclass of old_ptr.  The benefit
     // would be small, so don't bother.
@@ -1505,6 +2393,50 @@ namespace tcmalloc {
 namespace tcmalloc_internal {
 namespace {
 
+// fork() copies the address space with the locks that other threads held, and
+// those threads do not exist in the child.  ForkPrepare takes the locks of the
+// allocation paths in the order they nest in, so that the calling thread holds
+// all of them across fork(), and ForkParent and ForkChild release them again.
+// Locks of less frequent operations, such as profiling, are not taken.
+void ForkPrepare() ABSL_NO_THREAD_SAFETY_ANALYSIS {
+  tc_globals.cpu_cache().AcquireInternalLocks();
+  tc_globals.sharded_transfer_cache().AcquireInternalLocks();
+  tc_globals.transfer_cache().AcquireInternalLocks();
+  pageheap_lock.Lock();
+}
+
+void ForkParent() ABSL_NO_THREAD_SAFETY_ANALYSIS {
+  pageheap_lock.Unlock();
+  tc_globals.transfer_cache().ReleaseInternalLocks();
+  tc_globals.sharded_transfer_cache().ReleaseInternalLocks();
+  tc_globals.cpu_cache().ReleaseInternalLocks();
+}
+
+void ForkChild() {
+  ForkParent();
+  GetThreadSampler()->Reseed();
+  if (!Parameters::release_memory_after_fork()) return;
+
+  // The objects cached for the parent's threads are mostly not needed by the
+  // child, and releasing their memory both shrinks the child and keeps it
+  // from copying the pages on write.
+  if (tc_globals.CpuCacheActive()) {
+    const int num_cpus = NumCPUs();
+    for (int cpu = 0; cpu < num_cpus; ++cpu) {
+      MallocExtension_Internal_ReleaseCpuMemory(cpu);
+    }
+  }
+  tc_globals.sharded_transfer_cache().Plunder();
+#ifndef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
+  // The first pass plunders the objects that went unused in the parent, and
+  // the second the rest.
+  tc_globals.transfer_cache().TryPlunder();
+  tc_globals.transfer_cache().TryPlunder();
+#endif
+  MallocExtension_Internal_ReleaseMemoryToSystem(
+      std::numeric_limits<size_t>::max());
+}
+
 // The constructor allocates an object to ensure that initialization
 // runs before main(), and therefore we do not have a chance to become
 // multi-threaded before initialization.  We also create the TSD key
@@ -1518,6 +2450,7 @@ class TCMallocGuard {
     TCMallocInternalFree(TCMallocInternalMalloc(1));
     ThreadCache::InitTSD();
     TCMallocInternalFree(TCMallocInternalMalloc(1));
+    pthread_atfork(ForkPrepare, ForkParent, ForkChild);
   }
 };
 
@@ -1578,4 +2511,60 @@ ABSL_CACHELINE_ALIGNED void* operator new[](size_t size, std::align_val_t align,
   return fast_alloc(size,
                     CppPolicy().Nothrow().AlignAs(align).AccessAs(hot_cold));
 }
+
+ABSL_CACHELINE_ALIGNED void* operator new(
+    size_t size, tcmalloc::isolate_t) noexcept(false) {
+  return fast_alloc(size, CppPolicy().AlignAs(SizeMap::IsolatedAlignment(1)));
+}
+
+ABSL_CACHELINE_ALIGNED void* operator new(size_t size, const std::nothrow_t&,
+                                          tcmalloc::isolate_t) noexcept {
+  return fast_alloc(
+      size, CppPolicy().Nothrow().AlignAs(SizeMap::IsolatedAlignment(1)));
+}
+
+ABSL_CACHELINE_ALIGNED void* operator new(
+    size_t size, std::align_val_t align,
+    tcmalloc::isolate_t) noexcept(false) {
+  TC_ASSERT(absl::has_single_bit(static_cast<size_t>(align)));
+  return fast_alloc(size, CppPolicy().AlignAs(SizeMap::IsolatedAlignment(
+                              static_cast<size_t>(align))));
+}
+
+ABSL_CACHELINE_ALIGNED void* operator new(size_t size, std::align_val_t align,
+                                          const std::nothrow_t&,
+                                          tcmalloc::isolate_t) noexcept {
+  TC_ASSERT(absl::has_single_bit(static_cast<size_t>(align)));
+  return fast_alloc(size, CppPolicy().Nothrow().AlignAs(
+                              SizeMap::IsolatedAlignment(
+                                  static_cast<size_t>(align))));
+}
+
+ABSL_CACHELINE_ALIGNED void* operator new[](
+    size_t size, tcmalloc::isolate_t) noexcept(false) {
+  return fast_alloc(size, CppPolicy().AlignAs(SizeMap::IsolatedAlignment(1)));
+}
+
+ABSL_CACHELINE_ALIGNED void* operator new[](size_t size, const std::nothrow_t&,
+                                            tcmalloc::isolate_t) noexcept {
+  return fast_alloc(
+      size, CppPolicy().Nothrow().AlignAs(SizeMap::IsolatedAlignment(1)));
+}
+
+ABSL_CACHELINE_ALIGNED void* operator new[](
+    size_t size, std::align_val_t align,
+    tcmalloc::isolate_t) noexcept(false) {
+  TC_ASSERT(absl::has_single_bit(static_cast<size_t>(align)));
+  return fast_alloc(size, CppPolicy().AlignAs(SizeMap::IsolatedAlignment(
+                              static_cast<size_t>(align))));
+}
+
+ABSL_CACHELINE_ALIGNED void* operator new[](size_t size, std::align_val_t align,
+                                            const std::nothrow_t&,
+                                            tcmalloc::isolate_t) noexcept {
+  TC_ASSERT(absl::has_single_bit(static_cast<size_t>(align)));
+  return fast_alloc(size, CppPolicy().Nothrow().AlignAs(
+                              SizeMap::IsolatedAlignment(
+                                  static_cast<size_t>(align))));
+}
 #endif  // !TCMALLOC_INTERNAL_METHODS_ONLY
@@ -82,6 +82,7 @@
 
 #include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include <cstddef>
 #include <new>
@@ -94,6 +95,7 @@
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/parameters.h"
 #include "tcmalloc/sizemap.h"
+#include "tcmalloc/span.h"
 #include "tcmalloc/static_vars.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
@@ -165,6 +167,8 @@ class AllocationAccessAsPolicy {
 
   bool is_cold() const { return value_ < Parameters::min_hot_access_hint(); }
 
+  static constexpr SpanLifetime lifetime() { return SpanLifetime::kLongLived; }
+
  private:
   hot_cold_t value_;
 };
@@ -176,12 +180,39 @@ struct AllocationAccessHotPolicy {
   static constexpr hot_cold_t access() { return hot_cold_t{255}; }
 
   static bool is_cold() { return false; }
+
+  static constexpr SpanLifetime lifetime() { return SpanLifetime::kLongLived; }
 };
 
 struct AllocationAccessColdPolicy {
   static constexpr hot_cold_t access() { return hot_cold_t{0}; }
 
   static bool is_cold() { return true; }
+
+  static constexpr SpanLifetime lifetime() { return SpanLifetime::kLongLived; }
+};
+
+// AllocationLifetimeAsPolicy: use user provided lifetime hint.  The memory is
+// treated as frequently accessed, as with AllocationAccessHotPolicy.
+class AllocationLifetimeAsPolicy {
+ public:
+  AllocationLifetimeAsPolicy() = delete;
+  explicit constexpr AllocationLifetimeAsPolicy(lifetime_t value)
+      : value_(value) {}
+
+  static constexpr hot_cold_t access() { return hot_cold_t{255}; }
+
+  static bool is_cold() { return false; }
+
+  constexpr SpanLifetime lifetime() const {
+    return static_cast<uint8_t>(value_) <
+                   static_cast<uint8_t>(kMediumLifetime)
+               ? SpanLifetime::kShortLived
+               : SpanLifetime::kLongLived;
+  }
+
+ private:
+  lifetime_t value_;
 };
 
 using DefaultAllocationAccessPolicy = AllocationAccessHotPolicy;
@@ -296,6 +327,8 @@ class TCMallocPolicy {
 
   bool is_cold() const { return access_.is_cold(); }
 
+  constexpr SpanLifetime lifetime() const { return access_.lifetime(); }
+
   // Hooks policy
   static constexpr bool invoke_hooks() { return HooksPolicy::invoke_hooks(); }
 
@@ -328,6 +361,16 @@ class TCMallocPolicy {
         align_, AllocationAccessAsPolicy{hot_cold}, numa_);
   }
 
+  // Returns this policy with the lifetime hint 'lifetime', in place of an
+  // access hint.
+  constexpr TCMallocPolicy<OomPolicy, AlignPolicy, AllocationLifetimeAsPolicy,
+                           HooksPolicy, SizeReturningPolicy, NumaPolicy>
+  LifetimeAs(lifetime_t lifetime) const {
+    return TCMallocPolicy<OomPolicy, AlignPolicy, AllocationLifetimeAsPolicy,
+                          HooksPolicy, SizeReturningPolicy, NumaPolicy>(
+        align_, AllocationLifetimeAsPolicy{lifetime}, numa_);
+  }
+
   // Returns this policy for frequent access
   constexpr TCMallocPolicy<OomPolicy, AlignPolicy, AllocationAccessHotPolicy,
                            HooksPolicy, SizeReturningPolicy, NumaPolicy>
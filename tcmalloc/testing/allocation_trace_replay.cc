@@ -0,0 +1,313 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Replays allocation traces against the malloc this binary is linked with,
+// reporting throughput, RSS and fragmentation over time.
+//
+// Usage:
+//   allocation_trace_replay [--threads=N] [--report_interval=1s] trace...
+//
+// Traces are recorded by a TCMalloc built with
+// -DTCMALLOC_INTERNAL_ALLOCATION_TRACE.  A trace file holds the
+// AllocationTraceEvent structs returned by
+// malloc_tracing_extension::DrainAllocationTrace, written as they are in
+// memory, e.g. by a thread of the traced process running:
+//
+//   while (!done) {
+//     absl::SleepFor(absl::Milliseconds(5));
+//     auto trace = tcmalloc::malloc_tracing_extension::DrainAllocationTrace();
+//     fwrite(trace->events.data(), sizeof(trace->events[0]),
+//            trace->events.size(), file);
+//   }
+//
+// Files are therefore only portable between machines of the same ABI.
+//
+// Events are replayed in timestamp order, as fast as possible.  The events of
+// recorded thread t are replayed by thread t % --threads; a deallocation
+// replayed by one thread waits for the allocation of its object by another.
+// Deallocations of objects allocated before the trace started, or whose
+// allocation was dropped, are skipped, and objects still live at the end are
+// not freed.  Allocations write one byte per page, so that RSS reflects them.
+//
+// To evaluate a tuning or an upgrade, build the replayer against each of the
+// TCMalloc versions or variants to compare and replay the same traces.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <optional>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "tcmalloc/internal/memory_stats.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/malloc_tracing_extension.h"
+
+ABSL_FLAG(size_t, threads, 0,
+          "Number of replay threads; 0 uses one per recorded thread, up to the "
+          "number of CPUs");
+ABSL_FLAG(absl::Duration, report_interval, absl::Seconds(1),
+          "How often to report progress and memory usage");
+ABSL_FLAG(bool, print_stats, false,
+          "Print MallocExtension::GetStats() once the replay is done");
+
+namespace tcmalloc {
+namespace {
+
+using malloc_tracing_extension::AllocationTraceEvent;
+
+// One operation of a replay thread.
+struct Op {
+  // Index of the object in the replay's object table.
+  uint64_t object : 63;
+  uint64_t deallocation : 1;
+  // The allocation size, or the size to pass to sized delete.
+  uint64_t size;
+};
+
+struct Replay {
+  std::vector<std::vector<Op>> threads;
+  size_t num_objects = 0;
+  size_t num_ops = 0;
+  // Deallocations without a traced allocation.
+  size_t skipped = 0;
+};
+
+bool ReadTrace(const char* path, std::vector<AllocationTraceEvent>& events) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    absl::FPrintF(stderr, "Failed to open %s\n", path);
+    return false;
+  }
+  AllocationTraceEvent e;
+  while (file.read(reinterpret_cast<char*>(&e), sizeof(e))) {
+    events.push_back(e);
+  }
+  if (file.gcount() != 0) {
+    absl::FPrintF(stderr, "%s: truncated event at the end\n", path);
+    return false;
+  }
+  return true;
+}
+
+// Turns the events into a list of operations for each replay thread, with
+// addresses replaced by dense object indices.
+Replay Compile(std::vector<AllocationTraceEvent>& events,
+               size_t num_threads) {
+  std::stable_sort(events.begin(), events.end(),
+                   [](const AllocationTraceEvent& a,
+                      const AllocationTraceEvent& b) {
+                     return a.timestamp < b.timestamp;
+                   });
+  Replay replay;
+  replay.threads.resize(num_threads);
+  absl::flat_hash_map<uint64_t, uint64_t> live;
+  for (const AllocationTraceEvent& e : events) {
+    std::vector<Op>& ops = replay.threads[e.thread % num_threads];
+    if (e.kind == AllocationTraceEvent::Kind::kAllocation) {
+      // A second allocation at a live address means that its deallocation
+      // was dropped: forget the old object.
+      const uint64_t object = replay.num_objects++;
+      live[e.address_hash] = object;
+      ops.push_back({object, 0, e.size});
+    } else {
+      auto it = live.find(e.address_hash);
+      if (it == live.end()) {
+        ++replay.skipped;
+        continue;
+      }
+      ops.push_back({it->second, 1, e.size});
+      live.erase(it);
+    }
+    ++replay.num_ops;
+  }
+  return replay;
+}
+
+struct ABSL_CACHELINE_ALIGNED Progress {
+  std::atomic<uint64_t> ops{0};
+};
+
+void ReplayThread(absl::Span<const Op> ops,
+                  std::vector<std::atomic<void*>>& objects,
+                  Progress& progress) {
+  const size_t page_size = getpagesize();
+  constexpr uint64_t kReportEvery = 1024;
+  uint64_t done = 0;
+  for (const Op& op : ops) {
+    std::atomic<void*>& object = objects[op.object];
+    if (!op.deallocation) {
+      char* ptr = static_cast<char*>(::operator new(op.size));
+      for (size_t i = 0; i < op.size; i += page_size) {
+        ptr[i] = 1;
+      }
+      object.store(ptr, std::memory_order_release);
+    } else {
+      void* ptr;
+      while ((ptr = object.load(std::memory_order_acquire)) == nullptr) {
+        std::this_thread::yield();
+      }
+      if (op.size != 0) {
+        ::operator delete(ptr, op.size);
+      } else {
+        ::operator delete(ptr);
+      }
+    }
+    if (++done % kReportEvery == 0) {
+      progress.ops.store(done, std::memory_order_relaxed);
+    }
+  }
+  progress.ops.store(done, std::memory_order_relaxed);
+}
+
+struct MemoryUsage {
+  size_t rss;
+  size_t physical;
+  size_t allocated;
+
+  double fragmentation() const {
+    return physical > 0 ? 1 - static_cast<double>(allocated) / physical : 0;
+  }
+};
+
+MemoryUsage GetMemoryUsage() {
+  MemoryUsage usage;
+  tcmalloc_internal::MemoryStats stats;
+  usage.rss = tcmalloc_internal::GetMemoryStats(&stats) ? stats.rss : 0;
+  usage.physical =
+      MallocExtension::GetNumericProperty("generic.physical_memory_used")
+          .value_or(0);
+  usage.allocated =
+      MallocExtension::GetNumericProperty("generic.current_allocated_bytes")
+          .value_or(0);
+  return usage;
+}
+
+int Run(const std::vector<char*>& traces) {
+  if (traces.empty()) {
+    absl::FPrintF(stderr, "Usage: allocation_trace_replay [flags] trace...\n");
+    return 2;
+  }
+  std::vector<AllocationTraceEvent> events;
+  for (const char* path : traces) {
+    if (!ReadTrace(path, events)) return 1;
+  }
+
+  size_t num_threads = absl::GetFlag(FLAGS_threads);
+  if (num_threads == 0) {
+    uint32_t max_thread = 0;
+    for (const AllocationTraceEvent& e : events) {
+      max_thread = std::max(max_thread, e.thread);
+    }
+    num_threads = std::clamp<size_t>(
+        max_thread, 1, std::max(1u, std::thread::hardware_concurrency()));
+  }
+  const Replay replay = Compile(events, num_threads);
+  events.clear();
+  events.shrink_to_fit();
+  absl::FPrintF(stderr,
+                "%u operations on %u objects, %u deallocations skipped, %u "
+                "threads\n",
+                replay.num_ops, replay.num_objects, replay.skipped,
+                num_threads);
+  std::vector<std::atomic<void*>> objects(replay.num_objects);
+  std::vector<Progress> progress(num_threads);
+
+  const MemoryUsage before = GetMemoryUsage();
+  absl::PrintF("%9s %12s %12s %10s %10s %10s %6s\n", "seconds", "ops",
+               "ops/s", "rss_MiB", "phys_MiB", "alloc_MiB", "frag%");
+  auto report = [&](absl::Duration elapsed, uint64_t ops, double ops_per_sec) {
+    const MemoryUsage usage = GetMemoryUsage();
+    constexpr double kMiB = 1 << 20;
+    absl::PrintF("%9.2f %12u %12.0f %10.1f %10.1f %10.1f %6.2f\n",
+                 absl::ToDoubleSeconds(elapsed), ops, ops_per_sec,
+                 usage.rss / kMiB, usage.physical / kMiB,
+                 usage.allocated / kMiB, 100 * usage.fragmentation());
+    return usage;
+  };
+
+  const absl::Time start = absl::Now();
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back(ReplayThread, absl::MakeConstSpan(replay.threads[i]),
+                         std::ref(objects), std::ref(progress[i]));
+  }
+
+  auto total_ops = [&]() {
+    uint64_t ops = 0;
+    for (const Progress& p : progress) {
+      ops += p.ops.load(std::memory_order_relaxed);
+    }
+    return ops;
+  };
+  const absl::Duration interval = absl::GetFlag(FLAGS_report_interval);
+  absl::Time last = start;
+  uint64_t last_ops = 0;
+  size_t peak_rss = before.rss;
+  while (total_ops() < replay.num_ops) {
+    absl::SleepFor(std::min(interval, absl::Milliseconds(10)));
+    const absl::Time now = absl::Now();
+    if (now - last < interval) continue;
+    const uint64_t ops = total_ops();
+    const MemoryUsage usage = report(
+        now - start, ops, (ops - last_ops) / absl::ToDoubleSeconds(now - last));
+    peak_rss = std::max(peak_rss, usage.rss);
+    last = now;
+    last_ops = ops;
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  const absl::Duration elapsed = absl::Now() - start;
+  const MemoryUsage after =
+      report(elapsed, replay.num_ops,
+             replay.num_ops / absl::ToDoubleSeconds(elapsed));
+  peak_rss = std::max(peak_rss, after.rss);
+
+  absl::PrintF(
+      "\nreplayed %u operations in %s: %.0f ops/s, peak RSS %.1f MiB, final "
+      "fragmentation %.2f%%\n",
+      replay.num_ops, absl::FormatDuration(elapsed),
+      replay.num_ops / absl::ToDoubleSeconds(elapsed),
+      peak_rss / static_cast<double>(1 << 20), 100 * after.fragmentation());
+  if (absl::GetFlag(FLAGS_print_stats)) {
+    absl::PrintF("\n%s", MallocExtension::GetStats());
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace tcmalloc
+
+int main(int argc, char** argv) {
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  args.erase(args.begin());
+  return tcmalloc::Run(args);
+}
@@ -12,16 +12,25 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <fcntl.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <atomic>
+#include <optional>
+#include <string>
 #include <thread>
 
 #include "gtest/gtest.h"
 #include "absl/time/clock.h"
+#include "absl/strings/str_cat.h"
 #include "absl/time/time.h"
+#include "tcmalloc/internal/parameter_accessors.h"
 #include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/stats_page.h"
 #include "tcmalloc/testing/test_allocator_harness.h"
 #include "tcmalloc/testing/testutil.h"
 #include "tcmalloc/testing/thread_manager.h"
@@ -65,6 +74,92 @@ TEST(BackgroundTest, Stress) {
   background.join();
 }
 
+TEST(BackgroundTest, StatsPage) {
+  struct ProcessActions {
+    static void Go() {
+      constexpr absl::Duration kSleepTime = absl::Milliseconds(10);
+      ScopedBackgroundProcessSleepInterval sleep_time(kSleepTime);
+      MallocExtension::ProcessBackgroundActions();
+    }
+  };
+
+  TCMalloc_Internal_SetPublishStatsPage(true);
+  std::thread background(ProcessActions::Go);
+
+  std::optional<size_t> fd;
+  for (int i = 0; i < 500 && !fd.has_value(); ++i) {
+    absl::SleepFor(absl::Milliseconds(10));
+    fd = MallocExtension::GetNumericProperty("tcmalloc.stats_page_fd");
+  }
+
+  {
+    ScopedBackgroundProcessActionsEnabled background_process_enabled(
+        /*value=*/false);
+    background.join();
+  }
+  TCMalloc_Internal_SetPublishStatsPage(false);
+  if (!fd.has_value()) {
+    GTEST_SKIP() << "The stats page could not be created";
+  }
+
+  // Map the page as a scraper would, through the file system.
+  const std::string path = absl::StrCat("/proc/self/fd/", *fd);
+  const int scraper_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  ASSERT_GE(scraper_fd, 0);
+  void* mapped =
+      mmap(nullptr, sizeof(StatsPage), PROT_READ, MAP_SHARED, scraper_fd, 0);
+  close(scraper_fd);
+  ASSERT_NE(mapped, MAP_FAILED);
+  const StatsPage& page = *static_cast<const StatsPage*>(mapped);
+
+  EXPECT_EQ(page.version, StatsPage::kVersion);
+  uint64_t fields[StatsPage::kMaxFields];
+  ASSERT_EQ(ReadStatsPage(page, fields, StatsPage::kMaxFields),
+            StatsPage::kNumFields);
+  EXPECT_GT(fields[StatsPage::kUpdateTimeNanos], 0);
+  EXPECT_GT(fields[StatsPage::kInUseByAppBytes], 0);
+  EXPECT_GE(fields[StatsPage::kVirtualMemoryUsedBytes],
+            fields[StatsPage::kPhysicalMemoryUsedBytes]);
+  EXPECT_GT(fields[StatsPage::kMetadataBytes], 0);
+
+  munmap(mapped, sizeof(StatsPage));
+}
+
+TEST(BackgroundTest, PrepareForAllocation) {
+  struct ProcessActions {
+    static void Go() {
+      constexpr absl::Duration kSleepTime = absl::Milliseconds(10);
+      ScopedBackgroundProcessSleepInterval sleep_time(kSleepTime);
+      MallocExtension::ProcessBackgroundActions();
+    }
+  };
+
+  auto FreeBytes = []() {
+    return MallocExtension::GetNumericProperty("tcmalloc.page_heap_free")
+        .value_or(0);
+  };
+
+  constexpr size_t kBytes = size_t{256} << 20;
+  const size_t before = FreeBytes();
+  std::thread background(ProcessActions::Go);
+  MallocExtension::PrepareForAllocation(kBytes);
+
+  // The reservation is made on the background thread.
+  bool reserved = false;
+  for (int i = 0; i < 500 && !reserved; ++i) {
+    absl::SleepFor(absl::Milliseconds(10));
+    reserved = FreeBytes() >= before + kBytes;
+  }
+  EXPECT_TRUE(reserved);
+
+  ScopedBackgroundProcessActionsEnabled background_process_enabled(
+      /*value=*/false);
+  background.join();
+
+  void* ptr = ::operator new(kBytes);
+  ::operator delete(ptr);
+}
+
 }  // namespace
 }  // namespace tcmalloc
 
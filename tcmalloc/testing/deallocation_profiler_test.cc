@@ -16,6 +16,7 @@
 
 #include <stddef.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
@@ -32,6 +33,7 @@
 #include "absl/strings/match.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "tcmalloc/internal/parameter_accessors.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/testing/testutil.h"
 
@@ -749,6 +751,61 @@ TEST(LifetimeProfiler, RecordCensoredAllocations) {
   EXPECT_EQ(alloc_frames, 2 * (kAllocFrames + 1));
 }
 
+TEST(LifetimeProfiler, ContinuousProfile) {
+  if (CheckerIsActive()) {
+    return;
+  }
+
+  // Avoid unsample-related behavior
+  tcmalloc::ScopedProfileSamplingInterval test_sample_interval(1);
+  // A size no other test uses, to tell this test's samples apart in the
+  // process-wide profile.
+  constexpr int64_t kMallocSize = 3 * 1024 * 1024 + 17;
+  constexpr int kNumAllocations = 10;
+  constexpr absl::Duration kDuration = absl::Milliseconds(1);
+
+  TCMalloc_Internal_SetContinuousLifetimeProfilePeriod(1);
+  for (int i = 0; i < kNumAllocations; i++) {
+    void *ptr = SingleAlloc(2, kMallocSize);
+    absl::SleepFor(kDuration);
+    SingleDealloc(3, ptr);
+  }
+  void *live = SingleAlloc(2, kMallocSize);
+  TCMalloc_Internal_SetContinuousLifetimeProfilePeriod(0);
+
+  const tcmalloc::Profile profile = tcmalloc::MallocExtension::SnapshotCurrent(
+      tcmalloc::ProfileType::kLifetimes);
+  EXPECT_EQ(profile.Type(), tcmalloc::ProfileType::kLifetimes);
+  EXPECT_GT(profile.Duration(), absl::ZeroDuration());
+
+  int64_t alloc_count = 0, dealloc_count = 0, censored_count = 0;
+  absl::Duration min_lifetime = absl::InfiniteDuration();
+  profile.Iterate([&](const tcmalloc::Profile::Sample &sample) {
+    if (sample.requested_size != kMallocSize) {
+      return;
+    }
+    if (sample.is_censored) {
+      EXPECT_FALSE(sample.allocator_deallocator_thread_matched.has_value());
+      censored_count += sample.count;
+      return;
+    }
+    ASSERT_TRUE(sample.allocator_deallocator_thread_matched.has_value());
+    EXPECT_TRUE(sample.allocator_deallocator_thread_matched.value());
+    min_lifetime = std::min(min_lifetime, sample.min_lifetime);
+    if (sample.count > 0) {
+      alloc_count += sample.count;
+    } else {
+      dealloc_count -= sample.count;
+    }
+  });
+  SingleDealloc(1, live);
+
+  EXPECT_EQ(alloc_count, kNumAllocations);
+  EXPECT_EQ(dealloc_count, kNumAllocations);
+  EXPECT_EQ(censored_count, 1);
+  EXPECT_GE(min_lifetime, kDuration);
+}
+
 TEST(LifetimeProfiler, LifetimeBucketing) {
   using deallocationz::internal::LifetimeNsToBucketedDuration;
 
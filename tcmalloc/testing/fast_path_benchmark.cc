@@ -0,0 +1,133 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Measures the cost of an allocation and deallocation pair on the fast path,
+// for every size class and from 1 up to as many threads as there are CPUs.
+// The fast_path.*.golden tests pin down the instructions of the fast path;
+// this measures what they cost on the machine at hand.
+//
+// Each benchmark reports cycles_per_pair, in CycleClock ticks, alongside the
+// wall time.  The suite is built for every test variant; the
+// deprecated_perthread variant runs it without per-CPU caches.  To compare
+// two commits, run both with
+//
+//   --benchmark_out=fast_path.json --benchmark_out_format=json
+//
+// and diff the outputs, e.g. with Google Benchmark's tools/compare.py.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <new>
+#include <thread>  // NOLINT(build/c++11)
+
+#include "absl/base/internal/cycleclock.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/new_extension.h"
+
+namespace tcmalloc {
+namespace {
+
+// Runs the benchmark for the size of every size class, counted through
+// nallocx, and 1 to NumCPUs threads.
+void SizeClassesAndThreads(benchmark::internal::Benchmark* b) {
+  for (size_t size = 1; size <= tcmalloc_internal::kMaxSize;
+       size = nallocx(size, 0) + 1) {
+    b->Arg(nallocx(size, 0));
+  }
+  b->ThreadRange(1, std::max(1u, std::thread::hardware_concurrency()));
+}
+
+// Calls <pair> once per iteration and reports its cost in cycles.  It is
+// called once before timing starts, so that the caches are populated and
+// every timed iteration stays on the fast path.
+template <typename Pair>
+void MeasurePairs(benchmark::State& state, Pair pair) {
+  pair();
+  const int64_t start = absl::base_internal::CycleClock::Now();
+  for (auto s : state) {
+    pair();
+  }
+  const int64_t cycles = absl::base_internal::CycleClock::Now() - start;
+  state.counters["cycles_per_pair"] = benchmark::Counter(
+      static_cast<double>(cycles), benchmark::Counter::kAvgIterations);
+}
+
+void BM_fast_path_new_delete(benchmark::State& state) {
+  const size_t size = state.range(0);
+  MeasurePairs(state, [size]() {
+    void* ptr = ::operator new(size);
+    benchmark::DoNotOptimize(ptr);
+    ::operator delete(ptr);
+  });
+}
+BENCHMARK(BM_fast_path_new_delete)->Apply(SizeClassesAndThreads);
+
+void BM_fast_path_new_sized_delete(benchmark::State& state) {
+  const size_t size = state.range(0);
+  MeasurePairs(state, [size]() {
+    void* ptr = ::operator new(size);
+    benchmark::DoNotOptimize(ptr);
+    ::operator delete(ptr, size);
+  });
+}
+BENCHMARK(BM_fast_path_new_sized_delete)->Apply(SizeClassesAndThreads);
+
+void BM_fast_path_aligned_new(benchmark::State& state) {
+  const size_t size = state.range(0);
+  constexpr std::align_val_t kAlignment{64};
+  MeasurePairs(state, [size]() {
+    void* ptr = ::operator new(size, kAlignment);
+    benchmark::DoNotOptimize(ptr);
+    ::operator delete(ptr, size, kAlignment);
+  });
+}
+BENCHMARK(BM_fast_path_aligned_new)->Apply(SizeClassesAndThreads);
+
+void BM_fast_path_hot_new(benchmark::State& state) {
+  const size_t size = state.range(0);
+  MeasurePairs(state, [size]() {
+    void* ptr = ::operator new(size, hot_cold_t{255});
+    benchmark::DoNotOptimize(ptr);
+    ::operator delete(ptr, size);
+  });
+}
+BENCHMARK(BM_fast_path_hot_new)->Apply(SizeClassesAndThreads);
+
+void BM_fast_path_cold_new(benchmark::State& state) {
+  const size_t size = state.range(0);
+  MeasurePairs(state, [size]() {
+    void* ptr = ::operator new(size, hot_cold_t{0});
+    benchmark::DoNotOptimize(ptr);
+    ::operator delete(ptr, size);
+  });
+}
+BENCHMARK(BM_fast_path_cold_new)->Apply(SizeClassesAndThreads);
+
+void BM_fast_path_malloc_free(benchmark::State& state) {
+  const size_t size = state.range(0);
+  MeasurePairs(state, [size]() {
+    void* ptr = malloc(size);
+    benchmark::DoNotOptimize(ptr);
+    free(ptr);
+  });
+}
+BENCHMARK(BM_fast_path_malloc_free)->Apply(SizeClassesAndThreads);
+
+}  // namespace
+}  // namespace tcmalloc
@@ -0,0 +1,79 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "tcmalloc/internal/parameter_accessors.h"
+#include "tcmalloc/testing/test_allocator_harness.h"
+#include "tcmalloc/testing/thread_manager.h"
+
+namespace tcmalloc {
+namespace {
+
+// Allocates and frees objects of many sizes, and exits the (child) process
+// with status 0 if all of them succeeded.
+[[noreturn]] void AllocateAndExit() {
+  std::vector<void*> ptrs;
+  for (size_t size = 1; size <= (size_t{1} << 22); size *= 2) {
+    for (int i = 0; i < 16; ++i) {
+      void* p = malloc(size + i);
+      if (p == nullptr) _exit(1);
+      ptrs.push_back(p);
+    }
+  }
+  for (void* p : ptrs) {
+    free(p);
+  }
+  _exit(0);
+}
+
+void ForkWhileAllocating(bool release_memory_after_fork) {
+  const bool previous = TCMalloc_Internal_GetReleaseMemoryAfterFork();
+  TCMalloc_Internal_SetReleaseMemoryAfterFork(release_memory_after_fork);
+
+  constexpr int kThreads = 8;
+  ThreadManager mgr;
+  AllocatorHarness harness(kThreads);
+  mgr.Start(kThreads, [&](int thread_id) { harness.Run(thread_id); });
+
+  // Any lock held by the other threads at the time of fork() would deadlock
+  // the child, so fork repeatedly to hit them in the middle of allocations.
+  for (int i = 0; i < 50; ++i) {
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) AllocateAndExit();
+
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+  }
+
+  mgr.Stop();
+  TCMalloc_Internal_SetReleaseMemoryAfterFork(previous);
+}
+
+TEST(ForkTest, ChildCanAllocate) { ForkWhileAllocating(false); }
+
+TEST(ForkTest, ChildCanAllocateAfterRelease) { ForkWhileAllocating(true); }
+
+}  // namespace
+}  // namespace tcmalloc
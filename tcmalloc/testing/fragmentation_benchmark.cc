@@ -0,0 +1,323 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Runs synthetic server workloads for simulated hours and reports how much
+// memory TCMalloc holds for them, as a yardstick for changes to memory
+// efficiency.  Unlike frag_test.cc and realized_fragmentation_test.cc, which
+// check bounds, these report:
+//   rss_over_allocated  physical memory used over the bytes allocated,
+//                       averaged over the simulated minutes
+//   peak_rss_over_allocated  the highest of these
+//   hugepage_coverage   the fraction of physical memory on intact hugepages
+//                       backed by the kernel with a THP, averaged likewise
+//   cpu_ns_per_op       process CPU time, background actions included, per
+//                       allocation and deallocation
+//
+// Each step of the workload is a simulated second, run every kSimulatedSecond
+// of real time, and background actions run once per simulated second with
+// their intervals and release rate scaled to match.  When a step takes longer
+// than kSimulatedSecond, simulated time slows down accordingly.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <new>
+#include <optional>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/testing/testutil.h"
+
+namespace tcmalloc {
+namespace {
+
+// How much faster than real time the workloads and background actions run.
+constexpr int64_t kSpeedup = 1000;
+constexpr absl::Duration kSimulatedSecond = absl::Milliseconds(1);
+constexpr int64_t kStepsPerMinute = 60;
+constexpr int64_t kStepsPerHour = 60 * kStepsPerMinute;
+
+enum class Workload {
+  // Alternates every 20 minutes between a phase of small objects and one of
+  // larger objects, each living up to the length of a phase.
+  kPhaseChange,
+  // Mostly short-lived objects, with some living minutes and a few hours.
+  kMixedLifetimes,
+  // A steady load with a burst of ten times the allocations, mostly
+  // short-lived, for 30 seconds every 5 minutes.
+  kBursts,
+};
+
+// Objects allocated per simulated second, outside of bursts.
+constexpr int kAllocationsPerStep = 200;
+
+struct Allocation {
+  void* ptr;
+  size_t size;
+};
+
+size_t LogUniformSize(absl::BitGen& rng, size_t lo, size_t hi) {
+  return static_cast<size_t>(
+      std::exp(absl::Uniform(rng, std::log(lo), std::log(hi))));
+}
+
+// Frees allocations when their lifetime, in steps, has passed.
+class Lifetimes {
+ public:
+  explicit Lifetimes(int64_t max_lifetime) : wheel_(max_lifetime + 1) {}
+
+  ~Lifetimes() {
+    for (auto& slot : wheel_) Free(slot);
+    Free(forever_);
+  }
+
+  // Allocates and touches <size> bytes to live for <lifetime> steps, or until
+  // the end of the run if it is std::nullopt.
+  void Allocate(size_t size, std::optional<int64_t> lifetime) {
+    void* ptr = ::operator new(size);
+    // Touch every page, so that the memory is backed.
+    for (size_t i = 0; i < size; i += 4096) {
+      static_cast<char*>(ptr)[i] = 1;
+    }
+    benchmark::DoNotOptimize(ptr);
+    ++ops_;
+
+    if (!lifetime.has_value()) {
+      forever_.push_back({ptr, size});
+      return;
+    }
+    const int64_t steps = std::clamp<int64_t>(*lifetime, 1, wheel_.size() - 1);
+    wheel_[(now_ + steps) % wheel_.size()].push_back({ptr, size});
+  }
+
+  // Advances to the next step, freeing the allocations that expire.
+  void Step() {
+    ++now_;
+    Free(wheel_[now_ % wheel_.size()]);
+  }
+
+  int64_t ops() const { return ops_; }
+
+ private:
+  void Free(std::vector<Allocation>& allocations) {
+    for (const Allocation& a : allocations) {
+      ::operator delete(a.ptr, a.size);
+      ++ops_;
+    }
+    allocations.clear();
+  }
+
+  std::vector<std::vector<Allocation>> wheel_;
+  std::vector<Allocation> forever_;
+  int64_t now_ = 0;
+  int64_t ops_ = 0;
+};
+
+constexpr int64_t kPhaseLength = 20 * kStepsPerMinute;
+constexpr int64_t kMaxLifetime = kStepsPerHour;
+
+// Allocates the objects of simulated second <step> of <workload>.
+void RunStep(Workload workload, int64_t step, absl::BitGen& rng,
+             Lifetimes& lifetimes) {
+  switch (workload) {
+    case Workload::kPhaseChange: {
+      const bool small = (step / kPhaseLength) % 2 == 0;
+      for (int i = 0; i < kAllocationsPerStep; ++i) {
+        const size_t size = small ? LogUniformSize(rng, 8, 512)
+                                  : LogUniformSize(rng, 1024, 64 << 10);
+        lifetimes.Allocate(size, absl::Uniform<int64_t>(rng, 1, kPhaseLength));
+      }
+      break;
+    }
+    case Workload::kMixedLifetimes: {
+      for (int i = 0; i < kAllocationsPerStep; ++i) {
+        const double p = absl::Uniform(rng, 0.0, 1.0);
+        const size_t size = p < 0.99 ? LogUniformSize(rng, 8, 4096)
+                                     : LogUniformSize(rng, 64 << 10, 1 << 20);
+        const double q = absl::Uniform(rng, 0.0, 1.0);
+        std::optional<int64_t> lifetime;
+        if (q < 0.9) {
+          lifetime = absl::Uniform<int64_t>(rng, 1, 10);
+        } else if (q < 0.99) {
+          lifetime = absl::Uniform<int64_t>(rng, kStepsPerMinute,
+                                            30 * kStepsPerMinute);
+        }
+        lifetimes.Allocate(size, lifetime);
+      }
+      break;
+    }
+    case Workload::kBursts: {
+      const bool burst = step % (5 * kStepsPerMinute) < 30;
+      const int n = burst ? 10 * kAllocationsPerStep : kAllocationsPerStep;
+      for (int i = 0; i < n; ++i) {
+        const size_t size = LogUniformSize(rng, 8, 16 << 10);
+        const int64_t lifetime =
+            burst && absl::Bernoulli(rng, 0.9)
+                ? absl::Uniform<int64_t>(rng, 1, kStepsPerMinute)
+                : absl::Uniform<int64_t>(rng, 1, 10 * kStepsPerMinute);
+        lifetimes.Allocate(size, lifetime);
+      }
+      break;
+    }
+  }
+}
+
+int64_t CpuNanos(clockid_t clock) {
+  timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * int64_t{1000000000} + ts.tv_nsec;
+}
+
+// Runs background actions, accelerated by kSpeedup, for the lifetime of the
+// object.
+class AcceleratedBackgroundActions {
+ public:
+  AcceleratedBackgroundActions()
+      : release_rate_(MallocExtension::GetBackgroundReleaseRate()),
+        skip_subrelease_(MallocExtension::GetSkipSubreleaseInterval()),
+        skip_subrelease_short_(
+            MallocExtension::GetSkipSubreleaseShortInterval()),
+        skip_subrelease_long_(
+            MallocExtension::GetSkipSubreleaseLongInterval()) {
+    MallocExtension::SetBackgroundReleaseRate(
+        static_cast<MallocExtension::BytesPerSecond>(
+            static_cast<size_t>(release_rate_) * kSpeedup));
+    MallocExtension::SetSkipSubreleaseInterval(skip_subrelease_ / kSpeedup);
+    MallocExtension::SetSkipSubreleaseShortInterval(skip_subrelease_short_ /
+                                                    kSpeedup);
+    MallocExtension::SetSkipSubreleaseLongInterval(skip_subrelease_long_ /
+                                                   kSpeedup);
+    thread_ = std::thread([] {
+      ScopedBackgroundProcessSleepInterval sleep_interval(kSimulatedSecond);
+      MallocExtension::ProcessBackgroundActions();
+    });
+  }
+
+  ~AcceleratedBackgroundActions() {
+    {
+      ScopedBackgroundProcessActionsEnabled enabled(/*value=*/false);
+      thread_.join();
+    }
+    MallocExtension::SetBackgroundReleaseRate(release_rate_);
+    MallocExtension::SetSkipSubreleaseInterval(skip_subrelease_);
+    MallocExtension::SetSkipSubreleaseShortInterval(skip_subrelease_short_);
+    MallocExtension::SetSkipSubreleaseLongInterval(skip_subrelease_long_);
+  }
+
+ private:
+  const MallocExtension::BytesPerSecond release_rate_;
+  const absl::Duration skip_subrelease_;
+  const absl::Duration skip_subrelease_short_;
+  const absl::Duration skip_subrelease_long_;
+  std::thread thread_;
+};
+
+struct MemorySample {
+  double rss_over_allocated;
+  double hugepage_coverage;
+};
+
+std::optional<MemorySample> SampleMemory() {
+  const std::optional<size_t> rss =
+      MallocExtension::GetNumericProperty("generic.physical_memory_used");
+  const std::optional<size_t> allocated =
+      MallocExtension::GetNumericProperty("generic.current_allocated_bytes");
+  if (!rss.has_value() || !allocated.has_value() || *allocated == 0 ||
+      *rss == 0) {
+    return std::nullopt;
+  }
+  const size_t intact =
+      MallocExtension::GetNumericProperty(
+          "tcmalloc.hugepage_backing.intact_bytes")
+          .value_or(0);
+  const size_t small_page_backed =
+      MallocExtension::GetNumericProperty(
+          "tcmalloc.hugepage_backing.small_page_backed_bytes")
+          .value_or(0);
+  const size_t covered = intact - std::min(intact, small_page_backed);
+  return MemorySample{
+      static_cast<double>(*rss) / *allocated,
+      std::min(1.0, static_cast<double>(covered) / *rss),
+  };
+}
+
+// Runs a workload, state.range(0), for state.range(1) simulated hours.
+void BM_Fragmentation(benchmark::State& state) {
+  const auto workload = static_cast<Workload>(state.range(0));
+  const int64_t steps = state.range(1) * kStepsPerHour;
+
+  for (auto _ : state) {
+    absl::BitGen rng;
+    double rss_sum = 0, rss_peak = 0, coverage_sum = 0;
+    int samples = 0;
+    int64_t sampling_cpu = 0;
+    int64_t ops, cpu;
+
+    const int64_t cpu_start = CpuNanos(CLOCK_PROCESS_CPUTIME_ID);
+    {
+      AcceleratedBackgroundActions background;
+      Lifetimes lifetimes(kMaxLifetime);
+      const absl::Time start = absl::Now();
+      for (int64_t step = 0; step < steps; ++step) {
+        RunStep(workload, step, rng, lifetimes);
+        lifetimes.Step();
+
+        if (step % kStepsPerMinute == kStepsPerMinute - 1) {
+          const int64_t sampling_start = CpuNanos(CLOCK_THREAD_CPUTIME_ID);
+          if (std::optional<MemorySample> s = SampleMemory(); s.has_value()) {
+            rss_sum += s->rss_over_allocated;
+            rss_peak = std::max(rss_peak, s->rss_over_allocated);
+            coverage_sum += s->hugepage_coverage;
+            ++samples;
+          }
+          sampling_cpu += CpuNanos(CLOCK_THREAD_CPUTIME_ID) - sampling_start;
+        }
+
+        absl::SleepFor(start + (step + 1) * kSimulatedSecond - absl::Now());
+      }
+      ops = lifetimes.ops();
+      cpu = CpuNanos(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+    }
+
+    state.counters["rss_over_allocated"] =
+        samples > 0 ? rss_sum / samples : 0;
+    state.counters["peak_rss_over_allocated"] = rss_peak;
+    state.counters["hugepage_coverage"] =
+        samples > 0 ? coverage_sum / samples : 0;
+    state.counters["cpu_ns_per_op"] =
+        static_cast<double>(cpu - sampling_cpu) / std::max<int64_t>(ops, 1);
+    state.SetItemsProcessed(ops);
+  }
+}
+
+BENCHMARK(BM_Fragmentation)
+    ->ArgNames({"workload", "hours"})
+    ->Args({static_cast<int>(Workload::kPhaseChange), 2})
+    ->Args({static_cast<int>(Workload::kMixedLifetimes), 2})
+    ->Args({static_cast<int>(Workload::kBursts), 2})
+    ->Iterations(1)
+    ->Unit(benchmark::kSecond)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace tcmalloc
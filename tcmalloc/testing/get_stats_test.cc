@@ -292,6 +292,7 @@ TEST_F(GetStatsTest, Parameters) {
     EXPECT_THAT(pbtxt, HasSubstr(R"(guarded_sample_parameter: 50)"));
     EXPECT_THAT(pbtxt, HasSubstr(R"(desired_usage_limit_bytes: -1)"));
     EXPECT_THAT(pbtxt, HasSubstr(R"(hard_usage_limit_bytes: -1)"));
+    EXPECT_THAT(pbtxt, HasSubstr(R"(cgroup_usage_limit_bytes: -1)"));
     EXPECT_THAT(pbtxt, HasSubstr(R"(tcmalloc_per_cpu_caches: true)"));
     EXPECT_THAT(pbtxt,
                 HasSubstr(R"(tcmalloc_max_per_cpu_cache_size: 3145728)"));
@@ -391,6 +392,25 @@ Enabled: (0|1)
 #endif  // #ifndef TCMALLOC_INTERNAL_SELSAN
 }
 
+TEST_F(GetStatsTest, Summary) {
+  const std::string stats = MallocExtension::GetStats();
+  const std::string summary = MallocExtension::GetSummaryStats();
+  if (!absl::StrContains(stats, "MALLOC:")) {
+    GTEST_SKIP() << "Not linked against malloc";
+  }
+
+  EXPECT_THAT(summary, HasSubstr("Summary stats"));
+  EXPECT_THAT(summary, HasSubstr("Bytes in use by application"));
+  EXPECT_THAT(summary, HasSubstr("Bytes in per-CPU cache freelist"));
+  EXPECT_THAT(summary, HasSubstr("MALLOC SAMPLED PROFILES"));
+  // The per-size-class and per-CPU details are left out.
+  EXPECT_THAT(summary, Not(HasSubstr("Central cache freelist")));
+  EXPECT_THAT(summary, Not(HasSubstr("per-CPU cache underflows")));
+
+  EXPECT_THAT(stats, Not(HasSubstr("Summary stats")));
+  EXPECT_LT(summary.size(), stats.size());
+}
+
 TEST_F(GetStatsTest, RequiredBufferSizes) {
   if (&MallocExtension_Internal_GetStatsInPbtxt == nullptr) {
     GTEST_SKIP() << "Not linked against malloc";
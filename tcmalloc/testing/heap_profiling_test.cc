@@ -21,6 +21,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "tcmalloc/internal/profile.pb.h"
 #include "gtest/gtest.h"
@@ -33,9 +34,11 @@
 #include "absl/log/check.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/parameter_accessors.h"
 #include "tcmalloc/internal/profile_builder.h"
 #include "tcmalloc/internal/sampled_allocation.h"
 #include "tcmalloc/malloc_extension.h"
@@ -251,5 +254,122 @@ TEST(HeapProfilingTest, AllocateWhileIterating) {
   }
 }
 
+TEST(HeapProfilingTest, AllocationContext) {
+  ScopedProfileSamplingInterval s(1);
+  constexpr size_t kSize = 12347;
+  constexpr uint64_t kContext = 0x5eed;
+
+  void* with_context;
+  {
+    MallocExtension::ScopedAllocationContext context(kContext);
+    EXPECT_EQ(MallocExtension::GetAllocationContext(), kContext);
+    with_context = ::operator new(kSize);
+  }
+  EXPECT_EQ(MallocExtension::GetAllocationContext(), 0);
+  void* without_context = ::operator new(kSize);
+
+  int64_t count_with = 0, count_without = 0;
+  MallocExtension::SnapshotCurrent(ProfileType::kHeap)
+      .Iterate([&](const Profile::Sample& sample) {
+        if (sample.requested_size != kSize) return;
+        if (sample.allocation_context == kContext) {
+          count_with += sample.count;
+        } else if (sample.allocation_context == 0) {
+          count_without += sample.count;
+        }
+      });
+  EXPECT_EQ(count_with, 1);
+  EXPECT_EQ(count_without, 1);
+
+  ::operator delete(with_context);
+  ::operator delete(without_context);
+}
+
+TEST(HeapProfilingTest, AllocationAccounting) {
+  if (&TCMalloc_Internal_SetAllocationAccounting == nullptr) {
+    GTEST_SKIP() << "allocation_accounting is not supported";
+  }
+  const bool previous = TCMalloc_Internal_GetAllocationAccounting();
+  TCMalloc_Internal_SetAllocationAccounting(true);
+  ScopedProfileSamplingInterval s(1);
+  constexpr uint64_t kContext = 0xacc7;
+  constexpr size_t kSmallSize = 1024;
+  constexpr int kNumSmall = 100;
+  constexpr size_t kLargeSize = size_t{4} << 20;
+
+  auto account_bytes = [](absl::string_view kind) -> size_t {
+    const auto properties = MallocExtension::GetProperties();
+    auto it = properties.find(
+        absl::StrFormat("tcmalloc.account.%d.%s", kContext, kind));
+    return it == properties.end() ? 0 : it->second.value;
+  };
+  const size_t large_before = account_bytes("large_bytes");
+  const size_t sampled_before = account_bytes("sampled_bytes");
+
+  std::vector<void*> small;
+  void* large;
+  {
+    MallocExtension::ScopedAllocationContext context(kContext);
+    for (int i = 0; i < kNumSmall; ++i) {
+      small.push_back(::operator new(kSmallSize));
+    }
+    large = ::operator new(kLargeSize);
+  }
+
+  // Large allocations are charged exactly, small ones by their samples.
+  EXPECT_EQ(account_bytes("large_bytes") - large_before,
+            *MallocExtension::GetAllocatedSize(large));
+  EXPECT_GE(account_bytes("sampled_bytes") - sampled_before,
+            kNumSmall * kSmallSize / 2);
+
+  for (void* p : small) {
+    ::operator delete(p);
+  }
+  ::operator delete(large);
+  EXPECT_EQ(account_bytes("large_bytes"), large_before);
+  EXPECT_EQ(account_bytes("sampled_bytes"), sampled_before);
+
+  TCMalloc_Internal_SetAllocationAccounting(previous);
+}
+
+TEST(HeapProfilingTest, HeapProfileCursor) {
+  ScopedProfileSamplingInterval s(1);
+  constexpr size_t kSize = 12345;
+  constexpr int kNum = 100;
+
+  auto count_samples = [&](const Profile& profile) {
+    EXPECT_EQ(profile.Type(), ProfileType::kHeap);
+    int64_t count = 0;
+    profile.Iterate([&](const Profile::Sample& sample) {
+      if (sample.requested_size == kSize) count += sample.count;
+    });
+    return count;
+  };
+
+  MallocExtension::HeapProfileCursor cursor =
+      MallocExtension::StartHeapProfileCursor();
+  void* allocations[kNum];
+  for (int i = 0; i < kNum; i++) {
+    allocations[i] = ::operator new(kSize);
+  }
+  EXPECT_EQ(count_samples(cursor.Advance()), kNum);
+
+  for (int i = 0; i < kNum / 2; i++) {
+    ::operator delete(allocations[i]);
+  }
+  EXPECT_EQ(count_samples(cursor.Advance()), -kNum / 2);
+
+  // Nothing changed since the previous call.
+  EXPECT_EQ(count_samples(cursor.Advance()), 0);
+
+  for (int i = kNum / 2; i < kNum; i++) {
+    ::operator delete(allocations[i]);
+  }
+  EXPECT_EQ(count_samples(cursor.Advance()), -kNum / 2);
+
+  MallocExtension::HeapProfileCursor empty;
+  EXPECT_EQ(empty.Advance().Type(), ProfileType::kDoNotUse);
+}
+
 }  // namespace
 }  // namespace tcmalloc
@@ -0,0 +1,54 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Test that, with want_lazy_per_cpu_caches linked in, the per-CPU caches are
+// not active at startup and are activated once the binary allocates enough.
+
+#include <stddef.h>
+
+#include <cstdlib>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace {
+
+TEST(LazyPerCpuCachesTest, ActivatedByAllocations) {
+  if (!tcmalloc_internal::subtle::percpu::IsFast()) {
+    GTEST_SKIP() << "Per-CPU caches are not supported.";
+  }
+  ASSERT_FALSE(MallocExtension::PerCpuCachesActive());
+
+  // Allocate more than the thread cache can hold, so that it keeps refilling
+  // from the transfer cache.
+  constexpr int kObjects = 20000;
+  std::vector<void*> ptrs(kObjects);
+  for (int round = 0;
+       round < 10000 && !MallocExtension::PerCpuCachesActive(); ++round) {
+    const size_t size = 8 << (round % 6);
+    for (void*& p : ptrs) {
+      p = malloc(size);
+    }
+    for (void* p : ptrs) {
+      free(p);
+    }
+  }
+  EXPECT_TRUE(MallocExtension::PerCpuCachesActive());
+}
+
+}  // namespace
+}  // namespace tcmalloc
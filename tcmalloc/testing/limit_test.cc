@@ -126,6 +126,35 @@ TEST_F(LimitTest, LimitZeroMeansNoLimit) {
   ::operator delete(ptr);
 }
 
+TEST_F(LimitTest, HeapMemoryLimit) {
+  using MemoryHeap = MallocExtension::MemoryHeap;
+  using LimitKind = MallocExtension::LimitKind;
+  constexpr size_t kLimit = size_t{64} << 30;
+
+  EXPECT_FALSE(MallocExtension::SetHeapMemoryLimit(MemoryHeap::kNormal, -1,
+                                                   kLimit, LimitKind::kSoft));
+  EXPECT_FALSE(MallocExtension::SetHeapMemoryLimit(
+      MemoryHeap::kNormal, MallocExtension::GetNumNumaPartitions(), kLimit,
+      LimitKind::kSoft));
+
+  ASSERT_TRUE(MallocExtension::SetHeapMemoryLimit(MemoryHeap::kSampled, 0,
+                                                  kLimit, LimitKind::kSoft));
+  EXPECT_EQ(MallocExtension::GetHeapMemoryLimit(MemoryHeap::kSampled, 0,
+                                                LimitKind::kSoft),
+            kLimit);
+  EXPECT_EQ(MallocExtension::GetHeapMemoryLimit(MemoryHeap::kNormal, 0,
+                                                LimitKind::kSoft),
+            std::numeric_limits<size_t>::max());
+  EXPECT_THAT(MallocExtension::GetStats(),
+              HasSubstr("Limits of the SAMPLED heap"));
+
+  ASSERT_TRUE(MallocExtension::SetHeapMemoryLimit(MemoryHeap::kSampled, 0, 0,
+                                                  LimitKind::kSoft));
+  EXPECT_EQ(MallocExtension::GetHeapMemoryLimit(MemoryHeap::kSampled, 0,
+                                                LimitKind::kSoft),
+            std::numeric_limits<size_t>::max());
+}
+
 void LimitTest::LimitRespected() {
   // Needed to see what expectation failed (if any).
   testing::UnitTest::GetInstance()->listeners().SuppressEventForwarding(false);
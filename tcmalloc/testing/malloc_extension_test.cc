@@ -17,19 +17,32 @@
 #include "tcmalloc/malloc_extension.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
 #include <map>
+#include <new>
 #include <optional>
+#include <stdexcept>
+#include <thread>  // NOLINT(build/c++11)
 #include <utility>
+#include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/base/config.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "tcmalloc/cpu_cache.h"
 #include "tcmalloc/experiment.h"
 #include "tcmalloc/experiment_config.h"
+#include "tcmalloc/internal/parameter_accessors.h"
 #include "tcmalloc/static_vars.h"
+#include "tcmalloc/tcmalloc_policy.h"
 #include "tcmalloc/testing/testutil.h"
 
 namespace tcmalloc {
@@ -87,6 +100,211 @@ TEST(MallocExtension, SkipSubreleaseIntervals) {
             absl::ZeroDuration());
 }
 
+TEST(MallocExtension, AllocateBatch) {
+  for (size_t size : {8, 32, 100, 1024, 8192, 300000}) {
+    SCOPED_TRACE(size);
+    constexpr size_t kBatchSize = 1000;
+    std::vector<void*> ptrs(kBatchSize, nullptr);
+    ASSERT_EQ(MallocExtension::AllocateBatch(size, absl::MakeSpan(ptrs)),
+              kBatchSize);
+    for (void* ptr : ptrs) {
+      ASSERT_NE(ptr, nullptr);
+      EXPECT_GE(MallocExtension::GetAllocatedSize(ptr), size);
+      memset(ptr, 0xcd, size);
+    }
+
+    std::vector<void*> sorted = ptrs;
+    std::sort(sorted.begin(), sorted.end());
+    EXPECT_EQ(std::adjacent_find(sorted.begin(), sorted.end()), sorted.end());
+
+    MallocExtension::DeallocateBatch(ptrs);
+  }
+}
+
+TEST(MallocExtension, TryResizeInPlace) {
+  for (size_t size : {10, 1000, 300000}) {
+    SCOPED_TRACE(size);
+    void* ptr = ::operator new(size);
+    const std::optional<size_t> capacity =
+        MallocExtension::GetAllocatedSize(ptr);
+    ASSERT_TRUE(capacity.has_value());
+
+    // Growing within the capacity succeeds, and the whole capacity is usable.
+    EXPECT_EQ(MallocExtension::TryResizeInPlace(ptr, *capacity), capacity);
+    memset(ptr, 0xcd, *capacity);
+    // Growing past it does not move the allocation.
+    EXPECT_EQ(MallocExtension::TryResizeInPlace(ptr, *capacity + 1), capacity);
+    // Shrinking keeps the capacity.
+    EXPECT_EQ(MallocExtension::TryResizeInPlace(ptr, 1), capacity);
+
+    ::operator delete(ptr, *capacity);
+  }
+}
+
+TEST(MallocExtension, DeallocateSizedBatch) {
+  for (size_t size : {8, 48, 4096, 262144, 1 << 20}) {
+    SCOPED_TRACE(size);
+    constexpr size_t kBatchSize = 1000;
+    std::vector<void*> ptrs(kBatchSize, nullptr);
+    ASSERT_EQ(MallocExtension::AllocateBatch(size, absl::MakeSpan(ptrs)),
+              kBatchSize);
+    // Objects from malloc may be sampled; mix them in along with nullptr.
+    for (int i = 0; i < 100; ++i) {
+      ptrs.push_back(malloc(size));
+    }
+    ptrs.push_back(nullptr);
+
+    MallocExtension::DeallocateSizedBatch(ptrs, size);
+  }
+}
+
+TEST(MallocExtension, SizeClassHandle) {
+  for (size_t size : {8, 24, 100, 1024, 8192, 300000}) {
+    for (size_t alignment : {size_t{8}, size_t{64}, size_t{4096}}) {
+      for (hot_cold_t hot_cold :
+           {static_cast<hot_cold_t>(0), static_cast<hot_cold_t>(255)}) {
+        SCOPED_TRACE(absl::StrCat(size, " ", alignment, " ",
+                                  static_cast<int>(hot_cold)));
+        const MallocExtension::SizeClassHandle handle =
+            MallocExtension::GetSizeClassHandle(
+                size, static_cast<std::align_val_t>(alignment), hot_cold);
+        EXPECT_EQ(handle.size(), size);
+
+        std::vector<void*> ptrs;
+        for (int i = 0; i < 1000; ++i) {
+          void* ptr = MallocExtension::AllocateWithHandle(handle);
+          ASSERT_NE(ptr, nullptr);
+          EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % alignment, 0);
+          EXPECT_GE(MallocExtension::GetAllocatedSize(ptr), size);
+          memset(ptr, 0xcd, size);
+          ptrs.push_back(ptr);
+        }
+        // Objects from ::operator new may also be freed with the handle.
+        ptrs.push_back(
+            ::operator new(size, static_cast<std::align_val_t>(alignment)));
+
+        for (void* ptr : ptrs) {
+          MallocExtension::DeallocateWithHandle(ptr, handle);
+        }
+        MallocExtension::DeallocateWithHandle(nullptr, handle);
+      }
+    }
+  }
+}
+
+TEST(MallocExtension, SizeClassHandleAllocator) {
+  std::map<int, int, std::less<int>,
+           SizeClassHandleAllocator<std::pair<const int, int>>>
+      m;
+  for (int i = 0; i < 10000; ++i) {
+    m[i] = i;
+  }
+  std::vector<int, SizeClassHandleAllocator<int>> v;
+  for (int i = 0; i < 10000; ++i) {
+    v.push_back(i);
+  }
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_EQ(m[i], v[i]);
+  }
+
+  SizeClassHandleAllocator<int> hot;
+  SizeClassHandleAllocator<double> other(hot);
+  EXPECT_TRUE(hot == other);
+  EXPECT_TRUE(hot != SizeClassHandleAllocator<int>(static_cast<hot_cold_t>(0)));
+}
+
+struct alignas(64) Node {
+  explicit Node(int value, bool fail = false) : value(value) {
+#ifdef ABSL_HAVE_EXCEPTIONS
+    if (fail) throw std::runtime_error("constructor failed");
+#endif
+    ++live;
+  }
+  ~Node() { --live; }
+
+  int value;
+  static int live;
+};
+
+int Node::live = 0;
+
+TEST(MallocExtension, NewAndDelete) {
+  std::vector<Node*> nodes;
+  for (int i = 0; i < 1000; ++i) {
+    Node* node = New<Node>(i);
+    ASSERT_NE(node, nullptr);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(node) % alignof(Node), 0);
+    EXPECT_EQ(node->value, i);
+    nodes.push_back(node);
+  }
+  EXPECT_EQ(Node::live, 1000);
+  for (Node* node : nodes) {
+    Delete(node);
+  }
+  EXPECT_EQ(Node::live, 0);
+  Delete<Node>(nullptr);
+
+  // Objects of other types of the same size and alignment share the handle.
+  int* i = New<int>(5);
+  EXPECT_EQ(*i, 5);
+  Delete(i);
+
+#ifdef ABSL_HAVE_EXCEPTIONS
+  EXPECT_THROW(New<Node>(0, /*fail=*/true), std::runtime_error);
+  EXPECT_EQ(Node::live, 0);
+#endif
+}
+
+TEST(MallocExtension, Heap) {
+  MallocExtension::Heap* heap = MallocExtension::CreateHeap();
+  ASSERT_NE(heap, nullptr);
+
+  struct Allocation {
+    char* p;
+    size_t size;
+  };
+  std::vector<Allocation> allocations;
+  for (int i = 0; i < 10000; ++i) {
+    const size_t size = i % 100 == 0 ? (1 << 20) + i : i % 512;
+    const size_t alignment = size_t{1} << (i % 17);
+    char* p = static_cast<char*>(MallocExtension::HeapAllocate(
+        heap, size, static_cast<std::align_val_t>(alignment)));
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % alignment, 0);
+    EXPECT_EQ(MallocExtension::GetOwnership(p),
+              MallocExtension::Ownership::kOwned);
+    memset(p, i, size);
+    allocations.push_back({p, size});
+  }
+  // The objects do not overlap.
+  for (int i = 0; i < allocations.size(); ++i) {
+    const Allocation& a = allocations[i];
+    EXPECT_EQ(std::count(a.p, a.p + a.size, static_cast<char>(i)), a.size);
+  }
+  MallocExtension::DestroyHeap(heap);
+
+  heap = MallocExtension::CreateHeap();
+  ASSERT_NE(heap, nullptr);
+  EXPECT_NE(MallocExtension::HeapAllocate(heap, 0), nullptr);
+  MallocExtension::DestroyHeap(heap);
+  MallocExtension::DestroyHeap(nullptr);
+}
+
+TEST(MallocExtension, DeallocateBatchMixed) {
+  // DeallocateBatch accepts objects from any allocation routine, of mixed
+  // sizes, interleaved with nullptr.
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 1000; ++i) {
+    ptrs.push_back(::operator new(i % 64 + 1));
+    ptrs.push_back(malloc(i % 7 == 0 ? 1 << 20 : 16));
+    if (i % 10 == 0) {
+      ptrs.push_back(nullptr);
+    }
+  }
+  MallocExtension::DeallocateBatch(ptrs);
+  MallocExtension::DeallocateBatch({});
+}
+
 TEST(MallocExtension, CacheDemandReleaseIntervals) {
 
   // Mutate via MallocExtension.
@@ -138,6 +356,7 @@ TEST(MallocExtension, Properties) {
       "tcmalloc.external_fragmentation_bytes",
       "tcmalloc.hard_limit_hits",
       "tcmalloc.hard_usage_limit_bytes",
+      "tcmalloc.heap_profile_snapshot_peak_bytes",
       "tcmalloc.local_bytes",
       "tcmalloc.max_total_thread_cache_bytes",
       "tcmalloc.metadata_bytes",
@@ -174,6 +393,157 @@ TEST(MallocExtension, Properties) {
   }
 }
 
+TEST(MallocExtension, StaleNumericProperties) {
+  constexpr absl::string_view kProperty = "generic.current_allocated_bytes";
+  constexpr size_t kSize = 64 << 20;
+  absl::Duration old_staleness;
+  TCMalloc_Internal_GetNumericPropertyStaleness(&old_staleness);
+
+  TCMalloc_Internal_SetNumericPropertyStaleness(absl::Hours(1));
+  const std::optional<size_t> before =
+      MallocExtension::GetNumericProperty(kProperty);
+  ASSERT_THAT(before, testing::Ne(std::nullopt));
+  void* ptr = ::operator new(kSize);
+  // The snapshot taken above is reused.
+  EXPECT_EQ(MallocExtension::GetNumericProperty(kProperty), before);
+
+  TCMalloc_Internal_SetNumericPropertyStaleness(absl::ZeroDuration());
+  EXPECT_THAT(MallocExtension::GetNumericProperty(kProperty),
+              testing::Optional(testing::Ge(*before + kSize)));
+
+  ::operator delete(ptr);
+  TCMalloc_Internal_SetNumericPropertyStaleness(old_staleness);
+}
+
+size_t budget_callback_calls = 0;
+size_t budget_callback_bytes = 0;
+
+void RecordBudgetExceeded(size_t allocated_bytes) {
+  ++budget_callback_calls;
+  budget_callback_bytes = allocated_bytes;
+  // The callback may allocate without being called again.
+  ::operator delete(::operator new(1 << 20));
+}
+
+TEST(MallocExtension, AllocationBudget) {
+  constexpr size_t kSize = 1 << 20;
+  constexpr size_t kBudget = 64 << 20;
+  budget_callback_calls = 0;
+  MallocExtension::SetAllocationBudgetCallback(&RecordBudgetExceeded);
+
+  MallocExtension::SetAllocationBudget(kBudget);
+  EXPECT_EQ(MallocExtension::GetAllocationBudgetUsage(), 0);
+  for (int i = 0; i < 1024; ++i) {
+    void* volatile ptr = ::operator new(kSize);
+    ::operator delete(ptr);
+  }
+  // Allocations are counted from the sampling slow path, so they are only
+  // estimated.
+  EXPECT_EQ(budget_callback_calls, 1);
+  EXPECT_GT(budget_callback_bytes, kBudget);
+  EXPECT_GE(MallocExtension::GetAllocationBudgetUsage(), 512 * kSize);
+
+  // Setting a budget again starts over.
+  MallocExtension::SetAllocationBudget(kBudget);
+  EXPECT_LT(MallocExtension::GetAllocationBudgetUsage(), kBudget);
+  for (int i = 0; i < 1024; ++i) {
+    void* volatile ptr = ::operator new(kSize);
+    ::operator delete(ptr);
+  }
+  EXPECT_EQ(budget_callback_calls, 2);
+
+  MallocExtension::SetAllocationBudget(0);
+  for (int i = 0; i < 1024; ++i) {
+    void* volatile ptr = ::operator new(kSize);
+    ::operator delete(ptr);
+  }
+  EXPECT_EQ(budget_callback_calls, 2);
+  MallocExtension::SetAllocationBudgetCallback(nullptr);
+}
+
+TEST(MallocExtension, SwapAllocationTaskState) {
+  constexpr size_t kSize = 1 << 20;
+  constexpr size_t kBudget = 64 << 20;
+  budget_callback_calls = 0;
+  MallocExtension::SetAllocationBudgetCallback(&RecordBudgetExceeded);
+  MallocExtension::SetAllocationContext(1);
+  MallocExtension::SetAllocationBudget(0);
+
+  // Switch to a task, which starts with a state of its own.
+  MallocExtension::AllocationTaskState task;
+  MallocExtension::SwapAllocationTaskState(task);
+  EXPECT_EQ(MallocExtension::GetAllocationContext(), 0);
+  MallocExtension::SetAllocationContext(2);
+  MallocExtension::SetAllocationBudget(kBudget);
+  for (int i = 0; i < 32; ++i) {
+    void* volatile ptr = ::operator new(kSize);
+    ::operator delete(ptr);
+  }
+  const size_t usage = MallocExtension::GetAllocationBudgetUsage();
+  EXPECT_GT(usage, 0);
+
+  // Switching back restores the thread's own state, and allocations made in
+  // between are not charged to the task.
+  MallocExtension::SwapAllocationTaskState(task);
+  EXPECT_EQ(MallocExtension::GetAllocationContext(), 1);
+  EXPECT_EQ(MallocExtension::GetAllocationBudgetUsage(), 0);
+  EXPECT_EQ(task.allocation_context, 2);
+  EXPECT_EQ(task.budget_usage, usage);
+  for (int i = 0; i < 1024; ++i) {
+    void* volatile ptr = ::operator new(kSize);
+    ::operator delete(ptr);
+  }
+  EXPECT_EQ(budget_callback_calls, 0);
+
+  // The task picks up where it left off, on this thread or another.
+  std::thread([&] {
+    MallocExtension::SwapAllocationTaskState(task);
+    EXPECT_EQ(MallocExtension::GetAllocationContext(), 2);
+    EXPECT_EQ(MallocExtension::GetAllocationBudgetUsage(), usage);
+    for (int i = 0; i < 1024; ++i) {
+      void* volatile ptr = ::operator new(kSize);
+      ::operator delete(ptr);
+    }
+    EXPECT_EQ(budget_callback_calls, 1);
+    MallocExtension::SwapAllocationTaskState(task);
+  }).join();
+
+  MallocExtension::SetAllocationContext(0);
+  MallocExtension::SetAllocationBudgetCallback(nullptr);
+}
+
+TEST(MallocExtension, WarmUp) {
+  constexpr size_t kSize = 2048;
+  constexpr size_t kCount = 256;
+  const size_t size_class = tc_globals.sizemap().SizeClass(CppPolicy(), kSize);
+  ASSERT_NE(size_class, 0);
+  auto& transfer_cache = tc_globals.transfer_cache();
+  if (transfer_cache.GetStats(size_class).max_capacity == 0) {
+    GTEST_SKIP() << "No transfer cache";
+  }
+
+  const MallocExtension::WarmUpBucket histogram[] = {
+      {kSize, kCount},
+      // Too large for a size class, so it is reserved instead.
+      {size_t{4} << 20, 2},
+  };
+  MallocExtension::WarmUp(histogram);
+  EXPECT_GT(transfer_cache.tc_length(size_class), 0);
+  EXPECT_LE(transfer_cache.tc_length(size_class),
+            transfer_cache.GetStats(size_class).capacity);
+
+  // The warmed up objects serve allocations as usual.
+  std::vector<void*> objects;
+  for (size_t i = 0; i < kCount; ++i) {
+    objects.push_back(::operator new(kSize));
+  }
+  for (void* ptr : objects) {
+    ::operator delete(ptr, kSize);
+  }
+
+  MallocExtension::WarmUp(histogram, /*per_cpu_caches=*/true);
+}
+
 // Test that when we resize the slab repeatedly, the metadata metric is
 // positive.
 TEST(MallocExtension, DynamicSlabMallocMetadata) {
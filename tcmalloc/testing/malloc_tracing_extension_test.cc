@@ -21,6 +21,9 @@
 
 #include <stddef.h>
 
+#include <algorithm>
+#include <new>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "absl/status/status.h"
@@ -44,6 +47,13 @@ TEST(MallocTracingExtension, GetAllocatedAddressRanges) {
   ASSERT_FALSE(allocated.ok());
   EXPECT_EQ(allocated.status().code(), absl::StatusCode::kUnimplemented);
 }
+
+TEST(MallocTracingExtension, DrainAllocationTrace) {
+  absl::StatusOr<tcmalloc::malloc_tracing_extension::AllocationTrace> trace =
+      tcmalloc::malloc_tracing_extension::DrainAllocationTrace();
+  ASSERT_FALSE(trace.ok());
+  EXPECT_EQ(trace.status().code(), absl::StatusCode::kUnimplemented);
+}
 #else
 
 using ::tcmalloc::malloc_tracing_extension::AllocatedAddressRanges;
@@ -107,6 +117,50 @@ TEST(MallocTracingExtension, GetAllocatedAddressRanges) {
     }
   }
 }
+
+#ifdef MALLOC_TRACING_EXTENSION_ALLOCATION_TRACE
+using ::tcmalloc::malloc_tracing_extension::AllocationTrace;
+using ::tcmalloc::malloc_tracing_extension::AllocationTraceEvent;
+
+TEST(MallocTracingExtension, DrainAllocationTrace) {
+  constexpr size_t kSize = 123457;
+  ASSERT_TRUE(tcmalloc::malloc_tracing_extension::DrainAllocationTrace().ok());
+  void* volatile ptr = ::operator new(kSize);
+  ::operator delete(ptr, kSize);
+  absl::StatusOr<AllocationTrace> trace =
+      tcmalloc::malloc_tracing_extension::DrainAllocationTrace();
+  ASSERT_TRUE(trace.ok()) << trace.status();
+
+  std::vector<AllocationTraceEvent>& events = trace->events;
+  std::stable_sort(
+      events.begin(), events.end(),
+      [](const AllocationTraceEvent& a, const AllocationTraceEvent& b) {
+        return a.timestamp < b.timestamp;
+      });
+  auto allocation = std::find_if(
+      events.begin(), events.end(), [&](const AllocationTraceEvent& e) {
+        return e.kind == AllocationTraceEvent::Kind::kAllocation &&
+               e.size == kSize;
+      });
+  ASSERT_NE(allocation, events.end());
+  auto deallocation = std::find_if(
+      allocation, events.end(), [&](const AllocationTraceEvent& e) {
+        return e.kind == AllocationTraceEvent::Kind::kDeallocation &&
+               e.address_hash == allocation->address_hash;
+      });
+  ASSERT_NE(deallocation, events.end());
+  EXPECT_EQ(deallocation->size, kSize);
+  EXPECT_EQ(deallocation->thread, allocation->thread);
+  EXPECT_NE(allocation->thread, 0);
+}
+#else
+TEST(MallocTracingExtension, DrainAllocationTrace) {
+  absl::StatusOr<tcmalloc::malloc_tracing_extension::AllocationTrace> trace =
+      tcmalloc::malloc_tracing_extension::DrainAllocationTrace();
+  ASSERT_FALSE(trace.ok());
+  EXPECT_EQ(trace.status().code(), absl::StatusCode::kFailedPrecondition);
+}
+#endif
 #endif
 
 }  // namespace
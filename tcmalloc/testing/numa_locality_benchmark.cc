@@ -0,0 +1,197 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Measures the performance side of NUMA awareness on multi-socket hosts, which
+// numa_locality_test.cc checks the correctness of: a producer allocates and
+// fills objects that a consumer reads and frees, either on a CPU of the same
+// NUMA partition or of another one.  Reports the throughput of objects, the
+// time the consumer takes to read them and the fraction of the memory handed
+// out to the producer that is remote to it.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <new>
+#include <optional>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/optimization.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/affinity.h"
+#include "tcmalloc/internal/numa.h"
+#include "tcmalloc/internal/page_size.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/testing/testutil.h"
+
+namespace tcmalloc::tcmalloc_internal {
+namespace {
+
+// Objects passed from the producer to the consumer per run.
+constexpr size_t kObjects = size_t{1} << 21;
+// One in this many objects is checked for the node backing it.
+constexpr size_t kResidencySampling = 256;
+
+// Returns the NUMA node backing the resident page containing ptr, or
+// std::nullopt if it is unknown.
+std::optional<size_t> ResidentNode(const void* ptr) {
+  static const size_t page_size = GetPageSize();
+  uintptr_t page_addr = reinterpret_cast<uintptr_t>(ptr) & ~(page_size - 1);
+  int status = -1;
+  if (syscall(__NR_move_pages, /*pid=*/0, /*count=*/1, &page_addr,
+              /*nodes=*/nullptr, &status, /*flags=*/0) != 0 ||
+      status < 0) {
+    return std::nullopt;
+  }
+  return status;
+}
+
+// A single-producer single-consumer queue of allocations.
+class Queue {
+ public:
+  static constexpr size_t kCapacity = 1024;
+
+  void Push(std::pair<void*, size_t> item) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    while (tail - head_.load(std::memory_order_acquire) == kCapacity) {
+    }
+    items_[tail % kCapacity] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+  }
+
+  std::pair<void*, size_t> Pop() {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    while (tail_.load(std::memory_order_acquire) == head) {
+    }
+    const std::pair<void*, size_t> item = items_[head % kCapacity];
+    head_.store(head + 1, std::memory_order_release);
+    return item;
+  }
+
+ private:
+  std::array<std::pair<void*, size_t>, kCapacity> items_;
+  alignas(ABSL_CACHELINE_SIZE) std::atomic<size_t> head_{0};
+  alignas(ABSL_CACHELINE_SIZE) std::atomic<size_t> tail_{0};
+};
+
+// Returns a producer and a consumer CPU, in the same partition if !cross and in
+// different ones otherwise, or std::nullopt if there are none.
+std::optional<std::pair<int, int>> PickCpus(bool cross) {
+  const auto& topology = tc_globals.numa_topology();
+  const std::vector<int> allowed = AllowedCpus();
+  for (int producer : allowed) {
+    for (int consumer : allowed) {
+      if (producer == consumer) continue;
+      const bool same = topology.GetCpuPartition(producer) ==
+                        topology.GetCpuPartition(consumer);
+      if (same != cross) return std::make_pair(producer, consumer);
+    }
+  }
+  return std::nullopt;
+}
+
+// Passes kObjects from a producer to a consumer, in the same NUMA partition
+// if state.range(0) is 0 and across partitions otherwise.
+void BM_ProducerConsumer(benchmark::State& state) {
+  const auto& topology = tc_globals.numa_topology();
+  if (!topology.numa_aware()) {
+    state.SkipWithError("NUMA awareness is disabled");
+    return;
+  }
+  const std::optional<std::pair<int, int>> cpus = PickCpus(state.range(0));
+  if (!cpus.has_value()) {
+    state.SkipWithError("No CPUs for the placement");
+    return;
+  }
+  const size_t producer_partition = topology.GetCpuPartition(cpus->first);
+
+  // Sampled allocations are not placed by partition.
+  ScopedNeverSample never_sample;
+
+  for (auto _ : state) {
+    Queue queue;
+    size_t sampled = 0, remote = 0;
+    int64_t read_cycles = 0;
+    size_t read_bytes = 0;
+
+    std::thread producer([&] {
+      ScopedAffinityMask mask(cpus->first);
+      absl::BitGen rng;
+      for (size_t i = 0; i < kObjects; ++i) {
+        const size_t size = absl::Bernoulli(rng, 0.9)
+                                 ? absl::Uniform<size_t>(rng, 16, 1024)
+                                 : absl::Uniform<size_t>(rng, 1024, 64 << 10);
+        void* ptr = ::operator new(size);
+        memset(ptr, 42, size);
+        if (i % kResidencySampling == 0) {
+          if (std::optional<size_t> node = ResidentNode(ptr);
+              node.has_value()) {
+            ++sampled;
+            remote += NodeToPartition(*node, kNumaPartitions) !=
+                      producer_partition;
+          }
+        }
+        queue.Push({ptr, size});
+      }
+    });
+
+    std::thread consumer([&] {
+      ScopedAffinityMask mask(cpus->second);
+      uint64_t sum = 0;
+      for (size_t i = 0; i < kObjects; ++i) {
+        auto [ptr, size] = queue.Pop();
+        const int64_t start = absl::base_internal::CycleClock::Now();
+        const char* bytes = static_cast<const char*>(ptr);
+        for (size_t j = 0; j < size; j += ABSL_CACHELINE_SIZE) {
+          sum += bytes[j];
+        }
+        read_cycles += absl::base_internal::CycleClock::Now() - start;
+        read_bytes += size;
+        ::operator delete(ptr, size);
+      }
+      benchmark::DoNotOptimize(sum);
+    });
+
+    producer.join();
+    consumer.join();
+
+    state.counters["read_ns_per_kib"] =
+        read_cycles * 1e9 / absl::base_internal::CycleClock::Frequency() /
+        (read_bytes / 1024.0);
+    state.counters["remote_fraction"] =
+        sampled > 0 ? static_cast<double>(remote) / sampled : 0;
+  }
+
+  state.SetItemsProcessed(state.iterations() * kObjects);
+}
+
+BENCHMARK(BM_ProducerConsumer)
+    ->ArgName("cross_partition")
+    ->Arg(0)
+    ->Arg(1)
+    ->Iterations(1)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace tcmalloc::tcmalloc_internal
@@ -21,6 +21,7 @@
 #include <array>
 #include <atomic>
 #include <new>
+#include <set>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -30,15 +31,18 @@
 #include "absl/base/no_destructor.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
+#include "absl/numeric/bits.h"
 #include "absl/random/random.h"
 #include "absl/strings/str_cat.h"
 #include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/affinity.h"
+#include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/numa.h"
 #include "tcmalloc/internal/page_size.h"
 #include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/pages.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/testing/testutil.h"
 
@@ -54,12 +58,8 @@ namespace {
 #define TCMALLOC_TEST_DISABLE_FAKE_NUMA_FACTORY 1
 #endif
 
-// Returns the NUMA node whose memory is used to back the allocation at ptr.
-size_t BackingNode(void* const ptr) {
-  // Ensure that at least the page containing the first byte of our
-  // allocation is actually backed by physical memory by writing to it.
-  memset(ptr, 42, 1);
-
+// Returns the NUMA node whose memory backs the resident page containing ptr.
+size_t ResidentNode(const void* const ptr) {
   // The move_pages syscall expects page aligned addresses; we'll check the
   // page containing the first byte of the allocation at ptr.
   static const size_t page_size = GetPageSize();
@@ -75,6 +75,14 @@ size_t BackingNode(void* const ptr) {
   return status;
 }
 
+// Returns the NUMA node whose memory is used to back the allocation at ptr.
+size_t BackingNode(void* const ptr) {
+  // Ensure that at least the page containing the first byte of our
+  // allocation is actually backed by physical memory by writing to it.
+  memset(ptr, 42, 1);
+  return ResidentNode(ptr);
+}
+
 class FakeNumaAwareRegionFactory final : public tcmalloc::AddressRegionFactory {
  public:
   static constexpr size_t kAddrsAndHintsSize = 8;
@@ -230,6 +238,65 @@ TEST(NumaLocalityTest, AllocationsAreLocal) {
 #endif  // TCMALLOC_TEST_DISABLE_FAKE_NUMA_FACTORY
 }
 
+// Test that the spans and hugepage trackers describing memory of a NUMA
+// partition are themselves allocated on that partition.
+TEST(NumaLocalityTest, MetadataIsLocal) {
+  if (!tc_globals.numa_topology().numa_aware()) {
+    GTEST_SKIP() << "NUMA awareness is disabled";
+  }
+
+  ScopedNeverSample never_sample;
+
+  absl::BitGen gen;
+  std::vector<int> allowed = AllowedCpus();
+  for (size_t i = 0; i < 100; i++) {
+    ScopedAffinityMask mask(
+        allowed[absl::Uniform(gen, 0ul, allowed.size() - 1)]);
+
+    const size_t alloc_size = absl::Uniform(gen, 1ul, 5ul << 20);
+    void* ptr = ::operator new(alloc_size);
+    const size_t partition = NumaPartitionFromPointer(ptr);
+    const PageId p = PageIdContaining(ptr);
+    const Span* span = tc_globals.pagemap().GetDescriptor(p);
+    ASSERT_NE(span, nullptr);
+    EXPECT_EQ(NodeToPartition(ResidentNode(span), kNumaPartitions), partition);
+    if (const void* tracker = tc_globals.pagemap().GetHugepage(p)) {
+      EXPECT_EQ(NodeToPartition(ResidentNode(tracker), kNumaPartitions),
+                partition);
+    }
+    ::operator delete(ptr);
+  }
+}
+
+// Test that interleaved allocations spread their hugepages across the nodes of
+// all partitions.
+TEST(NumaLocalityTest, InterleavedAllocationsSpanNodes) {
+  constexpr size_t kHugePages = 16;
+  const size_t size = kHugePages * kHugePageSize - 1;
+  char* ptr = static_cast<char*>(MallocExtension::AllocateInterleaved(size));
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % kHugePageSize, 0);
+  memset(ptr, 42, size);
+
+  if (tc_globals.numa_topology().numa_aware()) {
+    std::set<size_t> nodes;
+    for (size_t i = 0; i < kHugePages; ++i) {
+      nodes.insert(ResidentNode(ptr + i * kHugePageSize));
+    }
+    uint64_t nodemask = 0;
+    for (size_t partition = 0;
+         partition < tc_globals.numa_topology().active_partitions();
+         ++partition) {
+      nodemask |= tc_globals.numa_topology().GetPartitionNodes(partition);
+    }
+    if (absl::popcount(nodemask) > 1) {
+      EXPECT_GT(nodes.size(), 1);
+    }
+  }
+
+  free(ptr);
+}
+
 #ifndef TCMALLOC_TEST_DISABLE_FAKE_NUMA_FACTORY
 static void install_factory() {
   // Install fake region factory to log hints for verification.
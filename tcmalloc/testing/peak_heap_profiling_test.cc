@@ -143,5 +143,29 @@ TEST(PeakHeapProfilingTest, PeakHeapTracking) {
   }
 }
 
+TEST(PeakHeapProfilingTest, WindowedPeakHeapTracking) {
+  ScopedPeakGrowthFraction s(1.25);
+  EXPECT_EQ(ProfileSize(ProfileType::kPeakHeapLastMinute), 0);
+  TCMalloc_Internal_SetWindowedPeakHeapProfiles(true);
+
+  // The windows start empty, so the first sampled allocation saves a peak.
+  void* ptr = ::operator new(100 << 20);
+  benchmark::DoNotOptimize(ptr);
+  const int64_t peak_minute = ProfileSize(ProfileType::kPeakHeapLastMinute);
+  const int64_t peak_hour = ProfileSize(ProfileType::kPeakHeapLastHour);
+  EXPECT_GE(peak_minute, 90 << 20);
+  EXPECT_GE(peak_hour, 90 << 20);
+
+  // Peaks outlive the allocations they saw.
+  ::operator delete(ptr);
+  EXPECT_EQ(ProfileSize(ProfileType::kPeakHeapLastMinute), peak_minute);
+  EXPECT_EQ(ProfileSize(ProfileType::kPeakHeapLastHour), peak_hour);
+
+  // No one minute epoch has ended yet.
+  EXPECT_TRUE(MallocExtension::SnapshotTopPeakHeaps().empty());
+
+  TCMalloc_Internal_SetWindowedPeakHeapProfiles(false);
+}
+
 }  // namespace
 }  // namespace tcmalloc
@@ -22,6 +22,7 @@
 #include <utility>
 
 #include "gtest/gtest.h"
+#include "tcmalloc/internal/parameter_accessors.h"
 
 namespace tcmalloc {
 namespace {
@@ -96,5 +97,55 @@ TEST(ReallocTest, AlignedAllocRealloc) {
   }
 }
 
+TEST(ReallocTest, GrowsHugeAllocationsByMovingPages) {
+  if (&TCMalloc_Internal_SetReallocMremap == nullptr) {
+    GTEST_SKIP() << "realloc_mremap is not supported";
+  }
+  const bool previous = TCMalloc_Internal_GetReallocMremap();
+  TCMalloc_Internal_SetReallocMremap(true);
+
+  // Whether or not the kernel lets the pages move, the contents survive.
+  size_t size = size_t{4} << 20;
+  auto buffer = static_cast<unsigned char*>(malloc(size));
+  Fill(buffer, size);
+  for (size_t new_size : {size * 3 / 2, size * 4, size * 8 + 4096}) {
+    buffer = static_cast<unsigned char*>(realloc(buffer, new_size));
+    ASSERT_NE(buffer, nullptr);
+    ExpectValid(buffer, size);
+    Fill(buffer, new_size);
+    size = new_size;
+  }
+  free(buffer);
+
+  TCMalloc_Internal_SetReallocMremap(previous);
+}
+
+TEST(ReallocTest, GeometricGrowthGetsHeadroom) {
+  if (&TCMalloc_Internal_SetReallocGrowthHeadroom == nullptr) {
+    GTEST_SKIP() << "realloc_growth_headroom is not supported";
+  }
+  const bool previous = TCMalloc_Internal_GetReallocGrowthHeadroom();
+  TCMalloc_Internal_SetReallocGrowthHeadroom(true);
+
+  // The second growth in a row gets headroom of as much again, which the third
+  // fits into.
+  size_t size = size_t{1} << 20;
+  auto buffer = static_cast<unsigned char*>(malloc(size));
+  Fill(buffer, size);
+  for (int i = 0; i < 2; ++i) {
+    buffer = static_cast<unsigned char*>(realloc(buffer, size * 2));
+    ASSERT_NE(buffer, nullptr);
+    ExpectValid(buffer, size);
+    size *= 2;
+    Fill(buffer, size);
+  }
+  auto grown = static_cast<unsigned char*>(realloc(buffer, size * 2));
+  EXPECT_EQ(grown, buffer);
+  ExpectValid(grown, size);
+  free(grown);
+
+  TCMalloc_Internal_SetReallocGrowthHeadroom(previous);
+}
+
 }  // namespace
 }  // namespace tcmalloc
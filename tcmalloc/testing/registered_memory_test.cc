@@ -0,0 +1,154 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/container/flat_hash_set.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// The ranges passed to RecordRange.  The callback runs under a TCMalloc lock,
+// so it records into a fixed array.
+constexpr int kMaxRanges = 64;
+std::pair<void*, size_t> ranges[kMaxRanges];
+int num_ranges = 0;
+
+void RecordRange(void* start, size_t size) {
+  TC_CHECK_LT(num_ranges, kMaxRanges);
+  ranges[num_ranges++] = {start, size};
+}
+
+bool IsRegistered(const void* ptr, size_t size) {
+  const uintptr_t p = reinterpret_cast<uintptr_t>(ptr);
+  for (int i = 0; i < num_ranges; ++i) {
+    const uintptr_t start = reinterpret_cast<uintptr_t>(ranges[i].first);
+    if (p >= start && p + size <= start + ranges[i].second) return true;
+  }
+  return false;
+}
+
+// Hands out exactly what is asked for, from the end of the region.
+class SimpleRegion : public AddressRegion {
+ public:
+  SimpleRegion(uintptr_t start, size_t size)
+      : start_(start), free_size_(size) {}
+
+  std::pair<void*, size_t> Alloc(size_t size, size_t alignment) override {
+    uintptr_t result = (start_ + free_size_ - size) & ~(alignment - 1);
+    if (result < start_ || result >= start_ + free_size_) return {nullptr, 0};
+    size_t actual_size = start_ + free_size_ - result;
+    free_size_ -= actual_size;
+    void* ptr = reinterpret_cast<void*>(result);
+    int err = mprotect(ptr, actual_size, PROT_READ | PROT_WRITE);
+    TC_CHECK_EQ(err, 0);
+    return {ptr, actual_size};
+  }
+
+ private:
+  uintptr_t start_;
+  size_t free_size_;
+};
+
+class SimpleRegionFactory : public AddressRegionFactory {
+ public:
+  AddressRegion* Create(void* start, size_t size, UsageHint hint) override {
+    void* region_space = MallocInternal(sizeof(SimpleRegion));
+    TC_CHECK_NE(region_space, nullptr);
+    usage_hint_ = hint;
+    return new (region_space)
+        SimpleRegion(reinterpret_cast<uintptr_t>(start), size);
+  }
+
+  UsageHint usage_hint_ = UsageHint::kNormal;
+};
+
+SimpleRegionFactory factory;
+
+class RegisteredMemoryTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    ASSERT_EQ(MallocExtension::AllocateRegistered(64), nullptr);
+    ASSERT_TRUE(
+        MallocExtension::SetRegisteredMemoryFactory(&factory, RecordRange));
+    ASSERT_FALSE(
+        MallocExtension::SetRegisteredMemoryFactory(&factory, RecordRange));
+  }
+};
+
+TEST_F(RegisteredMemoryTest, RegistersHugepagesOnce) {
+  constexpr size_t kSize = 4096;
+  const size_t per_hugepage = kHugePageSize / kSize;
+  std::vector<void*> buffers;
+  absl::flat_hash_set<void*> distinct;
+  const int ranges_before = num_ranges;
+  for (size_t i = 0; i < 2 * per_hugepage + 1; ++i) {
+    void* ptr = MallocExtension::AllocateRegistered(kSize);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % kSize, 0);
+    EXPECT_TRUE(IsRegistered(ptr, kSize));
+    EXPECT_TRUE(distinct.insert(ptr).second);
+    memset(ptr, 0xab, kSize);
+    buffers.push_back(ptr);
+  }
+  // Three hugepages, each registered once when the heap first needed it.
+  EXPECT_EQ(num_ranges - ranges_before, 3);
+  EXPECT_EQ(factory.usage_hint_,
+            AddressRegionFactory::UsageHint::kRegistered);
+
+  for (void* ptr : buffers) {
+    MallocExtension::DeallocateRegistered(ptr, kSize);
+  }
+}
+
+TEST_F(RegisteredMemoryTest, ReusesFreedBuffers) {
+  // Both sizes round up to 1 KiB.
+  void* ptr = MallocExtension::AllocateRegistered(1000);
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % 1024, 0);
+  MallocExtension::DeallocateRegistered(ptr, 1000);
+
+  const int ranges_before = num_ranges;
+  void* reused = MallocExtension::AllocateRegistered(900);
+  EXPECT_EQ(reused, ptr);
+  EXPECT_EQ(num_ranges, ranges_before);
+  MallocExtension::DeallocateRegistered(reused, 900);
+  MallocExtension::DeallocateRegistered(nullptr, 900);
+}
+
+TEST_F(RegisteredMemoryTest, LargestBuffer) {
+  void* ptr = MallocExtension::AllocateRegistered(kHugePageSize);
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % kHugePageSize, 0);
+  EXPECT_TRUE(IsRegistered(ptr, kHugePageSize));
+  MallocExtension::DeallocateRegistered(ptr, kHugePageSize);
+
+  EXPECT_EQ(MallocExtension::AllocateRegistered(kHugePageSize + 1), nullptr);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -0,0 +1,49 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+
+#include "gtest/gtest.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/system-alloc.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// The test target sets TCMALLOC_RESERVE_REGION_BYTES to 4 GiB.
+constexpr size_t kReserve = size_t{4} << 30;
+
+TEST(ReserveRegionTest, ReadsEnvironment) {
+  EXPECT_EQ(RegionReserveBytes(), kReserve);
+}
+
+// Allocations larger than kMinMmapAlloc, which would otherwise get a mapping
+// of their own, are carved from the end of the reserved region one after
+// another.
+TEST(ReserveRegionTest, CarvesLargeAllocations) {
+  const size_t size = kMinMmapAlloc + kMinMmapAlloc / 2;
+  const AddressRange first = SystemAlloc(size, kMinSystemAlloc,
+                                         MemoryTag::kSampled);
+  ASSERT_NE(first.ptr, nullptr);
+  const AddressRange second = SystemAlloc(size, kMinSystemAlloc,
+                                          MemoryTag::kSampled);
+  ASSERT_NE(second.ptr, nullptr);
+  EXPECT_EQ(static_cast<char*>(second.ptr) + second.bytes,
+            static_cast<char*>(first.ptr));
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
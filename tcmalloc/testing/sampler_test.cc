@@ -270,6 +270,68 @@ TEST(Sampler, weight_distribution) {
   }
 }
 
+TEST(SamplingBudget, GrowsWhileOverBudget) {
+  SamplingBudget budget;
+  constexpr ssize_t kMin = 2 << 20, kMax = 64 << 20;
+  budget.Update(0.01, kMin, kMax, 1000000);
+  EXPECT_EQ(budget.interval(), kMin);
+
+  // 10x over budget: the interval at most doubles per update.
+  budget.RecordCost(100000);
+  budget.Update(0.01, kMin, kMax, 1000000);
+  EXPECT_EQ(budget.interval(), 2 * kMin);
+
+  for (int i = 0; i < 10; ++i) {
+    budget.RecordCost(100000);
+    budget.Update(0.01, kMin, kMax, 1000000);
+  }
+  EXPECT_EQ(budget.interval(), kMax);
+}
+
+TEST(SamplingBudget, ConvergesToBudget) {
+  SamplingBudget budget;
+  constexpr ssize_t kMin = 1 << 20, kMax = 1 << 30;
+  // The cost of sampling is inversely proportional to the interval.
+  for (int i = 0; i < 20; ++i) {
+    budget.RecordCost((int64_t{1} << 40) / std::max(budget.interval(), kMin));
+    budget.Update(0.01, kMin, kMax, 1000000);
+  }
+  // Converges to 2^40 / 0.01 / 10^6 ~= 110 MB.
+  EXPECT_NEAR(budget.interval(), (int64_t{1} << 40) / 10000, 1 << 20);
+}
+
+TEST(SamplingBudget, ShrinksWhileUnderBudget) {
+  SamplingBudget budget;
+  constexpr ssize_t kMin = 2 << 20, kMax = 64 << 20;
+  for (int i = 0; i < 10; ++i) {
+    budget.RecordCost(1000000);
+    budget.Update(0.01, kMin, kMax, 1000000);
+  }
+  ASSERT_EQ(budget.interval(), kMax);
+
+  // Nothing was sampled: halve the interval on every update.
+  budget.Update(0.01, kMin, kMax, 1000000);
+  EXPECT_EQ(budget.interval(), kMax / 2);
+  for (int i = 0; i < 10; ++i) {
+    budget.Update(0.01, kMin, kMax, 1000000);
+  }
+  EXPECT_EQ(budget.interval(), kMin);
+}
+
+TEST(SamplingBudget, Disabled) {
+  SamplingBudget budget;
+  budget.RecordCost(1000000);
+  budget.Update(0.01, 2 << 20, 64 << 20, 1000000);
+  EXPECT_GT(budget.interval(), 0);
+
+  budget.Update(0, 2 << 20, 64 << 20, 1000000);
+  EXPECT_EQ(budget.interval(), 0);
+  // Sampling everything, or nothing, is left alone.
+  budget.RecordCost(1000000);
+  budget.Update(0.01, 1, 64 << 20, 1000000);
+  EXPECT_EQ(budget.interval(), 0);
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
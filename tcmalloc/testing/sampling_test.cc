@@ -35,6 +35,7 @@
 #include "absl/log/log.h"
 #include "absl/types/optional.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/parameter_accessors.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/testing/testutil.h"
 
@@ -283,5 +284,64 @@ TEST(Sampling, InternalFragmentation) {
               *ending_fragmentation, *ending_fragmentation * kEndingTolerance);
 }
 
+ABSL_ATTRIBUTE_NOINLINE ABSL_ATTRIBUTE_NO_TAIL_CALL void* AllocateSharedSample(
+    size_t size) {
+  void* p = ::operator new(size);
+  ::benchmark::DoNotOptimize(p);
+  return p;
+}
+
+TEST(Sampling, CompactSampledAllocations) {
+  if (&TCMalloc_Internal_SetCompactSampledAllocations == nullptr) {
+    GTEST_SKIP() << "compact_sampled_allocations is not supported";
+  }
+  const bool previous = TCMalloc_Internal_GetCompactSampledAllocations();
+  TCMalloc_Internal_SetCompactSampledAllocations(true);
+  ScopedGuardedSamplingInterval gs(-1);
+  ScopedProfileSamplingInterval s(1);
+
+  auto Property = [](const char* name) {
+    const std::optional<size_t> value =
+        MallocExtension::GetNumericProperty(name);
+    CHECK(value.has_value());
+    return *value;
+  };
+
+  static constexpr size_t kSize = 32;
+  static constexpr int kIters = 10000;
+  std::vector<void*> allocs;
+  allocs.reserve(kIters);
+  const size_t starting_pages = Property("tcmalloc.shared_sampled_pages");
+  const size_t starting_objects = Property("tcmalloc.shared_sampled_objects");
+  for (int i = 0; i < kIters; ++i) {
+    void* p = AllocateSharedSample(kSize);
+    memset(p, i, kSize);
+    allocs.push_back(p);
+  }
+  const size_t pages = Property("tcmalloc.shared_sampled_pages");
+  const size_t objects = Property("tcmalloc.shared_sampled_objects");
+
+  // The sampled objects share pages, which they do not overlap on.
+  EXPECT_GE(objects - starting_objects, kIters);
+  EXPECT_LE(pages - starting_pages, kIters / 16);
+  EXPECT_THAT(MallocExtension::GetAllocatedSize(allocs[0]),
+              testing::Optional(kSize));
+  EXPECT_EQ(CountMatchingBytes<false>(
+                "AllocateSharedSample",
+                MallocExtension::SnapshotCurrent(ProfileType::kHeap)),
+            kSize * kIters);
+
+  for (int i = 0; i < kIters; ++i) {
+    const unsigned char* p = static_cast<const unsigned char*>(allocs[i]);
+    for (size_t j = 0; j < kSize; ++j) {
+      ASSERT_EQ(p[j], static_cast<unsigned char>(i));
+    }
+    sized_delete(allocs[i], kSize);
+  }
+  EXPECT_LE(Property("tcmalloc.shared_sampled_objects"), starting_objects);
+
+  TCMalloc_Internal_SetCompactSampledAllocations(previous);
+}
+
 }  // namespace
 }  // namespace tcmalloc
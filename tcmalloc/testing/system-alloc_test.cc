@@ -123,6 +123,52 @@ TEST_F(MmapAlignedTest, LargeSizeSmallAlignment) {
   MmapAndCheck(uintptr_t{1} << kTagShift, kPageSize);
 }
 
+// Every NUMA partition has a distinct normal tag that maps back to it.
+TEST(MmapAligned, NumaPartitionTags) {
+  for (size_t partition = 0; partition < kNumaPartitions; ++partition) {
+    SCOPED_TRACE(partition);
+    const MemoryTag tag = NumaNormalTag(partition);
+    EXPECT_TRUE(IsNormalTag(tag));
+    EXPECT_EQ(NumaPartitionFromTag(tag), partition);
+
+    void* p = MmapAligned(kMinSystemAlloc, kMinSystemAlloc, tag);
+    ASSERT_NE(p, nullptr);
+    EXPECT_TRUE(IsNormalMemory(p));
+    EXPECT_EQ(GetMemoryTag(p), tag);
+    EXPECT_EQ(NumaPartitionFromPointer(p), partition);
+    EXPECT_EQ(munmap(p, kMinSystemAlloc), 0);
+  }
+
+  EXPECT_FALSE(IsNormalTag(MemoryTag::kSampled));
+  EXPECT_FALSE(IsNormalTag(MemoryTag::kCold));
+  EXPECT_FALSE(IsNormalTag(MemoryTag::kMetadata));
+}
+
+// This must run before the tests below replace the region factory.
+TEST(GiganticPages, BackAndRelease) {
+  const AddressRange range =
+      SystemAlloc(2 * kGiganticPageSize, kGiganticPageSize, MemoryTag::kNormal);
+  ASSERT_NE(range.ptr, nullptr);
+  char* start = static_cast<char*>(range.ptr);
+  const size_t before = SystemGiganticBytes();
+  const size_t backed = SystemBackGigantic(start, 2 * kGiganticPageSize);
+  if (backed == 0) {
+    GTEST_SKIP() << "No 1 GiB hugetlb pages available";
+  }
+  EXPECT_EQ(SystemGiganticBytes(), before + backed);
+
+  start[0] = 1;
+  start[backed - 1] = 1;
+  // Part of a 1 GiB page cannot be released.
+  EXPECT_FALSE(SystemRelease(start, kGiganticPageSize / 2));
+  EXPECT_EQ(SystemGiganticBytes(), before + backed);
+
+  ASSERT_TRUE(SystemRelease(start, 2 * kGiganticPageSize));
+  EXPECT_EQ(SystemGiganticBytes(), before);
+  EXPECT_EQ(start[0], 0);
+  start[0] = 1;
+}
+
 // Was SimpleRegion::Alloc invoked at least once?
 static bool simple_region_alloc_invoked = false;
 
@@ -177,6 +223,8 @@ const char* hintToString(AddressRegionFactory::UsageHint usage_hint) {
       return "kNormalNumaAwareS0";
     case UsageHint::kNormalNumaAwareS1:
       return "kNormalNumaAware";
+    case UsageHint::kRegistered:
+      return "kRegistered";
     default:
       return "unknown";
   }
@@ -14,6 +14,7 @@
 
 #include <malloc.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
@@ -21,11 +22,14 @@
 #include <cstring>
 #include <memory>
 #include <new>
+#include <optional>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include "absl/base/attributes.h"
+#include "absl/base/internal/cycleclock.h"
 #include "absl/random/random.h"
 #include "absl/synchronization/notification.h"
 #include "absl/time/clock.h"
@@ -168,6 +172,45 @@ BENCHMARK(BM_malloc_pages)
     ->Arg(1 + 20 * 1024 * 1024 / (8 * 1024))
     ->Arg(256);
 
+static void BM_calloc_free(benchmark::State& state) {
+  const size_t size = state.range(0);
+
+  for (auto s : state) {
+    void* ptr = calloc(1, size);
+    benchmark::DoNotOptimize(ptr);
+    free(ptr);
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_calloc_free)->Range(1 << 10, 64 << 20);
+
+// Measures how much zeroing large calloc'd buffers disturbs a hot working set
+// sized to fit in the last level cache, by timing reads of the working set
+// between allocations.
+static void BM_calloc_hot_working_set(benchmark::State& state) {
+  const size_t size = state.range(0);
+  const size_t kWorkingSetBytes = 4 << 20;
+  std::vector<uint64_t> working_set(kWorkingSetBytes / sizeof(uint64_t), 1);
+
+  for (auto s : state) {
+    state.PauseTiming();
+    void* ptr = calloc(1, size);
+    benchmark::DoNotOptimize(ptr);
+    state.ResumeTiming();
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < working_set.size(); i += 8) {
+      sum += working_set[i];
+    }
+    benchmark::DoNotOptimize(sum);
+
+    state.PauseTiming();
+    free(ptr);
+    state.ResumeTiming();
+  }
+}
+BENCHMARK(BM_calloc_hot_working_set)->Arg(64 << 10)->Arg(8 << 20);
+
 static void BM_random_malloc_pages(benchmark::State& state) {
   const int kMaxOnHeap = 5000;
   const int kMaxRequestSizePages = 127;
@@ -293,6 +336,14 @@ BENCHMARK(BM_get_stats_internal)
     ->Range(1, 1 << 20)
     ->Unit(benchmark::kMillisecond);
 
+static void BM_get_summary_stats(benchmark::State& state) {
+  for (auto s : state) {
+    const std::string stats = MallocExtension::GetSummaryStats();
+    benchmark::DoNotOptimize(stats);
+  }
+}
+BENCHMARK(BM_get_summary_stats);
+
 static void BM_get_stats_pageheap_lock(benchmark::State& state) {
   std::vector<std::unique_ptr<char[]>> allocations;
   const int num_allocations = state.range(0);
@@ -499,5 +550,105 @@ static void BM_get_heap_profile_while_allocating(benchmark::State& state) {
 }
 BENCHMARK(BM_get_heap_profile_while_allocating)->Range(1, 1 << 18);
 
+// Bytes allocated by the application and by TCMalloc for its metadata.
+static size_t AllocatedAndMetadataBytes() {
+  return MallocExtension::GetNumericProperty("generic.current_allocated_bytes")
+             .value_or(0) +
+         MallocExtension::GetNumericProperty("tcmalloc.metadata_bytes")
+             .value_or(0);
+}
+
+// Snapshots a profile of type state.range(0) with state.range(1) samples,
+// sampling every allocation.  Heap and peak heap profiles are of live objects,
+// allocation and lifetime profiles of objects allocated and freed since the
+// profiling started, and are collected by stopping it.
+//
+// Besides the wall and CPU time of the snapshot, reports the bytes allocated and used for
+// metadata while the profile is held, and the stalls of a thread making
+// page heap allocations, which take pageheap_lock, during snapshots.
+static void BM_snapshot_profile(benchmark::State& state) {
+  const auto type = static_cast<ProfileType>(state.range(0));
+  const int num_samples = state.range(1);
+  const bool live = type == ProfileType::kHeap || type == ProfileType::kPeakHeap;
+
+  const int64_t previous_interval =
+      MallocExtension::GetProfileSamplingInterval();
+  MallocExtension::SetProfileSamplingInterval(1);
+
+  std::vector<std::unique_ptr<char[]>> allocations;
+  auto sample_objects = [&] {
+    allocations.reserve(num_samples);
+    for (int i = 0; i < num_samples; i++) {
+      allocations.emplace_back(new char[64]);
+    }
+    if (!live) allocations.clear();
+  };
+  if (live) sample_objects();
+
+  // Allocates from the page heap while a snapshot is taken, recording the
+  // cycles of each allocation.
+  std::atomic<bool> snapshotting{false};
+  absl::Notification done;
+  std::vector<int64_t> stalls;
+  std::thread allocating_thread([&] {
+    while (!done.HasBeenNotified()) {
+      if (!snapshotting.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+        continue;
+      }
+      const int64_t start = absl::base_internal::CycleClock::Now();
+      void* ptr = ::operator new(256 << 10);
+      stalls.push_back(absl::base_internal::CycleClock::Now() - start);
+      ::operator delete(ptr);
+    }
+  });
+
+  size_t extra_bytes = 0;
+  for (auto s : state) {
+    std::optional<MallocExtension::AllocationProfilingToken> token;
+    if (!live) {
+      state.PauseTiming();
+      token = type == ProfileType::kLifetimes
+                  ? MallocExtension::StartLifetimeProfiling()
+                  : MallocExtension::StartAllocationProfiling();
+      sample_objects();
+      state.ResumeTiming();
+    }
+
+    const size_t before = AllocatedAndMetadataBytes();
+    snapshotting.store(true, std::memory_order_release);
+    Profile profile = live ? MallocExtension::SnapshotCurrent(type)
+                           : std::move(*token).Stop();
+    snapshotting.store(false, std::memory_order_release);
+    extra_bytes = std::max(extra_bytes, AllocatedAndMetadataBytes() - before);
+    benchmark::DoNotOptimize(profile);
+  }
+
+  done.Notify();
+  allocating_thread.join();
+  allocations.clear();
+  MallocExtension::SetProfileSamplingInterval(previous_interval);
+
+  std::sort(stalls.begin(), stalls.end());
+  auto stall_ns = [&](double p) {
+    if (stalls.empty()) return 0.0;
+    const size_t i =
+        std::min(stalls.size() - 1, static_cast<size_t>(p * stalls.size()));
+    return stalls[i] * 1e9 / absl::base_internal::CycleClock::Frequency();
+  };
+  state.counters["extra_bytes"] = extra_bytes;
+  state.counters["stall_p99_ns"] = stall_ns(0.99);
+  state.counters["stall_max_ns"] = stall_ns(1.0);
+}
+BENCHMARK(BM_snapshot_profile)
+    ->ArgNames({"type", "samples"})
+    ->ArgsProduct({{static_cast<int>(ProfileType::kHeap),
+                    static_cast<int>(ProfileType::kPeakHeap),
+                    static_cast<int>(ProfileType::kAllocations),
+                    static_cast<int>(ProfileType::kLifetimes)},
+                   {10000, 100000, 1000000}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
 }  // namespace
 }  // namespace tcmalloc
@@ -1171,6 +1171,29 @@ TEST(SizedDeleteTest, SizedOperatorDelete) {
   }
 }
 
+TEST(LifetimeTest, SizeReturningNewLifetime) {
+  // Small sizes use size classes, large ones the page heap, which places
+  // short-lived allocations apart from long-lived ones.
+  for (size_t size : {size_t{0}, size_t{100}, size_t{64} << 10,
+                      size_t{3} << 20}) {
+    for (lifetime_t lifetime :
+         {kShortLifetime, kMediumLifetime, kLongLifetime}) {
+      sized_ptr_t res = __size_returning_new_lifetime(size, lifetime);
+      ASSERT_NE(res.p, nullptr);
+      EXPECT_GE(res.n, size);
+      benchmark::DoNotOptimize(memset(res.p, 0xBF, res.n));
+      ::operator delete(res.p, res.n);
+
+      res = __size_returning_new_aligned_lifetime(size, std::align_val_t{64},
+                                                  lifetime);
+      ASSERT_NE(res.p, nullptr);
+      EXPECT_GE(res.n, size);
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(res.p) % 64, 0);
+      ::operator delete(res.p, res.n, std::align_val_t{64});
+    }
+  }
+}
+
 TEST(HotColdTest, HotColdNew) {
   const bool expectColdTags = tcmalloc_internal::ColdFeatureActive();
 
@@ -15,6 +15,7 @@
 #include "tcmalloc/thread_cache.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 
@@ -43,9 +44,16 @@ ABSL_CONST_INIT thread_local ThreadCache* ThreadCache::thread_local_data_
     ABSL_ATTRIBUTE_INITIAL_EXEC = nullptr;
 ABSL_CONST_INIT bool ThreadCache::tsd_inited_ = false;
 pthread_key_t ThreadCache::heap_key_;
+ABSL_CONST_INIT std::atomic<int32_t> ThreadCache::pending_activation_refills_{
+    0};
+ABSL_CONST_INIT std::atomic<bool> ThreadCache::per_cpu_cache_activation_due_{
+    false};
 
 ThreadCache::ThreadCache(pthread_t tid) {
   size_ = 0;
+  idle_check_size_ = 0;
+  misses_ = 0;
+  idle_check_misses_ = 0;
 
   max_size_ = 0;
   IncreaseCacheLimitLocked();
@@ -86,6 +94,7 @@ void ThreadCache::Cleanup() {
 void* ThreadCache::FetchFromTransferCache(size_t size_class, size_t byte_size) {
   FreeList* list = &list_[size_class];
   TC_ASSERT(list->empty());
+  ++misses_;
   const int batch_size = tc_globals.sizemap().num_objects_to_move(size_class);
 
   const int num_to_move = std::min<int>(list->max_length(), batch_size);
@@ -96,6 +105,13 @@ void* ThreadCache::FetchFromTransferCache(size_t size_class, size_t byte_size) {
     return nullptr;
   }
 
+  if (ABSL_PREDICT_FALSE(
+          pending_activation_refills_.load(std::memory_order_relaxed) > 0) &&
+      pending_activation_refills_.fetch_sub(1, std::memory_order_relaxed) ==
+          1) {
+    per_cpu_cache_activation_due_.store(true, std::memory_order_relaxed);
+  }
+
   if (--fetch_count > 0) {
     size_ += byte_size * fetch_count;
     list->PushBatch(fetch_count, batch + 1);
@@ -227,10 +243,13 @@ void ThreadCache::IncreaseCacheLimitLocked() {
     max_size_ += kStealAmount;
     return;
   }
-  // Don't hold pageheap_lock too long.  Try to steal from 10 other
-  // threads before giving up.  The i < 10 condition also prevents an
-  // infinite loop in case none of the existing thread heaps are
-  // suitable places to steal from.
+  // Don't hold pageheap_lock too long.  Look at 10 other threads, and steal
+  // from the one that missed least recently, provided that it missed no more
+  // than this thread: taking the budget of a busier thread would only move
+  // the misses to it.  The i < 10 condition also prevents an infinite loop in
+  // case none of the existing thread heaps are suitable places to steal from.
+  ThreadCache* victim = nullptr;
+  size_t victim_misses = RecentMisses();
   for (int i = 0; i < 10; ++i, next_memory_steal_ = next_memory_steal_->next_) {
     // Reached the end of the linked list.  Start at the beginning.
     if (next_memory_steal_ == nullptr) {
@@ -241,12 +260,22 @@ void ThreadCache::IncreaseCacheLimitLocked() {
         next_memory_steal_->max_size_ <= kMinThreadCacheSize) {
       continue;
     }
-    next_memory_steal_->max_size_ -= kStealAmount;
-    max_size_ += kStealAmount;
-
-    next_memory_steal_ = next_memory_steal_->next_;
-    return;
+    const size_t misses = next_memory_steal_->RecentMisses();
+    if (victim == nullptr ? misses > victim_misses : misses >= victim_misses) {
+      continue;
+    }
+    victim = next_memory_steal_;
+    victim_misses = misses;
+    if (misses == 0) {
+      // No thread is less busy than one that did not miss at all.
+      next_memory_steal_ = next_memory_steal_->next_;
+      break;
+    }
   }
+  if (victim == nullptr) return;
+
+  victim->max_size_ -= kStealAmount;
+  max_size_ += kStealAmount;
 }
 
 void ThreadCache::InitTSD() {
@@ -406,6 +435,20 @@ AllocatorStats ThreadCache::GetStats(uint64_t* total_bytes,
   return tc_globals.threadcache_allocator().stats();
 }
 
+void ThreadCache::ShrinkIdleCaches() {
+  for (ThreadCache* h = thread_heaps_; h != nullptr; h = h->next_) {
+    // Like GetStats, this reads size_ while its thread may be updating it.
+    const size_t size = h->size_;
+    if (size != 0 && size == h->idle_check_size_ &&
+        h->max_size_ > kMinThreadCacheSize) {
+      unclaimed_cache_space_ += h->max_size_ - kMinThreadCacheSize;
+      h->max_size_ = kMinThreadCacheSize;
+    }
+    h->idle_check_size_ = size;
+    h->idle_check_misses_ = h->misses_;
+  }
+}
+
 void ThreadCache::set_overall_thread_cache_size(size_t new_size) {
   // Clip the value to a reasonable minimum
   if (new_size < kMinThreadCacheSize) new_size = kMinThreadCacheSize;
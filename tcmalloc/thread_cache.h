@@ -20,6 +20,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <atomic>
+
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
@@ -71,6 +73,31 @@ class ThreadCache {
     return overall_thread_cache_size_;
   }
 
+  // Gives the budget of the thread caches whose size did not change since the
+  // last call, i.e. of threads that have likely not allocated or deallocated
+  // since, back to the unclaimed space for active threads to claim.  Such a
+  // cache returns its excess objects to the transfer cache on its next
+  // deallocation; draining it from another thread would require synchronizing
+  // its fast path.  Also starts the next interval over which the misses of the
+  // caches are compared, when deciding which cache to steal budget from.
+  static void ShrinkIdleCaches() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Defers the activation of the per-CPU caches until the thread caches have
+  // refilled from the transfer cache <refills> times, so that processes that
+  // allocate little do not pay for the per-CPU slabs.
+  static void DeferPerCpuCacheActivation(int32_t refills) {
+    pending_activation_refills_.store(refills, std::memory_order_relaxed);
+  }
+
+  // Returns true, once, after DeferPerCpuCacheActivation's refills happened.
+  // The caller then activates the per-CPU caches.
+  static bool ABSL_ATTRIBUTE_ALWAYS_INLINE TakePerCpuCacheActivation() {
+    return ABSL_PREDICT_FALSE(
+               per_cpu_cache_activation_due_.load(std::memory_order_relaxed)) &&
+           per_cpu_cache_activation_due_.exchange(false,
+                                                  std::memory_order_relaxed);
+  }
+
  private:
   // We inherit rather than include the list as a data structure to reduce
   // compiler padding.  Without inheritance, the compiler pads the list
@@ -143,6 +170,12 @@ class ThreadCache {
   // Same as above but called with pageheap_lock held.
   void IncreaseCacheLimitLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // The misses of this cache since the last ShrinkIdleCaches().  Like
+  // GetStats, this reads misses_ while its thread may be updating it.
+  size_t RecentMisses() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return misses_ - idle_check_misses_;
+  }
+
   void Scavenge();
   static ThreadCache* CreateCacheIfNecessary();
 
@@ -170,6 +203,11 @@ class ThreadCache {
   static bool tsd_inited_;
   static pthread_key_t heap_key_;
 
+  // The refills left before the per-CPU caches are activated, or 0 if their
+  // activation is not deferred.
+  ABSL_CONST_INIT static std::atomic<int32_t> pending_activation_refills_;
+  ABSL_CONST_INIT static std::atomic<bool> per_cpu_cache_activation_due_;
+
   // Linked list of heap objects.
   static ThreadCache* thread_heaps_ ABSL_GUARDED_BY(pageheap_lock);
   static int thread_heap_count_ ABSL_GUARDED_BY(pageheap_lock);
@@ -197,6 +235,12 @@ class ThreadCache {
 
   size_t size_;      // Combined size of data
   size_t max_size_;  // size_ > max_size_ --> Scavenge()
+  // size_ as of the last ShrinkIdleCaches().
+  size_t idle_check_size_ ABSL_GUARDED_BY(pageheap_lock);
+  // The refills from the transfer cache, and their number as of the last
+  // ShrinkIdleCaches().  Only written by the thread owning the cache.
+  size_t misses_;
+  size_t idle_check_misses_ ABSL_GUARDED_BY(pageheap_lock);
 
   pthread_t tid_;
   bool in_setspecific_;
@@ -22,6 +22,9 @@
 #include "absl/base/attributes.h"
 #include "absl/types/span.h"
 #include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/environment.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
@@ -30,6 +33,24 @@ namespace tcmalloc_internal {
 
 #ifndef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
 
+TransferCacheImplementation ChooseTransferCacheImplementation() {
+  const char *e = thread_safe_getenv("TCMALLOC_TRANSFER_CACHE_LOCK_FREE");
+  if (e) {
+    switch (e[0]) {
+      case '0':
+        return TransferCacheImplementation::kLegacy;
+      case '1':
+        return TransferCacheImplementation::kLockFree;
+      default:
+        TC_BUG("bad env var '%s'", e);
+    }
+  }
+
+  return Parameters::transfer_cache_lock_free()
+             ? TransferCacheImplementation::kLockFree
+             : TransferCacheImplementation::kLegacy;
+}
+
 size_t StaticForwarder::class_to_size(int size_class) {
   return tc_globals.sizemap().class_to_size(size_class);
 }
@@ -27,6 +27,7 @@
 #include "absl/base/call_once.h"
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
+#include "absl/functional/function_ref.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
 #include "tcmalloc/central_freelist.h"
@@ -51,6 +52,18 @@ namespace tcmalloc_internal {
 
 #ifndef TCMALLOC_INTERNAL_SMALL_BUT_SLOW
 
+// Selects how TransferCacheManager stores objects for each size class.
+enum class TransferCacheImplementation {
+  // TransferCache: a lock-protected LIFO slot array.
+  kLegacy,
+  // LockFreeTransferCache: a lock-free ring of batches.
+  kLockFree,
+};
+
+// Returns the implementation requested by the TCMALLOC_TRANSFER_CACHE_LOCK_FREE
+// environment variable, falling back to Parameters::transfer_cache_lock_free().
+TransferCacheImplementation ChooseTransferCacheImplementation();
+
 class StaticForwarder {
  public:
   static constexpr size_t kNumBaseClasses =
@@ -93,6 +106,10 @@ class ShardedStaticForwarder : public StaticForwarder {
     return enable_cache_for_large_classes_only_;
   }
 
+  static bool UseAdaptiveCache() {
+    return Parameters::sharded_transfer_cache_adaptive();
+  }
+
  private:
   static bool use_generic_cache_;
   static bool enable_cache_for_large_classes_only_;
@@ -136,6 +153,12 @@ class ShardedTransferCacheManagerBase {
   // node. kMinShardsAllowed is a workaround for now that hardcodes this.
   static constexpr int kMinShardsAllowed = 3;
 
+  // When the generic cache is adaptive, a size class starts out using the
+  // unsharded transfer cache and is switched over to the sharded one once it
+  // sees at least this many accesses from a different L3 shard than the
+  // previous access within one UpdateActiveSizeClasses() period.
+  static constexpr uint32_t kMinCrossShardAccessesToActivate = 64;
+
   void Init() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
     owner_->Init();
     num_shards_ = cpu_layout_->NumShards();
@@ -156,17 +179,64 @@ class ShardedTransferCacheManagerBase {
       // Finally, we enable generic sharded transfer caches only on platforms
       // that have multiple cache domains. On platforms with less than three
       // cache domains, the traditional LIFO transfer cache should suffice.
+      //
+      // In the adaptive configuration, eligible size classes are only
+      // activated once UpdateActiveSizeClasses() observes traffic crossing
+      // cache domains.
       int min_size = UseGenericCache() ? 0 : 4096;
       bool use_sharded_cache =
           UseCacheForLargeClassesOnly() ||
           (UseGenericCache() && (num_shards_ >= kMinShardsAllowed));
-      active_for_class_[size_class] =
+      eligible_for_class_[size_class] =
           use_sharded_cache && size_per_object >= min_size;
+      active_for_class_[size_class].store(
+          eligible_for_class_[size_class] && !UseAdaptiveCache(),
+          std::memory_order_relaxed);
     }
   }
 
   bool should_use(int size_class) const {
-    return active_for_class_[size_class];
+    return active_for_class_[size_class].load(std::memory_order_relaxed);
+  }
+
+  // Records an access to the unsharded transfer cache for `size_class` made
+  // on behalf of the current CPU.  This lets the adaptive configuration detect
+  // size classes whose freelists bounce between cache domains.
+  void RecordUnshardedAccess(int size_class) {
+    if (!eligible_for_class_[size_class] || should_use(size_class)) return;
+    const uint8_t shard = cpu_layout_->CpuShard(cpu_layout_->CurrentCpu());
+    ShardTraffic &traffic = traffic_[size_class];
+    if (traffic.last_shard.load(std::memory_order_relaxed) == shard) return;
+    traffic.last_shard.store(shard, std::memory_order_relaxed);
+    traffic.cross_shard_accesses.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Activates the sharded cache for eligible size classes that saw enough
+  // cross-shard traffic since the last call (or for all of them, if the
+  // adaptive configuration was turned off).  Size classes are never
+  // deactivated, as that would strand the objects cached in the shards.
+  void UpdateActiveSizeClasses() {
+    if (!UseGenericCache()) return;
+    const bool adaptive = UseAdaptiveCache();
+    for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+      if (!eligible_for_class_[size_class] || should_use(size_class)) continue;
+      const uint32_t cross_shard_accesses =
+          traffic_[size_class].cross_shard_accesses.exchange(
+              0, std::memory_order_relaxed);
+      if (!adaptive ||
+          cross_shard_accesses >= kMinCrossShardAccessesToActivate) {
+        active_for_class_[size_class].store(true, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Returns the number of size classes currently served by the sharded cache.
+  int NumActiveSizeClasses() const {
+    int active = 0;
+    for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+      active += should_use(size_class);
+    }
+    return active;
   }
 
   size_t TotalBytes() const {
@@ -220,6 +290,8 @@ class ShardedTransferCacheManagerBase {
                     : "INACTIVE");
     out->printf("Number of active sharded transfer caches: %3d\n",
                 NumActiveShards());
+    out->printf("Number of size classes using sharded transfer caches: %3d\n",
+                NumActiveSizeClasses());
     out->printf("------------------------------------------------\n");
     uint64_t sharded_cumulative_bytes = 0;
     static constexpr double MiB = 1048576.0;
@@ -255,6 +327,8 @@ class ShardedTransferCacheManagerBase {
       entry.PrintI64("max_capacity", stats.max_capacity);
     }
     region->PrintI64("active_sharded_transfer_caches", NumActiveShards());
+    region->PrintI64("active_sharded_transfer_cache_size_classes",
+                     NumActiveSizeClasses());
   }
 
   // Returns cumulative stats over all the shards of the sharded transfer cache.
@@ -287,14 +361,28 @@ class ShardedTransferCacheManagerBase {
   // All caches not touched since last attempt will return all objects
   // to the non-sharded TransferCache.
   void Plunder() {
-    if (shards_ == nullptr || num_shards_ == 0) return;
-    for (int shard = 0; shard < num_shards_; ++shard) {
-      if (!shard_initialized(shard)) continue;
-      for (int size_class = 0; size_class < kNumClasses; ++size_class) {
-        TransferCache &cache = shards_[shard].transfer_caches[size_class];
-        cache.TryPlunder(cache.freelist().size_class());
-      }
-    }
+    Plunder([](int) { return true; });
+  }
+
+  // As Plunder(), but only for the shards for which <should_plunder> returns
+  // true.
+  void Plunder(absl::FunctionRef<bool(int shard)> should_plunder) {
+    VisitPlunderable(should_plunder, [](TransferCache &cache) {
+      cache.TryPlunder(cache.freelist().size_class());
+    });
+  }
+
+  // As Plunder(), but each cache returns the objects it left unused for the
+  // idle window of <policy>, however often it is called, in bounded slices.
+  void Plunder(const internal_transfer_cache::PlunderPolicy &policy) {
+    Plunder(policy, [](int) { return true; });
+  }
+
+  void Plunder(const internal_transfer_cache::PlunderPolicy &policy,
+               absl::FunctionRef<bool(int shard)> should_plunder) {
+    VisitPlunderable(should_plunder, [&](TransferCache &cache) {
+      cache.TryPlunder(cache.freelist().size_class(), policy);
+    });
   }
 
   int tc_length(int cpu, int size_class) const {
@@ -304,6 +392,31 @@ class ShardedTransferCacheManagerBase {
     return shards_[shard].transfer_caches[size_class].tc_length();
   }
 
+  // Acquires the locks of the transfer caches of the initialized shards, for
+  // fork handlers.  Shards initialized in the meantime are left alone, and
+  // so are they by ReleaseInternalLocks.
+  void AcquireInternalLocks() {
+    for (int shard = 0; shard < num_shards_; ++shard) {
+      Shard &s = shards_[shard];
+      s.locked_for_fork = shard_initialized(shard);
+      if (!s.locked_for_fork) continue;
+      for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+        s.transfer_caches[size_class].AcquireInternalLocks();
+      }
+    }
+  }
+
+  void ReleaseInternalLocks() {
+    for (int shard = num_shards_ - 1; shard >= 0; --shard) {
+      Shard &s = shards_[shard];
+      if (!s.locked_for_fork) continue;
+      for (int size_class = kNumClasses - 1; size_class >= 0; --size_class) {
+        s.transfer_caches[size_class].ReleaseInternalLocks();
+      }
+      s.locked_for_fork = false;
+    }
+  }
+
   bool shard_initialized(int shard) const {
     if (shards_ == nullptr) return false;
     return shards_[shard].initialized.load(std::memory_order_acquire);
@@ -315,6 +428,8 @@ class ShardedTransferCacheManagerBase {
 
   bool UseGenericCache() const { return Manager::UseGenericCache(); }
 
+  bool UseAdaptiveCache() const { return Manager::UseAdaptiveCache(); }
+
   int NumActiveShards() const {
     return active_shards_.load(std::memory_order_relaxed);
   }
@@ -323,6 +438,17 @@ class ShardedTransferCacheManagerBase {
   using TransferCache =
       internal_transfer_cache::TransferCache<FreeList, Manager>;
 
+  void VisitPlunderable(absl::FunctionRef<bool(int shard)> should_plunder,
+                        absl::FunctionRef<void(TransferCache &)> f) {
+    if (shards_ == nullptr || num_shards_ == 0) return;
+    for (int shard = 0; shard < num_shards_; ++shard) {
+      if (!shard_initialized(shard) || !should_plunder(shard)) continue;
+      for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+        f(shards_[shard].transfer_caches[size_class]);
+      }
+    }
+  }
+
   // Store the transfer cache pointers and information about whether they are
   // initialized next to each other.
   struct Shard {
@@ -336,6 +462,15 @@ class ShardedTransferCacheManagerBase {
     // We need to be able to tell whether a given shard is initialized, which
     // the `once_flag` API doesn't offer.
     std::atomic<bool> initialized;
+    // Whether AcquireInternalLocks locked this shard's transfer caches.
+    bool locked_for_fork = false;
+  };
+
+  // Tracks which shard last accessed the unsharded transfer cache of a size
+  // class, and how often that changed.
+  struct ShardTraffic {
+    std::atomic<uint8_t> last_shard;
+    std::atomic<uint32_t> cross_shard_accesses;
   };
 
   struct Capacity {
@@ -343,15 +478,19 @@ class ShardedTransferCacheManagerBase {
     int max_capacity;
   };
 
+  // Capacities are sized for every eligible size class, even those that are
+  // not active yet, since shards may be initialized before a size class gets
+  // activated by UpdateActiveSizeClasses().
   Capacity LargeCacheCapacity(size_t size_class) const {
     const int size_per_object = Manager::class_to_size(size_class);
     static constexpr int k12MB = 12 << 20;
-    const int capacity = should_use(size_class) ? k12MB / size_per_object : 0;
+    const int capacity =
+        eligible_for_class_[size_class] ? k12MB / size_per_object : 0;
     return {capacity, capacity};
   }
 
   Capacity ScaledCacheCapacity(size_t size_class) const {
-    if (!should_use(size_class)) return {0, 0};
+    if (!eligible_for_class_[size_class]) return {0, 0};
     auto [capacity, max_capacity] = TransferCache::CapacityNeeded(size_class);
     return {capacity, max_capacity};
   }
@@ -391,7 +530,9 @@ class ShardedTransferCacheManagerBase {
   Shard *shards_ = nullptr;
   int num_shards_ = 0;
   std::atomic<int> active_shards_ = 0;
-  bool active_for_class_[kNumClasses] = {false};
+  bool eligible_for_class_[kNumClasses] = {false};
+  std::atomic<bool> active_for_class_[kNumClasses] = {};
+  ShardTraffic traffic_[kNumClasses] = {};
   Manager *const owner_;
   CpuLayout *const cpu_layout_;
 };
@@ -403,11 +544,34 @@ using ShardedTransferCacheManager =
 class TransferCacheManager : public StaticForwarder {
   template <typename CentralFreeList, typename Manager>
   friend class internal_transfer_cache::TransferCache;
+  template <typename CentralFreeList, typename Manager>
+  friend class internal_transfer_cache::LockFreeTransferCache;
   using TransferCache =
       internal_transfer_cache::TransferCache<tcmalloc_internal::CentralFreeList,
                                              TransferCacheManager>;
+  using LockFreeTransferCache = internal_transfer_cache::LockFreeTransferCache<
+      tcmalloc_internal::CentralFreeList, TransferCacheManager>;
+
+  // Calls `f` with the transfer cache of `size_class` for the implementation
+  // chosen in InitCaches.
+  template <typename F>
+  decltype(auto) Visit(int size_class, F f) {
+    if (implementation_ == TransferCacheImplementation::kLockFree) {
+      return f(cache_[size_class].lftc);
+    }
+    return f(cache_[size_class].tc);
+  }
+
+  template <typename F>
+  decltype(auto) Visit(int size_class, F f) const {
+    if (implementation_ == TransferCacheImplementation::kLockFree) {
+      return f(cache_[size_class].lftc);
+    }
+    return f(cache_[size_class].tc);
+  }
 
   friend class FakeMultiClassTransferCacheManager;
+  friend class FakeMultiClassLockFreeTransferCacheManager;
 
  public:
   constexpr TransferCacheManager() = default;
@@ -420,30 +584,37 @@ class TransferCacheManager : public StaticForwarder {
   }
 
   void InsertRange(int size_class, absl::Span<void *> batch) {
-    cache_[size_class].tc.InsertRange(size_class, batch);
+    Visit(size_class,
+          [&](auto &cache) { cache.InsertRange(size_class, batch); });
   }
 
   ABSL_MUST_USE_RESULT int RemoveRange(int size_class,
                                        absl::Span<void *> batch) {
-    return cache_[size_class].tc.RemoveRange(size_class, batch);
+    return Visit(size_class, [&](auto &cache) {
+      return cache.RemoveRange(size_class, batch);
+    });
   }
 
   // This is not const because the underlying ring-buffer transfer cache
   // function requires acquiring a lock.
   size_t tc_length(int size_class) const {
-    return cache_[size_class].tc.tc_length();
+    return Visit(size_class, [](auto &cache) { return cache.tc_length(); });
   }
 
   TransferCacheStats GetStats(int size_class) const {
-    return cache_[size_class].tc.GetStats();
+    return Visit(size_class, [](auto &cache) { return cache.GetStats(); });
   }
 
   CentralFreeList &central_freelist(int size_class) {
-    return cache_[size_class].tc.freelist();
+    return Visit(size_class, [](auto &cache) -> CentralFreeList & {
+      return cache.freelist();
+    });
   }
 
   bool CanIncreaseCapacity(int size_class) const {
-    return cache_[size_class].tc.CanIncreaseCapacity(size_class);
+    return Visit(size_class, [&](auto &cache) {
+      return cache.CanIncreaseCapacity(size_class);
+    });
   }
 
   // We try to grow up to 10% of the total number of size classes during one
@@ -463,26 +634,89 @@ class TransferCacheManager : public StaticForwarder {
   // the previous plunder.
   void TryPlunder() {
     for (int size_class = 0; size_class < kNumClasses; ++size_class) {
-      cache_[size_class].tc.TryPlunder(size_class);
+      Visit(size_class, [&](auto &cache) { cache.TryPlunder(size_class); });
+    }
+  }
+
+  // As TryPlunder(), but paced by <policy> rather than by how often it is
+  // called.
+  void TryPlunder(const internal_transfer_cache::PlunderPolicy &policy) {
+    for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+      Visit(size_class,
+            [&](auto &cache) { cache.TryPlunder(size_class, policy); });
     }
   }
 
-  void InitCaches() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+  // Acquires the locks of every transfer cache, then of every central
+  // freelist, which is the order they nest in, for fork handlers.
+  void AcquireInternalLocks() {
+    for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+      Visit(size_class, [](auto &cache) { cache.AcquireInternalLocks(); });
+    }
+    for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+      central_freelist(size_class).AcquireInternalLocks();
+    }
+  }
+
+  void ReleaseInternalLocks() {
+    for (int size_class = kNumClasses - 1; size_class >= 0; --size_class) {
+      central_freelist(size_class).ReleaseInternalLocks();
+    }
+    for (int size_class = kNumClasses - 1; size_class >= 0; --size_class) {
+      Visit(size_class, [](auto &cache) { cache.ReleaseInternalLocks(); });
+    }
+  }
+
+  void InitCaches(TransferCacheImplementation implementation =
+                      ChooseTransferCacheImplementation())
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    implementation_ = implementation;
     for (int i = 0; i < kNumClasses; ++i) {
-      new (&cache_[i].tc) TransferCache(this, i);
+      switch (implementation_) {
+        case TransferCacheImplementation::kLegacy:
+          new (&cache_[i].tc) TransferCache(this, i);
+          break;
+        case TransferCacheImplementation::kLockFree:
+          new (&cache_[i].lftc) LockFreeTransferCache(this, i);
+          break;
+      }
     }
   }
 
   bool ShrinkCache(int size_class) {
-    return cache_[size_class].tc.ShrinkCache(size_class);
+    return Visit(size_class,
+                 [&](auto &cache) { return cache.ShrinkCache(size_class); });
   }
 
   bool IncreaseCacheCapacity(int size_class) {
-    return cache_[size_class].tc.IncreaseCacheCapacity(size_class);
+    return Visit(size_class, [&](auto &cache) {
+      return cache.IncreaseCacheCapacity(size_class);
+    });
+  }
+
+  // Grows or shrinks the capacity of <size_class> a batch at a time to within
+  // a batch of <capacity>, such as a capacity an earlier process learned.
+  // Capacity beyond the maximum capacity of the cache is ignored.
+  void SetCapacity(int size_class, size_t capacity) {
+    const size_t n = num_objects_to_move(size_class);
+    if (n == 0) return;
+    while (GetStats(size_class).capacity + n <= capacity &&
+           IncreaseCacheCapacity(size_class)) {
+    }
+    while (GetStats(size_class).capacity >= capacity + n &&
+           ShrinkCache(size_class)) {
+    }
   }
 
   size_t FetchCommitIntervalMisses(int size_class) {
-    return cache_[size_class].tc.FetchCommitIntervalMisses();
+    const bool predictive = Parameters::transfer_cache_predictive_resize();
+    return Visit(size_class, [&](auto &cache) {
+      return cache.FetchCommitIntervalMisses(predictive);
+    });
+  }
+
+  TransferCacheImplementation implementation() const {
+    return implementation_;
   }
 
   void Print(Printer *out) const {
@@ -491,6 +725,10 @@ class TransferCacheManager : public StaticForwarder {
     out->printf("of the transfer cache freelists.\n");
     out->printf("It also reports insert/remove hits/misses by size class.\n");
     out->printf("------------------------------------------------\n");
+    out->printf("Transfer cache implementation: %s\n",
+                implementation_ == TransferCacheImplementation::kLockFree
+                    ? "LOCK_FREE"
+                    : "LEGACY");
     uint64_t cumulative_bytes = 0;
     static constexpr double MiB = 1048576.0;
     for (int size_class = 1; size_class < kNumClasses; ++size_class) {
@@ -502,16 +740,20 @@ class TransferCacheManager : public StaticForwarder {
           " objs; %5.1f MiB; %6.1f cum MiB; %5u capacity; %5u"
           " max_capacity; %8u insert hits; %8u"
           " insert misses (%10lu object misses); %8u remove hits;"
-          " %8u remove misses (%10lu object misses);\n",
+          " %8u remove misses (%10lu object misses); %8u interval object"
+          " misses (%8u forecast);\n",
           size_class, class_to_size(size_class), tc_stats.used,
           class_bytes / MiB, cumulative_bytes / MiB, tc_stats.capacity,
           tc_stats.max_capacity, tc_stats.insert_hits, tc_stats.insert_misses,
           tc_stats.insert_object_misses, tc_stats.remove_hits,
-          tc_stats.remove_misses, tc_stats.remove_object_misses);
+          tc_stats.remove_misses, tc_stats.remove_object_misses,
+          tc_stats.interval_object_misses, tc_stats.forecast_object_misses);
     }
   }
 
   void PrintInPbtxt(PbtxtRegion *region) const {
+    region->PrintBool("transfer_cache_lock_free",
+                      implementation_ == TransferCacheImplementation::kLockFree);
     for (int size_class = 1; size_class < kNumClasses; ++size_class) {
       PbtxtRegion entry = region->CreateSubRegion("transfer_cache");
       const TransferCacheStats tc_stats = GetStats(size_class);
@@ -522,6 +764,10 @@ class TransferCacheManager : public StaticForwarder {
       entry.PrintI64("remove_hits", tc_stats.remove_hits);
       entry.PrintI64("remove_misses", tc_stats.remove_misses);
       entry.PrintI64("remove_object_misses", tc_stats.remove_object_misses);
+      entry.PrintI64("interval_object_misses",
+                     tc_stats.interval_object_misses);
+      entry.PrintI64("forecast_object_misses",
+                     tc_stats.forecast_object_misses);
       entry.PrintI64("used", tc_stats.used);
       entry.PrintI64("capacity", tc_stats.capacity);
       entry.PrintI64("max_capacity", tc_stats.max_capacity);
@@ -534,9 +780,12 @@ class TransferCacheManager : public StaticForwarder {
     ~Cache() {}
 
     TransferCache tc;
+    LockFreeTransferCache lftc;
     bool dummy;
   };
   Cache cache_[kNumClasses];
+  TransferCacheImplementation implementation_ =
+      TransferCacheImplementation::kLegacy;
 } ABSL_CACHELINE_ALIGNED;
 
 #else
@@ -567,6 +816,8 @@ class TransferCacheManager {
 
   static constexpr TransferCacheStats GetStats(int size_class) { return {}; }
 
+  static constexpr void SetCapacity(int size_class, size_t capacity) {}
+
   const CentralFreeList& central_freelist(int size_class) const {
     return freelist_[size_class];
   }
@@ -575,6 +826,18 @@ class TransferCacheManager {
     return freelist_[size_class];
   }
 
+  void AcquireInternalLocks() {
+    for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+      freelist_[size_class].AcquireInternalLocks();
+    }
+  }
+
+  void ReleaseInternalLocks() {
+    for (int size_class = kNumClasses - 1; size_class >= 0; --size_class) {
+      freelist_[size_class].ReleaseInternalLocks();
+    }
+  }
+
   void Print(Printer* out) const {}
   void PrintInPbtxt(PbtxtRegion* region) const {}
 
@@ -595,6 +858,11 @@ struct ShardedTransferCacheManager {
   static constexpr void InsertRange(int size_class, absl::Span<void*> batch) {}
   static constexpr size_t TotalBytes() { return 0; }
   static constexpr void Plunder() {}
+  static void Plunder(absl::FunctionRef<bool(int shard)> should_plunder) {}
+  static constexpr void RecordUnshardedAccess(int size_class) {}
+  static constexpr void UpdateActiveSizeClasses() {}
+  static constexpr void AcquireInternalLocks() {}
+  static constexpr void ReleaseInternalLocks() {}
   static int tc_length(int cpu, int size_class) { return 0; }
   static int TotalObjectsOfClass(int size_class) { return 0; }
   static constexpr TransferCacheStats GetStats(int size_class) { return {}; }
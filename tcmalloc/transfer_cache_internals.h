@@ -24,18 +24,26 @@
 #include <atomic>
 #include <cstddef>
 #include <cstring>
+#include <limits>
+#include <new>
 
 #include "absl/base/attributes.h"
 #include "absl/base/const_init.h"
+#include "absl/base/internal/cycleclock.h"
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
+#include "absl/numeric/bits.h"
+#include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/allocation_guard.h"
 #include "tcmalloc/internal/atomic_stats_counter.h"
+#include "tcmalloc/internal/clock.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/prefetch.h"
+#include "tcmalloc/internal/timeseries_tracker.h"
 #include "tcmalloc/transfer_cache_stats.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
@@ -74,6 +82,109 @@ class MissCounts {
   std::atomic<size_t> total_committed_ = {0};
 };
 
+// Returns the misses expected in the interval following history[0], where
+// history[i] holds the misses incurred i intervals ago, if misses repeat with
+// a period.  Returns 0 if no period predicts the history at least twice as
+// well as the previous interval does (the reactive resizing already covers
+// that case).
+inline size_t ForecastPeriodicMisses(absl::Span<const size_t> history) {
+  const size_t n = history.size();
+  if (n < 4) return 0;
+  // Mean absolute error of predicting each interval by the one <period>
+  // intervals before it.
+  auto error = [&](size_t period) {
+    double sum = 0;
+    for (size_t i = 0; i + period < n; ++i) {
+      sum += history[i] > history[i + period]
+                 ? history[i] - history[i + period]
+                 : history[i + period] - history[i];
+    }
+    return sum / (n - period);
+  };
+  const double reactive_error = error(1);
+  size_t best_period = 0;
+  double best_error = reactive_error;
+  // The period must repeat at least twice within the history.
+  for (size_t period = 2; period <= n / 2; ++period) {
+    const double e = error(period);
+    if (e < best_error) {
+      best_period = period;
+      best_error = e;
+    }
+  }
+  if (best_period == 0 || 2 * best_error > reactive_error) return 0;
+  return history[best_period - 1];
+}
+
+// Keeps the misses of a transfer cache per resize interval and forecasts those
+// of the next interval with ForecastPeriodicMisses.
+class MissForecaster {
+ public:
+  // Each epoch covers one resize interval, which lasts 2 background intervals
+  // of 1s by default.
+  static constexpr size_t kEpochs = 16;
+  static constexpr absl::Duration kEpochLength = absl::Seconds(2);
+
+  MissForecaster()
+      : MissForecaster(Clock{.now = absl::base_internal::CycleClock::Now,
+                             .freq = absl::base_internal::CycleClock::Frequency}) {
+  }
+
+  // For testing with mock clock.
+  explicit MissForecaster(Clock clock)
+      : tracker_(clock, kEpochs * kEpochLength) {}
+
+  // Records the misses of the interval that just ended, and returns those
+  // forecast for the next one.  Not thread-safe.
+  size_t Update(size_t misses) {
+    last_forecast_.store(forecast_, std::memory_order_relaxed);
+    last_misses_.store(misses, std::memory_order_relaxed);
+    tracker_.Report(misses);
+    size_t history[kEpochs];
+    tracker_.IterBackwards(
+        [&](size_t offset, int64_t, const Entry &e) {
+          history[offset] = e.misses;
+        },
+        kEpochs);
+    forecast_ = ForecastPeriodicMisses(history);
+    return forecast_;
+  }
+
+  // Returns the misses of the last completed interval, and those that had been
+  // forecast for it.
+  size_t last_misses() const {
+    return last_misses_.load(std::memory_order_relaxed);
+  }
+  size_t last_forecast() const {
+    return last_forecast_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Entry {
+    size_t misses = 0;
+
+    static Entry Nil() { return Entry(); }
+    void Report(size_t n) { misses += n; }
+    bool empty() const { return misses == 0; }
+  };
+
+  TimeSeriesTracker<Entry, size_t, kEpochs> tracker_;
+  size_t forecast_ = 0;
+  std::atomic<size_t> last_misses_ = {0};
+  std::atomic<size_t> last_forecast_ = {0};
+};
+
+// Paces plunders independently of how often TryPlunder is called.  A cache
+// returns the objects it did not hand out over a window of at least <idle>
+// ticks, when that window ends, and at most <max_batches> batches per call,
+// leaving the rest to the following calls so as to bound how long its lock is
+// held and how much work a call does.
+struct PlunderPolicy {
+  int64_t now;
+  int64_t idle;
+  int max_batches;
+};
+
 // TransferCache is used to cache transfers of
 // sizemap.num_objects_to_move(size_class) back and forth between
 // thread caches and the central cache for a given size class.
@@ -186,6 +297,8 @@ class TransferCache {
     TC_ASSERT_LE(batch.size(), kMaxObjectsToMove);
     auto info = slot_info_.load(std::memory_order_relaxed);
     if (info.used) {
+      PrefetchSlots(info.used - std::min<int>(batch.size(), info.used),
+                    info.used);
       AllocationGuardSpinLockHolder h(&lock_);
       // Refetch with the lock
       info = slot_info_.load(std::memory_order_relaxed);
@@ -213,41 +326,62 @@ class TransferCache {
     if (max_capacity_ == 0) return;
     if (!lock_.TryLock()) return;
 
-    int to_return = low_water_mark_;
-    SizeInfo info = GetSlotInfo();
-    TC_ASSERT_LE(to_return, info.used);
+    plunder_pending_ = low_water_mark_;
+    TC_ASSERT_LE(plunder_pending_, GetSlotInfo().used);
     // Make sure to record number of used objects in the cache in the low water
     // mark at the start of each plunder. If we plunder objects below, we record
     // the new value of info.used in the low water mark as we progress.
-    low_water_mark_ = info.used;
-    while (true) {
-      info = GetSlotInfo();
-      const int B = Manager::num_objects_to_move(size_class);
-      const size_t num_to_move = std::min({B, info.used, to_return});
-      if (num_to_move == 0) break;
-
-      void *buf[kMaxObjectsToMove];
-      void **const entry = GetSlot(info.used - num_to_move);
-      memcpy(buf, entry, sizeof(void *) * num_to_move);
-      info.used -= num_to_move;
-      to_return -= num_to_move;
-      low_water_mark_ = info.used;
-      SetSlotInfo(info);
+    low_water_mark_ = GetSlotInfo().used;
+    plunder_window_start_ = 0;
+    if (ReturnPending(size_class, std::numeric_limits<int>::max())) {
       lock_.Unlock();
+    }
+  }
 
-      freelist().InsertRange({buf, num_to_move});
-      if (!lock_.TryLock()) return;
+  // As TryPlunder(size_class), but measures the window over which objects must
+  // stay unused to be returned, and bounds the work, with <policy>.
+  void TryPlunder(int size_class, const PlunderPolicy &policy)
+      ABSL_LOCKS_EXCLUDED(lock_) {
+    if (max_capacity_ == 0) return;
+    if (!lock_.TryLock()) return;
+
+    // Objects handed out since the window ended were not idle after all.
+    plunder_pending_ = std::min(plunder_pending_, low_water_mark_);
+    if (plunder_pending_ == 0) {
+      if (policy.now - plunder_window_start_ < policy.idle) {
+        lock_.Unlock();
+        return;
+      }
+      plunder_pending_ = low_water_mark_;
+      low_water_mark_ = GetSlotInfo().used;
+      plunder_window_start_ = policy.now;
+    }
+    if (ReturnPending(size_class, policy.max_batches)) {
+      lock_.Unlock();
     }
+  }
+
+  // Acquires and releases lock_ around fork(), so that a child does not
+  // inherit it held by a thread that only exists in the parent.
+  void AcquireInternalLocks() ABSL_NO_THREAD_SAFETY_ANALYSIS { lock_.Lock(); }
+  void ReleaseInternalLocks() ABSL_NO_THREAD_SAFETY_ANALYSIS {
     lock_.Unlock();
   }
+
   // Returns the number of free objects in the transfer cache.
   size_t tc_length() const {
     return static_cast<size_t>(slot_info_.load(std::memory_order_relaxed).used);
   }
 
   // Fetches the misses for the latest interval and commits them to the total.
-  size_t FetchCommitIntervalMisses() ABSL_LOCKS_EXCLUDED(lock_) {
-    return insert_object_misses_.Commit() + remove_object_misses_.Commit();
+  // With <predictive>, returns the larger of those and the misses forecast for
+  // the next interval.
+  size_t FetchCommitIntervalMisses(bool predictive = false)
+      ABSL_LOCKS_EXCLUDED(lock_) {
+    const size_t misses =
+        insert_object_misses_.Commit() + remove_object_misses_.Commit();
+    const size_t forecast = forecaster_.Update(misses);
+    return predictive ? std::max(misses, forecast) : misses;
   }
 
   // Returns the number of transfer cache insert/remove hits/misses.
@@ -260,6 +394,8 @@ class TransferCache {
     stats.insert_object_misses = insert_object_misses_.Total();
     stats.remove_misses = remove_misses_.value();
     stats.remove_object_misses = remove_object_misses_.Total();
+    stats.interval_object_misses = forecaster_.last_misses();
+    stats.forecast_object_misses = forecaster_.last_forecast();
 
     auto info = slot_info_.load(std::memory_order_relaxed);
     stats.used = info.used;
@@ -355,6 +491,18 @@ class TransferCache {
     return slots_ + i;
   }
 
+  // Prefetches slots [begin, end), so that they are fetched, typically from
+  // the cache of the CPU that inserted them, while the lock is acquired.
+  // slots_ is only assigned on construction, so this needs no lock.
+  void PrefetchSlots(size_t begin, size_t end) ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    constexpr uintptr_t kLineMask = ABSL_CACHELINE_SIZE - 1;
+    const uintptr_t last = reinterpret_cast<uintptr_t>(slots_ + end) - 1;
+    for (uintptr_t p = reinterpret_cast<uintptr_t>(slots_ + begin) & ~kLineMask;
+         p <= last; p += ABSL_CACHELINE_SIZE) {
+      PrefetchT0(reinterpret_cast<const void *>(p));
+    }
+  }
+
   void SetSlotInfo(SizeInfo info) {
     TC_ASSERT_LE(0, info.used);
     TC_ASSERT_LE(info.used, info.capacity);
@@ -362,6 +510,35 @@ class TransferCache {
     slot_info_.store(info, std::memory_order_relaxed);
   }
 
+  // Returns up to plunder_pending_ objects, in at most <max_batches> batches,
+  // to the freelist, dropping lock_ around each insertion.  Returns whether
+  // lock_ is still held, as it is given up if it cannot be reacquired at once.
+  bool ReturnPending(int size_class, int max_batches)
+      ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    const int B = Manager::num_objects_to_move(size_class);
+    for (; max_batches > 0; --max_batches) {
+      SizeInfo info = GetSlotInfo();
+      const size_t num_to_move = std::min({B, info.used, plunder_pending_});
+      if (num_to_move == 0) {
+        plunder_pending_ = 0;
+        break;
+      }
+
+      void *buf[kMaxObjectsToMove];
+      void **const entry = GetSlot(info.used - num_to_move);
+      memcpy(buf, entry, sizeof(void *) * num_to_move);
+      info.used -= num_to_move;
+      plunder_pending_ -= num_to_move;
+      low_water_mark_ = std::min(low_water_mark_, info.used);
+      SetSlotInfo(info);
+      lock_.Unlock();
+
+      freelist().InsertRange({buf, num_to_move});
+      if (!lock_.TryLock()) return false;
+    }
+    return true;
+  }
+
   // Note: lock_ must be appear first (see b/313914119).
   // The lock and the associated member variables that are accessed when the
   // spinlock is acquired are placed together on the same cache line for cache
@@ -377,6 +554,12 @@ class TransferCache {
   // again.
   int low_water_mark_ ABSL_GUARDED_BY(lock_);
 
+  // Objects found idle by the last plunder that are still to be returned, and
+  // the start, in ticks, of the window over which low_water_mark_ is tracked
+  // for TryPlunder with a PlunderPolicy.
+  int plunder_pending_ ABSL_GUARDED_BY(lock_) = 0;
+  int64_t plunder_window_start_ ABSL_GUARDED_BY(lock_) = 0;
+
   // insert_hits_ and remove_hits_ are logically guarded by lock_ for mutations
   // and use LossyAdd, but the thread annotations cannot indicate that we do not
   // need a lock for reads.
@@ -409,6 +592,417 @@ class TransferCache {
 
   MissCounts insert_object_misses_;
   MissCounts remove_object_misses_;
+  MissForecaster forecaster_;
+} ABSL_CACHELINE_ALIGNED;
+
+// LockFreeTransferCache is an alternative to TransferCache that does not
+// serialize InsertRange/RemoveRange on a lock.  Batches are stored in a
+// bounded multi-producer/multi-consumer ring (each cell holds one batch of up
+// to num_objects_to_move objects) with per-cell sequence numbers, so producers
+// and consumers only contend on the ring's head and tail positions.
+//
+// Unlike TransferCache, batches are handed out in FIFO order.  A RemoveRange
+// that is smaller than the oldest batch splits it and puts the remainder back
+// at the tail of the ring.  Capacity is still accounted in objects through
+// slot_info_, so the same resizing, plundering and statistics apply to both
+// implementations.
+template <typename CentralFreeList, typename TransferCacheManager>
+class LockFreeTransferCache {
+ public:
+  using Manager = TransferCacheManager;
+  using FreeList = CentralFreeList;
+  using Capacity =
+      typename TransferCache<CentralFreeList, TransferCacheManager>::Capacity;
+
+  LockFreeTransferCache(Manager *owner, int size_class)
+      : LockFreeTransferCache(owner, size_class, CapacityNeeded(size_class)) {}
+
+  LockFreeTransferCache(Manager *owner, int size_class, Capacity capacity)
+      : slot_info_(SizeInfo({0, capacity.capacity})),
+        low_water_mark_(0),
+        batch_size_(size_class > 0 ? Manager::num_objects_to_move(size_class)
+                                   : 0),
+        freelist_do_not_access_directly_(),
+        owner_(owner),
+        max_capacity_(capacity.max_capacity) {
+    freelist().Init(size_class);
+    if (max_capacity_ == 0 || batch_size_ == 0) return;
+
+    // Allow for some partial batches on top of max_capacity_ objects worth of
+    // full batches.
+    num_cells_ = absl::bit_ceil(
+        2 * static_cast<size_t>((max_capacity_ + batch_size_ - 1) /
+                                batch_size_));
+    cells_ = reinterpret_cast<Cell *>(
+        owner_->Alloc(num_cells_ * sizeof(Cell),
+                      std::align_val_t{alignof(Cell)}));
+    objects_ = reinterpret_cast<void **>(
+        owner_->Alloc(num_cells_ * batch_size_ * sizeof(void *)));
+    for (size_t i = 0; i < num_cells_; ++i) {
+      new (&cells_[i]) Cell;
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  LockFreeTransferCache(const LockFreeTransferCache &) = delete;
+  LockFreeTransferCache &operator=(const LockFreeTransferCache &) = delete;
+
+  static Capacity CapacityNeeded(int size_class) {
+    return TransferCache<CentralFreeList, Manager>::CapacityNeeded(size_class);
+  }
+
+  // Insert the specified batch into the transfer cache.
+  void InsertRange(int size_class, absl::Span<void *> batch) {
+    TC_ASSERT(0 < batch.size() && batch.size() <= kMaxObjectsToMove);
+    bool hit = false;
+    while (!batch.empty()) {
+      const size_t n = std::min<size_t>(batch.size(), batch_size_);
+      if (n == 0 || !Push(batch.subspan(batch.size() - n))) break;
+      batch.remove_suffix(n);
+      hit = true;
+    }
+    if (hit) insert_hits_.Add(1);
+    if (batch.empty()) return;
+
+    insert_misses_.LossyAdd(1);
+    insert_object_misses_.Inc(batch.size());
+
+    freelist().InsertRange(batch);
+  }
+
+  // Returns the actual number of fetched elements and stores elements in the
+  // batch.
+  ABSL_MUST_USE_RESULT int RemoveRange(int size_class,
+                                       const absl::Span<void *> batch) {
+    TC_ASSERT(!batch.empty());
+    TC_ASSERT_LE(batch.size(), kMaxObjectsToMove);
+    size_t got = 0;
+    while (got < batch.size()) {
+      const int n = Pop(batch.subspan(got));
+      if (n == 0) break;
+      got += n;
+    }
+    if (got > 0) {
+      remove_hits_.Add(1);
+      return got;
+    }
+
+    remove_misses_.LossyAdd(1);
+    remove_object_misses_.Inc(batch.size());
+    return freelist().RemoveRange(batch);
+  }
+
+  // Returns objects that stayed in the cache since the previous call to the
+  // freelist, like TransferCache::TryPlunder.
+  void TryPlunder(int size_class) {
+    if (max_capacity_ == 0) return;
+
+    plunder_pending_.store(
+        low_water_mark_.exchange(GetSlotInfo().used,
+                                 std::memory_order_relaxed),
+        std::memory_order_relaxed);
+    plunder_window_start_.store(0, std::memory_order_relaxed);
+    ReturnPending(std::numeric_limits<int>::max());
+  }
+
+  // As TransferCache::TryPlunder(size_class, policy).  Concurrent plunders
+  // may return a few objects too many, which only costs a refill.
+  void TryPlunder(int size_class, const PlunderPolicy &policy) {
+    if (max_capacity_ == 0) return;
+
+    int pending = std::min(plunder_pending_.load(std::memory_order_relaxed),
+                           low_water_mark_.load(std::memory_order_relaxed));
+    if (pending == 0) {
+      if (policy.now - plunder_window_start_.load(std::memory_order_relaxed) <
+          policy.idle) {
+        plunder_pending_.store(0, std::memory_order_relaxed);
+        return;
+      }
+      pending = low_water_mark_.exchange(GetSlotInfo().used,
+                                         std::memory_order_relaxed);
+      plunder_window_start_.store(policy.now, std::memory_order_relaxed);
+    }
+    plunder_pending_.store(pending, std::memory_order_relaxed);
+    ReturnPending(policy.max_batches);
+  }
+
+  // Returns the number of free objects in the transfer cache.
+  size_t tc_length() const {
+    return static_cast<size_t>(GetSlotInfo().used);
+  }
+
+  // Fetches the misses for the latest interval and commits them to the total.
+  // With <predictive>, returns the larger of those and the misses forecast for
+  // the next interval.
+  size_t FetchCommitIntervalMisses(bool predictive = false) {
+    const size_t misses =
+        insert_object_misses_.Commit() + remove_object_misses_.Commit();
+    const size_t forecast = forecaster_.Update(misses);
+    return predictive ? std::max(misses, forecast) : misses;
+  }
+
+  // Returns the number of transfer cache insert/remove hits/misses.
+  // The cache has no locks to hold around fork().
+  static void AcquireInternalLocks() {}
+  static void ReleaseInternalLocks() {}
+
+  TransferCacheStats GetStats() const {
+    TransferCacheStats stats;
+
+    stats.insert_hits = insert_hits_.value();
+    stats.remove_hits = remove_hits_.value();
+    stats.insert_misses = insert_misses_.value();
+    stats.insert_object_misses = insert_object_misses_.Total();
+    stats.remove_misses = remove_misses_.value();
+    stats.remove_object_misses = remove_object_misses_.Total();
+    stats.interval_object_misses = forecaster_.last_misses();
+    stats.forecast_object_misses = forecaster_.last_forecast();
+
+    auto info = GetSlotInfo();
+    stats.used = info.used;
+    stats.capacity = info.capacity;
+    stats.max_capacity = max_capacity_;
+
+    return stats;
+  }
+
+  SizeInfo GetSlotInfo() const {
+    return slot_info_.load(std::memory_order_relaxed);
+  }
+
+  // Increases capacity of the cache by a batch size. Returns true if it
+  // succeeded at growing the cache by a batch size. Else, returns false.
+  bool IncreaseCacheCapacity(int size_class) {
+    const int n = Manager::num_objects_to_move(size_class);
+    SizeInfo info = GetSlotInfo();
+    do {
+      if (info.capacity + n > max_capacity_) return false;
+    } while (!slot_info_.compare_exchange_weak(
+        info, SizeInfo({info.used, info.capacity + n}),
+        std::memory_order_relaxed));
+    return true;
+  }
+
+  // Checks if the cache capacity may be increased by a batch size.
+  bool CanIncreaseCapacity(int size_class) const {
+    int n = Manager::num_objects_to_move(size_class);
+    auto info = GetSlotInfo();
+    return max_capacity_ - info.capacity >= n;
+  }
+
+  // Checks if the cache has at least batch size number of free slots.
+  bool HasSpareCapacity(int size_class) const {
+    int n = Manager::num_objects_to_move(size_class);
+    auto info = GetSlotInfo();
+    return info.capacity - info.used >= n;
+  }
+
+  // Tries to shrink the Cache by a batch size.  Objects that no longer fit are
+  // returned to the freelist.  Returns false if it failed to shrink the cache.
+  bool ShrinkCache(int size_class) {
+    const int n = Manager::num_objects_to_move(size_class);
+    SizeInfo info = GetSlotInfo();
+    do {
+      if (info.capacity <= n) return false;
+    } while (!slot_info_.compare_exchange_weak(
+        info, SizeInfo({info.used, info.capacity - n}),
+        std::memory_order_relaxed));
+
+    // Inserts fail while used exceeds capacity, so we only have to drain the
+    // excess once.
+    void *buf[kMaxObjectsToMove];
+    for (info = GetSlotInfo(); info.used > info.capacity;
+         info = GetSlotInfo()) {
+      const int got = Pop(absl::MakeSpan(buf, batch_size_));
+      if (got == 0) break;
+      freelist().InsertRange({buf, static_cast<size_t>(got)});
+    }
+    return true;
+  }
+
+  // This is a thin wrapper for the CentralFreeList.
+  ABSL_ATTRIBUTE_ALWAYS_INLINE FreeList &freelist() {
+    return freelist_do_not_access_directly_;
+  }
+
+  int32_t max_capacity() const { return max_capacity_; }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    std::atomic<uint32_t> count;
+  };
+
+  // Reserves room for `batch` and stores it in the ring.  Returns false if the
+  // cache is at capacity or the ring is out of cells.
+  bool Push(absl::Span<void *const> batch) {
+    const int n = batch.size();
+    SizeInfo info = GetSlotInfo();
+    do {
+      if (info.capacity - info.used < n) return false;
+    } while (!slot_info_.compare_exchange_weak(
+        info, SizeInfo({info.used + n, info.capacity}),
+        std::memory_order_relaxed));
+
+    if (!Enqueue(batch)) {
+      Unreserve(n);
+      return false;
+    }
+    return true;
+  }
+
+  // Stores `batch` in a free cell of the ring.  The caller must already have
+  // accounted for the objects in slot_info_.
+  bool Enqueue(absl::Span<void *const> batch) {
+    TC_ASSERT_LE(batch.size(), batch_size_);
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells_[pos & (num_cells_ - 1)];
+      const size_t seq = cell->sequence.load(std::memory_order_acquire);
+      const intptr_t dif =
+          static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (dif == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        // The ring is full of partial batches.
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    memcpy(&objects_[(pos & (num_cells_ - 1)) * batch_size_], batch.data(),
+           sizeof(void *) * batch.size());
+    cell->count.store(batch.size(), std::memory_order_relaxed);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Removes the oldest batch from the ring and stores up to batch.size() of its
+  // objects in `batch`.  Objects that do not fit are put back into the ring.
+  // Returns the number of objects stored in `batch`.
+  int Pop(absl::Span<void *> batch) {
+    if (num_cells_ == 0) return 0;
+
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells_[pos & (num_cells_ - 1)];
+      const size_t seq = cell->sequence.load(std::memory_order_acquire);
+      const intptr_t dif =
+          static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (dif == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        // The ring is empty.
+        return 0;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    const uint32_t n = cell->count.load(std::memory_order_relaxed);
+    const uint32_t taken = std::min<size_t>(n, batch.size());
+    void *rest[kMaxObjectsToMove];
+    void **const entry = &objects_[(pos & (num_cells_ - 1)) * batch_size_];
+    memcpy(batch.data(), entry, sizeof(void *) * taken);
+    memcpy(rest, entry + taken, sizeof(void *) * (n - taken));
+    cell->sequence.store(pos + num_cells_, std::memory_order_release);
+
+    uint32_t released = taken;
+    if (n > taken && !Enqueue({rest, n - taken})) {
+      freelist().InsertRange({rest, n - taken});
+      released = n;
+    }
+
+    const SizeInfo info = Unreserve(released);
+    int low_water_mark = low_water_mark_.load(std::memory_order_relaxed);
+    while (info.used < low_water_mark &&
+           !low_water_mark_.compare_exchange_weak(low_water_mark, info.used,
+                                                  std::memory_order_relaxed)) {
+    }
+    return taken;
+  }
+
+  // Returns up to plunder_pending_ objects, in at most <max_batches> batches,
+  // to the freelist.
+  void ReturnPending(int max_batches) {
+    void *buf[kMaxObjectsToMove];
+    for (; max_batches > 0; --max_batches) {
+      const int pending = plunder_pending_.load(std::memory_order_relaxed);
+      if (pending <= 0) break;
+      const int got = Pop(absl::MakeSpan(
+          buf, std::min<size_t>(batch_size_, pending)));
+      if (got == 0) {
+        plunder_pending_.store(0, std::memory_order_relaxed);
+        break;
+      }
+      plunder_pending_.store(pending - got, std::memory_order_relaxed);
+      freelist().InsertRange({buf, static_cast<size_t>(got)});
+    }
+  }
+
+  // Releases `n` objects worth of capacity.  Returns the updated slot info.
+  SizeInfo Unreserve(int n) {
+    SizeInfo info = GetSlotInfo();
+    SizeInfo updated;
+    do {
+      updated = {info.used - n, info.capacity};
+      TC_ASSERT_GE(updated.used, 0);
+    } while (!slot_info_.compare_exchange_weak(info, updated,
+                                               std::memory_order_relaxed));
+    return updated;
+  }
+
+  // Number of objects currently stored or reserved, and the current capacity.
+  // INVARIANT: [0 <= slot_info_.used <= max_capacity_].  used may temporarily
+  // exceed capacity after ShrinkCache.
+  std::atomic<SizeInfo> slot_info_;
+
+  // Lowest value of "slot_info_.used" since last call to TryPlunder.
+  std::atomic<int32_t> low_water_mark_;
+
+  // As in TransferCache.  Plunders are not expected to run concurrently, so
+  // these are only atomic to keep races benign.
+  std::atomic<int32_t> plunder_pending_{0};
+  std::atomic<int64_t> plunder_window_start_{0};
+
+  // Producers and consumers contend on these, so keep them on separate cache
+  // lines.
+  alignas(ABSL_CACHELINE_SIZE) std::atomic<size_t> enqueue_pos_{0};
+  alignas(ABSL_CACHELINE_SIZE) std::atomic<size_t> dequeue_pos_{0};
+
+  alignas(ABSL_CACHELINE_SIZE) StatsCounter insert_hits_;
+  StatsCounter remove_hits_;
+
+  // Ring of num_cells_ batches; the objects of cell i are stored at
+  // objects_[i * batch_size_].
+  Cell *cells_ = nullptr;
+  void **objects_ = nullptr;
+  size_t num_cells_ = 0;
+  const size_t batch_size_;
+
+  FreeList freelist_do_not_access_directly_;
+
+  Manager *const owner_;
+
+  // Maximum size of the cache.
+  const int32_t max_capacity_;
+
+  // For these we are deliberately fast-and-loose. Some increments may be lost.
+  StatsCounter insert_misses_;
+  StatsCounter remove_misses_;
+
+  MissCounts insert_object_misses_;
+  MissCounts remove_object_misses_;
+  MissForecaster forecaster_;
 } ABSL_CACHELINE_ALIGNED;
 
 template <typename Manager>
@@ -27,6 +27,9 @@ struct TransferCacheStats {
   size_t remove_hits;
   size_t remove_misses;
   size_t remove_object_misses;
+  // Object misses in the last resize interval, and the number forecast for it.
+  size_t interval_object_misses;
+  size_t forecast_object_misses;
   size_t used;
   size_t capacity;
   size_t max_capacity;
@@ -320,6 +320,40 @@ TYPED_TEST_P(TransferCacheTest, Plunder) {
   EXPECT_EQ(env.transfer_cache().tc_length(), 0);
 }
 
+TYPED_TEST_P(TransferCacheTest, PlunderWithPolicy) {
+  TypeParam env;
+  constexpr int B = TypeParam::kBatchSize;
+  auto plunder = [&](int64_t now) {
+    env.transfer_cache().TryPlunder(
+        kSizeClass, {.now = now, .idle = 100, .max_batches = 1});
+  };
+
+  env.Insert(4 * B);
+  // Starts the window, as the cache was empty before.
+  plunder(100);
+  EXPECT_EQ(env.transfer_cache().tc_length(), 4 * B);
+  // However often plunders happen, objects are only returned once they stayed
+  // unused for the whole window, and then a batch at a time.
+  plunder(150);
+  EXPECT_EQ(env.transfer_cache().tc_length(), 4 * B);
+  plunder(200);
+  EXPECT_EQ(env.transfer_cache().tc_length(), 3 * B);
+  plunder(201);
+  EXPECT_EQ(env.transfer_cache().tc_length(), 2 * B);
+
+  // Objects handed out in the meantime are not returned.
+  env.Remove(B);
+  env.Insert(B);
+  plunder(202);
+  EXPECT_EQ(env.transfer_cache().tc_length(), B);
+  plunder(203);
+  EXPECT_EQ(env.transfer_cache().tc_length(), B);
+
+  // The rest stayed unused over the following window.
+  plunder(300);
+  EXPECT_EQ(env.transfer_cache().tc_length(), 0);
+}
+
 // PickCoprimeBatchSize picks a batch size in [2, max_batch_size) that is
 // coprime with 2^32.  We choose the largest possible batch size within that
 // constraint to minimize the number of iterations of insert/remove required.
@@ -414,7 +448,7 @@ TYPED_TEST_P(TransferCacheTest, b172283201) {
 REGISTER_TYPED_TEST_SUITE_P(TransferCacheTest, IsolatedSmoke, ReadStats,
                             FetchesFromFreelist, PartialFetchFromFreelist,
                             PushesToFreelist, WrappingWorks, SingleItemSmoke,
-                            Plunder, b172283201);
+                            Plunder, PlunderWithPolicy, b172283201);
 
 template <typename Env>
 using FuzzTest = ::testing::Test;
@@ -665,12 +699,68 @@ TEST(ShardedTransferCacheManagerTest, ShardsOnDemand) {
   }
 }
 
+TEST(ShardedTransferCacheManagerTest, AdaptiveActivation) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  using ShardedManager = FakeShardedTransferCacheEnvironment::ShardedManager;
+  constexpr int kNumShards = ShardedManager::kMinShardsAllowed;
+  constexpr int kAccesses = ShardedManager::kMinCrossShardAccessesToActivate;
+  FakeShardedTransferCacheManager::SetAdaptiveCache(true);
+  {
+    FakeShardedTransferCacheEnvironment env(kNumShards,
+                                            /*use_generic_cache=*/true);
+    ShardedManager& manager = env.sharded_manager();
+
+    // Sharded cache manager uses a flexible transfer cache.
+    env.transfer_cache_manager().SetPartialLegacyTransferCache(true);
+
+    // Nothing is sharded until we observe traffic across cache domains.
+    for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+      EXPECT_FALSE(manager.should_use(size_class));
+    }
+    EXPECT_EQ(manager.NumActiveSizeClasses(), 0);
+
+    // Accesses from a single shard do not need the sharded cache.
+    env.SetCurrentCpu(0);
+    for (int i = 0; i < 2 * kAccesses; ++i) {
+      manager.RecordUnshardedAccess(kSizeClass);
+    }
+    manager.UpdateActiveSizeClasses();
+    EXPECT_FALSE(manager.should_use(kSizeClass));
+
+    // Bouncing between shards 0 and 1 activates the size class.
+    for (int i = 0; i < kAccesses; ++i) {
+      env.SetCurrentCpu(i % 2 == 0 ? 2 : 0);
+      manager.RecordUnshardedAccess(kSizeClass);
+    }
+    manager.UpdateActiveSizeClasses();
+    EXPECT_TRUE(manager.should_use(kSizeClass));
+    EXPECT_EQ(manager.NumActiveSizeClasses(), 1);
+
+    // Objects are now cached in the shards.
+    void* ptr;
+    env.central_freelist().AllocateBatch({&ptr, 1});
+    env.SetCurrentCpu(0);
+    manager.Push(kSizeClass, ptr);
+    EXPECT_EQ(manager.tc_length(0, kSizeClass), 1);
+  }
+  FakeShardedTransferCacheManager::SetAdaptiveCache(false);
+}
+
 namespace unit_tests {
 using Env = FakeTransferCacheEnvironment<internal_transfer_cache::TransferCache<
     MockCentralFreeList, FakeTransferCacheManager>>;
 INSTANTIATE_TYPED_TEST_SUITE_P(TransferCache, TransferCacheTest,
                                ::testing::Types<Env>);
 
+using LockFreeEnv = FakeTransferCacheEnvironment<
+    internal_transfer_cache::LockFreeTransferCache<MockCentralFreeList,
+                                                   FakeTransferCacheManager>>;
+INSTANTIATE_TYPED_TEST_SUITE_P(LockFreeTransferCache, TransferCacheTest,
+                               ::testing::Types<LockFreeEnv>);
+
 }  // namespace unit_tests
 
 namespace fuzz_tests {
@@ -681,6 +771,12 @@ using Env = FakeTransferCacheEnvironment<internal_transfer_cache::TransferCache<
     MockCentralFreeList, FakeTransferCacheManager>>;
 INSTANTIATE_TYPED_TEST_SUITE_P(TransferCache, FuzzTest, ::testing::Types<Env>);
 
+using LockFreeEnv = FakeTransferCacheEnvironment<
+    internal_transfer_cache::LockFreeTransferCache<MockCentralFreeList,
+                                                   FakeTransferCacheManager>>;
+INSTANTIATE_TYPED_TEST_SUITE_P(LockFreeTransferCache, FuzzTest,
+                               ::testing::Types<LockFreeEnv>);
+
 }  // namespace fuzz_tests
 
 namespace resize_tests {
@@ -768,6 +864,58 @@ TEST(RealTransferCacheTest, DoesNotLeakCapacity) {
   testing::Mock::VerifyAndClear(&m);
 }
 
+TEST(RealTransferCacheTest, ForecastPeriodicMisses) {
+  using internal_transfer_cache::ForecastPeriodicMisses;
+  // history[0] is the most recent interval.
+  EXPECT_EQ(ForecastPeriodicMisses({0, 0, 0, 0, 0, 0, 0, 0}), 0);
+  // Steady misses are left to the reactive resizing.
+  EXPECT_EQ(ForecastPeriodicMisses({50, 50, 50, 50, 50, 50, 50, 50}), 0);
+  // A burst every 4 intervals, the last of which was 3 intervals ago.
+  EXPECT_EQ(ForecastPeriodicMisses({0, 0, 0, 100, 0, 0, 0, 100}), 100);
+  // The burst just happened, so the next interval should be quiet.
+  EXPECT_EQ(ForecastPeriodicMisses({100, 0, 0, 0, 100, 0, 0, 0}), 0);
+  // Too short to tell.
+  EXPECT_EQ(ForecastPeriodicMisses({0, 100}), 0);
+}
+
+class MissForecasterTest : public ::testing::Test {
+ protected:
+  static int64_t FakeClock() { return clock_; }
+  static double GetFakeClockFrequency() {
+    return absl::ToDoubleNanoseconds(absl::Seconds(2));
+  }
+  static void Advance(absl::Duration d) {
+    clock_ += absl::ToDoubleSeconds(d) * GetFakeClockFrequency();
+  }
+
+  static int64_t clock_;
+  internal_transfer_cache::MissForecaster forecaster_{
+      Clock{.now = FakeClock, .freq = GetFakeClockFrequency}};
+};
+
+int64_t MissForecasterTest::clock_{1234};
+
+TEST_F(MissForecasterTest, ForecastsBursts) {
+  using internal_transfer_cache::MissForecaster;
+  constexpr size_t kPeriod = 3;
+  constexpr size_t kBurst = 1000;
+  size_t forecast = 0;
+  for (size_t i = 0; i < MissForecaster::kEpochs; ++i) {
+    Advance(MissForecaster::kEpochLength);
+    const size_t misses = i % kPeriod == 0 ? kBurst : 0;
+    if (i >= 2 * kPeriod) {
+      // Once the period has repeated, every burst is forecast one interval
+      // ahead, and no other interval is.
+      EXPECT_EQ(forecast, misses) << i;
+    }
+    forecast = forecaster_.Update(misses);
+    EXPECT_EQ(forecaster_.last_misses(), misses);
+  }
+  // The last interval was a burst, and was forecast as one.
+  EXPECT_EQ(forecaster_.last_forecast(), kBurst);
+  EXPECT_EQ(forecast, 0);
+}
+
 template <typename Env>
 using RealTransferCacheTest = ::testing::Test;
 TYPED_TEST_SUITE_P(RealTransferCacheTest);
@@ -811,6 +959,12 @@ using TransferCacheRealEnv = MultiSizeClassTransferCacheEnvironment<
 INSTANTIATE_TYPED_TEST_SUITE_P(TransferCache, RealTransferCacheTest,
                                ::testing::Types<TransferCacheRealEnv>);
 
+using LockFreeTransferCacheRealEnv = MultiSizeClassTransferCacheEnvironment<
+    internal_transfer_cache::LockFreeTransferCache<
+        CentralFreeList, FakeMultiClassLockFreeTransferCacheManager>>;
+INSTANTIATE_TYPED_TEST_SUITE_P(LockFreeTransferCache, RealTransferCacheTest,
+                               ::testing::Types<LockFreeTransferCacheRealEnv>);
+
 }  // namespace resize_tests
 
 }  // namespace
@@ -0,0 +1,210 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/tuning_state.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <string>
+#include <type_traits>
+
+#include "absl/strings/string_view.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/cpu_cache.h"
+#include "tcmalloc/huge_pages.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/sysinfo.h"
+#include "tcmalloc/internal_malloc_extension.h"
+#include "tcmalloc/page_allocator.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/transfer_cache.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// The blob is a Header, then num_limits uint32_t HugeCache limits, then
+// num_classes TuningState::SizeClass entries, all in the (little endian)
+// layout of this build.
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_limits;
+  uint32_t num_classes;
+};
+
+static_assert(std::is_trivially_copyable_v<TuningState::SizeClass>);
+static_assert(sizeof(TuningState::SizeClass) == 12);
+
+template <typename T>
+void Append(std::string& out, const T* data, size_t n) {
+  out.append(reinterpret_cast<const char*>(data), n * sizeof(T));
+}
+
+}  // namespace
+
+std::string EncodeTuningState(const TuningState& state) {
+  const Header header = {TuningState::kMagic, TuningState::kVersion,
+                         static_cast<uint32_t>(state.huge_cache_limits.size()),
+                         static_cast<uint32_t>(state.size_classes.size())};
+  std::string out;
+  out.reserve(sizeof(header) +
+              sizeof(uint32_t) * state.huge_cache_limits.size() +
+              sizeof(TuningState::SizeClass) * state.size_classes.size());
+  Append(out, &header, 1);
+  Append(out, state.huge_cache_limits.data(), state.huge_cache_limits.size());
+  Append(out, state.size_classes.data(), state.size_classes.size());
+  return out;
+}
+
+std::optional<TuningState> DecodeTuningState(absl::string_view blob) {
+  Header header;
+  if (blob.size() < sizeof(header)) return std::nullopt;
+  memcpy(&header, blob.data(), sizeof(header));
+  blob.remove_prefix(sizeof(header));
+  if (header.magic != TuningState::kMagic ||
+      header.version != TuningState::kVersion) {
+    return std::nullopt;
+  }
+  // Compare in 64 bits so that neither count can overflow the expected size.
+  const uint64_t expected =
+      uint64_t{sizeof(uint32_t)} * header.num_limits +
+      uint64_t{sizeof(TuningState::SizeClass)} * header.num_classes;
+  if (blob.size() != expected) return std::nullopt;
+
+  TuningState state;
+  state.huge_cache_limits.resize(header.num_limits);
+  memcpy(state.huge_cache_limits.data(), blob.data(),
+         sizeof(uint32_t) * header.num_limits);
+  blob.remove_prefix(sizeof(uint32_t) * header.num_limits);
+  state.size_classes.resize(header.num_classes);
+  memcpy(state.size_classes.data(), blob.data(),
+         sizeof(TuningState::SizeClass) * header.num_classes);
+
+  // ApplyTuningState looks sizes up by binary search.
+  for (size_t i = 1; i < state.size_classes.size(); ++i) {
+    if (state.size_classes[i - 1].size >= state.size_classes[i].size) {
+      return std::nullopt;
+    }
+  }
+  return state;
+}
+
+TuningState CaptureTuningState() {
+  TuningState state;
+  const size_t partitions = tc_globals.numa_topology().active_partitions();
+  HugeLength limits[kNumaPartitions];
+  {
+    // Nothing may allocate while we hold pageheap_lock.
+    PageHeapSpinLockHolder l;
+    for (size_t partition = 0; partition < partitions; ++partition) {
+      limits[partition] = tc_globals.page_allocator().HugeCacheLimit(partition);
+    }
+  }
+  for (size_t partition = 0; partition < partitions; ++partition) {
+    state.huge_cache_limits.push_back(limits[partition].raw_num());
+  }
+
+  const bool cpu_cache_active = tc_globals.CpuCacheActive();
+  const int num_cpus = NumCPUs();
+  for (size_t size_class = 1; size_class < kNumBaseClasses; ++size_class) {
+    const size_t size = tc_globals.sizemap().class_to_size(size_class);
+    if (size == 0) continue;
+    TuningState::SizeClass entry = {};
+    entry.size = size;
+    if (cpu_cache_active) {
+      const auto& cpu_cache = tc_globals.cpu_cache();
+      size_t capacity = 0;
+      int populated = 0;
+      for (int cpu = 0; cpu < num_cpus; ++cpu) {
+        if (!cpu_cache.HasPopulated(cpu)) continue;
+        capacity += cpu_cache.GetCapacityOfSizeClass(cpu, size_class);
+        ++populated;
+      }
+      if (populated > 0) {
+        entry.cpu_cache_capacity = std::min<size_t>(
+            capacity / populated, std::numeric_limits<uint16_t>::max());
+      }
+      const size_t batch_length = cpu_cache.BatchLength(size_class);
+      if (batch_length !=
+          tc_globals.sizemap().num_objects_to_move(size_class)) {
+        entry.batch_length = batch_length;
+      }
+    }
+    entry.transfer_cache_capacity =
+        tc_globals.transfer_cache().GetStats(size_class).capacity;
+    state.size_classes.push_back(entry);
+  }
+  return state;
+}
+
+void ApplyTuningState(const TuningState& state) {
+  const size_t partitions = tc_globals.numa_topology().active_partitions();
+  {
+    PageHeapSpinLockHolder l;
+    for (size_t partition = 0;
+         partition < std::min(partitions, state.huge_cache_limits.size());
+         ++partition) {
+      tc_globals.page_allocator().RaiseHugeCacheLimit(
+          partition, NHugePages(state.huge_cache_limits[partition]));
+    }
+  }
+
+  for (size_t size_class = 1; size_class < kNumBaseClasses; ++size_class) {
+    const size_t size = tc_globals.sizemap().class_to_size(size_class);
+    if (size == 0) continue;
+    auto entry = std::lower_bound(
+        state.size_classes.begin(), state.size_classes.end(), size,
+        [](const TuningState::SizeClass& e, size_t s) { return e.size < s; });
+    if (entry == state.size_classes.end() || entry->size != size) continue;
+
+    for (size_t partition = 0; partition < partitions; ++partition) {
+      const size_t c = size_class + partition * kNumBaseClasses;
+      tc_globals.cpu_cache().SetWarmCapacity(c, entry->cpu_cache_capacity);
+      if (entry->batch_length != 0) {
+        tc_globals.cpu_cache().SetBatchLength(c, entry->batch_length);
+      }
+      tc_globals.transfer_cache().SetCapacity(c,
+                                              entry->transfer_cache_capacity);
+    }
+  }
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+extern "C" void MallocExtension_Internal_ExportTuningState(std::string* ret) {
+  tcmalloc::tcmalloc_internal::tc_globals.InitIfNecessary();
+  *ret = tcmalloc::tcmalloc_internal::EncodeTuningState(
+      tcmalloc::tcmalloc_internal::CaptureTuningState());
+}
+
+extern "C" bool MallocExtension_Internal_ImportTuningState(const char* data,
+                                                           size_t size) {
+  tcmalloc::tcmalloc_internal::tc_globals.InitIfNecessary();
+  std::optional<tcmalloc::tcmalloc_internal::TuningState> state =
+      tcmalloc::tcmalloc_internal::DecodeTuningState(
+          absl::string_view(data, size));
+  if (!state.has_value()) return false;
+  tcmalloc::tcmalloc_internal::ApplyTuningState(*state);
+  return true;
+}
@@ -0,0 +1,77 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_TUNING_STATE_H_
+#define TCMALLOC_TUNING_STATE_H_
+
+#include <stdint.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// What the caches learn about a workload while a process runs, in a form that
+// a later process can start from (see MallocExtension::ExportTuningState).
+struct TuningState {
+  // "TCTS", little endian.
+  static constexpr uint32_t kMagic = 0x53544354;
+  static constexpr uint32_t kVersion = 1;
+
+  struct SizeClass {
+    // The object size of the size class, which identifies it across processes
+    // whose size classes differ.
+    uint32_t size;
+    // The mean capacity of the populated per-CPU caches.
+    uint16_t cpu_cache_capacity;
+    // The per-CPU cache batch length, or 0 for the default.
+    uint16_t batch_length;
+    // The capacity of the transfer cache.
+    uint32_t transfer_cache_capacity;
+  };
+
+  // The HugeCache limit of each NUMA partition, in hugepages.
+  std::vector<uint32_t> huge_cache_limits;
+  // Ordered by size.
+  std::vector<SizeClass> size_classes;
+};
+
+// Encodes <state> as a blob that DecodeTuningState reads back.
+std::string EncodeTuningState(const TuningState& state);
+
+// Returns the state encoded in <blob>, or std::nullopt if it is not a blob
+// from EncodeTuningState.
+std::optional<TuningState> DecodeTuningState(absl::string_view blob);
+
+// Returns the state of the caches of this process.  Only the size classes of
+// the first NUMA partition are included; the others learn alike.
+TuningState CaptureTuningState();
+
+// Starts the caches of this process from <state>: size classes with the same
+// object size take its batch lengths and transfer cache capacities, and cpus
+// populated from now on start with its per-CPU cache capacities.  HugeCache
+// limits are only ever raised.
+void ApplyTuningState(const TuningState& state);
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_TUNING_STATE_H_
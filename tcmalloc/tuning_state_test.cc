@@ -0,0 +1,111 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/tuning_state.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "gtest/gtest.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/static_vars.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+TuningState TestState() {
+  TuningState state;
+  state.huge_cache_limits = {12, 34};
+  state.size_classes = {{8, 100, 0, 64}, {16, 2000, 64, 1024}, {1024, 7, 4, 0}};
+  return state;
+}
+
+TEST(TuningStateTest, RoundTrip) {
+  const TuningState state = TestState();
+  const std::string blob = EncodeTuningState(state);
+  std::optional<TuningState> decoded = DecodeTuningState(blob);
+  ASSERT_TRUE(decoded.has_value());
+  EXPECT_EQ(decoded->huge_cache_limits, state.huge_cache_limits);
+  ASSERT_EQ(decoded->size_classes.size(), state.size_classes.size());
+  for (size_t i = 0; i < state.size_classes.size(); ++i) {
+    EXPECT_EQ(decoded->size_classes[i].size, state.size_classes[i].size);
+    EXPECT_EQ(decoded->size_classes[i].cpu_cache_capacity,
+              state.size_classes[i].cpu_cache_capacity);
+    EXPECT_EQ(decoded->size_classes[i].batch_length,
+              state.size_classes[i].batch_length);
+    EXPECT_EQ(decoded->size_classes[i].transfer_cache_capacity,
+              state.size_classes[i].transfer_cache_capacity);
+  }
+}
+
+TEST(TuningStateTest, RejectsInvalidBlobs) {
+  const std::string blob = EncodeTuningState(TestState());
+  EXPECT_FALSE(DecodeTuningState("").has_value());
+  EXPECT_FALSE(DecodeTuningState("not a tuning state").has_value());
+  EXPECT_FALSE(
+      DecodeTuningState(blob.substr(0, blob.size() - 1)).has_value());
+  EXPECT_FALSE(DecodeTuningState(blob + "x").has_value());
+
+  std::string bad_version = blob;
+  bad_version[4] ^= 0xff;
+  EXPECT_FALSE(DecodeTuningState(bad_version).has_value());
+
+  TuningState unsorted = TestState();
+  std::swap(unsorted.size_classes[0], unsorted.size_classes[1]);
+  EXPECT_FALSE(DecodeTuningState(EncodeTuningState(unsorted)).has_value());
+}
+
+TEST(TuningStateTest, ExportImport) {
+  // Allocate something, so that the caches have learned a little.
+  void* ptr = ::operator new(100);
+  ::operator delete(ptr);
+
+  const std::string blob = MallocExtension::ExportTuningState();
+  std::optional<TuningState> state = DecodeTuningState(blob);
+  ASSERT_TRUE(state.has_value());
+  EXPECT_EQ(state->huge_cache_limits.size(),
+            tc_globals.numa_topology().active_partitions());
+  EXPECT_FALSE(state->size_classes.empty());
+
+  // A process's own state is a valid starting point.
+  ASSERT_TRUE(MallocExtension::ImportTuningState(blob));
+  EXPECT_FALSE(MallocExtension::ImportTuningState("garbage"));
+}
+
+TEST(TuningStateTest, RaisesHugeCacheLimits) {
+  TuningState state = CaptureTuningState();
+  for (uint32_t& limit : state.huge_cache_limits) {
+    limit += 5;
+  }
+  ApplyTuningState(state);
+  const TuningState applied = CaptureTuningState();
+  ASSERT_EQ(applied.huge_cache_limits.size(), state.huge_cache_limits.size());
+  for (size_t i = 0; i < state.huge_cache_limits.size(); ++i) {
+    if (state.huge_cache_limits[i] == 5) {
+      // Hugepage-aware allocation is off, so there is no HugeCache.
+      continue;
+    }
+    EXPECT_GE(applied.huge_cache_limits[i], state.huge_cache_limits[i]);
+  }
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
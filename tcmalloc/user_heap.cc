@@ -0,0 +1,151 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/user_heap.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <new>
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/numeric/bits.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/page_allocator.h"
+#include "tcmalloc/page_heap_allocator.h"
+#include "tcmalloc/pagemap.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+#include "tcmalloc/static_vars.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+ABSL_CONST_INIT PageHeapAllocator<UserHeap> heap_allocator
+    ABSL_GUARDED_BY(pageheap_lock);
+ABSL_CONST_INIT bool heap_allocator_inited ABSL_GUARDED_BY(pageheap_lock) =
+    false;
+
+}  // namespace
+
+void* UserHeap::Allocate(size_t size, size_t alignment) {
+  TC_ASSERT(absl::has_single_bit(alignment));
+  size = std::max<size_t>(size, 1);
+  alignment = std::max(alignment, static_cast<size_t>(kAlignment));
+
+  absl::base_internal::SpinLockHolder h(&lock_);
+  if (alignment > kPageSize || size > kMaxSpanBytes / 4) {
+    // Carving this from a shared span would waste too much of it.
+    Span* span =
+        NewSpan(BytesToLengthCeil(size), BytesToLengthCeil(alignment));
+    if (span == nullptr) return nullptr;
+    stats_.allocated_bytes += size;
+    return span->start_address();
+  }
+
+  uintptr_t result = (current_ + alignment - 1) & ~(alignment - 1);
+  if (current_ == 0 || result + size > end_) {
+    Span* span = NewSpan(BytesToLengthCeil(next_span_bytes_), Length(1));
+    if (span == nullptr) return nullptr;
+    next_span_bytes_ = std::min(next_span_bytes_ * 2, kMaxSpanBytes);
+    // Spans are page aligned, so the object is at the start.
+    result = reinterpret_cast<uintptr_t>(span->start_address());
+    end_ = result + span->bytes_in_span();
+  }
+  current_ = result + size;
+  stats_.allocated_bytes += size;
+  return reinterpret_cast<void*>(result);
+}
+
+Span* UserHeap::NewSpan(Length n, Length align) {
+  // Nothing takes lock_ while holding pageheap_lock, so lock_ may be held
+  // while allocating pages.
+  MemoryTag tag = MemoryTag::kNormal;
+  if (tc_globals.numa_topology().numa_aware()) {
+    tag = NumaNormalTag(tc_globals.numa_topology().GetCurrentPartition());
+  }
+  // The objects are freed together, so the span is only expected to live as
+  // long as the heap, which is usually short.
+  Span* span = tc_globals.page_allocator().NewAligned(
+      n, align,
+      {1, AccessDensityPrediction::kDense, SpanLifetime::kShortLived}, tag);
+  if (span == nullptr) return nullptr;
+  // Map every page to the span, not just the first and last, so that
+  // GetOwnership recognizes all of the objects.  Size class 0 tells the rest
+  // of TCMalloc that the span does not hold small objects.
+  tc_globals.pagemap().RegisterSizeClass(span, 0);
+  spans_.prepend(span);
+  ++stats_.spans;
+  stats_.span_bytes += span->bytes_in_span();
+  return span;
+}
+
+void UserHeap::Release() {
+  SpanList spans;
+  {
+    absl::base_internal::SpinLockHolder h(&lock_);
+    while (!spans_.empty()) {
+      Span* span = spans_.first();
+      spans_.remove(span);
+      spans.prepend(span);
+    }
+    stats_ = Stats();
+    current_ = end_ = 0;
+    next_span_bytes_ = kMinSpanBytes;
+  }
+  if (spans.empty()) return;
+
+  PageHeapSpinLockHolder l;
+  while (!spans.empty()) {
+    Span* span = spans.first();
+    spans.remove(span);
+    tc_globals.page_allocator().Delete(span, /*objects_per_span=*/1,
+                                       GetMemoryTag(span->start_address()));
+  }
+}
+
+UserHeap::Stats UserHeap::stats() const {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  return stats_;
+}
+
+UserHeap* UserHeap::Create() {
+  tc_globals.InitIfNecessary();
+  void* storage;
+  {
+    PageHeapSpinLockHolder l;
+    if (!heap_allocator_inited) {
+      heap_allocator.Init(&tc_globals.arena());
+      heap_allocator_inited = true;
+    }
+    storage = heap_allocator.New();
+  }
+  return new (storage) UserHeap();
+}
+
+void UserHeap::Destroy(UserHeap* heap) {
+  heap->~UserHeap();
+  PageHeapSpinLockHolder l;
+  heap_allocator.Delete(heap);
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,93 @@
+// Copyright 2024 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_USER_HEAP_H_
+#define TCMALLOC_USER_HEAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// A heap partition for MallocExtension::CreateHeap.  Objects are carved out of
+// spans that belong to this heap alone, so they never share a span with
+// objects of other heaps, or of malloc, and Release() returns every span to
+// the page allocator at once, without visiting the objects.
+//
+// The spans grow geometrically from kMinSpanBytes to kMaxSpanBytes, so that
+// small heaps stay small, and objects that would waste a large part of a span
+// get spans of their own.
+class UserHeap {
+ public:
+  static constexpr size_t kMinSpanBytes = size_t{64} << 10;
+  static constexpr size_t kMaxSpanBytes = kHugePageSize;
+
+  struct Stats {
+    // The spans held, and their total size.
+    size_t spans = 0;
+    size_t span_bytes = 0;
+    // The bytes requested by allocations since the last Release().
+    size_t allocated_bytes = 0;
+  };
+
+  constexpr UserHeap() = default;
+  ~UserHeap() { Release(); }
+
+  UserHeap(const UserHeap&) = delete;
+  UserHeap& operator=(const UserHeap&) = delete;
+
+  // Returns <size> bytes aligned to <alignment>, a power of two, or nullptr if
+  // out of memory.
+  void* Allocate(size_t size, size_t alignment) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Returns all of the spans to the page allocator, freeing every object
+  // allocated from this heap.  The heap may be used again afterwards.
+  void Release() ABSL_LOCKS_EXCLUDED(lock_);
+
+  Stats stats() const ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Allocates and frees UserHeaps, from TCMalloc's metadata.
+  static UserHeap* Create();
+  static void Destroy(UserHeap* heap);
+
+ private:
+  // Allocates a span of <n> pages aligned to <align> pages and adds it to
+  // spans_.
+  Span* NewSpan(Length n, Length align) ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  mutable absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  SpanList spans_ ABSL_GUARDED_BY(lock_);
+  Stats stats_ ABSL_GUARDED_BY(lock_);
+  // The unused part of the span that small objects are carved from.
+  uintptr_t current_ ABSL_GUARDED_BY(lock_) = 0;
+  uintptr_t end_ ABSL_GUARDED_BY(lock_) = 0;
+  // The size of the next span for small objects.
+  size_t next_span_bytes_ ABSL_GUARDED_BY(lock_) = kMinSpanBytes;
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_USER_HEAP_H_
@@ -44,6 +44,10 @@ build_variants = [
         "name": "256k_pages_numa_aware",
         "copts": ["-DTCMALLOC_INTERNAL_256K_PAGES", "-DTCMALLOC_INTERNAL_NUMA_AWARE"],
     },
+    {
+        "name": "allocation_trace",
+        "copts": ["-DTCMALLOC_INTERNAL_8K_PAGES", "-DTCMALLOC_INTERNAL_ALLOCATION_TRACE"],
+    },
 ]
 
 test_variants = [